@@ -55,6 +55,7 @@
 #include "redblack.h"
 #include "drsyms.h"
 #include "drsymcache.h"
+#include "prof.h"
 #ifdef MACOS
 # include <sys/syscall.h>
 # include <sys/mman.h>
@@ -94,6 +95,7 @@ static int sysnum_mapcmf = -1;
 static int sysnum_munmap = -1;
 static int sysnum_valloc = -1;
 static int sysnum_vfree = -1;
+static int sysnum_vprotect = -1;
 int sysnum_continue = -1;
 int sysnum_setcontext = -1;
 int sysnum_RaiseException = -1;
@@ -108,6 +110,9 @@ static int sysnum_SetInformationProcess = -1;
 uint num_mallocs;
 uint num_large_mallocs;
 uint num_frees;
+uint malloc_entry_slabs_allocated;
+uint num_lazy_modules;
+uint num_lazy_searches;
 #endif
 
 /* points at the per-malloc API to use */
@@ -2130,6 +2135,42 @@ enumerate_set_syms_cb(drsym_info_t *info, drsym_error_t status, void *data)
     return true; /* keep iterating */
 }
 
+/* After a successful search for "prefix*" or "*suffix", deals with the
+ * possible routines the search should have covered but did not find.
+ */
+static void
+find_alloc_regex_unmatched(set_enum_data_t *edata, const char *prefix,
+                           const char *suffix)
+{
+    uint i;
+    for (i = 0; i < edata->num_possible; i++) {
+        const char *name = edata->possible[i].name;
+        if (!edata->processed[i] &&
+            ((prefix != NULL && strstr(name, prefix) == name) ||
+             (suffix != NULL && strlen(name) >= strlen(suffix) &&
+              strcmp(name + strlen(name) - strlen(suffix), suffix) == 0))) {
+            app_pc pc = NULL;
+            /* XXX: somehow drsym_search_symbols misses msvcrt!malloc
+             * (dbghelp 6.11+ w/ full search does find it but full takes too
+             * long) so we always try an export lookup
+             */
+            /* can't look up wildcard in exports */
+            if (edata->wildcard_name == NULL)
+                pc = (app_pc) dr_get_proc_address(edata->mod->handle, name);
+            if (pc != NULL) {
+                LOG(2, "regex didn't match %s but it's an export\n", name);
+                add_to_alloc_set(edata, pc, i);
+            } else {
+                LOG(2, "marking %s as processed since regex didn't match\n", name);
+                ASSERT(edata->wildcard_name == NULL, "shouldn't get here");
+                edata->processed[i] = true;
+                if (alloc_ops.use_symcache)
+                    drsymcache_add(edata->mod, edata->possible[i].name, 0);
+            }
+        }
+    }
+}
+
 /* Only supports "\w*" && prefix=="\w", "*\w" && suffix=="\w",
  * or a wildcard for which we want to wrap all matches
  */
@@ -2137,7 +2178,6 @@ static void
 find_alloc_regex(set_enum_data_t *edata, const char *regex,
                  const char *prefix, const char *suffix)
 {
-    uint i;
     bool full = false;
 #ifdef WINDOWS
     if (edata->is_libc || edata->is_libcpp) {
@@ -2154,35 +2194,82 @@ find_alloc_regex(set_enum_data_t *edata, const char *regex,
     }
 #endif
     if (lookup_all_symbols(edata->mod, regex, full,
-                           enumerate_set_syms_cb, (void *)edata)) {
-        for (i = 0; i < edata->num_possible; i++) {
-            const char *name = edata->possible[i].name;
-            if (!edata->processed[i] &&
-                ((prefix != NULL && strstr(name, prefix) == name) ||
-                 (suffix != NULL && strlen(name) >= strlen(suffix) &&
-                  strcmp(name + strlen(name) - strlen(suffix), suffix) == 0))) {
-                app_pc pc = NULL;
-                /* XXX: somehow drsym_search_symbols misses msvcrt!malloc
-                 * (dbghelp 6.11+ w/ full search does find it but full takes too
-                 * long) so we always try an export lookup
-                 */
-                /* can't look up wildcard in exports */
-                if (edata->wildcard_name == NULL)
-                    pc = (app_pc) dr_get_proc_address(edata->mod->handle, name);
-                if (pc != NULL) {
-                    LOG(2, "regex didn't match %s but it's an export\n", name);
-                    add_to_alloc_set(edata, pc, i);
-                } else {
-                    LOG(2, "marking %s as processed since regex didn't match\n", name);
-                    ASSERT(edata->wildcard_name == NULL, "shouldn't get here");
-                    edata->processed[i] = true;
-                    if (alloc_ops.use_symcache)
-                        drsymcache_add(edata->mod, edata->possible[i].name, 0);
-                }
-            }
+                           enumerate_set_syms_cb, (void *)edata))
+        find_alloc_regex_unmatched(edata, prefix, suffix);
+    else
+        LOG(2, "WARNING: failed to look up symbols: %s\n", regex);
+}
+
+/* A "prefix*" or "*suffix" pattern for find_alloc_regexes() */
+typedef struct _alloc_regex_t {
+    const char *regex;
+    const char *prefix;
+    const char *suffix;
+} alloc_regex_t;
+
+typedef struct _multi_regex_data_t {
+    set_enum_data_t *edata;
+    const alloc_regex_t *regexes;
+    uint num_regexes;
+} multi_regex_data_t;
+
+static inline bool
+alloc_regex_matches(const alloc_regex_t *re, const char *name)
+{
+    size_t len, suffix_len;
+    if (re->prefix != NULL)
+        return strncmp(name, re->prefix, strlen(re->prefix)) == 0;
+    ASSERT(re->suffix != NULL, "need a prefix or a suffix");
+    len = strlen(name);
+    /* PECOFF and ELF names can have "()" at the end */
+    if (len > 2 && name[len-2] == '(' && name[len-1] == ')')
+        len -= 2;
+    suffix_len = strlen(re->suffix);
+    return (len >= suffix_len &&
+            strncmp(name + len - suffix_len, re->suffix, suffix_len) == 0);
+}
+
+static bool
+enumerate_multi_regex_cb(drsym_info_t *info, drsym_error_t status, void *data)
+{
+    multi_regex_data_t *mdata = (multi_regex_data_t *) data;
+    uint i;
+    for (i = 0; i < mdata->num_regexes; i++) {
+        /* one match suffices: enumerate_set_syms_cb() checks every routine */
+        if (alloc_regex_matches(&mdata->regexes[i], info->name))
+            return enumerate_set_syms_cb(info, status, mdata->edata);
+    }
+    return true; /* keep iterating */
+}
+
+/* Without a fast search (i.e., for anything but PDB), each regex search is
+ * a walk over every symbol in the module, which for large C++ modules is
+ * slow.  We instead walk once, matching all of the patterns together.
+ */
+static void
+find_alloc_regexes(set_enum_data_t *edata, const alloc_regex_t *regexes,
+                   uint num_regexes, bool has_fast_search)
+{
+    multi_regex_data_t mdata;
+    uint i;
+    if (has_fast_search) {
+        for (i = 0; i < num_regexes; i++) {
+            find_alloc_regex(edata, regexes[i].regex, regexes[i].prefix,
+                             regexes[i].suffix);
         }
+        return;
+    }
+    ASSERT(edata->wildcard_name == NULL, "wildcards need their own search");
+    mdata.edata = edata;
+    mdata.regexes = regexes;
+    mdata.num_regexes = num_regexes;
+    /* An empty pattern matches every symbol */
+    if (lookup_all_symbols(edata->mod, "", false, enumerate_multi_regex_cb,
+                           (void *)&mdata)) {
+        for (i = 0; i < num_regexes; i++)
+            find_alloc_regex_unmatched(edata, regexes[i].prefix, regexes[i].suffix);
     } else
-        LOG(2, "WARNING: failed to look up symbols: %s\n", regex);
+        LOG(2, "WARNING: failed to enumerate symbols for %d patterns\n", num_regexes);
 }
 
 #if defined(WINDOWS) && defined(X64)
@@ -2390,9 +2477,13 @@ find_alloc_routines(const module_data_t *mod, const possible_alloc_routine_t *po
                 }
 #endif
             } else if (possible == possible_cpp_routines) {
+                static const alloc_regex_t cpp_regexes[] = {
+                    {"operator new*", "operator new", NULL},
+                    {"operator delete*", "operator delete", NULL},
+                };
                 /* regardless of fast search we want to find all overloads */
-                find_alloc_regex(&edata, "operator new*", "operator new", NULL);
-                find_alloc_regex(&edata, "operator delete*", "operator delete", NULL);
+                find_alloc_regexes(&edata, cpp_regexes,
+                                   BUFFER_SIZE_ELEMENTS(cpp_regexes), has_fast_search);
 #ifdef WINDOWS
                 /* wrapper in place of real delete or delete[] operators
                  * (i#722,i#655)
@@ -2853,12 +2944,26 @@ event_post_call_entry_added(app_pc postcall)
  * insertions and deletions), so sticking with a hashtable!
  */
 #define ALLOC_TABLE_HASH_BITS 12
-static hashtable_t malloc_table;
+/* To let threads that allocate in parallel proceed in parallel, the table is
+ * split into stripes by chunk start, each with its own lock.  Operations on a
+ * single chunk lock only its stripe, while malloc_lock() and iteration lock
+ * every stripe, in index order, for a consistent view.  With
+ * alloc_ops.global_lock, every operation locks the whole table.
+ */
+#define MALLOC_TABLE_STRIPE_BITS 4
+#define MALLOC_TABLE_STRIPES (1 << MALLOC_TABLE_STRIPE_BITS)
+static hashtable_t malloc_table[MALLOC_TABLE_STRIPES];
+/* Return values of malloc_lock_stripe_if_not_held_by_me() other than an index */
+#define MALLOC_STRIPE_NONE -1
+#define MALLOC_STRIPE_ALL MALLOC_TABLE_STRIPES
 /* we could switch to a full-fledged known-owner lock, or a recursive lock.
  * xref i#129.
  */
 #define THREAD_ID_INVALID ((thread_id_t)0) /* invalid thread id on Linux+Windows */
+/* Owner of all of the stripes */
 static thread_id_t malloc_lock_owner = THREAD_ID_INVALID;
+/* Owner of each stripe when locked by itself */
+static thread_id_t malloc_stripe_owner[MALLOC_TABLE_STRIPES];
 
 /* PR 525807: to handle malloc-based stacks we need an interval tree
  * for large mallocs.  Putting all mallocs in a tree instead of a table
@@ -2900,9 +3005,21 @@ typedef struct _malloc_entry_t {
      */
     ushort usable_extra;
     ushort flags; /* holds MALLOC_* flags */
-    void *data;
+    void *data; /* also links free entries: see malloc_entry_alloc() */
 } malloc_entry_t;
 
+/* Entries are carved out of slabs rather than allocated one at a time, with a
+ * slab list and free list per stripe protected by the stripe's lock.  This
+ * saves a heap allocation per chunk and keeps a stripe's entries together.
+ * The first entry of each slab links the slabs, which are freed at exit.
+ */
+#define MALLOC_ENTRY_SLAB_SIZE (16*1024)
+static malloc_entry_t *malloc_entry_slabs[MALLOC_TABLE_STRIPES];
+static malloc_entry_t *malloc_entry_free_list[MALLOC_TABLE_STRIPES];
+
+static inline int
+malloc_stripe_index(app_pc start);
+
 /* Returns true if the malloc entry is ignored by us,
  * e.g. entry for windows internal rtl allocation.
  */
@@ -2918,13 +3035,53 @@ malloc_entry_is_native(malloc_entry_t *e)
 #endif
 }
 
+/* Caller must hold the lock of start's stripe */
+static malloc_entry_t *
+malloc_entry_alloc(app_pc start)
+{
+    int idx = malloc_stripe_index(start);
+    malloc_entry_t *e = malloc_entry_free_list[idx];
+    if (e == NULL) {
+        malloc_entry_t *slab = (malloc_entry_t *)
+            global_alloc(MALLOC_ENTRY_SLAB_SIZE, HEAPSTAT_WRAP);
+        uint i, num = MALLOC_ENTRY_SLAB_SIZE / sizeof(*slab);
+        slab[0].data = (void *) malloc_entry_slabs[idx];
+        malloc_entry_slabs[idx] = slab;
+        for (i = 1; i < num - 1; i++)
+            slab[i].data = (void *) &slab[i + 1];
+        slab[num - 1].data = NULL;
+        e = &slab[1];
+        STATS_INC(malloc_entry_slabs_allocated);
+    }
+    malloc_entry_free_list[idx] = (malloc_entry_t *) e->data;
+    return e;
+}
+
+/* Called with the lock of e->start's stripe held */
 static void
 malloc_entry_free(void *v)
 {
     malloc_entry_t *e = (malloc_entry_t *) v;
+    int idx = malloc_stripe_index(e->start);
     if (!malloc_entry_is_native(e))
         client_malloc_data_free(e->data);
-    global_free(e, sizeof(*e), HEAPSTAT_WRAP);
+    e->data = (void *) malloc_entry_free_list[idx];
+    malloc_entry_free_list[idx] = e;
+}
+
+static void
+malloc_entry_slabs_free(void)
+{
+    uint i;
+    for (i = 0; i < MALLOC_TABLE_STRIPES; i++) {
+        malloc_entry_t *slab, *next;
+        for (slab = malloc_entry_slabs[i]; slab != NULL; slab = next) {
+            next = (malloc_entry_t *) slab[0].data;
+            global_free(slab, MALLOC_ENTRY_SLAB_SIZE, HEAPSTAT_WRAP);
+        }
+        malloc_entry_slabs[i] = NULL;
+        malloc_entry_free_list[i] = NULL;
+    }
 }
 
 /* Mallocs are aligned to 8 so drop the bottom 3 bits */
@@ -2955,6 +3112,7 @@ malloc_entry_to_info(malloc_entry_t *e, malloc_info_t *info OUT)
     info->has_redzone = TEST(MALLOC_HAS_REDZONE, e->flags);
     info->client_flags = e->flags & MALLOC_POSSIBLE_CLIENT_FLAGS;
     info->client_data = e->data;
+    info->heap_destroyed = false;
 }
 
 void
@@ -2968,6 +3126,12 @@ alloc_kernel_xfer(void *drcontext, const dr_kernel_xfer_info_t *info)
 #endif
 }
 
+static void
+lazy_module_init(void);
+
+static void
+lazy_module_exit(void);
+
 /* If track_allocs is false, only callbacks and callback returns are tracked.
  * Else: if track_heap is false, only syscall allocs are tracked;
  *       else, syscall allocs and mallocs are tracked.
@@ -2997,6 +3161,9 @@ alloc_init(alloc_options_t *ops, size_t ops_size)
         drwrap_set_global_flags(DRWRAP_NO_FRILLS | DRWRAP_FAST_CLEANCALLS);
     }
 
+    if (alloc_ops.track_heap && alloc_ops.lazy_alloc_syms)
+        lazy_module_init();
+
     if (alloc_ops.replace_realloc) {
         /* we need generated code for our realloc replacements */
         /* b/c we may need to add to this gencode during execution if
@@ -3045,6 +3212,9 @@ alloc_init(alloc_options_t *ops, size_t ops_size)
 void
 alloc_exit(void)
 {
+    if (alloc_ops.track_heap && alloc_ops.lazy_alloc_syms)
+        lazy_module_exit();
+
     if (alloc_ops.track_allocs) {
         /* Must free this before alloc_replace_exit() frees crtheap_mod_table */
         hashtable_delete_with_stats(&alloc_routine_table, "alloc routine table");
@@ -3060,8 +3230,12 @@ alloc_exit(void)
         alloc_replace_exit();
 
     if (alloc_ops.track_allocs) {
-        if (!alloc_ops.replace_malloc)
-            hashtable_delete_with_stats(&malloc_table, "malloc table");
+        if (!alloc_ops.replace_malloc) {
+            uint i;
+            for (i = 0; i < MALLOC_TABLE_STRIPES; i++)
+                hashtable_delete_with_stats(&malloc_table[i], "malloc table");
+            malloc_entry_slabs_free();
+        }
         rb_tree_destroy(large_malloc_tree);
         dr_mutex_destroy(large_malloc_lock);
         if (alloc_ops.cache_postcall) {
@@ -3119,6 +3293,7 @@ alloc_find_syscalls(void *drcontext, const module_data_t *info)
             get_primary_sysnum("NtUnmapViewOfSection", &sysnum_munmap, false);
             get_primary_sysnum("NtAllocateVirtualMemory", &sysnum_valloc, false);
             get_primary_sysnum("NtFreeVirtualMemory", &sysnum_vfree, false);
+            get_primary_sysnum("NtProtectVirtualMemory", &sysnum_vprotect, false);
             get_primary_sysnum("NtContinue", &sysnum_continue, false);
             get_primary_sysnum("NtSetContextThread", &sysnum_setcontext, false);
             get_primary_sysnum("NtMapCMFModule", &sysnum_mapcmf,
@@ -3236,13 +3411,13 @@ module_is_libc(const module_data_t *mod, bool *is_libc, bool *is_libcpp, bool *i
     }
 }
 
-void
-alloc_module_load(void *drcontext, const module_data_t *info, bool loaded)
+/* Searches info for alloc routines and intercepts them */
+static void
+alloc_module_find_routines(const module_data_t *info)
 {
     alloc_routine_set_t *set_libc = NULL;
     alloc_routine_set_t *set_cpp = NULL;
     bool use_redzone = true;
-    bool res;
 #ifdef WINDOWS
     /* i#607 part C: is msvcp*d.dll present, yet we do not have symbols? */
     bool dbgcpp = false, dbgcpp_nosyms = false;
@@ -3252,10 +3427,6 @@ alloc_module_load(void *drcontext, const module_data_t *info, bool loaded)
     bool is_libc, is_libcpp, is_debug;
     module_is_libc(info, &is_libc, &is_libcpp, &is_debug);
 
-#ifdef WINDOWS
-    alloc_find_syscalls(drcontext, info);
-#endif
-
     if (modname != NULL &&
         (strcmp(modname, DYNAMORIO_LIBNAME) == 0 ||
          strcmp(modname, DRMEMORY_LIBNAME) == 0))
@@ -3479,6 +3650,171 @@ alloc_module_load(void *drcontext, const module_data_t *info, bool loaded)
         }
         dr_mutex_unlock(alloc_routine_lock);
     }
+}
+
+/***************************************************************************
+ * LAZY ROUTINE DISCOVERY
+ *
+ * With -lazy_alloc_syms we do not search a module for alloc routines
+ * until the app first executes code inside it, as searching every
+ * module's symbols at load time dominates startup for apps that load
+ * many libraries they barely use.  Our app2app pass runs before drwrap's,
+ * so interception set up for a module's first block is applied to that
+ * very block.  libc and the C++ library are always searched at load, as
+ * other modules' sets depend on them (set_dyn_libc).
+ */
+
+typedef struct _lazy_module_t {
+    module_data_t *data;
+} lazy_module_t;
+
+/* Covers the [start,end) regions of modules not yet searched */
+static rb_tree_t *lazy_module_tree;
+static void *lazy_module_lock;
+/* Lets the bb event skip the lock once every module has been searched */
+static volatile int lazy_module_count;
+
+/* Removes every region of lm from the tree and frees lm.
+ * Caller must hold lazy_module_lock.
+ */
+static void
+lazy_module_remove_all(lazy_module_t *lm)
+{
+    rb_node_t *node;
+    while ((node = rb_find_client_node(lazy_module_tree, (void *) lm)) != NULL)
+        rb_delete(lazy_module_tree, node);
+    dr_free_module_data(lm->data);
+    global_free(lm, sizeof(*lm), HEAPSTAT_MISC);
+    ATOMIC_DEC32(lazy_module_count);
+}
+
+static void
+lazy_module_add(const module_data_t *info)
+{
+    lazy_module_t *lm = (lazy_module_t *)
+        global_alloc(sizeof(*lm), HEAPSTAT_MISC);
+    lm->data = dr_copy_module_data(info);
+    dr_mutex_lock(lazy_module_lock);
+#ifdef WINDOWS
+    rb_insert(lazy_module_tree, info->start, info->end - info->start, (void *) lm);
+#else
+    if (info->contiguous)
+        rb_insert(lazy_module_tree, info->start, info->end - info->start, (void *) lm);
+    else {
+        app_pc seg_base;
+        uint i;
+        ASSERT(info->num_segments > 1 && info->segments != NULL, "invalid seg data");
+        seg_base = info->segments[0].start;
+        for (i = 1; i < info->num_segments; i++) {
+            if (info->segments[i].start > info->segments[i - 1].end) {
+                rb_insert(lazy_module_tree, seg_base,
+                          info->segments[i - 1].end - seg_base, (void *) lm);
+                seg_base = info->segments[i].start;
+            }
+        }
+        rb_insert(lazy_module_tree, seg_base, info->segments[i - 1].end - seg_base,
+                  (void *) lm);
+    }
+#endif
+    ATOMIC_INC32(lazy_module_count);
+    dr_mutex_unlock(lazy_module_lock);
+    STATS_INC(num_lazy_modules);
+    LOG(2, "deferring alloc routine search in %s "PFX"\n",
+        dr_module_preferred_name(info) == NULL ? "<noname>" :
+        dr_module_preferred_name(info), info->start);
+}
+
+static void
+lazy_module_unload(const module_data_t *info)
+{
+    rb_node_t *node;
+    dr_mutex_lock(lazy_module_lock);
+    node = rb_in_node(lazy_module_tree, info->start);
+    if (node != NULL) {
+        void *client;
+        rb_node_fields(node, NULL, NULL, &client);
+        LOG(2, "module "PFX" unloaded before its alloc routines were needed\n",
+            info->start);
+        lazy_module_remove_all((lazy_module_t *) client);
+    }
+    dr_mutex_unlock(lazy_module_lock);
+}
+
+static dr_emit_flags_t
+lazy_module_bb_event(void *drcontext, void *tag, instrlist_t *bb, bool for_trace,
+                     bool translating)
+{
+    rb_node_t *node;
+    if (lazy_module_count == 0 || translating)
+        return DR_EMIT_DEFAULT;
+    /* We search while holding the lock so that another thread's first block
+     * in the same module waits for its routines to be intercepted.
+     */
+    dr_mutex_lock(lazy_module_lock);
+    node = rb_in_node(lazy_module_tree, (byte *) dr_fragment_app_pc(tag));
+    if (node != NULL) {
+        void *client;
+        lazy_module_t *lm;
+        rb_node_fields(node, NULL, NULL, &client);
+        lm = (lazy_module_t *) client;
+        LOG(2, "first execution in %s "PFX": searching for alloc routines\n",
+            dr_module_preferred_name(lm->data) == NULL ? "<noname>" :
+            dr_module_preferred_name(lm->data), lm->data->start);
+        STATS_INC(num_lazy_searches);
+        alloc_module_find_routines(lm->data);
+        lazy_module_remove_all(lm);
+    }
+    dr_mutex_unlock(lazy_module_lock);
+    return DR_EMIT_DEFAULT;
+}
+
+static void
+lazy_module_init(void)
+{
+    /* Before drwrap's app2app pass, which applies our replacements */
+    drmgr_priority_t pri_lazy = {sizeof(pri_lazy), "drmemory.alloc.lazy",
+                                 DRMGR_PRIORITY_NAME_DRWRAP, NULL,
+                                 DRMGR_PRIORITY_APP2APP_DRWRAP - 1};
+    lazy_module_tree = rb_tree_create(NULL);
+    lazy_module_lock = dr_mutex_create();
+    if (!drmgr_register_bb_app2app_event(lazy_module_bb_event, &pri_lazy))
+        ASSERT(false, "drmgr registration failed");
+}
+
+static void
+lazy_module_exit(void)
+{
+    rb_node_t *node;
+    if (!drmgr_unregister_bb_app2app_event(lazy_module_bb_event))
+        ASSERT(false, "drmgr unregistration failed");
+    /* modules never executed are still here */
+    while ((node = rb_min_node(lazy_module_tree)) != NULL) {
+        void *client;
+        rb_node_fields(node, NULL, NULL, &client);
+        lazy_module_remove_all((lazy_module_t *) client);
+    }
+    rb_tree_destroy(lazy_module_tree);
+    dr_mutex_destroy(lazy_module_lock);
+}
+
+void
+alloc_module_load(void *drcontext, const module_data_t *info, bool loaded)
+{
+    bool res;
+
+#ifdef WINDOWS
+    alloc_find_syscalls(drcontext, info);
+#endif
+
+    if (alloc_ops.track_heap) {
+        bool is_libc, is_libcpp, is_debug;
+        module_is_libc(info, &is_libc, &is_libcpp, &is_debug);
+        if (alloc_ops.lazy_alloc_syms && !is_libc && !is_libcpp &&
+            info->start != get_libc_base(NULL))
+            lazy_module_add(info);
+        else
+            alloc_module_find_routines(info);
+    }
 
     if (alloc_ops.track_allocs && alloc_ops.cache_postcall &&
         drsymcache_module_is_cached(info, &res) == DRMF_SUCCESS && res) {
@@ -3495,6 +3831,8 @@ alloc_module_load(void *drcontext, const module_data_t *info, bool loaded)
 void
 alloc_module_unload(void *drcontext, const module_data_t *info)
 {
+    if (alloc_ops.track_heap && alloc_ops.lazy_alloc_syms)
+        lazy_module_unload(info);
     if (alloc_ops.track_heap) {
         uint i;
         /* Rather than re-looking-up all the symbols, or storing
@@ -3702,16 +4040,98 @@ static void
 malloc_lock_internal(void)
 {
     void *drcontext = dr_get_current_drcontext();
-    hashtable_lock(&malloc_table);
+    thread_id_t tid = (drcontext == NULL) ? THREAD_ID_INVALID :
+        dr_get_thread_id(drcontext);
+    int i;
+    for (i = 0; i < MALLOC_TABLE_STRIPES; i++) {
+        /* Taking all stripes while holding one could deadlock */
+        ASSERT(tid == THREAD_ID_INVALID || malloc_stripe_owner[i] != tid,
+               "cannot lock the malloc table while holding a stripe");
+        hashtable_lock(&malloc_table[i]);
+    }
     if (drcontext != NULL) /* paranoid even w/ PR 536058 */
-        malloc_lock_owner = dr_get_thread_id(drcontext);
+        malloc_lock_owner = tid;
 }
 
 static void
 malloc_unlock_internal(void)
 {
+    int i;
     malloc_lock_owner = THREAD_ID_INVALID;
-    hashtable_unlock(&malloc_table);
+    for (i = MALLOC_TABLE_STRIPES - 1; i >= 0; i--)
+        hashtable_unlock(&malloc_table[i]);
+}
+
+static inline int
+malloc_stripe_index(app_pc start)
+{
+    /* We use the top bits of a multiplicative hash so that the keys within
+     * one stripe still spread across that stripe's buckets via malloc_hash().
+     */
+    uint hash = (uint)((ptr_uint_t)start >> 5) * 0x9e3779b1;
+    return (int)(hash >> (32 - MALLOC_TABLE_STRIPE_BITS));
+}
+
+static inline hashtable_t *
+malloc_stripe(app_pc start)
+{
+    return &malloc_table[malloc_stripe_index(start)];
+}
+
+/* Locks the stripe holding start, unless this thread already holds it or the
+ * whole table.  Returns the value to pass to malloc_unlock_stripe().
+ * A thread holding one stripe must not acquire another one, so code that
+ * may look up other chunks must lock the whole table instead.
+ */
+static int
+malloc_lock_stripe_if_not_held_by_me(app_pc start)
+{
+    void *drcontext = dr_get_current_drcontext();
+    thread_id_t tid;
+    int idx;
+    if (drcontext == NULL) {
+        ASSERT(false, "should always have dcontext w/ PR 536058");
+        return MALLOC_STRIPE_NONE;
+    }
+    tid = dr_get_thread_id(drcontext);
+    if (tid == malloc_lock_owner)
+        return MALLOC_STRIPE_NONE;
+    if (alloc_ops.global_lock) {
+        /* The client relies on every alloc and free being serialized */
+        malloc_lock_internal();
+        return MALLOC_STRIPE_ALL;
+    }
+    idx = malloc_stripe_index(start);
+    if (malloc_stripe_owner[idx] == tid)
+        return MALLOC_STRIPE_NONE;
+    hashtable_lock(&malloc_table[idx]);
+    malloc_stripe_owner[idx] = tid;
+    return idx;
+}
+
+static void
+malloc_unlock_stripe(int locked)
+{
+    if (locked == MALLOC_STRIPE_ALL)
+        malloc_unlock_internal();
+    else if (locked != MALLOC_STRIPE_NONE) {
+        malloc_stripe_owner[locked] = THREAD_ID_INVALID;
+        hashtable_unlock(&malloc_table[locked]);
+    }
+}
+
+/* Switches from holding start's stripe to holding the whole table, for
+ * paths that need to look at other chunks.  The caller must look up any
+ * entry again, as it may have been removed in between.
+ */
+static void
+malloc_upgrade_stripe_lock(int *locked INOUT)
+{
+    if (*locked == MALLOC_STRIPE_NONE || *locked == MALLOC_STRIPE_ALL)
+        return;
+    malloc_unlock_stripe(*locked);
+    malloc_lock_internal();
+    *locked = MALLOC_STRIPE_ALL;
 }
 
 static bool
@@ -3755,15 +4175,18 @@ malloc_add_common(app_pc start, app_pc end, app_pc real_end,
                   uint flags, uint client_flags, dr_mcontext_t *mc, app_pc post_call,
                   uint alloc_type)
 {
-    malloc_entry_t *e = (malloc_entry_t *) global_alloc(sizeof(*e), HEAPSTAT_WRAP);
+    malloc_entry_t *e;
     malloc_entry_t *old_e;
-    bool locked_by_me;
+    int locked;
     malloc_info_t info;
     ASSERT((alloc_ops.redzone_size > 0 && TEST(MALLOC_PRE_US, flags)) ||
            alloc_ops.record_allocs,
            "internal inconsistency on when doing detailed malloc tracking");
     IF_WINDOWS(ASSERT(ALIGN_BACKWARD(start, 64*1024) != (ptr_uint_t)
                       get_private_heap_handle(), "app using priv heap"));
+    /* grab lock around entry allocation, client call, and hashtable operations */
+    locked = malloc_lock_stripe_if_not_held_by_me(start);
+    e = malloc_entry_alloc(start);
     e->start = start;
     e->end = end;
     ASSERT(real_end != NULL && real_end - end <= USHRT_MAX, "real_end suspicously big");
@@ -3772,8 +4195,6 @@ malloc_add_common(app_pc start, app_pc end, app_pc real_end,
     e->flags |= alloc_type;
     LOG(3, "%s: type=%x\n", __FUNCTION__, alloc_type);
     e->flags |= (client_flags & MALLOC_POSSIBLE_CLIENT_FLAGS);
-    /* grab lock around client call and hashtable operations */
-    locked_by_me = malloc_lock_if_not_held_by_me();
 
     e->data = NULL;
     malloc_entry_to_info(e, &info);
@@ -3788,7 +4209,7 @@ malloc_add_common(app_pc start, app_pc end, app_pc real_end,
      * when the free succeeds, so a race can hit a conflict.
      * Update: we no longer do this but leaving code for now
      */
-    old_e = hashtable_add_replace(&malloc_table, (void *) start, (void *)e);
+    old_e = hashtable_add_replace(malloc_stripe(start), (void *) start, (void *)e);
 
     if (!malloc_entry_is_native(e) && end - start >= LARGE_MALLOC_MIN_SIZE) {
         malloc_large_add(e->start, e->end - e->start);
@@ -3800,19 +4221,22 @@ malloc_add_common(app_pc start, app_pc end, app_pc real_end,
     }
 
 #ifdef STATISTICS
-    if (!malloc_entry_is_native(e))
-        STATS_INC(num_mallocs);
-    if (num_mallocs % 10000 == 0) {
-        hashtable_cluster_stats(&malloc_table, "malloc table");
-        LOG(1, "malloc table stats after %u malloc calls\n", num_mallocs);
+    if (!malloc_entry_is_native(e)) {
+        /* the global lags until the next stats_fold(), so use this thread's count */
+        uint count = STATS_INC(num_mallocs);
+        if (count % 10000 == 0) {
+            hashtable_cluster_stats(malloc_stripe(start), "malloc table stripe");
+            LOG(1, "malloc table stats after %u malloc calls by this thread\n", count);
+        }
     }
 #endif
 
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    /* old_e goes back on the stripe's free list, so we free it under the lock */
     if (old_e != NULL) {
         ASSERT(!TEST(MALLOC_VALID, old_e->flags), "internal error in malloc tracking");
         malloc_entry_free(old_e);
     }
+    malloc_unlock_stripe(locked);
     LOG(2, "MALLOC "PFX"-"PFX"\n", start, end);
     DOLOG(3, {
         client_print_callstack(dr_get_current_drcontext(), mc, post_call);
@@ -3827,14 +4251,27 @@ malloc_wrap__add(app_pc start, app_pc end, app_pc real_end,
                       client_flags, mc, post_call, 0);
 }
 
-/* up to caller to lock and unlock */
+/* up to caller to lock and unlock start's stripe */
 static malloc_entry_t *
 malloc_lookup(app_pc start)
 {
-    return hashtable_lookup(&malloc_table, (void *) start);
+    return hashtable_lookup(malloc_stripe(start), (void *) start);
 }
 
-/* Note that this also frees the entry.  Caller should be holding lock. */
+#ifdef WINDOWS
+/* Returns whether removing e also needs a stripe other than e->start's */
+static bool
+malloc_entry_remove_needs_table(malloc_entry_t *e)
+{
+    return (e != NULL && TEST(MALLOC_CONTAINS_LIBC_ALLOC, e->flags) &&
+            malloc_stripe_index(e->start + DBGCRT_PRE_REDZONE_SIZE) !=
+            malloc_stripe_index(e->start));
+}
+#endif
+
+/* Note that this also frees the entry.  Caller should be holding lock,
+ * and for malloc_entry_remove_needs_table() the whole-table lock.
+ */
 static void
 malloc_entry_remove(malloc_entry_t *e)
 {
@@ -3856,10 +4293,13 @@ malloc_entry_remove(malloc_entry_t *e)
      */
     if (TEST(MALLOC_CONTAINS_LIBC_ALLOC, e->flags)) {
         ASSERT(e->start + DBGCRT_PRE_REDZONE_SIZE < e->end, "invalid internal alloc");
-        hashtable_remove(&malloc_table, e->start + DBGCRT_PRE_REDZONE_SIZE);
+        ASSERT(!malloc_entry_remove_needs_table(e) || malloc_lock_held_by_self(),
+               "must hold the whole table to remove an inner entry");
+        hashtable_remove(malloc_stripe(e->start + DBGCRT_PRE_REDZONE_SIZE),
+                         e->start + DBGCRT_PRE_REDZONE_SIZE);
     }
 #endif
-    if (hashtable_remove(&malloc_table, e->start)) {
+    if (hashtable_remove(malloc_stripe(e->start), e->start)) {
 #ifdef STATISTICS
         if (!native)
             STATS_INC(num_frees);
@@ -3876,11 +4316,15 @@ static void
 malloc_remove(app_pc start)
 {
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
+    int locked = malloc_lock_stripe_if_not_held_by_me(start);
     e = malloc_lookup(start);
+    if (malloc_entry_remove_needs_table(e)) {
+        malloc_upgrade_stripe_lock(&locked);
+        e = malloc_lookup(start);
+    }
     if (e != NULL)
         malloc_entry_remove(e);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_stripe(locked);
 }
 #endif
 
@@ -3945,11 +4389,11 @@ static void
 malloc_set_valid(app_pc start, bool valid)
 {
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    int locked = malloc_lock_stripe_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL)
         malloc_entry_set_valid(e, valid);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_stripe(locked);
 }
 
 static bool
@@ -3991,12 +4435,12 @@ static uint
 malloc_alloc_type(byte *start)
 {
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
+    int locked = malloc_lock_stripe_if_not_held_by_me(start);
     uint res = 0;
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    e = malloc_lookup(start);
     if (e != NULL)
         res = malloc_alloc_entry_type(e);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_stripe(locked);
     return res;
 }
 
@@ -4005,11 +4449,11 @@ malloc_wrap__is_pre_us_ex(app_pc start, bool ok_if_invalid)
 {
     bool res = false;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    int locked = malloc_lock_stripe_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL)
         res = malloc_entry_is_pre_us(e, ok_if_invalid);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_stripe(locked);
     return res;
 }
 
@@ -4044,10 +4488,10 @@ malloc_is_native(app_pc start, cls_alloc_t *pt, bool consider_being_freed)
 #ifdef WINDOWS
     bool res = false;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    int locked = malloc_lock_stripe_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     res = malloc_entry_is_native_ex(e, start, pt, consider_being_freed);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_stripe(locked);
     return res;
 #else
     /* optimization: currently nothing in the table */
@@ -4062,7 +4506,7 @@ malloc_is_native(app_pc start, cls_alloc_t *pt, bool consider_being_freed)
 static bool
 malloc_entry_exists_racy_nolock(app_pc start)
 {
-    malloc_entry_t *e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    malloc_entry_t *e = malloc_lookup(start);
     return (e != NULL && MALLOC_VISIBLE(e->flags));
 }
 #endif
@@ -4072,11 +4516,11 @@ malloc_wrap__end(app_pc start)
 {
     app_pc end = NULL;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    int locked = malloc_lock_stripe_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL && MALLOC_VISIBLE(e->flags))
         end = e->end;
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_stripe(locked);
     return end;
 }
 
@@ -4086,11 +4530,11 @@ malloc_wrap__size(app_pc start)
 {
     ssize_t sz = -1;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    int locked = malloc_lock_stripe_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL && MALLOC_VISIBLE(e->flags))
         sz = (e->end - start);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_stripe(locked);
     return sz;
 }
 
@@ -4100,11 +4544,11 @@ malloc_wrap__size_invalid_only(app_pc start)
 {
     ssize_t sz = -1;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    int locked = malloc_lock_stripe_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL && !TEST(MALLOC_VALID, e->flags))
         sz = (e->end - start);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_stripe(locked);
     return sz;
 }
 
@@ -4113,11 +4557,11 @@ malloc_wrap__get_client_data(app_pc start)
 {
     void *res = NULL;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    int locked = malloc_lock_stripe_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL)
         res = e->data;
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_stripe(locked);
     return res;
 }
 
@@ -4126,11 +4570,11 @@ malloc_wrap__get_client_flags(app_pc start)
 {
     uint res = 0;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    int locked = malloc_lock_stripe_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL)
         res = (e->flags & MALLOC_POSSIBLE_CLIENT_FLAGS);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_stripe(locked);
     return res;
 }
 
@@ -4139,13 +4583,13 @@ malloc_wrap__set_client_flag(app_pc start, uint client_flag)
 {
     malloc_entry_t *e;
     bool found = false;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    int locked = malloc_lock_stripe_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL) {
         e->flags |= (client_flag & MALLOC_POSSIBLE_CLIENT_FLAGS);
         found = true;
     }
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_stripe(locked);
     return found;
 }
 
@@ -4154,13 +4598,13 @@ malloc_wrap__clear_client_flag(app_pc start, uint client_flag)
 {
     malloc_entry_t *e;
     bool found = false;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    int locked = malloc_lock_stripe_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL) {
         e->flags &= ~(client_flag & MALLOC_POSSIBLE_CLIENT_FLAGS);
         found = true;
     }
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_stripe(locked);
     return found;
 }
 
@@ -4173,19 +4617,23 @@ malloc_iterate_internal(bool include_native, malloc_iter_cb_t cb, void *iter_dat
      */
     bool locked_by_me = malloc_lock_if_not_held_by_me();
     malloc_info_t info;
-    for (i = 0; i < HASHTABLE_SIZE(malloc_table.table_bits); i++) {
-        hash_entry_t *he, *nxt;
-        for (he = malloc_table.table[i]; he != NULL; he = nxt) {
-            malloc_entry_t *e = (malloc_entry_t *) he->payload;
-            /* support malloc_remove() while iterating */
-            nxt = he->next;
-            if (MALLOC_VISIBLE(e->flags) &&
-                (include_native || !malloc_entry_is_native(e))) {
-                malloc_entry_to_info(e, &info);
-                if (include_native)
-                    info.client_flags = e->flags; /* all of them */
-                if (!cb(&info, iter_data)) {
-                    goto malloc_iterate_done;
+    uint stripe;
+    for (stripe = 0; stripe < MALLOC_TABLE_STRIPES; stripe++) {
+        hashtable_t *table = &malloc_table[stripe];
+        for (i = 0; i < HASHTABLE_SIZE(table->table_bits); i++) {
+            hash_entry_t *he, *nxt;
+            for (he = table->table[i]; he != NULL; he = nxt) {
+                malloc_entry_t *e = (malloc_entry_t *) he->payload;
+                /* support malloc_remove() while iterating */
+                nxt = he->next;
+                if (MALLOC_VISIBLE(e->flags) &&
+                    (include_native || !malloc_entry_is_native(e))) {
+                    malloc_entry_to_info(e, &info);
+                    if (include_native)
+                        info.client_flags = e->flags; /* all of them */
+                    if (!cb(&info, iter_data)) {
+                        goto malloc_iterate_done;
+                    }
                 }
             }
         }
@@ -4240,15 +4688,19 @@ malloc_wrap_init(void)
 {
     if (alloc_ops.track_allocs) {
         hashtable_config_t hashconfig = {sizeof(hashconfig),};
-        hashtable_init_ex(&malloc_table, ALLOC_TABLE_HASH_BITS, HASH_INTPTR,
-                          false/*!str_dup*/, false/*!synch*/, malloc_entry_free,
-                          malloc_hash, NULL);
+        uint i;
         /* hash lookup can be a bottleneck so it's worth taking some extra space
          * to reduce the collision chains
          */
         hashconfig.resizable = true;
         hashconfig.resize_threshold = 50; /* default is 75 */
-        hashtable_configure(&malloc_table, &hashconfig);
+        for (i = 0; i < MALLOC_TABLE_STRIPES; i++) {
+            hashtable_init_ex(&malloc_table[i],
+                              ALLOC_TABLE_HASH_BITS - MALLOC_TABLE_STRIPE_BITS,
+                              HASH_INTPTR, false/*!str_dup*/, false/*!synch*/,
+                              malloc_entry_free, malloc_hash, NULL);
+            hashtable_configure(&malloc_table[i], &hashconfig);
+        }
     }
 
     malloc_interface.malloc_lock = malloc_wrap__lock;
@@ -4282,7 +4734,7 @@ alloc_syscall_filter(void *drcontext, int sysnum)
 #ifdef WINDOWS
     if (sysnum == sysnum_mmap || sysnum == sysnum_munmap ||
         sysnum == sysnum_valloc || sysnum == sysnum_vfree ||
-        sysnum == sysnum_continue ||
+        sysnum == sysnum_vprotect || sysnum == sysnum_continue ||
         sysnum == sysnum_RaiseException ||
         sysnum == sysnum_setcontext || sysnum == sysnum_mapcmf ||
         sysnum == sysnum_UserConnectToServer ||
@@ -4294,6 +4746,7 @@ alloc_syscall_filter(void *drcontext, int sysnum)
     switch (sysnum) {
     case SYS_mmap:
     case SYS_munmap:
+    case SYS_mprotect:
 # ifdef LINUX
     IF_NOT_X64(case SYS_mmap2:)
     case SYS_mremap:
@@ -4320,13 +4773,14 @@ handle_pre_alloc_syscall(void *drcontext, int sysnum, dr_mcontext_t *mc)
 #ifdef WINDOWS
     if (sysnum == sysnum_mmap || sysnum == sysnum_munmap ||
         sysnum == sysnum_valloc || sysnum == sysnum_vfree ||
-        sysnum == sysnum_continue ||
+        sysnum == sysnum_vprotect || sysnum == sysnum_continue ||
         sysnum == sysnum_setcontext || sysnum == sysnum_mapcmf ||
         sysnum == sysnum_SetInformationProcess) {
         HANDLE process;
         pt->expect_sys_to_fail = false;
         if (sysnum == sysnum_mmap || sysnum == sysnum_munmap ||
             sysnum == sysnum_valloc || sysnum == sysnum_vfree ||
+            sysnum == sysnum_vprotect ||
             sysnum == sysnum_mapcmf || sysnum == sysnum_SetInformationProcess) {
             process = (HANDLE)
                 dr_syscall_get_param(drcontext,
@@ -4417,6 +4871,24 @@ handle_pre_alloc_syscall(void *drcontext, int sysnum, dr_mcontext_t *mc)
                     pt->expect_sys_to_fail = false;
                 }
             }
+        } else if (sysnum == sysnum_vprotect) {
+            if (pt->syscall_this_process) {
+                app_pc *base_ptr = (app_pc *) dr_syscall_get_param(drcontext, 1);
+                size_t *size_ptr = (size_t *) dr_syscall_get_param(drcontext, 2);
+                uint prot = (uint) dr_syscall_get_param(drcontext, 3);
+                app_pc base;
+                size_t size;
+                if (safe_read(base_ptr, sizeof(base), &base) &&
+                    safe_read(size_ptr, sizeof(size), &size)) {
+                    LOG(2, "NtProtectVirtualMemory: "PFX"-"PFX" 0x%x\n",
+                        base, base+size, prot);
+                    client_handle_mprotect(base, size,
+                                           TESTANY(PAGE_READWRITE | PAGE_WRITECOPY |
+                                                   PAGE_EXECUTE_READWRITE |
+                                                   PAGE_EXECUTE_WRITECOPY, prot));
+                } else
+                    WARN("WARNING: NtProtectVirtualMemory: error reading param\n");
+            }
         } else if (sysnum == sysnum_munmap) {
             pt->munmap_base = (app_pc) dr_syscall_get_param(drcontext, 1);
             /* we have to walk now (post-syscall nothing to walk): we'll restore
@@ -4450,6 +4922,13 @@ handle_pre_alloc_syscall(void *drcontext, int sysnum, dr_mcontext_t *mc)
         if (alloc_ops.track_heap)
             heap_region_remove(base, base+size, mc);
     }
+    else if (sysnum == SYS_mprotect) {
+        app_pc base = (app_pc) dr_syscall_get_param(drcontext, 0);
+        size_t size = (size_t) dr_syscall_get_param(drcontext, 1);
+        uint prot = (uint) dr_syscall_get_param(drcontext, 2);
+        LOG(2, "SYS_mprotect "PFX"-"PFX" 0x%x\n", base, base+size, prot);
+        client_handle_mprotect(base, size, TEST(PROT_WRITE, prot));
+    }
 # if defined(LINUX) && defined(DEBUG)
     else if (sysnum == SYS_brk) {
         pt->sbrk = (app_pc) dr_syscall_get_param(drcontext, 0);
@@ -5305,6 +5784,7 @@ handle_free_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
     bool size_in_zone = (redzone_size(routine) > 0 && alloc_ops.size_in_redzone);
     size_t size = 0;
     malloc_entry_t *entry;
+    int locked;
 
     base = (app_pc)arg;
     real_base = base;
@@ -5337,8 +5817,15 @@ handle_free_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
     /* We must have synchronized access to avoid races and ensure we report
      * an error on the 2nd free to the same base
      */
-    malloc_lock();
+    locked = malloc_lock_stripe_if_not_held_by_me(base);
     entry = malloc_lookup(base);
+    if (entry == NULL IF_WINDOWS(|| malloc_entry_remove_needs_table(entry))) {
+        /* Reporting an invalid free looks at other chunks, as does removing
+         * an i#1072 inner entry.
+         */
+        malloc_upgrade_stripe_lock(&locked);
+        entry = malloc_lookup(base);
+    }
     if (entry != NULL &&
         (malloc_entry_is_native_ex(entry, base, pt, false)
 #ifdef WINDOWS
@@ -5350,7 +5837,7 @@ handle_free_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
 #endif
          )) {
         malloc_entry_remove(entry);
-        malloc_unlock();
+        malloc_unlock_stripe(locked);
         return;
     }
     if (pt->in_heap_routine == 1/*alread incremented, so outer*/) {
@@ -5479,7 +5966,7 @@ handle_free_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
 
         malloc_entry_remove(entry);
     }
-    malloc_unlock();
+    malloc_unlock_stripe(locked);
 
     set_handling_heap_layer(pt, base, size);
 #ifdef WINDOWS
@@ -5489,12 +5976,12 @@ handle_free_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
 
 static void
 handle_free_post(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
-                 dr_mcontext_t *mc, alloc_routine_entry_t *routine)
+                 alloc_routine_entry_t *routine)
 {
     pt->alloc_being_freed = NULL;
 #ifdef WINDOWS
     if (routine->type == RTL_ROUTINE_FREE) {
-        if (MC_RET_REG(mc) == 0/*FALSE==failure*/) {
+        if (drwrap_get_retval(wrapcxt) == NULL/*FALSE==failure*/) {
             /* If our prediction is wrong, we can't undo the shadow memory
              * changes since we've lost which were defined vs undefined,
              * along with whether this malloc was pre-us or not.  We
@@ -5608,8 +6095,8 @@ size_plus_redzone_overflow(alloc_routine_entry_t *routine, size_t asked_for)
 
 /* If realloc is true, this is realloc(NULL, size) */
 static void
-handle_malloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
-                  alloc_routine_entry_t *routine)
+handle_malloc_pre_internal(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
+                           alloc_routine_entry_t *routine)
 {
     routine_type_t type = routine->type;
     bool realloc = is_realloc_routine(type);
@@ -5688,6 +6175,17 @@ handle_malloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
         realloc ? "(realloc(NULL,sz))" : "");
 }
 
+/* Brackets handle_malloc_pre_internal() for -profile_tool */
+static void
+handle_malloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
+                  alloc_routine_entry_t *routine)
+{
+    uint64 prof_start;
+    PROF_START(prof_start);
+    handle_malloc_pre_internal(drcontext, pt, wrapcxt, routine);
+    PROF_STOP(drcontext, PROF_HEAP, prof_start);
+}
+
 /* Returns the actual allocated size.  This can be either the
  * requested size that Dr. Memory passed to the system allocator
  * (including any redzones added) or that requested size padded to
@@ -5871,9 +6369,9 @@ handle_alloc_failure(malloc_info_t *info, app_pc pc, dr_mcontext_t *mc)
 }
 
 static void
-handle_malloc_post(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
-                   dr_mcontext_t *mc, bool realloc, app_pc post_call,
-                   alloc_routine_entry_t *routine)
+handle_malloc_post_internal(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
+                            dr_mcontext_t *mc, bool realloc, app_pc post_call,
+                            alloc_routine_entry_t *routine)
 {
     app_pc real_base = (app_pc) MC_RET_REG(mc);
     size_t pad_size, real_size = 0;
@@ -5917,6 +6415,19 @@ handle_malloc_post(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
     }
 }
 
+/* Brackets handle_malloc_post_internal() for -profile_tool */
+static void
+handle_malloc_post(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
+                   dr_mcontext_t *mc, bool realloc, app_pc post_call,
+                   alloc_routine_entry_t *routine)
+{
+    uint64 prof_start;
+    PROF_START(prof_start);
+    handle_malloc_post_internal(drcontext, pt, wrapcxt, mc, realloc, post_call,
+                                routine);
+    PROF_STOP(drcontext, PROF_HEAP, prof_start);
+}
+
 /**************************************************
  * REALLOC
  */
@@ -5931,6 +6442,7 @@ handle_realloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
     size_t size = (size_t) drwrap_get_arg(wrapcxt, ARGNUM_REALLOC_SIZE(type));
     app_pc base = (app_pc) drwrap_get_arg(wrapcxt, ARGNUM_REALLOC_PTR(type));
     malloc_entry_t *entry;
+    int locked;
     if (base == NULL) {
         /* realloc(NULL, size) == malloc(size) (PR 416535) */
         /* call_site for call;jmp will be jmp, so retaddr better even if post-call */
@@ -5947,11 +6459,16 @@ handle_realloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
         LOG(2, "realloc-pre "PFX" new size %d\n", base, pt->realloc_replace_size);
         return;
     }
-    malloc_lock();
+    locked = malloc_lock_stripe_if_not_held_by_me(base);
     entry = malloc_lookup(base);
+    if (entry == NULL IF_WINDOWS(|| malloc_entry_remove_needs_table(entry))) {
+        /* see handle_free_pre() */
+        malloc_upgrade_stripe_lock(&locked);
+        entry = malloc_lookup(base);
+    }
     if (entry != NULL && malloc_entry_is_native_ex(entry, base, pt, true)) {
         malloc_entry_remove(entry);
-        malloc_unlock();
+        malloc_unlock_stripe(locked);
         return;
     }
 #ifdef WINDOWS
@@ -5961,7 +6478,7 @@ handle_realloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
 #endif
     if (check_recursive_same_sequence(drcontext, &pt, routine, pt->alloc_size,
                                       size - redzone_size(routine)*2)) {
-        malloc_unlock();
+        malloc_unlock_stripe(locked);
         return;
     }
     set_handling_heap_layer(pt, base, size);
@@ -5973,7 +6490,7 @@ handle_realloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
     if (!check_valid_heap_block(entry == NULL, pt->alloc_base, pt, wrapcxt,
                                 routine->name, is_free_routine(type))) {
         pt->expect_lib_to_fail = true;
-        malloc_unlock();
+        malloc_unlock_stripe(locked);
         return;
     }
     ASSERT(entry != NULL, "shouldn't get here: tangent or invalid checked above");
@@ -6024,7 +6541,7 @@ handle_realloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
         pt->alloc_base, pt->realloc_old_info.request_size, pt->alloc_size);
     if (alloc_ops.record_allocs && !invalidated)
         malloc_entry_set_valid(entry, false);
-    malloc_unlock();
+    malloc_unlock_stripe(locked);
 }
 
 static void
@@ -6766,9 +7283,10 @@ handle_alloc_pre_ex(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
 /* only used if alloc_ops.track_heap */
 static void
 handle_alloc_post_func(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
-                       dr_mcontext_t *mc, app_pc func, app_pc post_call,
-                       alloc_routine_entry_t *routine)
+                       app_pc func, app_pc post_call, alloc_routine_entry_t *routine)
 {
+    /* We fetch the mcontext only on the paths that need it */
+    dr_mcontext_t *mc = NULL;
     routine_type_t type;
     bool adjusted = false;
     alloc_routine_entry_t routine_local;
@@ -6797,7 +7315,11 @@ handle_alloc_post_func(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
         func, get_alloc_routine_name(func),
         pt->in_heap_routine, pt->in_heap_adjusted);
     DOLOG(4, {
-        client_print_callstack(drcontext, mc, post_call);
+        if (wrapcxt != NULL) {
+            client_print_callstack(drcontext,
+                                   drwrap_get_mcontext_ex(wrapcxt, DR_MC_GPR),
+                                   post_call);
+        }
     });
     if (pt->in_heap_routine == pt->in_heap_adjusted) {
         pt->in_heap_adjusted = 0;
@@ -6811,6 +7333,7 @@ handle_alloc_post_func(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
     if (pt->in_heap_adjusted > 0 ||
         (!adjusted && pt->in_heap_adjusted < pt->in_heap_routine)) {
         if (pt->ignored_alloc) {
+            mc = drwrap_get_mcontext_ex(wrapcxt, DR_MC_GPR);
             LOG(2, "ignored post-alloc routine "PFX" %s => "PFX"\n",
                 func, get_alloc_routine_name(func), MC_RET_REG(mc));
             /* remember the alloc so we can ignore on size or free */
@@ -6825,19 +7348,24 @@ handle_alloc_post_func(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
         } else {
             /* some outer level did the adjustment, so nop for us */
             LOG(2, "recursive post-alloc routine "PFX" %s: no adjustments; eax="PFX"\n",
-                func, get_alloc_routine_name(func), MC_RET_REG(mc));
+                func, get_alloc_routine_name(func), drwrap_get_retval(wrapcxt));
         }
         return;
     }
     if (pt->in_heap_routine == 0)
         client_exiting_heap_routine();
 
+    /* The operators and free need no machine state, and they are half of
+     * an allocation-heavy app's heap calls.
+     */
+    if (!is_new_routine(type) && !is_free_routine(type))
+        mc = drwrap_get_mcontext_ex(wrapcxt, DR_MC_GPR);
     if (is_new_routine(type)) {
         /* clear to handle placement new */
         pt->allocator = 0;
     }
     else if (is_free_routine(type)) {
-        handle_free_post(drcontext, pt, wrapcxt, mc, routine);
+        handle_free_post(drcontext, pt, wrapcxt, routine);
     }
     else if (is_size_routine(type)) {
         handle_size_post(drcontext, pt, wrapcxt, mc, routine);
@@ -6871,12 +7399,11 @@ handle_alloc_post(void *wrapcxt, void *user_data)
     app_pc post_call = drwrap_get_retaddr(wrapcxt);
     void *drcontext = (void *) user_data;
     cls_alloc_t *pt = (cls_alloc_t *) drmgr_get_cls_field(drcontext, cls_idx_alloc);
-    dr_mcontext_t *mc = drwrap_get_mcontext_ex(wrapcxt, DR_MC_GPR);
 
     ASSERT(alloc_ops.track_heap, "requires track_heap");
     ASSERT(pt->in_heap_routine > 0, "shouldn't be called");
 
-    handle_alloc_post_func(drcontext, pt, wrapcxt, mc,
+    handle_alloc_post_func(drcontext, pt, wrapcxt,
                            pt->last_alloc_routine[pt->in_heap_routine], post_call,
                            (alloc_routine_entry_t *)
                            pt->last_alloc_info[pt->in_heap_routine]);
@@ -77,6 +77,19 @@ typedef struct _alloc_options_t {
     bool shared_redzones;
     uint delay_frees;
     uint delay_frees_maxsz;
+    /* Maximum number of per-thread arenas (i#948).  0 means a single arena.
+     * Only supported on Linux, and ignored if global_lock is set.
+     */
+    uint thread_arenas;
+    /* Whether to hand threads a per-thread arena on the NUMA node they are
+     * running on, with its memory preferring that node.  Linux only.
+     */
+    bool numa_arenas;
+    /* Whether alloc_replace_iteration_start() is available, for allocations
+     * that are all thrown away at once.  Only supported on Linux, and ignored
+     * if global_lock is set.
+     */
+    bool iteration_arenas;
 
     bool skip_msvc_importers;
 
@@ -100,6 +113,22 @@ typedef struct _alloc_options_t {
      */
     bool replace_nosy_allocs;
 
+    /* Only used with -replace_malloc: when non-zero, mmapped chunks with a
+     * request of at least this size end flush against a trailing inaccessible
+     * page instead of a redzone, and report has_redzone as false.
+     */
+    size_t guard_page_min_size;
+    /* Only used with -replace_malloc: when non-zero, a random one in this many
+     * allocations, on average, is a guard chunk regardless of its size.  Freed
+     * guard chunks are then kept inaccessible for a while before being
+     * unmapped.
+     */
+    uint sample_allocs;
+    /* Defer searching a module other than libc for alloc routines until
+     * the app first executes code in it.
+     */
+    bool lazy_alloc_syms;
+
     /* Add new options here */
 } alloc_options_t;
 
@@ -120,6 +149,7 @@ enum {
     MALLOC_RESERVED_9 = 0x1000,
     MALLOC_RESERVED_10= 0x2000,
     MALLOC_CLIENT_5 =   0x4000,
+    MALLOC_RESERVED_11= 0x8000,
     MALLOC_POSSIBLE_CLIENT_FLAGS = (MALLOC_CLIENT_1 | MALLOC_CLIENT_2 |
                                     MALLOC_CLIENT_3 | MALLOC_CLIENT_4 |
                                     MALLOC_CLIENT_5),
@@ -137,6 +167,8 @@ typedef struct {
     bool realloc;       /* only applies to malloc */
     uint client_flags;  /* does not apply to malloc/realloc where not set yet */
     void *client_data;  /* does not apply to malloc/realloc where not set yet */
+    bool fresh;         /* only applies to malloc: untouched since the OS zeroed it */
+    bool heap_destroyed;/* only applies to free: its whole heap is being released */
 } malloc_info_t;
 
 typedef bool (*malloc_iter_cb_t)(malloc_info_t *info, void *iter_data);
@@ -154,6 +186,9 @@ extern uint wrap_post;
 extern uint num_mallocs;
 extern uint num_large_mallocs;
 extern uint num_frees;
+extern uint malloc_entry_slabs_allocated;
+extern uint num_lazy_modules;
+extern uint num_lazy_searches;
 #endif
 
 /* caller should call drmgr_init() and drwrap_init() */
@@ -272,6 +307,12 @@ alloc_entering_replace_routine(app_pc pc);
 bool
 alloc_replace_in_cur_arena(byte *addr);
 
+/* Returns whether addr is in the trailing inaccessible page of a live chunk
+ * allocated under alloc_ops.guard_page_min_size.
+ */
+bool
+alloc_replace_in_guard_page(byte *addr);
+
 /* overlap check includes redzone */
 bool
 alloc_replace_overlaps_delayed_free(byte *start, byte *end,
@@ -301,6 +342,18 @@ client_app_malloc(void *drcontext, size_t size, app_pc caller);
 void
 client_app_free(void *drcontext, void *ptr, app_pc caller);
 
+/* Until alloc_replace_iteration_end(), the calling thread's application
+ * allocations come from a separate arena that alloc_replace_iteration_end()
+ * then empties, handling each chunk still live as a free at caller.
+ * These can only be used with -replace_malloc and alloc_ops.iteration_arenas,
+ * and otherwise do nothing.
+ */
+void
+alloc_replace_iteration_start(void *drcontext);
+
+void
+alloc_replace_iteration_end(void *drcontext, app_pc caller);
+
 /***************************************************************************
  * CLIENT CALLBACKS
  */
@@ -310,11 +363,12 @@ void
 client_malloc_data_free(void *data);
 
 /* called when a malloc is being moved to a free list.  the stored user
- * data is replaced with the return value.
+ * data is replaced with the return value.  base is the chunk's app base.
  * only called when replacing rather than wrapping malloc.
  */
 void *
-client_malloc_data_to_free_list(void *cur_data, dr_mcontext_t *mc, app_pc post_call);
+client_malloc_data_to_free_list(void *cur_data, dr_mcontext_t *mc, app_pc post_call,
+                                app_pc base);
 
 /* called when a freed chunk is being split, allowing for a copy of the
  * stored user data to be kept with the remaining-free portion.
@@ -430,6 +484,10 @@ client_handle_munmap(app_pc base, size_t size, bool anon);
 void
 client_handle_munmap_fail(app_pc base, size_t size, bool anon);
 
+/* Called prior to a change in protection of [base, base+size) */
+void
+client_handle_mprotect(app_pc base, size_t size, bool writable);
+
 #ifdef UNIX
 void
 client_handle_mremap(app_pc old_base, size_t old_size, app_pc new_base, size_t new_size,
@@ -71,10 +71,21 @@
  *   (though worse alloc re-use), and searches start at the front and
  *   take the first fit.
  *   we can add fancier algorithms in the future.
+ * + small chunks leaving the delay list go first to a small per-bucket cache
+ *   that is handed out LIFO without coalescing
  * + for alloc_ops.external_headers, free list entries use headers that
  *   are co-located with the chunk headers
  * + for !alloc_ops.external_headers, free list entry headers begin where
  *   regular headers begin, in the middle of the redzone.
+ * + we do not use slabs (runs of same-size slots with out-of-line bitmaps)
+ *   for small sizes: a slot still needs a shared redzone between neighbors
+ *   and a user_data pointer for its callstack, so the only savings would be
+ *   the part of the header that sticks out of the redzone
+ *   (header_beyond_redzone: 16 bytes by default on x64, 0 on x86), while
+ *   every header_from_ptr() caller, the iterators, and the overlap queries
+ *   would need a second code path.  On x86 the out-of-line metadata would
+ *   make small chunks larger.  Conversely, -redzone_size 32 on x64 costs no
+ *   extra space, as the header already occupies it.
  */
 
 #include "dr_api.h"
@@ -86,6 +97,7 @@
 #include "alloc_private.h"
 #include "heap.h"
 #include "drsymcache.h"
+#include "prof.h"
 #include <string.h> /* memcpy */
 
 #ifdef MACOS
@@ -133,6 +145,28 @@ static const uint free_list_sizes[] = {
 };
 #define NUM_FREE_LISTS (sizeof(free_list_sizes)/sizeof(free_list_sizes[0]))
 
+/* Chunks in the buckets below 192 bytes that come off the delay list are first
+ * placed in a small per-bucket LIFO cache, from which a same-bucket request
+ * can be satisfied without searching, splitting, or coalescing.  Under
+ * -thread_arenas this cache is per-thread.
+ */
+#define NUM_FREE_CACHE_LISTS IF_X64_ELSE(7, 8)
+#define FREE_CACHE_DEPTH 16
+
+#ifdef X64
+/* A chunk from memalign() and its relatives records its alignment in its
+ * header.  If that is between 2^ALIGNED_CACHE_MIN_SHIFT and
+ * 2^ALIGNED_CACHE_MAX_SHIFT, when it comes off the delay list it is kept in a
+ * per-alignment cache that is checked first by a request with the same
+ * alignment, which then needs neither padding nor splitting.  Only the x64
+ * header has room to record the alignment.
+ */
+# define ALIGNED_CACHE_MIN_SHIFT 5  /* 32 */
+# define ALIGNED_CACHE_MAX_SHIFT 12 /* 4096 */
+# define NUM_ALIGNED_CACHE_LISTS (ALIGNED_CACHE_MAX_SHIFT - ALIGNED_CACHE_MIN_SHIFT + 1)
+# define ALIGNED_CACHE_DEPTH 8
+#endif
+
 /* Values stored in chunk header flags */
 enum {
     CHUNK_FREED       = MALLOC_RESERVED_1,          /* 0x0001 */
@@ -149,6 +183,8 @@ enum {
      */
     CHUNK_LAYER_NOCHECK = MALLOC_RESERVED_9,
     CHUNK_SKIP_ITER   =   MALLOC_RESERVED_10,
+    /* An mmapped chunk ending at a PROT_NONE page in place of its redzones */
+    CHUNK_GUARD_PAGE  =   MALLOC_RESERVED_11,
 
     /* meta-flags */
 #ifdef WINDOWS
@@ -206,13 +242,11 @@ typedef struct _chunk_header_t {
              */
             uint prev_size_shr;
 #ifdef X64
-            /* Compiler will add anyway: just making explicit.  we need the header
-             * size to be aligned to 8 so we can't pack.  for alloc_ops.external_headers
-             * we eat this overhead to provide runtime flexibility w/ the same
-             * data struct as we don't need it there.
-             * Update: actually we need to align to 16.
+            /* The header size must be aligned to 16, so we have room for the log2
+             * of the requested alignment, or 0 for the default.  It lies beyond
+             * the prev pointer and so it survives until re-use.
              */
-            uint pad;
+            uint align_shift;
 #endif
         } unfree;
         struct _free_header_t *prev;
@@ -270,6 +304,28 @@ typedef struct _free_lists_t {
      */
     free_header_t *front[NUM_FREE_LISTS];
     free_header_t *last[NUM_FREE_LISTS];
+    /* Entries here have left the delay list but keep CHUNK_DELAY_FREE set, so
+     * that neighbors neither coalesce with them nor expect a prev size, and
+     * keep their user_data until re-use.
+     */
+    free_header_t *cache[NUM_FREE_CACHE_LISTS][FREE_CACHE_DEPTH];
+    uint cache_count[NUM_FREE_CACHE_LISTS];
+#ifdef X64
+    /* Similar, indexed by align_shift - ALIGNED_CACHE_MIN_SHIFT */
+    free_header_t *aligned_cache[NUM_ALIGNED_CACHE_LISTS][ALIGNED_CACHE_DEPTH];
+    uint aligned_cache_count[NUM_ALIGNED_CACHE_LISTS];
+#endif
+#ifdef LINUX
+    /* For a sharded delay list (see delay_batch_t): the newest batch_chunks
+     * entries have not yet been published; owed_chunks is how many of the
+     * oldest entries belong to retired batches (protected by delay_batch_lock);
+     * early_chunks is how many published entries were shifted ahead of time.
+     */
+    uint batch_chunks;
+    size_t batch_bytes;
+    uint owed_chunks;
+    uint early_chunks;
+#endif
 } free_lists_t;
 
 #ifdef LINUX
@@ -304,6 +360,10 @@ typedef struct _arena_header_t {
     byte *next_chunk;
     byte *commit_end;
     byte *reserve_end;
+    /* [zeroed_from, commit_end) has not been written since the OS zeroed it.
+     * This never moves backward, even if next_chunk does.
+     */
+    byte *zeroed_from;
     free_lists_t *free_list;
 #ifdef WINDOWS
     /* i#949: We need two locks.  The lock field is the app lock, which can
@@ -332,6 +392,20 @@ typedef struct _arena_header_t {
 #endif
     /* we need to iterate arenas belonging to one (non-default) Heap */
     struct _arena_header_t *next_arena;
+    /* The main arena (which owns the lock and free lists) for this sub-arena.
+     * Points at itself for a main arena.
+     */
+    struct _arena_header_t *main_arena;
+#ifdef LINUX
+    /* For -thread_arenas (i#948): the list of all per-thread main arenas,
+     * and how many live threads are currently assigned to this one.
+     * Only valid in a main arena, and protected by thread_arena_lock.
+     */
+    struct _arena_header_t *next_thread_arena;
+    uint thread_users;
+    /* For -numa_arenas: the NUMA node this main arena's memory prefers */
+    uint numa_node;
+#endif
     /* for main arena of each Heap, we inline free_lists_t here */
 } arena_header_t;
 
@@ -360,6 +434,10 @@ static HANDLE process_heap;
     (TEST(ARENA_PRE_US_MAPPED, (arena)->flags) || TEST(HEAP_ZERO_MEMORY, (alloc_flags)))
 #else
 # define ARENA_MAIN 0x0001
+/* A per-iteration arena (see iter_arena_list) and all its sub-arenas */
+# define ARENA_ITERATION 0x0002
+/* A -numa_arenas thread arena and its sub-arenas, preferring numa_node */
+# define ARENA_NUMA_BOUND 0x0004
 #endif
 
 /* Linux current arena, or Windows default Heap.  We always use this main
@@ -368,13 +446,106 @@ static HANDLE process_heap;
  */
 static arena_header_t *cur_arena;
 
+#ifdef LINUX
+/* i#948: for -thread_arenas we hand each thread its own main arena so that
+ * the arena lock is uncontended in the common case.  The lock is still
+ * acquired, as a chunk can be freed by a thread other than its allocator
+ * and as iteration must synchronize with splits and coalesces.  Arenas are
+ * never destroyed before exit, as they can contain live chunks: instead, an
+ * exiting thread's arena is handed to the next new thread.  Once
+ * alloc_ops.thread_arenas arenas exist, new threads share the least-used one.
+ * cur_arena is the first entry in this list.
+ */
+static arena_header_t *thread_arena_list;
+static uint num_thread_arenas;
+static void *thread_arena_lock;
+static int tls_idx_replace = -1;
+
+/* With -thread_arenas, each thread arena's delay list is a shard of one
+ * logical delayed-free FIFO.  A shard accumulates a local batch of frees under
+ * its own arena lock and then publishes the batch's counts to a global FIFO of
+ * batch records, to which -delay_frees and -delay_frees_maxsz are applied.
+ * Once over quota, the oldest batches are retired: their shards owe that many
+ * chunks, which are shifted off the shard's delay front by the next thread to
+ * free into that arena.  Until then retired chunks keep CHUNK_DELAY_FREE, so
+ * alloc_replace_overlaps_delayed_free() remains accurate.
+ */
+typedef struct _delay_batch_t {
+    arena_header_t *arena;
+    uint chunks;
+    size_t bytes;
+    struct _delay_batch_t *next;
+} delay_batch_t;
+
+/* Upper bound on a local batch, to keep retirement roughly FIFO across shards */
+#define DELAY_BATCH_MAX_CHUNKS 32
+
+static bool delay_sharded;
+static uint delay_batch_chunks;
+static size_t delay_batch_bytes;
+static void *delay_batch_lock;
+static delay_batch_t *delay_batch_front;
+static delay_batch_t *delay_batch_last;
+static uint delay_global_chunks;
+static size_t delay_global_bytes;
+
+/* With alloc_ops.iteration_arenas, a thread between
+ * alloc_replace_iteration_start() and alloc_replace_iteration_end() allocates
+ * from its own iteration arena, which the end call throws away wholesale by
+ * resetting each sub-arena's next_chunk and the free lists, rather than by
+ * freeing or unmapping anything.  The arenas are kept, already reset, on this
+ * list for reuse by later iterations.  As with thread arenas, thread_users
+ * (0 or 1) says whether an arena is in use, and next_thread_arena links the
+ * list, protected by thread_arena_lock.  Chunks in an iteration arena are
+ * never mmapped separately nor part of the sharded delay list, so that a
+ * reset is all that is needed to recycle the arena.
+ */
+static arena_header_t *iter_arena_list;
+static int tls_idx_iter = -1;
+#endif
+
+/* With alloc_ops.sample_allocs, a random one in every sample_allocs
+ * allocations, on average, is mmapped on its own as a guard chunk (see
+ * CHUNK_GUARD_PAGE).  When a guard chunk is freed, its whole mapping is made
+ * inaccessible and kept on a FIFO of up to SAMPLE_DELAY_FREES entries, so that
+ * a later access faults, until it is pushed out and unmapped.  As the header
+ * is then inaccessible, each entry holds a copy of the chunk's info, whose
+ * client_data is the free callstack.  The FIFO is protected by sample_lock.
+ */
+#define SAMPLE_DELAY_FREES 256
+
+typedef struct _sample_free_t {
+    byte *map;
+    size_t map_size;
+    malloc_info_t info;
+} sample_free_t;
+
+static volatile int sample_countdown;
+static void *sample_lock;
+static sample_free_t sample_frees[SAMPLE_DELAY_FREES];
+static uint sample_free_next; /* the oldest entry, once full */
+static uint sample_free_count;
+
 /* For handling pre-us mallocs for non-earliest injection or delayed/attach
- * instrumentation.  Contains chunk_header_t entries.
- * We assume this table is only added to at init and only removed from
- * at exit time and thus needs no external lock.
+ * instrumentation.  An attached process can have millions of these, so
+ * rather than allocating a header and a hashtable entry for each one we
+ * import them in bulk into one array, which we sort by address once on
+ * first use and binary-search from then on.
+ * We assume this array is only added to at init, before any lookup, and
+ * only freed at exit time.  The sort is the only later change and it is
+ * synchronized by pre_us_lock.
  */
-#define PRE_US_TABLE_HASH_BITS 8
-static hashtable_t pre_us_table;
+typedef struct _pre_us_chunk_t {
+    byte *start;
+    chunk_header_t head;
+} pre_us_chunk_t;
+
+#define PRE_US_INITIAL_CAPACITY 256
+static pre_us_chunk_t *pre_us_chunks;
+static uint pre_us_num;
+static uint pre_us_capacity;
+static volatile bool pre_us_sorted = true;
+static void *pre_us_lock;
 
 /* XXX i#879: for pattern mode we ideally don't want any co-located
  * headers and instead want a hashtable of live allocs (free are in
@@ -397,6 +568,14 @@ static uint num_coalesces;
 static uint num_dealloc;
 static uint dbgcrt_mismatch;
 static uint allocs_left_native;
+static uint thread_arena_foreign_frees;
+static uint free_cache_hits;
+static uint aligned_cache_hits;
+static uint aligned_tails_trimmed;
+static uint delay_batches_published;
+static uint realloc_grown_in_place;
+static uint zeroing_skipped;
+static uint heap_destroy_bulk_frees;
 #endif
 
 #ifdef DEBUG
@@ -441,6 +620,7 @@ typedef enum {
     ALLOC_ALLOW_EMPTY      = 0x0080, /* realloc: size==0 does re-allocate */
     ALLOC_IGNORE_MISMATCH  = 0x0100, /* free, realloc, size */
     ALLOC_IS_QUERY         = 0x0200, /* check_type_match */
+    ALLOC_FRESH            = 0x0400, /* client notify: untouched since OS zeroed it */
 } alloc_flags_t;
 
 /***************************************************************************
@@ -774,7 +954,8 @@ notify_client_alloc(void *drcontext, byte *ptr, chunk_header_t *head,
     malloc_info_t info = { sizeof(info), ptr, chunk_request_size(head),
                            head->alloc_size, false/*!pre_us*/, true/*redzone*/,
                            TEST(ALLOC_ZERO, flags), TEST(ALLOC_IS_REALLOC, flags),
-                           0, head->user_data };
+                           0, head->user_data, TEST(ALLOC_FRESH, flags),
+                           false/*!heap_destroyed*/ };
     if (TEST(ALLOC_INVOKE_CLIENT_DATA, flags)) {
         head->user_data = client_add_malloc_pre(&info, mc, caller);
         info.client_data = head->user_data;
@@ -928,13 +1109,122 @@ is_live_alloc(void *ptr, arena_header_t *arena, chunk_header_t *head)
             (TEST(CHUNK_MMAP, head->flags) || ptr_is_in_arena(ptr, arena)));
 }
 
+/* i#948: with -thread_arenas, a chunk can be freed, reallocated, or queried
+ * by a thread other than the one that allocated it.  Similarly, with
+ * iteration arenas a chunk can be freed from or into an iteration arena.
+ * If ptr is a valid chunk inside some other arena, returns that arena's main arena;
+ * else, returns arena unchanged.  As with is_live_alloc(), large allocs are
+ * their own arenas and need no switch.
+ */
+static arena_header_t *
+arena_for_foreign_chunk(arena_header_t *arena, void *ptr, chunk_header_t *head)
+{
+#ifdef LINUX
+    byte *region_start;
+    uint region_flags;
+    arena_header_t *owner;
+    if ((alloc_ops.thread_arenas == 0 && !alloc_ops.iteration_arenas) ||
+        !is_valid_chunk(ptr, head))
+        return arena;
+    if (!heap_region_bounds(ptr, &region_start, NULL, &region_flags) ||
+        !TEST(HEAP_ARENA, region_flags) || TEST(HEAP_PRE_US, region_flags))
+        return arena;
+    owner = ((arena_header_t *)region_start)->main_arena;
+    if (owner == arena || !ptr_is_in_arena(ptr, owner))
+        return arena;
+    LOG(3, "%s: "PFX" belongs to arena "PFX", not "PFX"\n", __FUNCTION__,
+        ptr, owner, arena);
+    STATS_INC(thread_arena_foreign_frees);
+    return owner;
+#else
+    return arena;
+#endif
+}
+
+static inline bool
+pre_us_chunk_less(pre_us_chunk_t *c1, pre_us_chunk_t *c2)
+{
+    return c1->start < c2->start;
+}
+
+/* A heapsort, as with the symbol batch sort, as we have no qsort */
+static void
+pre_us_sift_down(pre_us_chunk_t *a, uint root, uint n)
+{
+    while (2*root + 1 < n) {
+        uint child = 2*root + 1;
+        pre_us_chunk_t tmp;
+        if (child + 1 < n && pre_us_chunk_less(&a[child], &a[child+1]))
+            child++;
+        if (!pre_us_chunk_less(&a[root], &a[child]))
+            return;
+        tmp = a[root];
+        a[root] = a[child];
+        a[child] = tmp;
+        root = child;
+    }
+}
+
+/* Sorts the imported pre-us chunks, if they did not arrive in order */
+static void
+pre_us_chunks_prepare(void)
+{
+    uint i;
+    if (pre_us_sorted)
+        return;
+    dr_mutex_lock(pre_us_lock);
+    if (!pre_us_sorted) {
+        LOG(2, "sorting %u pre-us allocs\n", pre_us_num);
+        for (i = pre_us_num/2; i > 0; i--)
+            pre_us_sift_down(pre_us_chunks, i - 1, pre_us_num);
+        for (i = pre_us_num; i > 1; i--) {
+            pre_us_chunk_t tmp = pre_us_chunks[0];
+            pre_us_chunks[0] = pre_us_chunks[i - 1];
+            pre_us_chunks[i - 1] = tmp;
+            pre_us_sift_down(pre_us_chunks, 0, i - 1);
+        }
+        pre_us_sorted = true;
+    }
+    dr_mutex_unlock(pre_us_lock);
+}
+
+/* Returns the index of the first pre-us chunk that ends after addr */
+static uint
+pre_us_chunk_search(byte *addr)
+{
+    uint lo = 0, hi = pre_us_num;
+    pre_us_chunks_prepare();
+    /* chunks do not overlap, so sorting by start also sorts by end */
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (pre_us_chunks[mid].start + pre_us_chunks[mid].head.alloc_size <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Returns the header of the pre-us chunk starting at ptr, or NULL */
+static chunk_header_t *
+pre_us_lookup(void *ptr)
+{
+    uint idx;
+    if (pre_us_num == 0)
+        return NULL;
+    idx = pre_us_chunk_search((byte *)ptr);
+    if (idx < pre_us_num && pre_us_chunks[idx].start == (byte *)ptr)
+        return &pre_us_chunks[idx].head;
+    return NULL;
+}
+
 /* returns NULL if an invalid ptr, but will return a freed chunk */
 static inline chunk_header_t *
 header_from_ptr_include_pre_us(void *ptr)
 {
     chunk_header_t *head = header_from_ptr(ptr);
     if (!is_valid_chunk(ptr, head))
-        head = hashtable_lookup(&pre_us_table, (void *)ptr);
+        head = pre_us_lookup(ptr);
     return head;
 }
 
@@ -949,11 +1239,13 @@ header_to_info(chunk_header_t *head, malloc_info_t *info, byte *pre_us_base,
     ASSERT(!info->pre_us || pre_us_base != NULL, "need base for pre-us!");
     info->request_size = chunk_request_size(head);
     info->pad_size = head->alloc_size;
-    info->has_redzone = !info->pre_us;
+    info->has_redzone = !info->pre_us && !TEST(CHUNK_GUARD_PAGE, head->flags);
     info->zeroed = TEST(ALLOC_ZERO, flags);
     info->realloc = TEST(ALLOC_IS_REALLOC, flags);
     info->client_flags = head->flags & MALLOC_POSSIBLE_CLIENT_FLAGS;
     info->client_data = head->user_data;
+    info->fresh = TEST(ALLOC_FRESH, flags);
+    info->heap_destroyed = false;
 }
 
 /* Assumes caller zeroed the full struct and initialized the commit_end and
@@ -971,6 +1263,7 @@ arena_init(arena_header_t *arena, arena_header_t *parent)
         arena->dr_lock = parent->dr_lock;
 #endif
         arena->free_list = parent->free_list;
+        arena->main_arena = parent->main_arena;
 #ifdef WINDOWS
         arena->alloc_set_member = parent->alloc_set_member;
         arena->modbase = parent->modbase;
@@ -998,6 +1291,7 @@ arena_init(arena_header_t *arena, arena_header_t *parent)
          */
         arena->free_list = (free_lists_t *) ((byte *)arena + header_size);
         header_size += sizeof(*arena->free_list);
+        arena->main_arena = arena;
 #ifdef WINDOWS
         arena->alloc_set_member = NULL;
         arena->modbase = NULL;
@@ -1012,12 +1306,14 @@ arena_init(arena_header_t *arena, arena_header_t *parent)
         /* XXX: this wastes the initial redzone for !shared_redzones */
         ALIGN_FORWARD(header_size, CHUNK_ALIGNMENT) + inter_chunk_space();
     arena->next_chunk = arena->start_chunk;
+    /* Callers whose memory is fresh from the OS lower this to start_chunk */
+    arena->zeroed_from = arena->commit_end;
     arena->magic = HEADER_MAGIC;
     arena->next_arena = NULL;
     arena->prev_free_sz = 0;
-    STATS_ADD(heap_capacity, (uint)(arena->commit_end - (byte *)arena));
+    STATS_GLOBAL_ADD(heap_capacity, (uint)(arena->commit_end - (byte *)arena));
     STATS_PEAK(heap_capacity);
-    STATS_INC(num_arenas);
+    STATS_GLOBAL_INC(num_arenas);
     STATS_PEAK(num_arenas);
     if (parent != NULL) {
         ASSERT(parent->next_arena == NULL, "should only append to end");
@@ -1054,6 +1350,42 @@ arena_free(arena_header_t *arena)
     arena_deallocate(arena);
 }
 
+#ifdef LINUX
+# ifndef MPOL_PREFERRED
+#  define MPOL_PREFERRED 1
+# endif
+
+/* Returns the NUMA node of the CPU we're currently running on */
+static uint
+current_numa_node(void)
+{
+    uint cpu, node;
+    if (raw_syscall(SYS_getcpu, 3, &cpu, &node, NULL) != 0)
+        return 0;
+    return node;
+}
+
+/* For -numa_arenas: sets arena's memory, including any later in-place
+ * extension, to prefer node.  Pages already touched are not migrated.
+ */
+static void
+arena_prefer_numa_node(arena_header_t *arena, uint node)
+{
+    unsigned long nodemask;
+    ptr_int_t res;
+    if (node >= sizeof(nodemask) * 8) {
+        LOG(1, "NUMA node %d is too large to bind arena "PFX"\n", node, arena);
+        return;
+    }
+    nodemask = 1UL << node;
+    /* The kernel reads one fewer bit than maxnode */
+    res = raw_syscall(SYS_mbind, 6, arena, arena->reserve_end - (byte *)arena,
+                      MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8 + 1, 0);
+    LOG(2, "%s: arena "PFX"-"PFX" => node %d: %d\n", __FUNCTION__,
+        arena, arena->reserve_end, node, (int)res);
+}
+#endif
+
 static arena_header_t *
 arena_create(arena_header_t *parent, size_t initial_size)
 {
@@ -1071,6 +1403,13 @@ arena_create(arena_header_t *parent, size_t initial_size)
     new_arena->reserve_end = (byte *)new_arena + init_size;
     heap_region_add((byte *)new_arena, new_arena->reserve_end, HEAP_ARENA, NULL);
     arena_init(new_arena, parent);
+    new_arena->zeroed_from = new_arena->start_chunk;
+#ifdef LINUX
+    if (TEST(ARENA_NUMA_BOUND, new_arena->flags)) {
+        new_arena->numa_node = parent->main_arena->numa_node;
+        arena_prefer_numa_node(new_arena, new_arena->numa_node);
+    }
+#endif
     return new_arena;
 }
 
@@ -1088,7 +1427,7 @@ arena_extend(arena_header_t *arena, heapsz_t add_size)
         byte *new_brk = set_brk(cur_brk + aligned_add);
         if (new_brk >= cur_brk + add_size) {
             LOG(2, "\tincreased brk from "PFX" to "PFX"\n", cur_brk, new_brk);
-            STATS_ADD(heap_capacity, (uint)(new_brk - cur_brk));
+            STATS_GLOBAL_ADD(heap_capacity, (uint)(new_brk - cur_brk));
             STATS_PEAK(heap_capacity);
             cur_brk = new_brk;
             arena->commit_end = new_brk;
@@ -1109,7 +1448,7 @@ arena_extend(arena_header_t *arena, heapsz_t add_size)
         if (os_large_alloc_extend((byte *)arena, cur_size, new_size
                                   _IF_WINDOWS(arena_page_prot(arena->flags)))) {
             LOG(2, "\textended arena to "PFX"-"PFX"\n", arena, (byte*)arena + new_size);
-            STATS_ADD(heap_capacity, (uint)(new_size - cur_size));
+            STATS_GLOBAL_ADD(heap_capacity, (uint)(new_size - cur_size));
             STATS_PEAK(heap_capacity);
             arena->commit_end = (byte *)arena + new_size;
 #ifdef UNIX /* windows already added whole reservation */
@@ -1124,7 +1463,14 @@ arena_extend(arena_header_t *arena, heapsz_t add_size)
         return NULL;
 #endif
     /* XXX: add stranded space at end of arena to free list */
-    new_arena = arena_create(arena, 0/*default*/);
+#ifdef LINUX
+    /* An iteration arena holds even large chunks, which can exceed the default */
+    if (TEST(ARENA_ITERATION, arena->flags) &&
+        aligned_add + PAGE_SIZE > ARENA_INITIAL_SIZE)
+        new_arena = arena_create(arena, aligned_add + PAGE_SIZE);
+    else
+#endif
+        new_arena = arena_create(arena, 0/*default*/);
     LOG(1, "cur arena "PFX"-"PFX" out of space: created new one @"PFX"\n",
         (byte *)arena, arena->reserve_end, new_arena);
     return new_arena;
@@ -1293,7 +1639,7 @@ consider_giving_back_memory(arena_header_t *arena, chunk_header_t *tofree)
                 if (new_brk <= cur_brk) {
                     LOG(2, "shrinking brk "PFX"-"PFX" to "PFX"-"PFX"\n",
                         pre_us_brk, cur_brk, pre_us_brk, new_brk);
-                    STATS_ADD(heap_capacity, (int)(new_brk - cur_brk));
+                    STATS_GLOBAL_ADD(heap_capacity, (int)(new_brk - cur_brk));
                     STATS_INC(num_dealloc);
                     heap_region_remove(new_brk, cur_brk, NULL);
                     cur_brk = new_brk;
@@ -1320,9 +1666,9 @@ consider_giving_back_memory(arena_header_t *arena, chunk_header_t *tofree)
                 } else {
                     LOG(2, "de-allocating arena "PFX"-"PFX"\n", sub, sub->reserve_end);
                     prev->next_arena = sub->next_arena;
-                    STATS_ADD(heap_capacity, -(int)(sub->commit_end - (byte *)sub));
+                    STATS_GLOBAL_ADD(heap_capacity, -(int)(sub->commit_end - (byte *)sub));
                     STATS_INC(num_dealloc);
-                    STATS_DEC(num_arenas);
+                    STATS_GLOBAL_DEC(num_arenas);
                     heap_region_remove((byte *)sub, sub->reserve_end, NULL);
                     arena_deallocate(sub);
                     return NULL;
@@ -1414,6 +1760,145 @@ coalesce_adjacent_frees(arena_header_t *arena, free_header_t *cur)
     return consider_giving_back_memory(arena, tofree);
 }
 
+/* Moves a no-longer-delayed chunk into the free lists, coalescing it first */
+static void
+add_to_free_list_coalesced(arena_header_t *arena, free_header_t *cur)
+{
+    cur->head.flags &= ~CHUNK_DELAY_FREE;
+    /* We coalesce here, rather than on initial free, b/c only now
+     * can we throw away the user_data
+     */
+    cur = coalesce_adjacent_frees(arena, cur);
+    if (cur != NULL) {
+        set_prev_size_field(arena, &cur->head);
+        add_to_free_list(arena, &cur->head);
+        ASSERT(!TEST(CHUNK_PREV_FREE, cur->head.flags), "no adjacent frees");
+        DOLOG(2, {
+            chunk_header_t *next = next_chunk_forward(arena, &cur->head, NULL);
+            ASSERT(next == NULL || TEST(CHUNK_PREV_FREE, next->flags),
+                   "missing prev free pointer");
+        });
+    }
+}
+
+/* Returns whether cur, which has just left the delay list, was placed in the
+ * free cache
+ */
+static bool
+add_to_free_cache(arena_header_t *arena, free_header_t *cur)
+{
+    uint bucket = bucket_index(&cur->head);
+    if (bucket >= NUM_FREE_CACHE_LISTS ||
+        arena->free_list->cache_count[bucket] >= FREE_CACHE_DEPTH)
+        return false;
+    ASSERT(TEST(CHUNK_DELAY_FREE, cur->head.flags), "cache entries must stay delayed");
+    arena->free_list->cache[bucket][arena->free_list->cache_count[bucket]++] = cur;
+    LOG(3, "%s: "PFX" => bucket %d count %d\n", __FUNCTION__, cur, bucket,
+        arena->free_list->cache_count[bucket]);
+    return true;
+}
+
+/* Returns a chunk of at least free_list_sizes[bucket] bytes, or NULL.
+ * The returned chunk is no longer marked as delayed.
+ */
+static chunk_header_t *
+take_from_free_cache(arena_header_t *arena, uint bucket)
+{
+    free_header_t *cur;
+    if (bucket >= NUM_FREE_CACHE_LISTS || arena->free_list->cache_count[bucket] == 0)
+        return NULL;
+    cur = arena->free_list->cache[bucket][--arena->free_list->cache_count[bucket]];
+    ASSERT(cur->head.alloc_size >= free_list_sizes[bucket], "cache bucket invariant");
+    cur->head.flags &= ~CHUNK_DELAY_FREE;
+    STATS_INC(free_cache_hits);
+    LOG(3, "%s: bucket %d => "PFX"\n", __FUNCTION__, bucket, cur);
+    return &cur->head;
+}
+
+#ifdef X64
+static uint
+align_shift_of(size_t alignment)
+{
+    uint shift = 0;
+    while (((size_t)1 << shift) < alignment)
+        shift++;
+    return shift;
+}
+
+/* Returns whether cur, which has just left the delay list, was placed in the
+ * aligned cache
+ */
+static bool
+add_to_aligned_cache(arena_header_t *arena, free_header_t *cur)
+{
+    uint shift = cur->head.u.unfree.align_shift;
+    uint list;
+    if (shift < ALIGNED_CACHE_MIN_SHIFT || shift > ALIGNED_CACHE_MAX_SHIFT)
+        return false;
+    list = shift - ALIGNED_CACHE_MIN_SHIFT;
+    if (arena->free_list->aligned_cache_count[list] >= ALIGNED_CACHE_DEPTH)
+        return false;
+    ASSERT(TEST(CHUNK_DELAY_FREE, cur->head.flags), "cache entries must stay delayed");
+    ASSERT(ALIGNED(ptr_from_header(&cur->head), (size_t)1 << shift),
+           "aligned chunk lost its alignment");
+    arena->free_list->aligned_cache[list]
+        [arena->free_list->aligned_cache_count[list]++] = cur;
+    LOG(3, "%s: "PFX" => shift %d count %d\n", __FUNCTION__, cur, shift,
+        arena->free_list->aligned_cache_count[list]);
+    return true;
+}
+
+/* Returns a chunk whose user memory is aligned to alignment and holds at least
+ * size bytes, or NULL.  The returned chunk is no longer marked as delayed.
+ */
+static chunk_header_t *
+take_from_aligned_cache(arena_header_t *arena, size_t alignment, heapsz_t size)
+{
+    uint shift = align_shift_of(alignment);
+    uint list, i;
+    free_header_t **entries;
+    if (shift < ALIGNED_CACHE_MIN_SHIFT || shift > ALIGNED_CACHE_MAX_SHIFT)
+        return NULL;
+    list = shift - ALIGNED_CACHE_MIN_SHIFT;
+    entries = arena->free_list->aligned_cache[list];
+    /* Newest first, like the free cache */
+    for (i = arena->free_list->aligned_cache_count[list]; i > 0; i--) {
+        free_header_t *cur = entries[i - 1];
+        if (cur->head.alloc_size >= size) {
+            entries[i - 1] = entries[--arena->free_list->aligned_cache_count[list]];
+            cur->head.flags &= ~CHUNK_DELAY_FREE;
+            STATS_INC(aligned_cache_hits);
+            LOG(3, "%s: shift %d => "PFX"\n", __FUNCTION__, shift, cur);
+            return &cur->head;
+        }
+    }
+    return NULL;
+}
+#endif
+
+/* Gives up everything in the free caches, for when we're out of memory */
+static void
+flush_free_cache(arena_header_t *arena)
+{
+    uint bucket;
+    for (bucket = 0; bucket < NUM_FREE_CACHE_LISTS; bucket++) {
+        while (arena->free_list->cache_count[bucket] > 0) {
+            add_to_free_list_coalesced
+                (arena, arena->free_list->cache[bucket]
+                 [--arena->free_list->cache_count[bucket]]);
+        }
+    }
+#ifdef X64
+    for (bucket = 0; bucket < NUM_ALIGNED_CACHE_LISTS; bucket++) {
+        while (arena->free_list->aligned_cache_count[bucket] > 0) {
+            add_to_free_list_coalesced
+                (arena, arena->free_list->aligned_cache[bucket]
+                 [--arena->free_list->aligned_cache_count[bucket]]);
+        }
+    }
+#endif
+}
+
 static bool
 shift_from_delay_list_to_free_list(arena_header_t *arena)
 {
@@ -1421,7 +1906,6 @@ shift_from_delay_list_to_free_list(arena_header_t *arena)
     if (cur == NULL)
         return false;
     LOG(3, "%s: shifting "PFX" to regular free list\n", __FUNCTION__, cur);
-    cur->head.flags &= ~CHUNK_DELAY_FREE;
     arena->free_list->delay_front = cur->next;
     if (cur == arena->free_list->delay_last)
         arena->free_list->delay_last = NULL;
@@ -1433,23 +1917,109 @@ shift_from_delay_list_to_free_list(arena_header_t *arena)
     LOG(3, "%s: updated delayed chunks=%d, bytes="PIFX"\n", __FUNCTION__,
         arena->free_list->delayed_chunks, arena->free_list->delayed_bytes);
 
-    /* We coalesce here, rather than on initial free, b/c only now
-     * can we throw away the user_data
-     */
-    cur = coalesce_adjacent_frees(arena, cur);
-    if (cur != NULL) {
-        set_prev_size_field(arena, &cur->head);
-        add_to_free_list(arena, &cur->head);
-        ASSERT(!TEST(CHUNK_PREV_FREE, cur->head.flags), "no adjacent frees");
-        DOLOG(2, {
-            chunk_header_t *next = next_chunk_forward(arena, &cur->head, NULL);
-            ASSERT(next == NULL || TEST(CHUNK_PREV_FREE, next->flags),
-                   "missing prev free pointer");
-        });
-    }
+#ifdef X64
+    if (add_to_aligned_cache(arena, cur))
+        return true;
+#endif
+    if (!add_to_free_cache(arena, cur))
+        add_to_free_list_coalesced(arena, cur);
     return true;
 }
 
+/* Shifts the oldest delayed chunk regardless of the delay thresholds */
+static bool
+shift_from_delay_list_early(arena_header_t *arena)
+{
+#ifdef LINUX
+    free_lists_t *fl = arena->free_list;
+    if (delay_sharded && !TEST(ARENA_ITERATION, arena->flags) &&
+        fl->delay_front != NULL) {
+        if (fl->delayed_chunks > fl->batch_chunks)
+            fl->early_chunks++;
+        else {
+            /* the front is part of the unpublished batch */
+            fl->batch_chunks--;
+            fl->batch_bytes -= fl->delay_front->head.alloc_size;
+        }
+    }
+#endif
+    return shift_from_delay_list_to_free_list(arena);
+}
+
+#ifdef LINUX
+/* Shifts the chunks that arena owes from retired batches.
+ * Caller must hold arena's lock.
+ */
+static void
+delay_shard_drain(arena_header_t *arena)
+{
+    free_lists_t *fl = arena->free_list;
+    uint owed;
+    /* A racy read is fine: we'll see a new debt on the next free */
+    if (fl->owed_chunks == 0)
+        return;
+    dr_mutex_lock(delay_batch_lock);
+    owed = fl->owed_chunks;
+    fl->owed_chunks = 0;
+    dr_mutex_unlock(delay_batch_lock);
+    LOG(3, "%s: arena "PFX" owes %d chunks, %d shifted early\n", __FUNCTION__,
+        arena, owed, fl->early_chunks);
+    for (; owed > 0; owed--) {
+        if (fl->early_chunks > 0)
+            fl->early_chunks--;
+        else if (!shift_from_delay_list_to_free_list(arena))
+            break;
+    }
+}
+
+/* Publishes arena's local batch to the global FIFO, retiring the oldest
+ * batches while over either delay threshold.
+ * Caller must hold arena's lock.
+ */
+static void
+delay_shard_publish(arena_header_t *arena)
+{
+    free_lists_t *fl = arena->free_list;
+    uint published = fl->batch_chunks;
+    delay_batch_t *batch = (delay_batch_t *)
+        global_alloc(sizeof(*batch), HEAPSTAT_WRAP);
+    batch->arena = arena;
+    batch->chunks = fl->batch_chunks;
+    batch->bytes = fl->batch_bytes;
+    batch->next = NULL;
+    fl->batch_chunks = 0;
+    fl->batch_bytes = 0;
+    STATS_INC(delay_batches_published);
+
+    dr_mutex_lock(delay_batch_lock);
+    if (delay_batch_last == NULL)
+        delay_batch_front = batch;
+    else
+        delay_batch_last->next = batch;
+    delay_batch_last = batch;
+    delay_global_chunks += batch->chunks;
+    delay_global_bytes += batch->bytes;
+    while (delay_batch_front != NULL &&
+           (delay_global_chunks >= alloc_ops.delay_frees ||
+            delay_global_bytes >= alloc_ops.delay_frees_maxsz)) {
+        delay_batch_t *oldest = delay_batch_front;
+        delay_batch_front = oldest->next;
+        if (delay_batch_front == NULL)
+            delay_batch_last = NULL;
+        ASSERT(delay_global_chunks >= oldest->chunks &&
+               delay_global_bytes >= oldest->bytes, "delay batch counters off");
+        delay_global_chunks -= oldest->chunks;
+        delay_global_bytes -= oldest->bytes;
+        oldest->arena->free_list->owed_chunks += oldest->chunks;
+        global_free(oldest, sizeof(*oldest), HEAPSTAT_WRAP);
+    }
+    LOG(3, "%s: published %d chunks from "PFX": global chunks=%d, bytes="PIFX"\n",
+        __FUNCTION__, published, arena, delay_global_chunks,
+        delay_global_bytes);
+    dr_mutex_unlock(delay_batch_lock);
+}
+#endif
+
 static void
 add_to_delay_list(arena_header_t *arena, chunk_header_t *head)
 {
@@ -1469,6 +2039,18 @@ add_to_delay_list(arena_header_t *arena, chunk_header_t *head)
     LOG(3, "%s: updated delayed chunks=%d, bytes="PIFX"\n", __FUNCTION__,
         arena->free_list->delayed_chunks, arena->free_list->delayed_bytes);
 
+#ifdef LINUX
+    if (delay_sharded && !TEST(ARENA_ITERATION, arena->flags)) {
+        /* The thresholds are global, so we leave them to delay_shard_publish() */
+        arena->free_list->batch_chunks++;
+        arena->free_list->batch_bytes += head->alloc_size;
+        if (arena->free_list->batch_chunks >= delay_batch_chunks ||
+            arena->free_list->batch_bytes >= delay_batch_bytes)
+            delay_shard_publish(arena);
+        delay_shard_drain(arena);
+        return;
+    }
+#endif
     while (arena_delayed_list_full(arena)) {
         /* Keep shifting first delayed entry to the free lists, until we're
          * below both thresholds.
@@ -1547,8 +2129,33 @@ split_piece_for_free_list(arena_header_t *arena, chunk_header_t *head,
     iterator_unlock(arena, true/*in alloc*/);
 }
 
+/* Splits off all but the first keep_size bytes of head, which must exceed
+ * keep_size by more than a minimal chunk, as a separate free entry
+ */
+static void
+split_off_tail(arena_header_t *arena, chunk_header_t *head, heapsz_t keep_size)
+{
+    byte *split = ptr_from_header(head) + keep_size +
+        (alloc_ops.shared_redzones ? 0 : alloc_ops.redzone_size);
+    size_t rest_size = head->alloc_size - (keep_size + inter_chunk_space());
+    byte *chunk2_start = split + inter_chunk_space() -
+        (alloc_ops.shared_redzones ? 0 : alloc_ops.redzone_size);
+    free_header_t *rest = (free_header_t *) header_from_ptr(chunk2_start);
+    /* The rest inherits head's flags, but its prev is head, which is not free */
+    ushort prev_free = head->flags & CHUNK_PREV_FREE;
+    ASSERT(!TEST(CHUNK_MMAP, head->flags), "mmap not expected on free list");
+    ASSERT(head->alloc_size > keep_size + CHUNK_MIN_SIZE + inter_chunk_space(),
+           "tail too small to split");
+    STATS_INC(num_splits);
+    head->flags &= ~CHUNK_PREV_FREE;
+    split_piece_for_free_list(arena, head, rest, rest_size, keep_size);
+    head->flags |= prev_free;
+    ASSERT(is_valid_chunk(chunk2_start, &rest->head), "rest chunk inconsistent");
+}
+
 static chunk_header_t *
-find_free_list_entry(arena_header_t *arena, heapsz_t request_size, heapsz_t aligned_size)
+find_free_list_entry(arena_header_t *arena, heapsz_t request_size, heapsz_t aligned_size,
+                     size_t alignment)
 {
     chunk_header_t *head = NULL;
     uint bucket;
@@ -1571,6 +2178,16 @@ find_free_list_entry(arena_header_t *arena, heapsz_t request_size, heapsz_t alig
      * and doesn't seem to help much on others so I removed it.
      */
 
+    /* The caches are guaranteed to fit, like the non-var-size buckets */
+#ifdef X64
+    if (alignment > CHUNK_ALIGNMENT) {
+        head = take_from_aligned_cache(arena, alignment,
+                                       ALIGN_FORWARD(request_size, CHUNK_ALIGNMENT));
+    }
+    if (head == NULL)
+#endif
+        head = take_from_free_cache(arena, bucket);
+
     /* Use a larger bucket to avoid delaying a ton of allocs of a
      * certain size and never re-using them for pathological app alloc
      * sequences.  I used to do this only when delayed frees were piling
@@ -1613,18 +2230,8 @@ find_free_list_entry(arena_header_t *arena, heapsz_t request_size, heapsz_t alig
             head->alloc_size, request_size, aligned_size, bucket);
 
         /* if there's a lot of extra room, split it off as a separate free entry */
-        if (head->alloc_size > aligned_size + CHUNK_MIN_SIZE + inter_chunk_space()) {
-            byte *split = ptr_from_header(head) + aligned_size +
-                (alloc_ops.shared_redzones ? 0 : alloc_ops.redzone_size);
-            size_t rest_size = head->alloc_size - (aligned_size + inter_chunk_space());
-            byte *chunk2_start = split + inter_chunk_space() -
-                (alloc_ops.shared_redzones ? 0 : alloc_ops.redzone_size);
-            free_header_t *rest = (free_header_t *) header_from_ptr(chunk2_start);
-            ASSERT(!TEST(CHUNK_MMAP, head->flags), "mmap not expected on free list");
-            STATS_INC(num_splits);
-            split_piece_for_free_list(arena, head, rest, rest_size, aligned_size);
-            ASSERT(is_valid_chunk(chunk2_start, &rest->head), "rest chunk inconsistent");
-        }
+        if (head->alloc_size > aligned_size + CHUNK_MIN_SIZE + inter_chunk_space())
+            split_off_tail(arena, head, aligned_size);
 
         if (head->user_data != NULL) {
             client_malloc_data_free(head->user_data);
@@ -1641,6 +2248,87 @@ find_free_list_entry(arena_header_t *arena, heapsz_t request_size, heapsz_t alig
     return head;
 }
 
+static void
+sample_reset_countdown(void)
+{
+    /* Uniform in [1, 2*sample_allocs-1], for a mean of sample_allocs */
+    sample_countdown = 1 + dr_get_random_value(2 * alloc_ops.sample_allocs - 1);
+}
+
+/* Whichever thread takes the countdown to zero resets it, so races with other
+ * decrements only perturb the sampling interval.
+ */
+static bool
+sample_this_alloc(void)
+{
+    if (atomic_add32_return_sum(&sample_countdown, -1) != 0)
+        return false;
+    sample_reset_countdown();
+    return true;
+}
+
+/* Takes over freeing the mapping of a freed guard chunk */
+static void
+sample_delay_free(chunk_header_t *head, byte *map, size_t map_size,
+                  dr_mcontext_t *mc)
+{
+    sample_free_t *slot;
+    sample_free_t evict;
+    malloc_info_t info;
+    evict.map = NULL;
+    /* The header is about to become inaccessible */
+    header_to_info(head, &info, NULL, 0);
+    heap_region_remove(map, map + map_size, mc);
+    if (!dr_memory_protect(map, map_size, DR_MEMPROT_NONE)) {
+        LOG(1, "\tfailed to protect freed guard chunk "PFX"\n", map);
+        if (head->user_data != NULL)
+            client_malloc_data_free(head->user_data);
+        if (!os_large_free(map, map_size))
+            ASSERT(false, "munmap failed");
+        return;
+    }
+    dr_mutex_lock(sample_lock);
+    slot = &sample_frees[sample_free_next];
+    if (sample_free_count == SAMPLE_DELAY_FREES)
+        evict = *slot;
+    else
+        sample_free_count++;
+    slot->map = map;
+    slot->map_size = map_size;
+    slot->info = info;
+    sample_free_next = (sample_free_next + 1) % SAMPLE_DELAY_FREES;
+    dr_mutex_unlock(sample_lock);
+    LOG(2, "\tguard chunk "PFX" freed => delayed @"PFX"\n", info.base, map);
+    if (evict.map != NULL) {
+        LOG(2, "\tdelayed guard chunk "PFX" => munmap\n", evict.map);
+        if (evict.info.client_data != NULL)
+            client_malloc_data_free(evict.info.client_data);
+        if (!os_large_free(evict.map, evict.map_size))
+            ASSERT(false, "munmap failed");
+    }
+}
+
+static bool
+sample_delayed_lookup(byte *addr, malloc_info_t *info OUT)
+{
+    bool found = false;
+    uint i;
+    if (alloc_ops.sample_allocs == 0)
+        return false;
+    dr_mutex_lock(sample_lock);
+    for (i = 0; i < sample_free_count; i++) {
+        if (addr >= sample_frees[i].map &&
+            addr < sample_frees[i].map + sample_frees[i].map_size) {
+            if (info != NULL)
+                *info = sample_frees[i].info;
+            found = true;
+            break;
+        }
+    }
+    dr_mutex_unlock(sample_lock);
+    return found;
+}
+
 /* i#1581: to avoid retaddr local vars from callstack walks messing up app
  * callstacks, we invoke the 2nd layer on a clean dstack (this lets us keep
  * just the outer layer as stdcall, and avoids complicating drwrap further).
@@ -1652,6 +2340,21 @@ find_free_list_entry(arena_header_t *arena, heapsz_t request_size, heapsz_t alig
                            (void *)(ptr_uint_t)(flags), \
                            dc, mc, caller, (void *)(ptr_uint_t)(alloc_type))
 
+/* Returns the size of a chunk carved at the arena top, whose user memory would
+ * otherwise start at next_chunk, that holds request_size bytes at the given
+ * alignment plus any pre-aligned padding, which must fit a free chunk.
+ */
+static heapsz_t
+aligned_carve_size(byte *next_chunk, size_t request_size, size_t alignment)
+{
+    heapsz_t size = MAX(ALIGN_FORWARD(request_size, CHUNK_ALIGNMENT), CHUNK_MIN_SIZE);
+    if (!ALIGNED(next_chunk, alignment)) {
+        size += (byte *) ALIGN_FORWARD(next_chunk + CHUNK_MIN_SIZE +
+                                       inter_chunk_space(), alignment) - next_chunk;
+    }
+    return size;
+}
+
 /* As noted in the flag definitions, ALLOC_INVOKE_CLIENT_* in flags
  * only applies to successful allocation: client is still notified on failure
  * and when client user data is freed or shifted.
@@ -1662,13 +2365,16 @@ find_free_list_entry(arena_header_t *arena, heapsz_t request_size, heapsz_t alig
  * Pass 0 if no special alignment is needed.
  */
 static byte *
-replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignment,
-                     alloc_flags_t flags, void *drcontext, dr_mcontext_t *mc,
-                     app_pc caller, uint alloc_type)
+replace_alloc_common_internal(arena_header_t *arena, size_t request_size,
+                              size_t alignment, alloc_flags_t flags, void *drcontext,
+                              dr_mcontext_t *mc, app_pc caller, uint alloc_type)
 {
     heapsz_t aligned_size;
     byte *res = NULL;
     chunk_header_t *head = NULL;
+    bool sampled;
+    /* Whether the chunk is untouched since the OS zeroed it */
+    bool fresh = false;
     ASSERT((alloc_type & ~(ALLOCATOR_TYPE_FLAGS)) == 0, "invalid type flags");
 
     if (request_size > UINT_MAX ||
@@ -1703,19 +2409,34 @@ replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignmen
     if (aligned_size < CHUNK_MIN_SIZE)
         aligned_size = CHUNK_MIN_SIZE;
 
+    sampled = (alloc_ops.sample_allocs > 0 && sample_this_alloc());
+
     arena_lock(drcontext, arena, TEST(ALLOC_SYNCHRONIZE, flags));
 
     /* for large requests we do direct mmap with own redzones.
      * we use the large malloc table to track them for iteration.
      * XXX: for simplicity, not delay-freeing these for now
+     * An iteration arena keeps them inline so that its reset reclaims them.
      */
-    if (aligned_size + header_size >= CHUNK_MIN_MMAP) {
+    if ((sampled || aligned_size + header_size >= CHUNK_MIN_MMAP)
+        IF_LINUX(&& !TEST(ARENA_ITERATION, arena->flags))) {
         mmap_header_t *mhead;
-        size_t map_size = (size_t)
-            ALIGN_FORWARD(aligned_size + sizeof(mmap_header_t) +
-                          alloc_ops.redzone_size*2 + header_beyond_redzone, PAGE_SIZE);
+        bool guard = sampled ||
+            (alloc_ops.guard_page_min_size > 0 &&
+             request_size >= alloc_ops.guard_page_min_size);
+        /* A guard chunk ends right before a trailing page that we make
+         * inaccessible, so an overflow faults instead of needing a redzone.
+         */
+        size_t map_size = guard ?
+            (size_t) ALIGN_FORWARD(aligned_size + sizeof(mmap_header_t) +
+                                   redzone_beyond_header + header_size, PAGE_SIZE) +
+            PAGE_SIZE :
+            (size_t) ALIGN_FORWARD(aligned_size + sizeof(mmap_header_t) +
+                                   alloc_ops.redzone_size*2 + header_beyond_redzone,
+                                   PAGE_SIZE);
         byte *map = os_large_alloc(map_size _IF_WINDOWS(map_size)
                                    _IF_WINDOWS(arena_page_prot(arena->flags)));
+        byte *guard_page = map + map_size - PAGE_SIZE;
         size_t dist_to_map;
         ASSERT(map_size >= aligned_size, "overflow should have been caught");
         LOG(2, "\tlarge alloc %zu => mmap %zu @"PFX"\n", request_size, map_size, map);
@@ -1726,13 +2447,24 @@ replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignmen
         ASSERT(!alloc_ops.external_headers, "NYI");
         mhead = (mmap_header_t *) map;
         mhead->map_size = map_size;
-        head = (chunk_header_t *)
-            ((byte *)map + sizeof(mmap_header_t) + alloc_ops.redzone_size +
-             header_beyond_redzone - redzone_beyond_header - header_size);
-        res = ptr_from_header(head);
-        if (!ALIGNED(res, alignment)) {
-            res = (byte *) ALIGN_FORWARD(res, alignment);
+        if (guard && !dr_memory_protect(guard_page, PAGE_SIZE, DR_MEMPROT_NONE)) {
+            LOG(1, "\tfailed to protect guard page "PFX"\n", guard_page);
+            guard = false;
+        }
+        if (guard) {
+            /* Any alignment padding, under alignment bytes, remains at the end */
+            res = (byte *) ALIGN_BACKWARD(guard_page - request_size, alignment);
             head = header_from_ptr(res);
+            ASSERT((byte *)head >= map + sizeof(mmap_header_t), "guard map too small");
+        } else {
+            head = (chunk_header_t *)
+                ((byte *)map + sizeof(mmap_header_t) + alloc_ops.redzone_size +
+                 header_beyond_redzone - redzone_beyond_header - header_size);
+            res = ptr_from_header(head);
+            if (!ALIGNED(res, alignment)) {
+                res = (byte *) ALIGN_FORWARD(res, alignment);
+                head = header_from_ptr(res);
+            }
         }
         dist_to_map = (byte *)head - map;
         if (dist_to_map > PREV_SIZE_MAX) {
@@ -1747,11 +2479,17 @@ replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignmen
         mhead->head = head;
         head->flags |= CHUNK_MMAP;
         head->magic = HEADER_MAGIC;
-        head->alloc_size = (map + map_size - alloc_ops.redzone_size - res);
+        if (guard) {
+            head->flags |= CHUNK_GUARD_PAGE;
+            head->alloc_size = (guard_page - res);
+            LOG(2, "\tguard page @"PFX" after "PFX"\n", guard_page, res);
+        } else
+            head->alloc_size = (map + map_size - alloc_ops.redzone_size - res);
         heap_region_add(map, map + map_size, HEAP_MMAP, mc);
+        fresh = true;
     } else {
         /* look for free list entry */
-        head = find_free_list_entry(arena, request_size, aligned_size);
+        head = find_free_list_entry(arena, request_size, aligned_size, alignment);
         if (head != NULL) {
             malloc_info_t info;
             header_to_info(head, &info, NULL, 0);
@@ -1787,13 +2525,16 @@ replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignmen
              * be able to use a coalesced pair rather than searching the delay
              * list for a singleton that's large enough.
              */
-            arena = last_arena;
-            while (arena->free_list->delayed_bytes >= aligned_size) {
-                if (!shift_from_delay_list_to_free_list(arena))
-                    break;
-                head = find_free_list_entry(arena, request_size, aligned_size);
-                if (head != NULL)
+            arena = last_arena->main_arena;
+            /* The free cache does not coalesce, so we give it up as well */
+            flush_free_cache(arena);
+            head = find_free_list_entry(arena, request_size, aligned_size, alignment);
+            while (head == NULL && arena->free_list->delayed_bytes >= aligned_size) {
+                if (!shift_from_delay_list_early(arena))
                     break;
+                flush_free_cache(arena);
+                head = find_free_list_entry(arena, request_size, aligned_size,
+                                            alignment);
             }
             if (head == NULL) {
                 client_handle_alloc_failure(request_size, caller, mc);
@@ -1804,14 +2545,28 @@ replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignmen
             /* remember that arena->next_chunk always has a redzone preceding it */
             head = (chunk_header_t *)
                 (arena->next_chunk - redzone_beyond_header - header_size);
-            head->alloc_size = aligned_size;
+            if (alignment > CHUNK_ALIGNMENT) {
+                /* Carve only the padding needed at this spot, rather than the
+                 * worst case we reserved
+                 */
+                heapsz_t carve_size = aligned_carve_size(arena->next_chunk,
+                                                         request_size, alignment);
+                ASSERT(carve_size <= aligned_size, "aligned carve too large");
+                add_size = carve_size + inter_chunk_space();
+                head->alloc_size = carve_size;
+            } else
+                head->alloc_size = aligned_size;
             head->magic = HEADER_MAGIC;
             head->user_data = NULL; /* b/c we pass the old to client */
             head->flags = 0;
             LOG(2, "\tcarving out new chunk @"PFX" => head="PFX", res="PFX"\n",
                 arena->next_chunk - alloc_ops.redzone_size, head, ptr_from_header(head));
             orig_next_chunk = arena->next_chunk;
+            /* The header lies below next_chunk, so only user memory is checked */
+            fresh = (orig_next_chunk >= arena->zeroed_from);
             arena->next_chunk += add_size;
+            if (arena->zeroed_from < arena->next_chunk)
+                arena->zeroed_from = arena->next_chunk;
             if (arena->prev_free_sz != 0) {
                 /* There's a prior free, so we need to mark this new chunk with
                  * prev-free info.
@@ -1849,18 +2604,44 @@ replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignmen
             head->alloc_size, res - orig_res);
         split_piece_for_free_list(arena, head, pre, pre_sz,
                                   head->alloc_size - (res - orig_res));
-        ASSERT(head->alloc_size > request_size, "pre-align miscalculation");
+        ASSERT(head->alloc_size >= request_size, "pre-align miscalculation");
         head->u.unfree.request_diff = head->alloc_size - request_size;
     }
+    if (alignment > CHUNK_ALIGNMENT && !TEST(CHUNK_MMAP, head->flags)) {
+        /* Rather than keep the rest of the worst-case padding as request_diff,
+         * give back the tail.
+         */
+        heapsz_t keep_size = MAX(ALIGN_FORWARD(request_size, CHUNK_ALIGNMENT),
+                                 CHUNK_MIN_SIZE);
+        if (head->alloc_size > keep_size + CHUNK_MIN_SIZE + inter_chunk_space()) {
+            LOG(2, "\ttrimming aligned alloc %d bytes to %d\n",
+                head->alloc_size, keep_size);
+            split_off_tail(arena, head, keep_size);
+            head->u.unfree.request_diff = head->alloc_size - request_size;
+            STATS_INC(aligned_tails_trimmed);
+        }
+    }
+#ifdef X64
+    head->u.unfree.align_shift =
+        (alignment > CHUNK_ALIGNMENT) ? align_shift_of(alignment) : 0;
+#endif
     LOG(2, "\treplace_alloc_common arena="PFX" flags=0x%x request=%d, align=%d alloc=%d "
         "=> "PFX"\n", arena, head->flags,
         chunk_request_size(head), alignment, head->alloc_size, res);
-    if (TEST(ALLOC_ZERO, flags))
-        memset(res, 0, request_size);
+    if (TEST(ALLOC_ZERO, flags)) {
+        /* Fresh memory is already zero: for a large calloc this avoids
+         * touching every page.
+         */
+        if (fresh)
+            STATS_INC(zeroing_skipped);
+        else
+            memset(res, 0, request_size);
+    }
 
     ASSERT(head->alloc_size >= request_size, "chunk too small");
 
-    notify_client_alloc(drcontext, (byte *)res, head, flags, mc, caller);
+    notify_client_alloc(drcontext, (byte *)res, head,
+                        flags | (fresh ? ALLOC_FRESH : 0), mc, caller);
 
     if (chunk_request_size(head) >= LARGE_MALLOC_MIN_SIZE)
         malloc_large_add(res, request_size);
@@ -1873,6 +2654,21 @@ replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignmen
     return res;
 }
 
+/* Brackets replace_alloc_common_internal() for -profile_tool */
+static byte *
+replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignment,
+                     alloc_flags_t flags, void *drcontext, dr_mcontext_t *mc,
+                     app_pc caller, uint alloc_type)
+{
+    byte *res;
+    uint64 prof_start;
+    PROF_START(prof_start);
+    res = replace_alloc_common_internal(arena, request_size, alignment, flags,
+                                        drcontext, mc, caller, alloc_type);
+    PROF_STOP(drcontext, PROF_HEAP, prof_start);
+    return res;
+}
+
 static void
 check_type_match(void *ptr, chunk_header_t *head, uint free_type,
                  alloc_flags_t flags, dr_mcontext_t *mc, app_pc caller)
@@ -1932,17 +2728,21 @@ check_type_match(void *ptr, chunk_header_t *head, uint free_type,
  * via ONDSTACK_REPLACE_FREE_COMMON().
  */
 static bool
-replace_free_common(arena_header_t *arena, void *ptr, alloc_flags_t flags,
-                    void *drcontext, dr_mcontext_t *mc, app_pc caller, uint free_type)
+replace_free_common_internal(arena_header_t *arena, void *ptr, alloc_flags_t flags,
+                             void *drcontext, dr_mcontext_t *mc, app_pc caller,
+                             uint free_type)
 {
     chunk_header_t *head = header_from_ptr(ptr);
     malloc_info_t info;
+    bool sample_delay;
 
+    if (!is_live_alloc(ptr, arena, head))
+        arena = arena_for_foreign_chunk(arena, ptr, head);
     if (!is_live_alloc(ptr, arena, head)) { /* including NULL */
         /* w/o early inject, or w/ delayed instru, there are allocs in place
          * before we took over
          */
-        head = hashtable_lookup(&pre_us_table, (void *)ptr);
+        head = pre_us_lookup(ptr);
         if (head != NULL && !TEST(CHUNK_FREED, head->flags)) {
             /* XXX i#1195: need to call the app's free routine.
              * Xref DRi#497 for a mechanism to do this; or, we could call
@@ -2034,12 +2834,14 @@ replace_free_common(arena_header_t *arena, void *ptr, alloc_flags_t flags,
     header_to_info(head, &info, NULL, 0);
     if (TEST(ALLOC_INVOKE_CLIENT_DATA, flags))
         client_remove_malloc_pre(&info);
-    if (TESTANY(CHUNK_MMAP | CHUNK_PRE_US, head->flags)) {
+    sample_delay = (alloc_ops.sample_allocs > 0 && TEST(CHUNK_GUARD_PAGE, head->flags));
+    if (TESTANY(CHUNK_MMAP | CHUNK_PRE_US, head->flags) && !sample_delay) {
         if (head->user_data != NULL)
             client_malloc_data_free(head->user_data); /* ignores ALLOC_INVOKE_CLIENT */
         head->user_data = NULL;
     } else
-        head->user_data = client_malloc_data_to_free_list(head->user_data, mc, caller);
+        head->user_data = client_malloc_data_to_free_list(head->user_data, mc, caller,
+                                                          (app_pc)ptr);
 
     /* Mark this after client_remove_malloc_pre so client can iterate
      * and see the alloc as currently-live, matching wrapping behavior.
@@ -2071,10 +2873,15 @@ replace_free_common(arena_header_t *arena, void *ptr, alloc_flags_t flags,
         mmap_header_t *mhead = (mmap_header_t *) map;
         size_t map_size = mhead->map_size;
         ASSERT(mhead->head == head, "mmap header corrupted");
-        LOG(2, "\tlarge alloc %d freed => munmap @"PFX"\n", chunk_request_size(head), map);
-        heap_region_remove(map, map + map_size, mc);
-        if (!os_large_free(map, map_size))
-            ASSERT(false, "munmap failed");
+        if (sample_delay)
+            sample_delay_free(head, map, map_size, mc);
+        else {
+            LOG(2, "\tlarge alloc %d freed => munmap @"PFX"\n",
+                chunk_request_size(head), map);
+            heap_region_remove(map, map + map_size, mc);
+            if (!os_large_free(map, map_size))
+                ASSERT(false, "munmap failed");
+        }
     }
 
     STATS_INC(num_frees);
@@ -2083,6 +2890,130 @@ replace_free_common(arena_header_t *arena, void *ptr, alloc_flags_t flags,
     return true;
 }
 
+/* Brackets replace_free_common_internal() for -profile_tool */
+static bool
+replace_free_common(arena_header_t *arena, void *ptr, alloc_flags_t flags,
+                    void *drcontext, dr_mcontext_t *mc, app_pc caller, uint free_type)
+{
+    bool res;
+    uint64 prof_start;
+    PROF_START(prof_start);
+    res = replace_free_common_internal(arena, ptr, flags, drcontext, mc, caller,
+                                       free_type);
+    PROF_STOP(drcontext, PROF_HEAP, prof_start);
+    return res;
+}
+
+/* Tries to grow the live chunk head in place to hold size bytes, updating
+ * only head->alloc_size.  An arena chunk can absorb a true free that follows
+ * it, or the uncarved space after it if it is the final chunk in its
+ * sub-arena.  A large chunk can have its mapping extended in place.  This
+ * avoids copying both the contents and their shadow values.
+ * Caller must hold the arena lock.
+ */
+static bool
+realloc_grow_in_place(arena_header_t *arena, chunk_header_t *head, size_t size)
+{
+    heapsz_t aligned_size = ALIGN_FORWARD(size, CHUNK_ALIGNMENT);
+    byte *ptr;
+    arena_header_t *container = NULL;
+    chunk_header_t *next;
+    if (aligned_size < size || aligned_size <= head->alloc_size ||
+        /* an overflow must fault right at the guard page */
+        TEST(CHUNK_PRE_US | CHUNK_GUARD_PAGE, head->flags))
+        return false;
+    ptr = ptr_from_header(head);
+    if (ptr + aligned_size + inter_chunk_space() + PAGE_SIZE < ptr)
+        return false; /* overflow */
+    if (TEST(CHUNK_MMAP, head->flags)) {
+#ifdef UNIX
+        byte *map = (byte *)head - head->u.unfree.prev_size_shr;
+        mmap_header_t *mhead = (mmap_header_t *) map;
+        size_t new_map_size = (size_t)
+            ALIGN_FORWARD(ptr + aligned_size + alloc_ops.redzone_size - map, PAGE_SIZE);
+        ASSERT(mhead->head == head, "mmap header corrupted");
+        if (!os_large_alloc_extend(map, mhead->map_size, new_map_size)) {
+            LOG(2, "\tcannot extend large alloc mmap "PFX" in place\n", map);
+            return false;
+        }
+        LOG(2, "\textended large alloc mmap "PFX" from "PIFX" to "PIFX"\n",
+            map, mhead->map_size, new_map_size);
+        mhead->map_size = new_map_size;
+        head->alloc_size = (map + new_map_size - alloc_ops.redzone_size - ptr);
+        heap_region_adjust(map, map + new_map_size);
+        STATS_INC(realloc_grown_in_place);
+        return true;
+#else
+        /* os_large_alloc() reserves no more than it commits */
+        return false;
+#endif
+    }
+    next = next_chunk_forward(arena, head, &container);
+    if (next != NULL) {
+        heapsz_t total;
+        /* We can't take over a delayed free without losing its callstack */
+        if (!TEST(CHUNK_FREED, next->flags) || TEST(CHUNK_DELAY_FREE, next->flags))
+            return false;
+        total = head->alloc_size + inter_chunk_space() + next->alloc_size;
+        if (total < aligned_size)
+            return false;
+        /* Synchronize with iterators (i#949) */
+        iterator_lock(arena, true/*in alloc*/);
+        remove_from_free_list(arena, (free_header_t *)next, UINT_MAX);
+        if (next->user_data != NULL)
+            client_malloc_data_free(next->user_data);
+        LOG(3, "realloc of "PFX" absorbing next free "PFX" => "PFX"-"PFX"\n",
+            ptr, next, ptr, ptr + total);
+        STATS_INC(num_coalesces);
+        if (total > aligned_size + CHUNK_MIN_SIZE + inter_chunk_space()) {
+            /* Put the excess back on the free list */
+            byte *rest_ptr = ptr + aligned_size + inter_chunk_space();
+            free_header_t *rest = (free_header_t *) header_from_ptr(rest_ptr);
+            head->alloc_size = aligned_size;
+            rest->head.user_data = NULL;
+            rest->head.u.unfree.request_diff = 0;
+            rest->head.alloc_size = total - aligned_size - inter_chunk_space();
+            rest->head.magic = HEADER_MAGIC;
+            rest->head.flags = CHUNK_FREED;
+            STATS_INC(num_splits);
+            /* Let client fill/mark new redzones, if desired */
+            client_new_redzone(rest_ptr - alloc_ops.redzone_size, alloc_ops.redzone_size);
+            if (!alloc_ops.shared_redzones) {
+                client_new_redzone(rest_ptr + rest->head.alloc_size,
+                                   alloc_ops.redzone_size);
+            }
+            /* next was coalesced, so what follows it is not a true free */
+            set_prev_size_field(arena, &rest->head);
+            add_to_free_list(arena, &rest->head);
+        } else {
+            head->alloc_size = total;
+            next = next_chunk_forward(arena, head, &container);
+            if (next != NULL)
+                next->flags &= ~CHUNK_PREV_FREE;
+            else if (container != NULL)
+                container->prev_free_sz = 0;
+        }
+        iterator_unlock(arena, true/*in alloc*/);
+    } else if (container != NULL) {
+        /* The final chunk: extend into the space not yet carved out */
+        byte *new_next_chunk = ptr + aligned_size + inter_chunk_space();
+        ASSERT(container->prev_free_sz == 0, "live final chunk cannot be free");
+        if (new_next_chunk > container->commit_end)
+            return false;
+        LOG(3, "realloc of final chunk "PFX" moving next_chunk "PFX" => "PFX"\n",
+            ptr, container->next_chunk, new_next_chunk);
+        iterator_lock(arena, true/*in alloc*/);
+        head->alloc_size = aligned_size;
+        container->next_chunk = new_next_chunk;
+        if (container->zeroed_from < new_next_chunk)
+            container->zeroed_from = new_next_chunk;
+        iterator_unlock(arena, true/*in alloc*/);
+    } else
+        return false;
+    STATS_INC(realloc_grown_in_place);
+    return true;
+}
+
 /* See i#1581 notes above */
 #define ONDSTACK_REPLACE_REALLOC_COMMON(arena, ptr, size, flags, dc, mc, caller, type) \
     dr_call_on_clean_stack(dc, (void* (*)(void)) replace_realloc_common, arena, ptr,   \
@@ -2120,11 +3051,14 @@ replace_realloc_common(arena_header_t *arena, byte *ptr, size_t size,
                             flags | ALLOC_IS_REALLOC | ALLOC_INVOKE_CLIENT,
                             drcontext, mc, caller, alloc_type);
         return NULL;
-    } else if (!is_live_alloc(ptr, arena, head)) {
+    }
+    if (!is_live_alloc(ptr, arena, head))
+        arena = arena_for_foreign_chunk(arena, ptr, head);
+    if (!is_live_alloc(ptr, arena, head)) {
         /* w/o early inject, or w/ delayed instru, there are allocs in place
          * before we took over
          */
-        head = hashtable_lookup(&pre_us_table, (void *)ptr);
+        head = pre_us_lookup(ptr);
         if (head == NULL || TEST(CHUNK_FREED, head->flags)) {
             client_invalid_heap_arg(caller, (byte *)ptr, mc,
                                     /* XXX: we might be replacing RtlReallocateHeap or
@@ -2143,16 +3077,18 @@ replace_realloc_common(arena_header_t *arena, byte *ptr, size_t size,
     check_type_match(ptr, head, alloc_type, flags, mc, caller);
 #endif
     header_to_info(head, &old_info, ptr, 0);
-    if (head->alloc_size >= size &&
-        head->alloc_size - size <= REQUEST_DIFF_MAX &&
-        !TEST(CHUNK_PRE_US, head->flags)) {
+    if ((head->alloc_size >= size &&
+         head->alloc_size - size <= REQUEST_DIFF_MAX &&
+         !TEST(CHUNK_PRE_US, head->flags)) ||
+        (head->alloc_size < size && realloc_grow_in_place(arena, head, size))) {
+        /* head->alloc_size may have grown: use old_info for the prior size */
         LOG(2, "\t%s: in-place realloc from %d to %d bytes\n", __FUNCTION__,
-            chunk_request_size(head), size);
+            old_info.request_size, size);
         /* XXX: if shrinking a lot, should free and re-malloc, or split, to save space */
-        if (chunk_request_size(head) >= LARGE_MALLOC_MIN_SIZE)
+        if (old_info.request_size >= LARGE_MALLOC_MIN_SIZE)
             malloc_large_remove(ptr);
-        if (chunk_request_size(head) < size && TEST(ALLOC_ZERO, flags))
-            memset(ptr + chunk_request_size(head), 0, size - chunk_request_size(head));
+        if (old_info.request_size < size && TEST(ALLOC_ZERO, flags))
+            memset(ptr + old_info.request_size, 0, size - old_info.request_size);
         head->u.unfree.request_diff = head->alloc_size - size;
         if (chunk_request_size(head) >= LARGE_MALLOC_MIN_SIZE)
             malloc_large_add(ptr, chunk_request_size(head));
@@ -2164,8 +3100,9 @@ replace_realloc_common(arena_header_t *arena, byte *ptr, size_t size,
         bool was_mmap = TEST(CHUNK_MMAP, head->flags);
         LOG(2, "\t%s: malloc-and-free realloc from %d to %d bytes\n", __FUNCTION__,
             old_request_size, size);
-        /* XXX: use mremap for mmapped alloc! */
-        /* XXX: if final chunk in arena, extend in-place */
+        /* XXX: a moving mremap would avoid the data copy for a large alloc,
+         * but its shadow values would still have to be copied.
+         */
         res = (void *) replace_alloc_common(arena, size, 0,
                                             sub_flags | ALLOC_IS_REALLOC /*no client*/,
                                             drcontext, mc, caller, alloc_type);
@@ -2213,12 +3150,14 @@ replace_size_common(arena_header_t *arena, byte *ptr, alloc_flags_t flags,
     chunk_header_t *head = header_from_ptr(ptr);
     size_t res;
     LOG(2, "%s: "PFX", flags 0x%x, arena "PFX"\n", __FUNCTION__, ptr, flags, arena);
+    if (!is_live_alloc(ptr, arena, head))
+        arena = arena_for_foreign_chunk(arena, ptr, head);
     arena_lock(drcontext, arena, TEST(ALLOC_SYNCHRONIZE, flags));
     if (!is_live_alloc(ptr, arena, head)) {
         /* w/o early inject, or w/ delayed instru, there are allocs in place
          * before we took over
          */
-        head = hashtable_lookup(&pre_us_table, (void *)ptr);
+        head = pre_us_lookup(ptr);
         if (head == NULL || TEST(CHUNK_FREED, head->flags)) {
             client_invalid_heap_arg(caller, (byte *)ptr, mc,
                                     IF_WINDOWS_ELSE("_msize", "malloc_usable_size"),
@@ -2245,6 +3184,10 @@ replace_size_common(arena_header_t *arena, byte *ptr, alloc_flags_t flags,
 #if defined(WINDOWS) || defined(MACOS)
 /* Caller should hold any required locks, though we are probably assuming
  * no synch is needed here.
+ * Each live chunk is still handed to the client so it can drop its per-chunk
+ * data, but marked heap_destroyed so that it skips the per-chunk shadow
+ * update: heap_region_remove() releases the shadow of each whole sub-arena
+ * at once.
  */
 static void
 destroy_arena_family(arena_header_t *arena, dr_mcontext_t *mc, bool free_chunks,
@@ -2265,12 +3208,14 @@ destroy_arena_family(arena_header_t *arena, dr_mcontext_t *mc, bool free_chunks,
                      * a simple no-delay policy on the frees
                      */
                     header_to_info(head, &info, NULL, 0);
+                    info.heap_destroyed = true;
                     client_remove_malloc_pre(&info);
                     client_remove_malloc_post(&info);
                     if (head->user_data != NULL)
                         client_malloc_data_free(head->user_data);
                     client_handle_free(&info, info.base, mc, caller, NULL,
                                        true/*not delayed*/ _IF_WINDOWS((HANDLE)arena));
+                    STATS_INC(heap_destroy_bulk_frees);
                 }
                 cur += head->alloc_size + inter_chunk_space();
             }
@@ -2281,6 +3226,51 @@ destroy_arena_family(arena_header_t *arena, dr_mcontext_t *mc, bool free_chunks,
 }
 #endif
 
+#ifdef LINUX
+/* Throws away every chunk in the iteration arena family headed by arena,
+ * notifying the client of each live chunk as destroy_arena_family() does,
+ * and leaves the sub-arenas empty but committed for the next iteration.
+ * Caller must hold arena's lock.
+ */
+static void
+iteration_arena_reset(arena_header_t *arena, dr_mcontext_t *mc, app_pc caller)
+{
+    arena_header_t *a;
+    chunk_header_t *head;
+    malloc_info_t info;
+    uint live = 0;
+    ASSERT(TEST(ARENA_MAIN, arena->flags) && TEST(ARENA_ITERATION, arena->flags),
+           "must be passed a main iteration arena");
+    for (a = arena; a != NULL; a = a->next_arena) {
+        byte *cur = a->start_chunk;
+        while (cur < a->next_chunk) {
+            head = header_from_ptr(cur);
+            if (!TEST(CHUNK_FREED, head->flags)) {
+                header_to_info(head, &info, NULL, 0);
+                client_remove_malloc_pre(&info);
+                client_remove_malloc_post(&info);
+                if (head->user_data != NULL)
+                    client_malloc_data_free(head->user_data);
+                client_handle_free(&info, info.base, mc, caller, NULL,
+                                   true/*not delayed*/);
+                if (chunk_request_size(head) >= LARGE_MALLOC_MIN_SIZE)
+                    malloc_large_remove(info.base);
+                live++;
+            } else if (head->user_data != NULL) {
+                /* delayed and cached frees hold on to their data */
+                client_malloc_data_free(head->user_data);
+            }
+            cur += head->alloc_size + inter_chunk_space();
+        }
+        a->next_chunk = a->start_chunk;
+        a->prev_free_sz = 0;
+    }
+    memset(arena->free_list, 0, sizeof(*arena->free_list));
+    LOG(2, "%s: reset arena "PFX", discarding %d live chunks\n", __FUNCTION__,
+        arena, live);
+}
+#endif
+
 /***************************************************************************
  * iterator
  */
@@ -2360,7 +3350,7 @@ alloc_iterate(malloc_iter_cb_t cb, void *iter_data, bool only_live)
      *   - each arena of ours can be walked straight through
      *   - for mmap chunks, we can't use the large_malloc_tree b/c it has
      *     pre-us, so we store a new flag in heap regions: HEAP_MMAP (i#1051)
-     * + ignore pre-us arenas and instead iterate pre_us_table
+     * + ignore pre-us arenas and instead iterate pre_us_chunks
      */
     alloc_iter_data_t data = {only_live, cb, iter_data};
     uint i;
@@ -2374,22 +3364,19 @@ alloc_iterate(malloc_iter_cb_t cb, void *iter_data, bool only_live)
     heap_region_iterate(alloc_iter_own_arena, &data);
 
     LOG(3, "%s: iterating pre-us allocs\n", __FUNCTION__);
-    /* XXX: should add hashtable_iterate() to drcontainers */
-    /* See notes at top: this table is only modified at init or teardown
+    /* See notes at top: this array is only modified at init or teardown
      * and thus needs no external lock.
      */
-    for (i = 0; i < HASHTABLE_SIZE(pre_us_table.table_bits); i++) {
-        hash_entry_t *he;
-        for (he = pre_us_table.table[i]; he != NULL; he = he->next) {
-            chunk_header_t *head = (chunk_header_t *) he->payload;
-            byte *start = he->key;
-            if (!skip_chunk_in_iter(&data, head)) {
-                LOG(3, "\tpre-us "PFX"-"PFX"-"PFX"\n",
-                    start, start + chunk_request_size(head), start + head->alloc_size);
-                header_to_info(head, &info, start, 0);
-                if (!cb(&info, iter_data))
-                    break;
-            }
+    pre_us_chunks_prepare();
+    for (i = 0; i < pre_us_num; i++) {
+        chunk_header_t *head = &pre_us_chunks[i].head;
+        byte *start = pre_us_chunks[i].start;
+        if (!skip_chunk_in_iter(&data, head)) {
+            LOG(3, "\tpre-us "PFX"-"PFX"-"PFX"\n",
+                start, start + chunk_request_size(head), start + head->alloc_size);
+            header_to_info(head, &info, start, 0);
+            if (!cb(&info, iter_data))
+                break;
         }
     }
 }
@@ -2454,25 +3441,15 @@ alloc_replace_overlaps_region(byte *start, byte *end,
         ASSERT(size == chunk_request_size(head), "inconsistent");
     } else if (heap_region_bounds(start, &found_arena_start, &found_arena_end, &flags)) {
         if (TEST(HEAP_PRE_US, flags)) {
-            /* walk pre-us table.
-             * See notes at top: this table is only modified at init or teardown
+            /* search pre-us array.
+             * See notes at top: this array is only modified at init or teardown
              * and thus needs no external lock.
              */
-            uint i;
-            for (i = 0; i < HASHTABLE_SIZE(pre_us_table.table_bits); i++) {
-                hash_entry_t *he;
-                for (he = pre_us_table.table[i]; he != NULL; he = he->next) {
-                    chunk_header_t *head = (chunk_header_t *) he->payload;
-                    byte *chunk_start = he->key;
-                    if (start < chunk_start + head->alloc_size && end >= chunk_start) {
-                        found = overlap_helper(head, info,
-                                               positive_flags, negative_flags);
-                        goto overlap_inner_loop_break;
-                    }
-                }
+            uint idx = pre_us_chunk_search(start);
+            if (idx < pre_us_num && end >= pre_us_chunks[idx].start) {
+                found = overlap_helper(&pre_us_chunks[idx].head, info,
+                                       positive_flags, negative_flags);
             }
-        overlap_inner_loop_break:
-            ; /* nothing */
         } else if (TEST(HEAP_ARENA, flags)) {
             /* walk arena */
             /* XXX: make a shared internal iterator for this? */
@@ -2516,14 +3493,16 @@ bool
 alloc_replace_overlaps_delayed_free(byte *start, byte *end,
                                     malloc_info_t *info OUT)
 {
-    return alloc_replace_overlaps_region(start, end, info, CHUNK_DELAY_FREE, 0);
+    return (sample_delayed_lookup(start, info) ||
+            alloc_replace_overlaps_region(start, end, info, CHUNK_DELAY_FREE, 0));
 }
 
 bool
 alloc_replace_overlaps_any_free(byte *start, byte *end,
                                 malloc_info_t *info OUT)
 {
-    return alloc_replace_overlaps_region(start, end, info, CHUNK_FREED, 0);
+    return (sample_delayed_lookup(start, info) ||
+            alloc_replace_overlaps_region(start, end, info, CHUNK_FREED, 0));
 }
 
 bool
@@ -2537,6 +3516,79 @@ alloc_replace_overlaps_malloc(byte *start, byte *end,
  * app-facing interface
  */
 
+#ifdef LINUX
+/* Picks an unused per-thread arena, creating one if we're below the
+ * -thread_arenas limit, or else the arena with the fewest threads.
+ * With -numa_arenas, only arenas on the current NUMA node are considered
+ * until the limit is reached.
+ */
+static arena_header_t *
+thread_arena_acquire(void *drcontext)
+{
+    arena_header_t *a, *best = NULL, *best_on_node = NULL;
+    uint node = alloc_ops.numa_arenas ? current_numa_node() : 0;
+    dr_mutex_lock(thread_arena_lock);
+    for (a = thread_arena_list; a != NULL; a = a->next_thread_arena) {
+        if (best == NULL || a->thread_users < best->thread_users)
+            best = a;
+        if (alloc_ops.numa_arenas) {
+            if (a->numa_node == node &&
+                (best_on_node == NULL ||
+                 a->thread_users < best_on_node->thread_users))
+                best_on_node = a;
+            if (best_on_node != NULL && best_on_node->thread_users == 0)
+                break;
+        } else if (best->thread_users == 0)
+            break;
+    }
+    if (best_on_node != NULL)
+        best = best_on_node;
+    /* With -numa_arenas we'd rather create an arena on our node than share
+     * an idle one elsewhere.
+     */
+    if ((best->thread_users > 0 || (alloc_ops.numa_arenas && best_on_node == NULL)) &&
+        num_thread_arenas < alloc_ops.thread_arenas) {
+        a = arena_create(NULL, 0/*default*/);
+        if (a != NULL) {
+            a->next_thread_arena = thread_arena_list;
+            thread_arena_list = a;
+            num_thread_arenas++;
+            best = a;
+            if (alloc_ops.numa_arenas) {
+                a->flags |= ARENA_NUMA_BOUND;
+                a->numa_node = node;
+                arena_prefer_numa_node(a, node);
+            }
+            LOG(2, "%s: created arena #%d "PFX" on node %d\n", __FUNCTION__,
+                num_thread_arenas, a, node);
+        }
+    }
+    best->thread_users++;
+    dr_mutex_unlock(thread_arena_lock);
+    drmgr_set_tls_field(drcontext, tls_idx_replace, (void *)best);
+    LOG(2, "%s: thread "TIDFMT" using arena "PFX" with %d users\n", __FUNCTION__,
+        dr_get_thread_id(drcontext), best, best->thread_users);
+    return best;
+}
+
+static void
+replace_thread_exit(void *drcontext)
+{
+    arena_header_t *arena = (arena_header_t *)
+        drmgr_get_tls_field(drcontext, tls_idx_replace);
+    if (arena == NULL)
+        return;
+    /* The arena's chunks stay put: they can still be freed by other
+     * threads, and a new thread will pick up the arena.
+     */
+    dr_mutex_lock(thread_arena_lock);
+    ASSERT(arena->thread_users > 0, "thread arena user count off");
+    arena->thread_users--;
+    dr_mutex_unlock(thread_arena_lock);
+    drmgr_set_tls_field(drcontext, tls_idx_replace, NULL);
+}
+#endif
+
 static arena_header_t *
 arena_for_libc_alloc(void *drcontext)
 {
@@ -2570,6 +3622,21 @@ arena_for_libc_alloc(void *drcontext)
     }
     return arena;
 #else
+# ifdef LINUX
+    if (alloc_ops.iteration_arenas) {
+        arena_header_t *arena = (arena_header_t *)
+            drmgr_get_tls_field(drcontext, tls_idx_iter);
+        if (arena != NULL)
+            return arena;
+    }
+    if (alloc_ops.thread_arenas > 0) {
+        arena_header_t *arena = (arena_header_t *)
+            drmgr_get_tls_field(drcontext, tls_idx_replace);
+        if (arena == NULL)
+            arena = thread_arena_acquire(drcontext);
+        return arena;
+    }
+# endif
     /* we assume that pre-us (which doesn't use cur_arena) is checked by caller */
     return cur_arena;
 #endif
@@ -3141,6 +4208,7 @@ create_Rtl_heap(size_t commit_sz, size_t reserve_sz, uint flags)
         heap_region_set_heap((byte *)new_arena, (HANDLE)new_arena);
         /* this will create the lock even if TEST(HEAP_NO_SERIALIZE, flags) */
         arena_init(new_arena, NULL);
+        new_arena->zeroed_from = new_arena->start_chunk;
         new_arena->flags |= (flags & HEAP_CREATE_POSSIBLE_FLAGS);
     }
     return new_arena;
@@ -4692,6 +5760,25 @@ alloc_replace_in_cur_arena(byte *addr)
     return ptr_is_in_arena(addr, cur_arena);
 }
 
+bool
+alloc_replace_in_guard_page(byte *addr)
+{
+    byte *start, *end;
+    uint flags;
+    chunk_header_t *head;
+    ASSERT(alloc_ops.replace_malloc, "shouldn't call");
+    if (alloc_ops.guard_page_min_size == 0 && alloc_ops.sample_allocs == 0)
+        return false;
+    if (sample_delayed_lookup(addr, NULL))
+        return true;
+    if (!heap_region_bounds(addr, &start, &end, &flags) ||
+        !TEST(HEAP_MMAP, flags) || TEST(HEAP_PRE_US, flags))
+        return false;
+    head = header_from_mmap_base(start);
+    return (head != NULL && TEST(CHUNK_GUARD_PAGE, head->flags) &&
+            !TEST(CHUNK_FREED, head->flags) && addr >= end - PAGE_SIZE);
+}
+
 bool
 alloc_entering_replace_routine(app_pc pc)
 {
@@ -5084,8 +6171,29 @@ static void
 malloc_replace__add(app_pc start, app_pc end, app_pc real_end,
                     bool pre_us, uint client_flags, dr_mcontext_t *mc, app_pc post_call)
 {
-    IF_DEBUG(bool new_entry;)
-    chunk_header_t *head = global_alloc(sizeof(*head), HEAPSTAT_WRAP);
+    chunk_header_t *head;
+    /* we assume only called for pre_us and only during init when no lock is needed */
+    ASSERT(pre_us, "malloc add from outside must be pre_us");
+    if (pre_us_num == pre_us_capacity) {
+        uint new_capacity = (pre_us_capacity == 0) ? PRE_US_INITIAL_CAPACITY :
+            pre_us_capacity * 2;
+        pre_us_chunk_t *grown = (pre_us_chunk_t *)
+            global_alloc(new_capacity * sizeof(*grown), HEAPSTAT_WRAP);
+        if (pre_us_chunks != NULL) {
+            memcpy(grown, pre_us_chunks, pre_us_num * sizeof(*grown));
+            global_free(pre_us_chunks, pre_us_capacity * sizeof(*grown), HEAPSTAT_WRAP);
+        }
+        pre_us_chunks = grown;
+        pre_us_capacity = new_capacity;
+    }
+    /* heap walks mostly proceed in address order, in which case we never sort */
+    if (pre_us_num > 0 && start <= pre_us_chunks[pre_us_num - 1].start) {
+        ASSERT(start != pre_us_chunks[pre_us_num - 1].start, "should be no pre-us dups");
+        pre_us_sorted = false;
+    }
+    pre_us_chunks[pre_us_num].start = start;
+    head = &pre_us_chunks[pre_us_num].head;
+    pre_us_num++;
     head->alloc_size = (real_end - start);
     ASSERT(real_end - end <= REQUEST_DIFF_MAX, "too-large padding on pre-us malloc");
     head->u.unfree.request_diff = (real_end - end);
@@ -5094,12 +6202,10 @@ malloc_replace__add(app_pc start, app_pc end, app_pc real_end,
     head->flags = CHUNK_PRE_US;
     head->magic = HEADER_MAGIC;
     head->user_data = NULL;
-    /* we assume only called for pre_us and only during init when no lock is needed */
-    ASSERT(pre_us, "malloc add from outside must be pre_us");
-    IF_DEBUG(new_entry =)
-        hashtable_add(&pre_us_table, (void *)start, (void *)head);
     LOG(3, "new pre-us alloc "PFX"-"PFX"-"PFX"\n", start, end, real_end);
-    ASSERT(new_entry, "should be no pre-us dups");
+    /* head may move when the array grows or is sorted, but the client only
+     * keeps the user data we store in it here
+     */
     notify_client_alloc(NULL, start, head,
                         /* no client action: caller can do that on its own */
                         ALLOC_INVOKE_CLIENT_DATA, mc, post_call);
@@ -5109,7 +6215,7 @@ static bool
 malloc_replace__is_pre_us_ex(app_pc start, bool ok_if_invalid)
 {
     /* see notes up top about not needing an external lock */
-    chunk_header_t *head = hashtable_lookup(&pre_us_table, (void *)start);
+    chunk_header_t *head = pre_us_lookup(start);
     return (head != NULL && (ok_if_invalid || !TEST(CHUNK_FREED, head->flags)));
 }
 
@@ -5288,7 +6394,7 @@ alloc_replace_init(void)
                "redzone or header size not aligned properly");
     }
 
-    hashtable_init(&pre_us_table, PRE_US_TABLE_HASH_BITS, HASH_INTPTR, false/*!strdup*/);
+    pre_us_lock = dr_mutex_create();
 
 #ifdef WINDOWS
     if (alloc_ops.global_lock)
@@ -5315,6 +6421,50 @@ alloc_replace_init(void)
     LOG(2, "heap orig brk="PFX"\n", pre_us_brk);
     heap_region_add((byte *)cur_arena, cur_arena->reserve_end, HEAP_ARENA, NULL);
     arena_init(cur_arena, NULL);
+
+    if (alloc_ops.global_lock) {
+        /* malloc_lock() only locks cur_arena */
+        alloc_ops.thread_arenas = 0;
+        alloc_ops.numa_arenas = false;
+        alloc_ops.iteration_arenas = false;
+    }
+    if (alloc_ops.thread_arenas > 0 || alloc_ops.iteration_arenas)
+        thread_arena_lock = dr_mutex_create();
+    if (alloc_ops.iteration_arenas) {
+        tls_idx_iter = drmgr_register_tls_field();
+        ASSERT(tls_idx_iter > -1, "unable to reserve TLS field");
+    }
+    if (alloc_ops.thread_arenas > 0) {
+        thread_arena_list = cur_arena;
+        num_thread_arenas = 1;
+        /* We leave the brk to first-touch placement, as it is shared with
+         * whatever else grows it.
+         */
+        if (alloc_ops.numa_arenas)
+            cur_arena->numa_node = current_numa_node();
+        tls_idx_replace = drmgr_register_tls_field();
+        ASSERT(tls_idx_replace > -1, "unable to reserve TLS field");
+        if (!drmgr_register_thread_exit_event(replace_thread_exit))
+            ASSERT(false, "drmgr registration failed");
+        if (alloc_ops.delay_frees > 0 && alloc_ops.delay_frees_maxsz > 0) {
+            /* Size local batches so that all shards' unpublished frees together
+             * stay well under the quota.
+             */
+            delay_sharded = true;
+            delay_batch_lock = dr_mutex_create();
+            delay_batch_chunks = alloc_ops.delay_frees / (2 * alloc_ops.thread_arenas);
+            if (delay_batch_chunks > DELAY_BATCH_MAX_CHUNKS)
+                delay_batch_chunks = DELAY_BATCH_MAX_CHUNKS;
+            else if (delay_batch_chunks == 0)
+                delay_batch_chunks = 1;
+            delay_batch_bytes = alloc_ops.delay_frees_maxsz /
+                (2 * alloc_ops.thread_arenas);
+            if (delay_batch_bytes == 0)
+                delay_batch_bytes = 1;
+            LOG(2, "sharded delay list: batches of %d chunks or "PIFX" bytes\n",
+                delay_batch_chunks, delay_batch_bytes);
+        }
+    }
 #elif defined(MACOS)
     cur_arena = arena_create(NULL, 0/*default*/);
     ASSERT(cur_arena != NULL, "can't allocate initial heap: fatal");
@@ -5340,6 +6490,11 @@ alloc_replace_init(void)
     heap_iterator(NULL, NULL _IF_WINDOWS(pre_existing_heap_init));
 #endif
 
+    if (alloc_ops.sample_allocs > 0) {
+        sample_lock = dr_mutex_create();
+        sample_reset_countdown();
+    }
+
     /* set up pointers for per-malloc API */
     malloc_interface.malloc_lock = malloc_replace__lock;
     malloc_interface.malloc_unlock = malloc_replace__unlock;
@@ -5402,6 +6557,17 @@ alloc_replace_exit(void)
     LOG(1, "  deallocs:           %9d\n", num_dealloc);
     LOG(1, "  dbgcrt mismatches:  %9d\n", dbgcrt_mismatch);
     LOG(1, "  allocs left native: %9d\n", allocs_left_native);
+    LOG(1, "  foreign-arena frees:%9d\n", thread_arena_foreign_frees);
+    LOG(1, "  free cache hits:    %9d\n", free_cache_hits);
+    LOG(1, "  aligned cache hits: %9d\n", aligned_cache_hits);
+    LOG(1, "  aligned tail trims: %9d\n", aligned_tails_trimmed);
+    LOG(1, "  reallocs grown:     %9d\n", realloc_grown_in_place);
+    LOG(1, "  zeroing skipped:    %9d\n", zeroing_skipped);
+    LOG(1, "  heap destroy frees: %9d\n", heap_destroy_bulk_frees);
+# ifdef LINUX
+    LOG(1, "  thread arenas:      %9d\n", num_thread_arenas);
+    LOG(1, "  delay batches:      %9d\n", delay_batches_published);
+# endif
 #endif
 
     /* On Win10 at process exit, RtlLockHeap is called but the private
@@ -5414,18 +6580,15 @@ alloc_replace_exit(void)
     }
 
     alloc_iterate(free_user_data_at_exit, NULL, false/*free too*/);
-    /* XXX: should add hashtable_iterate() to drcontainers */
-    for (i = 0; i < HASHTABLE_SIZE(pre_us_table.table_bits); i++) {
-        hash_entry_t *he, *next;
-        for (he = pre_us_table.table[i]; he != NULL; he = next) {
-            chunk_header_t *head = (chunk_header_t *) he->payload;
-            next = he->next;
-            if (head->user_data != NULL)
-                client_malloc_data_free(head->user_data);
-            global_free(head, sizeof(*head), HEAPSTAT_WRAP);
-        }
+    for (i = 0; i < pre_us_num; i++) {
+        chunk_header_t *head = &pre_us_chunks[i].head;
+        if (head->user_data != NULL)
+            client_malloc_data_free(head->user_data);
     }
-    hashtable_delete_with_stats(&pre_us_table, "pre_us");
+    LOG(1, "pre-us allocs imported: %u\n", pre_us_num);
+    if (pre_us_chunks != NULL)
+        global_free(pre_us_chunks, pre_us_capacity * sizeof(*pre_us_chunks), HEAPSTAT_WRAP);
+    dr_mutex_destroy(pre_us_lock);
 
 #ifdef WINDOWS
 # ifdef X64
@@ -5445,6 +6608,35 @@ alloc_replace_exit(void)
 
     heap_region_iterate(free_arena_at_exit, NULL);
 
+    if (alloc_ops.sample_allocs > 0) {
+        for (i = 0; i < sample_free_count; i++) {
+            if (sample_frees[i].info.client_data != NULL)
+                client_malloc_data_free(sample_frees[i].info.client_data);
+            os_large_free(sample_frees[i].map, sample_frees[i].map_size);
+        }
+        dr_mutex_destroy(sample_lock);
+    }
+
+#ifdef LINUX
+    if (alloc_ops.thread_arenas > 0) {
+        if (!drmgr_unregister_thread_exit_event(replace_thread_exit))
+            ASSERT(false, "drmgr unregistration failed");
+        drmgr_unregister_tls_field(tls_idx_replace);
+    }
+    if (alloc_ops.iteration_arenas)
+        drmgr_unregister_tls_field(tls_idx_iter);
+    if (alloc_ops.thread_arenas > 0 || alloc_ops.iteration_arenas)
+        dr_mutex_destroy(thread_arena_lock);
+    if (delay_sharded) {
+        while (delay_batch_front != NULL) {
+            delay_batch_t *next = delay_batch_front->next;
+            global_free(delay_batch_front, sizeof(*delay_batch_front), HEAPSTAT_WRAP);
+            delay_batch_front = next;
+        }
+        dr_mutex_destroy(delay_batch_lock);
+    }
+#endif
+
 #ifdef WINDOWS
     if (alloc_ops.global_lock)
         dr_recurlock_destroy(global_lock);
@@ -5498,3 +6690,66 @@ client_app_free(void *drcontext, void *ptr, app_pc caller)
                         drcontext, &mc, caller,
                         MALLOC_ALLOCATOR_MALLOC);
 }
+
+/* Routes the calling thread's application allocations to an iteration arena
+ * until alloc_replace_iteration_end().  Does nothing unless
+ * alloc_ops.iteration_arenas is set.
+ */
+void
+alloc_replace_iteration_start(void *drcontext)
+{
+#ifdef LINUX
+    arena_header_t *a;
+    if (!alloc_ops.iteration_arenas ||
+        drmgr_get_tls_field(drcontext, tls_idx_iter) != NULL)
+        return;
+    dr_mutex_lock(thread_arena_lock);
+    for (a = iter_arena_list; a != NULL; a = a->next_thread_arena) {
+        if (a->thread_users == 0)
+            break;
+    }
+    if (a == NULL) {
+        a = arena_create(NULL, 0/*default*/);
+        if (a != NULL) {
+            a->flags |= ARENA_ITERATION;
+            a->next_thread_arena = iter_arena_list;
+            iter_arena_list = a;
+            LOG(2, "%s: created iteration arena "PFX"\n", __FUNCTION__, a);
+        }
+    }
+    /* On failure the iteration simply allocates from the regular arena */
+    if (a != NULL)
+        a->thread_users = 1;
+    dr_mutex_unlock(thread_arena_lock);
+    drmgr_set_tls_field(drcontext, tls_idx_iter, (void *)a);
+#endif
+}
+
+/* Frees every chunk allocated from the calling thread's iteration arena that
+ * is still live, as though the application had freed it at caller, and stops
+ * routing the thread's allocations there.
+ */
+void
+alloc_replace_iteration_end(void *drcontext, app_pc caller)
+{
+#ifdef LINUX
+    arena_header_t *arena;
+    dr_mcontext_t mc;
+    if (!alloc_ops.iteration_arenas)
+        return;
+    arena = (arena_header_t *) drmgr_get_tls_field(drcontext, tls_idx_iter);
+    if (arena == NULL)
+        return;
+    drmgr_set_tls_field(drcontext, tls_idx_iter, NULL);
+    mc.size = sizeof(mc);
+    mc.flags = DR_MC_CONTROL | DR_MC_INTEGER; /* xsp and xbp */
+    dr_get_mcontext(drcontext, &mc);
+    /* Other threads may still be freeing chunks into the arena */
+    arena_lock(drcontext, arena, true/*synch*/);
+    iteration_arena_reset(arena, &mc, caller);
+    arena_unlock(drcontext, arena, true/*synch*/);
+    dr_mutex_lock(thread_arena_lock);
+    arena->thread_users = 0;
+    dr_mutex_unlock(thread_arena_lock);
+#endif
+}
@@ -31,6 +31,9 @@
 #include "redblack.h"
 #include "drsyms.h"
 #include "drsyscall.h"
+#include "unwind.h"
+#include "prof.h"
+#include "hashmap.h"
 #ifdef UNIX
 # include <string.h>
 # include <errno.h>
@@ -52,14 +55,21 @@ static uint callstack_walks;
 static uint callstacks_symbolized;
 static uint find_next_fp_scans;
 static uint find_next_fp_cache_hits;
+static uint find_next_fp_cache_misses;
 static uint find_next_fp_strings;
 static uint find_next_fp_string_structs;
 static uint cstack_is_retaddr_tgt_mismatch;
 static uint symbol_names_truncated;
+static uint symbol_cache_hits;
+static uint module_cache_hits;
+static uint frame_tails_unique;
+static uint frame_tails_shared;
+static uint symbol_batch_lookups;
 static uint cstack_is_retaddr;
 static uint cstack_is_retaddr_backdecode;
 static uint cstack_is_retaddr_unreadable;
 static uint cstack_is_retaddr_unseen;
+static uint cstack_is_retaddr_cache_hits;
 #endif
 
 /* Cached frame pointer values to avoid repeated scans (i#1186) */
@@ -69,11 +79,49 @@ typedef struct _fpscan_cache_entry {
     app_pc retaddr;
 } fpscan_cache_entry;
 
-/* XXX: perhaps this should be based on the max frames, though if someone
- * asks for a ton of frames and optimizes his app with FPO he can't expect
- * great performance.
+/* The cache is set-associative, indexed by a hash of the input fp, with
+ * FPSCAN_CACHE_WAYS entries per set kept in most-recently-used order.  The
+ * number of entries comes from ops.fp_cache_entries, rounded down to a power
+ * of two.
  */
-#define FPSCAN_CACHE_ENTRIES 16
+#define FPSCAN_CACHE_WAYS 4
+#define FPSCAN_CACHE_DEFAULT_ENTRIES 16
+static uint fpcache_set_bits;
+#define FPSCAN_CACHE_SETS() (1U << fpcache_set_bits)
+#define FPSCAN_CACHE_ENTRIES() (FPSCAN_CACHE_SETS() * FPSCAN_CACHE_WAYS)
+
+/* Per-thread cache of module_lookup() results, avoiding modtree_lock and a
+ * tree walk for nearly every frame.  Entries are kept in most-recently-used
+ * order and are only valid while the thread's generation matches
+ * modtree_gen, which every module load and unload bumps.
+ */
+#define MODULE_CACHE_ENTRIES 4
+
+/* Per-thread direct-mapped cache of is_retaddr() verdicts, valid while the
+ * thread's generation matches modtree_gen.  A pc that passed the code-section
+ * and back-decode checks but not the retaddr_table check is cached as
+ * RETADDR_LOOKS_LIKE, as its call may still be seen later.
+ */
+#define RETADDR_CACHE_ENTRIES 64
+#define RETADDR_CACHE_HASH(pc) \
+    ((((ptr_uint_t)(pc)) ^ (((ptr_uint_t)(pc)) >> 6)) & (RETADDR_CACHE_ENTRIES - 1))
+
+enum {
+    RETADDR_NOT = 1,
+    RETADDR_LOOKS_LIKE,
+    RETADDR_IS,
+};
+
+typedef struct _retaddr_cache_entry_t {
+    app_pc pc;
+    uint verdict;
+} retaddr_cache_entry_t;
+
+typedef struct _module_cache_entry_t {
+    app_pc start;
+    size_t size;
+    struct _modname_info_t *name_info;
+} module_cache_entry_t;
 
 typedef struct _tls_callstack_t {
     char *errbuf; /* buffer for atomic writes to global logfile */
@@ -88,8 +136,13 @@ typedef struct _tls_callstack_t {
      */
     app_pc stack_lowest_retaddr;
     /* Optimization for FPO-optimized apps */
-    fpscan_cache_entry fpcache[FPSCAN_CACHE_ENTRIES];
-    uint fpcache_idx;
+    fpscan_cache_entry *fpcache; /* FPSCAN_CACHE_ENTRIES() entries */
+    uint modcache_gen;
+    module_cache_entry_t modcache[MODULE_CACHE_ENTRIES];
+    uint retaddr_cache_gen;
+    retaddr_cache_entry_t retaddr_cache[RETADDR_CACHE_ENTRIES];
+    /* scratch frames for callstack_record_raw(), ops.global_max_frames entries */
+    struct _full_frame_t *raw_frames;
 } tls_callstack_t;
 
 static int tls_idx_callstack = -1;
@@ -194,11 +247,53 @@ struct _packed_callstack_t {
         packed_frame_t *packed;
         full_frame_t *full;
     } frames;
+    /* For interned packed callstacks, the outer frames are shared with other
+     * callstacks: frames.packed then holds only the innermost
+     * (num_frames - tail->num_frames) frames.
+     */
+    struct _frame_tail_t *tail;
 };
 
+/* A run of outermost frames shared among interned packed callstacks.
+ * Callstacks from one allocation site share their outer frames far more
+ * often than their inner ones, so we keep the PCS_OWN_FRAMES innermost
+ * frames per callstack and intern the rest in frame_tail_table.
+ */
+typedef struct _frame_tail_t {
+    uint refcount; /* protected by the frame_tail_table lock */
+    ushort num_frames;
+    packed_frame_t *frames;
+} frame_tail_t;
+
+static uint
+frame_tail_hash(frame_tail_t *t);
+
+static bool
+frame_tail_cmp(frame_tail_t *t1, frame_tail_t *t2);
+
+static void
+frame_tail_free(frame_tail_t *t);
+
+#define PCS_OWN_FRAMES 4
+#define FRAME_TAIL_TABLE_HASH_BITS 12
+static hashtable_t frame_tail_table;
+
+static inline uint
+pcs_num_own_frames(packed_callstack_t *pcs)
+{
+    return pcs->num_frames - (pcs->tail == NULL ? 0 : pcs->tail->num_frames);
+}
+
+static inline packed_frame_t *
+pcs_packed_frame(packed_callstack_t *pcs, uint n)
+{
+    uint own = pcs_num_own_frames(pcs);
+    return (n < own) ? &pcs->frames.packed[n] : &pcs->tail->frames[n - own];
+}
+
 /* multiplexing between packed and full frames */
 #define PCS_FRAME_LOC(pcs, n) \
-    ((pcs)->is_packed ? (pcs)->frames.packed[n].loc : (pcs)->frames.full[n].loc)
+    ((pcs)->is_packed ? pcs_packed_frame(pcs, n)->loc : (pcs)->frames.full[n].loc)
 #define PCS_FRAMES(pcs) \
     ((pcs)->is_packed ? (void*)((pcs)->frames.packed) : (void*)((pcs)->frames.full))
 #define PCS_FRAME_SZ(pcs) \
@@ -223,6 +318,12 @@ static uint modname_array_end = 1;
  */
 static uint modname_unique_id = 1;
 
+/* Every malloc with a recorded callstack allocates a packed_callstack_t, so
+ * those come from a pool.  It is left for utils_exit() to destroy, as
+ * callstacks are still freed after callstack_exit().
+ */
+static obj_pool_t *pcs_pool;
+
 /* PR 473640: our own module region tree */
 static rb_tree_t *module_tree;
 static void *modtree_lock;
@@ -238,6 +339,36 @@ static modname_info_t *modtree_last_name_info;
 /* cached values for is_in_module() */
 static app_pc modtree_last_hit;
 static app_pc modtree_last_miss;
+/* bumped on every module unload, for users caching callstacks */
+static volatile uint module_unload_count;
+/* bumped on every module load and unload, to invalidate the per-thread
+ * module_lookup() caches.  Starts at 1 so a zeroed cache is invalid.
+ */
+static volatile uint modtree_gen = 1;
+
+/* Sorted, non-overlapping executable ranges of all modules, for is_retaddr().
+ * Each module load or unload builds a new index under modtree_lock and then
+ * publishes it with a single pointer write, so readers need no lock.  As a
+ * reader may still be using the prior index, it is kept on a list that is
+ * only freed at exit.
+ */
+typedef struct _code_range_t {
+    app_pc start;
+    app_pc end;
+} code_range_t;
+
+typedef struct _code_index_t {
+    struct _code_index_t *retired_next;
+    size_t alloc_size;
+    uint num_ranges;
+    code_range_t ranges[1]; /* variable-length */
+} code_index_t;
+
+/* A module with more executable ranges than this is treated as one range */
+#define CODE_RANGES_PER_MODULE 32
+
+static code_index_t * volatile code_index;
+static code_index_t *code_index_retired;
 
 /* i#1217: exclude DR and DrMem retaddrs on app stack from -replace_malloc */
 static app_pc libdr_base, libdr_end;
@@ -279,11 +410,43 @@ struct _symbolized_frame_t {
     void *user_data;
 };
 
+/* Results of symbol lookups, shared by all callstacks so that a frame that
+ * shows up in many error callstacks is only looked up once.  Like the
+ * modname_info_t entries they point at, entries are never removed.
+ */
+#define SYMBOL_CACHE_HASH_BITS 12
+static hashtable_t symbol_cache;
+
+typedef struct _symbol_cache_entry_t {
+    /* The key */
+    modname_info_t *name_info;
+    size_t modoffs;
+    /* The lookup result */
+    bool found;
+    bool has_symbols;
+    size_t funcoffs;
+    char *func;  /* strdup-ed; NULL if !found */
+    char *fname; /* strdup-ed; NULL if no line info */
+    uint64 line;
+    size_t lineoffs;
+} symbol_cache_entry_t;
+
+static void
+symbol_cache_free(symbol_cache_entry_t *e);
+
+static uint
+symbol_cache_hash(symbol_cache_entry_t *e);
+
+static bool
+symbol_cache_cmp(symbol_cache_entry_t *e1, symbol_cache_entry_t *e2);
+
 /***************************************************************************/
 
-/* i#1439: only allow retaddrs for calls we've seen */
+/* i#1439: only allow retaddrs for calls we've seen.  This is read on every
+ * frame of every callstack walk, so it is a lock-free-read hashmap_t.
+ */
 #define RETADDR_TABLE_HASH_BITS 10
-static hashtable_t retaddr_table;
+static hashmap_t retaddr_table;
 
 static dr_emit_flags_t
 event_basic_block_analysis(void *drcontext, void *tag, instrlist_t *bb,
@@ -320,22 +483,41 @@ callstack_init(callstack_options_t *options)
     ASSERT(options->struct_size <= sizeof(ops), "option struct too large");
     memcpy(&ops, options, options->struct_size);
 
+    if (ops.fp_cache_entries == 0)
+        ops.fp_cache_entries = FPSCAN_CACHE_DEFAULT_ENTRIES;
+    fpcache_set_bits = 0;
+    while ((FPSCAN_CACHE_SETS() << 1) * FPSCAN_CACHE_WAYS <= ops.fp_cache_entries)
+        fpcache_set_bits++;
+    LOG(1, "fp scan cache: %u sets of %u entries\n", FPSCAN_CACHE_SETS(),
+        FPSCAN_CACHE_WAYS);
+
     hashtable_init_ex(&modname_table, MODNAME_TABLE_HASH_BITS, HASH_STRING_NOCASE,
                       false/*!str_dup*/, false/*!synch*/, modname_info_free, NULL, NULL);
     modname_table_initialized = true;
+    hashtable_init_ex(&frame_tail_table, FRAME_TAIL_TABLE_HASH_BITS, HASH_CUSTOM,
+                      false/*!str_dup*/, true/*synch*/,
+                      (void (*)(void*)) frame_tail_free,
+                      (uint (*)(void*)) frame_tail_hash,
+                      (bool (*)(void*, void*)) frame_tail_cmp);
+    hashtable_init_ex(&symbol_cache, SYMBOL_CACHE_HASH_BITS, HASH_CUSTOM,
+                      false/*!str_dup*/, true/*synch*/,
+                      (void (*)(void*)) symbol_cache_free,
+                      (uint (*)(void*)) symbol_cache_hash,
+                      (bool (*)(void*, void*)) symbol_cache_cmp);
     modtree_lock = dr_mutex_create();
     module_tree = rb_tree_create(NULL);
+    pcs_pool = pool_create("packed callstack", sizeof(packed_callstack_t),
+                           HEAPSTAT_CALLSTACK);
 
     if (!TEST(FP_SEARCH_ALLOW_UNSEEN_RETADDR, ops.fp_flags)) {
-        hashtable_config_t hashconfig = {sizeof(hashconfig),};
-        hashtable_init(&retaddr_table, RETADDR_TABLE_HASH_BITS,
-                       HASH_INTPTR, false/*!str_dup*/);
-        hashconfig.resizable = true;
-        hashconfig.resize_threshold = 60; /* default is 75 */
-        hashtable_configure(&retaddr_table, &hashconfig);
+        hashmap_init(&retaddr_table, RETADDR_TABLE_HASH_BITS, true/*lockfree_reads*/,
+                     NULL);
         drmgr_register_bb_instrumentation_event(event_basic_block_analysis, NULL, NULL);
     }
 
+    if (TEST(FP_USE_UNWIND_INFO, ops.fp_flags))
+        unwind_init();
+
     IF_WINDOWS(ASSERT(using_private_peb(), "private peb not preserved"));
     /* we rely on drsym_init() being called in utils_init() */
 }
@@ -346,12 +528,27 @@ callstack_exit(void)
     ASSERT(libdr_base != NULL, "never found DR lib");
     ASSERT(!(ops.tool_lib_ignore != NULL && libtoolbase == NULL), "never found tool lib");
 
+    hashtable_delete_with_stats(&symbol_cache, "symbol cache");
+    hashtable_delete_with_stats(&frame_tail_table, "frame tail table");
     hashtable_delete(&modname_table);
     if (!TEST(FP_SEARCH_ALLOW_UNSEEN_RETADDR, ops.fp_flags))
-        hashtable_delete_with_stats(&retaddr_table, "retaddr table");
+        hashmap_delete_with_stats(&retaddr_table, "retaddr table");
+    if (TEST(FP_USE_UNWIND_INFO, ops.fp_flags))
+        unwind_exit();
 
     dr_mutex_lock(modtree_lock);
     rb_tree_destroy(module_tree);
+    if (code_index != NULL) {
+        code_index->retired_next = code_index_retired;
+        code_index_retired = code_index;
+        code_index = NULL;
+    }
+    while (code_index_retired != NULL) {
+        code_index_t *next = code_index_retired->retired_next;
+        global_free(code_index_retired, code_index_retired->alloc_size,
+                    HEAPSTAT_CALLSTACK);
+        code_index_retired = next;
+    }
     dr_mutex_unlock(modtree_lock);
     dr_mutex_destroy(modtree_lock);
 
@@ -366,17 +563,24 @@ callstack_dump_statistics(file_t f)
 {
     dr_fprintf(f, "callstack walks: %9u, callstacks symbolized: %8u\n",
                callstack_walks, callstacks_symbolized);
-    dr_fprintf(f, "callstack fp scans: %8u, cache hits: %8u\n",
-               find_next_fp_scans, find_next_fp_cache_hits);
+    dr_fprintf(f, "callstack fp scans: %8u, cache hits: %8u, misses: %8u\n",
+               find_next_fp_scans, find_next_fp_cache_hits, find_next_fp_cache_misses);
     dr_fprintf(f, "callstack strings: %6u, structs: %6u, target mismatch: %8u\n",
                find_next_fp_strings, find_next_fp_string_structs,
                cstack_is_retaddr_tgt_mismatch);
     dr_fprintf(f, "callstack is_retaddr: %8u, backdecode: %8u, unreadable: %8u\n",
                cstack_is_retaddr, cstack_is_retaddr_backdecode,
                cstack_is_retaddr_unreadable);
-    dr_fprintf(f, "callstack is_retaddr cont'd: unseen %8u\n",
-               cstack_is_retaddr_unseen);
+    dr_fprintf(f, "callstack is_retaddr cont'd: unseen %8u, cache hits: %8u\n",
+               cstack_is_retaddr_unseen, cstack_is_retaddr_cache_hits);
     dr_fprintf(f, "symbol names truncated: %8u\n", symbol_names_truncated);
+    dr_fprintf(f, "symbol cache hits: %8u, batched lookups: %8u\n",
+               symbol_cache_hits, symbol_batch_lookups);
+    dr_fprintf(f, "module lookup cache hits: %8u\n", module_cache_hits);
+    dr_fprintf(f, "callstack frame tails: %8u unique, %8u shared\n",
+               frame_tails_unique, frame_tails_shared);
+    if (TEST(FP_USE_UNWIND_INFO, ops.fp_flags))
+        unwind_dump_statistics(f);
 }
 #endif
 
@@ -420,6 +624,10 @@ callstack_thread_init(void *drcontext)
     pt->errbuf = (char *) thread_alloc(drcontext, pt->errbufsz, HEAPSTAT_CALLSTACK);
     /* We take the space hit to avoid serializing all mallocs just for callstacks */
     pt->page_buf = (byte *) thread_alloc(drcontext, PAGE_SIZE, HEAPSTAT_CALLSTACK);
+    pt->fpcache = (fpscan_cache_entry *)
+        thread_alloc(drcontext, sizeof(*pt->fpcache) * FPSCAN_CACHE_ENTRIES(),
+                     HEAPSTAT_CALLSTACK);
+    memset(pt->fpcache, 0, sizeof(*pt->fpcache) * FPSCAN_CACHE_ENTRIES());
 #ifdef WINDOWS
     if (get_TEB() != NULL) {
         pt->stack_lowest_frame = get_TEB()->StackBase;
@@ -477,6 +685,12 @@ callstack_thread_exit(void *drcontext)
         drmgr_get_tls_field(drcontext, tls_idx_callstack);
     thread_free(drcontext, (void *) pt->errbuf, pt->errbufsz, HEAPSTAT_CALLSTACK);
     thread_free(drcontext, (void *) pt->page_buf, PAGE_SIZE, HEAPSTAT_CALLSTACK);
+    thread_free(drcontext, (void *) pt->fpcache,
+                sizeof(*pt->fpcache) * FPSCAN_CACHE_ENTRIES(), HEAPSTAT_CALLSTACK);
+    if (pt->raw_frames != NULL) {
+        thread_free(drcontext, (void *) pt->raw_frames,
+                    sizeof(*pt->raw_frames) * ops.global_max_frames, HEAPSTAT_CALLSTACK);
+    }
     drmgr_set_tls_field(drcontext, tls_idx_callstack, NULL);
     thread_free(drcontext, pt, sizeof(*pt), HEAPSTAT_MISC);
 }
@@ -494,7 +708,7 @@ event_basic_block_analysis(void *drcontext, void *tag, instrlist_t *bb,
         if (instr_is_app(instr) && instr_is_call(instr)) {
             app_pc retaddr = instr_get_app_pc(instr) +  instr_length(drcontext, instr);
             /* we never remove from the table, and dups are fine */
-            hashtable_add(&retaddr_table, (void *)retaddr, (void *)tag);
+            hashmap_add(&retaddr_table, (void *)retaddr, (void *)tag);
         }
     }
     return DR_EMIT_DEFAULT;
@@ -513,14 +727,14 @@ init_symbolized_frame(symbolized_frame_t *frame OUT, uint frame_num)
 
 /* Symbol lookup: i#44/PR 243532 */
 static void
-lookup_func_and_line(symbolized_frame_t *frame OUT,
-                     modname_info_t *name_info IN, size_t modoffs)
+symbol_cache_resolve(symbol_cache_entry_t *e INOUT)
 {
     drsym_error_t symres;
     drsym_info_t sym;
-    const char *modpath = name_info->path;
+    const char *modpath = e->name_info->path;
     char name[MAX_FUNC_LEN];
     char file[MAXIMUM_PATH];
+    uint64 prof_start;
     sym.struct_size = sizeof(sym);
     sym.name = name;
     sym.name_size = BUFFER_SIZE_BYTES(name);
@@ -528,13 +742,15 @@ lookup_func_and_line(symbolized_frame_t *frame OUT,
     sym.file_size = BUFFER_SIZE_BYTES(file);
     IF_WINDOWS(ASSERT(using_private_peb(), "private peb not preserved"));
     STATS_INC(symbol_address_lookups);
-    symres = drsym_lookup_address(modpath, modoffs, &sym,
+    PROF_START(prof_start);
+    symres = drsym_lookup_address(modpath, e->modoffs, &sym,
                                   DRSYM_DEMANGLE |
                                   (TEST(PRINT_EXPAND_TEMPLATES, ops.print_flags) ?
                                    DRSYM_DEMANGLE_PDB_TEMPLATES : 0));
+    PROF_STOP(NULL, PROF_SYMBOLS, prof_start);
     if (symres == DRSYM_SUCCESS || symres == DRSYM_ERROR_LINE_NOT_AVAILABLE) {
         LOG(4, "symbol %s+"PIFX" => %s+"PIFX" ("PIFX"-"PIFX") kind="PIFX"\n",
-            modpath, modoffs, sym.name, modoffs - sym.start_offs,
+            modpath, e->modoffs, sym.name, e->modoffs - sym.start_offs,
             sym.start_offs, sym.end_offs, sym.debug_kind);
         if (sym.name_available_size >= sym.name_size) {
             DO_ONCE({
@@ -543,33 +759,105 @@ lookup_func_and_line(symbolized_frame_t *frame OUT,
             });
             STATS_INC(symbol_names_truncated);
         }
-        frame->has_symbols = TEST(DRSYM_SYMBOLS, sym.debug_kind);
+        e->found = true;
+        e->has_symbols = TEST(DRSYM_SYMBOLS, sym.debug_kind);
         /* sym.name could be something like "BigInteger::operator%" */
-        dr_snprintf(frame->func, MAX_FUNC_LEN, "%s", sym.name);
-        NULL_TERMINATE_BUFFER(frame->func);
-        frame->funcoffs = (modoffs - sym.start_offs);
-        if (symres == DRSYM_ERROR_LINE_NOT_AVAILABLE) {
-            frame->fname[0] = '\0';
-            frame->line = 0;
-            frame->lineoffs = 0;
-        } else {
+        NULL_TERMINATE_BUFFER(name);
+        e->func = drmem_strndup(sym.name, MAX_FUNC_LEN - 1, HEAPSTAT_CALLSTACK);
+        e->funcoffs = (e->modoffs - sym.start_offs);
+        if (symres == DRSYM_SUCCESS) {
             char *fname = sym.file;
+            char buf[MAX_FILENAME_LEN+1];
             /* i#1634: if sym.file is longer than MAX_FILENAME_LEN,
              * we skip some prefix.
              */
-            /* frame->fname has the size of MAX_FILENAME_LEN+1, so we do not need
-             * extra byte for NULL.
-             */
             if (strlen(fname) > MAX_FILENAME_LEN) {
                 fname += (strlen(fname) - MAX_FILENAME_LEN + 3 /* ... */);
                 if (strchr(fname, DIRSEP) != NULL)
                     fname = strchr(fname, DIRSEP);
             }
-            dr_snprintf(frame->fname, MAX_FILENAME_LEN, "%s%s",
+            dr_snprintf(buf, MAX_FILENAME_LEN, "%s%s",
                         fname == sym.file ? "" : "...", fname);
+            NULL_TERMINATE_BUFFER(buf);
+            e->fname = drmem_strdup(buf, HEAPSTAT_CALLSTACK);
+            e->line = sym.line;
+            e->lineoffs = sym.line_offs;
+        }
+    }
+}
+
+static uint
+symbol_cache_hash(symbol_cache_entry_t *e)
+{
+    return (uint)((ptr_uint_t)e->name_info ^ (e->modoffs * 0x9e3779b1));
+}
+
+static bool
+symbol_cache_cmp(symbol_cache_entry_t *e1, symbol_cache_entry_t *e2)
+{
+    return e1->name_info == e2->name_info && e1->modoffs == e2->modoffs;
+}
+
+static void
+symbol_cache_free(symbol_cache_entry_t *e)
+{
+    if (e->func != NULL)
+        global_free(e->func, strlen(e->func) + 1, HEAPSTAT_CALLSTACK);
+    if (e->fname != NULL)
+        global_free(e->fname, strlen(e->fname) + 1, HEAPSTAT_CALLSTACK);
+    global_free(e, sizeof(*e), HEAPSTAT_CALLSTACK);
+}
+
+/* Returns the cached lookup of name_info+modoffs, performing it if necessary */
+static symbol_cache_entry_t *
+symbol_cache_lookup(modname_info_t *name_info, size_t modoffs)
+{
+    symbol_cache_entry_t key, *e;
+    key.name_info = name_info;
+    key.modoffs = modoffs;
+    e = (symbol_cache_entry_t *) hashtable_lookup(&symbol_cache, &key);
+    if (e != NULL) {
+        STATS_INC(symbol_cache_hits);
+        return e;
+    }
+    e = (symbol_cache_entry_t *) global_alloc(sizeof(*e), HEAPSTAT_CALLSTACK);
+    memset(e, 0, sizeof(*e));
+    e->name_info = name_info;
+    e->modoffs = modoffs;
+    /* We do not hold a lock across the lookup: a racing thread may resolve
+     * the same address, in which case we discard ours.
+     */
+    symbol_cache_resolve(e);
+    if (!hashtable_add(&symbol_cache, e, e)) {
+        symbol_cache_free(e);
+        e = (symbol_cache_entry_t *) hashtable_lookup(&symbol_cache, &key);
+        ASSERT(e != NULL, "symbol cache entries are never removed");
+    }
+    return e;
+}
+
+static void
+lookup_func_and_line(symbolized_frame_t *frame OUT,
+                     modname_info_t *name_info IN, size_t modoffs)
+{
+    symbol_cache_entry_t *e = symbol_cache_lookup(name_info, modoffs);
+    if (e->found) {
+        frame->has_symbols = e->has_symbols;
+        dr_snprintf(frame->func, MAX_FUNC_LEN, "%s", e->func);
+        NULL_TERMINATE_BUFFER(frame->func);
+        frame->funcoffs = e->funcoffs;
+        if (e->fname == NULL) {
+            frame->fname[0] = '\0';
+            frame->line = 0;
+            frame->lineoffs = 0;
+        } else {
+            /* frame->fname has the size of MAX_FILENAME_LEN+1, so we do not need
+             * extra byte for NULL.
+             */
+            dr_snprintf(frame->fname, MAX_FILENAME_LEN, "%s", e->fname);
             NULL_TERMINATE_BUFFER(frame->fname);
-            frame->line = sym.line;
-            frame->lineoffs = sym.line_offs;
+            frame->line = e->line;
+            frame->lineoffs = e->lineoffs;
         }
     }
 
@@ -590,6 +878,7 @@ print_symbol(byte *addr, char *buf, size_t bufsz, size_t *sofar,
     module_data_t *data;
     uint flags = use_custom_flags ? custom_flags : ops.print_flags;
     const char *modname;
+    uint64 prof_start;
     data = dr_lookup_module(addr);
     if (data == NULL)
         return false;
@@ -603,10 +892,12 @@ print_symbol(byte *addr, char *buf, size_t bufsz, size_t *sofar,
     sym.file = NULL;
     IF_WINDOWS(ASSERT(using_private_peb(), "private peb not preserved"));
     STATS_INC(symbol_address_lookups);
+    PROF_START(prof_start);
     symres = drsym_lookup_address(data->full_path, addr - data->start, &sym,
                                   DRSYM_DEMANGLE |
                                   (TEST(PRINT_EXPAND_TEMPLATES, flags) ?
                                    DRSYM_DEMANGLE_PDB_TEMPLATES : 0));
+    PROF_STOP(NULL, PROF_SYMBOLS, prof_start);
     if (symres == DRSYM_SUCCESS || symres == DRSYM_ERROR_LINE_NOT_AVAILABLE) {
         if (sym.name_available_size >= sym.name_size) {
             DO_ONCE({
@@ -1025,33 +1316,33 @@ walk_wide_string(wchar_t *start, size_t safe_wchars,
 #endif
 
 static bool
-is_retaddr(app_pc pc, bool exclude_tool_lib)
+is_in_code_section(app_pc pc)
 {
-    /* XXX: for our purposes we really want is_in_code_section().  Since
-     * is_in_module() is used for is_image(), we would need a separate rbtree.  We
-     * could do +rx segment via mem query and avoid walking sections.  We'd have to
-     * store the range since might not be there at unmap time?  So far the 3 backward
-     * derefs looking for calls haven't been slow enough or have enough false
-     * positives to make the +rx-only seem worth the effort: global var addresses on
-     * the stack don't seem any more common than things like SEH handlers that would
-     * match +rx anyway, and rare for global var to have what looks like a call prior
-     * to it.
-     */
-#ifdef ARM
-    bool is_thumb = TEST(1, (ptr_uint_t)pc);
-    pc = (app_pc) ALIGN_BACKWARD(pc, 2);
-#endif
-    STATS_INC(cstack_is_retaddr);
-    if (!is_in_module(pc-1))
+    /* No lock: see the code_index comment */
+    code_index_t *idx = code_index;
+    uint lo = 0, hi;
+    if (idx == NULL)
         return false;
-    if (exclude_tool_lib &&
-        ((pc >= libdr_base && pc < libdr_end) ||
-         (pc >= libtoolbase && pc < libtoolend)))
+    hi = idx->num_ranges;
+    while (lo < hi) {
+        uint mid = (lo + hi) / 2;
+        if (pc < idx->ranges[mid].start)
+            hi = mid;
+        else if (pc >= idx->ranges[mid].end)
+            lo = mid + 1;
+        else
+            return true;
+    }
+    return false;
+}
+
+/* The checks of is_retaddr() that only depend on the code at pc */
+static bool
+is_retaddr_code(app_pc pc _IF_ARM(bool is_thumb))
+{
+    if (!is_in_code_section(pc-1))
         return false;
     if (!TEST(FP_SEARCH_DO_NOT_DISASM, ops.fp_flags)) {
-        /* The is_in_module() check is more expensive than our 3 derefs here.
-         * We do not bother to cache frequent/recent values.
-         */
         /* more efficient to read 3 dwords than safe_read 6 into a buffer */
         bool match;
         STATS_INC(cstack_is_retaddr_backdecode);
@@ -1109,8 +1400,8 @@ is_retaddr(app_pc pc, bool exclude_tool_lib)
             })
         }, { /* EXCEPT */
             match = false;
-            /* If we end up with a lot of these we could either cache
-             * frequent/recent or switch to +rx instead of whole module
+            /* With code_index these should be rare, and the verdict is
+             * cached by is_retaddr().
              */
             LOG(3, "is_retaddr: can't read "PFX"\n", pc);
             STATS_INC(cstack_is_retaddr_unreadable);
@@ -1127,6 +1418,56 @@ is_retaddr(app_pc pc, bool exclude_tool_lib)
         if (!match)
             return false;
     }
+    return true;
+}
+
+static bool
+is_retaddr(app_pc pc, bool exclude_tool_lib)
+{
+    /* We used to check is_in_module(), which walks whole modules, while
+     * code_index holds only their executable ranges.  Global variable addresses
+     * on the stack are thus ruled out before the back-decode, though they were
+     * rarely a problem as it is rare for one to have what looks like a call
+     * prior to it.
+     */
+    void *drcontext = dr_get_current_drcontext();
+    tls_callstack_t *pt = (tls_callstack_t *)
+        ((drcontext == NULL) ? NULL : drmgr_get_tls_field(drcontext, tls_idx_callstack));
+    retaddr_cache_entry_t *entry = NULL;
+    app_pc key = pc;
+    uint verdict;
+#ifdef ARM
+    bool is_thumb = TEST(1, (ptr_uint_t)pc);
+    pc = (app_pc) ALIGN_BACKWARD(pc, 2);
+#endif
+    STATS_INC(cstack_is_retaddr);
+    if (exclude_tool_lib &&
+        ((pc >= libdr_base && pc < libdr_end) ||
+         (pc >= libtoolbase && pc < libtoolend)))
+        return false;
+    if (pt != NULL) {
+        /* As in module_lookup(), a racing unload is no different from a
+         * lookup that completed just before it.
+         */
+        uint gen = modtree_gen;
+        if (pt->retaddr_cache_gen != gen) {
+            memset(pt->retaddr_cache, 0, sizeof(pt->retaddr_cache));
+            pt->retaddr_cache_gen = gen;
+        }
+        entry = &pt->retaddr_cache[RETADDR_CACHE_HASH(key)];
+        if (entry->pc == key && entry->verdict != 0) {
+            STATS_INC(cstack_is_retaddr_cache_hits);
+            if (entry->verdict != RETADDR_LOOKS_LIKE)
+                return (entry->verdict == RETADDR_IS);
+            /* Only the retaddr_table check remains */
+            verdict = RETADDR_LOOKS_LIKE;
+            goto is_retaddr_seen;
+        }
+    }
+    verdict = is_retaddr_code(pc _IF_ARM(is_thumb)) ? RETADDR_LOOKS_LIKE : RETADDR_NOT;
+ is_retaddr_seen:
+    if (verdict == RETADDR_NOT)
+        goto is_retaddr_done;
     if (!TEST(FP_SEARCH_ALLOW_UNSEEN_RETADDR, ops.fp_flags) &&
         /* Do not check for retaddrs in tool libs which of course won't
          * be in our table.
@@ -1134,13 +1475,19 @@ is_retaddr(app_pc pc, bool exclude_tool_lib)
         !((pc >= libdr_base && pc < libdr_end) ||
           (pc >= libtoolbase && pc < libtoolend))) {
         /* i#1439: only allow retaddrs for calls we've seen */
-        if (hashtable_lookup(&retaddr_table, (void *)pc) == NULL) {
+        if (hashmap_lookup(&retaddr_table, (void *)pc) == NULL) {
             LOG(4, "is_retaddr: never-before-seen "PFX"\n", pc);
             STATS_INC(cstack_is_retaddr_unseen);
-            return false;
+            goto is_retaddr_done;
         }
     }
-    return true;
+    verdict = RETADDR_IS;
+ is_retaddr_done:
+    if (entry != NULL) {
+        entry->pc = key;
+        entry->verdict = verdict;
+    }
+    return (verdict == RETADDR_IS);
 }
 
 #ifdef ARM
@@ -1338,13 +1685,33 @@ check_retaddr_targets_frame(app_pc frame_addr, app_pc next_retaddr, bool fp_walk
     return res;
 }
 
+static inline fpscan_cache_entry *
+fpcache_set(tls_callstack_t *pt, byte *fp_in)
+{
+    uint hash = (uint)((ptr_uint_t)fp_in / sizeof(app_pc)) * 0x9e3779b1;
+    uint set = (fpcache_set_bits == 0) ? 0 : (hash >> (32 - fpcache_set_bits));
+    return &pt->fpcache[set * FPSCAN_CACHE_WAYS];
+}
+
+/* Moves way to the front of its set, shifting the more recent ways back */
+static inline void
+fpcache_move_to_front(fpscan_cache_entry *set, uint way)
+{
+    fpscan_cache_entry save = set[way];
+    for (; way > 0; way--)
+        set[way] = set[way - 1];
+    set[0] = save;
+}
+
 static void
 fpcache_update(tls_callstack_t *pt, byte *fp_in, byte *fp_out, app_pc retaddr)
 {
-    pt->fpcache[pt->fpcache_idx].input_fp = fp_in;
-    pt->fpcache[pt->fpcache_idx].output_fp = fp_out;
-    pt->fpcache[pt->fpcache_idx].retaddr = retaddr;
-    pt->fpcache_idx = (pt->fpcache_idx + 1) % FPSCAN_CACHE_ENTRIES;
+    fpscan_cache_entry *set = fpcache_set(pt, fp_in);
+    /* Evict the least recently used way */
+    fpcache_move_to_front(set, FPSCAN_CACHE_WAYS - 1);
+    set[0].input_fp = fp_in;
+    set[0].output_fp = fp_out;
+    set[0].retaddr = retaddr;
 }
 
 static app_pc
@@ -1390,30 +1757,31 @@ find_next_fp(void *drcontext, tls_callstack_t *pt, app_pc fp, app_pc prior_ra,
      * to implement.
      */
     if (ops.old_retaddrs_zeroed) {
+        fpscan_cache_entry *set = fpcache_set(pt, orig_fp);
         uint i;
-        for (i = 0; i < FPSCAN_CACHE_ENTRIES; i++) {
-            if (orig_fp == pt->fpcache[i].input_fp) {
+        for (i = 0; i < FPSCAN_CACHE_WAYS; i++) {
+            if (orig_fp == set[i].input_fp) {
                 app_pc ra;
-                if (safe_read(pt->fpcache[i].output_fp + sizeof(app_pc),
-                              sizeof(ra), &ra) &&
-                    ra == pt->fpcache[i].retaddr &&
+                if (safe_read(set[i].output_fp + sizeof(app_pc), sizeof(ra), &ra) &&
+                    ra == set[i].retaddr &&
                     /* i#1231: we don't zero for full mode but we want the cache */
                     (ops.is_dword_defined == NULL ||
                      ops.is_dword_defined(drcontext,
-                                          pt->fpcache[i].output_fp + sizeof(app_pc)))) {
+                                          set[i].output_fp + sizeof(app_pc)))) {
                     if (retaddr != NULL)
                         *retaddr = ra;
                     LOG(4, "find_next_fp: cache hit "PFX" => "PFX", ra="PFX"\n",
-                        orig_fp, pt->fpcache[i].output_fp, ra);
+                        orig_fp, set[i].output_fp, ra);
                     /* Make sure we don't clobber this hit on our next miss */
-                    pt->fpcache_idx = (i + 1) % FPSCAN_CACHE_ENTRIES;
+                    fpcache_move_to_front(set, i);
                     STATS_INC(find_next_fp_cache_hits);
-                    return pt->fpcache[i].output_fp;
+                    return set[0].output_fp;
                 } else {
-                    pt->fpcache[i].input_fp = NULL; /* invalidate */
+                    set[i].input_fp = NULL; /* invalidate */
                 }
             }
         }
+        STATS_INC(find_next_fp_cache_misses);
     }
     /* PR 454536: dr_memory_is_readable() is racy so we use a safe_read().
      * On Windows safe_read() costs 1 system call: perhaps DR should
@@ -1594,6 +1962,103 @@ find_next_fp(void *drcontext, tls_callstack_t *pt, app_pc fp, app_pc prior_ra,
 }
 
 /* XXX i#1222: on win64, we should use SEH unwind tables to walk the callstack. */
+/* Results of print_callstack_unwind() */
+enum {
+    UNWIND_WALK_NONE,      /* nothing unwound: use the heuristics from the top */
+    UNWIND_WALK_PARTIAL,   /* continue with the heuristics from the resume point */
+    UNWIND_WALK_DONE,      /* the callstack is complete */
+};
+
+/* Walks frames using unwind info for as long as it covers them, recording
+ * frames just as print_callstack() does.  We need a known starting point:
+ * either the interrupted pc, or the entry to a routine whose caller's frame
+ * was already recorded and whose retaddr is at TOS, as for a wrapped or
+ * replaced allocation routine.
+ */
+static int
+print_callstack_unwind(tls_callstack_t *pt, char *buf, size_t bufsz, size_t *sofar,
+                       dr_mcontext_t *mc, bool print_fps, packed_callstack_t *pcs,
+                       int *num INOUT, bool for_log, uint max_frames,
+                       bool (*frame_cb)(app_pc pc, byte *fp, void *user_data),
+                       void *user_data, byte **resume_sp OUT, app_pc *resume_ra OUT)
+{
+    byte *sp = (byte *) MC_SP_REG(mc);
+    byte *fp = (byte *) MC_FP_REG(mc);
+    app_pc pc, ra;
+    bool top_frame, first = true, last_frame = false;
+    ssize_t len = 0;
+    size_t prev_sofar = 0;
+    unwind_result_t res;
+
+    if (TEST(DR_MC_CONTROL, mc->flags) && mc->pc != NULL) {
+        pc = mc->pc;
+        top_frame = true;
+    } else if (pcs != NULL && *num == 1 && !pcs->first_is_syscall &&
+               safe_read(sp, sizeof(pc), &pc) && pc == PCS_FRAME_LOC(pcs, 0).addr) {
+        sp += sizeof(app_pc);
+        top_frame = false;
+    } else
+        return UNWIND_WALK_NONE;
+
+    while (true) {
+        res = unwind_step(pc, top_frame, &sp, &fp, &ra);
+        if (res == UNWIND_OUTERMOST) {
+            LOG(4, "ending callstack: unwind info marks "PFX" as the base\n", pc);
+            return UNWIND_WALK_DONE;
+        }
+        if (res == UNWIND_NO_INFO) {
+            if (first)
+                return UNWIND_WALK_NONE;
+            *resume_sp = sp;
+            *resume_ra = pc;
+            return UNWIND_WALK_PARTIAL;
+        }
+        if (buf != NULL) {
+            prev_sofar = *sofar;
+            if (for_log)
+                BUFPRINT(buf, bufsz, *sofar, len, FP_PREFIX"#%2d ", *num);
+            if (print_fps) {
+                BUFPRINT(buf, bufsz, *sofar, len, "fp="PFX" parent="PFX" ",
+                         sp, fp);
+            }
+        }
+        if (pcs != NULL && first && *num == 1 && PCS_FRAME_LOC(pcs, 0).addr == ra) {
+            /* caller already added this frame */
+            if (buf != NULL) /* undo the fp= print */
+                *sofar = prev_sofar;
+        } else if ((pcs == NULL &&
+                    print_address_common(buf, bufsz, sofar, ra, NULL,
+                                         !TEST(FP_SHOW_NON_MODULE_FRAMES, ops.fp_flags),
+                                         true, for_log, &last_frame, *num)) ||
+                   (pcs != NULL &&
+                    address_to_frame(NULL, pcs, ra, NULL,
+                                     !TEST(FP_SHOW_NON_MODULE_FRAMES, ops.fp_flags),
+                                     true, pcs->num_frames))) {
+            (*num)++;
+            if (frame_cb != NULL && !(*frame_cb)(ra, fp, user_data))
+                return UNWIND_WALK_DONE;
+            if (last_frame)
+                return UNWIND_WALK_DONE;
+            if (pt != NULL && pt->stack_lowest_retaddr != NULL &&
+                ra == pt->stack_lowest_retaddr) {
+                LOG(4, "ending callstack: hit stack_lowest_retaddr "PFX"\n", ra);
+                return UNWIND_WALK_DONE;
+            }
+        } else if (buf != NULL) /* undo the fp= print */
+            *sofar = prev_sofar;
+        first = false;
+        if (*num >= max_frames || (pcs != NULL && pcs->num_frames >= max_frames)) {
+            if (buf != NULL)
+                BUFPRINT(buf, bufsz, *sofar, len, FP_PREFIX"..."NL);
+            LOG(4, "truncating callstack: hit max frames %d %d\n",
+                *num, pcs == NULL ? -1 : pcs->num_frames);
+            return UNWIND_WALK_DONE;
+        }
+        pc = ra;
+        top_frame = false;
+    }
+}
+
 void
 print_callstack(char *buf, size_t bufsz, size_t *sofar, dr_mcontext_t *mc,
                 bool print_fps, packed_callstack_t *pcs, int num_frames_printed,
@@ -1642,6 +2107,26 @@ print_callstack(char *buf, size_t bufsz, size_t *sofar, dr_mcontext_t *mc,
 #endif
     STATS_INC(callstack_walks);
 
+    if (TEST(FP_USE_UNWIND_INFO, ops.fp_flags)) {
+        byte *resume_sp = NULL;
+        app_pc resume_ra = NULL;
+        int walk = print_callstack_unwind(pt, buf, bufsz, sofar, mc, print_fps, pcs,
+                                          &num, for_log, max_frames, frame_cb,
+                                          user_data, &resume_sp, &resume_ra);
+        if (walk == UNWIND_WALK_DONE)
+            goto print_callstack_done;
+        if (walk == UNWIND_WALK_PARTIAL) {
+            /* Pick up with the heuristics from the first frame not covered */
+            LOG(4, "find_next_fp "PFX" b/c out of unwind info\n", resume_sp);
+            tos = resume_sp;
+            pc = (ptr_uint_t *) find_next_fp(drcontext, pt, resume_sp, resume_ra,
+                                             false/*!top*/, NULL);
+            scanned = true;
+            first_iter = false;
+            goto print_callstack_walk;
+        }
+    }
+
     LOG(4, "initial fp="PFX" vs sp="PFX" def=%d\n",
         MC_FP_REG(mc), MC_SP_REG(mc),
         (ops.is_dword_defined == NULL) ?
@@ -1702,6 +2187,7 @@ print_callstack(char *buf, size_t bufsz, size_t *sofar, dr_mcontext_t *mc,
                                          &custom_retaddr);
         scanned = true;
     }
+ print_callstack_walk:
     while (pc != NULL) {
         if (!have_appdata &&
             !safe_read((byte *)pc, sizeof(appdata), &appdata)) {
@@ -1985,12 +2471,13 @@ void
 packed_callstack_record(packed_callstack_t **pcs_out/*out*/, dr_mcontext_t *mc,
                         app_loc_t *loc, uint max_frames)
 {
-    packed_callstack_t *pcs = (packed_callstack_t *)
-        global_alloc(sizeof(*pcs), HEAPSTAT_CALLSTACK);
+    packed_callstack_t *pcs = (packed_callstack_t *) pool_alloc(pcs_pool);
     size_t sz_out;
     int num_frames_printed = 0;
+    uint64 prof_start;
     ASSERT(max_frames <= ops.global_max_frames, "max_frames > global_max_frames");
     ASSERT(pcs_out != NULL, "invalid args");
+    PROF_START(prof_start);
     memset(pcs, 0, sizeof(*pcs));
     pcs->refcount = 1;
     if (modname_array_end < MAX_MODNAMES_STORED) {
@@ -2058,6 +2545,7 @@ packed_callstack_record(packed_callstack_t **pcs_out/*out*/, dr_mcontext_t *mc,
         pcs->frames.full = frames_out;
     }
     *pcs_out = pcs;
+    PROF_STOP(NULL, PROF_CALLSTACK, prof_start);
 }
 
 void
@@ -2066,6 +2554,73 @@ packed_callstack_first_frame_retaddr(packed_callstack_t *pcs)
     pcs->first_is_retaddr = true;
 }
 
+uint
+callstack_record_raw(dr_mcontext_t *mc, app_loc_t *loc, app_pc *frames OUT,
+                     uint max_frames)
+{
+    void *drcontext = dr_get_current_drcontext();
+    tls_callstack_t *pt = (tls_callstack_t *)
+        ((drcontext == NULL) ? NULL : drmgr_get_tls_field(drcontext, tls_idx_callstack));
+    packed_callstack_t pcs;
+    int num_frames_printed = 0;
+    uint i;
+    uint64 prof_start;
+    ASSERT(max_frames <= ops.global_max_frames, "max_frames > global_max_frames");
+    ASSERT(loc == NULL || loc->type == APP_LOC_PC, "syscall frames not supported");
+    if (pt == NULL)
+        return 0;
+    PROF_START(prof_start);
+    if (pt->raw_frames == NULL) {
+        pt->raw_frames = (full_frame_t *)
+            thread_alloc(drcontext, sizeof(*pt->raw_frames) * ops.global_max_frames,
+                         HEAPSTAT_CALLSTACK);
+    }
+    /* We walk into a scratch callstack of full frames, which never needs the
+     * modname array and is never interned.
+     */
+    memset(&pcs, 0, sizeof(pcs));
+    pcs.refcount = 1;
+    pcs.is_packed = false;
+    pcs.frames.full = pt->raw_frames;
+    if (loc != NULL) {
+        address_to_frame(NULL, &pcs, loc_to_pc(loc), NULL, false, false, 0);
+        num_frames_printed = 1;
+    }
+    print_callstack(NULL, 0, NULL, mc, false, &pcs, num_frames_printed, false,
+                    max_frames, NULL, NULL);
+    for (i = 0; i < pcs.num_frames; i++)
+        frames[i] = pcs.frames.full[i].loc.addr;
+    PROF_STOP(drcontext, PROF_CALLSTACK, prof_start);
+    return pcs.num_frames;
+}
+
+packed_callstack_t *
+packed_callstack_from_raw(app_pc *frames, uint num_frames, bool first_is_retaddr)
+{
+    packed_callstack_t *pcs = (packed_callstack_t *) pool_alloc(pcs_pool);
+    uint i;
+    memset(pcs, 0, sizeof(*pcs));
+    pcs->refcount = 1;
+    pcs->first_is_retaddr = first_is_retaddr;
+    pcs->is_packed = (modname_array_end < MAX_MODNAMES_STORED);
+    if (num_frames > 0) {
+        if (pcs->is_packed) {
+            pcs->frames.packed = (packed_frame_t *)
+                global_alloc(sizeof(*pcs->frames.packed) * num_frames,
+                             HEAPSTAT_CALLSTACK);
+        } else {
+            pcs->frames.full = (full_frame_t *)
+                global_alloc(sizeof(*pcs->frames.full) * num_frames,
+                             HEAPSTAT_CALLSTACK);
+        }
+    }
+    /* the walk already filtered the frames, so keep them all */
+    for (i = 0; i < num_frames; i++)
+        address_to_frame(NULL, pcs, frames[i], NULL, false, false, i);
+    ASSERT(pcs->num_frames == num_frames, "raw frame lost");
+    return pcs;
+}
+
 /* Returns false if a syscall.  If returns true, also fills in the OUT params. */
 static bool
 packed_callstack_frame_modinfo(packed_callstack_t *pcs, uint frame,
@@ -2085,19 +2640,20 @@ packed_callstack_frame_modinfo(packed_callstack_t *pcs, uint frame,
         }
         offs = pcs->frames.full[frame].modoffs;
     } else {
-        if (pcs->frames.packed[frame].modname_idx == 0) {
+        packed_frame_t *f = pcs_packed_frame(pcs, frame);
+        if (f->modname_idx == 0) {
             ASSERT(frame == 0, "syscall should only be top frame");
             ASSERT(pcs->first_is_syscall, "flag not set");
             return false;
         }
-        if (pcs->frames.packed[frame].modoffs < MAX_MODOFFS_STORED) {
+        if (f->modoffs < MAX_MODOFFS_STORED) {
             /* If module is larger than 16M, we need to adjust offset.
              * The hashtable holds the first index.
              */
             int start_idx;
-            int idx = pcs->frames.packed[frame].modname_idx;
+            int idx = f->modname_idx;
             ASSERT(idx < MAX_MODNAMES_STORED, "invalid modname idx");
-            offs = pcs->frames.packed[frame].modoffs;
+            offs = f->modoffs;
             info = modname_array[idx];
             start_idx = info->index;
             ASSERT(start_idx != 0, "module in array must be in table");
@@ -2112,9 +2668,20 @@ packed_callstack_frame_modinfo(packed_callstack_t *pcs, uint frame,
     return true;
 }
 
+/* PR 543863: subtract one from retaddrs in callstacks so the line#
+ * is for the call and not for the next source code line, but only
+ * for symbol lookup so we still display a valid instr addr.
+ * We assume first frame is not a retaddr.
+ */
+static inline size_t
+packed_frame_lookup_offs(packed_callstack_t *pcs, uint idx, size_t offs)
+{
+    return (idx == 0 && !pcs->first_is_retaddr) ? offs : offs-1;
+}
+
 static void
 packed_frame_to_symbolized(packed_callstack_t *pcs IN, symbolized_frame_t *frame OUT,
-                           uint idx)
+                           uint idx, bool lookup_syms)
 {
     modname_info_t *info = NULL;
     size_t offs;
@@ -2162,13 +2729,10 @@ packed_frame_to_symbolized(packed_callstack_t *pcs IN, symbolized_frame_t *frame
             NULL_TERMINATE_BUFFER(frame->modname);
             dr_snprintf(frame->modoffs, MAX_PFX_LEN, PIFX, offs);
             NULL_TERMINATE_BUFFER(frame->modoffs);
-            /* PR 543863: subtract one from retaddrs in callstacks so the line#
-             * is for the call and not for the next source code line, but only
-             * for symbol lookup so we still display a valid instr addr.
-             * We assume first frame is not a retaddr.
-             */
-            lookup_func_and_line(frame, info,
-                                 (idx == 0 && !pcs->first_is_retaddr) ? offs : offs-1);
+            if (lookup_syms) {
+                lookup_func_and_line(frame, info,
+                                     packed_frame_lookup_offs(pcs, idx, offs));
+            }
         } else {
             ASSERT(!frame->is_module, "frame not initialized");
             dr_snprintf(frame->func, MAX_FUNC_LEN, "<not in a module>");
@@ -2190,7 +2754,7 @@ packed_callstack_print(packed_callstack_t *pcs, uint num_frames,
     STATS_INC(callstacks_symbolized);
     ASSERT(pcs != NULL, "invalid args");
     for (i = 0; i < pcs->num_frames && (num_frames == 0 || i < num_frames); i++) {
-        packed_frame_to_symbolized(pcs, &frame, i);
+        packed_frame_to_symbolized(pcs, &frame, i, true/*symbols*/);
         print_frame(&frame, buf, bufsz, sofar, false, 0, 0, prefix);
         if (ops.truncate_below != NULL &&
             text_matches_any_pattern((const char *)frame.func, ops.truncate_below, false))
@@ -2211,7 +2775,7 @@ packed_callstack_to_symbolized(packed_callstack_t *pcs IN,
         global_alloc(sizeof(*scs->frames) * scs->num_frames, HEAPSTAT_CALLSTACK);
     ASSERT(pcs != NULL, "invalid args");
     for (i = 0; i < pcs->num_frames; i++) {
-        packed_frame_to_symbolized(pcs, &scs->frames[i], i);
+        packed_frame_to_symbolized(pcs, &scs->frames[i], i, true/*symbols*/);
         /* we truncate for real and not just on printing (i#700) */
         if (ops.truncate_below != NULL &&
             text_matches_any_pattern((const char *)scs->frames[i].func,
@@ -2223,6 +2787,106 @@ packed_callstack_to_symbolized(packed_callstack_t *pcs IN,
     }
 }
 
+void
+packed_callstack_to_unsymbolized(packed_callstack_t *pcs IN,
+                                 symbolized_callstack_t *scs OUT)
+{
+    uint i;
+    ASSERT(pcs != NULL, "invalid args");
+    scs->num_frames = pcs->num_frames;
+    scs->num_frames_allocated = pcs->num_frames;
+    ASSERT(scs->num_frames > 0, "invalid empty callstack");
+    scs->frames = (symbolized_frame_t *)
+        global_alloc(sizeof(*scs->frames) * scs->num_frames, HEAPSTAT_CALLSTACK);
+    for (i = 0; i < pcs->num_frames; i++)
+        packed_frame_to_symbolized(pcs, &scs->frames[i], i, false/*no symbols*/);
+}
+
+/* Sorts by module and then by offset, with a heapsort as we have no qsort
+ * available in all of our build configurations.
+ */
+static inline bool
+symbol_batch_less(symbol_cache_entry_t *e1, symbol_cache_entry_t *e2)
+{
+    if (e1->name_info->id != e2->name_info->id)
+        return e1->name_info->id < e2->name_info->id;
+    return e1->modoffs < e2->modoffs;
+}
+
+static void
+symbol_batch_sift_down(symbol_cache_entry_t *a, uint root, uint n)
+{
+    while (2*root + 1 < n) {
+        uint child = 2*root + 1;
+        symbol_cache_entry_t tmp;
+        if (child + 1 < n && symbol_batch_less(&a[child], &a[child+1]))
+            child++;
+        if (!symbol_batch_less(&a[root], &a[child]))
+            return;
+        tmp = a[root];
+        a[root] = a[child];
+        a[child] = tmp;
+        root = child;
+    }
+}
+
+static void
+symbol_batch_sort(symbol_cache_entry_t *a, uint n)
+{
+    uint i;
+    for (i = n/2; i > 0; i--)
+        symbol_batch_sift_down(a, i - 1, n);
+    for (i = n; i > 1; i--) {
+        symbol_cache_entry_t tmp = a[0];
+        a[0] = a[i - 1];
+        a[i - 1] = tmp;
+        symbol_batch_sift_down(a, 0, i - 1);
+    }
+}
+
+void
+packed_callstack_symbolize_batch(packed_callstack_t **pcs_array, uint num_pcs)
+{
+    symbol_cache_entry_t *batch;
+    size_t batch_sz;
+    uint i, j, num = 0, total = 0;
+    for (i = 0; i < num_pcs; i++)
+        total += pcs_array[i]->num_frames;
+    if (total == 0)
+        return;
+    /* We only use the key fields here */
+    batch_sz = total * sizeof(*batch);
+    batch = (symbol_cache_entry_t *) global_alloc(batch_sz, HEAPSTAT_CALLSTACK);
+    for (i = 0; i < num_pcs; i++) {
+        packed_callstack_t *pcs = pcs_array[i];
+        for (j = 0; j < pcs->num_frames; j++) {
+            modname_info_t *info = NULL;
+            size_t offs;
+            if (packed_callstack_frame_modinfo(pcs, j, &info, &offs) &&
+                info != NULL && info->path != NULL) {
+                batch[num].name_info = info;
+                batch[num].modoffs = packed_frame_lookup_offs(pcs, j, offs);
+                num++;
+            }
+        }
+    }
+    /* Walking each module in address order keeps drsyms working on one
+     * module's debug info at a time, rather than re-loading it across
+     * interleaved modules.
+     */
+    symbol_batch_sort(batch, num);
+    LOG(2, "symbolizing %u frames from %u callstacks\n", num, num_pcs);
+    for (i = 0; i < num; i++) {
+        if (i > 0 && symbol_cache_cmp(&batch[i], &batch[i - 1]))
+            continue;
+        if (hashtable_lookup(&symbol_cache, &batch[i]) != NULL)
+            continue;
+        STATS_INC(symbol_batch_lookups);
+        symbol_cache_lookup(batch[i].name_info, batch[i].modoffs);
+    }
+    global_free(batch, batch_sz, HEAPSTAT_CALLSTACK);
+}
+
 #ifdef DEBUG
 void
 packed_callstack_log(packed_callstack_t *pcs, file_t f)
@@ -2252,6 +2916,91 @@ packed_callstack_log(packed_callstack_t *pcs, file_t f)
 }
 #endif
 
+static uint
+frame_tail_hash(frame_tail_t *t)
+{
+    uint hash = t->num_frames;
+    uint i;
+    for (i = 0; i < t->num_frames; i++)
+        hash ^= (ptr_uint_t) t->frames[i].loc.addr;
+    return hash;
+}
+
+static bool
+frame_tail_cmp(frame_tail_t *t1, frame_tail_t *t2)
+{
+    return (t1->num_frames == t2->num_frames &&
+            memcmp(t1->frames, t2->frames, sizeof(*t1->frames)*t1->num_frames) == 0);
+}
+
+static void
+frame_tail_free(frame_tail_t *t)
+{
+    global_free(t->frames, sizeof(*t->frames)*t->num_frames, HEAPSTAT_CALLSTACK);
+    global_free(t, sizeof(*t), HEAPSTAT_CALLSTACK);
+}
+
+static void
+frame_tail_release(frame_tail_t *t)
+{
+    hashtable_lock(&frame_tail_table);
+    ASSERT(t->refcount > 0, "frame tail refcount underflow");
+    t->refcount--;
+    if (t->refcount == 0)
+        hashtable_remove(&frame_tail_table, t); /* frees t */
+    hashtable_unlock(&frame_tail_table);
+}
+
+/* Copies all of pcs's frames, own and shared, into frames */
+static void
+packed_callstack_copy_frames(packed_callstack_t *pcs, packed_frame_t *frames OUT)
+{
+    uint own = pcs_num_own_frames(pcs);
+    ASSERT(pcs->is_packed, "only packed frames are shared");
+    memcpy(frames, pcs->frames.packed, sizeof(*frames)*own);
+    if (pcs->tail != NULL) {
+        memcpy(frames + own, pcs->tail->frames,
+               sizeof(*frames)*pcs->tail->num_frames);
+    }
+}
+
+/* Replaces the outer frames of pcs, which is about to be interned, with a
+ * shared tail.
+ */
+static void
+packed_callstack_share_tail(packed_callstack_t *pcs)
+{
+    frame_tail_t key, *t;
+    packed_frame_t *own_frames;
+    if (!pcs->is_packed || pcs->tail != NULL || pcs->num_frames <= PCS_OWN_FRAMES)
+        return;
+    key.num_frames = pcs->num_frames - PCS_OWN_FRAMES;
+    key.frames = pcs->frames.packed + PCS_OWN_FRAMES;
+    hashtable_lock(&frame_tail_table);
+    t = (frame_tail_t *) hashtable_lookup(&frame_tail_table, &key);
+    if (t == NULL) {
+        t = (frame_tail_t *) global_alloc(sizeof(*t), HEAPSTAT_CALLSTACK);
+        t->refcount = 0;
+        t->num_frames = key.num_frames;
+        t->frames = (packed_frame_t *)
+            global_alloc(sizeof(*t->frames)*t->num_frames, HEAPSTAT_CALLSTACK);
+        memcpy(t->frames, key.frames, sizeof(*t->frames)*t->num_frames);
+        hashtable_add(&frame_tail_table, t, t);
+        STATS_INC(frame_tails_unique);
+    } else
+        STATS_INC(frame_tails_shared);
+    t->refcount++;
+    hashtable_unlock(&frame_tail_table);
+
+    own_frames = (packed_frame_t *)
+        global_alloc(sizeof(*own_frames)*PCS_OWN_FRAMES, HEAPSTAT_CALLSTACK);
+    memcpy(own_frames, pcs->frames.packed, sizeof(*own_frames)*PCS_OWN_FRAMES);
+    global_free(pcs->frames.packed, sizeof(*pcs->frames.packed)*pcs->num_frames,
+                HEAPSTAT_CALLSTACK);
+    pcs->frames.packed = own_frames;
+    pcs->tail = t;
+}
+
 uint
 packed_callstack_free(packed_callstack_t *pcs)
 {
@@ -2266,9 +3015,11 @@ packed_callstack_free(packed_callstack_t *pcs)
         if (pcs->is_packed) {
             if (pcs->frames.packed != NULL) {
                 global_free(pcs->frames.packed,
-                            sizeof(*pcs->frames.packed)*pcs->num_frames,
+                            sizeof(*pcs->frames.packed)*pcs_num_own_frames(pcs),
                             HEAPSTAT_CALLSTACK);
             }
+            if (pcs->tail != NULL)
+                frame_tail_release(pcs->tail);
         } else {
             if (pcs->frames.full != NULL) {
                 global_free(pcs->frames.full,
@@ -2276,7 +3027,7 @@ packed_callstack_free(packed_callstack_t *pcs)
                             HEAPSTAT_CALLSTACK);
             }
         }
-        global_free(pcs, sizeof(*pcs), HEAPSTAT_CALLSTACK);
+        pool_free(pcs_pool, pcs);
     }
     return refcount;
 }
@@ -2308,11 +3059,11 @@ packed_callstack_clone(packed_callstack_t *src)
     dst->first_is_retaddr = src->first_is_retaddr;
     dst->first_is_syscall = src->first_is_syscall;
     if (dst->is_packed) {
+        /* The clone is not interned so we give it all its frames */
         dst->frames.packed = (packed_frame_t *)
             global_alloc(sizeof(*dst->frames.packed) * src->num_frames,
                          HEAPSTAT_CALLSTACK);
-        memcpy(dst->frames.packed, src->frames.packed,
-               sizeof(*dst->frames.packed) * src->num_frames);
+        packed_callstack_copy_frames(src, dst->frames.packed);
     } else {
         dst->frames.full = (full_frame_t *)
             global_alloc(sizeof(*dst->frames.full) * src->num_frames,
@@ -2346,6 +3097,31 @@ packed_callstack_hash(packed_callstack_t *pcs)
     return hash;
 }
 
+static bool
+packed_callstack_frame_cmp(packed_callstack_t *pcs1, packed_callstack_t *pcs2, uint i)
+{
+    modname_info_t *info1 = NULL, *info2 = NULL;
+    size_t offs1 = 0, offs2 = 0;
+    bool nonsys1, nonsys2;
+    nonsys1 = packed_callstack_frame_modinfo(pcs1, i, &info1, &offs1);
+    nonsys2 = packed_callstack_frame_modinfo(pcs2, i, &info2, &offs2);
+    if ((nonsys1 && !nonsys2) || (!nonsys1 && nonsys2))
+        return false;
+    if (!nonsys1) {
+        if (memcmp(PCS_FRAME_LOC(pcs1, i).sysloc, PCS_FRAME_LOC(pcs2, i).sysloc,
+                   sizeof(syscall_loc_t)) != 0)
+            return false;
+    } else {
+        if (PCS_FRAME_LOC(pcs1, i).addr != PCS_FRAME_LOC(pcs2, i).addr)
+            return false;
+        if (info1 != info2)
+            return false;
+        if (offs1 != offs2)
+            return false;
+    }
+    return true;
+}
+
 bool
 packed_callstack_cmp(packed_callstack_t *pcs1, packed_callstack_t *pcs2)
 {
@@ -2362,32 +3138,40 @@ packed_callstack_cmp(packed_callstack_t *pcs1, packed_callstack_t *pcs2)
     if (!pcs1->first_is_syscall && !pcs2->first_is_syscall &&
         ((pcs1->is_packed && pcs2->is_packed) ||
          (!pcs1->is_packed && !pcs2->is_packed))) {
-        return (memcmp(PCS_FRAMES(pcs1), PCS_FRAMES(pcs2),
-                       PCS_FRAME_SZ(pcs1)*pcs1->num_frames) == 0);
+        if (pcs1->tail == pcs2->tail) {
+            /* Shared tails are interned, so a pointer compare suffices for them */
+            return (memcmp(PCS_FRAMES(pcs1), PCS_FRAMES(pcs2),
+                           PCS_FRAME_SZ(pcs1)*pcs_num_own_frames(pcs1)) == 0);
+        }
+        if (pcs1->tail != NULL && pcs2->tail != NULL &&
+            pcs1->tail->num_frames == pcs2->tail->num_frames)
+            return false; /* same split but different interned tails */
     }
     /* One is packed, the other is not; or, one has a syscall.
      * We have to walk the frames.
      */
     for (i = 0; i < pcs1->num_frames; i++) {
-        modname_info_t *info1 = NULL, *info2 = NULL;
-        size_t offs1 = 0, offs2 = 0;
-        bool nonsys1, nonsys2;
-        nonsys1 = packed_callstack_frame_modinfo(pcs1, i, &info1, &offs1);
-        nonsys2 = packed_callstack_frame_modinfo(pcs2, i, &info2, &offs2);
-        if ((nonsys1 && !nonsys2) || (!nonsys1 && nonsys2))
+        if (!packed_callstack_frame_cmp(pcs1, pcs2, i))
+            return false;
+    }
+    return true;
+}
+
+bool
+packed_callstack_cmp_prefix(packed_callstack_t *pcs1, packed_callstack_t *pcs2,
+                            uint num_frames)
+{
+    uint i;
+    uint num1 = (PCS_FRAMES(pcs1) == NULL) ? 0 : pcs1->num_frames;
+    uint num2 = (PCS_FRAMES(pcs2) == NULL) ? 0 : pcs2->num_frames;
+    /* A callstack shorter than num_frames must be matched in full */
+    if ((num1 < num_frames || num2 < num_frames) && num1 != num2)
+        return false;
+    if (num1 < num_frames)
+        num_frames = num1;
+    for (i = 0; i < num_frames; i++) {
+        if (!packed_callstack_frame_cmp(pcs1, pcs2, i))
             return false;
-        if (!nonsys1) {
-            if (memcmp(PCS_FRAME_LOC(pcs1, i).sysloc, PCS_FRAME_LOC(pcs2, i).sysloc,
-                       sizeof(syscall_loc_t)) != 0)
-                return false;
-        } else {
-            if (PCS_FRAME_LOC(pcs1, i).addr != PCS_FRAME_LOC(pcs2, i).addr)
-                return false;
-            if (info1 != info2)
-                return false;
-            if (offs1 != offs2)
-                return false;
-        }
     }
     return true;
 }
@@ -2397,6 +3181,13 @@ packed_callstack_md5(packed_callstack_t *pcs, byte digest[MD5_RAW_BYTES])
 {
     if (pcs->num_frames == 0) {
         memset(digest, 0, sizeof(digest[0])*MD5_RAW_BYTES);
+    } else if (pcs->tail != NULL) {
+        /* We hash the same bytes as for an unshared callstack */
+        size_t sz = PCS_FRAME_SZ(pcs)*pcs->num_frames;
+        packed_frame_t *frames = (packed_frame_t *) global_alloc(sz, HEAPSTAT_CALLSTACK);
+        packed_callstack_copy_frames(pcs, frames);
+        get_md5_for_region((const byte *)frames, sz, digest);
+        global_free(frames, sz, HEAPSTAT_CALLSTACK);
     } else {
         get_md5_for_region((const byte *)PCS_FRAMES(pcs),
                            PCS_FRAME_SZ(pcs)*pcs->num_frames, digest);
@@ -2406,8 +3197,16 @@ packed_callstack_md5(packed_callstack_t *pcs, byte digest[MD5_RAW_BYTES])
 void
 packed_callstack_crc32(packed_callstack_t *pcs, uint crc[2])
 {
-    crc32_whole_and_half((const char *)PCS_FRAMES(pcs),
-                         PCS_FRAME_SZ(pcs)*pcs->num_frames, crc);
+    if (pcs->tail != NULL) {
+        size_t sz = PCS_FRAME_SZ(pcs)*pcs->num_frames;
+        packed_frame_t *frames = (packed_frame_t *) global_alloc(sz, HEAPSTAT_CALLSTACK);
+        packed_callstack_copy_frames(pcs, frames);
+        crc32_whole_and_half((const char *)frames, sz, crc);
+        global_free(frames, sz, HEAPSTAT_CALLSTACK);
+    } else {
+        crc32_whole_and_half((const char *)PCS_FRAMES(pcs),
+                             PCS_FRAME_SZ(pcs)*pcs->num_frames, crc);
+    }
 }
 
 uint
@@ -2416,6 +3215,26 @@ packed_callstack_num_frames(packed_callstack_t *pcs)
     return pcs->num_frames;
 }
 
+void
+packed_callstack_frame_raw(packed_callstack_t *pcs, uint frame, raw_frame_t *raw OUT)
+{
+    modname_info_t *info = NULL;
+    size_t offs = 0;
+    memset(raw, 0, sizeof(*raw));
+    if (!packed_callstack_frame_modinfo(pcs, frame, &info, &offs)) {
+        raw->is_syscall = true;
+        raw->sysnum = PCS_FRAME_LOC(pcs, frame).sysloc->sysnum;
+        return;
+    }
+    raw->pc = PCS_FRAME_LOC(pcs, frame).addr;
+    raw->is_retaddr = (frame > 0 || pcs->first_is_retaddr);
+    if (info != NULL) {
+        raw->modpath = info->path;
+        raw->modid = info->id;
+        raw->modoffs = offs;
+    }
+}
+
 /* destroy the packted callstack */
 void
 packed_callstack_destroy(packed_callstack_t *pcs)
@@ -2444,6 +3263,8 @@ packed_callstack_add_to_table(hashtable_t *table, packed_callstack_t *pcs
     existing = hashtable_lookup(table, (void *)pcs);
     if (existing == NULL) {
         /* avoid calling lookup twice by not calling hashtable_add() */
+        /* The table's hash and cmp are unaffected by sharing the frames */
+        packed_callstack_share_tail(pcs);
         IF_DEBUG(void *prior =)
             hashtable_add_replace(table, (void *)pcs, (void *)pcs);
         ASSERT(prior == NULL, "just did lookup: cannot happen");
@@ -2711,6 +3532,103 @@ callstack_module_remove_region(app_pc start, app_pc end)
     }
 }
 
+/* Fills in ranges with the module's executable ranges, sorted, and returns
+ * how many there are.  Falls back to the whole module.
+ */
+static uint
+code_index_module_ranges(const module_data_t *info,
+                         code_range_t ranges[CODE_RANGES_PER_MODULE])
+{
+    uint num = 0;
+#ifdef WINDOWS
+    IMAGE_DOS_HEADER *dos = (IMAGE_DOS_HEADER *) info->start;
+    DR_TRY_EXCEPT(dr_get_current_drcontext(), {
+        IMAGE_NT_HEADERS *nt = (IMAGE_NT_HEADERS *) (info->start + dos->e_lfanew);
+        IMAGE_SECTION_HEADER *sec = IMAGE_FIRST_SECTION(nt);
+        uint i;
+        for (i = 0; i < nt->FileHeader.NumberOfSections; i++, sec++) {
+            if (!TEST(IMAGE_SCN_MEM_EXECUTE, sec->Characteristics))
+                continue;
+            if (num == CODE_RANGES_PER_MODULE) {
+                num = 0;
+                break;
+            }
+            ranges[num].start = info->start + sec->VirtualAddress;
+            ranges[num].end = (app_pc)
+                ALIGN_FORWARD(ranges[num].start + sec->Misc.VirtualSize, PAGE_SIZE);
+            /* Sections are sorted and so we only need to merge adjacent ones */
+            if (num > 0 && ranges[num].start <= ranges[num - 1].end)
+                ranges[num - 1].end = ranges[num].end;
+            else
+                num++;
+        }
+    }, { /* EXCEPT */
+        num = 0;
+    });
+#else
+    uint i;
+    for (i = 0; i < info->num_segments; i++) {
+        if (!TEST(DR_MEMPROT_EXEC, info->segments[i].prot))
+            continue;
+        if (num == CODE_RANGES_PER_MODULE) {
+            num = 0;
+            break;
+        }
+        ranges[num].start = info->segments[i].start;
+        ranges[num].end = info->segments[i].end;
+        if (num > 0 && ranges[num].start <= ranges[num - 1].end)
+            ranges[num - 1].end = ranges[num].end;
+        else
+            num++;
+    }
+#endif
+    if (num == 0) {
+        ranges[0].start = info->start;
+        ranges[0].end = info->end;
+        num = 1;
+    }
+    return num;
+}
+
+/* Caller must hold modtree_lock.  Publishes a new code_index with the module's
+ * executable ranges added or removed.
+ */
+static void
+code_index_update(const module_data_t *info, bool add)
+{
+    code_range_t mod_ranges[CODE_RANGES_PER_MODULE];
+    uint mod_num = code_index_module_ranges(info, mod_ranges);
+    code_index_t *old = code_index;
+    code_index_t *idx;
+    uint old_num = (old == NULL) ? 0 : old->num_ranges;
+    uint max_num = old_num + (add ? mod_num : 0);
+    size_t alloc_size = sizeof(*idx) + max_num * sizeof(idx->ranges[0]);
+    uint i = 0, j = 0;
+    idx = (code_index_t *) global_alloc(alloc_size, HEAPSTAT_CALLSTACK);
+    idx->alloc_size = alloc_size;
+    idx->retired_next = NULL;
+    idx->num_ranges = 0;
+    /* Merge the two sorted lists, or copy skipping the module's ranges */
+    while (i < old_num || (add && j < mod_num)) {
+        if (j < mod_num &&
+            (i == old_num || mod_ranges[j].start <= old->ranges[i].start)) {
+            if (add)
+                idx->ranges[idx->num_ranges++] = mod_ranges[j];
+            else if (i < old_num && mod_ranges[j].start == old->ranges[i].start)
+                i++; /* removed */
+            j++;
+        } else
+            idx->ranges[idx->num_ranges++] = old->ranges[i++];
+    }
+    LOG(2, "code index %s %d range(s) => %d ranges\n", add ? "add" : "remove",
+        mod_num, idx->num_ranges);
+    code_index = idx;
+    if (old != NULL) {
+        old->retired_next = code_index_retired;
+        code_index_retired = old;
+    }
+}
+
 static void
 callstack_module_get_text_bounds(const module_data_t *info, bool loaded,
                                  app_pc *start OUT, app_pc *end OUT)
@@ -2776,10 +3694,15 @@ callstack_module_load(void *drcontext, const module_data_t *info, bool loaded)
         callstack_module_add_region(seg_base, info->segments[i - 1].end, name_info);
     }
 #endif
+    code_index_update(info, true/*add*/);
     /* update cached values */
     modtree_last_hit = NULL;
     modtree_last_miss = NULL;
+    ATOMIC_INC32(modtree_gen);
     dr_mutex_unlock(modtree_lock);
+
+    if (TEST(FP_USE_UNWIND_INFO, ops.fp_flags))
+        unwind_module_load(info);
 }
 
 void
@@ -2793,6 +3716,8 @@ callstack_module_unload(void *drcontext, const module_data_t *info)
     LOG(1, "module unload event: \"%s\" "PFX"-"PFX"\n",
         (dr_module_preferred_name(info) == NULL) ? "" :
         dr_module_preferred_name(info), info->start, info->end);
+    if (TEST(FP_USE_UNWIND_INFO, ops.fp_flags))
+        unwind_module_unload(info);
     dr_mutex_lock(modtree_lock);
 
 #ifdef WINDOWS
@@ -2818,6 +3743,7 @@ callstack_module_unload(void *drcontext, const module_data_t *info)
         callstack_module_remove_region(seg_base, info->segments[i - 1].end);
     }
 #endif
+    code_index_update(info, false/*remove*/);
 
     /* update cached bounds */
     node = rb_max_node(module_tree);
@@ -2835,15 +3761,52 @@ callstack_module_unload(void *drcontext, const module_data_t *info)
     modtree_last_start = NULL;
     modtree_last_hit = NULL;
     modtree_last_miss = NULL;
+    ATOMIC_INC32(module_unload_count);
+    ATOMIC_INC32(modtree_gen);
 
     dr_mutex_unlock(modtree_lock);
 }
 
+uint
+callstack_module_unload_count(void)
+{
+    return module_unload_count;
+}
+
 static bool
 module_lookup(byte *pc, app_pc *start OUT, size_t *size OUT, modname_info_t **name)
 {
     rb_node_t *node;
     bool res = false;
+    void *drcontext = dr_get_current_drcontext();
+    tls_callstack_t *pt = (tls_callstack_t *)
+        ((drcontext == NULL) ? NULL : drmgr_get_tls_field(drcontext, tls_idx_callstack));
+    module_cache_entry_t found;
+    uint i, gen = 0;
+    if (pt != NULL) {
+        /* We read modtree_gen w/o a lock: a racing unload is no different from
+         * a lookup that completed just before it.
+         */
+        gen = modtree_gen;
+        if (pt->modcache_gen == gen) {
+            for (i = 0; i < MODULE_CACHE_ENTRIES; i++) {
+                module_cache_entry_t *e = &pt->modcache[i];
+                if (e->start != NULL && pc >= e->start && pc < e->start + e->size) {
+                    found = *e;
+                    if (i > 0) {
+                        memmove(&pt->modcache[1], &pt->modcache[0],
+                                i * sizeof(pt->modcache[0]));
+                        pt->modcache[0] = found;
+                    }
+                    STATS_INC(module_cache_hits);
+                    goto module_lookup_found;
+                }
+            }
+        } else {
+            memset(pt->modcache, 0, sizeof(pt->modcache));
+            pt->modcache_gen = gen;
+        }
+    }
     dr_mutex_lock(modtree_lock);
     /* We cache to avoid the rb_in_node cost */
     if (modtree_last_start != NULL &&
@@ -2862,15 +3825,26 @@ module_lookup(byte *pc, app_pc *start OUT, size_t *size OUT, modname_info_t **na
         }
     }
     if (res) {
-        if (start != NULL)
-            *start = modtree_last_start;
-        if (size != NULL)
-            *size = modtree_last_size;
-        if (name != NULL)
-            *name = modtree_last_name_info;
+        found.start = modtree_last_start;
+        found.size = modtree_last_size;
+        found.name_info = modtree_last_name_info;
     }
     dr_mutex_unlock(modtree_lock);
-    return res;
+    if (!res)
+        return false;
+    if (pt != NULL && pt->modcache_gen == gen) {
+        memmove(&pt->modcache[1], &pt->modcache[0],
+                (MODULE_CACHE_ENTRIES - 1) * sizeof(pt->modcache[0]));
+        pt->modcache[0] = found;
+    }
+ module_lookup_found:
+    if (start != NULL)
+        *start = found.start;
+    if (size != NULL)
+        *size = found.size;
+    if (name != NULL)
+        *name = found.name_info;
+    return true;
 }
 
 /* this is exported for PR 570839 for is_image() */
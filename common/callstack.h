@@ -165,6 +165,11 @@ enum {
      * that we've already executed.
      */
     FP_SEARCH_ALLOW_UNSEEN_RETADDR    = 0x00010000,
+    /* Walk frames using the unwind tables in each module (.eh_frame on Linux)
+     * where available, falling back to frame pointers and scanning from the
+     * first frame they do not cover.
+     */
+    FP_USE_UNWIND_INFO                = 0x00020000,
     FP_SEARCH_AGGRESSIVE              = (FP_SHOW_NON_MODULE_FRAMES |
                                          FP_SEARCH_MATCH_SINGLE_FRAME),
 };
@@ -266,6 +271,11 @@ typedef struct _callstack_options_t {
     void (*module_unload)(const char * /*module path*/,
                           void * /*user data returned by module_load()*/);
 
+    /* Number of entries in each thread's frame pointer scan cache.  0 selects
+     * the default.  It is rounded down to a power of two.
+     */
+    uint fp_cache_entries;
+
     /* Add new options here */
 } callstack_options_t;
 
@@ -306,6 +316,21 @@ packed_callstack_record(packed_callstack_t **pcs_out/*out*/, dr_mcontext_t *mc,
 void
 packed_callstack_first_frame_retaddr(packed_callstack_t *pcs);
 
+/* Walks the callstack like packed_callstack_record() but keeps only the frame
+ * addresses, in the caller's array, so that nothing is allocated or interned.
+ * Returns the number of frames written.  The module layout may change before
+ * the frames are used: compare callstack_module_unload_count().
+ */
+uint
+callstack_record_raw(dr_mcontext_t *mc, app_loc_t *loc, app_pc *frames OUT,
+                     uint max_frames);
+
+/* Builds a new, uninterned callstack from frames written by
+ * callstack_record_raw().  Free it with packed_callstack_free().
+ */
+packed_callstack_t *
+packed_callstack_from_raw(app_pc *frames, uint num_frames, bool first_is_retaddr);
+
 void
 packed_callstack_print(packed_callstack_t *pcs, uint num_frames,
                        char *buf, size_t bufsz, size_t *sofar, const char *prefix);
@@ -334,6 +359,13 @@ packed_callstack_hash(packed_callstack_t *pcs);
 bool
 packed_callstack_cmp(packed_callstack_t *pcs1, packed_callstack_t *pcs2);
 
+/* Returns whether the first num_frames frames of pcs1 and pcs2 are identical.
+ * If either has fewer frames than that, both must be identical in full.
+ */
+bool
+packed_callstack_cmp_prefix(packed_callstack_t *pcs1, packed_callstack_t *pcs2,
+                            uint num_frames);
+
 void
 packed_callstack_md5(packed_callstack_t *pcs, byte digest[MD5_RAW_BYTES]);
 
@@ -343,6 +375,22 @@ packed_callstack_crc32(packed_callstack_t *pcs, uint crc[2]);
 uint
 packed_callstack_num_frames(packed_callstack_t *pcs);
 
+/* The unsymbolized location of one frame, for symbolizing offline */
+typedef struct _raw_frame_t {
+    bool is_syscall;
+    drsys_sysnum_t sysnum;  /* for is_syscall */
+    app_pc pc;              /* for !is_syscall */
+    /* For frames in a module; modpath is NULL for frames not in a module */
+    const char *modpath;
+    uint modid;
+    size_t modoffs;
+    /* Whether pc is a retaddr, so that lookups should use modoffs-1 */
+    bool is_retaddr;
+} raw_frame_t;
+
+void
+packed_callstack_frame_raw(packed_callstack_t *pcs, uint frame, raw_frame_t *raw OUT);
+
 /* destroy the packted callstack */
 void
 packed_callstack_destroy(packed_callstack_t *pcs);
@@ -360,6 +408,12 @@ callstack_module_load(void *drcontext, const module_data_t *info, bool loaded);
 void
 callstack_module_unload(void *drcontext, const module_data_t *info);
 
+/* Returns a count that changes on every module unload, so that users caching
+ * callstacks across calls can tell when to flush them.
+ */
+uint
+callstack_module_unload_count(void);
+
 bool
 is_in_module(byte *pc);
 
@@ -411,6 +465,21 @@ void
 packed_callstack_to_symbolized(packed_callstack_t *pcs IN,
                                symbolized_callstack_t *scs OUT);
 
+/* Like packed_callstack_to_symbolized() but without any symbol lookup, for
+ * comparing to suppressions that only name module offsets.  Module frames'
+ * function names are "?" and, as that needs function names, callstacks are not
+ * truncated at -callstack_truncate_below frames.
+ */
+void
+packed_callstack_to_unsymbolized(packed_callstack_t *pcs IN,
+                                 symbolized_callstack_t *scs OUT);
+
+/* Looks up the symbols for all of the given callstacks' frames together,
+ * one module at a time, so that symbolizing each of them later is cheap.
+ */
+void
+packed_callstack_symbolize_batch(packed_callstack_t **pcs_array, uint num_pcs);
+
 void
 symbolized_callstack_print(const symbolized_callstack_t *scs IN,
                            char *buf, size_t bufsz, size_t *sofar,
@@ -0,0 +1,459 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Open-addressing hash map: see hashmap.h.
+ *
+ * Each entry sits at or after its home slot, and Robin Hood insertion keeps
+ * the entries of a probe sequence ordered by their distance from home.  A
+ * lookup can thus stop at the first entry closer to its home than the probe
+ * is, and a removal shifts the following entries back rather than leaving a
+ * tombstone.  The distance is recomputed from the stored key, which for
+ * multiplicative hashing is cheaper than loading a stored hash.
+ */
+
+#include "dr_api.h"
+#include "utils.h"
+#include "hashmap.h"
+#ifdef WINDOWS
+# include <intrin.h>
+#endif
+
+#define HASHMAP_MIN_BITS 4
+/* Grow once the map is this many percent full */
+#define HASHMAP_LOAD_PERCENT 75
+
+#define HASHMAP_SIZE(bits) (1U << (bits))
+
+typedef struct _hashmap_array_t {
+    uint bits;
+    struct _hashmap_array_t *next_retired;
+    hashmap_entry_t *slots; /* follows the header in the same allocation */
+} hashmap_array_t;
+
+/* Orders the stores of a writer and the loads of a lock-free reader against
+ * the sequence count.  x86 does not reorder stores with stores or loads with
+ * loads, so only the compiler needs to be held back there.
+ */
+#ifdef WINDOWS
+# define HASHMAP_BARRIER() _ReadWriteBarrier()
+#elif defined(X86)
+# define HASHMAP_BARRIER() __asm__ __volatile__("" : : : "memory")
+#else
+# define HASHMAP_BARRIER() __asm__ __volatile__("dmb ish" : : : "memory")
+#endif
+
+static inline uint
+hashmap_hash(void *key, uint bits)
+{
+    /* Fibonacci hashing spreads the aligned, clustered addresses we use as keys */
+#ifdef X64
+    return (uint)(((ptr_uint_t)key * 0x9e3779b97f4a7c15ULL) >> (64 - bits));
+#else
+    return (uint)(((ptr_uint_t)key * 0x9e3779b9U) >> (32 - bits));
+#endif
+}
+
+static hashmap_array_t *
+hashmap_array_create(uint bits)
+{
+    size_t size = sizeof(hashmap_array_t) + HASHMAP_SIZE(bits) * sizeof(hashmap_entry_t);
+    hashmap_array_t *array = (hashmap_array_t *) global_alloc(size, HEAPSTAT_HASHTABLE);
+    memset(array, 0, size);
+    array->bits = bits;
+    array->slots = (hashmap_entry_t *) (array + 1);
+    return array;
+}
+
+static void
+hashmap_array_free(hashmap_array_t *array)
+{
+    global_free(array, sizeof(hashmap_array_t) +
+                HASHMAP_SIZE(array->bits) * sizeof(hashmap_entry_t), HEAPSTAT_HASHTABLE);
+}
+
+/* Returns the slot holding key, or -1.  This is also the lock-free reader's
+ * probe, so it must terminate even on an array that is being modified.
+ */
+static int
+hashmap_find_slot(hashmap_array_t *array, void *key)
+{
+    uint mask = HASHMAP_SIZE(array->bits) - 1;
+    uint home = hashmap_hash(key, array->bits);
+    uint dist;
+    for (dist = 0; dist <= mask; dist++) {
+        uint idx = (home + dist) & mask;
+        void *cur = array->slots[idx].key;
+        if (cur == key)
+            return (int) idx;
+        if (cur == NULL || ((idx - hashmap_hash(cur, array->bits)) & mask) < dist)
+            return -1;
+    }
+    return -1;
+}
+
+/* Caller must hold the lock and ensure key is absent and there is room */
+static void
+hashmap_insert(hashmap_t *map, hashmap_array_t *array, void *key, void *payload)
+{
+    uint mask = HASHMAP_SIZE(array->bits) - 1;
+    uint idx = hashmap_hash(key, array->bits);
+    uint dist = 0;
+    while (true) {
+        hashmap_entry_t *slot = &array->slots[idx];
+        uint slot_dist;
+        if (slot->key == NULL) {
+            slot->payload = payload;
+            slot->key = key;
+#ifdef STATISTICS
+            if (dist > map->max_probe)
+                map->max_probe = dist;
+#endif
+            return;
+        }
+        slot_dist = (idx - hashmap_hash(slot->key, array->bits)) & mask;
+        if (slot_dist < dist) {
+            /* Take from the rich: the resident is closer to home than we are */
+            void *tmp_key = slot->key, *tmp_payload = slot->payload;
+            slot->key = key;
+            slot->payload = payload;
+            key = tmp_key;
+            payload = tmp_payload;
+#ifdef STATISTICS
+            if (dist > map->max_probe)
+                map->max_probe = dist;
+#endif
+            dist = slot_dist;
+        }
+        idx = (idx + 1) & mask;
+        dist++;
+    }
+}
+
+static inline void
+hashmap_write_start(hashmap_t *map)
+{
+    if (map->lockfree_reads) {
+        map->seq++;
+        HASHMAP_BARRIER();
+    }
+}
+
+static inline void
+hashmap_write_end(hashmap_t *map)
+{
+    if (map->lockfree_reads) {
+        HASHMAP_BARRIER();
+        map->seq++;
+    }
+}
+
+/* Caller must hold the lock and be inside a write */
+static void
+hashmap_grow(hashmap_t *map)
+{
+    hashmap_array_t *old = map->array;
+    hashmap_array_t *array = hashmap_array_create(old->bits + 1);
+    uint i;
+    for (i = 0; i < HASHMAP_SIZE(old->bits); i++) {
+        if (old->slots[i].key != NULL)
+            hashmap_insert(map, array, old->slots[i].key, old->slots[i].payload);
+    }
+    HASHMAP_BARRIER();
+    map->array = array;
+    if (map->lockfree_reads) {
+        old->next_retired = map->retired;
+        map->retired = old;
+    } else
+        hashmap_array_free(old);
+#ifdef STATISTICS
+    map->resizes++;
+#endif
+    LOG(3, "hashmap "PFX" grew to %u bits\n", map, array->bits);
+}
+
+void
+hashmap_init(hashmap_t *map, uint num_bits, bool lockfree_reads,
+             void (*free_payload)(void *))
+{
+    memset(map, 0, sizeof(*map));
+    if (num_bits < HASHMAP_MIN_BITS)
+        num_bits = HASHMAP_MIN_BITS;
+    map->array = hashmap_array_create(num_bits);
+    map->lockfree_reads = lockfree_reads;
+    map->free_payload = free_payload;
+    map->lock = dr_recurlock_create();
+}
+
+void
+hashmap_delete(hashmap_t *map)
+{
+    hashmap_array_t *array = map->array, *next;
+    uint i;
+    if (map->free_payload != NULL) {
+        for (i = 0; i < HASHMAP_SIZE(array->bits); i++) {
+            if (array->slots[i].key != NULL)
+                map->free_payload(array->slots[i].payload);
+        }
+    }
+    hashmap_array_free(array);
+    for (array = map->retired; array != NULL; array = next) {
+        next = array->next_retired;
+        hashmap_array_free(array);
+    }
+    dr_recurlock_destroy(map->lock);
+    memset(map, 0, sizeof(*map));
+}
+
+void
+hashmap_delete_with_stats(hashmap_t *map, const char *name)
+{
+    LOG(1, "final %s map size: %u bits, %u entries\n", name, map->array->bits,
+        map->entries);
+#ifdef STATISTICS
+    LOG(1, "  %s map: %u resizes, max probe distance %u\n", name, map->resizes,
+        map->max_probe);
+#endif
+    hashmap_delete(map);
+}
+
+void
+hashmap_lock(hashmap_t *map)
+{
+    dr_recurlock_lock(map->lock);
+}
+
+void
+hashmap_unlock(hashmap_t *map)
+{
+    dr_recurlock_unlock(map->lock);
+}
+
+void *
+hashmap_lookup(hashmap_t *map, void *key)
+{
+    hashmap_array_t *array;
+    void *payload;
+    int idx;
+    ASSERT(key != NULL, "NULL key is reserved");
+    if (map->lockfree_reads) {
+        while (true) {
+            uint seq = map->seq;
+            if (TEST(1, seq)) {
+                /* A writer is mid-update: it holds the lock only briefly */
+                dr_thread_yield();
+                continue;
+            }
+            HASHMAP_BARRIER();
+            array = map->array;
+            idx = hashmap_find_slot(array, key);
+            payload = (idx < 0) ? NULL : array->slots[idx].payload;
+            HASHMAP_BARRIER();
+            if (map->seq == seq)
+                return payload;
+        }
+    }
+    dr_recurlock_lock(map->lock);
+    array = map->array;
+    idx = hashmap_find_slot(array, key);
+    payload = (idx < 0) ? NULL : array->slots[idx].payload;
+    dr_recurlock_unlock(map->lock);
+    return payload;
+}
+
+/* Caller must hold the lock.  Returns the old payload if key was present. */
+static bool
+hashmap_add_common(hashmap_t *map, void *key, void *payload, bool replace,
+                   void **old_payload OUT)
+{
+    hashmap_array_t *array = map->array;
+    int idx;
+    ASSERT(key != NULL, "NULL key is reserved");
+    idx = hashmap_find_slot(array, key);
+    if (idx >= 0) {
+        *old_payload = array->slots[idx].payload;
+        if (replace) {
+            /* A single aligned store: no need to bump the sequence count */
+            array->slots[idx].payload = payload;
+        }
+        return false;
+    }
+    *old_payload = NULL;
+    hashmap_write_start(map);
+    if ((map->entries + 1) * 100 > HASHMAP_SIZE(array->bits) * HASHMAP_LOAD_PERCENT)
+        hashmap_grow(map);
+    hashmap_insert(map, map->array, key, payload);
+    map->entries++;
+    hashmap_write_end(map);
+    return true;
+}
+
+bool
+hashmap_add(hashmap_t *map, void *key, void *payload)
+{
+    void *old;
+    bool added;
+    dr_recurlock_lock(map->lock);
+    added = hashmap_add_common(map, key, payload, false, &old);
+    dr_recurlock_unlock(map->lock);
+    return added;
+}
+
+void *
+hashmap_add_replace(hashmap_t *map, void *key, void *payload)
+{
+    void *old;
+    dr_recurlock_lock(map->lock);
+    hashmap_add_common(map, key, payload, true, &old);
+    dr_recurlock_unlock(map->lock);
+    return old;
+}
+
+bool
+hashmap_remove(hashmap_t *map, void *key)
+{
+    hashmap_array_t *array;
+    uint mask, idx, next;
+    void *payload;
+    int found;
+    dr_recurlock_lock(map->lock);
+    array = map->array;
+    found = hashmap_find_slot(array, key);
+    if (found < 0) {
+        dr_recurlock_unlock(map->lock);
+        return false;
+    }
+    mask = HASHMAP_SIZE(array->bits) - 1;
+    idx = (uint) found;
+    payload = array->slots[idx].payload;
+    hashmap_write_start(map);
+    /* Shift back each following entry that is not at its home slot */
+    while (true) {
+        hashmap_entry_t *cur = &array->slots[idx];
+        hashmap_entry_t *nxt;
+        next = (idx + 1) & mask;
+        nxt = &array->slots[next];
+        if (nxt->key == NULL || hashmap_hash(nxt->key, array->bits) == next) {
+            cur->key = NULL;
+            cur->payload = NULL;
+            break;
+        }
+        *cur = *nxt;
+        idx = next;
+    }
+    map->entries--;
+    hashmap_write_end(map);
+    dr_recurlock_unlock(map->lock);
+    if (map->free_payload != NULL)
+        map->free_payload(payload);
+    return true;
+}
+
+/***************************************************************************
+ * Unit tests
+ */
+
+#ifdef BUILD_UNIT_TESTS
+
+/* Keys that look like code addresses: clustered and partly aligned */
+static void *
+test_key(uint i)
+{
+    return (void *)(ptr_uint_t)(0x400000 + i * 7 + (i % 3) * 0x10000);
+}
+
+void
+hashmap_unit_tests(void)
+{
+    hashmap_t map;
+    uint i, pass;
+    for (pass = 0; pass < 2; pass++) {
+        hashmap_init(&map, 4, pass == 1/*lockfree_reads*/, NULL);
+        for (i = 0; i < 5000; i++)
+            EXPECT(hashmap_add(&map, test_key(i), (void *)(ptr_uint_t)(i + 1)));
+        EXPECT(!hashmap_add(&map, test_key(17), (void *)1));
+        EXPECT(map.entries == 5000);
+        for (i = 0; i < 5000; i++)
+            EXPECT(hashmap_lookup(&map, test_key(i)) == (void *)(ptr_uint_t)(i + 1));
+        EXPECT(hashmap_lookup(&map, test_key(5000)) == NULL);
+        /* Removing every other key exercises the backward shift */
+        for (i = 0; i < 5000; i += 2)
+            EXPECT(hashmap_remove(&map, test_key(i)));
+        EXPECT(!hashmap_remove(&map, test_key(0)));
+        for (i = 0; i < 5000; i++) {
+            EXPECT(hashmap_lookup(&map, test_key(i)) ==
+                   (TEST(1, i) ? (void *)(ptr_uint_t)(i + 1) : NULL));
+        }
+        EXPECT(hashmap_add_replace(&map, test_key(1), (void *)7) == (void *)2);
+        EXPECT(hashmap_lookup(&map, test_key(1)) == (void *)7);
+        EXPECT(hashmap_add_replace(&map, test_key(0), (void *)9) == NULL);
+        EXPECT(hashmap_lookup(&map, test_key(0)) == (void *)9);
+        hashmap_delete(&map);
+    }
+}
+
+void
+hashmap_microbenchmark(uint num_keys, uint iters)
+{
+    hashmap_t map;
+    hashtable_t table;
+    uint64 start, map_add, map_find, table_add, table_find;
+    uint i, j, found = 0;
+
+    start = dr_get_microseconds();
+    hashtable_init(&table, 10, HASH_INTPTR, false/*!strdup*/);
+    for (i = 0; i < num_keys; i++)
+        hashtable_add(&table, test_key(i), (void *)(ptr_uint_t)(i + 1));
+    table_add = dr_get_microseconds() - start;
+    start = dr_get_microseconds();
+    for (j = 0; j < iters; j++) {
+        for (i = 0; i < num_keys; i++) {
+            /* Half hits and half misses, as in is_retaddr() */
+            if (hashtable_lookup(&table, test_key(i * 2)) != NULL)
+                found++;
+        }
+    }
+    table_find = dr_get_microseconds() - start;
+    hashtable_delete(&table);
+
+    start = dr_get_microseconds();
+    hashmap_init(&map, 10, true/*lockfree_reads*/, NULL);
+    for (i = 0; i < num_keys; i++)
+        hashmap_add(&map, test_key(i), (void *)(ptr_uint_t)(i + 1));
+    map_add = dr_get_microseconds() - start;
+    start = dr_get_microseconds();
+    for (j = 0; j < iters; j++) {
+        for (i = 0; i < num_keys; i++) {
+            if (hashmap_lookup(&map, test_key(i * 2)) != NULL)
+                found--;
+        }
+    }
+    map_find = dr_get_microseconds() - start;
+    hashmap_delete(&map);
+
+    EXPECT(found == 0);
+    dr_printf("%u keys, %u lookups each:\n", num_keys, iters);
+    dr_printf("  %-12s %12s %12s\n", "", "add us", "lookup us");
+    dr_printf("  %-12s %12"UINT64_FORMAT_CODE" %12"UINT64_FORMAT_CODE"\n",
+              "hashtable_t", table_add, table_find);
+    dr_printf("  %-12s %12"UINT64_FORMAT_CODE" %12"UINT64_FORMAT_CODE"\n",
+              "hashmap_t", map_add, map_find);
+}
+#endif /* BUILD_UNIT_TESTS */
@@ -0,0 +1,114 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _HASHMAP_H_
+#define _HASHMAP_H_ 1
+
+/* Open-addressing hash map from pointer-sized keys to pointer-sized payloads.
+ *
+ * This is a drop-in for DR's hashtable_t with HASH_INTPTR keys on hot tables.
+ * Entries live inline in one array and are placed by Robin Hood linear
+ * probing, so a lookup touches one or two cache lines instead of chasing a
+ * chain.  A NULL key is reserved to mark empty slots.
+ *
+ * Writers are serialized by the map's lock.  If the map is created with
+ * lockfree_reads, hashmap_lookup() takes no lock: it reads under a sequence
+ * count that writers bump, and retries if a write raced with it.  Arrays
+ * replaced by a resize are then kept until hashmap_delete() so that a racing
+ * reader never touches freed memory.  The map cannot protect payloads, so a
+ * lock-free map whose payloads are freed on removal needs the caller to
+ * delay those frees itself.
+ */
+
+#include "dr_api.h"
+
+typedef struct _hashmap_entry_t {
+    void *key;
+    void *payload;
+} hashmap_entry_t;
+
+/* The fields are exposed so a map can be a static like a hashtable_t */
+typedef struct _hashmap_t {
+    struct _hashmap_array_t *volatile array;
+    uint entries;
+    bool lockfree_reads;
+    /* Odd while a writer is modifying the array */
+    volatile uint seq;
+    void *lock;
+    void (*free_payload)(void *);
+    /* Replaced arrays kept for lock-free readers */
+    struct _hashmap_array_t *retired;
+#ifdef STATISTICS
+    uint resizes;
+    uint max_probe;
+#endif
+} hashmap_t;
+
+/* Initializes a map with 2^num_bits slots, which grows when it is 3/4 full.
+ * free_payload, if non-NULL, is called on the payload of each entry removed
+ * by hashmap_remove() or hashmap_delete().
+ */
+void
+hashmap_init(hashmap_t *map, uint num_bits, bool lockfree_reads,
+             void (*free_payload)(void *));
+
+void
+hashmap_delete(hashmap_t *map);
+
+/* LOGs the final size and probe statistics, then deletes */
+void
+hashmap_delete_with_stats(hashmap_t *map, const char *name);
+
+/* Returns the payload for key, or NULL if it is not present */
+void *
+hashmap_lookup(hashmap_t *map, void *key);
+
+/* Adds key if it is not already present.  Returns whether it was added. */
+bool
+hashmap_add(hashmap_t *map, void *key, void *payload);
+
+/* Adds key or replaces its payload.  Returns the old payload, or NULL.  The
+ * old payload is not passed to free_payload.
+ */
+void *
+hashmap_add_replace(hashmap_t *map, void *key, void *payload);
+
+/* Removes key and frees its payload.  Returns whether it was present. */
+bool
+hashmap_remove(hashmap_t *map, void *key);
+
+/* The lock is recursive, so a caller can hold it across a lookup and an add */
+void
+hashmap_lock(hashmap_t *map);
+
+void
+hashmap_unlock(hashmap_t *map);
+
+#ifdef BUILD_UNIT_TESTS
+void
+hashmap_unit_tests(void);
+
+/* Times lookups and adds against a hashtable_t of the same size */
+void
+hashmap_microbenchmark(uint num_keys, uint iters);
+#endif
+
+#endif /* _HASHMAP_H_ */
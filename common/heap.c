@@ -931,6 +931,16 @@ is_entirely_in_heap_region(app_pc start, app_pc end)
     return res;
 }
 
+bool
+is_any_in_heap_region(app_pc start, app_pc end)
+{
+    bool res;
+    dr_rwlock_read_lock(heap_lock);
+    res = (rb_overlaps_node(heap_tree, start, end) != NULL);
+    dr_rwlock_read_unlock(heap_lock);
+    return res;
+}
+
 uint
 get_heap_region_flags(app_pc pc)
 {
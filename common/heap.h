@@ -171,6 +171,9 @@ is_in_heap_region(app_pc pc);
 bool
 is_entirely_in_heap_region(app_pc start, app_pc end);
 
+bool
+is_any_in_heap_region(app_pc start, app_pc end);
+
 uint
 get_heap_region_flags(app_pc pc);
 
@@ -0,0 +1,202 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Tool self-profiling (-profile_tool).
+ *
+ * Each thread adds into its own counters with no locking.  The counters of
+ * exited threads are folded into prof_retired; threads without a per-thread
+ * record (client threads such as the parallel leak scanners) add into
+ * prof_retired under prof_lock.  A dump reads live threads' counters without
+ * stopping them, which is fine for a profile.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "utils.h"
+#include "prof.h"
+
+bool prof_enabled;
+
+static const char *const prof_phase_name[PROF_PHASE_COUNT] = {
+    "slowpath",
+    "callstack walk",
+    "heap routines",
+    "leak scan",
+    "error report",
+    "symbol lookup",
+};
+
+typedef struct _prof_counts_t {
+    uint64 cycles[PROF_PHASE_COUNT];
+    uint64 count[PROF_PHASE_COUNT];
+} prof_counts_t;
+
+typedef struct _prof_thread_t {
+    prof_counts_t counts;
+    struct _prof_thread_t *next;
+    struct _prof_thread_t *prev;
+} prof_thread_t;
+
+static int tls_idx_prof = -1;
+/* protects prof_threads and prof_retired */
+static void *prof_lock;
+static prof_thread_t *prof_threads;
+static prof_counts_t prof_retired;
+/* to convert counter ticks to time at dump */
+static uint64 prof_base_cycles;
+static uint64 prof_base_usec;
+
+void
+prof_init(void)
+{
+    tls_idx_prof = drmgr_register_tls_field();
+    ASSERT(tls_idx_prof > -1, "unable to reserve TLS slot");
+    prof_lock = dr_mutex_create();
+    prof_base_cycles = prof_cycles();
+    prof_base_usec = dr_get_microseconds();
+    prof_enabled = true;
+}
+
+void
+prof_exit(void)
+{
+    prof_thread_t *pt, *next;
+    if (!prof_enabled)
+        return;
+    prof_enabled = false;
+    /* threads still alive at exit get no exit event */
+    for (pt = prof_threads; pt != NULL; pt = next) {
+        next = pt->next;
+        global_free(pt, sizeof(*pt), HEAPSTAT_MISC);
+    }
+    prof_threads = NULL;
+    dr_mutex_destroy(prof_lock);
+    drmgr_unregister_tls_field(tls_idx_prof);
+}
+
+void
+prof_thread_init(void *drcontext)
+{
+    prof_thread_t *pt;
+    if (!prof_enabled)
+        return;
+    pt = (prof_thread_t *) global_alloc(sizeof(*pt), HEAPSTAT_MISC);
+    memset(pt, 0, sizeof(*pt));
+    dr_mutex_lock(prof_lock);
+    pt->next = prof_threads;
+    if (prof_threads != NULL)
+        prof_threads->prev = pt;
+    prof_threads = pt;
+    dr_mutex_unlock(prof_lock);
+    drmgr_set_tls_field(drcontext, tls_idx_prof, (void *)pt);
+}
+
+void
+prof_thread_exit(void *drcontext)
+{
+    prof_thread_t *pt;
+    uint i;
+    if (!prof_enabled)
+        return;
+    pt = (prof_thread_t *) drmgr_get_tls_field(drcontext, tls_idx_prof);
+    if (pt == NULL)
+        return;
+    drmgr_set_tls_field(drcontext, tls_idx_prof, NULL);
+    dr_mutex_lock(prof_lock);
+    for (i = 0; i < PROF_PHASE_COUNT; i++) {
+        prof_retired.cycles[i] += pt->counts.cycles[i];
+        prof_retired.count[i] += pt->counts.count[i];
+    }
+    if (pt->prev != NULL)
+        pt->prev->next = pt->next;
+    else
+        prof_threads = pt->next;
+    if (pt->next != NULL)
+        pt->next->prev = pt->prev;
+    dr_mutex_unlock(prof_lock);
+    global_free(pt, sizeof(*pt), HEAPSTAT_MISC);
+}
+
+void
+prof_add(void *drcontext, prof_phase_t phase, uint64 start)
+{
+    uint64 elapsed = prof_cycles() - start;
+    prof_thread_t *pt = NULL;
+    ASSERT(phase < PROF_PHASE_COUNT, "invalid profile phase");
+    /* a bracket that began before prof_init() has no meaningful start */
+    if (start == 0)
+        return;
+    if (drcontext == NULL)
+        drcontext = dr_get_current_drcontext();
+    if (drcontext != NULL)
+        pt = (prof_thread_t *) drmgr_get_tls_field(drcontext, tls_idx_prof);
+    if (pt != NULL) {
+        pt->counts.cycles[phase] += elapsed;
+        pt->counts.count[phase]++;
+    } else {
+        dr_mutex_lock(prof_lock);
+        prof_retired.cycles[phase] += elapsed;
+        prof_retired.count[phase]++;
+        dr_mutex_unlock(prof_lock);
+    }
+}
+
+void
+prof_dump(file_t f)
+{
+    prof_counts_t sum;
+    prof_thread_t *pt;
+    uint64 total_cycles, total_usec, cycles_per_usec;
+    uint i;
+    if (!prof_enabled)
+        return;
+    dr_mutex_lock(prof_lock);
+    sum = prof_retired;
+    for (pt = prof_threads; pt != NULL; pt = pt->next) {
+        for (i = 0; i < PROF_PHASE_COUNT; i++) {
+            sum.cycles[i] += pt->counts.cycles[i];
+            sum.count[i] += pt->counts.count[i];
+        }
+    }
+    dr_mutex_unlock(prof_lock);
+    total_cycles = prof_cycles() - prof_base_cycles;
+    total_usec = dr_get_microseconds() - prof_base_usec;
+    if (total_cycles == 0)
+        total_cycles = 1;
+    /* the elapsed wall time gives the counter rate for a time estimate */
+    cycles_per_usec = (total_usec == 0) ? 0 : total_cycles / total_usec;
+    if (cycles_per_usec == 0)
+        cycles_per_usec = 1;
+
+    dr_fprintf(f, "\nTool profile (inclusive; phases nest, and cycles of all threads are"
+               " summed):\n");
+    dr_fprintf(f, "  %-16s %12s %18s %10s %7s\n",
+               "phase", "count", "cycles", "~ms", "%wall");
+    for (i = 0; i < PROF_PHASE_COUNT; i++) {
+        dr_fprintf(f, "  %-16s %12"UINT64_FORMAT_CODE" %18"UINT64_FORMAT_CODE
+                   " %10"UINT64_FORMAT_CODE" %6u%%\n",
+                   prof_phase_name[i], sum.count[i], sum.cycles[i],
+                   sum.cycles[i] / cycles_per_usec / 1000,
+                   (uint)(sum.cycles[i] * 100 / total_cycles));
+    }
+    dr_fprintf(f, "  %-16s %12s %18"UINT64_FORMAT_CODE" %10"UINT64_FORMAT_CODE"\n",
+               "elapsed", "", total_cycles, total_usec / 1000);
+}
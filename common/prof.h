@@ -0,0 +1,105 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Tool self-profiling (-profile_tool).
+ *
+ * Brackets the tool's own expensive phases with a cycle counter read and
+ * accumulates the elapsed count per thread, so a run can report where the
+ * tool's time went.  Phases nest (e.g., symbol lookups inside error reports
+ * inside the slowpath) and each one's time is inclusive of what it calls.
+ * When prof_enabled is false the brackets cost a single test.
+ */
+
+#ifndef _PROF_H_
+#define _PROF_H_ 1
+
+#include "dr_api.h"
+#include "utils.h"
+#ifdef WINDOWS
+# include <intrin.h>
+#endif
+
+typedef enum {
+    PROF_SLOWPATH,
+    PROF_CALLSTACK,
+    PROF_HEAP,
+    PROF_LEAK_SCAN,
+    PROF_REPORT,
+    PROF_SYMBOLS,
+    PROF_PHASE_COUNT,
+} prof_phase_t;
+
+extern bool prof_enabled;
+
+/* Returns a cheap monotonic counter: the time-stamp counter on x86 and the
+ * virtual counter on AArch64.  Elsewhere we fall back to microseconds.
+ */
+static inline uint64
+prof_cycles(void)
+{
+#if defined(X86) && defined(WINDOWS)
+    return __rdtsc();
+#elif defined(X86)
+    uint lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64)hi << 32) | lo;
+#elif defined(AARCH64)
+    uint64 val;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (val));
+    return val;
+#else
+    return dr_get_microseconds();
+#endif
+}
+
+/* Use as:
+ *   uint64 prof_start;
+ *   PROF_START(prof_start);
+ *   ...
+ *   PROF_STOP(drcontext, PROF_HEAP, prof_start);
+ * drcontext may be NULL if the caller does not have it handy.
+ */
+#define PROF_START(var) ((var) = prof_enabled ? prof_cycles() : 0)
+#define PROF_STOP(drcontext, phase, var) do { \
+    if (prof_enabled)                         \
+        prof_add(drcontext, phase, var);      \
+} while (0)
+
+void
+prof_init(void);
+
+void
+prof_exit(void);
+
+void
+prof_thread_init(void *drcontext);
+
+void
+prof_thread_exit(void *drcontext);
+
+void
+prof_add(void *drcontext, prof_phase_t phase, uint64 start);
+
+/* Prints the per-phase totals summed over all threads */
+void
+prof_dump(file_t f);
+
+#endif /* _PROF_H_ */
@@ -48,6 +48,14 @@ struct _rb_node_t {
     void *client;
 };
 
+/* Keep a slab within a page */
+#define RB_NODES_PER_SLAB 56
+
+typedef struct _rb_node_slab_t {
+    struct _rb_node_slab_t *next;
+    rb_node_t nodes[RB_NODES_PER_SLAB];
+} rb_node_slab_t;
+
 /* Data structure to wrap around the root node, to store global info
  * such as callback routines.
  */
@@ -62,6 +70,13 @@ struct _rb_tree_t {
      */
     rb_node_t NIL_node;
     void (*free_payload_func)(void*);
+    /* Nodes are carved out of slabs rather than allocated one at a time, so
+     * that a tree's nodes are packed together.  Freed nodes are kept on a
+     * free list linked through their parent field until the tree is
+     * destroyed.
+     */
+    rb_node_slab_t *slabs;
+    rb_node_t *free_nodes;
 };
 
 #define NIL(tree) (&(tree)->NIL_node)
@@ -98,8 +113,22 @@ rb_node_set_client(rb_node_t *node, void *client)
 static rb_node_t *
 rb_new_node(rb_tree_t *tree, byte *base, size_t size, void *client)
 {
-    rb_node_t *node = (rb_node_t *) global_alloc(sizeof(rb_node_t), HEAPSTAT_RBTREE);
-    ASSERT(node != NULL, "alloc failed");
+    rb_node_t *node;
+    if (tree->free_nodes == NULL) {
+        rb_node_slab_t *slab = (rb_node_slab_t *)
+            global_alloc(sizeof(*slab), HEAPSTAT_RBTREE);
+        int i;
+        ASSERT(slab != NULL, "alloc failed");
+        slab->next = tree->slabs;
+        tree->slabs = slab;
+        /* Link in address order so that consecutive inserts use adjacent nodes */
+        for (i = RB_NODES_PER_SLAB - 1; i >= 0; i--) {
+            slab->nodes[i].parent = tree->free_nodes;
+            tree->free_nodes = &slab->nodes[i];
+        }
+    }
+    node = tree->free_nodes;
+    tree->free_nodes = node->parent;
 
     if (node != NULL) {
         node->parent = NIL(tree);
@@ -120,9 +149,10 @@ rb_new_node(rb_tree_t *tree, byte *base, size_t size, void *client)
 static inline void
 rb_free_node(rb_tree_t *tree, rb_node_t *node, bool free_payload)
 {
-    if (tree != NULL && free_payload && tree->free_payload_func != NULL)
+    if (free_payload && tree->free_payload_func != NULL)
         (tree->free_payload_func)(node->client);
-    global_free(node, sizeof(rb_node_t), HEAPSTAT_RBTREE);
+    node->parent = tree->free_nodes;
+    tree->free_nodes = node;
 }
 
 
@@ -648,14 +678,21 @@ rb_tree_create(void (*free_payload_func)(void*))
 
     tree->root = NIL(tree);
     tree->free_payload_func = free_payload_func;
+    tree->slabs = NULL;
+    tree->free_nodes = NULL;
     return tree;
 }
 
 void
 rb_tree_destroy(rb_tree_t *tree)
 {
+    rb_node_slab_t *slab, *next_slab;
     ASSERT(tree != NULL, "invalid params");
     rb_clear(tree);
+    for (slab = tree->slabs; slab != NULL; slab = next_slab) {
+        next_slab = slab->next;
+        global_free(slab, sizeof(*slab), HEAPSTAT_RBTREE);
+    }
     global_free(tree, sizeof(*tree), HEAPSTAT_RBTREE);
 }
 
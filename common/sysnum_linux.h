@@ -330,6 +330,7 @@
 # define __NR_dup3                               292
 # define __NR_pipe2                              293
 # define __NR_inotify_init1                      294
+# define __NR_getcpu                             309
 # define __NR_process_vm_readv                   310
 # define __NR_process_vm_writev                  311
 # define __NR_finit_module                       313
@@ -739,6 +740,7 @@
 #define SYS_get_mempolicy __NR_get_mempolicy
 #define SYS_get_robust_list __NR_get_robust_list
 #define SYS_get_thread_area __NR_get_thread_area
+#define SYS_getcpu __NR_getcpu
 #define SYS_getcwd __NR_getcwd
 #define SYS_getdents __NR_getdents
 #define SYS_getdents64 __NR_getdents64
@@ -991,7 +993,6 @@
 # define SYS_fstatfs64 __NR_fstatfs64
 # define SYS_ftime __NR_ftime
 # define SYS_ftruncate64 __NR_ftruncate64
-# define SYS_getcpu __NR_getcpu
 # define SYS_getegid32 __NR_getegid32
 # define SYS_geteuid32 __NR_geteuid32
 # define SYS_getgid32 __NR_getgid32
@@ -0,0 +1,820 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Stack unwinding from .eh_frame call frame information.
+ *
+ * We do not need to parse anything up front: the linker's .eh_frame_hdr
+ * section (PT_GNU_EH_FRAME) already holds a table of FDE start addresses
+ * sorted for binary search.  We locate that table at module load and, per
+ * frame, interpret the call frame instructions of just the one FDE covering
+ * the pc, which costs the same for every frame regardless of how the code
+ * uses the stack.
+ *
+ * We only track the rules for the CFA, the return address, and the frame
+ * pointer, which is all a callstack walk needs.  CFA expressions (used by
+ * PLT entries and signal trampolines) are not supported and fall back to the
+ * caller's heuristics.
+ *
+ * XXX: Windows x64 .pdata unwind info is NYI.
+ */
+
+#include "dr_api.h"
+#include "utils.h"
+#include "redblack.h"
+#include "unwind.h"
+#if defined(LINUX) && defined(X86)
+# include <elf.h>
+# define UNWIND_SUPPORTED 1
+#endif
+
+#ifdef UNWIND_SUPPORTED
+
+#ifdef X64
+# define ELF_EHDR Elf64_Ehdr
+# define ELF_PHDR Elf64_Phdr
+# define DWARF_REG_SP 7
+# define DWARF_REG_FP 6
+#else
+# define ELF_EHDR Elf32_Ehdr
+# define ELF_PHDR Elf32_Phdr
+# define DWARF_REG_SP 4
+# define DWARF_REG_FP 5
+#endif
+#define DWARF_REG_NONE ((uint)-1)
+
+/* Pointer encodings */
+#define DW_EH_PE_absptr   0x00
+#define DW_EH_PE_uleb128  0x01
+#define DW_EH_PE_udata2   0x02
+#define DW_EH_PE_udata4   0x03
+#define DW_EH_PE_udata8   0x04
+#define DW_EH_PE_sleb128  0x09
+#define DW_EH_PE_sdata2   0x0a
+#define DW_EH_PE_sdata4   0x0b
+#define DW_EH_PE_sdata8   0x0c
+#define DW_EH_PE_pcrel    0x10
+#define DW_EH_PE_datarel  0x30
+#define DW_EH_PE_indirect 0x80
+
+/* Call frame instructions */
+#define DW_CFA_advance_loc        0x40
+#define DW_CFA_offset             0x80
+#define DW_CFA_restore            0xc0
+#define DW_CFA_nop                0x00
+#define DW_CFA_set_loc            0x01
+#define DW_CFA_advance_loc1       0x02
+#define DW_CFA_advance_loc2       0x03
+#define DW_CFA_advance_loc4       0x04
+#define DW_CFA_offset_extended    0x05
+#define DW_CFA_restore_extended   0x06
+#define DW_CFA_undefined          0x07
+#define DW_CFA_same_value         0x08
+#define DW_CFA_register           0x09
+#define DW_CFA_remember_state     0x0a
+#define DW_CFA_restore_state      0x0b
+#define DW_CFA_def_cfa            0x0c
+#define DW_CFA_def_cfa_register   0x0d
+#define DW_CFA_def_cfa_offset     0x0e
+#define DW_CFA_def_cfa_expression 0x0f
+#define DW_CFA_expression         0x10
+#define DW_CFA_offset_extended_sf 0x11
+#define DW_CFA_def_cfa_sf         0x12
+#define DW_CFA_def_cfa_offset_sf  0x13
+#define DW_CFA_val_offset         0x14
+#define DW_CFA_val_offset_sf      0x15
+#define DW_CFA_val_expression     0x16
+#define DW_CFA_GNU_args_size      0x2e
+#define DW_CFA_GNU_negative_offset_extended 0x2f
+
+/* CIEs and FDEs are copied locally with safe_read() in case the module is
+ * unloaded underneath us.  Real-world records are far smaller than this.
+ */
+#define CFI_MAX_RECORD 512
+#define CFI_STATE_STACK 4
+#define CFI_MAX_AUGMENTATION 8
+
+/* Per-module-load data, in unwind_tree */
+typedef struct _unwind_module_t {
+    app_pc hdr;          /* .eh_frame_hdr: the table is relative to it */
+    app_pc table;        /* pairs of (initial loc, FDE address) */
+    uint fde_count;
+} unwind_module_t;
+
+/* Entry in the .eh_frame_hdr table with the DW_EH_PE_datarel|sdata4 encoding */
+typedef struct _hdr_table_entry_t {
+    int initial_loc;
+    int fde;
+} hdr_table_entry_t;
+
+typedef struct _cfi_reader_t {
+    byte *buf;           /* local copy */
+    byte *cur;
+    byte *end;
+    app_pc app_base;     /* app address of buf[0] */
+    bool error;
+} cfi_reader_t;
+
+typedef struct _cie_info_t {
+    ptr_uint_t code_align;
+    ptr_int_t data_align;
+    uint ra_reg;
+    byte fde_enc;
+    bool has_aug_data;
+    cfi_reader_t insts;
+} cie_info_t;
+
+typedef enum {
+    RULE_SAME,           /* unchanged from the callee */
+    RULE_OFFSET,         /* saved at CFA + offset */
+    RULE_UNDEFINED,      /* not recoverable: for the retaddr, the base frame */
+    RULE_UNSUPPORTED,    /* a rule we do not evaluate */
+} reg_rule_t;
+
+typedef struct _cfi_row_t {
+    uint cfa_reg;        /* DWARF_REG_NONE if defined by an expression */
+    ptr_int_t cfa_off;
+    reg_rule_t ra_rule;
+    ptr_int_t ra_off;
+    reg_rule_t fp_rule;
+    ptr_int_t fp_off;
+} cfi_row_t;
+
+static rb_tree_t *unwind_tree;
+static void *unwind_lock;
+
+#ifdef STATISTICS
+static uint unwind_steps;
+static uint unwind_no_info;
+#endif
+
+static void
+unwind_module_free(void *p)
+{
+    global_free(p, sizeof(unwind_module_t), HEAPSTAT_CALLSTACK);
+}
+
+void
+unwind_init(void)
+{
+    unwind_lock = dr_mutex_create();
+    unwind_tree = rb_tree_create(unwind_module_free);
+}
+
+void
+unwind_exit(void)
+{
+    rb_tree_destroy(unwind_tree);
+    dr_mutex_destroy(unwind_lock);
+}
+
+/***************************************************************************
+ * Reading CFI data
+ */
+
+static inline byte
+cfi_read_u8(cfi_reader_t *r)
+{
+    if (r->cur >= r->end) {
+        r->error = true;
+        return 0;
+    }
+    return *r->cur++;
+}
+
+static inline void
+cfi_read_bytes(cfi_reader_t *r, void *dst, size_t sz)
+{
+    if (r->cur + sz > r->end) {
+        r->error = true;
+        memset(dst, 0, sz);
+        return;
+    }
+    memcpy(dst, r->cur, sz);
+    r->cur += sz;
+}
+
+static inline void
+cfi_skip(cfi_reader_t *r, ptr_uint_t sz)
+{
+    if (sz > (ptr_uint_t)(r->end - r->cur))
+        r->error = true;
+    else
+        r->cur += sz;
+}
+
+static ptr_uint_t
+cfi_read_uleb(cfi_reader_t *r)
+{
+    ptr_uint_t val = 0;
+    uint shift = 0;
+    byte b;
+    do {
+        b = cfi_read_u8(r);
+        if (shift < sizeof(val) * 8)
+            val |= (ptr_uint_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (TEST(0x80, b) && !r->error);
+    return val;
+}
+
+static ptr_int_t
+cfi_read_sleb(cfi_reader_t *r)
+{
+    ptr_int_t val = 0;
+    uint shift = 0;
+    byte b;
+    do {
+        b = cfi_read_u8(r);
+        if (shift < sizeof(val) * 8)
+            val |= (ptr_int_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (TEST(0x80, b) && !r->error);
+    if (shift < sizeof(val) * 8 && TEST(0x40, b))
+        val |= -((ptr_int_t)1 << shift);
+    return val;
+}
+
+/* Reads a pointer in the given DW_EH_PE_ encoding.  We only support the
+ * applications used for FDE fields: absolute and pc-relative.  An indirect
+ * value is returned without dereferencing it, as we only skip those.
+ */
+static ptr_uint_t
+cfi_read_encoded(cfi_reader_t *r, byte enc)
+{
+    app_pc field = r->app_base + (r->cur - r->buf);
+    ptr_uint_t val;
+    switch (enc & 0x0f) {
+    case DW_EH_PE_absptr: {
+        ptr_uint_t v;
+        cfi_read_bytes(r, &v, sizeof(v));
+        val = v;
+        break;
+    }
+    case DW_EH_PE_uleb128:
+        val = cfi_read_uleb(r);
+        break;
+    case DW_EH_PE_udata2: {
+        ushort v;
+        cfi_read_bytes(r, &v, sizeof(v));
+        val = v;
+        break;
+    }
+    case DW_EH_PE_udata4: {
+        uint v;
+        cfi_read_bytes(r, &v, sizeof(v));
+        val = v;
+        break;
+    }
+    case DW_EH_PE_udata8: {
+        uint64 v;
+        cfi_read_bytes(r, &v, sizeof(v));
+        val = (ptr_uint_t) v;
+        break;
+    }
+    case DW_EH_PE_sleb128:
+        val = (ptr_uint_t) cfi_read_sleb(r);
+        break;
+    case DW_EH_PE_sdata2: {
+        short v;
+        cfi_read_bytes(r, &v, sizeof(v));
+        val = (ptr_uint_t)(ptr_int_t) v;
+        break;
+    }
+    case DW_EH_PE_sdata4: {
+        int v;
+        cfi_read_bytes(r, &v, sizeof(v));
+        val = (ptr_uint_t)(ptr_int_t) v;
+        break;
+    }
+    case DW_EH_PE_sdata8: {
+        int64 v;
+        cfi_read_bytes(r, &v, sizeof(v));
+        val = (ptr_uint_t) v;
+        break;
+    }
+    default:
+        r->error = true;
+        return 0;
+    }
+    switch (enc & 0x70) {
+    case DW_EH_PE_absptr:
+        break;
+    case DW_EH_PE_pcrel:
+        val += (ptr_uint_t) field;
+        break;
+    default:
+        r->error = true;
+        return 0;
+    }
+    return val;
+}
+
+/* Copies the CIE or FDE at addr into buf and sets up r to read its contents
+ * after the length field.
+ */
+static bool
+cfi_read_record(app_pc addr, byte *buf, size_t bufsz, cfi_reader_t *r)
+{
+    uint len;
+    /* We do not support the 64-bit DWARF format (len 0xffffffff), which
+     * .eh_frame does not use in practice.
+     */
+    if (!safe_read(addr, sizeof(len), &len) || len == 0 || len > bufsz)
+        return false;
+    if (!safe_read(addr + sizeof(len), len, buf))
+        return false;
+    r->buf = buf;
+    r->cur = buf;
+    r->end = buf + len;
+    r->app_base = addr + sizeof(len);
+    r->error = false;
+    return true;
+}
+
+static bool
+cfi_parse_cie(app_pc cie_addr, byte *buf, cie_info_t *cie)
+{
+    cfi_reader_t r;
+    char aug[CFI_MAX_AUGMENTATION];
+    uint i, id;
+    byte version;
+    if (!cfi_read_record(cie_addr, buf, CFI_MAX_RECORD, &r))
+        return false;
+    cfi_read_bytes(&r, &id, sizeof(id));
+    if (id != 0)
+        return false;
+    version = cfi_read_u8(&r);
+    if (version != 1 && version != 3)
+        return false;
+    for (i = 0; i < CFI_MAX_AUGMENTATION; i++) {
+        aug[i] = (char) cfi_read_u8(&r);
+        if (aug[i] == '\0')
+            break;
+    }
+    if (i == CFI_MAX_AUGMENTATION || r.error)
+        return false;
+    cie->code_align = cfi_read_uleb(&r);
+    cie->data_align = cfi_read_sleb(&r);
+    cie->ra_reg = (version == 1) ? cfi_read_u8(&r) : (uint) cfi_read_uleb(&r);
+    cie->fde_enc = DW_EH_PE_absptr;
+    cie->has_aug_data = (aug[0] == 'z');
+    if (cie->has_aug_data) {
+        ptr_uint_t aug_len = cfi_read_uleb(&r);
+        byte *aug_end = r.cur + aug_len;
+        for (i = 1; aug[i] != '\0' && !r.error; i++) {
+            if (aug[i] == 'R')
+                cie->fde_enc = cfi_read_u8(&r);
+            else if (aug[i] == 'P')
+                cfi_read_encoded(&r, cfi_read_u8(&r)); /* personality: skip */
+            else if (aug[i] == 'L')
+                cfi_read_u8(&r); /* LSDA encoding: unused */
+            else if (aug[i] == 'S')
+                ; /* signal frame: the CFA rules we support still apply */
+            else
+                break; /* unknown: aug_len lets us skip the rest */
+        }
+        if (aug_end > r.end)
+            return false;
+        r.cur = aug_end;
+    } else if (aug[0] != '\0')
+        return false;
+    if (r.error)
+        return false;
+    cie->insts = r;
+    return true;
+}
+
+/* Finds the FDE covering pc via the module's .eh_frame_hdr table */
+static bool
+unwind_find_fde(app_pc pc, app_pc *fde OUT)
+{
+    rb_node_t *node;
+    unwind_module_t mod;
+    uint lo, hi;
+    hdr_table_entry_t entry;
+    ptr_int_t target;
+    dr_mutex_lock(unwind_lock);
+    node = rb_in_node(unwind_tree, pc);
+    if (node != NULL) {
+        void *data;
+        rb_node_fields(node, NULL, NULL, &data);
+        mod = *(unwind_module_t *)data;
+    }
+    dr_mutex_unlock(unwind_lock);
+    if (node == NULL)
+        return false;
+    /* Find the last entry whose initial loc is <= pc */
+    target = (ptr_int_t)(pc - mod.hdr);
+    lo = 0;
+    hi = mod.fde_count;
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (!safe_read(mod.table + mid * sizeof(entry), sizeof(entry), &entry))
+            return false;
+        if ((ptr_int_t)entry.initial_loc <= target)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return false;
+    if (!safe_read(mod.table + (lo - 1) * sizeof(entry), sizeof(entry), &entry))
+        return false;
+    *fde = mod.hdr + entry.fde;
+    return true;
+}
+
+/***************************************************************************
+ * Executing call frame instructions
+ */
+
+static void
+cfi_set_rule(cfi_row_t *row, const cie_info_t *cie, ptr_uint_t reg, reg_rule_t rule,
+             ptr_int_t off)
+{
+    if (reg == cie->ra_reg) {
+        row->ra_rule = rule;
+        row->ra_off = off;
+    } else if (reg == DWARF_REG_FP) {
+        row->fp_rule = rule;
+        row->fp_off = off;
+    }
+}
+
+static void
+cfi_restore_rule(cfi_row_t *row, const cfi_row_t *initial, const cie_info_t *cie,
+                 ptr_uint_t reg)
+{
+    if (initial == NULL)
+        cfi_set_rule(row, cie, reg, RULE_SAME, 0);
+    else if (reg == cie->ra_reg)
+        cfi_set_rule(row, cie, reg, initial->ra_rule, initial->ra_off);
+    else if (reg == DWARF_REG_FP)
+        cfi_set_rule(row, cie, reg, initial->fp_rule, initial->fp_off);
+}
+
+/* Executes instructions until the location passes target.  For the CIE's
+ * initial instructions, initial is NULL and target is ignored.
+ */
+static bool
+cfi_execute(cfi_reader_t *r, const cie_info_t *cie, const cfi_row_t *initial,
+            cfi_row_t *row, app_pc loc, app_pc target)
+{
+    cfi_row_t stack[CFI_STATE_STACK];
+    uint depth = 0;
+    ptr_uint_t reg, delta;
+    while (r->cur < r->end && !r->error) {
+        byte op = cfi_read_u8(r);
+        switch (op & 0xc0) {
+        case DW_CFA_advance_loc:
+            loc += (op & 0x3f) * cie->code_align;
+            if (initial != NULL && loc > target)
+                return true;
+            continue;
+        case DW_CFA_offset:
+            cfi_set_rule(row, cie, op & 0x3f, RULE_OFFSET,
+                         (ptr_int_t)cfi_read_uleb(r) * cie->data_align);
+            continue;
+        case DW_CFA_restore:
+            cfi_restore_rule(row, initial, cie, op & 0x3f);
+            continue;
+        }
+        switch (op) {
+        case DW_CFA_nop:
+            break;
+        case DW_CFA_set_loc:
+        case DW_CFA_advance_loc1:
+        case DW_CFA_advance_loc2:
+        case DW_CFA_advance_loc4:
+            if (op == DW_CFA_set_loc)
+                loc = (app_pc) cfi_read_encoded(r, cie->fde_enc);
+            else {
+                if (op == DW_CFA_advance_loc1)
+                    delta = cfi_read_u8(r);
+                else if (op == DW_CFA_advance_loc2) {
+                    ushort v;
+                    cfi_read_bytes(r, &v, sizeof(v));
+                    delta = v;
+                } else {
+                    uint v;
+                    cfi_read_bytes(r, &v, sizeof(v));
+                    delta = v;
+                }
+                loc += delta * cie->code_align;
+            }
+            if (initial != NULL && loc > target)
+                return !r->error;
+            break;
+        case DW_CFA_offset_extended:
+            reg = cfi_read_uleb(r);
+            cfi_set_rule(row, cie, reg, RULE_OFFSET,
+                         (ptr_int_t)cfi_read_uleb(r) * cie->data_align);
+            break;
+        case DW_CFA_offset_extended_sf:
+            reg = cfi_read_uleb(r);
+            cfi_set_rule(row, cie, reg, RULE_OFFSET, cfi_read_sleb(r) * cie->data_align);
+            break;
+        case DW_CFA_GNU_negative_offset_extended:
+            reg = cfi_read_uleb(r);
+            cfi_set_rule(row, cie, reg, RULE_OFFSET,
+                         -(ptr_int_t)cfi_read_uleb(r) * cie->data_align);
+            break;
+        case DW_CFA_restore_extended:
+            cfi_restore_rule(row, initial, cie, cfi_read_uleb(r));
+            break;
+        case DW_CFA_undefined:
+            cfi_set_rule(row, cie, cfi_read_uleb(r), RULE_UNDEFINED, 0);
+            break;
+        case DW_CFA_same_value:
+            cfi_set_rule(row, cie, cfi_read_uleb(r), RULE_SAME, 0);
+            break;
+        case DW_CFA_register:
+            reg = cfi_read_uleb(r);
+            cfi_read_uleb(r);
+            cfi_set_rule(row, cie, reg, RULE_UNSUPPORTED, 0);
+            break;
+        case DW_CFA_val_offset:
+        case DW_CFA_val_offset_sf:
+            reg = cfi_read_uleb(r);
+            if (op == DW_CFA_val_offset)
+                cfi_read_uleb(r);
+            else
+                cfi_read_sleb(r);
+            cfi_set_rule(row, cie, reg, RULE_UNSUPPORTED, 0);
+            break;
+        case DW_CFA_expression:
+        case DW_CFA_val_expression:
+            reg = cfi_read_uleb(r);
+            cfi_skip(r, cfi_read_uleb(r));
+            cfi_set_rule(row, cie, reg, RULE_UNSUPPORTED, 0);
+            break;
+        case DW_CFA_remember_state:
+            if (depth == CFI_STATE_STACK)
+                return false;
+            stack[depth++] = *row;
+            break;
+        case DW_CFA_restore_state:
+            if (depth == 0)
+                return false;
+            *row = stack[--depth];
+            break;
+        case DW_CFA_def_cfa:
+            row->cfa_reg = (uint) cfi_read_uleb(r);
+            row->cfa_off = (ptr_int_t) cfi_read_uleb(r);
+            break;
+        case DW_CFA_def_cfa_sf:
+            row->cfa_reg = (uint) cfi_read_uleb(r);
+            row->cfa_off = cfi_read_sleb(r) * cie->data_align;
+            break;
+        case DW_CFA_def_cfa_register:
+            row->cfa_reg = (uint) cfi_read_uleb(r);
+            break;
+        case DW_CFA_def_cfa_offset:
+            row->cfa_off = (ptr_int_t) cfi_read_uleb(r);
+            break;
+        case DW_CFA_def_cfa_offset_sf:
+            row->cfa_off = cfi_read_sleb(r) * cie->data_align;
+            break;
+        case DW_CFA_def_cfa_expression:
+            cfi_skip(r, cfi_read_uleb(r));
+            row->cfa_reg = DWARF_REG_NONE;
+            break;
+        case DW_CFA_GNU_args_size:
+            cfi_read_uleb(r);
+            break;
+        default:
+            LOG(3, "%s: unknown CFA op 0x%x\n", __FUNCTION__, op);
+            return false;
+        }
+    }
+    return !r->error;
+}
+
+/* Computes the unwind rules in effect at pc */
+static bool
+unwind_find_row(app_pc pc, cfi_row_t *row OUT)
+{
+    byte fde_buf[CFI_MAX_RECORD];
+    byte cie_buf[CFI_MAX_RECORD];
+    app_pc fde_addr;
+    cfi_reader_t r;
+    cie_info_t cie;
+    cfi_row_t initial;
+    uint cie_ptr;
+    app_pc pc_begin;
+    ptr_uint_t pc_range;
+
+    if (!unwind_find_fde(pc, &fde_addr))
+        return false;
+    if (!cfi_read_record(fde_addr, fde_buf, sizeof(fde_buf), &r))
+        return false;
+    /* The CIE pointer is relative to its own field */
+    cfi_read_bytes(&r, &cie_ptr, sizeof(cie_ptr));
+    if (r.error || cie_ptr == 0/*a CIE, not an FDE*/)
+        return false;
+    if (!cfi_parse_cie(r.app_base - cie_ptr, cie_buf, &cie))
+        return false;
+    pc_begin = (app_pc) cfi_read_encoded(&r, cie.fde_enc);
+    pc_range = cfi_read_encoded(&r, cie.fde_enc & 0x0f);
+    if (r.error || pc < pc_begin || pc >= pc_begin + pc_range)
+        return false;
+    if (cie.has_aug_data)
+        cfi_skip(&r, cfi_read_uleb(&r));
+
+    initial.cfa_reg = DWARF_REG_NONE;
+    initial.cfa_off = 0;
+    initial.ra_rule = RULE_UNDEFINED;
+    initial.ra_off = 0;
+    initial.fp_rule = RULE_SAME;
+    initial.fp_off = 0;
+    if (!cfi_execute(&cie.insts, &cie, NULL, &initial, pc_begin, pc))
+        return false;
+    *row = initial;
+    return cfi_execute(&r, &cie, &initial, row, pc_begin, pc);
+}
+
+unwind_result_t
+unwind_step(app_pc pc, bool top_frame, byte **sp INOUT, byte **fp INOUT,
+            app_pc *retaddr OUT)
+{
+    cfi_row_t row;
+    byte *cfa, *new_fp;
+    app_pc ra;
+    /* A retaddr may be just past the end of a noreturn call's function */
+    if (!unwind_find_row(top_frame ? pc : pc - 1, &row)) {
+        STATS_INC(unwind_no_info);
+        return UNWIND_NO_INFO;
+    }
+    if (row.ra_rule == RULE_UNDEFINED)
+        return UNWIND_OUTERMOST;
+    if (row.ra_rule != RULE_OFFSET || row.fp_rule == RULE_UNSUPPORTED)
+        return UNWIND_NO_INFO;
+    if (row.cfa_reg == DWARF_REG_SP)
+        cfa = *sp + row.cfa_off;
+    else if (row.cfa_reg == DWARF_REG_FP)
+        cfa = *fp + row.cfa_off;
+    else
+        return UNWIND_NO_INFO;
+    /* The caller's frame must be higher on the stack */
+    if (cfa <= *sp || !safe_read(cfa + row.ra_off, sizeof(ra), &ra))
+        return UNWIND_NO_INFO;
+    if (row.fp_rule == RULE_OFFSET) {
+        if (!safe_read(cfa + row.fp_off, sizeof(new_fp), &new_fp))
+            return UNWIND_NO_INFO;
+    } else if (row.fp_rule == RULE_UNDEFINED)
+        new_fp = NULL;
+    else
+        new_fp = *fp;
+    LOG(4, "%s: pc="PFX" sp="PFX" => cfa="PFX" ra="PFX" fp="PFX"\n", __FUNCTION__,
+        pc, *sp, cfa, ra, new_fp);
+    *sp = cfa;
+    *fp = new_fp;
+    *retaddr = ra;
+    STATS_INC(unwind_steps);
+    return UNWIND_OK;
+}
+
+/***************************************************************************
+ * Modules
+ */
+
+void
+unwind_module_load(const module_data_t *info)
+{
+    ELF_EHDR ehdr;
+    ELF_PHDR phdr;
+    uint i;
+    ptr_uint_t min_vaddr = 0, eh_vaddr = 0;
+    bool have_load = false, have_eh = false;
+    byte hdr_buf[4 + 2 * sizeof(uint64)];
+    cfi_reader_t r;
+    app_pc hdr;
+    ptr_uint_t fde_count;
+    unwind_module_t *mod;
+    rb_node_t *node;
+
+    if (!safe_read(info->start, sizeof(ehdr), &ehdr) ||
+        memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0)
+        return;
+    for (i = 0; i < ehdr.e_phnum; i++) {
+        if (!safe_read(info->start + ehdr.e_phoff + i * ehdr.e_phentsize,
+                       sizeof(phdr), &phdr))
+            return;
+        if (phdr.p_type == PT_LOAD && !have_load) {
+            min_vaddr = ALIGN_BACKWARD(phdr.p_vaddr, PAGE_SIZE);
+            have_load = true;
+        } else if (phdr.p_type == PT_GNU_EH_FRAME) {
+            eh_vaddr = phdr.p_vaddr;
+            have_eh = true;
+        }
+    }
+    if (!have_load || !have_eh) {
+        LOG(2, "%s: no .eh_frame_hdr for "PFX"\n", __FUNCTION__, info->start);
+        return;
+    }
+    hdr = info->start + (eh_vaddr - min_vaddr);
+    if (!safe_read(hdr, sizeof(hdr_buf), hdr_buf))
+        return;
+    /* version, eh_frame_ptr encoding, fde_count encoding, table encoding */
+    if (hdr_buf[0] != 1 || hdr_buf[3] != (DW_EH_PE_datarel | DW_EH_PE_sdata4))
+        return;
+    r.buf = hdr_buf;
+    r.cur = hdr_buf + 4;
+    r.end = hdr_buf + sizeof(hdr_buf);
+    r.app_base = hdr;
+    r.error = false;
+    cfi_read_encoded(&r, hdr_buf[1]); /* eh_frame_ptr: unused */
+    fde_count = cfi_read_encoded(&r, hdr_buf[2]);
+    if (r.error || fde_count == 0)
+        return;
+
+    mod = (unwind_module_t *) global_alloc(sizeof(*mod), HEAPSTAT_CALLSTACK);
+    mod->hdr = hdr;
+    mod->table = hdr + (r.cur - r.buf);
+    mod->fde_count = (uint) fde_count;
+    dr_mutex_lock(unwind_lock);
+    node = rb_insert(unwind_tree, info->start, info->end - info->start, (void *)mod);
+    dr_mutex_unlock(unwind_lock);
+    if (node != NULL) {
+        LOG(1, "%s: module "PFX" overlaps w/ existing\n", __FUNCTION__, info->start);
+        unwind_module_free(mod);
+        return;
+    }
+    LOG(2, "%s: "PFX" has %u FDEs\n", __FUNCTION__, info->start, mod->fde_count);
+}
+
+void
+unwind_module_unload(const module_data_t *info)
+{
+    rb_node_t *node;
+    dr_mutex_lock(unwind_lock);
+    node = rb_find(unwind_tree, info->start);
+    if (node != NULL)
+        rb_delete(unwind_tree, node);
+    dr_mutex_unlock(unwind_lock);
+}
+
+#ifdef STATISTICS
+void
+unwind_dump_statistics(file_t f)
+{
+    dr_fprintf(f, "unwind steps: %8u, no unwind info: %8u\n",
+               unwind_steps, unwind_no_info);
+}
+#endif
+
+#else /* UNWIND_SUPPORTED */
+
+void
+unwind_init(void)
+{
+}
+
+void
+unwind_exit(void)
+{
+}
+
+void
+unwind_module_load(const module_data_t *info)
+{
+}
+
+void
+unwind_module_unload(const module_data_t *info)
+{
+}
+
+unwind_result_t
+unwind_step(app_pc pc, bool top_frame, byte **sp INOUT, byte **fp INOUT,
+            app_pc *retaddr OUT)
+{
+    return UNWIND_NO_INFO;
+}
+
+# ifdef STATISTICS
+void
+unwind_dump_statistics(file_t f)
+{
+}
+# endif
+
+#endif /* UNWIND_SUPPORTED */
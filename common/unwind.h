@@ -0,0 +1,63 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _UNWIND_H_
+#define _UNWIND_H_ 1
+
+/***************************************************************************
+ * Stack unwinding using the unwind tables compilers emit for exception
+ * handling, for walking callstacks through frames with no frame pointer.
+ */
+
+typedef enum {
+    UNWIND_NO_INFO,     /* no usable unwind info for this pc */
+    UNWIND_OUTERMOST,   /* the unwind info marks this as the base frame */
+    UNWIND_OK,          /* the caller's frame was computed */
+} unwind_result_t;
+
+void
+unwind_init(void);
+
+void
+unwind_exit(void);
+
+void
+unwind_module_load(const module_data_t *info);
+
+void
+unwind_module_unload(const module_data_t *info);
+
+/* Computes the caller's frame for the frame executing at pc with stack
+ * pointer *sp and frame pointer *fp.  top_frame indicates that pc is the
+ * current instruction rather than a return address.  On UNWIND_OK, *sp and
+ * *fp are updated to the caller's values and *retaddr holds the return
+ * address into the caller.
+ */
+unwind_result_t
+unwind_step(app_pc pc, bool top_frame, byte **sp INOUT, byte **fp INOUT,
+            app_pc *retaddr OUT);
+
+#ifdef STATISTICS
+void
+unwind_dump_statistics(file_t f);
+#endif
+
+#endif /* _UNWIND_H_ */
@@ -1053,6 +1053,9 @@ heap_usage_inc(heapstat_t type, size_t size)
     ATOMIC_INC32(heap_count[type]);
 }
 
+static void
+pool_dump_stats(file_t f);
+
 static void
 heap_usage_dec(heapstat_t type, size_t size)
 {
@@ -1075,6 +1078,17 @@ heap_dump_stats(file_t f)
                    (heap_usage[i] > 8192) ? "KB" : " B",
                    heap_max[i]/1024);
     }
+    pool_dump_stats(f);
+}
+
+size_t
+heap_usage_total(void)
+{
+    size_t total = 0;
+    int i;
+    for (i = 0; i < HEAPSTAT_NUMTYPES; i++)
+        total += heap_usage[i];
+    return total;
 }
 #endif /* STATISTICS */
 
@@ -1151,6 +1165,238 @@ nonheap_free(void *p, size_t size, heapstat_t type)
 #define dr_nonheap_alloc DO_NOT_USE_use_nonheap_alloc
 #define dr_nonheap_free  DO_NOT_USE_use_nonheap_free
 
+/***************************************************************************
+ * OBJECT POOLS
+ */
+
+#define POOL_MAX_POOLS 8
+#define POOL_SLAB_SIZE (16*1024)
+/* Slabs are linked through their first word; objects start after this */
+#define POOL_SLAB_HEADER 16
+/* Objects moved between a thread's cache and the shared free list at once */
+#define POOL_CACHE_BATCH 32
+
+struct _obj_pool_t {
+    const char *name;
+    size_t obj_size;
+    heapstat_t type;
+    uint index; /* into tls_util_t.pool_cache */
+    void *lock; /* protects the fields below */
+    void *free_list; /* linked through each object's first word */
+    uint num_free;
+    byte *slabs;
+    uint num_slabs;
+#ifdef STATISTICS
+    uint in_use;
+#endif
+};
+
+typedef struct _pool_cache_t {
+    void *free_list;
+    uint num_free;
+} pool_cache_t;
+
+/* Indices are not reused, so a thread's cache never outlives its pool's slot */
+static obj_pool_t *pools[POOL_MAX_POOLS];
+static uint num_pools;
+
+obj_pool_t *
+pool_create(const char *name, size_t obj_size, heapstat_t type)
+{
+    obj_pool_t *pool;
+    if (num_pools >= POOL_MAX_POOLS) {
+        ASSERT(false, "too many object pools");
+        return NULL;
+    }
+    pool = (obj_pool_t *) global_alloc(sizeof(*pool), HEAPSTAT_MISC);
+    memset(pool, 0, sizeof(*pool));
+    pool->name = name;
+    pool->obj_size = ALIGN_FORWARD(obj_size, sizeof(void *));
+    ASSERT(pool->obj_size <= (POOL_SLAB_SIZE - POOL_SLAB_HEADER) / POOL_CACHE_BATCH,
+           "pool objects too large");
+    pool->type = type;
+    pool->lock = dr_mutex_create();
+    pool->index = num_pools;
+    pools[num_pools++] = pool;
+    return pool;
+}
+
+void
+pool_destroy(obj_pool_t *pool)
+{
+    byte *slab, *next;
+    if (pool == NULL)
+        return;
+    for (slab = pool->slabs; slab != NULL; slab = next) {
+        next = *(byte **)slab;
+        global_free(slab, POOL_SLAB_SIZE, pool->type);
+    }
+    dr_mutex_destroy(pool->lock);
+    pools[pool->index] = NULL;
+    global_free(pool, sizeof(*pool), HEAPSTAT_MISC);
+}
+
+/* Caller must hold pool->lock */
+static void *
+pool_take_locked(obj_pool_t *pool)
+{
+    void *obj;
+    if (pool->free_list == NULL) {
+        byte *slab = (byte *) global_alloc(POOL_SLAB_SIZE, pool->type);
+        uint i, num = (POOL_SLAB_SIZE - POOL_SLAB_HEADER) / pool->obj_size;
+        *(byte **)slab = pool->slabs;
+        pool->slabs = slab;
+        pool->num_slabs++;
+        /* Link in address order so that consecutive allocations are adjacent */
+        for (i = num; i > 0; i--) {
+            obj = slab + POOL_SLAB_HEADER + (i - 1) * pool->obj_size;
+            *(void **)obj = pool->free_list;
+            pool->free_list = obj;
+        }
+        pool->num_free += num;
+    }
+    obj = pool->free_list;
+    pool->free_list = *(void **)obj;
+    pool->num_free--;
+    return obj;
+}
+
+/* Caller must hold pool->lock */
+static void
+pool_give_locked(obj_pool_t *pool, void *obj)
+{
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->num_free++;
+}
+
+static pool_cache_t *
+pool_cache_lookup(obj_pool_t *pool)
+{
+    tls_util_t *pt = (tls_idx_util > -1) ? PT_LOOKUP() : NULL;
+    if (pt == NULL || pt->pool_cache == NULL)
+        return NULL;
+    return &pt->pool_cache[pool->index];
+}
+
+void *
+pool_alloc(obj_pool_t *pool)
+{
+    pool_cache_t *cache = pool_cache_lookup(pool);
+    void *obj;
+#ifdef STATISTICS
+    ATOMIC_INC32(pool->in_use);
+#endif
+    if (cache == NULL) {
+        dr_mutex_lock(pool->lock);
+        obj = pool_take_locked(pool);
+        dr_mutex_unlock(pool->lock);
+        return obj;
+    }
+    if (cache->free_list == NULL) {
+        uint i;
+        dr_mutex_lock(pool->lock);
+        for (i = 0; i < POOL_CACHE_BATCH; i++) {
+            obj = pool_take_locked(pool);
+            *(void **)obj = cache->free_list;
+            cache->free_list = obj;
+        }
+        dr_mutex_unlock(pool->lock);
+        cache->num_free = POOL_CACHE_BATCH;
+    }
+    obj = cache->free_list;
+    cache->free_list = *(void **)obj;
+    cache->num_free--;
+    return obj;
+}
+
+void
+pool_free(obj_pool_t *pool, void *obj)
+{
+    pool_cache_t *cache = pool_cache_lookup(pool);
+#ifdef STATISTICS
+    ATOMIC_DEC32(pool->in_use);
+#endif
+    if (cache == NULL) {
+        dr_mutex_lock(pool->lock);
+        pool_give_locked(pool, obj);
+        dr_mutex_unlock(pool->lock);
+        return;
+    }
+    *(void **)obj = cache->free_list;
+    cache->free_list = obj;
+    cache->num_free++;
+    if (cache->num_free > 2 * POOL_CACHE_BATCH) {
+        /* Hand a batch back so that a thread that mostly frees does not hoard */
+        uint i;
+        dr_mutex_lock(pool->lock);
+        for (i = 0; i < POOL_CACHE_BATCH; i++) {
+            obj = cache->free_list;
+            cache->free_list = *(void **)obj;
+            pool_give_locked(pool, obj);
+        }
+        dr_mutex_unlock(pool->lock);
+        cache->num_free -= POOL_CACHE_BATCH;
+    }
+}
+
+static void
+pool_thread_init(void *drcontext, tls_util_t *pt)
+{
+    pt->pool_cache = (pool_cache_t *)
+        thread_alloc(drcontext, sizeof(*pt->pool_cache) * POOL_MAX_POOLS,
+                     HEAPSTAT_MISC);
+    memset(pt->pool_cache, 0, sizeof(*pt->pool_cache) * POOL_MAX_POOLS);
+}
+
+static void
+pool_thread_exit(void *drcontext, tls_util_t *pt)
+{
+    uint i;
+    pool_cache_t *caches = pt->pool_cache;
+    if (caches == NULL)
+        return;
+    pt->pool_cache = NULL;
+    for (i = 0; i < num_pools; i++) {
+        obj_pool_t *pool = pools[i];
+        if (pool == NULL || caches[i].free_list == NULL)
+            continue;
+        dr_mutex_lock(pool->lock);
+        while (caches[i].free_list != NULL) {
+            void *obj = caches[i].free_list;
+            caches[i].free_list = *(void **)obj;
+            pool_give_locked(pool, obj);
+        }
+        dr_mutex_unlock(pool->lock);
+    }
+    thread_free(drcontext, caches, sizeof(*caches) * POOL_MAX_POOLS, HEAPSTAT_MISC);
+}
+
+static void
+pool_exit(void)
+{
+    uint i;
+    for (i = 0; i < num_pools; i++)
+        pool_destroy(pools[i]);
+}
+
+#ifdef STATISTICS
+static void
+pool_dump_stats(file_t f)
+{
+    uint i;
+    for (i = 0; i < num_pools; i++) {
+        obj_pool_t *pool = pools[i];
+        if (pool == NULL)
+            continue;
+        /* the free count omits objects sitting in thread caches */
+        dr_fprintf(f, "	%12s: pool %s: in use=%8u, slabs=%6u, shared free=%8u\n",
+                   heapstat_names[pool->type], pool->name, pool->in_use,
+                   pool->num_slabs, pool->num_free);
+    }
+}
+#endif
+
 /***************************************************************************
  * REGISTER CONVERSION UTILITIES
  */
@@ -1350,6 +1596,158 @@ hashwrap_assert_fail(const char *msg)
     ASSERT(false, msg);
 }
 
+#ifdef STATISTICS
+/***************************************************************************
+ * PER-THREAD STATISTICS
+ *
+ * Each thread counts into its own table of slots keyed by the address of the
+ * global statistic, with no atomic operations.  stats_fold() adds what each
+ * thread counted since the last fold into the globals; only the folding
+ * thread, holding stats_lock, touches a slot's folded field, and the owner
+ * only writes its value.  A table is a separate allocation, so no two threads
+ * share a cache line of counters.  When a table is full, or a thread has no
+ * table, we fall back to a locked add on the global.
+ */
+
+#define STATS_THREAD_SLOTS 512 /* power of 2 and more than we have statistics */
+#define STATS_THREAD_PROBES 8
+
+typedef struct _stats_slot_t {
+    volatile uint *stat;
+    uint value;
+    uint folded;
+} stats_slot_t;
+
+typedef struct _stats_thread_t {
+    stats_slot_t slot[STATS_THREAD_SLOTS];
+    struct _stats_thread_t *next;
+    struct _stats_thread_t *prev;
+} stats_thread_t;
+
+/* protects stats_threads and every table's folded fields */
+static void *stats_lock;
+static stats_thread_t *stats_threads;
+
+/* caller must hold stats_lock */
+static void
+stats_fold_thread(stats_thread_t *st)
+{
+    uint i;
+    for (i = 0; i < STATS_THREAD_SLOTS; i++) {
+        stats_slot_t *slot = &st->slot[i];
+        uint delta;
+        if (slot->stat == NULL)
+            continue;
+        delta = slot->value - slot->folded;
+        if (delta != 0) {
+            ATOMIC_ADD32(*slot->stat, delta);
+            slot->folded += delta;
+        }
+    }
+}
+
+/* Returns the calling thread's running count for stat, or the global's new
+ * value if it has no per-thread slot.
+ */
+uint
+stats_thread_add(volatile uint *stat, int val)
+{
+    void *drcontext;
+    tls_util_t *pt = NULL;
+    if (tls_idx_util > -1) {
+        drcontext = dr_get_current_drcontext();
+        pt = PT_GET(drcontext);
+    }
+    if (pt != NULL && pt->stats != NULL) {
+        stats_thread_t *st = pt->stats;
+        uint i, idx = (uint)(((ptr_uint_t)stat >> 2) * 2654435761U) &
+            (STATS_THREAD_SLOTS - 1);
+        for (i = 0; i < STATS_THREAD_PROBES; i++) {
+            stats_slot_t *slot = &st->slot[(idx + i) & (STATS_THREAD_SLOTS - 1)];
+            if (slot->stat == stat) {
+                slot->value += val;
+                return slot->value;
+            }
+            if (slot->stat == NULL) {
+                /* a concurrent fold may see the stat before the value: fine */
+                slot->stat = stat;
+                slot->value += val;
+                return slot->value;
+            }
+        }
+    }
+    return (uint) atomic_add32_return_sum((volatile int *)stat, val);
+}
+
+void
+stats_fold(void)
+{
+    stats_thread_t *st;
+    if (stats_lock == NULL)
+        return;
+    dr_mutex_lock(stats_lock);
+    for (st = stats_threads; st != NULL; st = st->next)
+        stats_fold_thread(st);
+    dr_mutex_unlock(stats_lock);
+}
+
+static void
+stats_init(void)
+{
+    stats_lock = dr_mutex_create();
+}
+
+static void
+stats_exit(void)
+{
+    stats_thread_t *st, *next;
+    /* threads still alive at exit get no exit event */
+    dr_mutex_lock(stats_lock);
+    for (st = stats_threads; st != NULL; st = next) {
+        next = st->next;
+        stats_fold_thread(st);
+        global_free(st, sizeof(*st), HEAPSTAT_MISC);
+    }
+    stats_threads = NULL;
+    dr_mutex_unlock(stats_lock);
+    dr_mutex_destroy(stats_lock);
+    stats_lock = NULL;
+}
+
+static void
+stats_thread_init(tls_util_t *pt)
+{
+    stats_thread_t *st = (stats_thread_t *) global_alloc(sizeof(*st), HEAPSTAT_MISC);
+    memset(st, 0, sizeof(*st));
+    dr_mutex_lock(stats_lock);
+    st->next = stats_threads;
+    if (stats_threads != NULL)
+        stats_threads->prev = st;
+    stats_threads = st;
+    dr_mutex_unlock(stats_lock);
+    pt->stats = st;
+}
+
+static void
+stats_thread_exit(tls_util_t *pt)
+{
+    stats_thread_t *st = pt->stats;
+    if (st == NULL)
+        return;
+    pt->stats = NULL;
+    dr_mutex_lock(stats_lock);
+    stats_fold_thread(st);
+    if (st->prev != NULL)
+        st->prev->next = st->next;
+    else
+        stats_threads = st->next;
+    if (st->next != NULL)
+        st->next->prev = st->prev;
+    dr_mutex_unlock(stats_lock);
+    global_free(st, sizeof(*st), HEAPSTAT_MISC);
+}
+#endif /* STATISTICS */
+
 /***************************************************************************
  * INIT/EXIT
  */
@@ -1366,6 +1764,9 @@ utils_early_init(void)
 void
 utils_init(void)
 {
+#ifdef STATISTICS
+    stats_init();
+#endif
     tls_idx_util = drmgr_register_tls_field();
     ASSERT(tls_idx_util > -1, "failed to obtain TLS slot");
 
@@ -1393,6 +1794,10 @@ utils_exit(void)
     if (drsym_exit() != DRSYM_SUCCESS) {
         LOG(1, "WARNING: error cleaning up symbol library\n");
     }
+#ifdef STATISTICS
+    stats_exit();
+#endif
+    pool_exit();
     drmgr_unregister_tls_field(tls_idx_util);
 }
 
@@ -1401,6 +1806,10 @@ utils_thread_init(void *drcontext)
 {
     tls_util_t *pt = (tls_util_t *) thread_alloc(drcontext, sizeof(*pt), HEAPSTAT_MISC);
     memset(pt, 0, sizeof(*pt));
+#ifdef STATISTICS
+    stats_thread_init(pt);
+#endif
+    pool_thread_init(drcontext, pt);
     drmgr_set_tls_field(drcontext, tls_idx_util, (void *) pt);
 }
 
@@ -1408,6 +1817,10 @@ void
 utils_thread_exit(void *drcontext)
 {
     tls_util_t *pt = (tls_util_t *) drmgr_get_tls_field(drcontext, tls_idx_util);
+#ifdef STATISTICS
+    stats_thread_exit(pt);
+#endif
+    pool_thread_exit(drcontext, pt);
     /* with PR 536058 we do have dcontext in exit event so indicate explicitly
      * that we've cleaned up the per-thread data
      */
@@ -403,6 +403,10 @@ print_prefix_to_console(void);
 /* Per-thread data shared across callbacks and all modules */
 typedef struct _tls_util_t {
     file_t f;  /* logfile */
+#ifdef STATISTICS
+    struct _stats_thread_t *stats;
+#endif
+    struct _pool_cache_t *pool_cache; /* one per obj_pool_t */
 } tls_util_t;
 
 extern int tls_idx_util;
@@ -571,9 +575,24 @@ extern int tls_idx_util;
 } while (0)
 
 #ifdef STATISTICS
-# define STATS_INC(stat) ATOMIC_INC32(stat)
-# define STATS_DEC(stat) ATOMIC_DEC32(stat)
-# define STATS_ADD(stat, val) ATOMIC_ADD32(stat, val)
+/* Statistics are counted per thread to keep their cache lines from bouncing
+ * between cores, and folded into the global variables by stats_fold(), so a
+ * global is only up to date right after a fold.  A statistic whose running
+ * value is read during execution, such as one tracked by STATS_PEAK, must use
+ * the STATS_GLOBAL_* variants instead.
+ */
+uint
+stats_thread_add(volatile uint *stat, int val);
+
+void
+stats_fold(void);
+
+# define STATS_INC(stat) stats_thread_add((volatile uint *)&(stat), 1)
+# define STATS_DEC(stat) stats_thread_add((volatile uint *)&(stat), -1)
+# define STATS_ADD(stat, val) stats_thread_add((volatile uint *)&(stat), (int)(val))
+# define STATS_GLOBAL_INC(stat) ATOMIC_INC32(stat)
+# define STATS_GLOBAL_DEC(stat) ATOMIC_DEC32(stat)
+# define STATS_GLOBAL_ADD(stat, val) ATOMIC_ADD32(stat, val)
 # define STATS_PEAK(stat) do {               \
     uint stats_peak_local_val_ = stat;       \
     if (stats_peak_local_val_ > peak_##stat) \
@@ -585,6 +604,9 @@ extern int tls_idx_util;
 # define STATS_INC(stat) /* nothing */
 # define STATS_DEC(stat) /* nothing */
 # define STATS_ADD(stat, val) /* nothing */
+# define STATS_GLOBAL_INC(stat) /* nothing */
+# define STATS_GLOBAL_DEC(stat) /* nothing */
+# define STATS_GLOBAL_ADD(stat, val) /* nothing */
 # define STATS_PEAK(stat) /* nothing */
 # define DOSTATS(x) /* nothing */
 # define _IF_STATS(x) /* nothing */
@@ -662,6 +684,16 @@ atomic_add32_return_sum(volatile int *x, int val)
                          : "1" (val) : "memory");
     return (cur + val);
 }
+
+/* Sets *x to val if it equals expect.  Returns whether it did. */
+static inline bool
+atomic_compare_exchange32(volatile int *x, int expect, int val)
+{
+    int prev;
+    __asm__ __volatile__("lock cmpxchgl %2, %1" : "=a" (prev), "+m" (*x)
+                         : "r" (val), "0" (expect) : "memory");
+    return (prev == expect);
+}
 # elif defined(ARM)
 /* XXX: should DR export these for us? */
 #  define ATOMIC_INC32(x)                                   \
@@ -715,6 +747,28 @@ atomic_add32_return_sum(volatile int *x, int val)
     ATOMIC_ADD_EXCHANGE32(x, val, temp);
     return (temp + val);
 }
+
+/* Sets *x to val if it equals expect.  Returns whether it did.
+ * The leading barrier orders the caller's prior stores before the swap.
+ */
+static inline bool
+atomic_compare_exchange32(volatile int *x, int expect, int val)
+{
+    int prev, fail;
+    __asm__ __volatile__(
+       "   dmb   ish            \n\t"
+       "1: ldrex %0, %2         \n\t"
+       "   cmp   %0, %3         \n\t"
+       "   bne   2f             \n\t"
+       "   strex %1, %4, %2     \n\t"
+       "   cmp   %1, #0         \n\t"
+       "   bne   1b             \n\t"
+       "2:"
+       : "=&r" (prev), "=&r" (fail), "+Q" (*x)
+       : "r" (expect), "r" (val)
+       : "cc", "memory");
+    return (prev == expect);
+}
 # endif
 #else
 # define ATOMIC_INC32(x) _InterlockedIncrement((volatile LONG *)&(x))
@@ -726,6 +780,13 @@ atomic_add32_return_sum(volatile int *x, int val)
 {
     return (ATOMIC_ADD32(*x, val) + val);
 }
+
+/* Sets *x to val if it equals expect.  Returns whether it did. */
+static inline bool
+atomic_compare_exchange32(volatile int *x, int expect, int val)
+{
+    return (_InterlockedCompareExchange((volatile LONG *)x, val, expect) == expect);
+}
 #endif
 
 /* racy: should be used only for diagnostics */
@@ -982,6 +1043,10 @@ nonheap_free(void *p, size_t size, heapstat_t type);
 void
 heap_dump_stats(file_t f);
 
+/* Returns the bytes of our own heap currently allocated, across all types */
+size_t
+heap_usage_total(void);
+
 #define dr_global_alloc DO_NOT_USE_use_global_alloc
 #define dr_global_free  DO_NOT_USE_use_global_free
 #define dr_thread_alloc DO_NOT_USE_use_thread_alloc
@@ -989,6 +1054,27 @@ heap_dump_stats(file_t f);
 #define dr_nonheap_alloc DO_NOT_USE_use_nonheap_alloc
 #define dr_nonheap_free  DO_NOT_USE_use_nonheap_free
 
+/* Object pools, for small fixed-size structures that are allocated and freed
+ * at a high rate.  Objects are carved out of slabs counted under the pool's
+ * heapstat type, and each thread keeps a cache of free objects so that most
+ * allocations and frees take no lock.  A pool's memory is only returned when
+ * it is destroyed; pools still alive are destroyed by utils_exit(), so their
+ * objects may be freed until then.  Pools must be created at init time.
+ */
+typedef struct _obj_pool_t obj_pool_t;
+
+obj_pool_t *
+pool_create(const char *name, size_t obj_size, heapstat_t type);
+
+void
+pool_destroy(obj_pool_t *pool);
+
+void *
+pool_alloc(obj_pool_t *pool);
+
+void
+pool_free(obj_pool_t *pool, void *obj);
+
 char *
 drmem_strdup(const char *src, heapstat_t type);
 
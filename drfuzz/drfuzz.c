@@ -58,6 +58,62 @@ typedef bool drfuzz_fault_action_t;
 
 static uint64 num_total_bbs;
 
+/* Edge coverage (drfuzz_enable_edge_coverage()).  Each bb is given a hashed id
+ * below EDGE_MAP_SIZE, and the edge from block a to block b is recorded in byte
+ * (a >> 1) + b of the thread's trace map.  Using a sum instead of AFL's xor
+ * lets the inline code compute the index with lea and a displacement, so it
+ * clobbers neither the arithmetic flags nor any register but one that it spills
+ * to its own TLS slot.  Hence the map is 1.5 times EDGE_MAP_SIZE.
+ */
+#define EDGE_MAP_BITS 16
+#define EDGE_MAP_SIZE (1 << EDGE_MAP_BITS)
+#define EDGE_MAP_ALLOC (EDGE_MAP_SIZE + EDGE_MAP_SIZE / 2)
+#define EDGE_BLOCK_ID(tag) \
+    ((((uint)(ptr_uint_t)(tag)) * 0x9e3779b1U) >> (32 - EDGE_MAP_BITS))
+
+/* Raw TLS slots used by the inline edge coverage code */
+enum {
+    EDGE_SLOT_BASE,  /* the thread's trace map */
+    EDGE_SLOT_PREV,  /* the trace map plus the last block's id halved */
+    EDGE_SLOT_SPILL, /* app value of the scratch register */
+    EDGE_SLOT_COUNT,
+};
+
+static bool edge_coverage;
+static reg_id_t edge_seg;
+static uint edge_offs;
+/* Edges seen by any thread while fuzzing.  Protected by edge_map_lock for
+ * writes; read without the lock to look for new edges.
+ */
+static byte *edge_map;
+static uint64 num_edges; /* protected by edge_map_lock */
+static void *edge_map_lock;
+/* Written by threads that are not fuzzing; never read */
+static byte *edge_discard;
+static bool edge_threads_started;
+
+/* Comparison capture (drfuzz_enable_cmp_capture()).  When a thread that is
+ * executing a fuzz target builds a block, we record the immediates of the
+ * block's compare instructions: these are the magic numbers and tags that the
+ * target tests its input against.  Only block building pays, so the capture
+ * costs nothing as the code runs, but it misses code first executed outside of
+ * fuzzing and values compared from memory.
+ */
+#define CMP_VALUES_MAX 1024
+
+typedef struct _cmp_value_t {
+    uint64 value;
+    uint size;
+} cmp_value_t;
+
+static bool cmp_capture;
+static cmp_value_t *cmp_values;
+/* Protected by cmp_lock for writes.  An entry is written before the count is
+ * raised to include it, so readers may read the count without the lock.
+ */
+static volatile uint num_cmp_values;
+static void *cmp_lock;
+
 /* Represents one fuzz target together with the client's registered callbacks */
 typedef struct _fuzz_target_t {
     app_pc func_pc;
@@ -130,6 +186,7 @@ typedef struct _pass_target_t {
     reg_t *current_args;  /* fuzzed argument values for the current iteration */
     void *user_data;      /* see drfuzz_{g,s}et_target_per_thread_user_data() */
     void (*delete_user_data_cb)(void *fuzzcxt, void *user_data);
+    app_pc repeat_pc;     /* see drfuzz_set_repeat_pc(); NULL for the target entry */
     struct _pass_target_t *next;   /* chains either stack in fuzz_pass_context_t */
 } pass_target_t;
 
@@ -155,6 +212,11 @@ typedef struct _fuzz_pass_context_t {
      * when this thread is terminated by an application crash.
      */
     drfuzz_fault_thread_state_t *thread_state;
+    /* This thread's edge coverage TLS slots and its trace map, which is only
+     * allocated once the thread starts fuzzing.
+     */
+    byte **edge_slots;
+    byte *edge_trace;
 } fuzz_pass_context_t;
 
 typedef void (*fault_event_t)(void *fuzzcxt,
@@ -243,6 +305,10 @@ free_pass_target(fuzz_pass_context_t *fp, pass_target_t *target);
 static void
 free_thread_state(fuzz_pass_context_t *fp);
 
+static dr_emit_flags_t
+edge_event_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                  bool for_trace, bool translating, void *user_data);
+
 DR_EXPORT drmf_status_t
 drfuzz_init(client_id_t client_id)
 {
@@ -297,6 +363,20 @@ drfuzz_exit(void)
 
     global_free(callbacks, sizeof(drfuzz_callbacks_t), HEAPSTAT_MISC);
 
+    if (edge_coverage) {
+        drmgr_unregister_bb_insertion_event(edge_event_insert);
+        dr_raw_tls_cfree(edge_offs, EDGE_SLOT_COUNT);
+        global_free(edge_map, EDGE_MAP_ALLOC, HEAPSTAT_MISC);
+        global_free(edge_discard, EDGE_MAP_ALLOC, HEAPSTAT_MISC);
+        dr_mutex_destroy(edge_map_lock);
+        edge_coverage = false;
+    }
+    if (cmp_capture) {
+        global_free(cmp_values, CMP_VALUES_MAX * sizeof(*cmp_values), HEAPSTAT_MISC);
+        dr_mutex_destroy(cmp_lock);
+        cmp_capture = false;
+    }
+
     drmgr_exit();
     drwrap_exit();
 
@@ -314,6 +394,13 @@ thread_init(void *dcontext)
     fp->dcontext = dcontext;
     fp->thread_state = create_fault_state(dcontext);
     drmgr_set_tls_field(dcontext, tls_idx_fuzzer, (void *) fp);
+
+    edge_threads_started = true;
+    if (edge_coverage) {
+        fp->edge_slots = (byte **) (dr_get_dr_segment_base(edge_seg) + edge_offs);
+        fp->edge_slots[EDGE_SLOT_BASE] = edge_discard;
+        fp->edge_slots[EDGE_SLOT_PREV] = edge_discard;
+    }
 }
 
 static void
@@ -337,9 +424,56 @@ thread_exit(void *dcontext)
 
     free_thread_state(fp);
     clear_pass_targets(fp);
+    if (fp->edge_trace != NULL)
+        thread_free(dcontext, fp->edge_trace, EDGE_MAP_ALLOC, HEAPSTAT_MISC);
     thread_free(dcontext, fp, sizeof(fuzz_pass_context_t), HEAPSTAT_MISC);
 }
 
+static void
+cmp_capture_add(uint64 value, uint size)
+{
+    uint i;
+    if (size < 2 || size > sizeof(uint64))
+        return;
+    if (size < sizeof(uint64))
+        value &= (1ULL << (size * 8)) - 1;
+    /* Small values and -1 are found by mutation alone */
+    if (value < 0x100 || value == ((size < sizeof(uint64)) ?
+                                   (1ULL << (size * 8)) - 1 : ~0ULL))
+        return;
+    dr_mutex_lock(cmp_lock);
+    for (i = 0; i < num_cmp_values; i++) {
+        if (cmp_values[i].value == value && cmp_values[i].size == size)
+            break;
+    }
+    if (i == num_cmp_values && i < CMP_VALUES_MAX) {
+        cmp_values[i].value = value;
+        cmp_values[i].size = size;
+        num_cmp_values = i + 1;
+        DRFUZZ_LOG(2, "captured %d-byte comparison value 0x"HEX64_FORMAT_STRING"\n",
+                   size, value);
+    }
+    dr_mutex_unlock(cmp_lock);
+}
+
+static void
+cmp_capture_bb(instrlist_t *bb)
+{
+#ifdef X86
+    instr_t *inst;
+    for (inst = instrlist_first_app(bb); inst != NULL; inst = instr_get_next_app(inst)) {
+        opnd_t imm;
+        if (instr_get_opcode(inst) != OP_cmp)
+            continue;
+        imm = instr_get_src(inst, 1);
+        if (!opnd_is_immed_int(imm))
+            continue;
+        cmp_capture_add((uint64) opnd_get_immed_int(imm),
+                        opnd_size_in_bytes(opnd_get_size(instr_get_src(inst, 0))));
+    }
+#endif
+}
+
 static dr_emit_flags_t
 bb_event(void *drcontext, void *tag, instrlist_t *bb,
          bool for_trace, bool translating)
@@ -363,10 +497,84 @@ bb_event(void *drcontext, void *tag, instrlist_t *bb,
         live->target->num_bbs++;
         DRFUZZ_LOG(3, "basic block "UINT64_FORMAT_STRING" @"PFX" during fuzzing "PFX"\n",
                    live->target->num_bbs, tag, live->target->func_pc);
+        if (cmp_capture)
+            cmp_capture_bb(bb);
     }
     return DR_EMIT_DEFAULT;
 }
 
+#ifdef X86
+static inline opnd_t
+edge_slot_opnd(uint slot)
+{
+    /* must use 0 scale to match what DR decodes for opnd_same */
+    return opnd_create_far_base_disp_ex(edge_seg, REG_NULL, REG_NULL, 0,
+                                        edge_offs + slot * sizeof(void *),
+                                        OPSZ_PTR, false, true, false);
+}
+#else
+static void
+edge_coverage_hit(uint id)
+{
+    byte **slots = (byte **) (dr_get_dr_segment_base(edge_seg) + edge_offs);
+    slots[EDGE_SLOT_PREV][id] = 1;
+    slots[EDGE_SLOT_PREV] = slots[EDGE_SLOT_BASE] + (id >> 1);
+}
+#endif
+
+/* Records the edge from the previous block to this one.  Threads that are not
+ * fuzzing record into edge_discard, so there is no check on the fast path.
+ * XXX: the sequence cannot fault, but we do not restore xax if DR translates
+ * an asynchronous interruption in its middle.
+ */
+static dr_emit_flags_t
+edge_event_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                  bool for_trace, bool translating, void *user_data)
+{
+    uint id;
+
+    if (!drmgr_is_first_instr(drcontext, inst))
+        return DR_EMIT_DEFAULT;
+    id = EDGE_BLOCK_ID(tag);
+#ifdef X86
+    /* mov [spill], xax
+     * mov xax, [prev]
+     * mov byte [xax + id], 1
+     * mov xax, [base]
+     * lea xax, [xax + id/2]
+     * mov [prev], xax
+     * mov xax, [spill]
+     */
+    instrlist_meta_preinsert
+        (bb, inst, INSTR_CREATE_mov_st(drcontext, edge_slot_opnd(EDGE_SLOT_SPILL),
+                                       opnd_create_reg(DR_REG_XAX)));
+    instrlist_meta_preinsert
+        (bb, inst, INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(DR_REG_XAX),
+                                       edge_slot_opnd(EDGE_SLOT_PREV)));
+    instrlist_meta_preinsert
+        (bb, inst, INSTR_CREATE_mov_st(drcontext, OPND_CREATE_MEM8(DR_REG_XAX, id),
+                                       OPND_CREATE_INT8(1)));
+    instrlist_meta_preinsert
+        (bb, inst, INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(DR_REG_XAX),
+                                       edge_slot_opnd(EDGE_SLOT_BASE)));
+    instrlist_meta_preinsert
+        (bb, inst, INSTR_CREATE_lea(drcontext, opnd_create_reg(DR_REG_XAX),
+                                    OPND_CREATE_MEM_lea(DR_REG_XAX, DR_REG_NULL, 0,
+                                                        id >> 1)));
+    instrlist_meta_preinsert
+        (bb, inst, INSTR_CREATE_mov_st(drcontext, edge_slot_opnd(EDGE_SLOT_PREV),
+                                       opnd_create_reg(DR_REG_XAX)));
+    instrlist_meta_preinsert
+        (bb, inst, INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(DR_REG_XAX),
+                                       edge_slot_opnd(EDGE_SLOT_SPILL)));
+#else
+    /* XXX: inline this for ARM too */
+    dr_insert_clean_call(drcontext, bb, inst, (void *) edge_coverage_hit, false, 1,
+                         OPND_CREATE_INT32(id));
+#endif
+    return DR_EMIT_DEFAULT;
+}
+
 DR_EXPORT drmf_status_t
 drfuzz_fuzz_target(generic_func_t func_pc, uint arg_count, uint flags, uint wrap_flags,
                    void (*pre_fuzz_cb)(void *fuzzcxt, generic_func_t target_pc,
@@ -545,6 +753,122 @@ drfuzz_get_target_num_bbs(generic_func_t func_pc, uint64 *num_bbs)
     return DRMF_SUCCESS;
 }
 
+DR_EXPORT drmf_status_t
+drfuzz_enable_edge_coverage(void)
+{
+    if (edge_coverage)
+        return DRMF_SUCCESS;
+    if (edge_threads_started)
+        return DRMF_ERROR_INVALID_CALL;
+    if (!dr_raw_tls_calloc(&edge_seg, &edge_offs, EDGE_SLOT_COUNT, 0))
+        return DRMF_ERROR;
+    if (!drmgr_register_bb_instrumentation_event(NULL, edge_event_insert, NULL)) {
+        dr_raw_tls_cfree(edge_offs, EDGE_SLOT_COUNT);
+        return DRMF_ERROR;
+    }
+    edge_map = global_alloc(EDGE_MAP_ALLOC, HEAPSTAT_MISC);
+    memset(edge_map, 0, EDGE_MAP_ALLOC);
+    edge_discard = global_alloc(EDGE_MAP_ALLOC, HEAPSTAT_MISC);
+    edge_map_lock = dr_mutex_create();
+    edge_coverage = true;
+    return DRMF_SUCCESS;
+}
+
+DR_EXPORT drmf_status_t
+drfuzz_get_new_edges(void *fuzzcxt, OUT uint *num_new_edges)
+{
+    fuzz_pass_context_t *fp = (fuzz_pass_context_t *) fuzzcxt;
+    ptr_uint_t *trace, *seen;
+    uint i, found = 0;
+
+    if (fp == NULL || num_new_edges == NULL)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    if (!edge_coverage)
+        return DRMF_ERROR_INVALID_CALL;
+    *num_new_edges = 0;
+    if (fp->edge_trace == NULL)
+        return DRMF_SUCCESS;
+
+    trace = (ptr_uint_t *) fp->edge_trace;
+    seen = (ptr_uint_t *) edge_map;
+    /* Most iterations find nothing new, so look for a new edge before locking.
+     * The seen map only gains edges, so the words skipped here stay old.
+     */
+    for (i = 0; i < EDGE_MAP_ALLOC / sizeof(ptr_uint_t); i++) {
+        if ((trace[i] & ~seen[i]) != 0)
+            break;
+    }
+    if (i < EDGE_MAP_ALLOC / sizeof(ptr_uint_t)) {
+        dr_mutex_lock(edge_map_lock);
+        for (; i < EDGE_MAP_ALLOC / sizeof(ptr_uint_t); i++) {
+            ptr_uint_t fresh = trace[i] & ~seen[i];
+            if (fresh != 0) {
+                seen[i] |= fresh;
+                /* each map byte is 0 or 1 */
+                for (; fresh != 0; fresh &= fresh - 1)
+                    found++;
+            }
+        }
+        num_edges += found;
+        dr_mutex_unlock(edge_map_lock);
+    }
+    memset(fp->edge_trace, 0, EDGE_MAP_ALLOC);
+    DRFUZZ_LOG(3, "%d new edges, "UINT64_FORMAT_STRING" in total\n", found, num_edges);
+    *num_new_edges = found;
+    return DRMF_SUCCESS;
+}
+
+DR_EXPORT drmf_status_t
+drfuzz_get_num_edges(OUT uint64 *num)
+{
+    if (num == NULL)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    if (!edge_coverage)
+        return DRMF_ERROR_INVALID_CALL;
+    *num = num_edges;
+    return DRMF_SUCCESS;
+}
+
+DR_EXPORT drmf_status_t
+drfuzz_enable_cmp_capture(void)
+{
+#ifdef X86
+    if (cmp_capture)
+        return DRMF_SUCCESS;
+    cmp_values = global_alloc(CMP_VALUES_MAX * sizeof(*cmp_values), HEAPSTAT_MISC);
+    cmp_lock = dr_mutex_create();
+    cmp_capture = true;
+    return DRMF_SUCCESS;
+#else
+    return DRMF_ERROR_NOT_IMPLEMENTED;
+#endif
+}
+
+DR_EXPORT drmf_status_t
+drfuzz_get_num_cmp_values(OUT uint *num)
+{
+    if (num == NULL)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    if (!cmp_capture)
+        return DRMF_ERROR_INVALID_CALL;
+    *num = num_cmp_values;
+    return DRMF_SUCCESS;
+}
+
+DR_EXPORT drmf_status_t
+drfuzz_get_cmp_value(uint index, OUT uint64 *value, OUT uint *size)
+{
+    if (value == NULL || size == NULL)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    if (!cmp_capture)
+        return DRMF_ERROR_INVALID_CALL;
+    if (index >= num_cmp_values)
+        return DRMF_ERROR_NOT_FOUND;
+    *value = cmp_values[index].value;
+    *size = cmp_values[index].size;
+    return DRMF_SUCCESS;
+}
+
 DR_EXPORT drmf_status_t
 drfuzz_get_arg(void *fuzzcxt, generic_func_t target_pc, int arg, bool original,
                OUT void **arg_value)
@@ -579,6 +903,17 @@ drfuzz_set_arg(void *fuzzcxt, int arg, void *val)
         return DRMF_ERROR;
 }
 
+DR_EXPORT drmf_status_t
+drfuzz_set_repeat_pc(void *fuzzcxt, app_pc pc)
+{
+    fuzz_pass_context_t *fp = (fuzz_pass_context_t *) fuzzcxt;
+
+    if (fp == NULL || fp->live_targets == NULL)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    fp->live_targets->repeat_pc = pc;
+    return DRMF_SUCCESS;
+}
+
 DR_EXPORT drmf_status_t
 drfuzz_get_target_user_data(IN generic_func_t target_pc, OUT void **user_data)
 {
@@ -723,6 +1058,19 @@ pre_fuzz_handler(void *wrapcxt, INOUT void **user_data)
     *live->unclobber.retaddr_loc = live->unclobber.retaddr; /* restore retaddr to stack */
 #endif
 
+    if (edge_coverage) {
+        if (fp->edge_trace == NULL) {
+            fp->edge_trace = thread_alloc(dcontext, EDGE_MAP_ALLOC, HEAPSTAT_MISC);
+            memset(fp->edge_trace, 0, EDGE_MAP_ALLOC);
+        } else if (is_target_entry && live->next == NULL) {
+            /* drop edges from app code run since the last fuzz pass */
+            memset(fp->edge_trace, 0, EDGE_MAP_ALLOC);
+        }
+        /* each iteration starts with no previous block */
+        fp->edge_slots[EDGE_SLOT_BASE] = fp->edge_trace;
+        fp->edge_slots[EDGE_SLOT_PREV] = fp->edge_trace;
+    }
+
     target->pre_fuzz_cb(fp, (generic_func_t) target_to_fuzz, mc);
     drwrap_set_mcontext(wrapcxt);
     for (i = 0; i < target->arg_count; i++)
@@ -752,17 +1100,26 @@ post_fuzz_handler(void *wrapcxt, void *user_data)
          * is a different retaddr for our repeating function.
          */
         IF_ARM(mc->lr = live->lr);
-        mc->pc = live->target->func_pc;
+        if (live->repeat_pc != NULL) {
+            mc->pc = live->repeat_pc;
+            live->repeat_pc = NULL;
+        } else
+            mc->pc = live->target->func_pc;
         IF_DEBUG(redirect_status =) drwrap_redirect_execution(wrapcxt);
-        DRFUZZ_LOG(4, "fuzz target "PFX" requesting redirect to self entry; result: %d\n",
-                   live->target->func_pc, live->target->func_pc, redirect_status);
+        DRFUZZ_LOG(4, "fuzz target "PFX" requesting redirect to "PFX"; result: %d\n",
+                   live->target->func_pc, mc->pc, redirect_status);
     } else { /* the current target is finished, so pop from live stack and cache it */
         fp->live_targets = live->next;   /* pop from live stack */
         live->next = fp->cached_targets; /* push to cached stack */
         fp->cached_targets = live;
 
-        if (fp->live_targets == NULL) /* clear cached targets after fuzz pass has ended */
+        if (fp->live_targets == NULL) { /* the fuzz pass has ended */
             clear_cached_targets(fp);
+            if (edge_coverage) {
+                fp->edge_slots[EDGE_SLOT_BASE] = edge_discard;
+                fp->edge_slots[EDGE_SLOT_PREV] = edge_discard;
+            }
+        }
     }
 }
 
@@ -1055,6 +1412,7 @@ static drfuzz_mutator_api_t default_mutator = {
     drfuzz_mutator_get_next_value,
     drfuzz_mutator_stop,
     drfuzz_mutator_feedback,
+    drfuzz_mutator_add_token,
 };
 
 DR_EXPORT drmf_status_t
@@ -1107,6 +1465,8 @@ drfuzz_mutator_load(IN const char *lib_path, INOUT drfuzz_mutator_api_t *api)
         dr_unload_aux_library(api->handle);
         return DRMF_ERROR;
     }
+    /* Optional: added in version 2 */
+    BINDFUNC(api, func, drfuzz_mutator_add_token);
 
     return DRMF_SUCCESS;
 }
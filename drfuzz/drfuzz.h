@@ -388,6 +388,97 @@ DR_EXPORT
 drmf_status_t
 drfuzz_get_target_num_bbs(IN generic_func_t target_pc, OUT uint64 *num_bbs);
 
+DR_EXPORT
+/**
+ * Enable edge coverage.  Every basic block records the control flow edge that
+ * reached it into a hashed bitmap that is private to its thread, via a short
+ * inline sequence that does not affect the arithmetic flags.  Each thread
+ * starts a new trace at the start of each fuzz iteration, and the edges of
+ * code executed outside of fuzzing are not recorded.  Use
+ * drfuzz_get_new_edges() to find which iterations reach new edges.
+ *
+ * Must be called before any thread initialization event, e.g., from
+ * dr_client_main(); returns DRMF_ERROR_INVALID_CALL otherwise.
+ *
+ * \note Distinct edges may share a bitmap entry, so the edge counts are a
+ * lower bound.
+ */
+drmf_status_t
+drfuzz_enable_edge_coverage(void);
+
+DR_EXPORT
+/**
+ * Merge the edges traced by \p fuzzcxt's thread since its last call (or since
+ * the start of its fuzz pass) into the set of edges seen by all threads, and
+ * start a new trace.  Intended to be called from the post_fuzz callback.
+ *
+ * @param[in] fuzzcxt         The fuzz context of the calling thread.
+ * @param[out] num_new_edges  Returns the number of traced edges that no
+ *                            thread had reached before.
+ *
+ * Returns DRMF_ERROR_INVALID_CALL if drfuzz_enable_edge_coverage() has not
+ * succeeded.
+ */
+drmf_status_t
+drfuzz_get_new_edges(IN void *fuzzcxt, OUT uint *num_new_edges);
+
+DR_EXPORT
+/**
+ * Get the number of distinct edges that drfuzz_get_new_edges() has merged
+ * from all threads.
+ *
+ * Returns DRMF_ERROR_INVALID_CALL if drfuzz_enable_edge_coverage() has not
+ * succeeded.
+ */
+drmf_status_t
+drfuzz_get_num_edges(OUT uint64 *num_edges);
+
+DR_EXPORT
+/**
+ * Enable comparison capture.  Whenever a thread that is executing a fuzz target
+ * builds a basic block, the immediate operands of the block's compare
+ * instructions, such as magic numbers and tags that the target checks its input
+ * against, are recorded for all threads.  Values of one byte, small values and
+ * all-ones values are not recorded.  Use drfuzz_get_num_cmp_values() and
+ * drfuzz_get_cmp_value() to retrieve the values, e.g., to add them to a
+ * mutator's dictionary with drfuzz_mutator_add_token().
+ *
+ * \note Only blocks built while fuzzing are examined, so a block that was
+ * first executed outside of fuzzing does not contribute, nor does a comparison
+ * against a value in memory.  Currently only supported on x86; returns
+ * DRMF_ERROR_NOT_IMPLEMENTED elsewhere.
+ */
+drmf_status_t
+drfuzz_enable_cmp_capture(void);
+
+DR_EXPORT
+/**
+ * Get the number of values recorded so far by comparison capture.  Values are
+ * only added, so a caller can keep its own count to find new values.
+ *
+ * Returns DRMF_ERROR_INVALID_CALL if drfuzz_enable_cmp_capture() has not
+ * succeeded.
+ */
+drmf_status_t
+drfuzz_get_num_cmp_values(OUT uint *num_values);
+
+DR_EXPORT
+/**
+ * Get the value recorded by comparison capture at \p index, which must be less
+ * than the count returned by drfuzz_get_num_cmp_values().
+ *
+ * @param[in] index   The index of the value.
+ * @param[out] value  Returns the value, zero-extended.
+ * @param[out] size   Returns the size in bytes of the compared operand.  The
+ *                    value as it appears in memory is its low \p size bytes in
+ *                    the target's byte order.
+ *
+ * Returns DRMF_ERROR_NOT_FOUND if \p index is out of range, and
+ * DRMF_ERROR_INVALID_CALL if drfuzz_enable_cmp_capture() has not succeeded.
+ */
+drmf_status_t
+drfuzz_get_cmp_value(uint index, OUT uint64 *value, OUT uint *size);
+
 DR_EXPORT
 /**
  * Get the value of an argument to the fuzz target function at \p target_pc. May only be
@@ -417,6 +508,23 @@ DR_EXPORT
 drmf_status_t
 drfuzz_set_arg(void *fuzzcxt, int arg, void *val);
 
+DR_EXPORT
+/**
+ * Redirect the next repetition of the current fuzz target to \p pc instead of
+ * to the start of the target function. May only be called from a post-fuzz
+ * callback that returns true, and applies to that repetition only.
+ *
+ * Execution resumes at \p pc with the stack pointer restored to its value at
+ * entry to the target, as it is for a regular repetition. The code at \p pc
+ * must eventually jump to the start of the target function without changing
+ * the stack pointer, running as application code (e.g., code generated by the
+ * client). The target's arguments are reset to their original values at the
+ * start of the target as usual, so this code may clobber the registers that
+ * hold arguments and the scratch registers of the calling convention.
+ */
+drmf_status_t
+drfuzz_set_repeat_pc(void *fuzzcxt, app_pc pc);
+
 DR_EXPORT
 /**
  * Get the user data associated with the \p target_pc.
@@ -127,6 +127,10 @@ typedef struct _mutator_t  {
      * the caller to synchronize access to the mutator.
      */
     drvector_t dictionary;
+    /* The dictionary's tokens as a trie, for finding them in the buffer */
+    struct _trie_node_t *trie;
+    uint trie_nodes;
+    uint trie_capacity;
 } mutator_t;
 
 static bitflip_t *
@@ -198,10 +202,121 @@ dictionary_init(mutator_t *mutator)
     drvector_init(&mutator->dictionary, DICT_INIT_CAP, false/*!sync*/, token_free);
 }
 
+/* The dictionary is also kept as a trie so that the random token mutation can
+ * find the tokens already in the buffer, to replace them or to insert at their
+ * boundaries, with one walk per position rather than a comparison against each
+ * token.  Children are sibling lists, as dictionaries have few tokens and most
+ * nodes have one child.  Node 0 is the root.
+ */
+#define TRIE_INIT_CAP 256
+
+typedef struct _trie_node_t {
+    uint child;   /* index of the first child, or 0 */
+    uint sibling; /* index of the next sibling, or 0 */
+    uint token;   /* 1 + the dictionary index of the token ending here, or 0 */
+    byte label;
+} trie_node_t;
+
+static uint
+trie_new_node(mutator_t *mutator, byte label)
+{
+    trie_node_t *node;
+    if (mutator->trie_nodes == mutator->trie_capacity) {
+        uint capacity = (mutator->trie_capacity == 0) ? TRIE_INIT_CAP :
+            mutator->trie_capacity * 2;
+        trie_node_t *grown = global_alloc(capacity * sizeof(*grown), HEAPSTAT_MISC);
+        if (mutator->trie != NULL) {
+            memcpy(grown, mutator->trie, mutator->trie_nodes * sizeof(*grown));
+            global_free(mutator->trie, mutator->trie_capacity * sizeof(*grown),
+                        HEAPSTAT_MISC);
+        }
+        mutator->trie = grown;
+        mutator->trie_capacity = capacity;
+    }
+    node = &mutator->trie[mutator->trie_nodes];
+    memset(node, 0, sizeof(*node));
+    node->label = label;
+    return mutator->trie_nodes++;
+}
+
+/* Returns the child of node labeled with value, or 0 */
+static inline uint
+trie_child(mutator_t *mutator, uint node, byte value)
+{
+    uint child = mutator->trie[node].child;
+    while (child != 0 && mutator->trie[child].label != value)
+        child = mutator->trie[child].sibling;
+    return child;
+}
+
+/* Adds the token with dictionary index index.  Returns false if it is already
+ * in the trie.
+ */
+static bool
+trie_add(mutator_t *mutator, const byte *data, size_t size, uint index)
+{
+    uint node = 0, i;
+    if (mutator->trie_nodes == 0)
+        trie_new_node(mutator, 0); /* the root */
+    for (i = 0; i < size; i++) {
+        uint child = trie_child(mutator, node, data[i]);
+        if (child == 0) {
+            /* trie_new_node() may move the array, so we index rather than point */
+            child = trie_new_node(mutator, data[i]);
+            mutator->trie[child].sibling = mutator->trie[node].child;
+            mutator->trie[node].child = child;
+        }
+        node = child;
+    }
+    if (mutator->trie[node].token != 0)
+        return false;
+    mutator->trie[node].token = index + 1;
+    return true;
+}
+
+/* Returns the size of the longest token that data starts with, or 0 */
+static size_t
+trie_longest_match(mutator_t *mutator, const byte *data, size_t size)
+{
+    uint node = 0;
+    size_t i, match = 0;
+    if (mutator->trie_nodes == 0)
+        return 0;
+    for (i = 0; i < size; i++) {
+        node = trie_child(mutator, node, data[i]);
+        if (node == 0)
+            break;
+        if (mutator->trie[node].token != 0)
+            match = i + 1;
+    }
+    return match;
+}
+
+/* Takes ownership of token.  Returns false, having freed it, if it is a
+ * duplicate.
+ */
+static bool
+dictionary_add(mutator_t *mutator, token_t *token)
+{
+    if (!trie_add(mutator, token->data, token->size, mutator->dictionary.entries)) {
+        DRFUZZ_LOG(3, "dropping duplicate token |%.*s|\n", token->size,
+                   (char *)token->data/*XXX: may be non-ascii!*/);
+        token_free(token);
+        return false;
+    }
+    drvector_append(&mutator->dictionary, token);
+    return true;
+}
+
 static void
 dictionary_free(mutator_t *mutator)
 {
     drvector_delete(&mutator->dictionary);
+    if (mutator->trie != NULL) {
+        global_free(mutator->trie, mutator->trie_capacity * sizeof(*mutator->trie),
+                    HEAPSTAT_MISC);
+        mutator->trie = NULL;
+    }
 }
 
 static bool
@@ -288,7 +403,9 @@ drfuzz_parse_dictionary(const char *file, mutator_t *mutator)
         DRFUZZ_LOG(3, "appending token cap=%d size=%d |%.*s|\n", token->capacity,
                    token->size, token->size,
                    (char *)token->data/*XXX: may be non-ascii!*/);
-        drvector_append(&mutator->dictionary, token);
+        dictionary_add(mutator, token);
+        /* owned by the dictionary, or freed as a duplicate */
+        token = NULL;
     }
     res = true;
     token = NULL;
@@ -609,6 +726,20 @@ generate_random_number(mutator_t *mutator)
     return (mutator->options.random_seed * XORSHIFT_MULTIPLIER);
 }
 
+/* Returns a random number in [0, bound).  For bounds that fit in 32 bits this scales
+ * the high half of the random number instead of dividing, which is the common case
+ * on our hot paths (picking bits and token positions).
+ */
+static inline uint64
+generate_random_below(mutator_t *mutator, uint64 bound)
+{
+    uint64 value = generate_random_number(mutator);
+    ASSERT(bound > 0, "random bound must be non-zero");
+    if (bound <= 0xffffffffULL)
+        return ((value >> 32) * bound) >> 32;
+    return value % bound;
+}
+
 static drmf_status_t
 get_next_random_number(mutator_t *mutator, void *buffer)
 {
@@ -635,35 +766,134 @@ get_next_random_number(mutator_t *mutator, void *buffer)
     } else {
         if (mutator->size > sizeof(uint64))
             return DRMF_ERROR; /* cannot cap a non-integer value */
-        value = generate_random_number(mutator) % mutator->options.max_value;
+        value = generate_random_below(mutator, mutator->options.max_value);
         return write_scalar(buffer, mutator->size, value);
     }
 }
 
-static drmf_status_t
-get_next_random_token(mutator_t *mutator, void *buffer)
+/* The random token mutation picks one of these at random */
+typedef enum _token_op_t {
+    TOKEN_OP_OVERWRITE, /* overwrite at a random offset, with separators */
+    TOKEN_OP_INSERT,    /* insert at a token boundary, shifting the rest */
+    TOKEN_OP_REPLACE,   /* replace a dictionary token found in the buffer */
+    TOKEN_OP_COUNT,
+} token_op_t;
+
+static inline bool
+token_is_word_byte(byte b)
+{
+    return ((b >= '0' && b <= '9') || (b >= 'a' && b <= 'z') ||
+            (b >= 'A' && b <= 'Z') || b == '_');
+}
+
+/* Whether offs is at the start or end of a word, or adjacent to punctuation,
+ * whitespace or binary data: i.e., whether a token could start there.
+ */
+static inline bool
+token_boundary(const byte *buf, size_t size, size_t offs)
+{
+    return (offs == 0 || offs >= size ||
+            !token_is_word_byte(buf[offs - 1]) || !token_is_word_byte(buf[offs]));
+}
+
+/* Moves the bytes at [from, size) to start at to, truncating at the end of the
+ * buffer.  Bytes left behind by a move to a lower offset are set to separators.
+ */
+static void
+token_shift(mutator_t *mutator, byte *buf, size_t from, size_t to)
+{
+    size_t size = mutator->size;
+    if (to == from)
+        return;
+    if (to < size)
+        memmove(buf + to, buf + from, MIN(size - from, size - to));
+    if (to < from)
+        memset(buf + size - (from - to), token_separator(mutator), from - to);
+}
+
+static void
+token_insert(mutator_t *mutator, byte *buf, token_t *token)
+{
+    size_t size = mutator->size, offs, len;
+    bool lead, trail;
+    offs = (size_t) generate_random_below(mutator, size);
+    while (offs < size && !token_boundary(buf, size, offs))
+        offs++;
+    if (offs == size)
+        offs = 0;
+    /* Only separate the token from words it would run into */
+    lead = (offs > 0 && token->size > 0 && token_is_word_byte(buf[offs - 1]) &&
+            token_is_word_byte(token->data[0]));
+    trail = (token->size > 0 && token_is_word_byte(buf[offs]) &&
+             token_is_word_byte(token->data[token->size - 1]));
+    len = (lead ? 1 : 0) + token->size + (trail ? 1 : 0);
+    token_shift(mutator, buf, offs, offs + len);
+    if (lead)
+        buf[offs++] = token_separator(mutator);
+    memcpy(buf + offs, token->data, MIN(token->size, size - offs));
+    offs += token->size;
+    if (trail && offs < size)
+        buf[offs] = token_separator(mutator);
+}
+
+/* Replaces the first whole dictionary token found at or after a random offset.
+ * Returns false if the buffer contains none.
+ */
+static bool
+token_replace(mutator_t *mutator, byte *buf, token_t *token)
+{
+    size_t size = mutator->size, start, i, offs, match = 0;
+    start = (size_t) generate_random_below(mutator, size);
+    for (i = 0; i < size; i++) {
+        offs = (start + i) % size;
+        if (!token_boundary(buf, size, offs))
+            continue;
+        match = trie_longest_match(mutator, buf + offs, size - offs);
+        if (match > 0 && token_boundary(buf, size, offs + match))
+            break;
+        match = 0;
+    }
+    if (match == 0)
+        return false;
+    token_shift(mutator, buf, offs + match, offs + token->size);
+    memcpy(buf + offs, token->data, MIN(token->size, size - offs));
+    return true;
+}
+
+static void
+token_overwrite(mutator_t *mutator, byte *buffer, token_t *token)
 {
-    uint64 rand_which_tok = generate_random_number(mutator);
-    uint64 rand_where = generate_random_number(mutator);
     size_t offs;
-    token_t *token = drvector_get_entry(&mutator->dictionary,
-                                        rand_which_tok % mutator->dictionary.entries);
-    /* XXX: there are multiple strategies that could be followed here,
-     * such as looking for a separator to avoid splitting an existing token,
-     * or shifting existing data to avoid overwriting existing tokens.
-     * Shifting is time-consuming and risky for our execution model (we'd
-     * have to reallocate the input buffer).
-     * We simply insert our own separators around our token.
-     */
+    /* We do not shift here, so we insert our own separators around our token */
     offs = token->size >= mutator->size ? 0 :
-        (rand_where % (mutator->size - token->size));
+        (size_t) generate_random_below(mutator, mutator->size - token->size);
     memcpy((byte *)buffer + offs, token->data, MIN(token->size, mutator->size));
     /* We separate this from the existing data with separators */
     if (offs > 0)
         *((char *)buffer + offs - 1) = token_separator(mutator);
     if (offs + token->size < mutator->size)
         *((char *)buffer + offs + token->size) = token_separator(mutator);
+}
 
+static drmf_status_t
+get_next_random_token(mutator_t *mutator, void *buffer)
+{
+    token_t *token = (token_t *)
+        drvector_get_entry(&mutator->dictionary, (uint)
+                           generate_random_below(mutator, mutator->dictionary.entries));
+    /* The buffer has a fixed size, so shifting truncates at its end */
+    switch ((token_op_t) generate_random_below(mutator, TOKEN_OP_COUNT)) {
+    case TOKEN_OP_REPLACE:
+        if (token_replace(mutator, (byte *) buffer, token))
+            break;
+        /* no token to replace: fall through to insert one */
+    case TOKEN_OP_INSERT:
+        token_insert(mutator, (byte *) buffer, token);
+        break;
+    default:
+        token_overwrite(mutator, (byte *) buffer, token);
+        break;
+    }
     return DRMF_SUCCESS;
 }
 
@@ -741,6 +971,24 @@ drfuzz_mutator_feedback(drfuzz_mutator_t *mutator_in, int feedback)
     return DRMF_SUCCESS;
 }
 
+LIB_EXPORT drmf_status_t
+drfuzz_mutator_add_token(drfuzz_mutator_t *mutator_in, IN const void *data,
+                         IN size_t size)
+{
+    mutator_t *mutator = (mutator_t *) mutator_in;
+    token_t *token;
+    if (mutator == NULL || data == NULL || size == 0 ||
+        !CHECK_TRUNCATE_RANGE_ushort(size))
+        return DRMF_ERROR_INVALID_PARAMETER;
+    if (mutator->options.unit != MUTATOR_UNIT_TOKEN)
+        return DRMF_ERROR_FEATURE_NOT_AVAILABLE;
+    token = token_alloc(size);
+    memcpy(token->data, data, size);
+    token->size = (ushort) size;
+    dictionary_add(mutator, token);
+    return DRMF_SUCCESS;
+}
+
 /***************************************************************************************
  * BIT FLIP ALGORITHM
  */
@@ -756,6 +1004,12 @@ drfuzz_mutator_feedback(drfuzz_mutator_t *mutator_in, int feedback)
  */
 
 #define SIZEOF_SHUFFLE(f) (f->bit_count * sizeof(short))
+/* Up to this fraction of the bits, a random flip resets just the shuffle entries it
+ * touched, which are recorded in `picks`, instead of clearing the whole workspace.
+ */
+#define SHUFFLE_PICKS_DIVISOR 8
+#define SHUFFLE_PICKS_CAPACITY(f) (f->bit_count / SHUFFLE_PICKS_DIVISOR)
+#define SIZEOF_SHUFFLE_PICKS(f) (SHUFFLE_PICKS_CAPACITY(f) * sizeof(uint))
 
 struct _bitflip_t {
     uint bit_count;    /* total bits in the target buffer (derived from mutator->size) */
@@ -763,6 +1017,8 @@ struct _bitflip_t {
     uint *index;       /* array of bit positions to flip next */
     uint *last_index;  /* cached reference to the most frequently accessed bit index */
     short *shuffle;    /* workspace for Fisher-Yates shuffle, used for random flip */
+    uint *picks;       /* shuffle entries touched by the last random flip, if few */
+    uint num_picks;    /* entries in `picks`, or UINT_MAX if `shuffle` needs a memset */
 };
 
 /* Start a new traversal of the loops iterated by `loop_index` and all indexes that
@@ -801,8 +1057,12 @@ bitflip_create(mutator_t *mutator)
     memset(f, 0, sizeof(bitflip_t));
     f->bit_count = 8 * mutator->size * sizeof(byte);
     bitflip_init_bits_to_flip(f, 1);
-    if (mutator->options.alg == MUTATOR_ALG_RANDOM)
+    if (mutator->options.alg == MUTATOR_ALG_RANDOM) {
         f->shuffle = global_alloc(SIZEOF_SHUFFLE(f), HEAPSTAT_MISC);
+        memset(f->shuffle, 0, SIZEOF_SHUFFLE(f));
+        if (SHUFFLE_PICKS_CAPACITY(f) > 0)
+            f->picks = global_alloc(SIZEOF_SHUFFLE_PICKS(f), HEAPSTAT_MISC);
+    }
     return f;
 }
 
@@ -814,6 +1074,8 @@ bitflip_destroy(bitflip_t *f)
         global_free(f->index, sizeof(uint) * f->bits_to_flip, HEAPSTAT_MISC);
     if (f->shuffle != NULL)
         global_free(f->shuffle, SIZEOF_SHUFFLE(f), HEAPSTAT_MISC);
+    if (f->picks != NULL)
+        global_free(f->picks, SIZEOF_SHUFFLE_PICKS(f), HEAPSTAT_MISC);
     global_free(f, sizeof(bitflip_t), HEAPSTAT_MISC);
 }
 
@@ -840,11 +1102,24 @@ bitflip_shuffle_and_flip(mutator_t *mutator, void *buffer)
     #define SHUFFLE_ABSOLUTE_VALUE(k) ((k) + f->shuffle[k])
     #define SHUFFLE_RELATIVE_VALUE(k, v) ((short) ((v) - k))
 
-    memset(f->shuffle, 0, SIZEOF_SHUFFLE(f));
+    /* Reset the workspace from the prior flip.  Flipping a few bits of a large buffer
+     * is the common case, where clearing the whole workspace would dominate.
+     */
+    if (f->num_picks == UINT_MAX)
+        memset(f->shuffle, 0, SIZEOF_SHUFFLE(f));
+    else {
+        for (i = 0; i < f->num_picks; i++)
+            f->shuffle[f->picks[i]] = 0;
+    }
+    f->num_picks = f->bits_to_flip <= SHUFFLE_PICKS_CAPACITY(f) ? f->bits_to_flip :
+        UINT_MAX;
+
     for (i = 0, pick_count = f->bit_count; pick_count > total_picks; i++, pick_count--) {
-        pick = i + (generate_random_number(mutator) % pick_count);
+        pick = i + (uint) generate_random_below(mutator, pick_count);
         flip_bit(buffer, SHUFFLE_ABSOLUTE_VALUE(pick));
         f->shuffle[pick] = SHUFFLE_RELATIVE_VALUE(pick, SHUFFLE_ABSOLUTE_VALUE(i));
+        if (f->num_picks != UINT_MAX)
+            f->picks[i] = pick;
     }
     ASSERT(i == f->bits_to_flip, "shuffled wrong number of bits");
 }
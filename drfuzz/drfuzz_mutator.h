@@ -87,7 +87,7 @@ typedef void * drfuzz_mutator_t;
 #define DRFUZZLIB_VERSION_CUR_VAR    _DRFUZZLIB_VERSION_CUR_
 #ifndef DYNAMIC_INTERFACE
 LIB_EXPORT LINK_ONCE int DRFUZZLIB_VERSION_COMPAT_VAR = 1;
-LIB_EXPORT LINK_ONCE int DRFUZZLIB_VERSION_CUR_VAR    = 1;
+LIB_EXPORT LINK_ONCE int DRFUZZLIB_VERSION_CUR_VAR    = 2;
 #endif
 #define DRFUZZLIB_VERSION_COMPAT_NAME STRINGIFY(DRFUZZLIB_VERSION_COMPAT_VAR)
 #define DRFUZZLIB_VERSION_CUR_NAME    STRINGIFY(DRFUZZLIB_VERSION_CUR_VAR)
@@ -150,6 +150,22 @@ LIB_EXPORT
 drmf_status_t
 LIBFUNC(drfuzz_mutator_feedback)(drfuzz_mutator_t *mutator, int feedback);
 
+LIB_EXPORT
+/**
+ * Adds a token of \p size bytes at \p data to the mutator's dictionary, e.g., a
+ * value that the target was seen to compare against (see
+ * drfuzz_enable_cmp_capture()).  The default mutator only accepts tokens when it
+ * was started with a \p -dictionary and ignores a token that is already in its
+ * dictionary.  Returns DRMF_ERROR_FEATURE_NOT_AVAILABLE if the mutator does not
+ * mutate by dictionary tokens.
+ *
+ * \note This export was added in version 2 of the interface and is optional:
+ * drfuzz_mutator_load() sets it to NULL for a library that does not provide it.
+ */
+drmf_status_t
+LIBFUNC(drfuzz_mutator_add_token)(drfuzz_mutator_t *mutator, IN const void *data,
+                                  IN size_t size);
+
 /*@}*/ /* end doxygen group */
 
 #ifdef __cplusplus
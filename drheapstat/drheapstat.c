@@ -35,6 +35,7 @@
 #include "callstack.h"
 #include "crypto.h"
 #include "staleness.h"
+#include "snapshot_binary.h"
 #include "../drmemory/leak.h"
 #include "../drmemory/stack.h"
 #include "../drmemory/shadow.h"
@@ -64,6 +65,7 @@ typedef struct _instru_info_t {
     instr_t *where_dead;
     bool flags_dead;
     uint instrs_in_bb;
+    bool stale_sample; /* whether to instrument memrefs for staleness */
 } instru_info_t;
 
 char logsubdir[MAXIMUM_PATH];
@@ -78,6 +80,18 @@ static int instr_count;
 static int byte_count;
 static int allocfree_count;
 
+/* For -time_instrs, each thread counts down from instr_chunk in a raw TLS
+ * slot of its own, as a shared counter updated from every bb on every thread
+ * thrashes its cache line.  Only the instrumentation at loop edges checks
+ * the thread counter: once it goes negative, the shared callout subtracts
+ * what the thread executed from instr_count, which is protected by
+ * snapshot_lock.
+ */
+#define INSTR_CHUNK_MAX (16*1024)
+static int instr_chunk;
+static reg_id_t instrcnt_seg;
+static uint instrcnt_offs;
+
 /* For -time_clock, the frequency is -dump_freq*10 milliseconds */
 #define TIME_BASE_FREQ 10
 /* These are all in milliseconds */
@@ -85,6 +99,12 @@ static uint timer_clock;
 static uint timer_stale;
 static uint timer_real;
 
+/* For -stale_sample, whether we instrument memory references in the current
+ * staleness interval
+ */
+static volatile bool stale_sampling = true;
+static uint stale_intervals;
+
 /* Needed to compute the current partial snapshot (PR 548013) */
 uint64 timestamp_last_snapshot;
 
@@ -125,6 +145,13 @@ static void *snapshot_lock;
 
 static void reset_clock_timer(void);
 static void reset_real_timer(void);
+static void snapshot_fold_deltas(void);
+static void snapshot_apply_usage(per_callstack_t *per, int instances, int mallocs,
+                                 int asked_for, int extra_usable, int extra_occupied);
+static void snapshot_prune_used(per_callstack_t *per);
+static file_t open_logfile(const char *name, bool pid_log, int which_thread);
+static void close_file(file_t f);
+static uint64 instrcnt_pending(void);
 static void event_thread_exit(void *drcontext);
 
 #ifdef STATISTICS
@@ -134,6 +161,9 @@ dump_statistics(void);
 uint alloc_stack_count;
 static uint peaks_detected;
 static uint peaks_skipped;
+static uint delta_folds;
+static uint stale_sample_flushes;
+static uint sites_merged;
 #endif
 
 /* PR 465174: share allocation site callstacks.
@@ -159,6 +189,11 @@ typedef struct _tls_heapstat_t {
 # ifdef UNIX
     int64 filepos; /* f_callstack file position */
 # endif
+    struct _snap_delta_t *delta; /* NULL if -thread_delta_max is 0 */
+    /* For -time_instrs: our raw TLS counter, and our entry in instrcnt_threads */
+    int *instrcnt;
+    struct _tls_heapstat_t *instrcnt_next;
+    struct _tls_heapstat_t *instrcnt_prev;
 } tls_heapstat_t;
 
 /* XXX: share w/ syscall_os.h */
@@ -170,6 +205,9 @@ typedef struct _tls_heapstat_t {
 
 static int tls_idx_heapstat = -1;
 
+/* For -time_instrs, protected by snapshot_lock */
+static tls_heapstat_t *instrcnt_threads;
+
 /***************************************************************************
  * OPTIONS
  */
@@ -297,16 +335,91 @@ struct _per_callstack_t {
     heap_used_t *used;
     /* for node removal w/o keeping a prev per heap_used_t per snapshot */
     heap_used_t *prev_used;
+    /* for -collapsed_stacks, symbolized when a snapshot is written */
+    packed_callstack_t *pcs;
+    /* for -merge_small_sites: consecutive snapshots below the threshold */
+    uint small_streak;
+    /* for -merge_small_sites: small_sites once merged, else NULL */
+    per_callstack_t *merged;
 };
 
+/* For -merge_small_sites: the usage of each merged allocation site is moved
+ * here, along with its later allocations.  Not in alloc_stack_table.
+ * Protected by malloc_lock().
+ */
+static per_callstack_t *small_sites;
+
+/* Each thread accumulates its changes in usage per callstack in a
+ * snap_delta_t so that allocs and frees do not have to touch the live
+ * snapshot.  The deltas of all threads are folded into the live snapshot
+ * together, so that a free of another thread's allocation can never drive a
+ * count negative: at each snapshot, at thread exit, and when a thread's table
+ * fills up or its changes exceed -thread_delta_max bytes.
+ * All protected by malloc_lock(), which we hold for every alloc and free
+ * via alloc_ops.global_lock.  Folding also requires snapshot_lock.
+ */
+#define DELTA_TABLE_BITS 6
+#define DELTA_TABLE_SIZE (1 << DELTA_TABLE_BITS)
+/* Keep the open-addressed table sparse for short probes */
+#define DELTA_TABLE_MAX_USED (DELTA_TABLE_SIZE / 2)
+
+typedef struct _heap_delta_t {
+    per_callstack_t *callstack; /* NULL if unused */
+    int instances;
+    int mallocs;
+    int bytes_asked_for;
+    int extra_usable;
+    int extra_occupied;
+} heap_delta_t;
+
+typedef struct _snap_delta_t {
+    heap_delta_t entry[DELTA_TABLE_SIZE];
+    uint num_used;
+    /* Net change in tot_bytes_occupied, for estimating peaks */
+    int64 tot_bytes_occupied;
+    /* Sum of the sizes of all changes, bounding the error of the estimate */
+    uint64 unfolded;
+    struct _snap_delta_t *next;
+    struct _snap_delta_t *prev;
+} snap_delta_t;
+
+static snap_delta_t *snap_delta_list;
+
 static uint num_callstacks;
 static uint snapshot_count;
 static uint nudge_count;
 
+/* For -binary_snapshots: the usage of each callstack id as of the last
+ * SNAPSHOT record written, which the next one is a delta against.
+ * All protected by snapshot_lock.
+ */
+typedef struct _snap_bin_used_t {
+    uint instances;
+    uint bytes_asked_for;
+    ushort extra_usable;
+    ushort extra_occupied;
+    uint seen; /* snap_bin_written when last present */
+} snap_bin_used_t;
+
+static snap_bin_used_t *snap_bin_prev;
+static uint snap_bin_prev_max;
+/* One entry per SNAPSHOT record, written as the footer at exit */
+static snap_bin_index_t *snap_bin_index;
+static uint snap_bin_index_max;
+static uint snap_bin_written;
+static uint64 snap_bin_key_offset;
+
+/* Merged sites forward to small_sites, which is never itself merged */
+static inline per_callstack_t *
+cstack_resolve_merged(per_callstack_t *per)
+{
+    return (per->merged != NULL) ? per->merged : per;
+}
+
 uint
 get_cstack_id(per_callstack_t *per)
 {
-    return per->id;
+    return cstack_resolve_merged(per)->id;
 }
 
 static inline per_callstack_t *
@@ -316,15 +429,17 @@ get_cstack_from_alloc_data(void *client_data)
      * client_data slot in each malloc
      */
     if (options.staleness)
-        return ((stale_per_alloc_t *)client_data)->cstack;
+        return cstack_resolve_merged(((stale_per_alloc_t *)client_data)->cstack);
     else
-        return (per_callstack_t *) client_data;
+        return cstack_resolve_merged((per_callstack_t *) client_data);
 }
 
 void
 alloc_callstack_free(void *p)
 {
     per_callstack_t *per = (per_callstack_t *) p;
+    if (per->pcs != NULL)
+        packed_callstack_free(per->pcs);
     global_free(per, sizeof(*per), HEAPSTAT_CALLSTACK);
 }
 
@@ -335,7 +450,8 @@ client_malloc_data_free(void *data)
 }
 
 void *
-client_malloc_data_to_free_list(void *cur_data, dr_mcontext_t *mc, app_pc post_call)
+client_malloc_data_to_free_list(void *cur_data, dr_mcontext_t *mc, app_pc post_call,
+                                app_pc base)
 {
     /* nothing to do since we persist our callstacks in alloc_stack_table */
     return cur_data;
@@ -390,6 +506,307 @@ unit_name(void)
     return "<error>";
 }
 
+/***************************************************************************
+ * -binary_snapshots
+ */
+
+/* Called on opening snapshot.bin, including in a fork child */
+static void
+snap_bin_init(void)
+{
+    snap_bin_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAP_BIN_MAGIC, sizeof(header.magic));
+    header.version = SNAP_BIN_VERSION;
+    header.header_size = sizeof(header);
+    if (options.staleness)
+        header.flags |= SNAP_BIN_STALENESS;
+    if (options.dump)
+        header.flags |= SNAP_BIN_VARIABLE;
+    dr_snprintf(header.unit_name, BUFFER_SIZE_ELEMENTS(header.unit_name), "%s",
+                unit_name());
+    NULL_TERMINATE_BUFFER(header.unit_name);
+    dr_write_file(f_snapshot, &header, sizeof(header));
+    snap_bin_written = 0;
+    snap_bin_key_offset = 0;
+    if (snap_bin_prev != NULL)
+        memset(snap_bin_prev, 0, snap_bin_prev_max*sizeof(*snap_bin_prev));
+}
+
+static void
+snap_bin_write(const void *data, size_t size, size_t *sofar INOUT)
+{
+    ASSERT(size < SNAPSHOT_LOG_BUF_SIZE, "single write can't overflow buffer");
+    if (*sofar + size > SNAPSHOT_LOG_BUF_SIZE)
+        FLUSH_BUFFER(f_snapshot, snaps_log_buf, *sofar);
+    memcpy(snaps_log_buf + *sofar, data, size);
+    *sofar += size;
+}
+
+static void
+snap_bin_write_varint(uint64 val, size_t *sofar INOUT)
+{
+    byte bytes[SNAP_BIN_MAX_VARINT];
+    uint len = 0;
+    do {
+        bytes[len] = (byte)(val & 0x7f);
+        val >>= 7;
+        if (val != 0)
+            bytes[len] |= 0x80;
+        len++;
+    } while (val != 0);
+    snap_bin_write(bytes, len, sofar);
+}
+
+/* Ensures snap_bin_prev has an entry for id */
+static void
+snap_bin_prev_grow(uint id)
+{
+    uint new_max;
+    snap_bin_used_t *grown;
+    if (id < snap_bin_prev_max)
+        return;
+    new_max = (snap_bin_prev_max == 0) ? 1024 : snap_bin_prev_max;
+    while (new_max <= id)
+        new_max *= 2;
+    grown = (snap_bin_used_t *)
+        global_alloc(new_max*sizeof(*grown), HEAPSTAT_SNAPSHOT);
+    memset(grown, 0, new_max*sizeof(*grown));
+    if (snap_bin_prev != NULL) {
+        memcpy(grown, snap_bin_prev, snap_bin_prev_max*sizeof(*grown));
+        global_free(snap_bin_prev, snap_bin_prev_max*sizeof(*snap_bin_prev),
+                    HEAPSTAT_SNAPSHOT);
+    }
+    snap_bin_prev = grown;
+    snap_bin_prev_max = new_max;
+}
+
+static void
+snap_bin_index_add(uint64 offset, uint64 key_offset)
+{
+    if (snap_bin_written >= snap_bin_index_max) {
+        uint new_max = (snap_bin_index_max == 0) ? 256 : snap_bin_index_max*2;
+        snap_bin_index_t *grown = (snap_bin_index_t *)
+            global_alloc(new_max*sizeof(*grown), HEAPSTAT_SNAPSHOT);
+        if (snap_bin_index != NULL) {
+            memcpy(grown, snap_bin_index, snap_bin_index_max*sizeof(*grown));
+            global_free(snap_bin_index, snap_bin_index_max*sizeof(*snap_bin_index),
+                        HEAPSTAT_SNAPSHOT);
+        }
+        snap_bin_index = grown;
+        snap_bin_index_max = new_max;
+    }
+    snap_bin_index[snap_bin_written].offset = offset;
+    snap_bin_index[snap_bin_written].key_offset = key_offset;
+}
+
+/* Up to caller to synchronize */
+static void
+dump_snapshot_binary(per_snapshot_t *snap, int idx/*-1 means peak*/)
+{
+    snap_bin_snapshot_t rec;
+    snap_bin_used_t *prev;
+    heap_used_t *u;
+    size_t sofar = 0;
+    int64 start, end;
+    uint i, id;
+    uint64 prev_access = 0;
+    /* A callstack is present if snap_bin_prev[id].seen is this, +1 so that
+     * zeroed entries are never present
+     */
+    uint seen = snap_bin_written + 1;
+    bool key = (snap_bin_written % SNAP_BIN_KEY_FREQ == 0);
+
+    start = dr_file_tell(f_snapshot);
+    ASSERT(start >= 0, "bad log file location");
+    if (key) {
+        snap_bin_key_offset = start;
+        if (snap_bin_prev != NULL)
+            memset(snap_bin_prev, 0, snap_bin_prev_max*sizeof(*snap_bin_prev));
+    }
+    memset(&rec, 0, sizeof(rec));
+    rec.rec.kind = SNAP_BIN_SNAPSHOT;
+    rec.rec.flags = key ? SNAP_BIN_KEY : 0;
+    rec.number = snapshot_count;
+    rec.idx = idx;
+    rec.stamp = snap->stamp + stamp_offs;
+    rec.stamp_offs = stamp_offs;
+    rec.tot_mallocs = snap->tot_mallocs;
+    rec.tot_bytes_asked_for = snap->tot_bytes_asked_for;
+    rec.tot_bytes_usable = snap->tot_bytes_usable;
+    rec.tot_bytes_occupied = snap->tot_bytes_occupied;
+    /* The size and counts are filled in below */
+    snap_bin_write(&rec, sizeof(rec), &sofar);
+
+    for (u = snap->used; u != NULL; u = u->next) {
+        if (u->bytes_asked_for + u->extra_usable == 0)
+            continue;
+        id = u->callstack->id;
+        snap_bin_prev_grow(id);
+        prev = &snap_bin_prev[id];
+        prev->seen = seen;
+        if (!key && prev->instances == u->instances &&
+            prev->bytes_asked_for == u->bytes_asked_for &&
+            prev->extra_usable == u->extra_usable &&
+            prev->extra_occupied == u->extra_occupied)
+            continue;
+        prev->instances = u->instances;
+        prev->bytes_asked_for = u->bytes_asked_for;
+        prev->extra_usable = u->extra_usable;
+        prev->extra_occupied = u->extra_occupied;
+        snap_bin_write_varint(id, &sofar);
+        snap_bin_write_varint(u->instances, &sofar);
+        snap_bin_write_varint(u->bytes_asked_for, &sofar);
+        snap_bin_write_varint(u->extra_usable, &sofar);
+        snap_bin_write_varint(u->extra_occupied, &sofar);
+        rec.num_heap++;
+    }
+    if (!key) {
+        /* Callstacks no longer present get an all-zero entry */
+        for (id = 0; id < snap_bin_prev_max; id++) {
+            prev = &snap_bin_prev[id];
+            if (prev->seen == seen ||
+                prev->bytes_asked_for + prev->extra_usable == 0)
+                continue;
+            memset(prev, 0, sizeof(*prev));
+            snap_bin_write_varint(id, &sofar);
+            for (i = 0; i < 4; i++)
+                snap_bin_write_varint(0, &sofar);
+            rec.num_heap++;
+        }
+    }
+
+    for (i = 0; options.staleness && snap->stale != NULL &&
+             i < snap->stale->num_entries; i++) {
+        uint64 access = staleness_get_snap_last_access(snap->stale, i);
+        int64 delta = (int64)(access - prev_access);
+        snap_bin_write_varint(staleness_get_snap_cstack_id(snap->stale, i), &sofar);
+        snap_bin_write_varint(staleness_get_snap_bytes(snap->stale, i), &sofar);
+        /* zigzag so that earlier accesses stay small */
+        snap_bin_write_varint((uint64)((delta << 1) ^ (delta >> 63)), &sofar);
+        prev_access = access;
+        rec.num_stale++;
+    }
+    FLUSH_BUFFER(f_snapshot, snaps_log_buf, sofar);
+
+    end = dr_file_tell(f_snapshot);
+    ASSERT(end > start && end - start < UINT_MAX, "snapshot record too large");
+    rec.rec.size = (uint)(end - start);
+    dr_file_seek(f_snapshot, start, DR_SEEK_SET);
+    dr_write_file(f_snapshot, &rec, sizeof(rec));
+    dr_file_seek(f_snapshot, end, DR_SEEK_SET);
+
+    snap_bin_index_add(start, snap_bin_key_offset);
+    snap_bin_written++;
+}
+
+static void
+snap_bin_write_nudge(uint64 nudge_stamp)
+{
+    snap_bin_nudge_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.rec.kind = SNAP_BIN_NUDGE;
+    rec.rec.size = sizeof(rec);
+    rec.stamp = nudge_stamp;
+    dr_write_file(f_snapshot, &rec, sizeof(rec));
+}
+
+/* Writes the index footer and frees our state.  Caller must hold snapshot_lock. */
+static void
+snap_bin_exit(void)
+{
+    snap_bin_footer_t footer;
+    int64 pos = dr_file_tell(f_snapshot);
+    ASSERT(pos >= 0, "bad log file location");
+    if (snap_bin_written > 0)
+        dr_write_file(f_snapshot, snap_bin_index, snap_bin_written*sizeof(*snap_bin_index));
+    memset(&footer, 0, sizeof(footer));
+    footer.index_offset = pos;
+    footer.num_snapshots = snap_bin_written;
+    memcpy(footer.magic, SNAP_BIN_FOOTER_MAGIC, sizeof(footer.magic));
+    dr_write_file(f_snapshot, &footer, sizeof(footer));
+    if (snap_bin_index != NULL) {
+        global_free(snap_bin_index, snap_bin_index_max*sizeof(*snap_bin_index),
+                    HEAPSTAT_SNAPSHOT);
+        snap_bin_index = NULL;
+        snap_bin_index_max = 0;
+    }
+    if (snap_bin_prev != NULL) {
+        global_free(snap_bin_prev, snap_bin_prev_max*sizeof(*snap_bin_prev),
+                    HEAPSTAT_SNAPSHOT);
+        snap_bin_prev = NULL;
+        snap_bin_prev_max = 0;
+    }
+}
+
+/* For -collapsed_stacks: writes one line per allocation site in snap, with
+ * its frames outermost first and then its bytes, which is the format read by
+ * flame graph tools.  Up to caller to synchronize.
+ */
+static void
+dump_snapshot_collapsed(per_snapshot_t *snap, int idx/*-1 means peak*/)
+{
+    heap_used_t *u;
+    packed_callstack_t **pcs_array = NULL;
+    uint num_pcs = 0, max_pcs = 0, i;
+    symbolized_callstack_t scs;
+    char name[MAXIMUM_PATH];
+    file_t f;
+    size_t sofar = 0;
+    ssize_t len = 0;
+
+    for (u = snap->used; u != NULL; u = u->next)
+        max_pcs++;
+    if (max_pcs > 0) {
+        pcs_array = (packed_callstack_t **)
+            global_alloc(max_pcs*sizeof(*pcs_array), HEAPSTAT_SNAPSHOT);
+        for (u = snap->used; u != NULL; u = u->next) {
+            if (u->bytes_asked_for + u->extra_usable > 0 && u->callstack->pcs != NULL)
+                pcs_array[num_pcs++] = u->callstack->pcs;
+        }
+        /* Look up every new frame in module order to fill the symbol cache */
+        packed_callstack_symbolize_batch(pcs_array, num_pcs);
+        global_free(pcs_array, max_pcs*sizeof(*pcs_array), HEAPSTAT_SNAPSHOT);
+    }
+
+    if (idx == -1) {
+        dr_snprintf(name, BUFFER_SIZE_ELEMENTS(name), "heap.%d.peak.folded",
+                    snapshot_count);
+    } else
+        dr_snprintf(name, BUFFER_SIZE_ELEMENTS(name), "heap.%d.folded", snapshot_count);
+    NULL_TERMINATE_BUFFER(name);
+    f = open_logfile(name, false, -1);
+    for (u = snap->used; u != NULL; u = u->next) {
+        if (u->bytes_asked_for + u->extra_usable == 0)
+            continue;
+        if (u->callstack == small_sites) {
+            BUFFERED_WRITE(f, snaps_log_buf, SNAPSHOT_LOG_BUF_SIZE, sofar, len,
+                           "<small allocation sites> %u\n", u->bytes_asked_for);
+            continue;
+        }
+        if (u->callstack->pcs == NULL)
+            continue;
+        packed_callstack_to_symbolized(u->callstack->pcs, &scs);
+        for (i = scs.num_frames; i > 0; i--) {
+            const char *sep = (i == scs.num_frames) ? "" : ";";
+            if (symbolized_callstack_frame_is_module(&scs, i - 1)) {
+                BUFFERED_WRITE(f, snaps_log_buf, SNAPSHOT_LOG_BUF_SIZE, sofar, len,
+                               "%s%s!%s", sep,
+                               symbolized_callstack_frame_modname(&scs, i - 1),
+                               symbolized_callstack_frame_func(&scs, i - 1));
+            } else {
+                BUFFERED_WRITE(f, snaps_log_buf, SNAPSHOT_LOG_BUF_SIZE, sofar, len,
+                               "%s<not in a module>", sep);
+            }
+        }
+        BUFFERED_WRITE(f, snaps_log_buf, SNAPSHOT_LOG_BUF_SIZE, sofar, len,
+                       " %u\n", u->bytes_asked_for);
+        symbolized_callstack_free(&scs);
+    }
+    FLUSH_BUFFER(f, snaps_log_buf, sofar);
+    close_file(f);
+}
+
 /* Up to caller to synchronize */
 static void
 dump_snapshot(per_snapshot_t *snap, int idx/*-1 means peak*/)
@@ -400,6 +817,13 @@ dump_snapshot(per_snapshot_t *snap, int idx/*-1 means peak*/)
 
     LOG(2, "dumping snapshot idx=%d count=%"INT64_FORMAT"u\n",
         idx, snap->stamp);
+    if (options.collapsed_stacks)
+        dump_snapshot_collapsed(snap, idx);
+    if (options.binary_snapshots) {
+        dump_snapshot_binary(snap, idx);
+        snapshot_count++;
+        return;
+    }
     dr_fprintf(f_snapshot, "SNAPSHOT #%4d @ %16"INT64_FORMAT"u %s\n",
                snapshot_count, snap->stamp + stamp_offs, unit_name());
     dr_fprintf(f_snapshot, "idx=%d, stamp_offs=%16"INT64_FORMAT"u\n",
@@ -494,6 +918,10 @@ copy_snapshot(per_snapshot_t *dst, per_snapshot_t *src, bool new_live)
                 per->prev_used = NULL;
             }
         }
+        if (small_sites != NULL) {
+            small_sites->used = NULL;
+            small_sites->prev_used = NULL;
+        }
     }
 
     prev_u = NULL;
@@ -522,20 +950,18 @@ difference_exceeds_percent(uint64 new_val, uint64 old_val, uint percent)
     return (100 * diff > percent * old_val);
 }
 
-/* If the current snap_idx snapshot is larger than the current peak,
- * makes a new peak snapshot (PR 476018).
- * Assumes snapshot lock and malloc_lock are held.
+/* Returns whether a snap_idx snapshot occupying tot_bytes_occupied, which
+ * is larger than the current peak, differs enough from it to replace it.
  */
-static void
-check_for_peak(void)
+static bool
+peak_differs(uint64 tot_bytes_occupied)
 {
-    if (snaps[snap_idx].tot_bytes_occupied > snap_peak.tot_bytes_occupied) {
-        /* PR 566116: avoid too-frequent peak snapshots by ignoring if the new
-         * peak is similar to the existing one, both in size and in malloc
-         * makeup.  May need to split -peak_threshold into 3 if we need
-         * separate control of each variable.
-         */
-        if (difference_exceeds_percent(snaps[snap_idx].tot_bytes_occupied,
+    /* PR 566116: avoid too-frequent peak snapshots by ignoring if the new
+     * peak is similar to the existing one, both in size and in malloc
+     * makeup.  May need to split -peak_threshold into 3 if we need
+     * separate control of each variable.
+     */
+    return (difference_exceeds_percent(tot_bytes_occupied,
                                        snap_peak.tot_bytes_occupied,
                                        options.peak_threshold) ||
             difference_exceeds_percent(allocfree_cur, allocfree_last_peak,
@@ -543,7 +969,19 @@ check_for_peak(void)
             /* even if not much different, if it's been a long time, use it */
             difference_exceeds_percent(snaps[snap_idx].stamp,
                                        snap_peak.stamp,
-                                       options.peak_threshold)) {
+                                       options.peak_threshold));
+}
+
+/* If the current snap_idx snapshot is larger than the current peak,
+ * makes a new peak snapshot (PR 476018).
+ * Assumes snapshot lock and malloc_lock are held, and that the thread
+ * deltas have been folded.
+ */
+static void
+check_for_peak(void)
+{
+    if (snaps[snap_idx].tot_bytes_occupied > snap_peak.tot_bytes_occupied) {
+        if (peak_differs(snaps[snap_idx].tot_bytes_occupied)) {
             STATS_INC(peaks_detected);
             allocfree_last_peak = allocfree_cur;
             copy_snapshot(&snap_peak, &snaps[snap_idx], false/*isolated copy*/);
@@ -562,6 +1000,75 @@ check_for_peak(void)
     }
 }
 
+/* Writes the callstack.log entry for small_sites on first use */
+static per_callstack_t *
+get_small_sites(void)
+{
+    if (small_sites == NULL) {
+        char buf[128];
+        size_t sofar = 0;
+        ssize_t len = 0;
+        small_sites = (per_callstack_t *)
+            global_alloc(sizeof(*small_sites), HEAPSTAT_CALLSTACK);
+        memset(small_sites, 0, sizeof(*small_sites));
+        small_sites->id =
+            atomic_add32_return_sum((volatile int *)&num_callstacks, 1);
+        BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len,
+                 "CALLSTACK %u\n# 0 <small allocation sites>\n%s",
+                 small_sites->id, END_MARKER);
+        print_buffer(f_callstack, buf);
+    }
+    return small_sites;
+}
+
+/* For -merge_small_sites: moves the live usage of each allocation site that
+ * has been below the threshold for long enough into small_sites.
+ * Caller must hold malloc_lock() and snapshot_lock, with the thread deltas
+ * folded.
+ */
+static void
+merge_small_sites(void)
+{
+    int i;
+    uint merged = 0;
+    if (options.merge_small_sites == 0)
+        return;
+    hashtable_lock(&alloc_stack_table);
+    for (i = 0; i < HASHTABLE_SIZE(alloc_stack_table.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = alloc_stack_table.table[i]; he != NULL; he = he->next) {
+            per_callstack_t *per = (per_callstack_t *) he->payload;
+            heap_used_t *u = per->used;
+            if (per->merged != NULL)
+                continue;
+            if (u != NULL &&
+                u->bytes_asked_for + u->extra_usable >= options.merge_small_sites) {
+                per->small_streak = 0;
+                continue;
+            }
+            if (++per->small_streak < options.merge_small_after)
+                continue;
+            per->merged = get_small_sites();
+            if (u != NULL) {
+                /* Moving the usage leaves the snapshot totals unchanged */
+                int instances = u->instances, asked_for = u->bytes_asked_for;
+                int extra_usable = u->extra_usable, extra_occupied = u->extra_occupied;
+                snapshot_apply_usage(per->merged, instances, 0, asked_for,
+                                     extra_usable, extra_occupied);
+                snapshot_apply_usage(per, -instances, 0, -asked_for,
+                                     -extra_usable, -extra_occupied);
+                snapshot_prune_used(per);
+            }
+            merged++;
+        }
+    }
+    hashtable_unlock(&alloc_stack_table);
+    if (merged > 0) {
+        STATS_ADD(sites_merged, merged);
+        LOG(2, "merged %u small allocation sites\n", merged);
+    }
+}
+
 /* Caller must hold malloc_lock() */
 static void
 take_snapshot(void)
@@ -571,6 +1078,7 @@ take_snapshot(void)
      * needing potentially very large buffers to try and get atomic writes
      */
     dr_mutex_lock(snapshot_lock);
+    snapshot_fold_deltas();
     if (options.staleness) {
         /* Unlike the mem usage data which is maintained as the app
          * executes, we have to go collect this at snapshot time from
@@ -612,71 +1120,216 @@ take_snapshot(void)
         /* Replace the existing list at snap_idx with a clone of prev_idx */
         copy_snapshot(&snaps[snap_idx], &snaps[prev_idx], true/*live copy*/);
     }
+    /* Done after the copy so that the snapshot just taken is unaffected */
+    merge_small_sites();
     dr_mutex_unlock(snapshot_lock);
 }
 
+/* Caller must hold snapshot_lock.
+ * Adds a change in the usage of per to the live snapshot.  The change may
+ * leave per's count at zero, or transiently negative while folding several
+ * threads' deltas, so the caller must call snapshot_prune_used() once done.
+ */
+static void
+snapshot_apply_usage(per_callstack_t *per, int instances, int mallocs, int asked_for,
+                     int extra_usable, int extra_occupied)
+{
+    if (per->used == NULL) {
+        per->used = (heap_used_t *)
+            global_alloc(sizeof(*per->used), HEAPSTAT_SNAPSHOT);
+        memset(per->used, 0, sizeof(*per->used));
+        per->used->callstack = per;
+        per->used->next = snaps[snap_idx].used;
+        if (snaps[snap_idx].used != NULL) {
+            ASSERT(snaps[snap_idx].used->callstack->prev_used == NULL,
+                   "prev_used should already be null");
+            snaps[snap_idx].used->callstack->prev_used = per->used;
+        }
+        ASSERT(per->prev_used == NULL, "prev_used should already be null");
+        snaps[snap_idx].used = per->used;
+    }
+    per->used->instances += instances;
+    per->used->bytes_asked_for += asked_for;
+    per->used->extra_usable += extra_usable;
+    per->used->extra_occupied += extra_occupied;
+    LOG(2, "callstack id %u => %ux, %uB, +%uB, +%uB\n", per->id,
+        per->used->instances, per->used->bytes_asked_for,
+        per->used->extra_usable, per->used->extra_occupied);
+    snaps[snap_idx].tot_mallocs += mallocs;
+    snaps[snap_idx].tot_bytes_asked_for += asked_for;
+    snaps[snap_idx].tot_bytes_usable += asked_for + extra_usable;
+    snaps[snap_idx].tot_bytes_occupied += asked_for + extra_usable + extra_occupied;
+}
+
+/* Caller must hold snapshot_lock.
+ * Removes per's node from the live snapshot if it has no allocations left.
+ */
+static void
+snapshot_prune_used(per_callstack_t *per)
+{
+    if (per->used == NULL || per->used->instances != 0)
+        return;
+    /* remove the node to save memory since may not re-alloc */
+    ASSERT(per->used->bytes_asked_for == 0, "no malloc => no bytes!");
+    if (per->used->next != NULL)
+        per->used->next->callstack->prev_used = per->prev_used;
+    if (per->prev_used == NULL) {
+        ASSERT(per->used == snaps[snap_idx].used, "prev node error");
+        snaps[snap_idx].used = per->used->next;
+    } else {
+        per->prev_used->next = per->used->next;
+    }
+    global_free(per->used, sizeof(*per->used), HEAPSTAT_SNAPSHOT);
+    per->used = NULL;
+    per->prev_used = NULL;
+}
+
+/* Folds every thread's deltas into the live snapshot.
+ * Caller must hold malloc_lock() and snapshot_lock.
+ */
+static void
+snapshot_fold_deltas(void)
+{
+    snap_delta_t *d;
+    heap_delta_t *e;
+    uint i;
+    bool any = false;
+    for (d = snap_delta_list; d != NULL; d = d->next) {
+        if (d->num_used == 0)
+            continue;
+        any = true;
+        for (i = 0; i < DELTA_TABLE_SIZE; i++) {
+            e = &d->entry[i];
+            if (e->callstack != NULL) {
+                snapshot_apply_usage(e->callstack, e->instances, e->mallocs,
+                                     e->bytes_asked_for, e->extra_usable,
+                                     e->extra_occupied);
+            }
+        }
+    }
+    if (!any)
+        return;
+    /* Only now that all threads are folded in are the counts accurate */
+    for (d = snap_delta_list; d != NULL; d = d->next) {
+        if (d->num_used == 0)
+            continue;
+        for (i = 0; i < DELTA_TABLE_SIZE; i++) {
+            e = &d->entry[i];
+            if (e->callstack != NULL) {
+                snapshot_prune_used(e->callstack);
+                memset(e, 0, sizeof(*e));
+            }
+        }
+        d->num_used = 0;
+        d->tot_bytes_occupied = 0;
+        d->unfolded = 0;
+    }
+    STATS_INC(delta_folds);
+}
+
+static inline snap_delta_t *
+get_snap_delta(void)
+{
+    void *drcontext = dr_get_current_drcontext();
+    tls_heapstat_t *pt;
+    if (drcontext == NULL)
+        return NULL;
+    pt = (tls_heapstat_t *) drmgr_get_tls_field(drcontext, tls_idx_heapstat);
+    return (pt == NULL) ? NULL : pt->delta;
+}
+
+static heap_delta_t *
+snapshot_delta_lookup(snap_delta_t *d, per_callstack_t *per)
+{
+    uint i = per->id & (DELTA_TABLE_SIZE - 1);
+    /* Terminates since we never let the table fill up */
+    while (d->entry[i].callstack != NULL && d->entry[i].callstack != per)
+        i = (i + 1) & (DELTA_TABLE_SIZE - 1);
+    return &d->entry[i];
+}
+
 /* Called from pre-alloc-hashtable-change events.
- * Updates the current snapshot and callstack usage.
+ * Updates the current thread's deltas for the snapshot and callstack usage,
+ * or the live snapshot directly if the thread has no deltas.
+ * Caller must hold malloc_lock().
  */
 static void
 account_for_bytes_pre(per_callstack_t *per, int asked_for,
                       int extra_usable, int extra_occupied, bool realloc)
 {
-    /* must be synched w/ take_snapshot().  the malloc lock is always acquired
-     * before the snapshot lock.
-     */
-    dr_mutex_lock(snapshot_lock);
+    snap_delta_t *d = get_snap_delta();
+    heap_delta_t *e;
+    int instances = 0, mallocs;
+    int occupied = asked_for + extra_usable + extra_occupied;
     if (asked_for+extra_usable > 0) {
-        if (per->used == NULL) {
-            per->used = (heap_used_t *)
-                global_alloc(sizeof(*per->used), HEAPSTAT_SNAPSHOT);
-            memset(per->used, 0, sizeof(*per->used));
-            per->used->callstack = per;
-            per->used->next = snaps[snap_idx].used;
-            if (snaps[snap_idx].used != NULL) {
-                ASSERT(snaps[snap_idx].used->callstack->prev_used == NULL,
-                       "prev_used should already be null");
-                snaps[snap_idx].used->callstack->prev_used = per->used;
-            }
-            ASSERT(per->prev_used == NULL, "prev_used should already be null");
-            snaps[snap_idx].used = per->used;
-        }
         if (!realloc)
-            per->used->instances++;
-        snaps[snap_idx].tot_mallocs++;
+            instances = 1;
+        mallocs = 1;
     } else {
         ASSERT(asked_for+extra_usable < 0, "cannot have 0-sized usable space");
-        ASSERT(per->used != NULL, "alloc must exist");
-        ASSERT(per->used->instances >= 0, "alloc count must be >= 0");
-        ASSERT(snaps[snap_idx].tot_mallocs >= 0, "alloc count must be >= 0");
         if (!realloc)
-            per->used->instances--;
-        snaps[snap_idx].tot_mallocs--;
+            instances = -1;
+        mallocs = -1;
     }
-    per->used->bytes_asked_for += asked_for;
-    per->used->extra_usable += extra_usable;
-    per->used->extra_occupied += extra_occupied;
-    LOG(2, "callstack id %u => %ux, %uB, +%uB, +%uB\n", per->id,
-        per->used->instances, per->used->bytes_asked_for,
-        per->used->extra_usable, per->used->extra_occupied);
-    if (per->used->instances == 0) {
-        /* remove the node to save memory since may not re-alloc */
-        ASSERT(per->used->bytes_asked_for == 0, "no malloc => no bytes!");
-        if (per->used->next != NULL)
-            per->used->next->callstack->prev_used = per->prev_used;
-        if (per->prev_used == NULL) {
-            ASSERT(per->used == snaps[snap_idx].used, "prev node error");
-            snaps[snap_idx].used = per->used->next;
-        } else {
-            per->prev_used->next = per->used->next;
+    if (d == NULL) {
+        /* e.g., -thread_delta_max 0, or the pre-existing allocs at init.
+         * Must be synched w/ take_snapshot().  The malloc lock is always
+         * acquired before the snapshot lock.
+         */
+        dr_mutex_lock(snapshot_lock);
+        ASSERT(asked_for+extra_usable > 0 || per->used != NULL, "alloc must exist");
+        snapshot_apply_usage(per, instances, mallocs, asked_for,
+                             extra_usable, extra_occupied);
+        snapshot_prune_used(per);
+        dr_mutex_unlock(snapshot_lock);
+        return;
+    }
+    e = snapshot_delta_lookup(d, per);
+    if (e->callstack == NULL) {
+        if (d->num_used >= DELTA_TABLE_MAX_USED) {
+            dr_mutex_lock(snapshot_lock);
+            snapshot_fold_deltas();
+            dr_mutex_unlock(snapshot_lock);
+            e = snapshot_delta_lookup(d, per);
         }
-        global_free(per->used, sizeof(*per->used), HEAPSTAT_SNAPSHOT);
-        per->used = NULL;
-        per->prev_used = NULL;
+        e->callstack = per;
+        d->num_used++;
     }
-    snaps[snap_idx].tot_bytes_asked_for += asked_for;
-    snaps[snap_idx].tot_bytes_usable += asked_for + extra_usable;
-    snaps[snap_idx].tot_bytes_occupied += asked_for + extra_usable + extra_occupied;
+    e->instances += instances;
+    e->mallocs += mallocs;
+    e->bytes_asked_for += asked_for;
+    e->extra_usable += extra_usable;
+    e->extra_occupied += extra_occupied;
+    d->tot_bytes_occupied += occupied;
+    d->unfolded += (occupied < 0) ? -occupied : occupied;
+    /* Bound how far off the live snapshot can be for peak detection */
+    if (d->unfolded > options.thread_delta_max) {
+        dr_mutex_lock(snapshot_lock);
+        snapshot_fold_deltas();
+        dr_mutex_unlock(snapshot_lock);
+    }
+}
+
+/* Called before a drop in usage to see whether we are at a new peak
+ * (PR 476018).  To avoid folding every thread's deltas on every free we
+ * first estimate using only this thread's deltas, which can be off by up to
+ * -thread_delta_max per other thread.
+ * Caller must hold malloc_lock().
+ */
+static void
+check_for_peak_pre_drop(void)
+{
+    snap_delta_t *d = get_snap_delta();
+    if (d != NULL) {
+        int64 estimate = (int64) snaps[snap_idx].tot_bytes_occupied +
+            d->tot_bytes_occupied;
+        if (estimate <= (int64) snap_peak.tot_bytes_occupied ||
+            !peak_differs((uint64) estimate))
+            return;
+    }
+    dr_mutex_lock(snapshot_lock);
+    snapshot_fold_deltas();
+    check_for_peak();
     dr_mutex_unlock(snapshot_lock);
 }
 
@@ -746,7 +1399,8 @@ client_add_malloc_pre(malloc_info_t *info, dr_mcontext_t *mc, app_pc post_call)
         per = get_cstack_from_alloc_data(info->client_data);
         IF_DEBUG({
             hashtable_lock(&alloc_stack_table);
-            ASSERT(hashtable_lookup(&alloc_stack_table,
+            ASSERT(per == small_sites ||
+                   hashtable_lookup(&alloc_stack_table,
                                     (void *)per->IF_MD5_ELSE(md5, crc)) == (void*)per,
                    "malloc re-add should still be in table");
             hashtable_unlock(&alloc_stack_table);
@@ -800,12 +1454,18 @@ client_add_malloc_pre(malloc_info_t *info, dr_mcontext_t *mc, app_pc post_call)
             STATS_INC(alloc_stack_count);
 
             dump_callstack(pcs, per, buf, bufsz, &sofar);
+            if (options.collapsed_stacks) {
+                packed_callstack_add_ref(pcs);
+                per->pcs = pcs;
+            }
         }
         hashtable_unlock(&alloc_stack_table);
         sofar = packed_callstack_free(pcs);
-        ASSERT(sofar == 0, "pcs should have 0 ref count");
+        ASSERT(sofar == (per->pcs == pcs ? 1 : 0), "pcs has unexpected ref count");
     }
 
+    per = cstack_resolve_merged(per);
+
 #ifdef X64
     /* FIXME: assert not truncating */
 #endif
@@ -839,9 +1499,7 @@ client_remove_malloc_pre(malloc_info_t *info)
     /* FIXME: assert not truncating */
 #endif
     /* To avoid repeatedly redoing the peak snapshot we wait until a drop (PR 476018) */
-    dr_mutex_lock(snapshot_lock);
-    check_for_peak();
-    dr_mutex_unlock(snapshot_lock);
+    check_for_peak_pre_drop();
     account_for_bytes_pre(per, -(ssize_t)info->request_size, -(ssize_t)info->pad_size,
                           -(ssize_t)(HEADER_SIZE), false);
     if (options.staleness)
@@ -883,8 +1541,11 @@ snapshot_dump_all(void)
         snaps[snap_idx].stamp = stamp + (options.dump_freq - allocfree_count);
     else if (options.time_bytes)
         snaps[snap_idx].stamp = stamp + (options.dump_freq - byte_count);
-    else if (options.time_instrs)
-        snaps[snap_idx].stamp = stamp + (options.dump_freq - instr_count);
+    else if (options.time_instrs) {
+        snaps[snap_idx].stamp = stamp + (options.dump_freq - instr_count) +
+            instrcnt_pending();
+    }
+    snapshot_fold_deltas();
     /* Check for peak on every snapshot (PR 476018) */
     check_for_peak();
     dump_snapshot(&snap_peak, -1);
@@ -907,6 +1568,18 @@ snapshot_exit(void)
     int i;
 
     snapshot_dump_all();
+    if (options.binary_snapshots) {
+        dr_mutex_lock(snapshot_lock);
+        snap_bin_exit();
+        dr_mutex_unlock(snapshot_lock);
+    }
+
+    /* snapshot_dump_all() folded any threads that have not exited */
+    while (snap_delta_list != NULL) {
+        snap_delta_t *d = snap_delta_list;
+        snap_delta_list = d->next;
+        global_free(d, sizeof(*d), HEAPSTAT_SNAPSHOT);
+    }
 
     for (i = 0; i < options.snapshots; i++)
         free_snapshot(&snaps[i]);
@@ -937,9 +1610,7 @@ client_handle_realloc(void *drcontext, malloc_info_t *old_info, malloc_info_t *n
         ssize_t delta_head = 0;
         if (delta_req < 0) {
             /* Just like on a free we check for a drop in the peak */
-            dr_mutex_lock(snapshot_lock);
-            check_for_peak();
-            dr_mutex_unlock(snapshot_lock);
+            check_for_peak_pre_drop();
         }
         account_for_bytes_pre(per, delta_req, delta_pad, delta_head, true/*realloc*/);
         account_for_bytes_post(delta_req, delta_pad, 0);
@@ -1014,6 +1685,11 @@ client_handle_munmap_fail(app_pc base, size_t size, bool anon)
 {
 }
 
+void
+client_handle_mprotect(app_pc base, size_t size, bool writable)
+{
+}
+
 #ifdef UNIX
 void
 client_handle_mremap(app_pc old_base, size_t old_size, app_pc new_base, size_t new_size,
@@ -1088,6 +1764,11 @@ client_post_syscall(void *drcontext, int sysnum)
 {
 }
 
+void
+client_found_leaks_pending(void **client_data, uint num)
+{
+}
+
 void
 client_found_leak(app_pc start, app_pc end, size_t indirect_bytes,
                   bool pre_us, bool reachable,
@@ -1138,30 +1819,58 @@ client_found_leak(app_pc start, app_pc end, size_t indirect_bytes,
  * INSTRUMENTATION
  */
 
+/* Returns the instructions executed by all threads that have not yet been
+ * subtracted from instr_count.  Caller must hold snapshot_lock.
+ */
+static uint64
+instrcnt_pending(void)
+{
+    tls_heapstat_t *pt;
+    uint64 pending = 0;
+    for (pt = instrcnt_threads; pt != NULL; pt = pt->instrcnt_next) {
+        /* Racy read of another thread's counter, but we only want an estimate */
+        int left = *pt->instrcnt;
+        if (left < instr_chunk)
+            pending += instr_chunk - left;
+    }
+    return pending;
+}
+
+/* Caller must hold snapshot_lock.  Returns whether a snapshot is due. */
+static bool
+instrcnt_flush(tls_heapstat_t *pt)
+{
+    /* The counter can be far below 0 if we passed no check in a while */
+    instr_count -= instr_chunk - *pt->instrcnt;
+    *pt->instrcnt = instr_chunk;
+    if (instr_count < 0) {
+        instr_count = options.dump_freq;
+        return true;
+    }
+    return false;
+}
+
 /* N.B.: mcontext is not in consistent app state, for efficiency.
  */
 static void
 shared_instrcnt_callee(void)
 {
-    bool do_snapshot = false;
+    void *drcontext = dr_get_current_drcontext();
+    tls_heapstat_t *pt = (tls_heapstat_t *)
+        drmgr_get_tls_field(drcontext, tls_idx_heapstat);
+    bool do_snapshot;
     ASSERT(options.time_instrs, "option mismatch");
-    /* We racily subtract and check, so serialize now for a single snapshot */
+    ASSERT(*pt->instrcnt < 0, "callee incorrectly invoked");
     dr_mutex_lock(snapshot_lock);
-    /* We can still have a double-snapshot if threshold is low enough that
-     * other threads bump the instr_count over it before 2nd guy to get lock
-     * can do this check, but that's ok
-     */
-    if (instr_count < 0) {
-        do_snapshot = true;
-        instr_count = options.dump_freq;
-    } else {
-        /* We assume can't take so long that it wraps around */
-        ASSERT(instr_count <= options.dump_freq, "callee incorrectly invoked");
-    }
+    do_snapshot = instrcnt_flush(pt);
     /* Release lock so take_snapshot can grab it */
     dr_mutex_unlock(snapshot_lock);
-    if (do_snapshot)
+    if (do_snapshot) {
+        /* Must hold malloc lock first, to fold the thread deltas */
+        malloc_lock();
         take_snapshot();
+        malloc_unlock();
+    }
 }
 
 /* To avoid the code expansion from a clean call in every bb we use
@@ -1242,51 +1951,73 @@ free_shared_code(void)
     nonheap_free(shared_code_region, SHARED_CODE_SIZE, HEAPSTAT_GENCODE);
 }
 
+/* Returns whether bb ends in a backward direct branch or in an indirect
+ * branch.  Every cycle in the control flow graph contains one of these, so
+ * checking the instruction counter only in such bbs still bounds how long a
+ * thread can run between checks.
+ */
+static bool
+bb_ends_in_loop_edge(void *tag, instrlist_t *bb)
+{
+    instr_t *last;
+    for (last = instrlist_last(bb); last != NULL; last = instr_get_prev(last)) {
+        if (!instr_is_meta(last))
+            break;
+    }
+    if (last == NULL || !instr_is_cti(last))
+        return false;
+    if (instr_is_mbr(last) || !opnd_is_pc(instr_get_target(last)))
+        return true;
+    return opnd_get_pc(instr_get_target(last)) <= (app_pc) tag;
+}
+
 static void
 insert_instr_counter(void *drcontext, instrlist_t *bb,
                      instr_t *first, bool flags_dead, instr_t *where_dead,
-                     uint instrs_in_bb)
+                     uint instrs_in_bb, bool check)
 {
     instr_t *where = (where_dead == NULL) ? first : where_dead;
     instr_t *done = INSTR_CREATE_label(drcontext);
     if (!flags_dead)
         dr_save_arith_flags(drcontext, bb, first, SPILL_SLOT_1);
     /* Rather than an ongoing count that would need a 64-bit
-     * counter, we do a racy subtract of a 32-bit counter and if
+     * counter, we subtract from this thread's 32-bit counter and if
      * negative (so we don't need a cmp) then we go to a callout
-     * that synchs for a counter reset and single snapshot.
-     * We assume that racy mods during that synch won't overflow
-     * the counter.  We also ignore the detail of how many instrs
-     * in this bb we've executed yet.
+     * that synchs to add it to instr_count and take any snapshot.
+     * We ignore the detail of how many instrs in this bb we've executed yet.
      */
     instrlist_meta_preinsert
-        (bb, where, INSTR_CREATE_sub(drcontext, OPND_CREATE_ABSMEM
-                                     ((byte *)&instr_count, OPSZ_4),
+        (bb, where, INSTR_CREATE_sub(drcontext, opnd_create_far_base_disp_ex
+                                     /* must use 0 scale to match what DR
+                                      * decodes for opnd_same
+                                      */
+                                     (instrcnt_seg, REG_NULL, REG_NULL, 0,
+                                      instrcnt_offs, OPSZ_4, false, true, false),
                                      (instrs_in_bb <= CHAR_MAX) ?
                                      OPND_CREATE_INT8(instrs_in_bb) :
                                      OPND_CREATE_INT32(instrs_in_bb)));
-    /* TODO: for better perf could not bother to check threshold
-     * in every bb: but don't want to skip for single-bb-loop-body
-     */
-    instrlist_meta_preinsert
-        (bb, where, INSTR_CREATE_jcc(drcontext, OP_jns_short,
-                                     opnd_create_instr(done)));
-    /* To avoid the code expansion from a clean call in every bb we use
-     * a shared clean call sequence, entering it with a direct jump
-     * and exiting with an indirect jump to a stored return point.
-     */
-    /* Get return point into SPILL_SLOT_2.  Spill reg, mov imm to reg, and then
-     * xchg reg and slot isn't any faster, right?
-     */
-    instrlist_meta_preinsert
-        (bb, where, INSTR_CREATE_mov_st
-         (drcontext, dr_reg_spill_slot_opnd(drcontext, SPILL_SLOT_2),
-          opnd_create_instr(done)));
-    instrlist_meta_preinsert
-        (bb, where, INSTR_CREATE_jmp(drcontext,
-                                     opnd_create_pc(shared_instrcnt_callout)));
-    /* Will return here */
-    instrlist_meta_preinsert(bb, where, done);
+    if (check) {
+        instrlist_meta_preinsert
+            (bb, where, INSTR_CREATE_jcc(drcontext, OP_jns_short,
+                                         opnd_create_instr(done)));
+        /* To avoid the code expansion from a clean call in every bb we use
+         * a shared clean call sequence, entering it with a direct jump
+         * and exiting with an indirect jump to a stored return point.
+         */
+        /* Get return point into SPILL_SLOT_2.  Spill reg, mov imm to reg, and
+         * then xchg reg and slot isn't any faster, right?
+         */
+        instrlist_meta_preinsert
+            (bb, where, INSTR_CREATE_mov_st
+             (drcontext, dr_reg_spill_slot_opnd(drcontext, SPILL_SLOT_2),
+              opnd_create_instr(done)));
+        instrlist_meta_preinsert
+            (bb, where, INSTR_CREATE_jmp(drcontext,
+                                         opnd_create_pc(shared_instrcnt_callout)));
+        /* Will return here */
+        instrlist_meta_preinsert(bb, where, done);
+    } else
+        instr_destroy(drcontext, done);
     if (!flags_dead)
         dr_restore_arith_flags(drcontext, bb, first, SPILL_SLOT_1);
 }
@@ -1298,6 +2029,8 @@ event_bb_app2app(void *drcontext, void *tag, instrlist_t *bb,
     /* we pass bi among all 4 phases */
     instru_info_t *ii = thread_alloc(drcontext, sizeof(*ii), HEAPSTAT_PERBB);
     memset(ii, 0, sizeof(*ii));
+    /* Read once so all phases agree even if the interval changes */
+    ii->stale_sample = stale_sampling;
     *user_data = (void *) ii;
     return DR_EMIT_DEFAULT;
 }
@@ -1365,7 +2098,10 @@ event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
         /* update liveness of whole-bb spilled regs */
         fastpath_pre_instrument(drcontext, bb, inst, &ii->bi);
 
-        if (instr_uses_memory_we_track(inst)) {
+        /* For -stale_sample we keep the whole-bb spill framework but skip the
+         * memref instrumentation outside of the sampled intervals.
+         */
+        if (ii->stale_sample && instr_uses_memory_we_track(inst)) {
             if (instr_ok_for_instrument_fastpath(inst, &mi, &ii->bi)) {
                 instrument_fastpath(drcontext, bb, inst, &mi, false);
                 ii->bi.added_instru = true;
@@ -1389,7 +2125,7 @@ event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
         }
     }
 
-    if (ZERO_STACK() && instr_writes_esp(inst)) {
+    if (ZERO_STACK() && !options.zero_stack_lazy && instr_writes_esp(inst)) {
         /* any new spill must be after the alloc instru */
         ii->bi.spill_after = instr_get_prev(inst);
         /* we zero for leaks, and staleness does not care about xsp */
@@ -1420,13 +2156,16 @@ event_bb_instru2instru(void *drcontext, void *tag, instrlist_t *bb,
                               */
                              (ii->where_dead == NULL) ?
                              instrlist_first(bb) : instr_get_next(ii->where_dead),
-                             ii->instrs_in_bb);
+                             ii->instrs_in_bb, bb_ends_in_loop_edge(tag, bb));
     }
 
     LOG(3, "final instrumentation:\n");
     DOLOG(3, instrlist_disassemble(drcontext, tag, bb, LOGFILE_GET(drcontext)););
 
     thread_free(drcontext, ii, sizeof(*ii), HEAPSTAT_PERBB);
+    /* With -stale_sample a re-translation could see a different interval */
+    if (options.staleness && options.stale_sample > 1)
+        return DR_EMIT_STORE_TRANSLATIONS;
     return DR_EMIT_DEFAULT; /* deterministic */
 }
 
@@ -1436,13 +2175,13 @@ event_bb_instru2instru(void *drcontext, void *tag, instrlist_t *bb,
 
 #ifdef STATISTICS
 /* statistics
- * FIXME: make per-thread to avoid races (or use locked inc)
- * may want some of these to be 64-bit
+ * FIXME: may want some of these to be 64-bit
  */
 static void
 dump_statistics(void)
 {
     int i;
+    stats_fold();
     dr_fprintf(f_global, "Statistics:\n");
     dr_fprintf(f_global, "app mallocs: %8u, frees: %8u, large mallocs; %6u\n",
                num_mallocs, num_frees, num_large_mallocs);
@@ -1450,9 +2189,15 @@ dump_statistics(void)
     dr_fprintf(f_global, "app heap regions: %8u\n", heap_regions);
     dr_fprintf(f_global, "peaks detected: %8u, skipped: %8u\n",
                peaks_detected, peaks_skipped);
+    dr_fprintf(f_global, "thread delta folds: %8u\n", delta_folds);
     if (options.staleness) {
         dr_fprintf(f_global, "staleness: needs large: %7u, needs ext: %7u\n",
                    stale_needs_large, stale_small_needs_ext);
+        dr_fprintf(f_global, "staleness sampling flushes: %7u\n",
+                   stale_sample_flushes);
+    }
+    if (options.merge_small_sites > 0) {
+        dr_fprintf(f_global, "small allocation sites merged: %8u\n", sites_merged);
     }
 
     /* FIXME: share w/ drmemory.c */
@@ -1603,9 +2348,17 @@ create_global_logfile(void)
     LOGF(1, f_global, "global logfile fd=%d\n", f_global);
 
     f_callstack = open_logfile("callstack.log", false, -1);
-    f_snapshot = open_logfile("snapshot.log", false, -1);
-    if (options.staleness)
-        f_staleness = open_logfile("staleness.log", false, -1);
+    if (options.binary_snapshots) {
+        /* This holds the staleness data too, and drheapstat_format recreates
+         * the nudge index along with the text logs.
+         */
+        f_snapshot = open_logfile("snapshot.bin", false, -1);
+        snap_bin_init();
+    } else {
+        f_snapshot = open_logfile("snapshot.log", false, -1);
+        if (options.staleness)
+            f_staleness = open_logfile("staleness.log", false, -1);
+    }
 
     /* For long running multi-process apps like sfcbd, this can mean a lot of
      * index files.  With each file being 1 MB minimum on esxi, space can be
@@ -1615,8 +2368,10 @@ create_global_logfile(void)
      * problem gets out of hand, we might use the global log, but then that
      * requires parsing the global log, which can get large.
      */
-    f_nudge = open_logfile("nudge.idx", false, -1);
-    dr_fprintf(f_nudge, "%s snapshots\n", options.dump ? "variable" : "constant");
+    if (!options.binary_snapshots) {
+        f_nudge = open_logfile("nudge.idx", false, -1);
+        dr_fprintf(f_nudge, "%s snapshots\n", options.dump ? "variable" : "constant");
+    }
 }
 
 static void
@@ -1652,6 +2407,25 @@ reset_to_time_zero(bool keep_offs)
     dr_mutex_unlock(snapshot_lock);
 }
 
+/* For -stale_sample: called at the end of each staleness interval to turn
+ * the memref instrumentation on for one of every -stale_sample intervals
+ */
+static void
+stale_sample_next_interval(void)
+{
+    bool sample;
+    stale_intervals++;
+    sample = ((stale_intervals % options.stale_sample) == 0);
+    if (sample != stale_sampling) {
+        LOG(2, "stale sampling %s @interval %u\n", sample ? "on" : "off",
+            stale_intervals);
+        stale_sampling = sample;
+        STATS_INC(stale_sample_flushes);
+        /* Re-instrument all code on its next execution */
+        dr_delay_flush_region(0, (size_t)-1, 0, NULL);
+    }
+}
+
 static void
 event_timer(void *drcontext, dr_mcontext_t *mcontext)
 {
@@ -1699,6 +2473,8 @@ event_timer(void *drcontext, dr_mcontext_t *mcontext)
     }
     if (alarm_stale) {
         staleness_sweep(stamp);
+        if (options.stale_sample > 1)
+            stale_sample_next_interval();
     }
 }
 
@@ -1787,9 +2563,11 @@ event_fork(void *drcontext)
     close_file(f_global);
     close_file(f_callstack);
     close_file(f_snapshot);
-    if (options.staleness)
-        close_file(f_staleness);
-    close_file(f_nudge);
+    if (!options.binary_snapshots) {
+        if (options.staleness)
+            close_file(f_staleness);
+        close_file(f_nudge);
+    }
     /* now create new files for all 5 */
     create_global_logfile();
     utils_thread_set_file(drcontext, f_global);
@@ -1907,6 +2685,9 @@ event_pre_syscall(void *drcontext, int sysnum)
 
     handle_pre_alloc_syscall(drcontext, sysnum, mc);
 
+    if (ZERO_STACK() && options.zero_stack_lazy)
+        zero_dead_stack(drcontext, (byte *)mc->xsp);
+
 #ifdef UNIX
     if (sysnum == SYS_fork ||
         (sysnum == SYS_clone &&
@@ -1982,7 +2763,10 @@ event_nudge(void *drcontext, uint64 argument)
     malloc_lock(); /* must be acquired before snapshot_lock */
     nudge_count++;
     snapshot_dump_all();
-    print_nudge_header(f_snapshot);
+    if (options.binary_snapshots)
+        snap_bin_write_nudge(snaps[snap_idx].stamp);
+    else
+        print_nudge_header(f_snapshot);
     print_nudge_header(f_callstack);
     if (options.dump) {
         /* For const # snapshots, we want the peak to be the global peak for the
@@ -1992,7 +2776,7 @@ event_nudge(void *drcontext, uint64 argument)
         free_snapshot(&snap_peak);
         memset(&snap_peak, 0, sizeof(snap_peak));
     }
-    if (options.staleness)
+    if (options.staleness && !options.binary_snapshots)
         print_nudge_header(f_staleness);
 
     /* Print the nudge index information, i.e., for each nudge, print the file
@@ -2003,12 +2787,14 @@ event_nudge(void *drcontext, uint64 argument)
      * to staleness.log.  Also specify whether snapshots are fixed in number or
      * variable (-dump).  PR 502468.
      */
-    snapshot_fpos = dr_file_tell(f_snapshot);
-    if (options.staleness)
-        staleness_fpos = dr_file_tell(f_staleness);
-    ASSERT(snapshot_fpos >= 0 && staleness_fpos >= 0, "bad log file location");
-    dr_fprintf(f_nudge, "%d,%"INT64_FORMAT"u,%"INT64_FORMAT"u\n",
-               nudge_count, snapshot_fpos, staleness_fpos);
+    if (!options.binary_snapshots) {
+        snapshot_fpos = dr_file_tell(f_snapshot);
+        if (options.staleness)
+            staleness_fpos = dr_file_tell(f_staleness);
+        ASSERT(snapshot_fpos >= 0 && staleness_fpos >= 0, "bad log file location");
+        dr_fprintf(f_nudge, "%d,%"INT64_FORMAT"u,%"INT64_FORMAT"u\n",
+                   nudge_count, snapshot_fpos, staleness_fpos);
+    }
     malloc_unlock();
     check_reachability(false/*!at_exit*/);
     print_nudge_header(f_global);
@@ -2061,6 +2847,31 @@ event_thread_init(void *drcontext)
     pt->errbufsz = MAX_ERROR_INITIAL_LINES + max_callstack_size();
     pt->errbuf = (char *) thread_alloc(drcontext, pt->errbufsz, HEAPSTAT_MISC);
 
+    if (options.thread_delta_max > 0) {
+        /* Global since other threads fold it */
+        pt->delta = (snap_delta_t *)
+            global_alloc(sizeof(*pt->delta), HEAPSTAT_SNAPSHOT);
+        memset(pt->delta, 0, sizeof(*pt->delta));
+        malloc_lock();
+        pt->delta->next = snap_delta_list;
+        if (snap_delta_list != NULL)
+            snap_delta_list->prev = pt->delta;
+        snap_delta_list = pt->delta;
+        malloc_unlock();
+    }
+
+    if (options.time_instrs) {
+        pt->instrcnt = (int *)
+            (dr_get_dr_segment_base(instrcnt_seg) + instrcnt_offs);
+        *pt->instrcnt = instr_chunk;
+        dr_mutex_lock(snapshot_lock);
+        pt->instrcnt_next = instrcnt_threads;
+        if (instrcnt_threads != NULL)
+            instrcnt_threads->instrcnt_prev = pt;
+        instrcnt_threads = pt;
+        dr_mutex_unlock(snapshot_lock);
+    }
+
     LOGPT(2, PT_GET(drcontext), "in event_thread_init()\n");
     callstack_thread_init(drcontext);
     if (options.check_leaks || options.staleness)
@@ -2079,6 +2890,33 @@ event_thread_exit(void *drcontext)
         instrument_thread_init(drcontext);
     callstack_thread_exit(drcontext);
     utils_thread_exit(drcontext);
+    if (options.time_instrs) {
+        dr_mutex_lock(snapshot_lock);
+        /* We do not bother with a snapshot if one is due */
+        instrcnt_flush(pt);
+        if (pt->instrcnt_prev == NULL)
+            instrcnt_threads = pt->instrcnt_next;
+        else
+            pt->instrcnt_prev->instrcnt_next = pt->instrcnt_next;
+        if (pt->instrcnt_next != NULL)
+            pt->instrcnt_next->instrcnt_prev = pt->instrcnt_prev;
+        dr_mutex_unlock(snapshot_lock);
+    }
+    if (pt->delta != NULL) {
+        /* Folding just our own deltas could make counts negative */
+        malloc_lock();
+        dr_mutex_lock(snapshot_lock);
+        snapshot_fold_deltas();
+        dr_mutex_unlock(snapshot_lock);
+        if (pt->delta->prev == NULL)
+            snap_delta_list = pt->delta->next;
+        else
+            pt->delta->prev->next = pt->delta->next;
+        if (pt->delta->next != NULL)
+            pt->delta->next->prev = pt->delta->prev;
+        malloc_unlock();
+        global_free(pt->delta, sizeof(*pt->delta), HEAPSTAT_SNAPSHOT);
+    }
     thread_free(drcontext, (void *) pt->errbuf, pt->errbufsz, HEAPSTAT_MISC);
     /* with PR 536058 we do have dcontext in exit event so indicate explicitly
      * that we've cleaned up the per-thread data
@@ -2122,6 +2960,8 @@ event_exit(void)
     LOG(1, "final alloc stack table size: %u bits, %u entries\n",
         alloc_stack_table.table_bits, alloc_stack_table.entries);
     hashtable_delete(&alloc_stack_table);
+    if (small_sites != NULL)
+        alloc_callstack_free(small_sites);
 #ifdef CHECK_WITH_MD5
     hashtable_delete(&alloc_md5_table);
 #endif
@@ -2131,6 +2971,11 @@ event_exit(void)
         shadow_exit();
     }
     free_shared_code();
+    if (options.time_instrs) {
+        IF_DEBUG(bool ok =)
+            dr_raw_tls_cfree(instrcnt_offs, 1);
+        ASSERT(ok, "WARNING: unable to free tls slot");
+    }
     utils_exit();
 
     if (options.use_symcache)
@@ -2152,13 +2997,18 @@ event_exit(void)
     close_file(f_global);
     dr_fprintf(f_callstack, "LOG END\n");
     close_file(f_callstack);
-    dr_fprintf(f_snapshot, "LOG END\n");
-    close_file(f_snapshot);
-    if (options.staleness) {
-        dr_fprintf(f_staleness, "LOG END\n");
-        close_file(f_staleness);
+    if (options.binary_snapshots) {
+        /* snapshot_exit() wrote the footer, which serves the same purpose */
+        close_file(f_snapshot);
+    } else {
+        dr_fprintf(f_snapshot, "LOG END\n");
+        close_file(f_snapshot);
+        if (options.staleness) {
+            dr_fprintf(f_staleness, "LOG END\n");
+            close_file(f_staleness);
+        }
+        close_file(f_nudge);
     }
-    close_file(f_nudge);
 }
 
 DR_EXPORT void
@@ -2268,6 +3118,7 @@ dr_init(client_id_t client_id)
     callstack_ops.tool_lib_ignore = IF_WINDOWS_ELSE("drheapstatlib.dll",
                                                     "libdrheapstatlib.so*");
     callstack_ops.bad_fp_list = options.callstack_bad_fp_list;
+    callstack_ops.fp_cache_entries = options.callstack_fp_cache_size;
     callstack_init(&callstack_ops);
 
     heap_region_init(client_heap_add, client_heap_remove);
@@ -2321,6 +3172,15 @@ dr_init(client_id_t client_id)
     if (options.check_leaks || options.staleness)
         instrument_init();
 
+    if (options.time_instrs) {
+        IF_DEBUG(bool ok =)
+            dr_raw_tls_calloc(&instrcnt_seg, &instrcnt_offs, 1, 0);
+        ASSERT(ok, "fatal error: unable to reserve tls slot");
+        /* Each thread can be up to a chunk off when we snapshot */
+        instr_chunk = (options.dump_freq < INSTR_CHUNK_MAX) ?
+            options.dump_freq : INSTR_CHUNK_MAX;
+    }
+
     create_shared_code();
 
     if (options.time_clock)
@@ -2339,6 +3199,7 @@ dr_init(client_id_t client_id)
                   options.midchunk_string_ok,
                   options.midchunk_size_ok,
                   options.show_reachable,
+                  options.leak_scan_threads,
                   IF_WINDOWS_(options.check_encoded_pointers)
                   NULL, NULL, NULL);
     }
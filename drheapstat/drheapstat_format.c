@@ -0,0 +1,411 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Offline expander for the snapshot.bin file written by -binary_snapshots.
+ *
+ * By default we recreate snapshot.log, staleness.log, and nudge.idx in the
+ * log directory exactly as Dr. Heapstat would have written them without
+ * -binary_snapshots, so that the post-processing and visualization tools
+ * can be used unchanged.  With -snapshot N we use the index at the end of
+ * the file to decode just snapshot N, starting from the key snapshot before
+ * it, and print it to stdout.
+ */
+
+#ifdef WINDOWS
+/* We use drfrontendlib, whose model has us take in UTF-16 argv */
+# define UNICODE
+# define _UNICODE
+#else
+# define _FILE_OFFSET_BITS 64
+#endif
+
+#include "dr_api.h"
+#include "dr_frontend.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Pull in BUFFER_SIZE_ELEMENTS, IF_WINDOWS, DIRSEP, and other useful macros */
+#include "utils.h"
+#include "snapshot_binary.h"
+
+#ifdef WINDOWS
+# define fseek64 _fseeki64
+# define ftell64 _ftelli64
+#else
+# define _stricmp strcasecmp
+# define fseek64 fseeko
+# define ftell64 ftello
+#endif
+
+#define USAGE "Usage:\n\
+  %s [-snapshot <N>] <log directory>\n\
+Expands the snapshot.bin file written by -binary_snapshots into\n\
+snapshot.log, staleness.log, and nudge.idx in the same directory.\n\
+Optional parameters:\n\
+  -snapshot = print only snapshot N to stdout\n"
+
+typedef struct _used_t {
+    uint instances;
+    uint bytes_asked_for;
+    uint extra_usable;
+    uint extra_occupied;
+} used_t;
+
+static snap_bin_header_t header;
+
+/* The usage of each callstack id as of the last SNAPSHOT record decoded */
+static used_t *used;
+static uint max_used;
+
+static byte *rec_buf;
+static size_t rec_buf_size;
+
+static void *
+xrealloc(void *ptr, size_t size)
+{
+    void *res = realloc(ptr, size);
+    if (res == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    return res;
+}
+
+static bool
+read_varint(const byte **pos, const byte *end, uint64 *val OUT)
+{
+    uint shift = 0;
+    *val = 0;
+    while (*pos < end && shift < 64) {
+        byte b = **pos;
+        (*pos)++;
+        *val |= ((uint64)(b & 0x7f)) << shift;
+        if (!TEST(0x80, b))
+            return true;
+        shift += 7;
+    }
+    return false;
+}
+
+/* Returns the next record, or NULL at the end of the records */
+static snap_bin_rec_t *
+read_record(FILE *f)
+{
+    snap_bin_rec_t rec;
+    if (fread(&rec, sizeof(rec), 1, f) != 1)
+        return NULL;
+    if (rec.size < sizeof(rec) ||
+        (rec.kind == SNAP_BIN_SNAPSHOT && rec.size < sizeof(snap_bin_snapshot_t)) ||
+        (rec.kind == SNAP_BIN_NUDGE && rec.size < sizeof(snap_bin_nudge_t))) {
+        /* The index footer starts here, or the file is truncated */
+        return NULL;
+    }
+    if (rec.size > rec_buf_size) {
+        rec_buf_size = rec.size;
+        rec_buf = (byte *) xrealloc(rec_buf, rec_buf_size);
+    }
+    memcpy(rec_buf, &rec, sizeof(rec));
+    if (fread(rec_buf + sizeof(rec), rec.size - sizeof(rec), 1, f) != 1)
+        return NULL;
+    return (snap_bin_rec_t *) rec_buf;
+}
+
+static void
+grow_used(uint64 id)
+{
+    uint new_max;
+    if (id < max_used)
+        return;
+    new_max = (max_used == 0) ? 1024 : max_used;
+    while (new_max <= id)
+        new_max *= 2;
+    used = (used_t *) xrealloc(used, new_max*sizeof(*used));
+    memset(used + max_used, 0, (new_max - max_used)*sizeof(*used));
+    max_used = new_max;
+}
+
+/* Applies the heap entries of snap to our usage state, and prints the
+ * snapshot if the files are non-NULL.  Returns false if malformed.
+ */
+static bool
+decode_snapshot(snap_bin_snapshot_t *snap, FILE *f_snap, FILE *f_stale)
+{
+    const byte *pos = (const byte *)(snap + 1);
+    const byte *end = (const byte *)snap + snap->rec.size;
+    uint64 id, vals[4], bytes, delta, access = 0;
+    uint i, j;
+
+    if (TEST(SNAP_BIN_KEY, snap->rec.flags) && used != NULL)
+        memset(used, 0, max_used*sizeof(*used));
+    for (i = 0; i < snap->num_heap; i++) {
+        if (!read_varint(&pos, end, &id))
+            return false;
+        for (j = 0; j < 4; j++) {
+            if (!read_varint(&pos, end, &vals[j]))
+                return false;
+        }
+        grow_used(id);
+        used[id].instances = (uint) vals[0];
+        used[id].bytes_asked_for = (uint) vals[1];
+        used[id].extra_usable = (uint) vals[2];
+        used[id].extra_occupied = (uint) vals[3];
+    }
+
+    if (f_snap != NULL) {
+        fprintf(f_snap, "SNAPSHOT #%4d @ %16"INT64_FORMAT"u %s\n",
+                snap->number, snap->stamp, header.unit_name);
+        fprintf(f_snap, "idx=%d, stamp_offs=%16"INT64_FORMAT"u\n",
+                snap->idx, snap->stamp_offs);
+        fprintf(f_snap, "total: %"INT64_FORMAT"u,%"INT64_FORMAT"u,%"
+                INT64_FORMAT"u,%"INT64_FORMAT"u\n",
+                snap->tot_mallocs, snap->tot_bytes_asked_for,
+                snap->tot_bytes_usable, snap->tot_bytes_occupied);
+        /* The order within a snapshot does not matter to the readers */
+        for (i = 0; i < max_used; i++) {
+            if (used[i].bytes_asked_for + used[i].extra_usable > 0) {
+                fprintf(f_snap, "%u,%u,%u,%u,%u\n", i, used[i].instances,
+                        used[i].bytes_asked_for, used[i].extra_usable,
+                        used[i].extra_occupied);
+            }
+        }
+    }
+    if (f_stale != NULL) {
+        fprintf(f_stale, "SNAPSHOT #%4d @ %16"INT64_FORMAT"u %s\n",
+                snap->number, snap->stamp, header.unit_name);
+    }
+    for (i = 0; i < snap->num_stale; i++) {
+        if (!read_varint(&pos, end, &id) ||
+            !read_varint(&pos, end, &bytes) ||
+            !read_varint(&pos, end, &delta))
+            return false;
+        /* Undo the zigzag encoding */
+        access += (delta >> 1) ^ (~(delta & 1) + 1);
+        if (f_stale != NULL) {
+            fprintf(f_stale, "%u,%u,%"INT64_FORMAT"u\n", (uint)id, (uint)bytes,
+                    access);
+        }
+    }
+    return true;
+}
+
+static bool
+read_header(FILE *f, const char *path)
+{
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, SNAP_BIN_MAGIC, sizeof(header.magic)) != 0) {
+        printf("ERROR: %s is not a -binary_snapshots file\n", path);
+        return false;
+    }
+    if (header.version != SNAP_BIN_VERSION || header.header_size != sizeof(header)) {
+        printf("ERROR: %s has unsupported version %d\n", path, header.version);
+        return false;
+    }
+    NULL_TERMINATE_BUFFER(header.unit_name);
+    return true;
+}
+
+/* Reads the footer if the process exited cleanly, leaving f positioned
+ * just past the header.
+ */
+static bool
+read_footer(FILE *f, snap_bin_footer_t *footer OUT)
+{
+    bool ok = (fseek64(f, -(int64)sizeof(*footer), SEEK_END) == 0 &&
+               fread(footer, sizeof(*footer), 1, f) == 1 &&
+               memcmp(footer->magic, SNAP_BIN_FOOTER_MAGIC,
+                      sizeof(footer->magic)) == 0);
+    fseek64(f, sizeof(header), SEEK_SET);
+    return ok;
+}
+
+static FILE *
+open_output(const char *dir, const char *name)
+{
+    char path[MAXIMUM_PATH];
+    FILE *f;
+    _snprintf(path, BUFFER_SIZE_ELEMENTS(path), "%s%c%s", dir, DIRSEP, name);
+    NULL_TERMINATE_BUFFER(path);
+    f = fopen(path, "w");
+    if (f == NULL)
+        printf("ERROR: unable to write %s\n", path);
+    return f;
+}
+
+/* Recreates all of the text logs */
+static bool
+expand_all(FILE *f, const char *dir)
+{
+    bool ok = true, has_stale = TEST(SNAP_BIN_STALENESS, header.flags);
+    FILE *f_snap, *f_stale = NULL, *f_nudge;
+    snap_bin_rec_t *rec;
+    int nudge_count = 0;
+    snap_bin_footer_t footer;
+    bool has_footer = read_footer(f, &footer);
+
+    f_snap = open_output(dir, "snapshot.log");
+    if (has_stale)
+        f_stale = open_output(dir, "staleness.log");
+    f_nudge = open_output(dir, "nudge.idx");
+    if (f_snap == NULL || (has_stale && f_stale == NULL) || f_nudge == NULL)
+        return false;
+    fprintf(f_nudge, "%s snapshots\n",
+            TEST(SNAP_BIN_VARIABLE, header.flags) ? "variable" : "constant");
+
+    /* Without the footer we read until a record is truncated */
+    while (ok && (!has_footer || (uint64) ftell64(f) < footer.index_offset) &&
+           (rec = read_record(f)) != NULL) {
+        if (rec->kind == SNAP_BIN_SNAPSHOT) {
+            ok = decode_snapshot((snap_bin_snapshot_t *) rec, f_snap, f_stale);
+        } else if (rec->kind == SNAP_BIN_NUDGE) {
+            snap_bin_nudge_t *nudge = (snap_bin_nudge_t *) rec;
+            nudge_count++;
+            fprintf(f_snap, "NUDGE @ %16"INT64_FORMAT"u %s\n\n",
+                    nudge->stamp, header.unit_name);
+            if (has_stale) {
+                fprintf(f_stale, "NUDGE @ %16"INT64_FORMAT"u %s\n\n",
+                        nudge->stamp, header.unit_name);
+            }
+            fprintf(f_nudge, "%d,%"INT64_FORMAT"u,%"INT64_FORMAT"u\n", nudge_count,
+                    (uint64) ftell64(f_snap),
+                    has_stale ? (uint64) ftell64(f_stale) : 0);
+        }
+        /* Unknown kinds are skipped */
+    }
+    if (!ok)
+        printf("ERROR: malformed snapshot record\n");
+
+    /* The text logs only end with LOG END after a clean exit, which is also
+     * when the footer is written.
+     */
+    if (has_footer) {
+        fprintf(f_snap, "LOG END\n");
+        if (has_stale)
+            fprintf(f_stale, "LOG END\n");
+    }
+    fclose(f_snap);
+    if (has_stale)
+        fclose(f_stale);
+    fclose(f_nudge);
+    return ok;
+}
+
+/* Prints snapshot number n to stdout */
+static bool
+expand_one(FILE *f, uint64 n)
+{
+    snap_bin_footer_t footer;
+    snap_bin_index_t entry;
+    snap_bin_rec_t *rec;
+    bool has_stale = TEST(SNAP_BIN_STALENESS, header.flags);
+
+    if (!read_footer(f, &footer)) {
+        printf("ERROR: no index found: the process did not exit cleanly\n");
+        return false;
+    }
+    if (n >= footer.num_snapshots) {
+        printf("ERROR: there are only %"INT64_FORMAT"u snapshots\n",
+               footer.num_snapshots);
+        return false;
+    }
+    if (fseek64(f, footer.index_offset + n*sizeof(entry), SEEK_SET) != 0 ||
+        fread(&entry, sizeof(entry), 1, f) != 1 ||
+        fseek64(f, entry.key_offset, SEEK_SET) != 0) {
+        printf("ERROR: malformed index\n");
+        return false;
+    }
+    /* Decode the deltas from the key snapshot up through ours */
+    while ((uint64) ftell64(f) < entry.offset) {
+        rec = read_record(f);
+        if (rec == NULL ||
+            (rec->kind == SNAP_BIN_SNAPSHOT &&
+             !decode_snapshot((snap_bin_snapshot_t *) rec, NULL, NULL))) {
+            printf("ERROR: malformed snapshot record\n");
+            return false;
+        }
+    }
+    rec = read_record(f);
+    if (rec == NULL || rec->kind != SNAP_BIN_SNAPSHOT ||
+        !decode_snapshot((snap_bin_snapshot_t *) rec, stdout,
+                         has_stale ? stdout : NULL)) {
+        printf("ERROR: malformed snapshot record\n");
+        return false;
+    }
+    return true;
+}
+
+int
+_tmain(int argc, TCHAR *targv[])
+{
+    int res = 1;
+    char **argv;
+    int i;
+    const char *dir = NULL;
+    char path[MAXIMUM_PATH];
+    bool one = false;
+    uint64 n = 0;
+    FILE *f;
+
+#if defined(WINDOWS) && !defined(_UNICODE)
+# error _UNICODE must be defined
+#else
+    /* Convert to UTF-8 if necessary */
+    if (drfront_convert_args((const TCHAR **)targv, &argv, argc) != DRFRONT_SUCCESS) {
+        printf("ERROR: failed to process args\n");
+        return 1;
+    }
+#endif
+
+    for (i = 1; i < argc; i++) {
+        if (_stricmp(argv[i], "-snapshot") == 0 && i + 1 < argc) {
+            one = true;
+            n = strtoull(argv[++i], NULL, 0);
+        } else if (argv[i][0] != '-' && dir == NULL)
+            dir = argv[i];
+        else {
+            printf(USAGE, argv[0]);
+            goto cleanup;
+        }
+    }
+    if (dir == NULL) {
+        printf(USAGE, argv[0]);
+        goto cleanup;
+    }
+
+    _snprintf(path, BUFFER_SIZE_ELEMENTS(path), "%s%csnapshot.bin", dir, DIRSEP);
+    NULL_TERMINATE_BUFFER(path);
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("ERROR: unable to read %s\n", path);
+        goto cleanup;
+    }
+    if (read_header(f, path) &&
+        (one ? expand_one(f, n) : expand_all(f, dir)))
+        res = 0;
+    fclose(f);
+    free(rec_buf);
+    free(used);
+
+ cleanup:
+    if (drfront_cleanup_args(argv, argc) != DRFRONT_SUCCESS)
+        printf("WARNING: drfront_cleanup_args failed\n");
+    return res;
+}
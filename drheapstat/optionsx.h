@@ -119,9 +119,24 @@ OPTION_CLIENT_BOOL(client, dump, false,
 OPTION_CLIENT(client, dump_freq, uint, 1, 0, UINT_MAX,
               "Frequency at which to take snapshots for -dump",
               "If explicitly set to a non-zero value, enables -dump and indicates the frequency at which data will be written to the log files.  For -time_instrs, the frequency is -dump_freq*1000 instructions.  For -time_clock, the frequency is -dump_freq*10 milliseconds.  For -time_allocs, the frequency is -dump_freq instances of allocations and deallocations.  For -time_bytes, the frequency is -dump_freq bytes of allocations and deallocations.  For all cases the exact point of each snapshot may vary slightly from the precise -dump_freq specified.")
+OPTION_CLIENT_BOOL(client, binary_snapshots, false,
+                   "Write snapshots in a compact binary format",
+                   "Write snapshots and staleness data to snapshot.bin in a compact binary format rather than to snapshot.log and staleness.log.  Each snapshot only records the allocation sites whose usage changed since the prior one, and an index at the end of the file allows seeking to any snapshot.  Run drheapstat_format on the log directory to recreate the text logs and the nudge index for -visualize, or to print a single snapshot.")
+OPTION_CLIENT(client, merge_small_sites, uint, 0, 0, UINT_MAX,
+              "Merge allocation sites using fewer bytes than this",
+              "If non-zero, an allocation site whose live bytes stay below this value for -merge_small_after snapshots in a row is merged into a single <small allocation sites> callstack, which also receives all of its later allocations.  Snapshot totals stay exact, while the memory Dr. Heapstat uses for each snapshot no longer grows with the number of small or short-lived allocation sites.  Snapshots taken before the merge still list the site separately.")
+OPTION_CLIENT(client, merge_small_after, uint, 8, 1, UINT_MAX,
+              "Snapshots an allocation site must stay small before merging",
+              "The number of snapshots in a row for which an allocation site must use fewer than -merge_small_sites bytes before it is merged.")
+OPTION_CLIENT_BOOL(client, collapsed_stacks, false,
+                   "Also write each snapshot in collapsed-stack format",
+                   "For each snapshot written to snapshot.log (or snapshot.bin), including the peak snapshot, also write a heap.<N>.folded file (heap.<N>.peak.folded for the peak) in the log directory, where N is the snapshot number.  Each line holds the symbolized callstack of one allocation site, outermost frame first and separated by semicolons, followed by the bytes it has allocated.  Flame graph tools read these files directly, and existing converters turn them into pprof profiles.  Callstacks are only symbolized when written.  This option keeps every allocation callstack in memory for the whole run.")
 OPTION_CLIENT(client, peak_threshold, uint, 5, 0, 99,
               "Accuracy of peak snapshot, in percentage from the true peak.",
               "A new peak snapshot will only be taken if it is more than this percentage different from the existing peak snapshot in any of total size, number of allocations and frees, and timestamp.  Lowering this number can reduce performance but will also increase accuracy.")
+OPTION_CLIENT(client, thread_delta_max, uint, 64*1024, 0, UINT_MAX,
+              "Maximum bytes of per-thread heap changes held back from snapshots",
+              "Each thread accumulates its changes in heap usage per allocation site locally and folds them into the current snapshot at each snapshot, when the thread exits, or when the total bytes it has allocated and freed since the last fold exceed this value.  Peak snapshot detection thus sees a total that may be off by up to this value per thread.  A value of 0 updates the current snapshot on every allocation and free.")
 
 OPTION_CLIENT_BOOL(client, staleness, true,
                    "Record staleness data for each allocation",
@@ -129,6 +144,9 @@ OPTION_CLIENT_BOOL(client, staleness, true,
 OPTION_CLIENT(client, stale_granularity, uint, 1000, 0, UINT_MAX,
               "Granularity of staleness, in milliseconds",
               "The granularity with which staleness is measured, in milliseconds.")
+OPTION_CLIENT(client, stale_sample, uint, 1, 1, UINT_MAX,
+              "Instrument memory references in one of every N staleness intervals",
+              "When greater than 1, memory references are only instrumented to record staleness during one of every N -stale_granularity intervals, and all code is re-instrumented when this changes.  This is much faster for long-running applications, but an allocation that is only accessed outside of the sampled intervals appears to have been last accessed in the prior sampled interval, so its staleness can be overestimated by up to N-1 intervals.  System call accesses are always recorded.")
 OPTION_CLIENT_BOOL(client, stale_ignore_sp, true,
                    "Ignore memory references off the stack",
                    "Do not track staleness of memory references that use only the stack pointer.  If your application allocates stacks in the heap, or uses the stack pointer register for purposes other than to point at the stack, then you should disable this option.  Disabling this option will decrease the performance of the Dr. Heapstat.")
@@ -0,0 +1,125 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The -binary_snapshots format written to snapshot.bin by Dr. Heapstat and
+ * expanded by drheapstat_format.
+ *
+ * The file is a snap_bin_header_t followed by records, each starting with a
+ * snap_bin_rec_t whose size covers the whole record.  A SNAPSHOT record
+ * replaces one snapshot in both snapshot.log and staleness.log.  Its fixed
+ * fields are followed by num_heap heap entries and then num_stale staleness
+ * entries, all as LEB128 varints:
+ *
+ *   heap entry:  callstack id, instances, bytes_asked_for, extra_usable,
+ *                extra_occupied
+ *   stale entry: callstack id, bytes, zigzag-encoded delta of last_access
+ *                from the prior stale entry's (from 0 for the first)
+ *
+ * The heap entries of a snapshot without SNAP_BIN_KEY only list the
+ * callstacks whose usage changed since the prior SNAPSHOT record in the file,
+ * with an all-zero entry for a callstack that is no longer present.  A KEY
+ * snapshot lists every callstack in use.  Staleness entries are always
+ * complete.
+ *
+ * At a clean exit the file ends with one snap_bin_index_t per SNAPSHOT
+ * record, in file order, followed by a snap_bin_footer_t, so a reader can
+ * seek to snapshot N by decoding from index[N].key_offset.  Without the footer
+ * (e.g., the process was killed) the records can still be read in order.
+ * All fields are laid out so that the format is identical for 32-bit and
+ * 64-bit writers.
+ */
+
+#ifndef _SNAPSHOT_BINARY_H_
+#define _SNAPSHOT_BINARY_H_ 1
+
+#define SNAP_BIN_MAGIC "DhSnapB"
+#define SNAP_BIN_FOOTER_MAGIC "DhSnapI"
+/* Must be bumped whenever any of the structures or encodings above change */
+#define SNAP_BIN_VERSION 1
+
+/* A KEY snapshot is written at least this often */
+#define SNAP_BIN_KEY_FREQ 32
+
+/* The longest LEB128 encoding of a 64-bit value */
+#define SNAP_BIN_MAX_VARINT 10
+
+#define SNAP_BIN_UNIT_LEN 32
+
+/* snap_bin_header_t.flags */
+#define SNAP_BIN_STALENESS 0x0001 /* stale entries are present */
+#define SNAP_BIN_VARIABLE  0x0002 /* -dump: variable number of snapshots */
+
+typedef enum {
+    SNAP_BIN_SNAPSHOT, /* snap_bin_snapshot_t */
+    SNAP_BIN_NUDGE,    /* snap_bin_nudge_t */
+} snap_bin_kind_t;
+
+/* snap_bin_rec_t.flags for SNAPSHOT records */
+#define SNAP_BIN_KEY 0x0001
+
+typedef struct _snap_bin_header_t {
+    char magic[8];
+    uint version;
+    uint header_size;
+    uint flags;
+    uint reserved;
+    char unit_name[SNAP_BIN_UNIT_LEN]; /* the x-axis unit, null-terminated */
+} snap_bin_header_t;
+
+typedef struct _snap_bin_rec_t {
+    ushort kind; /* snap_bin_kind_t */
+    ushort flags;
+    uint size;
+} snap_bin_rec_t;
+
+typedef struct _snap_bin_snapshot_t {
+    snap_bin_rec_t rec;
+    uint number;    /* sequential across the file, as in snapshot.log */
+    int idx;        /* -1 for the peak snapshot */
+    uint64 stamp;   /* including stamp_offs */
+    uint64 stamp_offs;
+    uint64 tot_mallocs;
+    uint64 tot_bytes_asked_for;
+    uint64 tot_bytes_usable;
+    uint64 tot_bytes_occupied;
+    uint num_heap;
+    uint num_stale;
+    /* Followed by the varint entries */
+} snap_bin_snapshot_t;
+
+/* Marks where a nudge's dump ends, replacing the NUDGE line in both logs */
+typedef struct _snap_bin_nudge_t {
+    snap_bin_rec_t rec;
+    uint64 stamp;
+} snap_bin_nudge_t;
+
+typedef struct _snap_bin_index_t {
+    uint64 offset;     /* of the SNAPSHOT record */
+    uint64 key_offset; /* of the most recent KEY record at or before it */
+} snap_bin_index_t;
+
+typedef struct _snap_bin_footer_t {
+    uint64 index_offset;
+    uint64 num_snapshots;
+    char magic[8];
+} snap_bin_footer_t;
+
+#endif /* _SNAPSHOT_BINARY_H_ */
@@ -260,10 +260,28 @@ slow_path_for_staleness(void *drcontext, dr_mcontext_t *mc, instr_t *inst,
     return true;
 }
 
+static bool
+mark_accessed_span(umbra_map_t *map, app_pc app_start, size_t app_size,
+                   byte *shadow_start, size_t shadow_size,
+                   umbra_shadow_memory_type_t shadow_type, void *user_data)
+{
+    if (shadow_type == UMBRA_SHADOW_MEMORY_TYPE_NORMAL) {
+        memset(shadow_start, 1, shadow_size);
+    } else if (shadow_start == NULL || *shadow_start != 1) {
+        /* Not allocated, or a shared block with some other value: let umbra
+         * allocate or replace it.  A shared default block already holding 1
+         * needs nothing.
+         */
+        shadow_set_range(app_start, app_start + app_size, 1);
+    }
+    return true;
+}
+
 bool
 handle_mem_ref(uint flags, app_loc_t *loc, byte *addr, size_t sz, dr_mcontext_t *mc)
 {
-    byte *ptr;
+    byte *start = (byte *) ALIGN_BACKWARD(addr, SHADOW_GRANULARITY);
+    byte *end = (byte *) ALIGN_FORWARD(addr + sz, SHADOW_GRANULARITY);
     /* We're piggybacking on Dr. Memory syscall, etc. code.  For reads
      * and writes we want to mark the shadow byte to indicate the
      * memory was accessed.  For an addressability check we do
@@ -271,12 +289,13 @@ handle_mem_ref(uint flags, app_loc_t *loc, byte *addr, size_t sz, dr_mcontext_t
      */
     if (TEST(MEMREF_CHECK_ADDRESSABLE, flags))
         return true;
-    /* We ignore MEMREF_MOVS, etc.: we don't propagate anything */
-    for (ptr = (byte *) ALIGN_BACKWARD(addr, SHADOW_GRANULARITY);
-         ptr < (byte *) ALIGN_FORWARD(addr + sz, SHADOW_GRANULARITY);
-         ptr += SHADOW_GRANULARITY) {
-        shadow_set_byte(ptr, 1);
-    }
+    /* We ignore MEMREF_MOVS, etc.: we don't propagate anything.
+     * Syscall params can be large, so we mark a block at a time.
+     */
+    if (end > start &&
+        umbra_iterate_shadow_range(umbra_map, start, end - start, NULL,
+                                   mark_accessed_span) != DRMF_SUCCESS)
+        ASSERT(false, "fail to iterate shadow range");
     return true;
 }
 
@@ -0,0 +1,542 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* dhvis_log_loader.cpp
+ *
+ * Provides the memory-mapped loader for Dr. Heapstat's log files
+ */
+
+#define __CLASS__ "dhvis_log_loader_t::"
+
+#include <QDebug>
+#include <QRegExp>
+#include <QList>
+
+#include <algorithm>
+#include <string.h>
+
+#include "dhvis_log_loader.h"
+
+/* Static
+ * Parses a line of num comma-separated unsigned integers into vals.
+ * Returns false if the line does not hold exactly num of them.
+ */
+static bool
+parse_fields(const QByteArray &line, quint64 *vals, int num)
+{
+    QList<QByteArray> fields = line.split(',');
+    if (fields.count() != num)
+        return false;
+    for (int i = 0; i < num; i++) {
+        bool ok;
+        vals[i] = fields[i].trimmed().toULongLong(&ok);
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+/* Public
+ * Constructor
+ */
+dhvis_log_loader_t::dhvis_log_loader_t(const QString &callstack_path,
+                                       const QString &snapshot_path,
+                                       const QString &staleness_path)
+    : canceled(0)
+{
+    qDebug().nospace() << "INFO: Entering " << __CLASS__ << __FUNCTION__;
+    callstack_log.file.setFileName(callstack_path);
+    snapshot_log.file.setFileName(snapshot_path);
+    staleness_log.file.setFileName(staleness_path);
+    callstack_log.base = snapshot_log.base = staleness_log.base = NULL;
+    callstack_log.size = snapshot_log.size = staleness_log.size = 0;
+}
+
+/* Public
+ * Destructor
+ * The thread running build_index() must have finished.
+ */
+dhvis_log_loader_t::~dhvis_log_loader_t(void)
+{
+    qDebug().nospace() << "INFO: Entering " << __CLASS__ << __FUNCTION__;
+    /* Anything not handed over by take_index() */
+    qDeleteAll(callstacks);
+    qDeleteAll(snapshots);
+    /* Closing the files also unmaps them */
+    callstack_log.file.close();
+    snapshot_log.file.close();
+    staleness_log.file.close();
+}
+
+/* Public
+ * Maps all three logs; called before build_index() is started.
+ */
+bool
+dhvis_log_loader_t::map_files(void)
+{
+    qDebug().nospace() << "INFO: Entering " << __CLASS__ << __FUNCTION__;
+    return map_log(callstack_log) && map_log(snapshot_log) &&
+        map_log(staleness_log);
+}
+
+/* Private
+ * Opens and maps a single log
+ */
+bool
+dhvis_log_loader_t::map_log(dhvis_mapped_log_t &log)
+{
+    if (!log.file.open(QFile::ReadOnly)) {
+        qDebug() << "WARNING: Failed to open file: " << log.file.fileName();
+        return false;
+    }
+    log.size = log.file.size();
+    /* QFile::map() fails for an empty file, which simply has no lines */
+    if (log.size == 0)
+        return true;
+    log.base = (const char *)log.file.map(0, log.size);
+    if (log.base == NULL) {
+        qDebug() << "WARNING: Failed to map file: " << log.file.fileName();
+        return false;
+    }
+    return true;
+}
+
+/* Public
+ * Asks build_index() to stop at its next opportunity
+ */
+void
+dhvis_log_loader_t::cancel(void)
+{
+    canceled.fetchAndStoreOrdered(1);
+}
+
+/* Private
+ * Sets *line to the line at *pos, without its line ending, and advances
+ * *pos to the start of the next line.  *line refers to the mapped data
+ * rather than holding a copy.  Returns false at the end of the log.
+ */
+bool
+dhvis_log_loader_t::next_line(const dhvis_mapped_log_t &log, quint64 *pos,
+                              QByteArray *line)
+{
+    if (*pos >= log.size)
+        return false;
+    const char *start = log.base + *pos;
+    const char *end = (const char *)memchr(start, '\n', log.size - *pos);
+    quint64 len;
+    if (end == NULL) {
+        len = log.size - *pos;
+        *pos = log.size;
+    } else {
+        len = end - start;
+        *pos += len + 1;
+    }
+    if (len > 0 && start[len - 1] == '\r')
+        len--;
+    *line = QByteArray::fromRawData(start, len);
+    return true;
+}
+
+/* Public Slot
+ * Indexes the logs.  Runs on the loader's thread.
+ */
+void
+dhvis_log_loader_t::build_index(void)
+{
+    qDebug().nospace() << "INFO: Entering " << __CLASS__ << __FUNCTION__;
+    if (index_callstack_log() && index_snapshot_log()) {
+        /* The graphs need the snapshots in time order */
+        std::stable_sort(snapshots.begin(), snapshots.end(), sort_snapshots);
+        lod.build(snapshots);
+        emit index_ready();
+        if (read_staleness_log())
+            emit staleness_ready();
+    }
+    emit finished();
+}
+
+/* Private
+ * Records where the frames of each callstack in callstack.log start
+ */
+bool
+dhvis_log_loader_t::index_callstack_log(void)
+{
+    quint64 pos = 0;
+    QByteArray line;
+    while (next_line(callstack_log, &pos, &line)) {
+        if (canceled.load() != 0)
+            return false;
+        if (line.contains("LOG END"))
+            break;
+        if (!line.contains("CALLSTACK"))
+            continue;
+        dhvis_callstack_listing_t *this_callstack = new dhvis_callstack_listing_t;
+        /* The callstacks begin counting at 1, however they are stored in
+         * an array which starts at index 0.
+         */
+        this_callstack->callstack_num = callstacks.count() + 1;
+#ifdef QT_DEBUG
+        QRegExp reg_exp("^CALLSTACK\\s+(\\d+)", Qt::CaseInsensitive);
+        reg_exp.indexIn(QString::fromLatin1(line));
+        if (this_callstack->callstack_num != reg_exp.cap(1).toULongLong()) {
+            qCritical() << "CRITICAL: counter != callstack_num\n"
+                        << callstack_log.file.fileName()
+                        << "\nis not in the expected order.";
+        }
+#endif
+        this_callstack->instances = 0;
+        this_callstack->bytes_asked_for = 0;
+        this_callstack->extra_usable = 0;
+        this_callstack->extra_occupied = 0;
+        this_callstack->cur_snap_num = 0;
+        this_callstack->log_offset = pos;
+        this_callstack->frames_loaded = false;
+        callstacks.append(this_callstack);
+    }
+    qDebug() << "INFO: callstack.log indexed";
+    return true;
+}
+
+/* Private
+ * Reads the header and totals of each snapshot in snapshot.log, and records
+ * where its callstack entries are.
+ */
+bool
+dhvis_log_loader_t::index_snapshot_log(void)
+{
+    dhvis_snapshot_listing_t *peak_snapshot = NULL;
+    dhvis_snapshot_listing_t *prev_snapshot = NULL;
+    QRegExp header_exp("^SNAPSHOT\\s#\\s+(\\d+)\\s@\\s+(\\d+)\\s(\\w+).+$",
+                       Qt::CaseInsensitive);
+    quint64 pos = 0;
+    QByteArray line;
+    /* We assume that the snapshots are listed in increasing order
+     * by their snapshot number.
+     */
+    for (;;) {
+        quint64 line_start = pos;
+        if (!next_line(snapshot_log, &pos, &line))
+            break;
+        if (canceled.load() != 0)
+            return false;
+        if (!line.contains("SNAPSHOT #") && !line.contains("LOG END"))
+            continue;
+        /* The previous snapshot's entries end at this line */
+        if (prev_snapshot != NULL)
+            prev_snapshot->log_end = line_start;
+        prev_snapshot = NULL;
+        if (line.contains("LOG END"))
+            break;
+        /* Get time and unit */
+        header_exp.indexIn(QString::fromLatin1(line));
+        if (header_exp.captureCount() != 3) {
+            qDebug() << "Malformed snapshot: " << line;
+            break;
+        }
+#ifdef QT_DEBUG
+        if ((quint64)snapshots.count() != header_exp.cap(1).toULongLong()) {
+            qCritical() << "CRITICAL: counter != snapshot_num\n"
+                        << snapshot_log.file.fileName()
+                        << "\nis not in the expected order.";
+        }
+#endif
+        quint64 num_time = header_exp.cap(2).toULongLong();
+        time_unit = header_exp.cap(3);
+        /* Skip past any extra info.
+         * Example: 'total: 40,1615,3399,3559'
+         */
+        bool found = false;
+        while (next_line(snapshot_log, &pos, &line)) {
+            if (line.startsWith("total:")) {
+                found = true;
+                break;
+            }
+        }
+        quint64 totals[4];
+        if (!found || !parse_fields(line.mid(strlen("total:")), totals, 4)) {
+            qDebug() << "Malformed snapshot: " << line;
+            break;
+        }
+        dhvis_snapshot_listing_t *this_snapshot = new dhvis_snapshot_listing_t;
+        this_snapshot->snapshot_num = snapshots.count();
+        this_snapshot->num_time = num_time;
+        this_snapshot->tot_mallocs = totals[0];
+        this_snapshot->tot_bytes_asked_for = totals[1];
+        this_snapshot->tot_bytes_usable = totals[2];
+        this_snapshot->tot_bytes_occupied = totals[3];
+        this_snapshot->tot_bytes_stale = 0;
+        this_snapshot->is_peak = false;
+        this_snapshot->log_offset = pos;
+        this_snapshot->log_end = snapshot_log.size;
+        this_snapshot->details_loaded = false;
+        if (peak_snapshot == NULL ||
+            this_snapshot->tot_bytes_occupied > peak_snapshot->tot_bytes_occupied)
+            peak_snapshot = this_snapshot;
+        snapshots.append(this_snapshot);
+        prev_snapshot = this_snapshot;
+    }
+    if (peak_snapshot != NULL)
+        peak_snapshot->is_peak = true;
+    qDebug() << "INFO: snapshot.log indexed";
+    return true;
+}
+
+/* Private
+ * Reads staleness.log into stale_entries.  The callstacks are not touched
+ * here since the GUI thread owns them once index_ready() is emitted.
+ */
+bool
+dhvis_log_loader_t::read_staleness_log(void)
+{
+    quint64 pos = 0;
+    QByteArray line;
+    while (next_line(staleness_log, &pos, &line)) {
+        if (canceled.load() != 0)
+            return false;
+        if (line.contains("LOG END"))
+            break;
+        if (line.contains("SNAPSHOT #")) {
+            stale_entries.append(QVector<dhvis_stale_entry_t>());
+            continue;
+        }
+        if (stale_entries.isEmpty() || line.isEmpty())
+            continue;
+        /* Example: 27,35,300 */
+        quint64 vals[3];
+        if (!parse_fields(line, vals, 3) || vals[0] == 0) {
+            qDebug() << "Malformed staleness: " << line;
+            continue;
+        }
+        /* Subtract 1 since the callstack # starts at 1 in the logfile;
+         * while the array index starts at 0.
+         */
+        dhvis_stale_entry_t entry;
+        entry.callstack_index = vals[0] - 1;
+        entry.stale_pair = stale_pair_t(vals[1], vals[2]);
+        stale_entries.last().append(entry);
+    }
+    qDebug() << "INFO: staleness.log read";
+    return true;
+}
+
+/* Public
+ * Hands the snapshots and callstacks found by build_index() to the caller,
+ * which then owns them.  Called on the GUI thread after index_ready().
+ */
+void
+dhvis_log_loader_t::take_index(QVector<dhvis_snapshot_listing_t *> &snapshots_out,
+                               QVector<dhvis_callstack_listing_t *> &callstacks_out,
+                               QString &time_unit_out,
+                               dhvis_snapshot_lod_t &lod_out)
+{
+    snapshots_out.clear();
+    snapshots_out.swap(snapshots);
+    callstacks_out.clear();
+    callstacks_out.swap(callstacks);
+    time_unit_out = time_unit;
+    lod_out = lod;
+    lod.clear();
+}
+
+/* Public
+ * Adds the staleness read by build_index() to the snapshots and callstacks,
+ * with each callstack's staleness info sorted (greatest first).  Called on the
+ * GUI thread after staleness_ready().
+ */
+void
+dhvis_log_loader_t::apply_staleness(QVector<dhvis_snapshot_listing_t *> &snapshots_in,
+                                    QVector<dhvis_callstack_listing_t *> &callstacks_in)
+{
+    qDebug().nospace() << "INFO: Entering " << __CLASS__ << __FUNCTION__;
+    foreach (dhvis_snapshot_listing_t *s, snapshots_in) {
+        quint64 snap_num = s->snapshot_num;
+        if (snap_num >= (quint64)stale_entries.count())
+            continue;
+        foreach (const dhvis_stale_entry_t &entry, stale_entries[snap_num]) {
+            if (entry.callstack_index >= (quint64)callstacks_in.count()) {
+                qDebug() << "Malformed staleness: callstack"
+                         << entry.callstack_index + 1;
+                continue;
+            }
+            dhvis_callstack_listing_t *this_callstack =
+                callstacks_in.at(entry.callstack_index);
+            /* Add to snapshot's vector on the callstack's first entry */
+            if (!this_callstack->staleness_info.contains(snap_num))
+                s->stale_callstacks.append(this_callstack);
+            /* Map with snapshot_num as key */
+            this_callstack->staleness_info[snap_num].append(entry.stale_pair);
+        }
+        foreach (dhvis_callstack_listing_t *c, s->stale_callstacks) {
+            QVector<stale_pair_t> &info = c->staleness_info[snap_num];
+            std::sort(info.begin(), info.end(), stale_pair_sorter);
+        }
+    }
+    stale_entries.clear();
+}
+
+/* Public
+ * Decodes a snapshot's callstack entries, setting each callstack's usage to
+ * its usage in this snapshot, and loads the frames of those callstacks.
+ * The snapshot's assoc_callstacks is only filled in the first time, as
+ * fill_callstacks_table() keeps it sorted.
+ */
+void
+dhvis_log_loader_t::load_snapshot(dhvis_snapshot_listing_t *snapshot,
+                                  QVector<dhvis_callstack_listing_t *> &callstacks_in,
+                                  frame_map_t &frames)
+{
+    qDebug().nospace() << "INFO: Entering " << __CLASS__ << __FUNCTION__;
+    quint64 pos = snapshot->log_offset;
+    QByteArray line;
+    for (quint64 i = 0; i < snapshot->tot_mallocs && pos < snapshot->log_end;) {
+        if (!next_line(snapshot_log, &pos, &line))
+            break;
+        /* Example: '27,1,124,124,4' */
+        quint64 vals[5];
+        if (!parse_fields(line, vals, 5) || vals[0] == 0 ||
+            vals[0] > (quint64)callstacks_in.count()) {
+            qDebug() << "Malformed snapshot: " << line;
+            break;
+        }
+        /* Get referenced callstack and subtract 1 since the
+         * callstack # starts at 1 in the logfile; while the array
+         * index starts at 0.
+         */
+        dhvis_callstack_listing_t *this_callstack = callstacks_in.at(vals[0] - 1);
+        this_callstack->instances = vals[1];
+        this_callstack->bytes_asked_for = vals[2];
+        this_callstack->extra_usable = vals[3] + this_callstack->bytes_asked_for;
+        this_callstack->extra_occupied = vals[4] + this_callstack->extra_usable;
+        /* tot_mallocs counts reallocs, while instances do not;
+         * so we can't assume that they will sum properly.
+         */
+        i += this_callstack->instances;
+        if (!snapshot->details_loaded) {
+            /* Callstacks listed high to low in log,
+             * prepending reverses the order
+             */
+            snapshot->assoc_callstacks.prepend(this_callstack);
+            load_frames(this_callstack, frames);
+        }
+    }
+    snapshot->details_loaded = true;
+}
+
+/* Private
+ * Decodes a callstack's frames from callstack.log
+ */
+void
+dhvis_log_loader_t::load_frames(dhvis_callstack_listing_t *callstack,
+                                frame_map_t &frames)
+{
+    if (callstack->frames_loaded)
+        return;
+    callstack->frames_loaded = true;
+    quint64 pos = callstack->log_offset;
+    QByteArray line;
+    QRegExp frame_exp("^#\\s*[0-9]+");
+    QRegExp address_exp("0x(\\w+) <.+0x\\w+>");
+    while (next_line(callstack_log, &pos, &line)) {
+        if (line.contains("<not in a module>"))
+            continue;
+        if (line.contains("error end") ||
+            line.contains("CALLSTACK") ||
+            line.contains("LOG END")) {
+            break;
+        }
+        /* Example:
+         * '# num exe_name!func_name [path/to/file_name:line_num] (address)'
+         */
+        QString frame = QString::fromLatin1(line);
+        if (!frame.contains(frame_exp)) {
+            qDebug() << "Malformed frame: " << frame;
+            continue;
+        }
+        /* Get address */
+        QString address = "";
+        if (address_exp.indexIn(frame) < 0)
+            qDebug() << "Malformed frame: " << frame;
+        else
+            address = address_exp.cap(1);
+
+        bool ok;
+        quint64 int_addr = address.toULongLong(&ok, 16);
+        if (!ok) {
+            qDebug() << "Malformed address: " << address;
+            continue;
+        }
+        frame_map_t::iterator itr = frames.find(int_addr);
+        if (itr == frames.end())
+            itr = frames.insert(int_addr, extract_frame_data(frame));
+        callstack->frame_data.append(*itr);
+    }
+}
+
+/* Private
+ * Extracts important info from a frame
+ * XXX i#1332: This function will not be needed after this issue is resolved.
+ */
+dhvis_frame_data_t *
+dhvis_log_loader_t::extract_frame_data(const QString &frame)
+{
+    /*              1     2     |----------------3----------------|     4
+     * Example: '# num exe_name!func_name [path/file_name:line_num] (address)'
+     */
+    QRegExp reg_exp("#\\s*(\\d+)\\s+(.+)\\!(.*(?!(?:\\s+\\[)|(?:\\s+\\()))"
+                    ".*\\((0x\\w+ <.+0x\\w+>)\\)");
+    reg_exp.indexIn(frame);
+    dhvis_frame_data_t *frame_data = new dhvis_frame_data_t;
+    /* Because callstacks share frames, but the frame is likely to be in a different
+     * position across callstacks, we do not save the position in the callstack. We
+     * use the order they are read to determine they're position.
+     */
+    frame_data->exec_name = reg_exp.cap(2);
+    int index = reg_exp.cap(3).lastIndexOf('[');
+    /* Cover case where func is 'operator new []' with no symbols after */
+    if (index == reg_exp.cap(3).lastIndexOf("[]"))
+        index++;
+    /* Trimming removes leading and trailing spaces */
+    frame_data->func_name = reg_exp.cap(3).left(index - 1).trimmed();
+    /* Frame may not be symbolized */
+    if (index > frame_data->func_name.size()) {
+        /* Remove the leading and trailing brackets and spaces */
+        QString full_path = reg_exp.cap(3).mid(index + 1);
+        full_path = full_path.left(full_path.lastIndexOf(']'));
+        /* We do not check the OS here because a user may load a data_set
+         * that was collected from a different computer.
+         */
+        int last_index = full_path.lastIndexOf('\\');
+        if (last_index == -1)
+            last_index = full_path.lastIndexOf('/');
+        /* +1 to include the / or \ in the path */
+        frame_data->file_path = full_path.left(last_index + 1);
+        frame_data->file_name = full_path.mid(last_index + 1);
+        index = frame_data->file_name.lastIndexOf(':');
+        frame_data->line_num = frame_data->file_name.mid(index + 1);
+        frame_data->file_name = frame_data->file_name.left(index);
+    } else {
+        frame_data->file_path = frame_data->file_name
+                              = frame_data->line_num = "?";
+    }
+    frame_data->address = reg_exp.cap(4);
+
+    return frame_data;
+}
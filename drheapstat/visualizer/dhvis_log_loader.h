@@ -0,0 +1,125 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* dhvis_log_loader.h
+ *
+ * Defines the memory-mapped loader for Dr. Heapstat's log files
+ *
+ * The loader runs build_index() on a background thread.  It first indexes
+ * callstack.log and snapshot.log by offset, keeping only each snapshot's
+ * totals, sorts the snapshots by time and builds their level-of-detail
+ * pyramids, and emits index_ready() so the snapshot graph can be drawn.  It
+ * then reads staleness.log and emits staleness_ready().  A snapshot's
+ * callstacks and their frames are only decoded, on the GUI thread, once the
+ * snapshot is selected.
+ */
+
+#ifndef DHVIS_LOG_LOADER_H
+#define DHVIS_LOG_LOADER_H
+
+#include <QObject>
+#include <QFile>
+#include <QVector>
+#include <QString>
+#include <QByteArray>
+#include <QAtomicInt>
+#include "dhvis_structures.h"
+
+struct dhvis_mapped_log_t {
+    QFile file;
+    const char *base;
+    quint64 size;
+};
+
+struct dhvis_stale_entry_t {
+    quint64 callstack_index;
+    stale_pair_t stale_pair;
+};
+
+class dhvis_log_loader_t : public QObject
+{
+    Q_OBJECT
+
+public:
+    dhvis_log_loader_t(const QString &callstack_path,
+                       const QString &snapshot_path,
+                       const QString &staleness_path);
+
+    ~dhvis_log_loader_t(void);
+
+    bool map_files(void);
+
+    void cancel(void);
+
+    void take_index(QVector<dhvis_snapshot_listing_t *> &snapshots_out,
+                    QVector<dhvis_callstack_listing_t *> &callstacks_out,
+                    QString &time_unit_out,
+                    dhvis_snapshot_lod_t &lod_out);
+
+    void apply_staleness(QVector<dhvis_snapshot_listing_t *> &snapshots_in,
+                         QVector<dhvis_callstack_listing_t *> &callstacks_in);
+
+    void load_snapshot(dhvis_snapshot_listing_t *snapshot,
+                       QVector<dhvis_callstack_listing_t *> &callstacks_in,
+                       frame_map_t &frames);
+
+public slots:
+    void build_index(void);
+
+signals:
+    void index_ready(void);
+
+    void staleness_ready(void);
+
+    void finished(void);
+
+private:
+    bool map_log(dhvis_mapped_log_t &log);
+
+    bool next_line(const dhvis_mapped_log_t &log, quint64 *pos,
+                   QByteArray *line);
+
+    bool index_callstack_log(void);
+
+    bool index_snapshot_log(void);
+
+    bool read_staleness_log(void);
+
+    void load_frames(dhvis_callstack_listing_t *callstack,
+                     frame_map_t &frames);
+
+    dhvis_frame_data_t *extract_frame_data(const QString &frame);
+
+    dhvis_mapped_log_t callstack_log;
+    dhvis_mapped_log_t snapshot_log;
+    dhvis_mapped_log_t staleness_log;
+    QAtomicInt canceled;
+
+    /* Filled by build_index() */
+    QVector<dhvis_callstack_listing_t *> callstacks;
+    QVector<dhvis_snapshot_listing_t *> snapshots;
+    QString time_unit;
+    dhvis_snapshot_lod_t lod;
+    /* Indexed by snapshot_num */
+    QVector<QVector<dhvis_stale_entry_t> > stale_entries;
+};
+
+#endif
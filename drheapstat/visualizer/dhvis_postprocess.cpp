@@ -0,0 +1,1278 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* dhvis_postprocess.cpp
+ *
+ * A native post-processor for Dr. Heapstat's logs, producing the reports that
+ * postprocess.pl produces in its -v mode much faster on large profiles:
+ *
+ *   snapshot_summary.xml  every snapshot's totals, in postprocess.pl's format
+ *   snapshot.idx          "pos size" of each snapshot in snapshot.log
+ *   staleness.idx         likewise for staleness.log, with -stale_*
+ *   callstack.idx         likewise for each callstack in callstack.log
+ *   callstack_peaks.xml   each callstack's peak usage, largest first
+ *
+ * With -diff it instead compares the profile against a baseline profile,
+ * as for a regression check of memory usage:
+ *
+ *   callstack_diff.xml    each callstack's change in peak and summed usage,
+ *                         largest change first, also summarized on stdout
+ *
+ * The logs are mapped and indexed by a single pass that only looks for record
+ * headers.  The snapshots are then split into ranges that are parsed on a
+ * pool of threads, each of which keeps its own per-callstack peaks, and the
+ * peaks are merged once all ranges are done.  Finally the frames used in the
+ * call stack headers that were not symbolized at runtime are gathered,
+ * de-duplicated, and looked up once each, one module at a time.
+ *
+ * The two profiles of a diff need not come from the same build, so their
+ * callstacks are matched by their symbolized frames rather than by number.
+ * Each profile is summarized into a hash table keyed by the frames, with
+ * callstacks that symbolize alike summed together, and the current profile
+ * probes the baseline's table.  Callstacks found in only one profile are
+ * reported against zero.
+ */
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+#include <QRegExp>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QHash>
+#include <QPair>
+#include <QVector>
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include "dhvis_structures.h"
+
+#include "dr_api.h"
+#include "drsyms.h"
+
+#define USAGE "Usage:\n\
+  %s -profdir <dir> [-x <exe>] [-stale_since <n> | -stale_for <n>]\n\
+     [-threads <n>] [-v]\n\
+     [-diff <baseline dir> [-diff_x <exe>] [-max_growth <bytes>]]\n\
+Processes the logs in a Dr. Heapstat profile directory.\n\
+Optional parameters:\n\
+  -x           = the profiled executable, whose directory is searched for\n\
+                 modules along with $DRHEAPSTAT_LIB_PATH\n\
+  -stale_since = count memory not accessed since the given time as stale\n\
+  -stale_for   = count memory not accessed for the given time as stale\n\
+  -threads     = the number of threads to parse snapshots with\n\
+  -v           = print the time taken by each step\n\
+  -diff        = compare the profile against a baseline profile rather than\n\
+                 writing the usual reports\n\
+  -diff_x      = the baseline's executable, if it differs from -x\n\
+  -max_growth  = exit with status 2 if the peak grew by more bytes than this\n"
+
+/* The number of call stack frames shown in a header, as in postprocess.pl */
+#define HEADER_FRAMES 3
+
+/* The number of callstacks -diff lists on stdout */
+#define DIFF_REPORT_ROWS 20
+
+struct mapped_log_t {
+    QFile file;
+    const char *base;
+    quint64 size;
+};
+
+/* A record's location in its log */
+struct log_range_t {
+    quint64 pos;
+    quint64 size;
+};
+
+struct dhpp_options_t {
+    QString profdir;
+    QString exe;
+    qint64 stale_since;
+    qint64 stale_for;
+    int threads;
+    bool verbose;
+    QString baseline;
+    QString baseline_exe;
+    qint64 max_growth;
+};
+
+static dhpp_options_t op;
+static bool have_stale;
+
+/* The profile being processed, which for -diff is each of the two in turn */
+static QString cur_profdir;
+static QString cur_exe;
+
+static mapped_log_t snapshot_log;
+static mapped_log_t staleness_log;
+static mapped_log_t callstack_log;
+
+/* Indexed by the snapshot's order in snapshot.log */
+static QVector<dhvis_snapshot_listing_t *> snapshots;
+static QVector<log_range_t> staleness_idx;
+static QString xaxis_label;
+
+/* Indexed by callstack_num - 1 */
+static QVector<log_range_t> callstack_idx;
+
+/* Static
+ * Opens and maps a log, which may be empty
+ */
+static bool
+map_log(mapped_log_t &log, const QString &name)
+{
+    log.file.setFileName(QDir(cur_profdir).absoluteFilePath(name));
+    log.base = NULL;
+    log.size = 0;
+    if (!log.file.open(QFile::ReadOnly)) {
+        fprintf(stderr, "ERROR: unable to open %s\n",
+                log.file.fileName().toLocal8Bit().constData());
+        return false;
+    }
+    log.size = log.file.size();
+    if (log.size == 0)
+        return true;
+    log.base = (const char *)log.file.map(0, log.size);
+    if (log.base == NULL) {
+        fprintf(stderr, "ERROR: unable to map %s\n",
+                log.file.fileName().toLocal8Bit().constData());
+        return false;
+    }
+    return true;
+}
+
+/* Static
+ * Sets [*start, *end) to the line at *pos, without its line ending, and
+ * advances *pos to the start of the next line.  Returns false at the end.
+ */
+static bool
+next_line(const char *base, quint64 size, quint64 *pos,
+          const char **start, const char **end)
+{
+    if (*pos >= size)
+        return false;
+    const char *line = base + *pos;
+    const char *nl = (const char *)memchr(line, '\n', size - *pos);
+    if (nl == NULL) {
+        *end = base + size;
+        *pos = size;
+    } else {
+        *end = nl;
+        *pos = nl + 1 - base;
+    }
+    if (*end > line && (*end)[-1] == '\r')
+        (*end)--;
+    *start = line;
+    return true;
+}
+
+static bool
+line_starts_with(const char *start, const char *end, const char *prefix)
+{
+    size_t len = strlen(prefix);
+    return (size_t)(end - start) >= len && memcmp(start, prefix, len) == 0;
+}
+
+/* Static
+ * Parses up to max comma-separated decimal fields from [p, end).  Returns the
+ * number parsed, or -1 if the line holds anything else.  This is the hot path
+ * for large profiles, so we avoid building strings here.
+ */
+static int
+parse_fields(const char *p, const char *end, quint64 *vals, int max)
+{
+    int num = 0;
+    while (p < end && *p == ' ')
+        p++;
+    if (p == end)
+        return -1;
+    while (num < max) {
+        quint64 val = 0;
+        const char *digits = p;
+        while (p < end && *p >= '0' && *p <= '9')
+            val = val * 10 + (*p++ - '0');
+        if (p == digits)
+            return -1;
+        vals[num++] = val;
+        if (p == end)
+            return num;
+        if (*p != ',')
+            return -1;
+        p++;
+    }
+    return -1;
+}
+
+/* Static
+ * Parses 'SNAPSHOT #    3 @      1234 ticks' into its number, time and unit
+ */
+static bool
+parse_snapshot_header(const char *start, const char *end, quint64 *num,
+                      quint64 *time, QString *unit)
+{
+    QRegExp header_exp("^SNAPSHOT\\s*#\\s*(\\d+)\\s+@\\s+(\\d+)\\s+(\\w+)");
+    if (header_exp.indexIn(QString::fromLatin1(start, end - start)) < 0)
+        return false;
+    *num = header_exp.cap(1).toULongLong();
+    *time = header_exp.cap(2).toULongLong();
+    *unit = header_exp.cap(3);
+    return true;
+}
+
+/***************************************************************************
+ * Indexing
+ */
+
+/* Static
+ * Records where each snapshot is in snapshot.log, along with its time
+ */
+static bool
+index_snapshot_log(void)
+{
+    quint64 pos = 0, line_pos;
+    const char *start, *end;
+    dhvis_snapshot_listing_t *prev = NULL;
+    for (line_pos = pos;
+         next_line(snapshot_log.base, snapshot_log.size, &pos, &start, &end);
+         line_pos = pos) {
+        bool is_header = line_starts_with(start, end, "SNAPSHOT");
+        if (!is_header && !line_starts_with(start, end, "NUDGE") &&
+            !line_starts_with(start, end, "LOG END"))
+            continue;
+        /* Only when reading the next header can a snapshot's size be known */
+        if (prev != NULL)
+            prev->log_end = line_pos;
+        prev = NULL;
+        if (!is_header)
+            continue;
+        quint64 num, time;
+        if (!parse_snapshot_header(start, end, &num, &time, &xaxis_label)) {
+            fprintf(stderr, "ERROR: malformed snapshot header at %llu\n",
+                    (unsigned long long)line_pos);
+            return false;
+        }
+        dhvis_snapshot_listing_t *s = new dhvis_snapshot_listing_t;
+        s->snapshot_num = snapshots.count();
+        s->num_time = time;
+        s->tot_mallocs = s->tot_bytes_asked_for = s->tot_bytes_usable =
+            s->tot_bytes_occupied = s->tot_bytes_stale = 0;
+        s->is_peak = false;
+        s->log_offset = line_pos;
+        s->log_end = snapshot_log.size;
+        s->details_loaded = false;
+        snapshots.append(s);
+        prev = s;
+    }
+    return true;
+}
+
+/* Static
+ * Records where each snapshot is in staleness.log.  There is one staleness
+ * snapshot per snapshot in snapshot.log, in the same order.
+ */
+static bool
+index_staleness_log(void)
+{
+    quint64 pos = 0, line_pos;
+    const char *start, *end;
+    log_range_t *prev = NULL;
+    staleness_idx.resize(snapshots.count());
+    int i = 0;
+    for (line_pos = pos;
+         next_line(staleness_log.base, staleness_log.size, &pos, &start, &end);
+         line_pos = pos) {
+        bool is_header = line_starts_with(start, end, "SNAPSHOT");
+        if (!is_header && !line_starts_with(start, end, "NUDGE") &&
+            !line_starts_with(start, end, "LOG END"))
+            continue;
+        if (prev != NULL)
+            prev->size = line_pos - prev->pos;
+        prev = NULL;
+        if (!is_header)
+            continue;
+        quint64 num, time;
+        QString unit;
+        if (i >= snapshots.count() ||
+            !parse_snapshot_header(start, end, &num, &time, &unit) ||
+            time != snapshots[i]->num_time) {
+            fprintf(stderr, "ERROR: staleness.log doesn't correspond to "
+                    "snapshot.log\n");
+            return false;
+        }
+        staleness_idx[i].pos = line_pos;
+        staleness_idx[i].size = staleness_log.size - line_pos;
+        prev = &staleness_idx[i];
+        i++;
+    }
+    return true;
+}
+
+/* Static
+ * Records where each callstack is in callstack.log
+ */
+static bool
+index_callstack_log(void)
+{
+    quint64 pos = 0, line_pos;
+    const char *start, *end;
+    for (line_pos = pos;
+         next_line(callstack_log.base, callstack_log.size, &pos, &start, &end);
+         line_pos = pos) {
+        bool is_header = line_starts_with(start, end, "CALLSTACK");
+        if (!is_header && !line_starts_with(start, end, "LOG END"))
+            continue;
+        if (!callstack_idx.isEmpty()) {
+            log_range_t &prev = callstack_idx.last();
+            if (prev.size == 0)
+                prev.size = line_pos - prev.pos;
+        }
+        if (!is_header)
+            break;
+        quint64 num = 0;
+        const char *p = start + strlen("CALLSTACK");
+        while (p < end && *p == ' ')
+            p++;
+        while (p < end && *p >= '0' && *p <= '9')
+            num = num * 10 + (*p++ - '0');
+        if (num != (quint64)callstack_idx.count() + 1) {
+            fprintf(stderr, "ERROR: call stack numbers in callstack.log aren't "
+                    "sequential from 1\n");
+            return false;
+        }
+        log_range_t range;
+        range.pos = line_pos;
+        range.size = 0;
+        callstack_idx.append(range);
+    }
+    if (!callstack_idx.isEmpty() && callstack_idx.last().size == 0)
+        callstack_idx.last().size = callstack_log.size - callstack_idx.last().pos;
+    return true;
+}
+
+/***************************************************************************
+ * Parallel snapshot parsing
+ */
+
+/* Static
+ * Returns whether memory last accessed at last_access is stale in a snapshot
+ * taken at snapshot_time, as postprocess.pl's is_stale()
+ */
+static bool
+is_stale(quint64 snapshot_time, quint64 last_access)
+{
+    if (op.stale_since > -1)
+        return (qint64)last_access < op.stale_since;
+    return (qint64)last_access <= (qint64)snapshot_time - op.stale_for;
+}
+
+/* Static
+ * Returns whether usage of mem_tot in snapshot s exceeds peak.  A tie goes to
+ * the earlier snapshot so the result does not depend on how the snapshots
+ * were split between threads.
+ */
+static bool
+is_new_peak(quint64 mem_tot, const dhvis_snapshot_listing_t *s,
+            const dhvis_callstack_listing_t &peak)
+{
+    if (mem_tot != peak.extra_occupied)
+        return mem_tot > peak.extra_occupied;
+    return s->num_time < snapshots[peak.cur_snap_num]->num_time;
+}
+
+/* Parses a contiguous range of snapshots.  Each worker keeps its own peaks,
+ * indexed by callstack_num - 1, so the workers share nothing that they write
+ * but the snapshots in their own range.
+ */
+class dhpp_worker_t : public QRunnable
+{
+public:
+    dhpp_worker_t(int first_, int last_)
+        : first(first_), last(last_), malformed(false)
+    {
+        setAutoDelete(false);
+    }
+
+    void run(void);
+
+    int first;
+    int last;
+    bool malformed;
+    QVector<dhvis_callstack_listing_t> peaks;
+    /* Each callstack's usage summed over the range's snapshots */
+    QVector<quint64> totals;
+
+private:
+    void parse_staleness(dhvis_snapshot_listing_t *s);
+
+    void parse_snapshot(dhvis_snapshot_listing_t *s);
+
+    /* Stale bytes per callstack index for the snapshot being parsed */
+    QMap<quint64, quint64> stale_bytes;
+};
+
+void
+dhpp_worker_t::run(void)
+{
+    peaks.resize(callstack_idx.count());
+    totals.fill(0, callstack_idx.count());
+    for (int i = 0; i < peaks.count(); i++) {
+        peaks[i].callstack_num = i + 1;
+        peaks[i].instances = peaks[i].bytes_asked_for = 0;
+        peaks[i].extra_usable = peaks[i].extra_occupied = 0;
+        peaks[i].cur_snap_num = 0;
+        peaks[i].log_offset = 0;
+        peaks[i].frames_loaded = false;
+    }
+    for (int i = first; i < last && !malformed; i++)
+        parse_snapshot(snapshots[i]);
+}
+
+void
+dhpp_worker_t::parse_staleness(dhvis_snapshot_listing_t *s)
+{
+    const log_range_t &range = staleness_idx[s->snapshot_num];
+    quint64 pos = range.pos, end_pos = range.pos + range.size;
+    const char *start, *end;
+    stale_bytes.clear();
+    while (pos < end_pos &&
+           next_line(staleness_log.base, end_pos, &pos, &start, &end)) {
+        /* Example: 27,35,300 */
+        quint64 vals[3];
+        if (parse_fields(start, end, vals, 3) != 3 || vals[0] == 0)
+            continue;
+        if (is_stale(s->num_time, vals[2])) {
+            stale_bytes[vals[0] - 1] += vals[1];
+            s->tot_bytes_stale += vals[1];
+        }
+    }
+}
+
+void
+dhpp_worker_t::parse_snapshot(dhvis_snapshot_listing_t *s)
+{
+    quint64 pos = s->log_offset;
+    const char *start, *end;
+    bool have_totals = false;
+    if (have_stale && s->snapshot_num < (quint64)staleness_idx.count())
+        parse_staleness(s);
+    while (pos < s->log_end &&
+           next_line(snapshot_log.base, s->log_end, &pos, &start, &end)) {
+        quint64 vals[5];
+        if (!have_totals) {
+            /* Example: 'total: 40,1615,3399,3559' */
+            if (!line_starts_with(start, end, "total:"))
+                continue;
+            if (parse_fields(start + strlen("total:"), end, vals, 4) != 4) {
+                malformed = true;
+                return;
+            }
+            s->tot_mallocs = vals[0];
+            s->tot_bytes_asked_for = vals[1];
+            s->tot_bytes_usable = vals[2];
+            s->tot_bytes_occupied = vals[3];
+            have_totals = true;
+            continue;
+        }
+        /* Example: '27,1,124,124,4' */
+        if (parse_fields(start, end, vals, 5) != 5)
+            continue;
+        if (vals[0] == 0 || vals[0] > (quint64)peaks.count()) {
+            malformed = true;
+            return;
+        }
+        quint64 index = vals[0] - 1;
+        /* The log holds deltas for the pad and header, as dhvis_tool_t does */
+        quint64 mem_tot = vals[2] + vals[3] + vals[4];
+        totals[index] += mem_tot;
+        dhvis_callstack_listing_t &peak = peaks[index];
+        if (mem_tot > 0 && is_new_peak(mem_tot, s, peak)) {
+            peak.instances = vals[1];
+            peak.bytes_asked_for = vals[2];
+            peak.extra_usable = vals[2] + vals[3];
+            peak.extra_occupied = mem_tot;
+            peak.cur_snap_num = s->snapshot_num;
+            if (have_stale) {
+                peak.staleness_sum_info.clear();
+                peak.staleness_sum_info[s->snapshot_num] = stale_bytes.value(index, 0);
+            }
+        }
+    }
+}
+
+/* Static
+ * Parses every snapshot on op.threads threads and merges their peaks and
+ * summed usage
+ */
+static bool
+parse_snapshots(QVector<dhvis_callstack_listing_t> &peaks, QVector<quint64> &totals)
+{
+    QThreadPool pool;
+    if (op.threads > 0)
+        pool.setMaxThreadCount(op.threads);
+    int count = snapshots.count();
+    int num_workers = qMax(1, qMin(pool.maxThreadCount(), count));
+    int per_worker = (count + num_workers - 1) / num_workers;
+    QVector<dhpp_worker_t *> workers;
+    for (int i = 0; i < num_workers; i++) {
+        int first = qMin(i * per_worker, count);
+        dhpp_worker_t *w = new dhpp_worker_t(first, qMin(first + per_worker, count));
+        workers.append(w);
+        pool.start(w);
+    }
+    pool.waitForDone();
+
+    bool ok = true;
+    peaks = workers[0]->peaks;
+    totals = workers[0]->totals;
+    foreach (dhpp_worker_t *w, workers) {
+        if (w->malformed)
+            ok = false;
+        if (w == workers[0])
+            continue;
+        for (int i = 0; i < peaks.count(); i++) {
+            const dhvis_callstack_listing_t &p = w->peaks[i];
+            totals[i] += w->totals[i];
+            if (p.extra_occupied > 0 &&
+                is_new_peak(p.extra_occupied, snapshots[p.cur_snap_num], peaks[i]))
+                peaks[i] = p;
+        }
+    }
+    qDeleteAll(workers);
+    if (!ok)
+        fprintf(stderr, "ERROR: malformed snapshot in snapshot.log\n");
+    return ok;
+}
+
+/***************************************************************************
+ * Snapshot ordering
+ */
+
+/* Static
+ * Sorts the snapshots by time and drops all but the largest of any that share
+ * a time, as postprocess.pl's process_peak_snapshots().  Returns the sorted
+ * snapshots and sets renumber[original index] to each one's new id.
+ */
+static QVector<dhvis_snapshot_listing_t *>
+sort_snapshots_by_time(QVector<int> &renumber)
+{
+    QVector<dhvis_snapshot_listing_t *> sorted = snapshots;
+    std::stable_sort(sorted.begin(), sorted.end(), sort_snapshots);
+    QVector<dhvis_snapshot_listing_t *> kept;
+    renumber.resize(snapshots.count());
+    foreach (dhvis_snapshot_listing_t *s, sorted) {
+        if (!kept.isEmpty() && kept.last()->num_time == s->num_time) {
+            if (kept.last()->tot_bytes_asked_for < s->tot_bytes_asked_for) {
+                renumber[kept.last()->snapshot_num] = kept.count() - 1;
+                kept.last() = s;
+            }
+            renumber[s->snapshot_num] = kept.count() - 1;
+            continue;
+        }
+        kept.append(s);
+        renumber[s->snapshot_num] = kept.count() - 1;
+    }
+    return kept;
+}
+
+/***************************************************************************
+ * Symbolization
+ */
+
+typedef QPair<QString /* module */, quint64 /* offset */> modoffs_t;
+
+struct header_frame_t {
+    /* Empty if the frame needs to be looked up */
+    QString symbol;
+    modoffs_t modoffs;
+};
+
+/* Static
+ * Returns the directories postprocess.pl's init_libsearch_path() searches
+ */
+static QStringList
+module_search_path(void)
+{
+    QStringList dirs;
+#ifdef WINDOWS
+    const char path_sep = ';';
+#else
+    const char path_sep = ':';
+#endif
+    QString env = QString::fromLocal8Bit(qgetenv("DRHEAPSTAT_LIB_PATH"));
+    if (!env.isEmpty())
+        dirs << env.split(path_sep, QString::SkipEmptyParts);
+    if (!cur_exe.isEmpty())
+        dirs << QFileInfo(cur_exe).absolutePath();
+#ifdef WINDOWS
+    QString sysroot = QString::fromLocal8Bit(qgetenv("SYSTEMROOT"));
+    dirs << sysroot << sysroot + "/system32" << sysroot + "/system32/wbem";
+    dirs << QString::fromLocal8Bit(qgetenv("PATH")).split(path_sep,
+                                                          QString::SkipEmptyParts);
+#else
+    dirs << "/lib" << "/usr/lib" << "/lib64" << "/usr/lib64"
+         << "/usr/lib/debug/lib" << "/usr/lib/debug/usr/lib";
+#endif
+    return dirs;
+}
+
+/* Found module paths, cleared between the profiles of a diff */
+static QMap<QString, QString> module_paths;
+static QStringList module_dirs;
+
+/* Static
+ * Returns the path of a module named in callstack.log, or an empty string
+ */
+static QString
+find_module(const QString &module)
+{
+    QMap<QString, QString>::const_iterator itr = module_paths.find(module);
+    if (itr != module_paths.end())
+        return *itr;
+    if (module_dirs.isEmpty())
+        module_dirs = module_search_path();
+    QString path;
+    if (!cur_exe.isEmpty() && QFileInfo(cur_exe).fileName() == module)
+        path = cur_exe;
+    for (int i = 0; path.isEmpty() && i < module_dirs.count(); i++) {
+        QFileInfo info(QDir(module_dirs[i]), module);
+        if (info.exists())
+            path = info.absoluteFilePath();
+    }
+    if (path.isEmpty() && op.verbose)
+        fprintf(stderr, "WARNING: can't find %s\n", module.toLocal8Bit().constData());
+    module_paths.insert(module, path);
+    return path;
+}
+
+/* Static
+ * Looks up each unique frame once.  The map is ordered by module so each
+ * module's debug information is loaded once and then freed.
+ */
+static void
+symbolize_frames(QMap<modoffs_t, QString> &lookups)
+{
+    QString prev_module;
+    QByteArray prev_path;
+    char name[256];
+    QMap<modoffs_t, QString>::iterator itr;
+    for (itr = lookups.begin(); itr != lookups.end(); ++itr) {
+        const QString &module = itr.key().first;
+        if (module != prev_module) {
+            if (!prev_path.isEmpty())
+                drsym_free_resources(prev_path.constData());
+            prev_module = module;
+            prev_path = find_module(module).toLocal8Bit();
+        }
+        *itr = module + "!?";
+        if (prev_path.isEmpty())
+            continue;
+        drsym_info_t sym;
+        sym.struct_size = sizeof(sym);
+        sym.name = name;
+        sym.name_size = sizeof(name);
+        sym.file = NULL;
+        sym.file_size = 0;
+        drsym_error_t res = drsym_lookup_address(prev_path.constData(),
+                                                 (size_t)itr.key().second, &sym,
+                                                 DRSYM_DEMANGLE);
+        if (res == DRSYM_SUCCESS || res == DRSYM_ERROR_LINE_NOT_AVAILABLE)
+            *itr = module + "!" + QString::fromLocal8Bit(sym.name);
+    }
+    if (!prev_path.isEmpty())
+        drsym_free_resources(prev_path.constData());
+}
+
+/* Static
+ * Reads the first max_frames frames of a callstack, or all of them if
+ * max_frames is -1.  A frame such as
+ * '# 1 libc.so.6!malloc+0x0 [file:line] (0x... <libc.so.6+0x7a1b0>)'
+ * already has its symbol, while 'libfoo.so!?' needs a lookup.
+ */
+static QVector<header_frame_t>
+read_header_frames(quint64 callstack_index, int max_frames)
+{
+    QVector<header_frame_t> frames;
+    const log_range_t &range = callstack_idx[callstack_index];
+    quint64 pos = range.pos, end_pos = range.pos + range.size;
+    const char *start, *end;
+    while ((max_frames < 0 || frames.count() < max_frames) && pos < end_pos &&
+           next_line(callstack_log.base, end_pos, &pos, &start, &end)) {
+        if (start == end || *start != '#')
+            continue;
+        QString line = QString::fromLatin1(start, end - start);
+        header_frame_t frame;
+        /* Skip '# num ' */
+        QRegExp frame_exp("^#\\s*\\d+\\s+");
+        int modoffs_start = line.lastIndexOf(" <");
+        int addr_start = line.lastIndexOf(" (");
+        if (modoffs_start < 0 || addr_start < 0 ||
+            line.contains("<not in a module>") ||
+            frame_exp.indexIn(line) < 0) {
+            frame.symbol = "?";
+            frames.append(frame);
+            continue;
+        }
+        QRegExp modoffs_exp("<(.*)\\+0x([0-9a-fA-F]+)>");
+        if (modoffs_exp.indexIn(line, modoffs_start) >= 0) {
+            frame.modoffs.first = modoffs_exp.cap(1);
+            frame.modoffs.second = modoffs_exp.cap(2).toULongLong(NULL, 16);
+            /* PR 543863: look up the call rather than the return address */
+            if (!frames.isEmpty() && frame.modoffs.second > 0)
+                frame.modoffs.second--;
+        }
+        int sym_start = frame_exp.matchedLength();
+        QString symbol = line.mid(sym_start, addr_start - sym_start);
+        int file_start = symbol.lastIndexOf(" [");
+        if (file_start >= 0)
+            symbol = symbol.left(file_start);
+        symbol = symbol.trimmed();
+        int offs = symbol.lastIndexOf("+0x");
+        if (offs > 0)
+            symbol = symbol.left(offs);
+        if (!symbol.endsWith("!?") || frame.modoffs.first.isEmpty())
+            frame.symbol = symbol;
+        frames.append(frame);
+    }
+    return frames;
+}
+
+/* Static
+ * Builds the header postprocess.pl's create_callstack_header() shows
+ */
+static QString
+callstack_header(quint64 callstack_index, const QVector<header_frame_t> &frames,
+                 const QMap<modoffs_t, QString> &lookups)
+{
+    /* callstack #1 is a special case */
+    if (callstack_index == 0)
+        return "Allocations before Dr. HeapStat got control";
+    QString header;
+    QRegExp lib_exp(".*!(.*)");
+    QRegExp func_exp(".*::([^:]+)\\(");
+    QRegExp template_exp("(.*)<.*>");
+    foreach (const header_frame_t &frame, frames) {
+        QString symbol = frame.symbol;
+        if (symbol.isEmpty())
+            symbol = lookups.value(frame.modoffs, "?");
+        /* Discard the library name */
+        if (lib_exp.indexIn(symbol) >= 0)
+            symbol = lib_exp.cap(1);
+        /* Get only the function name for templated symbols */
+        if (func_exp.indexIn(symbol) >= 0)
+            symbol = func_exp.cap(1);
+        if (template_exp.indexIn(symbol) >= 0)
+            symbol = template_exp.cap(1);
+        if (!header.isEmpty())
+            header += " &lt;-- ";
+        header += symbol;
+    }
+    return header;
+}
+
+/***************************************************************************
+ * Output
+ */
+
+static bool
+open_output(QFile &file, const QString &name)
+{
+    file.setFileName(QDir(cur_profdir).absoluteFilePath(name));
+    if (!file.open(QFile::WriteOnly | QFile::Truncate | QFile::Text)) {
+        fprintf(stderr, "ERROR: unable to write %s\n",
+                file.fileName().toLocal8Bit().constData());
+        return false;
+    }
+    return true;
+}
+
+/* Static
+ * Writes snapshot_summary.xml and the snapshot and staleness indices.  Unlike
+ * postprocess.pl, which samples 50 snapshots for its vistool, every snapshot
+ * is listed.
+ */
+static bool
+write_snapshot_reports(const QVector<dhvis_snapshot_listing_t *> &sorted)
+{
+    QFile sum_file, ss_idx_file, stale_idx_file;
+    if (!open_output(sum_file, "snapshot_summary.xml") ||
+        !open_output(ss_idx_file, "snapshot.idx") ||
+        (have_stale && !open_output(stale_idx_file, "staleness.idx")))
+        return false;
+    QTextStream sum(&sum_file), ss_idx(&ss_idx_file), stale_idx(&stale_idx_file);
+
+    sum << "<snapshot_summary totSnapshots=\"" << sorted.count() << "\" "
+        << "xAxisLabel=\"" << xaxis_label << "\" hasStale=\"";
+    if (!have_stale)
+        sum << "no\">\n";
+    else if (op.stale_since > -1)
+        sum << "yes\" staleType=\"since\" staleTime=\"" << op.stale_since << "\">\n";
+    else
+        sum << "yes\" staleType=\"for\" staleTime=\"" << op.stale_for << "\">\n";
+    for (int i = 0; i < sorted.count(); i++) {
+        const dhvis_snapshot_listing_t *s = sorted[i];
+        sum << "\t<snapshot id=\"" << i << "\""
+            << " totMemReq=\"" << s->tot_bytes_asked_for << "\""
+            << " totMemPad=\"" << s->tot_bytes_usable << "\""
+            << " totMemTot=\"" << s->tot_bytes_occupied << "\"";
+        if (have_stale)
+            sum << " totMemStale=\"" << s->tot_bytes_stale << "\"";
+        sum << "/>\n";
+        ss_idx << s->log_offset << " " << s->log_end - s->log_offset << "\n";
+        if (have_stale) {
+            const log_range_t &range = staleness_idx[s->snapshot_num];
+            stale_idx << range.pos << " " << range.size << "\n";
+        }
+    }
+    sum << "</snapshot_summary>\n";
+    return true;
+}
+
+static bool
+peak_sorter(const dhvis_callstack_listing_t *a, const dhvis_callstack_listing_t *b)
+{
+    if (a->extra_occupied == b->extra_occupied)
+        return a->callstack_num < b->callstack_num;
+    return a->extra_occupied > b->extra_occupied;
+}
+
+/* Static
+ * Symbolizes the frames the headers need and writes callstack_peaks.xml and
+ * callstack.idx.  The callstack elements use the attributes of those in
+ * postprocess.pl's snapshot XML, with the id of the peak's snapshot added.
+ */
+static bool
+write_callstack_reports(QVector<dhvis_callstack_listing_t> &peaks,
+                        const QVector<int> &renumber)
+{
+    QVector<dhvis_callstack_listing_t *> sorted;
+    for (int i = 0; i < peaks.count(); i++) {
+        if (peaks[i].extra_occupied > 0)
+            sorted.append(&peaks[i]);
+    }
+    std::sort(sorted.begin(), sorted.end(), peak_sorter);
+
+    QElapsedTimer timer;
+    timer.start();
+    QMap<int, QVector<header_frame_t> > header_frames;
+    QMap<modoffs_t, QString> lookups;
+    foreach (const dhvis_callstack_listing_t *c, sorted) {
+        int index = c->callstack_num - 1;
+        header_frames[index] = read_header_frames(index, HEADER_FRAMES);
+        foreach (const header_frame_t &frame, header_frames[index]) {
+            if (frame.symbol.isEmpty())
+                lookups.insert(frame.modoffs, QString());
+        }
+    }
+    symbolize_frames(lookups);
+    if (op.verbose) {
+        printf("Symbolized %d unique frames in %lld ms\n", lookups.count(),
+               (long long)timer.elapsed());
+    }
+
+    QFile peaks_file, cs_idx_file;
+    if (!open_output(peaks_file, "callstack_peaks.xml") ||
+        !open_output(cs_idx_file, "callstack.idx"))
+        return false;
+    QTextStream out(&peaks_file), cs_idx(&cs_idx_file);
+    out << "<callstack_peaks numCallstacks=\"" << sorted.count() << "\">\n";
+    foreach (const dhvis_callstack_listing_t *c, sorted) {
+        int index = c->callstack_num - 1;
+        out << "\t<callstack id=\"" << c->callstack_num << "\" "
+            << "hdr=\"" << callstack_header(index, header_frames[index], lookups)
+            << "\" "
+            << "num=\"" << c->instances << "\" "
+            << "memReq=\"" << c->bytes_asked_for << "\" "
+            << "memPad=\"" << c->extra_usable << "\" "
+            << "memTot=\"" << c->extra_occupied << "\"";
+        if (have_stale)
+            out << " memStale=\"" << c->staleness_sum_info.value(c->cur_snap_num, 0) << "\"";
+        out << " snapshot=\"" << renumber[c->cur_snap_num] << "\"/>\n";
+    }
+    out << "</callstack_peaks>\n";
+    foreach (const log_range_t &range, callstack_idx)
+        cs_idx << range.pos << " " << range.size << "\n";
+    return true;
+}
+
+/***************************************************************************
+ * Profile comparison
+ */
+
+/* A callstack's usage in one profile, summed over the callstacks there that
+ * symbolize alike
+ */
+struct diff_usage_t {
+    diff_usage_t(void) : peak(0), total(0), callstacks(0) {}
+    quint64 peak;
+    quint64 total;
+    int callstacks;
+};
+
+struct diff_row_t {
+    /* The symbolized frames, one per line */
+    QString key;
+    QString header;
+    diff_usage_t base;
+    diff_usage_t cur;
+};
+
+typedef QHash<QString, diff_row_t> diff_table_t;
+
+static qint64
+usage_delta(quint64 cur, quint64 base)
+{
+    return (qint64)(cur - base);
+}
+
+static quint64
+delta_magnitude(qint64 delta)
+{
+    return delta < 0 ? (quint64)-delta : (quint64)delta;
+}
+
+/* Static
+ * Symbolizes every frame of each callstack in the loaded profile that used
+ * any memory, and adds the callstack's usage to its row in table.  The
+ * baseline builds the table and the current profile then probes it.
+ */
+static void
+summarize_profile(const QVector<dhvis_callstack_listing_t> &peaks,
+                  const QVector<quint64> &totals, bool is_baseline,
+                  diff_table_t &table)
+{
+    QMap<int, QVector<header_frame_t> > frames;
+    QMap<modoffs_t, QString> lookups;
+    for (int i = 0; i < peaks.count(); i++) {
+        if (peaks[i].extra_occupied == 0)
+            continue;
+        frames[i] = read_header_frames(i, -1);
+        foreach (const header_frame_t &frame, frames[i]) {
+            if (frame.symbol.isEmpty())
+                lookups.insert(frame.modoffs, QString());
+        }
+    }
+    symbolize_frames(lookups);
+
+    QMap<int, QVector<header_frame_t> >::const_iterator itr;
+    for (itr = frames.begin(); itr != frames.end(); ++itr) {
+        int index = itr.key();
+        QString key;
+        if (index == 0)
+            key = callstack_header(index, *itr, lookups);
+        else {
+            QStringList symbols;
+            foreach (const header_frame_t &frame, *itr) {
+                symbols << (frame.symbol.isEmpty() ?
+                            lookups.value(frame.modoffs, "?") : frame.symbol);
+            }
+            key = symbols.join("\n");
+        }
+        diff_table_t::iterator row = table.find(key);
+        if (row == table.end()) {
+            row = table.insert(key, diff_row_t());
+            row->key = key;
+            row->header = callstack_header(index, itr->mid(0, HEADER_FRAMES), lookups);
+        }
+        diff_usage_t &usage = is_baseline ? row->base : row->cur;
+        usage.peak += peaks[index].extra_occupied;
+        usage.total += totals[index];
+        usage.callstacks++;
+    }
+}
+
+/* Largest change in peak usage first, then in summed usage */
+static bool
+diff_sorter(const diff_row_t *a, const diff_row_t *b)
+{
+    quint64 a_peak = delta_magnitude(usage_delta(a->cur.peak, a->base.peak));
+    quint64 b_peak = delta_magnitude(usage_delta(b->cur.peak, b->base.peak));
+    if (a_peak != b_peak)
+        return a_peak > b_peak;
+    quint64 a_total = delta_magnitude(usage_delta(a->cur.total, a->base.total));
+    quint64 b_total = delta_magnitude(usage_delta(b->cur.total, b->base.total));
+    if (a_total != b_total)
+        return a_total > b_total;
+    return a->key < b->key;
+}
+
+/* Static
+ * Writes callstack_diff.xml to the current profile's directory and lists the
+ * largest changes on stdout.  Callstacks whose usage did not change are left
+ * out.
+ */
+static bool
+write_diff_report(const diff_table_t &table, quint64 base_peak, quint64 cur_peak)
+{
+    QVector<const diff_row_t *> sorted;
+    diff_table_t::const_iterator itr;
+    for (itr = table.begin(); itr != table.end(); ++itr) {
+        if (itr->base.peak != itr->cur.peak || itr->base.total != itr->cur.total)
+            sorted.append(&*itr);
+    }
+    std::sort(sorted.begin(), sorted.end(), diff_sorter);
+
+    QFile diff_file;
+    if (!open_output(diff_file, "callstack_diff.xml"))
+        return false;
+    QTextStream out(&diff_file);
+    out << "<callstack_diff baseline=\"" << QDir(op.baseline).absolutePath() << "\" "
+        << "basePeak=\"" << base_peak << "\" "
+        << "curPeak=\"" << cur_peak << "\" "
+        << "numCallstacks=\"" << sorted.count() << "\">\n";
+    foreach (const diff_row_t *row, sorted) {
+        out << "\t<callstack hdr=\"" << row->header << "\" "
+            << "basePeak=\"" << row->base.peak << "\" "
+            << "curPeak=\"" << row->cur.peak << "\" "
+            << "peakDelta=\"" << usage_delta(row->cur.peak, row->base.peak) << "\" "
+            << "baseTotal=\"" << row->base.total << "\" "
+            << "curTotal=\"" << row->cur.total << "\" "
+            << "totalDelta=\"" << usage_delta(row->cur.total, row->base.total)
+            << "\" "
+            << "baseNum=\"" << row->base.callstacks << "\" "
+            << "curNum=\"" << row->cur.callstacks << "\"/>\n";
+    }
+    out << "</callstack_diff>\n";
+
+    printf("Peak usage: %llu bytes in the baseline, %llu bytes now (%+lld)\n",
+           (unsigned long long)base_peak, (unsigned long long)cur_peak,
+           (long long)usage_delta(cur_peak, base_peak));
+    printf("%d callstacks changed; the largest changes are:\n", sorted.count());
+    printf("  %14s %16s  %s\n", "peak change", "summed change", "callstack");
+    for (int i = 0; i < sorted.count() && i < DIFF_REPORT_ROWS; i++) {
+        const diff_row_t *row = sorted[i];
+        /* The header is escaped for the XML */
+        QString header = row->header;
+        header.replace("&lt;", "<");
+        printf("  %+14lld %+16lld  %s%s\n",
+               (long long)usage_delta(row->cur.peak, row->base.peak),
+               (long long)usage_delta(row->cur.total, row->base.total),
+               header.toLocal8Bit().constData(),
+               row->base.callstacks == 0 ? " (new)" :
+               (row->cur.callstacks == 0 ? " (gone)" : ""));
+    }
+    return true;
+}
+
+/***************************************************************************
+ * Top level
+ */
+
+/* Static
+ * Maps, indexes and parses the logs in cur_profdir
+ */
+static bool
+load_profile(QVector<dhvis_callstack_listing_t> &peaks, QVector<quint64> &totals)
+{
+    QElapsedTimer timer;
+    timer.start();
+    if (!map_log(snapshot_log, "snapshot.log") ||
+        !map_log(callstack_log, "callstack.log") ||
+        (have_stale && !map_log(staleness_log, "staleness.log")))
+        return false;
+    if (!index_snapshot_log() || !index_callstack_log() ||
+        (have_stale && !index_staleness_log()))
+        return false;
+    if (op.verbose) {
+        printf("Indexed %d snapshots and %d callstacks in %lld ms\n",
+               snapshots.count(), callstack_idx.count(), (long long)timer.elapsed());
+    }
+
+    timer.restart();
+    if (!parse_snapshots(peaks, totals))
+        return false;
+    if (op.verbose)
+        printf("Parsed snapshots in %lld ms\n", (long long)timer.elapsed());
+    return true;
+}
+
+/* Static
+ * Frees what load_profile() set up, so that another profile can be loaded
+ */
+static void
+unload_profile(void)
+{
+    qDeleteAll(snapshots);
+    snapshots.clear();
+    staleness_idx.clear();
+    callstack_idx.clear();
+    /* Closing unmaps */
+    snapshot_log.file.close();
+    staleness_log.file.close();
+    callstack_log.file.close();
+    module_paths.clear();
+    module_dirs.clear();
+}
+
+/* Static
+ * Writes the reports for op.profdir
+ */
+static int
+process_profile(void)
+{
+    QVector<dhvis_callstack_listing_t> peaks;
+    QVector<quint64> totals;
+    cur_profdir = op.profdir;
+    cur_exe = op.exe;
+    int res = 0;
+    if (!load_profile(peaks, totals))
+        res = 1;
+    else {
+        QVector<int> renumber;
+        QVector<dhvis_snapshot_listing_t *> sorted = sort_snapshots_by_time(renumber);
+        if (!write_snapshot_reports(sorted) ||
+            !write_callstack_reports(peaks, renumber))
+            res = 1;
+    }
+    unload_profile();
+    return res;
+}
+
+/* Static
+ * Compares op.profdir against op.baseline.  Returns 2 if the peak grew by
+ * more than -max_growth.
+ */
+static int
+diff_profiles(void)
+{
+    diff_table_t table;
+    quint64 peak[2];
+    const QString dirs[2] = { op.baseline, op.profdir };
+    const QString exes[2] = { op.baseline_exe.isEmpty() ? op.exe : op.baseline_exe,
+                              op.exe };
+    for (int i = 0; i < 2; i++) {
+        QVector<dhvis_callstack_listing_t> peaks;
+        QVector<quint64> totals;
+        cur_profdir = dirs[i];
+        cur_exe = exes[i];
+        if (!load_profile(peaks, totals)) {
+            unload_profile();
+            return 1;
+        }
+        peak[i] = 0;
+        foreach (const dhvis_snapshot_listing_t *s, snapshots)
+            peak[i] = qMax(peak[i], s->tot_bytes_occupied);
+        QElapsedTimer timer;
+        timer.start();
+        summarize_profile(peaks, totals, i == 0, table);
+        if (op.verbose) {
+            printf("Summarized %s in %lld ms\n", cur_profdir.toLocal8Bit().constData(),
+                   (long long)timer.elapsed());
+        }
+        unload_profile();
+    }
+    if (!write_diff_report(table, peak[0], peak[1]))
+        return 1;
+    if (op.max_growth > -1 && peak[1] > peak[0] &&
+        peak[1] - peak[0] > (quint64)op.max_growth) {
+        fprintf(stderr, "ERROR: peak usage grew by %llu bytes, more than -max_growth\n",
+                (unsigned long long)(peak[1] - peak[0]));
+        return 2;
+    }
+    return 0;
+}
+
+static bool
+parse_args(const QStringList &args)
+{
+    op.stale_since = op.stale_for = -1;
+    op.threads = 0;
+    op.verbose = false;
+    op.max_growth = -1;
+    for (int i = 1; i < args.count(); i++) {
+        bool ok = true;
+        if (args[i] == "-profdir" && i + 1 < args.count())
+            op.profdir = args[++i];
+        else if (args[i] == "-x" && i + 1 < args.count())
+            op.exe = args[++i];
+        else if (args[i] == "-stale_since" && i + 1 < args.count())
+            op.stale_since = args[++i].toLongLong(&ok);
+        else if (args[i] == "-stale_for" && i + 1 < args.count())
+            op.stale_for = args[++i].toLongLong(&ok);
+        else if (args[i] == "-threads" && i + 1 < args.count())
+            op.threads = args[++i].toInt(&ok);
+        else if (args[i] == "-v")
+            op.verbose = true;
+        else if (args[i] == "-diff" && i + 1 < args.count())
+            op.baseline = args[++i];
+        else if (args[i] == "-diff_x" && i + 1 < args.count())
+            op.baseline_exe = args[++i];
+        else if (args[i] == "-max_growth" && i + 1 < args.count())
+            op.max_growth = args[++i].toLongLong(&ok);
+        else
+            return false;
+        if (!ok)
+            return false;
+    }
+    if (op.profdir.isEmpty())
+        return false;
+    if (op.stale_since != -1 && op.stale_for != -1) {
+        fprintf(stderr, "ERROR: can't specify -stale_since and -stale_for together\n");
+        return false;
+    }
+    if (op.baseline.isEmpty() && (!op.baseline_exe.isEmpty() || op.max_growth != -1)) {
+        fprintf(stderr, "ERROR: -diff_x and -max_growth require -diff\n");
+        return false;
+    }
+    have_stale = (op.stale_since != -1 || op.stale_for != -1);
+    return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    if (!parse_args(app.arguments())) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+    if (!QDir(op.profdir).exists()) {
+        fprintf(stderr, "ERROR: can't find directory: %s\n",
+                op.profdir.toLocal8Bit().constData());
+        return 1;
+    }
+    if (!op.baseline.isEmpty() && !QDir(op.baseline).exists()) {
+        fprintf(stderr, "ERROR: can't find directory: %s\n",
+                op.baseline.toLocal8Bit().constData());
+        return 1;
+    }
+
+    dr_standalone_init();
+#ifdef WINDOWS
+    if (drsym_init(NULL) != DRSYM_SUCCESS) {
+#else
+    if (drsym_init(0) != DRSYM_SUCCESS) {
+#endif
+        fprintf(stderr, "ERROR: unable to initialize symbol library\n");
+        return 1;
+    }
+    int res = op.baseline.isEmpty() ? process_profile() : diff_profiles();
+    if (drsym_exit() != DRSYM_SUCCESS)
+        fprintf(stderr, "WARNING: error cleaning up symbol library\n");
+    return res;
+}
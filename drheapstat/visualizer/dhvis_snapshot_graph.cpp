@@ -49,6 +49,7 @@
  */
 dhvis_snapshot_graph_t::
 dhvis_snapshot_graph_t(QVector<dhvis_snapshot_listing_t *> *vec,
+                       dhvis_snapshot_lod_t *lod_,
                        QString *time_unit_,
                        dhvis_options_t *options_)
 {
@@ -56,6 +57,7 @@ dhvis_snapshot_graph_t(QVector<dhvis_snapshot_listing_t *> *vec,
     setAttribute(Qt::WA_DeleteOnClose);
     graph_outer_margin = 10;
     snapshots = vec;
+    lod = lod_;
     time_unit = time_unit_;
     options = options_;
     if (options != NULL)
@@ -359,22 +361,12 @@ dhvis_snapshot_graph_t::max_height(void)
 {
     qDebug().nospace() << "INFO: Entering " << __CLASS__ << __FUNCTION__;
     qreal height = 0;
-    qreal total_percent = 0;
-    qreal prev_time = 0;
-    if (snapshots != NULL &&
+    if (snapshots != NULL && lod != NULL &&
         !snapshots->isEmpty()) {
-        foreach (dhvis_snapshot_listing_t *snapshot, *snapshots) {
-            total_percent += ((snapshot->num_time - prev_time) /
-                             ((double)width_max)) * 100;
-            prev_time = snapshot->num_time;
-            if (total_percent < view_start_mark)
-                continue;
-            if (total_percent > view_end_mark)
-                break;
-
-            if (snapshot->tot_bytes_occupied > height)
-                height = snapshot->tot_bytes_occupied;
-        }
+        int first = snapshot_index_at(view_start_mark, false);
+        int last = snapshot_index_at(view_end_mark, true) - 1;
+        if (first <= last)
+            height = lod->query(DHVIS_LOD_OCCUPIED, first, last).max;
     }
     maximum_value = QString::number(height);
     height_max = height;
@@ -435,6 +427,26 @@ dhvis_snapshot_graph_t::data_point_y(const quint64 &y)
     return y * (max_y) / height_max;
 }
 
+/* Private
+ * Returns the index of the first snapshot at or, if after, past the given
+ * percent of the x-axis
+ */
+int
+dhvis_snapshot_graph_t::snapshot_index_at(const qreal &percent, bool after)
+{
+    int lo = 0;
+    int hi = snapshots->count();
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        qreal mid_percent = (snapshots->at(mid)->num_time / (double)width_max) * 100;
+        if (mid_percent < percent || (after && mid_percent == percent))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
 /* Private
  * Helps draw_heap_data() graph data
  */
@@ -526,6 +538,18 @@ dhvis_snapshot_graph_t::draw_heap_data(QPainter *painter)
     painter->setBrush(data_point_brush);
     painter->setPen(data_point_pen);
 
+    /* With more snapshots in view than pixel columns, individual points
+     * cannot be told apart anyway
+     */
+    int columns = (int)x_axis_width();
+    if (columns > 0 &&
+        snapshot_index_at(view_end_mark, true) -
+        snapshot_index_at(view_start_mark, false) > columns) {
+        draw_heap_data_lod(painter, data_point_pen, columns);
+        painter->restore();
+        return;
+    }
+
     bool first = true;
     bool last = false;
     foreach (dhvis_snapshot_listing_t *snapshot, *snapshots) {
@@ -580,6 +604,63 @@ dhvis_snapshot_graph_t::draw_heap_data(QPainter *painter)
 #undef DHVIS_DRAW_POINTS
 #undef DHVIS_MAKE_PREV_POINTS
 
+/* Private
+ * Graphs data one pixel column at a time: each column draws the range of its
+ * snapshots' values, from the pyramids, and joins their averages.  Repaint
+ * time thus depends on the graph's width rather than the profile's length.
+ */
+void
+dhvis_snapshot_graph_t::draw_heap_data_lod(QPainter *painter, QPen &pen,
+                                           int columns)
+{
+    static const int NUM_LINES = 4;
+    const dhvis_lod_series_t series[NUM_LINES] = {
+        DHVIS_LOD_STALE, DHVIS_LOD_ASKED_FOR, DHVIS_LOD_USABLE, DHVIS_LOD_OCCUPIED
+    };
+    const bool enabled[NUM_LINES] = {
+        staleness_line, mem_alloc_line, padding_line, headers_line
+    };
+    const QColor colors[NUM_LINES] = {
+        STALENESS_LINE_COLOR, MEM_ALLOC_LINE_COLOR, PADDING_LINE_COLOR,
+        HEADERS_LINE_COLOR
+    };
+    QPointF prev_points[NUM_LINES];
+    bool have_prev = false;
+    qreal percent_per_column = (view_end_mark - view_start_mark) / columns;
+    /* Adjacent columns touch, so wide lines would just smear */
+    pen.setWidth(1);
+
+    int first = snapshot_index_at(view_start_mark, false);
+    for (int col = 0; col < columns; col++) {
+        int last;
+        if (col == columns - 1)
+            last = snapshot_index_at(view_end_mark, true) - 1;
+        else {
+            last = snapshot_index_at(view_start_mark + (col + 1) * percent_per_column,
+                                     false) - 1;
+        }
+        if (last < first)
+            continue;
+        qreal dp_x = data_point_x(col * percent_per_column);
+        for (int i = 0; i < NUM_LINES; i++) {
+            if (!enabled[i])
+                continue;
+            dhvis_lod_node_t node = lod->query(series[i], first, last);
+            quint64 avg = node.sum / (last - first + 1);
+            QPointF avg_point(dp_x, data_point_y(avg));
+            pen.setColor(colors[i]);
+            painter->setPen(pen);
+            painter->drawLine(QPointF(dp_x, data_point_y(node.min)),
+                              QPointF(dp_x, data_point_y(node.max)));
+            if (have_prev)
+                painter->drawLine(prev_points[i], avg_point);
+            prev_points[i] = avg_point;
+        }
+        have_prev = true;
+        first = last + 1;
+    }
+}
+
 /* Private
  * Finds which snapshot to highlight according to slider position
  */
@@ -695,7 +776,7 @@ dhvis_snapshot_graph_t::update_settings(void)
  */
 bool
 dhvis_snapshot_graph_t::is_null(void) {
-    return snapshots == NULL || options == NULL;
+    return snapshots == NULL || lod == NULL || options == NULL;
 }
 
 /* Private Slot
@@ -765,31 +846,7 @@ dhvis_snapshot_graph_t::set_stale_num(const qreal &new_num)
             stale_num = new_num;
             stale_suffix = *time_unit;
         }
-        /* Calculate fitting sums of each snaphot */
-        dhvis_snapshot_listing_t *snapshot;
-        foreach (dhvis_snapshot_listing_t *snapshot, *snapshots) {
-            snapshot->tot_bytes_stale = 0;
-            foreach (dhvis_callstack_listing_t *c,
-                     snapshot->stale_callstacks) {
-                quint64 snap_num = snapshot->snapshot_num;
-                foreach (stale_pair_t sp, c->staleness_info[snap_num]) {
-                    bool add = false;
-                    qreal stale_comp = sp.STALE_LAST_ACCESS;
-                    /* Stale for */
-                    if (stale_type) {
-                        stale_comp = snapshot->num_time - stale_comp;
-                        if (stale_comp >= stale_num)
-                            add = true;
-                    } /* Stale since */
-                    else {
-                        if (stale_comp <= stale_num)
-                            add = true;
-                    }
-                    if (add)
-                        snapshot->tot_bytes_stale += sp.STALE_BYTES;
-                }
-            }
-        }
+        calculate_stale_sums();
         /* The valueChanged(int) signal is only emitted if the value is different
          * from the last one, so it is safe to call setValue(int) here.
          */
@@ -801,6 +858,54 @@ dhvis_snapshot_graph_t::set_stale_num(const qreal &new_num)
     }
 }
 
+/* Private
+ * Calculates each snapshot's sum of bytes fitting the staleness criteria
+ */
+void
+dhvis_snapshot_graph_t::calculate_stale_sums(void)
+{
+    foreach (dhvis_snapshot_listing_t *snapshot, *snapshots) {
+        snapshot->tot_bytes_stale = 0;
+        foreach (dhvis_callstack_listing_t *c,
+                 snapshot->stale_callstacks) {
+            quint64 snap_num = snapshot->snapshot_num;
+            foreach (stale_pair_t sp, c->staleness_info[snap_num]) {
+                bool add = false;
+                qreal stale_comp = sp.STALE_LAST_ACCESS;
+                /* Stale for */
+                if (stale_type) {
+                    stale_comp = snapshot->num_time - stale_comp;
+                    if (stale_comp >= stale_num)
+                        add = true;
+                } /* Stale since */
+                else {
+                    if (stale_comp <= stale_num)
+                        add = true;
+                }
+                if (add)
+                    snapshot->tot_bytes_stale += sp.STALE_BYTES;
+            }
+        }
+    }
+    if (lod != NULL)
+        lod->build_series(*snapshots, DHVIS_LOD_STALE);
+}
+
+/* Public
+ * Recalculates the staleness line once the staleness data is loaded,
+ * which can be after the graph is first drawn.
+ */
+void
+dhvis_snapshot_graph_t::refresh_staleness(void)
+{
+    qDebug().nospace() << "INFO: Entering " << __CLASS__ << __FUNCTION__;
+    if (is_null())
+        return;
+    calculate_stale_sums();
+    current_graph_modified = true;
+    set_heap_data(snapshots);
+}
+
 /* Private
  * Creates a suffix for the staleness spin box
  */
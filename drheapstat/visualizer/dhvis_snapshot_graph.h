@@ -42,11 +42,14 @@ class dhvis_snapshot_graph_t : public dhvis_graph_t
     Q_OBJECT
 public:
     dhvis_snapshot_graph_t(QVector<dhvis_snapshot_listing_t *> *vec,
+                           dhvis_snapshot_lod_t *lod_,
                            QString *time_unit_,
                            dhvis_options_t *options_);
 
     bool is_null(void);
 
+    void refresh_staleness(void);
+
 public slots:
     void update_settings(void);
 
@@ -84,6 +87,10 @@ private:
 
     void draw_heap_data(QPainter *painter);
 
+    void draw_heap_data_lod(QPainter *painter, QPen &pen, int columns);
+
+    int snapshot_index_at(const qreal &percent, bool after);
+
     void max_height(void);
 
     void max_width(void);
@@ -98,6 +105,8 @@ private:
 
     void draw_view_cursor(QPainter *painter);
 
+    void calculate_stale_sums(void);
+
     QString create_stale_suffix(const qreal &num);
 
     bool fix_point_coincidence(QVector<QPoint> &points, QPoint *next, int offset,
@@ -118,6 +127,7 @@ private:
 
     /* Data */
     QVector<dhvis_snapshot_listing_t *> *snapshots;
+    dhvis_snapshot_lod_t *lod;
     quint64 avg_time_between_snapshots;
 };
 
@@ -329,6 +329,21 @@ dhvis_stale_graph_t::draw_helper(QPainter *painter, qreal &next_loc,
         qreal num_stales = stale_bytes->count();
         qreal small_area = (next_loc - prev_loc) / num_stales;
 
+        /* With more instances than pixel columns, draw one bar per column.
+         * The instances are sorted greatest first, so each column's tallest
+         * is its first, and repaint time no longer grows with their number.
+         */
+        if (small_area < 1) {
+            int columns = qMax(1, (int)(next_loc - prev_loc));
+            for (int col = 0; col < columns; col++) {
+                int index = (int)(col * num_stales / columns);
+                qreal dp_x = prev_loc + col;
+                qreal dp_y = data_point_y((*stale_bytes)[index].STALE_BYTES);
+                painter->drawRect(QRectF(QPointF(dp_x, dp_y), QPointF(dp_x + 1, 0)));
+            }
+            return;
+        }
+
         for (qreal i = 0; i < num_stales; i++) {
             qreal dp_x = prev_loc + (small_area * i) + (SPACING / 2);
             qreal dp_y = data_point_y((*stale_bytes)[i].STALE_BYTES);
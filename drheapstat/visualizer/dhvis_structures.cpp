@@ -30,6 +30,124 @@
 
 #include "dhvis_structures.h"
 
+/* Static
+ * Returns the value of the given line for a snapshot
+ */
+static quint64
+lod_value(const dhvis_snapshot_listing_t *snapshot, dhvis_lod_series_t series)
+{
+    switch (series) {
+    case DHVIS_LOD_ASKED_FOR:
+        return snapshot->tot_bytes_asked_for;
+    case DHVIS_LOD_USABLE:
+        return snapshot->tot_bytes_usable;
+    case DHVIS_LOD_OCCUPIED:
+        return snapshot->tot_bytes_occupied;
+    default:
+        return snapshot->tot_bytes_stale;
+    }
+}
+
+/* Static
+ * Folds src into dst
+ */
+static void
+lod_combine(dhvis_lod_node_t &dst, const dhvis_lod_node_t &src)
+{
+    if (src.min < dst.min)
+        dst.min = src.min;
+    if (src.max > dst.max)
+        dst.max = src.max;
+    dst.sum += src.sum;
+}
+
+/* Public
+ * Builds the pyramids of every line; called by the loader once the snapshots
+ * are indexed and sorted.
+ */
+void
+dhvis_snapshot_lod_t::build(const QVector<dhvis_snapshot_listing_t *> &snapshots)
+{
+    for (int i = 0; i < DHVIS_LOD_NUM_SERIES; i++)
+        build_series(snapshots, (dhvis_lod_series_t)i);
+}
+
+/* Public
+ * Builds the pyramid of a single line
+ */
+void
+dhvis_snapshot_lod_t::build_series(const QVector<dhvis_snapshot_listing_t *> &snapshots,
+                                   dhvis_lod_series_t series)
+{
+    QVector<QVector<dhvis_lod_node_t> > &pyramid = levels[series];
+    pyramid.clear();
+    if (snapshots.isEmpty())
+        return;
+    QVector<dhvis_lod_node_t> level(snapshots.count());
+    for (int i = 0; i < snapshots.count(); i++) {
+        quint64 val = lod_value(snapshots.at(i), series);
+        level[i].min = level[i].max = level[i].sum = val;
+    }
+    pyramid.append(level);
+    while (level.count() > 1) {
+        QVector<dhvis_lod_node_t> above((level.count() + 1) / 2);
+        for (int i = 0; i < above.count(); i++) {
+            above[i] = level.at(2 * i);
+            if (2 * i + 1 < level.count())
+                lod_combine(above[i], level.at(2 * i + 1));
+        }
+        pyramid.append(above);
+        level = above;
+    }
+}
+
+/* Public
+ * Frees the pyramids
+ */
+void
+dhvis_snapshot_lod_t::clear(void)
+{
+    for (int i = 0; i < DHVIS_LOD_NUM_SERIES; i++)
+        levels[i].clear();
+}
+
+/* Public
+ * Returns true if there are no snapshots
+ */
+bool
+dhvis_snapshot_lod_t::is_empty(void) const
+{
+    return levels[DHVIS_LOD_ASKED_FOR].isEmpty();
+}
+
+/* Public
+ * Combines the O(log n) nodes that exactly cover first through last
+ */
+dhvis_lod_node_t
+dhvis_snapshot_lod_t::query(dhvis_lod_series_t series, int first, int last) const
+{
+    const QVector<QVector<dhvis_lod_node_t> > &pyramid = levels[series];
+    dhvis_lod_node_t res;
+    res.min = ~(quint64)0;
+    res.max = 0;
+    res.sum = 0;
+    if (pyramid.isEmpty() || first < 0 || last >= pyramid.at(0).count() ||
+        first > last)
+        return res;
+    for (int k = 0; ; k++) {
+        /* An odd first or even last node is not covered by its parent */
+        if (first % 2 == 1)
+            lod_combine(res, pyramid.at(k).at(first++));
+        if (last % 2 == 0 && first <= last)
+            lod_combine(res, pyramid.at(k).at(last--));
+        if (first > last)
+            break;
+        first /= 2;
+        last /= 2;
+    }
+    return res;
+}
+
 /* Non-member
  * Helper for std::sort which sorts snapshots by num_time to
  * align them properly with process lifetime.
@@ -69,6 +69,10 @@ struct dhvis_snapshot_listing_t {
     quint64 tot_bytes_stale;
     quint64 num_time;
     bool is_peak;
+    /* Where this snapshot's callstack entries are in snapshot.log */
+    quint64 log_offset;
+    quint64 log_end;
+    bool details_loaded;
 };
 
 struct dhvis_callstack_listing_t {
@@ -81,6 +85,9 @@ struct dhvis_callstack_listing_t {
     quint64 cur_snap_num;
     stale_map_t staleness_info;
     QMap<quint64, quint64> staleness_sum_info;
+    /* Where this callstack's frames are in callstack.log */
+    quint64 log_offset;
+    bool frames_loaded;
 };
 
 struct dhvis_frame_data_t {
@@ -93,6 +100,46 @@ struct dhvis_frame_data_t {
     QString address;
 };
 
+/* The snapshot graph lines, as summarized by dhvis_snapshot_lod_t */
+enum dhvis_lod_series_t {
+    DHVIS_LOD_ASKED_FOR,
+    DHVIS_LOD_USABLE,
+    DHVIS_LOD_OCCUPIED,
+    DHVIS_LOD_STALE,
+    DHVIS_LOD_NUM_SERIES
+};
+
+struct dhvis_lod_node_t {
+    quint64 min;
+    quint64 max;
+    quint64 sum;
+};
+
+/* Min/max/sum pyramids over the time-sorted snapshots, so that a graph can
+ * summarize any range of snapshots in O(log n) and draw at most one point per
+ * pixel column however long the profile is.  Level 0 has a node per snapshot,
+ * and each node of a level above covers two nodes of the level below.
+ */
+class dhvis_snapshot_lod_t
+{
+public:
+    void build(const QVector<dhvis_snapshot_listing_t *> &snapshots);
+
+    /* The stale line changes with the staleness criteria */
+    void build_series(const QVector<dhvis_snapshot_listing_t *> &snapshots,
+                      dhvis_lod_series_t series);
+
+    void clear(void);
+
+    bool is_empty(void) const;
+
+    /* Summarizes snapshots first through last, inclusive */
+    dhvis_lod_node_t query(dhvis_lod_series_t series, int first, int last) const;
+
+private:
+    QVector<QVector<dhvis_lod_node_t> > levels[DHVIS_LOD_NUM_SERIES];
+};
+
 struct dhvis_options_t {
     QString def_load_dir;
     QString dhrun_log_dir;
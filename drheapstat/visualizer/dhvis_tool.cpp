@@ -50,12 +50,15 @@
 #include <QProcess>
 #include <QStackedLayout>
 #include <QUrl>
+#include <QThread>
+#include <QXmlStreamReader>
 
 #include <algorithm>
 #include <cmath>
 
 #include "dhvis_snapshot_graph.h"
 #include "dhvis_stale_graph.h"
+#include "dhvis_log_loader.h"
 #include "dhvis_tool.h"
 
 /* Public
@@ -67,6 +70,7 @@ dhvis_tool_t::dhvis_tool_t(dhvis_options_t *options_)
     log_dir_text_changed = false;
     dhrun_loc_text_changed = false;
     dhrun_target_text_changed = false;
+    compare_base_text_changed = false;
     log_dir_loc =  "";
     options = options_;
     current_snapshot_num = -1;
@@ -74,6 +78,8 @@ dhvis_tool_t::dhvis_tool_t(dhvis_options_t *options_)
     show_occur = false;
     sorted_column = 0;
     sort_order = Qt::DescendingOrder;
+    loader = NULL;
+    loader_thread = NULL;
     create_layout();
 }
 
@@ -92,6 +98,23 @@ dhvis_tool_t::~dhvis_tool_t(void)
 void
 dhvis_tool_t::delete_data(void)
 {
+    /* Stop any load in progress before freeing what it refers to */
+    if (loader_thread != NULL) {
+        loader->cancel();
+        loader_thread->quit();
+        loader_thread->wait();
+        delete loader_thread;
+        loader_thread = NULL;
+        /* Drop any signals the loader queued for us before it stopped */
+        QCoreApplication::removePostedEvents(this, QEvent::MetaCall);
+        if (!load_results_button->isEnabled()) {
+            load_results_button->setEnabled(true);
+            qApp->restoreOverrideCursor();
+        }
+    }
+    delete loader;
+    loader = NULL;
+
     /* Manage memory */
     while (callstacks.count() > 0) {
         dhvis_callstack_listing_t *tmp = callstacks.back();
@@ -106,6 +129,7 @@ dhvis_tool_t::delete_data(void)
         delete tmp;
     }
     snapshots.clear();
+    snapshot_lod.clear();
 
     delete snapshot_graph;
 
@@ -176,7 +200,7 @@ dhvis_tool_t::create_layout(void)
     graph_title = new QLabel(QString(tr("Memory consumption over "
                                         "full process lifetime")),
                              this);
-    snapshot_graph = new dhvis_snapshot_graph_t(NULL, NULL, NULL);
+    snapshot_graph = new dhvis_snapshot_graph_t(NULL, NULL, NULL, NULL);
     QSpacerItem *space_holder = new QSpacerItem(graph_title->width(),
                                                 snapshot_graph->height());
     left_side->addWidget(graph_title, 0, 0);
@@ -233,6 +257,29 @@ dhvis_tool_t::create_layout(void)
     dhrun_tab_widget->addTab(dhrun_stdout_output_browser, tr("Output"));
     dhrun_tab_widget->addTab(dhrun_stderr_output_browser, tr("Errors"));
 
+    /* Compare against a baseline profile */
+    compare_widget = new QWidget(this);
+    compare_layout = new QGridLayout;
+    compare_base_label = new QLabel(tr("Baseline results"), this);
+    compare_base_line_edit = new QLineEdit(this);
+    connect(compare_base_line_edit, SIGNAL(textEdited(const QString &)),
+            this, SLOT(dir_text_changed_slot()));
+    compare_base_button = new QPushButton(tr("Find"), this);
+    connect(compare_base_button, SIGNAL(clicked()),
+            this, SLOT(choose_dir()));
+    compare_exec_push_button = new QPushButton(tr("Compare"), this);
+    connect(compare_exec_push_button, SIGNAL(clicked()),
+            this, SLOT(compare_profiles()));
+    compare_table = new QTableWidget(this);
+
+    compare_layout->addWidget(compare_base_label, 0, 0);
+    compare_layout->addWidget(compare_base_line_edit, 1, 0);
+    compare_layout->addWidget(compare_base_button, 1, 1);
+    compare_layout->addWidget(compare_exec_push_button, 1, 2);
+    compare_layout->addWidget(compare_table, 2, 0, 1, 3);
+    compare_widget->setLayout(compare_layout);
+    dhrun_tab_widget->addTab(compare_widget, tr("Compare"));
+
     left_side->addWidget(dhrun_tab_widget, 4, 0, 1, 2);
 
     /* Right side */
@@ -345,6 +392,10 @@ dhvis_tool_t::choose_dir(void)
         dir_text_changed = &log_dir_text_changed;
         dir_loc = &log_dir_loc;
         line_edit = log_dir_line_edit;
+    } else if (sender() == compare_base_button) {
+        dir_text_changed = &compare_base_text_changed;
+        dir_loc = &compare_base_loc;
+        line_edit = compare_base_line_edit;
     } else {
         return;
     }
@@ -390,6 +441,8 @@ dhvis_tool_t::dir_text_changed_slot(void)
     /* Determine which button sent signal */
     if (sender() == log_dir_line_edit)
         log_dir_text_changed = true;
+    else if (sender() == compare_base_line_edit)
+        compare_base_text_changed = true;
 }
 
 /* Private
@@ -444,8 +497,8 @@ dhvis_tool_t::dr_check_file(QFile &file)
 }
 
 /* Private
- * Reads the log files
- * XXX i#1319: optimize file reads
+ * Starts loading the log files.  The logs are mapped and indexed on a
+ * separate thread, and the snapshot graph is drawn by log_index_ready().
  */
 void
 dhvis_tool_t::read_log_data(void)
@@ -463,326 +516,114 @@ dhvis_tool_t::read_log_data(void)
         !dr_check_file(staleness_log))
         return;
 
-    /* Set cursor to hourglass */
-    qApp->setOverrideCursor(Qt::WaitCursor);
-
     /* Delete current memory */
     delete_data();
 
-    read_callstack_log(callstack_log);
-    read_snapshot_log(snapshot_log);
-    read_staleness_log(staleness_log);
-
-    /* Sort all of the information properly */
-    sort_log_data();
-
-    /* Setup views and current_info */
-    draw_snapshot_graph();
+    loader = new dhvis_log_loader_t(callstack_log.fileName(),
+                                    snapshot_log.fileName(),
+                                    staleness_log.fileName());
+    if (!loader->map_files()) {
+        delete loader;
+        loader = NULL;
+        QMessageBox msg_box(QMessageBox::Warning,
+                            tr("Invalid File"),
+                            tr("Failed to map the log files in<br>") +
+                            dr_log_dir.canonicalPath(), 0, this);
+        msg_box.exec();
+        return;
+    }
 
-    qApp->restoreOverrideCursor();
+    /* Set cursor to busy until the snapshot graph can be drawn */
+    qApp->setOverrideCursor(Qt::BusyCursor);
+    load_results_button->setEnabled(false);
+
+    loader_thread = new QThread;
+    loader->moveToThread(loader_thread);
+    connect(loader_thread, SIGNAL(started()),
+            loader, SLOT(build_index()));
+    connect(loader, SIGNAL(index_ready()),
+            this, SLOT(log_index_ready()));
+    connect(loader, SIGNAL(staleness_ready()),
+            this, SLOT(log_staleness_ready()));
+    connect(loader, SIGNAL(finished()),
+            loader_thread, SLOT(quit()));
+    connect(loader, SIGNAL(finished()),
+            this, SLOT(log_load_finished()));
+    loader_thread->start();
 }
 
-/* Private
- * Processes callstack.log
+/* Private Slot
+ * Draws the snapshot graph once the logs are indexed.  Each snapshot's
+ * callstacks are only decoded once it is selected.
  */
 void
-dhvis_tool_t::read_callstack_log(QFile &callstack_log)
+dhvis_tool_t::log_index_ready(void)
 {
-    if (callstack_log.open(QFile::ReadOnly)) {
-        quint64 file_entry = callstack_log.pos();
-        QTextStream in_log(&callstack_log);
-        QString line;
-        /* Count number of callstacks */
-        quint64 tot_callstacks = 0;
-        do {
-            line = in_log.readLine();
-            if (line.contains("CALLSTACK"))
-                tot_callstacks++;
-        } while (!line.isNull());
-        /* Allocate space now */
-        callstacks.resize(tot_callstacks);
-        for (quint64 i = 0; i < tot_callstacks; i++) {
-            callstacks[i] = new dhvis_callstack_listing_t;
-        }
-        /* Reset log */
-        if (!callstack_log.seek(file_entry)) {
-            delete_data();
-            return;
-        }
-        /* We assume that the snapshots are listed in increasing order
-         * by their snapshot number.
-         */
-        quint64 counter = 0;
-        line = "";
-        do /* Read file */ {
-            if (!line.contains("CALLSTACK")) {
-                do /* Skip past any extra info */ {
-                    line = in_log.readLine();
-                } while (!line.contains("CALLSTACK") &&
-                         !line.contains("LOG END") &&
-                         !line.isNull());
-            }
-            /* EOF check */
-            if (line.contains("LOG END") ||
-                line.isNull()) {
-                break;
-            }
-            dhvis_callstack_listing_t *this_callstack;
-            this_callstack = callstacks.at(counter);
-            /* The callstacks begin counting at 1, however they are stored in
-             * an array which starts at index 0.
-             */
-            this_callstack->callstack_num = counter + 1;
-#ifdef QT_DEBUG
-            QRegExp reg_exp("^CALLSTACK\\s+(\\d+)",
-                            Qt::CaseInsensitive);
-            reg_exp.indexIn(line);
-            if (this_callstack->callstack_num != reg_exp.cap(1).toULongLong()) {
-                qCritical() << "CRITICAL: counter != callstack_num\n"
-                            << callstack_log.fileName()
-                            << "\nis not in the expected order.";
-            }
-#endif
-            /* Read in frame data */
-            while (!line.isNull()) {
-                line = in_log.readLine();
-                if (line.contains("<not in a module>"))
-                    continue;
-                if (line.contains("error end") ||
-                    line.isNull() ||
-                    line.contains("CALLSTACK")) {
-                    break;
-                }
-                /* Example:
-                 * '# num exe_name!func_name [path/to/file_name:line_num] (address)'
-                 */
-                if (line.contains(QRegExp("^#\\s*[0-9]+"))) {
-                    /* Get address */
-                    QString address = "";
-                    QRegExp reg_exp("0x(\\w+) <.+0x\\w+>");
-                    if (reg_exp.indexIn(line) < 0)
-                        qDebug() << "Malformed frame: " << line;
-                    else
-                        address = reg_exp.cap(1);
-
-                    bool ok;
-                    quint64 int_addr = address.toULongLong(&ok, 16);
-                    if (!ok) {
-                        qDebug() << "Malformed address: " << address;
-                        continue;
-                    }
-                    dhvis_frame_data_t *frame_data;
-                    frame_map_t::iterator itr = frames.find(int_addr);
-                    if (itr == frames.end()) {
-                        frame_data = extract_frame_data(line);
-                        frames[int_addr] = frame_data;
-                    }
-                    this_callstack->frame_data.append(frames[int_addr]);
-                } else
-                    qDebug() << "Malformed frame: " << line;
-            }
-            counter++;
-        } while (!line.isNull() &&
-                 !line.contains("LOG END"));
-        callstack_log.close();
-    }
-    qDebug() << "INFO: callstack.log read";
-}
+    qDebug().nospace() << "INFO: Entering " << __CLASS__ << __FUNCTION__;
+    /* The loader has sorted the snapshots by time */
+    loader->take_index(snapshots, callstacks, time_unit, snapshot_lod);
 
-/* Private
- * Processes snapshot.log
- */
-void
-dhvis_tool_t::read_snapshot_log(QFile &snapshot_log)
-{
-    /* Clear current snapshot data */
-    snapshots.clear();
-    if (snapshot_log.open(QFile::ReadOnly)) {
-        dhvis_snapshot_listing_t *peak_snapshot = NULL;
-        QTextStream in_log(&snapshot_log);
-        QString line = in_log.readLine();
-        /* We assume that the snapshots are listed in increasing order
-         * by their snapshot number.
-         */
-        quint64 counter = 0;
-        do /* Read file */ {
-            /* Skip past any extra info */
-            while (!line.contains("SNAPSHOT #") &&
-                   !line.contains("LOG END")) {
-                line = in_log.readLine();
-            }
-            /* Sanity check */
-            if (line.contains("LOG END"))
-                break;
-            dhvis_snapshot_listing_t *this_snapshot;
-            this_snapshot = new dhvis_snapshot_listing_t;
-            this_snapshot->snapshot_num = counter;
-            /* Get time and unit */
-            QRegExp reg_exp("^SNAPSHOT\\s#\\s+(\\d+)\\s@\\s+(\\d+)\\s(\\w+).+$",
-                            Qt::CaseInsensitive);
-            reg_exp.indexIn(line);
-            if (reg_exp.captureCount() != 3) {
-                qDebug() << "Malformed snapshot: " << line;
-                break;
-            }
-#ifdef QT_DEBUG
-            if (counter != reg_exp.cap(1).toULongLong()) {
-                qCritical() << "CRITICAL: counter != snapshot_num\n"
-                            << snapshot_log.fileName()
-                            << "\nis not in the expected order.";
-            }
-#endif
-            this_snapshot->num_time = reg_exp.cap(2).toULongLong();
-            time_unit = reg_exp.cap(3);
-            do /* Skip past any extra info */ {
-                line = in_log.readLine();
-            } while (!line.contains("total: "));
-            /* Get snapshot data
-             * Example: 'total: 40,1615,3399,3559'
-             */
-            reg_exp.setPattern("^total:\\s+(\\d+),(\\d+),(\\d+),(\\d+)$");
-            reg_exp.indexIn(line);
-            if (reg_exp.captureCount() != 4) {
-                qDebug() << "Malformed snapshot: " << line;
-                break;
-            }
-            this_snapshot->tot_mallocs = reg_exp.cap(1).toULongLong();
-            this_snapshot->tot_bytes_asked_for = reg_exp.cap(2).toULongLong();
-            this_snapshot->tot_bytes_usable = reg_exp.cap(3).toULongLong();
-            this_snapshot->tot_bytes_occupied = reg_exp.cap(4).toULongLong();
-            this_snapshot->is_peak = false;
-            if (peak_snapshot == NULL ||
-                this_snapshot->tot_bytes_occupied > peak_snapshot->tot_bytes_occupied)
-                peak_snapshot = this_snapshot;
-            /* Add new data to callstacks */
-            for (unsigned int i = 0; i < this_snapshot->tot_mallocs;) {
-                line = in_log.readLine();
-                /* tot_mallocs counts reallocs, while instances do not;
-                 * so we can't assume that they will sum properly.
-                 */
-                if (line.contains("SNAPSHOT #") ||
-                    line.contains("LOG END")) {
-                    break;
-                }
-                /* Example: '27,1,124,124,4' */
-                reg_exp.setPattern("^(\\d+),(\\d+),(\\d+),(\\d+),(\\d+)$");
-                reg_exp.indexIn(line);
-                if (reg_exp.captureCount() != 5) {
-                    qDebug() << "Malformed snapshot: " << line;
-                    break;
-                }
-                /* Get referenced callstack and subtract 1 since the
-                 * callstack # starts at 1 in the logfile; while the array
-                 * index starts at 0.
-                 */
-                quint64 callstack_index = reg_exp.cap(1).toULongLong() - 1;
-                dhvis_callstack_listing_t *this_callstack;
-                this_callstack = callstacks.at(callstack_index);
-                this_callstack->instances = reg_exp.cap(2).toULongLong();
-                this_callstack->bytes_asked_for = reg_exp.cap(3).toULongLong();
-                this_callstack->extra_usable = reg_exp.cap(4).toULongLong()
-                                             + this_callstack->bytes_asked_for;
-                this_callstack->extra_occupied = reg_exp.cap(5).toULongLong()
-                                               + this_callstack->extra_usable;
-                /* Ensure proper counting */
-                i += this_callstack->instances;
-                /* Callstacks listed high to low in log,
-                 * prepending reverses the order
-                 */
-                this_snapshot->assoc_callstacks.prepend(this_callstack);
-            }
-            snapshots.append(this_snapshot);
-            counter++;
-        } while (!line.isNull() &&
-                 !line.contains("LOG END"));
-        snapshot_log.close();
-        peak_snapshot->is_peak = true;
+    load_results_button->setEnabled(true);
+    qApp->restoreOverrideCursor();
+
+    if (snapshots.isEmpty()) {
+        qDebug() << "WARNING: No snapshots found in " << log_dir_loc;
+        return;
     }
-    qDebug() << "INFO: snapshot.log read";
+
+    /* Setup views and current_info */
+    draw_snapshot_graph();
 }
 
-/* Private
- * Processes snapshot.log
+/* Private Slot
+ * Adds the staleness data once it is read, which can be after the user has
+ * started looking at the snapshots.
  */
 void
-dhvis_tool_t::read_staleness_log(QFile &staleness_log)
+dhvis_tool_t::log_staleness_ready(void)
 {
-    if (staleness_log.open(QFile::ReadOnly)) {
-        QTextStream in_log(&staleness_log);
-        QString line = "";
-        quint64 counter = 0;
-        do /* Read file */ {
-            while (!line.isNull() &&
-                   !line.contains("SNAPSHOT #") &&
-                   !line.contains("LOG END")) {
-                line = in_log.readLine();
-            }
-            if (line.isNull())
-                break;
-            /* Read in data for callstacks */
-            do {
-                line = in_log.readLine();
-                if (line.contains("SNAPSHOT #") ||
-                    line.contains("LOG END"))
-                    break;
-                /* Example: 27,35,300 */
-                QRegExp reg_exp("^(\\d+),(\\d+),(\\d+)$");
-                reg_exp.indexIn(line);
-                if (reg_exp.captureCount() != 3) {
-                    qDebug() << "Malformed staleness: " << line;
-                    break;
-                }
-                /* Get referenced callstack and subtract 1 since the
-                 * callstack # starts at 1 in the logfile; while the array
-                 * index starts at 0.
-                 */
-                quint64 callstack_index = reg_exp.cap(1).toULongLong() - 1;
-                dhvis_callstack_listing_t *this_callstack;
-                this_callstack = callstacks.at(callstack_index);
-                /* Add to snapshot's vector */
-                if (!snapshots[counter]->stale_callstacks
-                                       .contains(this_callstack)) {
-                    snapshots[counter]->stale_callstacks
-                                      .append(this_callstack);
-                }
-                /* Map with snapshot_num as key */
-                quint64 num_bytes = reg_exp.cap(2).toULongLong();
-                quint64 last_access = reg_exp.cap(3).toULongLong();
-                stale_pair_t tmp_pair(num_bytes, last_access);
-                this_callstack->staleness_info[counter].append(tmp_pair);
-            }  while (!line.contains("SNAPSHOT #") &&
-                      !line.contains("LOG END"));
-
-            counter++;
-        } while (!line.isNull() &&
-                 !line.contains("LOG END"));
-
-        staleness_log.close();
+    qDebug().nospace() << "INFO: Entering " << __CLASS__ << __FUNCTION__;
+    if (snapshots.isEmpty())
+        return;
+    loader->apply_staleness(snapshots, callstacks);
+    sort_stale_data();
+    snapshot_graph->refresh_staleness();
+
+    /* Any staleness graph created so far was drawn without the data */
+    int old_tab_index = frames_tab_area->currentIndex();
+    if (staleness_graph != NULL)
+        frames_tab_area->removeTab(2);
+    QMap<quint64, dhvis_stale_graph_t *>::iterator stale_itr;
+    stale_itr = stale_graphs.begin();
+    while (stale_itr != stale_graphs.end()) {
+        delete *stale_itr;
+        stale_itr = stale_graphs.erase(stale_itr);
+    }
+    staleness_graph = NULL;
+    if (current_snapshot_index >= 0 &&
+        current_snapshot_index < snapshots.count()) {
+        draw_staleness_graph();
+        frames_tab_area->setCurrentIndex(old_tab_index);
     }
-    qDebug() << "INFO: staleness.log read";
 }
 
-/* Private
- * Sorts the log data properly
+/* Private Slot
+ * Cleans up after the loading thread is done
  */
 void
-dhvis_tool_t::sort_log_data(void)
+dhvis_tool_t::log_load_finished(void)
 {
-    /* Sort snapshots by time */
-    std::sort(snapshots.begin(),
-              snapshots.end(),
-              sort_snapshots);
-    /* Sort each callstack's staleness info (greatest first) */
-    foreach (dhvis_callstack_listing_t *c, callstacks) {
-        stale_map_t::iterator itr = c->staleness_info.begin();
-        while (itr != c->staleness_info.end()) {
-            std::sort(itr.value().begin(),
-                      itr.value().end(),
-                      stale_pair_sorter);
-            ++itr;
-        }
+    qDebug().nospace() << "INFO: Entering " << __CLASS__ << __FUNCTION__;
+    if (loader_thread == NULL)
+        return;
+    /* Restore the GUI if indexing was abandoned */
+    if (!load_results_button->isEnabled()) {
+        load_results_button->setEnabled(true);
+        qApp->restoreOverrideCursor();
     }
-    sort_stale_data();
+    loader_thread->wait();
+    delete loader_thread;
+    loader_thread = NULL;
 }
 
 /* Private
@@ -828,8 +669,8 @@ dhvis_tool_t::draw_snapshot_graph(void)
     /* Remove */
     left_side->removeWidget(snapshot_graph);
     /* Create (previous is deleted in read_log_data()) */
-    snapshot_graph = new dhvis_snapshot_graph_t(&snapshots, &time_unit,
-                                                options);
+    snapshot_graph = new dhvis_snapshot_graph_t(&snapshots, &snapshot_lod,
+                                                &time_unit, options);
     /* Format(QWidget*, row, col, row_span, col_span) */
     left_side->addWidget(snapshot_graph, 1, 0, 1, 2);
     connect(snapshot_graph, SIGNAL(highlight_changed(quint64, quint64)),
@@ -849,6 +690,8 @@ dhvis_tool_t::highlight_changed(quint64 snapshot, quint64 index)
         current_snapshot_num = snapshot;
         current_snapshot_index = index;
         callstacks_display_page = 0;
+        if (loader != NULL && index < (quint64)snapshots.count())
+            loader->load_snapshot(snapshots[index], callstacks, frames);
         fill_callstacks_table();
         load_frames_tree(frames_tab_area->currentIndex());
         draw_staleness_graph();
@@ -1157,57 +1000,6 @@ dhvis_tool_t::anchor_clicked(QUrl link)
     emit code_editor_requested(file_name, line_num);
 }
 
-/* Private
- * Extracts important info from a frame
- * XXX i#1332: This function will not be needed after this issue is resolved.
- */
-dhvis_frame_data_t *
-dhvis_tool_t::extract_frame_data(const QString &frame)
-{
-    /*              1     2     |----------------3----------------|     4
-     * Example: '# num exe_name!func_name [path/file_name:line_num] (address)'
-     */
-    QRegExp reg_exp("#\\s*(\\d+)\\s+(.+)\\!(.*(?!(?:\\s+\\[)|(?:\\s+\\()))"
-                    ".*\\((0x\\w+ <.+0x\\w+>)\\)");
-    reg_exp.indexIn(frame);
-    dhvis_frame_data_t *frame_data = new dhvis_frame_data_t;
-    /* Because callstacks share frames, but the frame is likely to be in a different
-     * position across callstacks, we do not save the position in the callstack. We
-     * use the order they are read to determine they're position.
-     */
-    frame_data->exec_name = reg_exp.cap(2);
-    int index = reg_exp.cap(3).lastIndexOf('[');
-    /* Cover case where func is 'operator new []' with no symbols after */
-    if (index == reg_exp.cap(3).lastIndexOf("[]"))
-        index++;
-    /* Trimming removes leading and trailing spaces */
-    frame_data->func_name = reg_exp.cap(3).left(index - 1).trimmed();
-    /* Frame may not be symbolized */
-    if (index > frame_data->func_name.size()) {
-        /* Remove the leading and trailing brackets and spaces */
-        QString full_path = reg_exp.cap(3).mid(index + 1);
-        full_path = full_path.left(full_path.lastIndexOf(']'));
-        /* We do not check the OS here because a user may load a data_set
-         * that was collected from a different computer.
-         */
-        int last_index = full_path.lastIndexOf('\\');
-        if (last_index == -1)
-            last_index = full_path.lastIndexOf('/');
-        /* +1 to include the / or \ in the path */
-        frame_data->file_path = full_path.left(last_index + 1);
-        frame_data->file_name = full_path.mid(last_index + 1);
-        index = frame_data->file_name.lastIndexOf(':');
-        frame_data->line_num = frame_data->file_name.mid(index + 1);
-        frame_data->file_name = frame_data->file_name.left(index);
-    } else {
-        frame_data->file_path = frame_data->file_name
-                              = frame_data->line_num = "?";
-    }
-    frame_data->address = reg_exp.cap(4);
-
-    return frame_data;
-}
-
 /* Private Slot
  * Used to restrict loading the frames_tree when it is requested in the
  * tab interface. This reduces lag while highlighting snapshots if the
@@ -1621,6 +1413,95 @@ dhvis_tool_t::exec_dr_heap(void)
     }
 }
 
+/* Private Slot
+ * Compares the loaded results against the baseline results by running
+ * dhvis_postprocess -diff, which is installed beside the viewer, and shows its
+ * callstack_diff.xml.  The post-processor matches callstacks by their
+ * symbols, so the baseline may come from a different build of the target.
+ */
+void
+dhvis_tool_t::compare_profiles(void)
+{
+    qDebug().nospace() << "INFO: Entering " << __CLASS__ << __FUNCTION__;
+    if (compare_base_text_changed)
+        compare_base_loc = compare_base_line_edit->text();
+    compare_base_text_changed = false;
+    if (log_dir_loc.isEmpty() || compare_base_loc.isEmpty()) {
+        QMessageBox::warning(this, tr("Unable to compare"),
+                             tr("Load results and choose the baseline results "
+                                "to compare them against."),
+                             QMessageBox::Ok);
+        return;
+    }
+    if (!dr_check_dir(QDir(compare_base_loc)))
+        return;
+
+    QProcess pp_process;
+    QStringList args;
+    args << "-profdir" << log_dir_loc << "-diff" << compare_base_loc;
+    qApp->setOverrideCursor(Qt::WaitCursor);
+    pp_process.start(QDir(QCoreApplication::applicationDirPath())
+                     .absoluteFilePath("dhvis_postprocess"), args);
+    bool ran = pp_process.waitForStarted() && pp_process.waitForFinished(-1);
+    qApp->restoreOverrideCursor();
+    dhrun_stdout_output_browser->clear();
+    dhrun_stdout_output_browser->insertPlainText(pp_process.readAllStandardOutput());
+    dhrun_stderr_output_browser->clear();
+    dhrun_stderr_output_browser->insertPlainText(pp_process.readAllStandardError());
+    /* An exit status of 2 only means the peak grew past -max_growth */
+    if (!ran || pp_process.exitStatus() != QProcess::NormalExit ||
+        pp_process.exitCode() == 1) {
+        QMessageBox::warning(this, tr("Unable to compare"),
+                             tr("dhvis_postprocess failed; see the Errors tab."),
+                             QMessageBox::Ok);
+        return;
+    }
+
+    QFile diff_file(QDir(log_dir_loc).absoluteFilePath("callstack_diff.xml"));
+    if (!diff_file.open(QFile::ReadOnly | QFile::Text)) {
+        qDebug() << "WARNING: Unable to open" << diff_file.fileName();
+        return;
+    }
+    compare_table->clear();
+    compare_table->setRowCount(0);
+    compare_table->setColumnCount(5);
+    QStringList table_headers;
+    table_headers << tr("Symbol") << tr("Peak change") << tr("Peak")
+                  << tr("Summed change") << tr("Baseline peak");
+    compare_table->setHorizontalHeaderLabels(table_headers);
+    compare_table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    compare_table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    compare_table->verticalHeader()->hide();
+    compare_table->horizontalHeader()
+                 ->setSectionResizeMode(QHeaderView::ResizeToContents);
+    compare_table->horizontalHeader()
+                 ->setSectionResizeMode(0, QHeaderView::Stretch);
+    /* Rows arrive sorted by the size of the change */
+    compare_table->setSortingEnabled(false);
+    QXmlStreamReader xml(&diff_file);
+    while (!xml.atEnd()) {
+        if (xml.readNext() != QXmlStreamReader::StartElement ||
+            xml.name() != "callstack")
+            continue;
+        QXmlStreamAttributes attrs = xml.attributes();
+        int row = compare_table->rowCount();
+        compare_table->insertRow(row);
+        compare_table->setItem(row, 0,
+                               new QTableWidgetItem(attrs.value("hdr").toString()));
+        const char *const columns[] = { "peakDelta", "curPeak", "totalDelta",
+                                        "basePeak" };
+        for (int i = 0; i < 4; i++) {
+            QTableWidgetItem *item = new QTableWidgetItem;
+            item->setData(Qt::DisplayRole,
+                          attrs.value(columns[i]).toString().toLongLong());
+            compare_table->setItem(row, i + 1, item);
+        }
+    }
+    if (xml.hasError())
+        qDebug() << "WARNING: Malformed" << diff_file.fileName();
+    dhrun_tab_widget->setCurrentWidget(compare_widget);
+}
+
 /* Private Slot
  * Chooses files for QLineEdit QPushButton pairs
  */
@@ -50,9 +50,11 @@ class QTreeWidget;
 class QTreeWidgetItem;
 class QGroupBox;
 class QStackedLayout;
+class QThread;
 
 class dhvis_snapshot_graph_t;
 class dhvis_stale_graph_t;
+class dhvis_log_loader_t;
 
 typedef QPair<QString /* path */ , QString /* file_name */ > frame_tree_pair_t;
 typedef QMap<frame_tree_pair_t,
@@ -97,10 +99,18 @@ private slots:
 
     void exec_dr_heap(void);
 
+    void compare_profiles(void);
+
     void choose_file(void);
 
     void slot_table_clicked(int column);
 
+    void log_index_ready(void);
+
+    void log_staleness_ready(void);
+
+    void log_load_finished(void);
+
 signals:
     void code_editor_requested(QFile &file, int line_num);
 
@@ -119,14 +129,6 @@ private:
 
     void read_log_data(void);
 
-    void read_callstack_log(QFile &callstack_log);
-
-    void read_snapshot_log(QFile &snapshot_log);
-
-    void read_staleness_log(QFile &staleness_log);
-
-    void sort_log_data(void);
-
     void sort_stale_data(void);
 
     void draw_snapshot_graph(void);
@@ -135,8 +137,6 @@ private:
 
     void load_frames_text_edit(int current_row);
 
-    dhvis_frame_data_t *extract_frame_data(const QString &frame);
-
     void load_frames_tree(void);
 
     void fill_frames_tree(frame_tree_map_t &frame_data_map);
@@ -181,6 +181,17 @@ private:
     QTextBrowser *dhrun_stdout_output_browser;
     QTextBrowser *dhrun_stderr_output_browser;
 
+    /* Compares the loaded profile against a baseline with dhvis_postprocess */
+    QWidget *compare_widget;
+    QGridLayout *compare_layout;
+    QLabel *compare_base_label;
+    QLineEdit *compare_base_line_edit;
+    QPushButton *compare_base_button;
+    bool compare_base_text_changed;
+    QString compare_base_loc;
+    QPushButton *compare_exec_push_button;
+    QTableWidget *compare_table;
+
     QGridLayout *right_side;
     QLabel *right_title;
 
@@ -224,9 +235,12 @@ private:
     dhvis_options_t *options;
 
     /* Data */
+    dhvis_log_loader_t *loader;
+    QThread *loader_thread;
     QVector<dhvis_callstack_listing_t *> visible_assoc_callstacks;
     QVector<dhvis_callstack_listing_t *> callstacks;
     QVector<dhvis_snapshot_listing_t *> snapshots;
+    dhvis_snapshot_lod_t snapshot_lod;
     QMap<int, QTreeWidget *> frame_trees;
     QMap<quint64, dhvis_stale_graph_t *> stale_graphs;
     frame_map_t frames;
@@ -38,6 +38,7 @@
  * see DROPTION_SCOPE_CLIENT options.
  */
 #include "drltrace.h"
+#include <algorithm>
 
 /* XXX i#1948: features to add:
  *
@@ -51,19 +52,106 @@
  *   Today we have simple type-blind printing via -num_unknown_args and
  *   usage of drsyscall to print symbolic arguments for known library calls.
  *
- * + Add 2 more modes, both gathering statistics rather than a full
- *   trace: one mode that counts total calls, and one that just
- *   records whether each library routine was ever called.  For these,
- *   we'll probably want to insert custom instrumentation rather than
- *   a clean call via drwrap, and so we'll want our own hashtable of
- *   the library entries.
+ * + Add a mode that just records whether each library routine was ever
+ *   called.  This could share -count_only's inline instrumentation.
  */
 
 /* Where to write the trace */
 static file_t outf;
 
+/* Each thread formats its output into its own buffer, which is written to outf
+ * in one piece once less than OUTBUF_FLUSH_SLACK bytes remain at the end of a
+ * library call's line.  This avoids a write and a lock per call and keeps each
+ * thread's lines whole among other threads'.
+ */
+#define OUTBUF_SIZE (64*1024)
+#define OUTBUF_FLUSH_SLACK (4*1024)
+
+typedef struct _per_thread_t {
+    char buf[OUTBUF_SIZE];
+    size_t sofar;
+    /* For -only_from_app: the bounds of the last library a skipped call came
+     * from, valid while from_lib_gen matches module_unload_gen.
+     */
+    app_pc from_lib_start;
+    app_pc from_lib_end;
+    uint from_lib_gen;
+} per_thread_t;
+
+static int tls_idx = -1;
+/* Serializes buffer writes to outf */
+static void *outf_lock;
+
 /* Avoid exe exports, as on Linux many apps have a ton of global symbols. */
 static app_pc exe_start;
+/* For -only_from_app, to check return addresses without a module lookup */
+static module_data_t *exe_data;
+/* Bumped on each module unload to invalidate per_thread_t.from_lib_* */
+static volatile uint module_unload_gen;
+
+/* For -count_only and sampling: one per traced library routine */
+typedef struct _call_count_t {
+    ptr_uint_t count; /* incremented inline for -count_only */
+    std::string name; /* "module!routine" */
+    std::string routine;
+} call_count_t;
+
+/* Maps routine entry pcs to call_count_t */
+#define COUNT_TABLE_HASH_BITS 12
+static hashtable_t count_table;
+/* Counts for routines of unloaded modules, kept for the final dump.
+ * Protected by count_table's lock.
+ */
+static std::vector<call_count_t *> *retired_counts;
+
+static call_count_t *
+count_add(const module_data_t *info, const char *name, app_pc func);
+
+static bool
+count_remove(app_pc func);
+
+/* Whether only some calls are traced: see -sample_every and -sample_window_ms */
+static bool sampling;
+/* Toggled by sample_window_thread() */
+static volatile bool sample_window_open;
+
+/****************************************************************************
+ * Buffered output
+ */
+
+static void
+flush_output(per_thread_t *pt)
+{
+    if (pt->sofar == 0)
+        return;
+    dr_mutex_lock(outf_lock);
+    dr_write_file(outf, pt->buf, pt->sofar);
+    dr_mutex_unlock(outf_lock);
+    pt->sofar = 0;
+}
+
+static void
+output(per_thread_t *pt, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+    while (true) {
+        va_start(ap, fmt);
+        len = dr_vsnprintf(pt->buf + pt->sofar, OUTBUF_SIZE - pt->sofar, fmt, ap);
+        va_end(ap);
+        if (len >= 0 && (size_t)len < OUTBUF_SIZE - pt->sofar) {
+            pt->sofar += len;
+            return;
+        }
+        if (pt->sofar == 0) {
+            /* Too long for the whole buffer: keep what fits */
+            pt->sofar = OUTBUF_SIZE - 1;
+            return;
+        }
+        /* This can split a line in the log, but only for a huge line */
+        flush_output(pt);
+    }
+}
 
 /****************************************************************************
  * Arguments printing
@@ -73,30 +161,30 @@ static app_pc exe_start;
  * It would be better to move them in drsyscall and import in drstrace and here.
  */
 static void
-print_simple_value(drsys_arg_t *arg, bool leading_zeroes)
+print_simple_value(per_thread_t *pt, drsys_arg_t *arg, bool leading_zeroes)
 {
     bool pointer = !TEST(DRSYS_PARAM_INLINED, arg->mode);
-    dr_fprintf(outf, pointer ? PFX : (leading_zeroes ? PFX : PIFX), arg->value);
+    output(pt, pointer ? PFX : (leading_zeroes ? PFX : PIFX), arg->value);
     if (pointer && ((arg->pre && TEST(DRSYS_PARAM_IN, arg->mode)) ||
                     (!arg->pre && TEST(DRSYS_PARAM_OUT, arg->mode)))) {
         ptr_uint_t deref = 0;
         ASSERT(arg->size <= sizeof(deref), "too-big simple type");
         /* We assume little-endian */
         if (dr_safe_read((void *)arg->value, arg->size, &deref, NULL))
-            dr_fprintf(outf, (leading_zeroes ? " => " PFX : " => " PIFX), deref);
+            output(pt, (leading_zeroes ? " => " PFX : " => " PIFX), deref);
     }
 }
 
 static void
-print_string(void *drcontext, void *pointer_str, bool is_wide)
+print_string(void *drcontext, per_thread_t *pt, void *pointer_str, bool is_wide)
 {
     if (pointer_str == NULL)
-        dr_fprintf(outf, "<null>");
+        output(pt, "<null>");
     else {
         DR_TRY_EXCEPT(drcontext, {
-            dr_fprintf(outf, is_wide ? "%S" : "%s", pointer_str);
+            output(pt, is_wide ? "%S" : "%s", pointer_str);
         }, {
-            dr_fprintf(outf, "<invalid memory>");
+            output(pt, "<invalid memory>");
         });
     }
 }
@@ -104,47 +192,48 @@ print_string(void *drcontext, void *pointer_str, bool is_wide)
 static void
 print_arg(void *drcontext, drsys_arg_t *arg)
 {
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
     if (arg->pre && (TEST(DRSYS_PARAM_OUT, arg->mode) && !TEST(DRSYS_PARAM_IN, arg->mode)))
         return;
-    dr_fprintf(outf, "\n    arg %d: ", arg->ordinal);
+    output(pt, "\n    arg %d: ", arg->ordinal);
     switch (arg->type) {
-    case DRSYS_TYPE_VOID:         print_simple_value(arg, true); break;
-    case DRSYS_TYPE_POINTER:      print_simple_value(arg, true); break;
-    case DRSYS_TYPE_BOOL:         print_simple_value(arg, false); break;
-    case DRSYS_TYPE_INT:          print_simple_value(arg, false); break;
-    case DRSYS_TYPE_SIGNED_INT:   print_simple_value(arg, false); break;
-    case DRSYS_TYPE_UNSIGNED_INT: print_simple_value(arg, false); break;
-    case DRSYS_TYPE_HANDLE:       print_simple_value(arg, false); break;
-    case DRSYS_TYPE_NTSTATUS:     print_simple_value(arg, false); break;
-    case DRSYS_TYPE_ATOM:         print_simple_value(arg, false); break;
+    case DRSYS_TYPE_VOID:         print_simple_value(pt, arg, true); break;
+    case DRSYS_TYPE_POINTER:      print_simple_value(pt, arg, true); break;
+    case DRSYS_TYPE_BOOL:         print_simple_value(pt, arg, false); break;
+    case DRSYS_TYPE_INT:          print_simple_value(pt, arg, false); break;
+    case DRSYS_TYPE_SIGNED_INT:   print_simple_value(pt, arg, false); break;
+    case DRSYS_TYPE_UNSIGNED_INT: print_simple_value(pt, arg, false); break;
+    case DRSYS_TYPE_HANDLE:       print_simple_value(pt, arg, false); break;
+    case DRSYS_TYPE_NTSTATUS:     print_simple_value(pt, arg, false); break;
+    case DRSYS_TYPE_ATOM:         print_simple_value(pt, arg, false); break;
 #ifdef WINDOWS
-    case DRSYS_TYPE_LCID:         print_simple_value(arg, false); break;
-    case DRSYS_TYPE_LPARAM:       print_simple_value(arg, false); break;
-    case DRSYS_TYPE_SIZE_T:       print_simple_value(arg, false); break;
-    case DRSYS_TYPE_HMODULE:      print_simple_value(arg, false); break;
+    case DRSYS_TYPE_LCID:         print_simple_value(pt, arg, false); break;
+    case DRSYS_TYPE_LPARAM:       print_simple_value(pt, arg, false); break;
+    case DRSYS_TYPE_SIZE_T:       print_simple_value(pt, arg, false); break;
+    case DRSYS_TYPE_HMODULE:      print_simple_value(pt, arg, false); break;
 #endif
     case DRSYS_TYPE_CSTRING:
-        print_string(drcontext, (void *)arg->value, false);
+        print_string(drcontext, pt, (void *)arg->value, false);
         break;
     case DRSYS_TYPE_CWSTRING:
-        print_string(drcontext, (void *)arg->value, true);
+        print_string(drcontext, pt, (void *)arg->value, true);
         break;
     default: {
         if (arg->value == 0)
-            dr_fprintf(outf, "<null>");
+            output(pt, "<null>");
         else
-            dr_fprintf(outf, PFX, arg->value);
+            output(pt, PFX, arg->value);
     }
     }
 
-    dr_fprintf(outf, " (%s%s%stype=%s%s, size=" PIFX ")",
-              (arg->arg_name == NULL) ? "" : "name=",
-              (arg->arg_name == NULL) ? "" : arg->arg_name,
-              (arg->arg_name == NULL) ? "" : ", ",
-              (arg->type_name == NULL) ? "\"\"" : arg->type_name,
-              (arg->type_name == NULL ||
-              TESTANY(DRSYS_PARAM_INLINED|DRSYS_PARAM_RETVAL, arg->mode)) ? "" : "*",
-              arg->size);
+    output(pt, " (%s%s%stype=%s%s, size=" PIFX ")",
+           (arg->arg_name == NULL) ? "" : "name=",
+           (arg->arg_name == NULL) ? "" : arg->arg_name,
+           (arg->arg_name == NULL) ? "" : ", ",
+           (arg->type_name == NULL) ? "\"\"" : arg->type_name,
+           (arg->type_name == NULL ||
+           TESTANY(DRSYS_PARAM_INLINED|DRSYS_PARAM_RETVAL, arg->mode)) ? "" : "*",
+           arg->size);
 }
 
 static bool
@@ -166,48 +255,52 @@ print_args_unknown_call(app_pc func, void *wrapcxt)
 {
     uint i;
     void *drcontext = drwrap_get_drcontext(wrapcxt);
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
     DR_TRY_EXCEPT(drcontext, {
         for (i = 0; i < op_unknown_args.get_value(); i++) {
-            dr_fprintf(outf, "\n    arg %d: " PFX, i,
-                       drwrap_get_arg(wrapcxt, i));
+            output(pt, "\n    arg %d: " PFX, i, drwrap_get_arg(wrapcxt, i));
         }
     }, {
-        dr_fprintf(outf, "<invalid memory>");
+        output(pt, "<invalid memory>");
         /* Just keep going */
     });
     /* all args have been sucessfully printed */
-    dr_fprintf(outf, op_print_ret_addr.get_value() ? "\n   ": "");
+    output(pt, op_print_ret_addr.get_value() ? "\n   ": "");
 }
 
 static bool
-print_libcall_args(std::vector<drsys_arg_t*> *args_vec, void *wrapcxt)
+print_libcall_args(const libcall_sig_t *sig, void *wrapcxt)
 {
-    if (args_vec == NULL || args_vec->size() <= 0)
+    drsys_arg_t arg;
+    uint i, num_args;
+    if (sig == NULL)
         return false;
-
-    std::vector<drsys_arg_t*>::iterator it;
-    for (it = args_vec->begin(); it != args_vec->end(); ++it) {
-        if (!drlib_iter_arg_cb(*it, wrapcxt))
+    num_args = libcall_num_args(sig);
+    if (num_args == 0)
+        return false;
+    for (i = 0; i < num_args; i++) {
+        libcall_get_arg(sig, i, &arg);
+        if (!drlib_iter_arg_cb(&arg, wrapcxt))
             break;
     }
     return true;
 }
 
 static void
-print_symbolic_args(const char *name, void *wrapcxt, app_pc func)
+print_symbolic_args(per_thread_t *pt, const char *name, void *wrapcxt, app_pc func)
 {
     drmf_status_t res;
     drsys_syscall_t *syscall;
-    std::vector<drsys_arg_t *> *args_vec;
+    const libcall_sig_t *sig;
 
     if (op_max_args.get_value() == 0)
         return;
 
     if (op_use_config.get_value()) {
-        /* looking for libcall in libcalls hashtable */
-        args_vec = libcalls_search(name);
-        if (print_libcall_args(args_vec, wrapcxt)) {
-            dr_fprintf(outf, op_print_ret_addr.get_value() ? "\n   ": "");
+        /* looking for libcall in the config's signatures */
+        sig = libcalls_search(name);
+        if (print_libcall_args(sig, wrapcxt)) {
+            output(pt, op_print_ret_addr.get_value() ? "\n   ": "");
             return; /* we found libcall and sucessfully printed all arguments */
         }
     }
@@ -218,7 +311,7 @@ print_symbolic_args(const char *name, void *wrapcxt, app_pc func)
         if (res != DRMF_SUCCESS && res != DRMF_ERROR_DETAILS_UNKNOWN)
             ASSERT(false, "drsys_iterate_arg_types failed in print_symbolic_args");
         /* all args have been sucessfully printed */
-        dr_fprintf(outf, op_print_ret_addr.get_value() ? "\n   ": "");
+        output(pt, op_print_ret_addr.get_value() ? "\n   ": "");
         return;
     } else {
         /* use standard type-blind scheme */
@@ -234,7 +327,7 @@ print_symbolic_args(const char *name, void *wrapcxt, app_pc func)
 static void
 lib_entry(void *wrapcxt, INOUT void **user_data)
 {
-    const char *name = (const char *) *user_data;
+    const char *name;
     const char *modname = NULL;
     app_pc func = drwrap_get_func(wrapcxt);
     module_data_t *mod;
@@ -244,9 +337,24 @@ lib_entry(void *wrapcxt, INOUT void **user_data)
     drcovlib_status_t res;
 
     void *drcontext = drwrap_get_drcontext(wrapcxt);
+    per_thread_t *pt;
+
+    if (sampling) {
+        /* Every call is counted, whether or not it is traced */
+        call_count_t *cc = (call_count_t *) *user_data;
+        ptr_uint_t n = (ptr_uint_t)
+            IF_X64_ELSE(dr_atomic_add64_return_sum((volatile int64 *)&cc->count, 1),
+                        dr_atomic_add32_return_sum((volatile int *)&cc->count, 1));
+        if (!sample_window_open &&
+            (op_sample_every.get_value() <= 1 ||
+             (n - 1) % op_sample_every.get_value() != 0))
+            return;
+        name = cc->routine.c_str();
+    } else
+        name = (const char *) *user_data;
 
+    pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
     if (op_only_from_app.get_value()) {
-        /* For just this option, the modxfer approach might be better */
         app_pc retaddr =  NULL;
         DR_TRY_EXCEPT(drcontext, {
             retaddr = drwrap_get_retaddr(wrapcxt);
@@ -254,12 +362,29 @@ lib_entry(void *wrapcxt, INOUT void **user_data)
             retaddr = NULL;
         });
         if (retaddr != NULL) {
-            mod = dr_lookup_module(retaddr);
-            if (mod != NULL) {
-                bool from_exe = (mod->start == exe_start);
-                dr_free_module_data(mod);
-                if (!from_exe)
-                    return;
+            /* Most calls we skip are library-internal, and a library tends to
+             * call from the same module repeatedly, so we remember the last
+             * one rather than looking up (and allocating) a module each time.
+             */
+            if (exe_data != NULL && dr_module_contains_addr(exe_data, retaddr)) {
+                /* from the app */
+            } else if (retaddr >= pt->from_lib_start && retaddr < pt->from_lib_end &&
+                       pt->from_lib_gen == module_unload_gen) {
+                return;
+            } else {
+                uint gen = module_unload_gen;
+                mod = dr_lookup_module(retaddr);
+                if (mod != NULL) {
+                    bool from_exe = (mod->start == exe_start);
+                    if (!from_exe) {
+                        pt->from_lib_start = mod->start;
+                        pt->from_lib_end = mod->end;
+                        pt->from_lib_gen = gen;
+                    }
+                    dr_free_module_data(mod);
+                    if (!from_exe)
+                        return;
+                }
             }
         } else {
             /* Nearly all of these cases should be things like KiUserCallbackDispatcher
@@ -279,11 +404,11 @@ lib_entry(void *wrapcxt, INOUT void **user_data)
 
     tid = dr_get_thread_id(drcontext);
     if (tid != INVALID_THREAD_ID)
-        dr_fprintf(outf, "~~%d~~ ", tid);
+        output(pt, "~~%d~~ ", tid);
     else
-        dr_fprintf(outf, "~~Dr.L~~ ");
-    dr_fprintf(outf, "%s%s%s", modname == NULL ? "" : modname,
-               modname == NULL ? "" : "!", name);
+        output(pt, "~~Dr.L~~ ");
+    output(pt, "%s%s%s", modname == NULL ? "" : modname,
+           modname == NULL ? "" : "!", name);
 
     /* XXX: We employ three schemes of arguments printing. drsyscall is used
      * to get a symbolic representation of arguments for known library calls.
@@ -291,19 +416,22 @@ lib_entry(void *wrapcxt, INOUT void **user_data)
      * specified by user. If there is no info in both sources we employ type-blind
      * printing and use -num_unknown_args to get a count of arguments to print.
      */
-    print_symbolic_args(name, wrapcxt, func);
+    print_symbolic_args(pt, name, wrapcxt, func);
 
     if (op_print_ret_addr.get_value()) {
         ret_addr = drwrap_get_retaddr(wrapcxt);
         res = drmodtrack_lookup(drcontext, ret_addr, &mod_id, &mod_start);
         if (res == DRCOVLIB_SUCCESS) {
-            dr_fprintf(outf,
-                       op_print_ret_addr.get_value() ?
-                       " and return to module id:%d, offset:" PIFX : "",
-                       mod_id, ret_addr - mod_start);
+            output(pt,
+                   op_print_ret_addr.get_value() ?
+                   " and return to module id:%d, offset:" PIFX : "",
+                   mod_id, ret_addr - mod_start);
         }
     }
-    dr_fprintf(outf, "\n");
+    output(pt, "\n");
+    /* Interactive output to stderr is not held back */
+    if (outf == STDERR || pt->sofar > OUTBUF_SIZE - OUTBUF_FLUSH_SLACK)
+        flush_output(pt);
     if (mod != NULL)
         dr_free_module_data(mod);
 }
@@ -334,7 +462,26 @@ iterate_exports(const module_data_t *info, bool add)
 #endif
         if (op_ignore_underscore.get_value() && strstr(sym->name, "_") == sym->name)
             func = NULL;
-        if (func != NULL) {
+        if (func != NULL && op_count_only.get_value()) {
+            if (add)
+                count_add(info, sym->name, func);
+            else
+                count_remove(func);
+        } else if (func != NULL && sampling) {
+            if (add) {
+                call_count_t *cc = count_add(info, sym->name, func);
+                if (cc != NULL) {
+                    IF_DEBUG(bool ok =)
+                        drwrap_wrap_ex(func, lib_entry, NULL, (void *) cc, 0);
+                    ASSERT(ok, "wrap request failed");
+                }
+            } else if (count_remove(func)) {
+                /* Only the first alias at func was wrapped: see count_add() */
+                IF_DEBUG(bool ok =)
+                    drwrap_unwrap(func, lib_entry, NULL);
+                ASSERT(ok, "unwrap request failed");
+            }
+        } else if (func != NULL) {
             if (add) {
                 IF_DEBUG(bool ok =)
                     drwrap_wrap_ex(func, lib_entry, NULL, (void *) sym->name, 0);
@@ -377,10 +524,177 @@ event_module_load(void *drcontext, const module_data_t *info, bool loaded)
 static void
 event_module_unload(void *drcontext, const module_data_t *info)
 {
+    if (op_only_from_app.get_value())
+        dr_atomic_add32_return_sum((volatile int *)&module_unload_gen, 1);
     if (info->start != exe_start && library_matches_filter(info))
         iterate_exports(info, false/*remove*/);
 }
 
+/****************************************************************************
+ * Call counting for -count_only and sampling
+ */
+
+/* Returns NULL if func already has an entry */
+static call_count_t *
+count_add(const module_data_t *info, const char *name, app_pc func)
+{
+    const char *modname = dr_module_preferred_name(info);
+    call_count_t *cc = new call_count_t;
+    cc->count = 0;
+    if (modname != NULL) {
+        cc->name = modname;
+        cc->name += "!";
+    }
+    cc->name += name;
+    cc->routine = name;
+    /* Routines exported under several names are counted under the first */
+    if (!hashtable_add(&count_table, (void *)func, (void *)cc)) {
+        delete cc;
+        return NULL;
+    }
+    return cc;
+}
+
+/* Returns whether func had an entry */
+static bool
+count_remove(app_pc func)
+{
+    call_count_t *cc;
+    hashtable_lock(&count_table);
+    cc = (call_count_t *) hashtable_lookup(&count_table, (void *)func);
+    if (cc != NULL) {
+        retired_counts->push_back(cc);
+        hashtable_remove(&count_table, (void *)func);
+    }
+    hashtable_unlock(&count_table);
+    return cc != NULL;
+}
+
+static dr_emit_flags_t
+event_app_instruction(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
+                      bool for_trace, bool translating, void *user_data)
+{
+    call_count_t *cc;
+    app_pc pc;
+    if (!instr_is_app(instr))
+        return DR_EMIT_DEFAULT;
+    pc = instr_get_app_pc(instr);
+    if (pc == NULL)
+        return DR_EMIT_DEFAULT;
+    /* We check every instruction, not just the first, as a block can run into
+     * a routine entry without a branch.
+     */
+    cc = (call_count_t *) hashtable_lookup(&count_table, (void *)pc);
+    if (cc != NULL) {
+        /* The increment is atomic only on x86, so elsewhere racing threads can
+         * lose counts.
+         */
+        drx_insert_counter_update(drcontext, bb, instr, SPILL_SLOT_1,
+                                  IF_NOT_X86_(SPILL_SLOT_2) &cc->count, 1,
+                                  IF_X86(DRX_COUNTER_LOCK |)
+                                  IF_X64_ELSE(DRX_COUNTER_64BIT, 0));
+    }
+    return DR_EMIT_DEFAULT;
+}
+
+static bool
+count_greater(const call_count_t *a, const call_count_t *b)
+{
+    if (a->count != b->count)
+        return a->count > b->count;
+    return a->name < b->name;
+}
+
+static void
+dump_call_counts(void)
+{
+    std::vector<call_count_t *> all;
+    std::vector<call_count_t *>::iterator it;
+    uint i;
+    hashtable_lock(&count_table);
+    for (i = 0; i < HASHTABLE_SIZE(count_table.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = count_table.table[i]; he != NULL; he = he->next) {
+            call_count_t *cc = (call_count_t *) he->payload;
+            if (cc->count > 0)
+                all.push_back(cc);
+        }
+    }
+    for (it = retired_counts->begin(); it != retired_counts->end(); ++it) {
+        if ((*it)->count > 0)
+            all.push_back(*it);
+    }
+    /* Counts keep changing as we sort, which is fine for a snapshot */
+    std::sort(all.begin(), all.end(), count_greater);
+    dr_mutex_lock(outf_lock);
+    dr_fprintf(outf, "~~Dr.L~~ Library call counts:\n");
+    for (it = all.begin(); it != all.end(); ++it) {
+        dr_fprintf(outf, "~~Dr.L~~ %12" UINT64_FORMAT_CODE " %s\n",
+                   (uint64)(*it)->count, (*it)->name.c_str());
+    }
+    dr_mutex_unlock(outf_lock);
+    hashtable_unlock(&count_table);
+}
+
+static void
+event_nudge(void *drcontext, uint64 argument)
+{
+    dump_call_counts();
+}
+
+static void
+free_call_count(void *cc)
+{
+    delete (call_count_t *) cc;
+}
+
+static void
+sample_window_thread(void *arg)
+{
+    uint window = op_sample_window_ms.get_value();
+    uint period = op_sample_period_ms.get_value();
+    /* We start with a window open, to see initialization */
+    while (true) {
+        sample_window_open = true;
+        dr_sleep(window);
+        sample_window_open = false;
+        dr_sleep(period - window);
+    }
+}
+
+static void
+count_init(client_id_t id)
+{
+    hashtable_init_ex(&count_table, COUNT_TABLE_HASH_BITS, HASH_INTPTR,
+                      false/*!str_dup*/, true/*synch*/, NULL, NULL, NULL);
+    retired_counts = new std::vector<call_count_t *>;
+    if (op_count_only.get_value())
+        drmgr_register_bb_instrumentation_event(NULL, event_app_instruction, NULL);
+    else if (op_sample_window_ms.get_value() > 0) {
+        /* drheapstat uses an itimer but that is not available on Windows */
+        if (!dr_create_client_thread(sample_window_thread, NULL))
+            ASSERT(false, "failed to create sampling thread");
+    }
+    dr_register_nudge_event(event_nudge, id);
+}
+
+static void
+count_exit(void)
+{
+    std::vector<call_count_t *>::iterator it;
+    uint i;
+    dump_call_counts();
+    for (i = 0; i < HASHTABLE_SIZE(count_table.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = count_table.table[i]; he != NULL; he = he->next)
+            free_call_count(he->payload);
+    }
+    hashtable_delete(&count_table);
+    for (it = retired_counts->begin(); it != retired_counts->end(); ++it)
+        free_call_count(*it);
+    delete retired_counts;
+}
+
 /****************************************************************************
  * Init and exit
  */
@@ -406,10 +720,32 @@ open_log_file(void)
     }
 }
 
+static void
+event_thread_init(void *drcontext)
+{
+    per_thread_t *pt = (per_thread_t *) dr_thread_alloc(drcontext, sizeof(*pt));
+    pt->sofar = 0;
+    pt->from_lib_start = NULL;
+    pt->from_lib_end = NULL;
+    pt->from_lib_gen = 0;
+    drmgr_set_tls_field(drcontext, tls_idx, (void *) pt);
+}
+
+static void
+event_thread_exit(void *drcontext)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    flush_output(pt);
+    dr_thread_free(drcontext, pt, sizeof(*pt));
+}
+
 #ifndef WINDOWS
 static void
 event_fork(void *drcontext)
 {
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    /* The parent writes out what was buffered before the fork */
+    pt->sofar = 0;
     /* The old file was closed by DR b/c we passed DR_FILE_CLOSE_ON_FORK */
     open_log_file();
 }
@@ -418,17 +754,23 @@ event_fork(void *drcontext)
 static void
 event_exit(void)
 {
+    if (op_count_only.get_value() || sampling)
+        count_exit();
     if (op_max_args.get_value() > 0)
         drsys_exit();
 
     if (op_use_config.get_value())
-        libcalls_hashtable_delete();
+        libcalls_exit();
 
     if (outf != STDERR) {
         if (op_print_ret_addr.get_value())
             drmodtrack_dump(outf);
         dr_close_file(outf);
     }
+    if (exe_data != NULL)
+        dr_free_module_data(exe_data);
+    drmgr_unregister_tls_field(tls_idx);
+    dr_mutex_destroy(outf_lock);
     drx_exit();
     drwrap_exit();
     drmgr_exit();
@@ -469,7 +811,10 @@ dr_client_main(client_id_t id, int argc, const char *argv[])
     exe = dr_get_main_module();
     if (exe != NULL)
         exe_start = exe->start;
-    dr_free_module_data(exe);
+    if (op_only_from_app.get_value())
+        exe_data = exe;
+    else
+        dr_free_module_data(exe);
 
     /* No-frills is safe b/c we're the only module doing wrapping, and
      * we're only wrapping at module load and unwrapping at unload.
@@ -479,6 +824,24 @@ dr_client_main(client_id_t id, int argc, const char *argv[])
     drwrap_set_global_flags((drwrap_global_flags_t)
                             (DRWRAP_NO_FRILLS | DRWRAP_FAST_CLEANCALLS));
 
+    outf_lock = dr_mutex_create();
+    tls_idx = drmgr_register_tls_field();
+    ASSERT(tls_idx > -1, "failed to reserve TLS slot");
+    drmgr_register_thread_init_event(event_thread_init);
+    drmgr_register_thread_exit_event(event_thread_exit);
+    /* Have the exit events of threads still running at exit flush their output */
+    dr_request_synchronized_exit();
+
+    sampling = !op_count_only.get_value() &&
+        (op_sample_every.get_value() > 1 || op_sample_window_ms.get_value() > 0);
+    if (op_sample_window_ms.get_value() >= op_sample_period_ms.get_value() &&
+        op_sample_window_ms.get_value() > 0) {
+        NOTIFY_ERROR("-sample_window_ms must be smaller than -sample_period_ms" NL);
+        dr_abort();
+    }
+    if (op_count_only.get_value() || sampling)
+        count_init(id);
+
     dr_register_exit_event(event_exit);
 #ifdef UNIX
     dr_register_fork_init_event(event_fork);
@@ -52,5 +52,11 @@
 #define OPTION_MAX_LENGTH MAXIMUM_PATH
 
 void parse_config(void);
-std::vector<drsys_arg_t *> *libcalls_search(const char *name);
-void libcalls_hashtable_delete();
+/* A library call's signature from the config file */
+typedef struct _sigdb_func_t libcall_sig_t;
+
+/* Returns NULL if name is not in the config file */
+const libcall_sig_t *libcalls_search(const char *name);
+uint libcall_num_args(const libcall_sig_t *sig);
+void libcall_get_arg(const libcall_sig_t *sig, uint index, drsys_arg_t *arg OUT);
+void libcalls_exit();
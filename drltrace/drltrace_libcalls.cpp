@@ -32,50 +32,367 @@
 
 #include "drltrace.h"
 #include <algorithm>
+#include <map>
+#include <ctype.h>
+
 /****************************************************************************
- * Routines to support libcalls hashtable
+ * Signature database
+ *
+ * Parsing the text config file (thousands of lines of std::string splitting)
+ * at every process start is slow, so the first process to parse a config file
+ * writes a compact binary database of its signatures alongside it, named with
+ * SIGDB_SUFFIX.  Later processes map it and look routines up in place.  The
+ * database is tied to its config file by size and a hash of the whole file
+ * and is rebuilt when those differ.
+ *
+ * The database is a sigdb_header_t, then num_buckets+1 uints giving each hash
+ * bucket's first sigdb_func_t index, then the sigdb_func_t array ordered by
+ * bucket, then the sigdb_arg_t array, then a pool of null-terminated strings.
  */
 
-#define LIBCALLS_TABLE_HASH_BITS 6
-/* We init the following hashtable to be able to get library call arguments when
- * it is required for printing.
+#define SIGDB_SUFFIX ".bin"
+#define SIGDB_MAGIC "DrLtSig"
+/* Must be bumped whenever the structures below, config_parse_type(), or
+ * config_hash() change
  */
-static hashtable_t libcalls_table;
+#define SIGDB_VERSION 2
+#define SIGDB_MAX_TMP_TRIES 8
+
+typedef struct _sigdb_header_t {
+    char magic[8];
+    uint version;
+    uint header_size;
+    uint file_size;
+    uint pointer_size; /* type sizes depend on the bitwidth */
+    uint64 config_size;
+    uint config_hash;
+    uint num_buckets; /* a power of 2 */
+    uint num_funcs;
+    uint num_args;
+    uint strings_size;
+    uint reserved;
+} sigdb_header_t;
+
+struct _sigdb_func_t {
+    uint name; /* offset into the string pool */
+    uint hash;
+    uint first_arg;
+    uint num_args;
+};
+
+typedef struct _sigdb_arg_t {
+    int ordinal;
+    uint mode;
+    uint type;
+    uint size;
+    uint type_name; /* offset into the string pool */
+} sigdb_arg_t;
+
+/* The database in use, either mapped or built in memory */
+static byte *sigdb;
+static size_t sigdb_size;
+static bool sigdb_mapped;
+static const sigdb_header_t *sigdb_hdr;
+static const uint *sigdb_buckets;
+static const libcall_sig_t *sigdb_funcs;
+static const sigdb_arg_t *sigdb_args;
+static const char *sigdb_strings;
+
+static uint
+config_hash(const char *text, size_t size)
+{
+    /* FNV-1a over the whole file, so an edit anywhere rebuilds the database */
+    uint hash = 2166136261U;
+    size_t i;
+    for (i = 0; i < size; i++)
+        hash = (hash ^ (byte)text[i]) * 16777619U;
+    return hash;
+}
 
-static void
-free_args_list(void *p)
+/* Routine names are matched case-insensitively */
+static uint
+name_hash(const char *name)
 {
-    std::vector<drsys_arg_t *> *args_list = (std::vector<drsys_arg_t *> *) p;
-    std::vector<drsys_arg_t *>::iterator it;
-    for (it = args_list->begin(); it != args_list->end(); ++it)
-        global_free(*it, sizeof(drsys_arg_t), HEAPSTAT_MISC);
+    uint hash = 2166136261U;
+    for (; *name != '\0'; name++)
+        hash = (hash ^ (byte)tolower(*name)) * 16777619U;
+    return hash;
+}
 
-    delete args_list;
+static bool
+name_equal(const char *a, const char *b)
+{
+    for (; *a != '\0' && *b != '\0'; a++, b++) {
+        if (tolower(*a) != tolower(*b))
+            return false;
+    }
+    return *a == *b;
 }
 
+/* Sets the sigdb_* pointers if db holds a valid database matching the config */
+static bool
+sigdb_use(byte *db, size_t size, uint64 config_size, uint hash)
+{
+    const sigdb_header_t *hdr = (const sigdb_header_t *) db;
+    const uint *buckets;
+    const libcall_sig_t *funcs;
+    const sigdb_arg_t *args;
+    const char *strings;
+    uint i;
+    if (size < sizeof(*hdr) ||
+        strncmp(hdr->magic, SIGDB_MAGIC, BUFFER_SIZE_ELEMENTS(hdr->magic)) != 0 ||
+        hdr->version != SIGDB_VERSION || hdr->header_size != sizeof(*hdr) ||
+        hdr->file_size != size || hdr->pointer_size != sizeof(void *) ||
+        hdr->config_size != config_size || hdr->config_hash != hash ||
+        hdr->num_buckets == 0 || !IS_POWER_OF_2(hdr->num_buckets) ||
+        (uint64)sizeof(*hdr) + ((uint64)hdr->num_buckets + 1) * sizeof(uint) +
+        (uint64)hdr->num_funcs * sizeof(libcall_sig_t) +
+        (uint64)hdr->num_args * sizeof(sigdb_arg_t) + hdr->strings_size != size ||
+        hdr->strings_size == 0)
+        return false;
+    buckets = (const uint *) (hdr + 1);
+    funcs = (const libcall_sig_t *) (buckets + hdr->num_buckets + 1);
+    args = (const sigdb_arg_t *) (funcs + hdr->num_funcs);
+    strings = (const char *) (args + hdr->num_args);
+    if (strings[hdr->strings_size - 1] != '\0' ||
+        buckets[hdr->num_buckets] != hdr->num_funcs)
+        return false;
+    /* Validate once so lookups need no checks */
+    for (i = 0; i < hdr->num_buckets; i++) {
+        if (buckets[i] > buckets[i + 1])
+            return false;
+    }
+    for (i = 0; i < hdr->num_funcs; i++) {
+        if (funcs[i].name >= hdr->strings_size ||
+            (uint64)funcs[i].first_arg + funcs[i].num_args > hdr->num_args)
+            return false;
+    }
+    for (i = 0; i < hdr->num_args; i++) {
+        if (args[i].type_name >= hdr->strings_size)
+            return false;
+    }
+    sigdb = db;
+    sigdb_size = size;
+    sigdb_hdr = hdr;
+    sigdb_buckets = buckets;
+    sigdb_funcs = funcs;
+    sigdb_args = args;
+    sigdb_strings = strings;
+    return true;
+}
+
+static bool
+sigdb_load(const char *path, uint64 config_size, uint hash)
+{
+    file_t f = dr_open_file(path, DR_FILE_READ);
+    uint64 file_size;
+    size_t map_size = 0;
+    byte *map = NULL;
+    if (f == INVALID_FILE)
+        return false;
+    if (dr_file_size(f, &file_size) && file_size >= sizeof(sigdb_header_t)) {
+        map_size = (size_t)file_size;
+        map = (byte *) dr_map_file(f, &map_size, 0, NULL, DR_MEMPROT_READ, 0);
+    }
+    dr_close_file(f);
+    if (map == NULL)
+        return false;
+    if (map_size < file_size || !sigdb_use(map, (size_t)file_size, config_size, hash)) {
+        VNOTIFY(2, "signature database %s is stale or invalid" NL, path);
+        dr_unmap_file(map, map_size);
+        return false;
+    }
+    /* Unmap what the map rounded up to, too */
+    sigdb_size = map_size;
+    sigdb_mapped = true;
+    VNOTIFY(2, "using signature database %s" NL, path);
+    return true;
+}
+
+typedef std::vector<std::pair<std::string, std::vector<drsys_arg_t *> *> > libcall_list_t;
+
+static uint
+sigdb_add_string(std::string *pool, std::map<std::string, uint> *offs,
+                 const std::string &str)
+{
+    std::map<std::string, uint>::iterator it = offs->find(str);
+    uint res;
+    if (it != offs->end())
+        return it->second;
+    res = (uint)pool->size();
+    pool->append(str);
+    pool->push_back('\0');
+    (*offs)[str] = res;
+    return res;
+}
+
+/* Builds a database from the parsed config into a global_alloc-ed buffer */
+static byte *
+sigdb_build(libcall_list_t *libcalls, uint64 config_size, uint hash, size_t *size OUT)
+{
+    std::vector<libcall_sig_t> funcs;
+    std::vector<sigdb_arg_t> args;
+    std::vector<uint> buckets;
+    std::string pool;
+    std::map<std::string, uint> offs;
+    std::vector<std::vector<libcall_sig_t> > by_bucket;
+    libcall_list_t::iterator it;
+    sigdb_header_t hdr;
+    byte *db, *pc;
+    uint num_buckets = 1, i, j;
+
+    while (num_buckets < libcalls->size())
+        num_buckets *= 2;
+    by_bucket.resize(num_buckets);
+    for (it = libcalls->begin(); it != libcalls->end(); ++it) {
+        libcall_sig_t func;
+        std::vector<drsys_arg_t *>::iterator arg_it;
+        std::vector<libcall_sig_t> *bucket;
+        bool dup = false;
+        func.hash = name_hash(it->first.c_str());
+        bucket = &by_bucket[func.hash & (num_buckets - 1)];
+        for (j = 0; j < bucket->size(); j++) {
+            if ((*bucket)[j].hash == func.hash &&
+                name_equal(pool.c_str() + (*bucket)[j].name, it->first.c_str()))
+                dup = true;
+        }
+        if (dup) {
+            /* The first entry wins, as with the hashtable this replaced */
+            VNOTIFY(1, "duplicate config entry for %s is ignored" NL, it->first.c_str());
+            continue;
+        }
+        func.name = sigdb_add_string(&pool, &offs, it->first);
+        func.first_arg = (uint)args.size();
+        func.num_args = (uint)it->second->size();
+        for (arg_it = it->second->begin(); arg_it != it->second->end(); ++arg_it) {
+            sigdb_arg_t arg;
+            arg.ordinal = (*arg_it)->ordinal;
+            arg.mode = (*arg_it)->mode;
+            arg.type = (*arg_it)->type;
+            arg.size = (uint)(*arg_it)->size;
+            arg.type_name = sigdb_add_string(&pool, &offs, (*arg_it)->type_name);
+            args.push_back(arg);
+        }
+        bucket->push_back(func);
+    }
+    for (i = 0; i < num_buckets; i++) {
+        buckets.push_back((uint)funcs.size());
+        funcs.insert(funcs.end(), by_bucket[i].begin(), by_bucket[i].end());
+    }
+    buckets.push_back((uint)funcs.size());
+    if (pool.empty())
+        pool.push_back('\0');
+
+    memset(&hdr, 0, sizeof(hdr));
+    strncpy(hdr.magic, SIGDB_MAGIC, BUFFER_SIZE_ELEMENTS(hdr.magic));
+    hdr.version = SIGDB_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.pointer_size = sizeof(void *);
+    hdr.config_size = config_size;
+    hdr.config_hash = hash;
+    hdr.num_buckets = num_buckets;
+    hdr.num_funcs = (uint)funcs.size();
+    hdr.num_args = (uint)args.size();
+    hdr.strings_size = (uint)pool.size();
+    *size = sizeof(hdr) + buckets.size() * sizeof(uint) +
+        funcs.size() * sizeof(libcall_sig_t) + args.size() * sizeof(sigdb_arg_t) +
+        pool.size();
+    hdr.file_size = (uint)*size;
+
+    db = (byte *) global_alloc(*size, HEAPSTAT_MISC);
+    pc = db;
+    memcpy(pc, &hdr, sizeof(hdr));
+    pc += sizeof(hdr);
+    memcpy(pc, &buckets[0], buckets.size() * sizeof(uint));
+    pc += buckets.size() * sizeof(uint);
+    if (!funcs.empty()) {
+        memcpy(pc, &funcs[0], funcs.size() * sizeof(libcall_sig_t));
+        pc += funcs.size() * sizeof(libcall_sig_t);
+    }
+    if (!args.empty()) {
+        memcpy(pc, &args[0], args.size() * sizeof(sigdb_arg_t));
+        pc += args.size() * sizeof(sigdb_arg_t);
+    }
+    memcpy(pc, pool.data(), pool.size());
+    return db;
+}
+
+/* Failure is not an error: e.g., the config may be in a read-only install dir */
 static void
-init_libcalls_hashtable()
+sigdb_write(const char *path, const byte *db, size_t size)
 {
-    hashtable_init_ex(&libcalls_table, LIBCALLS_TABLE_HASH_BITS, HASH_STRING_NOCASE,
-                      false/*!strdup*/, false, free_args_list, NULL, NULL);
+    char tmp[MAXIMUM_PATH];
+    file_t f = INVALID_FILE;
+    bool ok;
+    int i;
+    for (i = 0; f == INVALID_FILE && i < SIGDB_MAX_TMP_TRIES; i++) {
+        /* Include the pid to avoid collisions among concurrent processes */
+        dr_snprintf(tmp, BUFFER_SIZE_ELEMENTS(tmp), "%s.%d.%04d.tmp",
+                    path, dr_get_process_id(), i);
+        NULL_TERMINATE_BUFFER(tmp);
+        f = dr_open_file(tmp, DR_FILE_WRITE_REQUIRE_NEW);
+    }
+    if (f == INVALID_FILE) {
+        VNOTIFY(2, "unable to create signature database %s" NL, path);
+        return;
+    }
+    ok = (dr_write_file(f, db, size) == (ssize_t)size);
+    dr_close_file(f);
+    if (!ok || !dr_rename_file(tmp, path, true/*replace*/)) {
+        VNOTIFY(2, "failed to write signature database %s" NL, path);
+        dr_delete_file(tmp);
+        return;
+    }
+    VNOTIFY(2, "wrote signature database %s" NL, path);
 }
 
 void
-libcalls_hashtable_delete()
+libcalls_exit()
 {
-    hashtable_delete(&libcalls_table);
+    if (sigdb == NULL)
+        return;
+    if (sigdb_mapped)
+        dr_unmap_file(sigdb, sigdb_size);
+    else
+        global_free(sigdb, sigdb_size, HEAPSTAT_MISC);
+    sigdb = NULL;
 }
 
-std::vector<drsys_arg_t *> *
+const libcall_sig_t *
 libcalls_search(const char *name)
 {
-    return (std::vector<drsys_arg_t *> *)hashtable_lookup(&libcalls_table, (void *)name);
+    uint hash, bucket, i;
+    if (sigdb == NULL)
+        return NULL;
+    hash = name_hash(name);
+    bucket = hash & (sigdb_hdr->num_buckets - 1);
+    for (i = sigdb_buckets[bucket]; i < sigdb_buckets[bucket + 1]; i++) {
+        if (sigdb_funcs[i].hash == hash &&
+            name_equal(sigdb_strings + sigdb_funcs[i].name, name))
+            return &sigdb_funcs[i];
+    }
+    return NULL;
+}
+
+uint
+libcall_num_args(const libcall_sig_t *sig)
+{
+    return sig->num_args;
 }
 
-static bool
-libcalls_hashtable_insert(const char *name, std::vector<drsys_arg_t *> *args_list)
+void
+libcall_get_arg(const libcall_sig_t *sig, uint index, drsys_arg_t *arg OUT)
 {
-    return hashtable_add(&libcalls_table, (void *)name, (void *)args_list);
+    const sigdb_arg_t *src = &sigdb_args[sig->first_arg + index];
+    ASSERT(index < sig->num_args, "libcall arg index out of range");
+    memset(arg, 0, sizeof(*arg));
+    arg->ordinal = src->ordinal;
+    arg->mode = (drsys_param_mode_t) src->mode;
+    arg->type = (drsys_param_type_t) src->type;
+    arg->size = src->size;
+    arg->type_name = sigdb_strings + src->type_name;
+    arg->pre = true;
+    arg->valid = true;
 }
 
 /****************************************************************************
@@ -248,8 +565,21 @@ split(const char *buf, const char delim, std::vector<std::string> *tokens_list)
     return count;
 }
 
+static void
+free_libcalls(libcall_list_t *libcalls)
+{
+    libcall_list_t::iterator it;
+    std::vector<drsys_arg_t *>::iterator arg_it;
+    for (it = libcalls->begin(); it != libcalls->end(); ++it) {
+        for (arg_it = it->second->begin(); arg_it != it->second->end(); ++arg_it)
+            global_free(*arg_it, sizeof(drsys_arg_t), HEAPSTAT_MISC);
+        delete it->second;
+    }
+    libcalls->clear();
+}
+
 static bool
-parse_line(const char *line, int line_num)
+parse_line(const char *line, int line_num, libcall_list_t *libcalls)
 {
     std::vector<std::string> tokens;
     drsys_arg_t *tmp_arg;
@@ -287,17 +617,16 @@ parse_line(const char *line, int line_num)
         elem_index++;
     }
 
+    /* Whatever vector we return is freed by free_libcalls() */
+    libcalls->push_back(std::make_pair(std::string(func_name == NULL ? "" : func_name),
+                                       args_vector));
     if (func_name == NULL || args_vector->size() <= 0) {
         VNOTIFY(0, "unable to parse config file at line %d: %s" NL, line_num, line);
         return false;
     }
 
-    VNOTIFY(2, "adding %s from config file with %d arguments in the hashtable" NL,
+    VNOTIFY(2, "adding %s from config file with %d arguments" NL,
             func_name, args_vector->size());
-    IF_DEBUG(bool ok =)
-        libcalls_hashtable_insert(strdup(func_name), args_vector);
-    ASSERT(ok, "failed to add libcall in the hashtable");
-
     return true;
 }
 
@@ -311,6 +640,11 @@ parse_config(void)
     int lines_count = 0, line_num = 1;
     bool res = false;
     std::vector<std::string> lines_list;
+    libcall_list_t libcalls;
+    uint hash;
+    std::string db_path = op_config_file.get_value() + SIGDB_SUFFIX;
+    byte *db;
+    size_t db_size;
 
     if (!op_use_config.get_value())
         return;
@@ -337,6 +671,13 @@ parse_config(void)
         return;
     }
 
+    hash = config_hash((const char *)map, (size_t)size_to_read);
+    if (sigdb_load(db_path.c_str(), size_to_read, hash)) {
+        dr_unmap_file(map, actual_size);
+        dr_close_file(file_desc);
+        return;
+    }
+
     lines_count = split((const char *)map, '\n', &lines_list); /* split buffer by lines */
 
     dr_unmap_file(map, actual_size);
@@ -348,20 +689,27 @@ parse_config(void)
         return;
     }
 
-    init_libcalls_hashtable();
-
     std::vector<std::string>::iterator it;
     for (it = lines_list.begin(); it != lines_list.end(); it++) {
         /* XXX: we have to describe a format of the config file in the drltrace's
          * documentation as well as list supported types.
          */
-        if (!parse_line(it->c_str(), line_num)) {
+        if (!parse_line(it->c_str(), line_num, &libcalls)) {
             VNOTIFY(0, "incorrect format for the line %d: %s in config file" NL,
                     line_num, it->c_str());
             op_use_config.set_value(false);
-            libcalls_hashtable_delete();
-            break;
+            free_libcalls(&libcalls);
+            return;
         }
         line_num++;
     }
+
+    db = sigdb_build(&libcalls, size_to_read, hash, &db_size);
+    free_libcalls(&libcalls);
+    IF_DEBUG(res =)
+        sigdb_use(db, db_size, size_to_read, hash);
+    ASSERT(res, "built an invalid signature database");
+    sigdb_mapped = false;
+    /* So the next process can skip the parsing */
+    sigdb_write(db_path.c_str(), db, db_size);
 }
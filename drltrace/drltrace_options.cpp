@@ -47,6 +47,28 @@ droption_t<bool> op_only_from_app
  "Only reports library calls from the application itself, as opposed to all calls even "
  "from other libraries or within the same library.");
 
+droption_t<bool> op_count_only
+(DROPTION_SCOPE_CLIENT, "count_only", false, "Only count library calls",
+ "Rather than printing each library call, count calls to each library routine with "
+ "inline counters and print the counts, sorted, at exit and on each nudge.  This has "
+ "far lower overhead than tracing.  -only_from_app is ignored in this mode.");
+
+droption_t<unsigned int> op_sample_every
+(DROPTION_SCOPE_CLIENT, "sample_every", 0, "Only trace every Nth call to each routine",
+ "Only trace the first of every N calls to each library routine.  All calls are still "
+ "counted, and the counts are printed, sorted, at exit and on each nudge.  Can be "
+ "combined with -sample_window_ms.  Values of 0 and 1 trace every call.");
+
+droption_t<unsigned int> op_sample_window_ms
+(DROPTION_SCOPE_CLIENT, "sample_window_ms", 0, "Trace all calls in periodic windows",
+ "Trace every library call during a window of this many milliseconds once every "
+ "-sample_period_ms milliseconds, starting at process start.  All calls are still "
+ "counted as for -sample_every.  0 disables windows.");
+
+droption_t<unsigned int> op_sample_period_ms
+(DROPTION_SCOPE_CLIENT, "sample_period_ms", 10000, "Period for -sample_window_ms",
+ "The interval in milliseconds between the starts of -sample_window_ms windows.");
+
 droption_t<bool> op_follow_children
 (DROPTION_SCOPE_FRONTEND, "follow_children", true, "Trace child processes",
  "Trace child processes created by a target application. Specify -no_follow_children "
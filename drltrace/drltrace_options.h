@@ -34,6 +34,10 @@
 
 extern droption_t<std::string> op_logdir;
 extern droption_t<bool> op_only_from_app;
+extern droption_t<bool> op_count_only;
+extern droption_t<unsigned int> op_sample_every;
+extern droption_t<unsigned int> op_sample_window_ms;
+extern droption_t<unsigned int> op_sample_period_ms;
 extern droption_t<bool> op_follow_children;
 extern droption_t<bool> op_print_ret_addr;
 extern droption_t<unsigned int> op_unknown_args;
@@ -33,6 +33,7 @@
 #include "leak.h"
 #include "memlayout.h"
 #include "alloc_drmem.h"
+#include "heap_profile.h"
 #ifdef UNIX
 # ifdef MACOS
 #  include <sys/syscall.h>
@@ -49,6 +50,7 @@
 # include "stack.h"
 #endif
 #include "pattern.h"
+#include <stddef.h> /* for offsetof */
 
 /* PR 465174: share allocation site callstacks.  We do not rely on
  * global malloc synchronization and instead use the
@@ -56,7 +58,37 @@
  * payloads.
  */
 #define ASTACK_TABLE_HASH_BITS 8
-static hashtable_t alloc_stack_table;
+/* With -malloc_callstacks every malloc interns its callstack, so a single
+ * table lock serializes allocating threads.  We split the table into stripes
+ * by callstack hash, each with its own lock.  A callstack always maps to the
+ * same stripe, so its lookup, ref count increment, and final removal are
+ * still serialized by that stripe's lock.  alloc_callstack_lock() takes every
+ * stripe, in index order.
+ */
+#define ASTACK_TABLE_STRIPE_BITS 4
+#define ASTACK_TABLE_STRIPES (1 << ASTACK_TABLE_STRIPE_BITS)
+static hashtable_t alloc_stack_table[ASTACK_TABLE_STRIPES];
+
+/* Most allocations come from a few hot call sites, so each thread keeps a
+ * small direct-mapped cache of the callstacks it last interned.  Each entry
+ * holds its own reference, which keeps the callstack in the table and lets a
+ * hit add a reference without taking the stripe lock.  The cache is flushed
+ * when a module is unloaded.
+ */
+#define ASTACK_CACHE_BITS 6
+#define ASTACK_CACHE_SIZE (1 << ASTACK_CACHE_BITS)
+typedef struct _astack_cache_t {
+    uint unload_count; /* callstack_module_unload_count() at the last flush */
+    packed_callstack_t *entry[ASTACK_CACHE_SIZE];
+    struct _free_stack_ring_t *free_ring; /* acquired on the first free */
+    /* for -heap_profile_sample_rate */
+    ptr_int_t bytes_until_sample;
+    uint sample_rng;
+} astack_cache_t;
+static int tls_idx_astack = -1;
+
+void
+shared_callstack_free(packed_callstack_t *pcs);
 
 #ifdef UNIX
 /* PR 418629: to determine stack bounds accurately we track anon mmaps */
@@ -66,6 +98,7 @@ static void *mmap_tree_lock; /* maybe rbtree should support internal synch */
 
 #ifdef STATISTICS
 uint alloc_stack_count;
+uint alloc_stack_cache_hits;
 #endif
 
 #ifdef WINDOWS
@@ -114,7 +147,7 @@ typedef struct _delay_free_t {
 #endif
     size_t real_size; /* includes redzones */
     bool has_redzone;
-    packed_callstack_t *pcs; /* i#205 for reporting where freed */
+    void *free_stack; /* i#205 for reporting where freed: see free_stack_record() */
 } delay_free_t;
 
 /* We need a separate free queue per malloc routine (PR 476805) */
@@ -150,6 +183,181 @@ static rb_tree_t *delay_free_tree;
 uint delayed_free_bytes; /* includes redzones */
 #endif
 
+/***************************************************************************
+ * FREE CALLSTACKS
+ */
+
+/* With -delay_frees_stack, most freed chunks are recycled without ever being
+ * named in a report, so interning a callstack on every free is wasted work.
+ * Instead each thread writes the raw frames of its frees into a ring of
+ * slots, and the freed chunk holds a tagged pointer to its slot.  A callstack
+ * is only built when a report asks for it.  A thread reuses a slot once it
+ * has made as many newer frees as its ring holds, so each slot records the
+ * base it was written for and a lookup through a reused slot finds nothing.
+ */
+typedef struct _free_stack_t {
+    app_pc volatile base; /* NULL while being written */
+    uint unload_count;    /* callstack_module_unload_count() when written */
+    ushort num_frames;
+    bool first_is_retaddr;
+    app_pc frames[1];     /* really options.free_max_frames entries */
+} free_stack_t;
+
+typedef struct _free_stack_ring_t {
+    byte *slots;
+    uint next;
+    bool in_use;
+    struct _free_stack_ring_t *next_ring;
+} free_stack_ring_t;
+
+/* Freed chunks refer into the rings after their threads exit, so the rings
+ * live until process exit and an exited thread's ring goes to the next new
+ * thread.  The lock protects the list and the in_use fields.
+ */
+static free_stack_ring_t *free_stack_rings;
+static void *free_stack_lock;
+static size_t free_stack_slot_size;
+static uint free_stack_ring_slots;
+
+/* Never set in a packed_callstack_t pointer, which is aligned */
+#define FREE_STACK_TAG 0x1
+#define IS_FREE_STACK_REF(data) TEST(FREE_STACK_TAG, (ptr_uint_t)(data))
+#define FREE_STACK_FROM_REF(data) ((free_stack_t *)((ptr_uint_t)(data) & ~FREE_STACK_TAG))
+
+#ifdef STATISTICS
+uint free_stack_count;
+uint free_stack_built;
+uint free_stack_lost;
+#endif
+
+static void
+free_stack_init(void)
+{
+    uint slots = 64;
+    free_stack_lock = dr_mutex_create();
+    free_stack_slot_size = offsetof(free_stack_t, frames) +
+        (options.free_max_frames == 0 ? 1 : options.free_max_frames) * sizeof(app_pc);
+    /* A ring at least as long as the delay queue keeps most slots alive
+     * for as long as their chunks stay delayed.
+     */
+    while (slots < (uint)options.delay_frees)
+        slots *= 2;
+    free_stack_ring_slots = slots;
+}
+
+static void
+free_stack_exit(void)
+{
+    free_stack_ring_t *ring, *next;
+    for (ring = free_stack_rings; ring != NULL; ring = next) {
+        next = ring->next_ring;
+        global_free(ring->slots, free_stack_ring_slots * free_stack_slot_size,
+                    HEAPSTAT_CALLSTACK);
+        global_free(ring, sizeof(*ring), HEAPSTAT_CALLSTACK);
+    }
+    free_stack_rings = NULL;
+    dr_mutex_destroy(free_stack_lock);
+}
+
+static free_stack_ring_t *
+free_stack_ring_acquire(void)
+{
+    free_stack_ring_t *ring;
+    dr_mutex_lock(free_stack_lock);
+    for (ring = free_stack_rings; ring != NULL; ring = ring->next_ring) {
+        if (!ring->in_use)
+            break;
+    }
+    if (ring == NULL) {
+        ring = (free_stack_ring_t *) global_alloc(sizeof(*ring), HEAPSTAT_CALLSTACK);
+        ring->slots = (byte *)
+            global_alloc(free_stack_ring_slots * free_stack_slot_size,
+                         HEAPSTAT_CALLSTACK);
+        memset(ring->slots, 0, free_stack_ring_slots * free_stack_slot_size);
+        ring->next = 0;
+        ring->next_ring = free_stack_rings;
+        free_stack_rings = ring;
+    }
+    ring->in_use = true;
+    dr_mutex_unlock(free_stack_lock);
+    return ring;
+}
+
+static void
+free_stack_ring_release(free_stack_ring_t *ring)
+{
+    dr_mutex_lock(free_stack_lock);
+    ring->in_use = false;
+    dr_mutex_unlock(free_stack_lock);
+}
+
+/* Records the callstack of the free of the chunk at base into this thread's
+ * ring and returns a tagged reference to pass to free_stack_lookup(), or
+ * NULL if there is no ring.  Nothing needs to be freed.
+ */
+static void *
+free_stack_record(dr_mcontext_t *mc, app_pc post_call, app_pc base)
+{
+    void *drcontext = dr_get_current_drcontext();
+    astack_cache_t *cache = NULL;
+    free_stack_ring_t *ring;
+    free_stack_t *fs;
+    app_loc_t loc;
+    if (drcontext != NULL)
+        cache = (astack_cache_t *) drmgr_get_tls_field(drcontext, tls_idx_astack);
+    if (cache == NULL)
+        return NULL;
+    if (cache->free_ring == NULL)
+        cache->free_ring = free_stack_ring_acquire();
+    ring = cache->free_ring;
+    fs = (free_stack_t *) (ring->slots + ring->next * free_stack_slot_size);
+    ring->next = (ring->next + 1) & (free_stack_ring_slots - 1);
+    /* A racing lookup of the old contents fails on the base, which is written
+     * last.
+     */
+    fs->base = NULL;
+    pc_to_loc(&loc, post_call);
+    fs->num_frames = (ushort)
+        callstack_record_raw(mc, &loc, fs->frames, options.free_max_frames);
+    /* our malloc and free callstacks use post-call as the top frame when wrapping */
+    fs->first_is_retaddr = !options.replace_malloc;
+    fs->unload_count = callstack_module_unload_count();
+    fs->base = base;
+    STATS_INC(free_stack_count);
+    return (void *) ((ptr_uint_t)fs | FREE_STACK_TAG);
+}
+
+/* Returns a new callstack, which the caller must free with
+ * packed_callstack_free(), for the free recorded in ref of the chunk at base.
+ * Returns NULL if nothing was recorded or the slot has since been reused or
+ * a module has been unloaded.
+ */
+static packed_callstack_t *
+free_stack_lookup(void *ref, app_pc base)
+{
+    free_stack_t *fs;
+    packed_callstack_t *pcs;
+    if (ref == NULL)
+        return NULL;
+    ASSERT(IS_FREE_STACK_REF(ref), "invalid free callstack reference");
+    fs = FREE_STACK_FROM_REF(ref);
+    if (fs->base != base || fs->unload_count != callstack_module_unload_count()) {
+        STATS_INC(free_stack_lost);
+        return NULL;
+    }
+    pcs = packed_callstack_from_raw(fs->frames,
+                                    MIN(fs->num_frames, options.free_max_frames),
+                                    fs->first_is_retaddr);
+    /* The owning thread may have rewritten the slot while we read it */
+    if (fs->base != base) {
+        packed_callstack_free(pcs);
+        STATS_INC(free_stack_lost);
+        return NULL;
+    }
+    STATS_INC(free_stack_built);
+    return pcs;
+}
+
 /***************************************************************************/
 
 static void
@@ -168,6 +376,7 @@ void
 alloc_drmem_init(void)
 {
     alloc_options_t alloc_ops = {0,};
+    int i;
     alloc_ops.track_allocs = options.track_allocs;
     alloc_ops.track_heap = options.track_heap;
     alloc_ops.redzone_size = options.redzone_size;
@@ -199,6 +408,11 @@ alloc_drmem_init(void)
     alloc_ops.shared_redzones = (options.pattern == 0);
     alloc_ops.delay_frees = options.delay_frees;
     alloc_ops.delay_frees_maxsz = options.delay_frees_maxsz;
+#ifdef LINUX
+    alloc_ops.thread_arenas = options.thread_arenas;
+    alloc_ops.numa_arenas = options.numa_arenas;
+    alloc_ops.iteration_arenas = options.fuzz_iteration_arena;
+#endif
 #ifdef WINDOWS
     alloc_ops.skip_msvc_importers = options.skip_msvc_importers;
 #endif
@@ -207,13 +421,21 @@ alloc_drmem_init(void)
 #ifdef WINDOWS
     alloc_ops.replace_nosy_allocs = options.replace_nosy_allocs;
 #endif
+    alloc_ops.guard_page_min_size = options.guard_page_min_size;
+    alloc_ops.sample_allocs = options.sample_allocs;
+    alloc_ops.lazy_alloc_syms = options.lazy_alloc_syms;
     alloc_init(&alloc_ops, sizeof(alloc_ops));
 
-    hashtable_init_ex(&alloc_stack_table, ASTACK_TABLE_HASH_BITS, HASH_CUSTOM,
-                      false/*!str_dup*/, false/*using external synch*/,
-                      alloc_callstack_free,
-                      (uint (*)(void*)) packed_callstack_hash,
-                      (bool (*)(void*, void*)) packed_callstack_cmp);
+    for (i = 0; i < ASTACK_TABLE_STRIPES; i++) {
+        hashtable_init_ex(&alloc_stack_table[i],
+                          ASTACK_TABLE_HASH_BITS - ASTACK_TABLE_STRIPE_BITS, HASH_CUSTOM,
+                          false/*!str_dup*/, false/*using external synch*/,
+                          alloc_callstack_free,
+                          (uint (*)(void*)) packed_callstack_hash,
+                          (bool (*)(void*, void*)) packed_callstack_cmp);
+    }
+    tls_idx_astack = drmgr_register_tls_field();
+    ASSERT(tls_idx_astack > -1, "unable to reserve TLS slot");
 
 #ifdef UNIX
     mmap_tree = rb_tree_create(NULL);
@@ -227,17 +449,22 @@ alloc_drmem_init(void)
               options.midchunk_string_ok,
               options.midchunk_size_ok,
               options.show_reachable,
+              options.leak_scan_threads,
               IF_WINDOWS_(options.check_encoded_pointers)
               next_defined_ptrsz,
               end_of_defined_region,
               is_register_defined);
 
     memlayout_init();
+    if (options.heap_profile_sample_rate > 0)
+        heap_profile_init();
 
     if (options.delay_frees > 0) {
         delay_free_lock = dr_mutex_create();
         delay_free_tree = rb_tree_create(NULL);
     }
+    if (options.delay_frees_stack)
+        free_stack_init();
 
 #ifdef WINDOWS /* for i#689 */
     ASSERT(ntdll_base != NULL, "init ordering problem");
@@ -249,10 +476,16 @@ alloc_drmem_init(void)
 void
 alloc_drmem_exit(void)
 {
+    int i;
     process_exiting = true;
     leak_exit();
+    memlayout_exit();
+    if (options.heap_profile_sample_rate > 0)
+        heap_profile_exit(); /* releases its callstacks into alloc_stack_table */
     alloc_exit(); /* must be before deleting alloc_stack_table */
-    hashtable_delete_with_stats(&alloc_stack_table, "alloc stack table");
+    for (i = 0; i < ASTACK_TABLE_STRIPES; i++)
+        hashtable_delete_with_stats(&alloc_stack_table[i], "alloc stack table");
+    drmgr_unregister_tls_field(tls_idx_astack);
 #ifdef UNIX
     rb_tree_destroy(mmap_tree);
     dr_mutex_destroy(mmap_tree_lock);
@@ -261,6 +494,50 @@ alloc_drmem_exit(void)
         rb_tree_destroy(delay_free_tree);
         dr_mutex_destroy(delay_free_lock);
     }
+    if (options.delay_frees_stack)
+        free_stack_exit();
+}
+
+static void
+astack_cache_flush(astack_cache_t *cache)
+{
+    uint i;
+    for (i = 0; i < ASTACK_CACHE_SIZE; i++) {
+        /* At process exit the table deletion frees everything */
+        if (cache->entry[i] != NULL && !process_exiting)
+            shared_callstack_free(cache->entry[i]);
+        cache->entry[i] = NULL;
+    }
+    cache->unload_count = callstack_module_unload_count();
+}
+
+void
+alloc_drmem_thread_init(void *drcontext)
+{
+    astack_cache_t *cache = (astack_cache_t *)
+        thread_alloc(drcontext, sizeof(*cache), HEAPSTAT_CALLSTACK);
+    memset(cache, 0, sizeof(*cache));
+    cache->unload_count = callstack_module_unload_count();
+    if (options.heap_profile_sample_rate > 0) {
+        /* xorshift needs a non-zero seed */
+        cache->sample_rng = (uint)dr_get_thread_id(drcontext) * 0x9e3779b1 | 1;
+        cache->bytes_until_sample = heap_profile_next_sample(&cache->sample_rng);
+    }
+    drmgr_set_tls_field(drcontext, tls_idx_astack, (void *)cache);
+}
+
+void
+alloc_drmem_thread_exit(void *drcontext)
+{
+    astack_cache_t *cache = (astack_cache_t *)
+        drmgr_get_tls_field(drcontext, tls_idx_astack);
+    if (cache == NULL)
+        return;
+    astack_cache_flush(cache);
+    if (cache->free_ring != NULL)
+        free_stack_ring_release(cache->free_ring);
+    drmgr_set_tls_field(drcontext, tls_idx_astack, NULL);
+    thread_free(drcontext, cache, sizeof(*cache), HEAPSTAT_CALLSTACK);
 }
 
 /***************************************************************************
@@ -345,16 +622,31 @@ mmap_anon_lookup(byte *addr, byte **start OUT, size_t *size OUT)
  * EVENTS FOR COMMON/ALLOC.C
  */
 
+static inline hashtable_t *
+alloc_stack_stripe(packed_callstack_t *pcs)
+{
+    /* We use the top bits of a multiplicative hash so that the callstacks
+     * within one stripe still spread across that stripe's buckets, which
+     * use the low bits of packed_callstack_hash().
+     */
+    uint hash = packed_callstack_hash(pcs) * 0x9e3779b1;
+    return &alloc_stack_table[hash >> (32 - ASTACK_TABLE_STRIPE_BITS)];
+}
+
 void
 alloc_callstack_lock(void)
 {
-    hashtable_lock(&alloc_stack_table);
+    int i;
+    for (i = 0; i < ASTACK_TABLE_STRIPES; i++)
+        hashtable_lock(&alloc_stack_table[i]);
 }
 
 void
 alloc_callstack_unlock(void)
 {
-    hashtable_unlock(&alloc_stack_table);
+    int i;
+    for (i = ASTACK_TABLE_STRIPES - 1; i >= 0; i--)
+        hashtable_unlock(&alloc_stack_table[i]);
 }
 
 void
@@ -371,10 +663,12 @@ void
 shared_callstack_free(packed_callstack_t *pcs)
 {
     uint count;
+    hashtable_t *stripe;
     if (pcs == NULL)
         return;
     /* We need to synchronize removal from the table w/ additions */
-    hashtable_lock(&alloc_stack_table);
+    stripe = alloc_stack_stripe(pcs);
+    hashtable_lock(stripe);
     count = packed_callstack_free(pcs);
     LOG(4, "%s: freed pcs "PFX" => refcount %d\n", __FUNCTION__, pcs, count);
     ASSERT(count != 0, "refcount should not hit 0 in malloc_table");
@@ -383,22 +677,24 @@ shared_callstack_free(packed_callstack_t *pcs)
          * packed_callstack_free will be called by hashtable_remove
          * to dec refcount to 0 and do the actual free.
          */
-        hashtable_remove(&alloc_stack_table, (void *)pcs);
+        hashtable_remove(stripe, (void *)pcs);
     }
-    hashtable_unlock(&alloc_stack_table);
+    hashtable_unlock(stripe);
 }
 
 void
 client_malloc_data_free(void *data)
 {
     packed_callstack_t *pcs = (packed_callstack_t *) data;
+    /* a freed chunk's callstack lives in a ring and needs no freeing */
+    if (IS_FREE_STACK_REF(data))
+        return;
     ASSERT(pcs != NULL || !options.count_leaks, "malloc data must exist");
     shared_callstack_free(pcs);
 }
 
 /* Be sure to pass the same max_frames for all callstacks that we want
- * a comparison to.  Currently we use a separate one for malloc vs
- * free, but we expect them to never match anyway.
+ * a comparison to.  Free callstacks do not come here: see free_stack_record().
  */
 static packed_callstack_t *
 get_shared_callstack(packed_callstack_t *existing_data, dr_mcontext_t *mc,
@@ -415,6 +711,10 @@ get_shared_callstack(packed_callstack_t *existing_data, dr_mcontext_t *mc,
      * every-alloc scheme).
      */
     packed_callstack_t *pcs;
+    hashtable_t *stripe;
+    void *drcontext = dr_get_current_drcontext();
+    astack_cache_t *cache = NULL;
+    uint slot = 0;
     if (existing_data != NULL)
         pcs = (packed_callstack_t *) existing_data;
     else {
@@ -431,29 +731,89 @@ get_shared_callstack(packed_callstack_t *existing_data, dr_mcontext_t *mc,
      * costs
      */
 
+    /* Check this thread's cache before the table.  The cached entry's own
+     * reference keeps it alive, so we can add ours without a lock.
+     */
+    if (drcontext != NULL)
+        cache = (astack_cache_t *) drmgr_get_tls_field(drcontext, tls_idx_astack);
+    if (cache != NULL) {
+        packed_callstack_t *hit;
+        if (cache->unload_count != callstack_module_unload_count())
+            astack_cache_flush(cache);
+        slot = (packed_callstack_hash(pcs) * 0x9e3779b1) >> (32 - ASTACK_CACHE_BITS);
+        hit = cache->entry[slot];
+        if (hit != NULL && packed_callstack_cmp(hit, pcs)) {
+            IF_DEBUG(uint count =) packed_callstack_free(pcs);
+            ASSERT(count == 0, "refcount should be 0");
+            packed_callstack_add_ref(hit);
+            STATS_INC(alloc_stack_cache_hits);
+            LOG(4, "%s: cached pcs "PFX"\n", __FUNCTION__, hit);
+            return hit;
+        }
+    }
+
     /* Synchronization: we no longer rely on malloc_lock(), as we
      * don't enable a global lock for -replace_malloc: i#949.  Thus we
-     * must hold the hashtable lock across the lookup and ref count inc.
-     * shared_callstack_free() grabs the hashtable lock before the final
+     * must hold the stripe lock across the lookup and ref count inc.
+     * shared_callstack_free() grabs the same stripe lock before the final
      * remove, ensuring pcs doesn't disappear underneath us.
      */
-    hashtable_lock(&alloc_stack_table);
-    pcs = packed_callstack_add_to_table(&alloc_stack_table, pcs
-                                        _IF_STATS(&alloc_stack_count));
+    stripe = alloc_stack_stripe(pcs);
+    hashtable_lock(stripe);
+    pcs = packed_callstack_add_to_table(stripe, pcs _IF_STATS(&alloc_stack_count));
     LOG(4, "%s: created pcs "PFX"\n", __FUNCTION__, pcs);
-    hashtable_unlock(&alloc_stack_table);
+    hashtable_unlock(stripe);
+    if (cache != NULL) {
+        /* We hold a reference, so the cache's can be added without a lock */
+        if (cache->entry[slot] != NULL)
+            shared_callstack_free(cache->entry[slot]);
+        packed_callstack_add_ref(pcs);
+        cache->entry[slot] = pcs;
+    }
     return pcs;
 }
 
+/* For -heap_profile_sample_rate: counts mal's bytes down to the next sample.
+ * Only a sampled allocation needs a callstack of its own.
+ */
+static void
+heap_profile_sample(malloc_info_t *mal, dr_mcontext_t *mc, app_pc post_call,
+                    packed_callstack_t *pcs)
+{
+    void *drcontext = dr_get_current_drcontext();
+    astack_cache_t *cache;
+    if (drcontext == NULL)
+        return;
+    cache = (astack_cache_t *) drmgr_get_tls_field(drcontext, tls_idx_astack);
+    if (cache == NULL)
+        return;
+    cache->bytes_until_sample -= (ptr_int_t) mal->request_size;
+    if (cache->bytes_until_sample > 0)
+        return;
+    /* The distance is memoryless, so we start a fresh one rather than carrying
+     * over the excess, and heap_profile_add() scales by the sampling probability.
+     */
+    cache->bytes_until_sample = heap_profile_next_sample(&cache->sample_rng);
+    if (pcs != NULL)
+        packed_callstack_add_ref(pcs);
+    else
+        pcs = get_shared_callstack(NULL, mc, post_call, options.malloc_max_frames);
+    heap_profile_add(mal->base, mal->request_size, pcs);
+}
+
 void *
 client_add_malloc_pre(malloc_info_t *mal, dr_mcontext_t *mc, app_pc post_call)
 {
-    if (!options.malloc_callstacks && !options.count_leaks &&
-        !options.track_origins_unaddr)
-        return NULL;
-    return (void *)
-        get_shared_callstack((packed_callstack_t *)mal->client_data, mc, post_call,
-                             options.malloc_max_frames);
+    packed_callstack_t *pcs = NULL;
+    if (options.malloc_callstacks || options.count_leaks ||
+        options.track_origins_unaddr || options.track_origins) {
+        pcs = get_shared_callstack((packed_callstack_t *)mal->client_data, mc,
+                                   post_call, options.malloc_max_frames);
+    }
+    /* pre-existing chunks have no mc and would skew the sampled distances */
+    if (options.heap_profile_sample_rate > 0 && mc != NULL && !mal->pre_us)
+        heap_profile_sample(mal, mc, post_call, pcs);
+    return (void *) pcs;
 }
 
 void
@@ -465,7 +825,9 @@ client_add_malloc_post(malloc_info_t *mal)
 void
 client_remove_malloc_pre(malloc_info_t *mal)
 {
-    /* nothing to do: client_malloc_data_free() does the work */
+    /* otherwise client_malloc_data_free() does the work */
+    if (options.heap_profile_sample_rate > 0)
+        heap_profile_remove(mal->base);
 }
 
 void
@@ -543,7 +905,19 @@ client_handle_malloc(void *drcontext, malloc_info_t *mal, dr_mcontext_t *mc)
     }
     if (options.shadowing) {
         uint val = mal->zeroed ? SHADOW_DEFINED : SHADOW_UNDEFINED;
-        shadow_set_range(mal->base, mal->base + mal->request_size, val);
+        byte *start = mal->base;
+        if (mal->fresh) {
+            /* The shadow of fresh memory has never been written, so any whole
+             * shadow blocks it covers can share a special block rather than
+             * each being filled in.  The unaligned tail is set per byte below.
+             */
+            byte *aligned_end = (byte *)
+                ALIGN_BACKWARD(mal->base + mal->request_size, SHADOW_GRANULARITY);
+            if (aligned_end > mal->base &&
+                shadow_create_shadow_memory(mal->base, aligned_end - mal->base, val))
+                start = aligned_end;
+        }
+        shadow_set_range(start, mal->base + mal->request_size, val);
     }
     if (options.pattern != 0) {
         pattern_handle_malloc(mal);
@@ -687,13 +1061,7 @@ client_remove_malloc_routine(void *client_data)
     /* We assume no lock is needed on destroy */
     if (options.delay_frees > 0) {
         delay_free_info_t *info = (delay_free_info_t *) client_data;
-        int i;
         ASSERT(info != NULL, "invalid param");
-        for (i = 0; i < info->delay_free_fill; i++) {
-            if (info->delay_free_list[i].addr != NULL) {
-                shared_callstack_free(info->delay_free_list[i].pcs);
-            }
-        }
         global_free(info->delay_free_list,
                     options.delay_frees * sizeof(*info->delay_free_list), HEAPSTAT_MISC);
         global_free(info, sizeof(*info), HEAPSTAT_MISC);
@@ -759,8 +1127,7 @@ next_to_free(delay_free_info_t *info, int idx _IF_WINDOWS(ptr_int_t *auxarg OUT)
             pattern_handle_real_free(&mal, true /* delayed */);
         }
     }
-    shared_callstack_free(info->delay_free_list[idx].pcs);
-    info->delay_free_list[idx].pcs = NULL;
+    info->delay_free_list[idx].free_stack = NULL;
     return pass_to_free;
 }
 
@@ -774,7 +1141,10 @@ client_handle_free(malloc_info_t *mal, byte *tofree, dr_mcontext_t *mc,
 {
     report_malloc(mal->base, mal->base + mal->request_size, "free", mc);
 
-    if (options.shadowing) {
+    /* For a chunk in a heap being destroyed, the shadow of the whole heap is
+     * released in one step by handle_removed_heap_region().
+     */
+    if (options.shadowing && !mal->heap_destroyed) {
         shadow_set_range(mal->base, mal->base + mal->request_size,
                          SHADOW_UNADDRESSABLE);
     }
@@ -911,10 +1281,10 @@ client_handle_free(malloc_info_t *mal, byte *tofree, dr_mcontext_t *mc,
         info->delay_free_list[idx].real_size = tot_sz;
         info->delay_free_list[idx].has_redzone = mal->has_redzone;
         if (options.delay_frees_stack) {
-            info->delay_free_list[idx].pcs =
-                get_shared_callstack(NULL, mc, free_routine, options.free_max_frames);
+            info->delay_free_list[idx].free_stack =
+                free_stack_record(mc, free_routine, rz_start);
         } else
-            info->delay_free_list[idx].pcs = NULL;
+            info->delay_free_list[idx].free_stack = NULL;
 
         STATS_ADD(delayed_free_bytes, (uint)tot_sz);
 
@@ -950,16 +1320,17 @@ client_new_redzone(app_pc start, size_t size)
 }
 
 void *
-client_malloc_data_to_free_list(void *cur_data, dr_mcontext_t *mc, app_pc post_call)
+client_malloc_data_to_free_list(void *cur_data, dr_mcontext_t *mc, app_pc post_call,
+                                app_pc base)
 {
     packed_callstack_t *pcs = (packed_callstack_t *) cur_data;
     ASSERT(options.replace_malloc, "should not be called");
     ASSERT(pcs != NULL || !options.count_leaks, "malloc data must exist");
-    shared_callstack_free(pcs);
+    if (!IS_FREE_STACK_REF(cur_data))
+        shared_callstack_free(pcs);
     /* replace malloc callstack with free callstack */
     if (options.delay_frees_stack) {
-        return (void *)
-            get_shared_callstack(NULL, mc, post_call, options.free_max_frames);
+        return free_stack_record(mc, post_call, base);
     } else {
         /* XXX: could keep the malloc callstack and report that, if labeled properly */
         return NULL;
@@ -969,13 +1340,12 @@ client_malloc_data_to_free_list(void *cur_data, dr_mcontext_t *mc, app_pc post_c
 void *
 client_malloc_data_free_split(void *cur_data)
 {
-    packed_callstack_t *pcs = (packed_callstack_t *) cur_data;
     ASSERT(options.replace_malloc, "should not be called");
-    if (pcs != NULL) {
-        ASSERT(options.delay_frees_stack, "should be NULL");
-        packed_callstack_add_ref(pcs);
-    }
-    return pcs;
+    /* The ring slot records the original base, so a lookup for the split-off
+     * portion will find nothing.
+     */
+    ASSERT(cur_data == NULL || IS_FREE_STACK_REF(cur_data), "should be NULL");
+    return cur_data;
 }
 
 #ifdef WINDOWS
@@ -1003,8 +1373,7 @@ client_handle_heap_destroy(void *drcontext, HANDLE heap, void *client_data)
             else
                 ASSERT(false, "delay_free_tree inconsistent");
             info->delay_free_list[i].addr = NULL;
-            shared_callstack_free(info->delay_free_list[i].pcs);
-            info->delay_free_list[i].pcs = NULL;
+            info->delay_free_list[i].free_stack = NULL;
             num_removed++;
         }
     }
@@ -1040,13 +1409,12 @@ overlaps_delayed_free(byte *start, byte *end,
                 *free_start = info.base;
             if (free_end != NULL)
                 *free_end = info.base + info.request_size;
-            /* There can be a race where this client_data is freed (due to
-             * the delay-free or freed chunk being re-used), but our alloc_stack_table
-             * refcount keeps it alive for the process lifetime.  So I see no
-             * reason to hold a lock, and esp not to clone it here.
+            /* There can be a race where the chunk is re-used and its ring slot
+             * rewritten, but the rings live for the process lifetime and
+             * free_stack_lookup() fails if the slot changes under it.
              */
             if (pcs != NULL)
-                *pcs = (packed_callstack_t *) info.client_data;
+                *pcs = free_stack_lookup(info.client_data, info.base);
         } else
             found = false;
         return found;
@@ -1073,12 +1441,8 @@ overlaps_delayed_free(byte *start, byte *end,
          */
         if (free_end != NULL)
             *free_end = real_base + size - redsz;
-        if (pcs != NULL) {
-            if (info->pcs == NULL)
-                *pcs = NULL;
-            else
-                *pcs = packed_callstack_clone(info->pcs);
-        }
+        if (pcs != NULL)
+            *pcs = free_stack_lookup(info->free_stack, real_base);
     }
     dr_mutex_unlock(delay_free_lock);
     return res;
@@ -1130,6 +1494,7 @@ client_handle_mmap(void *drcontext, app_pc base, size_t size, bool anon)
         mmap_walk(base, size, true/*add*/);
     }
 #endif
+    leak_handle_mapping_change(base, size);
     LOG(2, "mmap %s "PFX"-"PFX"\n", anon ? "anon" : "file",
         base, base+size);
 }
@@ -1140,7 +1505,7 @@ client_handle_munmap(app_pc base, size_t size, bool anon)
 #ifdef WINDOWS
     if (options.shadowing) {
         if (anon)
-            shadow_set_range(base, base+size, SHADOW_UNADDRESSABLE);
+            shadow_delete_shadow_memory(base, size);
         else
             mmap_walk(base, size, IF_WINDOWS_(NULL) false/*remove*/);
     }
@@ -1148,14 +1513,23 @@ client_handle_munmap(app_pc base, size_t size, bool anon)
     /* anon not known to common/alloc.c so we see whether in the anon table */
     if (mmap_tree_remove(base, size)) {
         if (options.shadowing)
-            shadow_set_range(base, base+size, SHADOW_UNADDRESSABLE);
+            shadow_delete_shadow_memory(base, size);
     } else if (options.shadowing)
         mmap_walk(base, size, IF_WINDOWS_(NULL) false/*remove*/);
 #endif
+    leak_handle_mapping_change(base, size);
     LOG(2, "munmap %s "PFX"-"PFX"\n", anon ? "anon" : "file",
         base, base+size);
 }
 
+void
+client_handle_mprotect(app_pc base, size_t size, bool writable)
+{
+    /* Only a writable read-only region can hold new pointers */
+    if (writable)
+        leak_handle_mapping_change(base, size);
+}
+
 void
 client_handle_munmap_fail(app_pc base, size_t size, bool anon)
 {
@@ -1200,6 +1574,8 @@ client_handle_mremap(app_pc old_base, size_t old_size, app_pc new_base, size_t n
         /* an anon region */
         mmap_tree_add(new_base, new_size);
     }
+    leak_handle_mapping_change(old_base, old_size);
+    leak_handle_mapping_change(new_base, new_size);
 }
 #endif
 
@@ -2394,12 +2770,12 @@ check_unaddressable_exceptions(bool write, app_loc_t *loc, app_pc addr, uint sz,
         return true;
     }
 #ifdef WINDOWS
-    /* For TLS, rather than proactively track sets and unsets, we check
-     * on fault for whether set and we never mark as addressable.
-     * FIXME i#537: for performance we should proactively track so we can mark
-     * as addressable.  Should just watch the API and let people who
-     * bypass to set the bits themselves deal w/ the false positives instead
-     * of adding checks to all writes to catch tls bitmask writes.
+    /* For TLS, rather than proactively track sets, we check on fault for
+     * whether set.  i#537: we do watch frees of the 64 TEB slots
+     * (tls_slot_freed()), so once an allocated slot is used we mark it defined
+     * and its later accesses stay on the fastpath.  People who bypass the API
+     * to set the bitmap themselves get no such tracking.  Expansion slots are
+     * still checked on every fault.
      */
     if ((addr >= (app_pc)&teb->TlsSlots[0] && addr < (app_pc)&teb->TlsSlots[64]) ||
         (teb->TlsExpansionSlots != NULL &&
@@ -2415,6 +2791,11 @@ check_unaddressable_exceptions(bool write, app_loc_t *loc, app_pc addr, uint sz,
             LOG(3, "checking unaddressable TLS slot "PFX" => %d\n",
                  addr, slot);
             tls_ok = ((peb->TlsBitmap->Buffer[slot/32] & (1 << (slot % 32))) != 0);
+            if (tls_ok && options.shadowing) {
+                app_pc slot_start = (app_pc)&teb->TlsSlots[slot];
+                shadow_set_range(slot_start, slot_start + sizeof(void*), SHADOW_DEFINED);
+                STATS_INC(tls_slot_defined);
+            }
         } else {
             uint slot = (addr - (app_pc)teb->TlsExpansionSlots) / sizeof(void*);
             ASSERT(peb->TlsExpansionBitmap != NULL, "TLS mismatch");
@@ -2430,8 +2811,6 @@ check_unaddressable_exceptions(bool write, app_loc_t *loc, app_pc addr, uint sz,
             tls_ok ? "ignoring" : "reporting", write ? "write" : "read",
             loc_to_print(loc), addr, shadow_get_byte(&info, addr));
         STATS_INC(tls_exception);
-        /* We leave as unaddressable since we're not tracking the unset so we
-         * can't safely mark as addressable */
         return tls_ok;
     }
 #else
@@ -2497,12 +2876,30 @@ void
 handle_removed_heap_region(app_pc start, app_pc end, dr_mcontext_t *mc)
 {
     report_heap_region(false/*remove*/, start, end, mc);
+    /* With our own allocator the region is released by us rather than by an
+     * app syscall we'd see in client_handle_munmap(), so we release its
+     * shadow here.  Every chunk inside is already unaddressable.
+     */
+    if (options.shadowing && options.replace_malloc)
+        shadow_delete_shadow_memory(start, end - start);
 }
 
 /***************************************************************************
  * LEAK CHECKING
  */
 
+void
+client_found_leaks_pending(void **client_data, uint num)
+{
+    /* Symbolizing each unique leak callstack as it is reported performs the
+     * same lookups over and over across modules: we instead resolve every
+     * frame up front in one sorted pass.
+     */
+    if (!options.count_leaks || !options.check_leaks)
+        return;
+    packed_callstack_symbolize_batch((packed_callstack_t **) client_data, num);
+}
+
 void
 client_found_leak(app_pc start, app_pc end, size_t indirect_bytes,
                   bool pre_us, bool reachable,
@@ -2613,6 +3010,28 @@ region_overlap_with_malloc_block(malloc_iter_data_t *iter_data)
     return iter_data->found;
 }
 
+static bool
+region_find_malloc_block(malloc_iter_data_t *iter_data)
+{
+    if (options.replace_malloc) {
+        /* Faster than full iteration, in presence of multiple arenas */
+        malloc_info_t mal;
+        mal.struct_size = sizeof(mal);
+        if (alloc_replace_overlaps_malloc(iter_data->addr,
+                                          iter_data->addr + iter_data->size, &mal)) {
+            iter_data->start = mal.base;
+            iter_data->end = mal.base + mal.request_size;
+            iter_data->real_end = mal.base + mal.pad_size +
+                (mal.has_redzone ? options.redzone_size*2 : 0);
+            iter_data->alloc_pcs = (packed_callstack_t *) mal.client_data;
+            iter_data->pre_us = false; /* we don't know, but won't match bounds checks */
+            iter_data->found = true;
+        }
+        return iter_data->found;
+    }
+    return region_overlap_with_malloc_block(iter_data);
+}
+
 /* check if region [addr, addr + size) overlaps with any malloc redzone
  * or padding.
  * - if overlaps, return true and fill all the passed in parameters,
@@ -2627,23 +3046,7 @@ region_in_redzone(byte *addr, size_t size,
                   app_pc *redzone_end OUT)
 {
     malloc_iter_data_t iter_data = {addr, size, NULL, NULL, NULL, false, false};
-    if (options.replace_malloc) {
-        /* Faster than full iteration, in presence of multiple arenas */
-        malloc_info_t mal;
-        mal.struct_size = sizeof(mal);
-        if (alloc_replace_overlaps_malloc(addr, addr + size, &mal)) {
-            iter_data.start = mal.base;
-            iter_data.end = mal.base + mal.request_size;
-            iter_data.real_end = mal.base + mal.pad_size +
-                (mal.has_redzone ? options.redzone_size*2 : 0);
-            iter_data.alloc_pcs = (packed_callstack_t *) mal.client_data;
-            iter_data.pre_us = false; /* we don't know, but won't match bounds checks */
-            iter_data.found = true;
-        }
-    } else if (region_overlap_with_malloc_block(&iter_data)) {
-        ASSERT(iter_data.found, "should be set already");
-    }
-    if (iter_data.found) {
+    if (region_find_malloc_block(&iter_data)) {
         LOG(3, "%s "PFX"-"PFX": match "PFX"-"PFX"-"PFX", checking redzones\n",
             __FUNCTION__, addr, addr+size, iter_data.start, iter_data.end,
             iter_data.real_end);
@@ -2687,3 +3090,24 @@ region_in_redzone(byte *addr, size_t size,
     return false;
 }
 
+bool
+region_in_malloc_block(byte *addr, size_t size,
+                       packed_callstack_t **alloc_pcs OUT,
+                       app_pc *app_start OUT,
+                       app_pc *app_end OUT)
+{
+    malloc_iter_data_t iter_data = {addr, size, NULL, NULL, NULL, false, false};
+    if (!region_find_malloc_block(&iter_data) || iter_data.pre_us ||
+        addr < iter_data.start || addr + size > iter_data.end)
+        return false;
+    LOG(3, "%s "PFX"-"PFX": in block "PFX"-"PFX"\n", __FUNCTION__,
+        addr, addr+size, iter_data.start, iter_data.end);
+    if (alloc_pcs != NULL)
+        *alloc_pcs = iter_data.alloc_pcs;
+    if (app_start != NULL)
+        *app_start = iter_data.start;
+    if (app_end != NULL)
+        *app_end = iter_data.end;
+    return true;
+}
+
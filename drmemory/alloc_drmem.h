@@ -35,6 +35,12 @@ alloc_drmem_init(void);
 void
 alloc_drmem_exit(void);
 
+void
+alloc_drmem_thread_init(void *drcontext);
+
+void
+alloc_drmem_thread_exit(void *drcontext);
+
 bool
 check_unaddressable_exceptions(bool write, app_loc_t *loc, app_pc addr, uint sz,
                                bool addr_on_stack, dr_mcontext_t *mc);
@@ -88,6 +94,17 @@ region_in_redzone(byte *addr, size_t size,
                   app_pc *redzone_start OUT,
                   app_pc *redzone_end OUT);
 
+/* check if region [addr, addr + size) lies within the requested bounds of a
+ * malloc block allocated by the app,
+ * - if so, return true and fill all the passed in parameters,
+ * - otherwise, return false and NO parameters is filled.
+ */
+bool
+region_in_malloc_block(byte *addr, size_t size,
+                       packed_callstack_t **alloc_pcs OUT,
+                       app_pc *app_start OUT,
+                       app_pc *app_end OUT);
+
 /* Synchronizes access to malloc callstacks (malloc_get_client_data()) */
 void
 alloc_callstack_lock(void);
@@ -29,6 +29,8 @@
  * - i#61: Implement AmIRunningUnderDrMemory() or RunningUnderValgrind().
  * - i#311: Annotate which part of the subprogram is running, for mapping
  *   allocation sites to test cases.
+ * - Valgrind's MEMPOOL client requests are not among the requests DR passes
+ *   to us, so custom pools must use our own drmemory_pool_* annotations.
  */
 
 #include "dr_api.h"
@@ -38,9 +40,13 @@
 #include "utils.h"
 #include "shadow.h"
 #include "options.h"
+#include "stack.h"
 #ifdef TOOL_DR_MEMORY
 # include "alloc_drmem.h"
 # include "memlayout.h"
+# include "report.h"
+# include "callstack.h"
+# include "redblack.h"
 #else
 extern void check_reachability(bool at_exit);
 #endif
@@ -98,6 +104,215 @@ void handle_dump_memory_layout(void)
     memlayout_dump_layout(pc);
 # endif
 }
+
+/***************************************************************************
+ * CUSTOM POOLS
+ *
+ * An arena or pool allocator hands out pieces of memory it obtained in bulk,
+ * so we cannot see its sub-allocations.  The drmemory_pool_* annotations
+ * describe them: each one updates the shadow of the whole range at once, and
+ * resetting a pool returns its entire arena to unaddressable without visiting
+ * the sub-allocations' shadow.  Sub-allocations are kept in a per-pool tree
+ * rather than the malloc table, as the arena is usually itself a heap chunk.
+ * Leak checking does not look inside pools.
+ */
+
+# ifdef TOOL_DR_MEMORY
+#  define POOL_TABLE_HASH_BITS 6
+
+typedef struct _pool_t {
+    byte *base;
+    size_t size;
+    /* live sub-allocations */
+    rb_tree_t *chunks;
+} pool_t;
+
+/* Maps the app's pool handle to a pool_t; the table lock guards the trees */
+static hashtable_t pool_table;
+
+static void
+pool_entry_free(void *p)
+{
+    pool_t *pool = (pool_t *) p;
+    rb_tree_destroy(pool->chunks);
+    global_free(pool, sizeof(*pool), HEAPSTAT_MISC);
+}
+
+static void
+pool_report_invalid(app_pc addr, const char *routine)
+{
+    void *drcontext = dr_get_current_drcontext();
+    app_pc pc = (app_pc) dr_read_saved_reg(drcontext, SPILL_SLOT_2);
+    dr_mcontext_t mc;
+    app_loc_t loc;
+    char msg[64];
+    mc.size = sizeof(mc);
+    mc.flags = DR_MC_CONTROL | DR_MC_INTEGER;
+    dr_get_mcontext(drcontext, &mc);
+    pc_to_loc(&loc, pc);
+    dr_snprintf(msg, BUFFER_SIZE_ELEMENTS(msg), " to %s", routine);
+    NULL_TERMINATE_BUFFER(msg);
+    report_invalid_heap_arg(&loc, addr, &mc, msg, true/*free*/);
+}
+# endif
+
+static void
+handle_pool_create(void *handle, void *base, size_t size)
+{
+# ifdef TOOL_DR_MEMORY
+    pool_t *pool;
+    LOG(2, "%s: "PFX" "PFX"-"PFX"\n", __FUNCTION__, handle, base, (byte*)base + size);
+    pool = (pool_t *) global_alloc(sizeof(*pool), HEAPSTAT_MISC);
+    pool->base = (byte *) base;
+    pool->size = size;
+    pool->chunks = rb_tree_create(NULL);
+    /* a re-created handle replaces the old pool */
+    hashtable_add_replace(&pool_table, handle, (void *) pool);
+    if (options.shadowing && size > 0)
+        shadow_set_range(pool->base, pool->base + size, SHADOW_UNADDRESSABLE);
+# endif
+}
+
+static void
+handle_pool_alloc(void *handle, void *addr, size_t size)
+{
+# ifdef TOOL_DR_MEMORY
+    pool_t *pool;
+    LOG(2, "%s: "PFX" "PFX"-"PFX"\n", __FUNCTION__, handle, addr, (byte*)addr + size);
+    hashtable_lock(&pool_table);
+    pool = (pool_t *) hashtable_lookup(&pool_table, handle);
+    if (pool == NULL) {
+        LOG(1, "WARNING: allocation "PFX" from unknown pool "PFX"\n", addr, handle);
+    } else {
+        /* a zero-sized allocation still needs a node to be freed later */
+        rb_node_t *node = rb_insert(pool->chunks, (byte *) addr, MAX(size, 1), NULL);
+        if (node != NULL) {
+            /* the app re-used memory without freeing it: replace the old node */
+            rb_delete(pool->chunks, node);
+            rb_insert(pool->chunks, (byte *) addr, MAX(size, 1), NULL);
+        }
+    }
+    hashtable_unlock(&pool_table);
+    if (options.shadowing && size > 0) {
+        shadow_set_range((byte *) addr, (byte *) addr + size,
+                         options.check_uninitialized ? SHADOW_UNDEFINED :
+                         SHADOW_DEFINED);
+    }
+# endif
+}
+
+static void
+handle_pool_free(void *handle, void *addr)
+{
+# ifdef TOOL_DR_MEMORY
+    pool_t *pool;
+    rb_node_t *node = NULL;
+    size_t size = 0;
+    LOG(2, "%s: "PFX" "PFX"\n", __FUNCTION__, handle, addr);
+    hashtable_lock(&pool_table);
+    pool = (pool_t *) hashtable_lookup(&pool_table, handle);
+    if (pool != NULL)
+        node = rb_find(pool->chunks, (byte *) addr);
+    if (node != NULL) {
+        rb_node_fields(node, NULL, &size, NULL);
+        rb_delete(pool->chunks, node);
+    }
+    hashtable_unlock(&pool_table);
+    if (node == NULL) {
+        pool_report_invalid((app_pc) addr, "drmemory_pool_free");
+        return;
+    }
+    if (options.shadowing)
+        shadow_set_range((byte *) addr, (byte *) addr + size, SHADOW_UNADDRESSABLE);
+# endif
+}
+
+# ifdef TOOL_DR_MEMORY
+/* Drops all sub-allocations and returns the arena's shadow to unaddressable.
+ * Umbra frees whole shadow blocks rather than writing them.
+ */
+static void
+pool_reset(void *handle, bool destroy)
+{
+    pool_t *pool;
+    byte *base = NULL;
+    size_t size = 0;
+    hashtable_lock(&pool_table);
+    pool = (pool_t *) hashtable_lookup(&pool_table, handle);
+    if (pool != NULL) {
+        base = pool->base;
+        size = pool->size;
+        if (destroy)
+            hashtable_remove(&pool_table, handle);
+        else
+            rb_clear(pool->chunks);
+    }
+    hashtable_unlock(&pool_table);
+    if (pool == NULL) {
+        LOG(1, "WARNING: reset of unknown pool "PFX"\n", handle);
+        return;
+    }
+    if (options.shadowing && size > 0)
+        shadow_delete_shadow_memory(base, size);
+}
+# endif
+
+static void
+handle_pool_reset(void *handle)
+{
+# ifdef TOOL_DR_MEMORY
+    LOG(2, "%s: "PFX"\n", __FUNCTION__, handle);
+    pool_reset(handle, false);
+# endif
+}
+
+static void
+handle_pool_destroy(void *handle)
+{
+# ifdef TOOL_DR_MEMORY
+    LOG(2, "%s: "PFX"\n", __FUNCTION__, handle);
+    pool_reset(handle, true);
+# endif
+}
+
+/***************************************************************************
+ * APP STACKS
+ *
+ * Coroutine and fiber stacks registered by the app, so that swaps among them
+ * are recognized directly (see check_stack_swap()).
+ */
+
+static void
+handle_stack_register(void *base, size_t size)
+{
+    LOG(2, "%s: "PFX"-"PFX"\n", __FUNCTION__, base, (byte*)base + size);
+    if (!options.check_stack_bounds)
+        return;
+    stack_register(dr_get_current_drcontext(), (byte *) base, size);
+}
+
+static void
+handle_stack_deregister(void *base)
+{
+    LOG(2, "%s: "PFX"\n", __FUNCTION__, base);
+    if (!options.check_stack_bounds)
+        return;
+    if (!stack_deregister((byte *) base))
+        LOG(1, "WARNING: deregistration of unknown stack "PFX"\n", base);
+}
+
+static void
+register_call_annotation(const char *name, void *handler, uint num_args,
+                         bool pass_pc)
+{
+    if (!dr_annotation_register_call(name, handler, false, num_args,
+                                     DR_ANNOTATION_CALL_TYPE_FASTCALL)) {
+        NOTIFY_ERROR("ERROR: Failed to register annotations"NL);
+        dr_abort();
+    }
+    if (pass_pc)
+        dr_annotation_pass_pc(name);
+}
 #endif
 
 void
@@ -130,10 +345,33 @@ annotate_init(void)
         NOTIFY_ERROR("ERROR: Failed to register annotations"NL);
         dr_abort();
     }
+
+# ifdef TOOL_DR_MEMORY
+    hashtable_init_ex(&pool_table, POOL_TABLE_HASH_BITS, HASH_INTPTR,
+                      false/*!str_dup*/, true/*synch*/, pool_entry_free, NULL, NULL);
+# endif
+    register_call_annotation("drmemory_pool_create", (void *) handle_pool_create,
+                             3, false);
+    register_call_annotation("drmemory_pool_alloc", (void *) handle_pool_alloc,
+                             3, false);
+    /* the pc is for reporting an invalid free */
+    register_call_annotation("drmemory_pool_free", (void *) handle_pool_free,
+                             2, true);
+    register_call_annotation("drmemory_pool_reset", (void *) handle_pool_reset,
+                             1, false);
+    register_call_annotation("drmemory_pool_destroy", (void *) handle_pool_destroy,
+                             1, false);
+    register_call_annotation("drmemory_stack_register", (void *) handle_stack_register,
+                             2, false);
+    register_call_annotation("drmemory_stack_deregister",
+                             (void *) handle_stack_deregister, 1, false);
 #endif
 }
 
 void
 annotate_exit(void)
 {
+#if !defined(ARM) && defined(TOOL_DR_MEMORY)
+    hashtable_delete(&pool_table);
+#endif
 }
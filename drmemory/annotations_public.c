@@ -24,3 +24,19 @@
 DR_DEFINE_ANNOTATION(void, drmemory_dump_memory_layout, (void),)
 
 DR_DEFINE_ANNOTATION(void, drmemory_make_unaddressable, (void *start, size_t len),)
+
+DR_DEFINE_ANNOTATION(void, drmemory_pool_create,
+                     (void *pool, void *base, size_t size),)
+
+DR_DEFINE_ANNOTATION(void, drmemory_pool_alloc,
+                     (void *pool, void *addr, size_t size),)
+
+DR_DEFINE_ANNOTATION(void, drmemory_pool_free, (void *pool, void *addr),)
+
+DR_DEFINE_ANNOTATION(void, drmemory_pool_reset, (void *pool),)
+
+DR_DEFINE_ANNOTATION(void, drmemory_pool_destroy, (void *pool),)
+
+DR_DEFINE_ANNOTATION(void, drmemory_stack_register, (void *start, size_t size),)
+
+DR_DEFINE_ANNOTATION(void, drmemory_stack_deregister, (void *start),)
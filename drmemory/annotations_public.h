@@ -34,12 +34,47 @@
 #define DRMEMORY_ANNOTATE_MAKE_UNADDRESSABLE(start, len)    \
     DR_ANNOTATION(drmemory_make_unaddressable, start, len)
 
+/* Custom pool allocators: "pool" is any value identifying the pool.  Creating a
+ * pool marks its arena [base, base+size) unaddressable; each allocation and
+ * free updates the shadow of that piece; resetting or destroying the pool
+ * returns the whole arena to unaddressable at once.
+ */
+#define DRMEMORY_ANNOTATE_POOL_CREATE(pool, base, size)    \
+    DR_ANNOTATION(drmemory_pool_create, pool, base, size)
+#define DRMEMORY_ANNOTATE_POOL_ALLOC(pool, addr, size)    \
+    DR_ANNOTATION(drmemory_pool_alloc, pool, addr, size)
+#define DRMEMORY_ANNOTATE_POOL_FREE(pool, addr)    \
+    DR_ANNOTATION(drmemory_pool_free, pool, addr)
+#define DRMEMORY_ANNOTATE_POOL_RESET(pool)    \
+    DR_ANNOTATION(drmemory_pool_reset, pool)
+#define DRMEMORY_ANNOTATE_POOL_DESTROY(pool)    \
+    DR_ANNOTATION(drmemory_pool_destroy, pool)
+
+/* Coroutine or fiber stacks: registering [start, start+size) as a stack lets
+ * switches to, from, and among registered stacks be recognized as stack swaps
+ * rather than as huge stack allocations or deallocations.  Deregister a stack
+ * before freeing its memory.
+ */
+#define DRMEMORY_ANNOTATE_STACK_REGISTER(start, size)    \
+    DR_ANNOTATION(drmemory_stack_register, start, size)
+#define DRMEMORY_ANNOTATE_STACK_DEREGISTER(start)    \
+    DR_ANNOTATION(drmemory_stack_deregister, start)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 DR_DECLARE_ANNOTATION(void, drmemory_dump_memory_layout, (void));
 DR_DECLARE_ANNOTATION(void, drmemory_make_unaddressable, (void *start, size_t len));
+DR_DECLARE_ANNOTATION(void, drmemory_pool_create,
+                      (void *pool, void *base, size_t size));
+DR_DECLARE_ANNOTATION(void, drmemory_pool_alloc,
+                      (void *pool, void *addr, size_t size));
+DR_DECLARE_ANNOTATION(void, drmemory_pool_free, (void *pool, void *addr));
+DR_DECLARE_ANNOTATION(void, drmemory_pool_reset, (void *pool));
+DR_DECLARE_ANNOTATION(void, drmemory_pool_destroy, (void *pool));
+DR_DECLARE_ANNOTATION(void, drmemory_stack_register, (void *start, size_t size));
+DR_DECLARE_ANNOTATION(void, drmemory_stack_deregister, (void *start));
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,395 @@
+/* **********************************************************
+ * Copyright (c) 2014-2015 Google, Inc.  All rights reserved.
+ * Copyright (c) 2010 VMware, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/***************************************************************************
+ * covstream.c: Dr. Memory streaming code coverage (-coverage_stream)
+ *
+ * Each thread appends the blocks it builds to its own buffer with no locking,
+ * and writes a full buffer to the stream as one record under covstream_lock.
+ * Blocks are recorded when they are built, as drcovlib does, so a block costs
+ * nothing once it is in the code cache.  The start pc of each recorded block
+ * is kept in covstream_seen, so a block rebuilt after a flush, or by another
+ * thread with thread-private caches, is dropped before it reaches a buffer.
+ * Module indices come from drmodtrack, which is what drcovlib uses as well,
+ * so the module table it dumps at exit matches the stream's module ids.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drx.h"
+#include "drcovlib.h"
+#include "drmemory.h"
+#include "utils.h"
+#include "covstream.h"
+
+/* Blocks buffered per thread before they are appended to the stream */
+#define COVSTREAM_BUF_ENTRIES 1024
+#define COVSTREAM_SEEN_TABLE_BITS 14
+#define DRCOV_VERSION 2
+#define DRCOV_FLAVOR "drcov"
+
+typedef struct _covstream_thread_t {
+    uint num;
+    covstream_bb_t bbs[COVSTREAM_BUF_ENTRIES];
+    struct _covstream_thread_t *next;
+    struct _covstream_thread_t *prev;
+} covstream_thread_t;
+
+static int tls_idx_covstream = -1;
+/* Protects the stream file, covstream_threads, and covstream_mod_written */
+static void *covstream_lock;
+static covstream_thread_t *covstream_threads;
+static file_t covstream_file = INVALID_FILE;
+static char covstream_path[MAXIMUM_PATH];
+static char covstream_drcov_path[MAXIMUM_PATH];
+/* Blocks written to the stream, which the drcov header needs up front */
+static uint covstream_num_bbs;
+/* Start pcs of the blocks recorded so far */
+static hashtable_t covstream_seen;
+/* Whether each module index has had its record written to the stream */
+static bool *covstream_mod_written;
+static uint covstream_mod_written_size;
+
+/* Caller must hold covstream_lock */
+static void
+covstream_write(const void *buf, size_t size)
+{
+    if (covstream_file == INVALID_FILE)
+        return;
+    if (dr_write_file(covstream_file, buf, size) != (ssize_t) size) {
+        WARN("WARNING: failed to write %s: coverage streaming is disabled\n",
+             covstream_path);
+        dr_close_file(covstream_file);
+        covstream_file = INVALID_FILE;
+    }
+}
+
+static bool
+covstream_open(void)
+{
+    covstream_header_t header;
+    covstream_file = drx_open_unique_appid_file(logsubdir, dr_get_process_id(),
+                                                "drcov", "stream", DR_FILE_ALLOW_LARGE,
+                                                covstream_path,
+                                                BUFFER_SIZE_ELEMENTS(covstream_path));
+    if (covstream_file == INVALID_FILE) {
+        NOTIFY_ERROR("Unable to create a coverage stream file in %s"NL, logsubdir);
+        return false;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COVSTREAM_MAGIC, sizeof(header.magic));
+    header.version = COVSTREAM_VERSION;
+    header.pid = (uint) dr_get_process_id();
+    covstream_write(&header, sizeof(header));
+    LOG(1, "coverage stream: %s\n", covstream_path);
+    return true;
+}
+
+/* Caller must hold covstream_lock */
+static void
+covstream_flush(covstream_thread_t *ct)
+{
+    covstream_record_t rec;
+    if (ct->num == 0)
+        return;
+    rec.type = COVSTREAM_RECORD_BBS;
+    rec.count = ct->num;
+    covstream_write(&rec, sizeof(rec));
+    covstream_write(ct->bbs, ct->num * sizeof(ct->bbs[0]));
+    if (covstream_file != INVALID_FILE)
+        covstream_num_bbs += ct->num;
+    ct->num = 0;
+}
+
+/* Writes the record of module mod_index if it has not been written yet */
+static void
+covstream_module_used(uint mod_index, app_pc mod_base)
+{
+    covstream_record_t rec;
+    covstream_module_t mod;
+    module_data_t *data;
+    /* A racy read is fine: we re-check under the lock */
+    if (mod_index < covstream_mod_written_size && covstream_mod_written[mod_index])
+        return;
+    dr_mutex_lock(covstream_lock);
+    if (mod_index >= covstream_mod_written_size) {
+        uint new_size = (covstream_mod_written_size == 0) ?
+            64 : covstream_mod_written_size * 2;
+        bool *grown;
+        while (new_size <= mod_index)
+            new_size *= 2;
+        grown = (bool *) global_alloc(new_size * sizeof(*grown), HEAPSTAT_MISC);
+        memset(grown, 0, new_size * sizeof(*grown));
+        if (covstream_mod_written != NULL) {
+            memcpy(grown, covstream_mod_written,
+                   covstream_mod_written_size * sizeof(*grown));
+            global_free(covstream_mod_written,
+                        covstream_mod_written_size * sizeof(*grown), HEAPSTAT_MISC);
+        }
+        covstream_mod_written = grown;
+        covstream_mod_written_size = new_size;
+    }
+    if (!covstream_mod_written[mod_index]) {
+        data = dr_lookup_module(mod_base);
+        memset(&mod, 0, sizeof(mod));
+        mod.id = mod_index;
+        mod.base = (uint64)(ptr_uint_t) mod_base;
+        rec.type = COVSTREAM_RECORD_MODULE;
+        rec.count = 1;
+        if (data != NULL) {
+            mod.end = (uint64)(ptr_uint_t) data->end;
+            if (data->full_path != NULL)
+                rec.count += (uint) strlen(data->full_path);
+        }
+        covstream_write(&rec, sizeof(rec));
+        covstream_write(&mod, sizeof(mod));
+        if (rec.count > 1)
+            covstream_write(data->full_path, rec.count);
+        else
+            covstream_write("", 1);
+        if (data != NULL)
+            dr_free_module_data(data);
+        covstream_mod_written[mod_index] = true;
+    }
+    dr_mutex_unlock(covstream_lock);
+}
+
+static dr_emit_flags_t
+covstream_event_bb(void *drcontext, void *tag, instrlist_t *bb, bool for_trace,
+                   bool translating, OUT void **user_data)
+{
+    covstream_thread_t *ct;
+    instr_t *inst;
+    app_pc start = dr_fragment_app_pc(tag), end = start, mod_base;
+    uint mod_index;
+    if (for_trace || translating)
+        return DR_EMIT_DEFAULT;
+    ct = (covstream_thread_t *) drmgr_get_tls_field(drcontext, tls_idx_covstream);
+    if (ct == NULL)
+        return DR_EMIT_DEFAULT;
+    for (inst = instrlist_first_app(bb); inst != NULL; inst = instr_get_next_app(inst)) {
+        app_pc pc = instr_get_app_pc(inst);
+        if (pc != NULL && pc + instr_length(drcontext, inst) > end)
+            end = pc + instr_length(drcontext, inst);
+    }
+    /* Like drcov we only record blocks in modules */
+    if (end == start ||
+        drmodtrack_lookup(drcontext, start, &mod_index, &mod_base) != DRCOVLIB_SUCCESS)
+        return DR_EMIT_DEFAULT;
+    if (!hashtable_add(&covstream_seen, (void *)start, (void *)start))
+        return DR_EMIT_DEFAULT; /* already recorded */
+    covstream_module_used(mod_index, mod_base);
+    ct->bbs[ct->num].start = (uint)(start - mod_base);
+    ct->bbs[ct->num].size = (ushort)(end - start);
+    ct->bbs[ct->num].mod_id = (ushort) mod_index;
+    if (++ct->num == COVSTREAM_BUF_ENTRIES) {
+        dr_mutex_lock(covstream_lock);
+        covstream_flush(ct);
+        dr_mutex_unlock(covstream_lock);
+    }
+    return DR_EMIT_DEFAULT;
+}
+
+static void
+covstream_event_module_unload(void *drcontext, const module_data_t *info)
+{
+    /* A module loaded at the same place later must have its blocks recorded */
+    hashtable_remove_range(&covstream_seen, (void *)info->start, (void *)info->end);
+}
+
+/* Reads exactly size bytes, returning false at the end of the stream or on error */
+static bool
+covstream_read(file_t f, void *buf, size_t size)
+{
+    return dr_read_file(f, buf, size) == (ssize_t) size;
+}
+
+/* Writes the drcov file from the stream, which must be closed */
+static bool
+covstream_merge(void)
+{
+    covstream_header_t header;
+    covstream_record_t rec;
+    covstream_bb_t *buf;
+    uint merged = 0;
+    bool ok = true;
+    file_t in, out;
+    in = dr_open_file(covstream_path, DR_FILE_READ | DR_FILE_ALLOW_LARGE);
+    if (in == INVALID_FILE)
+        return false;
+    if (!covstream_read(in, &header, sizeof(header)) ||
+        memcmp(header.magic, COVSTREAM_MAGIC, sizeof(header.magic)) != 0) {
+        dr_close_file(in);
+        return false;
+    }
+    out = drx_open_unique_appid_file(logsubdir, dr_get_process_id(), "drcov",
+                                     "proc.log", DR_FILE_ALLOW_LARGE,
+                                     covstream_drcov_path,
+                                     BUFFER_SIZE_ELEMENTS(covstream_drcov_path));
+    if (out == INVALID_FILE) {
+        dr_close_file(in);
+        return false;
+    }
+    dr_fprintf(out, "DRCOV VERSION: %d\n", DRCOV_VERSION);
+    dr_fprintf(out, "DRCOV FLAVOR: %s\n", DRCOV_FLAVOR);
+    if (drmodtrack_dump(out) != DRCOVLIB_SUCCESS)
+        ok = false;
+    dr_fprintf(out, "BB Table: %u bbs\n", covstream_num_bbs);
+    buf = (covstream_bb_t *) global_alloc(COVSTREAM_BUF_ENTRIES * sizeof(*buf),
+                                          HEAPSTAT_MISC);
+    while (ok && covstream_read(in, &rec, sizeof(rec))) {
+        if (rec.type == COVSTREAM_RECORD_MODULE) {
+            /* drmodtrack has the full module table */
+            if (!dr_file_seek(in, sizeof(covstream_module_t) + rec.count, DR_SEEK_CUR))
+                ok = false;
+        } else if (rec.type == COVSTREAM_RECORD_BBS &&
+                   rec.count <= COVSTREAM_BUF_ENTRIES &&
+                   covstream_read(in, buf, rec.count * sizeof(*buf))) {
+            if (dr_write_file(out, buf, rec.count * sizeof(*buf)) !=
+                (ssize_t)(rec.count * sizeof(*buf)))
+                ok = false;
+            merged += rec.count;
+        } else
+            ok = false;
+    }
+    global_free(buf, COVSTREAM_BUF_ENTRIES * sizeof(*buf), HEAPSTAT_MISC);
+    dr_close_file(out);
+    dr_close_file(in);
+    LOG(1, "coverage stream: merged %u of %u blocks into %s\n", merged,
+        covstream_num_bbs, covstream_drcov_path);
+    return ok && merged == covstream_num_bbs;
+}
+
+void
+covstream_init(void)
+{
+    if (drmodtrack_init() != DRCOVLIB_SUCCESS)
+        ASSERT(false, "failed to init drmodtrack");
+    tls_idx_covstream = drmgr_register_tls_field();
+    ASSERT(tls_idx_covstream > -1, "unable to reserve TLS slot");
+    covstream_lock = dr_mutex_create();
+    hashtable_init(&covstream_seen, COVSTREAM_SEEN_TABLE_BITS, HASH_INTPTR,
+                   false/*!strdup*/);
+    if (!drmgr_register_bb_instrumentation_event(covstream_event_bb, NULL, NULL) ||
+        !drmgr_register_module_unload_event(covstream_event_module_unload))
+        ASSERT(false, "failed to register coverage stream events");
+    covstream_open();
+}
+
+const char *
+covstream_exit(void)
+{
+    covstream_thread_t *ct, *next;
+    const char *res = NULL;
+    dr_mutex_lock(covstream_lock);
+    /* threads still alive at exit get no exit event */
+    for (ct = covstream_threads; ct != NULL; ct = next) {
+        next = ct->next;
+        covstream_flush(ct);
+        global_free(ct, sizeof(*ct), HEAPSTAT_MISC);
+    }
+    covstream_threads = NULL;
+    dr_mutex_unlock(covstream_lock);
+    if (covstream_file != INVALID_FILE) {
+        dr_close_file(covstream_file);
+        covstream_file = INVALID_FILE;
+        /* On failure the stream is kept for an offline merge */
+        if (covstream_merge()) {
+            dr_delete_file(covstream_path);
+            res = covstream_drcov_path;
+        } else {
+            WARN("WARNING: failed to merge coverage stream %s\n", covstream_path);
+            NOTIFY_ERROR("Unable to write the code coverage file; the raw coverage"
+                         " stream is in %s"NL, covstream_path);
+        }
+    }
+    drmgr_unregister_bb_instrumentation_event(covstream_event_bb);
+    drmgr_unregister_module_unload_event(covstream_event_module_unload);
+    hashtable_delete(&covstream_seen);
+    if (covstream_mod_written != NULL) {
+        global_free(covstream_mod_written,
+                    covstream_mod_written_size * sizeof(*covstream_mod_written),
+                    HEAPSTAT_MISC);
+        covstream_mod_written = NULL;
+    }
+    if (drmodtrack_exit() != DRCOVLIB_SUCCESS)
+        ASSERT(false, "failed to exit drmodtrack");
+    dr_mutex_destroy(covstream_lock);
+    drmgr_unregister_tls_field(tls_idx_covstream);
+    return res;
+}
+
+void
+covstream_fork_init(void *drcontext)
+{
+    covstream_thread_t *ct;
+    /* The child gets its own stream in its own log directory.  Blocks built
+     * before the fork are in the parent's stream, so the child keeps
+     * covstream_seen and drops whatever was still buffered.
+     */
+    if (covstream_file != INVALID_FILE)
+        dr_close_file(covstream_file);
+    covstream_file = INVALID_FILE;
+    covstream_num_bbs = 0;
+    if (covstream_mod_written != NULL) {
+        memset(covstream_mod_written, 0,
+               covstream_mod_written_size * sizeof(*covstream_mod_written));
+    }
+    for (ct = covstream_threads; ct != NULL; ct = ct->next)
+        ct->num = 0;
+    covstream_open();
+}
+
+void
+covstream_thread_init(void *drcontext)
+{
+    covstream_thread_t *ct = (covstream_thread_t *)
+        global_alloc(sizeof(*ct), HEAPSTAT_MISC);
+    ct->num = 0;
+    ct->prev = NULL;
+    dr_mutex_lock(covstream_lock);
+    ct->next = covstream_threads;
+    if (covstream_threads != NULL)
+        covstream_threads->prev = ct;
+    covstream_threads = ct;
+    dr_mutex_unlock(covstream_lock);
+    drmgr_set_tls_field(drcontext, tls_idx_covstream, (void *)ct);
+}
+
+void
+covstream_thread_exit(void *drcontext)
+{
+    covstream_thread_t *ct = (covstream_thread_t *)
+        drmgr_get_tls_field(drcontext, tls_idx_covstream);
+    if (ct == NULL)
+        return;
+    drmgr_set_tls_field(drcontext, tls_idx_covstream, NULL);
+    dr_mutex_lock(covstream_lock);
+    covstream_flush(ct);
+    if (ct->prev != NULL)
+        ct->prev->next = ct->next;
+    else
+        covstream_threads = ct->next;
+    if (ct->next != NULL)
+        ct->next->prev = ct->prev;
+    dr_mutex_unlock(covstream_lock);
+    global_free(ct, sizeof(*ct), HEAPSTAT_MISC);
+}
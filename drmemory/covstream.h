@@ -0,0 +1,97 @@
+/* **********************************************************
+ * Copyright (c) 2012-2014 Google, Inc.  All rights reserved.
+ * Copyright (c) 2010 VMware, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/***************************************************************************
+ * covstream.h: Dr. Memory streaming code coverage (-coverage_stream)
+ *
+ * In place of drcovlib, which keeps every block until exit, each thread
+ * buffers the blocks it builds and appends them to a stream file in the log
+ * directory whenever its buffer fills.  Each block is recorded the first time
+ * it is built; rebuilds of a block are dropped with no further cost.  At exit
+ * the stream is merged into a standard drcov file and removed.  If the
+ * process is killed the stream is left behind, holding all but the blocks
+ * still in the threads' buffers, along with the modules they are in.
+ *
+ * The stream starts with a covstream_header_t.  It is followed by records,
+ * each a covstream_record_t followed by:
+ *   COVSTREAM_RECORD_MODULE: a covstream_module_t and then the module's path,
+ *     with its terminating null, of count bytes.  A module's record precedes
+ *     every block that refers to it.
+ *   COVSTREAM_RECORD_BBS: count covstream_bb_t, in drcov's block format.
+ * All fields are laid out so that the format is identical for 32-bit and
+ * 64-bit writers.
+ */
+
+#ifndef _COVSTREAM_H_
+#define _COVSTREAM_H_ 1
+
+#include "dr_api.h"
+
+#define COVSTREAM_MAGIC "DrMCovS"
+/* Must be bumped whenever the structures below change */
+#define COVSTREAM_VERSION 1
+
+typedef struct _covstream_header_t {
+    char magic[8];
+    uint version;
+    uint pid;
+} covstream_header_t;
+
+enum {
+    COVSTREAM_RECORD_MODULE = 1,
+    COVSTREAM_RECORD_BBS    = 2,
+};
+
+typedef struct _covstream_record_t {
+    uint type;
+    uint count;
+} covstream_record_t;
+
+typedef struct _covstream_module_t {
+    uint id;    /* as used by mod_id in covstream_bb_t and in the drcov file */
+    uint padding;
+    uint64 base;
+    uint64 end;
+} covstream_module_t;
+
+typedef struct _covstream_bb_t {
+    uint start; /* offset from the module base */
+    ushort size;
+    ushort mod_id;
+} covstream_bb_t;
+
+void
+covstream_init(void);
+
+/* Merges the stream into the drcov file and returns its path, or NULL. */
+const char *
+covstream_exit(void);
+
+void
+covstream_fork_init(void *drcontext);
+
+void
+covstream_thread_init(void *drcontext);
+
+void
+covstream_thread_exit(void *drcontext);
+
+#endif /* _COVSTREAM_H_ */
@@ -67,6 +67,8 @@
 #include "alloc.h"
 #include "heap.h"
 #include "replace.h"
+#include "native_summary.h"
+#include "heap_profile.h"
 #include "leak.h"
 #include "stack.h"
 #include "perturb.h"
@@ -74,6 +76,8 @@
 #include "pattern.h"
 #include "frontend.h"
 #include "fuzzer.h"
+#include "prof.h"
+#include "covstream.h"
 #ifdef WINDOWS
 # include "handlecheck.h"
 #endif /* WINDOWS */
@@ -86,6 +90,7 @@ file_t f_results = INVALID_FILE;
 file_t f_missing_symbols;
 file_t f_suppress;
 file_t f_potential;
+file_t f_results_jsonl = INVALID_FILE;
 static uint num_threads;
 
 #if defined(__DATE__) && defined(__TIME__)
@@ -98,6 +103,12 @@ static const char * const build_date = "unknown";
 #define KNOWN_TABLE_HASH_BITS 8
 static hashtable_t known_table;
 
+#ifdef WINDOWS
+/* i#537: TEBs of live threads, so that a freed TLS slot can be reset in all of them */
+#define TEB_TABLE_HASH_BITS 6
+static hashtable_t teb_table;
+#endif
+
 static void
 set_thread_initial_structures(void *drcontext);
 
@@ -112,6 +123,14 @@ event_context_init(void *drcontext, bool new_depth);
 static void
 event_context_exit(void *drcontext, bool thread_exit);
 
+static void
+live_stats_exit_event(void);
+
+#ifdef WINDOWS
+static void
+preload_flush(void);
+#endif
+
 /***************************************************************************
  * OPTIONS
  */
@@ -204,12 +223,16 @@ void
 dump_statistics(void)
 {
     int i;
+    stats_fold();
     dr_fprintf(f_global, "Statistics:\n");
     dr_fprintf(f_global, "nudges: %d\n", num_nudges);
     dr_fprintf(f_global, "basic blocks: %d\n", num_bbs);
+    dr_fprintf(f_global, "self-loop bbs: %6u, memrefs in them: %8u\n",
+               self_loop_bbs, self_loop_memrefs);
     dr_fprintf(f_global, "adjust_esp:%10u slow; %10u fast\n", adjust_esp_executions,
                adjust_esp_fastpath);
-    dr_fprintf(f_global, "slow_path invocations: %10u\n", slowpath_executions);
+    dr_fprintf(f_global, "slow_path invocations: %10u, decode cache hits: %10u\n",
+               slowpath_executions, slowpath_decode_hits);
 #ifdef X86
     dr_fprintf(f_global, "med_path invocations: %10u, fast movs: %10u, fast cmps: %10u\n",
                medpath_executions, movs4_med_fast, cmps1_med_fast);
@@ -217,6 +240,8 @@ dump_statistics(void)
                movs4_src_unaligned, movs4_dst_unaligned, movs4_src_undef);
     dr_fprintf(f_global, "cmps1: src undef: %10u\n",
                cmps1_src_undef);
+    dr_fprintf(f_global, "wide memrefs: fast: %10u\n", wide_med_fast);
+    dr_fprintf(f_global, "rep string bulk: %10u\n", repstr_bulk);
 #endif
     dr_fprintf(f_global, "reads:  slow: %8u, fast: %8u, fast4: %8u, total: %8u\n",
                read_slowpath, read_fastpath, read4_fastpath,
@@ -234,6 +259,8 @@ dump_statistics(void)
                slow_instead_of_fast, slowpath_unaligned, slowpath_8_at_border);
     dr_fprintf(f_global, "addr exceptions: header: %7u, tls: %5u, alloca: %5u\n",
                heap_header_exception, tls_exception, alloca_exception);
+    dr_fprintf(f_global, "tls slots marked defined: %5u, reset on free: %5u\n",
+               tls_slot_defined, tls_slot_reset);
     dr_fprintf(f_global, "more addr exceptions: ld DR: %5u, cpp DR: %5u\n",
                loader_DRlib_exception, cppexcept_DRlib_exception);
     dr_fprintf(f_global, "addr cont'd: strlen: %5u, strcpy: %5u, str/mem: %5u\n",
@@ -256,16 +283,36 @@ dump_statistics(void)
                num_faults);
     dr_fprintf(f_global, "faults to transition to slowpath: %6u\n",
                num_slowpath_faults);
+    if (options.pattern != 0) {
+        dr_fprintf(f_global, "pattern false positives: cached: %8u, looked up: %8u\n",
+                   pattern_fp_cache_hits, pattern_fp_cache_misses);
+        dr_fprintf(f_global, "pattern checks instrumented without aflags: %8u\n",
+                   pattern_flag_free_checks);
+    }
     dr_fprintf(f_global, "app mallocs: %8u, frees: %8u, large mallocs: %6u\n",
                num_mallocs, num_frees, num_large_mallocs);
-    dr_fprintf(f_global, "unique malloc stacks: %8u\n", alloc_stack_count);
+    dr_fprintf(f_global, "malloc entry slabs: %6u\n", malloc_entry_slabs_allocated);
+    if (options.lazy_alloc_syms) {
+        dr_fprintf(f_global, "modules with deferred alloc search: %6u, searched: %6u\n",
+                   num_lazy_modules, num_lazy_searches);
+    }
+    dr_fprintf(f_global, "unique malloc stacks: %8u, cache hits: %8u\n",
+               alloc_stack_count, alloc_stack_cache_hits);
+    if (options.delay_frees_stack) {
+        dr_fprintf(f_global, "free stacks recorded: %8u, built: %6u, lost: %6u\n",
+                   free_stack_count, free_stack_built, free_stack_lost);
+    }
     callstack_dump_statistics(f_global);
     dr_fprintf(f_global, "symbol lookups: %6u cached %6u, searches: %6u cached %6u\n",
                symbol_lookups, symbol_lookup_cache_hits,
                symbol_searches, symbol_search_cache_hits);
     dr_fprintf(f_global, "symbol address lookups: %6u\n", symbol_address_lookups);
-    dr_fprintf(f_global, "stack swaps: %8u, triggers: %8u\n",
-               stack_swaps, stack_swap_triggers);
+    dr_fprintf(f_global, "bulk replaced memsets: %6u, memcpys: %6u\n",
+               replace_bulk_sets, replace_bulk_copies);
+    dr_fprintf(f_global, "native summary calls: %8u, slow checks: %6u\n",
+               native_summary_calls, native_summary_slow_checks);
+    dr_fprintf(f_global, "stack swaps: %8u, triggers: %8u, registered: %8u\n",
+               stack_swaps, stack_swap_triggers, stack_swaps_registered);
     dr_fprintf(f_global, "push addr tot: %8u heap: %6u mmap: %6u\n",
                push_addressable, push_addressable_heap, push_addressable_mmap);
     dr_fprintf(f_global, "delayed free bytes: %8u\n", delayed_free_bytes);
@@ -278,8 +325,8 @@ dump_statistics(void)
                "\t%6u not:slowpaths, %6u not:unalign, %6u not:mem2mem, %6u not:offs\n",
                xl8_not_shared_slowpaths, xl8_not_shared_unaligned,
                xl8_not_shared_mem2mem, xl8_not_shared_offs);
-    dr_fprintf(f_global, "\t%6u not:scratch conflict\n",
-               xl8_not_shared_scratch_conflict);
+    dr_fprintf(f_global, "\t%6u not:scratch conflict, %6u not:bb end\n",
+               xl8_not_shared_scratch_conflict, xl8_not_shared_bb_end);
     dr_fprintf(f_global, "\t%6u instrs slowpath, %6u count slowpath\n",
                xl8_shared_slowpath_instrs, xl8_shared_slowpath_count);
 #ifdef WINDOWS
@@ -292,6 +339,12 @@ dump_statistics(void)
                midchunk_postsize_ptrs, midchunk_postnew_ptrs,
                midchunk_postinheritance_ptrs, midchunk_string_ptrs);
     dr_fprintf(f_global, "strings not pointers: %5u\n", strings_not_pointers);
+    dr_fprintf(f_global, "leak scan blocks filtered: %9u\n", scan_blocks_filtered);
+    dr_fprintf(f_global, "leak scan read-only regions reused: %9u\n",
+               scan_ro_regions_reused);
+#ifdef LINUX
+    dr_fprintf(f_global, "leak scan pages reused: %9u\n", scan_pages_reused);
+#endif
 #ifdef WINDOWS
     if (options.check_handle_leaks)
         handlecheck_dump_statistics(f_global);
@@ -303,6 +356,10 @@ dump_statistics(void)
         dr_fprintf(f_global, "zeroing loop aborts: %6u fault, %6u thresh\n",
                    zero_loop_aborts_fault, zero_loop_aborts_thresh);
     }
+    if (options.zero_stack_lazy) {
+        dr_fprintf(f_global, "lazy stack zeroing: %6u passes, %9u bytes\n",
+                   zero_stack_lazy_passes, zero_stack_lazy_bytes);
+    }
     dr_fprintf(f_global, "pcaches loaded: %3u, base mismatch: %3u, written: %3u\n",
                pcaches_loaded, pcaches_mismatch, pcaches_written);
 
@@ -417,11 +474,20 @@ close_file(file_t f)
 
 #define dr_close_file DO_NOT_USE_dr_close_file
 
+#ifdef UNIX
+/* Whether this process is a fork child, for reporting shadow sharing at exit */
+static bool forked_child;
+#endif
+
 static void
 event_exit(void)
 {
     LOGF(2, f_global, "in event_exit\n");
 
+#ifdef WINDOWS
+    if (options.preload_symbols && options.preload_symbols_threads > 0)
+        preload_flush();
+#endif
     check_reachability(true/*at exit*/);
 
     if (options.pause_at_exit)
@@ -430,7 +496,25 @@ event_exit(void)
 #ifdef STATISTICS
     dump_statistics();
 #endif
+    slowpath_profile_dump(f_global);
+    prof_dump(f_global);
+    if (options.heap_profile_sample_rate > 0)
+        heap_profile_dump("exit");
+    live_stats_exit_event();
+#ifdef LINUX
+    if (forked_child && options.shadowing) {
+        uint resident, exclusive;
+        if (shadow_count_private_pages(&resident, &exclusive)) {
+            ELOGF(1, f_global, "shadow pages after fork: %u resident, %u copied or"
+                  " newly written, %u still shared with the parent\n",
+                  resident, exclusive, resident - exclusive);
+        }
+    }
+#endif
 
+    slowpath_profile_exit();
+    slowpath_decode_cache_exit();
+    prof_exit();
     instrument_exit();
 
     if (options.perturb)
@@ -450,6 +534,9 @@ event_exit(void)
             ASSERT(false, "fail to exit Umbra");
     }
     hashtable_delete(&known_table);
+#ifdef WINDOWS
+    hashtable_delete(&teb_table);
+#endif
 
     if (!options.perturb_only)
         report_exit();
@@ -458,13 +545,17 @@ event_exit(void)
     utils_exit();
 
     if (options.coverage) {
-        const char *covfile;
-        if (drcovlib_logfile(NULL, &covfile) == DRCOVLIB_SUCCESS) {
+        const char *covfile = NULL;
+        if (options.coverage_stream)
+            covfile = covstream_exit();
+        else if (drcovlib_logfile(NULL, &covfile) != DRCOVLIB_SUCCESS)
+            covfile = NULL;
+        if (covfile != NULL) {
             ELOGF(0, f_results, "Code coverage raw data: %s"NL, covfile);
             NOTIFY_COND(options.summary, f_global, "Code coverage raw data: %s"NL,
                         covfile);
         }
-        if (drcovlib_exit() != DRCOVLIB_SUCCESS)
+        if (!options.coverage_stream && drcovlib_exit() != DRCOVLIB_SUCCESS)
             ASSERT(false, "failed to exit drcovlib");
     }
 
@@ -488,6 +579,8 @@ event_exit(void)
     close_file(f_missing_symbols);
     close_file(f_suppress);
     close_file(f_potential);
+    if (f_results_jsonl != INVALID_FILE)
+        close_file(f_results_jsonl);
     dr_fprintf(f_global, "LOG END\n");
     close_file(f_global);
 
@@ -557,6 +650,130 @@ create_thread_logfile(void *drcontext)
     utils_thread_set_file(drcontext, f);
 }
 
+/***************************************************************************
+ * LIVE STATS (-live_stats_interval)
+ *
+ * A sideline thread appends one line of counters every interval to
+ * live_stats.log in the log directory, rotating it to live_stats.log.old
+ * once it grows past LIVE_STATS_MAX_BYTES.  The work happens off the app
+ * threads and does not depend on the app hitting the slowpath, unlike
+ * -stats_dump_interval.
+ */
+
+#define LIVE_STATS_FNAME "live_stats.log"
+#define LIVE_STATS_MAX_BYTES (4*1024*1024)
+
+static file_t f_live_stats = INVALID_FILE;
+static size_t live_stats_written;
+static volatile bool live_stats_exit;
+
+static bool
+live_stats_heap_cb(byte *start, byte *end, uint flags
+                   _IF_WINDOWS(HANDLE heap), void *data)
+{
+    *(size_t *)data += end - start;
+    return true;
+}
+
+/* Sums the memory DR itself allocated, including its code caches */
+static size_t
+live_stats_dr_bytes(void)
+{
+    byte *pc = NULL, *region_end;
+    dr_mem_info_t info;
+    size_t bytes = 0;
+    while (dr_query_memory_ex(pc, &info)) {
+        region_end = info.base_pc + info.size;
+        if (info.type != DR_MEMTYPE_FREE && dr_memory_is_dr_internal(info.base_pc))
+            bytes += info.size;
+        if (region_end <= pc) /* overflow */
+            break;
+        pc = region_end;
+    }
+    return bytes;
+}
+
+static void
+live_stats_rotate(void)
+{
+    char cur[MAXIMUM_PATH], old[MAXIMUM_PATH];
+    dr_snprintf(cur, BUFFER_SIZE_ELEMENTS(cur), "%s%c%s",
+                logsubdir, DIRSEP, LIVE_STATS_FNAME);
+    NULL_TERMINATE_BUFFER(cur);
+    dr_snprintf(old, BUFFER_SIZE_ELEMENTS(old), "%s.old", cur);
+    NULL_TERMINATE_BUFFER(old);
+    dr_close_file(f_live_stats);
+    if (!dr_rename_file(cur, old, true/*replace*/))
+        LOG(1, "WARNING: unable to rotate %s\n", cur);
+    f_live_stats = open_logfile(LIVE_STATS_FNAME, false, -1);
+    live_stats_written = 0;
+}
+
+static void
+live_stats_write(void)
+{
+    char buf[512];
+    size_t sofar = 0;
+    ssize_t len;
+    size_t heap_bytes = 0;
+    heap_region_iterate(live_stats_heap_cb, &heap_bytes);
+    BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len, "time=");
+    print_timestamp_elapsed(buf, BUFFER_SIZE_ELEMENTS(buf), &sofar);
+    BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len,
+             " threads_seen=%u app_heap_kb=%u dr_kb=%u", num_threads,
+             (uint)(heap_bytes / 1024), (uint)(live_stats_dr_bytes() / 1024));
+    if (options.shadowing) {
+        BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len, " shadow_kb=%u",
+                 (uint)(shadow_memory_footprint() / 1024));
+    }
+#ifdef STATISTICS
+    stats_fold();
+    BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len,
+             " tool_heap_kb=%u bbs=%u slowpaths=%u mallocs=%u frees=%u",
+             (uint)(heap_usage_total() / 1024), num_bbs, slowpath_executions,
+             num_mallocs, num_frees);
+#endif
+    BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len, "\n");
+    if (live_stats_written + sofar > LIVE_STATS_MAX_BYTES)
+        live_stats_rotate();
+    dr_write_file(f_live_stats, buf, sofar);
+    live_stats_written += sofar;
+}
+
+static void
+live_stats_thread(void *arg)
+{
+    while (!live_stats_exit) {
+        dr_sleep(options.live_stats_interval);
+        live_stats_write();
+    }
+}
+
+static void
+live_stats_init(void)
+{
+    if (options.live_stats_interval == 0)
+        return;
+    f_live_stats = open_logfile(LIVE_STATS_FNAME, false, -1);
+    if (!dr_create_client_thread(live_stats_thread, NULL)) {
+        LOG(1, "WARNING: unable to create live stats thread\n");
+        dr_close_file(f_live_stats);
+        f_live_stats = INVALID_FILE;
+    }
+}
+
+static void
+live_stats_exit_event(void)
+{
+    if (f_live_stats == INVALID_FILE)
+        return;
+    /* DR has already terminated the thread, so the file is ours (i#297) */
+    live_stats_exit = true;
+    live_stats_write();
+    dr_close_file(f_live_stats);
+    f_live_stats = INVALID_FILE;
+}
+
 static void
 event_thread_init(void *drcontext)
 {
@@ -572,6 +789,11 @@ event_thread_init(void *drcontext)
     create_thread_logfile(drcontext);
     LOGPT(2, PT_GET(drcontext), "in event_thread_init()\n");
     instrument_thread_init(drcontext);
+    slowpath_profile_thread_init(drcontext);
+    slowpath_decode_cache_thread_init(drcontext);
+    prof_thread_init(drcontext);
+    if (options.coverage_stream)
+        covstream_thread_init(drcontext);
     if (options.shadowing && !go_native) {
         /* For 1st thread we can't get mcontext so we wait for 1st bb.
          * For subsequent we can.  Xref i#117/PR 395156.
@@ -586,14 +808,20 @@ event_thread_init(void *drcontext)
     if (options.shadowing)
         shadow_thread_init(drcontext);
     syscall_thread_init(drcontext);
+    alloc_drmem_thread_init(drcontext);
+    if (options.pattern != 0)
+        pattern_thread_init(drcontext);
     if (!options.perturb_only)
         report_thread_init(drcontext);
     if (options.perturb)
-        perturb_thread_init();
+        perturb_thread_init(drcontext);
 
     if (options.native_until_thread > 0 || options.show_all_threads)
         local_count = dr_atomic_add32_return_sum(&thread_count, 1);
 
+    if (options.startup_addr_only && options.shadowing && !first_thread)
+        instru_end_startup_phase("a new thread");
+
     if (options.show_all_threads && !first_thread) {
         dr_mcontext_t mc;
 #ifdef WINDOWS
@@ -670,7 +898,7 @@ event_thread_exit(void *drcontext)
     LOGPT(2, PT_GET(drcontext), "in event_thread_exit() %d\n",
           dr_get_thread_id(drcontext));
     if (options.perturb)
-        perturb_thread_exit();
+        perturb_thread_exit(drcontext);
     if (!options.perturb_only)
         report_thread_exit(drcontext);
     if (options.thread_logs) {
@@ -685,14 +913,23 @@ event_thread_exit(void *drcontext)
         tls_drmem_t *pt = (tls_drmem_t *) drmgr_get_tls_field(drcontext, tls_idx_drmem);
         TEB *teb = pt->teb;
         ASSERT(teb != NULL, "cannot determine TEB for exiting thread");
+        hashtable_remove(&teb_table, (void *)teb);
         shadow_set_range((app_pc)teb, (app_pc)teb + sizeof(*teb), SHADOW_UNADDRESSABLE);
         /* pass cached teb to leak scan (i#547) in place we won't free */
         set_thread_tls_value(drcontext, SPILL_SLOT_1, (ptr_uint_t)teb);
     }
 #endif
+    alloc_drmem_thread_exit(drcontext);
+    if (options.pattern != 0)
+        pattern_thread_exit(drcontext);
     syscall_thread_exit(drcontext);
     if (options.shadowing)
         shadow_thread_exit(drcontext);
+    slowpath_profile_thread_exit(drcontext);
+    slowpath_decode_cache_thread_exit(drcontext);
+    prof_thread_exit(drcontext);
+    if (options.coverage_stream)
+        covstream_thread_exit(drcontext);
     instrument_thread_exit(drcontext);
     utils_thread_exit(drcontext);
     /* with PR 536058 we do have dcontext in exit event so indicate explicitly
@@ -1121,6 +1358,34 @@ set_teb_initial_shadow(TEB *teb)
     set_initial_range((app_pc)teb + offsetof(TEB, TlsLinks),
                       (app_pc)teb + sizeof(*teb));
 }
+
+/* i#537: kernel32!TlsFree zeroes the slot in every thread.  The slowpath
+ * marks an allocated TEB slot defined on its first access, so here we make
+ * the slot unaddressable again in all threads.
+ */
+void
+teb_tls_slot_freed(uint slot)
+{
+    uint i;
+    if (!options.shadowing || !options.check_tls || !options.check_uninitialized)
+        return;
+    /* expansion slots are not marked so there is nothing to reset */
+    if (slot >= 64)
+        return;
+    LOG(2, "TLS slot %d freed: resetting its shadow\n", slot);
+    hashtable_lock(&teb_table);
+    for (i = 0; i < HASHTABLE_SIZE(teb_table.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = teb_table.table[i]; he != NULL; he = he->next) {
+            TEB *teb = (TEB *) he->key;
+            app_pc slot_start = (app_pc)&teb->TlsSlots[slot];
+            shadow_set_range(slot_start, slot_start + sizeof(void*),
+                             SHADOW_UNADDRESSABLE);
+            STATS_INC(tls_slot_reset);
+        }
+    }
+    hashtable_unlock(&teb_table);
+}
 #endif
 
 /* Called for 1st thread at 1st bb (b/c can't get mcontext at thread init:
@@ -1152,6 +1417,7 @@ set_thread_initial_structures(void *drcontext)
      */
     LOG(2, "setting initial structures for thread w/ TEB "PFX"\n", teb);
     set_teb_initial_shadow(teb);
+    hashtable_add(&teb_table, (void *)teb, (void *)teb);
 
     if (is_wow64_process()) {
         /* Add unknown wow64-only structure TEB->0xf70->0x14d0
@@ -1508,6 +1774,8 @@ create_global_logfile(void)
         f_suppress = open_logfile("suppress.txt", false, -1);
         f_potential = open_logfile(RESULTS_POTENTIAL_FNAME, false, -1);
         print_version(f_potential, true);
+        if (options.results_jsonl)
+            f_results_jsonl = open_logfile(RESULTS_JSONL_FNAME, false, -1);
     }
 }
 
@@ -1534,6 +1802,14 @@ event_fork(void *drcontext)
 
     if (options.perturb)
         perturb_fork_init();
+    if (options.coverage_stream)
+        covstream_fork_init(drcontext);
+
+    /* Nothing here may touch shadow memory: the child shares all of the
+     * parent's shadow copy-on-write, and with many workers any eager write
+     * here would duplicate it per child.
+     */
+    forked_child = true;
 }
 
 static dr_signal_action_t
@@ -1560,12 +1836,14 @@ nudge_leak_scan(void *drcontext)
     /* PR 474554: use nudge/signal for mid-run summary/output */
     static int nudge_count;
     int local_count = atomic_add32_return_sum(&nudge_count, 1);
+    /* Keep earlier reports ahead of the nudge's */
+    report_flush();
     ELOGF(0, f_results, NL"==========================================================================="NL"SUMMARY AFTER NUDGE #%d:"NL, local_count);
     ELOGF(0, f_potential, NL"==========================================================================="NL"SUMMARY AFTER NUDGE #%d:"NL, local_count);
 #ifdef STATISTICS
     dump_statistics();
 #endif
-    STATS_INC(num_nudges);
+    STATS_GLOBAL_INC(num_nudges);
     if (options.perturb_only)
         return;
 #ifdef WINDOWS
@@ -1575,12 +1853,17 @@ nudge_leak_scan(void *drcontext)
     if (options.count_leaks || options.check_leaks || options.leak_scan) {
         report_leak_stats_checkpoint();
         check_reachability(false/*!at exit*/);
+        if (options.leak_growth)
+            report_leak_growth();
     }
     /* Provide a summary even if not checking for leaks */
     report_summary();
     if (options.count_leaks || options.check_leaks || options.leak_scan) {
         report_leak_stats_revert();
     }
+    prof_dump(f_global);
+    if (options.heap_profile_sample_rate > 0)
+        heap_profile_dump("nudge");
     ELOGF(0, f_global, "NUDGE\n");
     ELOGF(0, f_results, NL"==========================================================================="NL);
     ELOGF(0, f_potential, NL"==========================================================================="NL);
@@ -1638,6 +1921,150 @@ event_soft_kill(process_id_t pid, int exit_code)
     return false;
 }
 
+#ifdef WINDOWS
+/***************************************************************************
+ * SYMBOL PRELOADING
+ */
+
+/* For -preload_symbols, loading a module's debug info can take far longer than
+ * the rest of our module load processing, yet nothing at load time needs it:
+ * so when -preload_symbols_threads is non-zero we let sideline threads load it
+ * rather than blocking the app thread that loaded the module.  Whatever is
+ * still pending at exit is completed before the leak scan, which is what
+ * needs the symbols (i#723).
+ */
+typedef struct _preload_entry_t {
+    module_data_t *mod;
+    struct _preload_entry_t *next;
+} preload_entry_t;
+
+/* Protects the queue and preload_busy */
+static void *preload_lock;
+/* Signaled while the queue is non-empty or we are exiting */
+static void *preload_event;
+static preload_entry_t *preload_head, *preload_tail;
+static uint preload_busy;
+static volatile bool preload_exit;
+
+static void
+preload_module_symbols(const char *path)
+{
+    /* i#723: We can't load symbols for modules with dbghelp during shutdown
+     * on Vista, so we pre-load everything.  This wastes memory and is
+     * fragile since drsyms doesn't promise to cache pdbs forever, but for
+     * now it allows us to symbolize leak callstacks.
+     */
+    drsym_info_t syminfo;
+    syminfo.struct_size = sizeof(syminfo);
+    syminfo.name = NULL;  /* Don't need name. */
+    syminfo.file = NULL;
+    drsym_lookup_address(path, 0, &syminfo, DRSYM_DEFAULT_FLAGS);
+}
+
+/* Returns the next queued module, marking the caller busy, or NULL */
+static preload_entry_t *
+preload_dequeue(void)
+{
+    preload_entry_t *e;
+    dr_mutex_lock(preload_lock);
+    e = preload_head;
+    if (e != NULL) {
+        preload_head = e->next;
+        if (preload_head == NULL)
+            preload_tail = NULL;
+        preload_busy++;
+    } else if (!preload_exit)
+        dr_event_reset(preload_event);
+    dr_mutex_unlock(preload_lock);
+    return e;
+}
+
+static void
+preload_process(preload_entry_t *e)
+{
+    LOG(2, "preloading symbols for %s\n", e->mod->full_path);
+    preload_module_symbols(e->mod->full_path);
+    /* Match the synchronous path, which frees at the end of the module event */
+    drsym_free_resources(e->mod->full_path);
+    dr_free_module_data(e->mod);
+    global_free(e, sizeof(*e), HEAPSTAT_MISC);
+    dr_mutex_lock(preload_lock);
+    preload_busy--;
+    dr_mutex_unlock(preload_lock);
+}
+
+static void
+preload_thread(void *arg)
+{
+    /* We must not be suspended holding the drsyms lock, which the exit-time
+     * leak scan needs.
+     */
+    dr_client_thread_set_suspendable(false);
+    while (!preload_exit) {
+        preload_entry_t *e;
+        dr_event_wait(preload_event);
+        while ((e = preload_dequeue()) != NULL)
+            preload_process(e);
+    }
+}
+
+static void
+preload_init(void)
+{
+    uint i;
+    preload_lock = dr_mutex_create();
+    preload_event = dr_event_create();
+    for (i = 0; i < options.preload_symbols_threads; i++) {
+        if (!dr_create_client_thread(preload_thread, NULL)) {
+            /* We'll do the loads at exit instead */
+            LOG(1, "WARNING: unable to create symbol preload thread\n");
+            break;
+        }
+    }
+}
+
+static void
+preload_queue_module(const module_data_t *info)
+{
+    preload_entry_t *e = (preload_entry_t *) global_alloc(sizeof(*e), HEAPSTAT_MISC);
+    e->mod = dr_copy_module_data(info);
+    e->next = NULL;
+    dr_mutex_lock(preload_lock);
+    if (preload_tail == NULL)
+        preload_head = e;
+    else
+        preload_tail->next = e;
+    preload_tail = e;
+    dr_event_signal(preload_event);
+    dr_mutex_unlock(preload_lock);
+}
+
+/* Completes all pending loads and stops the sideline threads */
+static void
+preload_flush(void)
+{
+    preload_entry_t *e;
+    uint busy;
+    while ((e = preload_dequeue()) != NULL)
+        preload_process(e);
+    do {
+        /* Wait for a sideline thread's in-progress load */
+        dr_mutex_lock(preload_lock);
+        busy = preload_busy;
+        dr_mutex_unlock(preload_lock);
+        if (busy > 0)
+            dr_thread_yield();
+    } while (busy > 0);
+    dr_mutex_lock(preload_lock);
+    preload_exit = true;
+    dr_event_signal(preload_event);
+    dr_mutex_unlock(preload_lock);
+    /* As with the leak scan helpers, DR terminates the sideline threads, so we
+     * leave the lock and event in place for them.
+     */
+}
+#endif /* WINDOWS */
+
 static void
 event_module_load(void *drcontext, const module_data_t *info, bool loaded)
 {
@@ -1667,22 +2094,18 @@ event_module_load(void *drcontext, const module_data_t *info, bool loaded)
 #endif
 #ifdef WINDOWS
     if (options.preload_symbols) {
-        /* i#723: We can't load symbols for modules with dbghelp during shutdown
-         * on Vista, so we pre-load everything.  This wastes memory and is
-         * fragile since drsyms doesn't promise to cache pdbs forever, but for
-         * now it allows us to symbolize leak callstacks.
-         */
-        drsym_info_t syminfo;
-        syminfo.struct_size = sizeof(syminfo);
-        syminfo.name = NULL;  /* Don't need name. */
-        syminfo.file = NULL;
-        drsym_lookup_address(info->full_path, 0, &syminfo, DRSYM_DEFAULT_FLAGS);
+        if (options.preload_symbols_threads > 0)
+            preload_queue_module(info);
+        else
+            preload_module_symbols(info->full_path);
     }
 #endif /* WINDOWS */
     if (!options.perturb_only)
         callstack_module_load(drcontext, info, loaded);
-    if (INSTRUMENT_MEMREFS())
+    if (INSTRUMENT_MEMREFS()) {
         replace_module_load(drcontext, info, loaded);
+        native_summary_module_load(drcontext, info, loaded);
+    }
     syscall_module_load(drcontext, info, loaded); /* must precede alloc_module_load */
     alloc_module_load(drcontext, info, loaded);
     if (options.perturb_only)
@@ -1708,8 +2131,10 @@ event_module_unload(void *drcontext, const module_data_t *info)
     slowpath_module_unload(drcontext, info);
     if (!options.perturb_only)
         callstack_module_unload(drcontext, info);
-    if (INSTRUMENT_MEMREFS())
+    if (INSTRUMENT_MEMREFS()) {
+        native_summary_module_unload(drcontext, info);
         replace_module_unload(drcontext, info);
+    }
     alloc_module_unload(drcontext, info);
     /* Free resources.  Xref i#982. */
     drsym_free_resources(info->full_path);
@@ -1861,6 +2286,10 @@ dr_init(client_id_t id)
     LOG(2, "executable \"%s\" is "PFX"-"PFX"\n", app_path, app_base, app_end);
 
     dr_register_exit_event(event_exit);
+#ifdef WINDOWS
+    if (options.preload_symbols && options.preload_symbols_threads > 0)
+        preload_init();
+#endif
     drmgr_register_thread_init_event(event_thread_init);
     drmgr_register_thread_exit_event(event_thread_exit);
     drmgr_register_restore_state_ex_event(event_restore_state);
@@ -1898,8 +2327,13 @@ dr_init(client_id_t id)
     /* make it easy to tell, by looking at log file, which client executed */
     dr_log(NULL, LOG_ALL, 1, "client = Dr. Memory version %s\n", VERSION_STRING);
 
-    if (options.use_symcache)
-        drsymcache_init(client_id, options.symcache_dir, options.symcache_minsize);
+    if (options.use_symcache) {
+        drsymcache_options_t symcache_ops = {sizeof(symcache_ops),};
+        symcache_ops.max_dir_size = (uint64)options.symcache_max_mb * 1024 * 1024;
+        symcache_ops.negative_runs = options.symcache_negative_runs;
+        drsymcache_init_ex(client_id, options.symcache_dir, options.symcache_minsize,
+                           &symcache_ops);
+    }
 
     if (!options.perturb_only)
         report_init();
@@ -1965,14 +2399,24 @@ dr_init(client_id_t id)
     syscall_init(drcontext _IF_WINDOWS(ntdll_base));
 
     hashtable_init(&known_table, KNOWN_TABLE_HASH_BITS, HASH_INTPTR, false/*!strdup*/);
+#ifdef WINDOWS
+    hashtable_init(&teb_table, TEB_TABLE_HASH_BITS, HASH_INTPTR, false/*!strdup*/);
+#endif
     alloc_drmem_init();
 
     if (options.perturb)
         perturb_init();
 
     instrument_init();
-
-    if (options.coverage) {
+    slowpath_profile_init();
+    slowpath_decode_cache_init();
+    if (options.profile_tool)
+        prof_init();
+    live_stats_init();
+
+    if (options.coverage_stream)
+        covstream_init();
+    else if (options.coverage) {
         drcovlib_options_t ops = {sizeof(ops), 0, logsubdir, };
         if (drcovlib_init(&ops) != DRCOVLIB_SUCCESS)
             ASSERT(false, "failed to init drcovlib");
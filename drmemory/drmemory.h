@@ -74,6 +74,7 @@ extern char logsubdir[MAXIMUM_PATH];
 
 #define RESULTS_FNAME "results.txt"
 #define RESULTS_POTENTIAL_FNAME "potential_errors.txt"
+#define RESULTS_JSONL_FNAME "results.jsonl"
 #define POTENTIAL_PREFIX        "potential"
 #define POTENTIAL_PREFIX_CAP    "Potential"
 #define POTENTIAL_PREFIX_ALLCAP "POTENTIAL"
@@ -82,6 +83,7 @@ extern file_t f_results;
 extern file_t f_suppress;
 extern file_t f_missing_symbols;
 extern file_t f_potential;
+extern file_t f_results_jsonl;
 
 #ifdef WINDOWS
 extern app_pc ntdll_base;
@@ -122,6 +124,9 @@ mmap_walk(app_pc start, size_t size,
 #ifdef WINDOWS
 void
 set_teb_initial_shadow(TEB *teb);
+
+void
+teb_tls_slot_freed(uint slot);
 #endif
 
 #endif /* _DRMEMORY_H_ */
@@ -312,6 +312,55 @@ handle_possible_write_to_read_only(void *drcontext,
     return res;
 }
 
+/* Reports an access to the guard page placed after a chunk by
+ * -guard_page_min_size or -sample_allocs, or to a freed -sample_allocs
+ * chunk that is still being kept inaccessible.  With shadowing, the access was already reported
+ * by its shadow check, so we only claim the fault.  Either way the fault
+ * is then delivered to the app.
+ */
+static bool
+handle_guard_page_fault(void *drcontext, app_pc target,
+                        dr_mcontext_t *raw_mc, dr_mcontext_t *mc)
+{
+    app_pc addr;
+    bool is_write;
+    uint pos;
+    int  memopidx;
+    app_loc_t loc;
+    size_t size;
+    instr_t inst;
+    app_pc bad_addr = target;
+    size_t bad_size = 1;
+    uint access = DR_MEMPROT_READ;
+
+    if (!options.replace_malloc || !alloc_replace_in_guard_page(target))
+        return false;
+    if (options.shadowing)
+        return true;
+    instr_init(drcontext, &inst);
+    if (safe_decode(drcontext, raw_mc->pc, &inst, NULL)) {
+        for (memopidx = 0;
+             instr_compute_address_ex_pos(&inst, mc, memopidx,
+                                          &addr, &is_write, &pos);
+             memopidx++) {
+            size = opnd_size_in_bytes(opnd_get_size(is_write ?
+                                                    instr_get_dst(&inst, pos) :
+                                                    instr_get_src(&inst, pos)));
+            if (target >= addr && target < addr + size) {
+                bad_addr = addr;
+                bad_size = size;
+                access = is_write ? DR_MEMPROT_WRITE : DR_MEMPROT_READ;
+                break;
+            }
+        }
+    }
+    instr_free(drcontext, &inst);
+    pc_to_loc(&loc, mc->pc);
+    report_unaddressable_access(&loc, bad_addr, bad_size, access,
+                                bad_addr, bad_addr + bad_size, mc);
+    return true;
+}
+
 #endif /* TOOL_DR_MEMORY */
 
 /* PR 448701: we fault if we write to a special block */
@@ -346,6 +395,10 @@ event_signal_instrument(void *drcontext, dr_siginfo_t *info)
              * write for sub-dword.
              */
             return DR_SIGNAL_SUPPRESS;
+        } else if ((options.guard_page_min_size > 0 || options.sample_allocs > 0) &&
+                   handle_guard_page_fault(drcontext, target, info->raw_mcontext,
+                                           info->mcontext)) {
+            /* fall through to DR_SIGNAL_DELIVER */
         } else if (options.report_write_to_read_only &&
                    options.pattern == 0 && /* vs pattern_handle_segv_fault() */
                    handle_possible_write_to_read_only(drcontext, info->raw_mcontext,
@@ -412,6 +465,10 @@ event_exception_instrument(void *drcontext, dr_exception_t *excpt)
              * write for sub-dword.
              */
             return false;
+        } else if ((options.guard_page_min_size > 0 || options.sample_allocs > 0) &&
+                   handle_guard_page_fault(drcontext, target, excpt->raw_mcontext,
+                                           excpt->mcontext)) {
+            /* fall through to delivering the fault */
         } else if (options.report_write_to_read_only &&
                    options.pattern == 0 && /* vs pattern_handle_segv_fault() */
                    excpt->record->ExceptionCode != STATUS_GUARD_PAGE_VIOLATION &&
@@ -197,6 +197,12 @@ struct _bb_info_t {
     bool first_instr;
     bool added_instru;
     bool mark_defined; /* mark all instr dsts defined (i#1529) */
+    bool check_none; /* module is on -lib_check_none */
+    /* -tiered_threshold: only count executions, and mark dsts defined */
+    bool tier0;
+    void *tier_info;
+    /* -startup_addr_only: built before the startup phase ended */
+    bool startup;
     /* for calculating size of bb */
     app_pc first_app_pc;
     app_pc last_app_pc;
@@ -233,6 +239,10 @@ typedef struct _bb_saved_info_t {
      * XXX DRi#772: could add flush callback and avoid this save
      */
     bool pattern_4byte_check_only:1;
+    /* -tiered_threshold: whether instrumented as a counting-only bb */
+    bool tier0:1;
+    /* -startup_addr_only: whether instrumented during the startup phase */
+    bool startup:1;
     /* we store the size and assume bbs are contiguous so we can free (i#260) */
     ushort bb_size;
     app_pc first_restore_pc; /* first pc that need restore state */
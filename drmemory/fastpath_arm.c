@@ -46,8 +46,10 @@
 bool
 instr_ok_for_instrument_fastpath(instr_t *inst, fastpath_info_t *mi, bb_info_t *bi)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
-    /* Probably a lot of code can be shared with fastpath_x86.c: it
+    /* FIXME i#1726: there is no inline fastpath yet, so we send everything
+     * to the slowpath, whose operand analysis (adjust_memop(),
+     * num_true_srcs(), etc.) is what a fastpath here would share.
+     * Probably a lot of code can be shared with fastpath_x86.c: it
      * needs further refactoring.
      */
     return false;
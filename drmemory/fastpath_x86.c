@@ -58,7 +58,117 @@ extern const byte shadow_word_addr_not_bit[4][256];
 #endif
 
 #ifdef TOOL_DR_MEMORY
-static bool needs_shadow_op(instr_t *inst);
+/* Instructions whose result bytes are a permutation of their source bytes
+ * rather than a bytewise combination need insert_shadow_op() to move the
+ * combined source shadow to match.  We classify them here so that the
+ * fastpath's decisions about them are made in one place.
+ */
+typedef enum {
+    SHADOW_OP_NONE,
+    SHADOW_OP_SHL,
+    SHADOW_OP_SHR,
+    SHADOW_OP_SAR,
+    SHADOW_OP_ROL,
+    SHADOW_OP_ROR,
+    SHADOW_OP_BSWAP,
+    SHADOW_OP_NUM,
+} shadow_op_t;
+
+static const struct {
+    /* Whether an immed count that is not a multiple of 8 is propagated
+     * rather than requiring all-defined sources.
+     */
+    bool partial_count_ok;
+    /* Whether only operand sizes whose shadow exactly fills the shadow
+     * register (4 and 8) are handled, as for ops that wrap bytes around.
+     */
+    bool full_width_only;
+} shadow_op_info[SHADOW_OP_NUM] = {
+    /* SHADOW_OP_NONE  */ { false, false },
+    /* SHADOW_OP_SHL   */ { false, false },
+    /* SHADOW_OP_SHR   */ { false, false },
+    /* SHADOW_OP_SAR   */ { false, false },
+    /* SHADOW_OP_ROL   */ { true,  true  },
+    /* SHADOW_OP_ROR   */ { true,  true  },
+    /* SHADOW_OP_BSWAP */ { false, true  },
+};
+
+static shadow_op_t
+shadow_op_class(int opc)
+{
+    switch (opc) {
+    case OP_shl:   return SHADOW_OP_SHL;
+    case OP_shr:   return SHADOW_OP_SHR;
+    case OP_sar:   return SHADOW_OP_SAR;
+    case OP_rol:   return SHADOW_OP_ROL;
+    case OP_ror:   return SHADOW_OP_ROR;
+    case OP_bswap: return SHADOW_OP_BSWAP;
+    default:       return SHADOW_OP_NONE;
+    }
+}
+
+static bool
+needs_shadow_op(instr_t *inst)
+{
+    return shadow_op_class(instr_get_opcode(inst)) != SHADOW_OP_NONE;
+}
+
+/* Returns the immed count of a shift or rotate, reduced the way the
+ * hardware does, or -1 if the count is not an immed.
+ */
+static int
+shadow_op_count(instr_t *inst)
+{
+    shadow_op_t cls = shadow_op_class(instr_get_opcode(inst));
+    uint opsz = opnd_size_in_bytes(opnd_get_size(instr_get_dst(inst, 0)));
+    int count;
+    if (!opnd_is_immed_int(instr_get_src(inst, 0)))
+        return -1;
+    count = (int) opnd_get_immed_int(instr_get_src(inst, 0));
+    if (cls == SHADOW_OP_ROL || cls == SHADOW_OP_ROR)
+        count %= opsz*8;
+    return count;
+}
+
+/* Returns whether insert_shadow_op() can propagate inst's partially-undefined
+ * sources, rather than the fastpath requiring all-defined sources.
+ */
+static bool
+shadow_op_ok_for_fastpath(instr_t *inst)
+{
+    shadow_op_t cls = shadow_op_class(instr_get_opcode(inst));
+    if (cls == SHADOW_OP_NONE)
+        return true;
+    if (shadow_op_info[cls].full_width_only) {
+        uint opsz = opnd_size_in_bytes(opnd_get_size(instr_get_dst(inst, 0)));
+        if (opsz != 4 IF_X64(&& opsz != 8))
+            return false;
+    }
+    if (cls != SHADOW_OP_BSWAP) {
+        int count = shadow_op_count(inst);
+        if (count < 0 || (count % 8 != 0 && !shadow_op_info[cls].partial_count_ok))
+            return false;
+    }
+    return true;
+}
+
+/* Returns whether insert_shadow_op() needs a scratch register for inst */
+static bool
+shadow_op_needs_scratch(instr_t *inst)
+{
+    switch (shadow_op_class(instr_get_opcode(inst))) {
+    case SHADOW_OP_SAR:
+    case SHADOW_OP_BSWAP:
+        return true;
+    case SHADOW_OP_SHL:
+    case SHADOW_OP_SHR:
+    case SHADOW_OP_ROL:
+    case SHADOW_OP_ROR:
+        return shadow_op_count(inst) % 8 != 0;
+    default:
+        return false;
+    }
+}
 
 static bool
 load_reg_shadow_val(void *drcontext, instrlist_t *bb, instr_t *inst,
@@ -250,8 +360,6 @@ instr_needs_slowpath(instr_t *inst)
     switch (opc) {
     case OP_popa:
         return true;
-    case OP_bswap:
-        return options.check_uninitialized;
     default:
         return false;
     }
@@ -1041,10 +1149,13 @@ set_check_definedness_pre_regs(void *drcontext, instr_t *inst, fastpath_info_t *
     /* Similarly for shifts, since we don't have insert_shadow_op() fully
      * operational yet for non-immed-int-%8 shifts (xref PR 574918)
      */
-    if (opc_is_gpr_shift(opc) &&
-        (!opnd_is_immed_int(instr_get_src(inst, 0)) ||
-         opnd_get_immed_int(instr_get_src(inst, 0)) % 8 != 0))
-         mi->check_definedness = true;
+    if (needs_shadow_op(inst)) {
+        if (!shadow_op_ok_for_fastpath(inst))
+            mi->check_definedness = true;
+    } else if (opc_is_gpr_shift(opc) &&
+               (!opnd_is_immed_int(instr_get_src(inst, 0)) ||
+                opnd_get_immed_int(instr_get_src(inst, 0)) % 8 != 0))
+        mi->check_definedness = true;
 
     /* i#1525: these are tricky to implement in fastpath for partially-defined */
     switch (opc) {
@@ -1247,6 +1358,13 @@ should_share_addr_helper(fastpath_info_t *mi)
  * though likely at higher overhead.  If we do expand xl8 sharing any
  * further, with larger windows, we should probably move to the
  * analysis phase.
+ *
+ * Sharing cannot continue into the next bb: the translation lives in the
+ * whole-bb reg1, which is restored at the bottom of every bb, and we run
+ * with -disable_traces (required by -shared_slowpath and i#391), so there
+ * is no trace to carry it across.  State restoration (bb_saved_info_t) and
+ * the i#260 xl8_sharing_table cleanup also assume one contiguous bb per tag.
+ * xl8_not_shared_bb_end counts the candidates we lose at a bb end.
  */
 static bool
 should_share_addr(instr_t *inst, fastpath_info_t *cur, opnd_t cur_memop)
@@ -1265,10 +1383,12 @@ should_share_addr(instr_t *inst, fastpath_info_t *cur, opnd_t cur_memop)
         return false;
     if (!whole_bb_spills_enabled())
         return false;
-    if (nxt == NULL)
-        return false;
     if (!should_share_addr_helper(cur))
         return false;
+    if (nxt == NULL) {
+        STATS_INC(xl8_not_shared_bb_end);
+        return false;
+    }
     /* Don't share if we had too many slowpaths in the past */
     if ((uint)(ptr_uint_t)
         hashtable_lookup(&xl8_sharing_table, instr_get_app_pc(nxt)) >
@@ -1320,7 +1440,13 @@ should_share_addr(instr_t *inst, fastpath_info_t *cur, opnd_t cur_memop)
         }
         memop = adjust_memop(nxt, mi.load ? mi.src[0].app : mi.dst[0].app,
                              mi.store, &mi.memsz, &mi.pushpop_stackop);
-        if (cur->memsz != mi.memsz)
+        /* A dword ref needs only 4-alignment to be covered by one shadow byte,
+         * so it can use the translation of a wider aligned ref before it, as
+         * for a struct with mixed field sizes.  The reverse could have the
+         * wider ref straddle a shadow byte.
+         */
+        if (cur->memsz != mi.memsz &&
+            !(mi.memsz == 4 && (cur->memsz == 8 || cur->memsz == 16)))
             return false;
 #ifdef X64
         if (opnd_is_rel_addr(cur_memop) && opnd_is_rel_addr(memop)) {
@@ -1531,23 +1657,10 @@ insert_check_defined(void *drcontext, instrlist_t *bb, instr_t *inst,
     }
 }
 
-static bool
-needs_shadow_op(instr_t *inst)
-{
-    int opc = instr_get_opcode(inst);
-    switch (opc) {
-    case OP_shl:
-    case OP_shr:
-    case OP_sar:
-        return true;
-    default: return false;
-    }
-}
-
 /* Manipulates the shadow value in register reg that is the product of
  * combining the sources of instruction inst, prior to storing into the
  * destination(s) of inst, to mirror the instruction's operation.
- * Keep in sync w/ needs_shadow_op().
+ * Keep in sync w/ shadow_op_class().
  */
 static void
 insert_shadow_op(void *drcontext, instrlist_t *bb, fastpath_info_t *mi, instr_t *inst,
@@ -1650,6 +1763,91 @@ insert_shadow_op(void *drcontext, instrlist_t *bb, fastpath_info_t *mi, instr_t
         }
         break;
     }
+    case OP_rol:
+    case OP_ror: {
+        /* Each dst byte comes from at most two src bytes: rotate the shadow
+         * by the whole bytes and, for a partial byte, or in one more byte's worth.
+         */
+        int shift = shadow_op_count(inst);
+        ASSERT(shift >= 0, "rotate shadow op requires an immed count");
+        ASSERT(opnd_size_in_bytes(reg_get_size(reg)) * 4 ==
+               opnd_size_in_bytes(opnd_get_size(instr_get_dst(inst, 0))),
+               "rotate shadow must fill its reg");
+        if (shift / 8 != 0) {
+            PRE(bb, inst, (opc == OP_rol) ?
+                INSTR_CREATE_rol(drcontext, opnd_create_reg(reg),
+                                 OPND_CREATE_INT8((shift / 8)*2)) :
+                INSTR_CREATE_ror(drcontext, opnd_create_reg(reg),
+                                 OPND_CREATE_INT8((shift / 8)*2)));
+        }
+        if (shift % 8 != 0) {
+            ASSERT(scratch != REG_NULL, "invalid scratch reg");
+            mark_scratch_reg_used(drcontext, bb, mi->bb, si);
+            PRE(bb, inst,
+                INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(scratch),
+                                    opnd_create_reg(reg)));
+            PRE(bb, inst, (opc == OP_rol) ?
+                INSTR_CREATE_rol(drcontext, opnd_create_reg(scratch),
+                                 OPND_CREATE_INT8(2)) :
+                INSTR_CREATE_ror(drcontext, opnd_create_reg(scratch),
+                                 OPND_CREATE_INT8(2)));
+            PRE(bb, inst,
+                INSTR_CREATE_or(drcontext, opnd_create_reg(reg),
+                                opnd_create_reg(scratch)));
+        }
+        break;
+    }
+    case OP_bswap: {
+        /* Reverse the order of the 2-bit per-byte shadow fields */
+        bool wide = (reg_get_size(reg) == OPSZ_2);
+        ASSERT(reg_get_size(reg) == OPSZ_1 || wide, "bswap shadow must fill its reg");
+        ASSERT(scratch != REG_NULL, "invalid scratch reg");
+        mark_scratch_reg_used(drcontext, bb, mi->bb, si);
+        if (wide) {
+            /* swap the two 4-byte halves, then each half's nibbles */
+            PRE(bb, inst,
+                INSTR_CREATE_rol(drcontext, opnd_create_reg(reg), OPND_CREATE_INT8(8)));
+            PRE(bb, inst,
+                INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(scratch),
+                                    opnd_create_reg(reg)));
+            PRE(bb, inst,
+                INSTR_CREATE_shr(drcontext, opnd_create_reg(reg), OPND_CREATE_INT8(4)));
+            PRE(bb, inst,
+                INSTR_CREATE_and(drcontext, opnd_create_reg(reg),
+                                 OPND_CREATE_INT16((short)0x0f0f)));
+            PRE(bb, inst,
+                INSTR_CREATE_shl(drcontext, opnd_create_reg(scratch),
+                                 OPND_CREATE_INT8(4)));
+            PRE(bb, inst,
+                INSTR_CREATE_and(drcontext, opnd_create_reg(scratch),
+                                 OPND_CREATE_INT16((short)0xf0f0)));
+            PRE(bb, inst,
+                INSTR_CREATE_or(drcontext, opnd_create_reg(reg),
+                                opnd_create_reg(scratch)));
+        } else {
+            PRE(bb, inst,
+                INSTR_CREATE_rol(drcontext, opnd_create_reg(reg), OPND_CREATE_INT8(4)));
+        }
+        /* swap the fields within each nibble */
+        PRE(bb, inst,
+            INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(scratch),
+                                opnd_create_reg(reg)));
+        PRE(bb, inst,
+            INSTR_CREATE_shr(drcontext, opnd_create_reg(reg), OPND_CREATE_INT8(2)));
+        PRE(bb, inst,
+            INSTR_CREATE_and(drcontext, opnd_create_reg(reg), wide ?
+                             OPND_CREATE_INT16((short)0x3333) :
+                             OPND_CREATE_INT8((char)0x33)));
+        PRE(bb, inst,
+            INSTR_CREATE_shl(drcontext, opnd_create_reg(scratch), OPND_CREATE_INT8(2)));
+        PRE(bb, inst,
+            INSTR_CREATE_and(drcontext, opnd_create_reg(scratch), wide ?
+                             OPND_CREATE_INT16((short)0xcccc) :
+                             OPND_CREATE_INT8((char)0xcc)));
+        PRE(bb, inst,
+            INSTR_CREATE_or(drcontext, opnd_create_reg(reg), opnd_create_reg(scratch)));
+        break;
+    }
     }
 }
 
@@ -2096,13 +2294,20 @@ add_shadow_table_lookup(void *drcontext, instrlist_t *bb, instr_t *inst,
         /* PR 614275: for xmm regs we require 16-byte align: has to be for movdqa
          * anyway else will fault.
          * PR 624474: we handle OPSZ_10 fld on fastpath if 16-byte aligned
+         * With -fastpath_unaligned_xmm we keep 4-byte-aligned 16-byte memops,
+         * such as the movdqu pairs of vectorized copies, on the fastpath: they
+         * cover four whole shadow bytes, and a straddle of 64K is caught by the
+         * shadow block redzones as for 8-byte memops below.
          */
         PRE(bb, inst,
             INSTR_CREATE_test(drcontext, opnd_create_reg(reg_ptrsz_to_8(reg1)),
                               OPND_CREATE_INT8(mi->memsz == 4 ? 0x3 :
                                                (mi->memsz == 8 ? 0x3 :
-                                                ((mi->memsz == 16 || mi->memsz == 10) ?
-                                                 0xf : 0x1)))));
+                                                ((mi->memsz == 16 &&
+                                                  options.fastpath_unaligned_xmm) ?
+                                                 0x3 :
+                                                 ((mi->memsz == 16 || mi->memsz == 10) ?
+                                                  0xf : 0x1))))));
         /* i#1694: a short jcc doesn't always reach so we always use a long to
          * be on the safe side.
          */
@@ -3105,9 +3310,7 @@ instrument_fastpath(void *drcontext, instrlist_t *bb, instr_t *inst,
         /* We need a scratch reg in insert_shadow_op().
          * XXX: would be better to request down there -- feasible with drreg?
          */
-        (needs_shadow_op(inst) &&
-         opnd_is_immed_int(instr_get_src(inst, 0)) &&
-         (opc == OP_sar || opnd_get_immed_int(instr_get_src(inst, 0)) % 8 != 0)))
+        shadow_op_needs_scratch(inst))
         mi->need_nonoffs_reg3 = true;
     if (mi->shadow_indir) {
         /* We need a temp reg for indirected shadow memory */
@@ -3238,6 +3441,12 @@ instrument_fastpath(void *drcontext, instrlist_t *bb, instr_t *inst,
             LOG(2, "removing stale alloca probe exception at "PFX NL, pc);
         }
     }
+    if (options.saturate_sites &&
+        hashtable_lookup(&saturated_table, mi->xl8) != NULL) {
+        LOG(3, "not checking unaddressable accesses at saturated "PFX NL, mi->xl8);
+        check_ignore_unaddr = true;
+        check_ignore_tls = false;
+    }
 #endif
 
     /* PR 578892: fastpath heap routine unaddr accesses */
@@ -388,83 +388,333 @@ should_fetch_symbols(const TCHAR *system_root, char *modpath)
     return r;
 }
 
+/* Symbols are fetched by a pool of child processes, as dbghelp is not
+ * thread-safe and most of the time goes to network I/O.  We start fetching
+ * while the app is still running, for each module it adds to
+ * missing_symbols.txt, and finish once it exits.
+ */
+#define MAX_SYMFETCH_WORKERS 4
+#define SYMFETCH_POLL_MS 500
+#define SYMFETCH_WORKER_OP "-fetch_symbols_worker"
+
+static bool symfetch_enabled;
+static TCHAR symfetch_system_root[MAXIMUM_PATH];
+static char symfetch_srvpath[MAXIMUM_PATH];
+static TCHAR symfetch_exe[MAXIMUM_PATH];
+/* Empty until we know where the results are */
+static TCHAR symfetch_list[MAXIMUM_PATH];
+static long symfetch_list_offs;
+/* Every module we have seen, in order: those at index symfetch_next and
+ * beyond have not been started yet.
+ */
+static char **symfetch_queue;
+static int symfetch_queued;
+static int symfetch_queue_max;
+static int symfetch_next;
+static HANDLE symfetch_workers[MAX_SYMFETCH_WORKERS];
+static int symfetch_active;
+static int symfetch_fetched;
+static int symfetch_cached;
+
+/* The CodeView record pointing at a PDB 7.0 file */
+typedef struct _cv_info_pdb70_t {
+    DWORD signature;
+    GUID guid;
+    DWORD age;
+    char pdb_name[1];
+} cv_info_pdb70_t;
+#define CV_SIGNATURE_RSDS 0x53445352 /* "RSDS" */
+
+/* Returns whether the pdb for modpath is already in the local symbol store,
+ * which symsrv lays out as <store>/<pdb name>/<GUID><age>/<pdb name>.
+ */
+static bool
+symfetch_is_cached(const char *modpath)
+{
+    TCHAR wpath[MAXIMUM_PATH];
+    char store[MAXIMUM_PATH];
+    char pdbpath[MAXIMUM_PATH];
+    const char *c, *pdb_name;
+    HANDLE f, map = NULL;
+    byte *base = NULL;
+    IMAGE_NT_HEADERS *nt;
+    IMAGE_DATA_DIRECTORY *dir;
+    IMAGE_DEBUG_DIRECTORY *dbg;
+    DWORD i, num;
+    bool res = false;
+
+    /* The local store is the first element of "srv*<store>*<server>" */
+    if (_strnicmp(symfetch_srvpath, "srv*", 4) != 0)
+        return false;
+    c = strchr(symfetch_srvpath + 4, '*');
+    if (c == NULL || c - (symfetch_srvpath + 4) >= BUFFER_SIZE_ELEMENTS(store))
+        return false;
+    memcpy(store, symfetch_srvpath + 4, c - (symfetch_srvpath + 4));
+    store[c - (symfetch_srvpath + 4)] = '\0';
+
+    char_to_tchar(modpath, wpath, BUFFER_SIZE_ELEMENTS(wpath));
+    f = CreateFile(wpath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                   FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE)
+        return false;
+    /* An image mapping lets us follow RVAs directly */
+    map = CreateFileMapping(f, NULL, PAGE_READONLY | SEC_IMAGE, 0, 0, NULL);
+    if (map != NULL)
+        base = (byte *) MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+    if (base == NULL)
+        goto cached_done;
+    nt = (IMAGE_NT_HEADERS *) (base + ((IMAGE_DOS_HEADER *) base)->e_lfanew);
+    if (nt->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
+        dir = &((IMAGE_NT_HEADERS64 *) nt)->OptionalHeader.
+            DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG];
+    } else {
+        dir = &((IMAGE_NT_HEADERS32 *) nt)->OptionalHeader.
+            DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG];
+    }
+    dbg = (IMAGE_DEBUG_DIRECTORY *) (base + dir->VirtualAddress);
+    num = (dir->VirtualAddress == 0) ? 0 : dir->Size / sizeof(*dbg);
+    for (i = 0; i < num; i++) {
+        cv_info_pdb70_t *cv;
+        if (dbg[i].Type != IMAGE_DEBUG_TYPE_CODEVIEW || dbg[i].AddressOfRawData == 0)
+            continue;
+        cv = (cv_info_pdb70_t *) (base + dbg[i].AddressOfRawData);
+        if (cv->signature != CV_SIGNATURE_RSDS)
+            continue;
+        pdb_name = cv->pdb_name;
+        for (c = cv->pdb_name; *c != '\0'; c++) {
+            if (*c == '\\' || *c == '/')
+                pdb_name = c + 1;
+        }
+        _snprintf(pdbpath, BUFFER_SIZE_ELEMENTS(pdbpath),
+                  "%s\\%s\\%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%X\\%s",
+                  store, pdb_name, cv->guid.Data1, cv->guid.Data2, cv->guid.Data3,
+                  cv->guid.Data4[0], cv->guid.Data4[1], cv->guid.Data4[2],
+                  cv->guid.Data4[3], cv->guid.Data4[4], cv->guid.Data4[5],
+                  cv->guid.Data4[6], cv->guid.Data4[7], cv->age, pdb_name);
+        NULL_TERMINATE_BUFFER(pdbpath);
+        res = file_is_readable(pdbpath);
+        info("%s: %s => %d", __FUNCTION__, pdbpath, res);
+        break;
+    }
+
+ cached_done:
+    if (base != NULL)
+        UnmapViewOfFile(base);
+    if (map != NULL)
+        CloseHandle(map);
+    CloseHandle(f);
+    return res;
+}
+
 static void
-fetch_missing_symbols(const char *symdir, const TCHAR *resfile)
+symfetch_init(const char *symsrv_dir)
 {
-    TCHAR missing_symbols[MAXIMUM_PATH];
-    char line[MAXIMUM_PATH];
-    FILE *stream;
-    TCHAR *last_slash;
-    HANDLE proc = GetCurrentProcess();
-    int num_files;
-    int cur_file;
-    int files_fetched;
-    TCHAR system_root[MAXIMUM_PATH];
     DWORD len;
-
+    symfetch_enabled = (fetch_symbols || fetch_crt_syms_only) &&
+        !(no_resfile || (quiet && batch));
+    if (!symfetch_enabled)
+        return;
     /* Get %SystemRoot%. */
-    len = GetWindowsDirectory(system_root, BUFFER_SIZE_ELEMENTS(system_root));
+    len = GetWindowsDirectory(symfetch_system_root,
+                              BUFFER_SIZE_ELEMENTS(symfetch_system_root));
     if (len == 0) {
-        _tcsncpy(system_root, _T("C:\\Windows"), BUFFER_SIZE_ELEMENTS(system_root));
-        NULL_TERMINATE_BUFFER(system_root);
+        _tcsncpy(symfetch_system_root, _T("C:\\Windows"),
+                 BUFFER_SIZE_ELEMENTS(symfetch_system_root));
+        NULL_TERMINATE_BUFFER(symfetch_system_root);
+    }
+    strncpy(symfetch_srvpath, symsrv_dir, BUFFER_SIZE_ELEMENTS(symfetch_srvpath));
+    NULL_TERMINATE_BUFFER(symfetch_srvpath);
+    if (GetModuleFileName(NULL, symfetch_exe, BUFFER_SIZE_ELEMENTS(symfetch_exe)) == 0) {
+        warn("unable to find the path of this executable to fetch symbols: %d",
+             GetLastError());
+        symfetch_enabled = false;
     }
-    _tcsncpy(missing_symbols, resfile, BUFFER_SIZE_ELEMENTS(missing_symbols));
-    NULL_TERMINATE_BUFFER(missing_symbols);
-    drfront_string_replace_character_wide(missing_symbols, _T(ALT_DIRSEP), _T(DIRSEP));
-    last_slash = _tcsrchr(missing_symbols, _T(DIRSEP));
+}
+
+static void
+symfetch_set_resfile(const TCHAR *resfile)
+{
+    TCHAR *last_slash;
+    if (symfetch_list[0] != _T('\0'))
+        return;
+    _tcsncpy(symfetch_list, resfile, BUFFER_SIZE_ELEMENTS(symfetch_list));
+    NULL_TERMINATE_BUFFER(symfetch_list);
+    drfront_string_replace_character_wide(symfetch_list, _T(ALT_DIRSEP), _T(DIRSEP));
+    last_slash = _tcsrchr(symfetch_list, _T(DIRSEP));
     if (last_slash == NULL) {
-        warn(TSTR_FMT" is not an absolute path", missing_symbols);
+        warn(TSTR_FMT" is not an absolute path", symfetch_list);
+        symfetch_list[0] = _T('\0');
+        symfetch_enabled = false;
         return;
     }
-    *last_slash = _T(DIRSEP);
     *(last_slash+1) = _T('\0'); /* safe, since was null-terminated prior to _tcsrchr */
-    _tcscat_s(missing_symbols, BUFFER_SIZE_ELEMENTS(missing_symbols),
+    _tcscat_s(symfetch_list, BUFFER_SIZE_ELEMENTS(symfetch_list),
               _T("missing_symbols.txt"));
-    NULL_TERMINATE_BUFFER(missing_symbols);
+    NULL_TERMINATE_BUFFER(symfetch_list);
+}
 
-    stream = _tfopen(missing_symbols, _T("r"));
-    if (stream == NULL) {
-        warn("can't open "TSTR_FMT" to fetch missing symbols", missing_symbols);
-        return;
+static void
+symfetch_add(const char *modpath)
+{
+    int i;
+    for (i = 0; i < symfetch_queued; i++) {
+        if (_stricmp(symfetch_queue[i], modpath) == 0)
+            return;
     }
+    if (symfetch_queued == symfetch_queue_max) {
+        symfetch_queue_max = (symfetch_queue_max == 0) ? 16 : symfetch_queue_max * 2;
+        symfetch_queue = (char **)
+            realloc(symfetch_queue, symfetch_queue_max * sizeof(*symfetch_queue));
+        if (symfetch_queue == NULL)
+            fatal("out of memory fetching symbols");
+    }
+    symfetch_queue[symfetch_queued] = _strdup(modpath);
+    if (symfetch_queue[symfetch_queued] == NULL)
+        fatal("out of memory fetching symbols");
+    if (symfetch_is_cached(modpath)) {
+        /* Keep it in the queue for de-duplication but don't start it */
+        char *tmp = symfetch_queue[symfetch_next];
+        symfetch_queue[symfetch_next] = symfetch_queue[symfetch_queued];
+        symfetch_queue[symfetch_queued] = tmp;
+        symfetch_next++;
+        symfetch_cached++;
+    }
+    symfetch_queued++;
+}
 
-    /* Count the number of files we intend to fetch up front.  Each line is a
-     * module path, so MAXIMUM_PATH is always enough.
-     */
-    num_files = 0;
+/* Reads the complete lines added to missing_symbols.txt since the last call */
+static void
+symfetch_read_list(void)
+{
+    char line[MAXIMUM_PATH];
+    FILE *stream;
+    if (symfetch_list[0] == _T('\0'))
+        return;
+    stream = _tfopen(symfetch_list, _T("r"));
+    if (stream == NULL)
+        return;
+    fseek(stream, symfetch_list_offs, SEEK_SET);
+    /* Each line is a module path, so MAXIMUM_PATH is always enough. */
     while (fgets(line, BUFFER_SIZE_ELEMENTS(line), stream) != NULL) {
-        if (should_fetch_symbols(system_root, line))
-            num_files++;
+        /* Leave a partially written line for next time */
+        if (strchr(line, '\n') == NULL)
+            break;
+        symfetch_list_offs = ftell(stream);
+        if (should_fetch_symbols(symfetch_system_root, line))
+            symfetch_add(line);
     }
-    fseek(stream, 0, SEEK_SET);  /* Back to beginning. */
-
-    /* Don't initialize dbghelp and symsrv if there are no syms to fetch. */
-    if (num_files == 0)
-        goto stream_cleanup;
-
-    /* Initializing dbghelp can be slow, so print something to the user. */
-    sym_info("Fetching %d symbol files...", num_files);
+    fclose(stream);
+}
 
-    cur_file = 0;
-    files_fetched = 0;
-    while (fgets(line, BUFFER_SIZE_ELEMENTS(line), stream) != NULL) {
-        if (should_fetch_symbols(system_root, line)) {
-            cur_file++;
-            sym_info("[%d/%d] Fetching symbols for %s",
-                     cur_file, num_files, line);
-            if (drfront_fetch_module_symbols(line, NULL, 0) == DRFRONT_SUCCESS)
-                files_fetched++;
+/* Reaps finished workers, and starts workers for queued modules until
+ * MAX_SYMFETCH_WORKERS are running.
+ */
+static void
+symfetch_schedule(bool print)
+{
+    int i;
+    for (i = 0; i < symfetch_active; ) {
+        DWORD exit_code;
+        if (WaitForSingleObject(symfetch_workers[i], 0) != WAIT_OBJECT_0) {
+            i++;
+            continue;
         }
+        if (GetExitCodeProcess(symfetch_workers[i], &exit_code) && exit_code == 0)
+            symfetch_fetched++;
+        CloseHandle(symfetch_workers[i]);
+        symfetch_workers[i] = symfetch_workers[--symfetch_active];
     }
+    while (symfetch_active < MAX_SYMFETCH_WORKERS && symfetch_next < symfetch_queued) {
+        PROCESS_INFORMATION pi;
+        STARTUPINFO si;
+        TCHAR cmd[MAXIMUM_PATH*4];
+        const char *modpath = symfetch_queue[symfetch_next++];
+        if (print) {
+            sym_info("[%d/%d] Fetching symbols for %s", symfetch_next - symfetch_cached,
+                     symfetch_queued - symfetch_cached, modpath);
+        }
+        ZeroMemory(&si, sizeof(si));
+        si.cb = sizeof(si);
+        _sntprintf(cmd, BUFFER_SIZE_ELEMENTS(cmd), _T("\"%s\" %S \"%S\" \"%S\""),
+                   symfetch_exe, SYMFETCH_WORKER_OP, symfetch_srvpath, modpath);
+        NULL_TERMINATE_BUFFER(cmd);
+        if (!CreateProcess(symfetch_exe, cmd, NULL, NULL, FALSE, CREATE_NO_WINDOW,
+                           NULL, NULL, &si, &pi)) {
+            warn("cannot run \"%S\": %d", cmd, GetLastError());
+            continue;
+        }
+        CloseHandle(pi.hThread);
+        symfetch_workers[symfetch_active++] = pi.hProcess;
+    }
+}
 
-    if (drfront_sym_exit() != DRFRONT_SUCCESS)
-        warn("drfront_sym_exit failed %d", GetLastError());
+/* Called periodically while the app runs */
+static void
+symfetch_poll(const char *logdir, process_id_t pid)
+{
+    if (!symfetch_enabled)
+        return;
+    if (symfetch_list[0] == _T('\0')) {
+        /* The client writes the results path at startup */
+        char resfile[MAXIMUM_PATH];
+        TCHAR wresfile[MAXIMUM_PATH];
+        FILE *stream;
+        dr_snwprintf(wresfile, BUFFER_SIZE_ELEMENTS(wresfile),
+                     _T(TSTR_FMT)_T("/resfile.%d"), logdir, pid);
+        NULL_TERMINATE_BUFFER(wresfile);
+        stream = _tfopen(wresfile, _T("r"));
+        if (stream == NULL)
+            return;
+        if (fgets(resfile, BUFFER_SIZE_ELEMENTS(resfile), stream) == NULL) {
+            fclose(stream);
+            return;
+        }
+        fclose(stream);
+        char_to_tchar(resfile, wresfile, BUFFER_SIZE_ELEMENTS(wresfile));
+        symfetch_set_resfile(wresfile);
+    }
+    symfetch_read_list();
+    /* We stay quiet so as to not interleave with the app's output */
+    symfetch_schedule(false);
+}
 
-stream_cleanup:
-    fclose(stream);
-    if (num_files > 0) {
-        sym_info("Fetched %d symbol files successfully", files_fetched);
+/* Fetches the rest and waits for every worker */
+static void
+fetch_missing_symbols(const TCHAR *resfile)
+{
+    int already_started;
+    symfetch_set_resfile(resfile);
+    symfetch_read_list();
+    already_started = symfetch_next - symfetch_cached;
+    if (symfetch_queued - symfetch_cached == 0)
+        goto fetch_done;
+    if (symfetch_next < symfetch_queued) {
+        sym_info("Fetching %d symbol files...", symfetch_queued - symfetch_next);
+    } else {
+        sym_info("Waiting for %d symbol files fetched while the application ran...",
+                 already_started);
+    }
+    symfetch_schedule(true);
+    while (symfetch_active > 0) {
+        WaitForMultipleObjects(symfetch_active, symfetch_workers, FALSE, INFINITE);
+        symfetch_schedule(true);
     }
+    sym_info("Fetched %d symbol files successfully", symfetch_fetched);
+ fetch_done:
+    info("%d symbol files were already in the local store", symfetch_cached);
+}
+
+/* The worker process for a single module: see symfetch_schedule() */
+static int
+fetch_symbols_worker(const char *symsrv_dir, const char *modpath)
+{
+    int res = 1;
+    if (drfront_set_symbol_search_path(symsrv_dir) == DRFRONT_SUCCESS &&
+        drfront_fetch_module_symbols(modpath, NULL, 0) == DRFRONT_SUCCESS)
+        res = 0;
+    if (drfront_sym_exit() != DRFRONT_SUCCESS)
+        res = 1;
+    return res;
 }
 
 /* List of libs we might find inside drmemory.exe */
@@ -690,9 +940,9 @@ process_results_file(const char *logdir, const char *symdir,
     }
 
     /* We provide an option to allow the user to turn this feature off. */
-    if (fetch_symbols || fetch_crt_syms_only) {
+    if (symfetch_enabled) {
         info("fetching symbols");
-        fetch_missing_symbols(symdir, wresfile);
+        fetch_missing_symbols(wresfile);
     } else {
         info("skipping symbol fetching");
     }
@@ -858,6 +1108,13 @@ _tmain(int argc, TCHAR *targv[])
     if (sc != DRFRONT_SUCCESS)
         fatal("failed to process args: %d", sc);
 #endif
+#ifdef WINDOWS
+    if (argc == 4 && strcmp(argv[1], SYMFETCH_WORKER_OP) == 0) {
+        errcode = fetch_symbols_worker(argv[2], argv[3]);
+        drfront_cleanup_args(argv, argc);
+        return errcode;
+    }
+#endif
 
     /* Default root: we assume this exe is <root>/bin/drmemory.exe */
     get_full_path(argv[0], buf, BUFFER_SIZE_ELEMENTS(buf));
@@ -1460,6 +1717,7 @@ _tmain(int argc, TCHAR *targv[])
         DRFRONT_SUCCESS ||
         drfront_set_symbol_search_path(symsrv_dir) != DRFRONT_SUCCESS)
         warn("Can't set symbol search path. Symbol lookup may fail.");
+    symfetch_init(symsrv_dir);
 
     /* XXX i#2164: Until DR supports the delay-load features needed for timezone
      * utilities used by dbghelp loading symbols, we work around a crash when
@@ -1596,8 +1854,14 @@ _tmain(int argc, TCHAR *targv[])
         fatal("Failed to exec application");
 #else
         info("waiting for app to exit...");
-        errcode = WaitForSingleObject(dr_inject_get_process_handle(inject_data),
-                                      INFINITE);
+        do {
+            /* Start fetching symbols for modules found so far */
+            errcode = WaitForSingleObject(dr_inject_get_process_handle(inject_data),
+                                          symfetch_enabled ? SYMFETCH_POLL_MS :
+                                          INFINITE);
+            if (errcode == WAIT_TIMEOUT)
+                symfetch_poll(logdir, pid);
+        } while (errcode == WAIT_TIMEOUT);
         if (errcode != WAIT_OBJECT_0)
             info("failed to wait for app: %d\n", errcode);
         if (top_stats) {
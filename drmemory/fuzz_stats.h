@@ -0,0 +1,88 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The layout of the fuzz_stats.bin file kept up to date by -fuzz_live_stats.
+ *
+ * The file is mapped shared by the fuzzing process, and by its fork server
+ * children, so a reader can map or re-read it at any time to follow the
+ * fuzzer's progress.  Each fuzzing thread claims one slot and is the only
+ * writer of that slot's counts, which it updates without locking; a reader
+ * sums the counts of all claimed slots and of retired.  The counts are 32-bit
+ * and wrap, so a reader should compute rates such as executions per second
+ * from the difference of two samples modulo 2^32.  No field is ever updated
+ * in a way that a reader could see half of, so no sequence count is needed,
+ * but a sum over the slots is not a snapshot of one instant.  All fields are
+ * laid out so that the format is identical for 32-bit and 64-bit writers.
+ */
+
+#ifndef _FUZZ_STATS_H_
+#define _FUZZ_STATS_H_ 1
+
+#define FUZZ_STATS_MAGIC "DrMFuzz"
+/* Must be bumped whenever the structures below change */
+#define FUZZ_STATS_VERSION 1
+
+#define FUZZ_STATS_MAX_THREADS 64
+
+typedef struct _fuzz_stats_counts_t {
+    uint execs;        /* fuzz target iterations completed */
+    uint new_edges;    /* edges first reached, with -fuzz_edge_coverage */
+    uint corpus_added; /* inputs written to the corpus output directory */
+    uint errors;       /* errors reported while fuzzing */
+} fuzz_stats_counts_t;
+
+/* Each slot is a cache line of its own so threads do not contend */
+typedef struct _fuzz_stats_slot_t {
+    /* 0 while the slot is free */
+    volatile uint thread_id;
+    uint padding1;
+    fuzz_stats_counts_t counts;
+    uint padding2[10];
+} fuzz_stats_slot_t;
+
+typedef struct _fuzz_stats_t {
+    char magic[8];
+    uint version;
+    uint size;         /* of this structure */
+    uint pid;          /* of the fork server, if any */
+    uint max_threads;  /* entries in slots */
+    /* Milliseconds since the Epoch at which fuzzing started */
+    uint64 start_time;
+    /* The counts of threads that have exited, or that found no free slot.
+     * These are updated atomically.
+     */
+    fuzz_stats_counts_t retired;
+    /* Inputs in the -fuzz_corpus directory */
+    uint corpus_inputs;
+    /* The target's basic block count as of the last iteration, where known */
+    uint num_bbs;
+    /* With -fuzz_fork_server: the children run and those that crashed or
+     * reported errors
+     */
+    uint fork_children;
+    uint fork_crashes;
+    uint fork_errors;
+    /* So that the slots start on a cache line of their own */
+    uint padding[15];
+    fuzz_stats_slot_t slots[FUZZ_STATS_MAX_THREADS];
+} fuzz_stats_t;
+
+#endif /* _FUZZ_STATS_H_ */
@@ -33,10 +33,18 @@
 #include "drmemory.h"
 #include "drvector.h"
 #include "alloc.h"
+#include "alloc_drmem.h"
+#include "callstack.h"
+#include "fuzz_stats.h"
 
 #ifdef UNIX
 # include <dirent.h> /* opendir, readdir */
-#else
+#endif
+#ifdef LINUX
+# include "sysnum_linux.h"
+# include <sys/wait.h> /* WIFSIGNALED, WEXITSTATUS */
+#endif
+#ifdef WINDOWS
 # include <windows.h>
 # include "dbghelp.h"
 #endif
@@ -90,14 +98,24 @@ typedef struct _fuzz_state_t {
     thread_id_t thread_id;   /* always safe to access without lock */
     drfuzz_mutator_t *mutator;
     uint64 num_bbs;          /* number of basic blocks seen */
+    /* -fuzz_cmp_dictionary values added to mutator, if it is not a corpus mutator */
+    uint cmp_values_added;
+
+    /* whether this thread holds one of the -fuzz_threads fuzzing slots */
+    bool worker;
+    /* -fuzz_live_stats slot claimed by this thread, if any */
+    fuzz_stats_slot_t *stats_slot;
+    bool stats_full;         /* no slot was free */
 
     /* fields for corpus based mutation */
-    /* index in corpus_vec indicating which input file has been executed */
-    uint   corpus_index;
     /* index in mutator_vec indicating which mutator to be used */
     uint   mutator_index;
+    /* the mutator_vec entry claimed for the current iteration, if any */
+    struct _corpus_mutator_t *claimed;
     bool   should_mutate;    /* perform mutation on mutators from mutator_vec */
     bool   use_orig_input;   /* run with original input from app */
+    bool   corpus_done;      /* this thread has finished its corpus fuzzing */
+    bool   minimize_done;    /* -fuzz_corpus_minimize: no corpus input is left */
 
     /* While fields below are thread-local like the others, they may be read
      * by another thread at any time, i.e., during error reporting.
@@ -151,7 +169,8 @@ typedef struct _fuzz_target_t {
     const callconv_args_t *callconv_args;
     bool use_coverage;      /* use basic block coverage info for mutation */
     /* fields that need fuzz_target_lock for synchronized update */
-    thread_id_t tid;        /* the thread that performs fuzzing */
+    uint workers;           /* threads holding a fuzzing slot (at most -fuzz_threads) */
+    uint workers_done;      /* workers that have finished corpus fuzzing */
 } fuzz_target_t;
 
 static fuzz_target_t fuzz_target;
@@ -160,20 +179,42 @@ static fuzz_target_t fuzz_target;
 static void *fuzz_target_lock;
 
 
-/* Tables for corpus based fuzzing.
- * FIXME i#1842: we do not support multiple threads fuzzing the same target function.
+/* Tables for corpus based fuzzing, shared by all fuzzing threads.
  */
 /* The corpus_vec stores corpus input file names.
  * All its operations are synchronized.
  */
 drvector_t corpus_vec;
-/* The mutator_vec stores created mutators.
+/* The mutator_vec stores created mutators as corpus_mutator_t entries.
  * All its operations are synchronized.
  */
 drvector_t mutator_vec;
 #define CORPUS_VEC_INIT_SIZE 64
 #define MUTATOR_VEC_INIT_SIZE 64
 
+/* A mutator is not thread-safe, so a fuzzing thread claims a mutator_vec entry
+ * for one iteration of the target.
+ */
+typedef struct _corpus_mutator_t {
+    drfuzz_mutator_t *mutator;
+    bool busy; /* protected by the mutator_vec lock */
+    uint cmp_values_added; /* -fuzz_cmp_dictionary values added to mutator */
+} corpus_mutator_t;
+
+/* The next corpus_vec entry to execute.  Each corpus input is executed by only
+ * one thread.  Protected by fuzz_target_lock.
+ */
+static uint corpus_next;
+/* The coverage last added to the corpus, so that an input is only added when
+ * the target's shared basic block count has grown since.
+ * Protected by fuzz_target_lock.
+ */
+static uint64 corpus_num_bbs;
+/* The number of inputs written to -fuzz_corpus_out by -fuzz_corpus_minimize.
+ * Protected by fuzz_target_lock.
+ */
+static uint corpus_num_kept;
+
 static drfuzz_mutator_api_t mutator_api = {sizeof(mutator_api),};
 static int mutator_argc;
 static char **mutator_argv;
@@ -230,10 +271,38 @@ load_fuzz_corpus_input(void *dcontext, const char *fname, fuzz_state_t *state);
 static bool
 dump_fuzz_corpus_input(void *dcontext, fuzz_state_t *state);
 
+static void
+fuzz_buckets_init(void);
+
+static void
+fuzz_buckets_exit(void);
+
+static void
+fuzz_stats_init(void);
+
+static void
+fuzz_stats_exit(void);
+
+static void
+fuzz_stats_corpus_added(fuzz_state_t *state);
+
+static void
+fuzz_stats_error(fuzz_state_t *state);
+
+static void
+fuzz_stats_thread_exit(fuzz_state_t *state);
+
+#if defined(LINUX) && defined(X86)
+static void
+fork_server_exit(void);
+#endif
+
 static void
 mutator_vec_entry_free(void *entry)
 {
-    mutator_api.drfuzz_mutator_stop(entry);
+    corpus_mutator_t *cm = (corpus_mutator_t *) entry;
+    mutator_api.drfuzz_mutator_stop(cm->mutator);
+    global_free(cm, sizeof(*cm), HEAPSTAT_MISC);
 }
 
 static void
@@ -292,6 +361,70 @@ fuzzer_read_corpus_list(void)
 }
 #endif
 
+/* For -fuzz_corpus_minimize, we replay smaller inputs first, so that of the
+ * inputs reaching the same coverage the smallest one is kept.  This is a greedy
+ * approximation of a minimal covering set.  We use a heapsort as we have no
+ * qsort available in all of our build configurations.
+ */
+typedef struct _corpus_sort_entry_t {
+    char *fname;
+    uint64 size;
+} corpus_sort_entry_t;
+
+static void
+corpus_sort_sift_down(corpus_sort_entry_t *a, uint root, uint n)
+{
+    while (2*root + 1 < n) {
+        uint child = 2*root + 1;
+        corpus_sort_entry_t tmp;
+        if (child + 1 < n && a[child].size < a[child+1].size)
+            child++;
+        if (a[root].size >= a[child].size)
+            return;
+        tmp = a[root];
+        a[root] = a[child];
+        a[child] = tmp;
+        root = child;
+    }
+}
+
+static void
+fuzzer_sort_corpus_list(void)
+{
+    corpus_sort_entry_t *a;
+    uint i, n = corpus_vec.entries;
+    char path[MAXIMUM_PATH];
+    if (n < 2)
+        return;
+    a = global_alloc(n * sizeof(*a), HEAPSTAT_MISC);
+    for (i = 0; i < n; i++) {
+        file_t f;
+        a[i].fname = drvector_get_entry(&corpus_vec, i);
+        a[i].size = 0;
+        dr_snprintf(path, BUFFER_SIZE_ELEMENTS(path), "%s%c%s", options.fuzz_corpus,
+                    DIRSEP, a[i].fname);
+        NULL_TERMINATE_BUFFER(path);
+        f = dr_open_file(path, DR_FILE_READ);
+        if (f != INVALID_FILE) {
+            if (!dr_file_size(f, &a[i].size))
+                a[i].size = 0;
+            dr_close_file(f);
+        }
+    }
+    for (i = n/2; i > 0; i--)
+        corpus_sort_sift_down(a, i - 1, n);
+    for (i = n; i > 1; i--) {
+        corpus_sort_entry_t tmp = a[0];
+        a[0] = a[i - 1];
+        a[i - 1] = tmp;
+        corpus_sort_sift_down(a, 0, i - 1);
+    }
+    for (i = 0; i < n; i++)
+        drvector_set_entry(&corpus_vec, i, a[i].fname);
+    global_free(a, n * sizeof(*a), HEAPSTAT_MISC);
+    LOG(2, LOG_PREFIX" sorted %d corpus inputs by size\n", n);
+}
+
 static inline void
 replace_char(char *dst, char old, char new)
 {
@@ -310,6 +443,14 @@ fuzzer_init(client_id_t client_id)
     drmgr_init();
     if (drfuzz_init(client_id) != DRMF_SUCCESS)
         ASSERT(false, "fail to init Dr. Fuzz");
+    if (options.fuzz_edge_coverage && drfuzz_enable_edge_coverage() != DRMF_SUCCESS) {
+        NOTIFY_ERROR("Fuzzer failed to enable edge coverage."NL);
+        dr_abort();
+    }
+    if (options.fuzz_cmp_dictionary && drfuzz_enable_cmp_capture() != DRMF_SUCCESS) {
+        NOTIFY_ERROR("Fuzzer failed to enable comparison capture."NL);
+        dr_abort();
+    }
 
     tls_idx_fuzzer = drmgr_register_tls_field();
     if (tls_idx_fuzzer < 0) {
@@ -342,33 +483,52 @@ fuzzer_init(client_id_t client_id)
             NOTIFY_ERROR("Fuzzer failed to read corpus list."NL);
             dr_abort();
         }
-        if (option_specified.fuzz_corpus_out &&
-            !dr_directory_exists(options.fuzz_corpus_out)) {
-            NOTIFY_ERROR("Corpus output directory %s does not exist."NL,
-                         options.fuzz_corpus_out);
-            dr_abort();
-        }
+        if (options.fuzz_corpus_minimize)
+            fuzzer_sort_corpus_list();
+    }
+    if (options.fuzz_error_buckets > 0)
+        fuzz_buckets_init();
+    if (options.fuzz_live_stats)
+        fuzz_stats_init();
+    if (option_specified.fuzz_corpus_out &&
+        !dr_directory_exists(options.fuzz_corpus_out)) {
+        NOTIFY_ERROR("Corpus output directory %s does not exist."NL,
+                     options.fuzz_corpus_out);
+        dr_abort();
     }
 }
 
 void
 fuzzer_exit()
 {
-    uint64 num_bbs;
+    uint64 num_bbs, num_edges;
 
     if (option_specified.fuzz_corpus) {
+        if (options.fuzz_corpus_minimize) {
+            NOTIFY("Corpus minimization kept %d of %d inputs in %s"NL,
+                   corpus_num_kept, corpus_vec.entries, options.fuzz_corpus_out);
+        }
         drvector_delete(&mutator_vec);
         drvector_delete(&corpus_vec);
     }
     fuzzer_mutator_option_exit();
+    fuzz_buckets_exit();
+    fuzz_stats_exit();
 
     free_fuzz_target();
+#if defined(LINUX) && defined(X86)
+    fork_server_exit();
+#endif
 
     dr_mutex_destroy(fuzz_state_lock);
     dr_mutex_destroy(fuzz_target_lock);
 
     drfuzz_get_target_num_bbs(NULL, &num_bbs);
     LOG(1, LOG_PREFIX" "SZFMT" basic blocks seen during execution.\n", num_bbs);
+    if (options.fuzz_edge_coverage && drfuzz_get_num_edges(&num_edges) == DRMF_SUCCESS) {
+        LOG(1, LOG_PREFIX" "UINT64_FORMAT_STRING" edges seen during fuzzing.\n",
+            num_edges);
+    }
 
     if (drfuzz_exit() != DRMF_SUCCESS)
         ASSERT(false, "fail to exit Dr. Fuzz");
@@ -542,7 +702,7 @@ fuzzer_option_init()
     if (option_specified.fuzz_one_input)
         fuzzer_set_singleton_input(options.fuzz_one_input);
 
-    if (options.fuzz_coverage)
+    if (options.fuzz_coverage || options.fuzz_edge_coverage)
         fuzz_target.use_coverage = true;
     fuzz_target.buffer_fixed_size = options.fuzz_buffer_fixed_size;
     fuzz_target.buffer_offset = options.fuzz_buffer_offset;
@@ -736,7 +896,10 @@ dump_fuzz_corpus_input(void *dcontext, fuzz_state_t *state)
         options.fuzz_corpus_out : options.fuzz_corpus;
     dr_snprintf(suffix, BUFFER_SIZE_ELEMENTS(suffix), CORPUS_FILE_SUFFIX);
     NULL_TERMINATE_BUFFER(suffix);
-    return dump_fuzz_input(state, logdir, suffix, path, BUFFER_SIZE_ELEMENTS(path));
+    if (!dump_fuzz_input(state, logdir, suffix, path, BUFFER_SIZE_ELEMENTS(path)))
+        return false;
+    fuzz_stats_corpus_added(state);
+    return true;
 }
 
 static bool
@@ -842,8 +1005,10 @@ fuzzer_error_report(IN void *dcontext, OUT char *notify, IN size_t notify_size,
 
     dr_mutex_lock(fuzz_state_lock);
 
-    if (this_thread->input_size > 0)
+    if (this_thread->input_size > 0) {
         report_thread = this_thread;
+        fuzz_stats_error(this_thread);
+    }
     next = state_list;
     while (next != NULL) {
         if (next->state->input_size > 0) {
@@ -885,6 +1050,341 @@ fuzzer_error_report(IN void *dcontext, OUT char *notify, IN size_t notify_size,
     return sofar;
 }
 
+/***************************************************************************************
+ * ERROR BUCKETS
+ */
+
+/* For -fuzz_error_buckets, a target that hits the same bug on many inputs would
+ * otherwise pay for a full report and an input dump on each one that differs in its
+ * deeper frames, and with -fuzz_fork_server on every one, as each child starts from
+ * the parent's error table.  Instead we hash the type and top frames of each error
+ * found while fuzzing into a fixed open-addressing table of buckets, claimed and
+ * counted with atomic operations.  The table is a shared mapping of a file in the
+ * log directory so that the children of a fork server, which inherit the mapping,
+ * share it with the parent.  A full table treats every new bucket as a first hit.
+ */
+#define FUZZ_BUCKETS_FNAME "fuzz_buckets.bin"
+#define FUZZ_BUCKETS_BITS 12
+#define FUZZ_BUCKETS_NUM (1 << FUZZ_BUCKETS_BITS)
+#define FUZZ_BUCKETS_MAX_PROBES 64
+
+typedef struct _fuzz_bucket_t {
+    volatile int hash; /* 0 if unused */
+    volatile int count;
+} fuzz_bucket_t;
+
+static fuzz_bucket_t *fuzz_buckets;
+static size_t fuzz_buckets_size;
+static file_t fuzz_buckets_file = INVALID_FILE;
+/* Only the process that created the table prints its summary */
+static process_id_t fuzz_buckets_owner;
+/* Errors in this process that were only counted, for the fork server child status */
+static int fuzz_buckets_dups;
+
+static void
+fuzz_buckets_init(void)
+{
+    char fname[MAXIMUM_PATH];
+    byte *zeros;
+    size_t size = ALIGN_FORWARD(FUZZ_BUCKETS_NUM * sizeof(fuzz_bucket_t),
+                                dr_page_size());
+    dr_snprintf(fname, BUFFER_SIZE_ELEMENTS(fname), "%s%c%s",
+                logsubdir, DIRSEP, FUZZ_BUCKETS_FNAME);
+    NULL_TERMINATE_BUFFER(fname);
+    fuzz_buckets_file = dr_open_file(fname, DR_FILE_READ | DR_FILE_WRITE_OVERWRITE);
+    if (fuzz_buckets_file == INVALID_FILE) {
+        FUZZ_WARN("unable to create %s: errors will not be bucketed.\n", fname);
+        return;
+    }
+    /* The file must be as large as the mapping */
+    zeros = (byte *) global_alloc(size, HEAPSTAT_MISC);
+    memset(zeros, 0, size);
+    if (dr_write_file(fuzz_buckets_file, zeros, size) == (ssize_t) size) {
+        fuzz_buckets_size = size;
+        fuzz_buckets = (fuzz_bucket_t *)
+            dr_map_file(fuzz_buckets_file, &fuzz_buckets_size, 0, NULL,
+                        DR_MEMPROT_READ | DR_MEMPROT_WRITE, 0/*shared*/);
+    }
+    global_free(zeros, size, HEAPSTAT_MISC);
+    if (fuzz_buckets == NULL || fuzz_buckets_size < size) {
+        FUZZ_WARN("unable to map %s: errors will not be bucketed.\n", fname);
+        if (fuzz_buckets != NULL)
+            dr_unmap_file(fuzz_buckets, fuzz_buckets_size);
+        fuzz_buckets = NULL;
+        dr_close_file(fuzz_buckets_file);
+        fuzz_buckets_file = INVALID_FILE;
+        return;
+    }
+    fuzz_buckets_owner = dr_get_process_id();
+}
+
+static void
+fuzz_buckets_exit(void)
+{
+    uint i, used = 0, max_count = 0;
+    uint64 total = 0;
+    if (fuzz_buckets == NULL)
+        return;
+    if (dr_get_process_id() == fuzz_buckets_owner) {
+        for (i = 0; i < FUZZ_BUCKETS_NUM; i++) {
+            if (fuzz_buckets[i].hash == 0)
+                continue;
+            used++;
+            total += fuzz_buckets[i].count;
+            if ((uint) fuzz_buckets[i].count > max_count)
+                max_count = fuzz_buckets[i].count;
+            LOG(2, LOG_PREFIX" error bucket 0x%08x: %d error(s)\n",
+                fuzz_buckets[i].hash, fuzz_buckets[i].count);
+        }
+        LOG(1, LOG_PREFIX" %d error bucket(s), "UINT64_FORMAT_STRING
+            " error(s), at most %d in one bucket\n", used, total, max_count);
+        if (total > used) {
+            NOTIFY("Fuzzing found errors in %d bucket(s); "UINT64_FORMAT_STRING
+                   " later error(s) in those buckets were counted but not reported"NL,
+                   used, total - used);
+        }
+    }
+    dr_unmap_file(fuzz_buckets, fuzz_buckets_size);
+    fuzz_buckets = NULL;
+    dr_close_file(fuzz_buckets_file);
+    fuzz_buckets_file = INVALID_FILE;
+}
+
+bool
+fuzzer_error_bucketing(IN void *dcontext)
+{
+    fuzz_state_t *state;
+    if (!fuzzer_initialized || fuzz_buckets == NULL)
+        return false;
+    if (dcontext == NULL)
+        dcontext = dr_get_current_drcontext();
+    state = drmgr_get_tls_field(dcontext, tls_idx_fuzzer);
+    /* Errors outside of a fuzz target, e.g. at exit, are reported as usual */
+    return (state != NULL && state->input_size > 0);
+}
+
+/* FNV-1a over the type and the top frames */
+static uint
+fuzz_bucket_hash(uint type, packed_callstack_t *pcs)
+{
+    uint hash = 2166136261U;
+    uint i, num = packed_callstack_num_frames(pcs);
+    raw_frame_t raw;
+#define FUZZ_BUCKET_HASH(val) do { \
+    hash ^= (uint)(val);           \
+    hash *= 16777619U;             \
+} while (0)
+    FUZZ_BUCKET_HASH(type);
+    if (num > options.fuzz_error_buckets)
+        num = options.fuzz_error_buckets;
+    for (i = 0; i < num; i++) {
+        packed_callstack_frame_raw(pcs, i, &raw);
+        if (raw.is_syscall) {
+            FUZZ_BUCKET_HASH(raw.sysnum.number);
+            FUZZ_BUCKET_HASH(raw.sysnum.secondary);
+        } else {
+            FUZZ_BUCKET_HASH((ptr_uint_t) raw.pc);
+            IF_X64(FUZZ_BUCKET_HASH((ptr_uint_t) raw.pc >> 32));
+        }
+    }
+#undef FUZZ_BUCKET_HASH
+    /* 0 marks an unused bucket */
+    return (hash == 0) ? 1 : hash;
+}
+
+bool
+fuzzer_error_bucket_add(uint type, packed_callstack_t *pcs)
+{
+    uint hash, i, probes;
+    if (fuzz_buckets == NULL)
+        return true;
+    hash = fuzz_bucket_hash(type, pcs);
+    i = hash & (FUZZ_BUCKETS_NUM - 1);
+    for (probes = 0; probes < FUZZ_BUCKETS_MAX_PROBES; probes++) {
+        fuzz_bucket_t *bucket = &fuzz_buckets[i];
+        if (bucket->hash == 0 &&
+            atomic_compare_exchange32(&bucket->hash, 0, (int) hash)) {
+            dr_atomic_add32_return_sum(&bucket->count, 1);
+            LOG(2, LOG_PREFIX" new error bucket 0x%08x\n", hash);
+            return true;
+        }
+        /* Re-read in case another thread or process just claimed it */
+        if (bucket->hash == (int) hash) {
+            dr_atomic_add32_return_sum(&bucket->count, 1);
+            dr_atomic_add32_return_sum(&fuzz_buckets_dups, 1);
+            return false;
+        }
+        i = (i + 1) & (FUZZ_BUCKETS_NUM - 1);
+    }
+    LOG(2, LOG_PREFIX" error bucket table is full\n");
+    return true;
+}
+
+/***************************************************************************************
+ * LIVE STATISTICS
+ */
+
+/* For -fuzz_live_stats, fuzz_stats.bin in the log directory holds the counts laid
+ * out in fuzz_stats.h.  As for the error buckets, it is a shared mapping so that the
+ * children of a fork server, which inherit the mapping along with the parent's
+ * fuzz state, count into their parent's slot.  Each fuzzing thread claims a slot at
+ * its first iteration and is then its only writer: the parent of a fork server
+ * waits for each child, so the two never write at once.  A thread that finds no
+ * free slot adds into the retired counts atomically instead.
+ */
+#define FUZZ_STATS_FNAME "fuzz_stats.bin"
+
+static fuzz_stats_t *fuzz_stats;
+static size_t fuzz_stats_size;
+static file_t fuzz_stats_file = INVALID_FILE;
+/* Only the process that created the file retires slots */
+static process_id_t fuzz_stats_owner;
+
+#define FUZZ_STATS_ADD(state, field, val) do {                                    \
+    fuzz_stats_counts_t *counts_ = fuzz_stats_thread_counts(state);              \
+    if (counts_ != NULL)                                                         \
+        counts_->field += (val);                                                 \
+    else                                                                         \
+        dr_atomic_add32_return_sum((volatile int *) &fuzz_stats->retired.field,  \
+                                   (int) (val));                                 \
+} while (0)
+
+static void
+fuzz_stats_init(void)
+{
+    char fname[MAXIMUM_PATH];
+    byte *zeros;
+    size_t size = ALIGN_FORWARD(sizeof(fuzz_stats_t), dr_page_size());
+    dr_snprintf(fname, BUFFER_SIZE_ELEMENTS(fname), "%s%c%s",
+                logsubdir, DIRSEP, FUZZ_STATS_FNAME);
+    NULL_TERMINATE_BUFFER(fname);
+    fuzz_stats_file = dr_open_file(fname, DR_FILE_READ | DR_FILE_WRITE_OVERWRITE);
+    if (fuzz_stats_file == INVALID_FILE) {
+        FUZZ_WARN("unable to create %s: statistics will not be published.\n", fname);
+        return;
+    }
+    /* The file must be as large as the mapping */
+    zeros = (byte *) global_alloc(size, HEAPSTAT_MISC);
+    memset(zeros, 0, size);
+    if (dr_write_file(fuzz_stats_file, zeros, size) == (ssize_t) size) {
+        fuzz_stats_size = size;
+        fuzz_stats = (fuzz_stats_t *)
+            dr_map_file(fuzz_stats_file, &fuzz_stats_size, 0, NULL,
+                        DR_MEMPROT_READ | DR_MEMPROT_WRITE, 0/*shared*/);
+    }
+    global_free(zeros, size, HEAPSTAT_MISC);
+    if (fuzz_stats == NULL || fuzz_stats_size < size) {
+        FUZZ_WARN("unable to map %s: statistics will not be published.\n", fname);
+        if (fuzz_stats != NULL)
+            dr_unmap_file(fuzz_stats, fuzz_stats_size);
+        fuzz_stats = NULL;
+        dr_close_file(fuzz_stats_file);
+        fuzz_stats_file = INVALID_FILE;
+        return;
+    }
+    fuzz_stats_owner = dr_get_process_id();
+    memcpy(fuzz_stats->magic, FUZZ_STATS_MAGIC, sizeof(fuzz_stats->magic));
+    fuzz_stats->version = FUZZ_STATS_VERSION;
+    fuzz_stats->size = sizeof(*fuzz_stats);
+    fuzz_stats->pid = (uint) fuzz_stats_owner;
+    fuzz_stats->max_threads = FUZZ_STATS_MAX_THREADS;
+    fuzz_stats->start_time = dr_get_milliseconds();
+    if (option_specified.fuzz_corpus)
+        fuzz_stats->corpus_inputs = corpus_vec.entries;
+}
+
+static void
+fuzz_stats_exit(void)
+{
+    if (fuzz_stats == NULL)
+        return;
+    if (dr_get_process_id() == fuzz_stats_owner) {
+        LOG(1, LOG_PREFIX" live statistics: %u retired execution(s)\n",
+            fuzz_stats->retired.execs);
+    }
+    dr_unmap_file(fuzz_stats, fuzz_stats_size);
+    fuzz_stats = NULL;
+    dr_close_file(fuzz_stats_file);
+    fuzz_stats_file = INVALID_FILE;
+}
+
+/* Returns the counts of state's slot, claiming one if need be, or NULL if there
+ * is no free slot.
+ */
+static fuzz_stats_counts_t *
+fuzz_stats_thread_counts(fuzz_state_t *state)
+{
+    uint i;
+    if (state->stats_slot != NULL)
+        return &state->stats_slot->counts;
+    if (state->stats_full)
+        return NULL;
+    for (i = 0; i < FUZZ_STATS_MAX_THREADS; i++) {
+        fuzz_stats_slot_t *slot = &fuzz_stats->slots[i];
+        if (slot->thread_id == 0 &&
+            atomic_compare_exchange32((volatile int *) &slot->thread_id, 0,
+                                      (int) state->thread_id)) {
+            state->stats_slot = slot;
+            return &slot->counts;
+        }
+    }
+    LOG(1, LOG_PREFIX" no free live statistics slot for thread %d\n",
+        state->thread_id);
+    state->stats_full = true;
+    return NULL;
+}
+
+static void
+fuzz_stats_iteration(fuzz_state_t *state, generic_func_t target_pc, uint new_edges)
+{
+    uint64 num_bbs;
+    FUZZ_STATS_ADD(state, execs, 1);
+    if (new_edges > 0)
+        FUZZ_STATS_ADD(state, new_edges, new_edges);
+    if (drfuzz_get_target_num_bbs(target_pc, &num_bbs) == DRMF_SUCCESS)
+        fuzz_stats->num_bbs = (uint) num_bbs;
+}
+
+static void
+fuzz_stats_corpus_added(fuzz_state_t *state)
+{
+    if (fuzz_stats != NULL)
+        FUZZ_STATS_ADD(state, corpus_added, 1);
+}
+
+static void
+fuzz_stats_error(fuzz_state_t *state)
+{
+    if (fuzz_stats != NULL)
+        FUZZ_STATS_ADD(state, errors, 1);
+}
+
+/* Folds the slot of an exiting thread into the retired counts and frees it */
+static void
+fuzz_stats_thread_exit(fuzz_state_t *state)
+{
+    fuzz_stats_slot_t *slot = state->stats_slot;
+    if (fuzz_stats == NULL || slot == NULL)
+        return;
+    state->stats_slot = NULL;
+    /* A fork server child's slot still belongs to its parent's thread */
+    if (dr_get_process_id() != fuzz_stats_owner)
+        return;
+    /* A reader summing at this point may count these twice, which is as good
+     * as a sum over the slots gets anyway.
+     */
+    dr_atomic_add32_return_sum((volatile int *) &fuzz_stats->retired.execs,
+                               (int) slot->counts.execs);
+    dr_atomic_add32_return_sum((volatile int *) &fuzz_stats->retired.new_edges,
+                               (int) slot->counts.new_edges);
+    dr_atomic_add32_return_sum((volatile int *) &fuzz_stats->retired.corpus_added,
+                               (int) slot->counts.corpus_added);
+    dr_atomic_add32_return_sum((volatile int *) &fuzz_stats->retired.errors,
+                               (int) slot->counts.errors);
+    memset(&slot->counts, 0, sizeof(slot->counts));
+    slot->thread_id = 0;
+}
+
 /***************************************************************************************
  * SHADOW MEMORY SAVE/RESTORE
  */
@@ -1200,6 +1700,128 @@ shadow_state_exit(void *dcontext, void *fuzzcxt)
     free_shadow_buffers(shadow);
 }
 
+/***************************************************************************************
+ * GLOBAL STATE SAVE/RESTORE
+ */
+
+/* For -fuzz_reset_globals, the writable memory of the target module is copied,
+ * along with its shadow state, at the start of each fuzz pass.  Before each
+ * subsequent iteration of the pass we compare each page with its copy, and
+ * restore the app data and shadow state of those pages that differ.  The option
+ * requires -fuzz_threads 1, so these are only accessed by the fuzzing thread.
+ */
+typedef struct _global_region_t {
+    app_pc start;
+    size_t size;              /* a multiple of PAGE_SIZE */
+    byte *data;               /* copy of the app memory */
+    shadow_buffer_t **shadow; /* one per page; NULL without -check_uninitialized */
+    struct _global_region_t *next;
+} global_region_t;
+
+static global_region_t *global_regions;
+
+static void
+global_state_save_region(app_pc start, size_t size)
+{
+    global_region_t *region;
+    size_t num_pages = size / PAGE_SIZE, i;
+    byte *data = global_alloc(size, HEAPSTAT_MISC);
+
+    if (!dr_safe_read(start, size, data, NULL)) {
+        LOG(1, LOG_PREFIX" failed to read global state "PFX"-"PFX"\n",
+            start, start + size);
+        global_free(data, size, HEAPSTAT_MISC);
+        return;
+    }
+    region = global_alloc(sizeof(*region), HEAPSTAT_MISC);
+    region->start = start;
+    region->size = size;
+    region->data = data;
+    if (options.check_uninitialized) {
+        region->shadow = global_alloc(num_pages * sizeof(*region->shadow),
+                                      HEAPSTAT_MISC);
+        for (i = 0; i < num_pages; i++)
+            region->shadow[i] = shadow_save_region(start + i * PAGE_SIZE, PAGE_SIZE);
+    } else
+        region->shadow = NULL;
+    region->next = global_regions;
+    global_regions = region;
+    LOG(2, LOG_PREFIX" saved global state "PFX"-"PFX"\n", start, start + size);
+}
+
+static void
+global_state_free(void)
+{
+    global_region_t *region, *next;
+    size_t i;
+
+    for (region = global_regions; region != NULL; region = next) {
+        next = region->next;
+        if (region->shadow != NULL) {
+            for (i = 0; i < region->size / PAGE_SIZE; i++) {
+                if (region->shadow[i] != NULL)
+                    shadow_free_buffer(region->shadow[i]);
+            }
+            global_free(region->shadow,
+                        region->size / PAGE_SIZE * sizeof(*region->shadow),
+                        HEAPSTAT_MISC);
+        }
+        global_free(region->data, region->size, HEAPSTAT_MISC);
+        global_free(region, sizeof(*region), HEAPSTAT_MISC);
+    }
+    global_regions = NULL;
+}
+
+static void
+global_state_save(void)
+{
+    module_data_t *module = dr_lookup_module(fuzz_target.module_start);
+    dr_mem_info_t info;
+    app_pc pc;
+
+    global_state_free();
+    if (module == NULL) {
+        FUZZ_ERROR("Failed to find the target module to save its global state."NL);
+        return;
+    }
+    for (pc = module->start; pc < module->end; pc = info.base_pc + info.size) {
+        if (!dr_query_memory_ex(pc, &info) || info.base_pc + info.size <= pc)
+            break;
+        if (info.type != DR_MEMTYPE_FREE && TEST(DR_MEMPROT_WRITE, info.prot)) {
+            app_pc end = info.base_pc + info.size;
+            if (end > module->end)
+                end = module->end;
+            global_state_save_region(pc, end - pc);
+        }
+    }
+    dr_free_module_data(module);
+}
+
+static void
+global_state_restore(void)
+{
+    global_region_t *region;
+    size_t offs;
+    uint dirty = 0;
+
+    for (region = global_regions; region != NULL; region = region->next) {
+        for (offs = 0; offs < region->size; offs += PAGE_SIZE) {
+            if (memcmp(region->start + offs, region->data + offs, PAGE_SIZE) == 0)
+                continue;
+            if (!dr_safe_write(region->start + offs, PAGE_SIZE, region->data + offs,
+                               NULL)) {
+                LOG(1, LOG_PREFIX" failed to restore global state at "PFX"\n",
+                    region->start + offs);
+                continue;
+            }
+            if (region->shadow != NULL && region->shadow[offs / PAGE_SIZE] != NULL)
+                shadow_restore_region(region->shadow[offs / PAGE_SIZE]);
+            dirty++;
+        }
+    }
+    LOG(2, LOG_PREFIX" restored %d dirty global pages\n", dirty);
+}
+
 /***************************************************************************************
  * FUZZER PRIVATE
  */
@@ -1342,6 +1964,7 @@ fuzzer_mutator_init(void *dcontext, fuzz_state_t *fuzz_state)
         NOTIFY_ERROR("Failed to start the mutator with the specified options."NL);
         dr_abort();
     }
+    fuzz_state->cmp_values_added = 0;
 }
 
 /* create new mutator with existing mutator's current value as input seed */
@@ -1370,9 +1993,35 @@ fuzzer_mutator_copy(void *dcontext, fuzz_state_t *state)
     return mutator;
 }
 
+/* For -fuzz_cmp_dictionary, adds the comparison values captured since the
+ * mutator's last mutation to its dictionary.  A corpus mutator keeps its own
+ * count as it moves between threads.
+ */
+static void
+fuzzer_mutator_add_cmp_values(fuzz_state_t *fuzz_state)
+{
+    uint *added = (fuzz_state->claimed != NULL) ?
+        &fuzz_state->claimed->cmp_values_added : &fuzz_state->cmp_values_added;
+    uint num, size;
+    uint64 value;
+    if (mutator_api.drfuzz_mutator_add_token == NULL ||
+        drfuzz_get_num_cmp_values(&num) != DRMF_SUCCESS)
+        return;
+    for (; *added < num; (*added)++) {
+        if (drfuzz_get_cmp_value(*added, &value, &size) != DRMF_SUCCESS)
+            break;
+        /* x86 only, so the low bytes come first as in memory */
+        LOG(2, LOG_PREFIX" adding comparison value 0x"HEX64_FORMAT_STRING" to the"
+            " dictionary\n", value);
+        mutator_api.drfuzz_mutator_add_token(fuzz_state->mutator, &value, size);
+    }
+}
+
 static void
 fuzzer_mutator_next(void *dcontext, fuzz_state_t *fuzz_state)
 {
+    if (options.fuzz_cmp_dictionary)
+        fuzzer_mutator_add_cmp_values(fuzz_state);
     if (fuzz_target.singleton_input == NULL) {
         mutator_api.drfuzz_mutator_get_next_value
             (fuzz_state->mutator, MUTATION_START(fuzz_state->input_buffer));
@@ -1385,11 +2034,33 @@ fuzzer_mutator_next(void *dcontext, fuzz_state_t *fuzz_state)
     });
 }
 
+/* Returns the number of edges first reached by this thread's last iteration,
+ * or 0 without -fuzz_edge_coverage.
+ */
+static uint
+fuzzer_new_edges(void *fuzzcxt)
+{
+    uint num_new = 0;
+    if (options.fuzz_edge_coverage &&
+        drfuzz_get_new_edges(fuzzcxt, &num_new) != DRMF_SUCCESS)
+        ASSERT(false, "failed to get new edges");
+    return num_new;
+}
+
 static void
 fuzzer_mutator_feedback(void *dcontext, generic_func_t target_pc,
-                        fuzz_state_t *fuzz_state)
+                        fuzz_state_t *fuzz_state, uint new_edges)
 {
     uint64 num_bbs;
+    if (options.fuzz_edge_coverage) {
+        if (fuzz_state->repeat && new_edges > 0)
+            mutator_api.drfuzz_mutator_feedback(fuzz_state->mutator, new_edges);
+        LOG(2, LOG_PREFIX" %d new edges seen during fuzzing.\n", new_edges);
+        return;
+    }
+    /* XXX: the target's basic block count is shared by all threads, so with
+     * -fuzz_threads > 1 a thread's feedback includes coverage found by others.
+     */
     if (!fuzz_target.use_coverage ||
         drfuzz_get_target_num_bbs(target_pc, &num_bbs) != DRMF_SUCCESS)
         return;
@@ -1411,6 +2082,378 @@ fuzzer_mutator_exit(fuzz_state_t *fuzz_state)
     }
 }
 
+static corpus_mutator_t *
+mutator_vec_append(drfuzz_mutator_t *mutator, bool busy)
+{
+    corpus_mutator_t *cm = global_alloc(sizeof(*cm), HEAPSTAT_MISC);
+    cm->mutator = mutator;
+    cm->busy = busy;
+    cm->cmp_values_added = 0;
+    drvector_append(&mutator_vec, cm);
+    return cm;
+}
+
+/* Claims the next mutator in mutator_vec that no other thread is using.  There
+ * are never more busy entries than fuzzing threads, so if all are busy we start
+ * a new mutator from this thread's current input and add it to the corpus.
+ */
+static drfuzz_mutator_t *
+mutator_vec_claim(void *dcontext, fuzz_state_t *state)
+{
+    corpus_mutator_t *cm = NULL;
+    uint i;
+
+    ASSERT(state->claimed == NULL, "mutator claimed twice");
+    drvector_lock(&mutator_vec);
+    for (i = 0; i < mutator_vec.entries; i++) {
+        corpus_mutator_t *next;
+        if (state->mutator_index >= mutator_vec.entries)
+            state->mutator_index = 0;
+        /* the lock is not recursive so we cannot use drvector_get_entry() */
+        next = (corpus_mutator_t *) mutator_vec.array[state->mutator_index++];
+        if (!next->busy) {
+            next->busy = true;
+            cm = next;
+            break;
+        }
+    }
+    drvector_unlock(&mutator_vec);
+
+    if (cm == NULL) {
+        LOG(2, LOG_PREFIX" all %d corpus mutators are busy: adding one\n",
+            mutator_vec.entries);
+        state->mutator = NULL;
+        fuzzer_mutator_init(dcontext, state);
+        cm = mutator_vec_append(state->mutator, true/*busy*/);
+    }
+    state->claimed = cm;
+    return cm->mutator;
+}
+
+static void
+mutator_vec_release(fuzz_state_t *state)
+{
+    if (state->claimed == NULL)
+        return;
+    drvector_lock(&mutator_vec);
+    state->claimed->busy = false;
+    drvector_unlock(&mutator_vec);
+    state->claimed = NULL;
+}
+
+/* Returns the next corpus input that no thread has executed yet, or NULL. */
+static const char *
+corpus_vec_claim(void)
+{
+    const char *fname = NULL;
+    dr_mutex_lock(fuzz_target_lock);
+    if (corpus_next < corpus_vec.entries)
+        fname = drvector_get_entry(&corpus_vec, corpus_next++);
+    dr_mutex_unlock(fuzz_target_lock);
+    return fname;
+}
+
+/* Returns whether the target's basic block count has grown since an input was
+ * last added to the corpus by any thread.  The count is shared by all threads,
+ * so with -fuzz_threads > 1 new coverage is credited to whichever thread
+ * notices it first.
+ */
+static bool
+corpus_coverage_is_new(uint64 num_bbs)
+{
+    bool is_new = false;
+    dr_mutex_lock(fuzz_target_lock);
+    if (num_bbs > corpus_num_bbs) {
+        corpus_num_bbs = num_bbs;
+        is_new = true;
+    }
+    dr_mutex_unlock(fuzz_target_lock);
+    return is_new;
+}
+
+#if defined(LINUX) && defined(X86)
+/* For -fuzz_fork_server, the thread that runs the first iteration of a fuzz
+ * pass then serves forks instead of repeating the target itself: it redirects
+ * to fork_entry, app code generated below that forks a child, waits for it,
+ * and calls fork_decide_pc, whose pre-callback fork_server_decide_pre() picks
+ * whether to fork another child.  Each child inherits the code cache, shadow
+ * memory and symbol state, runs the next -fuzz_fork_server iterations from
+ * the target entry, and exits with the number of errors it reported as its
+ * status.  The parent skips its mutator past the inputs each child tried, and
+ * once no inputs remain it runs the target once more with the app's own
+ * arguments.  The fork and wait are app system calls so that DR and our fork
+ * event handle the child as for any app fork.  The option requires
+ * -fuzz_threads 1, so no lock is needed.
+ */
+typedef enum {
+    FORK_SERVER_IDLE,
+    FORK_SERVER_SERVING,   /* parent: children are being forked */
+    FORK_SERVER_FINISHING, /* parent: the final run of the target */
+    FORK_SERVER_FAILED,    /* fork failed: fuzz in-process from now on */
+} fork_server_phase_t;
+
+static fork_server_phase_t fork_phase;
+static bool fork_child;         /* whether this process is a fork server child */
+static uint fork_child_iters;   /* iterations run by this child */
+static byte *fork_stub;
+static app_pc fork_decide_pc;
+static app_pc fork_entry;
+static uint fork_num_children;
+static uint fork_num_errors;    /* children that reported errors */
+static uint fork_num_crashes;   /* children that were killed by a signal */
+
+#define FORK_STUB_SIZE PAGE_SIZE
+/* Stack slots below the target's entry xsp: the wait4 status at 0, the child
+ * pid at 8, and on 32-bit the callee-saved esi at 4 and ebx at 12.
+ */
+#define FORK_STUB_FRAME 16
+#define FORK_SLOT_STATUS 0
+#define FORK_SLOT_PID 8
+#define FORK_EINTR 4
+
+static void
+fork_server_decide_pre(void *wrapcxt, OUT void **user_data)
+{
+    void *dcontext = drwrap_get_drcontext(wrapcxt);
+    fuzz_state_t *state = drmgr_get_tls_field(dcontext, tls_idx_fuzzer);
+    int pid = (int)(ptr_int_t) drwrap_get_arg(wrapcxt, 0);
+    int status = (int)(ptr_int_t) drwrap_get_arg(wrapcxt, 1);
+    bool more = true;
+    uint i;
+
+    if (pid < 0) {
+        FUZZ_WARN("fork failed with %d: fuzzing in-process instead.\n", pid);
+        fork_phase = FORK_SERVER_FAILED;
+        drwrap_skip_call(wrapcxt, (void *) false, 0);
+        return;
+    }
+    fork_num_children++;
+    if (WIFSIGNALED(status)) {
+        fork_num_crashes++;
+        NOTIFY("Fuzz child %d was killed by signal %d"NL, pid, WTERMSIG(status));
+    } else if (WIFEXITED(status) && WEXITSTATUS(status) > 0) {
+        fork_num_errors++;
+        NOTIFY("Fuzz child %d reported %d error(s)"NL, pid, WEXITSTATUS(status));
+    }
+    if (fuzz_stats != NULL) {
+        fuzz_stats->fork_children = fork_num_children;
+        fuzz_stats->fork_crashes = fork_num_crashes;
+        fuzz_stats->fork_errors = fork_num_errors;
+    }
+    /* Mirror the child's iterations (see post_fuzz()) so the next child
+     * continues where it stopped.
+     */
+    for (i = 0; i < options.fuzz_fork_server && more; i++) {
+        fuzzer_mutator_next(dcontext, state);
+        state->repeat_index++;
+        more = (fuzz_target.repeat_count < 0 ||
+                state->repeat_index < (uint) fuzz_target.repeat_count) &&
+            mutator_api.drfuzz_mutator_has_next_value(state->mutator);
+    }
+    LOG(2, LOG_PREFIX" fuzz child %d finished at iteration #%d\n", pid,
+        state->repeat_index);
+    if (!more)
+        fork_phase = FORK_SERVER_FINISHING;
+    drwrap_skip_call(wrapcxt, (void *)(ptr_uint_t) more, 0);
+}
+
+#ifdef X64
+# define FORK_SYSCALL(dc) INSTR_CREATE_syscall(dc)
+#else
+# define FORK_SYSCALL(dc) INSTR_CREATE_int(dc, OPND_CREATE_INT8((sbyte)0x80))
+#endif
+
+static bool
+fork_server_create_stub(void *dcontext, generic_func_t target_pc)
+{
+    instrlist_t *ilist;
+    instr_t *fork_label, *wait_label, *report_label, *child_label, *instr;
+    opnd_t xsp = opnd_create_reg(DR_REG_XSP);
+    opnd_t xax = opnd_create_reg(DR_REG_XAX);
+    opnd_t eax = opnd_create_reg(DR_REG_EAX);
+    byte *pc;
+
+    fork_stub = (byte *)
+        nonheap_alloc(FORK_STUB_SIZE, DR_MEMPROT_READ|DR_MEMPROT_WRITE|DR_MEMPROT_EXEC,
+                      HEAPSTAT_GENCODE);
+    /* The decision routine, which fork_server_decide_pre() always skips */
+    fork_decide_pc = fork_stub;
+    instr = INSTR_CREATE_xor(dcontext, eax, eax);
+    pc = instr_encode(dcontext, instr, fork_stub);
+    instr_destroy(dcontext, instr);
+    instr = INSTR_CREATE_ret(dcontext);
+    pc = instr_encode(dcontext, instr, pc);
+    instr_destroy(dcontext, instr);
+    fork_entry = pc;
+
+    ilist = instrlist_create(dcontext);
+    fork_label = INSTR_CREATE_label(dcontext);
+    wait_label = INSTR_CREATE_label(dcontext);
+    report_label = INSTR_CREATE_label(dcontext);
+    child_label = INSTR_CREATE_label(dcontext);
+    instrlist_append(ilist, INSTR_CREATE_sub
+                     (dcontext, xsp, OPND_CREATE_INT8(FORK_STUB_FRAME)));
+    instrlist_append(ilist, INSTR_CREATE_mov_st
+                     (dcontext, OPND_CREATE_MEM32(DR_REG_XSP, FORK_SLOT_STATUS),
+                      OPND_CREATE_INT32(0)));
+#ifndef X64
+    instrlist_append(ilist, INSTR_CREATE_mov_st
+                     (dcontext, OPND_CREATE_MEM32(DR_REG_XSP, 12),
+                      opnd_create_reg(DR_REG_EBX)));
+    instrlist_append(ilist, INSTR_CREATE_mov_st
+                     (dcontext, OPND_CREATE_MEM32(DR_REG_XSP, 4),
+                      opnd_create_reg(DR_REG_ESI)));
+#endif
+    /* fork; the child goes straight to the target */
+    instrlist_append(ilist, fork_label);
+    instrlist_append(ilist, INSTR_CREATE_mov_imm
+                     (dcontext, eax, OPND_CREATE_INT32(SYS_fork)));
+    instrlist_append(ilist, FORK_SYSCALL(dcontext));
+    instrlist_append(ilist, INSTR_CREATE_test(dcontext, xax, xax));
+    instrlist_append(ilist, INSTR_CREATE_jcc
+                     (dcontext, OP_jz, opnd_create_instr(child_label)));
+    instrlist_append(ilist, INSTR_CREATE_mov_st
+                     (dcontext, OPND_CREATE_MEMPTR(DR_REG_XSP, FORK_SLOT_PID), xax));
+    instrlist_append(ilist, INSTR_CREATE_jcc
+                     (dcontext, OP_js, opnd_create_instr(report_label)));
+    /* wait4(pid, &status, 0, NULL), retried on EINTR */
+    instrlist_append(ilist, wait_label);
+#ifdef X64
+    instrlist_append(ilist, INSTR_CREATE_mov_ld
+                     (dcontext, opnd_create_reg(DR_REG_XDI),
+                      OPND_CREATE_MEMPTR(DR_REG_XSP, FORK_SLOT_PID)));
+    instrlist_append(ilist, INSTR_CREATE_lea
+                     (dcontext, opnd_create_reg(DR_REG_XSI),
+                      OPND_CREATE_MEM_lea(DR_REG_XSP, DR_REG_NULL, 0,
+                                          FORK_SLOT_STATUS)));
+    instrlist_append(ilist, INSTR_CREATE_xor
+                     (dcontext, opnd_create_reg(DR_REG_EDX),
+                      opnd_create_reg(DR_REG_EDX)));
+    instrlist_append(ilist, INSTR_CREATE_xor
+                     (dcontext, opnd_create_reg(DR_REG_R10D),
+                      opnd_create_reg(DR_REG_R10D)));
+#else
+    instrlist_append(ilist, INSTR_CREATE_mov_ld
+                     (dcontext, opnd_create_reg(DR_REG_EBX),
+                      OPND_CREATE_MEMPTR(DR_REG_XSP, FORK_SLOT_PID)));
+    instrlist_append(ilist, INSTR_CREATE_lea
+                     (dcontext, opnd_create_reg(DR_REG_ECX),
+                      OPND_CREATE_MEM_lea(DR_REG_XSP, DR_REG_NULL, 0,
+                                          FORK_SLOT_STATUS)));
+    instrlist_append(ilist, INSTR_CREATE_xor
+                     (dcontext, opnd_create_reg(DR_REG_EDX),
+                      opnd_create_reg(DR_REG_EDX)));
+    instrlist_append(ilist, INSTR_CREATE_xor
+                     (dcontext, opnd_create_reg(DR_REG_ESI),
+                      opnd_create_reg(DR_REG_ESI)));
+#endif
+    instrlist_append(ilist, INSTR_CREATE_mov_imm
+                     (dcontext, eax, OPND_CREATE_INT32(SYS_wait4)));
+    instrlist_append(ilist, FORK_SYSCALL(dcontext));
+    instrlist_append(ilist, INSTR_CREATE_cmp
+                     (dcontext, xax, OPND_CREATE_INT8(-FORK_EINTR)));
+    instrlist_append(ilist, INSTR_CREATE_jcc
+                     (dcontext, OP_je, opnd_create_instr(wait_label)));
+    /* fork another child if fork_server_decide_pre() says so */
+    instrlist_append(ilist, report_label);
+#ifdef X64
+    instrlist_append(ilist, INSTR_CREATE_mov_ld
+                     (dcontext, opnd_create_reg(DR_REG_XDI),
+                      OPND_CREATE_MEMPTR(DR_REG_XSP, FORK_SLOT_PID)));
+    instrlist_append(ilist, INSTR_CREATE_mov_ld
+                     (dcontext, opnd_create_reg(DR_REG_ESI),
+                      OPND_CREATE_MEM32(DR_REG_XSP, FORK_SLOT_STATUS)));
+    instrlist_append(ilist, INSTR_CREATE_call(dcontext, opnd_create_pc(fork_decide_pc)));
+#else
+    instrlist_append(ilist, INSTR_CREATE_mov_ld
+                     (dcontext, eax, OPND_CREATE_MEM32(DR_REG_XSP, FORK_SLOT_STATUS)));
+    instrlist_append(ilist, INSTR_CREATE_mov_ld
+                     (dcontext, opnd_create_reg(DR_REG_EDX),
+                      OPND_CREATE_MEM32(DR_REG_XSP, FORK_SLOT_PID)));
+    instrlist_append(ilist, INSTR_CREATE_push(dcontext, eax));
+    instrlist_append(ilist, INSTR_CREATE_push(dcontext, opnd_create_reg(DR_REG_EDX)));
+    instrlist_append(ilist, INSTR_CREATE_call(dcontext, opnd_create_pc(fork_decide_pc)));
+    instrlist_append(ilist, INSTR_CREATE_add
+                     (dcontext, xsp, OPND_CREATE_INT8(2 * sizeof(reg_t))));
+#endif
+    instrlist_append(ilist, INSTR_CREATE_test(dcontext, eax, eax));
+    instrlist_append(ilist, INSTR_CREATE_jcc
+                     (dcontext, OP_jnz, opnd_create_instr(fork_label)));
+    /* the child, or the parent once done: on to the target */
+    instrlist_append(ilist, child_label);
+#ifndef X64
+    instrlist_append(ilist, INSTR_CREATE_mov_ld
+                     (dcontext, opnd_create_reg(DR_REG_EBX),
+                      OPND_CREATE_MEM32(DR_REG_XSP, 12)));
+    instrlist_append(ilist, INSTR_CREATE_mov_ld
+                     (dcontext, opnd_create_reg(DR_REG_ESI),
+                      OPND_CREATE_MEM32(DR_REG_XSP, 4)));
+#endif
+    instrlist_append(ilist, INSTR_CREATE_add
+                     (dcontext, xsp, OPND_CREATE_INT8(FORK_STUB_FRAME)));
+    instrlist_append(ilist, INSTR_CREATE_mov_imm
+                     (dcontext, xax, OPND_CREATE_INTPTR(target_pc)));
+    instrlist_append(ilist, INSTR_CREATE_jmp_ind(dcontext, xax));
+
+    pc = instrlist_encode(dcontext, ilist, fork_entry, true/*has instr targets*/);
+    instrlist_clear_and_destroy(dcontext, ilist);
+    ASSERT(pc != NULL && pc < fork_stub + FORK_STUB_SIZE, "fork stub too large");
+    /* we keep it read-only, as for the realloc gencode (DRi#404) */
+    if (pc == NULL ||
+        !dr_memory_protect(fork_stub, FORK_STUB_SIZE, DR_MEMPROT_READ|DR_MEMPROT_EXEC) ||
+        !drwrap_wrap(fork_decide_pc, fork_server_decide_pre, NULL)) {
+        nonheap_free(fork_stub, FORK_STUB_SIZE, HEAPSTAT_GENCODE);
+        fork_stub = NULL;
+        return false;
+    }
+    LOG(2, LOG_PREFIX" fork server stub @"PFX"-"PFX"\n", fork_stub, pc);
+    return true;
+}
+
+/* Called from post_fuzz() when the parent would repeat the target */
+static void
+fork_server_start(void *fuzzcxt, generic_func_t target_pc)
+{
+    void *dcontext = drfuzz_get_drcontext(fuzzcxt);
+    if (fork_stub == NULL && !fork_server_create_stub(dcontext, target_pc)) {
+        FUZZ_WARN("failed to create the fork server: fuzzing in-process instead.\n");
+        fork_phase = FORK_SERVER_FAILED;
+        return;
+    }
+    if (drfuzz_set_repeat_pc(fuzzcxt, fork_entry) != DRMF_SUCCESS) {
+        ASSERT(false, "failed to redirect to the fork server");
+        fork_phase = FORK_SERVER_FAILED;
+        return;
+    }
+    fork_phase = FORK_SERVER_SERVING;
+}
+
+static void
+fork_server_child_exit(fuzz_state_t *state)
+{
+    /* Errors only counted in a bucket are still errors found by this child */
+    uint num_errors = report_num_errors() + fuzz_buckets_dups;
+    LOG(1, LOG_PREFIX" fuzz child exiting at iteration #%d with %d error(s)\n",
+        state->repeat_index, num_errors);
+    dr_exit_process(num_errors > 255 ? 255 : num_errors);
+}
+
+static void
+fork_server_exit(void)
+{
+    if (fork_num_children > 0) {
+        LOG(1, LOG_PREFIX" forked %d children: %d reported errors, %d crashed.\n",
+            fork_num_children, fork_num_errors, fork_num_crashes);
+    }
+    if (fork_stub != NULL) {
+        if (!drwrap_unwrap(fork_decide_pc, fork_server_decide_pre, NULL))
+            ASSERT(false, "failed to unwrap the fork server");
+        nonheap_free(fork_stub, FORK_STUB_SIZE, HEAPSTAT_GENCODE);
+        fork_stub = NULL;
+    }
+}
+#endif /* LINUX && X86 */
+
 /* Pre fuzz function for corpus based fuzzing.
  * We have two phases: corpus phase and mutate phase.
  * In the corpus phase (if state->should_mutate is false), we load corpus inputs
@@ -1428,13 +2471,15 @@ pre_fuzz_corpus(void *fuzzcxt, generic_func_t target_pc, dr_mcontext_t *mc)
     /* corpus phase */
     if (!state->should_mutate) {
         bool has_corpus = false;
-        while (state->corpus_index < corpus_vec.entries) {
-            char *fname = drvector_get_entry(&corpus_vec, state->corpus_index++);
+        const char *fname;
+        while ((fname = corpus_vec_claim()) != NULL) {
             ssize_t read_size;
             read_size = load_fuzz_corpus_input(dcontext, fname, state);
             if (read_size > 0) {
                 state->mutator = NULL;
-                fuzzer_mutator_init(dcontext, state);
+                /* a replay for -fuzz_corpus_minimize needs no mutator */
+                if (!options.fuzz_corpus_minimize)
+                    fuzzer_mutator_init(dcontext, state);
                 if (state->repeat)
                     shadow_state_restore(dcontext, fuzzcxt, state, mc);
                 else /* first fuzz loop */
@@ -1443,6 +2488,15 @@ pre_fuzz_corpus(void *fuzzcxt, generic_func_t target_pc, dr_mcontext_t *mc)
                 break;
             }
         }
+        if (!has_corpus && options.fuzz_corpus_minimize) {
+            /* every input has been replayed: let this call run with the app's
+             * own arguments, which drfuzz restored, and stop in post_fuzz_corpus
+             */
+            if (state->repeat)
+                shadow_state_restore(dcontext, fuzzcxt, state, mc);
+            state->minimize_done = true;
+            return;
+        }
         if (!has_corpus &&
             /* no corpus or all empty corpus, use current input */
             (corpus_vec.entries == 0 || mutator_vec.entries == 0)) {
@@ -1456,15 +2510,19 @@ pre_fuzz_corpus(void *fuzzcxt, generic_func_t target_pc, dr_mcontext_t *mc)
 
     /* mutate phase */
     if (state->should_mutate && mutator_vec.entries > 0) {
+        if (state->use_orig_input) {
+            /* Another thread added to mutator_vec since we checked above:
+             * mutate the shared corpus instead of the app's input.
+             */
+            fuzzer_mutator_exit(state);
+            state->use_orig_input = false;
+        }
         /* pick a mutator for fuzzing */
         /* Assuming we only increase the buffer size with -fuzz_replace_buffer.
          * The current buffer can be used for any mutator we have seen,
          * Xref load_fuzz_input() for when the buffer is replaced.
          */
-        state->mutator = drvector_get_entry(&mutator_vec, state->mutator_index);
-        state->mutator_index++;
-        if (state->mutator_index >= mutator_vec.entries)
-            state->mutator_index = 0;
+        state->mutator = mutator_vec_claim(dcontext, state);
         ASSERT(state->mutator != NULL, "corpus mutator must not be NULL");
         fuzzer_mutator_next(dcontext, state);
         shadow_state_restore(dcontext, fuzzcxt, state, mc);
@@ -1487,21 +2545,49 @@ pre_fuzz(void *fuzzcxt, generic_func_t target_pc, dr_mcontext_t *mc)
     LOG(2, LOG_PREFIX" executing pre-fuzz (repeat=%d) for "PIFX"\n",
         fuzz_state->repeat, target_pc);
 
-    /* i#1782: pick the first thread that hit target function for fuzzing */
-    dr_mutex_lock(fuzz_target_lock);
-    if (fuzz_target.tid == 0)
-        fuzz_target.tid = dr_get_thread_id(dcontext);
-    dr_mutex_unlock(fuzz_target_lock);
+    /* i#1782: the first -fuzz_threads threads that hit the target each fuzz it,
+     * with their own mutator, input buffer and shadow state.
+     */
+    if (!fuzz_state->worker) {
+        dr_mutex_lock(fuzz_target_lock);
+        if (fuzz_target.workers < options.fuzz_threads) {
+            fuzz_target.workers++;
+            fuzz_state->worker = true;
+        }
+        dr_mutex_unlock(fuzz_target_lock);
+    }
 
     if (!fuzz_target.enabled || fuzz_state->skip_initial > 0 ||
-        /* FIXME i#1782: no multiple threads fuzzing support */
-        fuzz_target.tid != dr_get_thread_id(dcontext))
+        !fuzz_state->worker || fuzz_state->corpus_done)
         return;
 
+#if defined(LINUX) && defined(X86)
+    if (fork_phase == FORK_SERVER_SERVING) {
+        /* we are a new child of the fork server */
+        fork_phase = FORK_SERVER_IDLE;
+        fork_child = true;
+        fork_child_iters = 0;
+    } else if (fork_phase == FORK_SERVER_FINISHING) {
+        /* the children tried every input: run the app's own arguments */
+        return;
+    }
+#endif
+
     /* find buffer arg and size arg */
     if (!fuzz_state->repeat && !find_target_buffer(fuzz_state, fuzzcxt, target_pc))
         return;
 
+    /* for -fuzz_iteration_arena; the input buffer comes from the regular arena */
+    alloc_replace_iteration_start(dcontext);
+
+    /* before any mutation of an input buffer that lives in the module's globals */
+    if (options.fuzz_reset_globals) {
+        if (fuzz_state->repeat)
+            global_state_restore();
+        else
+            global_state_save();
+    }
+
     if (option_specified.fuzz_corpus) {
         /* separate handling for fuzzing with corpus */
         pre_fuzz_corpus(fuzzcxt, target_pc, mc);
@@ -1543,32 +2629,84 @@ pre_fuzz(void *fuzzcxt, generic_func_t target_pc, dr_mcontext_t *mc)
     }
 }
 
+static void
+post_fuzz_corpus_done(void *fuzzcxt, fuzz_state_t *state)
+{
+    state->repeat = false;
+    shadow_state_exit(drfuzz_get_drcontext(fuzzcxt), fuzzcxt);
+    free_target_buffer(state, fuzzcxt);
+    /* for corpus fuzzing, we stop fuzzing even if we see the fuzz function again */
+    state->corpus_done = true;
+    dr_mutex_lock(fuzz_target_lock);
+    if (++fuzz_target.workers_done >= options.fuzz_threads)
+        fuzz_target.enabled = false;
+    dr_mutex_unlock(fuzz_target_lock);
+}
+
+/* Post fuzz function for -fuzz_corpus_minimize, which replays each corpus
+ * input once, spread across the fuzzing threads, and writes those that reach
+ * new coverage to -fuzz_corpus_out.  -fuzz_num_iters does not apply.
+ */
+static bool
+post_fuzz_corpus_minimize(void *fuzzcxt, generic_func_t target_pc, uint new_edges)
+{
+    uint64 num_bbs;
+    void *dcontext = drfuzz_get_drcontext(fuzzcxt);
+    fuzz_state_t *state = drmgr_get_tls_field(dcontext, tls_idx_fuzzer);
+
+    if (state->minimize_done) {
+        post_fuzz_corpus_done(fuzzcxt, state);
+        return false; /* stop fuzzing */
+    }
+    if (options.fuzz_edge_coverage ? new_edges > 0 :
+        (drfuzz_get_target_num_bbs(target_pc, &num_bbs) == DRMF_SUCCESS &&
+         corpus_coverage_is_new(num_bbs))) {
+        if (dump_fuzz_corpus_input(dcontext, state)) {
+            dr_mutex_lock(fuzz_target_lock);
+            corpus_num_kept++;
+            dr_mutex_unlock(fuzz_target_lock);
+        }
+    }
+    state->repeat_index++;
+    state->repeat = true;
+    return true;
+}
+
 /* Post fuzz function for corpus based fuzzing.
  * This is where any mutator is added into mutator_vec for future fuzzing.
  */
 static bool
-post_fuzz_corpus(void *fuzzcxt, generic_func_t target_pc)
+post_fuzz_corpus(void *fuzzcxt, generic_func_t target_pc, uint new_edges)
 {
     uint64 num_bbs;
     void *dcontext = drfuzz_get_drcontext(fuzzcxt);
     fuzz_state_t *state = drmgr_get_tls_field(dcontext, tls_idx_fuzzer);
 
+    if (options.fuzz_corpus_minimize)
+        return post_fuzz_corpus_minimize(fuzzcxt, target_pc, new_edges);
+
     if (drfuzz_get_target_num_bbs(target_pc, &num_bbs) == DRMF_SUCCESS) {
+        bool is_new = options.fuzz_edge_coverage ?
+            new_edges > 0 : corpus_coverage_is_new(num_bbs);
         if (!state->should_mutate) {
             /* corpus phase: simply add the mutator into mutator_vec */
-            drvector_append(&mutator_vec, (void *)state->mutator);
-            if (option_specified.fuzz_corpus_out && num_bbs > state->num_bbs)
+            mutator_vec_append(state->mutator, false/*!busy*/);
+            if (option_specified.fuzz_corpus_out && is_new)
                 dump_fuzz_corpus_input(dcontext, state);
-        } else if (num_bbs > state->num_bbs) {
+        } else if (is_new) {
             /* mutate phase: dump and add the mutator if we discover new bbs */
             dump_fuzz_corpus_input(dcontext, state);
-            drvector_append(&mutator_vec,
-                            state->use_orig_input ?
-                            state->mutator : fuzzer_mutator_copy(dcontext, state));
+            mutator_vec_append(state->use_orig_input ?
+                               state->mutator : fuzzer_mutator_copy(dcontext, state),
+                               false/*!busy*/);
             state->use_orig_input = false;
         }
         state->num_bbs = num_bbs;
     }
+    /* fuzzer_mutator_copy() above must finish before another thread can advance
+     * the claimed mutator
+     */
+    mutator_vec_release(state);
 
     if (fuzz_target.repeat_count > 0 &&
         ++state->repeat_index < fuzz_target.repeat_count) {
@@ -1576,11 +2714,7 @@ post_fuzz_corpus(void *fuzzcxt, generic_func_t target_pc)
         return true;
     }
 
-    state->repeat = false;
-    shadow_state_exit(dcontext, fuzzcxt);
-    free_target_buffer(state, fuzzcxt);
-    /* for corpus fuzzing, we stop fuzzing even if we see the fuzz function again */
-    fuzz_target.enabled = false;
+    post_fuzz_corpus_done(fuzzcxt, state);
     return false; /* stop fuzzing */
 }
 
@@ -1590,11 +2724,13 @@ post_fuzz(void *fuzzcxt, generic_func_t target_pc)
     void *dcontext = drfuzz_get_drcontext(fuzzcxt);
     fuzz_state_t *fuzz_state = (fuzz_state_t *) drmgr_get_tls_field(dcontext,
                                                                     tls_idx_fuzzer);
+    uint new_edges;
 
-    if (!fuzz_target.enabled ||
-        /* FIXME i#1782: no multiple threads fuzzing support */
-        fuzz_target.tid != dr_get_thread_id(dcontext))
-        return false; /* in case someone unfuzzed while a target was looping */
+    if (!fuzz_target.enabled || !fuzz_state->worker || fuzz_state->corpus_done) {
+        /* in case someone unfuzzed while a target was looping */
+        alloc_replace_iteration_end(dcontext, (app_pc)target_pc);
+        return false;
+    }
     if (fuzz_state->skip_initial > 0) {
         fuzz_state->skip_initial--;
         return false;
@@ -1602,10 +2738,29 @@ post_fuzz(void *fuzzcxt, generic_func_t target_pc)
 
     LOG(2, LOG_PREFIX" executing post-fuzz for "PIFX"\n", target_pc);
 
+#if defined(LINUX) && defined(X86)
+    if (fork_phase == FORK_SERVER_FINISHING) {
+        fork_phase = FORK_SERVER_IDLE;
+        fuzz_state->repeat = false;
+        goto post_fuzz_done;
+    }
+#endif
+
+    /* the scan must see this iteration's allocations before they are discarded */
+    if (options.fuzz_iteration_leaks)
+        check_reachability(false/*!at_exit*/);
+    alloc_replace_iteration_end(dcontext, (app_pc)target_pc);
+
+    new_edges = fuzzer_new_edges(fuzzcxt);
+    if (fuzz_stats != NULL)
+        fuzz_stats_iteration(fuzz_state, target_pc, new_edges);
     if (option_specified.fuzz_corpus)
-        return post_fuzz_corpus(fuzzcxt, target_pc);
+        return post_fuzz_corpus(fuzzcxt, target_pc, new_edges);
 
-    fuzzer_mutator_feedback(dcontext, target_pc, fuzz_state);
+    fuzzer_mutator_feedback(dcontext, target_pc, fuzz_state, new_edges);
+    /* promote inputs that reach new edges into the corpus */
+    if (new_edges > 0 && option_specified.fuzz_corpus_out)
+        dump_fuzz_corpus_input(dcontext, fuzz_state);
 
     fuzz_state->repeat_index++;
     if (fuzz_target.stat_freq > 0 && fuzz_state->repeat_index % fuzz_target.stat_freq) {
@@ -1623,9 +2778,20 @@ post_fuzz(void *fuzzcxt, generic_func_t target_pc)
     } else
         fuzz_state->repeat = false;
 
+#if defined(LINUX) && defined(X86)
+    if (fork_child &&
+        (!fuzz_state->repeat || ++fork_child_iters >= options.fuzz_fork_server))
+        fork_server_child_exit(fuzz_state);
+    if (fuzz_state->repeat && options.fuzz_fork_server > 0 &&
+        fork_phase == FORK_SERVER_IDLE && !fork_child)
+        fork_server_start(fuzzcxt, target_pc);
+#endif
     if (fuzz_state->repeat)
         return true;
 
+#if defined(LINUX) && defined(X86)
+ post_fuzz_done:
+#endif
     /* do not repeat, clean-up */
     shadow_state_exit(dcontext, fuzzcxt);
     fuzzer_mutator_exit(fuzz_state);
@@ -1676,6 +2842,9 @@ thread_exit(void *dcontext)
     }
     dr_mutex_unlock(fuzz_state_lock);
 
+    /* in case the thread exited during a corpus iteration */
+    mutator_vec_release(state);
+    fuzz_stats_thread_exit(state);
     thread_free(dcontext, state, sizeof(fuzz_state_t), HEAPSTAT_MISC);
     if (state_item == NULL)
         LOG(1, "Error: failed to find an exiting thread in the fuzz state list.\n");
@@ -1761,6 +2930,7 @@ free_fuzz_target()
                     HEAPSTAT_MISC);
     }
     fuzz_target.module_start = 0;
+    global_state_free();
     if (fuzz_target.type == FUZZ_TARGET_SYMBOL && fuzz_target.symbol != NULL) {
         global_free(fuzz_target.symbol, strlen(fuzz_target.symbol) + 1, HEAPSTAT_MISC);
     }
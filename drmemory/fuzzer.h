@@ -91,4 +91,16 @@ size_t
 fuzzer_error_report(IN void *dcontext, OUT char *user_message, IN size_t size,
                     int error_id);
 
+/* Returns whether errors on the current thread are bucketed (-fuzz_error_buckets),
+ * i.e., whether the thread is executing a fuzz target.
+ */
+bool
+fuzzer_error_bucketing(IN void *dcontext);
+
+/* Adds an error with the given type and top frames to its bucket.  Returns whether
+ * it is the first error in the bucket, which should then be reported in full.
+ */
+bool
+fuzzer_error_bucket_add(uint type, struct _packed_callstack_t *pcs);
+
 #endif /* _FUZZER_H_ */
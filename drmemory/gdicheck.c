@@ -30,6 +30,7 @@
  */
 
 #include "dr_api.h"
+#include "drmgr.h"
 #include "drwrap.h"
 #include "drmemory.h"
 #include "callstack.h"
@@ -50,12 +51,28 @@ typedef struct _per_dc_t {
     /* count of non-stock selected objects */
     uint non_stock_selected;
     packed_callstack_t *pcs;
+    /* Whether the DC is in its creating thread's dc_cache.  Protected by the
+     * dc_table lock.
+     */
+    bool cached;
+    /* Whether the DC has been removed from dc_table while still cached, in
+     * which case the creating thread frees it.
+     */
+    bool freed;
 } per_dc_t;
 
 /* Table of per_dc_t entries */
 #define DC_TABLE_HASH_BITS 6
 static hashtable_t dc_table;
 
+/* DCs are mostly used by the thread that created them, so each thread also
+ * keeps an unsynchronized cache of the DCs it created, looked up before
+ * falling back to dc_table.  A cached per_dc_t is only freed by its creating
+ * thread, so a cache hit is never stale.
+ */
+#define DC_CACHE_HASH_BITS 4
+static int tls_idx_gdicheck = -1;
+
 /* Table of selected object handles that stores DC selected into */
 #define SELECTED_TABLE_HASH_BITS 8
 static hashtable_t selected_table;
@@ -69,6 +86,35 @@ per_dc_free(void *p)
     global_free(pdc, sizeof(*pdc), HEAPSTAT_HASHTABLE);
 }
 
+/* Called with the dc_table lock held when a DC leaves dc_table */
+static void
+per_dc_release(void *p)
+{
+    per_dc_t *pdc = (per_dc_t *) p;
+    if (pdc->cached)
+        pdc->freed = true;
+    else
+        per_dc_free(p);
+}
+
+static per_dc_t *
+dc_lookup(HDC hdc)
+{
+    hashtable_t *cache = (hashtable_t *)
+        drmgr_get_tls_field(dr_get_current_drcontext(), tls_idx_gdicheck);
+    if (cache != NULL) {
+        per_dc_t *pdc = (per_dc_t *) hashtable_lookup(cache, (void *)hdc);
+        if (pdc != NULL) {
+            if (!pdc->freed)
+                return pdc;
+            /* freed by another thread: no longer referenced from dc_table */
+            hashtable_remove(cache, (void *)hdc);
+            per_dc_free((void *)pdc);
+        }
+    }
+    return (per_dc_t *) hashtable_lookup(&dc_table, (void *)hdc);
+}
+
 static void
 gdicheck_module_load(void *drcontext, const module_data_t *info, bool loaded);
 
@@ -78,10 +124,12 @@ gdicheck_init(void)
     ASSERT(options.check_gdi, "incorrectly called");
 
     drmgr_register_module_load_event(gdicheck_module_load);
+    tls_idx_gdicheck = drmgr_register_tls_field();
+    ASSERT(tls_idx_gdicheck > -1, "unable to reserve TLS slot");
 
     hashtable_init_ex(&dc_table, DC_TABLE_HASH_BITS, HASH_INTPTR,
                       false/*!str_dup*/, true/*synch*/,
-                      per_dc_free, NULL, NULL);
+                      per_dc_release, NULL, NULL);
     hashtable_init(&selected_table, SELECTED_TABLE_HASH_BITS, HASH_INTPTR,
                       false/*!str_dup*/);
 }
@@ -92,32 +140,50 @@ gdicheck_exit(void)
     ASSERT(options.check_gdi, "incorrectly called");
     hashtable_delete_with_stats(&dc_table, "DC table");
     hashtable_delete_with_stats(&selected_table, "selected object table");
+    drmgr_unregister_tls_field(tls_idx_gdicheck);
 }
 
 void
 gdicheck_thread_init(void *drcontext)
 {
+    hashtable_t *cache;
     ASSERT(options.check_gdi, "incorrectly called");
+    cache = (hashtable_t *) global_alloc(sizeof(*cache), HEAPSTAT_HASHTABLE);
+    hashtable_init_ex(cache, DC_CACHE_HASH_BITS, HASH_INTPTR,
+                      false/*!str_dup*/, false/*!synch*/, NULL, NULL, NULL);
+    drmgr_set_tls_field(drcontext, tls_idx_gdicheck, (void *) cache);
 }
 
 void
 gdicheck_thread_exit(void *drcontext)
 {
     uint i;
-    thread_id_t tid = dr_get_thread_id(drcontext);
+    hashtable_t *cache = (hashtable_t *)
+        drmgr_get_tls_field(drcontext, tls_idx_gdicheck);
     ASSERT(options.check_gdi, "incorrectly called");
+    if (cache == NULL)
+        return;
+    /* Only this thread's cache needs walking: it holds every DC we created
+     * that has not been freed by us.
+     */
     hashtable_lock(&dc_table);
-    for (i = 0; i < HASHTABLE_SIZE(dc_table.table_bits); i++) {
+    for (i = 0; i < HASHTABLE_SIZE(cache->table_bits); i++) {
         hash_entry_t *he;
-        for (he = dc_table.table[i]; he != NULL; he = he->next) {
+        for (he = cache->table[i]; he != NULL; he = he->next) {
             per_dc_t *pdc = (per_dc_t *) he->payload;
-            if (pdc->thread == tid) {
+            if (pdc->freed)
+                per_dc_free((void *)pdc);
+            else {
                 /* indicate this DC should not be used */
                 pdc->exited = true;
+                pdc->cached = false;
             }
         }
     }
     hashtable_unlock(&dc_table);
+    hashtable_delete(cache);
+    global_free(cache, sizeof(*cache), HEAPSTAT_HASHTABLE);
+    drmgr_set_tls_field(drcontext, tls_idx_gdicheck, NULL);
 }
 
 /***************************************************************************
@@ -199,7 +265,7 @@ gdicheck_dc_alloc(HDC hdc, gdi_dc_alloc_t flags, drsys_sysnum_t sysnum,
                   dr_mcontext_t *mc, app_loc_t *loc)
 {
     per_dc_t *pdc;
-    bool exists;
+    hashtable_t *cache;
     LOG(2, "GDI DC alloc "PFX" %s%s\n", hdc,
         TEST(GDI_DC_ALLOC_CREATE, flags) ? "create" : "",
         TEST(GDI_DC_ALLOC_GET, flags) ? "get" : "");
@@ -210,21 +276,39 @@ gdicheck_dc_alloc(HDC hdc, gdi_dc_alloc_t flags, drsys_sysnum_t sysnum,
     pdc->flags = flags;
     pdc->exited = false;
     pdc->non_stock_selected = 0;
+    cache = (hashtable_t *)
+        drmgr_get_tls_field(dr_get_current_drcontext(), tls_idx_gdicheck);
+    pdc->cached = (cache != NULL);
+    pdc->freed = false;
     packed_callstack_record(&pdc->pcs, mc, loc, options.callstack_max_frames);
+    hashtable_lock(&dc_table);
     if (!hashtable_add(&dc_table, (void *)hdc, (void *)pdc)) {
+        hashtable_unlock(&dc_table);
         per_dc_free((void *)pdc);
         /* Note that we don't report an error for calling GetDC again without
          * calling ReleaseDC first b/c this is not uncommon esp for
          * hwnd=NULL.  Plus, a private or class DC does not need ReleaseDC
          * to be called at all.
          */
+        return;
+    }
+    hashtable_unlock(&dc_table);
+    if (cache != NULL) {
+        /* A prior entry for a reused handle value was freed by another thread */
+        per_dc_t *stale = (per_dc_t *)
+            hashtable_add_replace(cache, (void *)hdc, (void *)pdc);
+        if (stale != NULL) {
+            ASSERT(stale->freed, "DC cache out of sync with dc_table");
+            per_dc_free((void *)stale);
+        }
     }
 }
 
 void
 gdicheck_dc_free(HDC hdc, bool create, drsys_sysnum_t sysnum, dr_mcontext_t *mc)
 {
-    per_dc_t *pdc = (per_dc_t *) hashtable_lookup(&dc_table, (void *)hdc);
+    per_dc_t *pdc = dc_lookup(hdc);
+    void *drcontext = dr_get_current_drcontext();
     IF_DEBUG(bool found;)
     LOG(2, "GDI DC free "PFX" %s\n", hdc, create ? "create" : "get");
     if (pdc == NULL) {
@@ -252,8 +336,16 @@ gdicheck_dc_free(HDC hdc, bool create, drsys_sysnum_t sysnum, dr_mcontext_t *mc)
         gdicheck_report(NULL, sysnum, mc, pdc, REPORT_PREFIX
                         "DC "PFX" that contains selected object being deleted", hdc);
     }
+    hashtable_lock(&dc_table);
+    if (pdc->cached && pdc->thread == dr_get_thread_id(drcontext)) {
+        hashtable_remove((hashtable_t *)
+                         drmgr_get_tls_field(drcontext, tls_idx_gdicheck),
+                         (void *)hdc);
+        pdc->cached = false;
+    }
     IF_DEBUG(found = )
         hashtable_remove(&dc_table, (void *)hdc);
+    hashtable_unlock(&dc_table);
     ASSERT(found, "DC tracking error");
 }
 
@@ -273,7 +365,7 @@ gdicheck_obj_free(HANDLE obj, drsys_sysnum_t sysnum, dr_mcontext_t *mc)
         HDC hdc = hashtable_lookup(&selected_table, (void *)obj);
         if (hdc != NULL) {
             per_dc_t *pdc;
-            pdc = (per_dc_t *) hashtable_lookup(&dc_table, (void *)hdc);
+            pdc = dc_lookup(hdc);
             /* Check: an HGDIOBJ being deleted is selected in any DC
              * While Petzold says not to delete any GDI object while it's selected,
              * MSDN explicitly says it's only bad to delete a pen or brush (i#899).
@@ -302,7 +394,7 @@ gdicheck_dc_select_obj(HDC hdc, HGDIOBJ prior_obj, HGDIOBJ new_obj,
                        app_pc addr, dr_mcontext_t *mc)
 {
     drsys_sysnum_t sysnum = {0,0}; /* not specifying */
-    per_dc_t *pdc = (per_dc_t *) hashtable_lookup(&dc_table, (void *)hdc);
+    per_dc_t *pdc = dc_lookup(hdc);
     LOG(2, "GDI obj select prior="PFX" new="PFX" hdc="PFX"\n", prior_obj, new_obj, hdc);
     if (pdc != NULL) {
         LOG(3, "\thdc="PFX" non_stock_sel=%d\n", hdc, pdc->non_stock_selected);
@@ -55,8 +55,12 @@ static handle_callstack_info_t other_proc_hci;
 #define HANDLE_VERBOSE_2 2
 #define HANDLE_VERBOSE_3 3
 
-/* We use one lock (handle_stack_table lock) for synchronizing all table operations
- * and payload access.
+/* The handle_stack_table lock protects handle_stack_table and open_close_table.
+ * Each handle table is protected by its own lock, so that handle creations and
+ * closes in different namespaces do not contend, and callstacks are recorded
+ * before taking any lock.  No lock is held while acquiring another, except
+ * when reporting, where the handle table locks are acquired in declaration
+ * order followed by the handle_stack_table lock.
  */
 
 /* Hashtable for handle open/close callstack */
@@ -311,14 +315,26 @@ open_close_pair_free(void *p)
 
 #ifdef DEBUG
 static bool
-handle_table_lock_self_owns(void)
+handle_stack_lock_self_owns(void)
 {
     return hashtable_lock_self_owns(&handle_stack_table);
 }
 #endif /* DEBUG */
 
+static void
+handle_stack_lock(void)
+{
+    hashtable_lock(&handle_stack_table);
+}
+
+static void
+handle_stack_unlock(void)
+{
+    hashtable_unlock(&handle_stack_table);
+}
+
 /* Add open/close pair into table.
- * The caller must hold the handle table lock.
+ * The caller must not hold any handle lock.
  * Called from handlecheck_delete_handle_post_syscall if the handle
  * is closed successfully.
  */
@@ -333,9 +349,12 @@ open_close_pair_add(handle_callstack_info_t *hci/* callstack of creation */,
     if (!options.filter_handle_leaks)
         return;
 
-    ASSERT(handle_table_lock_self_owns(), "caller must hold the handle table lock");
+    handle_stack_lock();
     pair = (open_close_pair_t *)hashtable_lookup(&open_close_table, hci->pcs);
-    /* we only store one close pcs if there are multiple */
+    handle_stack_unlock();
+    /* we only store one close pcs if there are multiple, so the common case
+     * of a call site that was already paired does no further work
+     */
     if (pair != NULL)
         return;
 
@@ -345,10 +364,20 @@ open_close_pair_add(handle_callstack_info_t *hci/* callstack of creation */,
      */
     pair->open = *hci;
     packed_callstack_add_ref(hci->pcs);
-    /* create pair->close.pcs and add it into handle_stack_table */
+    /* create pair->close.pcs outside of the lock */
     syscall_to_loc(&pair->close.loc, sysnum, NULL);
     packed_callstack_record(&pair->close.pcs, mc, &pair->close.loc,
                             options.callstack_max_frames);
+    handle_stack_lock();
+    if (hashtable_lookup(&open_close_table, hci->pcs) != NULL) {
+        /* another thread paired the same creation callstack meanwhile */
+        handle_stack_unlock();
+        packed_callstack_free(pair->open.pcs);
+        packed_callstack_free(pair->close.pcs);
+        global_free(pair, sizeof(*pair), HEAPSTAT_CALLSTACK);
+        return;
+    }
+    /* add pair->close.pcs into handle_stack_table */
     pair->close.pcs = packed_callstack_add_to_table(&handle_stack_table,
                                                     pair->close.pcs
                                                     _IF_STATS(&handle_stack_count));
@@ -356,20 +385,7 @@ open_close_pair_add(handle_callstack_info_t *hci/* callstack of creation */,
     IF_DEBUG(res =)
         hashtable_add(&open_close_table, (void *)hci->pcs, (void *)pair);
     ASSERT(res, "failed to add to open_close_table");
-}
-
-static void
-handle_table_lock(void)
-{
-    /* we use handle_stack_table lock for synchronizing all table operations */
-    hashtable_lock(&handle_stack_table);
-}
-
-static void
-handle_table_unlock(void)
-{
-    /* we use handle_stack_table lock for synchronizing all table operations */
-    hashtable_unlock(&handle_stack_table);
+    handle_stack_unlock();
 }
 
 void
@@ -388,12 +404,11 @@ handle_callstack_info_clone(handle_callstack_info_t *src)
     return dst;
 }
 
-/* the caller must hold the handle table lock */
+/* The callstack is recorded without holding any lock and then interned. */
 static handle_callstack_info_t *
 handle_callstack_info_alloc(drsys_sysnum_t sysnum, app_pc pc, dr_mcontext_t *mc)
 {
     handle_callstack_info_t *hci;
-    ASSERT(handle_table_lock_self_owns(), "caller must hold the handle table lock");
     hci = global_alloc(sizeof(*hci), HEAPSTAT_CALLSTACK);
     /* assuming pc will never be NULL */
     if (pc == NULL)
@@ -401,8 +416,10 @@ handle_callstack_info_alloc(drsys_sysnum_t sysnum, app_pc pc, dr_mcontext_t *mc)
     else
         pc_to_loc(&hci->loc, pc);
     packed_callstack_record(&hci->pcs, mc, &hci->loc, options.callstack_max_frames);
+    handle_stack_lock();
     hci->pcs = packed_callstack_add_to_table(&handle_stack_table, hci->pcs
                                              _IF_STATS(&handle_stack_count));
+    handle_stack_unlock();
     return hci;
 }
 
@@ -415,15 +432,15 @@ handle_callstack_info_free(handle_callstack_info_t *hci)
     global_free(hci, sizeof(*hci), HEAPSTAT_CALLSTACK);
 }
 
-/* the caller must hold the handle table lock */
+/* acquires table's lock */
 static void
 handlecheck_handle_add(hashtable_t *table, HANDLE handle,
                        handle_callstack_info_t *hci)
 {
     void *res;
 
-    ASSERT(handle_table_lock_self_owns(), "caller must hold the handle table lock");
     STATS_INC(num_handle_add);
+    hashtable_lock(table);
     /* We replace the old callstack with new callstack if we see
      * duplicated handle in the table, b/c we might have missed a
      * close, and it's best to take the latest creation of that
@@ -445,17 +462,18 @@ handlecheck_handle_add(hashtable_t *table, HANDLE handle,
         LOG(HANDLE_VERBOSE_1,
             "WARNING: conflict on adding handle "PFX" back\n", handle);
     }
+    hashtable_unlock(table);
 }
 
-/* the caller must hold the handle table lock */
+/* acquires table's lock */
 static bool
 handlecheck_handle_remove(hashtable_t *table, HANDLE handle,
                           handle_callstack_info_t **hci OUT)
 {
     bool res;
 
-    ASSERT(handle_table_lock_self_owns(), "caller must hold the handle table lock");
     STATS_INC(num_handle_remove);
+    hashtable_lock(table);
     if (hci != NULL) {
         handle_callstack_info_t *info;
         info = hashtable_lookup(table, (void *)handle);
@@ -468,6 +486,7 @@ handlecheck_handle_remove(hashtable_t *table, HANDLE handle,
             *hci = NULL;
     }
     res = hashtable_remove(table, (void *)handle);
+    hashtable_unlock(table);
     return res;
 }
 
@@ -506,7 +525,7 @@ handlecheck_report_leak_on_syscall(dr_mcontext_t *mc, drsys_arg_t *arg,
                        NULL /* aux_pcs */, false /* potential */);
 }
 
-/* the caller must hold the handle table lock */
+/* the caller must hold all handle locks */
 static void
 handlecheck_check_open_handle(const char *name,
                               HANDLE handle,
@@ -517,7 +536,7 @@ handlecheck_check_open_handle(const char *name,
     uint count;
     char msg[HANDLECHECK_PRE_MSG_SIZE];
 
-    ASSERT(handle_table_lock_self_owns(), "caller must hold the handle table lock");
+    ASSERT(handle_stack_lock_self_owns(), "caller must hold all handle locks");
     ASSERT(hci != NULL, "handle callstack info must not be NULL");
     count = packed_callstack_refcount(hci->pcs) - 1 /* hashtable refcount */;
     /* i#1373: use heuristics for better handle leak reports */
@@ -555,13 +574,13 @@ handlecheck_check_open_handle(const char *name,
                        potential);
 }
 
-/* caller must hold the handle table lock */
+/* caller must hold all handle locks */
 static void
 handlecheck_iterate_handle_table(hashtable_t *table, const char *name)
 {
     uint i;
     hash_entry_t *entry;
-    ASSERT(handle_table_lock_self_owns(), "caller must hold the handle table lock");
+    ASSERT(hashtable_lock_self_owns(table), "caller must hold all handle locks");
     for (i = 0; i < HASHTABLE_SIZE(table->table_bits); i++) {
         for (entry = table->table[i]; entry != NULL; entry = entry->next) {
             handlecheck_check_open_handle(name,
@@ -571,7 +590,7 @@ handlecheck_iterate_handle_table(hashtable_t *table, const char *name)
     }
 }
 
-/* caller must hold the handle table lock */
+/* caller must hold all handle locks */
 static bool
 handlecheck_enumerate_handles(void)
 {
@@ -579,7 +598,7 @@ handlecheck_enumerate_handles(void)
     SYSTEM_HANDLE_ENTRY *entry;
     uint i;
 
-    ASSERT(handle_table_lock_self_owns(), "caller must hold the handle table lock");
+    ASSERT(handle_stack_lock_self_owns(), "caller must hold all handle locks");
     /* i#1380: there could be handles closed by other process, i.e., some
      * handle in the table might be closed already, so we have to query the
      * existing handle list from system.
@@ -617,7 +636,10 @@ handlecheck_iterate_handles(void)
 {
     void *drcontext = dr_get_current_drcontext();
 
-    handle_table_lock();
+    hashtable_lock(&kernel_handle_table);
+    hashtable_lock(&gdi_handle_table);
+    hashtable_lock(&user_handle_table);
+    handle_stack_lock();
 
     /* kernel handles */
     LOG(HANDLE_VERBOSE_3, "enumerating kernel handles");
@@ -635,7 +657,10 @@ handlecheck_iterate_handles(void)
     LOG(HANDLE_VERBOSE_3, "iterating gdi handles");
     handlecheck_iterate_handle_table(&gdi_handle_table, "GDI");
 
-    handle_table_unlock();
+    handle_stack_unlock();
+    hashtable_unlock(&user_handle_table);
+    hashtable_unlock(&gdi_handle_table);
+    hashtable_unlock(&kernel_handle_table);
 }
 
 static inline hashtable_t *
@@ -723,11 +748,9 @@ handlecheck_create_handle(void *drcontext,
                                          _IF_DEBUG((void *)handle)
                                          _IF_DEBUG("opened"));
     ASSERT(table != NULL, "fail to get handle table");
-    handle_table_lock();
     hci = handle_callstack_info_alloc(sysnum, pc, mc);
     DOLOG(HANDLE_VERBOSE_3, { packed_callstack_log(hci->pcs, INVALID_FILE); });
     handlecheck_handle_add(table, handle, hci);
-    handle_table_unlock();
 }
 
 void *
@@ -753,13 +776,11 @@ handlecheck_delete_handle(void *drcontext,
                                          _IF_DEBUG("deleted"));
     ASSERT(table != NULL, "fail to get handle table");
     DOLOG(HANDLE_VERBOSE_3, { report_callstack(drcontext, mc); });
-    handle_table_lock();
     if (!handlecheck_handle_remove(table, handle, &hci)) {
         LOG(HANDLE_VERBOSE_1,
             "WARNING: fail to remove handle "PFX" at:\n", handle);
         DOLOG(HANDLE_VERBOSE_2, { report_callstack(drcontext, mc); });
     }
-    handle_table_unlock();
     return (void *)hci;
 }
 
@@ -786,7 +807,6 @@ handlecheck_delete_handle_post_syscall(void *drcontext, HANDLE handle,
         return;
     }
 
-    handle_table_lock();
     if (success) {
         /* add the pair info */
         if (options.filter_handle_leaks)
@@ -803,7 +823,6 @@ handlecheck_delete_handle_post_syscall(void *drcontext, HANDLE handle,
         DOLOG(HANDLE_VERBOSE_3, { packed_callstack_log(hci->pcs, INVALID_FILE); });
         handlecheck_handle_add(table, handle, hci);
     }
-    handle_table_unlock();
 }
 
 #ifdef STATISTICS
@@ -0,0 +1,335 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Sampled heap profiling (-heap_profile_sample_rate): see heap_profile.h.
+ *
+ * Sampled chunks are kept in a lock-free-read hashmap so that the lookup on
+ * every free costs no lock.  Each
+ * distinct callstack has a site, holding a reference to the shared callstack,
+ * that lives until exit so a profile can also show what was freed.  Sites and
+ * totals are protected by profile_lock, which only sampled operations take.
+ *
+ * Sampled allocations are scaled without floating point, as we can be called
+ * where the app's floating-point state has not been preserved.
+ */
+
+#include "dr_api.h"
+#include "drx.h"
+#include "drmemory.h"
+#include "utils.h"
+#include "hashmap.h"
+#include "callstack.h"
+#include "heap_profile.h"
+
+#define SITE_TABLE_HASH_BITS 8
+#define CHUNK_MAP_HASH_BITS 8
+
+/* 2^(-i/16) for i in 0..16, in 16.16 fixed point */
+static const uint exp2_neg_table[17] = {
+    65536, 62757, 60096, 57549, 55109, 52773, 50535, 48393, 46341,
+    44376, 42495, 40693, 38968, 37316, 35734, 34219, 32768,
+};
+
+typedef struct _heap_site_t {
+    packed_callstack_t *pcs;
+    uint64 live_bytes;
+    uint64 live_count;
+    uint64 peak_bytes;
+    uint64 total_bytes;
+    uint64 total_count;
+} heap_site_t;
+
+typedef struct _heap_sample_t {
+    heap_site_t *site;
+    /* estimated bytes and allocations this sample stands for */
+    uint64 bytes;
+    uint64 count;
+} heap_sample_t;
+
+/* Defined in alloc_drmem.c */
+void
+shared_callstack_free(packed_callstack_t *pcs);
+
+static void *profile_lock;
+static hashtable_t site_table;
+static hashmap_t chunk_map;
+/* Not synchronized for the test on every free: a stale value only costs a lookup */
+static volatile uint live_samples;
+static uint64 live_bytes;
+static uint64 peak_bytes;
+static uint num_dumps;
+
+static void
+heap_sample_free(void *p)
+{
+    global_free(p, sizeof(heap_sample_t), HEAPSTAT_MISC);
+}
+
+static void
+heap_site_free(void *p)
+{
+    heap_site_t *site = (heap_site_t *) p;
+    shared_callstack_free(site->pcs);
+    global_free(site, sizeof(*site), HEAPSTAT_MISC);
+}
+
+void
+heap_profile_init(void)
+{
+    profile_lock = dr_mutex_create();
+    hashtable_init_ex(&site_table, SITE_TABLE_HASH_BITS, HASH_INTPTR, false/*!strdup*/,
+                      false/*!synch*/, heap_site_free, NULL, NULL);
+    hashmap_init(&chunk_map, CHUNK_MAP_HASH_BITS, true/*lockfree_reads*/,
+                 heap_sample_free);
+}
+
+void
+heap_profile_exit(void)
+{
+    hashmap_delete_with_stats(&chunk_map, "heap profile chunks");
+    hashtable_delete_with_stats(&site_table, "heap profile sites");
+    dr_mutex_destroy(profile_lock);
+}
+
+/* xorshift32 */
+static uint
+heap_profile_random(uint *rng)
+{
+    uint x = *rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *rng = x;
+    return x;
+}
+
+size_t
+heap_profile_next_sample(uint *rng)
+{
+    /* -ln(u) for uniform u has a mean of 1.  We compute -log2(u) in 16.16
+     * fixed point from the bit length plus a quadratic fit of the mantissa,
+     * log2(1+f) ~= f + 0.3466*f*(1-f), and multiply by ln(2).
+     */
+    uint r = heap_profile_random(rng);
+    uint msb = 31, frac;
+    uint64 neg_ln, next;
+    if (r == 0)
+        r = 1;
+    while ((r & (1U << msb)) == 0)
+        msb--;
+    frac = (msb >= 16) ? (r >> (msb - 16)) & 0xffff : (r << (16 - msb)) & 0xffff;
+    frac += (uint)((((uint64)frac * (65536 - frac)) >> 16) * 22713 >> 16);
+    neg_ln = ((uint64)((32 << 16) - ((msb << 16) + frac)) * 45426) >> 16;
+    next = ((uint64)options.heap_profile_sample_rate * neg_ln) >> 16;
+    return (next == 0) ? 1 : (size_t) next;
+}
+
+/* A size-byte allocation is sampled with probability p = 1 - e^(-size/rate),
+ * so it stands for size/p bytes in 1/p allocations.
+ */
+static void
+heap_profile_scale(size_t size, uint64 *bytes OUT, uint64 *count OUT)
+{
+    uint64 rate = options.heap_profile_sample_rate;
+    uint64 x, y, e, p;
+    uint ipart, frac;
+    if (size == 0)
+        size = 1;
+    if (size >= 16 * rate) {
+        *bytes = size;
+        *count = 1;
+        return;
+    }
+    if (size < rate / 16) {
+        /* size/p = rate*x/(1 - e^(-x)) ~= rate*(1 + x/2) for x = size/rate */
+        *bytes = rate + size/2;
+        *count = *bytes / size;
+        return;
+    }
+    /* y = (size/rate)/ln(2), so that e^(-size/rate) = 2^(-y) */
+    x = ((uint64)size << 16) / rate;
+    y = (x * 94548) >> 16;
+    ipart = (uint)(y >> 16);
+    frac = (uint)(y & 0xffff);
+    e = exp2_neg_table[frac >> 12] -
+        (((uint64)(exp2_neg_table[frac >> 12] - exp2_neg_table[(frac >> 12) + 1]) *
+          (frac & 0xfff)) >> 12);
+    e >>= ipart;
+    p = 65536 - e;
+    *bytes = ((uint64)size << 16) / p;
+    *count = (65536 + p/2) / p;
+    if (*count == 0)
+        *count = 1;
+}
+
+static void
+heap_profile_remove_sample(heap_sample_t *sample)
+{
+    ASSERT(dr_mutex_self_owns(profile_lock), "must hold lock");
+    sample->site->live_bytes -= sample->bytes;
+    sample->site->live_count -= sample->count;
+    live_bytes -= sample->bytes;
+    live_samples--;
+}
+
+void
+heap_profile_add(byte *base, size_t size, packed_callstack_t *pcs)
+{
+    heap_sample_t *sample, *old;
+    heap_site_t *site;
+    sample = (heap_sample_t *) global_alloc(sizeof(*sample), HEAPSTAT_MISC);
+    heap_profile_scale(size, &sample->bytes, &sample->count);
+    LOG(3, "heap profile: sampled "PFX" size "PIFX" as %d bytes\n", base, size,
+        (int)sample->bytes);
+    dr_mutex_lock(profile_lock);
+    site = (heap_site_t *) hashtable_lookup(&site_table, (void *)pcs);
+    if (site == NULL) {
+        site = (heap_site_t *) global_alloc(sizeof(*site), HEAPSTAT_MISC);
+        memset(site, 0, sizeof(*site));
+        site->pcs = pcs;
+        hashtable_add(&site_table, (void *)pcs, (void *)site);
+    } else {
+        /* the site already holds a reference */
+        shared_callstack_free(pcs);
+    }
+    sample->site = site;
+    site->live_bytes += sample->bytes;
+    site->live_count += sample->count;
+    site->total_bytes += sample->bytes;
+    site->total_count += sample->count;
+    if (site->live_bytes > site->peak_bytes)
+        site->peak_bytes = site->live_bytes;
+    live_bytes += sample->bytes;
+    if (live_bytes > peak_bytes)
+        peak_bytes = live_bytes;
+    live_samples++;
+    /* A chunk still present had a free we did not see (e.g., a heap destroy) */
+    old = (heap_sample_t *) hashmap_add_replace(&chunk_map, (void *)base, sample);
+    if (old != NULL) {
+        heap_profile_remove_sample(old);
+        heap_sample_free(old);
+    }
+    dr_mutex_unlock(profile_lock);
+}
+
+void
+heap_profile_remove(byte *base)
+{
+    heap_sample_t *sample;
+    if (live_samples == 0)
+        return;
+    sample = (heap_sample_t *) hashmap_lookup(&chunk_map, (void *)base);
+    if (sample == NULL)
+        return;
+    dr_mutex_lock(profile_lock);
+    /* re-check under the lock in case of a racing replacement */
+    if (hashmap_lookup(&chunk_map, (void *)base) == sample) {
+        heap_profile_remove_sample(sample);
+        hashmap_remove(&chunk_map, (void *)base);
+    }
+    dr_mutex_unlock(profile_lock);
+}
+
+/* A heapsort by live bytes and then peak, as we have no qsort */
+static inline bool
+heap_site_less(heap_site_t *s1, heap_site_t *s2)
+{
+    /* the largest sites come first */
+    if (s1->live_bytes != s2->live_bytes)
+        return s1->live_bytes > s2->live_bytes;
+    return s1->peak_bytes > s2->peak_bytes;
+}
+
+static void
+heap_site_sift_down(heap_site_t **a, uint root, uint n)
+{
+    while (2*root + 1 < n) {
+        uint child = 2*root + 1;
+        heap_site_t *tmp;
+        if (child + 1 < n && heap_site_less(a[child], a[child+1]))
+            child++;
+        if (!heap_site_less(a[root], a[child]))
+            return;
+        tmp = a[root];
+        a[root] = a[child];
+        a[child] = tmp;
+        root = child;
+    }
+}
+
+void
+heap_profile_dump(const char *when)
+{
+    char fname[MAXIMUM_PATH];
+    heap_site_t **sites;
+    uint num_sites = 0, i;
+    size_t bufsz = max_callstack_size();
+    char *buf;
+    file_t f = drx_open_unique_file(logsubdir, "heap_profile", "txt",
+#ifndef WINDOWS
+                                    DR_FILE_CLOSE_ON_FORK |
+#endif
+                                    DR_FILE_ALLOW_LARGE,
+                                    fname, BUFFER_SIZE_ELEMENTS(fname));
+    if (f == INVALID_FILE) {
+        WARN("WARNING: unable to create heap profile file\n");
+        return;
+    }
+    buf = (char *) global_alloc(bufsz, HEAPSTAT_MISC);
+    dr_mutex_lock(profile_lock);
+    sites = (heap_site_t **)
+        global_alloc((site_table.entries + 1) * sizeof(*sites), HEAPSTAT_MISC);
+    for (i = 0; i < HASHTABLE_SIZE(site_table.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = site_table.table[i]; he != NULL; he = he->next)
+            sites[num_sites++] = (heap_site_t *) he->payload;
+    }
+    /* sort ascending by heap_site_less, which puts the largest first */
+    for (i = num_sites/2; i > 0; i--)
+        heap_site_sift_down(sites, i - 1, num_sites);
+    for (i = num_sites; i > 1; i--) {
+        heap_site_t *tmp = sites[0];
+        sites[0] = sites[i - 1];
+        sites[i - 1] = tmp;
+        heap_site_sift_down(sites, 0, i - 1);
+    }
+    dr_fprintf(f, "Heap profile #%u at %s, sampling every %u bytes on average\n",
+               ++num_dumps, when, options.heap_profile_sample_rate);
+    dr_fprintf(f, "Estimated live heap: %"UINT64_FORMAT_CODE" bytes, peak: %"
+               UINT64_FORMAT_CODE" bytes, in %u callstacks\n",
+               live_bytes, peak_bytes, num_sites);
+    for (i = 0; i < num_sites; i++) {
+        size_t sofar = 0;
+        dr_fprintf(f, "\nlive: %"UINT64_FORMAT_CODE" bytes in %"UINT64_FORMAT_CODE
+                   " allocs, peak: %"UINT64_FORMAT_CODE" bytes, total: %"
+                   UINT64_FORMAT_CODE" bytes in %"UINT64_FORMAT_CODE" allocs\n",
+                   sites[i]->live_bytes, sites[i]->live_count, sites[i]->peak_bytes,
+                   sites[i]->total_bytes, sites[i]->total_count);
+        buf[0] = '\0';
+        packed_callstack_print(sites[i]->pcs, 0/*all frames*/, buf, bufsz, &sofar, "");
+        dr_fprintf(f, "%s", buf);
+    }
+    global_free(sites, (site_table.entries + 1) * sizeof(*sites), HEAPSTAT_MISC);
+    dr_mutex_unlock(profile_lock);
+    global_free(buf, bufsz, HEAPSTAT_MISC);
+    dr_close_file(f);
+    NOTIFY("Heap profile written to: %s"NL, fname);
+}
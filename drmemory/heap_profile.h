@@ -0,0 +1,60 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Sampled heap profiling (-heap_profile_sample_rate).
+ *
+ * The allocation path picks a random subset of the bytes allocated, in the
+ * manner of tcmalloc's heap profiler: each thread counts down a random
+ * distance, drawn from an exponential distribution whose mean is the sample
+ * rate, and the allocation that crosses it is sampled.  Only sampled
+ * allocations pay for a callstack.  Each sample is scaled by the inverse of
+ * its probability of being sampled to estimate the live and peak heap of its
+ * callstack, which is written to a heap_profile file at each nudge and at exit.
+ */
+
+#ifndef _HEAP_PROFILE_H_
+#define _HEAP_PROFILE_H_ 1
+
+#include "callstack.h"
+
+void
+heap_profile_init(void);
+
+void
+heap_profile_exit(void);
+
+/* Returns a random number of bytes until the next sample, advancing *rng */
+size_t
+heap_profile_next_sample(uint *rng);
+
+/* Records a sampled allocation, taking over a reference to pcs */
+void
+heap_profile_add(byte *base, size_t size, packed_callstack_t *pcs);
+
+/* Called on every free: a cheap test when base was not sampled */
+void
+heap_profile_remove(byte *base);
+
+/* Writes the current profile to a new file.  when is "nudge" or "exit". */
+void
+heap_profile_dump(const char *when);
+
+#endif /* _HEAP_PROFILE_H_ */
@@ -35,6 +35,7 @@
 #include "stack.h"
 #include "annotations.h"
 #include "replace.h"
+#include "native_summary.h"
 #include "report.h"
 #include "syscall.h"
 #include "shadow.h"
@@ -60,6 +61,40 @@ hashtable_t xl8_sharing_table;
 #define IGNORE_UNADDR_HASH_BITS 6
 hashtable_t ignore_unaddr_table;
 
+/* -saturate_sites: instructions whose unaddressable accesses are not checked */
+#define SATURATED_HASH_BITS 6
+hashtable_t saturated_table;
+
+#ifdef TOOL_DR_MEMORY
+/* -tiered_threshold: bbs start out with only an execution counter and are
+ * re-instrumented with full definedness checks once they become hot.
+ * Entries are never removed, so a bb flushed and re-created keeps its tier
+ * and a pointer to an entry stays valid until exit.
+ * With -jit_tier_by_content, bbs outside of modules are keyed by a hash of
+ * their code instead of their pc, and pc is just the first such bb.
+ */
+# define TIER_HASH_BITS 12
+/* Longest bb span we hash for -jit_tier_by_content: longer ones use their pc */
+# define TIER_HASH_MAX_SPAN 4096
+static hashtable_t tier_table;
+typedef struct _tier_info_t {
+    app_pc pc;
+    volatile int count;
+    bool promoted;
+} tier_info_t;
+
+/* -startup_addr_only: until main is reached or a second thread is created,
+ * bbs are checked for addressability only.  When the phase ends all code is
+ * flushed.  As with the tier, the decision is saved in bb_table for translation.
+ */
+static volatile bool startup_phase;
+static app_pc startup_main_pc;
+static void *startup_lock;
+
+static void
+startup_phase_init(void);
+#endif
+
 #ifdef X86
 /* Handle slowpath for OP_loop in repstr_to_loop properly (i#391).
  * We map the address of an allocated OP_loop to the app_pc of the original
@@ -198,6 +233,14 @@ bb_table_free_entry(void *entry)
     global_free(save, sizeof(*save), HEAPSTAT_PERBB);
 }
 
+#ifdef TOOL_DR_MEMORY
+static void
+tier_free_entry(void *entry)
+{
+    global_free(entry, sizeof(tier_info_t), HEAPSTAT_PERBB);
+}
+#endif
+
 #ifdef X86
 static void
 stringop_free_entry(void *entry)
@@ -232,6 +275,8 @@ instrument_init(void)
     drmgr_priority_t priority = {sizeof(priority), "drmemory.instru", NULL, NULL,
                                  DRMGR_PRIORITY_INSTRU};
     drutil_init();
+    /* before annotate_init(), as annotations register stacks */
+    stack_init();
     annotate_init();
 
 #ifdef TOOL_DR_MEMORY
@@ -264,7 +309,20 @@ instrument_init(void)
                        false/*!strdup*/);
         hashtable_init(&ignore_unaddr_table, IGNORE_UNADDR_HASH_BITS, HASH_INTPTR,
                        false/*!strdup*/);
+        if (options.saturate_sites) {
+            hashtable_init(&saturated_table, SATURATED_HASH_BITS, HASH_INTPTR,
+                           false/*!strdup*/);
+        }
+        IF_DRMEM(medium_path_init_arch());
+    }
+#ifdef TOOL_DR_MEMORY
+    if (options.shadowing && options.tiered_threshold > 0) {
+        hashtable_init_ex(&tier_table, TIER_HASH_BITS, HASH_INTPTR, false/*!strdup*/,
+                          false/*!synch*/, tier_free_entry, NULL, NULL);
     }
+    if (options.shadowing && options.startup_addr_only)
+        startup_phase_init();
+#endif
     hashtable_init_ex(&bb_table, BB_HASH_BITS, HASH_INTPTR, false/*!strdup*/,
                       false/*!synch*/, bb_table_free_entry, NULL, NULL);
 #ifdef X86
@@ -277,8 +335,10 @@ instrument_init(void)
 #endif
 
 #ifdef TOOL_DR_MEMORY
-    if (INSTRUMENT_MEMREFS())
+    if (INSTRUMENT_MEMREFS()) {
         replace_init();
+        native_summary_init();
+    }
 #endif
 }
 
@@ -286,6 +346,7 @@ void
 instrument_exit(void)
 {
     annotate_exit();
+    stack_exit();
     drutil_exit();
     if (!INSTRUMENT_MEMREFS())
         return;
@@ -295,7 +356,16 @@ instrument_exit(void)
     if (options.shadowing) {
         hashtable_delete_with_stats(&xl8_sharing_table, "xl8_sharing");
         hashtable_delete_with_stats(&ignore_unaddr_table, "ignore_unaddr");
+        if (options.saturate_sites)
+            hashtable_delete_with_stats(&saturated_table, "saturated");
+        IF_DRMEM(medium_path_exit_arch());
     }
+#ifdef TOOL_DR_MEMORY
+    if (options.shadowing && options.tiered_threshold > 0)
+        hashtable_delete_with_stats(&tier_table, "tier_table");
+    if (options.shadowing && options.startup_addr_only)
+        dr_mutex_destroy(startup_lock);
+#endif
     hashtable_delete_with_stats(&bb_table, "bb_table");
 #ifdef X86
     dr_mutex_destroy(stringop_lock);
@@ -303,8 +373,10 @@ instrument_exit(void)
     hashtable_delete(&stringop_us2app_table);
 #endif
 #ifdef TOOL_DR_MEMORY
-    if (INSTRUMENT_MEMREFS())
+    if (INSTRUMENT_MEMREFS()) {
+        native_summary_exit();
         replace_exit();
+    }
 #endif
     instru_tls_exit();
 }
@@ -928,6 +1000,200 @@ convert_repstr_to_loop(void *drcontext, instrlist_t *bb, bb_info_t *bi,
 }
 #endif
 
+#ifdef STATISTICS
+/* With -disable_traces the only loops we see whole are bbs that branch back
+ * to their own start.  We do not hoist checks out of them: without a trip
+ * count there is no range to check at loop entry, and in full mode every
+ * access must still propagate definedness.  We count them instead, as an
+ * upper bound on what such hoisting could save.
+ */
+static void
+count_self_loop_bb(void *tag, instrlist_t *bb)
+{
+    instr_t *inst = instrlist_last_app_instr(bb);
+    if (inst == NULL || !instr_is_cbr(inst) || !opnd_is_pc(instr_get_target(inst)) ||
+        opnd_get_pc(instr_get_target(inst)) != dr_fragment_app_pc(tag))
+        return;
+    STATS_INC(self_loop_bbs);
+    for (inst = instrlist_first_app_instr(bb); inst != NULL;
+         inst = instr_get_next_app_instr(inst)) {
+        if (instr_reads_memory(inst) || instr_writes_memory(inst))
+            STATS_INC(self_loop_memrefs);
+    }
+}
+#endif
+
+#ifdef TOOL_DR_MEMORY
+/* For -jit_tier_by_content: an FNV-1a hash of the bytes from the bb's start
+ * through the first byte of its last instr, mixed with its instr count.
+ * Returns pc for a bb that spans too far (e.g., with elision) or is unreadable.
+ */
+static ptr_uint_t
+tier_code_hash(app_pc pc, instrlist_t *bb)
+{
+    instr_t *inst;
+    app_pc last_pc = NULL;
+    uint num_instrs = 0;
+    ptr_uint_t hash = (ptr_uint_t) IF_X64_ELSE(0xcbf29ce484222325ULL, 0x811c9dc5);
+    byte buf[64];
+    app_pc cur;
+    for (inst = instrlist_first_app_instr(bb); inst != NULL;
+         inst = instr_get_next_app_instr(inst)) {
+        if (instr_get_app_pc(inst) > last_pc)
+            last_pc = instr_get_app_pc(inst);
+        num_instrs++;
+    }
+    if (last_pc < pc || last_pc - pc >= TIER_HASH_MAX_SPAN)
+        return (ptr_uint_t) pc;
+    for (cur = pc; cur <= last_pc; cur += sizeof(buf)) {
+        size_t i, len = MIN(sizeof(buf), (size_t)(last_pc - cur) + 1);
+        if (!safe_read(cur, len, buf))
+            return (ptr_uint_t) pc;
+        for (i = 0; i < len; i++) {
+            hash ^= buf[i];
+            hash *= (ptr_uint_t) IF_X64_ELSE(0x100000001b3ULL, 0x01000193);
+        }
+    }
+    hash ^= num_instrs;
+    hash *= (ptr_uint_t) IF_X64_ELSE(0x100000001b3ULL, 0x01000193);
+    /* keep clear of the hashtable's NULL */
+    return (hash == 0) ? 1 : hash;
+}
+
+static tier_info_t *
+tier_lookup(app_pc pc, instrlist_t *bb, bool create)
+{
+    tier_info_t *ti;
+    const char *modname = module_lookup_preferred_name(pc);
+    ptr_uint_t key = (ptr_uint_t) pc;
+    if (options.jit_tier_by_content && modname == NULL)
+        key = tier_code_hash(pc, bb);
+    hashtable_lock(&tier_table);
+    ti = (tier_info_t *) hashtable_lookup(&tier_table, (void *)key);
+    if (ti == NULL && create) {
+        ti = (tier_info_t *) global_alloc(sizeof(*ti), HEAPSTAT_PERBB);
+        ti->pc = pc;
+        ti->count = 0;
+        ti->promoted = (modname != NULL && options.tiered_full_modules[0] != '\0' &&
+                        text_matches_any_pattern(modname, options.tiered_full_modules,
+                                                 FILESYS_CASELESS));
+        hashtable_add(&tier_table, (void *)key, (void *)ti);
+    }
+    hashtable_unlock(&tier_table);
+    return ti;
+}
+
+/* Clean call at the top of each counting-only bb */
+static void
+tier_count_execution(tier_info_t *ti, app_pc pc)
+{
+    if ((uint) dr_atomic_add32_return_sum(&ti->count, 1) == options.tiered_threshold) {
+        LOG(2, "bb @"PFX" is hot: re-instrumenting with full checks\n", pc);
+        ti->promoted = true;
+        /* Like slow_path_xl8_sharing, we are inside the bb being flushed.
+         * Other copies of a content-keyed bb are promoted when next rebuilt.
+         */
+        dr_unlink_flush_region(pc, 1);
+    }
+}
+
+/* Decides whether a bb gets only a counter (with its dsts marked defined),
+ * or full instrumentation.  The decision is saved in bb_table so that
+ * translation reproduces the same code even after a promotion.
+ */
+static void
+tier_bb_analysis(void *tag, instrlist_t *bb, bb_info_t *bi, bool translating)
+{
+    app_pc pc = dr_fragment_app_pc(tag);
+    tier_info_t *ti = NULL;
+    if (!translating) {
+        /* Already marked defined: nothing to gain from counting. */
+        if (bi->mark_defined)
+            return;
+        ti = tier_lookup(pc, bb, true);
+        bi->tier0 = !ti->promoted;
+    } else if (bi->tier0) {
+        ti = tier_lookup(pc, bb, false);
+        ASSERT(ti != NULL, "missing tier info");
+    }
+    if (bi->tier0) {
+        bi->tier_info = (void *) ti;
+        bi->mark_defined = true;
+        LOG(3, "bb @"PFX" count=%d: counting only\n", pc, ti->count);
+    }
+}
+#endif
+
+#ifdef TOOL_DR_MEMORY
+/* For -tiered_compact: whether a memory reference in a counting-only bb jumps
+ * to the shared slowpath instead of getting an inline fastpath.  Register-only
+ * instrs keep their fastpath, which is short when marking defined.
+ */
+static inline bool
+tier_compact_check(bb_info_t *bi, bool has_mem)
+{
+    return IF_X86_ELSE(bi->tier0 && has_mem && options.tiered_compact &&
+                       options.shared_slowpath, false);
+}
+#endif
+
+static void
+startup_phase_init(void)
+{
+    module_data_t *exe = dr_get_main_module();
+    ASSERT(exe != NULL, "cannot find executable");
+    startup_main_pc = lookup_symbol(exe, "main");
+#ifdef WINDOWS
+    if (startup_main_pc == NULL)
+        startup_main_pc = lookup_symbol(exe, "wmain");
+    if (startup_main_pc == NULL)
+        startup_main_pc = lookup_symbol(exe, "WinMain");
+    if (startup_main_pc == NULL)
+        startup_main_pc = lookup_symbol(exe, "wWinMain");
+#endif
+    dr_free_module_data(exe);
+    if (startup_main_pc == NULL)
+        LOG(1, "no main found: startup phase ends at the first new thread\n");
+    else
+        LOG(1, "startup phase ends at main "PFX"\n", startup_main_pc);
+    startup_lock = dr_mutex_create();
+    startup_phase = true;
+}
+
+void
+instru_end_startup_phase(const char *reason)
+{
+    if (!startup_phase)
+        return;
+    dr_mutex_lock(startup_lock);
+    if (startup_phase) {
+        startup_phase = false;
+        LOG(1, "startup phase ended by %s: flushing to add full checks\n", reason);
+        /* A bb being built by another thread right now may miss the flush and
+         * keep addressability-only checks, which costs only some coverage.
+         */
+        dr_delay_flush_region(0, (size_t)-1, 0, NULL);
+    }
+    dr_mutex_unlock(startup_lock);
+}
+
+/* Marks a bb built during the startup phase to have its dsts marked defined */
+static void
+startup_bb_analysis(void *tag, bb_info_t *bi, bool translating)
+{
+    if (!translating) {
+        if (startup_phase && dr_fragment_app_pc(tag) == startup_main_pc)
+            instru_end_startup_phase("reaching main");
+        bi->startup = startup_phase;
+    }
+    if (bi->startup) {
+        bi->mark_defined = true;
+        LOG(3, "bb @"PFX" is in the startup phase: addressability only\n",
+            dr_fragment_app_pc(tag));
+    }
+}
+#endif
+
 /* Conversions to app code itself that should happen before instrumentation */
 static dr_emit_flags_t
 instru_event_bb_app2app(void *drcontext, void *tag, instrlist_t *bb,
@@ -939,8 +1205,10 @@ instru_event_bb_app2app(void *drcontext, void *tag, instrlist_t *bb,
         return DR_EMIT_GO_NATIVE;
 
 #ifdef STATISTICS
-    if (!translating && !for_trace)
+    if (!translating && !for_trace) {
         STATS_INC(num_bbs);
+        count_self_loop_bb(tag, bb);
+    }
 #endif
 
 #ifdef TOOL_DR_MEMORY
@@ -957,13 +1225,17 @@ instru_event_bb_app2app(void *drcontext, void *tag, instrlist_t *bb,
     memset(bi, 0, sizeof(*bi));
     *user_data = (void *) bi;
 
-    if (options.check_uninitialized &&
-        options.check_uninit_blocklist[0] != '\0') {
+    if (options.check_uninit_blocklist[0] != '\0' || options.lib_check_none[0] != '\0' ||
+        options.jit_addr_only) {
         /* We assume no elision across modules here, so we can just pass the tag */
-        bi->mark_defined = module_is_on_check_uninit_blocklist(dr_fragment_app_pc(tag));
+        module_check_level_t level = module_check_level(dr_fragment_app_pc(tag));
+        bi->mark_defined = options.check_uninitialized && level != MODULE_CHECK_FULL;
+        bi->check_none = (level == MODULE_CHECK_NONE);
         DOLOG(3, {
-            if (bi->mark_defined)
-                LOG(3, "module is on uninit blocklist: always defined\n");
+            if (bi->check_none)
+                LOG(3, "module is on -lib_check_none: no checks\n");
+            else if (bi->mark_defined)
+                LOG(3, "module is on uninit blocklist or is JIT code: always defined\n");
         });
     }
 
@@ -1049,6 +1321,8 @@ instru_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
             bi->pattern_4byte_check_only = save->pattern_4byte_check_only;
             IF_DEBUG(bi->pattern_4byte_check_field_set = true);
             bi->share_xl8_max_diff = save->share_xl8_max_diff;
+            bi->tier0 = save->tier0;
+            bi->startup = save->startup;
             hashtable_unlock(&bb_table);
         } else {
             /* We want to ignore unaddr refs by heap routines (when touching headers,
@@ -1081,6 +1355,14 @@ instru_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
         }
     }
 
+#ifdef TOOL_DR_MEMORY
+    /* before the tier, to not count startup code */
+    if (options.shadowing && options.startup_addr_only)
+        startup_bb_analysis(tag, bi, translating);
+    if (options.shadowing && options.tiered_threshold > 0)
+        tier_bb_analysis(tag, bb, bi, translating);
+#endif
+
     bi->first_instr = true;
 #ifdef WINDOWS
     if (options.zero_retaddr)
@@ -1113,6 +1395,53 @@ instru_event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *ins
     if (instr_is_meta(inst))
         goto instru_event_bb_insert_done;
 
+#ifdef TOOL_DR_MEMORY
+    if (bi->first_instr && bi->tier0) {
+        dr_insert_clean_call(drcontext, bb, inst, (void *)tier_count_execution,
+                             false, 2, OPND_CREATE_INTPTR(bi->tier_info),
+                             OPND_CREATE_INTPTR(dr_fragment_app_pc(tag)));
+    }
+# ifdef X86
+    /* Large rep movs and rep stos are handled in bulk by a clean call, which
+     * sets xcx to 0 to skip the loop when it succeeds.  This must come before
+     * the whole-bb spills below so the call sees and updates app values.
+     * An inline test of the count jumps over the call for small strings.
+     */
+    if (bi->first_instr && bi->is_repstr_to_loop &&
+        options.repstr_bulk_threshold > 0 && options.check_uninitialized &&
+        !bi->mark_defined && bi->fake_xl8_override_instr != NULL) {
+        instr_t *string = bi->fake_xl8_override_instr;
+        uint string_opc = instr_get_opcode(string);
+        opnd_t dst = instr_get_dst(string, 0);
+        uint elemsz = opnd_size_in_bytes(opnd_get_size(dst));
+        uint min_count = (options.repstr_bulk_threshold + elemsz - 1) / elemsz;
+        if ((string_opc == OP_movs || string_opc == OP_stos) &&
+            opnd_is_base_disp(dst) && opnd_get_base(dst) == DR_REG_XDI &&
+            min_count <= INT_MAX) {
+            instr_t *skip = INSTR_CREATE_label(drcontext);
+            instr_t *done = INSTR_CREATE_label(drcontext);
+            /* The app's aflags are saved in al:ah around the compare */
+            spill_reg(drcontext, bb, inst, DR_REG_XAX, SPILL_SLOT_SLOW_PARAM);
+            insert_save_aflags_nospill(drcontext, bb, inst, true/*oflag*/);
+            PRE(bb, inst, INSTR_CREATE_cmp(drcontext, opnd_create_reg(DR_REG_XCX),
+                                           OPND_CREATE_INT32(min_count)));
+            PRE(bb, inst, INSTR_CREATE_jcc(drcontext, OP_jb, opnd_create_instr(skip)));
+            insert_restore_aflags_nospill(drcontext, bb, inst, true/*oflag*/);
+            restore_reg(drcontext, bb, inst, DR_REG_XAX, SPILL_SLOT_SLOW_PARAM);
+            dr_insert_clean_call(drcontext, bb, inst, (void *)repstr_bulk_handler,
+                                 false, 3, OPND_CREATE_INT32(string_opc),
+                                 OPND_CREATE_INT32(elemsz),
+                                 opnd_create_reg(DR_REG_XCX));
+            PRE(bb, inst, INSTR_CREATE_jmp(drcontext, opnd_create_instr(done)));
+            PRE(bb, inst, skip);
+            insert_restore_aflags_nospill(drcontext, bb, inst, true/*oflag*/);
+            restore_reg(drcontext, bb, inst, DR_REG_XAX, SPILL_SLOT_SLOW_PARAM);
+            PRE(bb, inst, done);
+        }
+    }
+# endif
+#endif
+
     if (!translating && !for_trace && options.check_pc)
         check_program_counter(drcontext, pc, inst);
 
@@ -1249,15 +1578,20 @@ instru_event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *ins
         goto instru_event_bb_insert_done;
 
     if (options.pattern != 0) {
-        if (!(bi->is_repstr_to_loop && options.pattern_opt_repstr)) {
+        /* pattern mode has no shadow to keep consistent for -lib_check_none */
+        if (!bi->check_none &&
+            !(bi->is_repstr_to_loop && options.pattern_opt_repstr)) {
             /* aggressive optimization of repstr for pattern mode will
              * be handled separately in pattern_instrument_repstr
              */
             pattern_instrument_check(drcontext, bb, inst, bi, translating);
         }
     } else if (options.shadowing &&
-               (options.check_uninitialized || has_noignorable_mem)) {
-        if (instr_ok_for_instrument_fastpath(inst, &mi, bi)) {
+               (options.check_uninitialized ||
+                /* w/o definedness, nothing to keep consistent for -lib_check_none */
+                (has_noignorable_mem && !bi->check_none))) {
+        if (instr_ok_for_instrument_fastpath(inst, &mi, bi) &&
+            !tier_compact_check(bi, has_mem)) {
             instrument_fastpath(drcontext, bb, inst, &mi, bi->check_ignore_unaddr);
             used_fastpath = true;
             bi->added_instru = true;
@@ -1289,7 +1623,8 @@ instru_event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *ins
         instr_writes_esp(inst)) {
         bool shadow_xsp = options.shadowing &&
             (options.check_uninitialized || options.check_stack_bounds);
-        bool zero_stack = ZERO_STACK();
+        /* -zero_stack_lazy zeroes at system calls instead */
+        bool zero_stack = ZERO_STACK() && !options.zero_stack_lazy;
         if (shadow_xsp || zero_stack) {
             /* any new spill must be after the fastpath instru */
             bi->spill_after = instr_get_prev(inst);
@@ -1310,7 +1645,8 @@ instru_event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *ins
         }
         bi->added_instru = true;
     }
-    if (options.zero_retaddr && !ZERO_STACK() && !options.check_uninitialized)
+    if (options.zero_retaddr && (!ZERO_STACK() || options.zero_stack_lazy) &&
+        !options.check_uninitialized)
         insert_zero_retaddr(drcontext, bb, inst, bi);
 
     /* None of the "goto instru_event_bb_insert_dones" above need to be processed here */
@@ -1348,7 +1684,7 @@ instru_event_bb_instru2instru(void *drcontext, void *tag, instrlist_t *bb,
 #ifdef TOOL_DR_MEMORY
 # ifdef X86
     if (options.pattern != 0 && options.pattern_opt_repstr &&
-        bi->is_repstr_to_loop)
+        bi->is_repstr_to_loop && !bi->check_none)
         pattern_instrument_repstr(drcontext, bb, bi, translating);
 # endif
 #endif
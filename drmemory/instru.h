@@ -57,6 +57,10 @@ instrument_resurrect_ro(void *drcontext, void *perscxt, byte **map INOUT);
 void
 bb_save_add_entry(app_pc key, bb_saved_info_t *save);
 
+/* For -startup_addr_only: switches to full checks, if not already done */
+void
+instru_end_startup_phase(const char *reason);
+
 void
 instru_insert_mov_pc(void *drcontext, instrlist_t *bb, instr_t *inst,
                      opnd_t dst, opnd_t pc_opnd);
@@ -29,9 +29,13 @@
 #include "heap.h"
 #include "spill.h"
 #include "redblack.h"
+#include "prof.h"
 #ifdef TOOL_DR_MEMORY
 # include "shadow.h"
 #endif
+#ifdef WINDOWS
+# include "../wininc/ndk_psfuncs.h" /* for PROCESSINFOCLASS */
+#endif
 
 /***************************************************************************
  * REACHABILITY-BASED LEAK DETECTION
@@ -55,6 +59,13 @@ enum {
 # define LOWEST_POINTER ((byte *)(PAGE_SIZE))
 #endif
 
+/* A hint to start loading memory we will soon scan.  It cannot fault. */
+#ifdef WINDOWS
+# define SCAN_PREFETCH(addr) _mm_prefetch((const char *)(addr), _MM_HINT_T0)
+#else
+# define SCAN_PREFETCH(addr) __builtin_prefetch(addr)
+#endif
+
 /* For queueing up regions to scan */
 typedef struct _pc_entry_t {
     app_pc start;
@@ -77,6 +88,53 @@ queue_add(pc_entry_t **head, pc_entry_t **tail, pc_entry_t *add)
     }
 }
 
+static pc_entry_t *
+queue_remove_head(pc_entry_t **head, pc_entry_t **tail)
+{
+    pc_entry_t *e;
+    ASSERT(head != NULL && tail != NULL, "invalid args");
+    e = *head;
+    if (e != NULL) {
+        *head = e->next;
+        if (*head == NULL) {
+            ASSERT(*tail == e, "inconsistent list tail");
+            *tail = NULL;
+        }
+        e->next = NULL;
+    }
+    return e;
+}
+
+/* A malloc chunk in the sorted table built for each scan */
+typedef struct _chunk_entry_t {
+    byte *start;
+    byte *end;
+    /* Mirrors the chunk's malloc table client flags for the length of the
+     * scan, so that a pointer into a chunk needs no malloc table lookup.
+     * Updated alongside every malloc_set_client_flag() made by the scan.
+     */
+    uint flags;
+    /* For -leak_scan_concurrent: set when the chunk was freed (or resized)
+     * while the app ran, so that it is neither marked nor reported.
+     */
+    bool stale;
+    /* Only needed for leaks, a small fraction (for most apps!) of the total,
+     * and so allocated lazily.
+     */
+    struct _unreach_entry_t *unreach;
+} chunk_entry_t;
+
+/* The stack of reachable chunks still to be scanned holds chunk table
+ * indices in fixed-size segments, so that marking does not allocate per chunk
+ * and pops walk memory sequentially.
+ */
+#define REACH_STACK_SEG_ENTRIES 1023
+typedef struct _reach_stack_seg_t {
+    struct _reach_stack_seg_t *prev;
+    size_t count;
+    size_t idx[REACH_STACK_SEG_ENTRIES];
+} reach_stack_seg_t;
+
 /* For passing shared data to helper routines */
 typedef struct _reachability_data_t {
     /* The primary scans find chunks whose head is reachable.
@@ -85,9 +143,11 @@ typedef struct _reachability_data_t {
     bool primary_scan;
     bool first_of_2_iters;
     bool last_of_2_iters;
-    /* Queue of reachable malloc chunks */
-    pc_entry_t *reachq_head;
-    pc_entry_t *reachq_tail;
+    /* Stack of reachable malloc chunks, with one spare segment kept to
+     * avoid an allocation each time a push crosses a segment boundary.
+     */
+    reach_stack_seg_t *reach_stack;
+    reach_stack_seg_t *reach_spare;
     /* Queue of reachable-through-mid-chunk-pointer malloc chunks.
      * Anything whose first reach is through a mid-chunk pointer
      * from the root, regardless of whether later points are to heads,
@@ -95,12 +155,65 @@ typedef struct _reachability_data_t {
      */
     pc_entry_t *midreachq_head;
     pc_entry_t *midreachq_tail;
-    /* Tree for interval lookup to find head given mid-chunk pointer */
-    rb_tree_t *alloc_tree;
+    /* Table sorted by start for interval lookup to find head given
+     * mid-chunk pointer.  chunk_starts duplicates the start of each entry
+     * so the binary search touches as few cache lines as possible.
+     */
+    chunk_entry_t *chunks;
+    byte **chunk_starts;
+    size_t num_chunks;
+    size_t max_chunks;
     /* Tree for storing beyond-TOS ranges for -leaks_only */
     rb_tree_t *stack_tree;
     /* Lowest possible pointer value */
     byte *low_ptr;
+    /* Bounds of all the chunks in the table, for testing a block of words at
+     * once in check_reachability_helper().
+     */
+    bool chunk_filter;
+    byte *chunks_start;
+    byte *chunks_end;
+    /* The span a block is tested against, which contains the chunk span but
+     * can be larger for -leak_scan_incremental.
+     */
+    byte *filter_start;
+    byte *filter_end;
+#ifdef LINUX
+    /* For -leak_scan_incremental */
+    bool incremental;
+    /* Whether pages in clean_page_tree may be skipped in this scan */
+    bool reuse_clean_pages;
+    /* Root pages that hold no word in the filter span, for the next scan */
+    rb_tree_t *new_clean_tree;
+    file_t pagemap;
+    /* For -leak_scan_concurrent: whether to scan only soft-dirty pages,
+     * skipping words inside chunks not (yet) known to be reachable.
+     */
+    bool rescan_dirty;
+#endif
+    /* For -leak_scan_concurrent: whether the primary scan runs while the app
+     * does, so the malloc table may no longer match the chunk table.
+     */
+    bool concurrent;
+    /* The fields below are only used by a parallel primary scan
+     * (-leak_scan_threads) and are protected by scan_lock, as are the
+     * reach_stack and midreachq while the scan is parallel.
+     */
+    bool parallel;
+    /* Pieces of non-heap memory to scan as roots */
+    pc_entry_t *rootq_head;
+    pc_entry_t *rootq_tail;
+    /* Set once every root piece has been queued */
+    bool roots_queued;
+    /* Number of scanners currently working on a dequeued piece or chunk */
+    uint scanners_busy;
+    /* For -strings_vs_pointers outside of a parallel scan: every address in
+     * [nontext_start, nontext_end) is known to fail is_part_of_string_ascii()
+     * when scanning up to nontext_max_scan.
+     */
+    byte *nontext_start;
+    byte *nontext_end;
+    byte *nontext_max_scan;
 } reachability_data_t;
 
 #ifdef STATISTICS
@@ -109,6 +222,11 @@ uint midchunk_postnew_ptrs;
 uint midchunk_postinheritance_ptrs;
 uint midchunk_string_ptrs;
 uint strings_not_pointers;
+uint scan_blocks_filtered;
+uint scan_ro_regions_reused;
+# ifdef LINUX
+uint scan_pages_reused;
+# endif
 # ifdef WINDOWS
 uint pointers_encoded;
 uint encoded_pointers_scanned;
@@ -123,6 +241,7 @@ static bool op_midchunk_inheritance_ok;
 static bool op_midchunk_string_ok;
 static bool op_midchunk_size_ok;
 static bool op_show_reachable;
+static uint op_scan_threads;
 #ifdef WINDOWS
 static bool op_check_encoded_pointers;
 #endif
@@ -130,6 +249,83 @@ static byte *(*cb_next_defined_ptrsz)(byte *, byte *);
 static byte *(*cb_end_of_defined_region)(byte *, byte *);
 static bool (*cb_is_register_defined)(void *, reg_id_t);
 
+/* Helper threads for a parallel primary scan on a nudge (-leak_scan_threads).
+ * They are created at init time, are not suspended by the scan's
+ * suspend-all, and poll for an open scan.  Roots are split into pieces
+ * that all scanners, including the thread performing the scan, pull from a
+ * single locked queue along with newly found reachable chunks.  Claiming a
+ * chunk (setting its flag and queueing it) is done under the same lock.
+ */
+static void *scan_lock;
+/* Non-NULL while a parallel scan is accepting helpers */
+static reachability_data_t * volatile scan_shared;
+/* Helpers that have joined the open scan and not yet left it */
+static volatile uint scan_helpers_joined;
+static volatile bool scan_helpers_exit;
+/* How long an idle helper sleeps between checks for a scan */
+#define SCAN_HELPER_POLL_MS 50
+/* The largest piece of a root region handed to one scanner */
+#define SCAN_ROOT_PIECE_SIZE (64*PAGE_SIZE)
+
+static void leak_scan_helper_thread(void *arg);
+
+#ifdef LINUX
+/* For -leak_scan_incremental: runs of root pages that held no word within
+ * [clean_span_start, clean_span_end) at the last nudge scan.  A page the
+ * kernel says has not been written since cannot point into that span now.
+ */
+static rb_tree_t *clean_page_tree;
+static byte *clean_span_start;
+static byte *clean_span_end;
+/* The soft-dirty bit in a /proc/self/pagemap entry */
+# define PAGEMAP_SOFT_DIRTY (1ULL << 55)
+/* How many pagemap entries we read at once */
+# define PAGEMAP_BATCH 128
+
+/* Per-call page state for check_reachability_helper() */
+typedef struct _page_track_t {
+    /* The page being scanned, or NULL */
+    byte *page;
+    /* Whether the page held a word in the filter span, or was not filtered */
+    bool candidate;
+    /* A run of clean pages not yet added to new_clean_tree */
+    byte *run_start;
+    byte *run_end;
+    /* Cached pagemap entries for pagemap_count pages from pagemap_base */
+    byte *pagemap_base;
+    uint pagemap_count;
+    uint64 pagemap_buf[PAGEMAP_BATCH];
+} page_track_t;
+#endif
+
+/* For -leak_scan_cache_read_only: the words of each read-only root region
+ * that fell within [span_start, span_end) when it was first scanned.  An
+ * entry is dropped when anything is mapped, unmapped, or made writable over
+ * its region, or when the heap outgrows its span.
+ */
+typedef struct _ro_candidate_t {
+    byte *addr;
+    byte *value;
+} ro_candidate_t;
+
+typedef struct _ro_cache_t {
+    byte *span_start;
+    byte *span_end;
+    size_t num;
+    size_t capacity;
+    ro_candidate_t *cands;
+} ro_cache_t;
+
+/* The initial candidate capacity of a region */
+#define RO_CACHE_INITIAL_CANDIDATES 64
+
+static rb_tree_t *ro_cache_tree;
+/* Protects ro_cache_tree, which app threads update on memory changes */
+static void *ro_cache_lock;
+
+/* For collecting the distinct client_data of the chunks about to be reported */
+#define PENDING_TABLE_HASH_BITS 10
+
 #ifdef WINDOWS
 /* RtlHeap stores failed alloc info which can hide leaks (i#292) */
 static app_pc rtl_fail_info;
@@ -151,8 +347,48 @@ static void leak_wrap_pre_encode_ptr(void *wrapcxt, void OUT **user_data);
 static void leak_wrap_post_encode_ptr(void *wrapcxt, void *user_data);
 /* i#1276: handle VS2012 Concurrency::details::Security::EncodePointer */
 static app_pc crt_encode_ptr;
+/* Whether we decode the Rtl routines' results arithmetically instead of
+ * wrapping the routines.  Always false on 32-bit.
+ */
+static bool decode_proc_ptrs;
+static bool decode_sys_ptrs;
+# ifdef X64
+/* On 64-bit Windows, RtlEncodePointer computes ror(ptr ^ cookie, cookie % 64)
+ * with the per-process cookie, and RtlEncodeSystemPointer does the same with
+ * the system-wide cookie in the shared user data.  When we can confirm that
+ * at init time we decode every scanned word and need no table entries.  We
+ * do not try this on 32-bit, where so much of the address space is in use
+ * that a random word would often decode to a heap address.
+ */
+typedef struct _ptr_encoding_t {
+    ptr_uint_t cookie;
+    uint rot;
+} ptr_encoding_t;
+static ptr_encoding_t encoding_proc;
+static ptr_encoding_t encoding_sys;
+#  define USER_SHARED_DATA ((KUSER_SHARED_DATA *) 0x7ffe0000)
+GET_NTDLL(NtQueryInformationProcess, (IN HANDLE ProcessHandle,
+                                      IN PROCESSINFOCLASS ProcessInformationClass,
+                                      OUT PVOID ProcessInformation,
+                                      IN ULONG ProcessInformationLength,
+                                      OUT PULONG ReturnLength OPTIONAL));
+typedef PVOID (NTAPI *encode_pointer_t)(PVOID);
+static bool ptr_encoding_init_proc(app_pc encode_func);
+static bool ptr_encoding_init_sys(app_pc encode_func);
+# endif
 #endif
 
+static void
+ro_cache_free(void *p)
+{
+    ro_cache_t *cache = (ro_cache_t *) p;
+    if (cache->cands != NULL) {
+        global_free(cache->cands, cache->capacity * sizeof(*cache->cands),
+                    HEAPSTAT_MISC);
+    }
+    global_free(cache, sizeof(*cache), HEAPSTAT_MISC);
+}
+
 void
 leak_init(bool have_defined_info,
           bool check_leaks_on_destroy,
@@ -161,6 +397,7 @@ leak_init(bool have_defined_info,
           bool midchunk_string_ok,
           bool midchunk_size_ok,
           bool show_reachable,
+          uint scan_threads,
           IF_WINDOWS_(bool check_encoded_pointers)
           byte *(*next_defined_ptrsz)(byte *, byte *),
           byte *(*end_of_defined_region)(byte *, byte *),
@@ -177,6 +414,7 @@ leak_init(bool have_defined_info,
     op_midchunk_string_ok = midchunk_string_ok;
     op_midchunk_size_ok = midchunk_size_ok;
     op_show_reachable = show_reachable;
+    op_scan_threads = scan_threads;
 #ifdef WINDOWS
     op_check_encoded_pointers = check_encoded_pointers;
 #endif
@@ -189,6 +427,23 @@ leak_init(bool have_defined_info,
         cb_is_register_defined = is_register_defined;
     }
 
+    if (options.leak_scan_cache_read_only) {
+        ro_cache_tree = rb_tree_create(ro_cache_free);
+        ro_cache_lock = dr_mutex_create();
+    }
+
+    if (op_scan_threads > 0) {
+        uint i;
+        scan_lock = dr_mutex_create();
+        for (i = 0; i < op_scan_threads; i++) {
+            if (!dr_create_client_thread(leak_scan_helper_thread, NULL)) {
+                /* The scan does not depend on the helpers being there */
+                LOG(1, "WARNING: unable to create leak scan helper thread\n");
+                break;
+            }
+        }
+    }
+
 #ifdef WINDOWS
     if (op_check_encoded_pointers) {
         hashtable_init(&encoded_ptr_table, ENCODED_PTR_TABLE_HASH_BITS,
@@ -203,6 +458,19 @@ leak_init(bool have_defined_info,
                 dr_get_proc_address(mod->handle, "RtlEncodePointer");
             rtl_encode_sysptr = (app_pc)
                 dr_get_proc_address(mod->handle, "RtlEncodeSystemPointer");
+# ifdef X64
+            decode_proc_ptrs = ptr_encoding_init_proc(rtl_encode_ptr);
+            decode_sys_ptrs = ptr_encoding_init_sys(rtl_encode_sysptr);
+            LOG(1, "decoding %s%s%s arithmetically\n",
+                decode_proc_ptrs ? "RtlEncodePointer" : "",
+                (decode_proc_ptrs && decode_sys_ptrs) ? " and " : "",
+                decode_sys_ptrs ? "RtlEncodeSystemPointer" : "");
+            /* We only wrap, and later unwrap, what we cannot decode */
+            if (decode_proc_ptrs)
+                rtl_encode_ptr = NULL;
+            if (decode_sys_ptrs)
+                rtl_encode_sysptr = NULL;
+# endif
             if ((rtl_encode_ptr != NULL &&
                  !drwrap_wrap(rtl_encode_ptr, leak_wrap_pre_encode_ptr,
                               leak_wrap_post_encode_ptr)) ||
@@ -221,6 +489,22 @@ leak_init(bool have_defined_info,
 void
 leak_exit(void)
 {
+    if (op_scan_threads > 0) {
+        /* No scan can be open here, so the helpers are not using the lock.
+         * As with Dr. Heapstat's sideline thread, DR terminates them.
+         */
+        ASSERT(scan_shared == NULL, "leak scan still open at exit");
+        scan_helpers_exit = true;
+        dr_mutex_destroy(scan_lock);
+    }
+#ifdef LINUX
+    if (clean_page_tree != NULL)
+        rb_tree_destroy(clean_page_tree);
+#endif
+    if (ro_cache_tree != NULL) {
+        rb_tree_destroy(ro_cache_tree);
+        dr_mutex_destroy(ro_cache_lock);
+    }
 #ifdef WINDOWS
     if (op_check_encoded_pointers) {
         hashtable_delete_with_stats(&encoded_ptr_table, "encoded_ptr");
@@ -285,6 +569,29 @@ leak_handle_alloc(void *drcontext, app_pc base, size_t size)
 #endif
 }
 
+/* User must call when memory is mapped, unmapped, or made writable */
+void
+leak_handle_mapping_change(app_pc base, size_t size)
+{
+    rb_node_t *node;
+    byte *start = (byte *) ALIGN_BACKWARD(base, PAGE_SIZE);
+    byte *end = (byte *) ALIGN_FORWARD(base + size, PAGE_SIZE);
+    if (ro_cache_tree == NULL || end <= start)
+        return;
+    dr_mutex_lock(ro_cache_lock);
+    while ((node = rb_overlaps_node(ro_cache_tree, start, end - 1)) != NULL) {
+        DOLOG(2, {
+            byte *node_base;
+            size_t node_size;
+            rb_node_fields(node, &node_base, &node_size, NULL);
+            LOG(2, "dropping cached leak scan roots "PFX"-"PFX"\n",
+                node_base, node_base + node_size);
+        });
+        rb_delete(ro_cache_tree, node);
+    }
+    dr_mutex_unlock(ro_cache_lock);
+}
+
 #ifdef WINDOWS
 /* User must call from client_remove_malloc_on_destroy() */
 void
@@ -333,6 +640,93 @@ leak_remove_malloc_on_destroy(HANDLE heap, byte *start, byte *end)
  */
 
 #ifdef WINDOWS
+# ifdef X64
+static inline byte *
+ptr_encode(const ptr_encoding_t *enc, byte *ptr)
+{
+    ptr_uint_t v = (ptr_uint_t)ptr ^ enc->cookie;
+    if (enc->rot != 0)
+        v = (v >> enc->rot) | (v << (sizeof(v)*8 - enc->rot));
+    return (byte *) v;
+}
+
+static inline byte *
+ptr_decode(const ptr_encoding_t *enc, byte *encoded)
+{
+    ptr_uint_t v = (ptr_uint_t)encoded;
+    if (enc->rot != 0)
+        v = (v << enc->rot) | (v >> (sizeof(v)*8 - enc->rot));
+    return (byte *)(v ^ enc->cookie);
+}
+
+/* Checks our arithmetic against the real routine on a few values */
+static bool
+ptr_encoding_matches(app_pc func, const ptr_encoding_t *enc)
+{
+    static byte *const probes[] = {
+        NULL, (byte *)(ptr_uint_t)1, (byte *)(ptr_uint_t)0x12345678,
+        (byte *)(ptr_uint_t)0x7ff712345670,
+    };
+    uint i;
+    for (i = 0; i < BUFFER_SIZE_ELEMENTS(probes); i++) {
+        if ((byte *) ((encode_pointer_t)func)(probes[i]) != ptr_encode(enc, probes[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool
+ptr_encoding_init_proc(app_pc encode_func)
+{
+    ULONG cookie, got;
+    if (encode_func == NULL ||
+        !NT_SUCCESS(NtQueryInformationProcess(NT_CURRENT_PROCESS, ProcessCookie,
+                                              &cookie, sizeof(cookie), &got)))
+        return false;
+    encoding_proc.cookie = cookie;
+    encoding_proc.rot = cookie % (sizeof(ptr_uint_t)*8);
+    return ptr_encoding_matches(encode_func, &encoding_proc);
+}
+
+static bool
+ptr_encoding_init_sys(app_pc encode_func)
+{
+    ULONG cookie;
+    if (encode_func == NULL ||
+        !safe_read(&USER_SHARED_DATA->Cookie, sizeof(cookie), &cookie))
+        return false;
+    encoding_sys.cookie = cookie;
+    encoding_sys.rot = cookie % (sizeof(ptr_uint_t)*8);
+    return ptr_encoding_matches(encode_func, &encoding_sys);
+}
+# endif
+
+/* Returns whether any of the words decodes arithmetically into [lo, hi) */
+static inline bool
+scan_block_has_encoded_candidate(void **words, size_t num_words, byte *lo, byte *hi)
+{
+# ifdef X64
+    ptr_uint_t span = (ptr_uint_t)(hi - lo);
+    uint hits = 0;
+    size_t i;
+    if (decode_proc_ptrs) {
+        for (i = 0; i < num_words; i++) {
+            hits |= ((ptr_uint_t)(ptr_decode(&encoding_proc, (byte *)words[i]) - lo) <
+                     span);
+        }
+    }
+    if (decode_sys_ptrs) {
+        for (i = 0; i < num_words; i++) {
+            hits |= ((ptr_uint_t)(ptr_decode(&encoding_sys, (byte *)words[i]) - lo) <
+                     span);
+        }
+    }
+    return hits != 0;
+# else
+    return false;
+# endif
+}
+
 static void
 leak_wrap_pre_encode_ptr(void *wrapcxt, void OUT **user_data)
 {
@@ -401,17 +795,194 @@ unreach_entry_alloc(void)
     return e;
 }
 
+/* Returns the entry containing addr, or NULL.  The search has no
+ * data-dependent branches other than the loop bound.
+ */
+static inline chunk_entry_t *
+chunk_table_lookup(reachability_data_t *data, byte *addr)
+{
+    byte **base = data->chunk_starts;
+    size_t n = data->num_chunks;
+    size_t idx;
+    if (n == 0)
+        return NULL;
+    while (n > 1) {
+        size_t half = n / 2;
+        base = (base[half] <= addr) ? base + half : base;
+        n -= half;
+    }
+    if (*base > addr)
+        return NULL;
+    idx = base - data->chunk_starts;
+    if (addr >= data->chunks[idx].end)
+        return NULL;
+    return &data->chunks[idx];
+}
+
+/* Returns the entry starting at start, or NULL.  Unlike chunk_table_lookup()
+ * this finds zero-sized chunks.
+ */
+static chunk_entry_t *
+chunk_table_find(reachability_data_t *data, byte *start)
+{
+    size_t lo = 0, hi = data->num_chunks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (data->chunk_starts[mid] < start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < data->num_chunks && data->chunk_starts[lo] == start)
+        return &data->chunks[lo];
+    return NULL;
+}
+
 static bool
-rb_cleanup_entries(rb_node_t *node, void *iter_data)
+malloc_iterate_count_cb(malloc_info_t *info, void *iter_data)
 {
-    unreach_entry_t *e;
-    ASSERT(node != NULL, "invalid param");
-    rb_node_fields(node, NULL, NULL, (void*)&e);
-    if (e != NULL)
-        global_free(e, sizeof(*e), HEAPSTAT_MISC);
+    size_t *count = (size_t *) iter_data;
+    (*count)++;
     return true;
 }
 
+static bool
+malloc_iterate_build_table_cb(malloc_info_t *info, void *iter_data)
+{
+    reachability_data_t *data = (reachability_data_t *) iter_data;
+    chunk_entry_t *e;
+    ASSERT(data != NULL, "invalid iteration data");
+    if (data->num_chunks >= data->max_chunks) {
+        /* Only possible if some thread was not suspended */
+        LOG(1, "WARNING: heap grew during leak scan setup\n");
+        return false;
+    }
+    e = &data->chunks[data->num_chunks++];
+    e->start = info->base;
+    e->end = info->base + info->request_size;
+    e->flags = info->client_flags;
+    e->stale = false;
+    e->unreach = NULL;
+    return true;
+}
+
+static void
+chunk_table_sift_down(chunk_entry_t *chunks, size_t root, size_t count)
+{
+    while (2*root + 1 < count) {
+        size_t child = 2*root + 1;
+        chunk_entry_t tmp;
+        if (child + 1 < count && chunks[child].start < chunks[child + 1].start)
+            child++;
+        if (chunks[root].start >= chunks[child].start)
+            return;
+        tmp = chunks[root];
+        chunks[root] = chunks[child];
+        chunks[child] = tmp;
+        root = child;
+    }
+}
+
+/* Builds the table for interval lookup for mid-chunk pointers (PR 476482).
+ * We use a heapsort as it needs neither recursion nor extra memory.
+ */
+static void
+chunk_table_create(reachability_data_t *data)
+{
+    size_t i;
+    malloc_iterate(malloc_iterate_count_cb, (void *) &data->max_chunks);
+    if (data->max_chunks == 0)
+        return;
+    data->chunks = (chunk_entry_t *)
+        global_alloc(data->max_chunks * sizeof(*data->chunks), HEAPSTAT_MISC);
+    data->chunk_starts = (byte **)
+        global_alloc(data->max_chunks * sizeof(*data->chunk_starts), HEAPSTAT_MISC);
+    malloc_iterate(malloc_iterate_build_table_cb, (void *) data);
+    for (i = data->num_chunks / 2; i > 0; i--)
+        chunk_table_sift_down(data->chunks, i - 1, data->num_chunks);
+    for (i = data->num_chunks; i > 1; i--) {
+        chunk_entry_t tmp = data->chunks[0];
+        data->chunks[0] = data->chunks[i - 1];
+        data->chunks[i - 1] = tmp;
+        chunk_table_sift_down(data->chunks, 0, i - 1);
+    }
+    for (i = 0; i < data->num_chunks; i++) {
+        data->chunk_starts[i] = data->chunks[i].start;
+        ASSERT(i == 0 || data->chunks[i].start >= data->chunks[i - 1].end,
+               "mallocs should not overlap");
+    }
+    LOG(2, "leak scan chunk table has "SZFMT" entries\n", data->num_chunks);
+}
+
+static void
+chunk_table_destroy(reachability_data_t *data)
+{
+    size_t i;
+    if (data->max_chunks == 0)
+        return;
+    for (i = 0; i < data->num_chunks; i++) {
+        if (data->chunks[i].unreach != NULL) {
+            global_free(data->chunks[i].unreach, sizeof(*data->chunks[i].unreach),
+                        HEAPSTAT_MISC);
+        }
+    }
+    global_free(data->chunks, data->max_chunks * sizeof(*data->chunks), HEAPSTAT_MISC);
+    global_free(data->chunk_starts, data->max_chunks * sizeof(*data->chunk_starts),
+                HEAPSTAT_MISC);
+}
+
+static void
+reach_stack_push(reachability_data_t *data, chunk_entry_t *chunk)
+{
+    reach_stack_seg_t *seg = data->reach_stack;
+    if (seg == NULL || seg->count == REACH_STACK_SEG_ENTRIES) {
+        if (data->reach_spare != NULL) {
+            seg = data->reach_spare;
+            data->reach_spare = NULL;
+        } else
+            seg = (reach_stack_seg_t *) global_alloc(sizeof(*seg), HEAPSTAT_MISC);
+        seg->prev = data->reach_stack;
+        seg->count = 0;
+        data->reach_stack = seg;
+    }
+    seg->idx[seg->count++] = chunk - data->chunks;
+}
+
+/* Returns the next reachable chunk to scan, or NULL if there are none.  We
+ * prefetch the start of the one after it, which is the next to be popped
+ * unless scanning this one pushes more.
+ */
+static chunk_entry_t *
+reach_stack_pop(reachability_data_t *data)
+{
+    reach_stack_seg_t *seg = data->reach_stack;
+    chunk_entry_t *chunk;
+    if (seg == NULL)
+        return NULL;
+    chunk = &data->chunks[seg->idx[--seg->count]];
+    if (seg->count == 0) {
+        data->reach_stack = seg->prev;
+        if (data->reach_spare == NULL)
+            data->reach_spare = seg;
+        else
+            global_free(seg, sizeof(*seg), HEAPSTAT_MISC);
+        seg = data->reach_stack;
+    }
+    if (seg != NULL)
+        SCAN_PREFETCH(data->chunks[seg->idx[seg->count - 1]].start);
+    return chunk;
+}
+
+static void
+reach_stack_destroy(reachability_data_t *data)
+{
+    ASSERT(data->reach_stack == NULL, "reachable chunks left unscanned");
+    if (data->reach_spare != NULL) {
+        global_free(data->reach_spare, sizeof(*data->reach_spare), HEAPSTAT_MISC);
+        data->reach_spare = NULL;
+    }
+}
+
 /*
  * Design:
  * * in top-level summary, just list total bytes (direct+indirect):
@@ -450,7 +1021,7 @@ rb_cleanup_entries(rb_node_t *node, void *iter_data)
 static void
 mark_indirect(reachability_data_t *data, byte *ptr_parent, byte *ptr_child,
               byte *child_start, byte *child_end, uint flags,
-              rb_node_t *node_child/*OPTIONAL*/)
+              chunk_entry_t *chunk_child/*OPTIONAL*/)
 {
     if (TEST(MALLOC_REACHABLE, flags)) {
         /* if reachable through some other parent: leave alone */
@@ -465,26 +1036,22 @@ mark_indirect(reachability_data_t *data, byte *ptr_parent, byte *ptr_child,
          * every top-level direct leak, but we're not doing a
          * depth-first walk, so we must later update parents when we
          * process their children.  We also don't have any other good
-         * place to store the size so we use the rbtree.
+         * place to store the size so we use the chunk table.
          */
         unreach_entry_t *unreach_child, *unreach_parent;
-        rb_node_t *node_parent = rb_in_node(data->alloc_tree, ptr_parent);
-        ASSERT(node_parent != NULL, "unreachable must be in heap");
-        if (node_child == NULL) /* optional */
-            node_child = rb_find(data->alloc_tree, ptr_child);
-        ASSERT(node_child != NULL, "reachable object must be in rbtree");
-        rb_node_fields(node_child, NULL, NULL, (void*)&unreach_child);
-        /* rb client fields allocated lazily */
-        if (unreach_child == NULL) {
-            unreach_child = unreach_entry_alloc();
-            rb_node_set_client(node_child, (void *)unreach_child);
-        }
+        chunk_entry_t *chunk_parent = chunk_table_lookup(data, ptr_parent);
+        ASSERT(chunk_parent != NULL, "unreachable must be in heap");
+        if (chunk_child == NULL) /* optional */
+            chunk_child = chunk_table_find(data, ptr_child);
+        ASSERT(chunk_child != NULL, "reachable object must be in chunk table");
+        /* allocated lazily */
+        if (chunk_child->unreach == NULL)
+            chunk_child->unreach = unreach_entry_alloc();
+        unreach_child = chunk_child->unreach;
         /* acquire after in case child==parent */
-        rb_node_fields(node_parent, NULL, NULL, (void *)&unreach_parent);
-        if (unreach_parent == NULL) {
-            unreach_parent = unreach_entry_alloc();
-            rb_node_set_client(node_parent, (void *)unreach_parent);
-        }
+        if (chunk_parent->unreach == NULL)
+            chunk_parent->unreach = unreach_entry_alloc();
+        unreach_parent = chunk_parent->unreach;
 
         if (TEST(MALLOC_INDIRECTLY_REACHABLE, flags)) {
             /* node is already claimed: either by another parent,
@@ -518,6 +1085,7 @@ mark_indirect(reachability_data_t *data, byte *ptr_parent, byte *ptr_child,
                 IF_DEBUG(bool found =)
                     malloc_set_client_flag(child_start, MALLOC_INDIRECTLY_REACHABLE);
                 ASSERT(found, "malloc chunk must be in hashtable");
+                chunk_child->flags |= MALLOC_INDIRECTLY_REACHABLE;
             }
         }
     }
@@ -537,6 +1105,47 @@ leak_safe_read_heap(void *base, void **var)
     return safe_read(base, sizeof(void*), var);
 }
 
+/* The number of words check_reachability_helper() tests at once */
+#define SCAN_BLOCK_WORDS 64
+
+/* Returns a pointer to the num_words words at pc, either pc itself or a copy
+ * in buf, or NULL if they cannot be read in one go.  We make just one read
+ * per block instead of one per word.
+ */
+static inline void **
+scan_block_read(byte *pc, size_t num_words, void **buf)
+{
+#ifdef UNIX
+    /* i#1773: we use a safe read even for readable pages */
+    if (safe_read(pc, num_words * sizeof(void*), buf))
+        return buf;
+    return NULL;
+#else
+    /* Threads are suspended and we checked readability so safe to deref */
+    return (void **) pc;
+#endif
+}
+
+static inline bool
+scan_word_is_candidate(void *word, byte *lo, byte *hi)
+{
+    return ((ptr_uint_t)((byte *)word - lo) < (ptr_uint_t)(hi - lo));
+}
+
+/* Returns whether any of the words might point into [lo, hi).  We avoid
+ * branches inside the loop so the compiler can vectorize it.
+ */
+static inline bool
+scan_block_has_candidate(void **words, size_t num_words, byte *lo, byte *hi)
+{
+    ptr_uint_t span = (ptr_uint_t)(hi - lo);
+    uint hits = 0;
+    size_t i;
+    for (i = 0; i < num_words; i++)
+        hits |= ((ptr_uint_t)((byte *)words[i] - lo) < span);
+    return hits != 0;
+}
+
 /* Helper for PR 484544.  Do not export: assumes world is suspended! */
 static bool
 is_text(byte *ptr)
@@ -808,7 +1417,23 @@ is_midchunk_pointer_legitimate(byte *pointer, byte *chunk_start, byte *chunk_end
  */
 #define STRING_SINGLE_MAX_LEN   128
 
+/* We classify a pointer-sized word at a time when we can: a word with no null
+ * and no non-ASCII char can be skipped without looking at its chars.
+ */
+#define WORD_ONES  (~(ptr_uint_t)0 / 0xff)
+#define WORD_HIGHS (WORD_ONES * 0x80)
+#define WORD_HAS_ZERO_BYTE(v) ((((v) - WORD_ONES) & ~(v) & WORD_HIGHS) != 0)
+
 #ifdef WINDOWS
+/* IS_ASCII() looks only at the low byte of a wide char */
+# define WIDE_ONES  (~(ptr_uint_t)0 / 0xffff)
+# define WIDE_HIGHS (WIDE_ONES * 0x8000)
+# define WIDE_LOW_HIGHS (WIDE_ONES * 0x80)
+# define WIDE_LOWS  (WIDE_ONES * 0xff)
+# define WORD_IS_ALL_ASCII_WIDE(v) \
+    (((v) & WIDE_LOW_HIGHS) == 0 && \
+     ((((v) & WIDE_LOWS) - WIDE_ONES) & ~((v) & WIDE_LOWS) & WIDE_HIGHS) == 0)
+
 static bool
 is_part_of_string_wide(wchar_t *s, wchar_t *max_scan)
 {
@@ -817,6 +1442,14 @@ is_part_of_string_wide(wchar_t *s, wchar_t *max_scan)
         (wchar_t *) ALIGN_FORWARD(s, PAGE_SIZE);
     wchar_t *start;
     for (start = s; s < stop; s++) {
+        if (ALIGNED(s, sizeof(ptr_uint_t)) &&
+            (byte *)s + sizeof(ptr_uint_t) <= (byte *)stop &&
+            WORD_IS_ALL_ASCII_WIDE(*(ptr_uint_t *)s)) {
+            s += sizeof(ptr_uint_t) / sizeof(*s) - 1;
+            if (s - start >= STRING_SINGLE_MAX_LEN)
+                return true;
+            continue;
+        }
         if (*s == 0) {
             if (start < s) {
                 count++;
@@ -835,23 +1468,42 @@ is_part_of_string_wide(wchar_t *s, wchar_t *max_scan)
 }
 #endif
 
+/* If the result is false because of a null or non-ASCII char that ends the
+ * first string, returns that char's address in *fail_at; else NULL.  Every
+ * address between s and *fail_at then fails as well.
+ */
 static bool
-is_part_of_string_ascii(byte *s, byte *max_scan)
+is_part_of_string_ascii(byte *s, byte *max_scan, byte **fail_at OUT)
 {
     uint count = 0;
     byte *stop = (max_scan != NULL) ? max_scan : (byte *) ALIGN_FORWARD(s, PAGE_SIZE);
-    byte *start;
+    byte *start, *first = s;
+    *fail_at = NULL;
     for (start = s; s < stop; s++) {
+        if (ALIGNED(s, sizeof(ptr_uint_t)) && s + sizeof(ptr_uint_t) <= stop) {
+            ptr_uint_t v = *(ptr_uint_t *)s;
+            if ((v & WORD_HIGHS) == 0 && !WORD_HAS_ZERO_BYTE(v)) {
+                s += sizeof(v) - 1;
+                if (s - start >= STRING_SINGLE_MAX_LEN)
+                    return true;
+                continue;
+            }
+        }
         if (*s == 0) {
             if (start < s) {
                 count++;
-                if (s - start < STRING_MIN_LEN)
+                if (s - start < STRING_MIN_LEN) {
+                    if (start == first)
+                        *fail_at = s;
                     return false;
+                }
                 if (count >= STRING_MIN_COUNT)
                     break;
             } /* else, several nulls in a row */
             start = s + 1;
         } else if (!IS_ASCII(*s)) {
+            if (start == first)
+                *fail_at = s;
             return false;
         } else if (s - start >= STRING_SINGLE_MAX_LEN)
             return true;
@@ -860,52 +1512,61 @@ is_part_of_string_ascii(byte *s, byte *max_scan)
 }
 
 static bool
-is_part_of_string(byte *s, byte *max_scan)
+is_part_of_string(byte *s, byte *max_scan, reachability_data_t *data)
 {
+    byte *fail_at;
+    bool res;
 #ifdef WINDOWS
     if (*(s+1) == 0 && *(s+3) == 0)
         return is_part_of_string_wide((wchar_t *)s, (wchar_t *)max_scan);
 #endif
-    return is_part_of_string_ascii(s, max_scan);
+    /* Candidate pointers inside one non-text run share its verdict */
+    if (s >= data->nontext_start && s < data->nontext_end &&
+        max_scan == data->nontext_max_scan)
+        return false;
+    res = is_part_of_string_ascii(s, max_scan, &fail_at);
+    if (fail_at != NULL && !data->parallel) {
+        data->nontext_start = s;
+        data->nontext_end = fail_at;
+        data->nontext_max_scan = max_scan;
+    }
+    return res;
+}
+
+#ifdef LINUX
+/* As the app runs during a -leak_scan_concurrent primary scan, the page
+ * holding a string may be unmapped while we look at it.
+ */
+static bool
+is_part_of_string_concurrent(byte *s, byte *max_scan, reachability_data_t *data)
+{
+    bool res = false;
+    DR_TRY_EXCEPT(dr_get_current_drcontext(), {
+        res = is_part_of_string(s, max_scan, data);
+    }, { /* EXCEPT */
+        res = false;
+    });
+    return res;
 }
+#endif
 
 /***************************************************************************/
 
 static void
-check_reachability_pointer(byte *pointer, byte *ptr_addr, byte *defined_end,
-                           reachability_data_t *data)
+check_reachability_value(byte *pointer, byte *ptr_addr, byte *defined_end,
+                         reachability_data_t *data)
 {
     byte *chunk_start = NULL;
     byte *chunk_end;
     bool add_reachable = false, add_maybe_reachable = false;
     uint flags = 0;
     bool reachable = false;
-    rb_node_t *node = NULL;
+    bool claim_locked = false;
+    chunk_entry_t *chunk = NULL;
 
     if (pointer == NULL)
         return;
 
-#ifdef WINDOWS
-    if (op_check_encoded_pointers) {
-        /* XXX: measure perf hit of yet another hashtable lookup on every single ptr.
-         * Could store in malloc table since already looking there, and assuming
-         * disjoint though could imagine an xor happening to collide.
-         */
-        byte *decoded = get_decoded_ptr(pointer);
-        if (decoded != NULL) {
-            LOG(3, "\t("PFX" when decoded is "PFX" so checking both)\n",
-                pointer, decoded);
-            STATS_INC(encoded_pointers_scanned);
-            /* We check both encoded and decoded b/c xor could collide w/ heap addr.
-             * No reverse in table so we won't recurse forever.
-             */
-            ASSERT(get_decoded_ptr(decoded) == NULL, "encoded table can't have reverse");
-            check_reachability_pointer(decoded, ptr_addr, defined_end, data);
-            pointer = decoded;
-        }
-    }
-#endif
-
     /* skip any small value that cannot be a pointer
      * Note: there are several places (e.g., is_text, is_vtable, and is_image)
      * doing the similar checks against LOWEST_POINTER, which might benefit from
@@ -914,41 +1575,48 @@ check_reachability_pointer(byte *pointer, byte *ptr_addr, byte *defined_end,
      */
     if (pointer < data->low_ptr)
         return;
-    /* We look in rbtree first since likely to miss both so why do hash lookup */
-    node = rb_in_node(data->alloc_tree, pointer);
-    if (node != NULL) {
+    /* We look in the chunk table first since likely to miss both so why do
+     * hash lookup
+     */
+    chunk = chunk_table_lookup(data, pointer);
+    if (chunk != NULL && chunk->stale)
+        chunk = NULL;
+    if (chunk != NULL) {
 #ifndef VMX86_SERVER /* unsafe to read */
-        /* We check for strings after the rbtree lookup to avoid extra work
+        /* We check for strings after the table lookup to avoid extra work
          * on every pointer.
          */
         if (options.strings_vs_pointers &&
             ptr_addr > (byte *) PAGE_SIZE && /* rule out register */
-            is_part_of_string(ptr_addr, defined_end)) {
+            (IF_LINUX(data->concurrent ?
+                      is_part_of_string_concurrent(ptr_addr, defined_end, data) :)
+             is_part_of_string(ptr_addr, defined_end, data))) {
             LOG(3, "\t("PFX" is part of a string table so not considering a pointer)\n",
                 ptr_addr);
             STATS_INC(strings_not_pointers);
-            node = NULL;
+            chunk = NULL;
         }
 #endif
     }
-    if (node != NULL) {
-        chunk_end = malloc_end(pointer);
-        if (chunk_end != NULL) {
+    if (chunk != NULL) {
+        /* The table entry has the bounds and the flags, so we need no malloc
+         * table lookup for either a head or a mid-chunk pointer.
+         */
+        chunk_start = chunk->start;
+        chunk_end = chunk->end;
+        flags = chunk->flags;
+        if (pointer == chunk_start) {
             if (ptr_addr >= pointer && ptr_addr < chunk_end) {
                 LOG(3, "\t("PFX" points to start of its own chunk "PFX"-"PFX")\n",
                     ptr_addr, pointer, chunk_end);
             } else {
-                flags = malloc_get_client_flags(pointer);
                 LOG(3, "\t"PFX" points to chunk "PFX"-"PFX"\n",
                     ptr_addr, pointer, chunk_end);
-                chunk_start = pointer;
                 reachable = true;
             }
         } else {
-            size_t chunk_size;
-            rb_node_fields(node, &chunk_start, &chunk_size, NULL);
-            chunk_end = chunk_start + chunk_size;
-            ASSERT(is_in_heap_region(pointer), "heap data struct inconsistency");
+            ASSERT(data->concurrent || is_in_heap_region(pointer),
+                   "heap data struct inconsistency");
             if (ptr_addr >= chunk_start && ptr_addr < chunk_end) {
                 LOG(3, "\t("PFX" points to middle "PFX" of its own chunk "PFX"-"PFX")\n",
                     ptr_addr, pointer, chunk_start, chunk_end);
@@ -959,7 +1627,6 @@ check_reachability_pointer(byte *pointer, byte *ptr_addr, byte *defined_end,
                  */
                 LOG(3, "\t("PFX" points to mid-chunk "PFX" in "PFX"-"PFX")\n",
                     ptr_addr, pointer, chunk_start, chunk_end);
-                flags = malloc_get_client_flags(chunk_start);
                 if (is_midchunk_pointer_legitimate(pointer, chunk_start, chunk_end)) {
                     /* We could split these out as "probably reachable" but that would
                      * require a new chunk queue and flags and extra logic for
@@ -1010,29 +1677,285 @@ check_reachability_pointer(byte *pointer, byte *ptr_addr, byte *defined_end,
              * the secondary scan
              */
         } else {
-            mark_indirect(data, ptr_addr, pointer, chunk_start, chunk_end, flags, node);
+            mark_indirect(data, ptr_addr, pointer, chunk_start, chunk_end, flags, chunk);
+        }
+    }
+    if ((add_reachable || add_maybe_reachable) && data->parallel) {
+        /* Another scanner may have claimed the chunk since we read its flags */
+        dr_mutex_lock(scan_lock);
+        claim_locked = true;
+        flags = chunk->flags;
+        if (add_reachable)
+            add_reachable = !TEST(MALLOC_REACHABLE, flags);
+        else {
+            add_maybe_reachable =
+                !TESTANY(MALLOC_MAYBE_REACHABLE | MALLOC_REACHABLE |
+                         MALLOC_INDIRECTLY_REACHABLE, flags);
         }
     }
     if (add_reachable || add_maybe_reachable) {
         /* Mark chunk as reachable using the client flag and add to
-         * the queue of chunks to scan for further pointers.
+         * the chunks to scan for further pointers.
          */
-        pc_entry_t *add;
         IF_DEBUG(bool found =)
             malloc_set_client_flag(chunk_start,
                                    add_reachable ? MALLOC_REACHABLE :
                                    MALLOC_MAYBE_REACHABLE);
-        ASSERT(found, "malloc chunk must be in hashtable");
+        /* A concurrent scan can race with the app freeing the chunk */
+        ASSERT(found || data->concurrent, "malloc chunk must be in hashtable");
+        chunk->flags |= add_reachable ? MALLOC_REACHABLE : MALLOC_MAYBE_REACHABLE;
         ASSERT(!add_reachable || data->primary_scan, "only add reachable in primary");
-        /* Add to queue of chunks to scan */
-        add = (pc_entry_t *) global_alloc(sizeof(*add), HEAPSTAT_MISC);
-        add->start = chunk_start;
-        add->end = chunk_end;
-        add->next = NULL;
-        queue_add(add_reachable ? &data->reachq_head : &data->midreachq_head,
-                  add_reachable ? &data->reachq_tail : &data->midreachq_tail,
-                  add);
+        /* Add to the chunks to scan */
+        if (add_reachable)
+            reach_stack_push(data, chunk);
+        else {
+            pc_entry_t *add = (pc_entry_t *) global_alloc(sizeof(*add), HEAPSTAT_MISC);
+            add->start = chunk_start;
+            add->end = chunk_end;
+            add->next = NULL;
+            queue_add(&data->midreachq_head, &data->midreachq_tail, add);
+        }
+    }
+    if (claim_locked)
+        dr_mutex_unlock(scan_lock);
+}
+
+#ifdef WINDOWS
+static void
+check_decoded_value(byte *pointer, byte *decoded, byte *ptr_addr, byte *defined_end,
+                    reachability_data_t *data)
+{
+    LOG(3, "\t("PFX" when decoded is "PFX" so checking both)\n", pointer, decoded);
+    STATS_INC(encoded_pointers_scanned);
+    check_reachability_value(decoded, ptr_addr, defined_end, data);
+}
+#endif
+
+static void
+check_reachability_pointer(byte *pointer, byte *ptr_addr, byte *defined_end,
+                           reachability_data_t *data)
+{
+#ifdef WINDOWS
+    if (op_check_encoded_pointers && pointer != NULL) {
+        /* We check both encoded and decoded b/c xor could collide w/ heap addr.
+         * The table only holds what we could not decode arithmetically and
+         * is usually empty.
+         */
+        byte *decoded = (encoded_ptr_table.entries == 0) ? NULL :
+            get_decoded_ptr(pointer);
+        if (decoded != NULL) {
+            ASSERT(get_decoded_ptr(decoded) == NULL, "encoded table can't have reverse");
+            check_decoded_value(pointer, decoded, ptr_addr, defined_end, data);
+        }
+# ifdef X64
+        else {
+            if (decode_proc_ptrs) {
+                decoded = ptr_decode(&encoding_proc, pointer);
+                if (scan_word_is_candidate(decoded, data->chunks_start, data->chunks_end))
+                    check_decoded_value(pointer, decoded, ptr_addr, defined_end, data);
+            }
+            if (decode_sys_ptrs) {
+                decoded = ptr_decode(&encoding_sys, pointer);
+                if (scan_word_is_candidate(decoded, data->chunks_start, data->chunks_end))
+                    check_decoded_value(pointer, decoded, ptr_addr, defined_end, data);
+            }
+        }
+# endif
+    }
+#endif
+    check_reachability_value(pointer, ptr_addr, defined_end, data);
+}
+
+#ifdef LINUX
+/* Returns whether page may have been written since the soft-dirty bits were
+ * last reset.  We treat a failure to read the bit as dirty.
+ */
+static bool
+page_is_soft_dirty(reachability_data_t *data, page_track_t *track, byte *page)
+{
+    if (track->pagemap_count == 0 || page < track->pagemap_base ||
+        page >= track->pagemap_base + track->pagemap_count*PAGE_SIZE) {
+        ssize_t got = 0;
+        track->pagemap_count = 0;
+        /* The helpers share the file position */
+        if (data->parallel)
+            dr_mutex_lock(scan_lock);
+        if (dr_file_seek(data->pagemap,
+                         (int64)((ptr_uint_t)page / PAGE_SIZE) * sizeof(uint64),
+                         DR_SEEK_SET)) {
+            got = dr_read_file(data->pagemap, track->pagemap_buf,
+                               sizeof(track->pagemap_buf));
+        }
+        if (data->parallel)
+            dr_mutex_unlock(scan_lock);
+        if (got < (ssize_t)sizeof(uint64))
+            return true;
+        track->pagemap_base = page;
+        track->pagemap_count = (uint)(got / sizeof(uint64));
+    }
+    return TEST(PAGEMAP_SOFT_DIRTY,
+                track->pagemap_buf[(page - track->pagemap_base) / PAGE_SIZE]);
+}
+
+static void
+page_track_flush(reachability_data_t *data, page_track_t *track)
+{
+    if (track->run_end > track->run_start) {
+        IF_DEBUG(rb_node_t *node;)
+        if (data->parallel)
+            dr_mutex_lock(scan_lock);
+        IF_DEBUG(node =)
+            rb_insert(data->new_clean_tree, track->run_start,
+                      track->run_end - track->run_start, NULL);
+        if (data->parallel)
+            dr_mutex_unlock(scan_lock);
+        ASSERT(node == NULL, "clean page runs should not overlap");
+    }
+    track->run_start = NULL;
+    track->run_end = NULL;
+}
+
+static void
+page_track_add_clean(reachability_data_t *data, page_track_t *track, byte *page)
+{
+    if (track->run_start == NULL || track->run_end != page) {
+        page_track_flush(data, track);
+        track->run_start = page;
+    }
+    track->run_end = page + PAGE_SIZE;
+}
+
+static void
+page_track_finish_page(reachability_data_t *data, page_track_t *track)
+{
+    if (track->page != NULL && !track->candidate)
+        page_track_add_clean(data, track, track->page);
+    track->page = NULL;
+}
+
+/* For the dirty-page rescan of -leak_scan_concurrent: a word inside a chunk
+ * that has not been found reachable is only scanned if the chunk is later
+ * reached, so we skip it here.  Words in new or freed chunks and elsewhere
+ * in the heap are scanned as roots.
+ */
+static inline bool
+scan_word_in_unreached_chunk(reachability_data_t *data, byte *addr)
+{
+    chunk_entry_t *chunk = chunk_table_lookup(data, addr);
+    return (chunk != NULL && !chunk->stale && !TEST(MALLOC_REACHABLE, chunk->flags));
+}
+#endif
+
+static void
+ro_cache_add(ro_cache_t *cache, byte *addr, byte *value)
+{
+    if (cache->num == cache->capacity) {
+        size_t new_cap = (cache->capacity == 0) ? RO_CACHE_INITIAL_CANDIDATES :
+            cache->capacity * 2;
+        ro_candidate_t *grown = (ro_candidate_t *)
+            global_alloc(new_cap * sizeof(*grown), HEAPSTAT_MISC);
+        if (cache->cands != NULL) {
+            memcpy(grown, cache->cands, cache->num * sizeof(*grown));
+            global_free(cache->cands, cache->capacity * sizeof(*cache->cands),
+                        HEAPSTAT_MISC);
+        }
+        cache->cands = grown;
+        cache->capacity = new_cap;
+    }
+    cache->cands[cache->num].addr = addr;
+    cache->cands[cache->num].value = value;
+    cache->num++;
+}
+
+/* Walks the defined words of [start, end) and records those that might point
+ * into the heap.  We record against a span as wide again as the heap's on
+ * either side so that the entry survives some heap growth.
+ */
+static ro_cache_t *
+ro_cache_build(reachability_data_t *data, byte *start, byte *end)
+{
+    ro_cache_t *cache = (ro_cache_t *) global_alloc(sizeof(*cache), HEAPSTAT_MISC);
+    size_t span = data->chunks_end - data->chunks_start;
+    byte *pc, *defined_end;
+#ifdef UNIX
+    void *block_buf[SCAN_BLOCK_WORDS];
+#else
+    void **block_buf = NULL;
+#endif
+    memset(cache, 0, sizeof(*cache));
+    cache->span_start = ((ptr_uint_t)data->chunks_start < span) ? NULL :
+        data->chunks_start - span;
+    cache->span_end = (data->chunks_end + span < data->chunks_end) ?
+        (byte *) POINTER_MAX : data->chunks_end + span;
+    pc = start;
+    while (pc < end) {
+        if (op_have_defined_info) {
+            pc = cb_next_defined_ptrsz(pc, end);
+            if (pc == NULL)
+                break;
+            defined_end = cb_end_of_defined_region(pc, end);
+        } else
+            defined_end = end;
+        pc = (byte *) ALIGN_FORWARD(pc, sizeof(void*));
+        while (pc + sizeof(void*) <= defined_end) {
+            size_t i, num_words = (defined_end - pc) / sizeof(void*);
+            void **words;
+            if (num_words > SCAN_BLOCK_WORDS)
+                num_words = SCAN_BLOCK_WORDS;
+            words = scan_block_read(pc, num_words, block_buf);
+            for (i = 0; i < num_words; i++) {
+                void *word;
+                if (words != NULL)
+                    word = words[i];
+                else if (!leak_safe_read_heap(pc + i*sizeof(void*), &word))
+                    continue;
+                if (scan_word_is_candidate(word, cache->span_start, cache->span_end))
+                    ro_cache_add(cache, pc + i*sizeof(void*), (byte *) word);
+            }
+            pc += num_words * sizeof(void*);
+        }
+        pc = (byte *) ALIGN_FORWARD(defined_end, sizeof(void*));
+    }
+    LOG(2, "cached "SZFMT" leak scan roots for read-only "PFX"-"PFX"\n",
+        cache->num, start, end);
+    return cache;
+}
+
+/* Scans the read-only [start, end) through its cached candidate words,
+ * first recording them if we have no usable entry.
+ */
+static void
+scan_read_only_region(reachability_data_t *data, byte *start, byte *end)
+{
+    rb_node_t *node;
+    ro_cache_t *cache = NULL;
+    size_t i;
+    dr_mutex_lock(ro_cache_lock);
+    node = rb_find(ro_cache_tree, start);
+    if (node != NULL) {
+        byte *base;
+        size_t size;
+        rb_node_fields(node, &base, &size, (void **) &cache);
+        if (base + size != end ||
+            data->chunks_start < cache->span_start || data->chunks_end > cache->span_end)
+            cache = NULL;
+    }
+    if (cache == NULL) {
+        /* Drop what overlaps, including entries from a differently split scan */
+        while ((node = rb_overlaps_node(ro_cache_tree, start, end - 1)) != NULL)
+            rb_delete(ro_cache_tree, node);
+        cache = ro_cache_build(data, start, end);
+        rb_insert(ro_cache_tree, start, end - start, cache);
+    } else
+        STATS_INC(scan_ro_regions_reused);
+    for (i = 0; i < cache->num; i++) {
+        if (scan_word_is_candidate(cache->cands[i].value, data->chunks_start,
+                                   data->chunks_end)) {
+            check_reachability_pointer(cache->cands[i].value, cache->cands[i].addr,
+                                       end, data);
+        }
     }
+    dr_mutex_unlock(ro_cache_lock);
 }
 
 static void
@@ -1043,9 +1966,27 @@ check_reachability_helper(byte *start, byte *end, bool skip_heap,
     dr_mem_info_t info;
 #ifdef WINDOWS
     MEMORY_BASIC_INFORMATION mbi = {0};
+#endif
+#ifdef UNIX
+    void *block_buf[SCAN_BLOCK_WORDS];
+#else
+    void **block_buf = NULL;
+#endif
+#ifdef LINUX
+    /* We only track root pages for -leak_scan_incremental */
+    page_track_t track;
+    bool tracking, dirty_only;
 #endif
     ASSERT(data != NULL, "invalid args");
     LOG(4, "\nchecking reachability of "PFX"-"PFX"\n", start, end);
+#ifdef LINUX
+    tracking = data->incremental && skip_heap;
+    dirty_only = data->rescan_dirty;
+    track.page = NULL;
+    track.run_start = NULL;
+    track.run_end = NULL;
+    track.pagemap_count = 0;
+#endif
     pc = start;
     while (pc < end) {
         /* Skip free and unreadable regions (once we have PR 406328 unreadable
@@ -1058,7 +1999,7 @@ check_reachability_helper(byte *start, byte *end, bool skip_heap,
                 /* query on Windows expected to fail on kernel memory */
                 ASSERT(IF_WINDOWS_ELSE(info.type == DR_MEMTYPE_ERROR_WINKERNEL, false),
                        "dr_query_memory_ex failed");
-                return;
+                break;
             }
 #ifdef WINDOWS
             /* We need to avoid touching guard pages on Windows
@@ -1095,8 +2036,10 @@ check_reachability_helper(byte *start, byte *end, bool skip_heap,
                   /* Windows-only b/c it's a pain to identify non-image maps on Linux */
                   IF_WINDOWS(|| mbi.Type == MEM_MAPPED))) ||
 #ifdef WINDOWS
-                /* skip private heap: here we assume it's a single segment */
-                (pc == (byte *) get_private_heap_handle()) ||
+                /* skip private heap: here we assume it's a single segment.
+                 * We compare the base as a parallel scan starts mid-region.
+                 */
+                (info.base_pc == (byte *) get_private_heap_handle()) ||
 #endif
 #ifdef LINUX
                 /* i#1778: skip vvar page to avoid kernel soft lockups.
@@ -1121,6 +2064,48 @@ check_reachability_helper(byte *start, byte *end, bool skip_heap,
             }
         }
         iter_end = (query_end < end) ? query_end : end;
+        if (ro_cache_tree != NULL && data->chunk_filter && data->num_chunks > 0 &&
+            !TEST(DR_MEMPROT_WRITE, info.prot) && (pc == info.base_pc || pc == start)
+            IF_LINUX(&& !tracking && !dirty_only)) {
+            /* Nothing can change a read-only region's words while it stays
+             * mapped and read-only.
+             */
+            scan_read_only_region(data, pc, iter_end);
+            pc = iter_end;
+            continue;
+        }
+#ifdef LINUX
+        if (tracking || dirty_only) {
+            /* We go a page at a time so we can skip a clean page or record
+             * one for the next scan.
+             */
+            byte *page = (byte *) ALIGN_BACKWARD(pc, PAGE_SIZE);
+            if (page + PAGE_SIZE < pc) /* overflow */
+                break;
+            if (page != track.page) {
+                if (tracking)
+                    page_track_finish_page(data, &track);
+                if (dirty_only && !page_is_soft_dirty(data, &track, page)) {
+                    /* Unwritten since the pre-scan reset: already scanned */
+                    track.page = NULL;
+                    pc = page + PAGE_SIZE;
+                    continue;
+                }
+                if (data->reuse_clean_pages &&
+                    rb_in_node(clean_page_tree, page) != NULL &&
+                    !page_is_soft_dirty(data, &track, page)) {
+                    STATS_INC(scan_pages_reused);
+                    page_track_add_clean(data, &track, page);
+                    pc = page + PAGE_SIZE;
+                    continue;
+                }
+                track.page = page;
+                track.candidate = false;
+            }
+            if (page + PAGE_SIZE < iter_end)
+                iter_end = page + PAGE_SIZE;
+        }
+#endif
         if (!op_have_defined_info) {
             /* scan everything except beyond TOS which we assume a query
              * boundary will intersect
@@ -1146,37 +2131,95 @@ check_reachability_helper(byte *start, byte *end, bool skip_heap,
         }
         LOG(3, "defined range "PFX"-"PFX"\n", pc, defined_end);
 
-        for (pc = (byte *)ALIGN_FORWARD(pc, sizeof(void*));
-             pc < defined_end && pc + sizeof(void*) <= defined_end; pc += sizeof(void*)) {
-            if (skip_heap) {
-                /* Skip heap regions */
-                if (heap_region_bounds(pc, NULL, &chunk_end, NULL) &&
-                    chunk_end != NULL) {
-                    pc = chunk_end - sizeof(void*); /* let loop inc bump pc */
-                    ASSERT(ALIGNED(pc, sizeof(void*)), "heap region end not aligned!");
+        pc = (byte *)ALIGN_FORWARD(pc, sizeof(void*));
+        while (pc < defined_end && pc + sizeof(void*) <= defined_end) {
+            size_t num_words = (defined_end - pc) / sizeof(void*);
+            byte *block_end;
+            if (num_words > SCAN_BLOCK_WORDS)
+                num_words = SCAN_BLOCK_WORDS;
+            block_end = pc + num_words * sizeof(void*);
+            /* Test a whole block of words against the chunk bounds at once,
+             * which most blocks of non-pointer data fail.  A block overlapping
+             * the heap when we are skipping it takes the per-word path.
+             */
+            if (data->chunk_filter &&
+                (!skip_heap || !is_any_in_heap_region(pc, block_end))) {
+                void **words = scan_block_read(pc, num_words, block_buf);
+                if (words != NULL) {
+                    if (scan_block_has_candidate(words, num_words, data->filter_start,
+                                                 data->filter_end)
+                        IF_WINDOWS(|| scan_block_has_encoded_candidate
+                                   (words, num_words, data->filter_start,
+                                    data->filter_end))) {
+                        size_t i;
+#ifdef LINUX
+                        if (tracking)
+                            track.candidate = true;
+#endif
+                        for (i = 0; i < num_words; i++) {
+#ifdef LINUX
+                            if (dirty_only &&
+                                scan_word_in_unreached_chunk(data,
+                                                             pc + i*sizeof(void*)))
+                                continue;
+#endif
+                            if (scan_word_is_candidate(words[i], data->chunks_start,
+                                                       data->chunks_end)
+                                IF_WINDOWS(|| scan_block_has_encoded_candidate
+                                           (&words[i], 1, data->chunks_start,
+                                            data->chunks_end))) {
+                                check_reachability_pointer((byte *) words[i],
+                                                           pc + i*sizeof(void*),
+                                                           defined_end, data);
+                            }
+                        }
+                    } else
+                        STATS_INC(scan_blocks_filtered);
+                    pc = block_end;
                     continue;
                 }
             }
-            /* Now pc points to an aligned and defined (non-heap) ptrsz bytes */
-            /* XXX PR 475518: improve performance of all these reads and table
-             * lookups: this scan is where the noticeable pause at exit comes
-             * from, not the identification of defined regions.
-             */
+#ifdef LINUX
+            if (tracking)
+                track.candidate = true;
+#endif
+            for (; pc < block_end; pc += sizeof(void*)) {
+                if (skip_heap) {
+                    /* Skip heap regions */
+                    if (heap_region_bounds(pc, NULL, &chunk_end, NULL) &&
+                        chunk_end != NULL) {
+                        pc = chunk_end - sizeof(void*); /* let loop inc bump pc */
+                        ASSERT(ALIGNED(pc, sizeof(void*)), "heap region end not aligned!");
+                        continue;
+                    }
+                }
+#ifdef LINUX
+                if (dirty_only && scan_word_in_unreached_chunk(data, pc))
+                    continue;
+#endif
+                /* Now pc points to an aligned and defined (non-heap) ptrsz bytes */
 #ifdef UNIX
-            /* i#1773: we could hit a bus error even on a readable page.  Also
-             * on some UNIX platforms like VMX86_SERVER we do not have a
-             * reliable memory query.
-             */
-            if (leak_safe_read_heap(pc, (void **)&pointer))
-                check_reachability_pointer(pointer, pc, defined_end, data);
+                /* i#1773: we could hit a bus error even on a readable page.  Also
+                 * on some UNIX platforms like VMX86_SERVER we do not have a
+                 * reliable memory query.
+                 */
+                if (leak_safe_read_heap(pc, (void **)&pointer))
+                    check_reachability_pointer(pointer, pc, defined_end, data);
 #else
-            /* Threads are suspended and we checked readability so safe to deref */
-            pointer = *((app_pc*)pc);
-            check_reachability_pointer(pointer, pc, defined_end, data);
+                /* Threads are suspended and we checked readability so safe to deref */
+                pointer = *((app_pc*)pc);
+                check_reachability_pointer(pointer, pc, defined_end, data);
 #endif
+            }
         }
         pc = (byte *) ALIGN_FORWARD(defined_end, sizeof(void*));
     }
+#ifdef LINUX
+    if (tracking) {
+        page_track_finish_page(data, &track);
+        page_track_flush(data, &track);
+    }
+#endif
 }
 
 static void
@@ -1212,6 +2255,265 @@ check_reachability_regs(void *drcontext, dr_mcontext_t *mc, reachability_data_t
     }
 }
 
+/* Pulls root pieces and reachable chunks off the shared queues until both are
+ * empty and no other scanner is still working on something that could add to
+ * them.
+ */
+static void
+scan_drain_queues(reachability_data_t *data)
+{
+    pc_entry_t *e;
+    chunk_entry_t *chunk;
+    while (true) {
+        dr_mutex_lock(scan_lock);
+        e = queue_remove_head(&data->rootq_head, &data->rootq_tail);
+        chunk = (e == NULL) ? reach_stack_pop(data) : NULL;
+        if (e != NULL || chunk != NULL)
+            data->scanners_busy++;
+        else if (data->roots_queued && data->scanners_busy == 0) {
+            dr_mutex_unlock(scan_lock);
+            break;
+        }
+        dr_mutex_unlock(scan_lock);
+        if (e != NULL) {
+            check_reachability_helper(e->start, e->end, true/*skip heap*/, data);
+            global_free(e, sizeof(*e), HEAPSTAT_MISC);
+        } else if (chunk != NULL)
+            check_reachability_helper(chunk->start, chunk->end, false, data);
+        else {
+            /* Another scanner may yet find more reachable chunks */
+            dr_thread_yield();
+            continue;
+        }
+        dr_mutex_lock(scan_lock);
+        data->scanners_busy--;
+        dr_mutex_unlock(scan_lock);
+    }
+}
+
+static void
+leak_scan_helper_thread(void *arg)
+{
+    /* We must keep running during the scan's suspend-all.  We only read app
+     * memory and use the malloc table's own locks.
+     */
+    dr_client_thread_set_suspendable(false);
+    LOG(1, "leak scan helper thread "TIDFMT" running\n",
+        dr_get_thread_id(dr_get_current_drcontext()));
+    while (!scan_helpers_exit) {
+        reachability_data_t *data = NULL;
+        if (scan_shared != NULL) {
+            dr_mutex_lock(scan_lock);
+            data = scan_shared;
+            if (data != NULL)
+                scan_helpers_joined++;
+            dr_mutex_unlock(scan_lock);
+        }
+        if (data != NULL) {
+            scan_drain_queues(data);
+            dr_mutex_lock(scan_lock);
+            scan_helpers_joined--;
+            dr_mutex_unlock(scan_lock);
+        }
+        dr_sleep(SCAN_HELPER_POLL_MS);
+    }
+}
+
+/* Queues every readable region in pieces of at most SCAN_ROOT_PIECE_SIZE.
+ * check_reachability_helper() applies the finer-grained region filtering.
+ */
+static void
+scan_queue_roots(reachability_data_t *data)
+{
+    byte *pc = NULL, *start, *piece_end, *region_end;
+    dr_mem_info_t info;
+    pc_entry_t *add;
+    uint pieces = 0;
+    while (dr_query_memory_ex(pc, &info)) {
+        region_end = info.base_pc + info.size;
+        if (region_end <= pc) /* overflow */
+            region_end = (byte *) POINTER_MAX;
+        if (TEST(DR_MEMPROT_READ, info.prot)) {
+            for (start = pc; start < region_end; start = piece_end) {
+                piece_end = ((size_t)(region_end - start) > SCAN_ROOT_PIECE_SIZE) ?
+                    start + SCAN_ROOT_PIECE_SIZE : region_end;
+                /* A scanner may take and free this as soon as it is queued */
+                add = (pc_entry_t *) global_alloc(sizeof(*add), HEAPSTAT_MISC);
+                add->start = start;
+                add->end = piece_end;
+                add->next = NULL;
+                dr_mutex_lock(scan_lock);
+                queue_add(&data->rootq_head, &data->rootq_tail, add);
+                dr_mutex_unlock(scan_lock);
+                pieces++;
+            }
+        }
+        if (region_end == (byte *) POINTER_MAX)
+            break;
+        pc = region_end;
+    }
+    dr_mutex_lock(scan_lock);
+    data->roots_queued = true;
+    dr_mutex_unlock(scan_lock);
+    LOG(2, "queued %u root pieces for parallel scan\n", pieces);
+}
+
+#ifdef LINUX
+static void
+leak_scan_incremental_start(reachability_data_t *data)
+{
+    data->pagemap = dr_open_file("/proc/self/pagemap", DR_FILE_READ);
+    if (data->pagemap == INVALID_FILE) {
+        LOG(1, "WARNING: unable to open pagemap: scanning all memory\n");
+        return;
+    }
+    data->incremental = true;
+    data->new_clean_tree = rb_tree_create(NULL);
+    if (clean_page_tree != NULL &&
+        data->chunks_start >= clean_span_start && data->chunks_end <= clean_span_end) {
+        data->reuse_clean_pages = true;
+        /* We test against the prior span so that what we record for the
+         * next scan holds for the pages we skip as well as those we scan.
+         */
+        data->filter_start = clean_span_start;
+        data->filter_end = clean_span_end;
+    }
+    LOG(2, "incremental leak scan %s pages clean since the prior scan\n",
+        data->reuse_clean_pages ? "skipping" : "not skipping");
+}
+
+static void
+leak_scan_incremental_finish(reachability_data_t *data)
+{
+    file_t f;
+    bool reset = false;
+    dr_close_file(data->pagemap);
+    if (clean_page_tree != NULL)
+        rb_tree_destroy(clean_page_tree);
+    clean_page_tree = data->new_clean_tree;
+    data->new_clean_tree = NULL;
+    clean_span_start = data->filter_start;
+    clean_span_end = data->filter_end;
+    /* The app is still suspended, so any write to a page we just scanned
+     * will show up in the next scan.
+     */
+    f = dr_open_file("/proc/self/clear_refs", DR_FILE_WRITE_OVERWRITE);
+    if (f != INVALID_FILE) {
+        reset = (dr_write_file(f, "4", 1) == 1);
+        dr_close_file(f);
+    }
+    if (!reset) {
+        /* Likely a kernel without soft-dirty support */
+        LOG(1, "WARNING: unable to reset soft-dirty bits: not reusing scan\n");
+        rb_tree_destroy(clean_page_tree);
+        clean_page_tree = NULL;
+    }
+}
+
+/* Resets the soft-dirty bits while the app is suspended, so that the final
+ * pause of a -leak_scan_concurrent scan can find every page written while
+ * the primary scan ran.  Returns false if that is not possible.
+ */
+static bool
+leak_scan_concurrent_start(reachability_data_t *data)
+{
+    file_t f;
+    bool reset = false;
+    data->pagemap = dr_open_file("/proc/self/pagemap", DR_FILE_READ);
+    if (data->pagemap == INVALID_FILE) {
+        LOG(1, "WARNING: unable to open pagemap: not scanning concurrently\n");
+        return false;
+    }
+    f = dr_open_file("/proc/self/clear_refs", DR_FILE_WRITE_OVERWRITE);
+    if (f != INVALID_FILE) {
+        reset = (dr_write_file(f, "4", 1) == 1);
+        dr_close_file(f);
+    }
+    if (!reset) {
+        /* Likely a kernel without soft-dirty support */
+        LOG(1, "WARNING: unable to reset soft-dirty bits: not scanning concurrently\n");
+        dr_close_file(data->pagemap);
+        data->pagemap = INVALID_FILE;
+        return false;
+    }
+    data->concurrent = true;
+    return true;
+}
+
+/* Brings the chunk table up to date after the app ran during the primary
+ * scan.  A chunk that was freed is marked stale.  A chunk at the same bounds
+ * that lost its flag was freed and reallocated: as a pointer to it that we
+ * already found may sit on a page that was not written since, we keep it
+ * reachable, but its new contents must be scanned again.
+ */
+static void
+leak_scan_concurrent_resync(reachability_data_t *data)
+{
+    size_t i;
+    uint flags;
+    uint num_stale = 0, num_requeued = 0;
+    for (i = 0; i < data->num_chunks; i++) {
+        chunk_entry_t *chunk = &data->chunks[i];
+        if (malloc_end(chunk->start) != chunk->end) {
+            chunk->stale = true;
+            num_stale++;
+            continue;
+        }
+        flags = malloc_get_client_flags(chunk->start);
+        if (TEST(MALLOC_REACHABLE, chunk->flags) && !TEST(MALLOC_REACHABLE, flags)) {
+            malloc_set_client_flag(chunk->start, MALLOC_REACHABLE);
+            reach_stack_push(data, chunk);
+            num_requeued++;
+        } else if (TEST(MALLOC_MAYBE_REACHABLE, chunk->flags) &&
+                   !TEST(MALLOC_MAYBE_REACHABLE, flags))
+            malloc_set_client_flag(chunk->start, MALLOC_MAYBE_REACHABLE);
+    }
+    LOG(2, "concurrent leak scan: %u chunks freed and %u reallocated while running\n",
+        num_stale, num_requeued);
+}
+#endif
+
+/* The primary scan of roots and then of reachable chunks, split across the
+ * -leak_scan_threads helpers and the current thread.
+ */
+static void
+scan_primary_parallel(reachability_data_t *data)
+{
+    ASSERT(data->primary_scan, "only the primary scan is parallel");
+    data->parallel = true;
+    dr_mutex_lock(scan_lock);
+    scan_shared = data;
+    dr_mutex_unlock(scan_lock);
+    scan_queue_roots(data);
+    scan_drain_queues(data);
+    dr_mutex_lock(scan_lock);
+    scan_shared = NULL;
+    dr_mutex_unlock(scan_lock);
+    /* Wait for helpers that have not yet noticed the queues are drained */
+    while (scan_helpers_joined > 0)
+        dr_thread_yield();
+    data->parallel = false;
+    ASSERT(data->rootq_head == NULL && data->reach_stack == NULL,
+           "parallel scan queues not drained");
+}
+
+/* Returns the table entry for a chunk that is still the one the scan started
+ * with, or NULL for a chunk allocated during a -leak_scan_concurrent primary
+ * scan, which is too new to be considered.
+ */
+static chunk_entry_t *
+chunk_in_scan(reachability_data_t *data, malloc_info_t *info)
+{
+    chunk_entry_t *chunk = chunk_table_find(data, info->base);
+    if (data->concurrent) {
+        if (chunk != NULL &&
+            (chunk->stale || chunk->end != info->base + info->request_size))
+            chunk = NULL;
+    } else
+        ASSERT(chunk != NULL, "must be in chunk table");
+    return chunk;
+}
+
 static bool
 malloc_iterate_identify_indirect_cb(malloc_info_t *info, void *iter_data)
 {
@@ -1219,7 +2521,8 @@ malloc_iterate_identify_indirect_cb(malloc_info_t *info, void *iter_data)
     ASSERT(data != NULL, "invalid iteration data");
     ASSERT(info->base != NULL, "invalid params");
     if (!TESTANY(MALLOC_IGNORE_LEAK | MALLOC_REACHABLE | MALLOC_MAYBE_REACHABLE,
-                 info->client_flags)) {
+                 info->client_flags) &&
+        chunk_in_scan(data, info) != NULL) {
         check_reachability_helper(info->base, info->base + info->request_size,
                                   false, (void *)data);
     }
@@ -1230,6 +2533,7 @@ static bool
 malloc_iterate_cb(malloc_info_t *info, void *iter_data)
 {
     reachability_data_t *data = (reachability_data_t *) iter_data;
+    chunk_entry_t *chunk;
     ASSERT(data != NULL, "invalid iteration data");
     ASSERT(info->base != NULL, "invalid params");
     LOG(4, "malloc iter: "PFX"-"PFX"%s%s%s%s%s\n", info->base,
@@ -1245,11 +2549,9 @@ malloc_iterate_cb(malloc_info_t *info, void *iter_data)
      */
     if (!TESTANY(MALLOC_IGNORE_LEAK | MALLOC_INDIRECTLY_REACHABLE, info->client_flags) &&
         /* for 2nd pass only report reachable */
-        (!data->last_of_2_iters || TEST(MALLOC_REACHABLE, info->client_flags))) {
-        rb_node_t *node = rb_find(data->alloc_tree, info->base);
-        unreach_entry_t *unreach;
-        ASSERT(node != NULL, "must be in rbtree");
-        rb_node_fields(node, NULL, NULL, (void *)&unreach);
+        (!data->last_of_2_iters || TEST(MALLOC_REACHABLE, info->client_flags)) &&
+        (chunk = chunk_in_scan(data, info)) != NULL) {
+        unreach_entry_t *unreach = chunk->unreach;
         client_found_leak(info->base, info->base + info->request_size,
                           (unreach == NULL) ? 0 : unreach->indirect_bytes,
                           info->pre_us,
@@ -1268,21 +2570,43 @@ malloc_iterate_cb(malloc_info_t *info, void *iter_data)
 }
 
 static bool
-malloc_iterate_build_tree_cb(malloc_info_t *info, void *iter_data)
-{
-    rb_tree_t *alloc_tree = (rb_tree_t *) iter_data;
-    IF_DEBUG(rb_node_t *node;)
-    ASSERT(alloc_tree != NULL, "invalid iteration data");
-    /* We use NULL for client b/c we only need unreach_entry_t for the
-     * leaks, a small fraction (for most apps!) of the total and thus
-     * best allocated lazily
+malloc_iterate_pending_cb(malloc_info_t *info, void *iter_data)
+{
+    hashtable_t *pending = (hashtable_t *) iter_data;
+    /* This matches the malloc_iterate_cb() filter, except that reachable
+     * chunks are only worth preparing if they will be shown.
      */
-    IF_DEBUG(node = )
-        rb_insert(alloc_tree, info->base, info->request_size, NULL);
-    ASSERT(node == NULL, "mallocs should not overlap");
+    if (info->client_data != NULL &&
+        !TESTANY(MALLOC_IGNORE_LEAK | MALLOC_INDIRECTLY_REACHABLE, info->client_flags) &&
+        (op_show_reachable || !TEST(MALLOC_REACHABLE, info->client_flags)))
+        hashtable_add(pending, info->client_data, info->client_data);
     return true;
 }
 
+/* Hands the client the distinct client_data of every chunk we are about to
+ * report, so it can e.g. symbolize all of their callstacks at once.
+ */
+static void
+leak_report_prepare(void)
+{
+    hashtable_t pending;
+    uint i, num = 0;
+    hashtable_init(&pending, PENDING_TABLE_HASH_BITS, HASH_INTPTR, false/*!strdup*/);
+    malloc_iterate(malloc_iterate_pending_cb, &pending);
+    if (pending.entries > 0) {
+        size_t array_sz = pending.entries * sizeof(void *);
+        void **array = (void **) global_alloc(array_sz, HEAPSTAT_MISC);
+        for (i = 0; i < HASHTABLE_SIZE(pending.table_bits); i++) {
+            hash_entry_t *he;
+            for (he = pending.table[i]; he != NULL; he = he->next)
+                array[num++] = he->payload;
+        }
+        client_found_leaks_pending(array, num);
+        global_free(array, array_sz, HEAPSTAT_MISC);
+    }
+    hashtable_delete(&pending);
+}
+
 static void
 prepare_thread_for_scan(void *drcontext, bool *was_app_state OUT)
 {
@@ -1335,6 +2659,87 @@ restore_thread_after_scan(void *drcontext, bool was_app_state)
 #endif
 }
 
+/* Walks the registers of the suspended threads and of the current thread */
+static void
+scan_thread_registers(reachability_data_t *data, void **drcontexts, uint num_threads,
+                      void *my_drcontext)
+{
+    dr_mcontext_t mc; /* do not init whole thing: memset is expensive */
+    uint i;
+    mc.size = sizeof(mc);
+    mc.flags = DR_MC_CONTROL|DR_MC_INTEGER; /* don't need xmm */
+    /* We rely on mcontext field ordering here. */
+    for (i = 0; i < num_threads; i++) {
+        LOG(3, "\nwalking registers of thread "TIDFMT"\n",
+            dr_get_thread_id(drcontexts[i]));
+        dr_get_mcontext(drcontexts[i], &mc);
+        check_reachability_regs(drcontexts[i], &mc, data);
+    }
+    LOG(3, "\nwalking registers of thread "TIDFMT"\n", dr_get_thread_id(my_drcontext));
+    dr_get_mcontext(my_drcontext, &mc);
+    check_reachability_regs(my_drcontext, &mc, data);
+}
+
+/* Scans the chunks on the reachable-chunk stack, and those they reach */
+static void
+scan_reachable_stack(reachability_data_t *data)
+{
+    chunk_entry_t *chunk;
+    LOG(3, "\nwalking reachable-chunk stack\n");
+    while ((chunk = reach_stack_pop(data)) != NULL)
+        check_reachability_helper(chunk->start, chunk->end, false, data);
+}
+
+/* The primary scan of roots and then of the chunks they reach */
+static void
+scan_primary(reachability_data_t *data, bool at_exit)
+{
+    uint64 primary_start = dr_get_milliseconds();
+    if (!at_exit && op_scan_threads > 0) {
+        /* We keep the scan at exit serial as the helpers may no longer run,
+         * and an exiting helper that had joined would hang the scan.
+         */
+        LOG(3, "\nwalking roots and reachable-chunk stack in parallel\n");
+        scan_primary_parallel(data);
+    } else {
+        check_reachability_helper(NULL, (app_pc)POINTER_MAX, true/*skip heap*/, data);
+        scan_reachable_stack(data);
+    }
+    LOG(1, "primary leak scan took "UINT64_FORMAT_STRING" ms%s\n",
+        dr_get_milliseconds() - primary_start,
+        data->concurrent ? " while the app ran" : "");
+}
+
+#ifdef LINUX
+/* The final pause of a -leak_scan_concurrent scan: the other threads are
+ * suspended again and prepared.  Anything the app did while the primary
+ * scan ran is in a register or on a page it wrote, so we rescan those and
+ * then whatever they reach.
+ */
+static void
+leak_scan_concurrent_finish(reachability_data_t *data, void **drcontexts,
+                            uint num_threads, void *my_drcontext)
+{
+    uint64 finish_start = dr_get_milliseconds();
+    leak_scan_concurrent_resync(data);
+    /* A non-text run found while the app ran may have been overwritten */
+    data->nontext_start = NULL;
+    data->nontext_end = NULL;
+    /* The stacks have moved since the first pause */
+    rb_tree_destroy(data->stack_tree);
+    data->stack_tree = rb_tree_create(NULL);
+    scan_thread_registers(data, drcontexts, num_threads, my_drcontext);
+    LOG(3, "\nwalking pages written during the concurrent scan\n");
+    data->rescan_dirty = true;
+    check_reachability_helper(NULL, (app_pc)POINTER_MAX, false, data);
+    data->rescan_dirty = false;
+    scan_reachable_stack(data);
+    dr_close_file(data->pagemap);
+    LOG(1, "final pause of concurrent leak scan took "UINT64_FORMAT_STRING" ms\n",
+        dr_get_milliseconds() - finish_start);
+}
+#endif
+
 void
 leak_scan_for_leaks(bool at_exit)
 {
@@ -1342,12 +2747,15 @@ leak_scan_for_leaks(bool at_exit)
     void **drcontexts = NULL;
     bool *was_app_state = NULL;
     uint num_threads = 0, i;
-    dr_mcontext_t mc; /* do not init whole thing: memset is expensive */
     reachability_data_t data;
     void *my_drcontext = dr_get_current_drcontext();
     dr_mem_info_t mem_info;
+    uint64 prof_start;
 #ifdef DEBUG
     static bool called_at_exit;
+#endif
+    PROF_START(prof_start);
+#ifdef DEBUG
     if (at_exit) {
         /* we only clear the flags on nudges, so only 1 at_exit supported */
         ASSERT(!called_at_exit, "check_reachability only supports 1 call at_exit");
@@ -1355,8 +2763,6 @@ leak_scan_for_leaks(bool at_exit)
     }
 #endif
     LOG(1, "checking leaks via reachability analysis\n");
-    mc.size = sizeof(mc);
-    mc.flags = DR_MC_CONTROL|DR_MC_INTEGER; /* don't need xmm */
 
     /* XXX: no MacOS private loader yet */
     /* ARM is always in app state */
@@ -1402,7 +2808,6 @@ leak_scan_for_leaks(bool at_exit)
 
     memset(&data, 0, sizeof(data));
     data.primary_scan = true;
-    data.alloc_tree = rb_tree_create(NULL);
     data.stack_tree = rb_tree_create(NULL);
     /* get the lowest allocated memory */
     dr_query_memory_ex(NULL, &mem_info);
@@ -1411,36 +2816,73 @@ leak_scan_for_leaks(bool at_exit)
     else
         data.low_ptr = NULL;
 
-    /* Build tree for interval lookup for mid-chunk pointers (PR 476482).
-     * Since doing this just once, we could use an array, but tree may be
-     * useful later on.  I have measured the cost of having the malloc
-     * hashtable be an rbtree instead, avoiding this creation, but the extra
-     * overhead shows up on heap-intensive bmarks (PR 535568).
+    /* Build a sorted table for interval lookup for mid-chunk pointers
+     * (PR 476482).  Since doing this just once per scan, an array beats a
+     * tree on lookups, which happen for every candidate pointer.  I have
+     * measured the cost of having the malloc hashtable be an rbtree instead,
+     * avoiding this creation, but the extra overhead shows up on
+     * heap-intensive bmarks (PR 535568).
+     */
+    chunk_table_create(&data);
+    /* A word outside every chunk misses the table, so we can skip it.
+     * That is not true of encoded pointers in the table, while the block
+     * filter decodes those we can decode arithmetically.
      */
-    malloc_iterate(malloc_iterate_build_tree_cb, (void *) data.alloc_tree);
+    data.chunk_filter = IF_WINDOWS_ELSE(!op_check_encoded_pointers ||
+                                        encoded_ptr_table.entries == 0, true);
+    if (data.num_chunks > 0) {
+        data.chunks_start = data.chunks[0].start;
+        data.chunks_end = data.chunks[data.num_chunks - 1].end;
+    }
+    LOG(2, "chunks span "PFX"-"PFX"\n", data.chunks_start, data.chunks_end);
+    data.filter_start = data.chunks_start;
+    data.filter_end = data.chunks_end;
+#ifdef LINUX
+    if (!at_exit && options.leak_scan_incremental)
+        leak_scan_incremental_start(&data);
+#endif
 
     if (!at_exit || !op_have_defined_info) {
-        /* Walk the thread's registers.  We rely on mcontext field ordering here. */
-        for (i = 0; i < num_threads; i++) {
-            LOG(3, "\nwalking registers of thread "TIDFMT"\n",
-                dr_get_thread_id(drcontexts[i]));
-            dr_get_mcontext(drcontexts[i], &mc);
-            check_reachability_regs(drcontexts[i], &mc, &data);
-        }
-        LOG(3, "\nwalking registers of thread "TIDFMT"\n",
-            dr_get_thread_id(my_drcontext));
-        dr_get_mcontext(my_drcontext, &mc);
-        check_reachability_regs(my_drcontext, &mc, &data);
+        /* Walk the thread's registers */
+        scan_thread_registers(&data, drcontexts, num_threads, my_drcontext);
     }
 
-    check_reachability_helper(NULL, (app_pc)POINTER_MAX, true/*skip heap*/, &data);
-    LOG(3, "\nwalking reachable-chunk queue\n");
-    for (e = data.reachq_head; e != NULL; e = next_e) {
-        check_reachability_helper(e->start, e->end, false, &data);
-        next_e = e->next;
-        global_free(e, sizeof(*e), HEAPSTAT_MISC);
-    }
+#ifdef LINUX
+    if (!at_exit && options.leak_scan_concurrent && drcontexts != NULL &&
+        leak_scan_concurrent_start(&data)) {
+        /* Let the app run during the primary scan.  We stay in the state we
+         * prepared for ourselves.
+         */
+        bool my_was_app_state = was_app_state[num_threads];
+        IF_DEBUG(bool ok;)
+        for (i = 0; i < num_threads; i++)
+            restore_thread_after_scan(drcontexts[i], was_app_state[i]);
+        global_free(was_app_state, (num_threads+1)*sizeof(bool), HEAPSTAT_MISC);
+        IF_DEBUG(ok =)
+            dr_resume_all_other_threads(drcontexts, num_threads);
+        ASSERT(ok, "failed to resume for concurrent leak scan");
+        drcontexts = NULL;
+        num_threads = 0;
+
+        scan_primary(&data, at_exit);
+
+        if (!dr_suspend_all_other_threads(&drcontexts, &num_threads, NULL)) {
+            LOG(0, "WARNING: not all threads suspended for reachability analysis\n");
+            ASSERT(num_threads == 0, "param clobbered on failure");
+        }
+        was_app_state = (bool *) global_alloc((num_threads+1)*sizeof(bool), HEAPSTAT_MISC);
+        for (i = 0; i < num_threads; i++)
+            prepare_thread_for_scan(drcontexts[i], &was_app_state[i]);
+        was_app_state[num_threads] = my_was_app_state;
+        leak_scan_concurrent_finish(&data, drcontexts, num_threads, my_drcontext);
+    } else
+#endif
+        scan_primary(&data, at_exit);
     data.primary_scan = false;
+#ifdef LINUX
+    if (data.incremental)
+        leak_scan_incremental_finish(&data);
+#endif
 
     /* now split direct from indirect leaks, and perhaps find new maybe-reachable.
      * indirect trumps maybe-reachable, so do this walk first.
@@ -1451,9 +2893,13 @@ leak_scan_for_leaks(bool at_exit)
     /* split direct from indirect among maybe-reachable */
     LOG(3, "\nwalking maybe-reachable-chunk queue\n");
     for (e = data.midreachq_head; e != NULL; e = next_e) {
-        uint flags = malloc_get_client_flags(e->start);
-        if (TEST(MALLOC_REACHABLE, flags)) {
-            /* This was later marked as fully-reachable and added to reachq,
+        chunk_entry_t *chunk = chunk_table_find(&data, e->start);
+        uint flags = (chunk == NULL) ? 0 : chunk->flags;
+        ASSERT(chunk != NULL, "must be in chunk table");
+        if (chunk != NULL && chunk->stale) {
+            /* Freed during a concurrent scan */
+        } else if (TEST(MALLOC_REACHABLE, flags)) {
+            /* This was later marked as fully-reachable and pushed for scanning,
              * so ignore it here
              */
         } else if (TEST(MALLOC_INDIRECTLY_REACHABLE, flags)) {
@@ -1480,6 +2926,8 @@ leak_scan_for_leaks(bool at_exit)
 
     /* up to caller to call report_leak_stats_{checkpoint,revert} if desired */
 
+    leak_report_prepare();
+
     /* in order to separate reachable from real leaks we do two passes */
     if (op_show_reachable)
         data.first_of_2_iters = true;
@@ -1496,10 +2944,11 @@ leak_scan_for_leaks(bool at_exit)
         ASSERT(ok, "failed to resume after leak scan");
     }
 
-    /* We do not maintain the tree throughout execution: we make a new one for
+    /* We do not maintain the table throughout execution: we make a new one for
      * each reachability scan.
      */
-    rb_iterate(data.alloc_tree, rb_cleanup_entries, NULL);
-    rb_tree_destroy(data.alloc_tree);
+    reach_stack_destroy(&data);
+    chunk_table_destroy(&data);
     rb_tree_destroy(data.stack_tree);
+    PROF_STOP(my_drcontext, PROF_LEAK_SCAN, prof_start);
 }
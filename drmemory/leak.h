@@ -35,6 +35,11 @@ extern uint midchunk_postnew_ptrs;
 extern uint midchunk_postinheritance_ptrs;
 extern uint midchunk_string_ptrs;
 extern uint strings_not_pointers;
+extern uint scan_blocks_filtered;
+extern uint scan_ro_regions_reused;
+# ifdef LINUX
+extern uint scan_pages_reused;
+# endif
 # ifdef WINDOWS
 extern uint pointers_encoded;
 extern uint encoded_pointers_scanned;
@@ -50,6 +55,13 @@ client_found_leak(app_pc start, app_pc end, size_t indirect_bytes,
                   bool maybe_reachable, void *client_data,
                   bool count_reachable, bool show_reachable);
 
+/* Called before each batch of client_found_leak() calls with the distinct
+ * client_data of the chunks that may be reported, so the client can prepare
+ * them together.
+ */
+void
+client_found_leaks_pending(void **client_data, uint num);
+
 /**************************/
 /* Must be called by client */
 
@@ -61,6 +73,7 @@ leak_init(bool have_defined_info,
           bool midchunk_string_ok,
           bool midchunk_size_ok,
           bool show_reachable,
+          uint scan_threads,
           IF_WINDOWS_(bool check_encoded_pointers)
           byte *(*next_defined_ptrsz)(byte *, byte *),
           byte *(*end_of_defined_region)(byte *, byte *),
@@ -81,6 +94,10 @@ leak_scan_for_leaks(bool at_exit);
 void
 leak_handle_alloc(void *drcontext, app_pc base, size_t size);
 
+/* User must call when memory is mapped, unmapped, or made writable */
+void
+leak_handle_mapping_change(app_pc base, size_t size);
+
 #ifdef WINDOWS
 /* User must call from client_remove_malloc_on_destroy() */
 void
@@ -0,0 +1,72 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The layout of the live_summary.bin file kept up to date by -live_summary.
+ *
+ * The file is mapped shared by the process being monitored, so a reader can
+ * map or re-read it at any time.  The writer increments seq before and after
+ * each update, so a reader should copy the structure and retry until it sees
+ * the same even seq before and after its copy.  All fields are laid out so
+ * that the format is identical for 32-bit and 64-bit writers.
+ */
+
+#ifndef _LIVE_SUMMARY_H_
+#define _LIVE_SUMMARY_H_ 1
+
+#define LIVE_SUMMARY_MAGIC "DrMLive"
+/* Must be bumped whenever the structure below changes */
+#define LIVE_SUMMARY_VERSION 1
+
+#define LIVE_SUMMARY_MAX_TYPES 16
+#define LIVE_SUMMARY_NAME_LEN 32
+
+/* Indices for the first dimension of the count arrays */
+#define LIVE_SUMMARY_NORMAL    0
+#define LIVE_SUMMARY_POTENTIAL 1
+
+typedef struct _live_summary_t {
+    char magic[8];
+    uint version;
+    uint size;      /* of this structure */
+    uint pid;
+    uint num_types; /* entries used in each count array */
+    volatile uint seq;
+    /* The number of summaries (at a nudge or at exit) the leak counts are from */
+    uint leak_scans;
+    /* Milliseconds since the process started, as of the last update */
+    uint64 update_time;
+    /* The error counts are current.  The leak counts and bytes are as of the
+     * last leak scan.
+     */
+    uint unique[2][LIVE_SUMMARY_MAX_TYPES];
+    uint total[2][LIVE_SUMMARY_MAX_TYPES];
+    uint bytes_leaked[2][LIVE_SUMMARY_MAX_TYPES];
+    uint suppressed_user;
+    uint suppressed_default;
+    uint suppressed_leaks_user;
+    uint suppressed_leaks_default;
+    uint throttled_errors;
+    uint throttled_leaks;
+    /* The name of each type, as used in suppression files */
+    char type_name[LIVE_SUMMARY_MAX_TYPES][LIVE_SUMMARY_NAME_LEN];
+} live_summary_t;
+
+#endif /* _LIVE_SUMMARY_H_ */
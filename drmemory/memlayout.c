@@ -37,15 +37,54 @@ byte *xsp_at_main;
 
 /* Bump this whenever the format changes. */
 #define MEMLAYOUT_FILE_VERSION 2
+/* Likewise for the jsonl and binary formats */
+#define MEMLAYOUT_STREAM_VERSION 1
+
+/* Output is gathered in a buffer of this size rather than written a field at
+ * a time.  Contents larger than this are written straight from the app's
+ * memory.
+ */
+#define LAYOUT_BUFFER_SIZE (64*1024)
+/* Space a single formatted line may need */
+#define LAYOUT_LINE_MAX (MAX_SYMBOL_LEN + 256)
 
 /* We claim the 5th malloc client flag */
 enum {
     MALLOC_BEFORE_MAIN  = MALLOC_CLIENT_5,
 };
 
+typedef enum {
+    LAYOUT_JSON,
+    LAYOUT_JSONL,
+    LAYOUT_BINARY,
+} layout_format_t;
+
+/* A heap object dumped for -memlayout_changed_only */
+typedef struct _layout_chunk_t {
+    byte *base;
+    size_t size;
+    uint64 hash;
+} layout_chunk_t;
+
+typedef struct _layout_chunk_list_t {
+    layout_chunk_t *chunks;
+    uint num;
+    uint capacity;
+} layout_chunk_list_t;
+
+/* The heap objects of the previous dump, in address order.  Dumps are made with
+ * all other threads suspended, so there is no lock.
+ */
+static layout_chunk_list_t prev_chunks;
+
 typedef struct _layout_data_t {
     file_t outf;
-    /* Tree for lookup and iteration of the heap. */
+    layout_format_t format;
+    char *buf;
+    size_t buf_used;
+    /* Tree for lookup and iteration of the heap.  The payload is non-NULL for
+     * objects that pass -memlayout_min_size and -memlayout_sample.
+     */
     rb_tree_t *heap_tree;
     /* Tree for lookup and iteration of the valid stack regions. */
     rb_tree_t *stack_tree;
@@ -53,6 +92,12 @@ typedef struct _layout_data_t {
     bool walking_heap;
     /* Used to prevent a trailing JSON comma. */
     bool entry_count;
+    /* The thread whose callstack is being written */
+    thread_id_t cur_thread;
+    /* For -memlayout_changed_only */
+    layout_chunk_list_t cur_chunks;
+    uint prev_index;
+    uint heap_records;
 } layout_data_t;
 
 void
@@ -68,6 +113,16 @@ memlayout_init(void)
     dr_free_module_data(exe);
 }
 
+void
+memlayout_exit(void)
+{
+    if (prev_chunks.chunks != NULL) {
+        global_free(prev_chunks.chunks, prev_chunks.capacity * sizeof(layout_chunk_t),
+                    HEAPSTAT_MISC);
+    }
+    memset(&prev_chunks, 0, sizeof(prev_chunks));
+}
+
 void
 memlayout_handle_new_block(void *drcontext, void *tag)
 {
@@ -90,16 +145,225 @@ memlayout_handle_alloc(void *drcontext, app_pc base, size_t size)
         malloc_set_client_flag(base, MALLOC_BEFORE_MAIN);
 }
 
+/***************************************************************************
+ * Buffered output
+ */
+
+static void
+layout_flush(layout_data_t *data)
+{
+    if (data->buf_used == 0)
+        return;
+    if (dr_write_file(data->outf, data->buf, data->buf_used) < (ssize_t)data->buf_used)
+        REPORT_DISK_ERROR();
+    data->buf_used = 0;
+}
+
+static void
+layout_write(layout_data_t *data, const void *ptr, size_t size)
+{
+    if (data->buf_used + size > LAYOUT_BUFFER_SIZE) {
+        layout_flush(data);
+        if (size >= LAYOUT_BUFFER_SIZE) {
+            if (dr_write_file(data->outf, ptr, size) < (ssize_t)size)
+                REPORT_DISK_ERROR();
+            return;
+        }
+    }
+    memcpy(data->buf + data->buf_used, ptr, size);
+    data->buf_used += size;
+}
+
+static void
+layout_print(layout_data_t *data, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+    if (LAYOUT_BUFFER_SIZE - data->buf_used < LAYOUT_LINE_MAX)
+        layout_flush(data);
+    va_start(ap, fmt);
+    len = dr_vsnprintf(data->buf + data->buf_used, LAYOUT_BUFFER_SIZE - data->buf_used,
+                       fmt, ap);
+    va_end(ap);
+    ASSERT(len >= 0, "memlayout line too long");
+    if (len > 0)
+        data->buf_used += len;
+}
+
+/* Writes contents as a hex string */
+static void
+layout_print_hex(layout_data_t *data, byte *base, size_t size)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t i;
+    for (i = 0; i < size; i++) {
+        if (data->buf_used + 2 > LAYOUT_BUFFER_SIZE)
+            layout_flush(data);
+        data->buf[data->buf_used++] = hex[base[i] >> 4];
+        data->buf[data->buf_used++] = hex[base[i] & 0xf];
+    }
+}
+
+/* Writes a JSON string, escaping what needs it */
+static void
+layout_print_string(layout_data_t *data, const char *str)
+{
+    const char *c;
+    layout_write(data, "\"", 1);
+    for (c = str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\')
+            layout_print(data, "\\%c", *c);
+        else if ((unsigned char)*c < 0x20)
+            layout_print(data, "\\u%04x", (unsigned char)*c);
+        else
+            layout_write(data, c, 1);
+    }
+    layout_write(data, "\"", 1);
+}
+
+static void
+layout_write_record(layout_data_t *data, memlayout_record_kind_t kind,
+                    thread_id_t thread, byte *address, uint64 aux,
+                    const void *contents, size_t size)
+{
+    memlayout_record_t rec;
+    rec.kind = kind;
+    rec.thread_id = (uint)thread;
+    rec.address = (uint64)(ptr_uint_t)address;
+    rec.aux = aux;
+    rec.size = size;
+    layout_write(data, &rec, sizeof(rec));
+    if (size > 0)
+        layout_write(data, contents, size);
+}
+
+/***************************************************************************
+ * Choosing heap objects
+ */
+
+/* The choice depends only on the address so that successive dumps agree */
+static bool
+layout_sampled(byte *base)
+{
+    uint64 x = (uint64)(ptr_uint_t)base;
+    if (options.memlayout_sample <= 1)
+        return true;
+    /* Mix the bits so that allocator alignment does not skew the choice */
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x % options.memlayout_sample == 0;
+}
+
+static uint64
+layout_hash(byte *base, size_t size)
+{
+    uint64 hash = 0xcbf29ce484222325ULL;
+    size_t i;
+    for (i = 0; i + sizeof(ptr_uint_t) <= size; i += sizeof(ptr_uint_t)) {
+        hash ^= *(ptr_uint_t *)(base + i);
+        hash *= 0x100000001b3ULL;
+    }
+    for (; i < size; i++) {
+        hash ^= base[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void
+layout_chunk_append(layout_chunk_list_t *list, byte *base, size_t size, uint64 hash)
+{
+    if (list->num == list->capacity) {
+        uint new_capacity = (list->capacity == 0) ? 1024 : list->capacity * 2;
+        layout_chunk_t *grown = (layout_chunk_t *)
+            global_alloc(new_capacity * sizeof(*grown), HEAPSTAT_MISC);
+        if (list->chunks != NULL) {
+            memcpy(grown, list->chunks, list->num * sizeof(*grown));
+            global_free(list->chunks, list->capacity * sizeof(*grown), HEAPSTAT_MISC);
+        }
+        list->chunks = grown;
+        list->capacity = new_capacity;
+    }
+    list->chunks[list->num].base = base;
+    list->chunks[list->num].size = size;
+    list->chunks[list->num].hash = hash;
+    list->num++;
+}
+
+static void
+layout_write_freed(layout_data_t *data, byte *base)
+{
+    if (data->format == LAYOUT_BINARY)
+        layout_write_record(data, MEMLAYOUT_RECORD_FREED, 0, base, 0, NULL, 0);
+    else
+        layout_print(data, "{\"kind\":\"freed\",\"address\":\"" PFX "\"}\n", base);
+}
+
+/* Writes FREED records for the previous dump's objects below limit, which is
+ * NULL for all that remain
+ */
+static void
+layout_write_freed_below(layout_data_t *data, byte *limit)
+{
+    while (data->prev_index < prev_chunks.num &&
+           (limit == NULL || prev_chunks.chunks[data->prev_index].base < limit)) {
+        layout_write_freed(data, prev_chunks.chunks[data->prev_index].base);
+        data->prev_index++;
+    }
+}
+
+/* Returns whether an object is new or different since the previous dump.  The
+ * heap is walked in address order, as the previous dump's objects are kept, so
+ * the two are merged as we go.
+ */
+static bool
+layout_chunk_changed(layout_data_t *data, byte *base, size_t size)
+{
+    uint64 hash = layout_hash(base, size);
+    bool changed = true;
+    layout_chunk_append(&data->cur_chunks, base, size, hash);
+    layout_write_freed_below(data, base);
+    if (data->prev_index < prev_chunks.num &&
+        prev_chunks.chunks[data->prev_index].base == base) {
+        layout_chunk_t *prev = &prev_chunks.chunks[data->prev_index++];
+        changed = (prev->size != size || prev->hash != hash);
+    }
+    return changed;
+}
+
+/***************************************************************************
+ * Writing the layout
+ */
+
 static bool
 memory_layout_malloc_iter(malloc_info_t *info, void *iter_data)
 {
     layout_data_t *data = (layout_data_t *)iter_data;
+    bool dump;
     if (info->pre_us || TEST(MALLOC_BEFORE_MAIN, info->client_flags))
         return true;
-    rb_insert(data->heap_tree, info->base, info->request_size, NULL);
+    /* Objects we leave out still resolve where the dumped words point */
+    dump = (info->request_size >= options.memlayout_min_size &&
+            layout_sampled(info->base));
+    rb_insert(data->heap_tree, info->base, info->request_size,
+              dump ? (void *)data : NULL);
     return true;
 }
 
+/* Returns the heap object or stack region that value points into, or NULL */
+static rb_node_t *
+memory_layout_points_to(layout_data_t *data, byte *value, bool *tgt_stack)
+{
+    rb_node_t *target = rb_in_node(data->heap_tree, value);
+    *tgt_stack = false;
+    if (target == NULL) {
+        target = rb_in_node(data->stack_tree, value);
+        *tgt_stack = true;
+    }
+    return target;
+}
+
 static void
 memory_layout_walk_chunk(layout_data_t *data, byte *base, size_t size)
 {
@@ -108,45 +372,102 @@ memory_layout_walk_chunk(layout_data_t *data, byte *base, size_t size)
          * to de-ref off the end of any non-aligned object.
          */
         if (addr > base)
-            ELOGF(0, data->outf, ",\n");
-        ELOGF(0, data->outf, "        {\n");
-        ELOGF(0, data->outf, "          \"address\": \"" PFX "\",\n", addr);
+            layout_print(data, ",\n");
+        layout_print(data, "        {\n");
+        layout_print(data, "          \"address\": \"" PFX "\",\n", addr);
         size_t sz = base + size - addr;
         if (sz >= sizeof(void*)) {
             byte *value = *(byte**)addr;
             /* No trailing commas on final item! */
-            ELOGF(0, data->outf, "          \"value\": \"" PFX "\"", value);
+            layout_print(data, "          \"value\": \"" PFX "\"", value);
             addr += sizeof(void*);
-            rb_node_t *target = rb_in_node(data->heap_tree, value);
-            bool tgt_stack = false;
-            if (target == NULL) {
-                target = rb_in_node(data->stack_tree, value);
-                tgt_stack = true;
-            }
+            bool tgt_stack;
+            rb_node_t *target = memory_layout_points_to(data, value, &tgt_stack);
             if (target != NULL) {
                 byte *tgt_base;
                 rb_node_fields(target, &tgt_base, NULL, NULL);
-                ELOGF(0, data->outf, ",\n          \"points-to-type\": \"%s\",\n",
-                      tgt_stack ? "stack" : "heap");
-                ELOGF(0, data->outf, "          \"points-to-base\": \"" PFX "\",\n",
-                      tgt_base);
-                ELOGF(0, data->outf, "          \"points-to-offset\": \"0x%zx\"",
-                       value - tgt_base);
+                layout_print(data, ",\n          \"points-to-type\": \"%s\",\n",
+                             tgt_stack ? "stack" : "heap");
+                layout_print(data, "          \"points-to-base\": \"" PFX "\",\n",
+                             tgt_base);
+                layout_print(data, "          \"points-to-offset\": \"0x%zx\"",
+                             value - tgt_base);
             }
-            ELOGF(0, data->outf, "\n");
+            layout_print(data, "\n");
         } else if (sz >= sizeof(int)) {
-            ELOGF(0, data->outf, "          \"value\": \"0x%08x\"\n", *(int*)addr);
+            layout_print(data, "          \"value\": \"0x%08x\"\n", *(int*)addr);
             addr += sizeof(int);
         } else if (sz >= sizeof(short)) {
-            ELOGF(0, data->outf, "          \"value\": \"0x%04x\"\n", (short)*(int*)addr);
+            layout_print(data, "          \"value\": \"0x%04x\"\n", (short)*(int*)addr);
             addr += sizeof(short);
         } else {
-            ELOGF(0, data->outf, "          \"value\": \"0x%02x\"\n", (char)*(int*)addr);
+            layout_print(data, "          \"value\": \"0x%02x\"\n", (char)*(int*)addr);
             addr += sizeof(char);
         }
-        ELOGF(0, data->outf, "        }");
+        layout_print(data, "        }");
+    }
+    layout_print(data, "\n");
+}
+
+/* Writes the rest of a jsonl heap or stack line: the contents and the words
+ * among them that point into the heap or a stack
+ */
+static void
+memory_layout_stream_contents(layout_data_t *data, byte *base, size_t size)
+{
+    bool first = true;
+    layout_print(data, ",\"contents\":\"");
+    layout_print_hex(data, base, size);
+    layout_print(data, "\",\"pointers\":[");
+    for (byte *addr = base; addr + sizeof(void*) <= base + size; addr += sizeof(void*)) {
+        byte *value = *(byte**)addr;
+        bool tgt_stack;
+        rb_node_t *target = memory_layout_points_to(data, value, &tgt_stack);
+        if (target != NULL) {
+            byte *tgt_base;
+            rb_node_fields(target, &tgt_base, NULL, NULL);
+            layout_print(data, "%s{\"offset\":%zu,\"type\":\"%s\",\"base\":\"" PFX "\","
+                         "\"base_offset\":%zu}", first ? "" : ",", (size_t)(addr - base),
+                         tgt_stack ? "stack" : "heap", tgt_base,
+                         (size_t)(value - tgt_base));
+            first = false;
+        }
     }
-    ELOGF(0, data->outf, "\n");
+    layout_print(data, "]}\n");
+}
+
+static bool
+memory_layout_stream_iter(rb_node_t *node, void *iter_data)
+{
+    layout_data_t *data = (layout_data_t *)iter_data;
+    byte *base;
+    size_t size;
+    void *val;
+    rb_node_fields(node, &base, &size, &val);
+    if (data->walking_heap) {
+        if (val == NULL)
+            return true;
+        if (options.memlayout_changed_only && !layout_chunk_changed(data, base, size))
+            return true;
+        data->heap_records++;
+        if (data->format == LAYOUT_BINARY) {
+            layout_write_record(data, MEMLAYOUT_RECORD_HEAP, 0, base, 0, base, size);
+        } else {
+            layout_print(data, "{\"kind\":\"heap\",\"address\":\"" PFX "\",\"size\":%zu",
+                         base, size);
+            memory_layout_stream_contents(data, base, size);
+        }
+    } else {
+        thread_id_t id = (thread_id_t)(ptr_uint_t)val;
+        if (data->format == LAYOUT_BINARY) {
+            layout_write_record(data, MEMLAYOUT_RECORD_STACK, id, base, 0, base, size);
+        } else {
+            layout_print(data, "{\"kind\":\"stack\",\"thread_id\":%d,"
+                         "\"address\":\"" PFX "\",\"size\":%zu", id, base, size);
+            memory_layout_stream_contents(data, base, size);
+        }
+    }
+    return true;
 }
 
 static bool
@@ -158,27 +479,29 @@ memory_layout_rb_iter(rb_node_t *node, void *iter_data)
     void *val;
     thread_id_t id;
     rb_node_fields(node, &base, &size, &val);
+    if (data->walking_heap && val == NULL)
+        return true;
     id = (thread_id_t)(ptr_uint_t)val;
     if (data->entry_count++ > 0)
-        ELOGF(0, data->outf, ",\n");
+        layout_print(data, ",\n");
     if (data->walking_heap) {
-        ELOGF(0, data->outf, "    {\n      \"address\": \"" PFX "\",\n", base);
-        ELOGF(0, data->outf, "      \"size\": \"%d\",\n", size);
+        layout_print(data, "    {\n      \"address\": \"" PFX "\",\n", base);
+        layout_print(data, "      \"size\": \"%d\",\n", size);
     } else {
-        ELOGF(0, data->outf,
-              "    {\n      \"thread_id\": \"" PFX "\",\n", id);
-        ELOGF(0, data->outf, "      \"address\": \"" PFX "\",\n", base);
-        ELOGF(0, data->outf, "      \"size\": \"%d\",\n", size);
+        layout_print(data,
+                     "    {\n      \"thread_id\": \"" PFX "\",\n", id);
+        layout_print(data, "      \"address\": \"" PFX "\",\n", base);
+        layout_print(data, "      \"size\": \"%d\",\n", size);
     }
-    ELOGF(0, data->outf, "      \"contents\": [\n");
+    layout_print(data, "      \"contents\": [\n");
     memory_layout_walk_chunk(data, base, size);
-    ELOGF(0, data->outf, "      ]\n");
-    ELOGF(0, data->outf, "    }");
+    layout_print(data, "      ]\n");
+    layout_print(data, "    }");
     return true;
 }
 
 static void
-memlayout_dump_function(layout_data_t *data, app_pc pc)
+memlayout_dump_frame_common(layout_data_t *data, app_pc pc, byte *fp, bool first)
 {
     char buf[MAX_SYMBOL_LEN];
     size_t sofar = 0;
@@ -186,17 +509,29 @@ memlayout_dump_function(layout_data_t *data, app_pc pc)
     char *toprint = buf;
     if (*toprint == ' ')
         ++toprint;
-    ELOGF(0, data->outf, "          \"function\": \"%s\"\n", toprint);
+    if (data->format == LAYOUT_BINARY) {
+        layout_write_record(data, MEMLAYOUT_RECORD_FRAME, data->cur_thread, pc,
+                            (uint64)(ptr_uint_t)fp, toprint, strlen(toprint));
+    } else if (data->format == LAYOUT_JSONL) {
+        layout_print(data, "%s{\"pc\":\"" PFX "\",\"fp\":\"" PFX "\",\"function\":",
+                     first ? "" : ",", pc, fp);
+        layout_print_string(data, toprint);
+        layout_print(data, "}");
+    } else {
+        if (!first)
+            layout_print(data, "        },\n");
+        layout_print(data,
+                     "        {\n          \"program_counter\": \"" PFX "\",\n", pc);
+        layout_print(data, "          \"frame_pointer\": \"" PFX "\",\n", fp);
+        layout_print(data, "          \"function\": \"%s\"\n", toprint);
+    }
 }
 
 static bool
 memlayout_dump_frame(app_pc pc, byte *fp, void *user_data)
 {
     layout_data_t *data = (layout_data_t *)user_data;
-    ELOGF(0, data->outf,
-          "        },\n        {\n          \"program_counter\": \"" PFX "\",\n", pc);
-    ELOGF(0, data->outf, "          \"frame_pointer\": \"" PFX "\",\n", fp);
-    memlayout_dump_function(data, pc);
+    memlayout_dump_frame_common(data, pc, fp, false);
     return rb_in_node(data->stack_tree, fp) != NULL;
 }
 
@@ -218,8 +553,9 @@ memory_layout_record_stack_region(void *drcontext,
     }
     if (dr_get_thread_id(dr_get_current_drcontext()) == dr_get_thread_id(drcontext))
         mc.pc = cur_thread_pc;
+    data->cur_thread = dr_get_thread_id(drcontext);
     rb_insert(data->stack_tree, (byte*)mc.xsp, record_sz,
-              (void*)(ptr_uint_t)dr_get_thread_id(drcontext));
+              (void*)(ptr_uint_t)data->cur_thread);
 
     /* XXX: It's easier to make a temp buffer than to change print_callstack to not
      * need either a buffer or pcs.
@@ -227,28 +563,58 @@ memory_layout_record_stack_region(void *drcontext,
     size_t bufsz = max_callstack_size();
     char *buf = (char *) global_alloc(bufsz, HEAPSTAT_CALLSTACK);
     size_t sofar = 0;
-    ELOGF(0, data->outf, "    {\n      \"thread_id\": \"" PFX "\",\n",
-          dr_get_thread_id(drcontext));
-    ELOGF(0, data->outf, "      \"stack_frames\": [\n");
-    ELOGF(0, data->outf,
-          "        {\n          \"program_counter\": \"" PFX "\",\n", mc.pc);
-    ELOGF(0, data->outf,
-          "          \"frame_pointer\": \"" PFX "\",\n", MC_FP_REG(&mc));
-    memlayout_dump_function(data, mc.pc);
+    if (data->format == LAYOUT_JSONL) {
+        layout_print(data, "{\"kind\":\"thread\",\"thread_id\":%d,\"frames\":[",
+                     data->cur_thread);
+    } else if (data->format == LAYOUT_JSON) {
+        layout_print(data, "    {\n      \"thread_id\": \"" PFX "\",\n",
+                     data->cur_thread);
+        layout_print(data, "      \"stack_frames\": [\n");
+    }
+    memlayout_dump_frame_common(data, mc.pc, (byte *)MC_FP_REG(&mc), true);
     print_callstack(buf, bufsz, &sofar, &mc, false/*no fps*/, NULL, 0, false,
                     options.callstack_max_frames, memlayout_dump_frame, data);
-    ELOGF(0, data->outf, "        }\n");
-    ELOGF(0, data->outf, "      ]\n");
-    ELOGF(0, data->outf, "    }\n");
+    if (data->format == LAYOUT_JSONL)
+        layout_print(data, "]}\n");
+    else if (data->format == LAYOUT_JSON) {
+        layout_print(data, "        }\n");
+        layout_print(data, "      ]\n");
+        layout_print(data, "    }\n");
+    }
     global_free(buf, bufsz, HEAPSTAT_CALLSTACK);
 }
 
+static void
+memlayout_write_stream_header(layout_data_t *data)
+{
+    if (data->format == LAYOUT_BINARY) {
+        memlayout_header_t header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MEMLAYOUT_MAGIC, sizeof(header.magic));
+        header.version = MEMLAYOUT_STREAM_VERSION;
+        header.pointer_size = sizeof(void *);
+        header.changed_only = options.memlayout_changed_only;
+        layout_write(data, &header, sizeof(header));
+    } else {
+        layout_print(data, "{\"kind\":\"memlayout\",\"version\":%d,\"pointer_size\":%d,"
+                     "\"changed_only\":%s}\n", MEMLAYOUT_STREAM_VERSION,
+                     (int)sizeof(void *),
+                     options.memlayout_changed_only ? "true" : "false");
+    }
+}
+
 void
 memlayout_dump_layout(app_pc pc)
 {
     char fname[MAXIMUM_PATH];
-    file_t outf = drx_open_unique_file(logsubdir,
-                                       "memlayout", "json",
+    layout_format_t format = LAYOUT_JSON;
+    if (strcmp(options.memlayout_format, "jsonl") == 0)
+        format = LAYOUT_JSONL;
+    else if (strcmp(options.memlayout_format, "binary") == 0)
+        format = LAYOUT_BINARY;
+    file_t outf = drx_open_unique_file(logsubdir, "memlayout",
+                                       format == LAYOUT_BINARY ? "bin" :
+                                       (format == LAYOUT_JSONL ? "jsonl" : "json"),
 #ifndef WINDOWS
                                        DR_FILE_CLOSE_ON_FORK |
 #endif
@@ -264,6 +630,8 @@ memlayout_dump_layout(app_pc pc)
     layout_data_t data;
     memset(&data, 0, sizeof(data));
     data.outf = outf;
+    data.format = format;
+    data.buf = (char *) global_alloc(LAYOUT_BUFFER_SIZE, HEAPSTAT_MISC);
     data.heap_tree = rb_tree_create(NULL);
     data.stack_tree = rb_tree_create(NULL);
 
@@ -276,26 +644,48 @@ memlayout_dump_layout(app_pc pc)
 
     malloc_iterate(memory_layout_malloc_iter, &data);
 
-    ELOGF(0, data.outf, "{\n  \"version\": \"%d\",\n", MEMLAYOUT_FILE_VERSION);
-    ELOGF(0, data.outf, "  \"threads\": [\n");
+    if (format == LAYOUT_JSON) {
+        layout_print(&data, "{\n  \"version\": \"%d\",\n", MEMLAYOUT_FILE_VERSION);
+        layout_print(&data, "  \"threads\": [\n");
+    } else
+        memlayout_write_stream_header(&data);
     for (uint i = 0; i < num_threads; i++) {
         memory_layout_record_stack_region(drcontexts[i], &data, NULL);
     }
     memory_layout_record_stack_region(dr_get_current_drcontext(), &data, pc);
 
-    ELOGF(0, data.outf, "  ],\n  \"heap objects\": [\n");
-    data.walking_heap = true;
-    data.entry_count = 0;
-    rb_iterate(data.heap_tree, memory_layout_rb_iter, &data);
-    if (data.entry_count > 0)
-        ELOGF(0, data.outf, "\n");
-    ELOGF(0, data.outf, "  ],\n  \"thread stacks\": [\n");
-    data.walking_heap = false;
-    data.entry_count = 0;
-    rb_iterate(data.stack_tree, memory_layout_rb_iter, &data);
-    if (data.entry_count > 0)
-        ELOGF(0, data.outf, "\n");
-    ELOGF(0, data.outf, "  ]\n}\n");
+    if (format == LAYOUT_JSON) {
+        layout_print(&data, "  ],\n  \"heap objects\": [\n");
+        data.walking_heap = true;
+        data.entry_count = 0;
+        rb_iterate(data.heap_tree, memory_layout_rb_iter, &data);
+        if (data.entry_count > 0)
+            layout_print(&data, "\n");
+        layout_print(&data, "  ],\n  \"thread stacks\": [\n");
+        data.walking_heap = false;
+        data.entry_count = 0;
+        rb_iterate(data.stack_tree, memory_layout_rb_iter, &data);
+        if (data.entry_count > 0)
+            layout_print(&data, "\n");
+        layout_print(&data, "  ]\n}\n");
+    } else {
+        data.walking_heap = true;
+        rb_iterate(data.heap_tree, memory_layout_stream_iter, &data);
+        if (options.memlayout_changed_only) {
+            layout_write_freed_below(&data, NULL);
+            memlayout_exit();
+            prev_chunks = data.cur_chunks;
+        }
+        data.walking_heap = false;
+        rb_iterate(data.stack_tree, memory_layout_stream_iter, &data);
+        if (format == LAYOUT_BINARY) {
+            layout_write_record(&data, MEMLAYOUT_RECORD_END, 0, NULL,
+                                data.heap_records, NULL, 0);
+        } else
+            layout_print(&data, "{\"kind\":\"end\",\"heap_objects\":%d}\n",
+                         data.heap_records);
+    }
+    layout_flush(&data);
 
     if (drcontexts != NULL) {
         IF_DEBUG(bool ok =)
@@ -303,6 +693,7 @@ memlayout_dump_layout(app_pc pc)
         ASSERT(ok, "failed to resume after leak scan");
     }
 
+    global_free(data.buf, LAYOUT_BUFFER_SIZE, HEAPSTAT_MISC);
     rb_tree_destroy(data.heap_tree);
     rb_tree_destroy(data.stack_tree);
     dr_close_file(outf);
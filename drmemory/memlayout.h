@@ -22,9 +22,56 @@
 #ifndef _MEMLAYOUT_H_
 #define _MEMLAYOUT_H_ 1
 
+/* The -memlayout_format binary file is a memlayout_header_t followed by
+ * memlayout_record_t records, each followed by its size bytes of data, in
+ * the tool's native byte order:
+ *
+ *   FRAME   one per callstack frame of each thread, innermost first, with the
+ *           pc in address, the frame pointer in aux, and the function's name
+ *           as the data
+ *   HEAP    a heap object at address, with its contents as the data
+ *   STACK   the recorded part of a thread's stack, likewise
+ *   FREED   a heap object of the previous dump that is gone, with
+ *           -memlayout_changed_only
+ *   END     the last record, with the number of HEAP records in aux
+ *
+ * Records of one kind are in address order, and FREED records are mixed in
+ * among the HEAP records.  Unlike the JSON formats, which pointers in the
+ * contents refer to heap objects or stacks is left to the reader.
+ */
+#define MEMLAYOUT_MAGIC "DRMEMLAY"
+
+typedef enum {
+    MEMLAYOUT_RECORD_FRAME = 1,
+    MEMLAYOUT_RECORD_HEAP,
+    MEMLAYOUT_RECORD_STACK,
+    MEMLAYOUT_RECORD_FREED,
+    MEMLAYOUT_RECORD_END,
+} memlayout_record_kind_t;
+
+typedef struct _memlayout_header_t {
+    char magic[8];
+    uint version;
+    uint pointer_size;
+    /* Whether only objects changed since the previous dump are present */
+    uint changed_only;
+    uint padding;
+} memlayout_header_t;
+
+typedef struct _memlayout_record_t {
+    uint kind;
+    uint thread_id;
+    uint64 address;
+    uint64 aux;
+    uint64 size;
+} memlayout_record_t;
+
 void
 memlayout_init(void);
 
+void
+memlayout_exit(void);
+
 void
 memlayout_handle_new_block(void *drcontext, void *tag);
 
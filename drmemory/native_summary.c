@@ -0,0 +1,519 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Native execution of trusted library routines (-native_summaries).
+ *
+ * The summary file has one line per routine, in the manner of drltrace's
+ * configuration file:
+ *
+ *   # module|function|effect|effect...
+ *   libz.so.1|crc32|read arg1 arg2
+ *   libz.so.1|uncompress|read arg2 arg3|write arg0 *arg1
+ *
+ * Each effect is "read <ptr> <size>" or "write <ptr> <size>", where a value
+ * is argN (the Nth integer argument, from 0), *argN (the pointer-sized value
+ * argN points to, or *argN:4 for a 4-byte value), ret (the return value), or
+ * a constant.  Reads are evaluated and checked at the call, and writes are
+ * evaluated and marked defined at the return, so "write arg0 *arg1" uses
+ * the length the routine stored.
+ *
+ * A summarized routine is replaced with drwrap_replace_native() by a stub
+ * that runs natively on the app stack, like the heap replacement routines in
+ * alloc_replace.c.  The stub checks the reads on DR's stack, calls the real
+ * routine natively, and marks the writes.  Nothing the routine does
+ * internally is seen: it must only touch memory its summary describes, must
+ * not allocate from or free to the app's heap or call back into app code,
+ * and may take at most SUMMARY_MAX_ARGS integer or pointer arguments.  On
+ * 32-bit Windows it must be cdecl.
+ */
+
+#include "dr_api.h"
+#include "drwrap.h"
+#include "drmemory.h"
+#include "utils.h"
+#include "asm_utils.h"
+#include "alloc.h"
+#include "shadow.h"
+#include "slowpath.h"
+#include "callstack.h"
+#include "native_summary.h"
+
+#define SUMMARY_MAX_ARGS 8
+#define SUMMARY_MAX_EFFECTS 8
+#define SUMMARY_TABLE_HASH_BITS 6
+
+#define DR_STATE_TO_SWAP (DR_STATE_ALL & (~DR_STATE_STACK_BOUNDS))
+
+#ifdef STATISTICS
+uint native_summary_calls;
+uint native_summary_slow_checks;
+#endif
+
+typedef enum {
+    SUMMARY_VAL_CONST,
+    SUMMARY_VAL_ARG,
+    SUMMARY_VAL_DEREF_ARG,
+    SUMMARY_VAL_RET,
+} summary_val_kind_t;
+
+typedef struct _summary_val_t {
+    summary_val_kind_t kind;
+    /* The constant, or the argument index */
+    ptr_uint_t value;
+    /* For SUMMARY_VAL_DEREF_ARG */
+    uint deref_size;
+} summary_val_t;
+
+typedef struct _summary_effect_t {
+    bool write;
+    summary_val_t ptr;
+    summary_val_t size;
+} summary_effect_t;
+
+typedef struct _summary_func_t {
+    char *module;
+    char *name;
+    uint num_effects;
+    summary_effect_t effect[SUMMARY_MAX_EFFECTS];
+    struct _summary_func_t *next;
+} summary_func_t;
+
+/* One summarized routine in one loaded module, passed to the stub */
+typedef struct _summary_instance_t {
+    summary_func_t *func;
+    app_pc pc;
+} summary_instance_t;
+
+typedef ptr_uint_t (*summary_target_t)(ptr_uint_t, ptr_uint_t, ptr_uint_t, ptr_uint_t,
+                                       ptr_uint_t, ptr_uint_t, ptr_uint_t, ptr_uint_t);
+
+static summary_func_t *summary_funcs;
+
+/* Maps a replaced pc to its summary_instance_t */
+static hashtable_t summary_table;
+
+/***************************************************************************
+ * Applying summaries
+ */
+
+static bool
+summary_eval(const summary_val_t *val, const ptr_uint_t *args, const ptr_uint_t *ret,
+             ptr_uint_t *out)
+{
+    switch (val->kind) {
+    case SUMMARY_VAL_CONST:
+        *out = val->value;
+        return true;
+    case SUMMARY_VAL_ARG:
+        *out = args[val->value];
+        return true;
+    case SUMMARY_VAL_DEREF_ARG: {
+        uint val32;
+        if (val->deref_size == sizeof(val32)) {
+            if (!safe_read((void *)args[val->value], sizeof(val32), &val32))
+                return false;
+            *out = val32;
+            return true;
+        }
+        return safe_read((void *)args[val->value], sizeof(*out), out);
+    }
+    case SUMMARY_VAL_RET:
+        if (ret == NULL)
+            return false;
+        *out = *ret;
+        return true;
+    }
+    return false;
+}
+
+/* Checks or marks one effect.  A range whose shadow has nothing to report is
+ * handled in one operation; otherwise handle_mem_ref() checks it byte by byte
+ * and reports, as for a system call parameter.
+ */
+static void
+summary_apply_effect(const summary_effect_t *effect, const ptr_uint_t *args,
+                     const ptr_uint_t *ret, app_loc_t *loc, dr_mcontext_t *mc)
+{
+    ptr_uint_t start, size;
+    uint flags;
+    if (!summary_eval(&effect->ptr, args, ret, &start) ||
+        !summary_eval(&effect->size, args, ret, &size) ||
+        start == 0 || size == 0 || start + size < start)
+        return;
+    if (!effect->write || !options.check_uninitialized) {
+        /* Fully defined bytes pass both definedness and addressability checks */
+        if (shadow_check_range((app_pc)start, size, SHADOW_DEFINED, NULL, NULL, NULL))
+            return;
+    } else if (shadow_range_ok_for_bulk((app_pc)start, size)) {
+        shadow_set_range((app_pc)start, (app_pc)(start + size), SHADOW_DEFINED);
+        return;
+    }
+    STATS_INC(native_summary_slow_checks);
+    if (effect->write)
+        flags = options.check_uninitialized ? MEMREF_WRITE : MEMREF_CHECK_ADDRESSABLE;
+    else {
+        flags = options.check_uninitialized ?
+            MEMREF_CHECK_DEFINEDNESS : MEMREF_CHECK_ADDRESSABLE;
+    }
+    /* i#556: as check_sysmem() does, stop at the first bad word of a huge range */
+    if (size > 64*1024)
+        flags |= MEMREF_ABORT_AFTER_UNADDR;
+    handle_mem_ref(flags, loc, (app_pc)start, size, mc);
+}
+
+/* Called on DR's stack.  ret is NULL at the call. */
+static void
+summary_apply(summary_instance_t *inst, ptr_uint_t *args, ptr_uint_t *ret,
+              dr_mcontext_t *mc)
+{
+    app_loc_t loc;
+    uint i;
+    if (!options.shadowing)
+        return;
+    pc_to_loc(&loc, inst->pc);
+    for (i = 0; i < inst->func->num_effects; i++) {
+        const summary_effect_t *effect = &inst->func->effect[i];
+        if (effect->write == (ret != NULL))
+            summary_apply_effect(effect, args, ret, &loc, mc);
+    }
+}
+
+/* The replacement for every summarized routine, which runs natively.  As in
+ * alloc_replace.c, our frame is marked defined for callstack walks, and the
+ * work of checking is done on DR's stack.
+ */
+static ptr_uint_t
+replace_native_summary(ptr_uint_t a0, ptr_uint_t a1, ptr_uint_t a2, ptr_uint_t a3,
+                       ptr_uint_t a4, ptr_uint_t a5, ptr_uint_t a6, ptr_uint_t a7)
+{
+    void *drcontext = dr_get_current_drcontext();
+    summary_instance_t *inst = (summary_instance_t *)
+        dr_read_saved_reg(drcontext, DRWRAP_REPLACE_NATIVE_DATA_SLOT);
+    byte *app_xsp = (byte *)
+        dr_read_saved_reg(drcontext, DRWRAP_REPLACE_NATIVE_SP_SLOT);
+    ptr_uint_t args[SUMMARY_MAX_ARGS];
+    ptr_uint_t res;
+    dr_mcontext_t mc;
+
+    client_stack_alloc(app_xsp - sizeof(void*), app_xsp, true/*defined*/);
+    args[0] = a0;
+    args[1] = a1;
+    args[2] = a2;
+    args[3] = a3;
+    args[4] = a4;
+    args[5] = a5;
+    args[6] = a6;
+    args[7] = a7;
+    mc.size = sizeof(mc);
+    mc.flags = DR_MC_CONTROL | DR_MC_INTEGER;
+    get_stack_registers(&MC_SP_REG(&mc), &MC_FP_REG(&mc));
+    mc.pc = inst->pc;
+    STATS_INC(native_summary_calls);
+
+#ifdef WINDOWS
+    dr_switch_to_dr_state_ex(drcontext, DR_STATE_TO_SWAP);
+#endif
+    dr_call_on_clean_stack(drcontext, (void* (*)(void)) summary_apply, inst, args,
+                           NULL, &mc, NULL, NULL, NULL, NULL);
+#ifdef WINDOWS
+    dr_switch_to_app_state_ex(drcontext, DR_STATE_TO_SWAP);
+#endif
+
+    /* We are native, so the routine and everything it calls run natively */
+    res = ((summary_target_t)inst->pc)(a0, a1, a2, a3, a4, a5, a6, a7);
+
+#ifdef WINDOWS
+    dr_switch_to_dr_state_ex(drcontext, DR_STATE_TO_SWAP);
+#endif
+    dr_call_on_clean_stack(drcontext, (void* (*)(void)) summary_apply, inst, args,
+                           &res, &mc, NULL, NULL, NULL, NULL);
+#ifdef WINDOWS
+    dr_switch_to_app_state_ex(drcontext, DR_STATE_TO_SWAP);
+#endif
+
+    client_stack_dealloc(app_xsp - sizeof(void*), app_xsp);
+    drwrap_replace_native_fini(drcontext);
+    /* i#1217: clear the retaddr drwrap_replace_native_fini() left below TOS */
+    zero_pointers_on_stack(IF_X64_ELSE(64, 32));
+    return res;
+}
+
+/***************************************************************************
+ * Summary file
+ */
+
+static const char *
+summary_skip_space(const char *s, const char *eol)
+{
+    while (s < eol && (*s == ' ' || *s == '\t'))
+        s++;
+    return s;
+}
+
+/* Parses one value, returning the text after it or NULL */
+static const char *
+summary_parse_value(const char *s, const char *eol, summary_val_t *val)
+{
+    s = summary_skip_space(s, eol);
+    val->deref_size = sizeof(ptr_uint_t);
+    if (s < eol && *s == '*') {
+        val->kind = SUMMARY_VAL_DEREF_ARG;
+        s++;
+    } else
+        val->kind = SUMMARY_VAL_ARG;
+    if (eol - s >= 3 && strncmp(s, "arg", 3) == 0) {
+        s += 3;
+        if (s == eol || *s < '0' || *s >= '0' + SUMMARY_MAX_ARGS)
+            return NULL;
+        val->value = *s - '0';
+        s++;
+        if (val->kind == SUMMARY_VAL_DEREF_ARG && s < eol && *s == ':') {
+            s++;
+            if (s == eol || (*s != '4' && *s != '8') ||
+                (*s == '8' && sizeof(ptr_uint_t) < 8))
+                return NULL;
+            val->deref_size = *s - '0';
+            s++;
+        }
+    } else if (val->kind == SUMMARY_VAL_DEREF_ARG) {
+        return NULL;
+    } else if (eol - s >= 3 && strncmp(s, "ret", 3) == 0) {
+        val->kind = SUMMARY_VAL_RET;
+        s += 3;
+    } else {
+        const char *digits = s;
+        int base = 10;
+        val->kind = SUMMARY_VAL_CONST;
+        val->value = 0;
+        if (eol - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+            base = 16;
+            s += 2;
+            digits = s;
+        }
+        for (; s < eol; s++) {
+            uint digit;
+            if (*s >= '0' && *s <= '9')
+                digit = *s - '0';
+            else if (base == 16 && *s >= 'a' && *s <= 'f')
+                digit = *s - 'a' + 10;
+            else if (base == 16 && *s >= 'A' && *s <= 'F')
+                digit = *s - 'A' + 10;
+            else
+                break;
+            val->value = val->value * base + digit;
+        }
+        if (s == digits)
+            return NULL;
+    }
+    if (s < eol && *s != ' ' && *s != '\t' && *s != '|')
+        return NULL;
+    return s;
+}
+
+/* Parses "read <ptr> <size>" or "write <ptr> <size>" up to the next '|' */
+static const char *
+summary_parse_effect(const char *s, const char *eol, summary_effect_t *effect)
+{
+    s = summary_skip_space(s, eol);
+    if (eol - s > 5 && strncmp(s, "read ", 5) == 0) {
+        effect->write = false;
+        s += 5;
+    } else if (eol - s > 6 && strncmp(s, "write ", 6) == 0) {
+        effect->write = true;
+        s += 6;
+    } else
+        return NULL;
+    s = summary_parse_value(s, eol, &effect->ptr);
+    if (s == NULL)
+        return NULL;
+    s = summary_parse_value(s, eol, &effect->size);
+    if (s == NULL)
+        return NULL;
+    s = summary_skip_space(s, eol);
+    if (s < eol && *s != '|')
+        return NULL;
+    /* At the call we have no return value and cannot know what will be stored */
+    if (!effect->write &&
+        (effect->ptr.kind == SUMMARY_VAL_RET || effect->size.kind == SUMMARY_VAL_RET))
+        return NULL;
+    return s;
+}
+
+static bool
+summary_parse_line(const char *line, const char *eol)
+{
+    const char *module_end, *name, *name_end, *s;
+    summary_func_t *func;
+    module_end = memchr(line, '|', eol - line);
+    if (module_end == NULL || module_end == line)
+        return false;
+    name = module_end + 1;
+    name_end = memchr(name, '|', eol - name);
+    if (name_end == NULL)
+        name_end = eol;
+    if (name_end == name)
+        return false;
+    func = (summary_func_t *) global_alloc(sizeof(*func), HEAPSTAT_MISC);
+    memset(func, 0, sizeof(*func));
+    for (s = name_end; s < eol; ) {
+        s++; /* the '|' */
+        if (func->num_effects == SUMMARY_MAX_EFFECTS)
+            s = NULL;
+        else
+            s = summary_parse_effect(s, eol, &func->effect[func->num_effects++]);
+        if (s == NULL) {
+            global_free(func, sizeof(*func), HEAPSTAT_MISC);
+            return false;
+        }
+    }
+    func->module = drmem_strndup(line, module_end - line, HEAPSTAT_MISC);
+    func->name = drmem_strndup(name, name_end - name, HEAPSTAT_MISC);
+    func->next = summary_funcs;
+    summary_funcs = func;
+    LOG(1, "native summary for %s!%s with %d effects\n", func->module, func->name,
+        func->num_effects);
+    return true;
+}
+
+static void
+summary_read_file(const char *fname)
+{
+    const char *line, *eol, *next_line, *eof;
+    uint64 map_size;
+    size_t actual_size;
+    void *map = NULL;
+    int line_num = 0;
+    file_t f = dr_open_file(fname, DR_FILE_READ);
+    if (f == INVALID_FILE) {
+        NOTIFY_ERROR("Error opening -native_summaries file %s"NL, fname);
+        dr_abort();
+    }
+    /* we avoid having to do our own buffering by just mapping the whole file */
+    if (dr_file_size(f, &map_size) && map_size > 0) {
+        actual_size = (size_t) map_size;
+        map = dr_map_file(f, &actual_size, 0, NULL, DR_MEMPROT_READ, 0);
+    }
+    if (map != NULL && actual_size >= map_size) {
+        eof = ((char *) map) + map_size;
+        for (line = (char *) map; line < eof; line = next_line) {
+            next_line = find_next_line(line, eof, &line, &eol, true);
+            line_num++;
+            if (line == eol || line[0] == '#')
+                continue;
+            if (!summary_parse_line(line, eol)) {
+                NOTIFY_ERROR("Malformed line %d in -native_summaries file %s: %.*s"NL,
+                             line_num, fname, (int)(eol - line), line);
+                dr_abort();
+            }
+        }
+    }
+    if (map != NULL)
+        dr_unmap_file(map, actual_size);
+    dr_close_file(f);
+}
+
+/***************************************************************************
+ * Replacing
+ */
+
+static void
+summary_free_instance(void *p)
+{
+    global_free(p, sizeof(summary_instance_t), HEAPSTAT_MISC);
+}
+
+static void
+summary_in_module(const module_data_t *info, bool add)
+{
+    const char *modname = dr_module_preferred_name(info);
+    summary_func_t *func;
+    if (modname == NULL)
+        return;
+    for (func = summary_funcs; func != NULL; func = func->next) {
+        app_pc pc;
+        if (!text_matches_pattern(modname, func->module, IF_WINDOWS_ELSE(true, false)))
+            continue;
+        pc = (app_pc) dr_get_proc_address(info->handle, func->name);
+        if (pc == NULL)
+            continue;
+        if (add) {
+            summary_instance_t *inst = (summary_instance_t *)
+                global_alloc(sizeof(*inst), HEAPSTAT_MISC);
+            inst->func = func;
+            inst->pc = pc;
+            if (!hashtable_add(&summary_table, pc, inst)) {
+                /* e.g., an export forwarded to one we already replaced */
+                summary_free_instance(inst);
+                continue;
+            }
+            if (!drwrap_replace_native(pc, (app_pc)replace_native_summary, true/*entry*/,
+                                       0, inst, false)) {
+                LOG(1, "failed to replace %s!%s\n", modname, func->name);
+                hashtable_remove(&summary_table, pc);
+                continue;
+            }
+            LOG(2, "running %s!%s "PFX" natively\n", modname, func->name, pc);
+        } else if (hashtable_lookup(&summary_table, pc) != NULL) {
+            drwrap_replace_native(pc, NULL, true/*entry*/, 0, NULL, true/*override*/);
+            hashtable_remove(&summary_table, pc);
+        }
+    }
+}
+
+void
+native_summary_init(void)
+{
+    if (options.native_summaries[0] == '\0')
+        return;
+    hashtable_init_ex(&summary_table, SUMMARY_TABLE_HASH_BITS, HASH_INTPTR,
+                      false/*!strdup*/, true/*synch*/, summary_free_instance, NULL, NULL);
+    summary_read_file(options.native_summaries);
+}
+
+void
+native_summary_exit(void)
+{
+    summary_func_t *func, *next;
+    if (options.native_summaries[0] == '\0')
+        return;
+    hashtable_delete_with_stats(&summary_table, "native summaries");
+    for (func = summary_funcs; func != NULL; func = next) {
+        next = func->next;
+        global_free(func->module, strlen(func->module) + 1, HEAPSTAT_MISC);
+        global_free(func->name, strlen(func->name) + 1, HEAPSTAT_MISC);
+        global_free(func, sizeof(*func), HEAPSTAT_MISC);
+    }
+    summary_funcs = NULL;
+}
+
+void
+native_summary_module_load(void *drcontext, const module_data_t *info, bool loaded)
+{
+    if (summary_funcs != NULL)
+        summary_in_module(info, true/*add*/);
+}
+
+void
+native_summary_module_unload(void *drcontext, const module_data_t *info)
+{
+    if (summary_funcs != NULL)
+        summary_in_module(info, false/*remove*/);
+}
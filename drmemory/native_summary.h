@@ -0,0 +1,50 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Native execution of trusted library routines (-native_summaries).
+ *
+ * Each routine listed in the summary file is replaced by a stub that runs
+ * natively: it checks the memory the routine's summary says it reads, calls
+ * the real routine natively so that the routine and everything it calls run
+ * at full speed, and then marks what the summary says it wrote as defined.
+ */
+
+#ifndef _NATIVE_SUMMARY_H_
+#define _NATIVE_SUMMARY_H_ 1
+
+void
+native_summary_init(void);
+
+void
+native_summary_exit(void);
+
+void
+native_summary_module_load(void *drcontext, const module_data_t *info, bool loaded);
+
+void
+native_summary_module_unload(void *drcontext, const module_data_t *info);
+
+#ifdef STATISTICS
+extern uint native_summary_calls;
+extern uint native_summary_slow_checks;
+#endif
+
+#endif /* _NATIVE_SUMMARY_H_ */
@@ -421,9 +421,26 @@ options_init(const char *opstr)
         options.light = false;
         options.pattern = 0;
     }
+    if (options.sample_allocs > 0) {
+        /* only the sampled guard chunks catch errors */
+        if (!options.replace_malloc)
+            usage_error("-sample_allocs cannot be used with -no_replace_malloc", "");
+        if (options.light || option_specified.pattern)
+            usage_error("-sample_allocs cannot be used with -light or -pattern", "");
+        options.leaks_only = true;
+    }
+    if (options.coverage_stream)
+        options.coverage = true;
 #endif
     if (options.leaks_only || options.perturb_only) {
         option_disable_memory_checks();
+        /* Without shadowing nothing checks the redzones, so the replacement
+         * allocator's chunks only need their headers.  Wrapping keeps them
+         * for -size_in_redzone.
+         */
+        if (options.leaks_only && options.replace_malloc &&
+            !option_specified.redzone_size)
+            options.redzone_size = 0;
 #ifdef WINDOWS
         /* i#1457-c#3: -perturb_only skips callstack ops init, so we must disable
          * check_gdi and check_handle_leaks
@@ -564,7 +581,14 @@ options_init(const char *opstr)
         option_specified.fuzz_input_file ||
         option_specified.fuzz_corpus ||
         option_specified.fuzz_corpus_out ||
+        option_specified.fuzz_corpus_minimize ||
         option_specified.fuzz_coverage ||
+        IF_LINUX(option_specified.fuzz_iteration_arena ||)
+        IF_LINUX(option_specified.fuzz_fork_server ||)
+        option_specified.fuzz_iteration_leaks ||
+        option_specified.fuzz_error_buckets ||
+        option_specified.fuzz_live_stats ||
+        option_specified.fuzz_reset_globals ||
         option_specified.fuzz_target ||
         option_specified.fuzz_mutator_lib ||
         option_specified.fuzz_mutator_ops ||
@@ -575,6 +599,7 @@ options_init(const char *opstr)
         option_specified.fuzz_mutator_max_value ||
         option_specified.fuzz_mutator_random_seed ||
         option_specified.fuzz_dictionary ||
+        option_specified.fuzz_cmp_dictionary ||
         option_specified.fuzz_one_input ||
         option_specified.fuzz_buffer_fixed_size ||
         option_specified.fuzz_buffer_offset ||
@@ -590,13 +615,65 @@ options_init(const char *opstr)
             usage_error("-fuzz_replace_buffer cannot be used with -no_replace_malloc",
                         "");
         }
+#ifdef LINUX
+        if (options.fuzz_iteration_arena && !options.replace_malloc) {
+            usage_error("-fuzz_iteration_arena cannot be used with -no_replace_malloc",
+                        "");
+        }
+        if (options.fuzz_fork_server > 0) {
+# ifdef ARM
+            usage_error("-fuzz_fork_server is not yet supported on ARM", "");
+# endif
+            if (options.fuzz_threads > 1)
+                usage_error("-fuzz_fork_server requires -fuzz_threads 1", "");
+            if (option_specified.fuzz_corpus)
+                usage_error("-fuzz_fork_server cannot be used with -fuzz_corpus", "");
+        }
+#endif
         if (option_specified.fuzz_dictionary && option_specified.fuzz_mutator_unit &&
             strcmp(options.fuzz_mutator_unit, "token") != 0)
             usage_error("-fuzz_dictionary requires -fuzz_mutator_unit token", "");
+        if (options.fuzz_cmp_dictionary) {
+#ifndef X86
+            usage_error("-fuzz_cmp_dictionary is only supported on x86", "");
+#endif
+            if (!option_specified.fuzz_dictionary)
+                usage_error("-fuzz_cmp_dictionary requires -fuzz_dictionary", "");
+            /* A child's captures would not reach the mutator the parent mirrors */
+            if (IF_LINUX_ELSE(options.fuzz_fork_server > 0, false)) {
+                usage_error("-fuzz_cmp_dictionary cannot be used with -fuzz_fork_server",
+                            "");
+            }
+        }
+        if (options.fuzz_reset_globals && options.fuzz_threads > 1)
+            usage_error("-fuzz_reset_globals requires -fuzz_threads 1", "");
         if (option_specified.fuzz_corpus_out && !option_specified.fuzz_corpus)
             usage_error("-fuzz_corpus_out requires -fuzz_corpus", "");
+        if (options.fuzz_corpus_minimize &&
+            (!option_specified.fuzz_corpus || !option_specified.fuzz_corpus_out)) {
+            usage_error("-fuzz_corpus_minimize requires -fuzz_corpus and "
+                        "-fuzz_corpus_out", "");
+        }
     }
 
+    if (options.guard_page_min_size > 0 && !options.replace_malloc)
+        usage_error("-guard_page_min_size cannot be used with -no_replace_malloc", "");
+#ifdef LINUX
+    if (options.numa_arenas && (options.thread_arenas == 0 || !options.replace_malloc))
+        usage_error("-numa_arenas requires -thread_arenas and -replace_malloc", "");
+    /* Both reset the soft-dirty bits, each for its own use */
+    if (options.leak_scan_concurrent && options.leak_scan_incremental) {
+        usage_error("-leak_scan_concurrent cannot be used with -leak_scan_incremental",
+                    "");
+    }
+#endif
+    if (strcmp(options.memlayout_format, "json") != 0 &&
+        strcmp(options.memlayout_format, "jsonl") != 0 &&
+        strcmp(options.memlayout_format, "binary") != 0)
+        usage_error("-memlayout_format must be json, jsonl, or binary", "");
+    if (options.memlayout_changed_only && strcmp(options.memlayout_format, "json") == 0)
+        usage_error("-memlayout_changed_only requires -memlayout_format jsonl or binary",
+                    "");
     if (options.replace_malloc) {
         options.replace_realloc = false; /* no need for it */
         /* whole header is in redzone, but supports redzone being smaller than header */
@@ -614,6 +691,12 @@ options_init(const char *opstr)
         options.results_to_stderr = false;
         options.summary = false;
     }
+    if (options.track_origins && !options.check_uninitialized)
+        usage_error("-track_origins only valid w/ -check_uninitialized", "");
+    if (options.tiered_threshold > 0 && !options.check_uninitialized)
+        usage_error("-tiered_threshold only valid w/ -check_uninitialized", "");
+    if (options.startup_addr_only && !options.check_uninitialized)
+        usage_error("-startup_addr_only only valid w/ -check_uninitialized", "");
     if (options.check_uninitialized) {
         if (options.check_stack_bounds)
             usage_error("-check_stack_bounds only valid w/ -no_check_uninitialized", "");
@@ -88,7 +88,7 @@ options_print_usage();
 
 #define HAVE_STALE_RETADDRS() \
     ((!options.shadowing || !options.check_uninitialized) && \
-     (!options.leaks_only || !options.zero_stack))
+     (!options.leaks_only || !options.zero_stack || options.zero_stack_lazy))
 
 static inline bool
 persistence_supported(void)
@@ -100,7 +100,15 @@ persistence_supported(void)
      * the drmem library: but we're already assuming it's at the same base.
      * Plus, the bb will be fine-grained due to its non-exit cti.
      * FIXME i#769: full mode is not yet persistable b/c its lean routines have
-     * absolute return targets and they need patching
+     * absolute return targets and they need patching.  Concretely, each bb's
+     * fastpath jumps directly into the shared slowpath, which lives in
+     * nonheap_alloc()-ed memory whose address differs per run, and stores a
+     * code cache return address as an immediate (see
+     * shared_slowpath_save_retaddr()).  Both would need relocating in
+     * event_resurrect_ro(); persisting bb_table and the stringop tables, which
+     * instrument_persist_ro() already does, is not enough on its own.
+     * -no_shared_slowpath does not help either: its clean calls make DR refuse
+     * to persist the bbs.
      */
     return (options.persist_code &&
             (!options.shadowing || !options.check_uninitialized));
@@ -105,7 +105,7 @@ OPTION_FRONT_BOOL(front, top_stats, false,
                   "Primarily for use by developers of the tool.  Shows time taken and memory usage of the whole process at the end of the run")
 OPTION_FRONT_BOOL(front, fetch_symbols, false,
                   "Fetch missing symbol files at the end of the run",
-                  "Fetch missing symbol files at the end of the run.  While fetching of arbitrary symbols is off by default, auto-fetching of C library symbols is enabled unless -no_fetch_symbols is explicitly requested.")
+                  "Fetch missing symbol files at the end of the run.  While fetching of arbitrary symbols is off by default, auto-fetching of C library symbols is enabled unless -no_fetch_symbols is explicitly requested.  Fetching starts in the background while the application is still running, with several symbol files fetched at once, and symbol files already in the local symbol store are not fetched again.")
 # endif
 #endif /* TOOL_DR_MEMORY */
 OPTION_FRONT_BOOL(front, follow_children, true,
@@ -162,6 +162,27 @@ OPTION_CLIENT(client, prefix_style, uint, 0, 0, 2,
               "<li>2 = Use blank spaces.  This makes the output compatible "
               " with Visual Studio file and line number parsing.@@"
               "</ul>@@")
+OPTION_CLIENT_BOOL(client, async_results, false,
+                   "Write results and log reports from a sideline thread",
+                   "Queue error reports for results.txt, the potential errors file, and the log files, and write them from a sideline thread rather than from the application thread that hit the error.  Consecutive reports to the same file are combined into one write.  This helps when the log directory is on a slow or networked file system.  Output to stderr is still written immediately.  Everything queued is written before each summary, before -pause_at_* and -crash_at_* take effect, and at exit.  If the queue grows beyond 1MB, application threads write it out themselves until it drains.")
+OPTION_CLIENT_BOOL(client, results_jsonl, false,
+                   "Also write unsymbolized error reports to results.jsonl",
+                   "Write each reported error as one JSON object per line to results.jsonl in the log directory, for machine consumption.  Callstack frames are written as a module id and offset rather than as symbols: the path of each module is written once, in its own record.  The final duplicate count of each error, and the usage count of each suppression that was used, are written at exit.  The symresults tool symbolizes such a file offline and writes it back out as JSON lines or as text.  Suppressions still apply as usual, so the errors in this file are the same as those in results.txt and potential_errors.txt.")
+OPTION_CLIENT_BOOL(client, live_summary, false,
+                   "Publish error and leak counts in a shared memory file",
+                   "Keep the counts shown in the summary in live_summary.bin in the log directory, which is mapped as shared memory and updated as each error is found.  Another process can poll the file at no cost to the application, without a nudge.  Leak counts are as of the last leak scan, which happens at a nudge and at exit.  The layout is described in drmemory/live_summary.h.")
+OPTION_CLIENT_STRING(drmemscope, memlayout_format, "json",
+                     "Format of drmemory_dump_memory_layout() dumps: json, jsonl, or binary",
+                     "Selects the format of the memlayout files written by the drmemory_dump_memory_layout() annotation.  'json' is a single indented JSON object listing every word of every heap object and stack.  'jsonl' writes one compact JSON object per line for each thread, stack, and heap object, with the contents as a hex string and only the words that point into the heap or a stack listed apart.  'binary' writes length-prefixed records holding the raw contents, as described in drmemory/memlayout.h, and leaves resolving pointers to the reader.  Both streaming formats are written through a large buffer, and a dump can be limited with -memlayout_min_size, -memlayout_sample, and -memlayout_changed_only.")
+OPTION_CLIENT(drmemscope, memlayout_min_size, uint, 0, 0, UINT_MAX,
+              "Only dump heap objects of at least this many bytes",
+              "Heap objects smaller than this are left out of memory layout dumps.  They are still used to resolve where the dumped words point.")
+OPTION_CLIENT(drmemscope, memlayout_sample, uint, 1, 1, UINT_MAX,
+              "Only dump one in this many heap objects",
+              "Dumps only about one in this many heap objects in each memory layout dump.  The choice depends only on an object's address, so successive dumps sample the same objects.  Objects left out are still used to resolve where the dumped words point.")
+OPTION_CLIENT_BOOL(drmemscope, memlayout_changed_only, false,
+                   "Only dump heap objects changed since the previous dump",
+                   "Each memory layout dump after the first lists only the heap objects that were allocated or whose contents changed since the previous dump, along with a record of each previously dumped object that has since been freed.  Requires -memlayout_format jsonl or binary.")
 OPTION_CLIENT_BOOL(client, log_suppressed_errors, false,
                    "Log suppressed error reports for postprocessing.",
                    "Log suppressed error reports for postprocessing.  Enabling this option will increase the logfile size, but will allow users to re-process suppressed reports with alternate suppressions or additional symbols.")
@@ -218,6 +239,12 @@ OPTION_CLIENT(client, callstack_max_frames, uint, 20, 0, 4096,
 OPTION_CLIENT(client, malloc_max_frames, uint, 12, 0, 4096,
               "How many call stack frames to record on each malloc",
               "How many call stack frames to record on each malloc, for use in leak error reports as well as alloc/free mismatch error reports (unless leaks are disabled (via -no_count_leaks or -light) and -malloc_callstacks is also disabled).  A larger maximum will ensure that no call stack is truncated, but can use more memory and slow down the tool.")
+OPTION_CLIENT(client, dup_pc_threshold, uint, 0, 0, UINT_MAX,
+              "Shorten call stack walks for errors repeated at one pc",
+              "Once this many duplicates of an error have been found at the same instruction, and every error of that type found there has had the same call stack, later errors of that type at that instruction only walk -dup_pc_frames frames of the call stack and are counted as duplicates of the prior error if those frames match.  This speeds up applications that hit the same error in a loop, at the risk of counting an error that differs only in deeper frames as a duplicate, with that duplicate's suppression status.  0 disables the shortcut.")
+OPTION_CLIENT(client, dup_pc_frames, uint, 4, 0, 4096,
+              "Frames to compare for -dup_pc_threshold",
+              "How many call stack frames to walk and compare to confirm a duplicate error once -dup_pc_threshold is reached.  0 counts every later error of the same type at that instruction as a duplicate without walking the call stack.")
 OPTION_CLIENT(client, free_max_frames, uint, 6, 0, 4096,
               "How many call stack frames to record on each free",
               "If -delay_frees_stack is enabled, this controls how many call stack frames to record for each use-after-free informational report.  A larger maximum will ensure that no call stack is truncated, but can use more memory and slow down the tool.")
@@ -287,6 +314,12 @@ OPTION_CLIENT_EX(client, src_allowlist_frames, src_whitelist_frames, uint, 4, 0,
 OPTION_CLIENT_STRING_EX(drmemscope, check_uninit_blocklist, check_uninit_blacklist, "",
                      ",-separated list of module basenames in which to not check uninits",
                    "For each library or executable basename on this list, Dr. Memory suspends checking of uninitialized reads.  Instead Dr. Memory marks all memory written by such modules as defined.  This is a more efficient way to ignore all errors from a module than suppressing them or adding to the lib_blocklist option.  Dr. Memory does automatically turn a whole-module suppression consisting of a single frame of the form 'modulename!*' into an entry on this list.  The entries on this list can contain wildcards.")
+OPTION_CLIENT_STRING(drmemscope, lib_check_none, "",
+                     ",-separated list of module basenames in which to report no memory errors",
+                     "For each library or executable basename on this list, Dr. Memory reports no errors on memory references made by that module's own code, while still keeping shadow memory consistent.  With -check_uninitialized, memory written by such modules is marked defined as with -check_uninit_blocklist, and addressability is still tracked but unaddressable accesses from these modules are not reported.  Without -check_uninitialized, these modules' memory references are not instrumented at all.  Unlike -lib_blocklist, which only controls how errors are reported, this reduces instrumentation cost.  Errors found in Dr. Memory's replacement routines, such as string functions called by these modules, are still reported.  The entries on this list can contain wildcards.")
+OPTION_CLIENT_STRING(drmemscope, native_summaries, "",
+                     "Path to a file of memory summaries for library routines to run natively",
+                     "Each routine described in this file is run natively, with none of its own memory references instrumented.  Instead, the memory its summary says it reads is checked in bulk when it is called, and the memory its summary says it writes is marked defined when it returns.  Each line names one exported routine as module|function|effect|effect..., where the module can contain wildcards, lines starting with # are ignored, and each effect is 'read <ptr> <size>' or 'write <ptr> <size>'.  A value is argN (the Nth integer or pointer argument, from 0 to 7), *argN (the pointer-sized value argN points to, or *argN:4 for a 4-byte value), ret (the return value, for writes only), or a decimal or 0x-prefixed constant.  Writes are evaluated at the return, so a size can be a length the routine stored.  For example, 'libz.so.1|uncompress|read arg2 arg3|write arg0 *arg1'.  A summarized routine must only touch memory its summary describes, must not allocate or free memory from the application's heap or call back into application code, and must take at most 8 integer or pointer arguments and no floating-point arguments.  On 32-bit Windows it must use the cdecl calling convention.  Errors in the checked memory are reported at the call site.")
 #endif
 
 OPTION_CLIENT_BOOL(client, callstack_use_top_fp, true,
@@ -307,6 +340,14 @@ OPTION_CLIENT_BOOL(client, callstack_conservative, false,
 OPTION_CLIENT(client, callstack_max_scan, uint, 4096, 0, 16384,
               "How far to scan to locate the first or next stack frame",
               "How far to scan to locate the first stack frame when starting in a frameless function, or to locate the next stack frame when crossing loader or glue stub thunks or a signal or exception frame.  Increasing this can produce better callstacks but may incur noticeable overhead for applications that make many allocation calls.")
+#ifdef LINUX
+OPTION_CLIENT_BOOL(client, callstack_use_unwind_info, false,
+              "Walk callstacks using the unwind tables in each library",
+              "Whether to walk callstacks using the .eh_frame unwind tables that compilers emit for exception handling.  This produces accurate frames through code compiled without frame pointers, at a fixed cost per frame, in place of the scanning controlled by -callstack_max_scan.  Frames not covered by unwind tables, such as PLT stubs or libraries without them, are walked with the regular frame pointer and scanning heuristics from that point onward.")
+#endif
+OPTION_CLIENT(client, callstack_fp_cache_size, uint, 256, 4, 65536,
+              "Entries in each thread's cache of stack scan results",
+              "Each thread caches the results of scanning for the next stack frame so that callstacks through frameless functions seen before do not need another -callstack_max_scan scan.  This sets the number of entries in that cache, rounded down to a power of two.  A larger cache can help applications with deep callstacks through frame pointer optimized code.")
 OPTION_CLIENT_STRING(client, callstack_bad_fp_list, IF_WINDOWS_ELSE("", "libstdc++*"),
               ",-separated list of path patterns where frame pointers are untrustworthy",
               "When walking frame pointers and transitioning from any module on this list to a frame not in the same module, the frame pointer chain is assumed to be suspect and a stack scan is performed.  Use this option to avoid missing frames in your application's code that are skipped due to frame pointer optimizations in other libraries.")
@@ -354,9 +395,26 @@ OPTION_CLIENT_BOOL(client, midchunk_string_ok, true,
 OPTION_CLIENT_BOOL(client, scan_read_only_files, false,
                    "Whether the leak scan should scan read-only file-mapped memory",
                    "Whether the leak scan should scan read-only file-mapped memory when looking for pointers to the heap.  The leak scan does not track whether pages have been read-only since they were mapped, so it's possible for the application to store heap pointers in a file-mapped region and then mark it read-only.  If your application does so, you may want to turn on this option.")
+OPTION_CLIENT_BOOL(client, leak_scan_cache_read_only, false,
+                   "Cache the possible heap pointers in read-only memory across leak scans",
+                   "When the leak scan looks for pointers to the heap in readable but not writable memory, record the words of each such region that might point into the heap so that later scans replay just those words instead of reading the whole region again.  A region's record is discarded when memory is mapped, unmapped, or made writable over it, or when the heap grows well beyond its extent at the time of the record.  This helps applications with large read-only mappings, especially with -scan_read_only_files, that request many leak scans via nudges.")
 OPTION_CLIENT_BOOL(client, strings_vs_pointers, true,
                    "Use heuristics to rule out sub-strings as leak scan pointers",
                    "Use heuristics to rule out sub-strings as leak scan pointers, preventing strings from anchoring heap objects and resulting in false negatives.")
+OPTION_CLIENT(client, leak_scan_threads, uint, 0, 0, 64,
+              "Number of helper threads for nudge-time leak scans",
+              "When non-zero, this many additional threads are created at startup to help the thread performing a leak scan requested by a nudge, which can shorten the pause of an application with a large heap.  Scanning for chunks reachable from outside the heap is split across the threads; the identification of indirect leaks, and the leak scan at process exit, are still performed by a single thread.")
+#ifdef LINUX
+OPTION_CLIENT_BOOL(client, leak_scan_incremental, false,
+                   "Skip unmodified pointer-free memory in repeated nudge scans",
+                   "When a leak scan is requested by a nudge, skip pages outside of the heap that held no pointer into the heap at the previous nudge's scan and that the kernel reports have not been written since.  This uses the kernel's soft-dirty page tracking, which is reset for the whole process after each such scan.  If the heap has grown beyond its extent at the prior scan, every page is scanned.  The leak scan at process exit always scans everything.")
+OPTION_CLIENT_BOOL(client, leak_scan_concurrent, false,
+                   "Let the application run during most of a nudge's leak scan",
+                   "When a leak scan is requested by a nudge, suspend the application only to take a snapshot of the heap and of the threads' registers, then let it run while memory is scanned for pointers to the heap, and suspend it again briefly to rescan the registers and the pages that the kernel's soft-dirty page tracking reports were written in the meantime.  Allocations made during the scan are not reported until the next one.  This shortens the pause of an application with a large heap, at a small cost in accuracy for memory that is freed during the scan.  Falls back to a regular scan if soft-dirty tracking is unavailable.  Cannot be combined with -leak_scan_incremental.  The leak scan at process exit is always performed with the application stopped.")
+#endif
+OPTION_CLIENT_BOOL(client, leak_growth, false,
+                   "List the leaks that grew since the previous nudge",
+                   "After the leak scan requested by each nudge, list in the results file the leaks whose total size grew since the previous nudge's scan (or since startup, for the first nudge), by error number and with the largest growth first.  Only each leak's size at the prior scan is kept in between, so no earlier report needs to be re-read.  Requires -check_leaks.")
 OPTION_CLIENT_BOOL(client, show_reachable, false,
                    "List reachable allocs",
                    "Whether to list reachable allocations when leak checking.  Requires -check_leaks.")
@@ -366,6 +424,9 @@ OPTION_CLIENT_STRING_REPEATABLE(client, suppress, "",
 OPTION_CLIENT_BOOL(client, default_suppress, true,
                    "Use the set of default suppressions",
                    "Use the set of default suppressions that come with "TOOLNAME".  See \\ref page_suppress.")
+OPTION_CLIENT_BOOL(client, lazy_suppress, false,
+                   "Read the suppression files when the first error is found",
+                   "By default, "TOOLNAME" reads and parses the default and user suppression files at startup.  With this option, they are not read until the first error is found, which benefits applications such as build systems that launch many short-lived child processes that report no errors.  When no error is found, the list of suppressions used at the end of the results file omits the whole-library suppressions whose counts are unavailable, and the number of suppressions recorded is printed only once the files are read.")
 OPTION_CLIENT_BOOL(client, gen_suppress_offs, true,
                    "Generate mod+offs suppressions in the output suppress file",
                    "Generate mod+offs suppressions in addition to mod!sym suppressions in the output suppress file")
@@ -390,6 +451,9 @@ OPTION_CLIENT_BOOL(drmemscope, check_uninit_cmps, true,
                     */
                    "Check definedness of comparison instructions",
                    "Report definedness errors on compares instead of waiting for conditional jmps.")
+OPTION_CLIENT_BOOL(internal, defer_uninit_cmps, false,
+                   "Check compares' definedness at the flags consumer",
+                   "With -check_uninit_cmps, a compare that writes only the arithmetic flags propagates its sources' definedness into the shadow flags instead of checking them inline, and the conditional jump, conditional move, or loop that reads the flags does the check.  This removes the checks of compares whose flags are never read, at the cost of reporting an error at the consumer rather than at the compare.")
 OPTION_CLIENT_BOOL(drmemscope, check_uninit_non_moves, false,
                    /* XXX: should also support different checks on a per-module
                     * basis to be more stringent w/ non-3rd-party code?
@@ -402,6 +466,9 @@ OPTION_CLIENT_BOOL(drmemscope, check_uninit_all, false,
 OPTION_CLIENT_BOOL(drmemscope, strict_bitops, false,
                    "Fully check definedness of bit operations",
                    "Currently, Dr. Memory's definedness granularity is per-byte.  This can lead to false positives on code that uses bitfields.  By default, Dr. Memory relaxes its uninitialized checking on certain bit operations that are typically only used with bitfields, to avoid these false positives.  However, this can lead to false negatives.  Turning this option on will eliminate all false negatives (at the cost of potential false positives).  Eventually Dr. Memory will have bit-level granularity and this option will go away.")
+OPTION_CLIENT_BOOL(internal, fastpath_bitfields, false,
+                   "Apply the bitfield relaxations for immediates in the fastpath",
+                   "When -strict_bitops is off, treat the result of an or with an immediate, and of an and with a bitmask immediate that clears one contiguous run of bits, as defined directly in the fastpath, rather than exiting to the slowpath whenever the other source is undefined.  The results match the slowpath's bitfield handling.")
 OPTION_CLIENT_BOOL(drmemscope, check_pc, true,
                    "Check the program counter for unaddressable execution",
                    "Check the program counter on each instruction to ensure it is executing from valid memory.")
@@ -417,6 +484,12 @@ OPTION_CLIENT_SCOPE(drmemscope, report_max, int, 20000, -1, INT_MAX,
 OPTION_CLIENT_SCOPE(drmemscope, report_leak_max, int, 10000, -1, INT_MAX,
                     "Maximum leaks to report (-1=no limit)",
                     "Maximum leaks to report (-1=no limit).  This includes 'potential' leaks listed separately.")
+OPTION_CLIENT_SCOPE(drmemscope, report_site_max, int, -1, -1, INT_MAX,
+                    "Maximum non-leak errors to count at one instruction (-1=no limit)",
+                    "Maximum non-leak errors, including duplicates, to count at any one instruction (-1=no limit).  Later errors at that instruction are only tallied, without walking the call stack, and are listed in the summary as beyond -report_site_max.  See also -saturate_sites.")
+OPTION_CLIENT_BOOL(drmemscope, saturate_sites, false,
+                   "Stop checking instructions that reach an error limit",
+                   "When an instruction exceeds -report_site_max, or reports an error after -report_max has been reached, flush its code and re-instrument it so that unaddressable accesses there are no longer checked, as though they were alloca probes.  This lets an application with a known noisy bug run at normal speed while being tested for other errors.  Unaddressable accesses at such an instruction are no longer counted at all.  Other error types there continue to be checked but are only tallied as for -report_site_max.")
 OPTION_CLIENT_BOOL(drmemscope, report_write_to_read_only, true,
                    "Report writes to read-only memory as unaddressable errors",
                    "Report writes to read-only memory as unaddressable errors.")
@@ -439,6 +512,12 @@ OPTION_CLIENT_STRING(drmemscope, symcache_dir, "<install>/logs/symcache",
 OPTION_CLIENT(client, symcache_minsize, uint, 1000, 0, UINT_MAX,
                    "Minimum module size to cache symbols for",
                    "Minimum module size to cache symbols for.  Note that there's little downside to caching and it is pretty much always better to cache.")
+OPTION_CLIENT(client, symcache_max_mb, uint, 0, 0, UINT_MAX,
+              "Maximum size in MB of the symbol cache directory",
+              "If non-zero, at exit the symbol cache files of the least recently used modules are deleted to keep the files in -symcache_dir under this many megabytes.  Modules used by the exiting process are kept.  Only modules used since this option was first enabled are counted.")
+OPTION_CLIENT(client, symcache_negative_runs, uint, 0, 0, UINT_MAX,
+              "Drop negative symbol cache entries unused for this many runs",
+              "If non-zero, when a module's symbol cache file is rewritten, entries recording that a symbol is not present are dropped once this many rewrites in a row have been by runs that did not look them up.  This keeps files from accumulating entries for symbols that are no longer queried.")
 OPTION_CLIENT_BOOL(drmemscope, use_symcache_postcall, true,
                    "Cache post-call sites to speed up future runs",
                    "Cache post-call sites to speed up future runs.  Requires -use_symcache to be true.")
@@ -446,10 +525,16 @@ OPTION_CLIENT_BOOL(drmemscope, use_symcache_postcall, true,
 OPTION_CLIENT_BOOL(drmemscope, preload_symbols, false,
                    "Preload debug symbols on module load",
                    "Preload debug symbols on module load.  Debug symbols cannot be loaded during leak reporting on Vista, so this option is on by default on Vista.  This option may cause excess memory usage from unneeded debugging symbols.")
+OPTION_CLIENT(drmemscope, preload_symbols_threads, uint, 1, 0, 16,
+              "Number of sideline threads that load symbols for -preload_symbols",
+              "When non-zero, -preload_symbols loads each module's debug symbols on one of this many sideline threads rather than on the application thread that loaded the module, so that the loading overlaps with application execution.  Loads still pending at exit are completed before the exit-time leak scan.  Symbol loading is largely serialized inside the symbol library, so more than one thread rarely helps.  When zero, symbols are loaded synchronously at module load.")
 OPTION_CLIENT_BOOL(drmemscope, skip_msvc_importers, true,
                    "Do not search for alloc routines in modules that import from msvc*",
                    "Do not search for alloc routines in modules that import from msvc*")
 #endif /* WINDOWS */
+OPTION_CLIENT_BOOL(drmemscope, lazy_alloc_syms, false,
+                   "Search each library for alloc routines on its first execution",
+                   "By default, "TOOLNAME" searches each library for allocation routines when the library is loaded, which for an application that loads many libraries, or libraries with large symbol files, is a large part of startup time.  With this option, the search of a library other than the C and C++ libraries is deferred until the application first executes code inside it, and libraries that are never executed are never searched.  The C and C++ libraries are always searched at load time.")
 OPTION_CLIENT_BOOL(drmemscope, warn_null_ptr, false,
                    "Warn if NULL passed to free/realloc",
                    "Whether to warn when NULL is passed to free() or realloc().")
@@ -459,12 +544,29 @@ OPTION_CLIENT_SCOPE(drmemscope, delay_frees, uint, 2000, 0, UINT_MAX,
 OPTION_CLIENT_SCOPE(drmemscope, delay_frees_maxsz, uint, 20000000, 0, UINT_MAX,
                     "Maximum size of frees to delay before committing",
                     "Maximum size of frees to delay before committing.  The larger this number, the greater the likelihood that "TOOLNAME" will identify use-after-free errors.  However, the larger this number, the more memory will be used.  This value is separate for each set of allocation routines and each Windows Heap.")
+OPTION_CLIENT_SCOPE(drmemscope, guard_page_min_size, uint, 0, 0, UINT_MAX,
+                    "Minimum allocation size to place against a guard page",
+                    "Only applies to -replace_malloc.  When non-zero, each allocation of at least this many bytes that is large enough to be given its own memory mapping (currently 128KB and above) is placed so that it ends right before an inaccessible page, in place of its redzones.  An overflow past its end then faults and is reported as an unaddressable access, without needing any shadow or pattern checks of its own, which benefits -light in particular.  The application is not allowed to continue past such an overflow, and alignment padding at the end of the allocation, which is smaller than the allocation's alignment, is not covered by the inaccessible page.  Underflows are not detected for these allocations, beyond the allocator's own header checks.")
+OPTION_CLIENT_SCOPE(drmemscope, sample_allocs, uint, 0, 0, 1024*1024*1024,
+                    "Check a random one in this many allocations using guard pages only",
+                    "When non-zero, puts "TOOLNAME" into a low-overhead sampling mode suited to long-running or production use.  Memory references are not instrumented, as with -leaks_only.  Instead, a random one in every N allocations, on average, where N is this value, is given its own memory mapping and placed so that it ends right before an inaccessible page, as with -guard_page_min_size.  When such an allocation is freed, its memory is made inaccessible and its unmapping is delayed for the next 256 such frees.  An overflow past the end of a sampled allocation, or a use of one after it is freed, then faults and is reported as an unaddressable access, with the free callstack for a use after free.  The application is not allowed to continue past such an access.  Each sampled allocation uses at least two pages of memory, so small values of N should be avoided.  Requires -replace_malloc.")
+OPTION_CLIENT_SCOPE(drmemscope, heap_profile_sample_rate, uint, 0, 0, UINT_MAX,
+                    "Profile the heap by sampling one in this many bytes allocated",
+                    "When non-zero, records the callstack of a random sample of allocations, chosen so that on average one in every N bytes allocated is sampled, where N is this value, in the manner of tcmalloc's heap profiler.  Each sample is scaled by the inverse of its probability of being chosen to estimate the live, peak, and total heap allocated from each callstack, which is written to a heap_profile file in the log directory at each leak-scan nudge and at exit.  Only sampled allocations pay for a callstack walk unless callstacks are needed for other reasons, as they are with -count_leaks, so the savings apply with -no_count_leaks.  A reallocation in place keeps the size of its original sample.  Values that are small relative to typical allocation sizes sample most allocations.")
+#ifdef LINUX
+OPTION_CLIENT_SCOPE(drmemscope, thread_arenas, uint, 0, 0, 1024,
+                    "Maximum number of per-thread heap arenas",
+                    "Only applies to -replace_malloc.  When non-zero, each thread allocates from its own heap arena, up to this many arenas, after which threads share the least-used arena.  This reduces lock contention in applications with many threads that allocate concurrently, at the cost of additional memory.  Memory freed by a thread other than the one that allocated it is returned to the allocating thread's arena.  -delay_frees and -delay_frees_maxsz still apply across all arenas together, though the delayed frees are released in small per-arena batches and so the quota can be briefly exceeded.")
+OPTION_CLIENT_BOOL(drmemscope, numa_arenas, false,
+                   "Place per-thread heap arenas on the thread's NUMA node",
+                   "Only applies to -thread_arenas.  Each new per-thread arena belongs to the NUMA node of the CPU that the thread first using it is running on, and its memory is set to prefer that node.  A thread is then handed an arena of its own node, falling back to the least-used arena of any node once -thread_arenas arenas exist.  A thread that later migrates to another node keeps its arena.  The shadow memory for the heap is not bound explicitly, but is normally first written, and thus placed, by the allocating thread.  This reduces cross-node memory traffic on multi-socket machines.")
+#endif
 OPTION_CLIENT_BOOL(drmemscope, delay_frees_stack, true,
                    "Record callstacks on free to use when reporting use-after-free",
                    "Record callstacks on free to use when reporting use-after-free or other errors that overlap with freed objects.  There is a slight performance hit incurred by this feature for malloc-intensive applications.  The callstack size is controlled by -free_max_frames.")
 OPTION_CLIENT_BOOL(drmemscope, leaks_only, false,
                    "Check only for leaks and not memory access errors",
-                   "Puts "TOOLNAME" into a leak-check-only mode that has lower overhead but does not detect other types of errors other than invalid frees.")
+                   "Puts "TOOLNAME" into a leak-check-only mode that has lower overhead but does not detect other types of errors other than invalid frees.  With -replace_malloc, malloc chunks get no redzones in this mode unless -redzone_size is specified.")
 #ifdef WINDOWS
 OPTION_CLIENT_BOOL(drmemscope, handle_leaks_only, false,
                    "Check only for handle leak errors and no other errors",
@@ -486,6 +588,39 @@ OPTION_CLIENT_BOOL(drmemscope, check_alignment, false,
 OPTION_CLIENT_BOOL(drmemscope, fault_to_slowpath, true,
                    "For -no_check_uninitialized, use faults to exit to slowpath",
                    "Only applies for -no_check_uninitialized.  Determines whether to use faulting instructions rather than explicit jump-and-link to exit from fastpath to slowpath.")
+OPTION_CLIENT_BOOL(drmemscope, track_origins, false,
+                   "Report where uninitialized heap memory was allocated",
+                   "Only applies for -check_uninitialized.  For uninitialized read errors on heap memory, adds the callstack of the allocation containing the uninitialized bytes to the report.  This records a callstack on each allocation, as -malloc_callstacks does.  Errors on values that were first loaded into registers do not include an origin.")
+OPTION_CLIENT(drmemscope, slowpath_profile, uint, 0, 0, 4096,
+              "Report the N instructions that most often take the slowpath",
+              "When non-zero, counts how often each application instruction leaves the inlined fastpath for the slowpath, along with the likely reason (an unaddressable, unaligned, or partially undefined memory operand, an undefined source, or an instruction the fastpath does not handle), and writes the N most frequent ones with symbolized locations to the global log file at exit.  This is intended for finding gaps in fastpath coverage and for tuning -loads_use_table and -stores_use_table.")
+OPTION_CLIENT_BOOL(drmemscope, slowpath_decode_cache, false,
+                   "Cache decoded instructions for the slowpath",
+                   "Keeps each thread's recently decoded slowpath instructions in a small table keyed by address, so an instruction that repeatedly exits the fastpath is not decoded again on every slowpath entry.  A cached instruction is used only if its bytes are unchanged.  This helps applications whose slowpath is dominated by a few hot instructions, such as those with many partially undefined or unaligned accesses.")
+OPTION_CLIENT_BOOL(drmemscope, profile_tool, false,
+                   "Report where the tool's own time goes",
+                   "Times the tool's expensive phases with the processor's cycle counter: the slowpath, callstack walks, heap routine handling, leak scans, error reports, and symbol lookups.  Cycles are accumulated per thread and a breakdown summed over all threads is written to the global log file at exit and on each nudge.  Each phase's time includes any nested phases, such as symbol lookups made while reporting an error.  This is intended for finding which part of the tool dominates the slowdown of a particular application.")
+OPTION_CLIENT(client, live_stats_interval, uint, 0, 0, UINT_MAX,
+              "Write a line of tool counters every N milliseconds",
+              "When non-zero, a separate thread appends a compact line of counters to live_stats.log in the log directory every N milliseconds: the elapsed time, the number of threads seen, the bytes in application heap regions, the memory allocated by DynamoRIO itself including its code caches, and the normal shadow memory in use.  Builds with statistics enabled also write the tool's own heap usage and its basic block, slowpath, malloc, and free counts.  The file is renamed to live_stats.log.old once it grows past 4MB.  Unlike -stats_dump_interval, this does not depend on the application executing the slowpath, and no work is done on application threads.")
+OPTION_CLIENT(drmemscope, tiered_threshold, uint, 0, 0, UINT_MAX,
+              "Fully check a basic block only after it executes N times",
+              "Only applies for -check_uninitialized.  When non-zero, each basic block is first instrumented with only an execution counter plus addressability checks, with all values it writes marked defined, and is re-instrumented with full definedness checking once it has executed N times.  This reduces the cost of code that runs only a few times, such as startup code, at the price of missing uninitialized reads in that code and in the values it copies.  Use -tiered_full_modules to fully check selected modules from the start.")
+OPTION_CLIENT_STRING(drmemscope, tiered_full_modules, "",
+                     ",-separated list of module basenames to fully check from the start",
+                     "Only applies when -tiered_threshold is non-zero.  Basic blocks in modules whose basename matches an entry on this list skip the counting tier and are fully checked on their first execution.  The entries on this list can contain wildcards.")
+OPTION_CLIENT_BOOL(drmemscope, tiered_compact, false,
+                   "Check memory references of not-yet-hot blocks out of line",
+                   "Only applies when -tiered_threshold is non-zero.  Each memory reference in a basic block that has not yet executed -tiered_threshold times is checked by a short jump into the shared, register-specialized slowpath entries rather than by an inline fastpath sequence, which makes such blocks several times smaller in the code cache.  Blocks are given the inline fastpath once they become hot.  On large applications most blocks never become hot, so this reduces pressure on the code cache and on the instruction cache and TLB, at the price of a slowpath execution for each cold memory reference.  The slowpath checks definedness in full, so cold memory references are checked as they would be without -tiered_threshold.  Only supported on x86 with -shared_slowpath.")
+OPTION_CLIENT_BOOL(drmemscope, startup_addr_only, false,
+                   "Check only addressability until main or the first new thread",
+                   "Only applies for -check_uninitialized.  Code executed before the application reaches its main routine or creates its first additional thread, which includes the loader and static constructors, is checked for addressability only, with all values it writes marked defined, as for modules on -check_uninit_blocklist.  At that point all code is flushed from the code cache and is re-instrumented with full definedness checking.  This shortens startup, at the price of missing uninitialized reads in startup code and in the values it copies.  If the executable has no main symbol, only thread creation ends the startup phase.")
+OPTION_CLIENT_BOOL(drmemscope, jit_addr_only, false,
+                   "Check only addressability in code outside of any module",
+                   "Only applies for -check_uninitialized.  Code that is not part of any library or executable, such as code generated by a JavaScript or Lua JIT, is checked for addressability only, with all values it writes marked defined, as for modules on -check_uninit_blocklist.  Such code is typically generated and invalidated often, and this makes each of its many instrumentation passes cheaper, at the price of missing uninitialized reads in that code and in the values it copies.")
+OPTION_CLIENT_BOOL(drmemscope, jit_tier_by_content, false,
+                   "Key -tiered_threshold counts outside of modules by code contents",
+                   "Only applies when -tiered_threshold is non-zero.  Basic blocks outside of any module, such as JIT-generated code, have their execution counts and tier decisions keyed by a hash of their code bytes rather than by their address.  A stub that a JIT regenerates with identical code, at the same or a different address, keeps the count and tier of its earlier copies, so a hot stub is fully instrumented right away rather than counted and re-instrumented again, while new code written over an old stub's address does not inherit its count.  Distinct blocks whose hashes collide share a tier, which only affects performance.  Code checked by -jit_addr_only has no tiers.")
 #ifdef WINDOWS
 OPTION_CLIENT_BOOL(internal, check_tls, true,
                    "Check for access to un-reserved TLS slots",
@@ -555,6 +690,12 @@ OPTION_CLIENT_BOOL(drmemscope, perturb_only, false,
 OPTION_CLIENT_SCOPE(drmemscope, perturb_max, uint, 50, 0, UINT_MAX,
                     "Maximum delay added by -perturb",
                     "This option sets the maximum delay added by -perturb, in milliseconds for thread operations and in custom units for instruction-level operations.  Delays added will be randomly selected from 0 up to -perturb_max.")
+OPTION_CLIENT_SCOPE(drmemscope, perturb_rate, uint, 1, 1, 1024*1024*1024,
+                    "Synchronization instructions per instruction-level -perturb delay",
+                    "On average only one in this many synchronization instructions executed by each thread is delayed by -perturb.  The others pass through an inlined countdown without leaving the code cache, so a larger value perturbs less often at far lower overhead.  Thread and system call delays are not affected.")
+OPTION_CLIENT_BOOL(drmemscope, perturb_record, false,
+                   "Record the delays added by -perturb",
+                   "Writes the seed and then every delay added by -perturb to perturb.<pid>.log in the log directory, one line per delay giving the thread's creation order, the delay's index within that thread, the type of operation, and the delay amount.  Each thread draws its delays from its own random sequence derived from the seed and its creation order, so passing the recorded seed to -perturb_seed replays the same delays as long as the threads are created in the same order.")
 OPTION_CLIENT_SCOPE(drmemscope, perturb_seed, uint, 0, 0, UINT_MAX,
                     "Seed used for random delays added by -perturb",
                     "To reproduce the random delays added by -perturb, pass the seed from the logfile from the target run to this option.  There may still be non-determinism in the rest of the system, however.")
@@ -591,6 +732,9 @@ OPTION_CLIENT_STRING(drmemscope, syscall_number_path, "",
 OPTION_CLIENT_BOOL(drmemscope, coverage, false,
                    "Measure and provide code coverage information",
                    "Measure code coverage during application execution.  The resulting data is written to a separate file named with a 'drcov' prefix in the same directory as Dr. Memory's other results files.  The raw data can be turned into a human-readable format using the drcov2lcov utility.")
+OPTION_CLIENT_BOOL(drmemscope, coverage_stream, false,
+                   "Stream code coverage to disk as it is found",
+                   "Implies -coverage.  Rather than keeping all coverage in memory until exit, each thread buffers the basic blocks it has not seen before and appends them to a compact stream file with a 'drcov' prefix and a 'stream' suffix in the log directory whenever its buffer fills.  A block is recorded just once, when it is first built, so blocks already covered cost nothing.  At exit the stream is merged into the same drcov file produced by -coverage and is then deleted.  If the process is killed before exit the stream file is left behind, holding all blocks but those still buffered along with the modules they are in; its format is described in drmemory/covstream.h.")
 OPTION_CLIENT_BOOL(drmemscope, fuzz, false,
                    "Enable fuzzing by Dr. Memory",
                    "Enable fuzzing by Dr. Memory.  See the other fuzz_* options for all of the different fuzzing options.")
@@ -657,10 +801,39 @@ OPTION_CLIENT_STRING(drmemscope, fuzz_corpus, "",
                      "Load a corpus of input data files from the specified directory, perform coverage based fuzzing, and dump input data that causes more coverage.")
 OPTION_CLIENT_STRING(drmemscope, fuzz_corpus_out, "",
                      "Create and store the minimized corpus inputs from -fuzz_corpus to -fuzz_corpus_out",
-                     "Create the minimized corpus inputs from -fuzz_corpus and dump them to the directory specified by -fuzz_corpus_out.")
+                     "Create the minimized corpus inputs from -fuzz_corpus and dump them to the directory specified by -fuzz_corpus_out.  With -fuzz_edge_coverage, also add each input that reaches new edges to this directory, even without -fuzz_corpus.")
+OPTION_CLIENT_BOOL(drmemscope, fuzz_corpus_minimize, false,
+                   "Only replay -fuzz_corpus to write a minimized corpus to -fuzz_corpus_out",
+                   "Replay each -fuzz_corpus input once, with no mutation, and write each input that reaches new coverage to -fuzz_corpus_out.  Smaller inputs are replayed first, so of several inputs with the same coverage the smallest tends to be kept.  With -fuzz_threads, the inputs are spread across the fuzzing threads.  Use -fuzz_edge_coverage for a smaller and more precise result than basic block counts.  -fuzz_num_iters does not apply, and the application's own call to the target runs once all inputs have been replayed.")
 OPTION_CLIENT_BOOL(drmemscope, fuzz_coverage, false,
                    "Enable basic block coverage guided fuzzing.",
                    "Enable basic block coverage guided fuzzing for the default bit-flip based mutator.  A custom mutator that implements drfuzz_mutator_feedback must use this option to enable the coverage feedback guided mutation.")
+OPTION_CLIENT_BOOL(drmemscope, fuzz_edge_coverage, false,
+                   "Enable edge coverage guided fuzzing.",
+                   "Enable control flow edge coverage guided fuzzing.  Each basic block records the edge that reached it into a per-thread hashed bitmap with a short inline sequence, and after each iteration the edges are merged into a bitmap shared by all fuzzing threads.  The number of new edges is passed to drfuzz_mutator_feedback, and replaces the basic block count for deciding which inputs to add to the corpus (see -fuzz_corpus and -fuzz_corpus_out).  Implies -fuzz_coverage.")
+OPTION_CLIENT_SCOPE(drmemscope, fuzz_threads, uint, 1, 1, UINT_MAX,
+                    "Number of threads that may fuzz the target concurrently",
+                    "Number of application threads that may fuzz the target concurrently.  Each of the first -fuzz_threads threads to call the target repeats it with its own mutator, input buffer and shadow state, so the target must be thread-safe.  -fuzz_num_iters applies to each thread.  With -fuzz_corpus, the threads share the corpus: each corpus input is executed by one thread, and an input is added to the corpus only when it increases the target's basic block coverage seen by all threads.  Without -fuzz_corpus, threads fuzzing identical inputs with identical mutator options will try the same values.")
+#ifdef LINUX
+OPTION_CLIENT_BOOL(drmemscope, fuzz_iteration_arena, false,
+                   "Discard the target's heap allocations after each fuzz iteration",
+                   "Only applies to -replace_malloc.  Each fuzz iteration allocates from a separate heap arena, and at the end of the iteration every allocation still live in that arena is freed at once and the arena is reused by the next iteration.  This keeps the heap from growing over a long fuzzing run and keeps one iteration's allocations from being reported as leaks or reached by later iterations.  Only use this when the target does not hand out memory allocated during an iteration that is used after the iteration: any such access is reported as a use-after-free.  Use -fuzz_iteration_leaks to report leaks in an iteration before its allocations are freed.")
+OPTION_CLIENT_SCOPE(drmemscope, fuzz_fork_server, uint, 0, 0, UINT_MAX,
+                    "Run fuzz iterations in forked children, this many per child",
+                    "If non-zero, once the first iteration of a fuzz pass completes, the fuzzing thread forks a child process at the target's entry instead of repeating the target itself.  The child runs the next -fuzz_fork_server iterations and then exits, and the parent waits for it and forks the next child until the pass is complete.  Each child starts from the state of the process at the fork, so iterations run in different children cannot affect each other through global or heap state, and a crash ends only that child.  Children write their own logs and results into new log directories, as for any forked process, and the number of children that crashed or reported errors is noted in the parent's log.  Coverage found by a child does not guide the parent's mutator.  Requires -fuzz_threads 1 and cannot be used with -fuzz_corpus.  Supported on x86 only.")
+#endif
+OPTION_CLIENT_BOOL(drmemscope, fuzz_reset_globals, false,
+                   "Restore the target module's global state before each fuzz iteration",
+                   "Save the writable memory of the target module, along with its shadow state, at the start of each fuzz pass, and before each subsequent iteration of the pass restore every page that the previous iteration changed.  This makes iterations of a target that keeps state in global variables, e.g., caches or static counters, independent of each other.  Pages are found to be changed by comparing them with the saved copy, so a write that only changes the shadow state of a page is not undone.  Memory outside of the target module, such as the heap (see -fuzz_iteration_arena) or other libraries' globals, is not restored.  Requires -fuzz_threads 1.")
+OPTION_CLIENT_BOOL(drmemscope, fuzz_iteration_leaks, false,
+                   "Check for leaks after each fuzz iteration",
+                   "Perform a leak scan, as done by a nudge, at the end of each fuzz iteration.  This is expensive, but with -fuzz_iteration_arena it is the only way to find leaks in the target, as the allocations left from an iteration are freed once it completes.  Leaks are reported just once per allocation callstack, and the scan covers the whole heap.")
+OPTION_CLIENT_SCOPE(drmemscope, fuzz_error_buckets, uint, 0, 0, 64,
+                    "Report only the first error found while fuzzing with the same top N frames",
+                    "If non-zero, each error found while a fuzz target is executing is placed in a bucket identified by its type and the top -fuzz_error_buckets frames of its call stack, which are the only frames walked to find the bucket.  Only the first error in a bucket is reported in full, with its fuzz input dumped as for -fuzz_dump_on_error; later errors in the bucket are only counted, and the number of buckets and of errors counted in them is printed at exit.  With -fuzz_fork_server the buckets are shared by the fork server and all of its children, so an error found by one child is not reported again by later children.  Errors are bucketed before suppressions are matched, so an error whose top frames match those of a suppressed error is counted in the suppressed error's bucket.  0 disables bucketing.")
+OPTION_CLIENT_BOOL(drmemscope, fuzz_live_stats, false,
+                   "Publish fuzzing statistics in a shared memory file",
+                   "Keep counts of fuzz target executions, new edges, corpus inputs written, and errors found, along with the target's basic block count and -fuzz_fork_server child counts, in fuzz_stats.bin in the log directory.  The file is mapped as shared memory and updated by each fuzzing thread without locking, so another process can poll it to compute executions per second and follow the fuzzer's progress at no cost to the application.  The file is shared with -fuzz_fork_server children.  The layout is described in drmemory/fuzz_stats.h.")
 /* long comment includes HTML escape characters (http://www.doxygen.nl/htmlcmds.html) */
 OPTION_CLIENT_STRING(drmemscope, fuzz_target, "",
                      "Fuzz test the target program according to the specified descriptor"NL
@@ -726,6 +899,9 @@ OPTION_CLIENT_SCOPE(drmemscope, fuzz_mutator_random_seed, uint64, 0x5a8390e9a31d
 OPTION_CLIENT_STRING(drmemscope, fuzz_dictionary, "",
                      "Specify a dictionary containing tokens for mutation",
                      "Specify a dictionary file listing tokens to use for mutation by insertion into the input buffer.  The file must be a text file with one double-quote-delimited token per line.  Specifying this option automatically selects -fuzz_mutator_unit token.")
+OPTION_CLIENT_BOOL(drmemscope, fuzz_cmp_dictionary, false,
+                   "Add values the fuzz target compares against to -fuzz_dictionary",
+                   "Record the immediate operands of the compare instructions in code first executed while fuzzing, such as magic numbers and tags that the target checks its input against, and add each one to the -fuzz_dictionary of the mutator before its next mutation.  Values compared from memory, such as strings passed to strcmp, are not recorded.  Requires -fuzz_dictionary and cannot be used with -fuzz_fork_server.  Supported on x86 only.")
 
 OPTION_CLIENT_STRING(drmemscope, fuzz_one_input, "",
                      "Specify one fuzz input value to test."NL
@@ -763,6 +939,11 @@ OPTION_CLIENT_BOOL(internal, use_stderr, true,
 OPTION_CLIENT_BOOL(internal, shadowing, true,
                    "Enable memory shadowing",
                    "For debugging and -leaks_only and -perturb_only modes: can disable all shadowing and do nothing but track mallocs")
+#if defined(LINUX) && defined(X64)
+OPTION_CLIENT_BOOL(internal, shadow_huge_pages, false,
+                   "Request transparent huge pages for shadow memory",
+                   "Asks the kernel to back shadow memory with transparent huge pages, reducing TLB misses in the instrumentation for applications with large heaps at the cost of a potentially larger shadow memory footprint.  Falls back to normal pages if transparent huge pages are unavailable.")
+#endif
 OPTION_CLIENT_BOOL(internal, track_allocs, true,
                    "Enable malloc and alloc syscall tracking",
                    "for debugging and -leaks_only and -perturb_only modes: can disable all malloc and alloc syscall tracking")
@@ -782,6 +963,9 @@ OPTION_CLIENT_BOOL(internal, fastpath, true,
 OPTION_CLIENT_BOOL(internal, esp_fastpath, IF_X64_ELSE(false, true),
                    "Enable esp-adjust fastpath",
                    "Enable esp-adjust fastpath")
+OPTION_CLIENT(internal, esp_bulk_threshold, uint, 0x4000, 0, INT_MAX,
+              "Stack adjustments larger than this go to the bulk shadow update",
+              "The esp-adjust fastpath updates shadow memory one shadow dword at a time.  Stack pointer adjustments by more than this many bytes, such as large stack frames or alloca, instead go to the esp-adjust slowpath, which sets whole shadow blocks at once.  0 disables the bulk update.")
 OPTION_CLIENT_BOOL(internal, shared_slowpath, true,
                    "Enable shared slowpath calling code",
                    "Enable shared slowpath calling code")
@@ -794,6 +978,9 @@ OPTION_CLIENT_BOOL(internal, stores_use_table, true,
 OPTION_CLIENT(internal, num_spill_slots, uint, 6, 0, 16,
               "How many of our own spill slots to use",
               "How many of our own spill slots to use")
+OPTION_CLIENT_BOOL(internal, scratch_reg_liveness, false,
+                   "Pick whole-bb scratch registers by liveness-based spill cost",
+                   "When picking the two scratch registers that are spilled across a whole basic block, count the restores and saves that each candidate would actually need within the block, using liveness, rather than its raw number of uses.  A register whose written value is dead before its next read is then preferred.")
 OPTION_CLIENT_BOOL(internal, check_ignore_unaddr, true,
                    "Suppress instrumentation (vs dynamic exceptions) for heap code",
                    "Suppress instrumentation (vs dynamic exceptions) for heap code.  PR 578892: this is now done dynamically and is pretty safe")
@@ -830,12 +1017,18 @@ OPTION_CLIENT_STRING(internal, libc_addrs, "",
                       */
                      "Addresses of statically-included libc routines for replacement.",
                      "Addresses of statically-included libc routines for replacement.  Must be a comma-separated list of hex addresses with 0x prefixes,  in this order: memset, memcpy, memchr, strchr, strrchr, strlen, strcmp, strncmp, strcpy, strncpy, strcat, strncat")
+OPTION_CLIENT(internal, replace_bulk_size, uint, 4096, 0, UINT_MAX,
+              "Minimum size for handling replaced memcpy, memmove, and memset in bulk",
+              "Calls to the replaced memcpy, memmove, and memset routines of at least this many bytes, whose memory is fully addressable, are performed natively and have their shadow values copied or set in a single operation rather than executing the instrumented byte loops.  Calls touching unaddressable memory fall back to the loops so that errors are reported as usual.  0 disables bulk handling.")
 OPTION_CLIENT_BOOL(internal, check_push, true,
                    "Check that pushes are writing to unaddressable memory",
                    "Check that pushes are writing to unaddressable memory")
 OPTION_CLIENT_BOOL(internal, repstr_to_loop, true,
                    "Add fastpath for rep string instrs by converting to normal loop",
                    "Add fastpath for rep string instrs by converting to normal loop")
+OPTION_CLIENT(internal, repstr_bulk_threshold, uint, 256, 0, UINT_MAX,
+              "Minimum size for handling -repstr_to_loop movs and stos in bulk",
+              "Rep movs and rep stos instances, converted to loops by -repstr_to_loop, that touch at least this many bytes of fully addressable memory with defined registers are performed natively and have their shadow values copied or set in a single operation rather than executing the instrumented loop.  Instances touching unaddressable memory fall back to the loop so that errors are reported as usual.  Only applies with -check_uninitialized.  0 disables bulk handling.")
 OPTION_CLIENT_BOOL(internal, replace_realloc, true,
                    "Replace realloc to avoid races and non-delayed frees",
                    "Replace realloc to avoid races and non-delayed frees")
@@ -853,6 +1046,9 @@ OPTION_CLIENT(internal, share_xl8_max_diff, uint, 2048, 0, SHADOW_REDZONE_SIZE*4
 OPTION_CLIENT(internal, share_xl8_max_flushes, uint, 64, 0, UINT_MAX,
               "How many flushes before abandoning sharing altogether",
               "How many flushes before abandoning sharing altogether")
+OPTION_CLIENT_BOOL(internal, fastpath_unaligned_xmm, false,
+                   "Keep 4-byte-aligned 16-byte xmm memory references on the fastpath",
+                   "By default a 16-byte memory reference, such as a movdqu or movups load or store of an xmm register, is only handled in the fastpath when it is 16-byte aligned, and goes to the slowpath otherwise.  When this option is enabled, a 16-byte reference only needs 4-byte alignment, which still covers exactly four shadow bytes, so vectorized copy loops over unaligned buffers keep propagating their shadow values with one 4-byte shadow move per reference.  References that are not 4-byte aligned, and 32-byte ymm references, whose registers are not shadowed, still go to the slowpath.")
 OPTION_CLIENT_BOOL(internal, check_memset_unaddr, true,
                    "Check for in-heap unaddr in memset",
                    "Check for in-heap unaddr in memset")
@@ -868,10 +1064,16 @@ OPTION_CLIENT_BOOL(internal, zero_stack,
                    IF_ARM_ELSE(false, IF_X64_ELSE(IF_UNIX_ELSE(false, true), true)),
                    "When detecting leaks but not keeping definedness info, zero old stack frames",
                    "When detecting leaks but not keeping definedness info, zero old stack frames in order to avoid false negatives from stale stack values.  This is potentially unsafe.")
+OPTION_CLIENT_BOOL(internal, zero_stack_lazy, false,
+                   "With -zero_stack, zero dead stack at system calls instead",
+                   "With -zero_stack, rather than zeroing each new stack frame, zero the dead stack beyond the top of the stack at each system call, down to the first page that is already all zero.  This costs far less on call-heavy code, but a stale value that a new frame covers before the next system call is not removed.  Unlike -zero_stack alone, this supports the x64 UNIX stack redzone, which is left alone.")
 OPTION_CLIENT_BOOL(internal, zero_retaddr, true,
                    "Zero stale return addresses for better callstacks",
                    "Zero stale return addresses for better callstacks.  When enabled, zeroing is performed in all modes of Dr. Memory.  This is theoretically potentially unsafe.  If your application does not work correctly because of this option please let us know.")
 
+OPTION_CLIENT_BOOL(internal, skip_benign_syscalls, true,
+                   "Do not intercept syscalls with no effect on shadow state",
+                   "Do not intercept system calls that Dr. Syscall reports as having no memory parameters and that Dr. Memory has no handling for.  When checking uninitialized reads, only such system calls that take no parameters at all are skipped, as their parameter values would otherwise be checked for definedness.  Currently only applies on Linux.")
 #ifdef SYSCALL_DRIVER
 OPTION_CLIENT_BOOL(internal, syscall_driver, false,
                    "Use a syscall-info driver if available",
@@ -898,6 +1100,9 @@ OPTION_CLIENT_BOOL(internal, replace_malloc, true,
 OPTION_CLIENT_SCOPE(internal, pattern_max_2byte_faults, int, 0x1000, -1, INT_MAX,
                     "The max number of faults caused by 2-byte pattern checks we could tolerate before switching to 4-byte checks only",
                     "The max number of faults caused by 2-byte pattern checks we could tolerate before switching to 4-byte checks only. 0 means do not use 2-byte checks, and negative value means always use 2-byte checks")
+OPTION_CLIENT_BOOL(internal, pattern_flag_free_checks, false,
+                   "Use pattern checks that do not write the arithmetic flags",
+                   "Only applies to x86 -pattern mode.  Where the arithmetic flags are live, check for the pattern with a load into %ecx followed by lea and jecxz, rather than with cmp and jne, so that the flags need not be saved and restored around the check.  %ecx is spilled if it is live instead.  Where the flags are dead the regular check is used.")
 OPTION_CLIENT(internal, callstack_dump_stack, uint, 0, 0, 512*1024,
               "How much of the stack to dump to the logfile",
               "How much of the stack to dump to the logfile prior to each callstack walk.  Debug-build only.")
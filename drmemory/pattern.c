@@ -37,6 +37,7 @@
 #include "redblack.h"
 #include "report.h"
 #include "alloc_drmem.h"
+#include "drmgr.h"
 
 #ifdef UNIX
 # include <signal.h> /* for SIGSEGV */
@@ -47,6 +48,8 @@
  */
 
 #define MAX_NUM_CHECKS_PER_REF 4
+/* Memory references at least this large also have their last 4 bytes checked */
+#define PATTERN_TAIL_CHECK_MIN_SIZE 16
 #define MAX_REFS_PER_INSTR 3
 #define SWAP_BYTE(x)  ((0x0ff & ((x) >> 8)) | ((0x0ff & (x)) << 8))
 #define PATTERN_REVERSE(x) (SWAP_BYTE(x) | (SWAP_BYTE(x) << 16))
@@ -60,6 +63,39 @@ static void *flush_lock;
 
 static int num_2byte_faults = 0;
 
+/* The false-positive cache: a per-thread cache of ranges where a pattern value
+ * was found to be app data rather than a redzone, so that data which
+ * legitimately contains the pattern does not take the redzone lookups in
+ * pattern_handle_mem_ref() every time.
+ * An entry holds a live chunk's requested bounds, or for memory outside of the
+ * heap just the words accessed.  Any change to the heap layout or its redzones
+ * bumps pattern_heap_gen, which invalidates every entry at once: entries can
+ * never be stale, at the cost of emptying the cache on every malloc and free.
+ * XXX: an entry that sits unused while the generation wraps around could match
+ * again, though it would take 2^32 heap changes.
+ */
+#define PATTERN_FP_CACHE_SIZE 8
+
+typedef struct _pattern_fp_entry_t {
+    byte *start;
+    byte *end;
+    uint gen;
+} pattern_fp_entry_t;
+
+typedef struct _tls_pattern_t {
+    pattern_fp_entry_t fp_cache[PATTERN_FP_CACHE_SIZE];
+    uint fp_next; /* round-robin replacement */
+} tls_pattern_t;
+
+static int tls_idx_pattern = -1;
+static volatile uint pattern_heap_gen;
+
+#ifdef STATISTICS
+uint pattern_fp_cache_hits;
+uint pattern_fp_cache_misses;
+uint pattern_flag_free_checks;
+#endif
+
 /* check if the opnd should be instrumented for checks */
 bool
 pattern_opnd_needs_check(opnd_t opnd)
@@ -269,6 +305,76 @@ pattern_insert_cmp_jne_ud2a(void *drcontext, instrlist_t *ilist, instr_t *app,
     PRE(ilist, app, label);
 }
 
+#ifdef X86
+/* i-ud2a sequence for -pattern_flag_free_checks, which leaves the arithmetic
+ * flags untouched so that no aflags spill is needed where they are live:
+ *    mov/movzx  ref -> %ecx
+ *    lea        -pattern(%xcx) -> %ecx
+ *    jecxz      match
+ *    jmp_short  label
+ *  match:
+ *    ud2a
+ *  label:
+ * The caller must have reserved %xcx and ref must not use it.
+ * The fault handlers recognize this sequence as well as cmp;jne;ud2a.
+ */
+static void
+pattern_insert_lea_jecxz_ud2a(void *drcontext, instrlist_t *ilist, instr_t *app,
+                              opnd_t ref, opnd_t pattern)
+{
+    instr_t *label = INSTR_CREATE_label(drcontext);
+    instr_t *match = INSTR_CREATE_ud2a(drcontext);
+    app_pc pc = instr_get_app_pc(app);
+    int disp = -(int)opnd_get_immed_int(pattern);
+    IF_DEBUG(drreg_status_t res;)
+    ASSERT(!opnd_uses_reg(ref, DR_REG_XCX), "ref must not use the scratch reg");
+    IF_DEBUG(res =)
+        drreg_restore_app_values(drcontext, ilist, app, ref, NULL);
+    ASSERT(res == DRREG_SUCCESS, "should restore memref regs");
+    if (opnd_get_size(ref) == OPSZ_4) {
+        PREXL8M(ilist, app, INSTR_XL8
+                (INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(DR_REG_ECX), ref), pc));
+    } else {
+        ASSERT(opnd_get_size(ref) == OPSZ_2, "unsupported pattern check size");
+        disp = -(int)(ushort)opnd_get_immed_int(pattern);
+        PREXL8M(ilist, app, INSTR_XL8
+                (INSTR_CREATE_movzx(drcontext, opnd_create_reg(DR_REG_ECX), ref), pc));
+    }
+    /* a 32-bit dst zeroes the top of %rcx, so jrcxz is fine on x64 */
+    PRE(ilist, app, INSTR_CREATE_lea
+        (drcontext, opnd_create_reg(DR_REG_ECX),
+         OPND_CREATE_MEM_lea(DR_REG_XCX, DR_REG_NULL, 0, disp)));
+    PRE(ilist, app, INSTR_CREATE_jecxz(drcontext, opnd_create_instr(match)));
+    PRE(ilist, app, INSTR_CREATE_jmp_short(drcontext, opnd_create_instr(label)));
+    PREXL8M(ilist, app, INSTR_XL8(match, pc));
+    PRE(ilist, app, label);
+}
+
+/* Returns whether the lea;jecxz;jmp;ud2a sequence ends just before next_pc,
+ * which is where the ud2a starts.
+ */
+static bool
+pattern_is_lea_jecxz_ud2a(byte *next_pc)
+{
+    /* disp32 form: 8d 89 <disp32> e3 02 eb 02; disp8 form: 8d 49 <disp8> ... */
+    byte buf[10];
+    int disp;
+    if (!safe_read(next_pc - sizeof(buf), sizeof(buf), buf) ||
+        buf[6] != JECXZ_OPCODE || buf[7] != JMP_SHORT_LENGTH ||
+        buf[8] != JMP_SHORT_OPCODE || buf[9] != UD2A_LENGTH)
+        return false;
+    if (buf[0] == LEA_OPCODE && buf[1] == LEA_ECX_DISP32_MODRM)
+        disp = *(int *)&buf[2];
+    else if (buf[3] == LEA_OPCODE && buf[4] == LEA_ECX_DISP8_MODRM)
+        disp = (char)buf[5];
+    else
+        return false;
+    return (disp == -(int)options.pattern || disp == -(int)pattern_reverse ||
+            disp == -(int)(ushort)options.pattern ||
+            disp == -(int)(ushort)pattern_reverse);
+}
+#endif
+
 static int
 pattern_create_check_opnds(bb_info_t *bi, opnd_t *refs, opnd_t *opnds
                            _IF_DEBUG(int max_refs /* size for both arrays */))
@@ -286,9 +392,26 @@ pattern_create_check_opnds(bb_info_t *bi, opnd_t *refs, opnd_t *opnds
     /* XXX i#881: detect access boundary of the redzone in pattern mode */
     ref_size = opnd_get_size(refs[0]);
     if (ref_size > OPSZ_2) {
+#ifdef X86
+        uint bytes = opnd_size_in_bytes(ref_size);
+#endif
         /* cmp [ref], pattern */
         opnd_set_size(&refs[0], OPSZ_4);
         opnds[0] = OPND_CREATE_INT32((int)options.pattern);
+#ifdef X86
+        /* A wide vector access that runs off the end of a chunk still starts
+         * in app data, so we check its last 4 bytes as well.  This is the same
+         * cmp;jne;ud2a as every other check so the fault handling is shared.
+         */
+        if (bytes >= PATTERN_TAIL_CHECK_MIN_SIZE &&
+            opnd_get_disp(refs[0]) <= INT_MAX - (int)bytes) {
+            /* cmp [ref + size - 4], pattern */
+            refs[1]  = refs[0];
+            opnd_set_disp(&refs[1], opnd_get_disp(refs[0]) + bytes - sizeof(uint));
+            opnds[1] = opnds[0];
+            return 2;
+        }
+#endif
         return 1;
     }
 
@@ -373,12 +496,32 @@ pattern_insert_check_code(void *drcontext, instrlist_t *ilist,
 {
     opnd_t refs[MAX_NUM_CHECKS_PER_REF], opnds[MAX_NUM_CHECKS_PER_REF];
     int num_checks, i;
+    bool flag_free = false;
     IF_DEBUG(drreg_status_t res);
 
     if (drmgr_current_bb_phase(drcontext) == DRMGR_PHASE_INSERTION) {
-        IF_DEBUG(res =)
-            drreg_reserve_aflags(drcontext, ilist, app);
-        ASSERT(res == DRREG_SUCCESS, "reserve of aflags should work");
+#ifdef X86
+        /* With the aflags dead the cmp is cheaper and needs no scratch reg */
+        bool aflags_dead;
+        if (options.pattern_flag_free_checks &&
+            !opnd_uses_reg(ref, DR_REG_XCX) && instr_get_opcode(app) != OP_xlat &&
+            drreg_are_aflags_dead(drcontext, app, &aflags_dead) == DRREG_SUCCESS &&
+            !aflags_dead) {
+            drvector_t allowed;
+            reg_id_t scratch;
+            drreg_init_and_fill_vector(&allowed, false);
+            drreg_set_vector_entry(&allowed, DR_REG_XCX, true);
+            flag_free = (drreg_reserve_register(drcontext, ilist, app, &allowed,
+                                                &scratch) == DRREG_SUCCESS);
+            drvector_delete(&allowed);
+            ASSERT(!flag_free || scratch == DR_REG_XCX, "failed to reserve ecx");
+        }
+#endif
+        if (!flag_free) {
+            IF_DEBUG(res =)
+                drreg_reserve_aflags(drcontext, ilist, app);
+            ASSERT(res == DRREG_SUCCESS, "reserve of aflags should work");
+        }
     }
     ASSERT(opnd_uses_nonignorable_memory(ref),
            "non-memory-ref opnd is instrumented");
@@ -393,15 +536,27 @@ pattern_insert_check_code(void *drcontext, instrlist_t *ilist,
                                             _IF_DEBUG(MAX_NUM_CHECKS_PER_REF));
     ASSERT(num_checks > 0 && num_checks <= MAX_NUM_CHECKS_PER_REF,
            "Wrong number of checks created");
-    for (i = 0; i < num_checks; i++)
+    for (i = 0; i < num_checks; i++) {
+#ifdef X86
+        if (flag_free) {
+            pattern_insert_lea_jecxz_ud2a(drcontext, ilist, app, refs[i], opnds[i]);
+            continue;
+        }
+#endif
         pattern_insert_cmp_jne_ud2a(drcontext, ilist, app, refs[i], opnds[i]);
+    }
 
 #ifdef X86
     if (instr_get_opcode(app) == OP_xlat)
         pattern_handle_xlat(drcontext, ilist, app, false /* post */);
 #endif
 
-    if (drmgr_current_bb_phase(drcontext) == DRMGR_PHASE_INSERTION) {
+    if (flag_free) {
+        STATS_INC(pattern_flag_free_checks);
+        IF_DEBUG(res =)
+            drreg_unreserve_register(drcontext, ilist, app, DR_REG_XCX);
+        ASSERT(res == DRREG_SUCCESS, "reg unreserve should work");
+    } else if (drmgr_current_bb_phase(drcontext) == DRMGR_PHASE_INSERTION) {
         IF_DEBUG(res =)
             drreg_unreserve_aflags(drcontext, ilist, app);
         ASSERT(res == DRREG_SUCCESS, "unreserve of aflags should work");
@@ -849,6 +1004,10 @@ pattern_ill_instr_is_instrumented(void *drcontext, byte *pc)
 {
 #ifdef X86
     byte buf[6];
+    if (options.pattern_flag_free_checks && pattern_is_lea_jecxz_ud2a(pc)) {
+        ushort ud2a;
+        return (safe_read(pc, sizeof(ud2a), &ud2a) && ud2a == (ushort)UD2A_OPCODE);
+    }
     /* check if our code sequence */
     if (!safe_read(pc - JNZ_SHORT_LENGTH - 2 /* 2 bytes of cmp immed value */,
                    BUFFER_SIZE_BYTES(buf), buf)   ||
@@ -998,13 +1157,28 @@ pattern_handle_ill_fault(void *drcontext,
     return true;
 }
 
-/* Assumes the caller has set the ISA mode to match the fault point */
+/* Assumes the caller has set the ISA mode to match the fault point.
+ * On x86, sets resume_pc to the pc past the check's ud2a.
+ */
 static bool
 pattern_segv_instr_is_instrumented(byte *pc, byte *next_next_pc,
-                                   instr_t *inst, instr_t *next)
+                                   instr_t *inst, instr_t *next, byte **resume_pc)
 {
 #ifdef X86
     ushort ud2a;
+    /* check code sequence: mov/movzx; lea; jecxz; jmp_short; ud2a */
+    if (options.pattern_flag_free_checks &&
+        (instr_get_opcode(inst) == OP_mov_ld || instr_get_opcode(inst) == OP_movzx) &&
+        opnd_is_reg(instr_get_dst(inst, 0)) &&
+        opnd_get_reg(instr_get_dst(inst, 0)) == DR_REG_ECX &&
+        instr_get_opcode(next) == OP_lea &&
+        pattern_is_lea_jecxz_ud2a(next_next_pc + JECXZ_LENGTH + JMP_SHORT_LENGTH) &&
+        safe_read(next_next_pc + JECXZ_LENGTH + JMP_SHORT_LENGTH, sizeof(ushort),
+                  &ud2a) &&
+        ud2a == (ushort)UD2A_OPCODE) {
+        *resume_pc = next_next_pc + JECXZ_LENGTH + JMP_SHORT_LENGTH + UD2A_LENGTH;
+        return true;
+    }
     /* check code sequence: cmp; jne_short; ud2a */
     if (instr_get_opcode(inst) == OP_cmp &&
         instr_get_opcode(next) == OP_jne_short &&
@@ -1025,6 +1199,7 @@ pattern_segv_instr_is_instrumented(byte *pc, byte *next_next_pc,
                        "Similar code sequence is seen");
             }
         });
+        *resume_pc = next_next_pc + UD2A_LENGTH;
         return true;
     }
 #elif defined(ARM)
@@ -1067,6 +1242,7 @@ pattern_handle_segv_fault(void *drcontext, dr_mcontext_t *raw_mc,
     bool ours = false;
     instr_t inst, next;
     byte *next_pc;
+    byte *resume_pc = NULL;
 #ifdef ARM
     dr_isa_mode_t old_mode;
     dr_isa_mode_t fault_mode = get_isa_mode_from_fault_mc(raw_mc);
@@ -1081,7 +1257,8 @@ pattern_handle_segv_fault(void *drcontext, dr_mcontext_t *raw_mc,
     if (!safe_decode(drcontext, next_pc, &next, &next_pc))
         goto handle_light_mode_segv_fault_done;
     /* check if our own code */
-    if (!pattern_segv_instr_is_instrumented(raw_mc->pc, next_pc, &inst, &next)) {
+    if (!pattern_segv_instr_is_instrumented(raw_mc->pc, next_pc, &inst, &next,
+                                            &resume_pc)) {
         app_pc addr;
         bool is_write;
         uint pos;
@@ -1148,9 +1325,8 @@ pattern_handle_segv_fault(void *drcontext, dr_mcontext_t *raw_mc,
 #endif
     /* skip pattern check code */
 #ifdef X86
-    LOG(2, "pattern check cmp fault@"PFX" => skip to "PFX"\n",
-        raw_mc->pc, next_pc + UD2A_LENGTH);
-    raw_mc->pc = next_pc + UD2A_LENGTH;
+    LOG(2, "pattern check fault@"PFX" => skip to "PFX"\n", raw_mc->pc, resume_pc);
+    raw_mc->pc = resume_pc;
 #elif defined(ARM)
     instr_reset(drcontext, &next);
     if (!safe_decode(drcontext, next_pc, &next, &next_pc))
@@ -1185,8 +1361,12 @@ pattern_handle_segv_fault(void *drcontext, dr_mcontext_t *raw_mc,
  * Memory allocation bookkeeping Functions
  */
 
+/* If addr is in a live chunk but outside of its redzones, returns the chunk's
+ * requested bounds in app_start and app_end.
+ */
 static bool
-pattern_addr_in_malloc_tree(byte *addr, size_t size)
+pattern_addr_in_malloc_tree(byte *addr, size_t size,
+                            app_pc *app_start OUT, app_pc *app_end OUT)
 {
     rb_node_t *node;
     bool res = false;
@@ -1206,6 +1386,10 @@ pattern_addr_in_malloc_tree(byte *addr, size_t size)
         if (addr <  start + options.redzone_size ||
             addr >= start + options.redzone_size + app_size)
             res = true;
+        else {
+            *app_start = start + options.redzone_size;
+            *app_end = start + options.redzone_size + app_size;
+        }
     }
     dr_rwlock_read_unlock(pattern_malloc_tree_rwlock);
     return res;
@@ -1313,19 +1497,64 @@ pattern_addr_pre_check(byte *addr)
     return false;
 }
 
-/* Checks whether [addr, addr+size) overlaps a redzone or padding */
+/* Checks whether [addr, addr+size) overlaps a redzone or padding.
+ * If not, and it lies in a live chunk, returns the chunk's requested bounds in
+ * app_start and app_end; otherwise leaves them untouched.
+ */
 static bool
-pattern_addr_in_redzone(byte *addr, size_t size)
+pattern_addr_in_redzone(byte *addr, size_t size,
+                        app_pc *app_start OUT, app_pc *app_end OUT)
 {
     bool res = false;
     LOG(3, "%s: "PFX"-"PFX"\n", __FUNCTION__, addr, addr+size);
     if (options.pattern_use_malloc_tree)
-        res = pattern_addr_in_malloc_tree(addr, size);
-    else
+        res = pattern_addr_in_malloc_tree(addr, size, app_start, app_end);
+    else {
         res = region_in_redzone(addr, size, NULL, NULL, NULL, NULL, NULL);
+        /* only reached on a pattern value that passed pattern_addr_pre_check(),
+         * and the cache makes this second lookup rare
+         */
+        if (!res)
+            region_in_malloc_block(addr, size, NULL, app_start, app_end);
+    }
     return res;
 }
 
+/* Called after any change to the heap layout or its redzones, which invalidates
+ * every thread's false-positive cache.
+ */
+static inline void
+pattern_heap_changed(void)
+{
+    ATOMIC_INC32(pattern_heap_gen);
+}
+
+static bool
+pattern_fp_cache_lookup(tls_pattern_t *pt, byte *addr, size_t size)
+{
+    uint i, gen = pattern_heap_gen;
+    for (i = 0; i < PATTERN_FP_CACHE_SIZE; i++) {
+        pattern_fp_entry_t *e = &pt->fp_cache[i];
+        if (e->gen == gen && addr >= e->start && addr + size <= e->end)
+            return true;
+    }
+    return false;
+}
+
+/* gen must be read before the lookups that found [start, end) to be app data,
+ * so that a concurrent heap change makes the entry invalid.
+ */
+static void
+pattern_fp_cache_add(tls_pattern_t *pt, byte *start, byte *end, uint gen)
+{
+    pattern_fp_entry_t *e = &pt->fp_cache[pt->fp_next];
+    pt->fp_next = (pt->fp_next + 1) % PATTERN_FP_CACHE_SIZE;
+    e->start = start;
+    e->end = end;
+    e->gen = gen;
+    LOG(3, "%s: "PFX"-"PFX" gen %d\n", __FUNCTION__, start, end, gen);
+}
+
 /* Assumes that it's ok to write the pattern value beyond end!
  * I.e., if a small region is passed in, assumes there's already a
  * redzone beyond it.
@@ -1377,6 +1606,7 @@ pattern_handle_malloc(malloc_info_t *info)
         ASSERT(malloc_is_pre_us(app_base), "unknown malloc region");
 #endif
     }
+    pattern_heap_changed();
 }
 
 void
@@ -1416,6 +1646,7 @@ pattern_handle_real_free(malloc_info_t *info, bool delayed)
 #endif
         }
     }
+    pattern_heap_changed();
 }
 
 void
@@ -1432,6 +1663,7 @@ pattern_handle_delayed_free(malloc_info_t *info)
     ASSERT(ALIGNED(info->base, 4), "unaligned pointer for free");
     pattern_write_pattern(info->base, info->base + info->request_size
                           _IF_DEBUG("delay-freed block"));
+    pattern_heap_changed();
 }
 
 void
@@ -1460,6 +1692,11 @@ pattern_handle_realloc(malloc_info_t *old_info, malloc_info_t *new_info,
                 (old_info->has_redzone ? options.redzone_size : 0);
             size_t add_sz = new_info->pad_size - new_info->request_size +
                 (new_info->has_redzone ? options.redzone_size : 0);
+            /* Growing in place can extend past the old redzone into what was
+             * a free chunk or unused arena space.
+             */
+            if (rm_sz < new_info->request_size - old_info->request_size)
+                rm_sz = new_info->request_size - old_info->request_size;
             LOG(2, "clear pattern value "PFX"-"PFX" %d bytes on in-place realloc\n",
                 old_info->base + old_info->request_size,
                 old_info->base + old_info->request_size + rm_sz, rm_sz);
@@ -1473,6 +1710,7 @@ pattern_handle_realloc(malloc_info_t *old_info, malloc_info_t *new_info,
                                   _IF_DEBUG("realloc shrunk in-place new pad"));
         }
     }
+    pattern_heap_changed();
 }
 
 void
@@ -1483,6 +1721,18 @@ pattern_new_redzone(app_pc start, size_t size)
     ASSERT(ALIGNED(start, 4), "unaligned redzone start");
     ASSERT(ALIGNED(size, 4), "unaligned redzone size");
     pattern_write_pattern(start, start + size _IF_DEBUG("new redzone"));
+    pattern_heap_changed();
+}
+
+static bool
+pattern_value_at(byte *addr, size_t check_sz)
+{
+    uint val;
+    return (safe_read(addr, check_sz, &val) &&
+            ((ushort)val == (ushort)options.pattern ||
+             (ushort)val == (ushort)pattern_reverse) &&
+            (check_sz == 4 ?
+             (val == options.pattern || val == pattern_reverse)  : true));
 }
 
 /* returns true if no errors were found */
@@ -1490,30 +1740,45 @@ bool
 pattern_handle_mem_ref(app_loc_t *loc, byte *addr, size_t size,
                        dr_mcontext_t *mc, bool is_write)
 {
-    uint val;
+    uint gen;
     size_t check_sz;
-    /* XXX i#774: for ref of >4 byte, we check the starting 4-byte only */
+    byte *check_addr = addr;
+    tls_pattern_t *pt;
+    app_pc app_start = NULL, app_end = NULL;
+    /* XXX i#774: for ref of >4 byte, we check the starting 4-byte, plus the
+     * last 4-byte for wide refs as pattern_create_check_opnds() does.
+     */
     check_sz = (size <= 2) ? 2 : 4;
     /* there are several memory opnd, so it should be faster to check
      * before lookup in the rbtree.
      */
-    if (safe_read(addr, check_sz, &val) &&
-        ((ushort)val == (ushort)options.pattern ||
-         (ushort)val == (ushort)pattern_reverse) &&
-        (check_sz == 4 ?
-         (val == options.pattern || val == pattern_reverse)  : true) &&
-        /* we first do a pre-check to avoid expensive lookup
-         * XXX: we might miss the use-after-free error that accessing
-         * a freed pre-us block with smaller-than-redzone size.
-         */
-        pattern_addr_pre_check(addr) &&
-        /* We don't have alloc_ops.global_lock set, but by iterating for
-         * live chunks before freed, we shouldn't miss anything: even
-         * chunk re-use should still show up, and we will synchronize
-         * with a split or coalesce.
-         */
-        (pattern_addr_in_redzone(addr, size) ||
-         overlaps_delayed_free(addr, addr + size, NULL, NULL, NULL, false/*any*/))) {
+    if (!pattern_value_at(addr, check_sz)) {
+        if (size < PATTERN_TAIL_CHECK_MIN_SIZE ||
+            !pattern_value_at(addr + size - sizeof(uint), sizeof(uint)))
+            return true;
+        check_addr = addr + size - sizeof(uint);
+    }
+    /* app data containing the pattern that we have already looked up */
+    pt = (tls_pattern_t *) drmgr_get_tls_field(dr_get_current_drcontext(),
+                                               tls_idx_pattern);
+    if (pt != NULL && pattern_fp_cache_lookup(pt, addr, size)) {
+        STATS_INC(pattern_fp_cache_hits);
+        return true;
+    }
+    /* we first do a pre-check to avoid expensive lookup
+     * XXX: we might miss the use-after-free error that accessing
+     * a freed pre-us block with smaller-than-redzone size.
+     */
+    if (!pattern_addr_pre_check(check_addr))
+        return true;
+    gen = pattern_heap_gen;
+    /* We don't have alloc_ops.global_lock set, but by iterating for
+     * live chunks before freed, we shouldn't miss anything: even
+     * chunk re-use should still show up, and we will synchronize
+     * with a split or coalesce.
+     */
+    if (pattern_addr_in_redzone(addr, size, &app_start, &app_end) ||
+        overlaps_delayed_free(addr, addr + size, NULL, NULL, NULL, false/*any*/)) {
         /* XXX: i#786: the actually freed memory is neither in malloc tree
          * nor in delayed free rbtree, in which case we cannot detect. We
          * can maintain the information in pattern malloc tree, i.e. mark
@@ -1539,10 +1804,23 @@ pattern_handle_mem_ref(app_loc_t *loc, byte *addr, size_t size,
          */
         /* i#902: it is only safe to set one byte here since the memory
          * [addr, addr + size] might be partial buffer underflow.
+         * Similarly, only the last byte of a wide overflow is in the redzone.
          */
-        *(byte *)addr = 0;
+        if (check_addr == addr)
+            *(byte *)addr = 0;
+        else
+            *(addr + size - 1) = 0;
         return false;
     }
+    STATS_INC(pattern_fp_cache_misses);
+    if (pt != NULL) {
+        if (app_start != NULL && addr >= app_start && addr + size <= app_end)
+            pattern_fp_cache_add(pt, app_start, app_end, gen);
+        else {
+            pattern_fp_cache_add(pt, (byte *) ALIGN_BACKWARD(addr, sizeof(uint)),
+                                 (byte *) ALIGN_FORWARD(addr + size, sizeof(uint)), gen);
+        }
+    }
     return true;
 }
 
@@ -1558,6 +1836,8 @@ pattern_init(void)
         pattern_malloc_tree = rb_tree_create(NULL);
         pattern_malloc_tree_rwlock = dr_rwlock_create();
     }
+    tls_idx_pattern = drmgr_register_tls_field();
+    ASSERT(tls_idx_pattern > -1, "unable to reserve TLS slot");
 
     /* reverse the byte order for unaligned checks:
      * for example, if the pattern is 0x43214321, the reversed pattern is
@@ -1579,5 +1859,27 @@ pattern_exit(void)
         dr_rwlock_destroy(pattern_malloc_tree_rwlock);
         rb_tree_destroy(pattern_malloc_tree);
     }
+    drmgr_unregister_tls_field(tls_idx_pattern);
     dr_mutex_destroy(flush_lock);
 }
+
+void
+pattern_thread_init(void *drcontext)
+{
+    tls_pattern_t *pt = (tls_pattern_t *)
+        thread_alloc(drcontext, sizeof(*pt), HEAPSTAT_MISC);
+    memset(pt, 0, sizeof(*pt));
+    /* zeroed entries have an empty range and so never match */
+    drmgr_set_tls_field(drcontext, tls_idx_pattern, (void *) pt);
+}
+
+void
+pattern_thread_exit(void *drcontext)
+{
+    tls_pattern_t *pt = (tls_pattern_t *)
+        drmgr_get_tls_field(drcontext, tls_idx_pattern);
+    if (pt == NULL)
+        return;
+    drmgr_set_tls_field(drcontext, tls_idx_pattern, NULL);
+    thread_free(drcontext, pt, sizeof(*pt), HEAPSTAT_MISC);
+}
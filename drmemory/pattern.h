@@ -63,6 +63,12 @@ pattern_init(void);
 void
 pattern_exit(void);
 
+void
+pattern_thread_init(void *drcontext);
+
+void
+pattern_thread_exit(void *drcontext);
+
 void
 pattern_handle_malloc(malloc_info_t *info);
 
@@ -86,4 +92,10 @@ pattern_handle_mem_ref(app_loc_t *loc, app_pc addr, size_t size,
 bool
 pattern_opnd_needs_check(opnd_t opnd);
 
+#ifdef STATISTICS
+extern uint pattern_fp_cache_hits;
+extern uint pattern_fp_cache_misses;
+extern uint pattern_flag_free_checks;
+#endif
+
 #endif /* _PATTERN_H_ */
@@ -45,7 +45,6 @@ enum {
     SYNCH_PROCESS,
 };
 
-#if defined(DEBUG) || defined(STATISTICS)
 static const char * const synch_type[] = {
     "instr",
     "syscall",
@@ -53,8 +52,7 @@ static const char * const synch_type[] = {
     "thread",
     "process",
 };
-# define NUM_TYPES (sizeof(synch_type)/sizeof(synch_type[0]))
-#endif
+#define NUM_TYPES (sizeof(synch_type)/sizeof(synch_type[0]))
 
 #ifdef STATISTICS
 static uint count[NUM_TYPES];
@@ -116,12 +114,86 @@ perturb_event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *in
  * abnormal thread orderings and tease out race conditions
  */
 
+/* Each thread draws its delays from its own random sequence, seeded from the
+ * base seed and the thread's creation order, so that a run's delays can be
+ * replayed from its seed regardless of how the threads interleave.
+ */
+typedef struct _perturb_thread_t {
+    uint rand_state;
+    uint ordinal;
+    uint num_delays;
+} perturb_thread_t;
+
+static int tls_idx_perturb = -1;
+static uint perturb_base_seed;
+static int perturb_thread_count;
+/* for -perturb_record */
+static file_t f_perturb = INVALID_FILE;
+
+/* The countdown to the next instruction-level delay lives in a raw TLS slot
+ * so the inlined check can decrement it without a register for the address.
+ */
+static reg_id_t perturb_seg;
+static uint perturb_tls_offs;
+
+/* The rest of the tool's instrumentation does not use this DR slot */
+#define PERTURB_SPILL_SLOT SPILL_SLOT_4
+
+/* Returns a value in [0, max) from pt's sequence, or from DR's shared
+ * generator for a thread we have not set up.
+ */
+static uint
+perturb_random(perturb_thread_t *pt, uint max)
+{
+    uint x;
+    if (max == 0)
+        return 0;
+    if (pt == NULL)
+        return dr_get_random_value(max);
+    /* xorshift32 */
+    x = pt->rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pt->rand_state = x;
+    return x % max;
+}
+
+static perturb_thread_t *
+perturb_thread_data(void)
+{
+    void *drcontext = dr_get_current_drcontext();
+    if (drcontext == NULL || tls_idx_perturb < 0)
+        return NULL;
+    return (perturb_thread_t *) drmgr_get_tls_field(drcontext, tls_idx_perturb);
+}
+
+static uint *
+perturb_countdown(void)
+{
+    return (uint *) (dr_get_dr_segment_base(perturb_seg) + perturb_tls_offs);
+}
+
+static void
+perturb_reset_countdown(perturb_thread_t *pt)
+{
+    /* Uniform in [1, 2*rate-1], for one delay per -perturb_rate points on average */
+    *perturb_countdown() = 1 + perturb_random(pt, 2*options.perturb_rate - 1);
+}
+
 /* called via clean call from cache as well as from thread and fork events */
 static void
 do_delay(uint type)
 {
-    uint delay_ms = dr_get_random_value(options.perturb_max);
+    perturb_thread_t *pt = perturb_thread_data();
+    uint delay_ms = perturb_random(pt, options.perturb_max);
     ASSERT(type < NUM_TYPES, "invalid synch type");
+    if (f_perturb != INVALID_FILE && pt != NULL) {
+        dr_fprintf(f_perturb, "%u %u %s %u\n", pt->ordinal, pt->num_delays,
+                   synch_type[type], delay_ms);
+    }
+    if (pt != NULL)
+        pt->num_delays++;
     if (type == SYNCH_INSTR) {
         /* For instrs, sleeping for even 1ms is way too long so we have
          * a loop of moderately slow operations: library call that reads
@@ -145,6 +217,38 @@ do_delay(uint type)
     STATS_INC(count[type]);
 }
 
+/* Called via clean call at instruction-level synch points.  On x86 the
+ * inlined check only calls here once the countdown reaches zero.
+ */
+static void
+do_delay_instr(uint type)
+{
+    perturb_thread_t *pt = perturb_thread_data();
+#ifndef X86
+    uint *countdown = perturb_countdown();
+    if (--(*countdown) > 0)
+        return;
+#endif
+    perturb_reset_countdown(pt);
+    do_delay(type);
+}
+
+static void
+perturb_open_record(void)
+{
+    char name[MAXIMUM_PATH];
+    dr_snprintf(name, BUFFER_SIZE_ELEMENTS(name), "%s%cperturb.%d.log",
+                logsubdir, DIRSEP, dr_get_process_id());
+    NULL_TERMINATE_BUFFER(name);
+    f_perturb = dr_open_file(name, DR_FILE_WRITE_OVERWRITE | DR_FILE_CLOSE_ON_FORK);
+    if (f_perturb == INVALID_FILE) {
+        NOTIFY_ERROR("Unable to open perturb record %s"NL, name);
+        return;
+    }
+    dr_fprintf(f_perturb, "seed %u\n", perturb_base_seed);
+    NOTIFY("perturb record is %s"NL, name);
+}
+
 static bool
 is_synch_routine(app_pc pc)
 {
@@ -174,7 +278,14 @@ perturb_init(void)
         ASSERT(false, "drmgr registration failed");
     if (options.perturb_seed != 0)
         dr_set_random_seed(options.perturb_seed);
-    LOG(1, "initial random seed: %d\n", dr_get_random_seed());
+    perturb_base_seed = dr_get_random_seed();
+    LOG(1, "initial random seed: %d\n", perturb_base_seed);
+    tls_idx_perturb = drmgr_register_tls_field();
+    ASSERT(tls_idx_perturb > -1, "unable to reserve TLS slot");
+    if (!dr_raw_tls_calloc(&perturb_seg, &perturb_tls_offs, 1, 0))
+        ASSERT(false, "unable to reserve raw TLS slot");
+    if (options.perturb_record)
+        perturb_open_record();
 }
 
 void
@@ -232,7 +343,10 @@ perturb_module_load(void *drcontext, const module_data_t *info, bool loaded)
 void
 perturb_exit(void)
 {
-    /* nothing yet */
+    if (f_perturb != INVALID_FILE)
+        dr_close_file(f_perturb);
+    dr_raw_tls_cfree(perturb_tls_offs, 1);
+    drmgr_unregister_tls_field(tls_idx_perturb);
 }
 
 #ifdef STATISTICS
@@ -253,19 +367,37 @@ perturb_dump_statistics(file_t f)
 void
 perturb_fork_init(void)
 {
+    /* the parent's record was closed on fork */
+    if (options.perturb_record)
+        perturb_open_record();
     do_delay(SYNCH_PROCESS);
 }
 
 void
-perturb_thread_init(void)
+perturb_thread_init(void *drcontext)
 {
+    perturb_thread_t *pt = (perturb_thread_t *)
+        thread_alloc(drcontext, sizeof(*pt), HEAPSTAT_MISC);
+    pt->ordinal = dr_atomic_add32_return_sum(&perturb_thread_count, 1) - 1;
+    pt->rand_state = perturb_base_seed ^ ((pt->ordinal + 1) * 0x9e3779b9);
+    if (pt->rand_state == 0)
+        pt->rand_state = 1;
+    pt->num_delays = 0;
+    drmgr_set_tls_field(drcontext, tls_idx_perturb, (void *)pt);
+    perturb_reset_countdown(pt);
     do_delay(SYNCH_THREAD);
 }
 
 void
-perturb_thread_exit(void)
+perturb_thread_exit(void *drcontext)
 {
+    perturb_thread_t *pt = (perturb_thread_t *)
+        drmgr_get_tls_field(drcontext, tls_idx_perturb);
     do_delay(SYNCH_THREAD);
+    if (pt != NULL) {
+        drmgr_set_tls_field(drcontext, tls_idx_perturb, NULL);
+        thread_free(drcontext, pt, sizeof(*pt), HEAPSTAT_MISC);
+    }
 }
 
 void
@@ -384,6 +516,37 @@ perturb_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
     return DR_EMIT_DEFAULT;
 }
 
+/* Inserts a decrement of the countdown and a clean call to do_delay_instr()
+ * that is only taken when it reaches zero.  We save and restore xax and the
+ * arithmetic flags ourselves as we insert after the rest of the tool.
+ */
+static void
+insert_delay_check(void *drcontext, instrlist_t *bb, instr_t *inst, uint type)
+{
+#ifdef X86
+    instr_t *skip = INSTR_CREATE_label(drcontext);
+    dr_save_reg(drcontext, bb, inst, DR_REG_XAX, PERTURB_SPILL_SLOT);
+    dr_save_arith_flags_to_xax(drcontext, bb, inst);
+    instrlist_meta_preinsert
+        (bb, inst, INSTR_CREATE_sub
+         (drcontext, opnd_create_far_base_disp_ex
+          (perturb_seg, DR_REG_NULL, DR_REG_NULL, 0, perturb_tls_offs, OPSZ_4,
+           false, true, false),
+          OPND_CREATE_INT8(1)));
+    instrlist_meta_preinsert
+        (bb, inst, INSTR_CREATE_jcc(drcontext, OP_jnz, opnd_create_instr(skip)));
+    dr_insert_clean_call(drcontext, bb, inst, (void *)do_delay_instr, false,
+                         1, OPND_CREATE_INT32(type));
+    instrlist_meta_preinsert(bb, inst, skip);
+    dr_restore_arith_flags_from_xax(drcontext, bb, inst);
+    dr_restore_reg(drcontext, bb, inst, DR_REG_XAX, PERTURB_SPILL_SLOT);
+#else
+    /* XXX: inline the countdown here too */
+    dr_insert_clean_call(drcontext, bb, inst, (void *)do_delay_instr, false,
+                         1, OPND_CREATE_INT32(type));
+#endif
+}
+
 static dr_emit_flags_t
 perturb_event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
                         bool for_trace, bool translating, void *user_data)
@@ -393,13 +556,10 @@ perturb_event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *in
      */
     drmgr_disable_auto_predication(drcontext, bb);
 
-    if (instr_is_synch_op(inst)) {
-        dr_insert_clean_call(drcontext, bb, inst, (void *)do_delay, false,
-                             1, OPND_CREATE_INT32(SYNCH_INSTR));
-    } else if (is_synch_routine(instr_get_app_pc(inst))) {
-        dr_insert_clean_call(drcontext, bb, inst, (void *)do_delay, false,
-                             1, OPND_CREATE_INT32(SYNCH_LIBRARY));
-    }
+    if (instr_is_synch_op(inst))
+        insert_delay_check(drcontext, bb, inst, SYNCH_INSTR);
+    else if (is_synch_routine(instr_get_app_pc(inst)))
+        insert_delay_check(drcontext, bb, inst, SYNCH_LIBRARY);
     /* XXX: maybe add delay on post as well as pre */
     return DR_EMIT_DEFAULT;
 }
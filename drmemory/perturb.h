@@ -45,10 +45,10 @@ void
 perturb_fork_init(void);
 
 void
-perturb_thread_init(void);
+perturb_thread_init(void *drcontext);
 
 void
-perturb_thread_exit(void);
+perturb_thread_exit(void *drcontext);
 
 void
 perturb_module_load(void *drcontext, const module_data_t *info, bool loaded);
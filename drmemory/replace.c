@@ -152,6 +152,16 @@ replace_tolower_ascii(int c);
 /* for locale-specific tolower() for str{,n}casecmp */
 static int (*app_tolower)(int) = replace_tolower_ascii;
 
+/* Copy of -replace_bulk_size for reading from the replacement routines.
+ * 0 means bulk handling is disabled.
+ */
+static size_t replace_bulk_size;
+
+#ifdef STATISTICS
+uint replace_bulk_sets;
+uint replace_bulk_copies;
+#endif
+
 /***************************************************************************
  * The replacements themselves.
  * These routines are not static so that under gdb a fault will show
@@ -177,6 +187,19 @@ ACTUAL_PRAGMA( code_seg(".replace") )
 # define IN_REPLACE_SECTION /* nothing */
 #endif
 
+/* Markers for the bulk handling of large calls: see replace_bulk_set() */
+#ifdef WINDOWS
+# define REPLACE_MARKER __declspec(noinline)
+#else
+# define REPLACE_MARKER __attribute__((noinline, used))
+#endif
+
+REPLACE_MARKER IN_REPLACE_SECTION bool
+replace_bulk_set(void *dst, int val_in, size_t size);
+
+REPLACE_MARKER IN_REPLACE_SECTION bool
+replace_bulk_copy(void *dst, const void *src, size_t size);
+
 /* prevent cl from replacing our loop with a call to ntdll!memset,
  * which we replace with this routine, which results an infinite loop!
  */
@@ -187,6 +210,9 @@ replace_memset(void *dst, int val_in, size_t size)
     register unsigned char *ptr = (unsigned char *) dst;
     unsigned char val = (unsigned char) val_in;
     unsigned int val4 = (val << 24) | (val << 16) | (val << 8) | val;
+    if (replace_bulk_size > 0 && size >= replace_bulk_size &&
+        replace_bulk_set(dst, val_in, size))
+        return dst;
     while (!ALIGNED(ptr, 4) && size > 0) {
         *ptr++ = val;
         size--;
@@ -226,6 +252,9 @@ replace_memcpy(void *dst, const void *src, size_t size)
 {
     register unsigned char *d = (unsigned char *) dst;
     register unsigned char *s = (unsigned char *) src;
+    if (replace_bulk_size > 0 && size >= replace_bulk_size &&
+        replace_bulk_copy(dst, src, size))
+        return dst;
     if (((ptr_uint_t)dst & 3) == ((ptr_uint_t)src & 3)) {
         /* same alignment, so we can do 4 aligned bytes at a time and stay
          * on fastpath.  when not same alignment, I'm assuming it's faster
@@ -269,6 +298,31 @@ replace_wmemcpy(wchar_t *dst, const wchar_t *src, size_t size)
 #endif
 }
 
+/* These two are markers that are wrapped by replace_bulk_pre_{set,copy}, which
+ * perform the operation natively and skip the call when they can.  Otherwise
+ * they return false and the caller proceeds with its instrumented loop.
+ * They are identified by address, so they must not be inlined, and their
+ * bodies differ so that identical code folding cannot merge them.  Their
+ * results come from a volatile that is never written, so that the compiler
+ * cannot assume them to be false in the callers.  DO_NOT_OPTIMIZE is empty
+ * on UNIX and cannot be relied upon for any of this.
+ */
+static volatile bool replace_bulk_marker_result[2];
+
+DO_NOT_OPTIMIZE
+REPLACE_MARKER IN_REPLACE_SECTION bool
+replace_bulk_set(void *dst, int val_in, size_t size)
+{
+    return replace_bulk_marker_result[0];
+}
+
+REPLACE_MARKER IN_REPLACE_SECTION bool
+replace_bulk_copy(void *dst, const void *src, size_t size)
+{
+    return replace_bulk_marker_result[1];
+}
+END_DO_NOT_OPTIMIZE
+
 IN_REPLACE_SECTION void *
 replace_memchr(const void *mem, int find, size_t size)
 {
@@ -739,6 +793,10 @@ replace_wcsstr(const wchar_t *haystack, const wchar_t *needle)
 IN_REPLACE_SECTION void *
 replace_memmove(void *dst, const void *src, size_t size)
 {
+    /* replace_bulk_copy only handles non-overlapping ranges */
+    if (replace_bulk_size > 0 && size >= replace_bulk_size &&
+        replace_bulk_copy(dst, src, size))
+        return dst;
     if (((ptr_uint_t)dst) - ((ptr_uint_t)src) >= size) {
         /* forward walk won't clobber: either no overlap or dst < src */
         register const char *s = (const char *) src;
@@ -876,6 +934,99 @@ get_function_entry(app_pc C_var)
     return pc;
 }
 
+/***************************************************************************
+ * Bulk handling of large mem{cpy,move,set} calls.
+ * Rather than having each dword of a large copy go through the instrumented
+ * loops, we wrap the replace_bulk_* markers and perform the whole operation
+ * natively, propagating shadow values once for the whole range.  To keep
+ * error reporting in one place we only do this when no byte involved is
+ * unaddressable: otherwise we let the loops run and report as usual.
+ */
+
+/* Returns whether [start, start+size) is addressable and, as we do not bulk
+ * copy bit-level values, not bit-level.
+ */
+static bool
+replace_bulk_range_ok(app_pc start, size_t size)
+{
+    app_pc pc = start, bad_start, bad_end;
+    uint bad_state;
+    if (start + size < start)
+        return false;
+    while (pc < start + size) {
+        if (shadow_check_range(pc, start + size - pc, SHADOW_DEFINED,
+                               &bad_start, &bad_end, &bad_state))
+            return true;
+        if (bad_state == SHADOW_UNADDRESSABLE || bad_state == SHADOW_DEFINED_BITLEVEL)
+            return false;
+        ASSERT(bad_end > pc, "shadow_check_range made no progress");
+        pc = bad_end;
+    }
+    return true;
+}
+
+static void
+replace_bulk_pre_set(void *wrapcxt, OUT void **user_data)
+{
+    byte *dst = (byte *) drwrap_get_arg(wrapcxt, 0);
+    int val = (int)(ptr_int_t) drwrap_get_arg(wrapcxt, 1);
+    size_t size = (size_t) drwrap_get_arg(wrapcxt, 2);
+    bool ok = false;
+    if (!replace_bulk_range_ok(dst, size))
+        return;
+    DR_TRY_EXCEPT(drwrap_get_drcontext(wrapcxt), {
+        memset(dst, val, size);
+        ok = true;
+    }, { /* EXCEPT */
+        /* e.g., read-only memory: the loop will raise the fault for the app */
+    });
+    if (!ok)
+        return;
+    shadow_set_range(dst, dst + size, SHADOW_DEFINED);
+    STATS_INC(replace_bulk_sets);
+    drwrap_skip_call(wrapcxt, (void *)(ptr_int_t) true, 0);
+}
+
+static void
+replace_bulk_pre_copy(void *wrapcxt, OUT void **user_data)
+{
+    byte *dst = (byte *) drwrap_get_arg(wrapcxt, 0);
+    byte *src = (byte *) drwrap_get_arg(wrapcxt, 1);
+    size_t size = (size_t) drwrap_get_arg(wrapcxt, 2);
+    bool ok = false;
+    /* An overlapping copy that faults partway would not be restartable by the
+     * loop, so we leave overlaps to the loops.
+     */
+    if ((dst < src + size && src < dst + size) ||
+        !replace_bulk_range_ok(src, size) || !replace_bulk_range_ok(dst, size))
+        return;
+    DR_TRY_EXCEPT(drwrap_get_drcontext(wrapcxt), {
+        memcpy(dst, src, size);
+        ok = true;
+    }, { /* EXCEPT */
+    });
+    if (!ok)
+        return;
+    shadow_copy_range(src, dst, size);
+    STATS_INC(replace_bulk_copies);
+    drwrap_skip_call(wrapcxt, (void *)(ptr_int_t) true, 0);
+}
+
+static void
+replace_bulk_init(void)
+{
+    if (options.replace_bulk_size == 0 || !options.shadowing)
+        return;
+    if (!drwrap_wrap(get_function_entry((app_pc)replace_bulk_set),
+                     replace_bulk_pre_set, NULL) ||
+        !drwrap_wrap(get_function_entry((app_pc)replace_bulk_copy),
+                     replace_bulk_pre_copy, NULL)) {
+        ASSERT(false, "failed to wrap bulk markers");
+        return;
+    }
+    replace_bulk_size = options.replace_bulk_size;
+}
+
 void
 replace_init(void)
 {
@@ -930,6 +1081,7 @@ replace_init(void)
             hashtable_add(&replace_name_table, (void *) replace_routine_name[i],
                           (void *)(ptr_int_t)(i+1)/*since 0 is "not found"*/);
         }
+        replace_bulk_init();
     }
 }
 
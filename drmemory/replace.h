@@ -45,4 +45,9 @@ in_replace_routine(app_pc pc);
 bool
 in_replace_memset(app_pc pc);
 
+#ifdef STATISTICS
+extern uint replace_bulk_sets;
+extern uint replace_bulk_copies;
+#endif
+
 #endif /* _REPLACE_H_ */
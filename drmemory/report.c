@@ -36,6 +36,8 @@
 #include "heap.h"
 #include "alloc_drmem.h"
 #include "fuzzer.h"
+#include "live_summary.h"
+#include "prof.h"
 #ifdef UNIX
 # include <errno.h>
 #endif
@@ -55,6 +57,7 @@ static uint num_suppressions_matched_default;
 static uint num_suppressed_leaks_default;
 static uint num_throttled_errors;
 static uint num_throttled_leaks;
+static uint num_saturated_errors;
 
 static uint saved_leaks_ignored;
 static uint saved_suppressed_leaks_user;
@@ -70,14 +73,24 @@ typedef struct _tls_report_t {
     size_t errbufsz;
     /* for callstack shadow xl8 cache */
     umbra_shadow_memory_info_t xl8_info;
-    /* cached values for module_is_on_check_uninit_blocklist() for i#1529 */
+    /* cached values for module_check_level() for i#1529 */
     app_pc last_query_mod_start;
     size_t last_query_mod_size;
-    bool last_query_res;
+    module_check_level_t last_query_res;
 } tls_report_t;
 
 static int tls_idx_report = -1;
 
+/* Reports from threads without a tls_report_t, such as the leaks reported at
+ * exit after the thread's own state is gone, reuse these buffers rather than
+ * allocating and freeing a large one for each report.  There are as many as
+ * there have been such reports in parallel, up to REPORT_SPARE_BUFS_MAX.
+ */
+#define REPORT_SPARE_BUFS_MAX 8
+static void *report_spare_lock;
+static char *report_spare_bufs[REPORT_SPARE_BUFS_MAX];
+static uint report_num_spare_bufs;
+
 /***************************************************************************/
 /* Store all errors so we can eliminate duplicates (PR 484167) */
 
@@ -243,8 +256,17 @@ typedef struct _stored_error_t {
     bool suppressed;
     bool suppressed_by_default;
     bool potential;
+    /* Set while the first report symbolizes without error_lock: duplicates
+     * must wait to learn whether it is suppressed.
+     */
+    bool pending;
     suppress_spec_t *suppress_spec;
     packed_callstack_t *pcs;
+    /* For leaks: bytes found by the current scan, and for -leak_growth the
+     * bytes found by the previous nudge's scan.
+     */
+    size_t leak_bytes;
+    size_t prev_leak_bytes;
     /* We also keep a linked list so we can iterate in id order */
     struct _stored_error_t *next;
 } stored_error_t;
@@ -259,6 +281,40 @@ typedef struct _error_callstack_t {
 
 #define ERROR_HASH_BITS 8
 hashtable_t error_table;
+
+/* Memoized suppression verdicts, so that errors of different types and leaks
+ * with the same callstack as an earlier one need not be symbolized and matched
+ * again.  Each entry is its own key.  Protected by error_lock.
+ */
+typedef struct _suppress_verdict_t {
+    uint type;
+    packed_callstack_t *pcs; /* our own clone */
+    char *instruction;       /* NULL if empty */
+    suppress_spec_t *spec;   /* NULL if not suppressed */
+} suppress_verdict_t;
+
+#define VERDICT_HASH_BITS 10
+static hashtable_t verdict_table;
+
+/* For -dup_pc_threshold: the error last recorded at each (pc, type) pair and
+ * how many times in a row a full callstack walk there found that same error.
+ * Each entry is its own key.  Protected by error_lock.
+ */
+typedef struct _dup_pc_t {
+    app_pc pc;
+    uint type;
+    stored_error_t *err;  /* NULL once more than one error was found here */
+    uint hits;
+} dup_pc_t;
+
+#define DUP_PC_HASH_BITS 8
+static hashtable_t dup_pc_table;
+
+/* For -report_site_max: the number of errors counted at each pc.
+ * Protected by error_lock.
+ */
+#define SITE_HASH_BITS 8
+static hashtable_t site_table;
 /* We need an outer lock to synchronize stored_error_t data access.
  * Since we never remove from error_table we could instead have
  * a lock per stored_error_t but we save space, assuming errors
@@ -347,6 +403,388 @@ static void
 print_double_null_term_string(const char *s, const char *sep);
 #endif
 
+/***************************************************************************
+ * Asynchronous output for -async_results
+ */
+
+typedef struct _async_write_t {
+    file_t f;
+    size_t size;
+    struct _async_write_t *next;
+    char buf[1]; /* variable-sized and null-terminated */
+} async_write_t;
+
+/* Once this many bytes are queued, app threads write the queue themselves */
+#define ASYNC_MAX_QUEUED (1024*1024)
+/* Consecutive writes to the same file are combined up to this size */
+#define ASYNC_BATCH_SIZE (64*1024)
+
+/* Protects the queue */
+static void *async_lock;
+/* Held while writing dequeued entries, to keep the writes in order */
+static void *async_write_lock;
+/* Signaled while the queue is non-empty */
+static void *async_event;
+static async_write_t *async_head, *async_tail;
+static size_t async_queued;
+static bool async_active;
+/* Protected by async_write_lock */
+static char async_batch[ASYNC_BATCH_SIZE + 1/*null*/];
+
+static async_write_t *
+async_dequeue_all(void)
+{
+    async_write_t *list;
+    dr_mutex_lock(async_lock);
+    list = async_head;
+    async_head = NULL;
+    async_tail = NULL;
+    async_queued = 0;
+    dr_event_reset(async_event);
+    dr_mutex_unlock(async_lock);
+    return list;
+}
+
+/* Caller must hold async_write_lock */
+static void
+async_write_list(async_write_t *list)
+{
+    async_write_t *e, *next;
+    file_t batch_file = INVALID_FILE;
+    size_t sofar = 0;
+    for (e = list; e != NULL; e = next) {
+        next = e->next;
+        if (sofar > 0 && (e->f != batch_file || sofar + e->size > ASYNC_BATCH_SIZE)) {
+            async_batch[sofar] = '\0';
+            print_buffer(batch_file, async_batch);
+            sofar = 0;
+        }
+        if (e->size > ASYNC_BATCH_SIZE)
+            print_buffer(e->f, e->buf);
+        else {
+            memcpy(async_batch + sofar, e->buf, e->size);
+            sofar += e->size;
+            batch_file = e->f;
+        }
+        global_free(e, sizeof(*e) + e->size, HEAPSTAT_REPORT);
+    }
+    if (sofar > 0) {
+        async_batch[sofar] = '\0';
+        print_buffer(batch_file, async_batch);
+    }
+}
+
+/* Writes out everything queued so far before returning */
+static void
+async_flush(void)
+{
+    if (!async_active)
+        return;
+    dr_mutex_lock(async_write_lock);
+    async_write_list(async_dequeue_all());
+    dr_mutex_unlock(async_write_lock);
+}
+
+static void
+async_writer_thread(void *arg)
+{
+    /* Like the symbol preload threads, we must not be suspended holding a lock
+     * that the app threads' flushes need.
+     */
+    dr_client_thread_set_suspendable(false);
+    while (true) {
+        dr_event_wait(async_event);
+        dr_mutex_lock(async_write_lock);
+        async_write_list(async_dequeue_all());
+        dr_mutex_unlock(async_write_lock);
+    }
+}
+
+static void
+async_init(void)
+{
+    if (async_lock == NULL) {
+        async_lock = dr_mutex_create();
+        async_write_lock = dr_mutex_create();
+        async_event = dr_event_create();
+    }
+    async_active = dr_create_client_thread(async_writer_thread, NULL);
+    if (!async_active)
+        LOG(1, "WARNING: unable to create results writer thread\n");
+}
+
+static void
+async_exit(void)
+{
+    async_flush();
+    /* Anything printed from here on is written directly.  As with the symbol
+     * preload threads, DR terminates our thread, so we leave the locks and the
+     * event in place for it.
+     */
+    async_active = false;
+}
+
+/* Writes buf to f, from the writer thread if -async_results */
+static void
+report_write_buffer(file_t f, char *buf)
+{
+    async_write_t *e;
+    size_t size;
+    bool full;
+    /* Output to the console stays in order with the app's own */
+    if (!async_active || f == STDERR) {
+        print_buffer(f, buf);
+        return;
+    }
+    size = strlen(buf);
+    e = (async_write_t *) global_alloc(sizeof(*e) + size, HEAPSTAT_REPORT);
+    e->f = f;
+    e->size = size;
+    e->next = NULL;
+    memcpy(e->buf, buf, size + 1);
+    dr_mutex_lock(async_lock);
+    if (async_tail == NULL)
+        async_head = e;
+    else
+        async_tail->next = e;
+    async_tail = e;
+    async_queued += size;
+    full = (async_queued > ASYNC_MAX_QUEUED);
+    dr_event_signal(async_event);
+    dr_mutex_unlock(async_lock);
+    if (full) {
+        /* The writer is falling behind: throttle this thread */
+        async_flush();
+    }
+}
+
+/***************************************************************************
+ * -results_jsonl stream
+ */
+
+/* Ids of the modules whose record has been written to f_results_jsonl */
+#define STREAM_MODULE_HASH_BITS 6
+static hashtable_t stream_module_table;
+
+static void
+stream_print_string(char *buf, size_t bufsz, size_t *sofar, const char *str)
+{
+    ssize_t len;
+    const char *c;
+    BUFPRINT(buf, bufsz, *sofar, len, "\"");
+    for (c = str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\')
+            BUFPRINT(buf, bufsz, *sofar, len, "\\%c", *c);
+        else if ((unsigned char)*c < 0x20)
+            BUFPRINT(buf, bufsz, *sofar, len, "\\u%04x", (unsigned char)*c);
+        else
+            BUFPRINT(buf, bufsz, *sofar, len, "%c", *c);
+    }
+    BUFPRINT(buf, bufsz, *sofar, len, "\"");
+}
+
+/* The first error to reference a module writes its path.  Another thread's
+ * error referencing the module may be written first, so readers should
+ * collect all module records before resolving frames.
+ */
+static void
+stream_write_module(const raw_frame_t *raw)
+{
+    char buf[2*MAXIMUM_PATH + 64];
+    size_t sofar = 0;
+    ssize_t len;
+    if (!hashtable_add(&stream_module_table, (void *)(ptr_uint_t)raw->modid,
+                       (void *)(ptr_uint_t)raw->modid))
+        return;
+    BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len,
+             "{\"kind\":\"module\",\"modid\":%d,\"path\":", raw->modid);
+    stream_print_string(buf, BUFFER_SIZE_ELEMENTS(buf), &sofar, raw->modpath);
+    BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len, "}\n");
+    report_write_buffer(f_results_jsonl, buf);
+}
+
+/* Writes one line for a reported error, with its callstack as module ids and
+ * offsets.  buf is free for our use.
+ */
+static void
+stream_write_error(void *drcontext, char *buf, size_t bufsz,
+                   error_toprint_t *etp, stored_error_t *err)
+{
+    size_t sofar = 0;
+    ssize_t len;
+    uint i, num_frames;
+    raw_frame_t raw;
+    BUFPRINT(buf, bufsz, sofar, len,
+             "{\"kind\":\"error\",\"id\":%d,\"type\":\"%s\",\"potential\":%s",
+             err->id, suppress_name[etp->errtype], err->potential ? "true" : "false");
+    if (drcontext != NULL) {
+        BUFPRINT(buf, bufsz, sofar, len, ",\"thread\":%d",
+                 dr_get_thread_id(drcontext));
+    }
+    BUFPRINT(buf, bufsz, sofar, len, ",\"addr\":\""PFX"\",\"size\":"SZFMT,
+             etp->addr, etp->sz);
+    if (etp->errtype == ERROR_UNADDRESSABLE) {
+        BUFPRINT(buf, bufsz, sofar, len, ",\"access\":\"%s\"",
+                 etp->access_type == DR_MEMPROT_WRITE ? "write" :
+                 (etp->access_type == DR_MEMPROT_EXEC ? "execute" : "read"));
+    } else if (etp->errtype == ERROR_UNDEFINED && etp->addr < (app_pc)(64*1024)) {
+        /* See print_error_to_buffer() on this hack for registers */
+        BUFPRINT(buf, bufsz, sofar, len, ",\"register\":\"%s\"",
+                 (etp->addr == (app_pc)REG_EFLAGS) ?
+                 "eflags" : get_register_name((reg_id_t)(ptr_uint_t)etp->addr));
+    } else if (type_is_leak(etp->errtype)) {
+        BUFPRINT(buf, bufsz, sofar, len, ",\"indirect_size\":"SZFMT,
+                 etp->indirect_size);
+    }
+    if (etp->msg != NULL) {
+        BUFPRINT(buf, bufsz, sofar, len, ",\"msg\":");
+        stream_print_string(buf, bufsz, &sofar, etp->msg);
+    }
+    BUFPRINT(buf, bufsz, sofar, len, ",\"frames\":[");
+    num_frames = (err->pcs == NULL) ? 0 : packed_callstack_num_frames(err->pcs);
+    for (i = 0; i < num_frames; i++) {
+        packed_callstack_frame_raw(err->pcs, i, &raw);
+        if (i > 0)
+            BUFPRINT(buf, bufsz, sofar, len, ",");
+        if (raw.is_syscall) {
+            BUFPRINT(buf, bufsz, sofar, len, "{\"syscall\":\"%d.%d\"}",
+                     raw.sysnum.number, raw.sysnum.secondary);
+        } else if (raw.modpath == NULL) {
+            BUFPRINT(buf, bufsz, sofar, len, "{\"pc\":\""PFX"\"}", raw.pc);
+        } else {
+            stream_write_module(&raw);
+            BUFPRINT(buf, bufsz, sofar, len,
+                     "{\"modid\":%d,\"offs\":\""PIFX"\",\"retaddr\":%s}",
+                     raw.modid, raw.modoffs, raw.is_retaddr ? "true" : "false");
+        }
+    }
+    BUFPRINT(buf, bufsz, sofar, len, "]}\n");
+    report_write_buffer(f_results_jsonl, buf);
+}
+
+/* Writes the final count of each reported error */
+static void
+stream_write_counts(void)
+{
+    char buf[128];
+    size_t sofar;
+    ssize_t len;
+    stored_error_t *err;
+    dr_mutex_lock(error_lock);
+    for (err = error_head; err != NULL; err = err->next) {
+        if (err->id == 0 || err->suppressed)
+            continue;
+        sofar = 0;
+        BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len,
+                 "{\"kind\":\"count\",\"id\":%d,\"potential\":%s,\"count\":%d}\n",
+                 err->id, err->potential ? "true" : "false", err->count);
+        report_write_buffer(f_results_jsonl, buf);
+    }
+    dr_mutex_unlock(error_lock);
+}
+
+/***************************************************************************
+ * -live_summary page
+ */
+
+#define LIVE_SUMMARY_FNAME "live_summary.bin"
+
+static live_summary_t *live_summary;
+static size_t live_summary_size;
+static file_t live_summary_file = INVALID_FILE;
+
+static void
+live_summary_init(void)
+{
+    char fname[MAXIMUM_PATH];
+    byte *zeros;
+    size_t size = ALIGN_FORWARD(sizeof(*live_summary), dr_page_size());
+    uint i;
+    ASSERT(ERROR_MAX_VAL <= LIVE_SUMMARY_MAX_TYPES, "live summary too small");
+    dr_snprintf(fname, BUFFER_SIZE_ELEMENTS(fname), "%s%c%s",
+                logsubdir, DIRSEP, LIVE_SUMMARY_FNAME);
+    NULL_TERMINATE_BUFFER(fname);
+    live_summary_file = dr_open_file(fname, DR_FILE_READ | DR_FILE_WRITE_OVERWRITE);
+    if (live_summary_file == INVALID_FILE) {
+        NOTIFY_ERROR("Unable to create %s for -live_summary"NL, fname);
+        return;
+    }
+    /* The file must be as large as the mapping */
+    zeros = (byte *) global_alloc(size, HEAPSTAT_REPORT);
+    memset(zeros, 0, size);
+    if (dr_write_file(live_summary_file, zeros, size) == (ssize_t) size) {
+        live_summary_size = size;
+        live_summary = (live_summary_t *)
+            dr_map_file(live_summary_file, &live_summary_size, 0, NULL,
+                        DR_MEMPROT_READ | DR_MEMPROT_WRITE, 0/*shared*/);
+    }
+    global_free(zeros, size, HEAPSTAT_REPORT);
+    if (live_summary == NULL || live_summary_size < sizeof(*live_summary)) {
+        NOTIFY_ERROR("Unable to map %s for -live_summary"NL, fname);
+        if (live_summary != NULL)
+            dr_unmap_file(live_summary, live_summary_size);
+        live_summary = NULL;
+        dr_close_file(live_summary_file);
+        live_summary_file = INVALID_FILE;
+        return;
+    }
+    live_summary->version = LIVE_SUMMARY_VERSION;
+    live_summary->size = sizeof(*live_summary);
+    live_summary->pid = dr_get_process_id();
+    live_summary->num_types = ERROR_MAX_VAL;
+    for (i = 0; i < ERROR_MAX_VAL; i++) {
+        dr_snprintf(live_summary->type_name[i], LIVE_SUMMARY_NAME_LEN, "%s",
+                    suppress_name[i]);
+        live_summary->type_name[i][LIVE_SUMMARY_NAME_LEN - 1] = '\0';
+    }
+    /* Readers check the magic last */
+    memcpy(live_summary->magic, LIVE_SUMMARY_MAGIC, sizeof(live_summary->magic));
+}
+
+static void
+live_summary_exit(void)
+{
+    if (live_summary == NULL)
+        return;
+    dr_unmap_file(live_summary, live_summary_size);
+    live_summary = NULL;
+    dr_close_file(live_summary_file);
+    live_summary_file = INVALID_FILE;
+}
+
+/* Copies the current counts into the page.  Leak counts are only consistent
+ * once a scan has finished, so they are copied only if leaks is true.
+ * The caller must hold error_lock, which also serializes writers.
+ */
+static void
+live_summary_update(bool leaks)
+{
+    uint set, i;
+    if (live_summary == NULL)
+        return;
+    ATOMIC_INC32(live_summary->seq);
+    for (set = 0; set < ERROR_SET_NUM; set++) {
+        for (i = 0; i < ERROR_MAX_VAL; i++) {
+            if (type_is_leak(i) && !leaks)
+                continue;
+            live_summary->unique[set][i] = num_unique[set][i];
+            live_summary->total[set][i] = num_total[set][i];
+            live_summary->bytes_leaked[set][i] = num_bytes_leaked[set][i];
+        }
+    }
+    live_summary->suppressed_user = num_suppressions_matched_user;
+    live_summary->suppressed_default = num_suppressions_matched_default;
+    live_summary->throttled_errors = num_throttled_errors;
+    if (leaks) {
+        live_summary->suppressed_leaks_user = num_suppressed_leaks_user;
+        live_summary->suppressed_leaks_default = num_suppressed_leaks_default;
+        live_summary->throttled_leaks = num_throttled_leaks;
+        live_summary->leak_scans++;
+    }
+    live_summary->update_time = dr_get_milliseconds() - timestamp_start;
+    ATOMIC_INC32(live_summary->seq);
+}
+
 /***************************************************************************
  * suppression list
  */
@@ -376,6 +814,10 @@ struct _suppress_spec_t {
     suppress_frame_t *last_frame;
     bool is_default; /* from default file, or user-specified? */
     bool is_memcheck_syscall;
+    /* Whether this can be compared to an unsymbolized callstack: it names no
+     * functions in modules and has no "..." frames.
+     */
+    bool unsymbolized_ok;
     size_t bytes_leaked;
     /* During initial reading it's easier to build a linked list.
      * We could convert to an array after reading both suppress files,
@@ -390,8 +832,55 @@ static suppress_spec_t *supp_list[ERROR_MAX_VAL];
 static uint supp_num[ERROR_MAX_VAL];
 static bool have_module_wildcard;
 
+/* With thousands of suppressions, comparing each error to every one of them
+ * is slow.  We index each type's suppressions by their top frame's function
+ * or module offset when it has no wildcards, and keep the rest on a list that
+ * is always checked.  Each index list is kept in supp_list order (newest
+ * first) so the first spec to match is the same as with a supp_list walk.
+ */
+typedef struct _suppress_ref_t {
+    suppress_spec_t *spec;
+    struct _suppress_ref_t *next;
+} suppress_ref_t;
+
+#define SUPPRESS_INDEX_HASH_BITS 10
+/* The wildcard list plus function and offset lists for 2 error frames */
+#define SUPPRESS_MAX_CANDIDATE_LISTS 5
+static hashtable_t supp_func_index[ERROR_MAX_VAL];
+static hashtable_t supp_offs_index[ERROR_MAX_VAL];
+static suppress_ref_t *supp_wild[ERROR_MAX_VAL];
+/* One past the highest num of each type's specs that are not unsymbolized_ok.
+ * An unsymbolized callstack can only be compared to specs from here on, as
+ * those it cannot be compared to would be tried first.
+ */
+static uint supp_symbolic_num_end[ERROR_MAX_VAL];
+
 static void *suppress_file_lock;
 
+/* Generated suppressions are gathered here, under suppress_file_lock, and
+ * written out in bulk when the buffer fills and at each summary, rather than
+ * with a write per line for every error.
+ */
+#define SUPPRESS_GEN_BUFSZ (64*1024)
+/* Room for the longest line we print, below which we flush first */
+#define SUPPRESS_GEN_LINE_MAX (2*MAXIMUM_PATH + 64)
+static char *suppress_gen_buf;
+static size_t suppress_gen_sofar;
+
+#define SUPPRESS_GEN_PRINT(...) do {                                         \
+    ssize_t len_;                                                            \
+    if (SUPPRESS_GEN_BUFSZ - suppress_gen_sofar < SUPPRESS_GEN_LINE_MAX)     \
+        suppress_gen_flush();                                                \
+    BUFPRINT_NO_ASSERT(suppress_gen_buf, SUPPRESS_GEN_BUFSZ, suppress_gen_sofar, \
+                       len_, __VA_ARGS__);                                   \
+} while (0)
+
+/* With -lazy_suppress we do not parse the suppression files until the first
+ * error needs them: many short-lived child processes never report one.
+ */
+static volatile bool suppress_loaded;
+static void *suppress_load_lock;
+
 static void
 error_callstack_init(error_callstack_t *ecs)
 {
@@ -451,6 +940,7 @@ suppress_spec_create(int type, bool is_default)
     spec->type = type; /* may be -1 initially for Valgrind format */
     spec->count_used = 0;
     spec->is_default = is_default;
+    spec->unsymbolized_ok = false;
     spec->bytes_leaked = 0;
     spec->name = NULL; /* for i#50 NYI */
     spec->num = num_suppressions;
@@ -516,6 +1006,110 @@ suppress_spec_free(suppress_spec_t *spec)
     global_free(spec, sizeof(*spec), HEAPSTAT_REPORT);
 }
 
+static void
+suppress_ref_list_free(suppress_ref_t *ref)
+{
+    suppress_ref_t *next;
+    for (; ref != NULL; ref = next) {
+        next = ref->next;
+        global_free(ref, sizeof(*ref), HEAPSTAT_REPORT);
+    }
+}
+
+static void
+suppress_index_init(void)
+{
+    int i;
+    for (i = 0; i < ERROR_MAX_VAL; i++) {
+        /* The keys point into the specs' frames, which outlive the tables.
+         * Only init adds to the tables, so no synch is needed.
+         */
+        hashtable_init_ex(&supp_func_index[i], SUPPRESS_INDEX_HASH_BITS, HASH_STRING,
+                          false/*!str_dup*/, false/*!synch*/,
+                          (void (*)(void*)) suppress_ref_list_free, NULL, NULL);
+        /* Module offsets are compared case-insensitively */
+        hashtable_init_ex(&supp_offs_index[i], SUPPRESS_INDEX_HASH_BITS,
+                          HASH_STRING_NOCASE, false/*!str_dup*/, false/*!synch*/,
+                          (void (*)(void*)) suppress_ref_list_free, NULL, NULL);
+        supp_wild[i] = NULL;
+    }
+}
+
+static void
+suppress_index_exit(void)
+{
+    int i;
+    for (i = 0; i < ERROR_MAX_VAL; i++) {
+        hashtable_delete(&supp_func_index[i]);
+        hashtable_delete(&supp_offs_index[i]);
+        suppress_ref_list_free(supp_wild[i]);
+        supp_wild[i] = NULL;
+    }
+}
+
+static void
+suppress_index_add(suppress_spec_t *spec)
+{
+    suppress_frame_t *top = spec->frames;
+    hashtable_t *table = NULL;
+    const char *key = NULL;
+    suppress_ref_t *ref = (suppress_ref_t *)
+        global_alloc(sizeof(*ref), HEAPSTAT_REPORT);
+    ref->spec = spec;
+    if (!top->is_ellipsis && !top->is_star) {
+        if (top->func != NULL) {
+            table = &supp_func_index[spec->type];
+            key = top->func;
+        } else if (top->is_module && top->modoffs != NULL) {
+            table = &supp_offs_index[spec->type];
+            key = top->modoffs;
+        }
+    }
+    /* A replace_* top frame can be skipped in matching (i#1189), so it does
+     * not determine what the error's top frame is.
+     */
+    if (key != NULL &&
+        (strchr(key, '*') != NULL || strchr(key, '?') != NULL ||
+         text_matches_pattern(key, "replace_*", false/*consider case*/)))
+        key = NULL;
+    if (key == NULL) {
+        ref->next = supp_wild[spec->type];
+        supp_wild[spec->type] = ref;
+    } else {
+        ref->next = (suppress_ref_t *) hashtable_lookup(table, (void *)key);
+        hashtable_add_replace(table, (void *)key, (void *)ref);
+    }
+}
+
+/* Adds the index lists that error frame idx can match */
+static void
+suppress_index_lookup(uint type, const error_callstack_t *ecs, uint idx,
+                      suppress_ref_t **lists, uint *num_lists INOUT)
+{
+    suppress_ref_t *found[2] = {NULL, NULL};
+    const char *func = symbolized_callstack_frame_func(&ecs->scs, idx);
+    const char *modoffs = symbolized_callstack_frame_modoffs(&ecs->scs, idx);
+    uint i, j;
+    if (func != NULL)
+        found[0] = (suppress_ref_t *) hashtable_lookup(&supp_func_index[type],
+                                                       (void *)func);
+    if (modoffs != NULL && modoffs[0] != '\0')
+        found[1] = (suppress_ref_t *) hashtable_lookup(&supp_offs_index[type],
+                                                       (void *)modoffs);
+    for (i = 0; i < BUFFER_SIZE_ELEMENTS(found); i++) {
+        if (found[i] == NULL)
+            continue;
+        for (j = 0; j < *num_lists; j++) {
+            if (lists[j] == found[i])
+                break;
+        }
+        if (j == *num_lists) {
+            ASSERT(*num_lists < SUPPRESS_MAX_CANDIDATE_LISTS, "too many lists");
+            lists[(*num_lists)++] = found[i];
+        }
+    }
+}
+
 /* Return true if the suppression has a single frame covering an entire module.
  * We can handle single frame expressions that match the current instruction.
  */
@@ -535,6 +1129,7 @@ suppress_spec_finish(suppress_spec_t *spec,
                      const char *orig_start,
                      const char *orig_end)
 {
+    suppress_frame_t *frame;
     ASSERT(spec->type >= 0 && spec->type < ERROR_MAX_VAL, "internal error type error");
     if (spec->frames == NULL) {
         report_malformed_suppression(orig_start, orig_end,
@@ -547,9 +1142,22 @@ suppress_spec_finish(suppress_spec_t *spec,
         ASSERT(false, "should not reach here");
     }
     LOG(3, "added suppression #%d of type %s\n", spec->num, suppress_name[spec->type]);
+    /* A "..." frame can match error frames past a -callstack_truncate_below
+     * frame, which only symbolizing would truncate.  Without "..." we assume
+     * a spec does not list frames past such a frame, as any spec generated
+     * from a truncated callstack ends at it.
+     */
+    spec->unsymbolized_ok = true;
+    for (frame = spec->frames; frame != NULL; frame = frame->next) {
+        if (frame->is_ellipsis || (frame->is_module && frame->func != NULL))
+            spec->unsymbolized_ok = false;
+    }
+    if (!spec->unsymbolized_ok)
+        supp_symbolic_num_end[spec->type] = spec->num + 1;
     /* insert into list */
     spec->next = supp_list[spec->type];
     supp_list[spec->type] = spec;
+    suppress_index_add(spec);
     supp_num[spec->type]++;
     num_suppressions++;
     if (is_module_wildcard(spec)) {
@@ -918,7 +1526,52 @@ open_and_read_suppression_file(const char *fname, bool is_default)
     }
 }
 
-/* up to caller to lock f_results file */
+/* Reads the default and user suppression files, once */
+static void
+suppress_load(void)
+{
+    const char *c;
+    if (suppress_loaded)
+        return;
+    dr_mutex_lock(suppress_load_lock);
+    if (!suppress_loaded) {
+        if (options.default_suppress) {
+            /* the default suppression file must be located at
+             *   dr_get_client_path()/../suppress-default.txt
+             */
+            const char *const DEFAULT_SUPPRESS_NAME = "suppress-default.txt";
+            char dname[MAXIMUM_PATH];
+            if (obtain_configfile_path(dname, BUFFER_SIZE_ELEMENTS(dname),
+                                        DEFAULT_SUPPRESS_NAME))
+                open_and_read_suppression_file(dname, true);
+            else
+                ASSERT(false, "default-suppress snprintf error");
+        }
+
+        /* we support multiple suppress file (i#574) */
+        c = options.suppress;
+        while (*c != '\0') {
+            open_and_read_suppression_file(c, false);
+            c += strlen(c) + 1;
+        }
+        suppress_loaded = true;
+    }
+    dr_mutex_unlock(suppress_load_lock);
+}
+
+/* Caller must hold suppress_file_lock */
+static void
+suppress_gen_flush(void)
+{
+    ASSERT(dr_mutex_self_owns(suppress_file_lock), "caller must hold lock");
+    if (suppress_gen_sofar == 0)
+        return;
+    suppress_gen_buf[suppress_gen_sofar] = '\0';
+    report_write_buffer(f_suppress, suppress_gen_buf);
+    suppress_gen_sofar = 0;
+}
+
+/* up to caller to hold suppress_file_lock */
 static void
 write_suppress_pattern(uint type, symbolized_callstack_t *scs, bool symbolic, uint id)
 {
@@ -926,8 +1579,8 @@ write_suppress_pattern(uint type, symbolized_callstack_t *scs, bool symbolic, ui
     ASSERT(type >= 0 && type < ERROR_MAX_VAL, "invalid error type");
     ASSERT(scs != NULL, "invalid param");
 
-    dr_fprintf(f_suppress, "%s"NL, suppress_name[type]);
-    dr_fprintf(f_suppress, "name=Error #%d (update to meaningful name)"NL, id);
+    SUPPRESS_GEN_PRINT("%s"NL, suppress_name[type]);
+    SUPPRESS_GEN_PRINT("name=Error #%d (update to meaningful name)"NL, id);
 
     for (i = 0; i < scs->num_frames; i++) {
         if (symbolized_callstack_frame_is_module(scs, i)) {
@@ -936,17 +1589,15 @@ write_suppress_pattern(uint type, symbolized_callstack_t *scs, bool symbolic, ui
                 /* i#285: replace ? with * */
                 if (strcmp(func, "?") == 0)
                     func = "*";
-                dr_fprintf(f_suppress, "%s!%s"NL,
-                           symbolized_callstack_frame_modname(scs, i), func);
+                SUPPRESS_GEN_PRINT("%s!%s"NL,
+                                   symbolized_callstack_frame_modname(scs, i), func);
             } else {
-                dr_fprintf(f_suppress, "<%s+%s>"NL,
-                           symbolized_callstack_frame_modname(scs, i),
-                           symbolized_callstack_frame_modoffs(scs, i));
+                SUPPRESS_GEN_PRINT("<%s+%s>"NL,
+                                   symbolized_callstack_frame_modname(scs, i),
+                                   symbolized_callstack_frame_modoffs(scs, i));
             }
-        } else {
-            dr_fprintf(f_suppress, "%s"NL,
-                       symbolized_callstack_frame_func(scs, i));
-        }
+        } else
+            SUPPRESS_GEN_PRINT("%s"NL, symbolized_callstack_frame_func(scs, i));
     }
 }
 
@@ -961,15 +1612,15 @@ report_error_suppression(uint type, error_callstack_t *ecs, uint id)
      * could not create any file at all: for now we create an empty
      * file for simplicity
      */
-    dr_fprintf(f_suppress, "# Suppression for Error #%d"NL, id);
+    SUPPRESS_GEN_PRINT("# Suppression for Error #%d"NL, id);
     if (options.gen_suppress_syms)
         write_suppress_pattern(type, &ecs->scs, true/*mod!func*/, id);
     if (options.gen_suppress_offs) {
         if (options.gen_suppress_syms)
-            dr_fprintf(f_suppress, "\n## Mod+offs-style suppression for Error #%d:"NL, id);
+            SUPPRESS_GEN_PRINT("\n## Mod+offs-style suppression for Error #%d:"NL, id);
         write_suppress_pattern(type, &ecs->scs, false/*mod+offs*/, id);
     }
-    dr_fprintf(f_suppress, ""NL);
+    SUPPRESS_GEN_PRINT(""NL);
     dr_mutex_unlock(suppress_file_lock);
 }
 
@@ -1108,13 +1759,50 @@ stack_matches_suppression(const error_callstack_t *ecs, const suppress_spec_t *s
     return (supp == NULL);
 }
 
+/* If unsymbolized, ecs is from packed_callstack_to_unsymbolized() and we
+ * only return true if the first spec to match is unsymbolized_ok.
+ */
 static bool
-on_suppression_list_helper(uint type, error_callstack_t *ecs,
+on_suppression_list_helper(uint type, error_callstack_t *ecs, bool unsymbolized,
                            suppress_spec_t **matched OUT)
 {
     suppress_spec_t *spec;
+    suppress_ref_t *lists[SUPPRESS_MAX_CANDIDATE_LISTS];
+    uint num_lists = 0, i, best;
     ASSERT(type >= 0 && type < ERROR_MAX_VAL, "invalid error type");
-    for (spec = supp_list[type]; spec != NULL; spec = spec->next) {
+    suppress_load();
+    if (unsymbolized && options.replace_malloc && ecs->scs.num_frames > 0 &&
+        text_matches_pattern(symbolized_callstack_frame_modname(&ecs->scs, 0),
+                             DRMEMORY_LIBNAME, FILESYS_CASELESS)) {
+        /* Skipping a replace_ top frame (i#1189) needs its function name */
+        return false;
+    }
+    lists[num_lists++] = supp_wild[type];
+    if (ecs->scs.num_frames > 0) {
+        const char *top_func = symbolized_callstack_frame_func(&ecs->scs, 0);
+        suppress_index_lookup(type, ecs, 0, lists, &num_lists);
+        /* A top replace_ frame may be skipped in matching (i#1189) */
+        if (options.replace_malloc && top_func != NULL &&
+            text_matches_pattern(top_func, "replace_*", false/*consider case*/))
+            suppress_index_lookup(type, ecs, 1, lists, &num_lists);
+    }
+    while (true) {
+        /* Merge the candidate lists to visit specs in supp_list order */
+        best = num_lists;
+        for (i = 0; i < num_lists; i++) {
+            if (lists[i] != NULL &&
+                (best == num_lists || lists[i]->spec->num > lists[best]->spec->num))
+                best = i;
+        }
+        if (best == num_lists)
+            break;
+        spec = lists[best]->spec;
+        lists[best] = lists[best]->next;
+        if (unsymbolized && spec->num < supp_symbolic_num_end[type]) {
+            /* A spec we cannot compare to may come first */
+            return false;
+        }
+        ASSERT(!unsymbolized || spec->unsymbolized_ok, "invalid unsymbolized compare");
         DOLOG(3, {
             suppress_frame_print(LOGFILE_LOOKUP(), spec->frames,
                                  "supp: comparing error to suppression pattern");
@@ -1137,17 +1825,169 @@ static bool
 on_suppression_list(uint type, error_callstack_t *ecs, suppress_spec_t **matched OUT)
 {
     ASSERT(type >= 0 && type < ERROR_MAX_VAL, "invalid error type");
-    if (on_suppression_list_helper(type, ecs, matched))
+    if (on_suppression_list_helper(type, ecs, false/*symbolized*/, matched))
         return true;
     /* qualified leak reports should be checked against LEAK suppressions */
     if (type_is_leak(type) && type != ERROR_LEAK) {
-        if (on_suppression_list_helper(ERROR_LEAK, ecs, matched))
+        if (on_suppression_list_helper(ERROR_LEAK, ecs, false/*symbolized*/, matched))
             return true;
     }
     LOG(3, "supp: no match\n");
     return false;
 }
 
+static uint
+suppress_verdict_hash(suppress_verdict_t *verdict)
+{
+    return packed_callstack_hash(verdict->pcs) ^ verdict->type;
+}
+
+static bool
+suppress_verdict_cmp(suppress_verdict_t *v1, suppress_verdict_t *v2)
+{
+    if (v1->type != v2->type)
+        return false;
+    if ((v1->instruction == NULL) != (v2->instruction == NULL) ||
+        (v1->instruction != NULL && strcmp(v1->instruction, v2->instruction) != 0))
+        return false;
+    return packed_callstack_cmp(v1->pcs, v2->pcs);
+}
+
+static void
+suppress_verdict_free(suppress_verdict_t *verdict)
+{
+    packed_callstack_free(verdict->pcs);
+    if (verdict->instruction != NULL) {
+        global_free(verdict->instruction, strlen(verdict->instruction) + 1,
+                    HEAPSTAT_REPORT);
+    }
+    global_free(verdict, sizeof(*verdict), HEAPSTAT_REPORT);
+}
+
+static uint
+dup_pc_hash(dup_pc_t *dup)
+{
+    return (uint)(ptr_uint_t)dup->pc ^ dup->type;
+}
+
+static bool
+dup_pc_cmp(dup_pc_t *dup1, dup_pc_t *dup2)
+{
+    return dup1->pc == dup2->pc && dup1->type == dup2->type;
+}
+
+static void
+dup_pc_free(dup_pc_t *dup)
+{
+    global_free(dup, sizeof(*dup), HEAPSTAT_REPORT);
+}
+
+/* Returns whether a verdict for this callstack and type was already recorded,
+ * in which case it is treated as another match, and sets *matched to the spec,
+ * or NULL if not suppressed.  Caller must hold error_lock.
+ */
+static bool
+suppress_verdict_lookup(uint type, packed_callstack_t *pcs, const char *instruction,
+                        suppress_spec_t **matched OUT)
+{
+    suppress_verdict_t key, *verdict;
+    key.type = type;
+    key.pcs = pcs;
+    key.instruction = (instruction[0] == '\0') ? NULL : (char *) instruction;
+    verdict = (suppress_verdict_t *) hashtable_lookup(&verdict_table, (void *)&key);
+    if (verdict == NULL)
+        return false;
+    LOG(3, "supp: reusing verdict for callstack: %s\n",
+        verdict->spec == NULL ? "no match" :
+        (verdict->spec->name == NULL ? "<no name>" : verdict->spec->name));
+    /* Match on_suppression_list_helper()'s accounting */
+    if (verdict->spec != NULL)
+        verdict->spec->count_used++;
+    *matched = verdict->spec;
+    return true;
+}
+
+/* Caller must hold error_lock */
+static void
+suppress_verdict_record(uint type, packed_callstack_t *pcs, const char *instruction,
+                        suppress_spec_t *matched)
+{
+    suppress_verdict_t *verdict = (suppress_verdict_t *)
+        global_alloc(sizeof(*verdict), HEAPSTAT_REPORT);
+    verdict->type = type;
+    /* Leak callstacks are shared with the malloc table, whose refcounts we
+     * must not perturb, so we clone like record_error() does.
+     */
+    verdict->pcs = packed_callstack_clone(pcs);
+    verdict->instruction = (instruction[0] == '\0') ? NULL :
+        drmem_strdup(instruction, HEAPSTAT_REPORT);
+    verdict->spec = matched;
+    if (!hashtable_add(&verdict_table, (void *)verdict, (void *)verdict))
+        suppress_verdict_free(verdict);
+}
+
+static inline bool
+suppressed_errors_logged(void)
+{
+    return (options.log_suppressed_errors || options.verbose >= 2);
+}
+
+/* Tries to find out whether pcs is suppressed without symbolizing it, from a
+ * prior verdict or a spec that only names module offsets.  Returns whether it
+ * did, in which case *matched is the spec, or NULL if not suppressed.
+ * Caller must hold error_lock.
+ */
+static bool
+suppress_check_unsymbolized(uint type, packed_callstack_t *pcs, error_callstack_t *ecs,
+                            suppress_spec_t **matched OUT)
+{
+    bool res;
+    if (suppress_verdict_lookup(type, pcs, ecs->instruction, matched))
+        return true;
+    if (packed_callstack_num_frames(pcs) == 0)
+        return false;
+    packed_callstack_to_unsymbolized(pcs, &ecs->scs);
+    res = on_suppression_list_helper(type, ecs, true/*unsymbolized*/, matched);
+    symbolized_callstack_free(&ecs->scs);
+    ecs->scs.num_frames = 0;
+    ecs->scs.frames = NULL;
+    if (!res)
+        return false;
+    LOG(3, "supp: matched without symbols\n");
+    suppress_verdict_record(type, pcs, ecs->instruction, *matched);
+    return true;
+}
+
+/* Compares ecs, symbolized from pcs, to suppressions and records the verdict.
+ * Caller must hold error_lock.
+ */
+static bool
+suppress_check_symbolized(uint type, packed_callstack_t *pcs, error_callstack_t *ecs,
+                          suppress_spec_t **matched OUT)
+{
+    bool res = on_suppression_list(type, ecs, matched);
+    suppress_verdict_record(type, pcs, ecs->instruction, res ? *matched : NULL);
+    return res;
+}
+
+/* Like on_suppression_list() but reuses and records verdicts by callstack.
+ * Symbolizes pcs into ecs, unless pcs is found to be suppressed without
+ * symbols and suppressed errors are not logged, which is the common case that
+ * makes this worthwhile.  Caller must hold error_lock.
+ */
+static bool
+on_suppression_list_memoized(uint type, packed_callstack_t *pcs, error_callstack_t *ecs,
+                             suppress_spec_t **matched OUT)
+{
+    if (suppress_check_unsymbolized(type, pcs, ecs, matched)) {
+        if (*matched == NULL || suppressed_errors_logged())
+            packed_callstack_to_symbolized(pcs, &ecs->scs);
+        return (*matched != NULL);
+    }
+    packed_callstack_to_symbolized(pcs, &ecs->scs);
+    return suppress_check_symbolized(type, pcs, ecs, matched);
+}
+
 /* Returns true if we have a whole-module suppression of the same type covering
  * the app pc.  Updates the suppression usage counts if it does.
  */
@@ -1208,7 +2048,7 @@ typedef struct _per_callstack_module_t {
     bool on_blocklist;
     bool on_allowlist;
     bool in_tool;
-    bool on_check_uninit_blocklist;
+    module_check_level_t check_level;
 } per_callstack_module_t;
 
 static void *
@@ -1230,12 +2070,17 @@ callstack_module_load_cb(const char *path, const char *modname, byte *base)
                                                   FILESYS_CASELESS));
     mod->in_tool = (path != NULL &&
                     text_matches_pattern(modname, DRMEMORY_LIBNAME, FILESYS_CASELESS));
-    mod->on_check_uninit_blocklist =
-        (modname != NULL && options.check_uninit_blocklist[0] != '\0' &&
-         text_matches_any_pattern(modname, options.check_uninit_blocklist,
-                                  FILESYS_CASELESS));
-    LOG(1, "%s: %s => block=%d allow=%d uninit=%d\n", __FUNCTION__, path,
-        mod->on_blocklist, mod->on_allowlist, mod->on_check_uninit_blocklist);
+    if (modname != NULL && options.lib_check_none[0] != '\0' &&
+        text_matches_any_pattern(modname, options.lib_check_none, FILESYS_CASELESS))
+        mod->check_level = MODULE_CHECK_NONE;
+    else if (modname != NULL && options.check_uninit_blocklist[0] != '\0' &&
+             text_matches_any_pattern(modname, options.check_uninit_blocklist,
+                                      FILESYS_CASELESS))
+        mod->check_level = MODULE_CHECK_ADDR_ONLY;
+    else
+        mod->check_level = MODULE_CHECK_FULL;
+    LOG(1, "%s: %s => block=%d allow=%d check=%d\n", __FUNCTION__, path,
+        mod->on_blocklist, mod->on_allowlist, mod->check_level);
     return (void *) mod;
 }
 
@@ -1310,8 +2155,8 @@ check_blocklist_and_allowlist(error_callstack_t *ecs, uint start)
     return false;
 }
 
-bool
-module_is_on_check_uninit_blocklist(app_pc pc)
+module_check_level_t
+module_check_level(app_pc pc)
 {
     /* We use TLS to cache the last lookup.  For -no_fastpath, or a series of
      * fastpath entrances, we expect a whole bunch of queries for the same module.
@@ -1325,13 +2170,21 @@ module_is_on_check_uninit_blocklist(app_pc pc)
             module_lookup_user_data(pc, &pt->last_query_mod_start,
                                     &pt->last_query_mod_size);
         if (mod != NULL)
-            pt->last_query_res = mod->on_check_uninit_blocklist;
+            pt->last_query_res = mod->check_level;
+        else if (options.jit_addr_only && module_lookup_preferred_name(pc) == NULL)
+            pt->last_query_res = MODULE_CHECK_ADDR_ONLY; /* JIT or other non-module */
         else
-            pt->last_query_res = false;
+            pt->last_query_res = MODULE_CHECK_FULL;
     }
     return pt->last_query_res;
 }
 
+bool
+module_is_on_check_uninit_blocklist(app_pc pc)
+{
+    return module_check_level(pc) != MODULE_CHECK_FULL;
+}
+
 static bool
 error_is_likely_false_positive(error_callstack_t *ecs, error_toprint_t *etp)
 {
@@ -1461,7 +2314,6 @@ missing_syms_cb(const char *modpath)
 void
 report_init(void)
 {
-    char *c;
     callstack_options_t callstack_ops = { sizeof(callstack_ops), 0 };
 
     timestamp_start = dr_get_milliseconds();
@@ -1482,6 +2334,22 @@ report_init(void)
                       (void (*)(void*)) stored_error_free,
                       (uint (*)(void*)) stored_error_hash,
                       (bool (*)(void*, void*)) stored_error_cmp);
+    hashtable_init_ex(&verdict_table, VERDICT_HASH_BITS, HASH_CUSTOM,
+                      false/*!str_dup*/, false/*using error_lock*/,
+                      (void (*)(void*)) suppress_verdict_free,
+                      (uint (*)(void*)) suppress_verdict_hash,
+                      (bool (*)(void*, void*)) suppress_verdict_cmp);
+    if (options.dup_pc_threshold > 0) {
+        hashtable_init_ex(&dup_pc_table, DUP_PC_HASH_BITS, HASH_CUSTOM,
+                          false/*!str_dup*/, false/*using error_lock*/,
+                          (void (*)(void*)) dup_pc_free,
+                          (uint (*)(void*)) dup_pc_hash,
+                          (bool (*)(void*, void*)) dup_pc_cmp);
+    }
+    if (options.report_site_max >= 0) {
+        hashtable_init_ex(&site_table, SITE_HASH_BITS, HASH_INTPTR, false/*!str_dup*/,
+                          false/*using error_lock*/, NULL, NULL, NULL);
+    }
 
     /* callstack.c wants these as null-separated, double-null-terminated */
     convert_commas_to_nulls(options.callstack_truncate_below,
@@ -1541,6 +2409,10 @@ report_init(void)
     callstack_ops.fp_flags = 0;
     if (!options.callstack_use_fp)
         callstack_ops.fp_flags |= FP_DO_NOT_WALK_FP;
+#ifdef LINUX
+    if (options.callstack_use_unwind_info)
+        callstack_ops.fp_flags |= FP_USE_UNWIND_INFO;
+#endif
     if (options.callstack_conservative) {
         /* We don't expose FP_VERIFY_CROSS_MODULE_TARGET, although it can be a big
          * perf win over FP_VERIFY_CALL_TARGET (see i#703 numbers) -- so should we
@@ -1549,6 +2421,7 @@ report_init(void)
         callstack_ops.fp_flags |= FP_VERIFY_CALL_TARGET;
     }
     callstack_ops.fp_scan_sz = options.callstack_max_scan;
+    callstack_ops.fp_cache_entries = options.callstack_fp_cache_size;
     callstack_ops.print_flags = options.callstack_style;
     callstack_ops.get_syscall_name = get_syscall_name;
     callstack_ops.is_dword_defined =
@@ -1578,6 +2451,11 @@ report_init(void)
     callstack_init(&callstack_ops);
 
     suppress_file_lock = dr_mutex_create();
+    report_spare_lock = dr_mutex_create();
+    if (options.gen_suppress_syms || options.gen_suppress_offs) {
+        suppress_gen_buf = (char *)
+            global_alloc(SUPPRESS_GEN_BUFSZ + 1/*null*/, HEAPSTAT_REPORT);
+    }
     ELOGF(0, f_results, "Dr. Memory results for pid %d: \"%s\""NL,
           dr_get_process_id(), dr_get_application_name());
 #ifdef WINDOWS
@@ -1613,25 +2491,19 @@ report_init(void)
           "unaddressable errors, consider running with -light to skip all "
           "uninitialized reads and leaks for higher performance."NL);
 
-    if (options.default_suppress) {
-        /* the default suppression file must be located at
-         *   dr_get_client_path()/../suppress-default.txt
-         */
-        const char *const DEFAULT_SUPPRESS_NAME = "suppress-default.txt";
-        char dname[MAXIMUM_PATH];
-        if (obtain_configfile_path(dname, BUFFER_SIZE_ELEMENTS(dname),
-                                    DEFAULT_SUPPRESS_NAME))
-            open_and_read_suppression_file(dname, true);
-        else
-            ASSERT(false, "default-suppress snprintf error");
-    }
+    suppress_index_init();
+    suppress_load_lock = dr_mutex_create();
+    if (!options.lazy_suppress)
+        suppress_load();
 
-    /* we support multiple suppress file (i#574) */
-    c = options.suppress;
-    while (*c != '\0') {
-        open_and_read_suppression_file(c, false);
-        c += strlen(c) + 1;
+    if (options.results_jsonl) {
+        hashtable_init(&stream_module_table, STREAM_MODULE_HASH_BITS, HASH_INTPTR,
+                       false/*!str_dup*/);
     }
+    if (options.async_results)
+        async_init();
+    if (options.live_summary)
+        live_summary_init();
 
     if (options.show_threads || options.show_all_threads) {
         main_thread = dr_get_thread_id(dr_get_current_drcontext());
@@ -1674,6 +2546,27 @@ report_fork_init(void)
     timestamp_start = dr_get_milliseconds();
     print_timestamp(f_global, timestamp_start, "start time");
 
+    if (async_active) {
+        /* The parent writes out what it had queued.  Its writer thread is not
+         * in the child and may have held the locks, so we start over.
+         */
+        async_write_t *e, *next;
+        for (e = async_head; e != NULL; e = next) {
+            next = e->next;
+            global_free(e, sizeof(*e) + e->size, HEAPSTAT_REPORT);
+        }
+        async_head = NULL;
+        async_tail = NULL;
+        async_queued = 0;
+        async_lock = NULL;
+        async_init();
+    }
+    /* The child has its own stream file */
+    if (options.results_jsonl)
+        hashtable_clear(&stream_module_table);
+    /* The parent writes out its own pending suppressions */
+    suppress_gen_sofar = 0;
+
     /* PR 513984: fork child should not inherit errors from parent */
     dr_mutex_lock(error_lock);
     error_id = 0;
@@ -1700,6 +2593,12 @@ report_fork_init(void)
     num_suppressed_leaks_default = 0;
     num_throttled_errors = 0;
     num_throttled_leaks = 0;
+    num_saturated_errors = 0;
+    if (options.report_site_max >= 0)
+        hashtable_clear(&site_table);
+    /* Before error_table, whose payloads this points at */
+    if (options.dup_pc_threshold > 0)
+        hashtable_clear(&dup_pc_table);
     hashtable_clear(&error_table);
     /* Be sure to reset the error list (xref PR 519222)
      * The error list points at hashtable payloads so nothing to free
@@ -1708,6 +2607,12 @@ report_fork_init(void)
     error_tail = NULL;
     dr_mutex_unlock(error_lock);
 
+    /* The parent's page is shared with us: we need our own */
+    if (live_summary != NULL) {
+        live_summary_exit();
+        live_summary_init();
+    }
+
     if (options.show_threads && !options.show_all_threads) {
         dr_mutex_lock(thread_table_lock);
         hashtable_clear(&thread_table);
@@ -1763,7 +2668,7 @@ report_summary_to_file(file_t f, bool stderr_too, bool print_full_stats, bool po
     dr_fprintf(f, "DUPLICATE %sERROR COUNTS:"NL,
                potential ? POTENTIAL_PREFIX_ALLCAP " " : "");
     for (err = error_head; err != NULL; err = err->next) {
-        if (err->count > 1 && !err->suppressed &&
+        if (err->count > 1 && !err->suppressed && !err->pending &&
             ((potential && err->potential) || (!potential && !err->potential)) &&
             /* possible leaks are left with id==0 and should be ignored
              * except in summary, unless -possible_leaks
@@ -1844,6 +2749,7 @@ report_summary_to_file(file_t f, bool stderr_too, bool print_full_stats, bool po
         /* -brief doesn't list the count of potential errors */
         if (!options.brief) {
             if (num_throttled_errors > 0 || num_throttled_leaks > 0 ||
+                num_saturated_errors > 0 ||
                 (!options.show_reachable && num_reported_errors > 0) ||
                 num_reported_errors[ERROR_POTENTIAL] > 0 ||
                 num_total_leaks[ERROR_POTENTIAL] > 0)
@@ -1900,14 +2806,37 @@ report_summary_to_file(file_t f, bool stderr_too, bool print_full_stats, bool po
             NOTIFY_COND(notify, f, "  %5d leak(s) beyond -report_leak_max"NL,
                         num_throttled_leaks);
         }
+        if (num_saturated_errors > 0) {
+            NOTIFY_COND(notify, f, "  %5d error(s) beyond -report_site_max"NL,
+                        num_saturated_errors);
+        }
     }
     NOTIFY_COND(notify, f, "Details: %s%c%s"NL, logsubdir, DIRSEP,
                 potential ? RESULTS_POTENTIAL_FNAME : RESULTS_FNAME);
 }
 
+void
+report_flush(void)
+{
+    async_flush();
+}
+
 void
 report_summary(void)
 {
+    /* The summary follows the error reports */
+    if (suppress_gen_buf != NULL) {
+        dr_mutex_lock(suppress_file_lock);
+        suppress_gen_flush();
+        dr_mutex_unlock(suppress_file_lock);
+    }
+    async_flush();
+    if (live_summary != NULL) {
+        /* Any leak scan has finished by now */
+        dr_mutex_lock(error_lock);
+        live_summary_update(true);
+        dr_mutex_unlock(error_lock);
+    }
     report_summary_to_file(f_global, true, true, false);
     report_summary_to_file(f_global, false, false, true);
     /* we don't show default suppressions used in results.txt file */
@@ -1915,20 +2844,81 @@ report_summary(void)
     report_summary_to_file(f_potential, false, false, true);
 }
 
+/* Writes the -results_jsonl record of each suppression that was used, so that
+ * streams from many processes can be merged without results.txt.
+ */
+static void
+stream_write_suppressions(void)
+{
+    char buf[MAXIMUM_PATH + 192];
+    size_t sofar;
+    ssize_t len;
+    uint i;
+    suppress_spec_t *spec;
+    for (i = 0; i < ERROR_MAX_VAL; i++) {
+        for (spec = supp_list[i]; spec != NULL; spec = spec->next) {
+            if (spec->count_used == 0)
+                continue;
+            sofar = 0;
+            BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len,
+                     "{\"kind\":\"suppression\",\"type\":\"%s\",\"default\":%s,"
+                     "\"count\":%d,\"bytes_leaked\":"SZFMT",\"name\":",
+                     suppress_name[i], spec->is_default ? "true" : "false",
+                     spec->count_used, spec->bytes_leaked);
+            if (spec->name == NULL) {
+                BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len,
+                         "\"<no name %d>\"", spec->num);
+            } else
+                stream_print_string(buf, BUFFER_SIZE_ELEMENTS(buf), &sofar, spec->name);
+            BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len, "}\n");
+            report_write_buffer(f_results_jsonl, buf);
+        }
+    }
+}
+
 void
 report_exit(void)
 {
     uint i;
     report_exited = true;
     ELOGF(0, f_results, NL"==========================================================================="NL"FINAL SUMMARY:"NL);
+    if (suppress_gen_buf != NULL) {
+        dr_mutex_lock(suppress_file_lock);
+        suppress_gen_flush();
+        dr_mutex_unlock(suppress_file_lock);
+        global_free(suppress_gen_buf, SUPPRESS_GEN_BUFSZ + 1, HEAPSTAT_REPORT);
+        suppress_gen_buf = NULL;
+    }
     dr_mutex_destroy(suppress_file_lock);
+    dr_mutex_destroy(suppress_load_lock);
     report_summary();
+    if (options.results_jsonl) {
+        stream_write_counts();
+        stream_write_suppressions();
+        hashtable_delete(&stream_module_table);
+    }
+    async_exit();
+    live_summary_exit();
 
+    if (options.dup_pc_threshold > 0)
+        hashtable_delete(&dup_pc_table);
+    if (options.report_site_max >= 0)
+        hashtable_delete(&site_table);
     hashtable_delete(&error_table);
+    /* Before callstack_exit() as this frees callstacks */
+    hashtable_delete(&verdict_table);
     dr_mutex_destroy(error_lock);
 
+    for (i = 0; i < report_num_spare_bufs; i++) {
+        global_free(report_spare_bufs[i], MAX_ERROR_INITIAL_LINES + max_callstack_size(),
+                    HEAPSTAT_CALLSTACK);
+    }
+    report_num_spare_bufs = 0;
+    dr_mutex_destroy(report_spare_lock);
+
     callstack_exit();
 
+    suppress_index_exit();
     for (i = 0; i < ERROR_MAX_VAL; i++) {
         suppress_spec_t *spec, *next;
         for (spec = supp_list[i]; spec != NULL; spec = next) {
@@ -1945,6 +2935,12 @@ report_exit(void)
     drmgr_unregister_tls_field(tls_idx_report);
 }
 
+uint
+report_num_errors(void)
+{
+    return num_reported_errors[ERROR_SET(false/*!potential*/)];
+}
+
 void
 report_exit_if_errors(void)
 {
@@ -2069,10 +3065,10 @@ report_error_from_buffer(file_t f, char *buf, bool add_prefix)
             print_to_cmd(newbuf);
         else
 #endif
-            print_buffer(f, newbuf);
+            report_write_buffer(f, newbuf);
         global_free(newbuf, newsz, HEAPSTAT_CALLSTACK);
     } else
-        print_buffer(f, buf);
+        report_write_buffer(f, buf);
 }
 
 /* caller should hold error_lock */
@@ -2086,6 +3082,161 @@ acquire_error_number(stored_error_t *err)
     num_unique[ERROR_SET(err->potential)][err->errtype]++;
 }
 
+/* Notes that a full callstack walk at pc found err.
+ * Caller must hold error_lock.
+ */
+static void
+dup_pc_note(uint type, app_pc pc, stored_error_t *err)
+{
+    dup_pc_t key, *dup;
+    key.pc = pc;
+    key.type = type;
+    dup = (dup_pc_t *) hashtable_lookup(&dup_pc_table, (void *)&key);
+    if (dup == NULL) {
+        dup = (dup_pc_t *) global_alloc(sizeof(*dup), HEAPSTAT_REPORT);
+        dup->pc = pc;
+        dup->type = type;
+        dup->err = err;
+        dup->hits = 0;
+        hashtable_add(&dup_pc_table, (void *)dup, (void *)dup);
+    } else if (dup->err == err) {
+        if (dup->hits < options.dup_pc_threshold)
+            dup->hits++;
+    } else if (dup->err != NULL) {
+        /* Distinct callstacks reach this pc: never take the shortcut here */
+        LOG(2, "dup_pc: multiple errors of type %d at "PFX"\n", type, pc);
+        dup->err = NULL;
+    }
+}
+
+/* Returns the error that errors of this type at pc have always been, if
+ * -dup_pc_threshold has been reached there, or NULL.
+ * Caller must hold error_lock.
+ */
+static stored_error_t *
+dup_pc_lookup(uint type, app_pc pc)
+{
+    dup_pc_t key, *dup;
+    key.pc = pc;
+    key.type = type;
+    dup = (dup_pc_t *) hashtable_lookup(&dup_pc_table, (void *)&key);
+    if (dup == NULL || dup->hits < options.dup_pc_threshold)
+        return NULL;
+    return dup->err;
+}
+
+/* Records a callstack of up to max_frames frames for mc at loc */
+static void
+record_error_callstack(uint type, app_loc_t *loc, dr_mcontext_t *mc, uint max_frames,
+                       packed_callstack_t **pcs OUT)
+{
+    reg_t save_xbp = MC_FP_REG(mc);
+    bool zeroed_xbp = false;
+    const char *modpath = NULL;
+    if (options.callstack_use_top_fp_selectively && HAVE_STALE_RETADDRS()) {
+        /* We need the module of the top frame for checks below */
+        if (loc->type == APP_LOC_PC) {
+            app_pc pc = loc_to_pc(loc);
+            /* callstack mod table is faster than DR lookup */
+            modpath = module_lookup_path(pc);
+        }
+    }
+    if (options.callstack_use_top_fp_selectively &&
+        /* for -replace_malloc invalid args and leaks we have our own
+         * malloc routine as the top frame (i#639).  we ensure it has ebp.
+         */
+        (!options.replace_malloc ||
+         (type != ERROR_INVALID_HEAP_ARG && !type_is_leak(type) &&
+          /* ditto for warnings reported from malloc routines */
+          (type != ERROR_WARNING ||
+           (modpath != NULL &&
+            !text_matches_pattern(modpath, "*drmemory*", true/*ignore case*/)))))) {
+        /* i#844: force a scan in the top frame to handle the all-too-common
+         * leaf function with no frame pointer.
+         * We assume there is no setting of mcontext on this path:
+         * only reading of mcontext.
+         * XXX: perhaps callstack should provide per-callstack flags.
+         * But this works just as well.
+         */
+        if (HAVE_STALE_RETADDRS()) {
+            /* We don't have definedness info or zeroing so disabling
+             * top fp will result in risk of stale retaddrs.
+             * System libs don't normally have leaf funcs w/o frames so
+             * only do this for the app.
+             * XXX: this is hacky: the system lib identification, the
+             * risk of stale frames.  But it's not clear that there's
+             * a great solution when the app has missing frames and
+             * we don't have definedness or zeroing.
+             * XXX i#624: Probably long-term we should add zeroing to light mode.
+             */
+            if (loc->type == APP_LOC_PC) {
+                if (modpath != NULL && !text_matches_pattern
+                    (modpath, "*windows?sys*", true/*ignore case*/)) {
+                    zeroed_xbp = true;
+                    MC_FP_REG(mc) = 0;
+                }
+            }
+        } else {
+            /* we have definedness info so scanning is accurate */
+            zeroed_xbp = true;
+            MC_FP_REG(mc) = 0;
+        }
+    }
+    packed_callstack_record(pcs, mc, loc, max_frames);
+    if (zeroed_xbp) {
+        MC_FP_REG(mc) = save_xbp;
+        /* i#1049: scan may not have been far enough so re-try w/ ebp */
+        if (packed_callstack_num_frames(*pcs) <= 1) {
+            IF_DEBUG(uint ref = )
+                packed_callstack_free(*pcs);
+            ASSERT(ref == 0, "invalid ref count");
+            packed_callstack_record(pcs, mc, loc, max_frames);
+        }
+    }
+}
+
+/* For -dup_pc_threshold: if errors of this type at loc have always had the
+ * same callstack, walks just the top -dup_pc_frames frames to confirm a
+ * duplicate and returns the prior error, holding error_lock.  Otherwise
+ * returns NULL, holding error_lock only if have_lock.
+ */
+static stored_error_t *
+record_error_dup_pc(uint type, app_loc_t *loc, dr_mcontext_t *mc, bool have_lock)
+{
+    app_pc pc = loc_to_pc(loc);
+    stored_error_t *err;
+    packed_callstack_t *pcs;
+    bool match;
+    if (!have_lock)
+        dr_mutex_lock(error_lock);
+    err = dup_pc_lookup(type, pc);
+    if (err == NULL) {
+        if (!have_lock)
+            dr_mutex_unlock(error_lock);
+        return NULL;
+    }
+    if (options.dup_pc_frames == 0) {
+        LOG(3, "dup_pc: counting duplicate at "PFX" without a walk\n", pc);
+        return err;
+    }
+    /* Walk outside of the lock if we can.  Stored errors are never freed. */
+    if (!have_lock)
+        dr_mutex_unlock(error_lock);
+    record_error_callstack(type, loc, mc, options.dup_pc_frames, &pcs);
+    match = packed_callstack_cmp_prefix(pcs, err->pcs, options.dup_pc_frames);
+    IF_DEBUG(uint ref = )
+        packed_callstack_free(pcs);
+    ASSERT(ref == 0, "invalid ref count");
+    if (match && !have_lock)
+        dr_mutex_lock(error_lock);
+    if (!match) {
+        LOG(2, "dup_pc: top frames differ at "PFX"\n", pc);
+        return NULL;
+    }
+    LOG(3, "dup_pc: top frames confirm duplicate at "PFX"\n", pc);
+    return err;
+}
+
 /* Records a callstack for mc (or uses the passed-in pcs) and checks
  * whether this is a new error or a duplicate.  If new, it adds a new
  * entry to the error table.  Either way, it increments the error's
@@ -2098,73 +3249,24 @@ static stored_error_t *
 record_error(uint type, packed_callstack_t *pcs, app_loc_t *loc, dr_mcontext_t *mc,
              bool have_lock)
 {
-    stored_error_t *err = stored_error_create(type);
+    stored_error_t *err;
+    bool use_dup_pc = (pcs == NULL && options.dup_pc_threshold > 0 &&
+                       loc->type == APP_LOC_PC);
+    if (use_dup_pc) {
+        err = record_error_dup_pc(type, loc, mc, have_lock);
+        if (err != NULL) {
+            /* Just as for a duplicate found the slow way below */
+            err->count++;
+            if (!err->suppressed && !err->pending)
+                num_total[ERROR_SET(err->potential)][type]++;
+            return err;
+        }
+    }
+    err = stored_error_create(type);
     if (pcs == NULL) {
-        reg_t save_xbp = MC_FP_REG(mc);
-        bool zeroed_xbp = false;
-        const char *modpath = NULL;
         uint max_frames = (type_is_leak(type) ? options.malloc_max_frames :
                            options.callstack_max_frames);
-        if (options.callstack_use_top_fp_selectively && HAVE_STALE_RETADDRS()) {
-            /* We need the module of the top frame for checks below */
-            if (loc->type == APP_LOC_PC) {
-                app_pc pc = loc_to_pc(loc);
-                /* callstack mod table is faster than DR lookup */
-                modpath = module_lookup_path(pc);
-            }
-        }
-        if (options.callstack_use_top_fp_selectively &&
-            /* for -replace_malloc invalid args and leaks we have our own
-             * malloc routine as the top frame (i#639).  we ensure it has ebp.
-             */
-            (!options.replace_malloc ||
-             (type != ERROR_INVALID_HEAP_ARG && !type_is_leak(type) &&
-              /* ditto for warnings reported from malloc routines */
-              (type != ERROR_WARNING ||
-               (modpath != NULL &&
-                !text_matches_pattern(modpath, "*drmemory*", true/*ignore case*/)))))) {
-            /* i#844: force a scan in the top frame to handle the all-too-common
-             * leaf function with no frame pointer.
-             * We assume there is no setting of mcontext on this path:
-             * only reading of mcontext.
-             * XXX: perhaps callstack should provide per-callstack flags.
-             * But this works just as well.
-             */
-            if (HAVE_STALE_RETADDRS()) {
-                /* We don't have definedness info or zeroing so disabling
-                 * top fp will result in risk of stale retaddrs.
-                 * System libs don't normally have leaf funcs w/o frames so
-                 * only do this for the app.
-                 * XXX: this is hacky: the system lib identification, the
-                 * risk of stale frames.  But it's not clear that there's
-                 * a great solution when the app has missing frames and
-                 * we don't have definedness or zeroing.
-                 * XXX i#624: Probably long-term we should add zeroing to light mode.
-                 */
-                if (loc->type == APP_LOC_PC) {
-                    if (modpath != NULL && !text_matches_pattern
-                        (modpath, "*windows?sys*", true/*ignore case*/)) {
-                        zeroed_xbp = true;
-                        MC_FP_REG(mc) = 0;
-                    }
-                }
-            } else {
-                /* we have definedness info so scanning is accurate */
-                zeroed_xbp = true;
-                MC_FP_REG(mc) = 0;
-            }
-        }
-        packed_callstack_record(&err->pcs, mc, loc, max_frames);
-        if (zeroed_xbp) {
-            MC_FP_REG(mc) = save_xbp;
-            /* i#1049: scan may not have been far enough so re-try w/ ebp */
-            if (packed_callstack_num_frames(err->pcs) <= 1) {
-                IF_DEBUG(uint ref = )
-                    packed_callstack_free(err->pcs);
-                ASSERT(ref == 0, "invalid ref count");
-                packed_callstack_record(&err->pcs, mc, loc, max_frames);
-            }
-        }
+        record_error_callstack(type, loc, mc, max_frames, &err->pcs);
     } else {
         /* lifetimes differ so we must clone */
         err->pcs = packed_callstack_clone(pcs);
@@ -2198,8 +3300,11 @@ record_error(uint type, packed_callstack_t *pcs, app_loc_t *loc, dr_mcontext_t *
      * If later marked as hidden ("potential") up to caller to adjust counters.
      */
     err->count++;
-    if (!err->suppressed)
+    /* If pending, up to caller to wait and then increment */
+    if (!err->suppressed && !err->pending)
         num_total[ERROR_SET(err->potential)][type]++;
+    if (use_dup_pc)
+        dup_pc_note(type, loc_to_pc(loc), err);
     return err;
 }
 
@@ -2519,8 +3624,8 @@ report_heap_info(IN error_toprint_t *etp, OUT char *buf, size_t bufsz, size_t *s
         } else
             BUFPRINT(buf, bufsz, *sofar, len, NL);
     }
-    /* For wrapping, overlaps_delayed_free gives us a clone */
-    if (etp->free_pcs != NULL && !options.replace_malloc)
+    /* overlaps_delayed_free builds us a new callstack */
+    if (etp->free_pcs != NULL)
         packed_callstack_free(etp->free_pcs);
     if (!invalid_heap_arg && alloc_in_heap_routine(drcontext)) {
         BUFPRINT(buf, bufsz, *sofar, len,
@@ -2579,6 +3684,10 @@ print_error_report(void *drcontext, char *buf, size_t bufsz, bool reporting,
             report_error_from_buffer(LOGFILE_GET(drcontext), buf, false);
         }
     }
+
+    /* Last, as this reuses buf */
+    if (reporting && err != NULL && options.results_jsonl)
+        stream_write_error(drcontext, buf, bufsz, etp, err);
 }
 
 static char *
@@ -2589,7 +3698,13 @@ report_alloc_buf(void *drcontext, size_t *bufsz)
         drmgr_get_tls_field(drcontext, tls_idx_report) == NULL) {
         /* at exit time, thread already cleaned up */
         *bufsz = MAX_ERROR_INITIAL_LINES + max_callstack_size();
-        buf = (char *) global_alloc(*bufsz, HEAPSTAT_CALLSTACK);
+        buf = NULL;
+        dr_mutex_lock(report_spare_lock);
+        if (report_num_spare_bufs > 0)
+            buf = report_spare_bufs[--report_num_spare_bufs];
+        dr_mutex_unlock(report_spare_lock);
+        if (buf == NULL)
+            buf = (char *) global_alloc(*bufsz, HEAPSTAT_CALLSTACK);
     } else {
         tls_report_t *pt = (tls_report_t *)
             drmgr_get_tls_field(drcontext, tls_idx_report);
@@ -2605,7 +3720,14 @@ report_free_buf(void *drcontext, char *buf, size_t bufsz)
 {
     if (drcontext == NULL ||
         drmgr_get_tls_field(drcontext, tls_idx_report) == NULL) {
-        global_free(buf, bufsz, HEAPSTAT_CALLSTACK);
+        dr_mutex_lock(report_spare_lock);
+        if (report_num_spare_bufs < REPORT_SPARE_BUFS_MAX) {
+            report_spare_bufs[report_num_spare_bufs++] = buf;
+            buf = NULL;
+        }
+        dr_mutex_unlock(report_spare_lock);
+        if (buf != NULL)
+            global_free(buf, bufsz, HEAPSTAT_CALLSTACK);
     }
 }
 
@@ -2653,9 +3775,48 @@ report_pause_at_error(error_toprint_t *etp, dr_mcontext_t *mc, const char *msg)
     if (!dr_mcontext_to_context(&cxt, mc))
         NOTIFY_ERROR("Failed to set CONTEXT for ldmp"NL);
 #endif
+    /* So the report is there to look at while paused */
+    async_flush();
     wait_for_user(msg);
 }
 
+/* For -saturate_sites: stops checking pc for unaddressable accesses */
+static void
+report_saturate_site(app_pc pc)
+{
+    if (!options.saturate_sites || !options.shadowing)
+        return;
+    /* add returns false if already there, perhaps with the flush pending */
+    if (hashtable_add(&saturated_table, pc, (void *)1)) {
+        LOG(1, "saturated error site "PFX": flushing\n", pc);
+        if (!dr_delay_flush_region(pc, 1, 0, NULL))
+            ASSERT(false, "saturated site flush failed");
+    }
+}
+
+/* For -report_site_max: counts an error at pc and returns whether pc is over
+ * the limit, in which case nothing else need be done for the error.
+ */
+static bool
+report_site_over_max(app_pc pc)
+{
+    uint count;
+    bool over;
+    dr_mutex_lock(error_lock);
+    count = (uint)(ptr_uint_t) hashtable_lookup(&site_table, pc);
+    over = (count >= (uint)options.report_site_max);
+    if (over)
+        num_saturated_errors++;
+    else {
+        count++;
+        hashtable_add_replace(&site_table, pc, (void *)(ptr_uint_t)count);
+    }
+    dr_mutex_unlock(error_lock);
+    if (over)
+        report_saturate_site(pc);
+    return over;
+}
+
 /* pcs is only used for invalid heap args */
 static void
 report_error(error_toprint_t *etp, dr_mcontext_t *mc, packed_callstack_t *pcs)
@@ -2664,15 +3825,18 @@ report_error(error_toprint_t *etp, dr_mcontext_t *mc, packed_callstack_t *pcs)
     char fuzzer_buf[FUZZER_MSG_SZ];
     stored_error_t *err;
     bool reporting = false;
+    bool first = false, gen_suppression = false;
     suppress_spec_t *spec;
     error_callstack_t ecs;
     char  *errbuf;
     size_t errbufsz;
+    uint64 prof_start;
 
     /* we do not want to use dbghelp at init time b/c that's too early so we
      * only check symbols and give warnings if we end up reporting something
      */
     static bool reported_any_error;
+    PROF_START(prof_start);
     if (!reported_any_error) {
         report_symbol_advice();
         reported_any_error = true;
@@ -2682,6 +3846,11 @@ report_error(error_toprint_t *etp, dr_mcontext_t *mc, packed_callstack_t *pcs)
     if (mc != NULL)
         etp->xsp = (byte *) mc->xsp;
 
+    if (options.report_site_max >= 0 &&
+        etp->loc != NULL && etp->loc->type == APP_LOC_PC &&
+        report_site_over_max(loc_to_pc(etp->loc)))
+        goto report_error_done;
+
     /* Our report_max throttling is post-dup-checking, to make the option
      * useful (else if 1st error has 20K instances, won't see any others).
      * Also, num_reported_errors doesn't count suppressed errors.
@@ -2701,10 +3870,13 @@ report_error(error_toprint_t *etp, dr_mcontext_t *mc, packed_callstack_t *pcs)
          * to report whether there are any.
          */
         num_throttled_errors++;
+        if (etp->loc != NULL && etp->loc->type == APP_LOC_PC)
+            report_saturate_site(loc_to_pc(etp->loc));
         DO_ONCE({
             NOTIFY(NL);
             NOTIFY("Reached maximum error report limit (-report_max). "
                    "No further errors will be reported."NL);
+            async_flush();
             ELOGF(0, f_results, NL"Reached maximum error report limit (-report_max). "
                   "No further errors will be reported."NL);
         });
@@ -2752,14 +3924,49 @@ report_error(error_toprint_t *etp, dr_mcontext_t *mc, packed_callstack_t *pcs)
      * error type, don't bother taking the stack trace, unless we need to log
      * it.
      */
+    suppress_load();
     if (have_module_wildcard && !options.log_suppressed_errors) {
         if (report_in_suppressed_module(etp->errtype, etp->loc, ecs.instruction)) {
             goto report_error_done;
         }
     }
 
+    /* -fuzz_error_buckets: walk just the top frames, and stop here for an error
+     * in a bucket that was already reported.
+     */
+    if (options.fuzz_error_buckets > 0 && fuzzer_error_bucketing(drcontext)) {
+        bool new_bucket;
+        if (pcs != NULL)
+            new_bucket = fuzzer_error_bucket_add(etp->errtype, pcs);
+        else {
+            packed_callstack_t *top;
+            record_error_callstack(etp->errtype, etp->loc, mc,
+                                   options.fuzz_error_buckets, &top);
+            new_bucket = fuzzer_error_bucket_add(etp->errtype, top);
+            IF_DEBUG(uint ref = )
+                packed_callstack_free(top);
+            ASSERT(ref == 0, "invalid ref count");
+        }
+        if (!new_bucket) {
+            LOG(2, "error counted in an existing fuzz error bucket\n");
+            goto report_error_done;
+        }
+    }
+
     err = record_error(etp->errtype, pcs, etp->loc, mc, false/*no lock */);
-    if (err->count > 1) {
+    first = (err->count == 1);
+    if (!first) {
+        if (err->pending) {
+            while (err->pending) {
+                /* Another thread is symbolizing the first instance */
+                dr_mutex_unlock(error_lock);
+                dr_thread_yield();
+                dr_mutex_lock(error_lock);
+            }
+            /* Counted here rather than in record_error() */
+            if (!err->suppressed)
+                num_total[ERROR_SET(err->potential)][etp->errtype]++;
+        }
         if (err->suppressed) {
             /* Suppression count is total, not unique callstacks (i#1527) */
             err->suppress_spec->count_used++;
@@ -2773,6 +3980,7 @@ report_error(error_toprint_t *etp, dr_mcontext_t *mc, packed_callstack_t *pcs)
             reporting = true;
         }
         if (!options.show_duplicates) {
+            live_summary_update(false);
             dr_mutex_unlock(error_lock);
             goto report_error_done;
         }
@@ -2786,11 +3994,26 @@ report_error(error_toprint_t *etp, dr_mcontext_t *mc, packed_callstack_t *pcs)
     if (!options.replace_malloc && etp->errtype == ERROR_INVALID_HEAP_ARG)
         packed_callstack_first_frame_retaddr(err->pcs);
 
-    /* Convert to symbolized so we can compare to suppressions */
-    packed_callstack_to_symbolized(err->pcs, &ecs.scs);
-
-    if (err->count == 1) {
-        reporting = !on_suppression_list(etp->errtype, &ecs, &spec);
+    if (!first) {
+        /* Only reached for -show_duplicates */
+        packed_callstack_to_symbolized(err->pcs, &ecs.scs);
+    } else {
+        bool known = suppress_check_unsymbolized(etp->errtype, err->pcs, &ecs, &spec);
+        if (!known || spec == NULL || suppressed_errors_logged()) {
+            /* Symbolizing is slow, so we release error_lock to not block
+             * threads reporting other errors.
+             */
+            err->pending = true;
+            dr_mutex_unlock(error_lock);
+            packed_callstack_to_symbolized(err->pcs, &ecs.scs);
+            dr_mutex_lock(error_lock);
+            /* We hold the lock from here until err is updated */
+            err->pending = false;
+        }
+        if (known)
+            reporting = (spec == NULL);
+        else
+            reporting = !suppress_check_symbolized(etp->errtype, err->pcs, &ecs, &spec);
         if (!reporting) {
             err->suppressed = true;
             err->suppressed_by_default = spec->is_default;
@@ -2813,11 +4036,15 @@ report_error(error_toprint_t *etp, dr_mcontext_t *mc, packed_callstack_t *pcs)
             num_reported_errors[ERROR_POTENTIAL]++;
         } else {
             acquire_error_number(err);
-            report_error_suppression(etp->errtype, &ecs, err->id);
+            gen_suppression = true;
             num_reported_errors[ERROR_NORMAL]++;
         }
     }
+    live_summary_update(false);
     dr_mutex_unlock(error_lock);
+    /* This writes a file, so we do it without error_lock */
+    if (gen_suppression)
+        report_error_suppression(etp->errtype, &ecs, err->id);
 
     if (fuzzer_error_report(drcontext, fuzzer_buf, FUZZER_MSG_SZ, err->id) > 0)
         etp->fuzzer_msg = fuzzer_buf;
@@ -2833,7 +4060,7 @@ report_error(error_toprint_t *etp, dr_mcontext_t *mc, packed_callstack_t *pcs)
 #ifdef WINDOWS
     /* don't create dumps for dup errors or potential errors */
     if (TEST(error_mask[etp->errtype], options.dump_at_error_mask) &&
-        reporting && err->count == 1 && !err->potential) {
+        reporting && first && !err->potential) {
         report_core_dump(etp, options.dump_at_error_mask, err->id, mc);
     }
 #endif
@@ -2850,10 +4077,12 @@ report_error(error_toprint_t *etp, dr_mcontext_t *mc, packed_callstack_t *pcs)
             NOTIFY(NL);
             NOTIFY("TERMINATING PROCESS after first %serror found"NL,
                    options.crash_at_error ? "" : "unaddressable ");
+            async_flush();
             crash_process();
             ASSERT_NOT_REACHED();
         }
     }
+    PROF_STOP(drcontext, PROF_REPORT, prof_start);
 }
 
 static void
@@ -3051,6 +4280,9 @@ report_unaddressable_access(app_loc_t *loc, app_pc addr, size_t sz,
     error_toprint_t etp = {0};
     app_pc redzone_start, app_start, app_end;
     char buf[UNADDR_MSG_SZ];
+    if (options.lib_check_none[0] != '\0' && loc->type == APP_LOC_PC &&
+        module_check_level(loc_to_pc(loc)) == MODULE_CHECK_NONE)
+        return;
     etp.errtype = ERROR_UNADDRESSABLE;
     etp.loc = loc;
     etp.addr = addr;
@@ -3091,6 +4323,8 @@ report_undefined_read(app_loc_t *loc, app_pc addr, size_t sz,
                       dr_mcontext_t *mc)
 {
     error_toprint_t etp = {0};
+    char buf[UNADDR_MSG_SZ];
+    app_pc app_start, app_end;
     etp.errtype = ERROR_UNDEFINED;
     etp.loc = loc;
     etp.addr = addr;
@@ -3098,6 +4332,17 @@ report_undefined_read(app_loc_t *loc, app_pc addr, size_t sz,
     etp.container_start = container_start;
     etp.container_end = container_end;
     etp.report_instruction = true;
+    /* A NULL container means addr is a register rather than memory */
+    if (options.track_origins && container_start != NULL &&
+        region_in_malloc_block(addr, sz, &etp.aux_pcs, &app_start, &app_end) &&
+        etp.aux_pcs != NULL) {
+        ssize_t len = 0;
+        size_t sofar = 0;
+        BUFPRINT(buf, UNADDR_MSG_SZ, sofar, len,
+                 "%sthe uninitialized memory is in "PFX"-"PFX" allocated here:"NL,
+                 INFO_PFX, app_start, app_end);
+        etp.aux_msg = buf;
+    }
     report_error(&etp, mc, NULL);
 }
 
@@ -3260,12 +4505,115 @@ report_leak_stats_revert(void)
             stored_error_t *err = (stored_error_t *) he->payload;
             if (type_is_leak(err->errtype)) {
                 err->count = 0;
+                err->leak_bytes = 0;
             }
         }
     }
     dr_mutex_unlock(error_lock);
 }
 
+typedef struct _leak_growth_t {
+    uint id;
+    uint errtype;
+    uint count;
+    size_t bytes;
+    size_t growth;
+} leak_growth_t;
+
+/* Orders by decreasing growth, then by id */
+static bool
+leak_growth_less(leak_growth_t *g1, leak_growth_t *g2)
+{
+    if (g1->growth != g2->growth)
+        return g1->growth > g2->growth;
+    return g1->id < g2->id;
+}
+
+static void
+leak_growth_sift_down(leak_growth_t *a, uint root, uint n)
+{
+    while (2*root + 1 < n) {
+        uint child = 2*root + 1;
+        leak_growth_t tmp;
+        if (child + 1 < n && leak_growth_less(&a[child], &a[child+1]))
+            child++;
+        if (!leak_growth_less(&a[root], &a[child]))
+            return;
+        tmp = a[root];
+        a[root] = a[child];
+        a[child] = tmp;
+        root = child;
+    }
+}
+
+static void
+leak_growth_sort(leak_growth_t *a, uint n)
+{
+    uint i;
+    for (i = n/2; i > 0; i--)
+        leak_growth_sift_down(a, i - 1, n);
+    for (i = n; i > 1; i--) {
+        leak_growth_t tmp = a[0];
+        a[0] = a[i - 1];
+        a[i - 1] = tmp;
+        leak_growth_sift_down(a, 0, i - 1);
+    }
+}
+
+/* For -leak_growth: must be called after a nudge's leak scan and before
+ * report_leak_stats_revert().  Lists the reported leaks whose bytes grew since
+ * the previous nudge's scan, largest growth first, and then makes this scan
+ * the baseline for the next.  All we keep between scans is one field of
+ * each leak's stored_error_t.
+ */
+void
+report_leak_growth(void)
+{
+    stored_error_t *err;
+    leak_growth_t *growth = NULL;
+    uint num = 0, max = 0, i;
+    dr_mutex_lock(error_lock);
+    for (err = error_head; err != NULL; err = err->next) {
+        if (type_is_leak(err->errtype))
+            max++;
+    }
+    if (max > 0) {
+        growth = (leak_growth_t *)
+            global_alloc(max * sizeof(*growth), HEAPSTAT_REPORT);
+    }
+    for (err = error_head; err != NULL; err = err->next) {
+        if (!type_is_leak(err->errtype))
+            continue;
+        /* Only leaks with an error number printed in the results file */
+        if (err->id != 0 && !err->suppressed && !err->potential &&
+            err->leak_bytes > err->prev_leak_bytes) {
+            ASSERT(num < max, "leak count changed under lock");
+            growth[num].id = err->id;
+            growth[num].errtype = err->errtype;
+            growth[num].count = err->count;
+            growth[num].bytes = err->leak_bytes;
+            growth[num].growth = err->leak_bytes - err->prev_leak_bytes;
+            num++;
+        }
+        err->prev_leak_bytes = err->leak_bytes;
+    }
+    dr_mutex_unlock(error_lock);
+
+    leak_growth_sort(growth, num);
+    ELOGF(0, f_results, NL"LEAK GROWTH SINCE THE PREVIOUS NUDGE:"NL);
+    for (i = 0; i < num; i++) {
+        ELOGF(0, f_results, "  Error #%d: +"SZFMT" byte(s) to "SZFMT" byte(s) in %d"
+              " %sleak(s)"NL, growth[i].id, growth[i].growth, growth[i].bytes,
+              growth[i].count,
+              (growth[i].errtype == ERROR_POSSIBLE_LEAK) ? "possible " :
+              ((growth[i].errtype == ERROR_REACHABLE_LEAK) ? "reachable " : ""));
+    }
+    if (num == 0)
+        ELOGF(0, f_results, "  none"NL);
+    if (growth != NULL)
+        global_free(growth, max * sizeof(*growth), HEAPSTAT_REPORT);
+}
+
 void
 report_leak(bool known_malloc, app_pc addr, size_t size, size_t indirect_size,
             bool early, bool reachable, bool maybe_reachable, uint shadow_state,
@@ -3311,6 +4659,7 @@ report_leak(bool known_malloc, app_pc addr, size_t size, size_t indirect_size,
             NOTIFY(NL);
             NOTIFY("Reached maximum leak report limit (-report_leak_max). "
                    "No further leaks will be reported."NL);
+            async_flush();
             ELOGF(0, f_results, NL"Reached maximum leak report limit (-report_leak_max). "
                   "No further leaks will be reported."NL);
         });
@@ -3370,6 +4719,7 @@ report_leak(bool known_malloc, app_pc addr, size_t size, size_t indirect_size,
                     /* We only count bytes for non-suppressed leaks */
                     /* Total size does not distinguish direct from indirect (PR 576032) */
                     num_bytes_leaked[set][type] += size + indirect_size;
+                    err->leak_bytes += size + indirect_size;
                 }
                 DOLOG(3, {
                     LOG(3, "Duplicate leak of %d (%d indirect) bytes:\n",
@@ -3388,22 +4738,30 @@ report_leak(bool known_malloc, app_pc addr, size_t size, size_t indirect_size,
          * support suppressing) when show_reachable is off and the only goal
          * is a count of unique instances.
          */
-        if (!early && (!reachable || show_reachable)) {
+        if (type < ERROR_MAX_VAL && !early && (!reachable || show_reachable)) {
             ASSERT(pcs != NULL, "non-early allocs must have stacks");
-            packed_callstack_to_symbolized(pcs, &ecs.scs);
+            /* Symbolizes, unless an earlier leak or error with the same
+             * callstack was suppressed.
+             */
+            reporting = !on_suppression_list_memoized(type, pcs, &ecs, &spec);
+        } else {
+            if (!early && (!reachable || show_reachable)) {
+                ASSERT(pcs != NULL, "non-early allocs must have stacks");
+                packed_callstack_to_symbolized(pcs, &ecs.scs);
+            }
+            /* only real, possible, and reachable leaks can be suppressed */
+            if (type < ERROR_MAX_VAL) {
+                if (reachable && !show_reachable)
+                    reporting = true; /* suppressions not supported: i#1852 */
+                else
+                    reporting = !on_suppression_list(type, &ecs, &spec);
+            }
         }
 
+        /* Comparing to recorded verdicts reads pcs, so we unlock after it */
         if (locked_malloc)
             alloc_callstack_unlock();
 
-        /* only real, possible, and reachable leaks can be suppressed */
-        if (type < ERROR_MAX_VAL) {
-            if (reachable && !show_reachable)
-                reporting = true; /* suppressions not supported: i#1852 */
-            else
-                reporting = !on_suppression_list(type, &ecs, &spec);
-        }
-
         if (reporting && type < ERROR_MAX_VAL) {
             /* We can have identical leaks across nudges: keep same error #.
              * Multiple nudges are kind of messy wrt leaks: we try to not
@@ -3448,6 +4806,7 @@ report_leak(bool known_malloc, app_pc addr, size_t size, size_t indirect_size,
             /* We only count bytes for non-suppressed leaks */
             /* Total size does not distinguish direct from indirect (PR 576032) */
             num_bytes_leaked[set][type] += size + indirect_size;
+            err->leak_bytes += size + indirect_size;
         } else if (type < ERROR_MAX_VAL) {
             bool already_supp = err->suppressed;
             ASSERT(err != NULL && spec != NULL, "invalid local");
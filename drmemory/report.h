@@ -51,6 +51,14 @@ report_fork_init(void);
 void
 report_summary(void);
 
+/* Returns the number of unique non-potential errors reported so far */
+uint
+report_num_errors(void);
+
+/* Writes out any error reports queued for -async_results */
+void
+report_flush(void);
+
 void
 report_thread_init(void *drcontext);
 
@@ -105,6 +113,12 @@ report_leak_stats_checkpoint(void);
 void
 report_leak_stats_revert(void);
 
+/* For -leak_growth: lists the leaks that grew since the previous nudge.
+ * Must be called between a nudge's leak scan and report_leak_stats_revert().
+ */
+void
+report_leak_growth(void);
+
 void
 report_leak(bool known_malloc, app_pc addr, size_t size, size_t indirect_size,
             bool early, bool reachable, bool maybe_reachable, uint shadow_state,
@@ -130,6 +144,19 @@ print_timestamp_elapsed_to_file(file_t f, const char *prefix);
 void
 report_child_thread(void *drcontext, thread_id_t child);
 
+/* Per-module instrumentation policy, from -check_uninit_blocklist and
+ * -lib_check_none.
+ */
+typedef enum {
+    MODULE_CHECK_FULL,      /* addressability and definedness */
+    MODULE_CHECK_ADDR_ONLY, /* addressability; writes are marked defined */
+    MODULE_CHECK_NONE,      /* nothing reported; writes are marked defined */
+} module_check_level_t;
+
+module_check_level_t
+module_check_level(app_pc pc);
+
+/* Returns whether uninitialized reads are not checked in pc's module */
 bool
 module_is_on_check_uninit_blocklist(app_pc pc);
 
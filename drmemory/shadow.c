@@ -160,7 +160,13 @@ bytemap_4to1_ushort(bitmap_t bm, uint i)
 umbra_map_t *umbra_map;
 
 /* 2 shadow bits per app byte */
-/* we use Umbra's 4B-to-1B and layer 1B-to-2b on top of that */
+/* we use Umbra's 4B-to-1B and layer 1B-to-2b on top of that.
+ * An addressability-only 8B-to-1B map would suffice for -no_check_uninitialized,
+ * but -light and -unaddr_only normally run in pattern mode with no shadow at
+ * all, and with -pattern 0 the fastpath already checks a dword with a single
+ * shadow byte compare against SHADOW_DWORD_UNADDRESSABLE.  A second encoding
+ * would need its own fastpath generator and slowpath for little gain.
+ */
 #define SHADOW_MAP_SCALE   UMBRA_MAP_SCALE_DOWN_4X
 #define SHADOW_DEFAULT_VALUE SHADOW_DWORD_UNADDRESSABLE
 #define SHADOW_DEFAULT_VALUE_SIZE 1
@@ -277,6 +283,10 @@ shadow_table_init(void)
     umbra_map_ops.flags =
         UMBRA_MAP_CREATE_SHADOW_ON_TOUCH |
         UMBRA_MAP_SHADOW_SHARED_READONLY;
+#if defined(LINUX) && defined(X64)
+    if (options.shadow_huge_pages)
+        umbra_map_ops.flags |= UMBRA_MAP_SHADOW_HUGE_PAGES;
+#endif
     umbra_map_ops.scale = SHADOW_MAP_SCALE;
     umbra_map_ops.default_value = SHADOW_DEFAULT_VALUE;
     umbra_map_ops.default_value_size = SHADOW_DEFAULT_VALUE_SIZE;
@@ -303,6 +313,15 @@ static void
 shadow_table_exit(void)
 {
     LOG(2, "shadow_table_exit\n");
+#if defined(LINUX) && defined(X64)
+    if (options.shadow_huge_pages) {
+        uint marked, fallback;
+        if (umbra_get_huge_page_stats(umbra_map, &marked, &fallback) == DRMF_SUCCESS) {
+            LOG(1, "shadow blocks: %u marked for huge pages, %u on normal pages\n",
+                marked, fallback);
+        }
+    }
+#endif
     if (umbra_destroy_mapping(umbra_map) != DRMF_SUCCESS)
         ASSERT(false, "fail to destroy shadow memory");
 }
@@ -311,12 +330,23 @@ bool
 shadow_create_shadow_memory(app_pc base, size_t size, uint value)
 {
     uint flags = UMBRA_CREATE_SHADOW_SHARED_READONLY; /* allow special block */
-    if (umbra_create_shadow_memory(umbra_map, flags,
-                                   base, size, value, 1) == DRMF_SUCCESS)
+    ASSERT(value <= 4, "invalid shadow value");
+    if (umbra_create_shadow_memory(umbra_map, flags, base, size,
+                                   shadow_value_byte_2_dword(value), 1) == DRMF_SUCCESS)
         return true;
     return false;
 }
 
+void
+shadow_delete_shadow_memory(app_pc base, size_t size)
+{
+    /* Unaddressable is our default value, so Umbra can hand whole blocks back */
+    if (umbra_delete_shadow_memory(umbra_map, base, size) != DRMF_SUCCESS) {
+        LOG(1, "failed to release shadow for "PFX"-"PFX"\n", base, base+size);
+        shadow_set_range(base, base+size, SHADOW_UNADDRESSABLE);
+    }
+}
+
 size_t
 get_shadow_block_size(void)
 {
@@ -343,6 +373,71 @@ shadow_get_special(app_pc addr, uint *val)
     return SHADOW_IS_SHARED_ONLY(info.shadow_type);
 }
 
+/* Per-thread copy of the info for the last normal block a thread looked up,
+ * so that callers that start each series of calls with a fresh
+ * umbra_shadow_memory_info_t (the slowpath, syscall checks, the leak scan)
+ * still skip Umbra when they stay within one block.  Shared blocks are not
+ * cached since Umbra replaces them; a normal block is only trusted while the
+ * map generation is unchanged, as Umbra bumps it before freeing one.
+ */
+typedef struct _shadow_cache_t {
+    umbra_shadow_memory_info_t info;
+    uint generation;
+} shadow_cache_t;
+
+static int tls_idx_shadow_cache = -1;
+
+static void
+shadow_cache_thread_init(void *drcontext)
+{
+    shadow_cache_t *cache = (shadow_cache_t *)
+        thread_alloc(drcontext, sizeof(*cache), HEAPSTAT_SHADOW);
+    umbra_shadow_memory_info_init(&cache->info);
+    cache->generation = 0;
+    drmgr_set_tls_field(drcontext, tls_idx_shadow_cache, (void *) cache);
+}
+
+static void
+shadow_cache_thread_exit(void *drcontext)
+{
+    shadow_cache_t *cache = (shadow_cache_t *)
+        drmgr_get_tls_field(drcontext, tls_idx_shadow_cache);
+    if (cache == NULL)
+        return;
+    drmgr_set_tls_field(drcontext, tls_idx_shadow_cache, NULL);
+    thread_free(drcontext, cache, sizeof(*cache), HEAPSTAT_SHADOW);
+}
+
+/* Fills in info for addr, from the thread's cache when it is still valid */
+static drmf_status_t
+shadow_lookup_info(INOUT umbra_shadow_memory_info_t *info, app_pc addr)
+{
+    void *drcontext = dr_get_current_drcontext();
+    shadow_cache_t *cache = NULL;
+    uint generation = 0;
+    drmf_status_t res;
+    if (drcontext != NULL) {
+        cache = (shadow_cache_t *)
+            drmgr_get_tls_field(drcontext, tls_idx_shadow_cache);
+    }
+    if (cache != NULL &&
+        umbra_get_map_generation(umbra_map, &generation) == DRMF_SUCCESS) {
+        if (generation == cache->generation &&
+            addr >= cache->info.app_base &&
+            addr < cache->info.app_base + cache->info.app_size) {
+            *info = cache->info;
+            return DRMF_SUCCESS;
+        }
+    }
+    res = umbra_get_shadow_memory(umbra_map, addr, NULL, info);
+    if (res == DRMF_SUCCESS && cache != NULL &&
+        info->shadow_type == UMBRA_SHADOW_MEMORY_TYPE_NORMAL) {
+        cache->info = *info;
+        cache->generation = generation;
+    }
+    return res;
+}
+
 /* return the two bits for the byte at the passed-in address */
 /* umbra_shadow_memory_info must be first zeroed out by the caller prior to
  * calling the first time for any series of calls. It will be filled out
@@ -362,8 +457,7 @@ shadow_get_byte(INOUT umbra_shadow_memory_info_t *info, app_pc addr)
     if (addr < info->app_base || addr >= info->app_base + info->app_size) {
         ASSERT(info->struct_size == sizeof(*info),
                "shadow memory info is not initialized properly");
-        if (umbra_get_shadow_memory(umbra_map, addr,
-                                    NULL, info) != DRMF_SUCCESS) {
+        if (shadow_lookup_info(info, addr) != DRMF_SUCCESS) {
             ASSERT(false, "fail to get shadow memory info");
             return 0;
         }
@@ -390,8 +484,7 @@ shadow_get_dword(INOUT umbra_shadow_memory_info_t *info, app_pc addr)
     if (addr < info->app_base || addr >= info->app_base + info->app_size) {
         ASSERT(info->struct_size == sizeof(*info),
                "shadow memory info is not initialized properly");
-        if (umbra_get_shadow_memory(umbra_map, addr,
-                                    NULL, info) != DRMF_SUCCESS) {
+        if (shadow_lookup_info(info, addr) != DRMF_SUCCESS) {
             ASSERT(false, "fail to get shadow memory info");
             return 0;
         }
@@ -417,8 +510,7 @@ shadow_get_qword(INOUT umbra_shadow_memory_info_t *info, app_pc addr)
     if (addr < info->app_base || addr >= info->app_base + info->app_size) {
         ASSERT(info->struct_size == sizeof(*info),
                "shadow memory info is not initialized properly");
-        if (umbra_get_shadow_memory(umbra_map, addr,
-                                    NULL, info) != DRMF_SUCCESS) {
+        if (shadow_lookup_info(info, addr) != DRMF_SUCCESS) {
             ASSERT(false, "fail to get shadow memory info");
             return 0;
         }
@@ -456,8 +548,7 @@ shadow_set_byte(INOUT umbra_shadow_memory_info_t *info, app_pc addr, uint val)
     if (addr < info->app_base || addr >= info->app_base + info->app_size) {
         ASSERT(info->struct_size == sizeof(*info),
                "shadow memory info is not initialized properly");
-        if (umbra_get_shadow_memory(umbra_map, addr,
-                                    NULL, info) != DRMF_SUCCESS) {
+        if (shadow_lookup_info(info, addr) != DRMF_SUCCESS) {
             ASSERT(false, "fail to get shadow memory info");
         }
     }
@@ -493,8 +584,7 @@ shadow_set_byte(INOUT umbra_shadow_memory_info_t *info, app_pc addr, uint val)
             NOTIFY_ERROR("unhandled application memory @"PFX NL, addr);
             dr_abort();
         }
-        if (umbra_get_shadow_memory(umbra_map, addr,
-                                    NULL, info) != DRMF_SUCCESS)
+        if (shadow_lookup_info(info, addr) != DRMF_SUCCESS)
             ASSERT(false, "fail to get shadow memory info");
     }
     ASSERT(info->shadow_type != UMBRA_SHADOW_MEMORY_TYPE_SHADOW_NOT_ALLOC, "will fault");
@@ -729,39 +819,144 @@ shadow_copy_range(app_pc old_start, app_pc new_start, size_t size)
     }
 }
 
+/* Returns the number of leading bytes in [shadow, shadow+len) that equal val.
+ * Large ranges are dominated by this scan, so we compare four pointer-sized
+ * words at a time once aligned.
+ */
+static size_t
+shadow_block_match_len(const byte *shadow, size_t len, byte val)
+{
+    const byte *s = shadow, *end = shadow + len;
+    ptr_uint_t pattern = (ptr_uint_t)val * (POINTER_MAX / 0xff);
+    while (s < end && !ALIGNED(s, sizeof(ptr_uint_t))) {
+        if (*s != val)
+            return s - shadow;
+        s++;
+    }
+    while (s + 4*sizeof(ptr_uint_t) <= end) {
+        const ptr_uint_t *w = (const ptr_uint_t *) s;
+        if (((w[0] ^ pattern) | (w[1] ^ pattern) |
+             (w[2] ^ pattern) | (w[3] ^ pattern)) != 0)
+            break;
+        s += 4*sizeof(ptr_uint_t);
+    }
+    while (s + sizeof(ptr_uint_t) <= end && *(const ptr_uint_t *)s == pattern)
+        s += sizeof(ptr_uint_t);
+    while (s < end && *s == val)
+        s++;
+    return s - shadow;
+}
+
+/* For a normal (non-shared) shadow block described by info, returns the
+ * number of app bytes starting at the shadow-granularity-aligned pc and
+ * stopping at end whose shadow is val in whole dwords.
+ */
+static size_t
+shadow_dword_run_len(umbra_shadow_memory_info_t *info, app_pc pc, app_pc end, uint val)
+{
+    app_pc lim = info->app_base + info->app_size;
+    ptr_uint_t offs = pc - info->app_base;
+    size_t num_dwords;
+    ASSERT(!MAP_4B_TO_1B && info->shadow_type == UMBRA_SHADOW_MEMORY_TYPE_NORMAL,
+           "only normal 2-bit shadow blocks can be scanned directly");
+    ASSERT(ALIGNED(pc, SHADOW_GRANULARITY), "pc must be aligned");
+    if (end < lim)
+        lim = end;
+    num_dwords = (lim - pc) / SHADOW_GRANULARITY;
+    if (num_dwords == 0)
+        return 0;
+    return SHADOW_GRANULARITY *
+        shadow_block_match_len(info->shadow_base + BLOCK_AS_BYTE_ARRAY_IDX(offs),
+                               num_dwords, (byte) val_to_dword[val]);
+}
+
 void
 shadow_set_non_matching_range(app_pc start, size_t size, uint val, uint val_not)
 {
     umbra_shadow_memory_info_t info;
     app_pc end = start + size;
     app_pc cur;
+    byte dword_skip1 = (byte) val_to_dword[val];
+    byte dword_skip2 = (byte) val_to_dword[val_not];
 
     ASSERT(!MAP_4B_TO_1B, "invalid shadow mode");
     LOG(2, "Marking non-%s bytes in range "PFX"-"PFX" as %s\n",
         shadow_name[val_not], start, end, shadow_name[val]);
-    /* XXX: We could try to be clever for perf, but these calls are rare, so we
-     * go byte by byte.
-     */
     umbra_shadow_memory_info_init(&info);
-    for (cur = start; cur != end; cur++) {
+    for (cur = start; cur != end; ) {
         uint shadow = shadow_get_byte(&info, cur);
+        if (ALIGNED(cur, SHADOW_GRANULARITY) &&
+            info.shadow_type == UMBRA_SHADOW_MEMORY_TYPE_NORMAL &&
+            (size_t)(end - cur) >= SHADOW_GRANULARITY) {
+            /* Operate on the shadow block directly, a dword per shadow byte */
+            app_pc lim = info.app_base + info.app_size;
+            byte *sb = info.shadow_base + BLOCK_AS_BYTE_ARRAY_IDX((ptr_uint_t)
+                                                                 (cur - info.app_base));
+            if (end < lim)
+                lim = end;
+            for (; cur + SHADOW_GRANULARITY <= lim; cur += SHADOW_GRANULARITY, sb++) {
+                uint orig = *sb, res = 0, i;
+                if (orig == dword_skip1 || orig == dword_skip2)
+                    continue;
+                for (i = 0; i < SHADOW_GRANULARITY; i++) {
+                    uint cur_val = (orig >> (i*2)) & 3;
+                    res |= (cur_val == val_not ? cur_val : val) << (i*2);
+                }
+                *sb = (byte) res;
+            }
+            continue;
+        }
         if (shadow != val_not) {
             shadow_set_byte(&info, cur, val);
         }
+        cur++;
     }
 }
 
-static uint dqword_to_val(uint dqword)
+bool
+shadow_range_ok_for_bulk(app_pc start, size_t size)
 {
-    if (dqword == SHADOW_DQWORD_UNADDRESSABLE)
-        return SHADOW_UNADDRESSABLE;
-    if (dqword == SHADOW_DQWORD_UNDEFINED)
-        return SHADOW_UNDEFINED;
-    if (dqword == SHADOW_DQWORD_DEFINED)
-        return SHADOW_DEFINED;
-    if (dqword == SHADOW_DQWORD_BITLEVEL)
-        return SHADOW_DEFINED_BITLEVEL;
-    return UINT_MAX;
+    umbra_shadow_memory_info_t info;
+    app_pc end = start + size;
+    app_pc cur;
+    ASSERT(!MAP_4B_TO_1B, "invalid shadow mode");
+    if (end < start)
+        return false;
+    umbra_shadow_memory_info_init(&info);
+    for (cur = start; cur < end; ) {
+        uint shadow = shadow_get_byte(&info, cur);
+        if (info.shadow_type != UMBRA_SHADOW_MEMORY_TYPE_NORMAL) {
+            /* A shared or not-yet-allocated block has a single value */
+            app_pc lim = info.app_base + info.app_size;
+            if (shadow == SHADOW_UNADDRESSABLE || shadow == SHADOW_DEFINED_BITLEVEL)
+                return false;
+            if (lim <= cur) /* overflow at the top of the address space */
+                break;
+            cur = lim;
+            continue;
+        }
+        if (ALIGNED(cur, SHADOW_GRANULARITY) &&
+            (size_t)(end - cur) >= SHADOW_GRANULARITY) {
+            /* Scan the shadow block directly, a dword per shadow byte.
+             * A 2-bit value is unaddressable or bit-level iff its two bits
+             * differ.
+             */
+            app_pc lim = info.app_base + info.app_size;
+            byte *sb = info.shadow_base + BLOCK_AS_BYTE_ARRAY_IDX((ptr_uint_t)
+                                                                 (cur - info.app_base));
+            if (end < lim)
+                lim = end;
+            for (; cur + SHADOW_GRANULARITY <= lim; cur += SHADOW_GRANULARITY, sb++) {
+                if (((*sb ^ (*sb >> 1)) & 0x55) != 0)
+                    return false;
+            }
+            continue;
+        }
+        if (shadow == SHADOW_UNADDRESSABLE || shadow == SHADOW_DEFINED_BITLEVEL)
+            return false;
+        cur++;
+    }
+    return true;
 }
 
 const char *
@@ -798,19 +993,20 @@ shadow_check_range(app_pc start, size_t size, uint expect,
     umbra_shadow_memory_info_init(&info);
     while (pc < start+size) {
         val = shadow_get_byte(&info, pc);
-        if (!ALIGNED(pc, 16)) {
-            incr = 1;
-        } else if (SHADOW_IS_SHARED_ONLY(info.shadow_type)) {
+        if (ALIGNED(pc, 16) && SHADOW_IS_SHARED_ONLY(info.shadow_type)) {
             incr = info.app_base + info.app_size - pc;
+        } else if (!MAP_4B_TO_1B && ALIGNED(pc, SHADOW_GRANULARITY) &&
+                   info.shadow_type == UMBRA_SHADOW_MEMORY_TYPE_NORMAL &&
+                   (res ? expect : bad_val) != SHADOW_MIXED &&
+                   (incr = shadow_dword_run_len(&info, pc, start+size,
+                                                res ? expect : bad_val)) > 0) {
+            /* A run of whole dwords matching what we're looking for: either
+             * expect, or the extent of the bad value.
+             */
+            val = res ? expect : bad_val;
         } else {
-            val = shadow_get_byte(&info, pc);
-            val = dqword_to_val(val);
-            if (val == UINT_MAX) {
-                /* mixed: have to drop to per-byte */
-                val = shadow_get_byte(&info, pc);
-                incr = 1;
-            } else /* all identical */
-                incr = 16;
+            /* mixed, unaligned, or a value change: go per-byte */
+            incr = 1;
         }
         if (!res) {
             /* we know we have some non-matching bytes, but we want to know
@@ -1985,19 +2181,107 @@ void
 shadow_thread_init(void *drcontext)
 {
     shadow_registers_thread_init(drcontext);
+    shadow_cache_thread_init(drcontext);
 }
 
 void
 shadow_thread_exit(void *drcontext)
 {
+    shadow_cache_thread_exit(drcontext);
     shadow_registers_thread_exit(drcontext);
 }
 
+static bool
+shadow_footprint_cb(umbra_map_t *map, umbra_shadow_memory_info_t *info,
+                    void *user_data)
+{
+    /* Shared special blocks cost one block no matter how much they shadow */
+    if (info->shadow_type == UMBRA_SHADOW_MEMORY_TYPE_NORMAL)
+        *(size_t *)user_data += info->shadow_size;
+    return true;
+}
+
+size_t
+shadow_memory_footprint(void)
+{
+    size_t bytes = 0;
+    if (umbra_iterate_shadow_memory(umbra_map, &bytes, shadow_footprint_cb) !=
+        DRMF_SUCCESS)
+        LOG(1, "WARNING: failed to iterate shadow memory\n");
+    return bytes;
+}
+
+#ifdef LINUX
+/* /proc/self/pagemap entry bits */
+# define PAGEMAP_PRESENT   (1ULL << 63)
+# define PAGEMAP_EXCLUSIVE (1ULL << 56)
+/* How many pagemap entries we read at once */
+# define PAGEMAP_BATCH 128
+
+typedef struct _page_count_t {
+    file_t pagemap;
+    uint resident;
+    uint exclusive;
+    bool ok;
+} page_count_t;
+
+static bool
+shadow_count_pages_cb(umbra_map_t *map, umbra_shadow_memory_info_t *info,
+                      void *user_data)
+{
+    page_count_t *count = (page_count_t *) user_data;
+    uint64 entries[PAGEMAP_BATCH];
+    byte *pc = (byte *) ALIGN_BACKWARD(info->shadow_base, PAGE_SIZE);
+    byte *end = (byte *) ALIGN_FORWARD(info->shadow_base + info->shadow_size, PAGE_SIZE);
+    /* Shared special blocks are shared by construction */
+    if (info->shadow_type != UMBRA_SHADOW_MEMORY_TYPE_NORMAL)
+        return true;
+    while (pc < end) {
+        size_t num = MIN(PAGEMAP_BATCH, (end - pc) / PAGE_SIZE);
+        size_t i;
+        if (!dr_file_seek(count->pagemap, ((ptr_uint_t)pc / PAGE_SIZE) * sizeof(uint64),
+                          DR_SEEK_SET) ||
+            dr_read_file(count->pagemap, entries, num * sizeof(uint64)) !=
+            (ssize_t)(num * sizeof(uint64))) {
+            count->ok = false;
+            return false;
+        }
+        for (i = 0; i < num; i++) {
+            if (TEST(PAGEMAP_PRESENT, entries[i])) {
+                count->resident++;
+                if (TEST(PAGEMAP_EXCLUSIVE, entries[i]))
+                    count->exclusive++;
+            }
+        }
+        pc += num * PAGE_SIZE;
+    }
+    return true;
+}
+
+bool
+shadow_count_private_pages(uint *resident OUT, uint *exclusive OUT)
+{
+    page_count_t count = {INVALID_FILE, 0, 0, true};
+    count.pagemap = dr_open_file("/proc/self/pagemap", DR_FILE_READ);
+    if (count.pagemap == INVALID_FILE)
+        return false;
+    if (umbra_iterate_shadow_memory(umbra_map, &count, shadow_count_pages_cb) !=
+        DRMF_SUCCESS)
+        count.ok = false;
+    dr_close_file(count.pagemap);
+    *resident = count.resident;
+    *exclusive = count.exclusive;
+    return count.ok;
+}
+#endif
+
 void
 shadow_init(void)
 {
     ASSERT(options.shadowing, "shadowing disabled");
     shadow_registers_init();
+    tls_idx_shadow_cache = drmgr_register_tls_field();
+    ASSERT(tls_idx_shadow_cache > -1, "failed to reserve TLS slot");
     shadow_table_init();
 }
 
@@ -2005,6 +2289,7 @@ void
 shadow_exit(void)
 {
     shadow_registers_exit();
+    drmgr_unregister_tls_field(tls_idx_shadow_cache);
     shadow_table_exit();
 }
 
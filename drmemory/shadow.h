@@ -149,6 +149,32 @@ shadow_thread_init(void *drcontext);
 void
 shadow_thread_exit(void *drcontext);
 
+/* Returns the bytes of normal, i.e., not shared special, shadow blocks */
+size_t
+shadow_memory_footprint(void);
+
+#ifdef LINUX
+/* Counts the resident pages of normal shadow blocks and how many of them are
+ * exclusive to this process, i.e., no longer shared copy-on-write with the
+ * parent after a fork.  Returns false if the counts are unavailable.
+ */
+bool
+shadow_count_private_pages(uint *resident OUT, uint *exclusive OUT);
+#endif
+
+/* Sets [base, base+size) to value (a SHADOW_* byte value), using a special
+ * block for each whole shadow block the range covers that has not been
+ * written yet.  Returns false on failure, in which case nothing may be set.
+ */
+bool
+shadow_create_shadow_memory(app_pc base, size_t size, uint value);
+
+/* Marks [base, base+size) unaddressable, releasing any shadow blocks the range
+ * covers entirely.  For memory that is no longer mapped.
+ */
+void
+shadow_delete_shadow_memory(app_pc base, size_t size);
+
 size_t
 get_shadow_block_size(void);
 
@@ -239,6 +265,13 @@ shadow_copy_range(app_pc old_start, app_pc new_start, size_t size);
 void
 shadow_set_non_matching_range(app_pc start, size_t size, uint val, uint val_not);
 
+/* Returns whether no byte in [start, start+size) is unaddressable or
+ * bit-level, i.e., whether the range can be written natively and have its
+ * shadow values copied or set as a whole.  Only supported in full mode.
+ */
+bool
+shadow_range_ok_for_bulk(app_pc start, size_t size);
+
 /* Compares every byte in [start, start+size) to expect.
  * start must be 16-byte aligned.
  * Stops and returns the pc of the first non-matching value.
@@ -48,6 +48,10 @@
 #include "pattern.h"
 #include <stddef.h>
 #include "asm_utils.h"
+#include "prof.h"
+#ifdef BUILD_UNIT_TESTS
+# include "hashmap.h"
+#endif
 
 #ifdef STATISTICS
 /* per-opcode counts */
@@ -61,8 +65,12 @@ uint64 slowpath_sz10;
 uint64 slowpath_sz16;
 uint64 slowpath_szOther;
 
-/* PR 423757: periodic stats dump */
+/* PR 423757: periodic stats dump.  Threads publish their slowpath counts to
+ * stats_dump_clock in batches, so the dump can be up to one batch per thread late.
+ */
 uint next_stats_dump;
+volatile int stats_dump_clock;
+#define STATS_DUMP_BATCH 1024
 
 uint num_faults;
 uint num_slowpath_faults;
@@ -71,6 +79,7 @@ uint num_slowpath_faults;
 #ifdef STATISTICS
 uint slowpath_executions;
 uint medpath_executions;
+uint slowpath_decode_hits;
 uint read_slowpath;
 uint write_slowpath;
 uint push_slowpath;
@@ -86,6 +95,8 @@ uint pop4_fastpath;
 uint slow_instead_of_fast;
 uint heap_header_exception;
 uint tls_exception;
+uint tls_slot_defined;
+uint tls_slot_reset;
 uint alloca_exception;
 uint strlen_exception;
 uint strlen_uninit_exception;
@@ -117,11 +128,14 @@ uint xl8_not_shared_unaligned;
 uint xl8_not_shared_mem2mem;
 uint xl8_not_shared_offs;
 uint xl8_not_shared_slowpaths;
+uint xl8_not_shared_bb_end;
 uint xl8_shared_slowpath_instrs;
 uint xl8_shared_slowpath_count;
 uint slowpath_unaligned;
 uint slowpath_8_at_border;
 uint num_bbs;
+uint self_loop_bbs;
+uint self_loop_memrefs;
 #endif
 
 /***************************************************************************
@@ -491,7 +505,7 @@ slow_path_without_uninitialized(void *drcontext, dr_mcontext_t *mc, instr_t *ins
         }
     }
 
-    instr_free(drcontext, inst);
+    slowpath_instr_free(drcontext, inst);
 
     /* call this last after freeing inst in case it does a synchronous flush */
     slow_path_xl8_sharing(loc, instr_sz, memop, mc);
@@ -500,6 +514,443 @@ slow_path_without_uninitialized(void *drcontext, dr_mcontext_t *mc, instr_t *ins
 }
 #endif /* TOOL_DR_MEMORY */
 
+#ifdef TOOL_DR_MEMORY
+/***************************************************************************
+ * Slowpath profile (-slowpath_profile)
+ *
+ * Counts slowpath entries per app pc and likely reason, so we can see which
+ * instructions the fastpath is missing or bailing out of.  Each thread counts
+ * into its own table with no locking; tables are merged on thread exit, and
+ * any still-live threads' tables are merged at process exit.
+ */
+
+typedef enum {
+    SLOWPATH_REASON_MEDIUM,       /* handled by the medium path */
+    SLOWPATH_REASON_UNADDR,       /* a memory operand is unaddressable */
+    SLOWPATH_REASON_UNALIGNED,    /* a memory operand is not size-aligned */
+    SLOWPATH_REASON_PARTIAL,      /* memory shadow is mixed or bitlevel */
+    SLOWPATH_REASON_UNDEF_MEM,    /* an undefined memory source */
+    SLOWPATH_REASON_UNDEF_REG,    /* an undefined register source or address */
+    SLOWPATH_REASON_OTHER,        /* the fastpath does not handle this instr */
+    SLOWPATH_REASON_COUNT,
+} slowpath_reason_t;
+
+static const char *const slowpath_reason_name[SLOWPATH_REASON_COUNT] = {
+    "medium path",
+    "unaddressable",
+    "unaligned",
+    "partially undefined",
+    "undefined memory",
+    "undefined register",
+    "unsupported",
+};
+
+typedef struct _slowpath_prof_entry_t {
+    app_pc pc;
+    uint64 total;
+    uint64 count[SLOWPATH_REASON_COUNT];
+} slowpath_prof_entry_t;
+
+typedef struct _slowpath_prof_thread_t {
+    hashtable_t table;
+    struct _slowpath_prof_thread_t *next;
+    struct _slowpath_prof_thread_t *prev;
+} slowpath_prof_thread_t;
+
+#define SLOWPATH_PROF_HASH_BITS 10
+
+static int tls_idx_slowprof = -1;
+/* protects slowprof_table and slowprof_threads */
+static void *slowprof_lock;
+static hashtable_t slowprof_table;
+static slowpath_prof_thread_t *slowprof_threads;
+
+static void
+slowpath_prof_entry_free(void *entry)
+{
+    global_free(entry, sizeof(slowpath_prof_entry_t), HEAPSTAT_MISC);
+}
+
+static void
+slowpath_profile_add(hashtable_t *table, app_pc pc, const uint64 *counts)
+{
+    slowpath_prof_entry_t *entry = (slowpath_prof_entry_t *)
+        hashtable_lookup(table, pc);
+    uint i;
+    if (entry == NULL) {
+        entry = (slowpath_prof_entry_t *) global_alloc(sizeof(*entry), HEAPSTAT_MISC);
+        memset(entry, 0, sizeof(*entry));
+        entry->pc = pc;
+        hashtable_add(table, pc, entry);
+    }
+    for (i = 0; i < SLOWPATH_REASON_COUNT; i++) {
+        entry->count[i] += counts[i];
+        entry->total += counts[i];
+    }
+}
+
+/* caller must hold slowprof_lock */
+static void
+slowpath_profile_merge(slowpath_prof_thread_t *pt)
+{
+    uint i;
+    hash_entry_t *he;
+    for (i = 0; i < HASHTABLE_SIZE(pt->table.table_bits); i++) {
+        for (he = pt->table.table[i]; he != NULL; he = he->next) {
+            slowpath_prof_entry_t *entry = (slowpath_prof_entry_t *) he->payload;
+            slowpath_profile_add(&slowprof_table, entry->pc, entry->count);
+        }
+    }
+    hashtable_clear(&pt->table);
+}
+
+void
+slowpath_profile_init(void)
+{
+    if (options.slowpath_profile == 0)
+        return;
+    tls_idx_slowprof = drmgr_register_tls_field();
+    ASSERT(tls_idx_slowprof > -1, "unable to reserve TLS slot");
+    slowprof_lock = dr_mutex_create();
+    hashtable_init_ex(&slowprof_table, SLOWPATH_PROF_HASH_BITS, HASH_INTPTR,
+                      false/*!strdup*/, false/*using external synch*/,
+                      slowpath_prof_entry_free, NULL, NULL);
+}
+
+void
+slowpath_profile_exit(void)
+{
+    slowpath_prof_thread_t *pt, *next;
+    if (options.slowpath_profile == 0)
+        return;
+    /* threads still alive at exit get no exit event */
+    for (pt = slowprof_threads; pt != NULL; pt = next) {
+        next = pt->next;
+        hashtable_delete(&pt->table);
+        global_free(pt, sizeof(*pt), HEAPSTAT_MISC);
+    }
+    slowprof_threads = NULL;
+    hashtable_delete(&slowprof_table);
+    dr_mutex_destroy(slowprof_lock);
+    drmgr_unregister_tls_field(tls_idx_slowprof);
+}
+
+void
+slowpath_profile_thread_init(void *drcontext)
+{
+    slowpath_prof_thread_t *pt;
+    if (options.slowpath_profile == 0)
+        return;
+    pt = (slowpath_prof_thread_t *) global_alloc(sizeof(*pt), HEAPSTAT_MISC);
+    hashtable_init_ex(&pt->table, SLOWPATH_PROF_HASH_BITS, HASH_INTPTR,
+                      false/*!strdup*/, false/*!synch*/,
+                      slowpath_prof_entry_free, NULL, NULL);
+    dr_mutex_lock(slowprof_lock);
+    pt->prev = NULL;
+    pt->next = slowprof_threads;
+    if (slowprof_threads != NULL)
+        slowprof_threads->prev = pt;
+    slowprof_threads = pt;
+    dr_mutex_unlock(slowprof_lock);
+    drmgr_set_tls_field(drcontext, tls_idx_slowprof, (void *)pt);
+}
+
+void
+slowpath_profile_thread_exit(void *drcontext)
+{
+    slowpath_prof_thread_t *pt;
+    if (options.slowpath_profile == 0)
+        return;
+    pt = (slowpath_prof_thread_t *) drmgr_get_tls_field(drcontext, tls_idx_slowprof);
+    if (pt == NULL)
+        return;
+    dr_mutex_lock(slowprof_lock);
+    slowpath_profile_merge(pt);
+    if (pt->prev != NULL)
+        pt->prev->next = pt->next;
+    else
+        slowprof_threads = pt->next;
+    if (pt->next != NULL)
+        pt->next->prev = pt->prev;
+    dr_mutex_unlock(slowprof_lock);
+    drmgr_set_tls_field(drcontext, tls_idx_slowprof, NULL);
+    hashtable_delete(&pt->table);
+    global_free(pt, sizeof(*pt), HEAPSTAT_MISC);
+}
+
+/* Any bit pair of 1x is undefined or bitlevel; 01 just marks the unused
+ * bytes of a sub-register.
+ */
+static bool
+slowpath_profile_reg_undefined(int opc, reg_id_t reg)
+{
+    if (reg == REG_NULL || !reg_is_shadowed(opc, reg))
+        return false;
+    return TESTANY(0xaaaaaaaa, get_shadow_register(reg));
+}
+
+/* Re-derives why the fastpath did not handle this execution, without
+ * changing any state.  The first unaddressable byte wins; otherwise the
+ * reasons are ranked in the order the fastpath checks them.
+ */
+static slowpath_reason_t
+slowpath_profile_reason(instr_t *inst, dr_mcontext_t *mc)
+{
+    int i, opc = instr_get_opcode(inst);
+    int num_srcs = instr_num_srcs(inst);
+    bool unaligned = false, partial = false, undef_mem = false, undef_reg = false;
+    umbra_shadow_memory_info_t info;
+    umbra_shadow_memory_info_init(&info);
+    for (i = 0; i < num_srcs + instr_num_dsts(inst); i++) {
+        bool is_src = (i < num_srcs);
+        opnd_t opnd = is_src ? instr_get_src(inst, i) : instr_get_dst(inst, i - num_srcs);
+        if (opnd_is_reg(opnd)) {
+            if (is_src && options.check_uninitialized &&
+                slowpath_profile_reg_undefined(opc, opnd_get_reg(opnd)))
+                undef_reg = true;
+        } else if (opnd_is_memory_reference(opnd)) {
+            app_pc addr;
+            uint sz, j;
+            bool seen_def = false, seen_undef = false;
+            if (options.check_uninitialized && opnd_is_base_disp(opnd) &&
+                (slowpath_profile_reg_undefined(opc, opnd_get_base(opnd)) ||
+                 slowpath_profile_reg_undefined(opc, opnd_get_index(opnd))))
+                undef_reg = true;
+            if (IF_X86_ELSE(opc == OP_lea, false))
+                continue;
+            addr = opnd_compute_address(opnd, mc);
+            sz = opnd_size_in_bytes(opnd_get_size(opnd));
+            /* as in handle_mem_ref_internal(), 8 bytes aligned to 4 is fine */
+            if (sz > 1 && !ALIGNED(addr, sz) && !(sz == 8 && ALIGNED(addr, 4)))
+                unaligned = true;
+            /* we do not need every byte of a large operand to classify it */
+            for (j = 0; j < sz && j < 64; j++) {
+                uint shadow = shadow_get_byte(&info, addr + j);
+                if (shadow == SHADOW_UNADDRESSABLE)
+                    return SLOWPATH_REASON_UNADDR;
+                if (shadow == SHADOW_DEFINED_BITLEVEL)
+                    partial = true;
+                else if (shadow == SHADOW_UNDEFINED)
+                    seen_undef = true;
+                else
+                    seen_def = true;
+            }
+            if (seen_def && seen_undef)
+                partial = true;
+            else if (seen_undef && is_src)
+                undef_mem = true;
+        }
+    }
+    if (unaligned)
+        return SLOWPATH_REASON_UNALIGNED;
+    if (options.check_uninitialized) {
+        if (partial)
+            return SLOWPATH_REASON_PARTIAL;
+        if (undef_mem)
+            return SLOWPATH_REASON_UNDEF_MEM;
+        if (undef_reg)
+            return SLOWPATH_REASON_UNDEF_REG;
+    }
+    return SLOWPATH_REASON_OTHER;
+}
+
+static void
+slowpath_profile_record(void *drcontext, app_pc pc, slowpath_reason_t reason)
+{
+    slowpath_prof_thread_t *pt = (slowpath_prof_thread_t *)
+        drmgr_get_tls_field(drcontext, tls_idx_slowprof);
+    uint64 counts[SLOWPATH_REASON_COUNT];
+    if (pt == NULL)
+        return;
+    memset(counts, 0, sizeof(counts));
+    counts[reason] = 1;
+    slowpath_profile_add(&pt->table, pc, counts);
+}
+
+/* Prints the options.slowpath_profile pcs with the most slowpath entries.
+ * Must be called while symbols are still available.
+ */
+void
+slowpath_profile_dump(file_t f)
+{
+    slowpath_prof_thread_t *pt;
+    slowpath_prof_entry_t **top;
+    uint i, j, num_top = 0, max_top = options.slowpath_profile;
+    uint64 total = 0;
+    hash_entry_t *he;
+    char buf[MAX_SYMBOL_LEN + MAX_FILENAME_LEN*2/*extra for PRINT_ABS_ADDRESS*/];
+    if (max_top == 0)
+        return;
+    top = (slowpath_prof_entry_t **)
+        global_alloc(max_top * sizeof(*top), HEAPSTAT_MISC);
+    dr_mutex_lock(slowprof_lock);
+    /* Other threads are no longer running at process exit */
+    for (pt = slowprof_threads; pt != NULL; pt = pt->next)
+        slowpath_profile_merge(pt);
+    /* keep the top entries sorted by total, highest first */
+    for (i = 0; i < HASHTABLE_SIZE(slowprof_table.table_bits); i++) {
+        for (he = slowprof_table.table[i]; he != NULL; he = he->next) {
+            slowpath_prof_entry_t *entry = (slowpath_prof_entry_t *) he->payload;
+            total += entry->total;
+            if (num_top == max_top && entry->total <= top[num_top - 1]->total)
+                continue;
+            if (num_top < max_top)
+                num_top++;
+            for (j = num_top - 1; j > 0 && top[j - 1]->total < entry->total; j--)
+                top[j] = top[j - 1];
+            top[j] = entry;
+        }
+    }
+    dr_fprintf(f, "\nSlowpath profile: %"UINT64_FORMAT_CODE" entries at %u pcs;"
+               " top %u:\n", total, slowprof_table.entries, num_top);
+    for (i = 0; i < num_top; i++) {
+        size_t sofar = 0;
+        ssize_t len;
+        BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len,
+                 "%12"UINT64_FORMAT_CODE" ", top[i]->total);
+        if (!print_address(buf, BUFFER_SIZE_ELEMENTS(buf), &sofar, top[i]->pc, NULL,
+                           true/*for log*/))
+            BUFPRINT(buf, BUFFER_SIZE_ELEMENTS(buf), sofar, len, PFX"\n", top[i]->pc);
+        NULL_TERMINATE_BUFFER(buf);
+        dr_fprintf(f, "%s", buf);
+        for (j = 0; j < SLOWPATH_REASON_COUNT; j++) {
+            if (top[i]->count[j] > 0) {
+                dr_fprintf(f, "\t\t%12"UINT64_FORMAT_CODE" %s\n",
+                           top[i]->count[j], slowpath_reason_name[j]);
+            }
+        }
+    }
+    dr_mutex_unlock(slowprof_lock);
+    global_free(top, max_top * sizeof(*top), HEAPSTAT_MISC);
+}
+
+/***************************************************************************
+ * Slowpath decode cache (-slowpath_decode_cache)
+ *
+ * An instruction that keeps exiting to the slowpath is decoded again on every
+ * entry.  Each thread keeps its recently decoded instrs in a small direct-mapped
+ * table indexed by decode pc.  A hit must also match the instr's bytes, so code
+ * that was modified or re-mapped at the same address is decoded afresh.  The
+ * operands of a cached instr come from that thread's heap, so the table is not
+ * shared.
+ */
+
+#define DECODE_CACHE_BITS 7
+#define DECODE_CACHE_SIZE (1 << DECODE_CACHE_BITS)
+
+typedef struct _decode_cache_entry_t {
+    app_pc pc; /* NULL if unused */
+    instr_t inst;
+    ushort length;
+    byte bytes[MAX_INSTR_LENGTH];
+} decode_cache_entry_t;
+
+static int tls_idx_decode_cache = -1;
+
+static inline uint
+decode_cache_index(app_pc pc)
+{
+    ptr_uint_t val = (ptr_uint_t) pc;
+    return (uint)((val ^ (val >> DECODE_CACHE_BITS)) & (DECODE_CACHE_SIZE - 1));
+}
+
+void
+slowpath_decode_cache_init(void)
+{
+    if (!options.slowpath_decode_cache)
+        return;
+    tls_idx_decode_cache = drmgr_register_tls_field();
+    ASSERT(tls_idx_decode_cache > -1, "unable to reserve TLS slot");
+}
+
+void
+slowpath_decode_cache_exit(void)
+{
+    if (!options.slowpath_decode_cache)
+        return;
+    drmgr_unregister_tls_field(tls_idx_decode_cache);
+}
+
+void
+slowpath_decode_cache_thread_init(void *drcontext)
+{
+    decode_cache_entry_t *cache;
+    if (!options.slowpath_decode_cache)
+        return;
+    cache = (decode_cache_entry_t *)
+        thread_alloc(drcontext, DECODE_CACHE_SIZE * sizeof(*cache), HEAPSTAT_MISC);
+    memset(cache, 0, DECODE_CACHE_SIZE * sizeof(*cache));
+    drmgr_set_tls_field(drcontext, tls_idx_decode_cache, (void *)cache);
+}
+
+void
+slowpath_decode_cache_thread_exit(void *drcontext)
+{
+    decode_cache_entry_t *cache;
+    uint i;
+    if (!options.slowpath_decode_cache)
+        return;
+    cache = (decode_cache_entry_t *)
+        drmgr_get_tls_field(drcontext, tls_idx_decode_cache);
+    if (cache == NULL)
+        return;
+    drmgr_set_tls_field(drcontext, tls_idx_decode_cache, NULL);
+    for (i = 0; i < DECODE_CACHE_SIZE; i++) {
+        if (cache[i].pc != NULL)
+            instr_free(drcontext, &cache[i].inst);
+    }
+    thread_free(drcontext, cache, DECODE_CACHE_SIZE * sizeof(*cache), HEAPSTAT_MISC);
+}
+
+/* Decodes the instr at decode_pc into *local, or with -slowpath_decode_cache
+ * into this thread's cache.  Returns the instr to use in *inst and, like
+ * decode(), the pc of the next instr (NULL if invalid).  The instr must be
+ * released with slowpath_instr_free().
+ */
+static app_pc
+slowpath_decode(void *drcontext, app_pc decode_pc, instr_t *local, instr_t **inst OUT)
+{
+    decode_cache_entry_t *cache, *entry;
+    app_pc next_pc;
+    if (options.slowpath_decode_cache) {
+        cache = (decode_cache_entry_t *)
+            drmgr_get_tls_field(drcontext, tls_idx_decode_cache);
+        ASSERT(cache != NULL, "decode cache not initialized");
+        entry = &cache[decode_cache_index(decode_pc)];
+        if (entry->pc == decode_pc &&
+            memcmp(entry->bytes, decode_pc, entry->length) == 0) {
+            STATS_INC(slowpath_decode_hits);
+            *inst = &entry->inst;
+            return decode_pc + entry->length;
+        }
+        if (entry->pc != NULL)
+            instr_free(drcontext, &entry->inst);
+        entry->pc = NULL;
+        instr_init(drcontext, &entry->inst);
+        next_pc = decode(drcontext, decode_pc, &entry->inst);
+        if (next_pc != NULL) {
+            ASSERT(next_pc - decode_pc <= MAX_INSTR_LENGTH, "instr too long");
+            entry->pc = decode_pc;
+            entry->length = (ushort)(next_pc - decode_pc);
+            memcpy(entry->bytes, decode_pc, entry->length);
+        }
+        *inst = &entry->inst;
+        return next_pc;
+    }
+    instr_init(drcontext, local);
+    *inst = local;
+    return decode(drcontext, decode_pc, local);
+}
+
+void
+slowpath_instr_free(void *drcontext, instr_t *inst)
+{
+    /* a cached instr is freed when evicted or at thread exit */
+    if (!options.slowpath_decode_cache)
+        instr_free(drcontext, inst);
+}
+#endif /* TOOL_DR_MEMORY */
+
 /* Does everything in C code, except for handling non-push/pop writes to esp.
  *
  * General design:
@@ -521,10 +972,11 @@ slow_path_without_uninitialized(void *drcontext, dr_mcontext_t *mc, instr_t *ins
  * one byte at a time, so we can make the slowpath more closely match the
  * fastpath code, and thus make it easier to transition opcodes to the fastpath?
  */
-bool
-slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *mc)
+static bool
+slow_path_with_mc_internal(void *drcontext, app_pc pc, app_pc decode_pc,
+                           dr_mcontext_t *mc)
 {
-    instr_t inst;
+    instr_t inst_local, *inst;
     int opc;
 #ifdef TOOL_DR_MEMORY
     opnd_t opnd;
@@ -544,13 +996,15 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
     /* PR 423757: periodic stats dump, both for server apps that don't
      * close cleanly and to get stats out prior to overflow.
      */
-    int execs = atomic_add32_return_sum((volatile int *)&slowpath_executions, 1);
-    if (execs == next_stats_dump) {
-        /* still racy: could skip a dump, but that's ok */
-        ATOMIC_ADD32(next_stats_dump, options.stats_dump_interval);
-        dr_fprintf(f_global, "\n**** per-%dK-slowpath stats dump:\n",
-                   options.stats_dump_interval/1000);
-        dump_statistics();
+    if (STATS_INC(slowpath_executions) % STATS_DUMP_BATCH == 0) {
+        int execs = atomic_add32_return_sum(&stats_dump_clock, STATS_DUMP_BATCH);
+        if ((uint)execs >= next_stats_dump) {
+            /* still racy: could skip a dump, but that's ok */
+            ATOMIC_ADD32(next_stats_dump, options.stats_dump_interval);
+            dr_fprintf(f_global, "\n**** per-%dK-slowpath stats dump:\n",
+                       options.stats_dump_interval/1000);
+            dump_statistics();
+        }
     }
 #endif
 
@@ -567,35 +1021,44 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
 
 #ifdef TOOL_DR_MEMORY
     if (decode_pc != NULL) {
-        if (medium_path_arch(decode_pc, &loc, mc))
+        if (medium_path_arch(decode_pc, &loc, mc)) {
+            if (options.slowpath_profile > 0)
+                slowpath_profile_record(drcontext, pc, SLOWPATH_REASON_MEDIUM);
             return true;
+        }
     }
 #endif /* TOOL_DR_MEMORY */
 
-    instr_init(drcontext, &inst);
 #ifdef TOOL_DR_MEMORY
-    instr_sz = decode(drcontext, decode_pc, &inst) - decode_pc;
+    instr_sz = slowpath_decode(drcontext, decode_pc, &inst_local, &inst) - decode_pc;
 #else
-    decode(drcontext, decode_pc, &inst);
+    inst = &inst_local;
+    instr_init(drcontext, inst);
+    decode(drcontext, decode_pc, inst);
 #endif
-    ASSERT(instr_valid(&inst), "invalid instr");
-    opc = instr_get_opcode(&inst);
+    ASSERT(instr_valid(inst), "invalid instr");
+    opc = instr_get_opcode(inst);
 
     slowpath_update_app_loc_arch(opc, decode_pc, &loc);
 
+#ifdef TOOL_DR_MEMORY
+    if (options.slowpath_profile > 0)
+        slowpath_profile_record(drcontext, pc, slowpath_profile_reason(inst, mc));
+#endif
+
 #ifdef STATISTICS
     STATS_INC(slowpath_count[opc]);
     {
-        uint bytes = instr_memory_reference_size(&inst);
+        uint bytes = instr_memory_reference_size(inst);
         if (bytes == 0) {
-            if (instr_num_dsts(&inst) > 0 &&
-                !opnd_is_pc(instr_get_dst(&inst, 0)) &&
-                !opnd_is_instr(instr_get_dst(&inst, 0)))
-                bytes = opnd_size_in_bytes(opnd_get_size(instr_get_dst(&inst, 0)));
-            else if (instr_num_srcs(&inst) > 0 &&
-                     !opnd_is_pc(instr_get_src(&inst, 0)) &&
-                     !opnd_is_instr(instr_get_src(&inst, 0)))
-                bytes = opnd_size_in_bytes(opnd_get_size(instr_get_src(&inst, 0)));
+            if (instr_num_dsts(inst) > 0 &&
+                !opnd_is_pc(instr_get_dst(inst, 0)) &&
+                !opnd_is_instr(instr_get_dst(inst, 0)))
+                bytes = opnd_size_in_bytes(opnd_get_size(instr_get_dst(inst, 0)));
+            else if (instr_num_srcs(inst) > 0 &&
+                     !opnd_is_pc(instr_get_src(inst, 0)) &&
+                     !opnd_is_instr(instr_get_src(inst, 0)))
+                bytes = opnd_size_in_bytes(opnd_get_size(instr_get_src(inst, 0)));
             else
                 bytes = 0;
         }
@@ -618,25 +1081,25 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
 
     DOLOG(3, {
         LOG(3, "\nslow_path "PFX": ", pc);
-        instr_disassemble(drcontext, &inst, LOGFILE_GET(drcontext));
-        if (instr_num_dsts(&inst) > 0 &&
-            opnd_is_memory_reference(instr_get_dst(&inst, 0))) {
+        instr_disassemble(drcontext, inst, LOGFILE_GET(drcontext));
+        if (instr_num_dsts(inst) > 0 &&
+            opnd_is_memory_reference(instr_get_dst(inst, 0))) {
             umbra_shadow_memory_info_t info;
             umbra_shadow_memory_info_init(&info);
             LOG(3, " | 0x%x",
                 shadow_get_byte(&info,
-                                opnd_compute_address(instr_get_dst(&inst, 0),
+                                opnd_compute_address(instr_get_dst(inst, 0),
                                                      mc)));
         }
         LOG(3, "\n");
     });
 
 #ifdef TOOL_DR_HEAPSTAT
-    return slow_path_for_staleness(drcontext, mc, &inst, &loc);
+    return slow_path_for_staleness(drcontext, mc, inst, &loc);
 
 #else
     if (!options.check_uninitialized)
-        return slow_path_without_uninitialized(drcontext, mc, &inst, &loc, instr_sz);
+        return slow_path_without_uninitialized(drcontext, mc, inst, &loc, instr_sz);
 
     LOG(4, "shadow registers prior to instr:\n");
     DOLOG(4, { print_shadow_registers(); });
@@ -659,10 +1122,10 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
      * definedness to.  If there are more, we can fit them side by
      * side in our 8-dword-capacity comb->dst array.
      */
-    check_definedness = instr_check_definedness(&inst);
-    always_defined = result_is_always_defined(&inst, false/*us*/);
+    check_definedness = instr_check_definedness(inst);
+    always_defined = result_is_always_defined(inst, false/*us*/);
     pushpop = opc_is_push(opc) || opc_is_pop(opc);
-    check_srcs_after = instr_needs_all_srcs_and_vals(&inst);
+    check_srcs_after = instr_needs_all_srcs_and_vals(inst);
     if (check_srcs_after) {
         /* We need to check definedness of addressing registers, and so we do
          * our normal src loop but we do not check undefinedness or combine
@@ -670,17 +1133,17 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
          * check_mem_opnd() and integrate_register_shadow(), causing the 2
          * sources to be laid out side-by-side in comb->dst.
          */
-        ASSERT(instr_num_srcs(&inst) == 2, "and/or special handling error");
+        ASSERT(instr_num_srcs(inst) == 2, "and/or special handling error");
         check_definedness = false;
         IF_DEBUG(comb.opsz = 0;) /* for asserts below */
     }
 
-    shadow_combine_init(&comb, &inst, opc, OPND_SHADOW_ARRAY_LEN);
+    shadow_combine_init(&comb, inst, opc, OPND_SHADOW_ARRAY_LEN);
 
-    num_srcs = num_true_srcs(&inst, mc);
+    num_srcs = num_true_srcs(inst, mc);
 #ifdef X86
     if (opc == OP_lea)
-        num_srcs = IF_X64_ELSE(opnd_is_rel_addr(instr_get_src(&inst, 0)), false) ? 0 : 2;
+        num_srcs = IF_X64_ELSE(opnd_is_rel_addr(instr_get_src(inst, 0)), false) ? 0 : 2;
 #endif
  check_srcs:
     for (i = 0; i < num_srcs; i++) {
@@ -689,15 +1152,15 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
              * code below can handle REG_NULL
              */
             if (i == 0)
-                opnd = opnd_create_reg(opnd_get_base(instr_get_src(&inst, 0)));
+                opnd = opnd_create_reg(opnd_get_base(instr_get_src(inst, 0)));
             else
-                opnd = opnd_create_reg(opnd_get_index(instr_get_src(&inst, 0)));
+                opnd = opnd_create_reg(opnd_get_index(instr_get_src(inst, 0)));
         } else {
-            opnd = instr_get_src(&inst, i);
+            opnd = instr_get_src(inst, i);
         }
         if (opnd_is_memory_reference(opnd)) {
             int flags = 0;
-            opnd = adjust_memop(&inst, opnd, false, &sz, &pushpop_stackop);
+            opnd = adjust_memop(inst, opnd, false, &sz, &pushpop_stackop);
             /* do not combine srcs if checking after */
             if (check_srcs_after) {
                 ASSERT(i == 0 || sz >= comb.opsz, "check-after needs >=-size srcs");
@@ -713,7 +1176,7 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
             if (always_defined) {
                 LOG(2, "marking and/or/xor with 0/~0/self as defined @"PFX"\n", pc);
                 /* w/o MEMREF_USE_VALUES, handle_mem_ref() will use SHADOW_DEFINED */
-            } else if (check_definedness || always_check_definedness(&inst, i)) {
+            } else if (check_definedness || always_check_definedness(inst, i)) {
                 flags |= MEMREF_CHECK_DEFINEDNESS;
                 if (options.leave_uninit)
                     flags |= MEMREF_USE_VALUES;
@@ -747,8 +1210,8 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
                 if (always_defined) {
                     /* if result defined regardless, don't propagate (is
                      * equivalent to propagating SHADOW_DEFINED) or check */
-                } else if (check_definedness || always_check_definedness(&inst, i)) {
-                    check_register_defined(drcontext, reg, &loc, sz, mc, &inst);
+                } else if (check_definedness || always_check_definedness(inst, i)) {
+                    check_register_defined(drcontext, reg, &loc, sz, mc, inst);
                     if (options.leave_uninit) {
                         integrate_register_shadow(&comb, i, reg, shadow, pushpop);
                     }
@@ -771,14 +1234,14 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
     }
 
     /* eflags source */
-    if (TESTANY(EFLAGS_READ_ARITH, instr_get_eflags(&inst, DR_QUERY_DEFAULT))) {
+    if (TESTANY(EFLAGS_READ_ARITH, instr_get_eflags(inst, DR_QUERY_DEFAULT))) {
         uint shadow = get_shadow_eflags();
         /* for check_srcs_after we leave comb.dst where it last was */
         if (always_defined) {
             /* if result defined regardless, don't propagate (is
              * equivalent to propagating SHADOW_DEFINED) or check */
         } else if (check_definedness) {
-            check_register_defined(drcontext, REG_EFLAGS, &loc, 1, mc, &inst);
+            check_register_defined(drcontext, REG_EFLAGS, &loc, 1, mc, inst);
             if (options.leave_uninit)
                 integrate_register_shadow(&comb, 0, REG_EFLAGS, shadow, pushpop);
         } else {
@@ -797,10 +1260,10 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
 
     if (check_srcs_after) {
         /* turn back on for dsts */
-        check_definedness = instr_check_definedness(&inst);
-        if (check_andor_sources(drcontext, mc, &inst, &comb, decode_pc + instr_sz)) {
+        check_definedness = instr_check_definedness(inst);
+        if (check_andor_sources(drcontext, mc, inst, &comb, decode_pc + instr_sz)) {
             if (TESTANY(EFLAGS_WRITE_ARITH,
-                        instr_get_eflags(&inst, DR_QUERY_INCLUDE_ALL))) {
+                        instr_get_eflags(inst, DR_QUERY_INCLUDE_ALL))) {
                 /* We have to redo the eflags propagation.  map_src_to_dst() combined
                  * all the laid-out sources, some of which we made defined in
                  * check_andor_sources.
@@ -837,12 +1300,12 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
         }
     }
 
-    num_dsts = num_true_dsts(&inst, mc);
+    num_dsts = num_true_dsts(inst, mc);
     for (i = 0; i < num_dsts; i++) {
-        opnd = instr_get_dst(&inst, i);
+        opnd = instr_get_dst(inst, i);
         if (opnd_is_memory_reference(opnd)) {
             int flags = MEMREF_WRITE;
-            opnd = adjust_memop(&inst, opnd, true, &sz, &pushpop_stackop);
+            opnd = adjust_memop(inst, opnd, true, &sz, &pushpop_stackop);
             if (pushpop_stackop)
                 flags |= MEMREF_PUSHPOP;
             if (cpt->mem2fpmm_source != NULL && cpt->mem2fpmm_pc == pc) {
@@ -884,14 +1347,14 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
         } else
             ASSERT(opnd_is_immed_int(opnd) || opnd_is_pc(opnd), "unexpected opnd");
     }
-    if (TESTANY(EFLAGS_WRITE_ARITH, instr_get_eflags(&inst, DR_QUERY_INCLUDE_ALL))) {
+    if (TESTANY(EFLAGS_WRITE_ARITH, instr_get_eflags(inst, DR_QUERY_INCLUDE_ALL))) {
         set_shadow_eflags(comb.eflags);
     }
 
     LOG(4, "shadow registers after instr:\n");
     DOLOG(4, { print_shadow_registers(); });
 
-    instr_free(drcontext, &inst);
+    slowpath_instr_free(drcontext, inst);
 
     /* call this last after freeing inst in case it does a synchronous flush */
     slow_path_xl8_sharing(&loc, instr_sz, memop, mc);
@@ -939,6 +1402,17 @@ slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *m
 #endif /* !TOOL_DR_HEAPSTAT */
 }
 
+bool
+slow_path_with_mc(void *drcontext, app_pc pc, app_pc decode_pc, dr_mcontext_t *mc)
+{
+    bool res;
+    uint64 prof_start;
+    PROF_START(prof_start);
+    res = slow_path_with_mc_internal(drcontext, pc, decode_pc, mc);
+    PROF_STOP(drcontext, PROF_SLOWPATH, prof_start);
+    return res;
+}
+
 /* called from code cache */
 static bool
 slow_path(app_pc pc, app_pc decode_pc)
@@ -1922,7 +2396,14 @@ main(int argc, char *argv[])
 {
     void *drcontext = dr_standalone_init();
 
+    if (argc > 1 && strcmp(argv[1], "-bench_hashmap") == 0) {
+        hashmap_microbenchmark(4096, 1000);
+        hashmap_microbenchmark(1 << 18, 20);
+        return 0;
+    }
+
     slowpath_unit_tests_arch(drcontext);
+    hashmap_unit_tests();
 
     /* add more tests here */
 
@@ -99,6 +99,7 @@ extern uint64 slowpath_szOther;
 /* FIXME: make generalized stats infrastructure */
 extern uint slowpath_executions;
 extern uint medpath_executions;
+extern uint slowpath_decode_hits;
 extern uint read_slowpath;
 extern uint write_slowpath;
 extern uint push_slowpath;
@@ -114,6 +115,8 @@ extern uint pop4_fastpath;
 extern uint slow_instead_of_fast;
 extern uint heap_header_exception;
 extern uint tls_exception;
+extern uint tls_slot_defined;
+extern uint tls_slot_reset;
 extern uint alloca_exception;
 extern uint strlen_exception;
 extern uint strlen_uninit_exception;
@@ -146,13 +149,20 @@ extern uint xl8_not_shared_unaligned;
 extern uint xl8_not_shared_mem2mem;
 extern uint xl8_not_shared_offs;
 extern uint xl8_not_shared_slowpaths;
+extern uint xl8_not_shared_bb_end;
 extern uint xl8_shared_slowpath_instrs;
 extern uint xl8_shared_slowpath_count;
 extern uint slowpath_unaligned;
 extern uint slowpath_8_at_border;
 extern uint alloc_stack_count;
+extern uint alloc_stack_cache_hits;
+extern uint free_stack_count;
+extern uint free_stack_built;
+extern uint free_stack_lost;
 extern uint delayed_free_bytes;
 extern uint num_bbs;
+extern uint self_loop_bbs;
+extern uint self_loop_memrefs;
 
 # ifdef X86
 extern uint movs4_src_unaligned;
@@ -161,6 +171,8 @@ extern uint movs4_src_undef;
 extern uint movs4_med_fast;
 extern uint cmps1_src_undef;
 extern uint cmps1_med_fast;
+extern uint wide_med_fast;
+extern uint repstr_bulk;
 # endif
 
 #endif /* STATISTICS */
@@ -173,6 +185,9 @@ extern hashtable_t xl8_sharing_table;
 /* alloca handling in fastpath (i#91) */
 extern hashtable_t ignore_unaddr_table;
 
+/* -saturate_sites: instructions whose unaddressable accesses are not checked */
+extern hashtable_t saturated_table;
+
 bool
 opnd_uses_nonignorable_memory(opnd_t opnd);
 
@@ -214,6 +229,43 @@ slowpath_module_load(void *drcontext, const module_data_t *mod, bool loaded);
 void
 slowpath_module_unload(void *drcontext, const module_data_t *mod);
 
+#ifdef TOOL_DR_MEMORY
+void
+slowpath_profile_init(void);
+
+void
+slowpath_profile_exit(void);
+
+void
+slowpath_profile_thread_init(void *drcontext);
+
+void
+slowpath_profile_thread_exit(void *drcontext);
+
+void
+slowpath_profile_dump(file_t f);
+
+void
+slowpath_decode_cache_init(void);
+
+void
+slowpath_decode_cache_exit(void);
+
+void
+slowpath_decode_cache_thread_init(void *drcontext);
+
+void
+slowpath_decode_cache_thread_exit(void *drcontext);
+
+void
+slowpath_instr_free(void *drcontext, instr_t *inst);
+
+# ifdef X86
+void
+repstr_bulk_handler(uint opc, uint elemsz, reg_t count);
+# endif
+#endif
+
 /***************************************************************************
  * ISA UTILITY ROUTINES
  */
@@ -223,10 +275,21 @@ slowpath_module_unload(void *drcontext, const module_data_t *mod);
 # define REPNE_PREFIX  0xf2
 # define MOVS_4_OPCODE 0xa5
 # define CMPS_1_OPCODE 0xa6
+# define VEX_3BYTE_PREFIX_OPCODE 0xc4
+# define VEX_2BYTE_PREFIX_OPCODE 0xc5
+# define EVEX_PREFIX_OPCODE      0x62
 # define LOOP_INSTR_OPCODE 0xe2
 # define LOOP_INSTR_LENGTH 2
 # define JNZ_SHORT_OPCODE    0x75
 # define JNZ_SHORT_LENGTH    2
+# define JECXZ_OPCODE        0xe3
+# define JECXZ_LENGTH        2
+# define JMP_SHORT_OPCODE    0xeb
+# define JMP_SHORT_LENGTH    2
+# define LEA_OPCODE          0x8d
+/* modrm bytes for %ecx <- disp(%xcx) */
+# define LEA_ECX_DISP8_MODRM  0x49
+# define LEA_ECX_DISP32_MODRM 0x89
 # define UD2A_LENGTH         2
 # define CMP_OPCODE       0x80
 # define CMP_BASE_IMM1_LENGTH  3
@@ -151,6 +151,12 @@ bool
 assign_register_shadow_arch(shadow_combine_t *comb INOUT, int opnum, opnd_t opnd,
                             reg_id_t reg, bool pushpop, uint *shift INOUT);
 
+void
+medium_path_init_arch(void);
+
+void
+medium_path_exit_arch(void);
+
 /* Returns whether it handled the instruction */
 bool
 medium_path_arch(app_pc decode_pc, app_loc_t *loc, dr_mcontext_t *mc);
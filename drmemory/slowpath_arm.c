@@ -76,17 +76,19 @@ reg_offs_in_dword(reg_id_t reg)
     return 0;
 }
 
+/* There are no implicit stack references to adjust: DR represents the memory
+ * of stm/ldm (including push and pop) and of stp/ldp with a single explicit
+ * operand sized to cover the whole register list.
+ */
 bool
 opc_is_push(uint opc)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
     return false;
 }
 
 bool
 opc_is_pop(uint opc)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
     return false;
 }
 
@@ -108,10 +110,12 @@ opc_is_loopcc(uint opc)
     return false;
 }
 
+/* A shift amount is just another source, whether immed or reg: unlike x86's
+ * %cl it has no special definedness rules.
+ */
 bool
 opc_is_gpr_shift(uint opc)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
     return false;
 }
 
@@ -121,17 +125,18 @@ instr_is_jcc(instr_t *inst)
     return instr_is_cbr(inst);
 }
 
+/* Predication applies to any instruction rather than to particular opcodes:
+ * see num_true_srcs().
+ */
 bool
 opc_is_cmovcc(uint opc)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
     return false;
 }
 
 bool
 opc_is_fcmovcc(uint opc)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
     return false;
 }
 
@@ -139,8 +144,9 @@ opc_is_fcmovcc(uint opc)
 bool
 opc_2nd_dst_is_extension(uint opc)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
-    return false;
+    /* the 64-bit multiplies write the result's halves to two GPRs */
+    return (opc == OP_umull || opc == OP_smull ||
+            opc == OP_umlal || opc == OP_smlal);
 }
 
 bool
@@ -162,10 +168,15 @@ adjust_memop_push_offs(instr_t *inst)
     return 0;
 }
 
+/* The operand already covers the whole reference (see opc_is_push()).
+ * XXX i#1726: stm/ldm and stp/ldp writeback of the stack pointer will
+ * need the MEMREF_PUSHPOP treatment once stack adjusts are ported.
+ */
 opnd_t
 adjust_memop(instr_t *inst, opnd_t opnd, bool write, uint *opsz, bool *pushpop_stackop)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
+    *opsz = opnd_size_in_bytes(opnd_get_size(opnd));
+    *pushpop_stackop = false;
     return opnd;
 }
 
@@ -176,7 +187,6 @@ adjust_memop(instr_t *inst, opnd_t opnd, bool write, uint *opsz, bool *pushpop_s
 bool
 always_check_definedness(instr_t *inst, int opnum)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
     return false;
 }
 
@@ -184,8 +194,20 @@ always_check_definedness(instr_t *inst, int opnum)
 bool
 instr_check_definedness(instr_t *inst)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
-    return false;
+    return
+        /* always check conditional branches, including cbz/cbnz's register */
+        instr_is_cbr(inst) ||
+        options.check_uninit_all ||
+        (options.check_uninit_cmps && !options.defer_uninit_cmps &&
+         /* a compare writes the flags but nothing else */
+         instr_num_dsts(inst) == 0 &&
+         TESTANY(EFLAGS_WRITE_ARITH, instr_get_eflags(inst, DR_QUERY_INCLUDE_ALL))) ||
+        /* if pc is a destination we have to check the corresponding source */
+        instr_writes_to_reg(inst, DR_REG_PC, DR_QUERY_INCLUDE_ALL) ||
+        (!instr_propagatable_dsts(inst) &&
+         !TESTANY(EFLAGS_WRITE_ARITH, instr_get_eflags(inst, DR_QUERY_INCLUDE_ALL)) &&
+         /* as on x86, i#244 */
+         !instr_is_prefetch(inst));
 }
 
 /***************************************************************************
@@ -236,10 +258,10 @@ map_src_to_dst(shadow_combine_t *comb INOUT, int opnum, int src_bytenum, uint sh
 }
 #endif /* TOOL_DR_MEMORY */
 
+/* XXX i#1726: and/orr with 0/~0 are not yet special-cased as on x86 */
 bool
 instr_needs_all_srcs_and_vals(instr_t *inst)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
     return false;
 }
 
@@ -270,21 +292,36 @@ assign_register_shadow_arch(shadow_combine_t *comb INOUT, int opnum, opnd_t opnd
 }
 #endif /* TOOL_DR_MEMORY */
 
+/* As for x86 cmovcc (PR 530902), an instruction whose predicate fails reads
+ * and writes nothing but the flags.
+ */
 int
 num_true_srcs(instr_t *inst, dr_mcontext_t *mc /*optional*/)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
+    if (mc != NULL && instr_predicate_triggered(inst, mc) == DR_PRED_TRIGGER_MISMATCH)
+        return 0;
     return instr_num_srcs(inst);
 }
 
 int
 num_true_dsts(instr_t *inst, dr_mcontext_t *mc /*optional*/)
 {
-    ASSERT_NOT_IMPLEMENTED(); /* FIXME i#1726: NYI */
+    if (mc != NULL && instr_predicate_triggered(inst, mc) == DR_PRED_TRIGGER_MISMATCH)
+        return 0;
     return instr_num_dsts(inst);
 }
 
 #ifdef TOOL_DR_MEMORY
+void
+medium_path_init_arch(void)
+{
+}
+
+void
+medium_path_exit_arch(void)
+{
+}
+
 /* Returns whether it handled the instruction */
 bool
 medium_path_arch(app_pc decode_pc, app_loc_t *loc, dr_mcontext_t *mc)
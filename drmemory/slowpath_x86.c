@@ -56,6 +56,13 @@ uint movs4_src_undef;
 uint movs4_med_fast;
 uint cmps1_src_undef;
 uint cmps1_med_fast;
+uint wide_med_fast;
+uint repstr_bulk;
+#endif
+
+#ifdef TOOL_DR_MEMORY
+static bool
+check_andor_bitmask_immed(int opc, size_t sz, reg_t immed, bool *byte_bounds OUT);
 #endif
 
 /***************************************************************************
@@ -388,8 +395,10 @@ instr_check_definedness(instr_t *inst)
         (options.check_uninit_cmps &&
          /* a compare writes eflags but nothing else, or is a loop, cmps, or cmovcc.
           * for cmpxchg* only some operands are compared: see always_check_definedness.
+          * With -defer_uninit_cmps a plain compare only propagates to the shadow
+          * eflags and the consuming jcc, cmovcc, or loop does the check.
           */
-         ((instr_num_dsts(inst) == 0 &&
+         ((!options.defer_uninit_cmps && instr_num_dsts(inst) == 0 &&
            TESTANY(EFLAGS_WRITE_6, instr_get_eflags(inst, DR_QUERY_INCLUDE_ALL))) ||
           opc_is_loop(opc) || opc_is_cmovcc(opc) || opc_is_fcmovcc(opc) ||
           opc == OP_cmps || opc == OP_rep_cmps || opc == OP_repne_cmps)) ||
@@ -432,7 +441,8 @@ result_is_always_defined(instr_t *inst, bool natively)
 
 #ifdef TOOL_DR_MEMORY
     /* i#1529: mark an entire module defined */
-    if (!natively && options.check_uninit_blocklist[0] != '\0') {
+    if (!natively && (options.check_uninit_blocklist[0] != '\0' ||
+                      options.lib_check_none[0] != '\0' || options.jit_addr_only)) {
         /* Fastpath should have already checked the cached value in
          * bb_info_t.mark_defined, so we should only be paying this
          * cost for each slowpath entry.
@@ -464,6 +474,29 @@ result_is_always_defined(instr_t *inst, bool natively)
         STATS_INC(andor_exception);
         return true;
     }
+
+#ifdef TOOL_DR_MEMORY
+    /* i#849: the slowpath's bitfield relaxations that depend only on the
+     * immediate make the whole result defined, so with -fastpath_bitfields we
+     * apply them up front and the fastpath need not bail out on an undefined
+     * bitfield:
+     *   - or with a (necessarily defined) immediate
+     *   - and with a contiguous-zeroes bitmask immediate
+     */
+    if (!natively && options.fastpath_bitfields && !options.strict_bitops &&
+        (opc == OP_or || opc == OP_and) &&
+        opnd_is_immed_int(instr_get_src(inst, 0))) {
+        bool byte_bounds;
+        if (opc == OP_or) {
+            STATS_INC(bitfield_const_exception);
+            return true;
+        }
+        if (check_andor_bitmask_immed
+            (opc, opnd_size_in_bytes(opnd_get_size(instr_get_src(inst, 1))),
+             (reg_t) opnd_get_immed_int(instr_get_src(inst, 0)), &byte_bounds))
+            return true;
+    }
+#endif
     return false;
 }
 
@@ -1691,7 +1724,8 @@ check_andor_vals(int opc, reg_t val, uint i, bool bitmask_immed)
         /* i#849: we relax typical bitfield operations:
          * + OP_or with a defined value (not enough to just allow non-0 value)
          *   used to set a bitfield var to a non-const-zero value
-         *   XXX: could put this on fastpath for perf.
+         *   (-fastpath_bitfields handles the immediate case on the fastpath
+         *   via result_is_always_defined()).
          *   XXX i#489: another sequence used to set is a double xor
          *   sequence which will require pattern matching.
          * + OP_and with a constant that has only one sequence of 0's and at
@@ -2278,7 +2312,8 @@ medium_path_cmps1(app_loc_t *loc, dr_mcontext_t *mc)
     flags = MEMREF_USE_VALUES;
     if (options.check_uninit_cmps)
         flags |= MEMREF_CHECK_DEFINEDNESS;
-    if (options.check_uninit_blocklist[0] != '\0') {
+    if (options.check_uninit_blocklist[0] != '\0' || options.lib_check_none[0] != '\0' ||
+        options.jit_addr_only) {
         /* i#1529: mark an entire module defined */
         /* XXX: this is the wrong pc if decode_pc != pc.  For now we live with it. */
         if (module_is_on_check_uninit_blocklist(loc_to_pc(loc)))
@@ -2298,6 +2333,167 @@ medium_path_cmps1(app_loc_t *loc, dr_mcontext_t *mc)
     set_shadow_eflags(comb.dst[0]);
 }
 
+/* i#243: ymm and zmm registers are not shadowed, so for an instruction whose
+ * only shadowed operand is a 32- or 64-byte memory reference the slowpath does
+ * no propagation: it checks the memory and, for a store, marks it defined.
+ * Such operands are too wide for the fastpath's shadow registers, and as for
+ * movs4 the cost is in the decode and IR processing, so we cache the decoded
+ * memory operand per pc and check its shadow a dword at a time.
+ */
+typedef struct _wide_memref_t {
+    /* we re-decode if the code at the pc changes */
+    byte raw[MAX_INSTR_LENGTH];
+    uint length;
+    opnd_t memop;
+    uint size; /* 0 if the instruction does not qualify */
+    bool read;
+    bool write;
+} wide_memref_t;
+
+#define WIDE_MEMREF_HASH_BITS 8
+static hashtable_t wide_memref_table;
+
+static void
+wide_memref_free(void *entry)
+{
+    global_free(entry, sizeof(wide_memref_t), HEAPSTAT_PERBB);
+}
+
+void
+medium_path_init_arch(void)
+{
+    hashtable_init_ex(&wide_memref_table, WIDE_MEMREF_HASH_BITS, HASH_INTPTR,
+                      false/*!strdup*/, false/*!synch*/, wide_memref_free, NULL, NULL);
+}
+
+void
+medium_path_exit_arch(void)
+{
+    hashtable_delete_with_stats(&wide_memref_table, "wide_memref");
+}
+
+static bool
+wide_memref_opnd_ok(int opc, opnd_t opnd, bool write, wide_memref_t *wm)
+{
+    if (opnd_is_memory_reference(opnd)) {
+        if (wm->read || wm->write) {
+            /* a second reference must be the same memory, as for an alu store */
+            if (!opnd_same(opnd, wm->memop))
+                return false;
+        } else
+            wm->memop = opnd;
+        if (write)
+            wm->write = true;
+        else
+            wm->read = true;
+        return true;
+    }
+    return !opnd_is_reg(opnd) || !reg_is_shadowed(opc, opnd_get_reg(opnd));
+}
+
+static void
+wide_memref_decode(void *drcontext, app_pc decode_pc, wide_memref_t *wm)
+{
+    instr_t inst;
+    int i, opc;
+    reg_id_t index;
+    app_pc next_pc;
+    memset(wm, 0, sizeof(*wm));
+    instr_init(drcontext, &inst);
+    next_pc = decode(drcontext, decode_pc, &inst);
+    if (next_pc == NULL)
+        goto wide_memref_decode_done;
+    wm->length = (uint)(next_pc - decode_pc);
+    ASSERT(wm->length <= sizeof(wm->raw), "invalid instr length");
+    memcpy(wm->raw, decode_pc, wm->length);
+    opc = instr_get_opcode(&inst);
+    if (instr_is_cti(&inst) || opc_is_stringop(opc) ||
+        TESTANY(EFLAGS_READ_ARITH|EFLAGS_WRITE_ARITH,
+                instr_get_eflags(&inst, DR_QUERY_INCLUDE_ALL)))
+        goto wide_memref_decode_done;
+    for (i = 0; i < instr_num_dsts(&inst); i++) {
+        if (!wide_memref_opnd_ok(opc, instr_get_dst(&inst, i), true, wm))
+            goto wide_memref_decode_done;
+    }
+    for (i = 0; i < instr_num_srcs(&inst); i++) {
+        if (!wide_memref_opnd_ok(opc, instr_get_src(&inst, i), false, wm))
+            goto wide_memref_decode_done;
+    }
+    if (!wm->read && !wm->write)
+        goto wide_memref_decode_done;
+    /* VSIB (gather/scatter) uses a vector index */
+    index = opnd_is_base_disp(wm->memop) ? opnd_get_index(wm->memop) : REG_NULL;
+    if (opnd_is_far_memory_reference(wm->memop) ||
+        (index != REG_NULL && !reg_is_gpr(index)))
+        goto wide_memref_decode_done;
+    wm->size = opnd_size_in_bytes(opnd_get_size(wm->memop));
+    if (wm->size != 32 && wm->size != 64)
+        wm->size = 0;
+ wide_memref_decode_done:
+    LOG(3, "wide memref @"PFX": size %d%s%s\n", decode_pc, wm->size,
+        wm->read ? " read" : "", wm->write ? " write" : "");
+    instr_free(drcontext, &inst);
+}
+
+/* We copy the entry out under the lock so a replacement can free it */
+static void
+wide_memref_lookup(app_pc decode_pc, wide_memref_t *wm OUT)
+{
+    wide_memref_t *entry;
+    hashtable_lock(&wide_memref_table);
+    entry = (wide_memref_t *) hashtable_lookup(&wide_memref_table, decode_pc);
+    if (entry == NULL || entry->length == 0 ||
+        memcmp(entry->raw, decode_pc, entry->length) != 0) {
+        entry = (wide_memref_t *) global_alloc(sizeof(*entry), HEAPSTAT_PERBB);
+        wide_memref_decode(dr_get_current_drcontext(), decode_pc, entry);
+        hashtable_add_replace(&wide_memref_table, decode_pc, entry);
+    }
+    *wm = *entry;
+    hashtable_unlock(&wide_memref_table);
+}
+
+static bool
+medium_path_wide(app_pc decode_pc, app_loc_t *loc, dr_mcontext_t *mc)
+{
+    wide_memref_t entry, *wm = &entry;
+    app_pc addr;
+    reg_id_t base, index;
+    uint i, val;
+    umbra_shadow_memory_info_t info;
+
+    wide_memref_lookup(decode_pc, wm);
+    if (wm->size == 0)
+        return false;
+    STATS_INC(medpath_executions);
+    base = opnd_get_base(wm->memop);
+    index = opnd_get_index(wm->memop);
+    if ((base != REG_NULL && !is_shadow_register_defined(get_shadow_register(base))) ||
+        (index != REG_NULL && !is_shadow_register_defined(get_shadow_register(index))))
+        return false;
+    addr = opnd_compute_address(wm->memop, mc);
+    if (!ALIGNED(addr, SHADOW_GRANULARITY))
+        return false;
+    /* Anything unusual (unaddressable, bitlevel, undefined source) goes to the
+     * general routines for reporting.
+     */
+    umbra_shadow_memory_info_init(&info);
+    for (i = 0; i < wm->size; i += SHADOW_GRANULARITY) {
+        val = shadow_get_dword(&info, addr + i);
+        if (val == SHADOW_DWORD_DEFINED)
+            continue;
+        if (val == SHADOW_DWORD_UNDEFINED &&
+            (!wm->read || !options.check_uninitialized))
+            continue;
+        return false;
+    }
+    /* the source is an unshadowed register: see above */
+    if (wm->write && options.check_uninitialized)
+        shadow_set_range(addr, addr + wm->size, SHADOW_DEFINED);
+    STATS_INC(wide_med_fast);
+    slow_path_xl8_sharing(loc, wm->length, wm->memop, mc);
+    return true;
+}
+
 /* Returns whether it handled the instruction */
 bool
 medium_path_arch(app_pc decode_pc, app_loc_t *loc, dr_mcontext_t *mc)
@@ -2320,9 +2516,92 @@ medium_path_arch(app_pc decode_pc, app_loc_t *loc, dr_mcontext_t *mc)
                 *(decode_pc + 1) == CMPS_1_OPCODE)) {
         medium_path_cmps1(loc, mc);
         return true;
+    } else if (*decode_pc == VEX_3BYTE_PREFIX_OPCODE ||
+               *decode_pc == VEX_2BYTE_PREFIX_OPCODE ||
+               *decode_pc == EVEX_PREFIX_OPCODE) {
+        return medium_path_wide(decode_pc, loc, mc);
     }
     return false;
 }
+
+/* Called prior to a -repstr_to_loop expansion of a rep movs or rep stos once
+ * inline code has found its count, the app's xcx, to reach the threshold.
+ * If the whole range is addressable and the registers involved are defined,
+ * we perform the string operation natively, propagate the shadow values
+ * once for the whole range, and set xcx to 0 so the loop is skipped.
+ * Otherwise we leave everything alone and let the instrumented loop check
+ * each iteration, which reports the precise failing element.
+ */
+void
+repstr_bulk_handler(uint opc, uint elemsz, reg_t count)
+{
+    void *drcontext = dr_get_current_drcontext();
+    dr_mcontext_t mc;
+    byte *dst, *src = NULL;
+    size_t size;
+    reg_id_t val_reg = IF_X64_ELSE(DR_REG_RAX, DR_REG_EAX);
+    bool ok = false;
+    ASSERT(opc == OP_movs || opc == OP_stos, "invalid rep string opcode");
+    size = count * elemsz;
+    if (size < options.repstr_bulk_threshold || size / elemsz != count)
+        return;
+    /* Undefined addressing or count registers must be reported by the loop */
+    if (get_shadow_register(DR_REG_XCX) != SHADOW_DWORD_DEFINED ||
+        get_shadow_register(DR_REG_XDI) != SHADOW_DWORD_DEFINED ||
+        (opc == OP_movs && get_shadow_register(DR_REG_XSI) != SHADOW_DWORD_DEFINED))
+        return;
+    if (opc == OP_stos) {
+        if (elemsz < sizeof(reg_t))
+            val_reg = reg_resize_to_opsz(val_reg, opnd_size_from_bytes(elemsz));
+        if (get_shadow_register(val_reg) != SHADOW_DWORD_DEFINED)
+            return;
+    }
+    /* The mcontext is only read once the cheap checks have passed */
+    mc.size = sizeof(mc);
+    mc.flags = DR_MC_INTEGER | DR_MC_CONTROL;
+    dr_get_mcontext(drcontext, &mc);
+    if (TEST(EFLAGS_DF, mc.xflags))
+        return;
+    dst = (byte *) mc.xdi;
+    if (opc == OP_movs) {
+        src = (byte *) mc.xsi;
+        /* An overlapping copy does not match the element-by-element semantics
+         * of movs, and a fault partway would not be restartable.
+         */
+        if ((dst < src + size && src < dst + size) ||
+            !shadow_range_ok_for_bulk(src, size))
+            return;
+    }
+    if (!shadow_range_ok_for_bulk(dst, size))
+        return;
+    DR_TRY_EXCEPT(drcontext, {
+        if (opc == OP_movs)
+            memcpy(dst, src, size);
+        else if (elemsz == 1)
+            memset(dst, (int)(mc.xax & 0xff), size);
+        else {
+            size_t i;
+            for (i = 0; i < size; i += elemsz)
+                memcpy(dst + i, &mc.xax, elemsz);
+        }
+        ok = true;
+    }, { /* EXCEPT */
+        /* e.g., read-only memory: the loop will raise the fault for the app */
+    });
+    if (!ok)
+        return;
+    if (opc == OP_movs) {
+        shadow_copy_range(src, dst, size);
+        mc.xsi += size;
+    } else
+        shadow_set_range(dst, dst + size, SHADOW_DEFINED);
+    mc.xdi += size;
+    mc.xcx = 0;
+    LOG(3, "rep %s bulk: "PFX" "SZFMT" bytes\n", opc == OP_movs ? "movs" : "stos",
+        dst, size);
+    STATS_INC(repstr_bulk);
+    dr_set_mcontext(drcontext, &mc);
+}
 #endif /* TOOL_DR_MEMORY */
 
 void
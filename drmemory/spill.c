@@ -1177,6 +1177,55 @@ pick_bb_scratch_regs_helper(opnd_t opnd, int uses[NUM_LIVENESS_REGS])
     }
 }
 
+/* For -scratch_reg_liveness: computes what using each of a/b/c/d as a whole-bb
+ * scratch register would cost in the restores before app reads and the saves
+ * after app writes that fastpath_pre_app_instr() inserts.  A reverse walk
+ * gives the liveness within the bb, so a write whose value is overwritten
+ * before it is read costs nothing, unlike the plain use count.
+ * The last app instr costs nothing as the end-of-bb restore covers it.
+ */
+static void
+pick_bb_scratch_regs_cost(instr_t *last, int uses[NUM_LIVENESS_REGS])
+{
+    bool live[DR_REG_XBX - REG_START + 1];
+    instr_t *inst;
+    int i, j;
+    /* everything is live out of the bb */
+    for (i = 0; i <= DR_REG_XBX - REG_START; i++)
+        live[i] = true;
+    for (inst = last; inst != NULL; inst = instr_get_prev(inst)) {
+        if (!instr_is_app(inst))
+            continue;
+        for (i = 0; i <= DR_REG_XBX - REG_START; i++) {
+            reg_id_t reg = REG_START + i;
+            bool reads = instr_reads_from_reg(inst, reg, DR_QUERY_INCLUDE_ALL);
+            bool writes = instr_writes_to_reg(inst, reg, DR_QUERY_INCLUDE_ALL);
+            /* a partial or conditional write needs the app value restored first */
+            bool full_write = writes &&
+                instr_writes_to_exact_reg(inst, reg, DR_QUERY_INCLUDE_ALL) &&
+                instr_writes_to_reg(inst, reg, DR_QUERY_DEFAULT);
+            if (inst != last) {
+                if (reads || (writes && !full_write))
+                    uses[i]++;
+                if (writes && live[i])
+                    uses[i]++;
+                /* the lea for the shadow address needs the app value too */
+                for (j = 0; j < instr_num_srcs(inst); j++) {
+                    opnd_t opnd = instr_get_src(inst, j);
+                    if (opnd_is_memory_reference(opnd) && opnd_uses_reg(opnd, reg))
+                        uses[i]++;
+                }
+                for (j = 0; j < instr_num_dsts(inst); j++) {
+                    opnd_t opnd = instr_get_dst(inst, j);
+                    if (opnd_is_memory_reference(opnd) && opnd_uses_reg(opnd, reg))
+                        uses[i]++;
+                }
+            }
+            live[i] = reads || (live[i] && !full_write);
+        }
+    }
+}
+
 static void
 pick_bb_scratch_regs(instr_t *inst, bb_info_t *bi)
 {
@@ -1201,18 +1250,24 @@ pick_bb_scratch_regs(instr_t *inst, bb_info_t *bi)
      */
     int uses[NUM_LIVENESS_REGS] = {0,};
     int i, uses_least = INT_MAX, uses_second = INT_MAX;
+    instr_t *last_app = NULL;
 
     while (inst != NULL) {
         if (instr_is_app(inst)) {
-            for (i = 0; i < instr_num_dsts(inst); i++)
-                pick_bb_scratch_regs_helper(instr_get_dst(inst, i), uses);
-            for (i = 0; i < instr_num_srcs(inst); i++)
-                pick_bb_scratch_regs_helper(instr_get_src(inst, i), uses);
+            last_app = inst;
+            if (!options.scratch_reg_liveness) {
+                for (i = 0; i < instr_num_dsts(inst); i++)
+                    pick_bb_scratch_regs_helper(instr_get_dst(inst, i), uses);
+                for (i = 0; i < instr_num_srcs(inst); i++)
+                    pick_bb_scratch_regs_helper(instr_get_src(inst, i), uses);
+            }
             if (instr_is_cti(inst))
                 break;
         }
         inst = instr_get_next(inst);
     }
+    if (options.scratch_reg_liveness && last_app != NULL)
+        pick_bb_scratch_regs_cost(last_app, uses);
     /* Too risky to use esp: if no alt sig stk (ESXi) or on Windows can't
      * handle fault
      */
@@ -1730,6 +1785,8 @@ fastpath_bottom_of_bb(void *drcontext, void *tag, instrlist_t *bb,
          * XXX DRi#772: could add flush callback and avoid this save
          */
         save->pattern_4byte_check_only = bi->pattern_4byte_check_only;
+        save->tier0 = bi->tier0;
+        save->startup = bi->startup;
 
         /* we store the size and assume bbs are contiguous so we can free (i#260) */
         ASSERT(bi->first_app_pc != NULL, "first instr should have app pc");
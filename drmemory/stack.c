@@ -35,19 +35,105 @@
 #include "heap.h"
 #include "alloc.h"
 #include "alloc_drmem.h"
+#include "redblack.h"
 
 #ifdef STATISTICS
 uint adjust_esp_executions;
 uint adjust_esp_fastpath;
 uint stack_swaps;
 uint stack_swap_triggers;
+uint stack_swaps_registered;
 uint push_addressable;
 uint push_addressable_heap;
 uint push_addressable_mmap;
 uint zero_loop_aborts_fault;
 uint zero_loop_aborts_thresh;
+uint zero_stack_lazy_passes;
+uint zero_stack_lazy_bytes;
 #endif
 
+/***************************************************************************
+ * REGISTERED STACKS
+ *
+ * Apps built on user-space coroutines or fibers swap among many stacks, and
+ * each swap looks to us like a large stack adjustment.  The app can register
+ * such stacks (drmemory_stack_register), which lets check_stack_swap()
+ * classify an adjustment with a tree lookup instead of a memory query and
+ * keeps adjustments within a registered stack from raising the threshold.
+ */
+
+static rb_tree_t *registered_stacks;
+static void *registered_stacks_lock;
+/* lets the common case of no registered stacks skip the lock */
+static volatile uint num_registered_stacks;
+
+void
+stack_init(void)
+{
+    registered_stacks = rb_tree_create(NULL);
+    registered_stacks_lock = dr_mutex_create();
+}
+
+void
+stack_exit(void)
+{
+    rb_tree_destroy(registered_stacks);
+    dr_mutex_destroy(registered_stacks_lock);
+}
+
+void
+stack_register(void *drcontext, byte *base, size_t size)
+{
+    rb_node_t *node;
+    if (size == 0)
+        return;
+    LOG(2, "registering stack "PFX"-"PFX"\n", base, base + size);
+    dr_mutex_lock(registered_stacks_lock);
+    /* a stack overlapping stale registrations replaces them */
+    while ((node = rb_insert(registered_stacks, base, size, NULL)) != NULL) {
+        rb_delete(registered_stacks, node);
+        num_registered_stacks--;
+    }
+    num_registered_stacks++;
+    dr_mutex_unlock(registered_stacks_lock);
+    /* A swap between adjacent stacks must still exceed the threshold to
+     * reach check_stack_swap().
+     */
+    check_stack_size_vs_threshold(drcontext, size);
+}
+
+bool
+stack_deregister(byte *base)
+{
+    rb_node_t *node;
+    dr_mutex_lock(registered_stacks_lock);
+    node = rb_find(registered_stacks, base);
+    if (node != NULL) {
+        rb_delete(registered_stacks, node);
+        num_registered_stacks--;
+    }
+    dr_mutex_unlock(registered_stacks_lock);
+    LOG(2, "deregistering stack "PFX"%s\n", base, node == NULL ? ": not found" : "");
+    return node != NULL;
+}
+
+static bool
+registered_stack_bounds(byte *addr, byte **base OUT, size_t *size OUT)
+{
+    rb_node_t *node;
+    bool res = false;
+    if (num_registered_stacks == 0)
+        return false;
+    dr_mutex_lock(registered_stacks_lock);
+    node = rb_in_node(registered_stacks, addr);
+    if (node != NULL) {
+        rb_node_fields(node, base, size, NULL);
+        res = true;
+    }
+    dr_mutex_unlock(registered_stacks_lock);
+    return res;
+}
+
 /***************************************************************************
  * STACK SWAP THRESHOLD ADJUSTMENTS
  *
@@ -127,6 +213,26 @@ check_stack_swap(byte *cur_xsp, byte *new_xsp)
     size_t stack_size;
     STATS_INC(stack_swap_triggers);
     ASSERT(options.check_stack_bounds, "shouldn't be called");
+    if (registered_stack_bounds(cur_xsp, &stack_start, &stack_size)) {
+        /* The app told us the bounds, so there is nothing to learn about
+         * the threshold from an intra-stack adjustment.
+         */
+        if (new_xsp >= stack_start && new_xsp < stack_start + stack_size) {
+            LOG(3, "stack adjust "PFX" to "PFX" is within registered stack\n",
+                cur_xsp, new_xsp);
+            return false;
+        }
+        LOG(2, "registered stack swap "PFX" => "PFX"\n", cur_xsp, new_xsp);
+        STATS_INC(stack_swaps);
+        STATS_INC(stack_swaps_registered);
+        return true;
+    }
+    if (registered_stack_bounds(new_xsp, NULL, NULL)) {
+        LOG(2, "stack swap "PFX" => registered stack "PFX"\n", cur_xsp, new_xsp);
+        STATS_INC(stack_swaps);
+        STATS_INC(stack_swaps_registered);
+        return true;
+    }
     if (get_stack_region_bounds(cur_xsp, &stack_start, &stack_size)) {
         LOG(3, "stack bounds "PFX" "PFX"-"PFX"\n", cur_xsp,
             stack_start, stack_start + stack_size);
@@ -531,3 +637,51 @@ instrument_esp_adjust(void *drcontext, instrlist_t *bb, instr_t *inst, bb_info_t
         return instrument_esp_adjust_slowpath(drcontext, bb, inst, bi, sp_action);
 }
 
+
+/***************************************************************************
+ * LAZY STACK ZEROING
+ *
+ * For -zero_stack_lazy we do not instrument stack allocations but instead
+ * zero the dead stack below the stack pointer at each system call.  Each pass
+ * leaves zeros behind it, so the dead range ends at the first page that is
+ * already all zero: that is the thread's low-water mark since the prior pass,
+ * found without tracking the stack pointer.  A zero page in the middle of old
+ * frames ends the pass early, which only costs us some stale values.
+ */
+
+static bool
+page_is_zero(byte *page)
+{
+    ptr_uint_t *word;
+    for (word = (ptr_uint_t *) page; (byte *)word < page + PAGE_SIZE; word++) {
+        if (*word != 0)
+            return false;
+    }
+    return true;
+}
+
+void
+zero_dead_stack(void *drcontext, byte *xsp)
+{
+    /* the redzone beyond TOS is live */
+    byte *top = xsp - BEYOND_TOS_REDZONE_SIZE;
+    byte *stack_base, *pc;
+    size_t stack_size;
+    uint prot;
+    if (!dr_query_memory(top, &stack_base, &stack_size, &prot) ||
+        !TESTALL(DR_MEMPROT_READ | DR_MEMPROT_WRITE, prot) ||
+        TEST(DR_MEMPROT_GUARD, prot)) {
+        LOG(2, "%s: skipping unknown stack "PFX"\n", __FUNCTION__, xsp);
+        return;
+    }
+    /* the partial page holding top is always dirty enough to zero */
+    pc = (byte *) MAX(ALIGN_BACKWARD(top, PAGE_SIZE), (ptr_uint_t)stack_base);
+    memset(pc, 0, top - pc);
+    while (pc - PAGE_SIZE >= stack_base && !page_is_zero(pc - PAGE_SIZE)) {
+        pc -= PAGE_SIZE;
+        memset(pc, 0, PAGE_SIZE);
+    }
+    LOG(3, "%s: zeroed "PFX"-"PFX"\n", __FUNCTION__, pc, top);
+    STATS_INC(zero_stack_lazy_passes);
+    STATS_ADD(zero_stack_lazy_bytes, top - pc);
+}
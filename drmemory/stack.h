@@ -34,11 +34,14 @@ extern uint adjust_esp_executions;
 extern uint adjust_esp_fastpath;
 extern uint stack_swaps;
 extern uint stack_swap_triggers;
+extern uint stack_swaps_registered;
 extern uint push_addressable;
 extern uint push_addressable_heap;
 extern uint push_addressable_mmap;
 extern uint zero_loop_aborts_fault;
 extern uint zero_loop_aborts_thresh;
+extern uint zero_stack_lazy_passes;
+extern uint zero_stack_lazy_bytes;
 #endif
 
 /* since we dynamically adjust options.stack_swap_threshold we use a separate
@@ -63,6 +66,22 @@ typedef enum {
     SP_ADJUST_ACTION_ZERO      /* Zero the stack on SP decrease. */
 } sp_adjust_action_t;
 
+void
+stack_init(void);
+
+void
+stack_exit(void);
+
+/* Registers [base, base+size) as an app stack, such as a coroutine's, so that
+ * swaps to and from it are recognized without heuristics.
+ */
+void
+stack_register(void *drcontext, byte *base, size_t size);
+
+/* Returns false if no stack was registered at base */
+bool
+stack_deregister(byte *base);
+
 app_pc
 generate_shared_esp_slowpath(void *drcontext, instrlist_t *ilist, app_pc pc);
 
@@ -96,4 +115,8 @@ bool
 handle_zeroing_fault(void *drcontext, byte *target, dr_mcontext_t *raw_mc,
                      dr_mcontext_t *mc);
 
+/* For -zero_stack_lazy: zeroes the stack below xsp that is no longer in use */
+void
+zero_dead_stack(void *drcontext, byte *xsp);
+
 #endif /* _STACK_H_ */
@@ -789,6 +789,23 @@ generate_shared_esp_fastpath_helper(void *drcontext, instrlist_t *bb,
         add_jcc_slowpath(drcontext, bb, NULL, OP_jl/*short doesn't reach*/, &mi);
     }
 
+    /* For a large adjustment our loop below, which writes one shadow dword
+     * per 16 stack bytes, costs more than a trip to the slowpath, where
+     * shadow_set_range() memsets whole shadow blocks.
+     * These cmps come after the swap threshold cmps, which is what
+     * esp_fastpath_update_swap_threshold() relies on to patch the right ones.
+     */
+    if (options.esp_bulk_threshold > 0) {
+        PRE(bb, NULL,
+            INSTR_CREATE_cmp(drcontext, opnd_create_reg(mi.reg3.reg),
+                             OPND_CREATE_INT32(options.esp_bulk_threshold)));
+        add_jcc_slowpath(drcontext, bb, NULL, OP_jg/*short doesn't reach*/, &mi);
+        PRE(bb, NULL,
+            INSTR_CREATE_cmp(drcontext, opnd_create_reg(mi.reg3.reg),
+                             OPND_CREATE_INT32(-(int)options.esp_bulk_threshold)));
+        add_jcc_slowpath(drcontext, bb, NULL, OP_jl/*short doesn't reach*/, &mi);
+    }
+
     /* Ensure the size is 4-aligned so our loop works out */
     PRE(bb, NULL,
         INSTR_CREATE_test(drcontext, opnd_create_reg(mi.reg3.reg),
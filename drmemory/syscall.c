@@ -30,6 +30,7 @@
 #include "syscall_os.h"
 #include "alloc.h"
 #include "perturb.h"
+#include "stack.h"
 #ifdef UNIX
 # include "sysnum_linux.h"
 #endif
@@ -346,6 +347,138 @@ check_sysmem(uint flags, drsys_sysnum_t sysnum, app_pc ptr, size_t sz, dr_mconte
     }
 }
 
+/* Rather than checking each memarg as drsyscall hands it to us, we collect a
+ * syscall's memargs and, once iteration is done, merge overlapping and
+ * adjacent ranges with the same check flags.  A merged range whose shadow
+ * shows nothing to report (or, for writes, nothing unaddressable) is handled
+ * with a single shadow operation.  Otherwise we fall back to checking the
+ * range's memargs individually, in their original order, so errors name the
+ * right parameter.
+ */
+#define SYSMEM_BATCH_MAX 16
+/* Fits the longest names in drsyscall's tables, which are ~75 chars */
+#define SYSMEM_ID_MAX 128
+
+typedef struct _sysmem_entry_t {
+    uint flags;
+    app_pc start;
+    size_t size;
+    bool done;
+    /* drsyscall's names for fields can be on its stack */
+    char id[SYSMEM_ID_MAX];
+} sysmem_entry_t;
+
+typedef struct _sysmem_batch_t {
+    drsys_sysnum_t sysnum;
+    dr_mcontext_t *mc;
+    uint num;
+    sysmem_entry_t entry[SYSMEM_BATCH_MAX];
+} sysmem_batch_t;
+
+static bool
+sysmem_range_clean(uint flags, app_pc start, size_t size)
+{
+    if (start + size < start)
+        return false;
+    if (flags == MEMREF_WRITE) {
+        /* check_sysmem only passes writes through in full mode */
+        if (!shadow_range_ok_for_bulk(start, size))
+            return false;
+        shadow_set_range(start, start + size, SHADOW_DEFINED);
+        return true;
+    }
+    /* Fully defined bytes pass both definedness and addressability checks */
+    return shadow_check_range(start, size, SHADOW_DEFINED, NULL, NULL, NULL);
+}
+
+static void
+sysmem_batch_flush(sysmem_batch_t *batch)
+{
+    uint order[SYSMEM_BATCH_MAX];
+    uint i, j;
+    if (batch->num == 0)
+        return;
+    /* Sort by flags and then start, and try each maximal merged range */
+    for (i = 0; i < batch->num; i++) {
+        sysmem_entry_t *e = &batch->entry[i];
+        for (j = i; j > 0; j--) {
+            sysmem_entry_t *prev = &batch->entry[order[j-1]];
+            if (prev->flags < e->flags ||
+                (prev->flags == e->flags && prev->start <= e->start))
+                break;
+            order[j] = order[j-1];
+        }
+        order[j] = i;
+    }
+    for (i = 0; i < batch->num; ) {
+        sysmem_entry_t *first = &batch->entry[order[i]];
+        app_pc end = first->start + first->size;
+        for (j = i + 1; j < batch->num; j++) {
+            sysmem_entry_t *e = &batch->entry[order[j]];
+            if (e->flags != first->flags || e->start > end)
+                break;
+            if (e->start + e->size > end)
+                end = e->start + e->size;
+        }
+        if (end > first->start &&
+            sysmem_range_clean(first->flags, first->start, end - first->start)) {
+            uint k;
+            LOG(SYSCALL_VERBOSE, "\t  batch "PFX"-"PFX" clean for %d memargs\n",
+                first->start, end, j - i);
+            for (k = i; k < j; k++)
+                batch->entry[order[k]].done = true;
+        }
+        i = j;
+    }
+    for (i = 0; i < batch->num; i++) {
+        sysmem_entry_t *e = &batch->entry[i];
+        if (!e->done) {
+            check_sysmem(e->flags, batch->sysnum, e->start, e->size, batch->mc,
+                         e->id[0] == '\0' ? NULL : e->id);
+        }
+    }
+    batch->num = 0;
+}
+
+static void
+sysmem_batch_add(sysmem_batch_t *batch, uint flags, drsys_arg_t *arg)
+{
+    sysmem_entry_t *e;
+    if (batch == NULL) {
+        check_sysmem(flags, arg->sysnum, arg->start_addr, arg->size, arg->mc,
+                     arg->arg_name);
+        return;
+    }
+    /* Mirror check_sysmem's filters so only real checks are queued */
+    if ((!options.check_uninitialized && flags != MEMREF_CHECK_ADDRESSABLE) ||
+        arg->start_addr == NULL || arg->size == 0)
+        return;
+    if (batch->num == SYSMEM_BATCH_MAX)
+        sysmem_batch_flush(batch);
+    if (arg->arg_name != NULL && strlen(arg->arg_name) >= SYSMEM_ID_MAX) {
+        /* A truncated name would not match suppressions: check it now, after
+         * the memargs queued before it.
+         */
+        sysmem_batch_flush(batch);
+        check_sysmem(flags, arg->sysnum, arg->start_addr, arg->size, arg->mc,
+                     arg->arg_name);
+        return;
+    }
+    batch->sysnum = arg->sysnum;
+    batch->mc = arg->mc;
+    e = &batch->entry[batch->num++];
+    e->flags = flags;
+    e->start = arg->start_addr;
+    e->size = arg->size;
+    e->done = false;
+    if (arg->arg_name == NULL)
+        e->id[0] = '\0';
+    else {
+        dr_snprintf(e->id, BUFFER_SIZE_ELEMENTS(e->id), "%s", arg->arg_name);
+        NULL_TERMINATE_BUFFER(e->id);
+    }
+}
+
 static bool
 drsys_iter_memarg_cb(drsys_arg_t *arg, void *user_data)
 {
@@ -385,7 +518,7 @@ drsys_iter_memarg_cb(drsys_arg_t *arg, void *user_data)
         ASSERT(TEST(DRSYS_PARAM_OUT, arg->mode), "shouldn't see IN params in post");
         flags = MEMREF_WRITE;
     }
-    check_sysmem(flags, arg->sysnum, arg->start_addr, arg->size, arg->mc, arg->arg_name);
+    sysmem_batch_add((sysmem_batch_t *) user_data, flags, arg);
     return true; /* keep going */
 }
 
@@ -428,6 +561,7 @@ event_pre_syscall(void *drcontext, int sysnum)
     dr_mcontext_t *mc;
     bool res = true;
     drsys_syscall_t *syscall;
+    sysmem_batch_t batch;
     if (drsys_cur_syscall(drcontext, &syscall) != DRMF_SUCCESS)
         ASSERT(false, "shouldn't fail");
 
@@ -469,8 +603,10 @@ event_pre_syscall(void *drcontext, int sysnum)
     if (options.shadowing) {
         if (drsys_iterate_args(drcontext, drsys_iter_arg_cb, NULL) != DRMF_SUCCESS)
             LOG(1, "unknown system call args for #%d\n", sysnum_full.number);
-        if (drsys_iterate_memargs(drcontext, drsys_iter_memarg_cb, NULL) != DRMF_SUCCESS)
+        batch.num = 0;
+        if (drsys_iterate_memargs(drcontext, drsys_iter_memarg_cb, &batch) != DRMF_SUCCESS)
             LOG(1, "unknown system call memargs for #%d\n", sysnum_full.number);
+        sysmem_batch_flush(&batch);
         /* there may be overlap between our table and auxlib: e.g., SYS_ioctl */
         if (auxlib_known_syscall(sysnum))
             res = auxlib_shadow_pre_syscall(drcontext, sysnum, mc) && res;
@@ -482,6 +618,9 @@ event_pre_syscall(void *drcontext, int sysnum)
      */
     res = handle_pre_alloc_syscall(drcontext, sysnum, mc) && res;
 
+    if (ZERO_STACK() && options.zero_stack_lazy)
+        zero_dead_stack(drcontext, (byte *)mc->xsp);
+
     if (options.perturb)
         res = perturb_pre_syscall(drcontext, sysnum) && res;
 
@@ -495,6 +634,7 @@ event_post_syscall(void *drcontext, int sysnum)
     drsys_sysnum_t sysnum_full;
     dr_mcontext_t *mc;
     drsys_syscall_t *syscall;
+    sysmem_batch_t batch;
     bool success = false;
     uint error;
     uint64 ret_val;
@@ -526,19 +666,70 @@ event_post_syscall(void *drcontext, int sysnum)
         register_shadow_set_ptrsz(DR_REG_PTR_RETURN, SHADOW_PTRSZ_DEFINED);
         if (success) {
             /* commit the writes via MEMREF_WRITE */
-            if (drsys_iterate_memargs(drcontext, drsys_iter_memarg_cb, NULL) !=
+            batch.num = 0;
+            if (drsys_iterate_memargs(drcontext, drsys_iter_memarg_cb, &batch) !=
                 DRMF_SUCCESS)
                 ASSERT(false, "drsys_iterate_memargs failed");
+            sysmem_batch_flush(&batch);
         }
         if (auxlib_known_syscall(sysnum))
             auxlib_shadow_post_syscall(drcontext, sysnum, mc);
     }
 }
 
+/* Syscalls that neither drsyscall nor we need to see: no memory params, no
+ * handling of our own, and, in full mode, no params whose definedness we'd
+ * check.  Not intercepting these lets DR run them inline.
+ * XXX: we also skip marking the return value register defined, relying on it
+ * holding the already-defined syscall number beforehand.
+ */
+#define BENIGN_TABLE_HASH_BITS 8
+static hashtable_t benign_table;
+
+static bool
+count_params_cb(drsys_arg_t *arg, void *user_data)
+{
+    if (!TEST(DRSYS_PARAM_RETVAL, arg->mode))
+        (*(uint *)user_data)++;
+    return true; /* keep going */
+}
+
+static bool
+find_benign_syscalls_cb(drsys_sysnum_t sysnum, drsys_syscall_t *syscall,
+                        void *user_data)
+{
+    void *drcontext = user_data;
+    bool memarg_free;
+    if (sysnum.secondary != 0 ||
+        drsys_syscall_is_memarg_free(syscall, &memarg_free) != DRMF_SUCCESS ||
+        !memarg_free)
+        return true; /* keep going */
+    if (alloc_syscall_filter(drcontext, sysnum.number) ||
+        os_shared_syscall_filter(drcontext, sysnum.number) ||
+        auxlib_known_syscall(sysnum.number))
+        return true; /* keep going */
+    if (options.shadowing && options.check_uninitialized) {
+        uint params = 0;
+        if (drsys_iterate_arg_types(syscall, count_params_cb, &params) != DRMF_SUCCESS ||
+            params > 0)
+            return true; /* keep going */
+    }
+    LOG(2, "not intercepting benign syscall #%d %s\n", sysnum.number,
+        get_syscall_name(sysnum));
+    hashtable_add(&benign_table, (void *)(ptr_int_t)sysnum.number,
+                  (void *)(ptr_int_t)sysnum.number);
+    if (drsys_unfilter_syscall(sysnum) != DRMF_SUCCESS)
+        ASSERT(false, "drsys_unfilter_syscall should never fail");
+    return true; /* keep going */
+}
+
 static bool
 event_filter_syscall(void *drcontext, int sysnum)
 {
-    return true; /* intercept everything */
+    if (options.skip_benign_syscalls &&
+        hashtable_lookup(&benign_table, (void *)(ptr_int_t)sysnum) != NULL)
+        return false;
+    return true; /* intercept everything else */
 }
 
 static void
@@ -710,6 +901,15 @@ syscall_init(void *drcontext _IF_WINDOWS(app_pc ntdll_base))
     /* We support additional system call handling via a separate shared library */
     if (options.auxlib[0] != '\0')
         syscall_load_auxlib(options.auxlib);
+
+    if (options.skip_benign_syscalls) {
+        hashtable_init(&benign_table, BENIGN_TABLE_HASH_BITS, HASH_INTPTR,
+                       false/*!strdup*/);
+        /* Perturbation can apply to any syscall */
+        if (!options.perturb &&
+            drsys_iterate_syscalls(find_benign_syscalls_cb, drcontext) != DRMF_SUCCESS)
+            LOG(1, "WARNING: unable to iterate syscalls\n");
+    }
 }
 
 void
@@ -720,6 +920,9 @@ syscall_exit(void)
 
     syscall_os_exit();
 
+    if (options.skip_benign_syscalls)
+        hashtable_delete(&benign_table);
+
     if (drsys_exit() != DRMF_SUCCESS)
         ASSERT(false, "drsys failed to exit");
 
@@ -188,6 +188,7 @@ driver_process_writes(void *drcontext, int sysnum)
     tls_driver_t *pt = (tls_driver_t *) drmgr_get_tls_field(drcontext, tls_idx_driver);
     WritesBuffer *writes = (WritesBuffer *) pt->driver_buffer;
     size_t i, num;
+    byte *run_start = NULL, *run_end = NULL;
     if (f_driver == INVALID_FILE)
         return false;
     if (writes == NULL)
@@ -199,13 +200,27 @@ driver_process_writes(void *drcontext, int sysnum)
     } else
         num = writes->num_used;
     for (i = 0; i < num; i++) {
+        byte *start = (byte *) writes->writes[i].start;
+        byte *end = start + writes->writes[i].length;
         LOG(2, "driver info: syscall #0x%x write %d: "PFX"-"PFX"\n",
-            sysnum, i, writes->writes[i].start,
-            (byte*)writes->writes[i].start + writes->writes[i].length);
-        shadow_set_range(writes->writes[i].start,
-                         (byte*)writes->writes[i].start + writes->writes[i].length,
-                         SHADOW_DEFINED);
+            sysnum, i, start, end);
+        /* The kernel often fills in a struct or buffer piecemeal, so we
+         * coalesce adjacent and overlapping writes into one shadow update.
+         */
+        if (run_start != NULL && start <= run_end && end >= run_start) {
+            if (start < run_start)
+                run_start = start;
+            if (end > run_end)
+                run_end = end;
+        } else {
+            if (run_start != NULL)
+                shadow_set_range(run_start, run_end, SHADOW_DEFINED);
+            run_start = start;
+            run_end = end;
+        }
     }
+    if (run_start != NULL)
+        shadow_set_range(run_start, run_end, SHADOW_DEFINED);
     writes->num_used = 0;
     return true;
 }
@@ -249,6 +249,21 @@ handle_pre_execve(void *drcontext)
     /* Nothing. */
 }
 
+bool
+os_shared_syscall_filter(void *drcontext, int sysnum)
+{
+    /* Must be kept in sync with os_shared_{pre,post}_syscall() */
+    switch (sysnum) {
+    case SYS_close:
+    case SYS_execve:
+    case SYS_clone:
+    case SYS_prctl:
+        return true;
+    default:
+        return false;
+    }
+}
+
 /* for tasks unrelated to shadowing that are common to all tools */
 bool
 os_shared_pre_syscall(void *drcontext, cls_syscall_t *pt, drsys_sysnum_t sysnum,
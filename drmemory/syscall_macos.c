@@ -65,6 +65,12 @@ os_process_syscall_memarg(drsys_arg_t *arg)
     return false; /* not handled */
 }
 
+bool
+os_shared_syscall_filter(void *drcontext, int sysnum)
+{
+    return true; /* conservatively see everything */
+}
+
 /* for tasks unrelated to shadowing that are common to all tools */
 bool
 os_shared_pre_syscall(void *drcontext, cls_syscall_t *pt, drsys_sysnum_t sysnum,
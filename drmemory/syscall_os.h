@@ -52,6 +52,12 @@ syscall_os_thread_exit(void *drcontext);
 void
 syscall_os_module_load(void *drcontext, const module_data_t *info, bool loaded);
 
+/* Returns whether os_shared_pre_syscall() or os_shared_post_syscall() needs
+ * to see sysnum.
+ */
+bool
+os_shared_syscall_filter(void *drcontext, int sysnum);
+
 /* for tasks unrelated to shadowing that are common to all tools */
 bool
 os_shared_pre_syscall(void *drcontext, cls_syscall_t *pt, drsys_sysnum_t sysnum,
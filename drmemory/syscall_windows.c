@@ -34,6 +34,7 @@
 #include "../wininc/ndk_dbgktypes.h"
 #include "../wininc/ndk_iotypes.h"
 #include "../wininc/ndk_extypes.h"
+#include "../wininc/ndk_psfuncs.h" /* for THREADINFOCLASS */
 #include "../wininc/afd_shared.h"
 #include "../wininc/msafdlib.h"
 #include "../wininc/winioctl.h"
@@ -53,6 +54,8 @@ syscall_handle_type(drsys_syscall_type_t drsys_type, drsys_sysnum_t sysnum);
  */
 static drsys_sysnum_t sysnum_CreateThread = {-1,0};
 static drsys_sysnum_t sysnum_CreateThreadEx = {-1,0};
+/* i#537: for TlsFree */
+static drsys_sysnum_t sysnum_SetInformationThread = {-1,0};
 
 /* For handle leak checking */
 static drsys_sysnum_t sysnum_Close = {-1,0};
@@ -176,6 +179,8 @@ syscall_os_init(void *drcontext, app_pc ntdll_base)
     get_sysnum("NtCreateThread", &sysnum_CreateThread, false/*reqd*/);
     get_sysnum("NtCreateThreadEx", &sysnum_CreateThreadEx,
                get_windows_version() <= DR_WINDOWS_VERSION_2003);
+    get_sysnum("NtSetInformationThread", &sysnum_SetInformationThread,
+               false/*reqd*/);
     get_sysnum("NtClose", &sysnum_Close, false/*reqd*/);
     get_sysnum("NtUserDestroyAcceleratorTable",
                &sysnum_UserDestroyAcceleratorTable,
@@ -329,6 +334,20 @@ handle_post_CreateThreadEx(void *drcontext, drsys_sysnum_t sysnum, cls_syscall_t
     }
 }
 
+static void
+handle_post_SetInformationThread(void *drcontext, drsys_sysnum_t sysnum,
+                                 cls_syscall_t *pt, dr_mcontext_t *mc)
+{
+    /* i#537: kernel32!TlsFree zeroes the freed slot in every thread via
+     * ThreadZeroTlsCell, which is our cue to stop treating it as allocated.
+     */
+    ULONG slot;
+    if (syscall_get_param(drcontext, 1) == ThreadZeroTlsCell &&
+        NT_SUCCESS(dr_syscall_get_result(drcontext)) &&
+        safe_read((byte *)syscall_get_param(drcontext, 2), sizeof(slot), &slot))
+        teb_tls_slot_freed(slot);
+}
+
 static bool
 syscall_could_leak_handle(drsys_sysnum_t sysnum)
 {
@@ -496,6 +515,13 @@ syscall_creates_handle(void *drcontext, drsys_sysnum_t sysnum)
  * TOP LEVEL
  */
 
+bool
+os_shared_syscall_filter(void *drcontext, int sysnum)
+{
+    /* Handle leak checks and GDI checks can involve most syscalls */
+    return true;
+}
+
 bool
 os_shared_pre_syscall(void *drcontext, cls_syscall_t *pt, drsys_sysnum_t sysnum,
                       dr_mcontext_t *mc, drsys_syscall_t *syscall)
@@ -548,6 +574,9 @@ os_shared_post_syscall(void *drcontext, cls_syscall_t *pt, drsys_sysnum_t sysnum
             handle_post_CreateThread(drcontext, sysnum, pt, mc);
         else if (drsys_sysnums_equal(&sysnum, &sysnum_CreateThreadEx))
             handle_post_CreateThreadEx(drcontext, sysnum, pt, mc);
+    } else if (drsys_sysnums_equal(&sysnum, &sysnum_SetInformationThread) &&
+               options.shadowing) {
+        handle_post_SetInformationThread(drcontext, sysnum, pt, mc);
     }
     /* for handle leak checks */
     if (options.check_handle_leaks) {
@@ -35,6 +35,7 @@
 #include "drx.h"
 #include "drsyscall.h"
 #include "drstrace_named_consts.h"
+#include "drstrace_binary.h"
 #include "utils.h"
 #include <string.h>
 #ifdef WINDOWS
@@ -91,20 +92,130 @@ typedef struct _drstrace_options_t {
     char logdir[MAXIMUM_PATH];
     char sympath[MAXIMUM_PATH]; /* The path to wintypes.pdb */
     char sysnum_file[MAXIMUM_PATH]; /* The path to the syscall number file. */
+    bool binary; /* Write raw values for drstrace_format rather than text. */
+    uint sample_every; /* Only trace every Nth call to each syscall. */
+    uint sample_window_ms; /* Trace all calls in windows this long... */
+    uint sample_period_ms; /* ...that start this often. */
+    char filter[OPTION_MAX_LENGTH]; /* Only intercept these syscalls. */
+    char exclude[OPTION_MAX_LENGTH]; /* Intercept all but these syscalls. */
 } drstrace_options_t;
 
 static drstrace_options_t options;
 
+/* The primary numbers of the -filter or -exclude syscalls.  Only written in
+ * dr_init(), so lookups need no lock.
+ */
+static hashtable_t filter_table;
+#define FILTER_TABLE_BITS 6
+
+/* When sampling, every call is counted and the counts are written at exit */
+typedef struct _syscall_count_t {
+    uint64 count;
+    const char *name;
+    drsys_sysnum_t sysnum;
+} syscall_count_t;
+
+static bool sampling;
+/* Keyed by drsys_syscall_t */
+static hashtable_t count_table;
+/* Holds whether the current syscall is being traced */
+static int tls_idx_sample = -1;
+/* Toggled by sample_window_thread() */
+static volatile bool sample_window_open;
+
+/* For -binary, each thread appends records to its own buffer, which is only
+ * written out when full or at thread exit.  See drstrace_binary.h.
+ */
+#define BIN_BUFFER_SIZE (64*1024)
+
+typedef struct _bin_tls_t {
+    byte *buf;
+    size_t sofar;
+    thread_id_t tid;
+} bin_tls_t;
+
+static int tls_idx_bin = -1;
+/* Serializes whole-buffer writes to outf */
+static void *bin_lock;
+/* The strings whose STRING record has been written, keyed by address */
+static hashtable_t bin_string_table;
+
+#ifdef DRSTRACE_OFFLINE
+/* When formatting a trace offline, the memory captured for the argument
+ * being printed.
+ */
+# define MAX_CAPTURED_MEM 8
+typedef struct _captured_mem_t {
+    byte *addr;
+    size_t size;
+    const byte *data;
+} captured_mem_t;
+static captured_mem_t captured_mem[MAX_CAPTURED_MEM];
+static uint num_captured_mem;
+#endif
+
+/* Returns a pointer through which size bytes of application memory at addr can
+ * be read: addr itself while tracing, or the copy captured in a -binary trace
+ * when formatting offline, or NULL if no copy was captured.
+ */
+static void *
+app_mem(void *addr, size_t size)
+{
+#ifdef DRSTRACE_OFFLINE
+    uint i;
+    for (i = 0; i < num_captured_mem; i++) {
+        captured_mem_t *mem = &captured_mem[i];
+        if ((byte *)addr >= mem->addr && (byte *)addr + size >= (byte *)addr &&
+            (byte *)addr + size <= mem->addr + mem->size)
+            return (void *)(mem->data + ((byte *)addr - mem->addr));
+    }
+    return NULL;
+#else
+    return addr;
+#endif
+}
+
+static bool
+app_read(void *addr, size_t size, void *dst)
+{
+#ifdef DRSTRACE_OFFLINE
+    void *src = app_mem(addr, size);
+    if (src == NULL)
+        return false;
+    memcpy(dst, src, size);
+    return true;
+#else
+    return dr_safe_read(addr, size, dst, NULL);
+#endif
+}
+
 static void
 print_unicode_string(buf_info_t *buf, UNICODE_STRING *us)
 {
-    if (us == NULL)
+    wchar_t *str = NULL;
+    size_t len;
+    if (us == NULL) {
         OUTPUT(buf, "<null>");
-    else {
-        OUTPUT(buf, "%d/%d \"%.*S\"", us->Length, us->MaximumLength,
-               us->Length/sizeof(wchar_t),
-               (us->Buffer == NULL) ? L"<null>" : us->Buffer);
+        return;
+    }
+    us = (UNICODE_STRING *) app_mem(us, sizeof(*us));
+    if (us == NULL) {
+        OUTPUT(buf, "<unavailable>");
+        return;
+    }
+    len = us->Length;
+    if (us->Buffer != NULL) {
+        str = (wchar_t *) app_mem(us->Buffer, len);
+#ifdef DRSTRACE_OFFLINE
+        /* The trace holds only the start of a long string */
+        if (str == NULL && len > DRSTRACE_BIN_MAX_MEM) {
+            len = DRSTRACE_BIN_MAX_MEM;
+            str = (wchar_t *) app_mem(us->Buffer, len);
+        }
+#endif
     }
+    OUTPUT(buf, "%d/%d \"%.*S\"", us->Length, us->MaximumLength,
+           len/sizeof(wchar_t), (str == NULL) ? L"<null>" : str);
 }
 
 void
@@ -117,7 +228,7 @@ print_simple_value(buf_info_t *buf, drsys_arg_t *arg, bool leading_zeroes)
         ptr_uint_t deref = 0;
         ASSERT(arg->size <= sizeof(deref), "too-big simple type");
         /* We assume little-endian */
-        if (dr_safe_read((void *)arg->value, arg->size, &deref, NULL))
+        if (app_read((void *)arg->value, arg->size, &deref))
             OUTPUT(buf, (leading_zeroes ? " => "PFX : " => "PIFX), deref);
     }
 }
@@ -194,7 +305,7 @@ safe_read_field(buf_info_t *buf, void *addr_to_resolve, size_t addr_size,
 {
     int64 mem_value = 0;
     ASSERT(addr_size <= sizeof(mem_value), "too-big mem value to read");
-    if (!dr_safe_read(addr_to_resolve, addr_size, &mem_value, NULL)) {
+    if (!app_read(addr_to_resolve, addr_size, &mem_value)) {
         OUTPUT(buf, "<field unreadable>");
         return 0;
     }
@@ -212,7 +323,9 @@ print_known_compound_type(buf_info_t *buf, drsys_param_type_t type, void *start_
         break;
     }
     case DRSYS_TYPE_OBJECT_ATTRIBUTES: {
-        OBJECT_ATTRIBUTES *oa = (OBJECT_ATTRIBUTES *) start_addr;
+        OBJECT_ATTRIBUTES *oa = (OBJECT_ATTRIBUTES *) app_mem(start_addr, sizeof(*oa));
+        if (oa == NULL)
+            return false;
         OUTPUT(buf, "len="PIFX", root="PIFX", name=",
                 oa->Length, oa->RootDirectory);
         print_unicode_string(buf, oa->ObjectName);
@@ -222,13 +335,17 @@ print_known_compound_type(buf_info_t *buf, drsys_param_type_t type, void *start_
         break;
     }
     case DRSYS_TYPE_IO_STATUS_BLOCK: {
-        IO_STATUS_BLOCK *io = (IO_STATUS_BLOCK *) start_addr;
+        IO_STATUS_BLOCK *io = (IO_STATUS_BLOCK *) app_mem(start_addr, sizeof(*io));
+        if (io == NULL)
+            return false;
         OUTPUT(buf, "status="PIFX", info="PIFX"", io->StatusPointer.Status,
                 io->Information);
         break;
     }
     case DRSYS_TYPE_LARGE_INTEGER: {
-        LARGE_INTEGER *li = (LARGE_INTEGER *) start_addr;
+        LARGE_INTEGER *li = (LARGE_INTEGER *) app_mem(start_addr, sizeof(*li));
+        if (li == NULL)
+            return false;
         OUTPUT(buf, "0x"HEX64_FORMAT_STRING, li->QuadPart);
         break;
     }
@@ -382,33 +499,80 @@ type_has_unknown_components(drsym_type_t *type)
     return true;
 }
 
-static bool
-drstrace_print_info_class_struct(buf_info_t *buf, drsys_arg_t *arg)
+/* The expanded type of each structure printed, keyed by its name.  Looking
+ * the type up in the pdb is far more expensive than printing it, and the
+ * same information-class structures are printed over and over.
+ */
+typedef struct _struct_type_t {
+    /* NULL if the type could not be used, so that we do not look it up again */
+    drsym_type_t *type;
+    /* holds the type tree */
+    char buf[TYPE_OUTPUT_SIZE];
+} struct_type_t;
+
+static hashtable_t struct_type_table;
+
+static void
+struct_type_free(void *p)
+{
+    dr_global_free(p, sizeof(struct_type_t));
+}
+
+static void
+struct_types_init(void)
+{
+    hashtable_init_ex(&struct_type_table, HASHTABLE_BITSIZE, HASH_STRING,
+                      true/*strdup*/, true/*synch*/, struct_type_free, NULL, NULL);
+}
+
+static void
+struct_types_exit(void)
 {
-    char buf_tmp[TYPE_OUTPUT_SIZE];
+    hashtable_delete(&struct_type_table);
+}
+
+static drsym_type_t *
+struct_type_lookup(const char *name)
+{
+    struct_type_t *st;
     drsym_type_t *type;
-    drsym_type_t *expand_type;
     drsym_error_t r;
-
-    r = drsym_get_type_by_name(options.sympath, arg->enum_name,
-                               buf_tmp, BUFFER_SIZE_BYTES(buf_tmp),
+    hashtable_lock(&struct_type_table);
+    st = (struct_type_t *) hashtable_lookup(&struct_type_table, (void *) name);
+    if (st != NULL) {
+        hashtable_unlock(&struct_type_table);
+        return st->type;
+    }
+    st = (struct_type_t *) dr_global_alloc(sizeof(*st));
+    st->type = NULL;
+    r = drsym_get_type_by_name(options.sympath, name,
+                               st->buf, BUFFER_SIZE_BYTES(st->buf),
                                &type);
     if (r != DRSYM_SUCCESS) {
-        NOTIFY("Value to symbol %s lookup failed", arg->enum_name);
-        return false;
+        NOTIFY("Value to symbol %s lookup failed", name);
+    } else {
+        r = drsym_expand_type(options.sympath, type->id, UINT_MAX,
+                              st->buf, BUFFER_SIZE_BYTES(st->buf),
+                              &st->type);
+        if (r != DRSYM_SUCCESS) {
+            NOTIFY("%s structure expanding failed", name);
+            st->type = NULL;
+        } else if (!type_has_unknown_components(st->type)) {
+            NOTIFY("%s structure has unknown types", name);
+            st->type = NULL;
+        }
     }
+    hashtable_add(&struct_type_table, (void *) name, (void *) st);
+    hashtable_unlock(&struct_type_table);
+    return st->type;
+}
 
-    r = drsym_expand_type(options.sympath, type->id, UINT_MAX,
-                          buf_tmp, BUFFER_SIZE_BYTES(buf_tmp),
-                          &expand_type);
-    if (r != DRSYM_SUCCESS) {
-        NOTIFY("%s structure expanding failed", arg->enum_name);
-        return false;
-    }
-    if (!type_has_unknown_components(expand_type)) {
-        NOTIFY("%s structure has unknown types", arg->enum_name);
+static bool
+drstrace_print_info_class_struct(buf_info_t *buf, drsys_arg_t *arg)
+{
+    drsym_type_t *expand_type = struct_type_lookup(arg->enum_name);
+    if (expand_type == NULL)
         return false;
-    }
 
     if (arg->valid && !arg->pre) {
         if (arg->value64 == 0) {
@@ -508,6 +672,329 @@ drsys_iter_arg_cb(drsys_arg_t *arg, void *user_data)
     return true; /* keep going */
 }
 
+/***************************************************************************
+ * Binary trace output
+ */
+
+static void
+bin_flush(bin_tls_t *tls)
+{
+    drstrace_bin_chunk_t chunk;
+    if (tls->sofar == 0)
+        return;
+    chunk.thread_id = tls->tid;
+    chunk.data_size = tls->sofar;
+    dr_mutex_lock(bin_lock);
+    dr_write_file(outf, &chunk, sizeof(chunk));
+    dr_write_file(outf, tls->buf, tls->sofar);
+    dr_mutex_unlock(bin_lock);
+    tls->sofar = 0;
+}
+
+/* Returns a zeroed record of the given size in tls's buffer.  Callers must
+ * obtain any string ids before this, as that can flush the buffer.
+ */
+static void *
+bin_reserve(bin_tls_t *tls, drstrace_bin_kind_t kind, size_t size)
+{
+    drstrace_bin_rec_t *rec;
+    size = ALIGN_FORWARD(size, DRSTRACE_BIN_ALIGN);
+    ASSERT(size <= BIN_BUFFER_SIZE, "binary record too large");
+    if (tls->sofar + size > BIN_BUFFER_SIZE)
+        bin_flush(tls);
+    rec = (drstrace_bin_rec_t *) (tls->buf + tls->sofar);
+    memset(rec, 0, size);
+    rec->kind = (ushort) kind;
+    rec->size = (uint) size;
+    tls->sofar += size;
+    return rec;
+}
+
+static uint64
+bin_string_id(bin_tls_t *tls, const char *str)
+{
+    if (str == NULL)
+        return 0;
+    if (hashtable_add(&bin_string_table, (void *)str, (void *)str)) {
+        /* First use in this process */
+        size_t len = strlen(str);
+        drstrace_bin_string_t *rec;
+        if (len >= DRSTRACE_BIN_MAX_STRING)
+            len = DRSTRACE_BIN_MAX_STRING - 1;
+        rec = (drstrace_bin_string_t *)
+            bin_reserve(tls, DRSTRACE_BIN_STRING,
+                        offsetof(drstrace_bin_string_t, str) + len + 1);
+        rec->id = (uint64)(ptr_uint_t)str;
+        memcpy(rec->str, str, len);
+    }
+    return (uint64)(ptr_uint_t)str;
+}
+
+/* Copies up to size bytes of app memory at addr, as far as it is readable */
+static void
+bin_capture_mem(bin_tls_t *tls, void *addr, size_t size)
+{
+    drstrace_bin_mem_t *rec;
+    size_t got = 0, rec_size;
+    if (addr == NULL || size == 0)
+        return;
+    if (size > DRSTRACE_BIN_MAX_MEM)
+        size = DRSTRACE_BIN_MAX_MEM;
+    rec = (drstrace_bin_mem_t *)
+        bin_reserve(tls, DRSTRACE_BIN_MEM, offsetof(drstrace_bin_mem_t, data) + size);
+    if (!dr_safe_read(addr, size, rec->data, &got) && got == 0) {
+        tls->sofar -= rec->size;
+        return;
+    }
+    rec_size = ALIGN_FORWARD(offsetof(drstrace_bin_mem_t, data) + got,
+                             DRSTRACE_BIN_ALIGN);
+    tls->sofar -= rec->size - rec_size;
+    rec->rec.size = (uint) rec_size;
+    rec->length = (uint) got;
+    rec->addr = (uint64)(ptr_uint_t)addr;
+}
+
+static void
+bin_capture_unicode_string(bin_tls_t *tls, UNICODE_STRING *us)
+{
+    UNICODE_STRING local;
+    if (us == NULL)
+        return;
+    bin_capture_mem(tls, us, sizeof(*us));
+    if (dr_safe_read(us, sizeof(local), &local, NULL))
+        bin_capture_mem(tls, local.Buffer, local.Length);
+}
+
+/* Records arg's value along with the memory that print_arg() reads */
+static void
+bin_record_arg(bin_tls_t *tls, drsys_arg_t *arg)
+{
+    drstrace_bin_arg_t *rec;
+    uint64 arg_name = bin_string_id(tls, arg->arg_name);
+    uint64 type_name = bin_string_id(tls, arg->type_name);
+    uint64 enum_name = bin_string_id(tls, arg->enum_name);
+    rec = (drstrace_bin_arg_t *) bin_reserve(tls, DRSTRACE_BIN_ARG, sizeof(*rec));
+    rec->ordinal = arg->ordinal;
+    rec->mode = arg->mode;
+    rec->type = arg->type;
+    rec->pre = arg->pre;
+    rec->size = arg->size;
+    rec->value = arg->value;
+    rec->value64 = arg->value64;
+    rec->arg_name = arg_name;
+    rec->type_name = type_name;
+    rec->enum_name = enum_name;
+
+    if (arg->value64 == 0 || TEST(DRSYS_PARAM_INLINED, arg->mode) ||
+        (arg->pre && !TEST(DRSYS_PARAM_IN, arg->mode)) ||
+        (!arg->pre && !TEST(DRSYS_PARAM_OUT, arg->mode)))
+        return;
+    switch (arg->type) {
+    case DRSYS_TYPE_UNICODE_STRING:
+        bin_capture_unicode_string(tls, (UNICODE_STRING *) arg->value);
+        break;
+    case DRSYS_TYPE_OBJECT_ATTRIBUTES: {
+        OBJECT_ATTRIBUTES oa;
+        bin_capture_mem(tls, (void *) arg->value, sizeof(oa));
+        if (dr_safe_read((void *) arg->value, sizeof(oa), &oa, NULL))
+            bin_capture_unicode_string(tls, oa.ObjectName);
+        break;
+    }
+    case DRSYS_TYPE_IO_STATUS_BLOCK:
+        bin_capture_mem(tls, (void *) arg->value, sizeof(IO_STATUS_BLOCK));
+        break;
+    case DRSYS_TYPE_LARGE_INTEGER:
+        bin_capture_mem(tls, (void *) arg->value, sizeof(LARGE_INTEGER));
+        break;
+    default:
+        /* Structures from wintypes.pdb are captured only at the top level */
+        bin_capture_mem(tls, (void *)(ptr_uint_t) arg->value64, arg->size);
+        break;
+    }
+}
+
+static bool
+bin_iter_arg_cb(drsys_arg_t *arg, void *user_data)
+{
+    bin_tls_t *tls = (bin_tls_t *) user_data;
+    ASSERT(arg->valid, "no args should be invalid");
+    if ((arg->pre && !TEST(DRSYS_PARAM_RETVAL, arg->mode)) ||
+        (!arg->pre && TESTANY(DRSYS_PARAM_OUT|DRSYS_PARAM_RETVAL, arg->mode)))
+        bin_record_arg(tls, arg);
+    return true; /* keep going */
+}
+
+static void
+bin_pre_syscall(void *drcontext, drsys_syscall_t *syscall, const char *name, bool known)
+{
+    bin_tls_t *tls = (bin_tls_t *) drmgr_get_tls_field(drcontext, tls_idx_bin);
+    drstrace_bin_pre_t *rec;
+    drsys_sysnum_t sysnum = {0,};
+    uint64 name_id = bin_string_id(tls, name);
+    drmf_status_t res;
+    if (drsys_syscall_number(syscall, &sysnum) != DRMF_SUCCESS)
+        ASSERT(false, "drsys_syscall_number failed");
+    rec = (drstrace_bin_pre_t *) bin_reserve(tls, DRSTRACE_BIN_PRE, sizeof(*rec));
+    rec->name = name_id;
+    rec->number = sysnum.number;
+    rec->secondary = sysnum.secondary;
+    rec->known = known;
+    res = drsys_iterate_args(drcontext, bin_iter_arg_cb, tls);
+    if (res != DRMF_SUCCESS && res != DRMF_ERROR_DETAILS_UNKNOWN)
+        ASSERT(false, "drsys_iterate_args failed pre-syscall");
+    /* Unlike text output we do not flush here: a thread blocked in the kernel
+     * just holds its records a little longer.
+     */
+}
+
+static void
+bin_post_syscall(void *drcontext, bool success, uint error)
+{
+    bin_tls_t *tls = (bin_tls_t *) drmgr_get_tls_field(drcontext, tls_idx_bin);
+    drstrace_bin_post_t *rec;
+    drmf_status_t res;
+    rec = (drstrace_bin_post_t *) bin_reserve(tls, DRSTRACE_BIN_POST, sizeof(*rec));
+    rec->success = success;
+    rec->error = error;
+    res = drsys_iterate_args(drcontext, bin_iter_arg_cb, tls);
+    if (res != DRMF_SUCCESS && res != DRMF_ERROR_DETAILS_UNKNOWN)
+        ASSERT(false, "drsys_iterate_args failed post-syscall");
+}
+
+static void
+bin_write_header(void)
+{
+    drstrace_bin_header_t header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, DRSTRACE_BIN_MAGIC, BUFFER_SIZE_ELEMENTS(header.magic));
+    header.version = DRSTRACE_BIN_VERSION;
+    header.header_size = sizeof(header);
+    header.pointer_size = sizeof(void *);
+    dr_write_file(outf, &header, sizeof(header));
+}
+
+static void
+event_thread_init(void *drcontext)
+{
+    bin_tls_t *tls = (bin_tls_t *) dr_thread_alloc(drcontext, sizeof(*tls));
+    tls->buf = (byte *) dr_thread_alloc(drcontext, BIN_BUFFER_SIZE);
+    tls->sofar = 0;
+    tls->tid = dr_get_thread_id(drcontext);
+    drmgr_set_tls_field(drcontext, tls_idx_bin, (void *) tls);
+}
+
+static void
+event_thread_exit(void *drcontext)
+{
+    bin_tls_t *tls = (bin_tls_t *) drmgr_get_tls_field(drcontext, tls_idx_bin);
+    bin_flush(tls);
+    dr_thread_free(drcontext, tls->buf, BIN_BUFFER_SIZE);
+    dr_thread_free(drcontext, tls, sizeof(*tls));
+}
+
+/***************************************************************************
+ * Sampling
+ */
+
+static void
+sample_window_thread(void *arg)
+{
+    /* We start with a window open, to see initialization */
+    while (true) {
+        sample_window_open = true;
+        dr_sleep(options.sample_window_ms);
+        sample_window_open = false;
+        dr_sleep(options.sample_period_ms - options.sample_window_ms);
+    }
+}
+
+/* Counts the call and returns whether to trace it */
+static bool
+sample_syscall(void *drcontext, drsys_syscall_t *syscall, const char *name)
+{
+    syscall_count_t *sc;
+    uint64 n;
+    bool traced;
+    hashtable_lock(&count_table);
+    sc = (syscall_count_t *) hashtable_lookup(&count_table, (void *)syscall);
+    if (sc == NULL) {
+        sc = (syscall_count_t *) dr_global_alloc(sizeof(*sc));
+        sc->count = 0;
+        sc->name = name;
+        if (drsys_syscall_number(syscall, &sc->sysnum) != DRMF_SUCCESS)
+            ASSERT(false, "drsys_syscall_number failed");
+        hashtable_add(&count_table, (void *)syscall, (void *)sc);
+    }
+    n = ++sc->count;
+    hashtable_unlock(&count_table);
+    traced = sample_window_open ||
+        (options.sample_every > 1 && (n - 1) % options.sample_every == 0);
+    /* XXX: a Windows callback can make syscalls while one is outstanding, which
+     * could have us omit or include a post-syscall without its pre-syscall.
+     * We live with that rather than using callback-local storage.
+     */
+    drmgr_set_tls_field(drcontext, tls_idx_sample, (void *)(ptr_uint_t)traced);
+    return traced;
+}
+
+static void
+free_syscall_count(void *sc)
+{
+    dr_global_free(sc, sizeof(syscall_count_t));
+}
+
+static void
+dump_syscall_counts(void)
+{
+    syscall_count_t **all;
+    uint i, j, num = 0, max = count_table.entries;
+    if (max == 0)
+        return;
+    all = (syscall_count_t **) dr_global_alloc(max * sizeof(*all));
+    for (i = 0; i < HASHTABLE_SIZE(count_table.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = count_table.table[i]; he != NULL && num < max; he = he->next)
+            all[num++] = (syscall_count_t *) he->payload;
+    }
+    /* In descending order of count */
+    for (i = 1; i < num; i++) {
+        syscall_count_t *tmp = all[i];
+        for (j = i; j > 0 && all[j-1]->count < tmp->count; j--)
+            all[j] = all[j-1];
+        all[j] = tmp;
+    }
+    if (options.binary) {
+        drstrace_bin_rec_t *rec;
+        bin_tls_t tls;
+        tls.buf = (byte *) dr_global_alloc(BIN_BUFFER_SIZE);
+        tls.sofar = 0;
+        tls.tid = 0;
+        for (i = 0; i < num; i++) {
+            drstrace_bin_count_t *count;
+            uint64 name_id = bin_string_id(&tls, all[i]->name);
+            rec = (drstrace_bin_rec_t *)
+                bin_reserve(&tls, DRSTRACE_BIN_COUNT, sizeof(*count));
+            count = (drstrace_bin_count_t *) rec;
+            count->name = name_id;
+            count->count = all[i]->count;
+            count->number = all[i]->sysnum.number;
+            count->secondary = all[i]->sysnum.secondary;
+        }
+        bin_flush(&tls);
+        dr_global_free(tls.buf, BIN_BUFFER_SIZE);
+    } else {
+        buf_info_t buf;
+        buf.sofar = 0;
+        OUTPUT(&buf, "System call counts:\n");
+        for (i = 0; i < num; i++) {
+            OUTPUT(&buf, "%12"UINT64_FORMAT_CODE" %s\n", all[i]->count,
+                   all[i]->name);
+        }
+        FLUSH_BUFFER(outf, buf.buf, buf.sofar);
+    }
+    dr_global_free(all, max * sizeof(*all));
+}
+
 static bool
 event_pre_syscall(void *drcontext, int sysnum)
 {
@@ -528,6 +1015,14 @@ event_pre_syscall(void *drcontext, int sysnum)
     if (drsys_syscall_is_known(syscall, &known) != DRMF_SUCCESS)
         ASSERT(false, "failed to find whether known");
 
+    if (sampling && !sample_syscall(drcontext, syscall, name))
+        return true;
+
+    if (options.binary) {
+        bin_pre_syscall(drcontext, syscall, name, known);
+        return true;
+    }
+
     OUTPUT(&buf, "%s%s\n", name, known ? "" : " (details not all known)");
 
     res = drsys_iterate_args(drcontext, drsys_iter_arg_cb, &buf);
@@ -550,12 +1045,20 @@ event_post_syscall(void *drcontext, int sysnum)
     buf_info_t buf;
     buf.sofar = 0;
 
+    if (sampling && drmgr_get_tls_field(drcontext, tls_idx_sample) == NULL)
+        return;
+
     if (drsys_cur_syscall(drcontext, &syscall) != DRMF_SUCCESS)
         ASSERT(false, "drsys_cur_syscall failed");
 
     if (drsys_cur_syscall_result(drcontext, &success, NULL, &error) != DRMF_SUCCESS)
         ASSERT(false, "drsys_cur_syscall_result failed");
 
+    if (options.binary) {
+        bin_post_syscall(drcontext, success, error);
+        return;
+    }
+
     if (success)
         OUTPUT(&buf, "    succeeded =>\n");
     else
@@ -569,9 +1072,52 @@ event_post_syscall(void *drcontext, int sysnum)
 static bool
 event_filter_syscall(void *drcontext, int sysnum)
 {
+    /* Syscalls we do not trace are not intercepted at all, so they pay no
+     * overhead beyond what DR itself adds.
+     */
+    if (options.filter[0] != '\0')
+        return hashtable_lookup(&filter_table, (void *)(ptr_int_t)sysnum) != NULL;
+    if (options.exclude[0] != '\0')
+        return hashtable_lookup(&filter_table, (void *)(ptr_int_t)sysnum) == NULL;
     return true; /* intercept everything */
 }
 
+/* Resolves each name in the comma-separated list, adds its primary number to
+ * filter_table, and passes the number to filter_func.  As with Dr. Syscall's
+ * own filtering, a secondary syscall's name covers all secondaries under the
+ * same primary number.
+ */
+static void
+filter_table_init(const char *list, const char *option,
+                  drmf_status_t (*filter_func)(drsys_sysnum_t))
+{
+    const char *start = list, *end;
+    char name[OPTION_MAX_LENGTH];
+    while (*start != '\0') {
+        size_t len;
+        drsys_syscall_t *syscall;
+        drsys_sysnum_t sysnum;
+        end = strchr(start, ',');
+        if (end == NULL)
+            end = start + strlen(start);
+        len = end - start;
+        if (len > 0) {
+            ASSERT(len < BUFFER_SIZE_ELEMENTS(name), "option token too long");
+            memcpy(name, start, len);
+            name[len] = '\0';
+            if (drsys_name_to_syscall(name, &syscall) == DRMF_SUCCESS &&
+                drsys_syscall_number(syscall, &sysnum) == DRMF_SUCCESS) {
+                if (filter_func(sysnum) != DRMF_SUCCESS)
+                    ASSERT(false, "drsys filtering should never fail");
+                hashtable_add(&filter_table, (void *)(ptr_uint_t)sysnum.number,
+                              (void *)syscall);
+            } else
+                ALERT(1, "<%s: unknown system call %s>\n", option, name);
+        }
+        start = (*end == ',') ? end + 1 : end;
+    }
+}
+
 static void
 open_log_file(void)
 {
@@ -580,7 +1126,7 @@ open_log_file(void)
         outf = STDERR;
     else {
         outf = drx_open_unique_appid_file(options.logdir, dr_get_process_id(),
-                                          "drstrace", "log",
+                                          "drstrace", options.binary ? "bin" : "log",
 #ifndef WINDOWS
                                           DR_FILE_CLOSE_ON_FORK |
 #endif
@@ -588,6 +1134,8 @@ open_log_file(void)
                                           buf, BUFFER_SIZE_ELEMENTS(buf));
         ASSERT(outf != INVALID_FILE, "failed to open log file");
         ALERT(1, "<drstrace log file is %s>\n", buf);
+        if (options.binary)
+            bin_write_header();
     }
 }
 
@@ -597,20 +1145,39 @@ event_fork(void *drcontext)
 {
     /* The old file was closed by DR b/c we passed DR_FILE_CLOSE_ON_FORK */
     open_log_file();
+    if (options.binary) {
+        /* The parent writes out its own pending records and strings */
+        bin_tls_t *tls = (bin_tls_t *) drmgr_get_tls_field(drcontext, tls_idx_bin);
+        tls->sofar = 0;
+        tls->tid = dr_get_thread_id(drcontext);
+        hashtable_clear(&bin_string_table);
+    }
 }
 #endif
 
 static
 void exit_event(void)
 {
+    if (sampling) {
+        dump_syscall_counts();
+        hashtable_delete(&count_table);
+        drmgr_unregister_tls_field(tls_idx_sample);
+    }
     if (outf != STDERR)
         dr_close_file(outf);
+    if (options.binary) {
+        drmgr_unregister_tls_field(tls_idx_bin);
+        hashtable_delete(&bin_string_table);
+        dr_mutex_destroy(bin_lock);
+    }
+    hashtable_delete(&filter_table);
     if (drsys_exit() != DRMF_SUCCESS)
         ASSERT(false, "drsys failed to exit");
     drsym_exit();
     drx_exit();
     drmgr_exit();
     hashtable_delete(&nconsts_table);
+    struct_types_exit();
 }
 
 static void
@@ -622,6 +1189,7 @@ options_init(client_id_t id)
 
     /* default values */
     dr_snprintf(options.logdir, BUFFER_SIZE_ELEMENTS(options.logdir), ".");
+    options.sample_period_ms = 10000;
 
     for (s = dr_get_token(opstr, token, BUFFER_SIZE_ELEMENTS(token));
          s != NULL;
@@ -647,18 +1215,69 @@ options_init(client_id_t id)
                              BUFFER_SIZE_ELEMENTS(options.sysnum_file));
             USAGE_CHECK(s != NULL, "missing sysnum_file path");
             ALERT(2, "<drstrace system call number file is %s>\n", options.sysnum_file);
+        } else if (strcmp(token, "-binary") == 0) {
+            options.binary = true;
+        } else if (strcmp(token, "-sample_every") == 0) {
+            s = dr_get_token(s, token, BUFFER_SIZE_ELEMENTS(token));
+            USAGE_CHECK(s != NULL, "missing -sample_every number");
+            if (s != NULL) {
+                int res = dr_sscanf(token, "%u", &options.sample_every);
+                USAGE_CHECK(res == 1, "invalid -sample_every number");
+            }
+        } else if (strcmp(token, "-sample_window_ms") == 0) {
+            s = dr_get_token(s, token, BUFFER_SIZE_ELEMENTS(token));
+            USAGE_CHECK(s != NULL, "missing -sample_window_ms number");
+            if (s != NULL) {
+                int res = dr_sscanf(token, "%u", &options.sample_window_ms);
+                USAGE_CHECK(res == 1, "invalid -sample_window_ms number");
+            }
+        } else if (strcmp(token, "-sample_period_ms") == 0) {
+            s = dr_get_token(s, token, BUFFER_SIZE_ELEMENTS(token));
+            USAGE_CHECK(s != NULL, "missing -sample_period_ms number");
+            if (s != NULL) {
+                int res = dr_sscanf(token, "%u", &options.sample_period_ms);
+                USAGE_CHECK(res == 1, "invalid -sample_period_ms number");
+            }
+        } else if (strcmp(token, "-filter") == 0) {
+            s = dr_get_token(s, options.filter, BUFFER_SIZE_ELEMENTS(options.filter));
+            USAGE_CHECK(s != NULL, "missing -filter syscall list");
+        } else if (strcmp(token, "-exclude") == 0) {
+            s = dr_get_token(s, options.exclude, BUFFER_SIZE_ELEMENTS(options.exclude));
+            USAGE_CHECK(s != NULL, "missing -exclude syscall list");
         } else {
             ALERT(0, "UNRECOGNIZED OPTION: \"%s\"\n", token);
             USAGE_CHECK(false, "invalid option");
         }
     }
+    USAGE_CHECK(!options.binary || strcmp(options.logdir, "-") != 0,
+                "-binary requires a -logdir directory");
+    USAGE_CHECK(options.sample_window_ms < options.sample_period_ms,
+                "-sample_window_ms must be smaller than -sample_period_ms");
+    USAGE_CHECK(options.filter[0] == '\0' || options.exclude[0] == '\0',
+                "-filter and -exclude cannot be combined");
+    sampling = (options.sample_every > 1 || options.sample_window_ms > 0);
+}
+
+static void
+named_consts_init(void)
+{
+    uint i = 0;
+    uint const_arrays_num = get_const_arrays_num();
+    hashtable_init(&nconsts_table, HASHTABLE_BITSIZE, HASH_STRING, false);
+    while (i < const_arrays_num) {
+        const_values_t *named_consts = const_struct_array[i];
+        bool res = hashtable_add(&nconsts_table,
+                                 (void *) named_consts[0].const_name,
+                                 (void *) named_consts);
+        if (!res)
+            ASSERT(false, "drstrace failed to add to hashtable");
+        i++;
+    }
 }
 
 DR_EXPORT
 void dr_init(client_id_t id)
 {
-    uint i = 0;
-    uint const_arrays_num;
     drsys_options_t ops = { sizeof(ops), 0, };
 
     dr_set_client_name("Dr. STrace", "http://drmemory.org/issues");
@@ -699,27 +1318,312 @@ void dr_init(client_id_t id)
     if (res != DRMF_SUCCESS)
         ASSERT(false, "drsys failed to init");
     dr_register_exit_event(exit_event);
+#ifndef WINDOWS
+    dr_register_fork_init_event(event_fork);
+#endif
 
     dr_register_filter_syscall_event(event_filter_syscall);
     drmgr_register_pre_syscall_event(event_pre_syscall);
     drmgr_register_post_syscall_event(event_post_syscall);
-    if (drsys_filter_all_syscalls() != DRMF_SUCCESS)
-        ASSERT(false, "drsys_filter_all_syscalls should never fail");
+    hashtable_init_ex(&filter_table, FILTER_TABLE_BITS, HASH_INTPTR,
+                      false/*!strdup*/, false/*!synch*/, NULL, NULL, NULL);
+    if (options.filter[0] != '\0')
+        filter_table_init(options.filter, "-filter", drsys_filter_syscall);
+    else {
+        if (drsys_filter_all_syscalls() != DRMF_SUCCESS)
+            ASSERT(false, "drsys_filter_all_syscalls should never fail");
+        filter_table_init(options.exclude, "-exclude", drsys_unfilter_syscall);
+    }
+    if (options.binary) {
+        bin_lock = dr_mutex_create();
+        hashtable_init(&bin_string_table, HASHTABLE_BITSIZE, HASH_INTPTR,
+                       false/*!strdup*/);
+        tls_idx_bin = drmgr_register_tls_field();
+        ASSERT(tls_idx_bin > -1, "failed to reserve TLS slot");
+        drmgr_register_thread_init_event(event_thread_init);
+        drmgr_register_thread_exit_event(event_thread_exit);
+        /* Have threads still running at exit flush their buffers */
+        dr_request_synchronized_exit();
+    }
+    if (sampling) {
+        hashtable_init_ex(&count_table, HASHTABLE_BITSIZE, HASH_INTPTR,
+                          false/*!strdup*/, true/*synch*/, free_syscall_count,
+                          NULL, NULL);
+        tls_idx_sample = drmgr_register_tls_field();
+        ASSERT(tls_idx_sample > -1, "failed to reserve TLS slot");
+        if (options.sample_window_ms > 0 &&
+            /* drheapstat uses an itimer but that is not available on Windows */
+            !dr_create_client_thread(sample_window_thread, NULL))
+            ASSERT(false, "failed to create sampling thread");
+    }
     open_log_file();
 
-    const_arrays_num = get_const_arrays_num();
-    hashtable_init(&nconsts_table, HASHTABLE_BITSIZE, HASH_STRING, false);
-    while (i < const_arrays_num) {
-        const_values_t *named_consts = const_struct_array[i];
-        bool res = hashtable_add(&nconsts_table,
-                                 (void *) named_consts[0].const_name,
-                                 (void *) named_consts);
-        if (!res)
-            ASSERT(false, "drstrace failed to add to hashtable");
-        i++;
+    named_consts_init();
+    struct_types_init();
+}
+
+/****************************************************************************
+ * Offline formatting of -binary traces
+ */
+
+#ifdef DRSTRACE_OFFLINE
+/* The strings from the trace's STRING records, keyed by id */
+static hashtable_t offline_string_table;
+
+static const char *
+offline_string(uint64 id)
+{
+    if (id == 0)
+        return NULL;
+    return (const char *)
+        hashtable_lookup(&offline_string_table, (void *)(ptr_uint_t)id);
+}
+
+/* Calls cb on each record in the trace, which is size bytes at start.
+ * Returns false if the trace is ill-formed.
+ */
+static bool
+offline_walk(const byte *start, size_t size,
+             void (*cb)(drstrace_bin_rec_t *rec, uint64 thread_id))
+{
+    const byte *chunk_pc = start + sizeof(drstrace_bin_header_t);
+    const byte *end = start + size;
+    while (chunk_pc < end) {
+        drstrace_bin_chunk_t *chunk = (drstrace_bin_chunk_t *) chunk_pc;
+        const byte *pc = chunk_pc + sizeof(*chunk), *chunk_end;
+        if (pc > end || chunk->data_size > (uint64)(end - pc))
+            return false;
+        chunk_end = pc + (size_t)chunk->data_size;
+        while (pc < chunk_end) {
+            drstrace_bin_rec_t *rec = (drstrace_bin_rec_t *) pc;
+            if (chunk_end - pc < sizeof(*rec) || rec->size < sizeof(*rec) ||
+                rec->size > (size_t)(chunk_end - pc))
+                return false;
+            cb(rec, chunk->thread_id);
+            pc += rec->size;
+        }
+        chunk_pc = chunk_end;
+    }
+    return true;
+}
+
+static void
+offline_collect_string(drstrace_bin_rec_t *rec, uint64 thread_id)
+{
+    drstrace_bin_string_t *str = (drstrace_bin_string_t *) rec;
+    if (rec->kind != DRSTRACE_BIN_STRING ||
+        rec->size <= offsetof(drstrace_bin_string_t, str))
+        return;
+    /* The writer pads with zeroes, but be safe */
+    ((char *)rec)[rec->size - 1] = '\0';
+    hashtable_add(&offline_string_table, (void *)(ptr_uint_t)str->id, str->str);
+}
+
+/* The argument whose memory records are being gathered */
+static drsys_arg_t offline_arg;
+static bool offline_arg_pending;
+static uint64 offline_thread_id;
+static buf_info_t offline_buf;
+
+static void
+offline_print_pending_arg(void)
+{
+    if (offline_arg_pending) {
+        print_arg(&offline_buf, &offline_arg);
+        offline_arg_pending = false;
     }
+    num_captured_mem = 0;
+}
 
+static void
+offline_print_record(drstrace_bin_rec_t *rec, uint64 thread_id)
+{
+    buf_info_t *buf = &offline_buf;
+    if (rec->kind != DRSTRACE_BIN_MEM)
+        offline_print_pending_arg();
+    if (thread_id != offline_thread_id && rec->kind != DRSTRACE_BIN_STRING &&
+        rec->kind != DRSTRACE_BIN_COUNT) {
+        OUTPUT(buf, "~~~~ thread "UINT64_FORMAT_STRING" ~~~~\n", thread_id);
+        offline_thread_id = thread_id;
+    }
+    switch (rec->kind) {
+    case DRSTRACE_BIN_PRE: {
+        drstrace_bin_pre_t *pre = (drstrace_bin_pre_t *) rec;
+        const char *name = offline_string(pre->name);
+        if (rec->size < sizeof(*pre))
+            break;
+        if (name != NULL)
+            OUTPUT(buf, "%s", name);
+        else
+            OUTPUT(buf, "<sysnum 0x%x.0x%x>", pre->number, pre->secondary);
+        OUTPUT(buf, "%s\n", pre->known ? "" : " (details not all known)");
+        break;
+    }
+    case DRSTRACE_BIN_POST: {
+        drstrace_bin_post_t *post = (drstrace_bin_post_t *) rec;
+        if (rec->size < sizeof(*post))
+            break;
+        if (post->success)
+            OUTPUT(buf, "    succeeded =>\n");
+        else {
+            OUTPUT(buf, "    failed (error="IF_WINDOWS_ELSE(PIFX, "%d")") =>\n",
+                   post->error);
+        }
+        break;
+    }
+    case DRSTRACE_BIN_ARG: {
+        drstrace_bin_arg_t *arg = (drstrace_bin_arg_t *) rec;
+        if (rec->size < sizeof(*arg))
+            break;
+        memset(&offline_arg, 0, sizeof(offline_arg));
+        offline_arg.pre = arg->pre;
+        offline_arg.ordinal = arg->ordinal;
+        offline_arg.mode = arg->mode;
+        offline_arg.type = arg->type;
+        offline_arg.valid = true;
+        offline_arg.size = (size_t) arg->size;
+        offline_arg.value = (ptr_uint_t) arg->value;
+        offline_arg.value64 = arg->value64;
+        offline_arg.arg_name = offline_string(arg->arg_name);
+        offline_arg.type_name = offline_string(arg->type_name);
+        offline_arg.enum_name = offline_string(arg->enum_name);
+        offline_arg_pending = true;
+        break;
+    }
+    case DRSTRACE_BIN_MEM: {
+        drstrace_bin_mem_t *mem = (drstrace_bin_mem_t *) rec;
+        if (rec->size < offsetof(drstrace_bin_mem_t, data) ||
+            mem->length > rec->size - offsetof(drstrace_bin_mem_t, data) ||
+            num_captured_mem >= MAX_CAPTURED_MEM)
+            break;
+        captured_mem[num_captured_mem].addr = (byte *)(ptr_uint_t) mem->addr;
+        captured_mem[num_captured_mem].size = mem->length;
+        captured_mem[num_captured_mem].data = mem->data;
+        num_captured_mem++;
+        break;
+    }
+    case DRSTRACE_BIN_COUNT: {
+        drstrace_bin_count_t *count = (drstrace_bin_count_t *) rec;
+        const char *name = offline_string(count->name);
+        static bool printed_title;
+        if (rec->size < sizeof(*count))
+            break;
+        if (!printed_title) {
+            OUTPUT(buf, "System call counts:\n");
+            printed_title = true;
+        }
+        OUTPUT(buf, "%12"UINT64_FORMAT_CODE" ", count->count);
+        if (name != NULL)
+            OUTPUT(buf, "%s\n", name);
+        else
+            OUTPUT(buf, "<sysnum 0x%x.0x%x>\n", count->number, count->secondary);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void
+offline_usage(void)
+{
+    dr_fprintf(STDERR, "usage: drstrace_format [-symcache_path <dir>] <trace.bin>\n");
+    dr_fprintf(STDERR, "Prints a trace written by drstrace -binary to stdout.\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *trace = NULL;
+    drstrace_bin_header_t *header;
+    file_t f;
+    uint64 file_size;
+    size_t map_size;
+    byte *map = NULL;
+    int i, res = 1;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-symcache_path") == 0 && i + 1 < argc) {
+            dr_snprintf(options.sympath, BUFFER_SIZE_ELEMENTS(options.sympath),
+                        "%s", argv[++i]);
+            NULL_TERMINATE_BUFFER(options.sympath);
+        } else if (argv[i][0] != '-' && trace == NULL)
+            trace = argv[i];
+        else {
+            offline_usage();
+            return 1;
+        }
+    }
+    if (trace == NULL) {
+        offline_usage();
+        return 1;
+    }
+
+    dr_standalone_init();
+    if (drsym_init(0) != DRSYM_SUCCESS) {
+        dr_fprintf(STDERR, "failed to initialize symbol access\n");
+        return 1;
+    }
+    named_consts_init();
+    struct_types_init();
+    hashtable_init(&offline_string_table, HASHTABLE_BITSIZE, HASH_INTPTR,
+                   false/*!strdup*/);
+    outf = STDOUT;
+    offline_buf.sofar = 0;
+
+    f = dr_open_file(trace, DR_FILE_READ);
+    if (f == INVALID_FILE || !dr_file_size(f, &file_size) ||
+        file_size < sizeof(*header)) {
+        dr_fprintf(STDERR, "failed to open %s\n", trace);
+        goto offline_done;
+    }
+    map_size = (size_t) file_size;
+    /* We modify the view (see offline_collect_string) so we map it copy-on-write */
+    map = (byte *) dr_map_file(f, &map_size, 0, NULL,
+                               DR_MEMPROT_READ | DR_MEMPROT_WRITE, DR_MAP_PRIVATE);
+    if (map == NULL || map_size < file_size) {
+        dr_fprintf(STDERR, "failed to map %s\n", trace);
+        goto offline_done;
+    }
+    header = (drstrace_bin_header_t *) map;
+    if (strncmp(header->magic, DRSTRACE_BIN_MAGIC,
+                BUFFER_SIZE_ELEMENTS(header->magic)) != 0 ||
+        header->version != DRSTRACE_BIN_VERSION ||
+        header->header_size != sizeof(*header)) {
+        dr_fprintf(STDERR, "%s is not a drstrace binary trace of version %d\n",
+                   trace, DRSTRACE_BIN_VERSION);
+        goto offline_done;
+    }
+    if (header->pointer_size != sizeof(void *)) {
+        dr_fprintf(STDERR, "%s is from a %d-bit application: use the %d-bit "
+                   "drstrace_format\n", trace, header->pointer_size * 8,
+                   header->pointer_size * 8);
+        goto offline_done;
+    }
+    /* Strings can be referenced before the chunk defining them */
+    if (!offline_walk(map, (size_t) file_size, offline_collect_string) ||
+        !offline_walk(map, (size_t) file_size, offline_print_record)) {
+        offline_print_pending_arg();
+        FLUSH_BUFFER(outf, offline_buf.buf, offline_buf.sofar);
+        dr_fprintf(STDERR, "%s is truncated or corrupt\n", trace);
+        goto offline_done;
+    }
+    offline_print_pending_arg();
+    FLUSH_BUFFER(outf, offline_buf.buf, offline_buf.sofar);
+    res = 0;
+
+ offline_done:
+    if (map != NULL)
+        dr_unmap_file(map, map_size);
+    if (f != INVALID_FILE)
+        dr_close_file(f);
+    hashtable_delete(&offline_string_table);
+    hashtable_delete(&nconsts_table);
+    struct_types_exit();
+    drsym_exit();
+    return res;
 }
+#endif /* DRSTRACE_OFFLINE */
 
 /****************************************************************************
  * Unit tests group of functions
@@ -732,6 +1636,7 @@ drstrace_unit_test_syscall_exit()
     if (drsym_exit() != DRSYM_SUCCESS)
         return false;
     hashtable_delete(&nconsts_table);
+    struct_types_exit();
     return true;
 }
 
@@ -757,6 +1662,7 @@ drstrace_unit_test_syscall_init()
             return false;
         i++;
     }
+    struct_types_init();
     return true;
 }
 
@@ -0,0 +1,128 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The -binary trace format written by drstrace and decoded by drstrace_format.
+ *
+ * The file is a drstrace_bin_header_t followed by chunks.  Each chunk is a
+ * drstrace_bin_chunk_t followed by data_size bytes of records from a single
+ * thread, in that thread's order.  Every record starts with a
+ * drstrace_bin_rec_t whose size covers the whole record, padded to
+ * DRSTRACE_BIN_ALIGN.  Strings are written once per process, in a STRING
+ * record that may appear in any thread's chunk, and are referenced by id.
+ * All fields are laid out so that the format is identical for 32-bit and
+ * 64-bit writers.
+ */
+
+#ifndef _DRSTRACE_BINARY_H_
+#define _DRSTRACE_BINARY_H_ 1
+
+#define DRSTRACE_BIN_MAGIC "DrSTrcB"
+/* Must be bumped whenever any of the structures below change */
+#define DRSTRACE_BIN_VERSION 1
+
+#define DRSTRACE_BIN_ALIGN 8
+
+/* Caps the bytes of memory copied for any one argument */
+#define DRSTRACE_BIN_MAX_MEM 1024
+/* Caps the length of any one string */
+#define DRSTRACE_BIN_MAX_STRING 256
+
+typedef enum {
+    DRSTRACE_BIN_STRING, /* drstrace_bin_string_t */
+    DRSTRACE_BIN_PRE,    /* drstrace_bin_pre_t: starts a system call */
+    DRSTRACE_BIN_POST,   /* drstrace_bin_post_t: the system call returned */
+    DRSTRACE_BIN_ARG,    /* drstrace_bin_arg_t: an argument or the return value */
+    DRSTRACE_BIN_MEM,    /* drstrace_bin_mem_t: memory for the preceding ARG */
+    DRSTRACE_BIN_COUNT,  /* drstrace_bin_count_t: calls to one syscall, at exit */
+} drstrace_bin_kind_t;
+
+typedef struct _drstrace_bin_header_t {
+    char magic[8];
+    uint version;
+    uint header_size;
+    uint pointer_size; /* of the traced application */
+    uint reserved;
+} drstrace_bin_header_t;
+
+typedef struct _drstrace_bin_chunk_t {
+    uint64 thread_id;
+    uint64 data_size;
+} drstrace_bin_chunk_t;
+
+typedef struct _drstrace_bin_rec_t {
+    ushort kind; /* drstrace_bin_kind_t */
+    ushort reserved;
+    uint size;
+} drstrace_bin_rec_t;
+
+typedef struct _drstrace_bin_string_t {
+    drstrace_bin_rec_t rec;
+    uint64 id;
+    char str[1]; /* null-terminated; variable-sized */
+} drstrace_bin_string_t;
+
+typedef struct _drstrace_bin_pre_t {
+    drstrace_bin_rec_t rec;
+    uint64 name; /* string id */
+    uint number;
+    uint secondary;
+    uint known;
+    uint reserved;
+} drstrace_bin_pre_t;
+
+typedef struct _drstrace_bin_post_t {
+    drstrace_bin_rec_t rec;
+    uint success;
+    uint error;
+} drstrace_bin_post_t;
+
+typedef struct _drstrace_bin_arg_t {
+    drstrace_bin_rec_t rec;
+    int ordinal;
+    uint mode;
+    uint type;
+    uint pre;
+    uint64 size;
+    uint64 value;
+    uint64 value64;
+    uint64 arg_name;  /* string id */
+    uint64 type_name; /* string id */
+    uint64 enum_name; /* string id */
+} drstrace_bin_arg_t;
+
+typedef struct _drstrace_bin_mem_t {
+    drstrace_bin_rec_t rec;
+    uint length;
+    uint reserved;
+    uint64 addr;
+    byte data[1]; /* variable-sized */
+} drstrace_bin_mem_t;
+
+/* Written at exit when sampling, in descending order of count */
+typedef struct _drstrace_bin_count_t {
+    drstrace_bin_rec_t rec;
+    uint64 name; /* string id */
+    uint64 count;
+    uint number;
+    uint secondary;
+} drstrace_bin_count_t;
+
+#endif /* _DRSTRACE_BINARY_H_ */
@@ -116,6 +116,18 @@ print_usage(void)
     fprintf(stderr, "                The default value is \".\" (current dir).\n");
     fprintf(stderr, "                If set to \"-\", data for all processes are\n");
     fprintf(stderr, "                printed to stderr (warning: this can be slow).\n");
+    fprintf(stderr, "-binary         Write raw system call data to a .bin file in\n");
+    fprintf(stderr, "                the -logdir directory, for lower overhead.\n");
+    fprintf(stderr, "                Use drstrace_format to print it as text.\n");
+    fprintf(stderr, "-sample_every <N>   Only trace the first of every N calls to\n");
+    fprintf(stderr, "                each system call.  All calls are counted, and\n");
+    fprintf(stderr, "                the counts are written at exit.\n");
+    fprintf(stderr, "-sample_window_ms <W>   Trace all calls during a window of W\n");
+    fprintf(stderr, "                milliseconds every -sample_period_ms <P>\n");
+    fprintf(stderr, "                milliseconds (default 10000), counting as above.\n");
+    fprintf(stderr, "-filter <s1,s2>   Only trace the listed system calls.  The\n");
+    fprintf(stderr, "                others are not intercepted at all.\n");
+    fprintf(stderr, "-exclude <s1,s2>  Trace all but the listed system calls.\n");
     fprintf(stderr, "-symcache_path <path>   Specify absolute path where symbol data\n");
     fprintf(stderr, "                should be cached. If not set, _NT_SYMBOL_PATH\n");
     fprintf(stderr, "                environment variable will be used, if set; else\n");
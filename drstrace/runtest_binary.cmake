@@ -0,0 +1,90 @@
+# **********************************************************
+# Copyright (c) 2026 Google, Inc.  All rights reserved.
+# **********************************************************
+
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# * Redistributions of source code must retain the above copyright notice,
+#   this list of conditions and the following disclaimer.
+#
+# * Redistributions in binary form must reproduce the above copyright notice,
+#   this list of conditions and the following disclaimer in the documentation
+#   and/or other materials provided with the distribution.
+#
+# * Neither the name of Google, Inc. nor the names of its contributors may be
+#   used to endorse or promote products derived from this software without
+#   specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+
+# Invoked by the test suite to check that drstrace_format turns a -binary
+# trace back into what the text mode writes.
+
+# input:
+# * drstrace = path to drstrace
+# * format = path to drstrace_format
+# * dr = DynamoRIO root
+# * app = application to run
+# * outdir = scratch directory for the logs
+
+file(REMOVE_RECURSE "${outdir}")
+file(MAKE_DIRECTORY "${outdir}/text")
+file(MAKE_DIRECTORY "${outdir}/bin")
+
+foreach (mode text bin)
+  if ("${mode}" STREQUAL "bin")
+    set(extra_ops "-binary")
+  else ()
+    set(extra_ops "")
+  endif ()
+  execute_process(COMMAND ${drstrace} -dr ${dr} -logdir ${outdir}/${mode} ${extra_ops}
+    -- ${app}
+    RESULT_VARIABLE cmd_result
+    ERROR_VARIABLE cmd_err
+    OUTPUT_VARIABLE cmd_out)
+  if (cmd_result)
+    message(FATAL_ERROR
+      "*** drstrace ${extra_ops} failed (${cmd_result}): ${cmd_err}***\n")
+  endif (cmd_result)
+endforeach ()
+
+file(GLOB text_log "${outdir}/text/drstrace.*.log")
+file(GLOB bin_log "${outdir}/bin/drstrace.*.bin")
+list(LENGTH text_log text_count)
+list(LENGTH bin_log bin_count)
+if (NOT text_count EQUAL 1 OR NOT bin_count EQUAL 1)
+  message(FATAL_ERROR "expected one log per run: got ${text_log} and ${bin_log}")
+endif ()
+
+execute_process(COMMAND ${format} ${bin_log}
+  RESULT_VARIABLE cmd_result
+  ERROR_VARIABLE cmd_err
+  OUTPUT_VARIABLE format_out)
+if (cmd_result)
+  message(FATAL_ERROR "*** drstrace_format failed (${cmd_result}): ${cmd_err}***\n")
+endif (cmd_result)
+file(READ "${text_log}" text_out)
+
+# The text log has no thread markers.  Pointers, handles, and other values
+# differ between the two runs, so we only compare the hex-free shape.
+foreach (var text_out format_out)
+  string(REGEX REPLACE "\r" "" ${var} "${${var}}")
+  string(REGEX REPLACE "~~~~ thread [0-9]+ ~~~~\n" "" ${var} "${${var}}")
+  string(REGEX REPLACE "0x[0-9a-fA-F]+" "0x?" ${var} "${${var}}")
+endforeach ()
+
+if (NOT "${format_out}" STREQUAL "${text_out}")
+  message(FATAL_ERROR "drstrace_format output ${format_out} failed to match "
+    "text-mode output ${text_out}")
+endif ()
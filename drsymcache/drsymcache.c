@@ -47,6 +47,18 @@
  *   of wildcard symcache entries.  i#722 added
  *   "std::_DebugHeapDelete<*>" whose matches are stored as
  *   "std::_DebugHeapDelete<>" duplicates.
+ * - We write a binary file (see symcache_bin_header_t) that is mapped and
+ *   queried in place, to avoid parsing and building tables for every module
+ *   at load time.  We still read the older text file, which is simpler to
+ *   create synthetically, and replace it with a binary file on our next write.
+ * - Many processes may share one cache dir.  Rather than a separate store we
+ *   keep one file per module and merge: on a lookup miss, and before each
+ *   write, we pull in whatever other processes have written since we last
+ *   looked.  Writes still go through a rename of a temp file, so readers
+ *   always see a complete file.
+ * - Entries added on top of a binary file go to an append-only journal, and
+ *   the file is only rewritten once the journal grows large, which is also
+ *   when negative entries are aged out (drsymcache_options_t.negative_runs).
  */
 
 #define SYMCACHE_FILE_HEADER "Dr. Memory symbol cache version"
@@ -68,12 +80,105 @@
  */
 #define SYMCACHE_BUFFER_SIZE 4096
 
-/* The number of digits used for the decimal representation of the file size of
- * the symcache file.
+#define SYMCACHE_MAX_TMP_TRIES 1000
+
+#define SYMCACHE_TEXT_SUFFIX "txt"
+#define SYMCACHE_BIN_SUFFIX "bin"
+#define SYMCACHE_JOURNAL_SUFFIX "jnl"
+
+/* The binary format has its own version, which must be bumped whenever any
+ * of the symcache_bin_*_t or symcache_jnl_*_t structures change.
  */
-#define SYMCACHE_SIZE_DIGITS 10
+#define SYMCACHE_BIN_MAGIC "DrMSymC"
+#define SYMCACHE_BIN_VERSION 2
+#define SYMCACHE_JOURNAL_MAGIC "DrMSymJ"
 
-#define SYMCACHE_MAX_TMP_TRIES 1000
+/* Entries added to a module with a binary file are appended to a journal
+ * beside it.  The binary file is only rewritten, merging the journal in, once
+ * the journal reaches this percentage of its size.
+ */
+#define SYMCACHE_JOURNAL_MAX_PERCENT 50
+
+/* Records when each module's files were last used, for a size budget */
+#define SYMCACHE_INDEX_NAME "symcache.idx"
+#define SYMCACHE_INDEX_HEADER "Dr. Memory symbol cache index version 1"
+
+/* The binary file is a header, followed by an array of symcache_bin_sym_t
+ * sorted by name, then an array of uint offsets, then a pool of
+ * null-terminated names.  We only support reading a file written by the
+ * same build configuration: a mismatch in header_size from a different
+ * bitwidth simply makes the file stale.
+ */
+typedef struct _symcache_bin_header_t {
+    char magic[8];
+    uint version;
+    uint header_size;
+    uint file_size; /* self-consistency check */
+    uint num_syms;
+    uint num_offs;
+    uint strings_size;
+    uint has_debug_info;
+    /* Module consistency fields */
+    uint timestamp;
+    uint64 module_file_size;
+#ifdef WINDOWS
+    uint64 file_version;
+    uint64 product_version;
+    uint64 module_internal_size;
+    uint checksum;
+#else
+# ifdef LINUX
+    byte md5[MD5_RAW_BYTES];
+# endif
+# ifdef MACOS
+    uint current_version;
+    uint compatibility_version;
+    byte uuid[16];
+# endif
+#endif
+} symcache_bin_header_t;
+
+typedef struct _symcache_bin_sym_t {
+    uint name;       /* offset into the string pool */
+    uint first_offs; /* index into the offset array */
+    uint num_offs;
+    /* For a negative entry, the number of rewrites in a row by processes that
+     * never queried it.
+     */
+    uint idle_runs;
+} symcache_bin_sym_t;
+
+/* The journal is a header followed by records, each a symcache_jnl_rec_t and
+ * then name_len bytes of name and a null.  Records are replayed in order onto
+ * the binary file whose file_size matches bin_size; a journal left over from
+ * an older binary file is ignored.
+ */
+typedef struct _symcache_jnl_header_t {
+    char magic[8];
+    uint version;
+    uint bin_size;
+} symcache_jnl_header_t;
+
+typedef struct _symcache_jnl_rec_t {
+    uint offs;
+    uint name_len;
+} symcache_jnl_rec_t;
+
+/* An entry added in this process and not yet written out */
+typedef struct _symcache_pending_t {
+    char *symbol;
+    uint offs;
+    struct _symcache_pending_t *next;
+} symcache_pending_t;
+
+/* A module in the index of last uses: see symcache_enforce_budget() */
+typedef struct _symcache_used_t {
+    char *modname;
+    uint64 size;
+    uint64 last_use; /* in milliseconds */
+    bool used; /* by this process, so not to be evicted */
+    struct _symcache_used_t *next;
+} symcache_used_t;
 
 /* We key on full path to reduce chance of duplicate name (i#729).
  * If we do have duplicate preferred name, though, note that only one can
@@ -82,21 +187,54 @@
  */
 static hashtable_t symcache_table;
 
-/* simple synch scheme: hold this lock across all operations on outer or inner tables */
+/* Lookups vastly outnumber adds, so locking is read-mostly and per module.
+ * This read-write lock protects symcache_table, and its read side keeps each
+ * mod_cache_t alive while a thread uses it.  Each mod_cache_t has its own
+ * read-write lock for its table and mapped file, which querying takes for read.
+ * The order is symcache_lock before a module's lock.  Holding symcache_lock
+ * for write excludes every module lock holder, so it also covers the modules.
+ */
 static void *symcache_lock;
 
 static bool initialized;
 
 static int symcache_init_count;
 
+static drsymcache_options_t symcache_ops;
+
+/* Protects symcache_used */
+static void *symcache_used_lock;
+static symcache_used_t *symcache_used;
+
 /* Entry in the outer table */
 typedef struct _mod_cache_t {
     /* strdup-ed modname since key now holds path */
     const char *modname;
+    /* Read-write lock for the fields below: see symcache_lock */
+    void *lock;
     bool from_file; /* came from a cache file */
-    bool appended; /* added to since read from file? */
-    /* Table of offset_list_t entries */
+    bool from_text; /* came from an old-style text file */
+    /* Table of offset_list_t entries.  With a binary file mapped in, this holds
+     * only the symbols added on top of it, and a symbol here supersedes the
+     * file's entry for it.
+     */
     hashtable_t table;
+    /* A mapped read-only view of the binary file, or NULL */
+    const symcache_bin_header_t *map;
+    size_t map_size;
+    /* With -symcache_negative_runs, one flag per symbol in the view, set once
+     * its negative entry is queried.  Racy sets are fine as they all store 1.
+     */
+    byte *map_queried;
+    /* Size of the binary file when we last read or wrote it, so we can
+     * notice entries added by other processes sharing the cache dir.
+     */
+    uint64 disk_size;
+    /* How much of the journal we have replayed or written */
+    uint64 journal_size;
+    /* Entries to write out at the next save, in order */
+    symcache_pending_t *pending;
+    symcache_pending_t *pending_last;
     /* Values for consistency that we cache until ready to write to file */
     uint64 module_file_size;
 #ifdef WINDOWS
@@ -148,6 +286,9 @@ typedef struct _offset_list_t {
     /* For improved iteration performance we cache the last index + entry */
     uint iter_idx;
     offset_entry_t *iter_entry;
+    /* For a negative entry: see symcache_bin_sym_t.idle_runs and map_queried */
+    uint idle_runs;
+    bool queried;
 } offset_list_t;
 
 static char symcache_dir[MAXIMUM_PATH];
@@ -162,20 +303,92 @@ symcache_module_load_save(void *drcontext, const module_data_t *mod, bool loaded
 static void
 symcache_module_unload(void *drcontext, const module_data_t *mod);
 
+static bool
+symcache_refresh(mod_cache_t *modcache);
+
+static void
+symcache_bin_load_table(mod_cache_t *modcache);
+
+#define ASSERT_MODCACHE_WRITABLE(modcache)                        \
+    ASSERT(dr_rwlock_self_owns_write_lock((modcache)->lock) ||    \
+           dr_rwlock_self_owns_write_lock(symcache_lock), "missing symcache lock")
+
 static bool
 module_has_symbols(const module_data_t *mod)
 {
     return (drsym_module_has_symbols(mod->full_path) == DRSYM_SUCCESS);
 }
 
-/* caller must hold symcache_lock, even at exit time */
+static void
+symcache_unmap(mod_cache_t *modcache)
+{
+    if (modcache->map != NULL) {
+        if (modcache->map_queried != NULL) {
+            global_free(modcache->map_queried, modcache->map->num_syms,
+                        HEAPSTAT_HASHTABLE);
+            modcache->map_queried = NULL;
+        }
+        dr_unmap_file((void *)modcache->map, modcache->map_size);
+        modcache->map = NULL;
+        modcache->map_size = 0;
+    }
+}
+
+/* Replaces any current view with hdr */
+static void
+symcache_set_map(mod_cache_t *modcache, const symcache_bin_header_t *hdr,
+                 size_t map_size)
+{
+    symcache_unmap(modcache);
+    modcache->map = hdr;
+    modcache->map_size = map_size;
+    modcache->disk_size = hdr->file_size;
+    if (symcache_ops.negative_runs > 0 && hdr->num_syms > 0) {
+        modcache->map_queried = (byte *) global_alloc(hdr->num_syms, HEAPSTAT_HASHTABLE);
+        memset(modcache->map_queried, 0, hdr->num_syms);
+    }
+}
+
+static void
+symcache_pending_free(mod_cache_t *modcache)
+{
+    symcache_pending_t *p, *next;
+    for (p = modcache->pending; p != NULL; p = next) {
+        next = p->next;
+        global_free(p->symbol, strlen(p->symbol) + 1, HEAPSTAT_HASHTABLE);
+        global_free(p, sizeof(*p), HEAPSTAT_HASHTABLE);
+    }
+    modcache->pending = NULL;
+    modcache->pending_last = NULL;
+}
+
+static void
+symcache_pending_add(mod_cache_t *modcache, const char *symbol, size_t offs)
+{
+    symcache_pending_t *p = (symcache_pending_t *)
+        global_alloc(sizeof(*p), HEAPSTAT_HASHTABLE);
+    p->symbol = drmem_strdup(symbol, HEAPSTAT_HASHTABLE);
+    /* In the file we currently store this as a 4-byte int. */
+    p->offs = (uint) offs;
+    p->next = NULL;
+    if (modcache->pending_last == NULL)
+        modcache->pending = p;
+    else
+        modcache->pending_last->next = p;
+    modcache->pending_last = p;
+}
+
+/* caller must hold symcache_lock for write, even at exit time */
 static void
 symcache_free_entry(void *v)
 {
     mod_cache_t *modcache = (mod_cache_t *) v;
-    ASSERT(dr_mutex_self_owns(symcache_lock), "missing symcache lock");
+    ASSERT(dr_rwlock_self_owns_write_lock(symcache_lock), "missing symcache lock");
     if (modcache != NULL) {
+        symcache_unmap(modcache);
+        symcache_pending_free(modcache);
         hashtable_delete(&modcache->table);
+        dr_rwlock_destroy(modcache->lock);
         if (modcache->modname != NULL) {
             global_free((void *)modcache->modname, strlen(modcache->modname) + 1,
                         HEAPSTAT_HASHTABLE);
@@ -185,16 +398,102 @@ symcache_free_entry(void *v)
 }
 
 static void
-symcache_get_filename(const char *modname, char *symfile, size_t symfile_count)
+symcache_get_filename(const char *modname, const char *suffix,
+                      char *symfile, size_t symfile_count)
 {
-    dr_snprintf(symfile, symfile_count, "%s/%s.txt", symcache_dir, modname);
+    dr_snprintf(symfile, symfile_count, "%s/%s.%s", symcache_dir, modname, suffix);
     symfile[symfile_count-1] = '\0';
 }
 
+static inline const symcache_bin_sym_t *
+symcache_bin_syms(const symcache_bin_header_t *hdr)
+{
+    return (const symcache_bin_sym_t *) (hdr + 1);
+}
+
+static inline const uint *
+symcache_bin_offs(const symcache_bin_header_t *hdr)
+{
+    return (const uint *) (symcache_bin_syms(hdr) + hdr->num_syms);
+}
+
+static inline const char *
+symcache_bin_strings(const symcache_bin_header_t *hdr)
+{
+    return (const char *) (symcache_bin_offs(hdr) + hdr->num_offs);
+}
+
+/* Binary searches the mapped file.  Returns NULL if symbol is not present or
+ * its entry is corrupted.  The view is never written, so concurrent searches
+ * only need modcache->lock for read, to keep it from being unmapped.
+ */
+static const symcache_bin_sym_t *
+symcache_bin_lookup(mod_cache_t *modcache, const char *symbol)
+{
+    const symcache_bin_header_t *hdr = modcache->map;
+    const symcache_bin_sym_t *syms = symcache_bin_syms(hdr);
+    const char *strings = symcache_bin_strings(hdr);
+    uint lo = 0, hi = hdr->num_syms;
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        int cmp;
+        if (syms[mid].name >= hdr->strings_size)
+            break;
+        cmp = strcmp(symbol, strings + syms[mid].name);
+        if (cmp == 0) {
+            if (syms[mid].num_offs == 0 ||
+                syms[mid].first_offs > hdr->num_offs ||
+                syms[mid].num_offs > hdr->num_offs - syms[mid].first_offs)
+                break;
+#ifdef WINDOWS
+            {
+                /* Guard against corrupted files that cause DrMem to crash (i#1465) */
+                const uint *offs = symcache_bin_offs(hdr) + syms[mid].first_offs;
+                uint i;
+                for (i = 0; i < syms[mid].num_offs; i++) {
+                    if (offs[i] >= modcache->module_internal_size) {
+                        NOTIFY("SYMCACHE ERROR: %s file has too-large entry "PIFX
+                               " for %s"NL, modcache->modname, (ptr_uint_t)offs[i],
+                               symbol);
+                        return NULL;
+                    }
+                }
+            }
+#endif
+            return &syms[mid];
+        } else if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    if (lo < hi)
+        WARN("WARNING: %s symbol cache file is corrupted\n", modcache->modname);
+    return NULL;
+}
+
+/* Opens a new temp file for writing, to be renamed to path once complete */
+static file_t
+symcache_open_tmp(const char *path, char *tmp, size_t tmp_count)
+{
+    file_t f = INVALID_FILE;
+    uint i = 0;
+    while (f == INVALID_FILE && i < SYMCACHE_MAX_TMP_TRIES) {
+        /* Include the pid to avoid collisions among concurrent processes */
+        dr_snprintf(tmp, tmp_count, "%s.%d.%04d.tmp", path, dr_get_process_id(), i);
+        tmp[tmp_count-1] = '\0';
+        f = dr_open_file(tmp, DR_FILE_WRITE_REQUIRE_NEW);
+        i++;
+    }
+    if (f == INVALID_FILE)
+        NOTIFY("WARNING: Unable to create symcache temp file %s"NL, tmp);
+    return f;
+}
+
 /* If an entry already exists and is 0, replaces it; else adds a new
  * offset for that symbol.
  *
- * If symtable is visible outside of this thread, the caller must hold symcache_lock.
+ * If symtable is visible outside of this thread, the caller must hold its
+ * module's lock for write.
  */
 static bool
 symcache_symbol_add(const char *modname, hashtable_t *symtable,
@@ -240,6 +539,8 @@ symcache_symbol_add(const char *modname, hashtable_t *symtable,
         olist->list = NULL;
         olist->list_last = NULL;
         olist->table = NULL;
+        olist->idle_runs = 0;
+        olist->queried = false;
     }
     LOG(2, "%s: %s \"%s\" @ "PIFX"\n", __FUNCTION__, modname, symbol, offs);
     /* we could verify by an addr lookup but we still need consistency info
@@ -277,133 +578,443 @@ symcache_symbol_add(const char *modname, hashtable_t *symtable,
     return true;
 }
 
-/* caller must hold symcache_lock */
+static inline bool
+symcache_olist_is_negative(const offset_list_t *olist)
+{
+    return olist->num == 1 && olist->list->offs == 0;
+}
+
+/* Adds to the table overlaying any mapped file.  A symbol's first overlay entry
+ * is seeded with the file's entry for it, so that the overlay can supersede it.
+ * A negative entry read from disk never clobbers an entry we already have.
+ * Caller must hold modcache->lock or symcache_lock for write.
+ */
+static bool
+symcache_table_add(mod_cache_t *modcache, const char *symbol, size_t offs,
+                   bool from_disk)
+{
+    offset_list_t *olist;
+    ASSERT_MODCACHE_WRITABLE(modcache);
+    olist = (offset_list_t *) hashtable_lookup(&modcache->table, (void *)symbol);
+    if (olist == NULL && modcache->map != NULL) {
+        const symcache_bin_sym_t *sym = symcache_bin_lookup(modcache, symbol);
+        if (sym != NULL) {
+            const uint *file_offs = symcache_bin_offs(modcache->map) + sym->first_offs;
+            uint i, idx = (uint)(sym - symcache_bin_syms(modcache->map));
+            for (i = 0; i < sym->num_offs; i++) {
+                symcache_symbol_add(modcache->modname, &modcache->table, symbol,
+                                    file_offs[i]);
+            }
+            olist = (offset_list_t *)
+                hashtable_lookup(&modcache->table, (void *)symbol);
+            if (olist != NULL) {
+                olist->idle_runs = sym->idle_runs;
+                olist->queried = (modcache->map_queried != NULL &&
+                                  modcache->map_queried[idx] != 0);
+            }
+        }
+    }
+    if (from_disk && offs == 0 && olist != NULL)
+        return false;
+    return symcache_symbol_add(modcache->modname, &modcache->table, symbol, offs);
+}
+
+static size_t
+symcache_pending_size(mod_cache_t *modcache)
+{
+    symcache_pending_t *p;
+    size_t size = 0;
+    for (p = modcache->pending; p != NULL; p = p->next)
+        size += sizeof(symcache_jnl_rec_t) + strlen(p->symbol) + 1;
+    return size;
+}
+
+/* Replays journal records that we have not yet seen.  Replaying a record
+ * twice is harmless, as duplicates are dropped.  Returns whether anything
+ * was added.  Caller must hold modcache->lock or symcache_lock for write.
+ */
+static bool
+symcache_journal_replay(mod_cache_t *modcache)
+{
+    char jnlfile[MAXIMUM_PATH];
+    const symcache_jnl_header_t *hdr;
+    const byte *map;
+    uint64 file_size, pos;
+    size_t map_size;
+    file_t f;
+    bool changed = false;
+    ASSERT_MODCACHE_WRITABLE(modcache);
+    if (modcache->disk_size == 0)
+        return false;
+    symcache_get_filename(modcache->modname, SYMCACHE_JOURNAL_SUFFIX,
+                          jnlfile, BUFFER_SIZE_ELEMENTS(jnlfile));
+    f = dr_open_file(jnlfile, DR_FILE_READ);
+    if (f == INVALID_FILE)
+        return false;
+    if (!dr_file_size(f, &file_size) || file_size < sizeof(*hdr) ||
+        file_size <= modcache->journal_size) {
+        dr_close_file(f);
+        return false;
+    }
+    map_size = (size_t) file_size;
+    map = (const byte *) dr_map_file(f, &map_size, 0, NULL, DR_MEMPROT_READ, 0);
+    dr_close_file(f);
+    if (map == NULL || map_size < file_size) {
+        WARN("WARNING: unable to map symbol cache journal for %s\n", modcache->modname);
+        if (map != NULL)
+            dr_unmap_file((void *)map, map_size);
+        return false;
+    }
+    hdr = (const symcache_jnl_header_t *) map;
+    if (memcmp(hdr->magic, SYMCACHE_JOURNAL_MAGIC, sizeof(SYMCACHE_JOURNAL_MAGIC)) != 0 ||
+        hdr->version != SYMCACHE_BIN_VERSION || hdr->bin_size != modcache->disk_size) {
+        /* Left over from an older binary file: our next write replaces it */
+        LOG(2, "ignoring stale symbol cache journal for %s\n", modcache->modname);
+        dr_unmap_file((void *)map, map_size);
+        return false;
+    }
+    LOG(2, "replaying symbol cache journal for %s from %d\n", modcache->modname,
+        (uint)modcache->journal_size);
+    pos = (modcache->journal_size == 0) ? sizeof(*hdr) : modcache->journal_size;
+    while (pos + sizeof(symcache_jnl_rec_t) <= file_size) {
+        symcache_jnl_rec_t rec;
+        const char *name = (const char *) map + pos + sizeof(rec);
+        memcpy(&rec, map + pos, sizeof(rec));
+        /* A short record is still being appended: we'll read it next time */
+        if ((uint64)rec.name_len + 1 > file_size - pos - sizeof(rec))
+            break;
+        if (name[rec.name_len] != '\0' || strlen(name) != rec.name_len) {
+            WARN("WARNING: %s symbol cache journal is corrupted\n", modcache->modname);
+            break;
+        }
+        if (symcache_table_add(modcache, name, rec.offs, true/*from disk*/))
+            changed = true;
+        pos += sizeof(rec) + rec.name_len + 1;
+    }
+    modcache->journal_size = pos;
+    dr_unmap_file((void *)map, map_size);
+    return changed;
+}
+
+/* Writes the pending entries to the journal.  A new journal is written whole
+ * and renamed into place; otherwise we append with a single write so that
+ * records from concurrent processes do not interleave.
+ * Caller must hold modcache->lock or symcache_lock for write.
+ */
+static bool
+symcache_journal_write(mod_cache_t *modcache)
+{
+    char jnlfile[MAXIMUM_PATH];
+    char jnlfile_tmp[MAXIMUM_PATH];
+    symcache_pending_t *p;
+    byte *buf;
+    size_t size, sofar = 0;
+    file_t f;
+    bool ok, create = (modcache->journal_size == 0);
+    ASSERT_MODCACHE_WRITABLE(modcache);
+    size = symcache_pending_size(modcache);
+    if (create)
+        size += sizeof(symcache_jnl_header_t);
+    buf = (byte *) global_alloc(size, HEAPSTAT_HASHTABLE);
+    if (create) {
+        symcache_jnl_header_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        strncpy(hdr.magic, SYMCACHE_JOURNAL_MAGIC, BUFFER_SIZE_ELEMENTS(hdr.magic));
+        hdr.version = SYMCACHE_BIN_VERSION;
+        hdr.bin_size = (uint) modcache->disk_size;
+        memcpy(buf, &hdr, sizeof(hdr));
+        sofar = sizeof(hdr);
+    }
+    for (p = modcache->pending; p != NULL; p = p->next) {
+        symcache_jnl_rec_t rec;
+        rec.offs = p->offs;
+        rec.name_len = (uint) strlen(p->symbol);
+        memcpy(buf + sofar, &rec, sizeof(rec));
+        sofar += sizeof(rec);
+        memcpy(buf + sofar, p->symbol, rec.name_len + 1);
+        sofar += rec.name_len + 1;
+    }
+    ASSERT(sofar == size, "journal size mismatch");
+
+    symcache_get_filename(modcache->modname, SYMCACHE_JOURNAL_SUFFIX,
+                          jnlfile, BUFFER_SIZE_ELEMENTS(jnlfile));
+    if (create) {
+        f = symcache_open_tmp(jnlfile, jnlfile_tmp, BUFFER_SIZE_ELEMENTS(jnlfile_tmp));
+        ok = (f != INVALID_FILE);
+        if (ok) {
+            ok = (dr_write_file(f, buf, size) == (ssize_t)size);
+            dr_close_file(f);
+            if (ok)
+                ok = dr_rename_file(jnlfile_tmp, jnlfile, /*replace*/true);
+            if (!ok)
+                dr_delete_file(jnlfile_tmp);
+        }
+        /* We can skip our own records when replaying */
+        if (ok)
+            modcache->journal_size = size;
+    } else {
+        f = dr_open_file(jnlfile, DR_FILE_WRITE_APPEND);
+        ok = (f != INVALID_FILE);
+        if (ok) {
+            ok = (dr_write_file(f, buf, size) == (ssize_t)size);
+            dr_close_file(f);
+        }
+    }
+    global_free(buf, size, HEAPSTAT_HASHTABLE);
+    if (!ok)
+        WARN("WARNING: Unable to write symcache journal for %s\n", modcache->modname);
+    else {
+        LOG(3, "Appended %d bytes to symcache journal for %s\n", (uint)size,
+            modcache->modname);
+    }
+    return ok;
+}
+
+/* Whether a rewrite should drop this negative entry for -symcache_negative_runs */
+static bool
+symcache_negative_expired(const offset_list_t *olist)
+{
+    return (symcache_ops.negative_runs > 0 && symcache_olist_is_negative(olist) &&
+            !olist->queried && olist->idle_runs + 1 >= symcache_ops.negative_runs);
+}
+
+/* Simple heapsort by name: we have no qsort available in all of our build
+ * configurations.
+ */
 static void
-symcache_write_symfile(const char *modname, mod_cache_t *modcache)
+symcache_sift_down(hash_entry_t **a, uint root, uint n)
+{
+    while (2*root + 1 < n) {
+        uint child = 2*root + 1;
+        hash_entry_t *tmp;
+        if (child + 1 < n &&
+            strcmp((const char *)a[child]->key, (const char *)a[child+1]->key) < 0)
+            child++;
+        if (strcmp((const char *)a[root]->key, (const char *)a[child]->key) >= 0)
+            return;
+        tmp = a[root];
+        a[root] = a[child];
+        a[child] = tmp;
+        root = child;
+    }
+}
+
+static void
+symcache_sort_entries(hash_entry_t **a, uint n)
 {
     uint i;
+    for (i = n/2; i > 0; i--)
+        symcache_sift_down(a, i - 1, n);
+    for (i = n; i > 1; i--) {
+        hash_entry_t *tmp = a[0];
+        a[0] = a[i - 1];
+        a[i - 1] = tmp;
+        symcache_sift_down(a, 0, i - 1);
+    }
+}
+
+static bool
+symcache_write_buffered(file_t f, char *buf, size_t bsz, size_t *sofar,
+                        const void *data, size_t size)
+{
+    if (*sofar + size > bsz) {
+        if (*sofar > 0 && dr_write_file(f, buf, *sofar) != (ssize_t)*sofar)
+            return false;
+        *sofar = 0;
+        if (size > bsz)
+            return dr_write_file(f, data, size) == (ssize_t)size;
+    }
+    memcpy(buf + *sofar, data, size);
+    *sofar += size;
+    return true;
+}
+
+/* caller must hold modcache->lock or symcache_lock for write */
+static void
+symcache_write_symfile(const char *modname, mod_cache_t *modcache)
+{
+    uint i, n;
     file_t f;
     hashtable_t *symtable = &modcache->table;
     char buf[SYMCACHE_BUFFER_SIZE];
     size_t sofar = 0;
-    ssize_t len;
     size_t bsz = BUFFER_SIZE_ELEMENTS(buf);
-    size_t filesz_loc;
     char symfile[MAXIMUM_PATH];
     char symfile_tmp[MAXIMUM_PATH];
-    int64 file_size;
+    symcache_bin_header_t hdr;
+    hash_entry_t **sorted;
+    size_t sorted_sz;
+    uint name, first;
+    bool ok;
 
-    ASSERT(dr_mutex_self_owns(symcache_lock), "missing symcache lock");
+    ASSERT_MODCACHE_WRITABLE(modcache);
 
     /* if from file, we assume it's a waste of time to re-write file:
-     * the version matched after all, unless we appended to it.
+     * the version matched after all, unless we added to it or it
+     * is in the old text format.
      */
-    if (modcache->from_file && !modcache->appended)
+    if (modcache->pending == NULL && !modcache->from_text)
         return;
-    if (symtable->entries == 0)
+    if (modcache->map == NULL && symtable->entries == 0)
         return; /* nothing to write */
+    /* Merge in what other processes have written so we don't drop their
+     * entries when we replace the file.  There is still a window between
+     * here and our rename, but the next writer will merge again.
+     */
+    symcache_refresh(modcache);
+
+    /* Small additions go to the journal rather than rewriting the whole file */
+    if (modcache->disk_size > 0 && !modcache->from_text &&
+        (modcache->journal_size + symcache_pending_size(modcache)) * 100 <
+        modcache->disk_size * SYMCACHE_JOURNAL_MAX_PERCENT &&
+        symcache_journal_write(modcache)) {
+        symcache_pending_free(modcache);
+        return;
+    }
+
+    /* Compact the file and journal into a new file */
+    if (modcache->map != NULL)
+        symcache_bin_load_table(modcache);
 
     /* Open the temp symcache that we will rename.  */
-    symcache_get_filename(modname, symfile, BUFFER_SIZE_ELEMENTS(symfile));
-    f = INVALID_FILE;
-    i = 0;
-    while (f == INVALID_FILE && i < SYMCACHE_MAX_TMP_TRIES) {
-        dr_snprintf(symfile_tmp, BUFFER_SIZE_ELEMENTS(symfile_tmp),
-                    "%s.%04d.tmp", symfile, i);
-        NULL_TERMINATE_BUFFER(symfile_tmp);
-        f = dr_open_file(symfile_tmp, DR_FILE_WRITE_REQUIRE_NEW);
-        i++;
-    }
-    if (f == INVALID_FILE) {
-        NOTIFY("WARNING: Unable to create symcache temp file %s"NL,
-               symfile_tmp);
+    symcache_get_filename(modname, SYMCACHE_BIN_SUFFIX,
+                          symfile, BUFFER_SIZE_ELEMENTS(symfile));
+    f = symcache_open_tmp(symfile, symfile_tmp, BUFFER_SIZE_ELEMENTS(symfile_tmp));
+    if (f == INVALID_FILE)
         return;
-    }
 
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, "%s %d\n",
-                   SYMCACHE_FILE_HEADER, SYMCACHE_VERSION);
-    /* Leave room for file size for self-consistency check */
-    filesz_loc = sofar;  /* XXX: Assumes that the buffer hasn't been flushed. */
-    BUFFERED_WRITE(f, buf, bsz, sofar, len,
-                   "%"STRINGIFY(SYMCACHE_SIZE_DIGITS)"u,", 0);
-#ifdef WINDOWS
-    BUFFERED_WRITE(f, buf, bsz, sofar, len,
-                   UINT64_FORMAT_STRING","UINT64_FORMAT_STRING","
-                   UINT64_FORMAT_STRING",%u,%u,%zu\n",
-                   modcache->module_file_size, modcache->file_version.version,
-                   modcache->product_version.version,
-                   modcache->checksum, modcache->timestamp,
-                   modcache->module_internal_size);
-#else
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, UINT64_FORMAT_STRING",%u",
-                   modcache->module_file_size, modcache->timestamp);
-# ifdef LINUX
-    /* For easy sscanf we print as separate bytes. */
-    for (i = 0; i < MD5_RAW_BYTES; i++)
-        BUFFERED_WRITE(f, buf, bsz, sofar, len, ",%02x", modcache->md5[i]);
-# endif
-# ifdef MACOS
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, ",%u,%u,",
-                   modcache->current_version, modcache->compatibility_version);
-    /* For easy sscanf we print as 4 ints */
-    for (i = 0; i < 4; i++)
-        BUFFERED_WRITE(f, buf, bsz, sofar, len, "%08x,", *(int*)(&modcache->uuid[i*4]));
-# endif
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, "\n");
-#endif
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, "%u\n", modcache->has_debug_info);
+    memset(&hdr, 0, sizeof(hdr));
+    /* The names must be sorted so the reader can binary search in place */
+    sorted_sz = symtable->entries * sizeof(*sorted);
+    sorted = (hash_entry_t **) global_alloc(sorted_sz, HEAPSTAT_HASHTABLE);
+    n = 0;
     for (i = 0; i < HASHTABLE_SIZE(symtable->table_bits); i++) {
         hash_entry_t *he;
         for (he = symtable->table[i]; he != NULL; he = he->next) {
             offset_list_t *olist = (offset_list_t *) he->payload;
-            offset_entry_t *e;
             if (olist == NULL)
                 continue;
-            /* skip symbol in dup entries to save space */
-            BUFFERED_WRITE(f, buf, bsz, sofar, len, "%s", he->key);
-            e = olist->list;
-            while (e != NULL) {
-                BUFFERED_WRITE(f, buf, bsz, sofar, len, ",0x%x\n", e->offs);
-                e = e->next;
+            if (symcache_negative_expired(olist)) {
+                LOG(3, "dropping unqueried negative entry %s\n",
+                    (const char *)he->key);
+                continue;
             }
+            ASSERT(n < symtable->entries, "symcache count is off");
+            sorted[n++] = he;
+            hdr.num_offs += olist->num;
+            hdr.strings_size += (uint) strlen((const char *)he->key) + 1;
         }
     }
-
-    /* now update size */
-    FLUSH_BUFFER(f, buf, sofar);
-    if ((file_size = dr_file_tell(f)) < 0 ||
-        dr_snprintf(buf, BUFFER_SIZE_ELEMENTS(buf),
-                    "%"STRINGIFY(SYMCACHE_SIZE_DIGITS)"u", (uint)file_size) < 0 ||
-        !dr_file_seek(f, filesz_loc, DR_SEEK_SET) ||
-        dr_write_file(f, buf, SYMCACHE_SIZE_DIGITS) != SYMCACHE_SIZE_DIGITS) {
-        /* If any steps fail, warn and give up. */
-        NOTIFY("WARNING: Unable to write symcache file size."NL);
+    symcache_sort_entries(sorted, n);
+    if (n == 0) {
+        /* Everything aged out: leave the existing file */
+        global_free(sorted, sorted_sz, HEAPSTAT_HASHTABLE);
         dr_close_file(f);
         dr_delete_file(symfile_tmp);
+        symcache_pending_free(modcache);
         return;
-    } else {
-        LOG(3, "Wrote symcache %s file size %u to pos "SZFMT"\n",
-            modname, (uint)file_size, filesz_loc);
-        ASSERT(strlen(buf) <= SYMCACHE_SIZE_DIGITS, "not enough space for file size");
     }
 
+    strncpy(hdr.magic, SYMCACHE_BIN_MAGIC, BUFFER_SIZE_ELEMENTS(hdr.magic));
+    hdr.version = SYMCACHE_BIN_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.num_syms = n;
+    hdr.file_size = sizeof(hdr) + n * sizeof(symcache_bin_sym_t) +
+        hdr.num_offs * sizeof(uint) + hdr.strings_size;
+    hdr.has_debug_info = modcache->has_debug_info;
+    hdr.timestamp = modcache->timestamp;
+    hdr.module_file_size = modcache->module_file_size;
+#ifdef WINDOWS
+    hdr.file_version = modcache->file_version.version;
+    hdr.product_version = modcache->product_version.version;
+    hdr.module_internal_size = modcache->module_internal_size;
+    hdr.checksum = modcache->checksum;
+#else
+# ifdef LINUX
+    memcpy(hdr.md5, modcache->md5, sizeof(hdr.md5));
+# endif
+# ifdef MACOS
+    hdr.current_version = modcache->current_version;
+    hdr.compatibility_version = modcache->compatibility_version;
+    memcpy(hdr.uuid, modcache->uuid, sizeof(hdr.uuid));
+# endif
+#endif
+
+    ok = symcache_write_buffered(f, buf, bsz, &sofar, &hdr, sizeof(hdr));
+    for (i = 0, name = 0, first = 0; ok && i < n; i++) {
+        offset_list_t *olist = (offset_list_t *) sorted[i]->payload;
+        symcache_bin_sym_t sym;
+        sym.name = name;
+        sym.first_offs = first;
+        sym.num_offs = olist->num;
+        /* This process's count stays in olist, so a later rewrite by us
+         * writes the same value: each process counts as one run.
+         */
+        sym.idle_runs = ((symcache_ops.negative_runs == 0 || olist->queried ||
+                          !symcache_olist_is_negative(olist)) ?
+                         0 : olist->idle_runs + 1);
+        ok = symcache_write_buffered(f, buf, bsz, &sofar, &sym, sizeof(sym));
+        name += (uint) strlen((const char *)sorted[i]->key) + 1;
+        first += olist->num;
+    }
+    for (i = 0; ok && i < n; i++) {
+        offset_list_t *olist = (offset_list_t *) sorted[i]->payload;
+        offset_entry_t *e;
+        for (e = olist->list; ok && e != NULL; e = e->next) {
+            /* In the file we currently store this as a 4-byte int. */
+            uint offs = (uint) e->offs;
+            ok = symcache_write_buffered(f, buf, bsz, &sofar, &offs, sizeof(offs));
+        }
+    }
+    for (i = 0; ok && i < n; i++) {
+        const char *sym = (const char *) sorted[i]->key;
+        ok = symcache_write_buffered(f, buf, bsz, &sofar, sym, strlen(sym) + 1);
+    }
+    if (ok && sofar > 0)
+        ok = (dr_write_file(f, buf, sofar) == (ssize_t)sofar);
+    global_free(sorted, sorted_sz, HEAPSTAT_HASHTABLE);
     dr_close_file(f);
+    if (!ok) {
+        NOTIFY("WARNING: Unable to write symcache file for %s."NL, modname);
+        dr_delete_file(symfile_tmp);
+        return;
+    }
+    LOG(3, "Wrote symcache %s: %u symbols, %u offsets, file size %u\n",
+        modname, hdr.num_syms, hdr.num_offs, hdr.file_size);
 
     if (!dr_rename_file(symfile_tmp, symfile, /*replace*/true)) {
-        NOTIFY_ERROR("WARNING: Failed to rename the symcache file."NL);
+        /* This can happen on Windows if another process has the file mapped.
+         * We'll try again on our next write.
+         */
+        WARN("WARNING: Failed to rename the symcache file for %s\n", modname);
         dr_delete_file(symfile_tmp);
+        return;
+    }
+    modcache->disk_size = hdr.file_size;
+    /* The journal's records are all in the new file */
+    symcache_get_filename(modname, SYMCACHE_JOURNAL_SUFFIX,
+                          symfile, BUFFER_SIZE_ELEMENTS(symfile));
+    dr_delete_file(symfile);
+    modcache->journal_size = 0;
+    symcache_pending_free(modcache);
+    if (modcache->from_text) {
+        /* Remove the stale text file now that it has been superseded */
+        symcache_get_filename(modname, SYMCACHE_TEXT_SUFFIX,
+                              symfile, BUFFER_SIZE_ELEMENTS(symfile));
+        dr_delete_file(symfile);
+        modcache->from_text = false;
     }
 }
 
 #define MAX_SYMLEN 256
 
-/* Sets modcache->has_debug_info.
+/* Reads the old-style text file.  Sets modcache->has_debug_info.
  * No lock is needed as we assume the caller hasn't exposed modcache outside this
  * thread yet.
  */
 static bool
-symcache_read_symfile(const module_data_t *mod, const char *modname,
-                      mod_cache_t *modcache)
+symcache_read_textfile(const module_data_t *mod, const char *modname,
+                       mod_cache_t *modcache)
 {
     hashtable_t *symtable = &modcache->table;
     bool res = false;
@@ -417,7 +1028,8 @@ symcache_read_symfile(const module_data_t *mod, const char *modname,
     char symfile[MAXIMUM_PATH];
     file_t f;
 
-    symcache_get_filename(modname, symfile, BUFFER_SIZE_ELEMENTS(symfile));
+    symcache_get_filename(modname, SYMCACHE_TEXT_SUFFIX,
+                          symfile, BUFFER_SIZE_ELEMENTS(symfile));
     f = dr_open_file(symfile, DR_FILE_READ);
     if (f == INVALID_FILE)
         goto symcache_read_symfile_done;
@@ -621,6 +1233,7 @@ symcache_read_symfile(const module_data_t *mod, const char *modname,
         }
     }
     res = true;
+    modcache->from_text = true;
  symcache_read_symfile_done:
     if (map != NULL)
         dr_unmap_file(map, actual_size);
@@ -632,11 +1245,438 @@ symcache_read_symfile(const module_data_t *mod, const char *modname,
     return res;
 }
 
+/* Maps in the binary file and checks its header against the consistency
+ * fields in modcache.  Returns NULL if there is no usable file.
+ * If skip_size is non-zero and matches the file size, the file is assumed to
+ * be unchanged and is not mapped.
+ */
+static const symcache_bin_header_t *
+symcache_bin_map(const char *modname, mod_cache_t *modcache, uint64 skip_size,
+                 size_t *size OUT)
+{
+    const symcache_bin_header_t *hdr;
+    uint64 map_size;
+    size_t actual_size;
+    void *map = NULL;
+    char symfile[MAXIMUM_PATH];
+    file_t f;
+    bool ok;
+
+    symcache_get_filename(modname, SYMCACHE_BIN_SUFFIX,
+                          symfile, BUFFER_SIZE_ELEMENTS(symfile));
+    f = dr_open_file(symfile, DR_FILE_READ);
+    if (f == INVALID_FILE)
+        return NULL;
+    ok = dr_file_size(f, &map_size) && map_size >= sizeof(*hdr);
+    if (ok && map_size == skip_size) {
+        dr_close_file(f);
+        return NULL;
+    }
+    LOG(2, "processing binary symbol cache file for %s\n", modname);
+    if (ok) {
+        actual_size = (size_t) map_size;
+        ASSERT(actual_size == map_size, "file size too large");
+        map = dr_map_file(f, &actual_size, 0, NULL, DR_MEMPROT_READ, 0);
+    }
+    /* The view remains valid after closing the file */
+    dr_close_file(f);
+    if (!ok || map == NULL || actual_size < map_size) {
+        WARN("WARNING: unable to map symbol cache file for %s\n", modname);
+        if (map != NULL)
+            dr_unmap_file(map, actual_size);
+        return NULL;
+    }
+    hdr = (const symcache_bin_header_t *) map;
+    if (memcmp(hdr->magic, SYMCACHE_BIN_MAGIC, sizeof(SYMCACHE_BIN_MAGIC)) != 0 ||
+        hdr->header_size != sizeof(*hdr)) {
+        WARN("WARNING: %s symbol cache file is corrupted\n", modname);
+        goto symcache_bin_map_error;
+    }
+    if (hdr->version != SYMCACHE_BIN_VERSION) {
+        WARN("Wrong version %d (expect %d) in symbol cache file for %s\n",
+             hdr->version, SYMCACHE_BIN_VERSION, modname);
+        goto symcache_bin_map_error;
+    }
+    /* We check the section sizes in uint64 to avoid overflow from a bogus header */
+    if (hdr->file_size != map_size ||
+        (uint64)sizeof(*hdr) + (uint64)hdr->num_syms * sizeof(symcache_bin_sym_t) +
+        (uint64)hdr->num_offs * sizeof(uint) + hdr->strings_size != map_size ||
+        hdr->strings_size == 0 ||
+        symcache_bin_strings(hdr)[hdr->strings_size - 1] != '\0') {
+        WARN("WARNING: %s symbol cache file is corrupted: map=%d vs file=%d\n",
+             modname, (uint)map_size, hdr->file_size);
+        goto symcache_bin_map_error;
+    }
+    if (hdr->module_file_size != modcache->module_file_size ||
+        hdr->timestamp != modcache->timestamp ||
+#ifdef WINDOWS
+        hdr->file_version != modcache->file_version.version ||
+        hdr->product_version != modcache->product_version.version ||
+        hdr->checksum != modcache->checksum ||
+        hdr->module_internal_size != modcache->module_internal_size
+#else
+# ifdef LINUX
+        memcmp(hdr->md5, modcache->md5, sizeof(hdr->md5)) != 0
+# endif
+# ifdef MACOS
+        hdr->current_version != modcache->current_version ||
+        hdr->compatibility_version != modcache->compatibility_version ||
+        memcmp(hdr->uuid, modcache->uuid, sizeof(hdr->uuid)) != 0
+# endif
+#endif
+        ) {
+        LOG(1, "module version mismatch: %s symbol cache file is stale\n", modname);
+        goto symcache_bin_map_error;
+    }
+    *size = actual_size;
+    return hdr;
+
+ symcache_bin_map_error:
+    dr_unmap_file(map, actual_size);
+    return NULL;
+}
+
+/* Maps in the binary file, leaving its contents to be queried in place.
+ * Sets modcache->has_debug_info on success.
+ * No lock is needed as we assume the caller hasn't exposed modcache outside this
+ * thread yet.
+ */
+static bool
+symcache_read_binfile(const module_data_t *mod, const char *modname,
+                      mod_cache_t *modcache)
+{
+    size_t map_size;
+    const symcache_bin_header_t *hdr =
+        symcache_bin_map(modname, modcache, 0, &map_size);
+    if (hdr == NULL)
+        return false;
+    if (hdr->has_debug_info) {
+        /* We assume that the current availability of debug info doesn't matter */
+        modcache->has_debug_info = true;
+    } else {
+        /* We delay the costly check for symbols until we've read the symcache
+         * b/c if its entry indicates symbols we don't need to look
+         */
+        if (module_has_symbols(mod)) {
+            LOG(1, "module now has debug info: %s symbol cache is stale\n", modname);
+            dr_unmap_file((void *)hdr, map_size);
+            return false;
+        }
+    }
+    symcache_set_map(modcache, hdr, map_size);
+    /* Uncontended, but symcache_table_add() expects it */
+    dr_rwlock_write_lock(modcache->lock);
+    symcache_journal_replay(modcache);
+    dr_rwlock_write_unlock(modcache->lock);
+    return true;
+}
+
+/* Sets modcache->has_debug_info.
+ * No lock is needed as we assume the caller hasn't exposed modcache outside this
+ * thread yet.
+ */
+static bool
+symcache_read_symfile(const module_data_t *mod, const char *modname,
+                      mod_cache_t *modcache)
+{
+    if (symcache_read_binfile(mod, modname, modcache))
+        return true;
+    return symcache_read_textfile(mod, modname, modcache);
+}
+
+/* Adds the contents of a mapped file into modcache->table.  queried, if
+ * non-NULL, holds the map_queried flags for hdr.
+ * Caller must hold modcache->lock or symcache_lock for write.
+ */
+static void
+symcache_bin_merge(mod_cache_t *modcache, const symcache_bin_header_t *hdr,
+                   const byte *queried)
+{
+    const symcache_bin_sym_t *syms = symcache_bin_syms(hdr);
+    const uint *offs = symcache_bin_offs(hdr);
+    const char *strings = symcache_bin_strings(hdr);
+    uint i, j;
+    ASSERT_MODCACHE_WRITABLE(modcache);
+    for (i = 0; i < hdr->num_syms; i++) {
+        if (syms[i].name >= hdr->strings_size ||
+            syms[i].first_offs > hdr->num_offs ||
+            syms[i].num_offs > hdr->num_offs - syms[i].first_offs) {
+            WARN("WARNING: %s symbol cache file is corrupted\n", modcache->modname);
+            break;
+        }
+        for (j = 0; j < syms[i].num_offs; j++) {
+            const char *sym = strings + syms[i].name;
+            uint val = offs[syms[i].first_offs + j];
+            offset_list_t *olist = (offset_list_t *)
+                hashtable_lookup(&modcache->table, (void *)sym);
+            /* A negative entry from another process must not clobber a
+             * symbol we have since resolved.
+             */
+            if (val == 0 && olist != NULL)
+                continue;
+            symcache_symbol_add(modcache->modname, &modcache->table, sym, val);
+            if (olist == NULL) {
+                olist = (offset_list_t *)
+                    hashtable_lookup(&modcache->table, (void *)sym);
+                olist->idle_runs = syms[i].idle_runs;
+                olist->queried = (queried != NULL && queried[i]);
+            }
+        }
+    }
+}
+
+/* Moves the mapped file contents into modcache->table so it can be rewritten.
+ * Entries already in the table supersede the file's.
+ * Caller must hold modcache->lock or symcache_lock for write.
+ */
+static void
+symcache_bin_load_table(mod_cache_t *modcache)
+{
+    LOG(2, "loading symbol cache file for %s to rewrite\n", modcache->modname);
+    symcache_bin_merge(modcache, modcache->map, modcache->map_queried);
+    symcache_unmap(modcache);
+}
+
+/* Picks up entries that other processes sharing the cache dir have written
+ * since we last read or wrote the file, so that a symbol only needs to be
+ * resolved once across all of them.  Returns whether anything was read.
+ * Caller must hold modcache->lock or symcache_lock for write.
+ */
+static bool
+symcache_refresh(mod_cache_t *modcache)
+{
+    size_t map_size;
+    const symcache_bin_header_t *hdr;
+    bool changed = false;
+    ASSERT_MODCACHE_WRITABLE(modcache);
+    hdr = symcache_bin_map(modcache->modname, modcache, modcache->disk_size, &map_size);
+    if (hdr != NULL) {
+        LOG(2, "refreshing symbol cache for %s from updated file\n", modcache->modname);
+        /* A new file starts a new journal */
+        modcache->journal_size = 0;
+        if (modcache->map != NULL || modcache->table.entries == 0) {
+            /* Our own entries stay in the table, overlaying the new view */
+            symcache_set_map(modcache, hdr, map_size);
+            modcache->from_file = true;
+            modcache->from_text = false;
+        } else {
+            symcache_bin_merge(modcache, hdr, NULL);
+            modcache->disk_size = hdr->file_size;
+            dr_unmap_file((void *)hdr, map_size);
+        }
+        changed = true;
+    }
+    if (symcache_journal_replay(modcache))
+        changed = true;
+    return changed;
+}
+
+/* Records that this process used modname's files, of the given total size.
+ * Only symcache_used_lock is needed.
+ */
+static void
+symcache_note_used(const char *modname, uint64 size)
+{
+    symcache_used_t *u;
+    dr_mutex_lock(symcache_used_lock);
+    for (u = symcache_used; u != NULL; u = u->next) {
+        if (strcmp(u->modname, modname) == 0)
+            break;
+    }
+    if (u == NULL) {
+        u = (symcache_used_t *) global_alloc(sizeof(*u), HEAPSTAT_HASHTABLE);
+        u->modname = drmem_strdup(modname, HEAPSTAT_HASHTABLE);
+        u->used = true;
+        u->next = symcache_used;
+        symcache_used = u;
+    }
+    u->size = size;
+    dr_mutex_unlock(symcache_used_lock);
+}
+
+static void
+symcache_free_used(symcache_used_t *list)
+{
+    symcache_used_t *u, *next;
+    for (u = list; u != NULL; u = next) {
+        next = u->next;
+        global_free(u->modname, strlen(u->modname) + 1, HEAPSTAT_HASHTABLE);
+        global_free(u, sizeof(*u), HEAPSTAT_HASHTABLE);
+    }
+}
+
+static bool
+symcache_parse_uint64(const char **s, uint64 *val OUT)
+{
+    const char *c = *s;
+    *val = 0;
+    if (*c < '0' || *c > '9')
+        return false;
+    for (; *c >= '0' && *c <= '9'; c++)
+        *val = *val * 10 + (*c - '0');
+    if (*c != ' ')
+        return false;
+    *s = c + 1;
+    return true;
+}
+
+/* Reads the index of when each module's files were last used, with a line
+ * "<last use> <total size> <modname>" per module.  Entries whose files are
+ * gone are dropped.
+ */
+static symcache_used_t *
+symcache_read_index(const char *path)
+{
+    symcache_used_t *list = NULL;
+    uint64 file_size;
+    size_t buf_size;
+    char *buf, *line, *eol;
+    file_t f = dr_open_file(path, DR_FILE_READ);
+    if (f == INVALID_FILE)
+        return NULL;
+    if (!dr_file_size(f, &file_size) || file_size == 0) {
+        dr_close_file(f);
+        return NULL;
+    }
+    buf_size = (size_t) file_size + 1;
+    buf = (char *) global_alloc(buf_size, HEAPSTAT_HASHTABLE);
+    if (dr_read_file(f, buf, buf_size - 1) != (ssize_t)(buf_size - 1) ||
+        strncmp(buf, SYMCACHE_INDEX_HEADER, strlen(SYMCACHE_INDEX_HEADER)) != 0) {
+        WARN("WARNING: ignoring corrupted symbol cache index %s\n", path);
+        buf[0] = '\0';
+    }
+    buf[buf_size - 1] = '\0';
+    dr_close_file(f);
+    for (line = strchr(buf, '\n'); line != NULL; line = eol) {
+        symcache_used_t *u;
+        const char *c;
+        uint64 last_use, size;
+        char symfile[MAXIMUM_PATH];
+        line++;
+        eol = strchr(line, '\n');
+        if (eol == NULL)
+            break; /* incomplete */
+        *eol = '\0';
+        c = line;
+        if (!symcache_parse_uint64(&c, &last_use) ||
+            !symcache_parse_uint64(&c, &size) || *c == '\0')
+            continue;
+        symcache_get_filename(c, SYMCACHE_BIN_SUFFIX,
+                              symfile, BUFFER_SIZE_ELEMENTS(symfile));
+        if (!dr_file_exists(symfile))
+            continue;
+        u = (symcache_used_t *) global_alloc(sizeof(*u), HEAPSTAT_HASHTABLE);
+        u->modname = drmem_strdup(c, HEAPSTAT_HASHTABLE);
+        u->size = size;
+        u->last_use = last_use;
+        u->used = false;
+        u->next = list;
+        list = u;
+    }
+    global_free(buf, buf_size, HEAPSTAT_HASHTABLE);
+    return list;
+}
+
+/* Keeps the files in the cache dir listed in the index under
+ * symcache_ops.max_dir_size by deleting those of the least recently used
+ * modules.  Modules this process used are never evicted.
+ */
+static void
+symcache_enforce_budget(void)
+{
+    char path[MAXIMUM_PATH];
+    char path_tmp[MAXIMUM_PATH];
+    symcache_used_t *list, *u, *next, **prev;
+    uint64 total = 0, now = dr_get_milliseconds();
+    file_t f;
+
+    dr_snprintf(path, BUFFER_SIZE_ELEMENTS(path), "%s/%s", symcache_dir,
+                SYMCACHE_INDEX_NAME);
+    NULL_TERMINATE_BUFFER(path);
+    list = symcache_read_index(path);
+    /* Fold in this process's uses */
+    for (u = symcache_used; u != NULL; u = next) {
+        symcache_used_t *i;
+        next = u->next;
+        for (i = list; i != NULL; i = i->next) {
+            if (strcmp(i->modname, u->modname) == 0)
+                break;
+        }
+        if (i != NULL) {
+            i->size = u->size;
+            i->last_use = now;
+            i->used = true;
+            global_free(u->modname, strlen(u->modname) + 1, HEAPSTAT_HASHTABLE);
+            global_free(u, sizeof(*u), HEAPSTAT_HASHTABLE);
+        } else {
+            u->last_use = now;
+            u->next = list;
+            list = u;
+        }
+    }
+    symcache_used = NULL;
+    for (u = list; u != NULL; u = u->next)
+        total += u->size;
+    while (total > symcache_ops.max_dir_size) {
+        symcache_used_t *oldest = NULL, **oldest_prev = NULL;
+        for (prev = &list; *prev != NULL; prev = &(*prev)->next) {
+            if (!(*prev)->used &&
+                (oldest == NULL || (*prev)->last_use < oldest->last_use)) {
+                oldest = *prev;
+                oldest_prev = prev;
+            }
+        }
+        if (oldest == NULL)
+            break; /* only what we used ourselves is left */
+        LOG(1, "evicting symbol cache for %s to stay under the size budget\n",
+            oldest->modname);
+        symcache_get_filename(oldest->modname, SYMCACHE_BIN_SUFFIX,
+                              path_tmp, BUFFER_SIZE_ELEMENTS(path_tmp));
+        dr_delete_file(path_tmp);
+        symcache_get_filename(oldest->modname, SYMCACHE_JOURNAL_SUFFIX,
+                              path_tmp, BUFFER_SIZE_ELEMENTS(path_tmp));
+        dr_delete_file(path_tmp);
+        symcache_get_filename(oldest->modname, SYMCACHE_TEXT_SUFFIX,
+                              path_tmp, BUFFER_SIZE_ELEMENTS(path_tmp));
+        dr_delete_file(path_tmp);
+        total -= oldest->size;
+        *oldest_prev = oldest->next;
+        oldest->next = NULL;
+        symcache_free_used(oldest);
+    }
+
+    f = symcache_open_tmp(path, path_tmp, BUFFER_SIZE_ELEMENTS(path_tmp));
+    if (f != INVALID_FILE) {
+        dr_fprintf(f, "%s\n", SYMCACHE_INDEX_HEADER);
+        for (u = list; u != NULL; u = u->next) {
+            dr_fprintf(f, "%"UINT64_FORMAT_CODE" %"UINT64_FORMAT_CODE" %s\n",
+                       u->last_use, u->size, u->modname);
+        }
+        dr_close_file(f);
+        if (!dr_rename_file(path_tmp, path, /*replace*/true)) {
+            WARN("WARNING: Failed to rename the symbol cache index\n");
+            dr_delete_file(path_tmp);
+        }
+    }
+    symcache_free_used(list);
+}
+
 DR_EXPORT
 drmf_status_t
 drsymcache_init(client_id_t client_id,
                 const char *symcache_dir_in,
                 size_t modsize_cache_threshold)
+{
+    return drsymcache_init_ex(client_id, symcache_dir_in, modsize_cache_threshold,
+                              NULL);
+}
+
+DR_EXPORT
+drmf_status_t
+drsymcache_init_ex(client_id_t client_id,
+                   const char *symcache_dir_in,
+                   size_t modsize_cache_threshold,
+                   drsymcache_options_t *ops)
 {
 #ifdef WINDOWS
     module_data_t *mod;
@@ -661,6 +1701,13 @@ drsymcache_init(client_id_t client_id,
     if (res != DRMF_SUCCESS)
         return res;
 
+    if (ops != NULL) {
+        if (ops->struct_size > sizeof(symcache_ops))
+            return DRMF_ERROR_INCOMPATIBLE_VERSION;
+        memcpy(&symcache_ops, ops, ops->struct_size); /* Leave rest 0 */
+    }
+    symcache_used_lock = dr_mutex_create();
+
     drmgr_init();
     drmgr_register_module_load_event_ex(symcache_module_load, &pri_mod_load_cache);
     drmgr_register_module_unload_event_ex(symcache_module_unload, &pri_mod_unload_cache);
@@ -674,7 +1721,7 @@ drsymcache_init(client_id_t client_id,
                       IF_WINDOWS_ELSE(HASH_STRING_NOCASE, HASH_STRING),
                       true/*strdup*/, false/*!synch*/,
                       symcache_free_entry, NULL, NULL);
-    symcache_lock = dr_mutex_create();
+    symcache_lock = dr_rwlock_create();
 
     dr_snprintf(symcache_dir, BUFFER_SIZE_ELEMENTS(symcache_dir),
                 "%s", symcache_dir_in);
@@ -728,17 +1775,27 @@ drsymcache_exit(void)
     if (!initialized)
         return DRMF_ERROR_NOT_INITIALIZED;
 
-    dr_mutex_lock(symcache_lock);
+    dr_rwlock_write_lock(symcache_lock);
     for (i = 0; i < HASHTABLE_SIZE(symcache_table.table_bits); i++) {
         hash_entry_t *he;
         for (he = symcache_table.table[i]; he != NULL; he = he->next) {
             mod_cache_t *modcache = (mod_cache_t *) he->payload;
             symcache_write_symfile(modcache->modname, modcache);
+            if (symcache_ops.max_dir_size > 0 && modcache->disk_size > 0) {
+                symcache_note_used(modcache->modname,
+                                   modcache->disk_size + modcache->journal_size);
+            }
         }
     }
     hashtable_delete(&symcache_table);
-    dr_mutex_unlock(symcache_lock);
-    dr_mutex_destroy(symcache_lock);
+    dr_rwlock_write_unlock(symcache_lock);
+    dr_rwlock_destroy(symcache_lock);
+
+    if (symcache_ops.max_dir_size > 0)
+        symcache_enforce_budget();
+    symcache_free_used(symcache_used);
+    symcache_used = NULL;
+    dr_mutex_destroy(symcache_used_lock);
 
     drmgr_unregister_module_load_event(symcache_module_load);
     drmgr_unregister_module_unload_event(symcache_module_unload);
@@ -787,17 +1844,18 @@ symcache_module_load(void *drcontext, const module_data_t *mod, bool loaded)
     }
 
     /* support initializing prior to module events => called twice */
-    dr_mutex_lock(symcache_lock);
+    dr_rwlock_read_lock(symcache_lock);
     modcache = (mod_cache_t *) hashtable_lookup(&symcache_table,
                                                 (void *)mod->full_path);
-    dr_mutex_unlock(symcache_lock);
+    dr_rwlock_read_unlock(symcache_lock);
     if (modcache != NULL) /* already there: e.g., ntdll, which we add early */
         return;
 
     modcache = (mod_cache_t *) global_alloc(sizeof(*modcache), HEAPSTAT_HASHTABLE);
     memset(modcache, 0, sizeof(*modcache));
+    modcache->lock = dr_rwlock_create();
     hashtable_init_ex(&modcache->table, SYMCACHE_MODULE_TABLE_HASH_BITS,
-                      HASH_STRING, true/*strdup*/, false/*!synch: using global synch*/,
+                      HASH_STRING, true/*strdup*/, false/*!synch: using modcache->lock*/,
                       symcache_free_list, NULL, NULL);
 
     /* store consistency fields */
@@ -830,17 +1888,19 @@ symcache_module_load(void *drcontext, const module_data_t *mod, bool loaded)
     modcache->modname = drmem_strdup(modname, HEAPSTAT_HASHTABLE);
     modcache->from_file = symcache_read_symfile(mod, modname, modcache);
 
-    dr_mutex_lock(symcache_lock);
+    dr_rwlock_write_lock(symcache_lock);
     if (!hashtable_add(&symcache_table, (void *)mod->full_path, (void *)modcache)) {
         /* this should be really rare to have dup paths (xref i#729) -- and
          * actually we now have a lookup up above so we should only get here
          * on a race while we let go of the lock
          */
         WARN("WARNING: duplicate module paths: only caching symbols from first\n");
+        symcache_unmap(modcache);
         hashtable_delete(&modcache->table);
+        dr_rwlock_destroy(modcache->lock);
         global_free(modcache, sizeof(*modcache), HEAPSTAT_HASHTABLE);
     }
-    dr_mutex_unlock(symcache_lock);
+    dr_rwlock_write_unlock(symcache_lock);
 }
 
 static drmf_status_t
@@ -852,14 +1912,31 @@ symcache_module_save_common(const module_data_t *mod, bool remove)
         return DRMF_ERROR_INVALID_PARAMETER; /* don't support caching */
     if (!initialized)
         return DRMF_ERROR_NOT_INITIALIZED;
-    dr_mutex_lock(symcache_lock);
+    /* Removal frees modcache, which needs every other user out */
+    if (remove)
+        dr_rwlock_write_lock(symcache_lock);
+    else
+        dr_rwlock_read_lock(symcache_lock);
     modcache = (mod_cache_t *) hashtable_lookup(&symcache_table, (void *)mod->full_path);
     if (modcache != NULL) {
-        symcache_write_symfile(modname, modcache);
-        if (remove)
+        uint64 size;
+        if (remove) {
+            symcache_write_symfile(modname, modcache);
+            size = modcache->disk_size + modcache->journal_size;
             hashtable_remove(&symcache_table, (void *)mod->full_path);
+        } else {
+            dr_rwlock_write_lock(modcache->lock);
+            symcache_write_symfile(modname, modcache);
+            size = modcache->disk_size + modcache->journal_size;
+            dr_rwlock_write_unlock(modcache->lock);
+        }
+        if (symcache_ops.max_dir_size > 0 && size > 0)
+            symcache_note_used(modname, size);
     }
-    dr_mutex_unlock(symcache_lock);
+    if (remove)
+        dr_rwlock_write_unlock(symcache_lock);
+    else
+        dr_rwlock_read_unlock(symcache_lock);
     return DRMF_SUCCESS;
 }
 
@@ -894,13 +1971,17 @@ symcache_module_has_data(const module_data_t *mod, bool require_syms, bool *res)
         return DRMF_ERROR_INVALID_PARAMETER; /* don't support caching */
     if (!initialized)
         return DRMF_ERROR_NOT_INITIALIZED;
-    dr_mutex_lock(symcache_lock);
+    dr_rwlock_read_lock(symcache_lock);
     modcache = (mod_cache_t *) hashtable_lookup(&symcache_table, (void *)mod->full_path);
     if (modcache != NULL) {
-        *res = (modcache->table.entries > 0 &&
-                (!require_syms || modcache->has_debug_info));
+        uint entries;
+        dr_rwlock_read_lock(modcache->lock);
+        entries = (modcache->map != NULL ? modcache->map->num_syms : 0) +
+            modcache->table.entries;
+        *res = (entries > 0 && (!require_syms || modcache->has_debug_info));
+        dr_rwlock_read_unlock(modcache->lock);
     }
-    dr_mutex_unlock(symcache_lock);
+    dr_rwlock_read_unlock(symcache_lock);
     return DRMF_SUCCESS;
 }
 
@@ -937,17 +2018,18 @@ drsymcache_add(const module_data_t *mod, const char *symbol, size_t offs)
         return DRMF_ERROR_INVALID_PARAMETER;
     if (!initialized)
         return DRMF_ERROR_NOT_INITIALIZED;
-    dr_mutex_lock(symcache_lock);
+    dr_rwlock_read_lock(symcache_lock);
     modcache = (mod_cache_t *) hashtable_lookup(&symcache_table, (void *)mod->full_path);
     if (modcache == NULL) {
         LOG(2, "%s: there is no cache for %s\n", __FUNCTION__, modname);
-        dr_mutex_unlock(symcache_lock);
+        dr_rwlock_read_unlock(symcache_lock);
         return DRMF_ERROR_NOT_FOUND;
     }
-    if (symcache_symbol_add(modname, &modcache->table, symbol, offs) &&
-        modcache->from_file)
-        modcache->appended = true;
-    dr_mutex_unlock(symcache_lock);
+    dr_rwlock_write_lock(modcache->lock);
+    if (symcache_table_add(modcache, symbol, offs, false/*ours*/))
+        symcache_pending_add(modcache, symbol, offs);
+    dr_rwlock_write_unlock(modcache->lock);
+    dr_rwlock_read_unlock(symcache_lock);
     return DRMF_SUCCESS;
 }
 
@@ -959,7 +2041,10 @@ drsymcache_lookup(const module_data_t *mod, const char *symbol,
     offset_list_t *olist;
     offset_entry_t *e;
     mod_cache_t *modcache;
+    const symcache_bin_sym_t *sym;
     uint i;
+    bool refreshed = false, write_locked = false;
+    drmf_status_t res = DRMF_ERROR_NOT_FOUND;
     const char *modname = dr_module_preferred_name(mod);
     if (modname == NULL)
         return DRMF_ERROR_INVALID_PARAMETER; /* don't support caching */
@@ -968,18 +2053,56 @@ drsymcache_lookup(const module_data_t *mod, const char *symbol,
     if (symbol == NULL || offs_array == NULL || num_entries == NULL ||
         offs_single == NULL)
         return DRMF_ERROR_INVALID_PARAMETER;
-    dr_mutex_lock(symcache_lock);
+    dr_rwlock_read_lock(symcache_lock);
     modcache = (mod_cache_t *) hashtable_lookup(&symcache_table, (void *)mod->full_path);
     if (modcache == NULL) {
-        dr_mutex_unlock(symcache_lock);
+        dr_rwlock_read_unlock(symcache_lock);
         return DRMF_ERROR_NOT_FOUND;
     }
+    /* Hits only read, so concurrent lookups share the module's lock.  The
+     * queried flags for negative entries are set under the read lock, which is
+     * fine as every racing store writes true.
+     */
+    dr_rwlock_read_lock(modcache->lock);
+ drsymcache_lookup_retry:
+    sym = NULL;
     olist = (offset_list_t *) hashtable_lookup(&modcache->table, (void *)symbol);
-    if (olist == NULL) {
-        dr_mutex_unlock(symcache_lock);
-        return DRMF_ERROR_NOT_FOUND;
+    if (olist != NULL && symcache_olist_is_negative(olist) && modcache->map != NULL) {
+        /* A file another process has since written may have resolved it */
+        sym = symcache_bin_lookup(modcache, symbol);
+        if (sym != NULL && (sym->num_offs > 1 ||
+                            symcache_bin_offs(modcache->map)[sym->first_offs] != 0))
+            olist = NULL;
+    }
+    if (olist == NULL && modcache->map != NULL) {
+        const uint *offs;
+        if (sym == NULL)
+            sym = symcache_bin_lookup(modcache, symbol);
+        if (sym == NULL)
+            goto drsymcache_lookup_miss;
+        offs = symcache_bin_offs(modcache->map) + sym->first_offs;
+        if (sym->num_offs == 1 && offs[0] == 0 && modcache->map_queried != NULL)
+            modcache->map_queried[sym - symcache_bin_syms(modcache->map)] = 1;
+        if (sym->num_offs == 1)
+            *offs_array = offs_single;
+        else {
+            *offs_array = (size_t *) global_alloc(sym->num_offs * sizeof(size_t),
+                                                  HEAPSTAT_HASHTABLE);
+        }
+        *num_entries = sym->num_offs;
+        for (i = 0; i < sym->num_offs; i++) {
+            (*offs_array)[i] = offs[i];
+            LOG(2, "sym lookup of %s in %s => symcache hit %d of %d == "PIFX"\n",
+                symbol, mod->full_path, i, sym->num_offs, (ptr_uint_t)offs[i]);
+        }
+        res = DRMF_SUCCESS;
+        goto drsymcache_lookup_done;
     }
+    if (olist == NULL)
+        goto drsymcache_lookup_miss;
     ASSERT(olist->num > 0, "empty list not allowed");
+    if (symcache_olist_is_negative(olist))
+        olist->queried = true;
     if (olist->num == 1)
         *offs_array = offs_single;
     else {
@@ -993,8 +2116,30 @@ drsymcache_lookup(const module_data_t *mod, const char *symbol,
         LOG(2, "sym lookup of %s in %s => symcache hit %d of %d == "PIFX"\n",
             symbol, mod->full_path, i, olist->num, e->offs);
     }
-    dr_mutex_unlock(symcache_lock);
-    return DRMF_SUCCESS;
+    res = DRMF_SUCCESS;
+    goto drsymcache_lookup_done;
+
+ drsymcache_lookup_miss:
+    /* On a miss we check whether another process has since resolved the symbol.
+     * That can replace the view or fill the table, so it needs the write lock.
+     * Another thread may have refreshed while we had no lock, which
+     * symcache_refresh() notices from the file size.
+     */
+    if (!refreshed) {
+        refreshed = true;
+        dr_rwlock_read_unlock(modcache->lock);
+        dr_rwlock_write_lock(modcache->lock);
+        write_locked = true;
+        symcache_refresh(modcache);
+        goto drsymcache_lookup_retry;
+    }
+ drsymcache_lookup_done:
+    if (write_locked)
+        dr_rwlock_write_unlock(modcache->lock);
+    else
+        dr_rwlock_read_unlock(modcache->lock);
+    dr_rwlock_read_unlock(symcache_lock);
+    return res;
 }
 
 DR_EXPORT
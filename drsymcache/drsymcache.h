@@ -102,6 +102,43 @@ drsymcache_init(client_id_t client_id,
                 const char *drsymcache_dir,
                 size_t modsize_cache_threshold);
 
+/** Specifies optional parameters for drsymcache_init_ex(). */
+typedef struct _drsymcache_options_t {
+    /** For compatibility. Set to sizeof(drsymcache_options_t). */
+    size_t struct_size;
+    /**
+     * If non-zero, a budget in bytes for the cache files in the cache directory.
+     * At drsymcache_exit(), the files of the least recently used modules not
+     * used by this process are deleted until the files of the modules
+     * recorded in the directory's index fit in the budget.
+     */
+    uint64 max_dir_size;
+    /**
+     * If non-zero, a negative entry (a symbol recorded as not present) is
+     * dropped from a module's cache file once this many rewrites of the file
+     * in a row have been by processes that did not query it.
+     */
+    uint negative_runs;
+} drsymcache_options_t;
+
+DR_EXPORT
+/**
+ * Identical to drsymcache_init() but takes additional options.
+ *
+ * @param[in]  client_id  The id of the client using drsymcache, as passed to dr_init().
+ * @param[in]  drsymcache_dir  The directory in which to store symbol cache files.
+ * @param[in]  modsize_cache_threshold   The minimum module size for which symbols
+ *    should be cached.
+ * @param[in]  ops  Additional options, or NULL for the defaults.
+ *
+ * \return success code.
+ */
+drmf_status_t
+drsymcache_init_ex(client_id_t client_id,
+                   const char *drsymcache_dir,
+                   size_t modsize_cache_threshold,
+                   drsymcache_options_t *ops);
+
 DR_EXPORT
 /**
  * Cleans up drsymcache.
@@ -298,17 +298,292 @@ sysnum_cmp(void *v1, void *v2)
     return drsys_sysnums_equal(num1, num2);
 }
 
+/* Direct-indexed form of systable and secondary_systable, rebuilt from the
+ * hashtables whenever their contents change (only at init, except on Windows
+ * with unknown syscall numbers where entries are added at module load).  Each
+ * primary number below SYSTABLE_DIRECT_MAX has a slot holding its entry plus
+ * the secondary entries sharing that number sorted by secondary component.
+ * Numbers outside the range, and the rare primary number with more than one
+ * hashtable entry, are looked up in the hashtables as before.
+ *
+ * A slot with many secondary entries, such as Linux ioctl with its few hundred
+ * request codes, also gets an open-addressing index from secondary component
+ * to entry, so that a lookup usually costs one probe rather than a binary
+ * search.  An ioctl request code's type and number are in its low 16 bits,
+ * and these are nearly unique on their own, so the hash folds the size and
+ * direction bits into them.
+ */
+#define SYSTABLE_DIRECT_MAX 0x4000
+#define SYSTABLE_INDEX_MIN_SECONDARY 16
+
+typedef struct _systable_slot_t {
+    syscall_info_t *primary;
+    bool use_hashtable; /* conflicting primary entries for this number */
+    uint num_secondary;
+    syscall_info_t **secondary; /* sorted by num.secondary */
+    /* If non-NULL, 1 + the position in secondary[] or 0 for empty */
+    ushort *index;
+    uint index_bits;
+} systable_slot_t;
+
+typedef struct _systable_direct_t {
+    uint size; /* number of slots */
+    uint entries; /* hashtable entries this was built from */
+    systable_slot_t *slots;
+    syscall_info_t **secondary_storage;
+    uint secondary_count;
+    ushort *index_storage;
+    uint index_count;
+    /* Superseded tables can still be in use by lock-free lookups and are only
+     * freed at exit.
+     */
+    struct _systable_direct_t *retired;
+} systable_direct_t;
+
+static systable_direct_t * volatile systable_direct;
+static int systable_direct_builds;
+
+static void
+systable_direct_free(systable_direct_t *table)
+{
+    while (table != NULL) {
+        systable_direct_t *next = table->retired;
+        if (table->secondary_storage != NULL) {
+            global_free(table->secondary_storage,
+                        table->secondary_count * sizeof(*table->secondary_storage),
+                        HEAPSTAT_MISC);
+        }
+        if (table->index_storage != NULL) {
+            global_free(table->index_storage,
+                        table->index_count * sizeof(*table->index_storage),
+                        HEAPSTAT_MISC);
+        }
+        if (table->slots != NULL)
+            global_free(table->slots, table->size * sizeof(*table->slots), HEAPSTAT_MISC);
+        global_free(table, sizeof(*table), HEAPSTAT_MISC);
+        table = next;
+    }
+}
+
+static inline uint
+systable_index_hash(int secondary, uint bits)
+{
+    uint key = (uint)secondary;
+    return ((key ^ (key >> 16)) * 0x9e3779b1) >> (32 - bits);
+}
+
+/* Builds the secondary index of each slot with enough secondary entries */
+static void
+systable_direct_index(systable_direct_t *table)
+{
+    uint i, j, pos = 0;
+    for (i = 0; i < table->size; i++) {
+        systable_slot_t *slot = &table->slots[i];
+        if (slot->num_secondary < SYSTABLE_INDEX_MIN_SECONDARY)
+            continue;
+        /* At most half full, so probe sequences stay short */
+        for (slot->index_bits = 1; (1U << slot->index_bits) < 2 * slot->num_secondary;
+             slot->index_bits++)
+            ; /* nothing */
+        table->index_count += 1U << slot->index_bits;
+    }
+    if (table->index_count == 0)
+        return;
+    table->index_storage =
+        global_alloc(table->index_count * sizeof(*table->index_storage), HEAPSTAT_MISC);
+    memset(table->index_storage, 0, table->index_count * sizeof(*table->index_storage));
+    for (i = 0; i < table->size; i++) {
+        systable_slot_t *slot = &table->slots[i];
+        uint mask;
+        if (slot->num_secondary < SYSTABLE_INDEX_MIN_SECONDARY)
+            continue;
+        ASSERT(slot->num_secondary < USHRT_MAX, "secondary index overflow");
+        slot->index = table->index_storage + pos;
+        pos += 1U << slot->index_bits;
+        mask = (1U << slot->index_bits) - 1;
+        for (j = 0; j < slot->num_secondary; j++) {
+            uint h = systable_index_hash(slot->secondary[j]->num.secondary,
+                                         slot->index_bits);
+            while (slot->index[h] != 0)
+                h = (h + 1) & mask;
+            slot->index[h] = (ushort)(j + 1);
+        }
+    }
+}
+
+static syscall_info_t *
+systable_slot_secondary(systable_slot_t *slot, int secondary)
+{
+    if (slot->index != NULL) {
+        uint mask = (1U << slot->index_bits) - 1;
+        uint h = systable_index_hash(secondary, slot->index_bits);
+        ushort pos;
+        while ((pos = slot->index[h]) != 0) {
+            syscall_info_t *info = slot->secondary[pos - 1];
+            if (info->num.secondary == secondary)
+                return info;
+            h = (h + 1) & mask;
+        }
+    } else {
+        uint lo = 0, hi = slot->num_secondary;
+        while (lo < hi) {
+            uint mid = (lo + hi) / 2;
+            syscall_info_t *info = slot->secondary[mid];
+            if (info->num.secondary == secondary)
+                return info;
+            if ((uint)info->num.secondary < (uint)secondary)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+    return NULL;
+}
+
+/* Rebuilds the direct tables if the hashtables have changed since the last
+ * build.  Must be called after any additions to the hashtables.
+ */
+void
+syscall_lookup_update(void)
+{
+    systable_direct_t *table, *cur;
+    uint i, max = 0, pos = 0;
+    dr_recurlock_lock(systable_lock);
+    cur = systable_direct;
+    if (cur != NULL && cur->entries == systable.entries + secondary_systable.entries) {
+        dr_recurlock_unlock(systable_lock);
+        return;
+    }
+    for (i = 0; i < HASHTABLE_SIZE(systable.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = systable.table[i]; he != NULL; he = he->next) {
+            syscall_info_t *info = (syscall_info_t *) he->payload;
+            if (info->num.number >= 0 && info->num.number < SYSTABLE_DIRECT_MAX &&
+                (uint)info->num.number >= max)
+                max = info->num.number + 1;
+        }
+    }
+    for (i = 0; i < HASHTABLE_SIZE(secondary_systable.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = secondary_systable.table[i]; he != NULL; he = he->next) {
+            syscall_info_t *info = (syscall_info_t *) he->payload;
+            if (info->num.number >= 0 && info->num.number < SYSTABLE_DIRECT_MAX &&
+                (uint)info->num.number >= max)
+                max = info->num.number + 1;
+        }
+    }
+    table = global_alloc(sizeof(*table), HEAPSTAT_MISC);
+    memset(table, 0, sizeof(*table));
+    table->size = max;
+    table->entries = systable.entries + secondary_systable.entries;
+    table->retired = cur;
+    if (max > 0) {
+        table->slots = global_alloc(max * sizeof(*table->slots), HEAPSTAT_MISC);
+        memset(table->slots, 0, max * sizeof(*table->slots));
+    }
+    for (i = 0; i < HASHTABLE_SIZE(systable.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = systable.table[i]; he != NULL; he = he->next) {
+            syscall_info_t *info = (syscall_info_t *) he->payload;
+            systable_slot_t *slot;
+            if (info->num.number < 0 || (uint)info->num.number >= max)
+                continue;
+            slot = &table->slots[info->num.number];
+            if (slot->primary != NULL)
+                slot->use_hashtable = true;
+            slot->primary = info;
+        }
+    }
+    /* Secondary entries: count per slot, then carve up one array */
+    for (i = 0; i < HASHTABLE_SIZE(secondary_systable.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = secondary_systable.table[i]; he != NULL; he = he->next) {
+            syscall_info_t *info = (syscall_info_t *) he->payload;
+            if (info->num.number < 0 || (uint)info->num.number >= max)
+                continue;
+            table->slots[info->num.number].num_secondary++;
+            table->secondary_count++;
+        }
+    }
+    if (table->secondary_count > 0) {
+        table->secondary_storage =
+            global_alloc(table->secondary_count * sizeof(*table->secondary_storage),
+                         HEAPSTAT_MISC);
+    }
+    for (i = 0; i < max; i++) {
+        systable_slot_t *slot = &table->slots[i];
+        if (slot->num_secondary > 0) {
+            slot->secondary = table->secondary_storage + pos;
+            pos += slot->num_secondary;
+            slot->num_secondary = 0; /* re-counted as filled in */
+        }
+    }
+    for (i = 0; i < HASHTABLE_SIZE(secondary_systable.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = secondary_systable.table[i]; he != NULL; he = he->next) {
+            syscall_info_t *info = (syscall_info_t *) he->payload;
+            systable_slot_t *slot;
+            uint j;
+            if (info->num.number < 0 || (uint)info->num.number >= max)
+                continue;
+            slot = &table->slots[info->num.number];
+            /* Insertion sort: this is once per build and the lists are short,
+             * apart from ioctl's few hundred.
+             */
+            for (j = slot->num_secondary;
+                 j > 0 && (uint)slot->secondary[j-1]->num.secondary >
+                     (uint)info->num.secondary; j--)
+                slot->secondary[j] = slot->secondary[j-1];
+            slot->secondary[j] = info;
+            slot->num_secondary++;
+        }
+    }
+    systable_direct_index(table);
+    LOG(2, "syscall direct table: %u numbers, %u secondary entries, %u index slots\n",
+        max, table->secondary_count, table->index_count);
+    /* The atomic op orders the table contents before the pointer that
+     * lock-free lookups read.
+     */
+    dr_atomic_add32_return_sum(&systable_direct_builds, 1);
+    systable_direct = table;
+    dr_recurlock_unlock(systable_lock);
+}
+
+static void
+syscall_lookup_exit(void)
+{
+    systable_direct_free(systable_direct);
+    systable_direct = NULL;
+}
+
 syscall_info_t *
 syscall_lookup(drsys_sysnum_t num, bool resolve_secondary)
 {
     /* The common case is lookup for syscalls without secondary component,
-     * which requires only one hashtable lookup. So we pay a cost of second
-     * lookup only if user queries it.
+     * which requires only one array index. So we pay a cost of the secondary
+     * search only if user queries it.
      */
     syscall_info_t *res = NULL;
-    /* First we look for secondary table to avoid collision with primary table
-     * in case when user looks for secondary table for entry with .0 secondary num.
-     */
+    systable_direct_t *table = systable_direct;
+    if (table != NULL && num.number >= 0 && (uint)num.number < table->size) {
+        systable_slot_t *slot = &table->slots[num.number];
+        /* As with the hashtables, we look in the secondary entries first in
+         * case the user looks for a secondary entry with .0 secondary num.
+         */
+        if (resolve_secondary && slot->num_secondary > 0) {
+            res = systable_slot_secondary(slot, num.secondary);
+            if (res != NULL)
+                return res;
+        }
+        if (!slot->use_hashtable) {
+            if (slot->primary != NULL &&
+                drsys_sysnums_equal(&slot->primary->num, &num))
+                return slot->primary;
+            return NULL;
+        }
+        /* Fall through for a conflicting primary number */
+        resolve_secondary = false;
+    }
     dr_recurlock_lock(systable_lock);
     if (resolve_secondary) {
         res = (syscall_info_t *) hashtable_lookup(&secondary_systable, (void *) &num);
@@ -325,6 +600,13 @@ syscall_lookup(drsys_sysnum_t num, bool resolve_secondary)
  */
 
 static const byte UNKNOWN_SYSVAL_SENTINEL = 0xab;
+/* Unknown syscall params are compared in chunks of this many bytes, so that
+ * unchanged memory (usually most of it) costs no per-byte shadow queries.
+ */
+#define UNKNOWN_SYSARG_STRIDE 16
+
+#define SYSARG_VAL_ARENA_SIZE (SYSCALL_NUM_ARG_TRACK * SYSCALL_ARG_TRACK_MAX_SZ)
+#define SYSARG_VAL(cpt, i) ((cpt)->sysarg_val_arena + (i) * SYSCALL_ARG_TRACK_MAX_SZ)
 
 static const syscall_info_t unknown_info_template =
     {{0,0},"<unknown>", 0/*UNKNOWN*/, DRSYS_TYPE_UNKNOWN, };
@@ -340,6 +622,29 @@ drsys_syscall_is_known(drsys_syscall_t *syscall, bool *known OUT)
     return DRMF_SUCCESS;
 }
 
+DR_EXPORT
+drmf_status_t
+drsys_syscall_is_memarg_free(drsys_syscall_t *syscall, bool *memarg_free OUT)
+{
+    syscall_info_t *sysinfo = (syscall_info_t *) syscall;
+    int i;
+    if (syscall == NULL || memarg_free == NULL)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    *memarg_free = false;
+    if (!TEST(SYSINFO_ALL_PARAMS_KNOWN, sysinfo->flags) ||
+        TEST(SYSINFO_SECONDARY_TABLE, sysinfo->flags) ||
+        os_syscall_has_custom_handling(sysinfo->num))
+        return DRMF_SUCCESS;
+    for (i = 0; i < MAX_ARGS_IN_ENTRY; i++) {
+        if (sysarg_invalid(&sysinfo->arg[i]))
+            break;
+        if (!TESTANY(SYSARG_INLINED | SYSARG_NON_MEMARG, sysinfo->arg[i].flags))
+            return DRMF_SUCCESS;
+    }
+    *memarg_free = true;
+    return DRMF_SUCCESS;
+}
+
 static bool
 is_byte_addressable(byte *addr)
 {
@@ -420,24 +725,28 @@ handle_pre_unknown_syscall(void *drcontext, cls_syscall_t *cpt,
                 /* This looks like a memory parameter.  It might contain OUT
                  * values mixed with IN, so we do not stop at the first undefined
                  * byte: instead we stop at an unaddr or at the max size.
-                 * We need two passes to know how far we can safely read,
-                 * so we go ahead and use dynamically sized memory as well.
+                 * We need two passes to know how far we can safely read, and
+                 * then copy into this arg's slot of the thread's arena.
                  */
                 byte *s_at = NULL;
                 int prev;
-                bool overlap = false;
-                for (j=0; j<SYSCALL_ARG_TRACK_MAX_SZ; j++) {
-                    for (prev=0; prev<i; prev++) {
-                        if (cpt->sysarg_ptr[prev] < start + j &&
-                            cpt->sysarg_ptr[prev] + cpt->sysarg_sz[prev] > start) {
-                            /* overlap w/ prior arg.  while we could miss some
-                             * data due to the max sz we just bail for simplicity.
-                             */
-                            overlap = true;
-                            break;
-                        }
+                int max_sz = SYSCALL_ARG_TRACK_MAX_SZ;
+                /* Stop at the first overlap w/ a prior arg.  While we could miss
+                 * some data due to the max sz we just bail for simplicity.
+                 * The overlap does not depend on the addressability scan, so we
+                 * find it up front rather than re-checking every arg per byte.
+                 */
+                for (prev=0; prev<i; prev++) {
+                    if (cpt->sysarg_ptr[prev] != NULL &&
+                        cpt->sysarg_ptr[prev] + cpt->sysarg_sz[prev] > start) {
+                        if (cpt->sysarg_ptr[prev] < start)
+                            max_sz = 0;
+                        else if (cpt->sysarg_ptr[prev] - start + 1 < max_sz)
+                            max_sz = (int)(cpt->sysarg_ptr[prev] - start + 1);
                     }
-                    if (overlap || !is_byte_addressable(start + j))
+                }
+                for (j=0; j<max_sz; j++) {
+                    if (!is_byte_addressable(start + j))
                         break;
                 }
                 if (j > 0) {
@@ -445,18 +754,11 @@ handle_pre_unknown_syscall(void *drcontext, cls_syscall_t *cpt,
                         "pre-unknown-syscall #"PIFX": param %d == "PFX" %d bytes\n",
                         sysnum, i, start, j);
                     /* Make a copy of the arg values */
-                    if (j > cpt->sysarg_val_bytes[i]) {
-                        if (cpt->sysarg_val_bytes[i] > 0) {
-                            thread_free(drcontext, cpt->sysarg_val[i],
-                                        cpt->sysarg_val_bytes[i], HEAPSTAT_MISC);
-                        } else
-                            ASSERT(cpt->sysarg_val[i] == NULL, "leak");
-                        cpt->sysarg_val_bytes[i] = ALIGN_FORWARD(j, 64);
-                        cpt->sysarg_val[i] =
-                            thread_alloc(drcontext, cpt->sysarg_val_bytes[i],
-                                         HEAPSTAT_MISC);
+                    if (cpt->sysarg_val_arena == NULL) {
+                        cpt->sysarg_val_arena = (byte *)
+                            thread_alloc(drcontext, SYSARG_VAL_ARENA_SIZE, HEAPSTAT_MISC);
                     }
-                    if (safe_read(start, j, cpt->sysarg_val[i])) {
+                    if (safe_read(start, j, SYSARG_VAL(cpt, i))) {
                         cpt->sysarg_ptr[i] = start;
                         cpt->sysarg_sz[i] = j;
                     } else {
@@ -521,6 +823,24 @@ handle_post_unknown_syscall(void *drcontext, cls_syscall_t *cpt,
             if (safe_read(cpt->sysarg_ptr[i], cpt->sysarg_sz[i], post_val)) {
                 for (j = 0; j < cpt->sysarg_sz[i]; j++) {
                     byte *pc = cpt->sysarg_ptr[i] + j;
+                    /* Without sentinels an unchanged byte is never a write, and
+                     * there is nothing to restore, so skip whole unchanged
+                     * strides without querying the shadow of each byte.
+                     */
+                    if (!drsys_ops.syscall_sentinels &&
+                        ALIGNED(j, UNKNOWN_SYSARG_STRIDE) &&
+                        j + UNKNOWN_SYSARG_STRIDE <= cpt->sysarg_sz[i] &&
+                        memcmp(post_val + j, SYSARG_VAL(cpt, i) + j,
+                               UNKNOWN_SYSARG_STRIDE) == 0) {
+                        if (ii == NULL && w_at != NULL) {
+                            LOG(SYSCALL_VERBOSE, "unknown-syscall #"SYSNUM_FMT
+                                ": param %d written "PFX" %d bytes\n", 0,
+                                i, w_at, pc - w_at);
+                            w_at = NULL;
+                        }
+                        j += UNKNOWN_SYSARG_STRIDE - 1;
+                        continue;
+                    }
                     if (is_byte_undefined(pc)) {
                         /* kernel could have written sentinel.
                          * XXX: we won't mark as defined if pre-syscall value
@@ -528,11 +848,11 @@ handle_post_unknown_syscall(void *drcontext, cls_syscall_t *cpt,
                          */
                         LOG(4, "\targ %d "PFX" %d comparing %x to %x\n", i,
                             cpt->sysarg_ptr[i], j,
-                            post_val[j], cpt->sysarg_val[i][j]);
+                            post_val[j], SYSARG_VAL(cpt, i)[j]);
                         if ((drsys_ops.syscall_sentinels &&
                              post_val[j] != UNKNOWN_SYSVAL_SENTINEL) ||
                             (!drsys_ops.syscall_sentinels &&
-                             post_val[j] != cpt->sysarg_val[i][j])) {
+                             post_val[j] != SYSARG_VAL(cpt, i)[j])) {
                             if (w_at == NULL)
                                 w_at = pc;
                             /* With no other threads this would still be undefined,
@@ -558,12 +878,12 @@ handle_post_unknown_syscall(void *drcontext, cls_syscall_t *cpt,
                             }
                         } else if (ii == NULL /* => restore */) {
                             if (post_val[j] == UNKNOWN_SYSVAL_SENTINEL &&
-                                cpt->sysarg_val[i][j] != UNKNOWN_SYSVAL_SENTINEL) {
+                                SYSARG_VAL(cpt, i)[j] != UNKNOWN_SYSVAL_SENTINEL) {
                                 /* kernel didn't write so restore app value that
                                  * we clobbered w/ our sentinel.
                                  */
                                 LOG(4, "restoring app sysval @"PFX"\n", pc);
-                                if (!dr_safe_write(pc, 1, &cpt->sysarg_val[i][j],
+                                if (!dr_safe_write(pc, 1, &SYSARG_VAL(cpt, i)[j],
                                                    NULL)) {
                                     LOG(1, "WARNING: unable to restore app sysval @"PFX"\n",
                                         pc);
@@ -1401,6 +1721,142 @@ should_ignore_arg(cls_syscall_t *pt, sysarg_iter_info_t *ii,
             SYSARG_AS_PTR(pt, sysinfo->arg[if_null_arg].param, app_pc) == NULL);
 }
 
+/* What drsys_iterate_args_common() reports for each parameter that does not
+ * depend on the syscall instance.
+ */
+typedef struct _sysarg_param_plan_t {
+    drsys_param_type_t type;
+    drsys_param_mode_t mode;
+    const char *enum_name;
+    ushort size;
+    bool inlined;
+} sysarg_param_plan_t;
+
+/* Rather than re-evaluating every entry's flags on each syscall, the first
+ * time a syscall is processed we record which of its arg entries the pre- and
+ * post-syscall walks act on, and which of those have a plain immediate size
+ * that needs no sysarg_get_size() call.  The walks then visit only those.
+ * We also record each parameter's static description for the arg iterator.
+ */
+typedef struct _sysarg_plan_t {
+    byte num_pre;
+    byte pre[MAX_ARGS_IN_ENTRY]; /* indices into sysinfo->arg[] */
+    byte num_post;
+    byte post[MAX_ARGS_IN_ENTRY];
+    bool immed_size[MAX_ARGS_IN_ENTRY];
+    sysarg_param_plan_t param[SYSCALL_NUM_ARG_STORE]; /* indexed by ordinal */
+    struct _sysarg_plan_t *next; /* for freeing at exit */
+} sysarg_plan_t;
+
+static sysarg_plan_t *sysarg_plans;
+static int sysarg_plan_count;
+
+static bool
+sysarg_size_is_immed(sysinfo_arg_t *arg)
+{
+    return (arg->size > 0 &&
+            !TESTANY(SYSARG_LENGTH_INOUT | SYSARG_POST_SIZE_IO_STATUS |
+                     SYSARG_SIZE_PLUS_1 | SYSARG_SIZE_IN_ELEMENTS, arg->flags));
+}
+
+static void
+sysarg_plan_params(syscall_info_t *sysinfo, sysarg_plan_t *plan)
+{
+    int i, compacted;
+    ASSERT(sysinfo->arg_count <= SYSCALL_NUM_ARG_STORE, "too many params");
+    for (i = 0, compacted = 0; i < sysinfo->arg_count; i++) {
+        sysarg_param_plan_t *param = &plan->param[i];
+        param->size = sizeof(void*);
+        param->type = DRSYS_TYPE_UNKNOWN;
+        param->mode = DRSYS_PARAM_IN;
+        param->enum_name = NULL;
+        /* FIXME i#1089: add type info for the non-memory-complex-type args */
+        if (!sysarg_invalid(&sysinfo->arg[compacted]) &&
+            sysinfo->arg[compacted].param == i) {
+            if (SYSARG_MISC_HAS_TYPE(sysinfo->arg[compacted].flags)) {
+                param->type = type_from_arg_info(&sysinfo->arg[compacted]);
+            } else if (!TEST(SYSARG_INLINED, sysinfo->arg[compacted].flags)) {
+                /* Rather than clutter up the tables with DRSYS_TYPE_STRUCT
+                 * for all the types we haven't given special enums to,
+                 * we mark the truly unknown and assume everything else is
+                 * a struct.
+                 */
+                param->type = DRSYS_TYPE_STRUCT;
+            }
+            if (TEST(SYSARG_INLINED, sysinfo->arg[compacted].flags)) {
+                int sz = sysinfo->arg[compacted].size;
+                ASSERT(sz > 0, "inlined must have regular size in bytes");
+                param->size = (ushort) sz;
+                param->inlined = true;
+            }
+            param->mode = mode_from_flags(sysinfo->arg[compacted].flags);
+            param->enum_name = sysinfo->arg[compacted].type_name;
+            /* Go to next entry.  Skip double entries. */
+            while (sysinfo->arg[compacted].param == i &&
+                   !sysarg_invalid(&sysinfo->arg[compacted]))
+                compacted++;
+            ASSERT(compacted <= MAX_ARGS_IN_ENTRY, "error in table entry");
+        }
+        ASSERT(param->type < NUM_PARAM_TYPE_NAMES, "invalid type enum val");
+    }
+}
+
+static sysarg_plan_t *
+sysarg_get_plan(syscall_info_t *sysinfo)
+{
+    sysarg_plan_t *plan = sysinfo->plan;
+    int i, last_param = -1;
+    if (plan != NULL)
+        return plan;
+    dr_recurlock_lock(systable_lock);
+    if (sysinfo->plan != NULL) {
+        plan = sysinfo->plan;
+        dr_recurlock_unlock(systable_lock);
+        return plan;
+    }
+    plan = global_alloc(sizeof(*plan), HEAPSTAT_MISC);
+    memset(plan, 0, sizeof(*plan));
+    for (i = 0; i < MAX_ARGS_IN_ENTRY; i++) { /* not <arg_count b/c of double entries */
+        sysinfo_arg_t *arg = &sysinfo->arg[i];
+        if (sysarg_invalid(arg))
+            break;
+        ASSERT(arg->param < sysinfo->arg_count, "param # > arg count!");
+        plan->immed_size[i] = sysarg_size_is_immed(arg);
+        /* The pre-syscall walk skips the second of a double entry, which is
+         * only used post-syscall, and args that are not memory.
+         */
+        if (arg->param != last_param &&
+            !TESTANY(SYSARG_INLINED | SYSARG_NON_MEMARG, arg->flags))
+            plan->pre[plan->num_pre++] = (byte) i;
+        last_param = arg->param;
+        if (TEST(SYSARG_WRITE, arg->flags)) {
+            ASSERT(!TEST(SYSARG_INLINED, arg->flags), "inlined should not be written");
+            plan->post[plan->num_post++] = (byte) i;
+        }
+    }
+    sysarg_plan_params(sysinfo, plan);
+    plan->next = sysarg_plans;
+    sysarg_plans = plan;
+    /* The atomic op orders the plan contents before the pointer that
+     * lock-free readers check.
+     */
+    dr_atomic_add32_return_sum(&sysarg_plan_count, 1);
+    sysinfo->plan = plan;
+    dr_recurlock_unlock(systable_lock);
+    return plan;
+}
+
+static void
+sysarg_plan_exit(void)
+{
+    while (sysarg_plans != NULL) {
+        sysarg_plan_t *next = sysarg_plans->next;
+        global_free(sysarg_plans, sizeof(*sysarg_plans), HEAPSTAT_MISC);
+        sysarg_plans = next;
+    }
+    LOG(1, "syscall arg plans: %d\n", sysarg_plan_count);
+}
+
 /* Walks the param entries stored in the syscall table and processes them
  * for pre-syscall usage.
  * Assumes that arg fields drcontext, sysnum, pre, and mc have already been filled in.
@@ -1410,40 +1866,33 @@ process_pre_syscall_reads_and_writes(cls_syscall_t *pt, sysarg_iter_info_t *ii)
 {
     void *drcontext = ii->arg->drcontext;
     syscall_info_t *sysinfo = pt->sysinfo;
+    sysarg_plan_t *plan = sysarg_get_plan(sysinfo);
     app_pc start;
     ptr_uint_t size;
-    int i, last_param = -1;
+    int i, j;
     char idmsg[32];
 
     LOG(SYSCALL_VERBOSE, "processing pre system call #"SYSNUM_FMT"."SYSNUM_FMT" %s\n",
         pt->sysnum.number, pt->sysnum.secondary, sysinfo->name);
-    for (i=0; i<MAX_ARGS_IN_ENTRY; i++) { /* not <arg_count b/c of double entries */
+    /* The length written may not match that requested, so we check whether
+     * addressable at pre-syscall point but only mark as defined (i.e.,
+     * commit the write) at post-syscall when know true length.  This also
+     * waits to determine syscall success before committing, but it opens up
+     * more possibilities for races (PR 408540).  When the pre and post
+     * sizes differ, we indicate what the post-syscall write size is via a
+     * second entry w/ the same param#: the plan omits those second entries.
+     * Xref PR 408536.
+     */
+    for (j = 0; j < plan->num_pre; j++) {
+        i = plan->pre[j];
         LOG(SYSCALL_VERBOSE, "\t  pre considering arg %d %d %x\n", sysinfo->arg[i].param,
             sysinfo->arg[i].size, sysinfo->arg[i].flags);
-        if (sysarg_invalid(&sysinfo->arg[i]))
-            break;
-        ASSERT(sysinfo->arg[i].param < sysinfo->arg_count, "param # > arg count!");
-
-        /* The length written may not match that requested, so we check whether
-         * addressable at pre-syscall point but only mark as defined (i.e.,
-         * commit the write) at post-syscall when know true length.  This also
-         * waits to determine syscall success before committing, but it opens up
-         * more possibilities for races (PR 408540).  When the pre and post
-         * sizes differ, we indicate what the post-syscall write size is via a
-         * second entry w/ the same param#.
-         * Xref PR 408536.
-         */
-        if (sysinfo->arg[i].param == last_param) {
-            /* Only used in post-syscall */
-            continue;
-        }
-        last_param = sysinfo->arg[i].param;
-
-        if (TESTANY(SYSARG_INLINED | SYSARG_NON_MEMARG, sysinfo->arg[i].flags))
-            continue;
 
         start = SYSARG_AS_PTR(pt, sysinfo->arg[i].param, app_pc);
-        size = sysarg_get_size(drcontext, pt, ii, sysinfo, i, true/*pre*/, start);
+        if (plan->immed_size[i])
+            size = sysinfo->arg[i].size;
+        else
+            size = sysarg_get_size(drcontext, pt, ii, sysinfo, i, true/*pre*/, start);
         pt->sysarg_known_sz[sysinfo->arg[i].param] = size;
         LOG(SYSCALL_VERBOSE, "\t  pre storing size "PIFX" for arg %d\n",
             size, sysinfo->arg[i].param);
@@ -1493,8 +1942,9 @@ process_post_syscall_reads_and_writes(cls_syscall_t *pt, sysarg_iter_info_t *ii)
     void *drcontext = ii->arg->drcontext;
     syscall_info_t *sysinfo = pt->sysinfo;
     app_pc start;
+    sysarg_plan_t *plan = sysarg_get_plan(sysinfo);
     ptr_uint_t size, last_size = 0;
-    int i, last_param = -1;
+    int i, j, last_param = -1;
     IF_DEBUG(int res;)
     char idmsg[32];
 #ifdef WINDOWS
@@ -1505,17 +1955,12 @@ process_post_syscall_reads_and_writes(cls_syscall_t *pt, sysarg_iter_info_t *ii)
         pt->sysnum.number, pt->sysnum.secondary);
     LOG(SYSCALL_VERBOSE, " %s res="PIFX"\n",
         sysinfo->name, dr_syscall_get_result(drcontext));
-    for (i=0; i<MAX_ARGS_IN_ENTRY; i++) { /* not <arg_count b/c of double entries */
+    for (j = 0; j < plan->num_post; j++) { /* only SYSARG_WRITE entries */
+        i = plan->post[j];
         LOG(SYSCALL_VERBOSE, "\t  post considering arg %d %d %x "PFX"\n",
             sysinfo->arg[i].param, sysinfo->arg[i].size, sysinfo->arg[i].flags,
             pt->sysarg[sysinfo->arg[i].param]);
-        if (sysarg_invalid(&sysinfo->arg[i]))
-            break;
         ASSERT(i < SYSCALL_NUM_ARG_STORE, "not storing enough args");
-        if (!TEST(SYSARG_WRITE, sysinfo->arg[i].flags))
-            continue;
-        ASSERT(!TEST(SYSARG_INLINED, sysinfo->arg[i].flags),
-               "inlined should not be written");
 #ifdef WINDOWS
         /* i#486, i#531, i#932: for too-small buffer, only last param written */
         if (os_syscall_ret_small_write_last(sysinfo, result) &&
@@ -1525,7 +1970,10 @@ process_post_syscall_reads_and_writes(cls_syscall_t *pt, sysarg_iter_info_t *ii)
 #endif
 
         start = SYSARG_AS_PTR(pt, sysinfo->arg[i].param, app_pc);
-        size = sysarg_get_size(drcontext, pt, ii, sysinfo, i, false/*!pre*/, start);
+        if (plan->immed_size[i])
+            size = sysinfo->arg[i].size;
+        else
+            size = sysarg_get_size(drcontext, pt, ii, sysinfo, i, false/*!pre*/, start);
         if (ii->abort)
             break;
 
@@ -1711,10 +2159,14 @@ static drmf_status_t
 drsys_iterate_args_common(void *drcontext, cls_syscall_t *pt, syscall_info_t *sysinfo,
                           drsys_arg_t *arg, drsys_iter_cb_t cb, void *user_data)
 {
-    int i, compacted;
+    int i;
+    sysarg_plan_t *plan = NULL;
 
     if (sysinfo == NULL)
         return DRMF_ERROR_DETAILS_UNKNOWN;
+    /* An unknown syscall's sysinfo is a per-thread copy with no params */
+    if (sysinfo->arg_count > 0)
+        plan = sysarg_get_plan(sysinfo);
 
     LOG(2, "iterating over args for syscall #"SYSNUM_FMT"."SYSNUM_FMT" %s\n",
         sysinfo->num.number, sysinfo->num.secondary, sysinfo->name);
@@ -1739,9 +2191,10 @@ drsys_iterate_args_common(void *drcontext, cls_syscall_t *pt, syscall_info_t *sy
      * There are no inlined OUT params anyway: have to at least set
      * to NULL, unless truly ignored based on another parameter.
      */
-    for (i = 0, compacted = 0; i < sysinfo->arg_count; i++) {
+    for (i = 0; i < sysinfo->arg_count; i++) {
+        const sysarg_param_plan_t *param = &plan->param[i];
         arg->ordinal = i;
-        arg->size = sizeof(void*);
+        arg->size = param->size;
         if (pt == NULL) {
             arg->reg = DR_REG_NULL;
             arg->start_addr = NULL;
@@ -1752,49 +2205,21 @@ drsys_iterate_args_common(void *drcontext, cls_syscall_t *pt, syscall_info_t *sy
             arg->value64 = pt->sysarg[i];
             arg->value = (ptr_uint_t) pt->sysarg[i];
         }
-        arg->type = DRSYS_TYPE_UNKNOWN;
-        arg->mode = DRSYS_PARAM_IN;
-
-        /* FIXME i#1089: add type info for the non-memory-complex-type args */
-        if (!sysarg_invalid(&sysinfo->arg[compacted]) &&
-            sysinfo->arg[compacted].param == i) {
-            if (SYSARG_MISC_HAS_TYPE(sysinfo->arg[compacted].flags)) {
-                arg->type = type_from_arg_info(&sysinfo->arg[compacted]);
-            } else if (!TEST(SYSARG_INLINED, sysinfo->arg[compacted].flags)) {
-                /* Rather than clutter up the tables with DRSYS_TYPE_STRUCT
-                 * for all the types we haven't given special enums to,
-                 * we mark the truly unknown and assume everything else is
-                 * a struct.
-                 */
-                arg->type = DRSYS_TYPE_STRUCT;
-            }
-            if (TEST(SYSARG_INLINED, sysinfo->arg[compacted].flags)) {
-                int sz = sysinfo->arg[compacted].size;
-                ASSERT(sz > 0, "inlined must have regular size in bytes");
-                arg->size = sz;
-                /* We zero out the top bits here which are uninitialized, to
-                 * avoid confusing the client.
-                 */
-                if (arg->size < sizeof(ptr_uint_t)) {
-                    if (arg->size == 1)
-                        arg->value &= 0xff;
-                    else if (arg->size == 2)
-                        arg->value &= 0xffff;
-                    else if (arg->size == 4)
-                        arg->value &= 0xffffffff;
-                    arg->value64 = arg->value;
-                }
-            }
-            arg->mode = mode_from_flags(sysinfo->arg[compacted].flags);
-            arg->enum_name = sysinfo->arg[compacted].type_name;
-            /* Go to next entry.  Skip double entries. */
-            while (sysinfo->arg[compacted].param == i &&
-                   !sysarg_invalid(&sysinfo->arg[compacted]))
-                compacted++;
-            ASSERT(compacted <= MAX_ARGS_IN_ENTRY, "error in table entry");
-        } else
-            arg->enum_name = NULL;
-        ASSERT(arg->type < NUM_PARAM_TYPE_NAMES, "invalid type enum val");
+        /* We zero out the top bits of inlined values here which are
+         * uninitialized, to avoid confusing the client.
+         */
+        if (param->inlined && arg->size < sizeof(ptr_uint_t)) {
+            if (arg->size == 1)
+                arg->value &= 0xff;
+            else if (arg->size == 2)
+                arg->value &= 0xffff;
+            else if (arg->size == 4)
+                arg->value &= 0xffffffff;
+            arg->value64 = arg->value;
+        }
+        arg->type = param->type;
+        arg->mode = param->mode;
+        arg->enum_name = param->enum_name;
         arg->type_name = param_type_names[arg->type];
 
         if (!(*cb)(arg, user_data))
@@ -2019,12 +2444,16 @@ static bool filter_all;
 #define FILTERED_TABLE_HASH_BITS 6
 /* Operates on DR's simple "int sysnum" */
 static hashtable_t filtered_table;
+/* Exceptions to filter_all */
+static hashtable_t unfiltered_table;
 
 static bool
 drsys_event_filter_syscall(void *drcontext, int sysnum)
 {
-    return (filter_all ||
-            (hashtable_lookup(&filtered_table, (void *)(ptr_int_t)sysnum) != NULL));
+    if (hashtable_lookup(&filtered_table, (void *)(ptr_int_t)sysnum) != NULL)
+        return true;
+    return (filter_all &&
+            hashtable_lookup(&unfiltered_table, (void *)(ptr_int_t)sysnum) == NULL);
 }
 
 DR_EXPORT
@@ -2045,6 +2474,16 @@ drsys_filter_all_syscalls(void)
     return DRMF_SUCCESS;
 }
 
+DR_EXPORT
+drmf_status_t
+drsys_unfilter_syscall(drsys_sysnum_t sysnum)
+{
+    /* As with filtering, this applies to the whole primary number */
+    hashtable_add(&unfiltered_table, (void *)(ptr_uint_t)sysnum.number,
+                  (void *)(ptr_uint_t)sysnum.number);
+    return DRMF_SUCCESS;
+}
+
 /***************************************************************************
  * Events and Top-Level
  */
@@ -2074,22 +2513,17 @@ static void
 syscall_module_load(void *drcontext, const module_data_t *info, bool loaded)
 {
     drsyscall_os_module_load(drcontext, info, loaded);
+    /* Windows adds entries here when the syscall numbers are unknown */
+    syscall_lookup_update();
 }
 
 static void
 syscall_reset_per_thread(void *drcontext, cls_syscall_t *cpt)
 {
-    int i;
-    for (i = 0; i < SYSCALL_NUM_ARG_TRACK; i++) {
-        if (cpt->sysarg_val_bytes[i] > 0) {
-            ASSERT(cpt->sysarg_val[i] != NULL, "sysarg alloc error");
-            thread_free(drcontext, cpt->sysarg_val[i], cpt->sysarg_val_bytes[i],
-                        HEAPSTAT_MISC);
-            cpt->sysarg_val[i] = NULL;
-            cpt->sysarg_val_bytes[i] = 0;
-        } else {
-            ASSERT(cpt->sysarg_val[i] == NULL, "sysarg alloc error");
-        }
+    if (cpt->sysarg_val_arena != NULL) {
+        thread_free(drcontext, cpt->sysarg_val_arena, SYSARG_VAL_ARENA_SIZE,
+                    HEAPSTAT_MISC);
+        cpt->sysarg_val_arena = NULL;
     }
 }
 
@@ -2097,14 +2531,17 @@ static void
 syscall_context_init(void *drcontext, bool new_depth)
 {
     cls_syscall_t *cpt;
+    byte *arena = NULL;
     if (new_depth) {
         cpt = (cls_syscall_t *) thread_alloc(drcontext, sizeof(*cpt), HEAPSTAT_MISC);
         drmgr_set_cls_field(drcontext, cls_idx_drsys, cpt);
     } else {
         cpt = (cls_syscall_t *) drmgr_get_cls_field(drcontext, cls_idx_drsys);
-        syscall_reset_per_thread(drcontext, cpt);
+        /* A reused context keeps its arena: callbacks are frequent */
+        arena = cpt->sysarg_val_arena;
     }
     memset(cpt, 0, sizeof(*cpt));
+    cpt->sysarg_val_arena = arena;
 
 #ifdef SYSCALL_DRIVER
     if (drsys_ops.syscall_driver &&
@@ -2209,6 +2646,7 @@ drsys_init(client_id_t client_id, drsys_options_t *ops)
     res = drsyscall_os_init(drcontext);
     if (res != DRMF_SUCCESS && res != DRMF_WARNING_UNSUPPORTED_KERNEL)
         return res;
+    syscall_lookup_update();
 
     /* We used to handle all the gory details of Windows pre- and
      * post-syscall hooking ourselves, including system call parameter
@@ -2240,6 +2678,8 @@ drsys_init(client_id_t client_id, drsys_options_t *ops)
     dr_register_filter_syscall_event(drsys_event_filter_syscall);
     hashtable_init(&filtered_table, FILTERED_TABLE_HASH_BITS, HASH_INTPTR,
                    false/*!strdup*/);
+    hashtable_init(&unfiltered_table, FILTERED_TABLE_HASH_BITS, HASH_INTPTR,
+                   false/*!strdup*/);
 
     if (!drmgr_register_bb_instrumentation_event
         (drsys_event_bb_analysis, drsys_event_bb_insert, &pri_bb)) {
@@ -2271,7 +2711,10 @@ drsys_exit(void)
 #endif
 
     hashtable_delete(&filtered_table);
+    hashtable_delete(&unfiltered_table);
 
+    syscall_lookup_exit();
+    sysarg_plan_exit();
     drsyscall_os_exit();
 
     dr_recurlock_destroy(systable_lock);
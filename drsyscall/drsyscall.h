@@ -442,6 +442,11 @@ typedef struct _drsys_options_t {
      *     ...
      *     =END
      *
+     * The first time a file is parsed, a binary index of all of its lists is
+     * written alongside it, with ".bin" appended to the name, if the directory
+     * is writable.  Later processes use the index rather than parsing the text.
+     * The index is rebuilt if the text file changes.
+     *
      * This file is currently only honored on Windows.
      */
     const char *sysnum_file;
@@ -528,6 +533,21 @@ DR_EXPORT
 drmf_status_t
 drsys_filter_all_syscalls(void);
 
+DR_EXPORT
+/**
+ * Excludes this system call from the effect of drsys_filter_all_syscalls(),
+ * allowing a client that filters all system calls to have particular system
+ * calls not intercepted at all.  Has no effect on system calls explicitly
+ * requested via drsys_filter_syscall().  As with drsys_filter_syscall(), this
+ * applies to the primary number only, covering all secondary numbers under it.
+ *
+ * @param[in] sysnum  The system call number to exclude.
+ *
+ * \return success code.
+ */
+drmf_status_t
+drsys_unfilter_syscall(drsys_sysnum_t sysnum);
+
 /***************************************************************************
  * STATELESS QUERIES
  */
@@ -629,6 +649,27 @@ DR_EXPORT
 drmf_status_t
 drsys_syscall_is_known(drsys_syscall_t *syscall, OUT bool *known);
 
+DR_EXPORT
+/**
+ * Identifies whether the given system call is known to take no parameters
+ * that refer to memory and to need no special handling by Dr. Syscall beyond
+ * its parameter list: i.e., whether drsys_iterate_memargs() will never
+ * invoke its callback for it.  Such a system call's parameters are all
+ * values and can only be checked via drsys_iterate_args().  Returns false as
+ * a conservative answer for system calls whose details are not fully known
+ * and, currently, on Windows and MacOS.
+ * The system call handle can be obtained from drsys_cur_syscall(),
+ * drsys_iterate_syscalls(), drsys_name_to_syscall(),
+ * drsys_number_to_syscall(), or drsys_arg_t.syscall.
+ *
+ * @param[in]  syscall      The handle for the system call to query.
+ * @param[out] memarg_free  Whether the system call has no memory parameters.
+ *
+ * \return success code.
+ */
+drmf_status_t
+drsys_syscall_is_memarg_free(drsys_syscall_t *syscall, OUT bool *memarg_free);
+
 DR_EXPORT
 /**
  * For Windows or Linux, identifies whether the given value is a
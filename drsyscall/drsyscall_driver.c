@@ -209,18 +209,33 @@ driver_process_writes(void *drcontext, drsys_sysnum_t sysnum)
     tls_driver_t *pt = (tls_driver_t *) drmgr_get_tls_field(drcontext, tls_idx_driver);
     WritesBuffer *writes = (WritesBuffer *) pt->driver_buffer;
     size_t i;
+    byte *run_start = NULL, *run_end = NULL;
     if (f_driver == INVALID_FILE)
         return false;
     if (writes == NULL)
         return false;
     for (i = 0; i < pt->frozen_num_writes; i++) {
+        byte *start = (byte *) writes->writes[i].start;
+        byte *end = start + writes->writes[i].length;
         LOG(2, "driver info: syscall #0x%x write %d: "PFX"-"PFX"\n",
-            sysnum, i, writes->writes[i].start,
-            (byte*)writes->writes[i].start + writes->writes[i].length);
-        shadow_set_range(writes->writes[i].start,
-                         (byte*)writes->writes[i].start + writes->writes[i].length,
-                         SHADOW_DEFINED);
+            sysnum, i, start, end);
+        /* The kernel often fills in a struct or buffer piecemeal, so we
+         * coalesce adjacent and overlapping writes into one shadow update.
+         */
+        if (run_start != NULL && start <= run_end && end >= run_start) {
+            if (start < run_start)
+                run_start = start;
+            if (end > run_end)
+                run_end = end;
+        } else {
+            if (run_start != NULL)
+                shadow_set_range(run_start, run_end, SHADOW_DEFINED);
+            run_start = start;
+            run_end = end;
+        }
     }
+    if (run_start != NULL)
+        shadow_set_range(run_start, run_end, SHADOW_DEFINED);
     return true;
 }
 
@@ -36,6 +36,361 @@ double_strchr(const char *s, char c1, char c2)
     return NULL;
 }
 
+/* Parsing a text file that holds lists for many Windows versions at every
+ * process start is slow, so the first process to parse a text file writes a
+ * binary index of it alongside, named with SYSNUM_BIN_SUFFIX.  Later
+ * processes map the index, binary search it for the current kernel's list,
+ * and record the names in place.  The index is tied to its text file by size
+ * and a hash of the whole text and is rebuilt when those differ.
+ */
+#define SYSNUM_BIN_SUFFIX ".bin"
+
+/* The binary format has its own version, which must be bumped whenever any
+ * of the sysnum_bin_*_t structures or the text hash change.
+ */
+#define SYSNUM_BIN_MAGIC "DrSysNm"
+#define SYSNUM_BIN_VERSION 2
+
+#define SYSNUM_BIN_MAX_TMP_TRIES 8
+
+/* The binary file is a header, followed by an array of sysnum_bin_list_t
+ * sorted by start value, then an array of sysnum_bin_entry_t, then a pool of
+ * null-terminated names.
+ */
+typedef struct _sysnum_bin_header_t {
+    char magic[8];
+    uint version;
+    uint header_size;
+    uint file_size;
+    uint64 text_size;
+    uint text_hash;
+    uint index_name; /* offset into the string pool */
+    uint num_lists;
+    uint num_entries;
+    uint strings_size;
+} sysnum_bin_header_t;
+
+typedef struct _sysnum_bin_list_t {
+    uint start;       /* the value of the index syscall selecting this list */
+    uint first_entry; /* index into the entry array */
+    uint num_entries;
+} sysnum_bin_list_t;
+
+typedef struct _sysnum_bin_entry_t {
+    uint name; /* offset into the string pool */
+    uint num;
+} sysnum_bin_entry_t;
+
+/* The index stays mapped so its names can be recorded without copying */
+static void *sysnum_bin_map;
+static size_t sysnum_bin_map_size;
+
+static uint
+sysnum_text_hash(const char *text, size_t size)
+{
+    /* FNV-1a over the whole file: an edit anywhere must invalidate the index.
+     * This is still far cheaper than scanning the text for our list.
+     */
+    uint hash = 2166136261U;
+    size_t i;
+    for (i = 0; i < size; i++)
+        hash = (hash ^ (byte)text[i]) * 16777619U;
+    return hash;
+}
+
+/* Returns DRMF_SUCCESS if the index was valid and had our list,
+ * DRMF_ERROR_NOT_FOUND if it had no list for this kernel, and another error
+ * if the index is missing, stale, or ill-formed.
+ */
+static drmf_status_t
+read_sysnum_bin(void *drcontext, const char *binfile, uint64 text_size, uint text_hash,
+                module_data_t *ntdll_data)
+{
+    drmf_status_t status = DRMF_ERROR;
+    file_t f;
+    void *map = NULL;
+    uint64 map_size;
+    size_t actual_size = 0;
+    const sysnum_bin_header_t *hdr;
+    const sysnum_bin_list_t *lists;
+    const sysnum_bin_entry_t *entries;
+    const char *strings;
+    drsys_sysnum_t num_from_wrapper;
+    uint lo, hi, i;
+
+    f = dr_open_file(binfile, DR_FILE_READ);
+    if (f == INVALID_FILE)
+        return DRMF_ERROR;
+    if (dr_file_size(f, &map_size) && map_size >= sizeof(*hdr)) {
+        actual_size = (size_t)map_size;
+        map = dr_map_file(f, &actual_size, 0, NULL, DR_MEMPROT_READ, 0);
+    }
+    dr_close_file(f);
+    if (map == NULL)
+        return DRMF_ERROR;
+    hdr = (const sysnum_bin_header_t *) map;
+    if (actual_size < map_size ||
+        strncmp(hdr->magic, SYSNUM_BIN_MAGIC, BUFFER_SIZE_ELEMENTS(hdr->magic)) != 0 ||
+        hdr->version != SYSNUM_BIN_VERSION || hdr->header_size != sizeof(*hdr) ||
+        hdr->file_size != map_size || hdr->text_size != text_size ||
+        hdr->text_hash != text_hash ||
+        (uint64)sizeof(*hdr) + (uint64)hdr->num_lists * sizeof(*lists) +
+        (uint64)hdr->num_entries * sizeof(*entries) + hdr->strings_size != map_size ||
+        hdr->strings_size == 0 || hdr->index_name >= hdr->strings_size) {
+        LOG(SYSCALL_VERBOSE, "syscall index %s is stale or invalid\n", binfile);
+        goto read_sysnum_bin_done;
+    }
+    lists = (const sysnum_bin_list_t *) (hdr + 1);
+    entries = (const sysnum_bin_entry_t *) (lists + hdr->num_lists);
+    strings = (const char *) (entries + hdr->num_entries);
+    if (strings[hdr->strings_size - 1] != '\0')
+        goto read_sysnum_bin_done;
+
+    if (!syscall_num_from_name(drcontext, ntdll_data, strings + hdr->index_name, NULL,
+                               false/*exported*/, &num_from_wrapper))
+        goto read_sysnum_bin_done;
+    LOG(SYSCALL_VERBOSE, "syscall index: %s is 0x%x\n", strings + hdr->index_name,
+        num_from_wrapper.number);
+    status = DRMF_ERROR_NOT_FOUND;
+    lo = 0;
+    hi = hdr->num_lists;
+    while (lo < hi) {
+        uint mid = (lo + hi) / 2;
+        if (lists[mid].start == (uint)num_from_wrapper.number) {
+            const sysnum_bin_list_t *list = &lists[mid];
+            if ((uint64)list->first_entry + list->num_entries > hdr->num_entries) {
+                status = DRMF_ERROR;
+                break;
+            }
+            for (i = 0; i < list->num_entries; i++) {
+                const sysnum_bin_entry_t *e = &entries[list->first_entry + i];
+                if (e->name >= hdr->strings_size)
+                    break;
+                name2num_record(strings + e->name, (int)e->num, false/*in place*/);
+            }
+            status = (i == list->num_entries) ? DRMF_SUCCESS : DRMF_ERROR;
+            break;
+        }
+        if (lists[mid].start < (uint)num_from_wrapper.number)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+ read_sysnum_bin_done:
+    if (status == DRMF_SUCCESS) {
+        LOG(SYSCALL_VERBOSE, "syscall index %s: found target list\n", binfile);
+        sysnum_bin_map = map;
+        sysnum_bin_map_size = actual_size;
+    } else if (status == DRMF_ERROR_NOT_FOUND) {
+        /* Nothing was recorded from it */
+        dr_unmap_file(map, actual_size);
+    } else {
+        /* A partial list may have been recorded, so we leave it mapped */
+        sysnum_bin_map = map;
+        sysnum_bin_map_size = actual_size;
+    }
+    return status;
+}
+
+static const char *
+sysnum_next_line(const char *line, const char *end)
+{
+    while (line < end && *line != '\n')
+        line++;
+    return (line < end) ? line + 1 : end;
+}
+
+static size_t
+sysnum_line_len(const char *line, const char *end)
+{
+    const char *eol = line;
+    while (eol < end && *eol != '\n' && *eol != '\r')
+        eol++;
+    return eol - line;
+}
+
+static bool
+sysnum_parse_hex(const char *s, size_t len, uint *val OUT)
+{
+    uint res = 0;
+    size_t i;
+    if (len < 3 || s[0] != '0' || (s[1] != 'x' && s[1] != 'X'))
+        return false;
+    for (i = 2; i < len; i++) {
+        char c = s[i];
+        if (c >= '0' && c <= '9')
+            res = (res << 4) | (c - '0');
+        else if (c >= 'a' && c <= 'f')
+            res = (res << 4) | (c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            res = (res << 4) | (c - 'A' + 10);
+        else
+            return false;
+    }
+    *val = res;
+    return true;
+}
+
+/* Walks every list in the text file body, which starts at the index name
+ * line.  With hdr->num_lists etc. zero and the arrays NULL, counts; else,
+ * fills in the arrays that were sized by a counting walk.
+ */
+static bool
+sysnum_text_walk(const char *body, const char *end, sysnum_bin_header_t *hdr,
+                 sysnum_bin_list_t *lists, sysnum_bin_entry_t *entries, char *strings)
+{
+    const char *line = body;
+    sysnum_bin_list_t *cur = NULL;
+    bool in_list = false;
+    size_t len = sysnum_line_len(line, end);
+    uint nlists = 0, nentries = 0, strsz = 0;
+    if (len == 0)
+        return false;
+    if (strings != NULL) {
+        memcpy(strings, line, len);
+        strings[len] = '\0';
+    }
+    hdr->index_name = 0;
+    strsz = (uint)len + 1;
+    for (line = sysnum_next_line(line, end); line < end;
+         line = sysnum_next_line(line, end)) {
+        const char *eq;
+        uint val;
+        len = sysnum_line_len(line, end);
+        if (len == 0)
+            continue;
+        if (len > strlen("START=") && strncmp(line, "START=", strlen("START=")) == 0) {
+            if (in_list)
+                return false;
+            if (!sysnum_parse_hex(line + strlen("START="), len - strlen("START="), &val))
+                return false;
+            if (lists != NULL) {
+                cur = &lists[nlists];
+                cur->start = val;
+                cur->first_entry = nentries;
+                cur->num_entries = 0;
+            }
+            in_list = true;
+            nlists++;
+            continue;
+        }
+        if (len == strlen(DRSYS_SYSNUM_FILE_FOOTER) &&
+            strncmp(line, DRSYS_SYSNUM_FILE_FOOTER, len) == 0) {
+            in_list = false;
+            continue;
+        }
+        if (!in_list)
+            return false;
+        eq = memchr(line, '=', len);
+        if (eq == NULL || eq == line || line[0] < 'A' || line[0] > 'Z' ||
+            !sysnum_parse_hex(eq + 1, len - (eq + 1 - line), &val))
+            return false;
+        if (entries != NULL) {
+            entries[nentries].name = strsz;
+            entries[nentries].num = val;
+            memcpy(strings + strsz, line, eq - line);
+            strings[strsz + (eq - line)] = '\0';
+            cur->num_entries++;
+        }
+        nentries++;
+        strsz += (uint)(eq - line) + 1;
+    }
+    if (in_list) /* missing footer */
+        return false;
+    hdr->num_lists = nlists;
+    hdr->num_entries = nentries;
+    hdr->strings_size = strsz;
+    return true;
+}
+
+/* Writes the binary index for the text file body starting at the index name.
+ * Failure is not an error: e.g., the directory may not be writable.
+ */
+static void
+write_sysnum_bin(const char *binfile, const char *body, const char *end,
+                 uint64 text_size, uint text_hash)
+{
+    sysnum_bin_header_t hdr;
+    sysnum_bin_list_t *lists = NULL;
+    sysnum_bin_entry_t *entries = NULL;
+    char *strings = NULL;
+    size_t lists_sz, entries_sz;
+    char tmpfile[MAXIMUM_PATH];
+    file_t f = INVALID_FILE;
+    bool ok;
+    uint i, j;
+
+    memset(&hdr, 0, sizeof(hdr));
+    if (!sysnum_text_walk(body, end, &hdr, NULL, NULL, NULL) || hdr.num_lists == 0)
+        return;
+    lists_sz = hdr.num_lists * sizeof(*lists);
+    entries_sz = hdr.num_entries * sizeof(*entries);
+    lists = global_alloc(lists_sz, HEAPSTAT_MISC);
+    if (entries_sz > 0)
+        entries = global_alloc(entries_sz, HEAPSTAT_MISC);
+    strings = global_alloc(hdr.strings_size, HEAPSTAT_MISC);
+    ok = sysnum_text_walk(body, end, &hdr, lists, entries, strings);
+    if (!ok)
+        goto write_sysnum_bin_done;
+    /* Sort the lists by start for the reader's binary search */
+    for (i = 1; i < hdr.num_lists; i++) {
+        sysnum_bin_list_t tmp = lists[i];
+        for (j = i; j > 0 && lists[j-1].start > tmp.start; j--)
+            lists[j] = lists[j-1];
+        lists[j] = tmp;
+    }
+
+    strncpy(hdr.magic, SYSNUM_BIN_MAGIC, BUFFER_SIZE_ELEMENTS(hdr.magic));
+    hdr.version = SYSNUM_BIN_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.file_size = (uint)(sizeof(hdr) + lists_sz + entries_sz + hdr.strings_size);
+    hdr.text_size = text_size;
+    hdr.text_hash = text_hash;
+
+    for (i = 0; f == INVALID_FILE && i < SYSNUM_BIN_MAX_TMP_TRIES; i++) {
+        /* Include the pid to avoid collisions among concurrent processes */
+        dr_snprintf(tmpfile, BUFFER_SIZE_ELEMENTS(tmpfile), "%s.%d.%04d.tmp",
+                    binfile, dr_get_process_id(), i);
+        NULL_TERMINATE_BUFFER(tmpfile);
+        f = dr_open_file(tmpfile, DR_FILE_WRITE_REQUIRE_NEW);
+    }
+    if (f == INVALID_FILE) {
+        LOG(SYSCALL_VERBOSE, "unable to create syscall index temp file\n");
+        goto write_sysnum_bin_done;
+    }
+    ok = (dr_write_file(f, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+          dr_write_file(f, lists, lists_sz) == (ssize_t)lists_sz &&
+          (entries_sz == 0 ||
+           dr_write_file(f, entries, entries_sz) == (ssize_t)entries_sz) &&
+          dr_write_file(f, strings, hdr.strings_size) == (ssize_t)hdr.strings_size);
+    dr_close_file(f);
+    if (!ok || !dr_rename_file(tmpfile, binfile, /*replace*/true)) {
+        /* On Windows the rename fails if another process has the index mapped:
+         * a later process will try again.
+         */
+        LOG(SYSCALL_VERBOSE, "failed to write syscall index %s\n", binfile);
+        dr_delete_file(tmpfile);
+        goto write_sysnum_bin_done;
+    }
+    LOG(SYSCALL_VERBOSE, "wrote syscall index %s: %u lists, %u entries\n",
+        binfile, hdr.num_lists, hdr.num_entries);
+
+ write_sysnum_bin_done:
+    global_free(strings, hdr.strings_size, HEAPSTAT_MISC);
+    if (entries != NULL)
+        global_free(entries, entries_sz, HEAPSTAT_MISC);
+    global_free(lists, lists_sz, HEAPSTAT_MISC);
+}
+
+void
+sysnum_file_exit(void)
+{
+    if (sysnum_bin_map != NULL) {
+        dr_unmap_file(sysnum_bin_map, sysnum_bin_map_size);
+        sysnum_bin_map = NULL;
+    }
+}
+
 /* i#1908: we support loading numbers from a file.  The file format is documented
  * in drsyscall.h.
  * We support carriage returns and a missing trailing newline, which are common
@@ -54,6 +409,9 @@ read_sysnum_file(void *drcontext, const char *sysnum_file, module_data_t *ntdll_
     int val;
     char name[MAXIMUM_PATH];
     drsys_sysnum_t num_from_wrapper;
+    char binfile[MAXIMUM_PATH];
+    const char *body;
+    uint text_hash = 0;
 
     f = dr_open_file(sysnum_file, DR_FILE_READ);
     if (f == INVALID_FILE) {
@@ -90,6 +448,23 @@ read_sysnum_file(void *drcontext, const char *sysnum_file, module_data_t *ntdll_
     if (line == NULL || line - map > actual_size)
         goto read_sysnum_file_done;
     line++;
+    body = line;
+
+    /* Use the binary index if it is up to date */
+    text_hash = sysnum_text_hash((const char *)map, actual_size);
+    dr_snprintf(binfile, BUFFER_SIZE_ELEMENTS(binfile), "%s%s", sysnum_file,
+                SYSNUM_BIN_SUFFIX);
+    NULL_TERMINATE_BUFFER(binfile);
+    status = read_sysnum_bin(drcontext, binfile, map_size, text_hash, ntdll_data);
+    if (status == DRMF_SUCCESS || status == DRMF_ERROR_NOT_FOUND)
+        goto read_sysnum_file_done;
+    if (sysnum_bin_map != NULL) {
+        /* Do not mix in text entries after a partial bad index */
+        status = DRMF_ERROR;
+        goto read_sysnum_file_done;
+    }
+    status = DRMF_ERROR_INVALID_PARAMETER;
+
     search = double_strchr(line, '\r', '\n');
     if (search == NULL || search - map > actual_size ||
         search - line >= BUFFER_SIZE_ELEMENTS(name))
@@ -157,6 +532,9 @@ read_sysnum_file(void *drcontext, const char *sysnum_file, module_data_t *ntdll_
     }
 
     status = DRMF_SUCCESS;
+    /* The index covers every list, so the next process can skip the text */
+    write_sysnum_bin(binfile, body, (const char *)map + actual_size, map_size,
+                     text_hash);
  read_sysnum_file_done:
     DOLOG(SYSCALL_VERBOSE, {
         if (status != DRMF_SUCCESS)
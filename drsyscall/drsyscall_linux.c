@@ -51,9 +51,10 @@ union ioctl_data {
  * syscall_lookup() while still sharing data for syscalls that are
  * identical between the two modes if we generated a static table from
  * macros.  But macros are a little ugly with commas which our nested
- * structs are full of.  So we go ahead and pay the cost of a
- * hashtable lookup.  We could list in x86 order and avoid the
- * hashtable lookup there except we want to eventually support
+ * structs are full of.  So we fill in hashtables here and
+ * syscall_lookup_update() compiles them into an array indexed by
+ * number once we're done.  We could list in x86 order and index the
+ * static table directly except we want to eventually support
  * mixed-mode and thus we want both x64 and x86 entries in the same
  * list.  We assume syscall numbers easily fit in 16 bits and pack the
  * numbers for the two platforms together via PACKNUM.
@@ -1776,6 +1777,45 @@ os_handle_pre_syscall(void *drcontext, cls_syscall_t *pt, sysarg_iter_info_t *ii
     /* If you add any handling here: need to check ii->abort first */
 }
 
+/* Must be kept in sync with the cases in os_handle_pre_syscall() and
+ * os_handle_post_syscall().
+ */
+bool
+os_syscall_has_custom_handling(drsys_sysnum_t sysnum)
+{
+    switch (sysnum.number) {
+    case SYS_clone:
+    case SYS__sysctl:
+    case SYS_mremap:
+    case SYS_open:
+    case SYS_fcntl:
+#ifndef X64
+    case SYS_fcntl64:
+#endif
+    case SYS_ioctl:
+#ifdef X64
+    case SYS_semctl:
+    case SYS_msgctl:
+    case SYS_shmctl:
+    case SYS_arch_prctl:
+#else
+    case SYS_socketcall:
+    case SYS_ipc:
+#endif
+    case SYS_select:
+    case SYS_pselect6:
+    case SYS_poll:
+    case SYS_prctl:
+    case SYS_rt_sigaction:
+    case SYS_futex:
+    case SYS_process_vm_readv:
+    case SYS_process_vm_writev:
+        return true;
+    default:
+        return false;
+    }
+}
+
 void
 os_handle_post_syscall(void *drcontext, cls_syscall_t *pt, sysarg_iter_info_t *ii)
 {
@@ -306,3 +306,10 @@ os_syscall_succeeded_custom(drsys_sysnum_t sysnum, syscall_info_t *info,
 {
     return false;
 }
+
+bool
+os_syscall_has_custom_handling(drsys_sysnum_t sysnum)
+{
+    /* XXX: not yet audited for Mac: be conservative */
+    return true;
+}
@@ -295,6 +295,11 @@ typedef struct _syscall_info_t {
      * (I'd use a union but that makes syscall table initializers uglier)
      */
     drsys_sysnum_t *num_out;
+    /* The arg entries pre-filtered for the pre- and post-syscall walks.
+     * Filled in by drsyscall the first time the syscall is processed, so the
+     * tables leave this NULL.
+     */
+    struct _sysarg_plan_t *plan;
 } syscall_info_t;
 
 typedef struct _cls_syscall_t {
@@ -332,9 +337,11 @@ typedef struct _cls_syscall_t {
     bool known;
     app_pc sysarg_ptr[SYSCALL_NUM_ARG_TRACK];
     size_t sysarg_sz[SYSCALL_NUM_ARG_TRACK];
-    /* dynamically allocated */
-    size_t sysarg_val_bytes[SYSCALL_NUM_ARG_TRACK];
-    byte *sysarg_val[SYSCALL_NUM_ARG_TRACK];
+    /* The pre-syscall values, SYSCALL_ARG_TRACK_MAX_SZ bytes per arg.  This is
+     * allocated by the first unknown syscall and kept while the thread lives,
+     * including across callback context resets, so that no syscall allocates.
+     */
+    byte *sysarg_val_arena;
 
     /* for a writable info struct so we can set the sysnum */
     syscall_info_t unknown_info;
@@ -380,6 +387,10 @@ drsyscall_os_exit(void);
 syscall_info_t *
 syscall_lookup(drsys_sysnum_t num, bool resolve_secondary);
 
+/* Must be called after adding entries to systable or secondary_systable */
+void
+syscall_lookup_update(void);
+
 void
 drsyscall_os_thread_init(void *drcontext);
 
@@ -443,6 +454,12 @@ bool
 os_syscall_succeeded_custom(drsys_sysnum_t sysnum, syscall_info_t *info,
                             cls_syscall_t *pt);
 
+/* Returns whether os_handle_pre_syscall() or os_handle_post_syscall() has
+ * code specific to sysnum beyond what its table entry describes.
+ */
+bool
+os_syscall_has_custom_handling(drsys_sysnum_t sysnum);
+
 #ifdef WINDOWS
 bool
 os_syscall_ret_small_write_last(syscall_info_t *info, ptr_int_t res);
@@ -985,6 +985,8 @@ drsyscall_os_exit(void)
     hashtable_delete(&secondary_systable);
     hashtable_delete(&name2num_table);
     drsyscall_wingdi_exit();
+    /* After the tables, which can point at names in the map */
+    sysnum_file_exit();
 }
 
 void
@@ -1188,6 +1190,15 @@ os_syscall_succeeded_custom(drsys_sysnum_t sysnum, syscall_info_t *info,
     return false;
 }
 
+bool
+os_syscall_has_custom_handling(drsys_sysnum_t sysnum)
+{
+    /* The Windows handlers are keyed on numbers resolved at runtime, so we
+     * conservatively claim every syscall.
+     */
+    return true;
+}
+
 bool
 os_syscall_succeeded(drsys_sysnum_t sysnum, syscall_info_t *info, cls_syscall_t *pt)
 {
@@ -40,6 +40,9 @@ syscall_num_from_name(void *drcontext, const module_data_t *info,
 bool
 read_sysnum_file(void *drcontext, const char *sysnum_file, module_data_t *ntdll_data);
 
+void
+sysnum_file_exit(void);
+
 bool
 handle_unicode_string_access(sysarg_iter_info_t *ii, const sysinfo_arg_t *arg_info,
                              app_pc start, uint size, bool ignore_len);
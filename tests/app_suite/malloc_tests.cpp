@@ -22,10 +22,12 @@
 #include "gtest/gtest.h"
 #include "app_suite_utils.h"
 #include <stdlib.h>
+#include <string.h>
 #ifdef WIN32
 #  include <windows.h>
 #else
 #  include <sys/mman.h>
+#  include <pthread.h>
 #endif
 
 #define ALIGN_BACKWARD(ptr, align) (((size_t)ptr) & (~((size_t)(align)-1)))
@@ -103,3 +105,52 @@ TEST(MallocTests, Executable) {
     free(p2);
 #endif
 }
+
+#ifdef UNIX
+# define CROSS_THREAD_COUNT 4
+# define CROSS_THREAD_ALLOCS 1024
+
+static void *cross_thread_ptrs[CROSS_THREAD_COUNT][CROSS_THREAD_ALLOCS];
+
+static void *
+cross_thread_alloc(void *arg)
+{
+    size_t id = (size_t) arg;
+    for (unsigned int i = 0; i < CROSS_THREAD_ALLOCS; i++) {
+        cross_thread_ptrs[id][i] = malloc(16 + (i % 8) * 24);
+        memset(cross_thread_ptrs[id][i], 0, 16);
+    }
+    return NULL;
+}
+
+static void *
+cross_thread_free(void *arg)
+{
+    /* Free what the neighboring thread allocated, resizing some of it first. */
+    size_t id = ((size_t) arg + 1) % CROSS_THREAD_COUNT;
+    for (unsigned int i = 0; i < CROSS_THREAD_ALLOCS; i++) {
+        if (i % 4 == 0) {
+            cross_thread_ptrs[id][i] = realloc(cross_thread_ptrs[id][i], 512);
+            EXPECT_NE((void *)NULL, cross_thread_ptrs[id][i]);
+        }
+        free(cross_thread_ptrs[id][i]);
+    }
+    return NULL;
+}
+
+TEST(MallocTests, CrossThreadFree) {
+    /* Stresses allocations being freed by a thread other than their allocator,
+     * which for -thread_arenas means freeing into a foreign arena.
+     */
+    pthread_t threads[CROSS_THREAD_COUNT];
+    size_t i;
+    for (i = 0; i < CROSS_THREAD_COUNT; i++)
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, cross_thread_alloc, (void *)i));
+    for (i = 0; i < CROSS_THREAD_COUNT; i++)
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+    for (i = 0; i < CROSS_THREAD_COUNT; i++)
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, cross_thread_free, (void *)i));
+    for (i = 0; i < CROSS_THREAD_COUNT; i++)
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+}
+#endif
@@ -0,0 +1,372 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Overhead benchmark kernels, run natively and under each tool mode by
+ * runbench.pl.  Each kernel times only its own work, so that process startup
+ * and tool initialization do not skew the slowdown, and prints one line:
+ *
+ *   bench <kernel> <milliseconds> <checksum>
+ *
+ * The checksum keeps the compiler from discarding the work.
+ *
+ * Usage: bench_kernels <kernel>|all [scale]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <pthread.h>
+# include <time.h>
+# include <unistd.h>
+# include <fcntl.h>
+#endif
+
+#define NUM_THREADS 4
+#define CALL_DEPTH 48
+
+static unsigned int scale = 1;
+
+/* A simple LCG so that runs are repeatable across platforms */
+static unsigned int rand_state = 12345;
+
+static unsigned int
+next_rand(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8);
+}
+
+static double
+now_ms(void)
+{
+#ifdef WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart * 1000. / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000. + (double)ts.tv_nsec / 1000000.;
+#endif
+}
+
+/***************************************************************************
+ * KERNELS
+ */
+
+/* Allocation storm: a ring of live blocks of mixed sizes, replaced in
+ * random order, with an occasional realloc.
+ */
+#define ALLOC_RING 1024
+
+static size_t
+alloc_work(unsigned int iters, unsigned int seed)
+{
+    char *ring[ALLOC_RING];
+    size_t sum = 0;
+    unsigned int i, state = seed;
+    memset(ring, 0, sizeof(ring));
+    for (i = 0; i < iters; i++) {
+        unsigned int slot, sz;
+        state = state * 1103515245 + 12345;
+        slot = (state >> 8) % ALLOC_RING;
+        /* mostly small, some medium, a few large */
+        sz = (state >> 4) % 16 == 0 ? 4096 + (state % 65536) : 8 + (state % 256);
+        if (ring[slot] != NULL && (state & 0x30) == 0) {
+            ring[slot] = (char *) realloc(ring[slot], sz);
+        } else {
+            free(ring[slot]);
+            ring[slot] = (char *) malloc(sz);
+        }
+        if (ring[slot] == NULL)
+            continue;
+        ring[slot][0] = (char) i;
+        sum += (unsigned char) ring[slot][0];
+    }
+    for (i = 0; i < ALLOC_RING; i++)
+        free(ring[i]);
+    return sum;
+}
+
+static size_t
+kernel_alloc(void)
+{
+    return alloc_work(400000 * scale, 1);
+}
+
+/* Bulk memory operations through the string and memory routines the tools
+ * replace.
+ */
+static size_t
+kernel_memcpy(void)
+{
+    const size_t size = 1024 * 1024;
+    char *src = (char *) malloc(size);
+    char *dst = (char *) malloc(size);
+    size_t sum = 0;
+    unsigned int i;
+    if (src == NULL || dst == NULL)
+        return 0;
+    memset(src, 'a', size);
+    src[size - 1] = '\0';
+    for (i = 0; i < 40 * scale; i++) {
+        memcpy(dst, src, size);
+        memmove(dst + 1, dst, size - 1);
+        sum += strlen(dst + 1);
+        sum += (memcmp(dst + 1, src, size / 2) == 0);
+        memset(dst, (int) i, size / 2);
+    }
+    free(src);
+    free(dst);
+    return sum;
+}
+
+/* Pointer chasing through heap nodes linked in random order, which defeats
+ * any locality in the tools' shadow and metadata lookups.
+ */
+typedef struct _node_t {
+    struct _node_t *next;
+    size_t value;
+} node_t;
+
+static size_t
+kernel_ptrchase(void)
+{
+    const unsigned int num = 1 << 16;
+    node_t **nodes = (node_t **) malloc(num * sizeof(*nodes));
+    node_t *cur;
+    size_t sum = 0;
+    unsigned int i, j;
+    if (nodes == NULL)
+        return 0;
+    for (i = 0; i < num; i++) {
+        nodes[i] = (node_t *) malloc(sizeof(node_t));
+        nodes[i]->value = i;
+    }
+    /* shuffle, then link in shuffled order */
+    for (i = num - 1; i > 0; i--) {
+        node_t *tmp;
+        j = next_rand() % (i + 1);
+        tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+    }
+    for (i = 0; i < num; i++)
+        nodes[i]->next = nodes[(i + 1) % num];
+    cur = nodes[0];
+    for (i = 0; i < 100 * scale * num; i++) {
+        sum += cur->value;
+        cur = cur->next;
+    }
+    for (i = 0; i < num; i++)
+        free(nodes[i]);
+    free(nodes);
+    return sum;
+}
+
+/* Syscall-heavy I/O: small writes and reads on a temporary file */
+static size_t
+kernel_syscall(void)
+{
+    char buf[512];
+    size_t sum = 0;
+    unsigned int i, j;
+#ifdef WIN32
+    char path[MAX_PATH], dir[MAX_PATH];
+    HANDLE f;
+    DWORD got;
+    GetTempPathA(sizeof(dir), dir);
+    GetTempFileNameA(dir, "drb", 0, path);
+#else
+    char path[] = "/tmp/drmem_benchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return 0;
+    close(fd);
+#endif
+    memset(buf, 'x', sizeof(buf));
+    for (i = 0; i < 20 * scale; i++) {
+#ifdef WIN32
+        f = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                        FILE_ATTRIBUTE_TEMPORARY, NULL);
+        if (f == INVALID_HANDLE_VALUE)
+            break;
+        for (j = 0; j < 256; j++)
+            WriteFile(f, buf, sizeof(buf), &got, NULL);
+        SetFilePointer(f, 0, NULL, FILE_BEGIN);
+        for (j = 0; j < 256; j++) {
+            if (ReadFile(f, buf, sizeof(buf), &got, NULL))
+                sum += got;
+        }
+        CloseHandle(f);
+#else
+        fd = open(path, O_RDWR | O_TRUNC);
+        if (fd < 0)
+            break;
+        for (j = 0; j < 256; j++) {
+            if (write(fd, buf, sizeof(buf)) < 0)
+                break;
+        }
+        lseek(fd, 0, SEEK_SET);
+        for (j = 0; j < 256; j++) {
+            ssize_t res = read(fd, buf, sizeof(buf));
+            if (res > 0)
+                sum += res;
+        }
+        close(fd);
+#endif
+    }
+#ifdef WIN32
+    DeleteFileA(path);
+#else
+    unlink(path);
+#endif
+    return sum;
+}
+
+/* Deep callstacks: every allocation and free happens CALL_DEPTH frames
+ * down, where the tools walk the stack to record the callstack.
+ */
+static size_t
+recurse_alloc(unsigned int depth, unsigned int iters)
+{
+    size_t sum = 0;
+    unsigned int i;
+    if (depth > 0)
+        return recurse_alloc(depth - 1, iters) + 1;
+    for (i = 0; i < iters; i++) {
+        char *p = (char *) malloc(16 + (i % 64));
+        if (p == NULL)
+            continue;
+        p[0] = (char) i;
+        sum += (unsigned char) p[0];
+        free(p);
+    }
+    return sum;
+}
+
+static size_t
+kernel_callstack(void)
+{
+    size_t sum = 0;
+    unsigned int i;
+    for (i = 0; i < 100 * scale; i++)
+        sum += recurse_alloc(CALL_DEPTH + (i % 8), 500);
+    return sum;
+}
+
+/* Multithreaded contention: every thread runs the allocation storm at once */
+static size_t thread_sums[NUM_THREADS];
+
+#ifdef WIN32
+static DWORD WINAPI
+thread_func(LPVOID arg)
+#else
+static void *
+thread_func(void *arg)
+#endif
+{
+    unsigned int idx = (unsigned int)(size_t) arg;
+    thread_sums[idx] = alloc_work(200000 * scale, idx + 1);
+    return 0;
+}
+
+static size_t
+kernel_threads(void)
+{
+    size_t sum = 0;
+    unsigned int i;
+#ifdef WIN32
+    HANDLE threads[NUM_THREADS];
+    for (i = 0; i < NUM_THREADS; i++)
+        threads[i] = CreateThread(NULL, 0, thread_func, (LPVOID)(size_t) i, 0, NULL);
+    WaitForMultipleObjects(NUM_THREADS, threads, TRUE, INFINITE);
+    for (i = 0; i < NUM_THREADS; i++)
+        CloseHandle(threads[i]);
+#else
+    pthread_t threads[NUM_THREADS];
+    for (i = 0; i < NUM_THREADS; i++)
+        pthread_create(&threads[i], NULL, thread_func, (void *)(size_t) i);
+    for (i = 0; i < NUM_THREADS; i++)
+        pthread_join(threads[i], NULL);
+#endif
+    for (i = 0; i < NUM_THREADS; i++)
+        sum += thread_sums[i];
+    return sum;
+}
+
+/***************************************************************************
+ * DRIVER
+ */
+
+typedef struct _kernel_t {
+    const char *name;
+    size_t (*func)(void);
+} kernel_t;
+
+static const kernel_t kernels[] = {
+    { "alloc",     kernel_alloc },
+    { "memcpy",    kernel_memcpy },
+    { "ptrchase",  kernel_ptrchase },
+    { "syscall",   kernel_syscall },
+    { "callstack", kernel_callstack },
+    { "threads",   kernel_threads },
+};
+#define NUM_KERNELS (sizeof(kernels)/sizeof(kernels[0]))
+
+static void
+run_kernel(const kernel_t *k)
+{
+    double start = now_ms();
+    size_t sum = k->func();
+    double end = now_ms();
+    printf("bench %s %.1f %lu\n", k->name, end - start, (unsigned long) sum);
+    fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned int i;
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <kernel>|all [scale]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2)
+        scale = (unsigned int) atoi(argv[2]);
+    if (scale == 0)
+        scale = 1;
+    for (i = 0; i < NUM_KERNELS; i++) {
+        if (strcmp(argv[1], "all") == 0 || strcmp(argv[1], kernels[i].name) == 0) {
+            run_kernel(&kernels[i]);
+            if (strcmp(argv[1], "all") != 0)
+                return 0;
+        }
+    }
+    if (strcmp(argv[1], "all") == 0)
+        return 0;
+    fprintf(stderr, "unknown kernel %s\n", argv[1]);
+    return 1;
+}
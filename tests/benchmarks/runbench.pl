@@ -0,0 +1,151 @@
+#!/usr/bin/perl
+
+# **********************************************************
+# Copyright (c) 2026 Google, Inc.  All rights reserved.
+# **********************************************************
+
+# Dr. Memory: the memory debugger
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation;
+# version 2.1 of the License, and no later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Library General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Runs each bench_kernels kernel natively and under every mode of the tool,
+# prints the slowdown versus native, and writes the results as JSON so they
+# can be tracked across releases.  Each kernel stresses one part of the tool:
+#
+#   alloc      heap replacement or wrapping and redzones
+#   memcpy     shadow propagation through string and memory routines
+#   ptrchase   shadow lookups on scattered heap loads
+#   syscall    system call parameter checking
+#   callstack  callstack walking at allocation and free
+#   threads    lock contention in the allocator and shadow updates
+#
+# Usage:
+#   runbench.pl -tool drmemory|drheapstat -frontend <path> -app <bench_kernels>
+#               [-out <file.json>] [-modes m1,m2] [-runs N] [-scale N]
+#               [-kernels k1,k2]
+
+use strict;
+use Getopt::Long;
+
+my $tool = 'drmemory';
+my $frontend = '';
+my $app = '';
+my $outfile = 'benchmarks.json';
+my $modes_arg = '';
+my $kernels_arg = 'alloc,memcpy,ptrchase,syscall,callstack,threads';
+my $runs = 3;
+my $scale = 1;
+
+if (!GetOptions("tool=s" => \$tool,
+                "frontend=s" => \$frontend,
+                "app=s" => \$app,
+                "out=s" => \$outfile,
+                "modes=s" => \$modes_arg,
+                "kernels=s" => \$kernels_arg,
+                "runs=i" => \$runs,
+                "scale=i" => \$scale) ||
+    $frontend eq '' || $app eq '') {
+    die "usage: $0 -tool drmemory|drheapstat -frontend <path> -app <path> ".
+        "[-out <file>] [-modes m1,m2] [-kernels k1,k2] [-runs N] [-scale N]\n";
+}
+
+my %tool_modes = ('drmemory' => [['full', ''],
+                                 ['light', '-light'],
+                                 ['pattern', '-pattern 0xf1fd'],
+                                 ['leaks_only', '-leaks_only']],
+                  'drheapstat' => [['heapstat', '']]);
+die "unknown tool $tool\n" unless defined($tool_modes{$tool});
+my @modes = @{$tool_modes{$tool}};
+if ($modes_arg ne '') {
+    my %want = map { $_ => 1 } split(',', $modes_arg);
+    @modes = grep { $want{$_->[0]} } @modes;
+}
+my @kernels = split(',', $kernels_arg);
+# Keep the front-end from opening the results or printing a summary
+my $batch = ($tool eq 'drmemory') ? '-batch -quiet' : '';
+
+# Returns the best time in ms over $runs runs, or -1 on failure
+sub run_kernel($$) {
+    my ($prefix, $kernel) = @_;
+    my $best = -1;
+    for (my $i = 0; $i < $runs; $i++) {
+        my $out = `$prefix "$app" $kernel $scale 2>&1`;
+        if ($out !~ /^bench $kernel ([\d\.]+) /m) {
+            print STDERR "failed to run $kernel under \"$prefix\":\n$out\n";
+            return -1;
+        }
+        $best = $1 if ($best < 0 || $1 < $best);
+    }
+    return $best;
+}
+
+my %native;
+my %results;
+foreach my $k (@kernels) {
+    $native{$k} = run_kernel('', $k);
+}
+foreach my $m (@modes) {
+    my ($name, $ops) = @{$m};
+    foreach my $k (@kernels) {
+        $results{$name}{$k} = run_kernel("\"$frontend\" $batch $ops --", $k);
+    }
+}
+
+# Human-readable table
+printf("%-12s %10s", "kernel", "native ms");
+foreach my $m (@modes) {
+    printf(" %12s", $m->[0]);
+}
+print "\n";
+foreach my $k (@kernels) {
+    printf("%-12s %10.1f", $k, $native{$k});
+    foreach my $m (@modes) {
+        my $t = $results{$m->[0]}{$k};
+        if ($t < 0 || $native{$k} <= 0) {
+            printf(" %12s", "n/a");
+        } else {
+            printf(" %11.1fx", $t / $native{$k});
+        }
+    }
+    print "\n";
+}
+
+# Machine-readable results
+open(OUT, "> $outfile") || die "cannot write $outfile: $!\n";
+print OUT "{\n";
+print OUT "  \"tool\": \"$tool\",\n";
+print OUT "  \"timestamp\": " . time() . ",\n";
+print OUT "  \"platform\": \"$^O\",\n";
+print OUT "  \"scale\": $scale,\n";
+print OUT "  \"runs\": $runs,\n";
+print OUT "  \"results\": [\n";
+my @entries;
+foreach my $k (@kernels) {
+    push @entries, sprintf("    {\"kernel\": \"%s\", \"mode\": \"native\", ".
+                           "\"ms\": %.1f, \"slowdown\": 1.0}", $k, $native{$k});
+    foreach my $m (@modes) {
+        my $t = $results{$m->[0]}{$k};
+        my $slowdown = ($t < 0 || $native{$k} <= 0) ? 'null' :
+            sprintf("%.2f", $t / $native{$k});
+        push @entries, sprintf("    {\"kernel\": \"%s\", \"mode\": \"%s\", ".
+                               "\"ms\": %s, \"slowdown\": %s}", $k, $m->[0],
+                               ($t < 0) ? 'null' : sprintf("%.1f", $t), $slowdown);
+    }
+}
+print OUT join(",\n", @entries) . "\n";
+print OUT "  ]\n";
+print OUT "}\n";
+close(OUT);
+print "Results written to $outfile\n";
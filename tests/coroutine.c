@@ -0,0 +1,79 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Tests the coroutine stack annotations: many switches among registered
+ * heap-allocated stacks must not be mistaken for stack allocations.
+ */
+
+#include "drmemory_annotations.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#define NUM_COROUTINES 4
+#define STACK_SIZE (64*1024)
+#define NUM_ROUNDS 100
+
+static ucontext_t main_ctx;
+static ucontext_t co_ctx[NUM_COROUTINES];
+static int sums[NUM_COROUTINES];
+
+static void
+coroutine(int idx)
+{
+    int i;
+    char buf[256];
+    for (i = 0; i < NUM_ROUNDS; i++) {
+        memset(buf, i, sizeof(buf));
+        sums[idx] += buf[i % sizeof(buf)];
+        swapcontext(&co_ctx[idx], &main_ctx);
+    }
+}
+
+int
+main()
+{
+    char *stacks[NUM_COROUTINES];
+    int i, round, total = 0;
+    for (i = 0; i < NUM_COROUTINES; i++) {
+        stacks[i] = (char *) malloc(STACK_SIZE);
+        DRMEMORY_ANNOTATE_STACK_REGISTER(stacks[i], STACK_SIZE);
+        getcontext(&co_ctx[i]);
+        co_ctx[i].uc_stack.ss_sp = stacks[i];
+        co_ctx[i].uc_stack.ss_size = STACK_SIZE;
+        co_ctx[i].uc_link = &main_ctx;
+        makecontext(&co_ctx[i], (void (*)(void)) coroutine, 1, i);
+    }
+    /* the last round lets each coroutine return */
+    for (round = 0; round <= NUM_ROUNDS; round++) {
+        for (i = 0; i < NUM_COROUTINES; i++)
+            swapcontext(&main_ctx, &co_ctx[i]);
+    }
+    for (i = 0; i < NUM_COROUTINES; i++) {
+        DRMEMORY_ANNOTATE_STACK_DEREGISTER(stacks[i]);
+        free(stacks[i]);
+        total += sums[i];
+    }
+    printf("total: %d\n", total);
+    printf("all done\n");
+    return 0;
+}
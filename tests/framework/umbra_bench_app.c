@@ -0,0 +1,188 @@
+/* **************************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **************************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Application for the Umbra benchmarks in umbra_client_bench.c.  It only sets
+ * up memory and threads: the client wraps the exported markers below and does
+ * its timing inside them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WINDOWS
+# include <windows.h>
+# define EXPORT __declspec(dllexport)
+#else
+# include <pthread.h>
+# include <sys/mman.h>
+# define EXPORT
+#endif
+
+#define REGION_SIZE (16*1024*1024)
+#define NUM_MAPS 256
+#define MAP_SIZE (256*1024)
+#define MAX_THREADS 8
+
+static char *region;
+
+/* The markers write to their memory so they are not optimized away */
+EXPORT void
+umbra_bench_region(char *base, size_t size)
+{
+    *(volatile char *)base = 0;
+}
+
+EXPORT void
+umbra_bench_map(char *base, size_t size)
+{
+    *(volatile char *)base = 0;
+}
+
+EXPORT void
+umbra_bench_maps_done(int num)
+{
+}
+
+EXPORT void
+umbra_bench_thread(char *base, size_t size)
+{
+    *(volatile char *)base = 0;
+}
+
+EXPORT void
+umbra_bench_threads_start(int num)
+{
+}
+
+EXPORT void
+umbra_bench_threads_end(int num)
+{
+}
+
+static char *
+map_memory(size_t size)
+{
+#ifdef WINDOWS
+    return (char *) VirtualAlloc(NULL, size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+#else
+    char *p = (char *) mmap(NULL, size, PROT_READ|PROT_WRITE,
+                            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    return (p == MAP_FAILED) ? NULL : p;
+#endif
+}
+
+static void
+unmap_memory(char *p, size_t size)
+{
+#ifdef WINDOWS
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, size);
+#endif
+}
+
+#ifdef WINDOWS
+static DWORD WINAPI
+thread_func(LPVOID arg)
+#else
+static void *
+thread_func(void *arg)
+#endif
+{
+    int i = (int)(size_t) arg;
+    umbra_bench_thread(region + i * (REGION_SIZE / MAX_THREADS),
+                       REGION_SIZE / MAX_THREADS);
+    return 0;
+}
+
+static void
+run_threads(int num)
+{
+#ifdef WINDOWS
+    HANDLE threads[MAX_THREADS];
+#else
+    pthread_t threads[MAX_THREADS];
+#endif
+    int i;
+    umbra_bench_threads_start(num);
+    for (i = 0; i < num; i++) {
+#ifdef WINDOWS
+        threads[i] = CreateThread(NULL, 0, thread_func, (LPVOID)(size_t) i, 0, NULL);
+#else
+        pthread_create(&threads[i], NULL, thread_func, (void *)(size_t) i);
+#endif
+    }
+    for (i = 0; i < num; i++) {
+#ifdef WINDOWS
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+    umbra_bench_threads_end(num);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int i;
+    region = (char *) malloc(REGION_SIZE);
+    if (region == NULL) {
+        printf("failed to allocate\n");
+        return 1;
+    }
+    memset(region, 0, REGION_SIZE);
+    umbra_bench_region(region, REGION_SIZE);
+
+    /* mmap-heavy pattern: map, touch, and unmap many regions */
+    for (i = 0; i < NUM_MAPS; i++) {
+        char *p = map_memory(MAP_SIZE);
+        size_t j;
+        if (p == NULL) {
+            printf("failed to map\n");
+            return 1;
+        }
+        for (j = 0; j < MAP_SIZE; j += 4096)
+            p[j] = 1;
+        umbra_bench_map(p, MAP_SIZE);
+        unmap_memory(p, MAP_SIZE);
+    }
+    umbra_bench_maps_done(NUM_MAPS);
+
+    for (i = 1; i <= MAX_THREADS; i *= 2)
+        run_threads(i);
+
+    free(region);
+    printf("done\n");
+    return 0;
+}
@@ -0,0 +1,279 @@
+/* **************************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **************************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Umbra microbenchmarks, run on umbra_bench_app with the scale to measure as
+ * the client option: one of down_8x, down_4x, down_2x, same_1x, or up_2x.
+ *
+ * Each measurement is printed to stderr as one line of the form
+ *   BENCH {"scale": "down_4x", "test": "translate", "threads": 1,
+ *          "ops": 1048576, "usec": 12345}
+ * all on one line, for scripts comparing Umbra changes.  ops counts lookups
+ * for translate and read, app bytes for set_range, copy_range, and
+ * map_shadow, and lookups summed over all threads for threads.  These are
+ * measurements, not checks: the test passes whatever the numbers are.
+ */
+
+#include <string.h>
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drwrap.h"
+#include "umbra.h"
+
+/* We don't want a popup so we don't use DR_ASSERT_MSG. */
+#define CHECK(cond, msg) ((void)((cond) ? 0 :                   \
+    (dr_fprintf(STDERR,  "ASSERT FAILURE: %s:%d: %s (%s)\n",    \
+                __FILE__, __LINE__, #cond, msg), dr_abort(), 0)))
+
+/* App bytes between lookups: one per cache line */
+#define STRIDE 64
+#define TRANSLATE_PASSES 4
+#define RANGE_PASSES 8
+
+static const struct {
+    const char *name;
+    umbra_map_scale_t scale;
+} scales[] = {
+    {"down_8x", UMBRA_MAP_SCALE_DOWN_8X},
+    {"down_4x", UMBRA_MAP_SCALE_DOWN_4X},
+    {"down_2x", UMBRA_MAP_SCALE_DOWN_2X},
+    {"same_1x", UMBRA_MAP_SCALE_SAME_1X},
+    {"up_2x",   UMBRA_MAP_SCALE_UP_2X},
+};
+#define NUM_SCALES (sizeof(scales)/sizeof(scales[0]))
+
+static umbra_map_t *umbra_map;
+static const char *scale_name;
+
+/* For the mmap-heavy pattern */
+static uint64 maps_usec;
+static uint64 maps_bytes;
+
+/* For the multithreaded pattern */
+static uint64 threads_start;
+static volatile int threads_ops;
+
+static void
+report(const char *test, int threads, uint64 ops, uint64 usec)
+{
+    dr_fprintf(STDERR, "BENCH {\"scale\": \"%s\", \"test\": \"%s\", \"threads\": %d, "
+               "\"ops\": "UINT64_FORMAT_STRING", \"usec\": "UINT64_FORMAT_STRING"}\n",
+               scale_name, test, threads, ops, usec);
+}
+
+/* Translates one address per STRIDE, starting from scratch for each */
+static uint64
+translate_range(byte *base, size_t size)
+{
+    umbra_shadow_memory_info_t info;
+    byte *shadow;
+    uint64 ops = 0;
+    size_t i;
+    for (i = 0; i < size; i += STRIDE) {
+        umbra_shadow_memory_info_init(&info);
+        if (umbra_get_shadow_memory(umbra_map, base + i, &shadow, &info) !=
+            DRMF_SUCCESS)
+            CHECK(false, "failed to translate");
+        ops++;
+    }
+    return ops;
+}
+
+static uint64
+read_range(byte *base, size_t size)
+{
+    byte buf[2 * STRIDE];
+    uint64 ops = 0;
+    size_t i;
+    for (i = 0; i + STRIDE <= size; i += STRIDE) {
+        size_t shadow_size = sizeof(buf);
+        if (umbra_read_shadow_memory(umbra_map, base + i, STRIDE, &shadow_size,
+                                     buf) != DRMF_SUCCESS)
+            CHECK(false, "failed to read shadow memory");
+        ops++;
+    }
+    return ops;
+}
+
+static void
+bench_region(void *wrapcxt, OUT void **user_data)
+{
+    byte *base = (byte *) drwrap_get_arg(wrapcxt, 0);
+    size_t size = (size_t) drwrap_get_arg(wrapcxt, 1);
+    size_t half = size / 2, shadow_size;
+    uint64 start, ops;
+    int i;
+
+    /* The first set allocates the shadow, so it is not timed */
+    if (umbra_shadow_set_range(umbra_map, base, size, &shadow_size, 0, 1) !=
+        DRMF_SUCCESS)
+        CHECK(false, "failed to set shadow memory");
+
+    start = dr_get_microseconds();
+    for (i = 0, ops = 0; i < TRANSLATE_PASSES; i++)
+        ops += translate_range(base, size);
+    report("translate", 1, ops, dr_get_microseconds() - start);
+
+    start = dr_get_microseconds();
+    for (i = 0, ops = 0; i < TRANSLATE_PASSES; i++)
+        ops += read_range(base, size);
+    report("read", 1, ops, dr_get_microseconds() - start);
+
+    start = dr_get_microseconds();
+    for (i = 0; i < RANGE_PASSES; i++) {
+        if (umbra_shadow_set_range(umbra_map, base, size, &shadow_size,
+                                   (i % 2 == 0) ? 0xff : 0, 1) != DRMF_SUCCESS)
+            CHECK(false, "failed to set shadow memory");
+    }
+    report("set_range", 1, (uint64)size * RANGE_PASSES, dr_get_microseconds() - start);
+
+    start = dr_get_microseconds();
+    for (i = 0; i < RANGE_PASSES; i++) {
+        if (umbra_shadow_copy_range(umbra_map, base, base + half, half,
+                                    &shadow_size) != DRMF_SUCCESS)
+            CHECK(false, "failed to copy shadow memory");
+    }
+    report("copy_range", 1, (uint64)half * RANGE_PASSES, dr_get_microseconds() - start);
+}
+
+/* Sets the shadow of each new mapping, as a tool does when it marks fresh
+ * memory, which is where the shadow is created, and deletes it again as a
+ * tool does on unmap.
+ */
+static void
+bench_map(void *wrapcxt, OUT void **user_data)
+{
+    byte *base = (byte *) drwrap_get_arg(wrapcxt, 0);
+    size_t size = (size_t) drwrap_get_arg(wrapcxt, 1);
+    size_t shadow_size;
+    uint64 start = dr_get_microseconds();
+    if (umbra_shadow_set_range(umbra_map, base, size, &shadow_size, 0xff, 1) !=
+        DRMF_SUCCESS)
+        CHECK(false, "failed to set shadow memory");
+    if (umbra_delete_shadow_memory(umbra_map, base, size) != DRMF_SUCCESS)
+        CHECK(false, "failed to delete shadow memory");
+    maps_usec += dr_get_microseconds() - start;
+    maps_bytes += size;
+}
+
+static void
+bench_maps_done(void *wrapcxt, OUT void **user_data)
+{
+    report("map_shadow", 1, maps_bytes, maps_usec);
+}
+
+static void
+bench_thread(void *wrapcxt, OUT void **user_data)
+{
+    byte *base = (byte *) drwrap_get_arg(wrapcxt, 0);
+    size_t size = (size_t) drwrap_get_arg(wrapcxt, 1);
+    uint64 ops = 0;
+    int i;
+    for (i = 0; i < TRANSLATE_PASSES; i++)
+        ops += translate_range(base, size);
+    dr_atomic_add32_return_sum(&threads_ops, (int) ops);
+}
+
+static void
+bench_threads_start(void *wrapcxt, OUT void **user_data)
+{
+    threads_ops = 0;
+    threads_start = dr_get_microseconds();
+}
+
+static void
+bench_threads_end(void *wrapcxt, OUT void **user_data)
+{
+    int num = (int)(ptr_int_t) drwrap_get_arg(wrapcxt, 0);
+    report("threads", num, (uint64) threads_ops, dr_get_microseconds() - threads_start);
+}
+
+static void
+wrap_marker(module_data_t *app, const char *name,
+            void (*pre)(void *wrapcxt, OUT void **user_data))
+{
+    app_pc pc = (app_pc) dr_get_proc_address(app->handle, name);
+    CHECK(pc != NULL, "failed to find marker");
+    if (!drwrap_wrap(pc, pre, NULL))
+        CHECK(false, "failed to wrap marker");
+}
+
+static void
+exit_event(void)
+{
+    if (umbra_destroy_mapping(umbra_map) != DRMF_SUCCESS)
+        CHECK(false, "failed to destroy shadow memory mapping");
+    umbra_exit();
+    drwrap_exit();
+    drmgr_exit();
+    dr_fprintf(STDERR, "TEST PASSED\n");
+}
+
+DR_EXPORT void
+dr_client_main(client_id_t id, int argc, const char *argv[])
+{
+    umbra_map_options_t umbra_map_ops;
+    module_data_t *app;
+    uint i;
+
+    CHECK(argc == 2, "expected the scale as the only argument");
+    for (i = 0; i < NUM_SCALES; i++) {
+        if (strcmp(argv[1], scales[i].name) == 0)
+            break;
+    }
+    CHECK(i < NUM_SCALES, "unknown scale");
+    scale_name = scales[i].name;
+
+    drmgr_init();
+    drwrap_init();
+    memset(&umbra_map_ops, 0, sizeof(umbra_map_ops));
+    umbra_map_ops.scale = scales[i].scale;
+    umbra_map_ops.flags = UMBRA_MAP_CREATE_SHADOW_ON_TOUCH |
+        UMBRA_MAP_SHADOW_SHARED_READONLY;
+    umbra_map_ops.default_value = 0;
+    umbra_map_ops.default_value_size = 1;
+    if (umbra_init(id) != DRMF_SUCCESS)
+        CHECK(false, "failed to init umbra");
+    if (umbra_create_mapping(&umbra_map_ops, &umbra_map) != DRMF_SUCCESS)
+        CHECK(false, "failed to create shadow memory mapping");
+
+    app = dr_get_main_module();
+    CHECK(app != NULL, "failed to get application module");
+    wrap_marker(app, "umbra_bench_region", bench_region);
+    wrap_marker(app, "umbra_bench_map", bench_map);
+    wrap_marker(app, "umbra_bench_maps_done", bench_maps_done);
+    wrap_marker(app, "umbra_bench_thread", bench_thread);
+    wrap_marker(app, "umbra_bench_threads_start", bench_threads_start);
+    wrap_marker(app, "umbra_bench_threads_end", bench_threads_end);
+    dr_free_module_data(app);
+    dr_register_exit_event(exit_event);
+}
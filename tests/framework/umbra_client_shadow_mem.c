@@ -94,6 +94,18 @@ write_shadow_mem(void *reg)
         DR_ASSERT(false);
 }
 
+static bool
+check_span(umbra_map_t *map, app_pc app_start, size_t app_size,
+           byte *shadow_start, size_t shadow_size,
+           umbra_shadow_memory_type_t shadow_type, void *user_data)
+{
+    size_t *total = (size_t *) user_data;
+    DR_ASSERT(shadow_start != NULL && shadow_size == 1);
+    DR_ASSERT(*shadow_start == MAGIC_VALUE);
+    *total += app_size;
+    return true;
+}
+
 static void
 read_shadow_mem(void *reg)
 {
@@ -106,6 +118,14 @@ read_shadow_mem(void *reg)
         DR_ASSERT(false);
     dr_printf("%x\n", buffer);
     DR_ASSERT(buffer == MAGIC_VALUE);
+    if (ALIGNED(reg, 4)) {
+        /* The same shadow byte through umbra_iterate_shadow_range() */
+        size_t total = 0;
+        if (umbra_iterate_shadow_range(umbra_map, reg, 4, &total,
+                                       check_span) != DRMF_SUCCESS)
+            DR_ASSERT(false);
+        DR_ASSERT(total == 4);
+    }
 }
 
 static void
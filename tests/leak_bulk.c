@@ -0,0 +1,60 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Tests that the leak scan's block-at-a-time filter for large non-pointer
+ * data still finds the few real pointers among it.  The primary scan time
+ * is in the global log at -verbose 1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BULK_WORDS (2*1024*1024)
+
+/* Non-pointer data, apart from two words (one in the middle of a block and
+ * one in the very last word).
+ */
+static void *bulk[BULK_WORDS];
+
+static void
+leak_one(void)
+{
+    char *p = malloc(sizeof(p)*4);
+    if (p == NULL)
+        printf("malloc failed\n");
+}
+
+int
+main()
+{
+    char *reach, *maybe;
+    size_t i;
+    for (i = 0; i < BULK_WORDS; i++)
+        bulk[i] = (void *)(i & 0xffff);
+    reach = malloc(sizeof(reach)*4);
+    maybe = malloc(sizeof(maybe)*4);
+    bulk[BULK_WORDS/2 + 3] = reach;
+    /* A mid-chunk pointer, for a possible leak */
+    bulk[BULK_WORDS - 1] = maybe + sizeof(maybe);
+    leak_one();
+    printf("all done\n");
+    return 0;
+}
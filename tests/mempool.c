@@ -0,0 +1,54 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Tests the custom pool annotations. */
+
+#include "drmemory_annotations.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_SIZE (64*1024)
+
+static int pool;
+
+int
+main()
+{
+    char *arena = (char *) malloc(ARENA_SIZE);
+    char *a, *b;
+    volatile char c;
+    DRMEMORY_ANNOTATE_POOL_CREATE(&pool, arena, ARENA_SIZE);
+    a = arena;
+    DRMEMORY_ANNOTATE_POOL_ALLOC(&pool, a, 32);
+    b = arena + 64;
+    DRMEMORY_ANNOTATE_POOL_ALLOC(&pool, b, 16);
+    memset(a, 1, 32);
+    memset(b, 2, 16);
+    DRMEMORY_ANNOTATE_POOL_FREE(&pool, a);
+    DRMEMORY_ANNOTATE_POOL_FREE(&pool, a); /* invalid heap arg */
+    DRMEMORY_ANNOTATE_POOL_RESET(&pool);
+    c = b[0]; /* unaddressable */
+    DRMEMORY_ANNOTATE_POOL_DESTROY(&pool);
+    free(arena);
+    printf("all done\n");
+    return 0;
+}
@@ -0,0 +1,49 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Tests that -track_origins reports the allocation holding uninitialized
+ * bytes that reach a system call.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define BUF_SIZE 16
+
+int
+main()
+{
+    char *buf;
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd < 0) {
+        printf("open failed\n");
+        return 1;
+    }
+    buf = malloc(BUF_SIZE);
+    /* ERROR: uninitialized bytes passed to write */
+    if (write(fd, buf, BUF_SIZE) != BUF_SIZE)
+        printf("write failed\n");
+    free(buf);
+    close(fd);
+    printf("all done\n");
+    return 0;
+}
@@ -0,0 +1,988 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Merges the results.jsonl files written by -results_jsonl in many processes.
+ *
+ * Errors are identified across processes by a hash of their type and
+ * normalized callstack: each module frame contributes its module's base name
+ * and offset, as module ids and load addresses differ between processes, and
+ * frames outside of any module contribute only a placeholder.  Suppression
+ * usage is merged by suppression name and type.
+ *
+ * Worker threads each take the next unread file and merge it into a table of
+ * their own, so reading and hashing proceed in parallel with no locking.  The
+ * per-thread tables, which are only as large as the number of distinct
+ * errors, are combined at the end.  Each merged error keeps the report of the
+ * first file, in command-line order, to report it, so the output does not
+ * depend on the thread schedule.
+ *
+ * The merged errors can be written back out as a results.jsonl file of their
+ * own, with module ids renumbered, which the symresults tool can symbolize.
+ *
+ * We only parse what -results_jsonl writes: this is not a general JSON parser.
+ */
+
+#ifdef WINDOWS
+/* We use drfrontendlib, whose model has us take in UTF-16 argv */
+# define UNICODE
+# define _UNICODE
+#endif
+
+#include "dr_api.h"
+#include "dr_frontend.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WINDOWS
+# include <windows.h>
+#else
+# include <pthread.h>
+# include <unistd.h>
+# include <ctype.h>
+#endif
+
+/* Pull in BUFFER_SIZE_ELEMENTS, IF_WINDOWS, TESTALL, and other useful macros */
+#include "utils.h"
+
+#ifndef WINDOWS
+# define _stricmp strcasecmp
+#endif
+
+#define USAGE "Usage:\n\
+  %s [-threads <N>] [-o <output file>] <results.jsonl | @listfile>...\n\
+Merges the results.jsonl files written by -results_jsonl in many processes,\n\
+identifying errors across processes by their type and callstack, and prints\n\
+a combined summary.\n\
+Optional parameters:\n\
+  -threads = the number of files to read in parallel (default: one per CPU)\n\
+  -o       = also write the merged errors as a results.jsonl file\n\
+  @file    = read the paths to merge from file, one per line\n"
+
+#define MAX_THREADS 64
+#define ERROR_TABLE_BITS 10
+#define SUPP_TABLE_BITS 6
+#define MODULE_TABLE_BITS 8
+
+/* One distinct error */
+typedef struct _merged_error_t {
+    uint64 hash;
+    /* The first report of the error: from the earliest file seen so far */
+    uint first_file;
+    char *line;
+    /* The path of each module frame of line, in order */
+    char **frame_paths;
+    uint num_frame_paths;
+    /* Totals */
+    uint processes;
+    uint64 count;
+    /* 1 + the index of the last file to count toward processes */
+    uint last_file;
+    struct _merged_error_t *next;
+} merged_error_t;
+
+typedef struct _merged_supp_t {
+    char *name;
+    char *type;
+    bool is_default;
+    uint processes;
+    uint64 count;
+    uint64 bytes_leaked;
+    uint last_file;
+    struct _merged_supp_t *next;
+} merged_supp_t;
+
+typedef struct _worker_t {
+    merged_error_t *errors[1 << ERROR_TABLE_BITS];
+    uint num_errors;
+    merged_supp_t *supps[1 << SUPP_TABLE_BITS];
+    /* Per-file scratch, kept across files to avoid reallocating */
+    char **modpaths; /* indexed by modid */
+    uint max_modpaths;
+    merged_error_t **ids[2]; /* indexed by potential and by id */
+    uint max_ids[2];
+    /* Statistics */
+    uint files_read;
+    uint files_failed;
+    uint files_with_errors;
+} worker_t;
+
+static char **files;
+static uint num_files;
+static uint max_files;
+/* the next file index for a worker to take */
+static volatile int next_file;
+
+static FILE *out;
+
+static void *
+xrealloc(void *ptr, size_t size)
+{
+    void *res = realloc(ptr, size);
+    if (res == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    return res;
+}
+
+static char *
+xstrdup(const char *str)
+{
+    size_t len = strlen(str);
+    char *res = (char *) xrealloc(NULL, len + 1);
+    memcpy(res, str, len + 1);
+    return res;
+}
+
+static int
+atomic_next_file(void)
+{
+#ifdef WINDOWS
+    return InterlockedIncrement((volatile LONG *)&next_file) - 1;
+#else
+    return __sync_fetch_and_add(&next_file, 1);
+#endif
+}
+
+/***************************************************************************
+ * Parsing: as in symresults
+ */
+
+/* Returns the start of the value for key within [start, end), or NULL.
+ * A key cannot match inside a string value, as quotes there are escaped.
+ */
+static const char *
+json_find(const char *start, const char *end, const char *key)
+{
+    char pattern[64];
+    const char *p;
+    _snprintf(pattern, BUFFER_SIZE_ELEMENTS(pattern), "\"%s\":", key);
+    NULL_TERMINATE_BUFFER(pattern);
+    p = strstr(start, pattern);
+    if (p == NULL || p >= end)
+        return NULL;
+    return p + strlen(pattern);
+}
+
+static uint64
+json_number(const char *start, const char *end, const char *key, uint64 dflt)
+{
+    const char *p = json_find(start, end, key);
+    if (p == NULL)
+        return dflt;
+    /* Addresses and offsets are hex strings */
+    if (*p == '"')
+        return strtoull(p + 1, NULL, 16);
+    return strtoull(p, NULL, 10);
+}
+
+static bool
+json_bool(const char *start, const char *end, const char *key)
+{
+    const char *p = json_find(start, end, key);
+    return (p != NULL && strncmp(p, "true", 4) == 0);
+}
+
+/* Unescapes the string value for key into buf.  Returns false if not found. */
+static bool
+json_string(const char *start, const char *end, const char *key,
+            char *buf, size_t bufsz)
+{
+    const char *p = json_find(start, end, key);
+    size_t i = 0;
+    if (p == NULL || *p != '"')
+        return false;
+    for (p++; *p != '"' && *p != '\0' && i + 1 < bufsz; p++) {
+        if (*p == '\\') {
+            p++;
+            if (*p == 'u') {
+                buf[i++] = (char) strtoul(p + 1, NULL, 16);
+                p += 4;
+                continue;
+            }
+            if (*p == '\0')
+                break;
+        }
+        buf[i++] = *p;
+    }
+    buf[i] = '\0';
+    return true;
+}
+
+static const char *
+error_frames(const char *line, const char **frames_end)
+{
+    const char *p = json_find(line, line + strlen(line), "frames");
+    if (p == NULL || *p != '[')
+        return NULL;
+    *frames_end = strchr(p, ']');
+    if (*frames_end == NULL)
+        return NULL;
+    return p + 1;
+}
+
+static const char *
+next_frame(const char *p, const char *end, const char **frame_end)
+{
+    while (p < end && *p != '{')
+        p++;
+    if (p >= end)
+        return NULL;
+    *frame_end = strchr(p, '}');
+    if (*frame_end == NULL || *frame_end > end)
+        return NULL;
+    (*frame_end)++;
+    return p;
+}
+
+static bool
+line_is_kind(const char *line, const char *kind)
+{
+    char buf[16];
+    return (json_string(line, line + strlen(line), "kind", buf,
+                        BUFFER_SIZE_ELEMENTS(buf)) &&
+            strcmp(buf, kind) == 0);
+}
+
+static const char *
+modpath_basename(const char *path)
+{
+    const char *c, *res = path;
+    for (c = path; *c != '\0'; c++) {
+        if (*c == DIRSEP || *c == ALT_DIRSEP)
+            res = c + 1;
+    }
+    return res;
+}
+
+/* Returns the file's contents, with each line null-terminated, or NULL */
+static char *
+read_file(const char *path, size_t *size OUT)
+{
+    FILE *f = fopen(path, "rb");
+    char *buf = NULL;
+    size_t sofar = 0, max = 0, len;
+    if (f == NULL)
+        return NULL;
+    do {
+        if (sofar + 1 >= max) {
+            max = (max == 0) ? 64*1024 : max * 2;
+            buf = (char *) xrealloc(buf, max);
+        }
+        len = fread(buf + sofar, 1, max - sofar - 1, f);
+        sofar += len;
+    } while (len > 0);
+    fclose(f);
+    buf[sofar] = '\0';
+    for (len = 0; len < sofar; len++) {
+        if (buf[len] == '\n' || buf[len] == '\r')
+            buf[len] = '\0';
+    }
+    *size = sofar;
+    return buf;
+}
+
+#define FOR_EACH_LINE(line, buf, size) \
+    for (line = buf; line < buf + size; line += strlen(line) + 1)
+
+/***************************************************************************
+ * Hashing
+ */
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static uint64
+hash_bytes(uint64 hash, const char *bytes, size_t len, bool fold_case)
+{
+    size_t i;
+    for (i = 0; i < len; i++) {
+        char c = bytes[i];
+        if (fold_case && c >= 'A' && c <= 'Z')
+            c = c - 'A' + 'a';
+        hash = (hash ^ (unsigned char)c) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint
+hash_string(const char *str, uint bits)
+{
+    uint64 hash = hash_bytes(FNV_OFFSET, str, strlen(str), false);
+    return (uint)(hash >> (64 - bits));
+}
+
+/* Returns a hash of line's type and callstack that is the same in every process.
+ * Module base names are compared case-insensitively on Windows.
+ */
+static uint64
+error_hash(worker_t *w, const char *line)
+{
+    const char *end = line + strlen(line);
+    const char *frames, *frames_end, *frame, *frame_end;
+    char buf[64];
+    uint64 hash = FNV_OFFSET;
+    if (json_string(line, end, "type", buf, BUFFER_SIZE_ELEMENTS(buf)))
+        hash = hash_bytes(hash, buf, strlen(buf), false);
+    hash = hash_bytes(hash, json_bool(line, end, "potential") ? "P" : "-", 1, false);
+    frames = error_frames(line, &frames_end);
+    if (frames == NULL)
+        return hash;
+    for (frame = next_frame(frames, frames_end, &frame_end); frame != NULL;
+         frame = next_frame(frame_end, frames_end, &frame_end)) {
+        if (json_string(frame, frame_end, "syscall", buf, BUFFER_SIZE_ELEMENTS(buf))) {
+            hash = hash_bytes(hash, "|s", 2, false);
+            hash = hash_bytes(hash, buf, strlen(buf), false);
+        } else if (json_find(frame, frame_end, "modid") != NULL) {
+            uint modid = (uint) json_number(frame, frame_end, "modid", 0);
+            uint64 offs = json_number(frame, frame_end, "offs", 0);
+            const char *name = (modid < w->max_modpaths && w->modpaths[modid] != NULL) ?
+                modpath_basename(w->modpaths[modid]) : "?";
+            hash = hash_bytes(hash, "|m", 2, false);
+            hash = hash_bytes(hash, name, strlen(name), IF_WINDOWS_ELSE(true, false));
+            hash = hash_bytes(hash, (const char *)&offs, sizeof(offs), false);
+        } else {
+            /* not in a module: the address is meaningless in another process */
+            hash = hash_bytes(hash, "|?", 2, false);
+        }
+    }
+    return hash;
+}
+
+/***************************************************************************
+ * Per-file merging
+ */
+
+static void
+worker_add_module(worker_t *w, const char *line)
+{
+    char path[MAXIMUM_PATH];
+    const char *end = line + strlen(line);
+    uint modid = (uint) json_number(line, end, "modid", 0);
+    if (!json_string(line, end, "path", path, BUFFER_SIZE_ELEMENTS(path)))
+        return;
+    if (modid >= w->max_modpaths) {
+        uint new_max = modid + 32;
+        w->modpaths = (char **) xrealloc(w->modpaths, new_max * sizeof(*w->modpaths));
+        memset(w->modpaths + w->max_modpaths, 0,
+               (new_max - w->max_modpaths) * sizeof(*w->modpaths));
+        w->max_modpaths = new_max;
+    }
+    if (w->modpaths[modid] == NULL)
+        w->modpaths[modid] = xstrdup(path);
+}
+
+/* Records the module paths of line's frames in err, as the modids are only
+ * meaningful with the modules of line's own file.
+ */
+static void
+error_set_report(worker_t *w, merged_error_t *err, const char *line, uint file)
+{
+    const char *frames, *frames_end, *frame, *frame_end;
+    uint i;
+    for (i = 0; i < err->num_frame_paths; i++)
+        free(err->frame_paths[i]);
+    free(err->frame_paths);
+    free(err->line);
+    err->frame_paths = NULL;
+    err->num_frame_paths = 0;
+    err->first_file = file;
+    err->line = xstrdup(line);
+    frames = error_frames(line, &frames_end);
+    if (frames == NULL)
+        return;
+    for (frame = next_frame(frames, frames_end, &frame_end); frame != NULL;
+         frame = next_frame(frame_end, frames_end, &frame_end)) {
+        uint modid;
+        if (json_find(frame, frame_end, "modid") == NULL)
+            continue;
+        modid = (uint) json_number(frame, frame_end, "modid", 0);
+        err->frame_paths = (char **)
+            xrealloc(err->frame_paths, (err->num_frame_paths + 1) * sizeof(char *));
+        err->frame_paths[err->num_frame_paths++] =
+            xstrdup((modid < w->max_modpaths && w->modpaths[modid] != NULL) ?
+                    w->modpaths[modid] : "?");
+    }
+}
+
+static merged_error_t *
+worker_add_error(worker_t *w, const char *line, uint file)
+{
+    uint64 hash = error_hash(w, line);
+    uint bucket = (uint)(hash >> (64 - ERROR_TABLE_BITS));
+    merged_error_t *err;
+    for (err = w->errors[bucket]; err != NULL; err = err->next) {
+        /* With 64 bits we treat a hash match as a match */
+        if (err->hash == hash)
+            break;
+    }
+    if (err == NULL) {
+        err = (merged_error_t *) xrealloc(NULL, sizeof(*err));
+        memset(err, 0, sizeof(*err));
+        err->hash = hash;
+        err->next = w->errors[bucket];
+        w->errors[bucket] = err;
+        w->num_errors++;
+        error_set_report(w, err, line, file);
+    }
+    /* A process reporting the same error twice, e.g. from two stray pcs,
+     * counts once toward processes.
+     */
+    if (err->last_file != file + 1) {
+        err->last_file = file + 1;
+        err->processes++;
+    }
+    return err;
+}
+
+/* Maps id to err for the count records of the current file */
+static void
+worker_set_id(worker_t *w, bool potential, uint id, merged_error_t *err)
+{
+    uint set = potential ? 1 : 0;
+    if (id >= w->max_ids[set]) {
+        uint new_max = id * 2 + 64;
+        w->ids[set] = (merged_error_t **)
+            xrealloc(w->ids[set], new_max * sizeof(*w->ids[set]));
+        memset(w->ids[set] + w->max_ids[set], 0,
+               (new_max - w->max_ids[set]) * sizeof(*w->ids[set]));
+        w->max_ids[set] = new_max;
+    }
+    w->ids[set][id] = err;
+}
+
+static void
+worker_add_count(worker_t *w, const char *line)
+{
+    const char *end = line + strlen(line);
+    uint set = json_bool(line, end, "potential") ? 1 : 0;
+    uint id = (uint) json_number(line, end, "id", 0);
+    if (id < w->max_ids[set] && w->ids[set][id] != NULL) {
+        /* the error line already counted one */
+        uint64 count = json_number(line, end, "count", 1);
+        if (count > 0)
+            w->ids[set][id]->count += count - 1;
+    }
+}
+
+static void
+worker_add_suppression(worker_t *w, const char *line, uint file)
+{
+    const char *end = line + strlen(line);
+    char name[1024], type[64];
+    uint bucket;
+    merged_supp_t *supp;
+    if (!json_string(line, end, "name", name, BUFFER_SIZE_ELEMENTS(name)) ||
+        !json_string(line, end, "type", type, BUFFER_SIZE_ELEMENTS(type)))
+        return;
+    bucket = hash_string(name, SUPP_TABLE_BITS);
+    for (supp = w->supps[bucket]; supp != NULL; supp = supp->next) {
+        if (strcmp(supp->name, name) == 0 && strcmp(supp->type, type) == 0)
+            break;
+    }
+    if (supp == NULL) {
+        supp = (merged_supp_t *) xrealloc(NULL, sizeof(*supp));
+        memset(supp, 0, sizeof(*supp));
+        supp->name = xstrdup(name);
+        supp->type = xstrdup(type);
+        supp->is_default = json_bool(line, end, "default");
+        supp->next = w->supps[bucket];
+        w->supps[bucket] = supp;
+    }
+    supp->count += json_number(line, end, "count", 0);
+    supp->bytes_leaked += json_number(line, end, "bytes_leaked", 0);
+    if (supp->last_file != file + 1) {
+        supp->last_file = file + 1;
+        supp->processes++;
+    }
+}
+
+static void
+worker_merge_file(worker_t *w, uint file)
+{
+    char *buf, *line;
+    size_t size;
+    uint i;
+    bool any_errors = false;
+    buf = read_file(files[file], &size);
+    if (buf == NULL) {
+        fprintf(stderr, "WARNING: unable to read %s\n", files[file]);
+        w->files_failed++;
+        return;
+    }
+    w->files_read++;
+    /* Modules may be written after the first error that references them */
+    FOR_EACH_LINE(line, buf, size) {
+        if (line_is_kind(line, "module"))
+            worker_add_module(w, line);
+    }
+    FOR_EACH_LINE(line, buf, size) {
+        if (line_is_kind(line, "error")) {
+            const char *end = line + strlen(line);
+            merged_error_t *err = worker_add_error(w, line, file);
+            /* A process that did not reach exit has no count records */
+            err->count++;
+            worker_set_id(w, json_bool(line, end, "potential"),
+                          (uint) json_number(line, end, "id", 0), err);
+            any_errors = true;
+        } else if (line_is_kind(line, "count"))
+            worker_add_count(w, line);
+        else if (line_is_kind(line, "suppression"))
+            worker_add_suppression(w, line, file);
+    }
+    if (any_errors)
+        w->files_with_errors++;
+    for (i = 0; i < w->max_modpaths; i++) {
+        free(w->modpaths[i]);
+        w->modpaths[i] = NULL;
+    }
+    for (i = 0; i < 2; i++) {
+        if (w->max_ids[i] > 0)
+            memset(w->ids[i], 0, w->max_ids[i] * sizeof(*w->ids[i]));
+    }
+    free(buf);
+}
+
+#ifdef WINDOWS
+static DWORD WINAPI
+#else
+static void *
+#endif
+worker_main(void *arg)
+{
+    worker_t *w = (worker_t *) arg;
+    int file;
+    while ((file = atomic_next_file()) < (int)num_files)
+        worker_merge_file(w, (uint)file);
+    return 0;
+}
+
+/***************************************************************************
+ * Combining the workers' tables
+ */
+
+static void
+error_free(merged_error_t *err)
+{
+    uint i;
+    for (i = 0; i < err->num_frame_paths; i++)
+        free(err->frame_paths[i]);
+    free(err->frame_paths);
+    free(err->line);
+    free(err);
+}
+
+/* Moves src's entries into dst.  src is left empty. */
+static void
+worker_combine(worker_t *dst, worker_t *src)
+{
+    uint i;
+    for (i = 0; i < BUFFER_SIZE_ELEMENTS(src->errors); i++) {
+        merged_error_t *err, *next, *match;
+        for (err = src->errors[i]; err != NULL; err = next) {
+            next = err->next;
+            for (match = dst->errors[i]; match != NULL; match = match->next) {
+                if (match->hash == err->hash)
+                    break;
+            }
+            if (match == NULL) {
+                err->next = dst->errors[i];
+                dst->errors[i] = err;
+                dst->num_errors++;
+                continue;
+            }
+            match->processes += err->processes;
+            match->count += err->count;
+            if (err->first_file < match->first_file) {
+                /* Keep the earliest report for a deterministic result */
+                merged_error_t tmp = *match;
+                match->first_file = err->first_file;
+                match->line = err->line;
+                match->frame_paths = err->frame_paths;
+                match->num_frame_paths = err->num_frame_paths;
+                err->line = tmp.line;
+                err->frame_paths = tmp.frame_paths;
+                err->num_frame_paths = tmp.num_frame_paths;
+            }
+            error_free(err);
+        }
+        src->errors[i] = NULL;
+    }
+    for (i = 0; i < BUFFER_SIZE_ELEMENTS(src->supps); i++) {
+        merged_supp_t *supp, *next, *match;
+        for (supp = src->supps[i]; supp != NULL; supp = next) {
+            next = supp->next;
+            for (match = dst->supps[i]; match != NULL; match = match->next) {
+                if (strcmp(match->name, supp->name) == 0 &&
+                    strcmp(match->type, supp->type) == 0)
+                    break;
+            }
+            if (match == NULL) {
+                supp->next = dst->supps[i];
+                dst->supps[i] = supp;
+                continue;
+            }
+            match->processes += supp->processes;
+            match->count += supp->count;
+            match->bytes_leaked += supp->bytes_leaked;
+            free(supp->name);
+            free(supp->type);
+            free(supp);
+        }
+        src->supps[i] = NULL;
+    }
+    dst->files_read += src->files_read;
+    dst->files_failed += src->files_failed;
+    dst->files_with_errors += src->files_with_errors;
+}
+
+static int
+error_cmp(const void *p1, const void *p2)
+{
+    const merged_error_t *e1 = *(const merged_error_t **) p1;
+    const merged_error_t *e2 = *(const merged_error_t **) p2;
+    /* The most widespread first */
+    if (e1->processes != e2->processes)
+        return (e1->processes > e2->processes) ? -1 : 1;
+    if (e1->count != e2->count)
+        return (e1->count > e2->count) ? -1 : 1;
+    if (e1->first_file != e2->first_file)
+        return (e1->first_file < e2->first_file) ? -1 : 1;
+    return (e1->hash < e2->hash) ? -1 : (e1->hash > e2->hash ? 1 : 0);
+}
+
+/***************************************************************************
+ * Output
+ */
+
+typedef struct _out_module_t {
+    char *path;
+    uint modid;
+    struct _out_module_t *next;
+} out_module_t;
+
+static out_module_t *out_modules[1 << MODULE_TABLE_BITS];
+static uint num_out_modules;
+
+static void
+print_json_string(const char *str)
+{
+    const char *c;
+    fputc('"', out);
+    for (c = str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\')
+            fprintf(out, "\\%c", *c);
+        else if ((unsigned char)*c < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char)*c);
+        else
+            fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+/* Returns the output modid for path, writing its record the first time */
+static uint
+out_module_id(const char *path)
+{
+    uint bucket = hash_string(path, MODULE_TABLE_BITS);
+    out_module_t *mod;
+    for (mod = out_modules[bucket]; mod != NULL; mod = mod->next) {
+        if (strcmp(mod->path, path) == 0)
+            return mod->modid;
+    }
+    mod = (out_module_t *) xrealloc(NULL, sizeof(*mod));
+    mod->path = xstrdup(path);
+    mod->modid = num_out_modules++;
+    mod->next = out_modules[bucket];
+    out_modules[bucket] = mod;
+    fprintf(out, "{\"kind\":\"module\",\"modid\":%d,\"path\":", mod->modid);
+    print_json_string(path);
+    fprintf(out, "}\n");
+    return mod->modid;
+}
+
+/* Writes err's report renumbered as id, with its frames' modids renumbered */
+static void
+write_error(merged_error_t *err, uint id)
+{
+    const char *line = err->line, *end = line + strlen(line);
+    const char *rest, *frames, *frames_end, *frame, *frame_end, *copied;
+    uint i, modframe = 0;
+    uint *modids = (uint *) xrealloc(NULL, (err->num_frame_paths + 1) * sizeof(uint));
+    /* The module records must precede the error */
+    for (i = 0; i < err->num_frame_paths; i++)
+        modids[i] = out_module_id(err->frame_paths[i]);
+    rest = json_find(line, end, "id");
+    if (rest == NULL) {
+        free(modids);
+        return;
+    }
+    rest += strspn(rest, "0123456789");
+    fprintf(out, "{\"kind\":\"error\",\"id\":%d,\"processes\":%d,\"example\":",
+            id, err->processes);
+    print_json_string(files[err->first_file]);
+    frames = error_frames(line, &frames_end);
+    if (frames == NULL) {
+        fprintf(out, "%s\n", rest);
+        free(modids);
+        return;
+    }
+    fwrite(rest, 1, frames - rest, out);
+    copied = frames;
+    for (frame = next_frame(frames, frames_end, &frame_end); frame != NULL;
+         frame = next_frame(frame_end, frames_end, &frame_end)) {
+        const char *modid = json_find(frame, frame_end, "modid");
+        if (modid == NULL || modframe >= err->num_frame_paths)
+            continue;
+        /* Everything up to the old modid's value */
+        fwrite(copied, 1, modid - copied, out);
+        fprintf(out, "%d", modids[modframe++]);
+        copied = modid + strspn(modid, "0123456789");
+    }
+    fprintf(out, "%s\n", copied);
+    free(modids);
+}
+
+static void
+write_summary(worker_t *w, merged_error_t **sorted, uint64 elapsed_ms,
+              uint num_threads)
+{
+    uint i;
+    uint64 total = 0;
+    bool printed_header = false;
+    for (i = 0; i < w->num_errors; i++)
+        total += sorted[i]->count;
+    printf("Merged %d files in %d ms using %d threads",
+           w->files_read, (uint) elapsed_ms, num_threads);
+    if (w->files_failed > 0)
+        printf(" (%d could not be read)", w->files_failed);
+    printf("\n%d processes reported %d unique errors, %"INT64_FORMAT"u in total\n",
+           w->files_with_errors, w->num_errors, total);
+    for (i = 0; i < w->num_errors; i++) {
+        merged_error_t *err = sorted[i];
+        const char *end = err->line + strlen(err->line);
+        char type[64];
+        if (!json_string(err->line, end, "type", type, BUFFER_SIZE_ELEMENTS(type)))
+            type[0] = '\0';
+        printf("  %sError #%d: %s: %d processes, %"INT64_FORMAT"u total, e.g. %s\n",
+               json_bool(err->line, end, "potential") ? "Potential " : "", i + 1, type,
+               err->processes, err->count, files[err->first_file]);
+    }
+    for (i = 0; i < BUFFER_SIZE_ELEMENTS(w->supps); i++) {
+        merged_supp_t *supp;
+        for (supp = w->supps[i]; supp != NULL; supp = supp->next) {
+            if (supp->is_default)
+                continue;
+            if (!printed_header) {
+                printf("\nSUPPRESSIONS USED:\n");
+                printed_header = true;
+            }
+            printf("\t%6"INT64_FORMAT"ux in %d processes", supp->count, supp->processes);
+            if (supp->bytes_leaked > 0)
+                printf(" (leaked %7"INT64_FORMAT"u bytes)", supp->bytes_leaked);
+            printf(": %s\n", supp->name);
+        }
+    }
+}
+
+static void
+write_merged(worker_t *w, merged_error_t **sorted)
+{
+    uint i;
+    for (i = 0; i < w->num_errors; i++)
+        write_error(sorted[i], i + 1);
+    for (i = 0; i < w->num_errors; i++) {
+        fprintf(out, "{\"kind\":\"count\",\"id\":%d,\"potential\":%s,"
+                "\"count\":%"INT64_FORMAT"u}\n", i + 1,
+                json_bool(sorted[i]->line, sorted[i]->line + strlen(sorted[i]->line),
+                          "potential") ? "true" : "false", sorted[i]->count);
+    }
+    for (i = 0; i < BUFFER_SIZE_ELEMENTS(w->supps); i++) {
+        merged_supp_t *supp;
+        for (supp = w->supps[i]; supp != NULL; supp = supp->next) {
+            fprintf(out, "{\"kind\":\"suppression\",\"type\":\"%s\",\"default\":%s,"
+                    "\"count\":%"INT64_FORMAT"u,\"bytes_leaked\":%"INT64_FORMAT"u,"
+                    "\"processes\":%d,\"name\":", supp->type,
+                    supp->is_default ? "true" : "false", supp->count,
+                    supp->bytes_leaked, supp->processes);
+            print_json_string(supp->name);
+            fprintf(out, "}\n");
+        }
+    }
+}
+
+/***************************************************************************
+ * Top level
+ */
+
+static void
+add_file(const char *path)
+{
+    if (num_files == max_files) {
+        max_files = (max_files == 0) ? 1024 : max_files * 2;
+        files = (char **) xrealloc(files, max_files * sizeof(*files));
+    }
+    files[num_files++] = xstrdup(path);
+}
+
+static bool
+add_list_file(const char *path)
+{
+    size_t size;
+    char *buf = read_file(path, &size), *line;
+    if (buf == NULL)
+        return false;
+    FOR_EACH_LINE(line, buf, size) {
+        if (line[0] != '\0')
+            add_file(line);
+    }
+    free(buf);
+    return true;
+}
+
+static uint
+default_num_threads(void)
+{
+#ifdef WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long res = sysconf(_SC_NPROCESSORS_ONLN);
+    return (res > 0) ? (uint) res : 1;
+#endif
+}
+
+int
+_tmain(int argc, TCHAR *targv[])
+{
+    int res = 1;
+    char **argv;
+    int i;
+    const char *outpath = NULL;
+    uint num_threads = 0;
+    worker_t *workers = NULL;
+    merged_error_t **sorted = NULL;
+    uint64 start;
+#ifdef WINDOWS
+    HANDLE threads[MAX_THREADS];
+#else
+    pthread_t threads[MAX_THREADS];
+#endif
+
+#if defined(WINDOWS) && !defined(_UNICODE)
+# error _UNICODE must be defined
+#else
+    /* Convert to UTF-8 if necessary */
+    if (drfront_convert_args((const TCHAR **)targv, &argv, argc) != DRFRONT_SUCCESS) {
+        printf("ERROR: failed to process args\n");
+        return 1;
+    }
+#endif
+
+    for (i = 1; i < argc; i++) {
+        if (_stricmp(argv[i], "-threads") == 0 && i + 1 < argc)
+            num_threads = (uint) strtoul(argv[++i], NULL, 10);
+        else if (_stricmp(argv[i], "-o") == 0 && i + 1 < argc)
+            outpath = argv[++i];
+        else if (argv[i][0] == '@') {
+            if (!add_list_file(argv[i] + 1)) {
+                printf("ERROR: unable to read %s\n", argv[i] + 1);
+                goto cleanup;
+            }
+        } else if (argv[i][0] != '-')
+            add_file(argv[i]);
+        else {
+            printf(USAGE, argv[0]);
+            goto cleanup;
+        }
+    }
+    if (num_files == 0) {
+        printf(USAGE, argv[0]);
+        goto cleanup;
+    }
+    if (num_threads == 0)
+        num_threads = default_num_threads();
+    if (num_threads > MAX_THREADS)
+        num_threads = MAX_THREADS;
+    if (num_threads > num_files)
+        num_threads = num_files;
+
+    dr_standalone_init();
+    start = dr_get_milliseconds();
+    workers = (worker_t *) xrealloc(NULL, num_threads * sizeof(*workers));
+    memset(workers, 0, num_threads * sizeof(*workers));
+    /* We do a share of the work on this thread */
+    for (i = 1; i < (int)num_threads; i++) {
+#ifdef WINDOWS
+        threads[i] = CreateThread(NULL, 0, worker_main, &workers[i], 0, NULL);
+        if (threads[i] == NULL) {
+#else
+        if (pthread_create(&threads[i], NULL, worker_main, &workers[i]) != 0) {
+#endif
+            /* the remaining workers pick up the slack */
+            num_threads = i;
+            break;
+        }
+    }
+    worker_main(&workers[0]);
+    for (i = 1; i < (int)num_threads; i++) {
+#ifdef WINDOWS
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+        worker_combine(&workers[0], &workers[i]);
+    }
+
+    sorted = (merged_error_t **)
+        xrealloc(NULL, (workers[0].num_errors + 1) * sizeof(*sorted));
+    {
+        uint j, n = 0;
+        for (j = 0; j < BUFFER_SIZE_ELEMENTS(workers[0].errors); j++) {
+            merged_error_t *err;
+            for (err = workers[0].errors[j]; err != NULL; err = err->next)
+                sorted[n++] = err;
+        }
+        qsort(sorted, n, sizeof(*sorted), error_cmp);
+    }
+    write_summary(&workers[0], sorted, dr_get_milliseconds() - start, num_threads);
+
+    if (outpath != NULL) {
+        out = fopen(outpath, "w");
+        if (out == NULL) {
+            printf("ERROR: unable to write %s\n", outpath);
+            goto cleanup;
+        }
+        write_merged(&workers[0], sorted);
+        fclose(out);
+    }
+    res = 0;
+
+ cleanup:
+    /* We leave the tables to process exit */
+    free(sorted);
+    free(workers);
+    if (drfront_cleanup_args(argv, argc) != DRFRONT_SUCCESS)
+        printf("WARNING: drfront_cleanup_args failed\n");
+    return res;
+}
@@ -33,6 +33,7 @@
 #include "dr_inject.h" /* for cross-arch support */
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* Pull in BUFFER_SIZE_ELEMENTS, IF_WINDOWS, TESTALL, and other useful macros */
@@ -40,6 +41,8 @@
 #undef sscanf /* we can use sscanf */
 
 #define MAX_FUNC_LEN 256
+/* Holds the output of one address lookup */
+#define RESULT_LEN (MAX_FUNC_LEN + MAXIMUM_PATH + 256)
 
 #define MAX_PATH_STR STRINGIFY(MAXIMUM_PATH)
 
@@ -58,6 +61,9 @@
 
 /* forward decls */
 static void symquery_lookup_address(const char *dllpath, size_t modoffs);
+static void symquery_format_address(const char *dllpath, size_t modoffs,
+                                    char *buf, size_t bufsz);
+static void symquery_lookup_batch(FILE *in);
 static void symquery_lookup_symbol(const char *dllpath, const char *sym);
 static void enumerate_symbols(const char *dllpath, const char *match,
                               bool search, bool searchall);
@@ -70,6 +76,8 @@ Look up addresses for one module:\n\
   %s -e <module> [-f] [-v] -a [<address relative to module base> ...]\n\
 Look up addresses for multiple modules:\n\
   %s [-f] [-v] -q <pairs of [module_path;address relative to module base] on stdin>\n\
+Look up many addresses for multiple modules, grouped by module, in input order:\n\
+  %s [-f] [-v] -b [<file of pairs as for -q, else read from stdin>]\n\
 Look up exact symbols for one module:\n\
   %s -e <module> [-v] [--enum] -s [<symbol1> <symbol2> ...]\n"
 
@@ -94,7 +102,7 @@ Optional parameters:\n\
   --enum = look up via external enum rather than drsyms-internal enum\n"
 
 #define PRINT_USAGE(mypath) do {\
-    printf(USAGE_PRE, mypath, mypath, mypath);\
+    printf(USAGE_PRE, mypath, mypath, mypath, mypath);\
     printf(USAGE_MID, mypath, mypath);\
     printf(USAGE_POST, mypath, mypath);\
 } while (0)
@@ -119,6 +127,8 @@ _tmain(int argc, TCHAR *targv[])
     /* options that can be local vars */
     bool addr2sym = false;
     bool addr2sym_multi = false;
+    bool addr2sym_batch = false;
+    const char *batch_file = NULL;
     bool sym2addr = false;
     bool enumerate = false;
     bool enumerate_all = false;
@@ -176,6 +186,11 @@ _tmain(int argc, TCHAR *targv[])
             enum_lines = true;
         } else if (_stricmp(argv[i], "-q") == 0) {
             addr2sym_multi = true;
+        } else if (_stricmp(argv[i], "-b") == 0) {
+            addr2sym_multi = true;
+            addr2sym_batch = true;
+            if (i+1 < argc && argv[i+1][0] != '-')
+                batch_file = argv[++i];
         } else if (_stricmp(argv[i], "--enum") == 0) {
             enumerate = true;
         } else if (_stricmp(argv[i], "--list") == 0) {
@@ -228,6 +243,19 @@ _tmain(int argc, TCHAR *targv[])
                     symquery_lookup_symbol(dll, argv[i]);
             }
         }
+    } else if (addr2sym_batch) {
+        FILE *in = stdin;
+        if (batch_file != NULL) {
+            in = fopen(batch_file, "r");
+            if (in == NULL) {
+                printf("ERROR: unable to open %s\n", batch_file);
+                drsym_exit();
+                goto cleanup;
+            }
+        }
+        symquery_lookup_batch(in);
+        if (in != stdin)
+            fclose(in);
     } else {
         while (!feof(stdin)) {
             char modpath[MAXIMUM_PATH];
@@ -332,9 +360,11 @@ check_architecture(const char *dll, char **argv)
 }
 
 static void
-print_debug_kind(drsym_debug_kind_t kind)
+format_debug_kind(drsym_debug_kind_t kind, char *buf, size_t bufsz, size_t *sofar)
 {
-    printf("<debug info: type=%s, %s symbols, %s line numbers>\n",
+    ssize_t len;
+    BUFPRINT_NO_ASSERT(buf, bufsz, *sofar, len,
+           "<debug info: type=%s, %s symbols, %s line numbers>\n",
            TEST(DRSYM_ELF_SYMTAB, kind) ? "ELF symtab" :
            (TEST(DRSYM_PECOFF_SYMTAB, kind) ? "PECOFF symtab" :
             (TEST(DRSYM_MACHO_SYMTAB, kind) ? "Mach-O symtab" :
@@ -343,6 +373,15 @@ print_debug_kind(drsym_debug_kind_t kind)
            TEST(DRSYM_LINE_NUMS, kind) ? "has" : "NO");
 }
 
+static void
+print_debug_kind(drsym_debug_kind_t kind)
+{
+    char buf[128];
+    size_t sofar = 0;
+    format_debug_kind(kind, buf, BUFFER_SIZE_ELEMENTS(buf), &sofar);
+    printf("%s", buf);
+}
+
 static void
 get_and_print_debug_kind(const char *dllpath)
 {
@@ -352,13 +391,17 @@ get_and_print_debug_kind(const char *dllpath)
         print_debug_kind(kind);
 }
 
+/* Writes the lines that -a and -q print for one address into buf */
 static void
-symquery_lookup_address(const char *dllpath, size_t modoffs)
+symquery_format_address(const char *dllpath, size_t modoffs, char *buf, size_t bufsz)
 {
     drsym_error_t symres;
     drsym_info_t sym;
     char name[MAX_FUNC_LEN];
     char file[MAXIMUM_PATH];
+    size_t sofar = 0;
+    ssize_t len;
+    buf[0] = '\0';
     sym.struct_size = sizeof(sym);
     sym.name = name;
     sym.name_size = MAX_FUNC_LEN;
@@ -367,24 +410,164 @@ symquery_lookup_address(const char *dllpath, size_t modoffs)
     symres = drsym_lookup_address(dllpath, modoffs, &sym, demangle_flags);
     if (symres == DRSYM_SUCCESS || symres == DRSYM_ERROR_LINE_NOT_AVAILABLE) {
         if (verbose)
-            print_debug_kind(sym.debug_kind);
-        if (sym.name_available_size >= sym.name_size)
-            printf("WARNING: function name longer than max: %s\n", sym.name);
-        if (show_func)
-            printf("%s+"SIZE_FMTX"\n", sym.name, (modoffs - sym.start_offs));
+            format_debug_kind(sym.debug_kind, buf, bufsz, &sofar);
+        if (sym.name_available_size >= sym.name_size) {
+            BUFPRINT_NO_ASSERT(buf, bufsz, sofar, len,
+                               "WARNING: function name longer than max: %s\n",
+                               sym.name);
+        }
+        if (show_func) {
+            BUFPRINT_NO_ASSERT(buf, bufsz, sofar, len, "%s+"SIZE_FMTX"\n", sym.name,
+                               (modoffs - sym.start_offs));
+        }
 
         if (symres == DRSYM_ERROR_LINE_NOT_AVAILABLE) {
-            printf("??:0\n");
+            BUFPRINT_NO_ASSERT(buf, bufsz, sofar, len, "??:0\n");
         } else {
-            printf("%s:%"INT64_FORMAT"u+"SIZE_FMTX"\n", sym.file, sym.line,
-                   sym.line_offs);
+            BUFPRINT_NO_ASSERT(buf, bufsz, sofar, len,
+                               "%s:%"INT64_FORMAT"u+"SIZE_FMTX"\n", sym.file, sym.line,
+                               sym.line_offs);
         }
     } else {
-        if (verbose)
-            printf("drsym_lookup_address error %d\n", symres);
-        else if (show_func)
-            printf("?\n");
+        if (verbose) {
+            BUFPRINT_NO_ASSERT(buf, bufsz, sofar, len,
+                               "drsym_lookup_address error %d\n", symres);
+        } else if (show_func)
+            BUFPRINT_NO_ASSERT(buf, bufsz, sofar, len, "?\n");
+    }
+}
+
+static void
+symquery_lookup_address(const char *dllpath, size_t modoffs)
+{
+    char buf[RESULT_LEN];
+    symquery_format_address(dllpath, modoffs, buf, BUFFER_SIZE_ELEMENTS(buf));
+    printf("%s", buf);
+}
+
+static void *
+xrealloc(void *ptr, size_t size)
+{
+    void *res = realloc(ptr, size);
+    if (res == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    return res;
+}
+
+static char *
+xstrdup(const char *str)
+{
+    size_t len = strlen(str);
+    char *res = (char *) xrealloc(NULL, len + 1);
+    memcpy(res, str, len + 1);
+    return res;
+}
+
+/* For -b: each input line, in input order */
+typedef struct _batch_query_t {
+    /* NULL if the line could not be parsed.  Consecutive queries of the same
+     * module share one copy.
+     */
+    char *modpath;
+    size_t modoffs;
+    size_t index;
+    char *result;
+} batch_query_t;
+
+/* Orders by module, then by offset, then by input order */
+static int
+batch_query_cmp(const void *v1, const void *v2)
+{
+    const batch_query_t *q1 = *(const batch_query_t **) v1;
+    const batch_query_t *q2 = *(const batch_query_t **) v2;
+    int res = strcmp(q1->modpath, q2->modpath);
+    if (res != 0)
+        return res;
+    if (q1->modoffs != q2->modoffs)
+        return (q1->modoffs < q2->modoffs) ? -1 : 1;
+    return (q1->index < q2->index) ? -1 : (q1->index > q2->index ? 1 : 0);
+}
+
+/* Reads every pair first and looks them up grouped by module, so that each
+ * module's debug information is loaded once and then freed, rather than
+ * going back and forth between modules as the input does.  The results are
+ * printed in input order at the end.
+ * We do not spread the lookups over threads: drsyms serializes its queries.
+ */
+static void
+symquery_lookup_batch(FILE *in)
+{
+    char line[MAXIMUM_PATH*2];
+    char modpath[MAXIMUM_PATH];
+    char result[RESULT_LEN];
+    batch_query_t *queries = NULL;
+    batch_query_t **sorted = NULL;
+    size_t num = 0, capacity = 0, num_sorted = 0, i;
+    size_t modoffs;
+    char *last_modpath = NULL;
+    while (fgets(line, sizeof(line), in) != NULL && strcmp(line, ";exit\n") != 0) {
+        if (num == capacity) {
+            capacity = (capacity == 0) ? 1024 : capacity * 2;
+            queries = (batch_query_t *)
+                xrealloc(queries, capacity * sizeof(*queries));
+        }
+        queries[num].modpath = NULL;
+        queries[num].result = NULL;
+        queries[num].index = num;
+        if (sscanf(line, "%"MAX_PATH_STR"[^;];"SIZE_FMT, (char *)&modpath,
+                   &modoffs) == 2) {
+            if (last_modpath == NULL || strcmp(modpath, last_modpath) != 0)
+                last_modpath = xstrdup(modpath);
+            queries[num].modpath = last_modpath;
+            queries[num].modoffs = modoffs;
+        } else if (verbose) {
+            _snprintf(result, BUFFER_SIZE_ELEMENTS(result), "Error: unknown input %s",
+                      line);
+            NULL_TERMINATE_BUFFER(result);
+            queries[num].result = xstrdup(result);
+        }
+        num++;
+    }
+
+    sorted = (batch_query_t **) xrealloc(NULL, (num == 0 ? 1 : num) * sizeof(*sorted));
+    for (i = 0; i < num; i++) {
+        if (queries[i].modpath != NULL)
+            sorted[num_sorted++] = &queries[i];
+    }
+    qsort(sorted, num_sorted, sizeof(*sorted), batch_query_cmp);
+    for (i = 0; i < num_sorted; i++) {
+        batch_query_t *q = sorted[i];
+        if (i > 0 && q->modoffs == sorted[i-1]->modoffs &&
+            strcmp(q->modpath, sorted[i-1]->modpath) == 0) {
+            /* a repeated address */
+            q->result = xstrdup(sorted[i-1]->result);
+        } else {
+            symquery_format_address(q->modpath, q->modoffs, result,
+                                    BUFFER_SIZE_ELEMENTS(result));
+            q->result = xstrdup(result);
+        }
+        if (i + 1 == num_sorted || strcmp(q->modpath, sorted[i+1]->modpath) != 0)
+            drsym_free_resources(q->modpath);
+    }
+
+    for (i = 0; i < num; i++) {
+        if (queries[i].result != NULL)
+            printf("%s", queries[i].result);
+    }
+    fflush(stdout);
+
+    last_modpath = NULL;
+    for (i = 0; i < num; i++) {
+        if (queries[i].modpath != NULL && queries[i].modpath != last_modpath) {
+            last_modpath = queries[i].modpath;
+            free(last_modpath);
+        }
+        free(queries[i].result);
     }
+    free(queries);
+    free(sorted);
 }
 
 static void
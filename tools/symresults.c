@@ -0,0 +1,641 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Offline symbolizer for the results.jsonl file written by -results_jsonl.
+ *
+ * We read the whole file, gather every distinct module offset referenced by
+ * any error, and look them up one module at a time so that each module's
+ * debug information is loaded once.  We then write each error back out with
+ * symbols added to its frames, either as JSON lines or as text.
+ *
+ * We only parse what -results_jsonl writes: this is not a general JSON parser.
+ */
+
+#ifdef WINDOWS
+/* We use drfrontendlib, whose model has us take in UTF-16 argv */
+# define UNICODE
+# define _UNICODE
+#endif
+
+#include "dr_api.h"
+#include "drsyms.h"
+#include "dr_frontend.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Pull in BUFFER_SIZE_ELEMENTS, IF_WINDOWS, TESTALL, and other useful macros */
+#include "utils.h"
+
+#define MAX_FUNC_LEN 256
+
+#ifndef WINDOWS
+# define _stricmp strcasecmp
+#endif
+
+#if defined(MACOS) && !defined(X64)
+/* size_t is unsigned long */
+# define SIZE_FMTX "0x%lx"
+#else
+# define SIZE_FMTX PIFX
+#endif
+
+#define USAGE "Usage:\n\
+  %s [-text] [-o <output file>] <results.jsonl>\n\
+Symbolizes the callstacks in a results.jsonl file written by -results_jsonl.\n\
+Optional parameters:\n\
+  -text = write the errors as text rather than as JSON lines\n\
+  -o    = write to the given file rather than to stdout\n"
+
+typedef struct _lookup_t {
+    /* The key */
+    uint modid;
+    size_t offs; /* already adjusted for retaddrs */
+    /* The result */
+    char *func;  /* NULL if not found */
+    size_t funcoffs;
+    char *file;  /* NULL if not found */
+    uint64 line;
+} lookup_t;
+
+static char **modpaths; /* indexed by modid */
+static uint num_modpaths;
+
+static lookup_t *lookups;
+static uint num_lookups;
+static uint max_lookups;
+
+static FILE *out;
+static bool text_output;
+
+/* We could expose the templates via an option */
+static uint demangle_flags = (DRSYM_DEMANGLE | DRSYM_DEMANGLE_PDB_TEMPLATES);
+
+static void *
+xrealloc(void *ptr, size_t size)
+{
+    void *res = realloc(ptr, size);
+    if (res == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    return res;
+}
+
+static char *
+xstrdup(const char *str)
+{
+    size_t len = strlen(str);
+    char *res = (char *) xrealloc(NULL, len + 1);
+    memcpy(res, str, len + 1);
+    return res;
+}
+
+/***************************************************************************
+ * Parsing
+ */
+
+/* Returns the start of the value for key within [start, end), or NULL.
+ * A key cannot match inside a string value, as quotes there are escaped.
+ */
+static const char *
+json_find(const char *start, const char *end, const char *key)
+{
+    char pattern[64];
+    const char *p;
+    _snprintf(pattern, BUFFER_SIZE_ELEMENTS(pattern), "\"%s\":", key);
+    NULL_TERMINATE_BUFFER(pattern);
+    p = strstr(start, pattern);
+    if (p == NULL || p >= end)
+        return NULL;
+    return p + strlen(pattern);
+}
+
+static uint64
+json_number(const char *start, const char *end, const char *key, uint64 dflt)
+{
+    const char *p = json_find(start, end, key);
+    if (p == NULL)
+        return dflt;
+    /* Addresses and offsets are hex strings */
+    if (*p == '"')
+        return strtoull(p + 1, NULL, 16);
+    return strtoull(p, NULL, 10);
+}
+
+static bool
+json_bool(const char *start, const char *end, const char *key)
+{
+    const char *p = json_find(start, end, key);
+    return (p != NULL && strncmp(p, "true", 4) == 0);
+}
+
+/* Unescapes the string value for key into buf.  Returns false if not found. */
+static bool
+json_string(const char *start, const char *end, const char *key,
+            char *buf, size_t bufsz)
+{
+    const char *p = json_find(start, end, key);
+    size_t i = 0;
+    if (p == NULL || *p != '"')
+        return false;
+    for (p++; *p != '"' && *p != '\0' && i + 1 < bufsz; p++) {
+        if (*p == '\\') {
+            p++;
+            if (*p == 'u') {
+                buf[i++] = (char) strtoul(p + 1, NULL, 16);
+                p += 4;
+                continue;
+            }
+            if (*p == '\0')
+                break;
+        }
+        buf[i++] = *p;
+    }
+    buf[i] = '\0';
+    return true;
+}
+
+/* Returns the frames array of an error line and sets *frames_end to its
+ * closing bracket.
+ */
+static const char *
+error_frames(const char *line, const char **frames_end)
+{
+    const char *p = json_find(line, line + strlen(line), "frames");
+    if (p == NULL || *p != '[')
+        return NULL;
+    *frames_end = strchr(p, ']');
+    if (*frames_end == NULL)
+        return NULL;
+    return p + 1;
+}
+
+/* Iterates the frame objects in [p, end).  Our frames have no nested objects. */
+static const char *
+next_frame(const char *p, const char *end, const char **frame_end)
+{
+    while (p < end && *p != '{')
+        p++;
+    if (p >= end)
+        return NULL;
+    *frame_end = strchr(p, '}');
+    if (*frame_end == NULL || *frame_end > end)
+        return NULL;
+    (*frame_end)++;
+    return p;
+}
+
+/* Returns false if not a module frame */
+static bool
+frame_lookup_key(const char *frame, const char *frame_end, lookup_t *key)
+{
+    if (json_find(frame, frame_end, "modid") == NULL)
+        return false;
+    key->modid = (uint) json_number(frame, frame_end, "modid", 0);
+    key->offs = (size_t) json_number(frame, frame_end, "offs", 0);
+    /* Look up the call and not the next source line: xref PR 543863 */
+    if (json_bool(frame, frame_end, "retaddr") && key->offs > 0)
+        key->offs--;
+    return true;
+}
+
+static void
+parse_module(const char *line)
+{
+    char path[MAXIMUM_PATH];
+    const char *end = line + strlen(line);
+    uint modid = (uint) json_number(line, end, "modid", 0);
+    if (!json_string(line, end, "path", path, BUFFER_SIZE_ELEMENTS(path)))
+        return;
+    if (modid >= num_modpaths) {
+        uint new_num = modid + 32;
+        modpaths = (char **) xrealloc(modpaths, new_num * sizeof(*modpaths));
+        memset(modpaths + num_modpaths, 0,
+               (new_num - num_modpaths) * sizeof(*modpaths));
+        num_modpaths = new_num;
+    }
+    if (modpaths[modid] == NULL)
+        modpaths[modid] = xstrdup(path);
+}
+
+static void
+parse_error(const char *line)
+{
+    const char *frames, *frames_end, *frame, *frame_end;
+    frames = error_frames(line, &frames_end);
+    if (frames == NULL)
+        return;
+    for (frame = next_frame(frames, frames_end, &frame_end); frame != NULL;
+         frame = next_frame(frame_end, frames_end, &frame_end)) {
+        lookup_t key;
+        if (!frame_lookup_key(frame, frame_end, &key))
+            continue;
+        if (num_lookups == max_lookups) {
+            max_lookups = (max_lookups == 0) ? 1024 : max_lookups * 2;
+            lookups = (lookup_t *) xrealloc(lookups, max_lookups * sizeof(*lookups));
+        }
+        memset(&lookups[num_lookups], 0, sizeof(lookups[num_lookups]));
+        lookups[num_lookups].modid = key.modid;
+        lookups[num_lookups].offs = key.offs;
+        num_lookups++;
+    }
+}
+
+/***************************************************************************
+ * Symbolizing
+ */
+
+static int
+lookup_cmp(const void *p1, const void *p2)
+{
+    const lookup_t *l1 = (const lookup_t *) p1;
+    const lookup_t *l2 = (const lookup_t *) p2;
+    if (l1->modid != l2->modid)
+        return (l1->modid < l2->modid) ? -1 : 1;
+    if (l1->offs != l2->offs)
+        return (l1->offs < l2->offs) ? -1 : 1;
+    return 0;
+}
+
+static lookup_t *
+lookup_find(lookup_t *key)
+{
+    return (lookup_t *) bsearch(key, lookups, num_lookups, sizeof(*lookups),
+                                lookup_cmp);
+}
+
+static void
+symbolize_all(void)
+{
+    uint i, unique;
+    char name[MAX_FUNC_LEN];
+    char file[MAXIMUM_PATH];
+    const char *prev_path = NULL;
+    if (num_lookups == 0)
+        return;
+    /* Sorting groups each module's lookups together and removes duplicates */
+    qsort(lookups, num_lookups, sizeof(*lookups), lookup_cmp);
+    for (i = 1, unique = 1; i < num_lookups; i++) {
+        if (lookup_cmp(&lookups[i], &lookups[unique - 1]) != 0)
+            lookups[unique++] = lookups[i];
+    }
+    num_lookups = unique;
+
+    for (i = 0; i < num_lookups; i++) {
+        lookup_t *l = &lookups[i];
+        const char *path = (l->modid < num_modpaths) ? modpaths[l->modid] : NULL;
+        drsym_info_t sym;
+        drsym_error_t symres;
+        if (path == NULL)
+            continue;
+        if (path != prev_path) {
+            /* We are done with the previous module: keep memory bounded */
+            if (prev_path != NULL)
+                drsym_free_resources(prev_path);
+            prev_path = path;
+        }
+        sym.struct_size = sizeof(sym);
+        sym.name = name;
+        sym.name_size = BUFFER_SIZE_ELEMENTS(name);
+        sym.file = file;
+        sym.file_size = BUFFER_SIZE_ELEMENTS(file);
+        symres = drsym_lookup_address(path, l->offs, &sym, demangle_flags);
+        if (symres == DRSYM_SUCCESS || symres == DRSYM_ERROR_LINE_NOT_AVAILABLE) {
+            l->func = xstrdup(sym.name);
+            l->funcoffs = l->offs - sym.start_offs;
+            if (symres == DRSYM_SUCCESS && sym.file != NULL) {
+                l->file = xstrdup(sym.file);
+                l->line = sym.line;
+            }
+        }
+    }
+    if (prev_path != NULL)
+        drsym_free_resources(prev_path);
+}
+
+/***************************************************************************
+ * Output
+ */
+
+static void
+print_json_string(const char *str)
+{
+    const char *c;
+    fputc('"', out);
+    for (c = str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\')
+            fprintf(out, "\\%c", *c);
+        else if ((unsigned char)*c < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char)*c);
+        else
+            fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+static const char *
+modpath_basename(const char *path)
+{
+    const char *c, *res = path;
+    for (c = path; *c != '\0'; c++) {
+        if (*c == DIRSEP || *c == ALT_DIRSEP)
+            res = c + 1;
+    }
+    return res;
+}
+
+static void
+write_error_json(const char *line)
+{
+    const char *frames, *frames_end, *frame, *frame_end, *copied;
+    frames = error_frames(line, &frames_end);
+    if (frames == NULL) {
+        fprintf(out, "%s\n", line);
+        return;
+    }
+    fwrite(line, 1, frames - line, out);
+    copied = frames;
+    for (frame = next_frame(frames, frames_end, &frame_end); frame != NULL;
+         frame = next_frame(frame_end, frames_end, &frame_end)) {
+        lookup_t key, *l = NULL;
+        if (frame_lookup_key(frame, frame_end, &key))
+            l = lookup_find(&key);
+        /* Everything up to the frame's closing brace */
+        fwrite(copied, 1, frame_end - 1 - copied, out);
+        copied = frame_end - 1;
+        if (l != NULL) {
+            const char *path = modpaths[l->modid];
+            fprintf(out, ",\"module\":");
+            print_json_string(modpath_basename(path));
+            if (l->func != NULL) {
+                fprintf(out, ",\"func\":");
+                print_json_string(l->func);
+                fprintf(out, ",\"funcoffs\":\""SIZE_FMTX"\"", l->funcoffs);
+            }
+            if (l->file != NULL) {
+                fprintf(out, ",\"file\":");
+                print_json_string(l->file);
+                fprintf(out, ",\"line\":%"INT64_FORMAT"u", l->line);
+            }
+        }
+    }
+    fprintf(out, "%s\n", copied);
+}
+
+static void
+write_error_text(const char *line)
+{
+    const char *end = line + strlen(line);
+    const char *frames, *frames_end, *frame, *frame_end;
+    char type[64], access[16], reg[16], msg[1024];
+    uint num = 0;
+    if (!json_string(line, end, "type", type, BUFFER_SIZE_ELEMENTS(type)))
+        type[0] = '\0';
+    fprintf(out, "\n%sError #%d: %s", json_bool(line, end, "potential") ?
+            "Potential " : "", (uint) json_number(line, end, "id", 0), type);
+    if (json_string(line, end, "register", reg, BUFFER_SIZE_ELEMENTS(reg)))
+        fprintf(out, ": reading register %s", reg);
+    else {
+        if (json_string(line, end, "access", access, BUFFER_SIZE_ELEMENTS(access)))
+            fprintf(out, ": %s", access);
+        fprintf(out, " "PFX" %d byte(s)",
+                (ptr_uint_t) json_number(line, end, "addr", 0),
+                (uint) json_number(line, end, "size", 0));
+    }
+    if (json_find(line, end, "indirect_size") != NULL) {
+        fprintf(out, " (%d indirect)",
+                (uint) json_number(line, end, "indirect_size", 0));
+    }
+    if (json_string(line, end, "msg", msg, BUFFER_SIZE_ELEMENTS(msg)))
+        fprintf(out, "%s", msg);
+    fprintf(out, "\n");
+    frames = error_frames(line, &frames_end);
+    if (frames == NULL)
+        return;
+    for (frame = next_frame(frames, frames_end, &frame_end); frame != NULL;
+         frame = next_frame(frame_end, frames_end, &frame_end), num++) {
+        lookup_t key, *l;
+        char buf[64];
+        fprintf(out, "# %2d ", num);
+        if (json_string(frame, frame_end, "syscall", buf, BUFFER_SIZE_ELEMENTS(buf)))
+            fprintf(out, "system call %s\n", buf);
+        else if (!frame_lookup_key(frame, frame_end, &key)) {
+            fprintf(out, "<not in a module> "PFX"\n",
+                    (ptr_uint_t) json_number(frame, frame_end, "pc", 0));
+        } else {
+            size_t offs = (size_t) json_number(frame, frame_end, "offs", 0);
+            l = lookup_find(&key);
+            if (l == NULL) {
+                fprintf(out, "<unknown module %d>+"SIZE_FMTX"\n", key.modid, offs);
+                continue;
+            }
+            fprintf(out, "%s!", modpath_basename(modpaths[l->modid]));
+            if (l->func != NULL)
+                fprintf(out, "%s+"SIZE_FMTX, l->func, l->funcoffs);
+            else
+                fprintf(out, "?+"SIZE_FMTX, offs);
+            if (l->file != NULL)
+                fprintf(out, " [%s:%"INT64_FORMAT"u]", l->file, l->line);
+            fprintf(out, "\n");
+        }
+    }
+}
+
+static void
+write_count_text(const char *line, bool *printed_header)
+{
+    const char *end = line + strlen(line);
+    if (!*printed_header) {
+        fprintf(out, "\nDUPLICATE ERROR COUNTS:\n");
+        *printed_header = true;
+    }
+    fprintf(out, "\t%sError #%3d: %6d\n", json_bool(line, end, "potential") ?
+            "Potential " : "", (uint) json_number(line, end, "id", 0),
+            (uint) json_number(line, end, "count", 0));
+}
+
+static void
+write_suppression_text(const char *line, bool *printed_header)
+{
+    const char *end = line + strlen(line);
+    char name[1024];
+    if (json_bool(line, end, "default") ||
+        !json_string(line, end, "name", name, BUFFER_SIZE_ELEMENTS(name)))
+        return;
+    if (!*printed_header) {
+        fprintf(out, "\nSUPPRESSIONS USED:\n");
+        *printed_header = true;
+    }
+    fprintf(out, "\t%6dx", (uint) json_number(line, end, "count", 0));
+    if (json_number(line, end, "bytes_leaked", 0) > 0) {
+        fprintf(out, " (leaked %7d bytes)",
+                (uint) json_number(line, end, "bytes_leaked", 0));
+    }
+    fprintf(out, ": %s\n", name);
+}
+
+/***************************************************************************
+ * Top level
+ */
+
+/* Returns the file's contents, with each line null-terminated, or NULL */
+static char *
+read_file(const char *path, size_t *size OUT)
+{
+    FILE *f = fopen(path, "rb");
+    char *buf = NULL;
+    size_t sofar = 0, max = 0, len;
+    if (f == NULL)
+        return NULL;
+    do {
+        if (sofar + 1 >= max) {
+            max = (max == 0) ? 64*1024 : max * 2;
+            buf = (char *) xrealloc(buf, max);
+        }
+        len = fread(buf + sofar, 1, max - sofar - 1, f);
+        sofar += len;
+    } while (len > 0);
+    fclose(f);
+    buf[sofar] = '\0';
+    for (len = 0; len < sofar; len++) {
+        if (buf[len] == '\n' || buf[len] == '\r')
+            buf[len] = '\0';
+    }
+    *size = sofar;
+    return buf;
+}
+
+#define FOR_EACH_LINE(line, buf, size) \
+    for (line = buf; line < buf + size; line += strlen(line) + 1)
+
+static bool
+line_is_kind(const char *line, const char *kind)
+{
+    char buf[16];
+    return (json_string(line, line + strlen(line), "kind", buf,
+                        BUFFER_SIZE_ELEMENTS(buf)) &&
+            strcmp(buf, kind) == 0);
+}
+
+int
+_tmain(int argc, TCHAR *targv[])
+{
+    int res = 1;
+    char **argv;
+    int i;
+    const char *inpath = NULL, *outpath = NULL;
+    char *buf, *line;
+    size_t size;
+    bool printed_header = false, printed_supp_header = false;
+
+#if defined(WINDOWS) && !defined(_UNICODE)
+# error _UNICODE must be defined
+#else
+    /* Convert to UTF-8 if necessary */
+    if (drfront_convert_args((const TCHAR **)targv, &argv, argc) != DRFRONT_SUCCESS) {
+        printf("ERROR: failed to process args\n");
+        return 1;
+    }
+#endif
+
+    for (i = 1; i < argc; i++) {
+        if (_stricmp(argv[i], "-text") == 0)
+            text_output = true;
+        else if (_stricmp(argv[i], "-o") == 0 && i + 1 < argc)
+            outpath = argv[++i];
+        else if (argv[i][0] != '-' && inpath == NULL)
+            inpath = argv[i];
+        else {
+            printf(USAGE, argv[0]);
+            goto cleanup;
+        }
+    }
+    if (inpath == NULL) {
+        printf(USAGE, argv[0]);
+        goto cleanup;
+    }
+
+    buf = read_file(inpath, &size);
+    if (buf == NULL) {
+        printf("ERROR: unable to read %s\n", inpath);
+        goto cleanup;
+    }
+    if (outpath == NULL)
+        out = stdout;
+    else {
+        out = fopen(outpath, "w");
+        if (out == NULL) {
+            printf("ERROR: unable to write %s\n", outpath);
+            free(buf);
+            goto cleanup;
+        }
+    }
+
+    dr_standalone_init();
+    if (drsym_init(IF_WINDOWS_ELSE(NULL, 0)) != DRSYM_SUCCESS) {
+        printf("ERROR: unable to initialize symbol library\n");
+        free(buf);
+        goto cleanup;
+    }
+
+    /* Modules may be written after the first error that references them,
+     * so we read everything before symbolizing anything.
+     */
+    FOR_EACH_LINE(line, buf, size) {
+        if (line_is_kind(line, "module"))
+            parse_module(line);
+        else if (line_is_kind(line, "error"))
+            parse_error(line);
+    }
+    symbolize_all();
+    FOR_EACH_LINE(line, buf, size) {
+        if (line_is_kind(line, "error")) {
+            if (text_output)
+                write_error_text(line);
+            else
+                write_error_json(line);
+        } else if (line_is_kind(line, "count")) {
+            if (text_output)
+                write_count_text(line, &printed_header);
+            else
+                fprintf(out, "%s\n", line);
+        } else if (line_is_kind(line, "suppression")) {
+            if (text_output)
+                write_suppression_text(line, &printed_supp_header);
+            else
+                fprintf(out, "%s\n", line);
+        }
+        /* The symbolized frames name their modules, so we drop module records */
+    }
+
+    if (drsym_exit() != DRSYM_SUCCESS)
+        printf("WARNING: error cleaning up symbol library\n");
+    if (out != stdout)
+        fclose(out);
+    free(buf);
+    res = 0;
+
+ cleanup:
+    if (drfront_cleanup_args(argv, argc) != DRFRONT_SUCCESS)
+        printf("WARNING: drfront_cleanup_args failed\n");
+    return res;
+}
@@ -664,6 +664,74 @@ umbra_iterate_shadow_memory(umbra_map_t *map,
     return umbra_iterate_shadow_memory_arch(map, user_data, iter_func);
 }
 
+DR_EXPORT
+drmf_status_t
+umbra_iterate_shadow_range(IN  umbra_map_t *map,
+                           IN  app_pc       app_addr,
+                           IN  size_t       app_size,
+                           IN  void        *user_data,
+                           IN  shadow_range_iterate_func_t iter_func)
+{
+    /* End pointers are closed (i.e., inclusive) to handle overflow (i#1260) */
+    app_pc pc, last, span_last;
+    if (map == NULL || map->magic != UMBRA_MAP_MAGIC) {
+        ASSERT(false, "invalid umbra_map");
+        return DRMF_ERROR_INVALID_PARAMETER;
+    }
+    if (iter_func == NULL)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    if (app_size == 0)
+        return DRMF_SUCCESS;
+    if (POINTER_OVERFLOW_ON_ADD(app_addr, app_size-1)) /* just hitting top is ok */
+        return DRMF_ERROR_INVALID_SIZE;
+    last = app_addr + app_size - 1;
+    pc = app_addr;
+    while (true) {
+        umbra_shadow_memory_info_t info;
+        byte *shadow;
+        ptr_uint_t offs_start, offs_end;
+        drmf_status_t res;
+        umbra_shadow_memory_info_init(&info);
+        res = umbra_get_shadow_memory_arch(map, pc, &shadow, &info);
+        if (res != DRMF_SUCCESS)
+            return res;
+        span_last = info.app_base + (info.app_size - 1);
+        if (span_last > last || span_last < pc/*wrapped*/)
+            span_last = last;
+        offs_start = pc - info.app_base;
+        offs_end = span_last - info.app_base + 1;
+        if (UMBRA_MAP_SCALE_IS_DOWN(map->options.scale))
+            offs_end = ALIGN_FORWARD(offs_end, 1 << map->shift);
+        if (info.shadow_type == UMBRA_SHADOW_MEMORY_TYPE_SHADOW_NOT_ALLOC ||
+            info.shadow_type == UMBRA_SHADOW_MEMORY_TYPE_NOT_SHADOW)
+            shadow = NULL;
+        if (!iter_func(map, pc, span_last - pc + 1, shadow,
+                       umbra_map_scale_app_to_shadow(map, offs_end) -
+                       umbra_map_scale_app_to_shadow(map, offs_start),
+                       info.shadow_type, user_data))
+            break;
+        if (span_last == last)
+            break;
+        pc = span_last + 1;
+    }
+    return DRMF_SUCCESS;
+}
+
+DR_EXPORT
+drmf_status_t
+umbra_get_huge_page_stats(IN  umbra_map_t *map,
+                          OUT uint *num_marked,
+                          OUT uint *num_fallback)
+{
+    if (map == NULL || map->magic != UMBRA_MAP_MAGIC) {
+        ASSERT(false, "invalid umbra_map");
+        return DRMF_ERROR_INVALID_PARAMETER;
+    }
+    if (num_marked == NULL || num_fallback == NULL)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    return umbra_get_huge_page_stats_arch(map, num_marked, num_fallback);
+}
+
 DR_EXPORT
 drmf_status_t
 umbra_get_shadow_memory_type(IN  umbra_map_t *map,
@@ -790,3 +858,34 @@ umbra_get_granularity(const umbra_map_t *map, OUT int *scale, OUT bool *is_scale
 
     return DRMF_SUCCESS;
 }
+
+DR_EXPORT
+drmf_status_t
+umbra_get_map_generation(IN umbra_map_t *map, OUT uint *generation)
+{
+    if (map == NULL || map->magic != UMBRA_MAP_MAGIC) {
+        ASSERT(false, "invalid umbra_map");
+        return DRMF_ERROR_INVALID_PARAMETER;
+    }
+    if (generation == NULL)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    *generation = map->generation;
+    return DRMF_SUCCESS;
+}
+
+DR_EXPORT
+drmf_status_t
+umbra_get_map_offset(IN umbra_map_t *map, IN umbra_map_t *base_map,
+                     OUT ptr_int_t *offset)
+{
+    if (map == NULL || map->magic != UMBRA_MAP_MAGIC ||
+        base_map == NULL || base_map->magic != UMBRA_MAP_MAGIC) {
+        ASSERT(false, "invalid umbra_map");
+        return DRMF_ERROR_INVALID_PARAMETER;
+    }
+    if (offset == NULL)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    if (!umbra_map_compatible(map, base_map))
+        return DRMF_ERROR_INVALID_PARAMETER;
+    return umbra_get_map_offset_arch(map, base_map, offset);
+}
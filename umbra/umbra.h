@@ -118,6 +118,17 @@ typedef enum {
      * exceptions that should be handled by the user.
      */
     UMBRA_MAP_SHADOW_SHARED_READONLY = 0x2,
+    /**
+     * This is an optimization hint for reducing TLB misses on densely
+     * used shadow memory by asking the kernel to back shadow blocks with
+     * transparent huge pages.  Umbra falls back to normal pages if huge
+     * pages are unavailable; umbra_get_huge_page_stats() reports how many
+     * blocks were successfully marked.
+     *
+     * \note: Only supported for the 64-bit Linux implementation; ignored
+     * elsewhere.
+     */
+    UMBRA_MAP_SHADOW_HUGE_PAGES = 0x4,
 } umbra_map_flags_t;
 
 /** Shadow memory creation flags used in umbra_create_shadow_memory. */
@@ -363,8 +374,10 @@ DR_EXPORT
  * and the shadow mapping implementation does not support shadow memory
  * for invalid addresses, returns DRMF_ERROR_INVALID_ADDRESS.
  *
- * \note: part of the shadow memory might not be actually deleted,
- * which will be set to the value specified on \p map creation instead.
+ * \note: For a map created with #UMBRA_MAP_CREATE_SHADOW_ON_TOUCH, the
+ * shadow for each block the range covers entirely is released (or, for
+ * 32-bit, replaced by the shared default block).  The rest of the range
+ * is set to the value specified on \p map creation.
  */
 drmf_status_t
 umbra_delete_shadow_memory(IN  umbra_map_t *map,
@@ -593,6 +606,82 @@ umbra_iterate_shadow_memory(IN  umbra_map_t *map,
                             IN  void  *user_data,
                             IN  shadow_iterate_func_t iter_func);
 
+/**
+ * Callback function type for umbra_iterate_shadow_range().
+ *
+ * @param[in]  map           The mapping object in use.
+ * @param[in]  app_start     The start of this span of application memory.
+ * @param[in]  app_size      The size of this span of application memory.
+ * @param[in]  shadow_start  The shadow memory for \p app_start, or NULL if
+ *                           there is no shadow memory to access directly
+ *                           (UMBRA_SHADOW_MEMORY_TYPE_SHADOW_NOT_ALLOC or
+ *                           UMBRA_SHADOW_MEMORY_TYPE_NOT_SHADOW).
+ * @param[in]  shadow_size   The size of the shadow memory for the span.
+ * @param[in]  shadow_type   The type of the shadow memory for the span.  If
+ *                           UMBRA_SHADOW_MEMORY_TYPE_SHARED is set, \p
+ *                           shadow_start points into a read-only special
+ *                           shared block and must not be written.
+ * @param[in]  user_data     User data passed to umbra_iterate_shadow_range().
+ *
+ * \return false to stop the iteration.
+ */
+typedef bool (*shadow_range_iterate_func_t)(umbra_map_t *map,
+                                            app_pc app_start,
+                                            size_t app_size,
+                                            byte *shadow_start,
+                                            size_t shadow_size,
+                                            umbra_shadow_memory_type_t shadow_type,
+                                            void *user_data);
+
+DR_EXPORT
+/**
+ * Splits the application memory range [\p app_addr, \p app_addr + \p app_size)
+ * into spans that each lie within one shadow memory block and calls
+ * \p iter_func once per span with a pointer to the span's contiguous shadow
+ * memory.  This lets the caller process a whole block with a single
+ * translation rather than calling umbra_read_shadow_memory() or
+ * umbra_write_shadow_memory() repeatedly.
+ *
+ * @param[in]  map        The mapping object to use.
+ * @param[in]  app_addr   The start of the application memory range.
+ * @param[in]  app_size   The size of the application memory range.
+ * @param[in]  user_data  The user data passed to \p iter_func.
+ * @param[in]  iter_func  The iterate callback function.
+ *                        It can return false to stop the iteration.
+ *
+ * \note: shadow memory is not allocated or replaced by this routine: a
+ * caller wanting to write to a span whose shadow is shared or not yet
+ * allocated should use umbra_write_shadow_memory() or
+ * umbra_shadow_set_range() for that span.
+ *
+ * \note: the caller is responsible for any synchronization with other threads
+ * writing the same shadow memory, as for umbra_get_shadow_memory().
+ */
+drmf_status_t
+umbra_iterate_shadow_range(IN  umbra_map_t *map,
+                           IN  app_pc       app_addr,
+                           IN  size_t       app_size,
+                           IN  void        *user_data,
+                           IN  shadow_range_iterate_func_t iter_func);
+
+DR_EXPORT
+/**
+ * Reports how many shadow blocks the mapping \p map has requested
+ * huge-page backing for when created with #UMBRA_MAP_SHADOW_HUGE_PAGES.
+ *
+ * @param[in]  map           The mapping object to use.
+ * @param[out] num_marked    The number of blocks marked for huge pages.
+ * @param[out] num_fallback  The number of blocks left on normal pages
+ *                           because the kernel refused the request.
+ *
+ * \return DRMF_ERROR_FEATURE_NOT_AVAILABLE if huge pages are not supported
+ * on this platform.
+ */
+drmf_status_t
+umbra_get_huge_page_stats(IN  umbra_map_t *map,
+                          OUT uint *num_marked,
+                          OUT uint *num_fallback);
+
 DR_EXPORT
 /**
  * Get shadow memory type for address \p shadow_addr.
@@ -745,7 +834,10 @@ DR_EXPORT
 /**
  * Clears and deletes redundant blocks consisting of only default values for \p map.
  * This function is typically invoked when low on memory. It deletes normal blocks
- * and sets mapping entries to the special basic block.
+ * and sets mapping entries to the special basic block.  On 64-bit, where there
+ * are no special blocks, it frees the blocks, which are recreated with default
+ * values on their next touch.  On 64-bit, a block is also left unallocated
+ * in the first place when it is only ever set to the default value.
  *
  * The number of redundant blocks destroyed is returned via \p count. This is an
  * optional parameter and can be set to NULL if the count is not wanted.
@@ -753,8 +845,8 @@ DR_EXPORT
  * Assumes that threads are suspended so that Umbra may safely modify shadow memory.
  * It is up to the caller to suspend and resume threads.
  *
- * This feature is only available on 32-bit and requires that the
- * create-on-touch optimization (#UMBRA_MAP_CREATE_SHADOW_ON_TOUCH) is enabled.
+ * This feature requires that the create-on-touch optimization
+ * (#UMBRA_MAP_CREATE_SHADOW_ON_TOUCH) is enabled.
  */
 drmf_status_t
 umbra_clear_redundant_blocks(umbra_map_t *map, uint *count);
@@ -776,6 +868,50 @@ drmf_status_t
 umbra_get_granularity(const umbra_map_t *map, OUT int *scale,
                       bool *is_scale_down);
 
+DR_EXPORT
+/**
+ * Returns a counter that changes whenever the map frees a normal shadow
+ * block, so that a caller may cache the #umbra_shadow_memory_info_t of a
+ * #UMBRA_SHADOW_MEMORY_TYPE_NORMAL block across calls and trust it for as
+ * long as the counter is unchanged.  Replacing a shared block with a normal
+ * one does not change the counter, as no normal block goes away.
+ *
+ * Reading the counter does not stop another thread from freeing the block
+ * afterward: the caller must still tolerate the same races as any other
+ * cached shadow address.
+ *
+ * @param[in]  map         The mapping object to use.
+ * @param[out] generation  The current counter value.
+ */
+drmf_status_t
+umbra_get_map_generation(IN umbra_map_t *map, OUT uint *generation);
+
+DR_EXPORT
+/**
+ * Returns the constant distance from the shadow address of any application
+ * address in \p base_map to its shadow address in \p map, so that a client
+ * with several maps can translate an address once with
+ * umbra_insert_app_to_shadow() for \p base_map and reach the shadow of
+ * every other map with a displacement.  All maps of a client use the same
+ * scale and so form one such group.
+ *
+ * Each map still allocates its own shadow memory, so a client using the
+ * offset to access a map's shadow must be prepared for that map's faults
+ * and #UMBRA_MAP_CREATE_SHADOW_ON_TOUCH handling, as for a direct access.
+ *
+ * \note: Only supported for the 64-bit direct mapping, where maps are laid
+ * out at fixed distances.  The 32-bit shadow table allocates each map's
+ * blocks independently, and #DRMF_ERROR_FEATURE_NOT_AVAILABLE is returned.
+ *
+ * @param[in]  map       The mapping object to reach.
+ * @param[in]  base_map  The mapping object whose translation is used.
+ * @param[out] offset    The displacement to add to the \p base_map shadow
+ *                       address.
+ */
+drmf_status_t
+umbra_get_map_offset(IN umbra_map_t *map, IN umbra_map_t *base_map,
+                     OUT ptr_int_t *offset);
+
 /*@}*/ /* end doxygen group */
 
 #ifdef __cplusplus
@@ -685,12 +685,47 @@ umbra_delete_shadow_memory_arch(umbra_map_t *map,
                                 app_pc       app_addr,
                                 size_t       app_size)
 {
-    size_t shadow_size;
-    /* XXX: we can optimize it by replace it with default block */
-    return umbra_shadow_set_range_arch(map, app_addr, app_size,
-                                       &shadow_size,
-                                       map->options.default_value,
-                                       map->options.default_value_size);
+    /* i#1260: end pointers are all closed (i.e., inclusive) to handle overflow */
+    app_pc app_blk_base, app_blk_end, app_src_end;
+    app_pc start, end;
+    size_t size, iter_size;
+    byte  *shadow_blk, *default_blk;
+    if (!TEST(UMBRA_MAP_CREATE_SHADOW_ON_TOUCH, map->options.flags)) {
+        return umbra_shadow_set_range_arch(map, app_addr, app_size, &size,
+                                           map->options.default_value,
+                                           map->options.default_value_size);
+    }
+    if (POINTER_OVERFLOW_ON_ADD(app_addr, app_size-1)) /* just hitting top is ok */
+        return DRMF_ERROR_INVALID_SIZE;
+    /* Whole normal blocks go back to the default block rather than staying
+     * committed with default values, as in umbra_clear_redundant_blocks().
+     */
+    umbra_map_lock(map);
+    default_blk = shadow_table_lookup_special_block(map, map->options.default_value,
+                                                    map->options.default_value_size);
+    APP_RANGE_LOOP(app_addr, app_size, app_blk_base, app_blk_end, app_src_end,
+                   start, end, iter_size, {
+        shadow_blk = shadow_table_get_block(map, SHADOW_TABLE_INDEX(app_blk_base));
+        if (start == app_blk_base && end == app_blk_end && default_blk != NULL &&
+            shadow_table_is_in_normal_block(map, shadow_blk)) {
+            ATOMIC_INC32(map->generation);
+            shadow_table_delete_block(map, shadow_blk);
+            shadow_table_set_block(map, SHADOW_TABLE_INDEX(app_blk_base), default_blk);
+            continue;
+        }
+        if (shadow_table_is_in_default_block(map, shadow_table_app_to_shadow(map, start),
+                                             NULL))
+            continue;
+        if (umbra_shadow_set_range_arch(map, start, iter_size, &size,
+                                        map->options.default_value,
+                                        map->options.default_value_size) !=
+            DRMF_SUCCESS) {
+            umbra_map_unlock(map);
+            return DRMF_ERROR;
+        }
+    });
+    umbra_map_unlock(map);
+    return DRMF_SUCCESS;
 }
 
 drmf_status_t
@@ -1025,6 +1060,27 @@ umbra_get_shadow_memory_type_arch(umbra_map_t *map,
     return DRMF_SUCCESS;
 }
 
+drmf_status_t
+umbra_get_huge_page_stats_arch(umbra_map_t *map, uint *num_marked, uint *num_fallback)
+{
+    /* XXX: UMBRA_MAP_SHADOW_HUGE_PAGES is not implemented for the shadow table */
+    return DRMF_ERROR_FEATURE_NOT_AVAILABLE;
+}
+
+drmf_status_t
+umbra_get_map_offset_arch(umbra_map_t *map, umbra_map_t *base_map, ptr_int_t *offset)
+{
+    /* XXX: each map's blocks come from separate allocations, so there is no
+     * fixed distance between maps.  Allocating a group's blocks together
+     * would provide one, at the cost of the special shared blocks.
+     */
+    if (map == base_map) {
+        *offset = 0;
+        return DRMF_SUCCESS;
+    }
+    return DRMF_ERROR_FEATURE_NOT_AVAILABLE;
+}
+
 drmf_status_t
 umbra_get_shadow_memory_arch(umbra_map_t *map,
                              app_pc app_addr,
@@ -1150,6 +1206,7 @@ umbra_clear_redundant_blocks(umbra_map_t *map, uint *count)
         ASSERT(special_block[0] == (byte)map->options.default_value,
                "default vals not in synch");
         /* Delete block and set entry to refer to special block. */
+        ATOMIC_INC32(map->generation);
         shadow_table_delete_block(map, shadow_data);
         shadow_table_set_block(map, i, special_block);
 
@@ -32,6 +32,11 @@
 #include "../framework/drmf.h"
 #include "utils.h"
 #include <string.h> /* for memchr */
+#ifdef LINUX
+# include "asm_utils.h"
+# include "sysnum_linux.h"
+# include <sys/mman.h> /* for MADV_HUGEPAGE */
+#endif
 
 #ifndef X64
 # error x64 only
@@ -756,6 +761,27 @@ umbra_set_shadow_bitmap(umbra_map_t *map, app_pc shdw_addr)
     }
 }
 
+static void
+umbra_clear_shadow_bitmap(umbra_map_t *map, app_pc shdw_addr)
+{
+    uint i, map_idx = map->index;
+    for (i = 0; i < MAX_NUM_APP_SEGMENTS; i++) {
+        if (app_segments[i].app_used &&
+            app_segments[i].map[map_idx] == map &&
+            app_segments[i].shadow_base[map_idx] <= shdw_addr &&
+            app_segments[i].shadow_end[map_idx]  >  shdw_addr) {
+            uint byte_idx =
+                BITMAP_BYTE_INDEX(map, shdw_addr,
+                                  app_segments[i].shadow_base[map_idx]);
+            uint bit_idx =
+                BITMAP_BIT_INDEX(map, shdw_addr,
+                                 app_segments[i].shadow_base[map_idx]);
+            app_segments[i].shadow_bitmap[map_idx][byte_idx] &= ~(1<<bit_idx);
+            return;
+        }
+    }
+}
+
 static bool
 umbra_shadow_block_exist(umbra_map_t *map, app_pc shdw_addr)
 {
@@ -858,6 +884,17 @@ umbra_map_arch_init(umbra_map_t *map, umbra_map_options_t *ops)
         map->disp += umbra_map_scale_shadow_to_app
             (map, map->index * 2*NUM_SEGMENTS*segment_size(num_seg_bits));
     }
+    /* Scaling distributes over the add only if disp has no bits shifted out */
+    map->mask_bits = 0;
+    if ((map->mask & (map->mask + 1)) == 0 &&
+        (UMBRA_MAP_SCALE_IS_UP(map->options.scale) ||
+         (map->disp & ((1 << map->shift) - 1)) == 0)) {
+        ptr_uint_t m;
+        for (m = map->mask; m != 0; m >>= 1)
+            map->mask_bits++;
+        map->disp_scaled = UMBRA_MAP_SCALE_IS_UP(map->options.scale) ?
+            map->disp << map->shift : map->disp >> map->shift;
+    }
     /* now we add shadow memory segment */
     for (i = 0; i < MAX_NUM_APP_SEGMENTS; i++) {
         if (app_segments[i].app_used &&
@@ -883,6 +920,13 @@ void
 umbra_map_arch_exit(umbra_map_t *map)
 {
     uint i;
+    LOG(1, "umbra map %d: %u blocks allocated, %u default-value block writes "
+        "left unallocated, %u redundant blocks freed\n", map->index,
+        map->num_blocks_alloc, map->num_blocks_dedup, map->num_blocks_freed);
+    if (TEST(UMBRA_MAP_SHADOW_HUGE_PAGES, map->options.flags)) {
+        LOG(1, "umbra map %d: %u blocks marked for huge pages, %u on normal pages\n",
+            map->index, map->num_blocks_huge, map->num_blocks_huge_fallback);
+    }
     umbra_iterate_shadow_memory(map, NULL, umbra_map_shadow_free);
     for (i = 0; i < MAX_NUM_APP_SEGMENTS; i++) {
         if (app_segments[i].app_used && app_segments[i].map[map->index] == map) {
@@ -901,6 +945,52 @@ umbra_map_arch_exit(umbra_map_t *map)
     }
 }
 
+/* Asks for transparent huge pages for a new shadow block.  Adjacent blocks
+ * with the same advice form one mapping, so once a 2MB-aligned range is fully
+ * allocated the kernel can back it with a single huge page.
+ * The caller must hold the map lock.
+ */
+static void
+umbra_shadow_block_request_huge(umbra_map_t *map, byte *block)
+{
+#if defined(LINUX) && defined(MADV_HUGEPAGE)
+    if (raw_syscall(SYS_madvise, 3, (ptr_int_t)block,
+                    (ptr_int_t)map->shadow_block_size, MADV_HUGEPAGE) == 0)
+        map->num_blocks_huge++;
+    else {
+        /* Likely a kernel without THP or with it disabled: normal pages work */
+        if (map->num_blocks_huge_fallback == 0)
+            LOG(1, "umbra map %d: huge pages unavailable for shadow\n", map->index);
+        map->num_blocks_huge_fallback++;
+    }
+#else
+    map->num_blocks_huge_fallback++;
+#endif
+}
+
+drmf_status_t
+umbra_get_huge_page_stats_arch(umbra_map_t *map, uint *num_marked, uint *num_fallback)
+{
+#if defined(LINUX) && defined(MADV_HUGEPAGE)
+    *num_marked = map->num_blocks_huge;
+    *num_fallback = map->num_blocks_huge_fallback;
+    return DRMF_SUCCESS;
+#else
+    return DRMF_ERROR_FEATURE_NOT_AVAILABLE;
+#endif
+}
+
+drmf_status_t
+umbra_get_map_offset_arch(umbra_map_t *map, umbra_map_t *base_map, ptr_int_t *offset)
+{
+    /* The maps share the mask and scale and differ only in disp, whose scaled
+     * difference is a whole number of units (see umbra_map_arch_init()).
+     */
+    *offset = (ptr_int_t)umbra_map_scale_app_to_shadow(map, map->disp) -
+        (ptr_int_t)umbra_map_scale_app_to_shadow(base_map, base_map->disp);
+    return DRMF_SUCCESS;
+}
+
 drmf_status_t
 umbra_create_shadow_memory_arch(umbra_map_t *map,
                                 uint   flags,
@@ -914,6 +1004,14 @@ umbra_create_shadow_memory_arch(umbra_map_t *map,
     app_pc start, end;
     size_t size, iter_size;
     byte  *shadow_blk, *res;
+    /* With create-on-touch, a block we do not allocate reads as the default
+     * value, so when the caller allows a shared block we leave it unallocated
+     * until its first non-default write.
+     */
+    bool lazy_default = TEST(UMBRA_CREATE_SHADOW_SHARED_READONLY, flags) &&
+        TEST(UMBRA_MAP_CREATE_SHADOW_ON_TOUCH, map->options.flags) &&
+        value == map->options.default_value &&
+        value_size == map->options.default_value_size;
 
     if (value_size != 1 || value >= UCHAR_MAX)
         return DRMF_ERROR_FEATURE_NOT_AVAILABLE;
@@ -926,6 +1024,10 @@ umbra_create_shadow_memory_arch(umbra_map_t *map,
     APP_RANGE_LOOP(app_addr, app_size, app_blk_base, app_blk_end, app_src_end,
                    start, end, iter_size, {
         shadow_blk  = (byte *)umbra_xl8_app_to_shadow(map, app_blk_base);
+        if (lazy_default && !umbra_shadow_block_exist(map, shadow_blk)) {
+            ATOMIC_INC32(map->num_blocks_dedup);
+            continue;
+        }
         if (!umbra_shadow_block_exist(map, shadow_blk)) {
             umbra_map_lock(map);
             if (!umbra_shadow_block_exist(map, shadow_blk)) {
@@ -940,6 +1042,9 @@ umbra_create_shadow_memory_arch(umbra_map_t *map,
                     umbra_set_shadow_bitmap(map, res);
                     ASSERT(umbra_shadow_block_exist(map, res),
                            "fail to set shadow bitmap");
+                    map->num_blocks_alloc++;
+                    if (TEST(UMBRA_MAP_SHADOW_HUGE_PAGES, map->options.flags))
+                        umbra_shadow_block_request_huge(map, res);
                 }
             }
             umbra_map_unlock(map);
@@ -959,11 +1064,44 @@ umbra_delete_shadow_memory_arch(umbra_map_t *map,
                                 app_pc       app_addr,
                                 size_t       app_size)
 {
-    size_t shadow_size;
-    return umbra_shadow_set_range_arch(map, app_addr, app_size,
-                                       &shadow_size,
-                                       map->options.default_value,
-                                       map->options.default_value_size);
+    /* i#1260: end pointers are all closed (i.e., inclusive) to handle overflow */
+    app_pc app_blk_base, app_blk_end, app_src_end;
+    app_pc start, end;
+    size_t size, iter_size;
+    byte  *shadow_blk;
+    if (!TEST(UMBRA_MAP_CREATE_SHADOW_ON_TOUCH, map->options.flags)) {
+        return umbra_shadow_set_range_arch(map, app_addr, app_size, &size,
+                                           map->options.default_value,
+                                           map->options.default_value_size);
+    }
+    if (POINTER_OVERFLOW_ON_ADD(app_addr, app_size-1)) /* just hitting top is ok */
+        return DRMF_ERROR_INVALID_SIZE;
+    /* An unallocated block reads as the default value, so rather than writing
+     * the default over whole blocks and leaving them committed we free them.
+     */
+    umbra_map_lock(map);
+    APP_RANGE_LOOP(app_addr, app_size, app_blk_base, app_blk_end, app_src_end,
+                   start, end, iter_size, {
+        shadow_blk = (byte *)umbra_xl8_app_to_shadow(map, app_blk_base);
+        if (!umbra_shadow_block_exist(map, shadow_blk))
+            continue;
+        if (start == app_blk_base && end == app_blk_end) {
+            umbra_clear_shadow_bitmap(map, shadow_blk);
+            ATOMIC_INC32(map->generation);
+            dr_raw_mem_free(shadow_blk, map->shadow_block_size);
+            map->num_blocks_freed++;
+            continue;
+        }
+        if (umbra_shadow_set_range_arch(map, start, iter_size, &size,
+                                        map->options.default_value,
+                                        map->options.default_value_size) !=
+            DRMF_SUCCESS) {
+            umbra_map_unlock(map);
+            return DRMF_ERROR;
+        }
+    });
+    umbra_map_unlock(map);
+    return DRMF_SUCCESS;
 }
 
 drmf_status_t
@@ -1075,10 +1213,19 @@ umbra_shadow_set_range_arch(IN   umbra_map_t *map,
     APP_RANGE_LOOP(app_addr, app_size, app_blk_base, app_blk_end, app_src_end,
                    start, end, iter_size, {
         shadow_start = umbra_xl8_app_to_shadow(map, start);
+        size = umbra_map_scale_app_to_shadow(map, iter_size);
         if (!umbra_shadow_block_exist(map, shadow_start)) {
             drmf_status_t res;
             if (!TEST(UMBRA_MAP_CREATE_SHADOW_ON_TOUCH, map->options.flags))
                 return DRMF_ERROR_INVALID_PARAMETER;
+            if (value == map->options.default_value &&
+                value_size == map->options.default_value_size) {
+                /* An unallocated block already reads as the default */
+                if (iter_size == map->app_block_size)
+                    ATOMIC_INC32(map->num_blocks_dedup);
+                shdw_size += size;
+                continue;
+            }
             res = umbra_create_shadow_memory_arch(map, 0, app_blk_base,
                                                   map->app_block_size,
                                                   map->options.default_value,
@@ -1086,7 +1233,6 @@ umbra_shadow_set_range_arch(IN   umbra_map_t *map,
             if (res != DRMF_SUCCESS)
                 return res;
         }
-        size = umbra_map_scale_app_to_shadow(map, iter_size);
         memset(shadow_start, value, size);
         shdw_size += size;
     });
@@ -1249,8 +1395,16 @@ umbra_num_scratch_regs_for_translation_arch()
     return 0;
 }
 
-/* code sequence:
- *
+/* code sequence, when the mask is contiguous (i.e., always but for an
+ * up-scaled map on Windows):
+ *   shl reg_addr, 64 - mask_bits
+ *   shr reg_addr, 64 - mask_bits +/- shift
+ *   add reg_addr, disp_scaled            (an immediate if it fits, else memory)
+ * which applies the mask and the scale in immediates in one register, and
+ * otherwise:
+ *   and reg_addr, [mask]
+ *   add reg_addr, [disp]
+ *   shr/shl reg_addr, shift
  */
 drmf_status_t
 umbra_insert_app_to_shadow_arch(void *drcontext,
@@ -1261,6 +1415,31 @@ umbra_insert_app_to_shadow_arch(void *drcontext,
                                 reg_id_t *scratch_regs,
                                 int num_scratch_regs)
 {
+    if (map->mask_bits > map->shift && map->mask_bits < 64) {
+        int left = 64 - map->mask_bits;
+        int right = UMBRA_MAP_SCALE_IS_UP(map->options.scale) ?
+            left - map->shift : left + map->shift;
+        PRE(ilist, where, INSTR_CREATE_shl(drcontext,
+                                           opnd_create_reg(reg_addr),
+                                           OPND_CREATE_INT8(left)));
+        if (right > 0) {
+            PRE(ilist, where, INSTR_CREATE_shr(drcontext,
+                                               opnd_create_reg(reg_addr),
+                                               OPND_CREATE_INT8(right)));
+        }
+        if ((ptr_int_t)map->disp_scaled == (int)map->disp_scaled) {
+            PRE(ilist, where, INSTR_CREATE_add(drcontext,
+                                               opnd_create_reg(reg_addr),
+                                               OPND_CREATE_INT32
+                                               ((int)map->disp_scaled)));
+        } else {
+            PRE(ilist, where, INSTR_CREATE_add(drcontext,
+                                               opnd_create_reg(reg_addr),
+                                               OPND_CREATE_ABSMEM(&map->disp_scaled,
+                                                                  OPSZ_PTR)));
+        }
+        return DRMF_SUCCESS;
+    }
     PRE(ilist, where, INSTR_CREATE_and(drcontext,
                                        opnd_create_reg(reg_addr),
                                        OPND_CREATE_ABSMEM(&map->mask,
@@ -1456,9 +1635,62 @@ umbra_handle_fault(void *drcontext, byte *target, dr_mcontext_t *raw_mc,
     return false;
 }
 
+static bool
+umbra_block_is_redundant(umbra_map_t *map, byte *block)
+{
+    size_t i;
+    ptr_uint_t *words = (ptr_uint_t *) block;
+    ptr_uint_t default_word = 0;
+    memset(&default_word, (int)map->options.default_value, sizeof(default_word));
+    for (i = 0; i < map->shadow_block_size / sizeof(ptr_uint_t); i++) {
+        if (words[i] != default_word)
+            return false;
+    }
+    return true;
+}
+
 drmf_status_t
 umbra_clear_redundant_blocks(umbra_map_t *map, uint *count)
 {
-    /* No operation needed for x64. */
-    return DRMF_ERROR_FEATURE_NOT_AVAILABLE;
+    uint i;
+    if (map == NULL)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    if (count != NULL)
+        *count = 0;
+    /* An unallocated block is only recreated with defaults if created on touch */
+    if (!TEST(UMBRA_MAP_CREATE_SHADOW_ON_TOUCH, map->options.flags))
+        return DRMF_ERROR_INVALID_PARAMETER;
+
+    umbra_map_lock(map);
+    for (i = 0; i < MAX_NUM_APP_SEGMENTS; i++) {
+        byte *block;
+        if (!app_segments[i].app_used || app_segments[i].map[map->index] != map)
+            continue;
+        for (block = app_segments[i].shadow_base[map->index];
+             block < app_segments[i].shadow_end[map->index];
+             block += map->shadow_block_size) {
+            uint byte_idx = BITMAP_BYTE_INDEX(map, block,
+                                              app_segments[i].shadow_base[map->index]);
+            /* Skip 8 unallocated blocks at a time */
+            if (app_segments[i].shadow_bitmap[map->index][byte_idx] == 0) {
+                block = app_segments[i].shadow_base[map->index] +
+                    (byte_idx + 1) * map->shadow_block_size * BIT_PER_BYTE -
+                    map->shadow_block_size;
+                continue;
+            }
+            if (!umbra_shadow_block_exist(map, block) ||
+                !umbra_block_is_redundant(map, block))
+                continue;
+            umbra_clear_shadow_bitmap(map, block);
+            ATOMIC_INC32(map->generation);
+            dr_raw_mem_free(block, map->shadow_block_size);
+            map->num_blocks_freed++;
+            if (count != NULL)
+                (*count)++;
+        }
+    }
+    umbra_map_unlock(map);
+    LOG(2, "umbra map %d: freed %u redundant blocks\n", map->index,
+        count == NULL ? 0 : *count);
+    return DRMF_SUCCESS;
 }
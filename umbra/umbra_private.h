@@ -56,6 +56,8 @@ struct _umbra_map_t {
     /* application and shadow block unit size on create/delete */
     size_t app_block_size;
     size_t shadow_block_size;
+    /* Bumped before a normal block is freed, for umbra_get_map_generation() */
+    volatile uint generation;
 
 #ifndef X64
     /* shadow table base mapping */
@@ -71,6 +73,25 @@ struct _umbra_map_t {
 #else
     ptr_uint_t disp;
     ptr_uint_t mask;
+    /* For the inlined translation: if mask is the low mask_bits bits (0 if it
+     * is not contiguous), disp_scaled is disp already scaled by shift so that
+     * the mask and the scale fold into two immediate shifts.
+     */
+    byte mask_bits;
+    ptr_uint_t disp_scaled;
+    /* An unallocated block reads as the default value, which is how we save
+     * memory in place of special shared blocks.  These count the blocks we
+     * allocated, the whole-block default-value writes we skipped instead of
+     * allocating, and the blocks freed by umbra_clear_redundant_blocks().
+     */
+    uint num_blocks_alloc;
+    uint num_blocks_dedup;
+    uint num_blocks_freed;
+    /* For UMBRA_MAP_SHADOW_HUGE_PAGES: blocks marked for huge pages, and those
+     * the kernel refused to mark (e.g., no THP support).
+     */
+    uint num_blocks_huge;
+    uint num_blocks_huge_fallback;
 #endif
     void *lock;
 };
@@ -228,6 +249,12 @@ umbra_get_shadow_memory_type_arch(umbra_map_t *map,
                                   byte *shadow_addr,
                                   umbra_shadow_memory_type_t *shadow_type);
 
+drmf_status_t
+umbra_get_huge_page_stats_arch(umbra_map_t *map, uint *num_marked, uint *num_fallback);
+
+drmf_status_t
+umbra_get_map_offset_arch(umbra_map_t *map, umbra_map_t *base_map, ptr_int_t *offset);
+
 drmf_status_t
 umbra_get_shadow_memory_arch(umbra_map_t *map,
                              app_pc app_addr,